@@ -0,0 +1,443 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* epoll_herd_bench.c
+
+   A quantitative version of multithread_epoll_wait.c: measure the
+   "thundering herd" effect when several threads use epoll to wait for
+   connections on a listening socket, and the techniques that avoid it.
+
+   Usage: epoll_herd_bench [-t nthreads] [-n nconns] [-C nclients] [-v]
+                           [-p port] [mode...]
+
+        -t nthreads  Number of accepting threads (default: 4)
+        -n nconns    Number of connections per mode (default: 5000)
+        -C nclients  Number of client threads, each of which makes one
+                     connection at a time (default: 1)
+        -v           Also display the resource usage of each accepting
+                     thread for each mode (as JSON, from rusageToJson())
+        -p port      Port to listen on (default: 50002)
+
+   The modes (by default, all are measured) are:
+
+        shared       All threads wait on one epoll instance in which the
+                     listening socket is registered (level-triggered)
+        per-thread   Each thread has its own epoll instance, in each of
+                     which the same listening socket is registered: every
+                     connection wakes every thread
+        exclusive    As for per-thread, but registered with EPOLLEXCLUSIVE
+                     (Linux 4.5), so that a connection wakes only one (or
+                     a few) of the threads
+        reuseport    Each thread has its own listening socket, bound to
+                     the same port with SO_REUSEPORT, and its own epoll
+                     instance: the kernel distributes the connections
+        oneshot      As for shared, but registered with EPOLLONESHOT; the
+                     thread that is woken rearms the registration (with
+                     EPOLL_CTL_MOD) after calling accept()
+
+   Note that EPOLLEXCLUSIVE applies to a file descriptor that is
+   registered in several epoll instances, and so can't be used with a
+   single, shared instance; for a shared instance, EPOLLONESHOT serves a
+   similar purpose.
+
+   Each client thread connects to the loopback address, sends the time at
+   which it started to connect, and waits for the server to close the
+   connection. Each accepting thread calls accept() once each time that
+   epoll_wait() reports the listening socket as ready; if accept() fails
+   with EAGAIN (because another thread has already accepted the
+   connection), the wakeup was spurious. (Before epoll_wait() returns,
+   the kernel checks again whether the socket is ready, so that a thread
+   that is woken after another has accepted the connection usually goes
+   back to sleep in the kernel. Such a herd shows up in the context
+   switch counts, rather than as spurious wakeups.)
+
+   For each mode, the program reports the rate of connections, the
+   number of wakeups and spurious wakeups per connection, percentiles of
+   the accept latency (from the start of the client's connect() until the
+   server's accept() returns), the context switches (voluntary plus
+   involuntary, from getrusage(RUSAGE_THREAD)) per connection incurred by
+   the accepting threads, and the share of the connections accepted by
+   the busiest thread.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include "inet_sockets.h"       /* Declares our socket functions */
+#include "print_rusage.h"
+#include "tlpi_hdr.h"
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1U << 28)
+#endif
+
+#define MAX_THREADS 256
+
+enum mode { SHARED, PER_THREAD, EXCLUSIVE, REUSEPORT, ONESHOT };
+
+static const char *modeNames[] = {
+    "shared", "per-thread", "exclusive", "reuseport", "oneshot"
+};
+
+#define NMODES (sizeof(modeNames) / sizeof(modeNames[0]))
+
+struct worker {                 /* Per-accepting-thread state */
+    pthread_t tid;
+    int epfd;
+    int lfd;
+    long accepted;
+    long wakeups;
+    long spurious;
+    double *lat;                /* Accept latency of each connection (us) */
+    struct rusageSnapshot ru0;  /* Resource usage at start of run */
+    struct rusageDelta ru;      /* Resource usage during the run */
+    char pad[64];               /* Keep counters in separate cache lines */
+};
+
+static enum mode mode;
+static int nconns;
+static volatile Boolean stop;
+static long claimed;            /* Connections started by clients */
+static struct sockaddr_storage svaddr;
+static socklen_t svaddrLen;
+
+static double
+nowUs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void *
+workerFunc(void *arg)
+{
+    struct worker *w = arg;
+    struct epoll_event ev;
+    struct rusageSnapshot ru1;
+    struct linger lin;
+    double start;
+    int cfd, ready;
+
+    if (rusageSnap(RUSAGE_THREAD, &w->ru0) == -1)
+        errExit("rusageSnap");
+
+    lin.l_onoff = 1;            /* Close with RST, to avoid filling the */
+    lin.l_linger = 0;           /* port space with TIME_WAIT sockets */
+
+    while (!stop) {
+        ready = epoll_wait(w->epfd, &ev, 1, 100);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("epoll_wait");
+        }
+        if (ready == 0)                 /* Timeout: check 'stop' */
+            continue;
+
+        w->wakeups++;
+        cfd = accept(w->lfd, NULL, NULL);
+        if (cfd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                errExit("accept");
+            w->spurious++;
+        } else {
+
+            /* The client sends the time at which it called connect() */
+
+            if (read(cfd, &start, sizeof(start)) == sizeof(start))
+                w->lat[w->accepted++] = nowUs() - start;
+            if (setsockopt(cfd, SOL_SOCKET, SO_LINGER, &lin,
+                           sizeof(lin)) == -1)
+                errExit("setsockopt-SO_LINGER");
+            close(cfd);
+        }
+
+        if (mode == ONESHOT) {
+            ev.events = EPOLLIN | EPOLLONESHOT;
+            ev.data.fd = w->lfd;
+            if (epoll_ctl(w->epfd, EPOLL_CTL_MOD, w->lfd, &ev) == -1)
+                errExit("epoll_ctl-EPOLL_CTL_MOD");
+        }
+    }
+
+    if (rusageSnap(RUSAGE_THREAD, &ru1) == -1)
+        errExit("rusageSnap");
+    rusageDiff(&w->ru0, &ru1, w->accepted, &w->ru);
+    return NULL;
+}
+
+static void *
+clientFunc(void *arg)
+{
+    double start;
+    char c;
+    int sfd;
+
+    while (__atomic_fetch_add(&claimed, 1, __ATOMIC_RELAXED) < nconns) {
+        sfd = socket(svaddr.ss_family, SOCK_STREAM, 0);
+        if (sfd == -1)
+            errExit("socket");
+
+        start = nowUs();
+        if (connect(sfd, (struct sockaddr *) &svaddr, svaddrLen) == -1)
+            errExit("connect");
+        if (write(sfd, &start, sizeof(start)) != sizeof(start))
+            errExit("write");
+
+        read(sfd, &c, 1);               /* Wait for server to close */
+        close(sfd);
+    }
+    return NULL;
+}
+
+static int
+cmpDouble(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Create a nonblocking listening socket (in the REUSEPORT case, 'nsocks'
+   of them) on 'port', and record the loopback address of the port in
+   'svaddr' for use by the clients */
+
+static void
+makeListeners(const char *port, int lfds[], int nsocks)
+{
+    int j;
+
+    if (nsocks == 1) {
+        lfds[0] = inetListen(port, SOMAXCONN, &svaddrLen);
+        if (lfds[0] == -1)
+            errExit("inetListen");
+    } else {
+        if (inetListenMulti(port, SOMAXCONN, &svaddrLen, lfds, nsocks,
+                            0) == -1)
+            errExit("inetListenMulti");
+    }
+
+    for (j = 0; j < nsocks; j++)
+        if (fcntl(lfds[j], F_SETFL, O_NONBLOCK) == -1)
+            errExit("fcntl");
+
+    svaddrLen = sizeof(svaddr);
+    if (getsockname(lfds[0], (struct sockaddr *) &svaddr, &svaddrLen) == -1)
+        errExit("getsockname");
+    if (svaddr.ss_family == AF_INET6)
+        ((struct sockaddr_in6 *) &svaddr)->sin6_addr = in6addr_loopback;
+    else
+        ((struct sockaddr_in *) &svaddr)->sin_addr.s_addr =
+                htonl(INADDR_LOOPBACK);
+}
+
+static void
+runMode(enum mode m, const char *port, int nthreads, int nclients,
+        Boolean verbose)
+{
+    struct worker *w;
+    struct epoll_event ev;
+    char buf[1024], label[32];
+    pthread_t *clients;
+    int lfds[MAX_THREADS];
+    double start, elapsed, *lat;
+    long total, wakeups, spurious, csw, busiest;
+    int j, s, sharedEpfd;
+
+    mode = m;
+    stop = FALSE;
+    claimed = 0;
+
+    w = calloc(nthreads, sizeof(struct worker));
+    clients = calloc(nclients, sizeof(pthread_t));
+    if (w == NULL || clients == NULL)
+        errExit("calloc");
+
+    makeListeners(port, lfds, (m == REUSEPORT) ? nthreads : 1);
+
+    sharedEpfd = -1;
+    if (m == SHARED || m == ONESHOT) {
+        sharedEpfd = epoll_create1(0);
+        if (sharedEpfd == -1)
+            errExit("epoll_create1");
+        ev.events = EPOLLIN | ((m == ONESHOT) ? EPOLLONESHOT : 0);
+        ev.data.fd = lfds[0];
+        if (epoll_ctl(sharedEpfd, EPOLL_CTL_ADD, lfds[0], &ev) == -1)
+            errExit("epoll_ctl");
+    }
+
+    for (j = 0; j < nthreads; j++) {
+        w[j].lfd = (m == REUSEPORT) ? lfds[j] : lfds[0];
+        if (sharedEpfd != -1) {
+            w[j].epfd = sharedEpfd;
+        } else {
+            w[j].epfd = epoll_create1(0);
+            if (w[j].epfd == -1)
+                errExit("epoll_create1");
+            ev.events = EPOLLIN | ((m == EXCLUSIVE) ? EPOLLEXCLUSIVE : 0);
+            ev.data.fd = w[j].lfd;
+            if (epoll_ctl(w[j].epfd, EPOLL_CTL_ADD, w[j].lfd, &ev) == -1)
+                errExit("epoll_ctl");
+        }
+        w[j].lat = malloc(nconns * sizeof(double));
+        if (w[j].lat == NULL)
+            errExit("malloc");
+
+        s = pthread_create(&w[j].tid, NULL, workerFunc, &w[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    /* Give the accepting threads time to reach epoll_wait() */
+
+    usleep(100000);
+
+    start = nowUs();
+    for (j = 0; j < nclients; j++) {
+        s = pthread_create(&clients[j], NULL, clientFunc, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    for (j = 0; j < nclients; j++) {
+        s = pthread_join(clients[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+    elapsed = (nowUs() - start) / 1e6;
+
+    stop = TRUE;
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_join(w[j].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    /* Merge the per-thread results */
+
+    lat = malloc(nconns * sizeof(double));
+    if (lat == NULL)
+        errExit("malloc");
+    total = wakeups = spurious = busiest = csw = 0;
+    for (j = 0; j < nthreads; j++) {
+        memcpy(&lat[total], w[j].lat, w[j].accepted * sizeof(double));
+        total += w[j].accepted;
+        wakeups += w[j].wakeups;
+        spurious += w[j].spurious;
+        if (w[j].accepted > busiest)
+            busiest = w[j].accepted;
+        csw += w[j].ru.nvcsw + w[j].ru.nivcsw;
+        free(w[j].lat);
+        if (w[j].epfd != sharedEpfd)
+            close(w[j].epfd);
+    }
+
+    if (total == 0)
+        fatal("%s: no connections accepted", modeNames[m]);
+
+    qsort(lat, total, sizeof(double), cmpDouble);
+    printf("%-10s %9.0f %8.2f %8.2f %8.0f %8.0f %8.2f %7.0f%%\n",
+            modeNames[m], total / elapsed, (double) wakeups / total,
+            (double) spurious / total, lat[total / 2],
+            lat[total * 99 / 100], (double) csw / total,
+            100.0 * busiest / total);
+    if (verbose) {
+        for (j = 0; j < nthreads; j++) {
+            snprintf(label, sizeof(label), "%s/%d", modeNames[m], j);
+            rusageToJson(buf, sizeof(buf), label, &w[j].ru);
+            printf("        %s\n", buf);
+        }
+    }
+
+    if (sharedEpfd != -1)
+        close(sharedEpfd);
+    for (j = 0; j < ((m == REUSEPORT) ? nthreads : 1); j++)
+        close(lfds[j]);
+    free(lat);
+    free(clients);
+    free(w);
+}
+
+static void
+usageError(const char *progName)
+{
+    int m;
+
+    fprintf(stderr, "Usage: %s [-t nthreads] [-n nconns] [-C nclients] [-v] "
+                    "[-p port] [mode...]\n", progName);
+    fprintf(stderr, "Modes:");
+    for (m = 0; m < NMODES; m++)
+        fprintf(stderr, " %s", modeNames[m]);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    Boolean selected[NMODES], verbose;
+    int opt, nthreads, nclients, m, j;
+    char *port;
+
+    nthreads = 4;
+    nconns = 5000;
+    nclients = 1;
+    verbose = FALSE;
+    port = "50002";
+    while ((opt = getopt(argc, argv, "t:n:C:vp:")) != -1) {
+        switch (opt) {
+        case 't':   nthreads = getInt(optarg, GN_GT_0, "nthreads");     break;
+        case 'n':   nconns = getInt(optarg, GN_GT_0, "nconns");         break;
+        case 'C':   nclients = getInt(optarg, GN_GT_0, "nclients");     break;
+        case 'v':   verbose = TRUE;                                     break;
+        case 'p':   port = optarg;                                      break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (nthreads > MAX_THREADS)
+        cmdLineErr("nthreads must be at most %d\n", MAX_THREADS);
+
+    for (m = 0; m < NMODES; m++)
+        selected[m] = (optind == argc);
+    for (j = optind; j < argc; j++) {
+        for (m = 0; m < NMODES; m++)
+            if (strcmp(argv[j], modeNames[m]) == 0)
+                break;
+        if (m == NMODES)
+            usageError(argv[0]);
+        selected[m] = TRUE;
+    }
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+    setbuf(stdout, NULL);
+
+    printf("%d accepting threads, %d client threads, %d connections\n",
+            nthreads, nclients, nconns);
+    printf("%-10s %9s %8s %8s %8s %8s %8s %8s\n", "mode", "conns/s",
+            "wake/c", "spur/c", "p50-us", "p99-us", "csw/c", "busiest");
+    for (m = 0; m < NMODES; m++)
+        if (selected[m])
+            runMode(m, port, nthreads, nclients, verbose);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,385 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* ev_deadline.c
+
+   I/O operations with deadlines, for programs built on event_loop.c.
+
+   timed_read.c places a timeout on a blocking read() by arranging for
+   SIGALRM to interrupt it. That requires a signal handler, the signal
+   is directed at the process (so that only one such timeout can be
+   pending, and it interrupts whichever thread receives it), and each
+   operation costs two setitimer() calls (via alarm()). Here, instead,
+   each operation is started by evDlRead(), evDlWrite(), or
+   evDlConnect() on a nonblocking descriptor, with a timeout, and
+   completes by invoking a callback with either the result of the system
+   call, or -ETIMEDOUT. The deadlines are timers in a timing wheel
+   (timer_wheel.c), which are driven by a single timerfd that is
+   monitored by the event loop, so that starting and completing an
+   operation costs no system calls for its deadline (the timerfd is
+   rearmed only when the earliest pending deadline changes), and
+   thousands of operations may be pending at once.
+
+   The descriptors are registered with the loop, with evAddFd(), by
+   this module, so that the caller must not register them itself. One
+   read and one write (or connect) operation may be pending on each
+   descriptor. Call evDlCancel() (which cancels any pending operations,
+   without invoking their callbacks) before closing a descriptor. The
+   timerfd is registered with the loop only while deadlines are pending,
+   so that evRun() returns once all operations have completed.
+
+   Deadlines are measured in ticks of 'tickMs' milliseconds, and an
+   operation times out up to one tick after its deadline. A timeout of
+   -1 means no deadline.
+
+   Functions return 0 on success, or -1 with errno set on error.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "timer_wheel.h"
+#include "ev_deadline.h"        /* Declares functions defined here */
+
+enum opKind { OP_NONE, OP_READ, OP_WRITE, OP_CONNECT };
+
+struct dlOp {                   /* A pending operation */
+    struct twTimer timer;       /* Its deadline */
+    struct evDeadlines *dl;
+    int fd;
+    enum opKind kind;
+    void *buf;
+    size_t len;
+    evDlCallback cb;
+    void *arg;
+};
+
+struct dlFd {                   /* Allocated separately for each descriptor,
+                                   since the wheel links its timers */
+    struct dlOp rd;             /* OP_READ */
+    struct dlOp wr;             /* OP_WRITE or OP_CONNECT */
+    int events;                 /* Events registered with the loop */
+};
+
+struct evDeadlines {
+    struct evLoop *loop;
+    struct timerWheel tw;
+    int twRegistered;           /* Is 'tw.fd' registered with the loop? */
+    struct dlFd **fds;          /* Indexed by file descriptor */
+    int nfds;
+    struct evDlStats stats;
+};
+
+static void fdReady(struct evLoop *loop, int fd, int events, void *arg);
+static void wheelReady(struct evLoop *loop, int fd, int events, void *arg);
+
+/* Register 'fd' with the loop for the events needed by its pending
+   operations (if any) */
+
+static int
+syncFd(struct evDeadlines *dl, int fd)
+{
+    struct dlFd *f = dl->fds[fd];
+    int events, s;
+
+    events = ((f->rd.kind != OP_NONE) ? EV_READ : 0) |
+             ((f->wr.kind != OP_NONE) ? EV_WRITE : 0);
+    if (events == f->events)
+        return 0;
+
+    if (events == 0)
+        s = evDelFd(dl->loop, fd);
+    else if (f->events == 0)
+        s = evAddFd(dl->loop, fd, events, fdReady, dl);
+    else
+        s = evModFd(dl->loop, fd, events);
+    if (s == 0)
+        f->events = events;
+    return s;
+}
+
+/* Register or unregister the timerfd, so that it is monitored only
+   while there are deadlines */
+
+static int
+syncWheel(struct evDeadlines *dl)
+{
+    if (dl->tw.count > 0 && !dl->twRegistered) {
+        if (evAddFd(dl->loop, dl->tw.fd, EV_READ, wheelReady, dl) == -1)
+            return -1;
+        dl->twRegistered = 1;
+    } else if (dl->tw.count == 0 && dl->twRegistered) {
+        if (evDelFd(dl->loop, dl->tw.fd) == -1)
+            return -1;
+        dl->twRegistered = 0;
+    }
+    return 0;
+}
+
+static void
+wheelReady(struct evLoop *loop, int fd, int events, void *arg)
+{
+    struct evDeadlines *dl = arg;
+
+    twProcess(&dl->tw);
+    syncWheel(dl);
+}
+
+/* Finish 'op' with result 'res' */
+
+static void
+complete(struct dlOp *op, ssize_t res)
+{
+    struct evDeadlines *dl = op->dl;
+
+    twCancel(&dl->tw, &op->timer);
+    op->kind = OP_NONE;
+    syncFd(dl, op->fd);
+    syncWheel(dl);
+
+    if (res == -ETIMEDOUT)
+        dl->stats.timedOut++;
+    else
+        dl->stats.completed++;
+    op->cb(dl, op->fd, res, op->arg);   /* May start another operation */
+}
+
+/* Attempt 'op', which the loop has reported is ready */
+
+static void
+attempt(struct dlOp *op)
+{
+    ssize_t res;
+    socklen_t optlen;
+    int err;
+
+    switch (op->kind) {
+    case OP_READ:
+        res = read(op->fd, op->buf, op->len);
+        break;
+    case OP_WRITE:
+        res = write(op->fd, op->buf, op->len);
+        break;
+    case OP_CONNECT:
+        optlen = sizeof(err);
+        if (getsockopt(op->fd, SOL_SOCKET, SO_ERROR, &err, &optlen) == -1)
+            err = errno;
+        res = (err == 0) ? 0 : -1;
+        errno = err;
+        break;
+    default:
+        return;
+    }
+
+    if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                      errno == EINTR))
+        return;                 /* Spurious readiness; keep waiting */
+    complete(op, (res == -1) ? -errno : res);
+}
+
+static void
+fdReady(struct evLoop *loop, int fd, int events, void *arg)
+{
+    struct evDeadlines *dl = arg;
+    struct dlFd *f = dl->fds[fd];
+
+    if ((events & EV_READ) && f->rd.kind != OP_NONE)
+        attempt(&f->rd);
+    if ((events & EV_WRITE) && f->wr.kind != OP_NONE)
+        attempt(&f->wr);
+}
+
+static void
+deadlineExpired(struct twTimer *timer, void *arg)
+{
+    complete(arg, -ETIMEDOUT);
+}
+
+/* Create a deadline manager for 'loop', with deadlines measured in
+   ticks of 'tickMs' milliseconds. Returns a pointer to the manager, or
+   NULL on error. */
+
+struct evDeadlines *
+evDlCreate(struct evLoop *loop, long tickMs)
+{
+    struct evDeadlines *dl;
+
+    if (tickMs <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    dl = calloc(1, sizeof(struct evDeadlines));
+    if (dl == NULL)
+        return NULL;
+    dl->loop = loop;
+    if (twInit(&dl->tw, tickMs * 1000000L) == -1) {
+        free(dl);
+        return NULL;
+    }
+    return dl;
+}
+
+/* Start an operation of kind 'kind' on 'fd' */
+
+static int
+startOp(struct evDeadlines *dl, int fd, enum opKind kind, void *buf,
+        size_t len, long timeoutMs, evDlCallback cb, void *arg)
+{
+    struct dlFd **fds, *f;
+    struct dlOp *op;
+    int n;
+
+    if (fd < 0 || cb == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (fd >= dl->nfds) {
+        n = (fd + 1 > 2 * dl->nfds) ? fd + 1 : 2 * dl->nfds;
+        fds = realloc(dl->fds, n * sizeof(struct dlFd *));
+        if (fds == NULL)
+            return -1;
+        memset(fds + dl->nfds, 0, (n - dl->nfds) * sizeof(struct dlFd *));
+        dl->fds = fds;
+        dl->nfds = n;
+    }
+    if (dl->fds[fd] == NULL) {
+        dl->fds[fd] = calloc(1, sizeof(struct dlFd));
+        if (dl->fds[fd] == NULL)
+            return -1;
+        twTimerInit(&dl->fds[fd]->rd.timer, deadlineExpired,
+                    &dl->fds[fd]->rd);
+        twTimerInit(&dl->fds[fd]->wr.timer, deadlineExpired,
+                    &dl->fds[fd]->wr);
+    }
+    f = dl->fds[fd];
+
+    op = (kind == OP_READ) ? &f->rd : &f->wr;
+    if (op->kind != OP_NONE) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    op->kind = kind;
+    if (syncFd(dl, fd) == -1) {
+        op->kind = OP_NONE;
+        return -1;
+    }
+
+    op->dl = dl;
+    op->fd = fd;
+    op->buf = buf;
+    op->len = len;
+    op->cb = cb;
+    op->arg = arg;
+    if (timeoutMs >= 0) {
+        if (twAdd(&dl->tw, &op->timer, timeoutMs * 1000000LL) == -1 ||
+                syncWheel(dl) == -1) {
+            twCancel(&dl->tw, &op->timer);
+            op->kind = OP_NONE;
+            syncFd(dl, fd);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Read up to 'len' bytes from 'fd' into 'buf' once 'fd' is readable, or
+   fail with ETIMEDOUT after 'timeoutMs' milliseconds */
+
+int
+evDlRead(struct evDeadlines *dl, int fd, void *buf, size_t len,
+         long timeoutMs, evDlCallback cb, void *arg)
+{
+    return startOp(dl, fd, OP_READ, buf, len, timeoutMs, cb, arg);
+}
+
+/* Write up to 'len' bytes from 'buf' to 'fd' once 'fd' is writable, or
+   fail with ETIMEDOUT after 'timeoutMs' milliseconds */
+
+int
+evDlWrite(struct evDeadlines *dl, int fd, const void *buf, size_t len,
+          long timeoutMs, evDlCallback cb, void *arg)
+{
+    return startOp(dl, fd, OP_WRITE, (void *) buf, len, timeoutMs, cb, arg);
+}
+
+/* Connect the nonblocking socket 'fd' to 'addr'. The callback receives
+   0 once the connection is established, or a negated errno value
+   (-ETIMEDOUT after 'timeoutMs' milliseconds). Errors detected at once
+   (e.g., ENETUNREACH) are returned by evDlConnect() itself. */
+
+int
+evDlConnect(struct evDeadlines *dl, int fd, const struct sockaddr *addr,
+            socklen_t addrlen, long timeoutMs, evDlCallback cb, void *arg)
+{
+    /* Whether the connection is established at once, or is in progress,
+       the socket becomes writable when the outcome is known */
+
+    if (connect(fd, addr, addrlen) == -1 && errno != EINPROGRESS)
+        return -1;
+    return startOp(dl, fd, OP_CONNECT, NULL, 0, timeoutMs, cb, arg);
+}
+
+/* Cancel the operations pending on 'fd', without invoking their
+   callbacks, and remove 'fd' from the loop */
+
+int
+evDlCancel(struct evDeadlines *dl, int fd)
+{
+    struct dlFd *f;
+
+    if (fd < 0 || fd >= dl->nfds || dl->fds[fd] == NULL)
+        return 0;
+    f = dl->fds[fd];
+
+    twCancel(&dl->tw, &f->rd.timer);
+    twCancel(&dl->tw, &f->wr.timer);
+    f->rd.kind = f->wr.kind = OP_NONE;
+    if (syncFd(dl, fd) == -1)
+        return -1;
+    return syncWheel(dl);
+}
+
+void
+evDlGetStats(const struct evDeadlines *dl, struct evDlStats *stats)
+{
+    *stats = dl->stats;
+    stats->wakeups = dl->tw.wakeups;
+}
+
+/* Free the manager; pending operations are abandoned (their descriptors
+   and the timerfd are removed from the loop) */
+
+void
+evDlDestroy(struct evDeadlines *dl)
+{
+    int fd;
+
+    for (fd = 0; fd < dl->nfds; fd++) {
+        if (dl->fds[fd] != NULL) {
+            if (dl->fds[fd]->events != 0)
+                evDelFd(dl->loop, fd);
+            free(dl->fds[fd]);
+        }
+    }
+    if (dl->twRegistered)
+        evDelFd(dl->loop, dl->tw.fd);
+    twDestroy(&dl->tw);
+    free(dl->fds);
+    free(dl);
+}
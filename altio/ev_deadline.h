@@ -0,0 +1,58 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* ev_deadline.h
+
+   Header file for ev_deadline.c.
+*/
+#ifndef EV_DEADLINE_H
+#define EV_DEADLINE_H           /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "event_loop.h"
+
+struct evDeadlines;             /* Opaque */
+
+/* Invoked when an operation completes: 'res' is the value that read()
+   or write() would have returned (0 for a successful connect()), or,
+   on error, the negated errno value; -ETIMEDOUT if the deadline
+   passed */
+
+typedef void (*evDlCallback)(struct evDeadlines *dl, int fd, ssize_t res,
+                             void *arg);
+
+struct evDlStats {
+    unsigned long completed;    /* Operations that completed in time */
+    unsigned long timedOut;     /* Operations that reached their deadline */
+    unsigned long wakeups;      /* Expirations of the timerfd */
+};
+
+struct evDeadlines *evDlCreate(struct evLoop *loop, long tickMs);
+
+void evDlDestroy(struct evDeadlines *dl);
+
+int evDlRead(struct evDeadlines *dl, int fd, void *buf, size_t len,
+             long timeoutMs, evDlCallback cb, void *arg);
+
+int evDlWrite(struct evDeadlines *dl, int fd, const void *buf, size_t len,
+              long timeoutMs, evDlCallback cb, void *arg);
+
+int evDlConnect(struct evDeadlines *dl, int fd, const struct sockaddr *addr,
+                socklen_t addrlen, long timeoutMs, evDlCallback cb,
+                void *arg);
+
+int evDlCancel(struct evDeadlines *dl, int fd);
+
+void evDlGetStats(const struct evDeadlines *dl, struct evDlStats *stats);
+
+#endif
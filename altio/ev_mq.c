@@ -0,0 +1,523 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* ev_mq.c
+
+   Serve many POSIX message queues from one thread, as part of an event
+   loop (event_loop.c). Unlike select_mq.c, which needs a child process
+   per (System V) queue and is limited to FD_SETSIZE descriptors, this
+   relies on the fact that, on Linux, a message queue descriptor is a
+   file descriptor that can be monitored with epoll.
+
+   evMqSetCreate() creates a set of queues, to which evMqAdd() adds queue
+   descriptors; each message taken from a queue is passed to the callback
+   given when the queue was added. The queues of a set are monitored by
+   an epoll instance of the set's own, whose descriptor is in turn
+   registered with the loop, so that the loop sees only one descriptor,
+   however many queues there are. When that descriptor is ready, the set
+   fetches (with epoll_wait() and a zero timeout) the list of queues that
+   have messages, and takes messages from them with nonblocking
+   mq_receive() calls until each is empty (EAGAIN).
+
+   Messages are delivered in priority order across the whole set, not
+   just within each queue: the set holds the first message of each
+   nonempty queue, and always delivers the held message with the highest
+   priority. Among queues whose first messages have the same priority,
+   the queue served least recently is served first, so that a busy queue
+   can't starve the others. So that system calls are amortized, up to
+   'batch' messages are taken from a queue in turn, as long as none of
+   the other held messages has a higher priority. (Since the set holds a
+   message from each queue before it has been delivered, a message with a
+   high priority that arrives on a queue can wait behind at most one held
+   message of that queue.)
+
+   At most 'budget' messages are delivered each time the loop services
+   the set, so that the loop's other descriptors are not starved either;
+   if messages remain, the set makes its epoll descriptor ready again
+   (by writing to an eventfd that it monitors), so that the loop returns
+   to it on the next iteration.
+
+   evMqAdd() sets the O_NONBLOCK flag of the queue description (which is
+   shared by duplicates of the descriptor, including those in child
+   processes); evMqDel() restores it. The caller remains responsible for
+   closing the queue descriptor, which should be done only after it has
+   been removed from the set. Callbacks may add and remove queues,
+   including the one being served.
+
+   Functions return 0 (or, for evMqAdd(), a queue ID) on success, and -1
+   with errno set on error.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "ev_mq.h"              /* Declares functions defined here */
+
+#define WAKE_ID UINT32_MAX      /* epoll data for the set's eventfd */
+
+struct evMq {                   /* State for one queue */
+    mqd_t mqd;                  /* -1 if this slot is unused */
+    evMqCallback cb;
+    void *arg;
+    long origFlags;             /* mq_flags when added */
+    char *buf;                  /* Holds one message (mq_msgsize bytes) */
+    size_t bufLen;
+    ssize_t len;                /* Length of held message, or -1 if none */
+    unsigned int prio;          /* Priority of held message */
+    unsigned long long served;  /* When last served (from 'clock') */
+    int heapIdx;                /* Position in 'heap', or -1 */
+};
+
+struct evMqSet {
+    struct evLoop *loop;
+    int epfd;                   /* Monitors the queues and 'evfd' */
+    int evfd;                   /* Written to make 'epfd' ready */
+    int wakePending;            /* Has 'evfd' been written? */
+    int batch;
+    int budget;
+    struct evMq *qs;            /* Indexed by queue ID */
+    int nqs;                    /* Number of elements in 'qs' */
+    int *heap;                  /* Queue IDs of held messages, as a heap
+                                   ordered by mqBefore() */
+    int heapLen;
+    struct epoll_event *evlist;
+    int evlistLen;              /* Equals 'nqs' + 1 */
+    unsigned long long clock;
+    struct evMqStats stats;
+};
+
+/* Should the held message of 'a' be delivered before that of 'b'? */
+
+static int
+mqBefore(const struct evMqSet *set, int a, int b)
+{
+    const struct evMq *qa = &set->qs[a], *qb = &set->qs[b];
+
+    if (qa->prio != qb->prio)
+        return qa->prio > qb->prio;
+    return qa->served < qb->served;
+}
+
+static void
+heapSet(struct evMqSet *set, int idx, int qid)
+{
+    set->heap[idx] = qid;
+    set->qs[qid].heapIdx = idx;
+}
+
+static void
+heapUp(struct evMqSet *set, int idx)
+{
+    int qid = set->heap[idx];
+
+    while (idx > 0 && mqBefore(set, qid, set->heap[(idx - 1) / 2])) {
+        heapSet(set, idx, set->heap[(idx - 1) / 2]);
+        idx = (idx - 1) / 2;
+    }
+    heapSet(set, idx, qid);
+}
+
+static void
+heapDown(struct evMqSet *set, int idx)
+{
+    int qid = set->heap[idx];
+    int child;
+
+    for (;;) {
+        child = 2 * idx + 1;
+        if (child >= set->heapLen)
+            break;
+        if (child + 1 < set->heapLen &&
+                mqBefore(set, set->heap[child + 1], set->heap[child]))
+            child++;
+        if (!mqBefore(set, set->heap[child], qid))
+            break;
+        heapSet(set, idx, set->heap[child]);
+        idx = child;
+    }
+    heapSet(set, idx, qid);
+}
+
+static void
+heapPush(struct evMqSet *set, int qid)
+{
+    set->heap[set->heapLen++] = qid;
+    heapUp(set, set->heapLen - 1);
+}
+
+static void
+heapRemove(struct evMqSet *set, int qid)
+{
+    int idx = set->qs[qid].heapIdx;
+    int moved;
+
+    set->qs[qid].heapIdx = -1;
+    set->heapLen--;
+    if (idx == set->heapLen)
+        return;
+
+    /* Move the last element into the gap, and restore the heap order */
+
+    moved = set->heap[set->heapLen];
+    heapSet(set, idx, moved);
+    heapUp(set, idx);
+    heapDown(set, set->qs[moved].heapIdx);
+}
+
+/* Take the next message from queue 'qid' into its buffer, if it doesn't
+   already hold one. Returns 1 if the queue holds a message, 0 if the
+   queue is empty, or -1 on error. */
+
+static int
+fillQueue(struct evMqSet *set, int qid)
+{
+    struct evMq *q = &set->qs[qid];
+    ssize_t len;
+
+    if (q->len >= 0)
+        return 1;
+
+    do {
+        len = mq_receive(q->mqd, q->buf, q->bufLen, &q->prio);
+    } while (len == -1 && errno == EINTR);
+
+    if (len == -1) {
+        if (errno != EAGAIN)
+            return -1;
+        set->stats.emptyReads++;
+        return 0;
+    }
+    q->len = len;
+    return 1;
+}
+
+/* Remove queue 'qid', after an error, and tell its callback */
+
+static void
+failQueue(struct evMqSet *set, int qid, int err)
+{
+    evMqCallback cb = set->qs[qid].cb;
+    void *arg = set->qs[qid].arg;
+
+    evMqDel(set, qid);
+    cb(set, qid, NULL, -err, 0, arg);
+}
+
+/* Called by the loop when the set's epoll descriptor is ready: collect
+   the queues that have become nonempty, and then deliver up to 'budget'
+   messages in priority order */
+
+static void
+serviceSet(struct evLoop *loop, int fd, int events, void *arg)
+{
+    struct evMqSet *set = arg;
+    struct evMq *q;
+    unsigned int prio;
+    uint64_t val;
+    ssize_t len;
+    int n, j, qid, run, delivered, s;
+
+    set->stats.passes++;
+
+    /* Since callbacks (called from failQueue()) may add queues, we must
+       index 'set->evlist' afresh on each iteration; its contents survive
+       reallocation */
+
+    n = epoll_wait(set->epfd, set->evlist, set->evlistLen, 0);
+    for (j = 0; j < n; j++) {
+        if (set->evlist[j].data.u32 == WAKE_ID) {
+            if (read(set->evfd, &val, sizeof(val)) == sizeof(val))
+                set->wakePending = 0;
+            continue;
+        }
+
+        qid = set->evlist[j].data.u32;
+        if (set->qs[qid].mqd == (mqd_t) -1)     /* Removed meanwhile */
+            continue;
+        if (set->qs[qid].len >= 0)              /* Already held */
+            continue;
+        s = fillQueue(set, qid);
+        if (s == 1)
+            heapPush(set, qid);
+        else if (s == -1)
+            failQueue(set, qid, errno);
+    }
+
+    /* Serve the queue whose held message has the highest priority, taking
+       up to 'batch' messages from it as long as no other queue holds a
+       message of higher priority */
+
+    for (delivered = 0; delivered < set->budget && set->heapLen > 0; ) {
+        qid = set->heap[0];
+        heapRemove(set, qid);
+
+        for (run = 0; ; ) {
+            q = &set->qs[qid];
+            len = q->len;
+            prio = q->prio;
+            q->len = -1;
+            q->served = ++set->clock;
+            q->cb(set, qid, q->buf, len, prio, q->arg);
+            set->stats.msgs++;
+            delivered++;
+            run++;
+
+            q = &set->qs[qid];          /* 'qs' may have been reallocated */
+            if (q->mqd == (mqd_t) -1)   /* Callback removed the queue */
+                break;
+
+            s = fillQueue(set, qid);
+            if (s == -1) {
+                failQueue(set, qid, errno);
+                break;
+            }
+            if (s == 0)
+                break;
+
+            if (run >= set->batch || delivered >= set->budget ||
+                    (set->heapLen > 0 &&
+                     set->qs[set->heap[0]].prio > q->prio)) {
+                heapPush(set, qid);
+                break;
+            }
+        }
+    }
+
+    /* Held messages remain: make sure that the loop comes back to us,
+       even if no more messages arrive */
+
+    if (set->heapLen > 0 && !set->wakePending) {
+        val = 1;
+        if (write(set->evfd, &val, sizeof(val)) == sizeof(val))
+            set->wakePending = 1;
+    }
+}
+
+/* Create a set of queues, to be served by 'loop'. Up to 'batch' messages
+   are taken from a queue in turn, and up to 'budget' messages are
+   delivered each time the loop services the set. Returns a pointer to
+   the set, or NULL on error. */
+
+struct evMqSet *
+evMqSetCreate(struct evLoop *loop, int batch, int budget)
+{
+    struct evMqSet *set;
+    struct epoll_event ev;
+    int savedErrno;
+
+    if (batch <= 0 || budget <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    set = calloc(1, sizeof(struct evMqSet));
+    if (set == NULL)
+        return NULL;
+    set->loop = loop;
+    set->batch = batch;
+    set->budget = budget;
+    set->epfd = set->evfd = -1;
+
+    set->evlistLen = 1;
+    set->evlist = malloc(sizeof(struct epoll_event));
+    if (set->evlist == NULL)
+        goto fail;
+
+    set->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (set->epfd == -1)
+        goto fail;
+    set->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (set->evfd == -1)
+        goto fail;
+
+    ev.events = EPOLLIN;
+    ev.data.u32 = WAKE_ID;
+    if (epoll_ctl(set->epfd, EPOLL_CTL_ADD, set->evfd, &ev) == -1)
+        goto fail;
+
+    if (evAddFd(loop, set->epfd, EV_READ, serviceSet, set) == -1)
+        goto fail;
+
+    return set;
+
+fail:
+    savedErrno = errno;
+    if (set->epfd != -1)
+        close(set->epfd);
+    if (set->evfd != -1)
+        close(set->evfd);
+    free(set->evlist);
+    free(set);
+    errno = savedErrno;
+    return NULL;
+}
+
+/* Remove all queues from 'set' (restoring their flags), and free it */
+
+void
+evMqSetDestroy(struct evMqSet *set)
+{
+    int qid;
+
+    for (qid = 0; qid < set->nqs; qid++)
+        if (set->qs[qid].mqd != (mqd_t) -1)
+            evMqDel(set, qid);
+
+    evDelFd(set->loop, set->epfd);
+    close(set->epfd);
+    close(set->evfd);
+    free(set->qs);
+    free(set->heap);
+    free(set->evlist);
+    free(set);
+}
+
+/* Enlarge the arrays of 'set', so that there is an unused queue slot */
+
+static int
+growSet(struct evMqSet *set)
+{
+    struct epoll_event *evlist;
+    struct evMq *qs;
+    int *heap;
+    int n, qid;
+
+    n = (set->nqs == 0) ? 16 : 2 * set->nqs;
+
+    /* If a later allocation fails, the earlier arrays are simply larger
+       than necessary */
+
+    qs = realloc(set->qs, n * sizeof(struct evMq));
+    if (qs == NULL)
+        return -1;
+    set->qs = qs;
+    heap = realloc(set->heap, n * sizeof(int));
+    if (heap == NULL)
+        return -1;
+    set->heap = heap;
+    evlist = realloc(set->evlist, (n + 1) * sizeof(struct epoll_event));
+    if (evlist == NULL)
+        return -1;
+    set->evlist = evlist;
+
+    for (qid = set->nqs; qid < n; qid++) {
+        memset(&set->qs[qid], 0, sizeof(struct evMq));
+        set->qs[qid].mqd = (mqd_t) -1;
+        set->qs[qid].len = -1;
+        set->qs[qid].heapIdx = -1;
+    }
+    set->nqs = n;
+    set->evlistLen = n + 1;
+    return 0;
+}
+
+/* Add the queue 'mqd' to 'set'; 'cb' is called with each message taken
+   from the queue. Returns an ID for the queue (the lowest unused), or -1
+   on error. */
+
+int
+evMqAdd(struct evMqSet *set, mqd_t mqd, evMqCallback cb, void *arg)
+{
+    struct mq_attr attr;
+    struct epoll_event ev;
+    struct evMq *q;
+    int qid, savedErrno;
+
+    for (qid = 0; qid < set->nqs; qid++)
+        if (set->qs[qid].mqd == (mqd_t) -1)
+            break;
+    if (qid == set->nqs && growSet(set) == -1)
+        return -1;
+    q = &set->qs[qid];
+
+    if (mq_getattr(mqd, &attr) == -1)
+        return -1;
+    q->bufLen = attr.mq_msgsize;
+    q->buf = malloc(q->bufLen);
+    if (q->buf == NULL)
+        return -1;
+
+    q->origFlags = attr.mq_flags;
+    attr.mq_flags |= O_NONBLOCK;
+    if (mq_setattr(mqd, &attr, NULL) == -1)
+        goto fail;
+
+    ev.events = EPOLLIN;
+    ev.data.u32 = qid;
+    if (epoll_ctl(set->epfd, EPOLL_CTL_ADD, mqd, &ev) == -1) {
+        savedErrno = errno;
+        attr.mq_flags = q->origFlags;
+        mq_setattr(mqd, &attr, NULL);
+        errno = savedErrno;
+        goto fail;
+    }
+
+    q->mqd = mqd;
+    q->cb = cb;
+    q->arg = arg;
+    q->len = -1;
+    q->served = 0;              /* New queues are served first */
+    q->heapIdx = -1;
+    return qid;
+
+fail:
+    savedErrno = errno;
+    free(q->buf);
+    q->buf = NULL;
+    errno = savedErrno;
+    return -1;
+}
+
+/* Remove queue 'qid' from 'set', discarding the message that the set
+   holds for it (if any), and restoring its flags */
+
+int
+evMqDel(struct evMqSet *set, int qid)
+{
+    struct mq_attr attr;
+    struct evMq *q;
+    int s;
+
+    if (qid < 0 || qid >= set->nqs || set->qs[qid].mqd == (mqd_t) -1) {
+        errno = ENOENT;
+        return -1;
+    }
+    q = &set->qs[qid];
+
+    if (q->heapIdx >= 0)
+        heapRemove(set, qid);
+
+    s = epoll_ctl(set->epfd, EPOLL_CTL_DEL, q->mqd, NULL);
+    if (s == 0 && mq_getattr(q->mqd, &attr) == 0) {
+        attr.mq_flags = q->origFlags;
+        s = mq_setattr(q->mqd, &attr, NULL);
+    }
+
+    free(q->buf);
+    q->buf = NULL;
+    q->mqd = (mqd_t) -1;
+    q->len = -1;
+    return s;
+}
+
+void
+evMqGetStats(const struct evMqSet *set, struct evMqStats *stats)
+{
+    *stats = set->stats;
+}
@@ -0,0 +1,51 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* ev_mq.h
+
+   Header file for ev_mq.c.
+*/
+#ifndef EV_MQ_H
+#define EV_MQ_H                 /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <mqueue.h>
+#include "event_loop.h"
+
+struct evMqSet;                 /* Opaque */
+
+/* Invoked with each message taken from queue 'qid'. If 'len' is
+   negative, it is a negated errno value: receiving from the queue failed,
+   and the queue has been removed from the set. 'msg' is valid only until
+   the callback returns. */
+
+typedef void (*evMqCallback)(struct evMqSet *set, int qid, const char *msg,
+                             ssize_t len, unsigned int prio, void *arg);
+
+struct evMqStats {
+    long long passes;           /* Times the set was serviced */
+    long long msgs;             /* Messages delivered */
+    long long emptyReads;       /* mq_receive() calls that found the
+                                   queue empty (EAGAIN) */
+};
+
+struct evMqSet *evMqSetCreate(struct evLoop *loop, int batch, int budget);
+
+void evMqSetDestroy(struct evMqSet *set);
+
+int evMqAdd(struct evMqSet *set, mqd_t mqd, evMqCallback cb, void *arg);
+
+int evMqDel(struct evMqSet *set, int qid);
+
+void evMqGetStats(const struct evMqSet *set, struct evMqStats *stats);
+
+#endif
@@ -0,0 +1,904 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* event_loop.c
+
+   A small event loop, of the kind that programs such as epoll_input.c
+   and self_pipe.c build by hand, with a choice of two backends: epoll,
+   and io_uring (Linux 5.6 and later). The caller can register:
+
+        evAddFd()       A callback invoked when a file descriptor is ready
+                        for reading and/or writing. Notification is level-
+                        triggered (as with poll()) with both backends.
+        evAddTimer()    A callback invoked when a timer (a timerfd)
+                        expires, once or periodically
+        evAddSignal()   A callback invoked when a signal is delivered (via
+                        a signalfd)
+        evSetWakeup()   A callback invoked in the loop's thread after
+                        another thread calls evWakeup() (via an eventfd)
+
+   and can also start I/O operations whose completion is reported by a
+   callback:
+
+        evRead()        read() into a buffer
+        evWrite()       write() from a buffer
+        evAccept()      accept() a connection
+
+   With the epoll backend, the loop performs these operations when epoll
+   reports that the descriptor is ready. With the io_uring backend, they
+   are submitted to the kernel as IORING_OP_READ, IORING_OP_WRITE, and
+   IORING_OP_ACCEPT requests, so that the data transfer takes place
+   without a separate readiness notification and system call. Thus, a
+   program written in terms of these operations runs unchanged on either
+   backend. At most one read (or accept) and one write operation may be
+   pending on each descriptor. The buffer of a pending operation must
+   remain valid until the operation completes, or until the loop has next
+   waited for events after the operation was cancelled by evDelFd().
+
+   evRun() dispatches events until evStop() is called, or until there
+   are no registrations or pending operations. Callbacks may add and
+   remove registrations, including that of the descriptor being
+   dispatched. Other than evWakeup(), the functions must be called only
+   from the thread that runs the loop.
+
+   Functions return 0 (or, for evAddTimer(), a timer ID) on success, and
+   -1 with errno set on error.
+
+   The io_uring backend uses the minimal API in uring_functions.c.
+   Readiness is monitored with one-shot IORING_OP_POLL_ADD requests, which
+   are rearmed after each callback (and submitted along with the next
+   wait for completions), which gives level-triggered semantics.
+*/
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "uring_functions.h"
+#include "event_loop.h"         /* Declares functions defined here */
+
+#define MAX_EVENTS 64           /* Max. events fetched per epoll_wait() */
+#define URING_ENTRIES 256
+
+/* Kinds of io_uring request. Each request's user_data encodes the
+   descriptor, the kind, and a generation number; a completion whose
+   generation doesn't match that of the descriptor's current request of
+   that kind is stale, and is ignored. */
+
+enum { REQ_POLL = 1, REQ_READ, REQ_WRITE, REQ_ACCEPT, REQ_IGNORE };
+
+#define GEN_MASK 0x1fffffff
+
+struct evOp {                   /* A pending I/O operation */
+    int kind;                   /* REQ_READ, REQ_WRITE, REQ_ACCEPT, or 0
+                                   if none is pending */
+    void *buf;
+    size_t len;
+    evIoCallback cb;
+    void *arg;
+    unsigned gen;
+};
+
+struct evFd {                   /* State for one file descriptor */
+    int hasWatcher;             /* Registered with evAddFd()? */
+    int counted;                /* Does watcher count in 'nUser'? */
+    int watch;                  /* Watched events (EV_READ, EV_WRITE) */
+    evFdCallback cb;
+    void *arg;
+    int epollEvents;            /* epoll: events in interest list (0 if
+                                   descriptor is not in the list) */
+    int pollArmed;              /* io_uring: poll request pending? */
+    unsigned pollGen;
+    struct evOp rd;             /* Pending read or accept */
+    struct evOp wr;             /* Pending write */
+};
+
+struct evTimer {
+    evTimerCallback cb;
+    void *arg;
+};
+
+struct evLoop {
+    int backend;
+    int epfd;                   /* epoll backend */
+    struct uring ring;          /* io_uring backend */
+    struct evFd *fds;           /* Indexed by file descriptor */
+    int nfds;                   /* Number of elements in 'fds' */
+    long nUser;                 /* Registrations and pending operations
+                                   that keep evRun() running */
+    int stop;
+    int evfd;                   /* eventfd for evWakeup() */
+    evWakeupCallback wakeupCb;
+    void *wakeupArg;
+    int sigfd;                  /* signalfd, or -1 */
+    sigset_t sigmask;           /* Signals accepted via 'sigfd' */
+    struct {
+        evSignalCallback cb;
+        void *arg;
+    } sigs[NSIG];
+};
+
+/* Return the state for 'fd', enlarging 'loop->fds' if necessary */
+
+static struct evFd *
+getFd(struct evLoop *loop, int fd)
+{
+    struct evFd *fds;
+    int n;
+
+    if (fd < 0) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    if (fd >= loop->nfds) {
+        n = (fd + 1 > 2 * loop->nfds) ? fd + 1 : 2 * loop->nfds;
+        fds = realloc(loop->fds, n * sizeof(struct evFd));
+        if (fds == NULL)
+            return NULL;
+        memset(&fds[loop->nfds], 0, (n - loop->nfds) * sizeof(struct evFd));
+        loop->fds = fds;
+        loop->nfds = n;
+    }
+    return &loop->fds[fd];
+}
+
+static uint64_t
+userData(int fd, unsigned gen, int kind)
+{
+    return ((uint64_t) fd << 32) | ((uint64_t) (gen & GEN_MASK) << 3) | kind;
+}
+
+/* Obtain a submission queue entry, first submitting the queued entries
+   if the queue is full */
+
+static struct io_uring_sqe *
+getSqe(struct evLoop *loop)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = uringGetSqe(&loop->ring);
+    if (sqe == NULL) {
+        if (uringSubmit(&loop->ring, 0) == -1)
+            return NULL;
+        sqe = uringGetSqe(&loop->ring);
+        if (sqe == NULL)
+            errno = EBUSY;
+    }
+    return sqe;
+}
+
+/* epoll backend: bring the interest list up to date for 'fd' */
+
+static int
+updateEpoll(struct evLoop *loop, int fd)
+{
+    struct evFd *e = &loop->fds[fd];
+    struct epoll_event ev;
+    int want, op;
+
+    want = (e->hasWatcher ? e->watch : 0) | (e->rd.kind ? EV_READ : 0) |
+           (e->wr.kind ? EV_WRITE : 0);
+    if (want == e->epollEvents)
+        return 0;
+
+    op = (e->epollEvents == 0) ? EPOLL_CTL_ADD :
+         (want == 0) ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+    ev.events = ((want & EV_READ) ? EPOLLIN : 0) |
+                ((want & EV_WRITE) ? EPOLLOUT : 0);
+    ev.data.fd = fd;
+    if (epoll_ctl(loop->epfd, op, fd, &ev) == -1)
+        return -1;
+
+    e->epollEvents = want;
+    return 0;
+}
+
+/* io_uring backend: queue a poll request for the watched events of 'fd',
+   or cancel the queued request */
+
+static int
+armPoll(struct evLoop *loop, int fd)
+{
+    struct io_uring_sqe *sqe;
+    struct evFd *e = &loop->fds[fd];
+
+    if (!e->hasWatcher || e->watch == 0)
+        return 0;
+
+    sqe = getSqe(loop);
+    if (sqe == NULL)
+        return -1;
+    uringPrepRw(sqe, IORING_OP_POLL_ADD, fd, NULL, 0, 0);
+    sqe->poll32_events = ((e->watch & EV_READ) ? POLLIN : 0) |
+                         ((e->watch & EV_WRITE) ? POLLOUT : 0);
+    sqe->user_data = userData(fd, e->pollGen, REQ_POLL);
+    e->pollArmed = 1;
+    return 0;
+}
+
+static int
+disarmPoll(struct evLoop *loop, int fd)
+{
+    struct io_uring_sqe *sqe;
+    struct evFd *e = &loop->fds[fd];
+
+    if (!e->pollArmed)
+        return 0;
+
+    e->pollArmed = 0;
+    sqe = getSqe(loop);
+    if (sqe == NULL)
+        return -1;
+    uringPrepRw(sqe, IORING_OP_POLL_REMOVE, -1, NULL, 0, 0);
+    sqe->addr = userData(fd, e->pollGen, REQ_POLL);
+    sqe->user_data = userData(fd, 0, REQ_IGNORE);
+    e->pollGen++;                       /* Ignore any completion */
+    return 0;
+}
+
+/* io_uring backend: submit (or cancel) the operation 'op' on 'fd' */
+
+static int
+submitOp(struct evLoop *loop, int fd, struct evOp *op)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = getSqe(loop);
+    if (sqe == NULL)
+        return -1;
+
+    switch (op->kind) {
+    case REQ_READ:
+        uringPrepRw(sqe, IORING_OP_READ, fd, op->buf, op->len, -1);
+        break;
+    case REQ_WRITE:
+        uringPrepRw(sqe, IORING_OP_WRITE, fd, op->buf, op->len, -1);
+        break;
+    case REQ_ACCEPT:
+        uringPrepRw(sqe, IORING_OP_ACCEPT, fd, NULL, 0, 0);
+        break;
+    }
+    sqe->user_data = userData(fd, op->gen, op->kind);
+    return 0;
+}
+
+static int
+cancelOp(struct evLoop *loop, int fd, struct evOp *op)
+{
+    struct io_uring_sqe *sqe;
+
+    if (op->kind == 0)
+        return 0;
+
+    loop->nUser--;
+    if (loop->backend == EV_BACKEND_URING) {
+        sqe = getSqe(loop);
+        if (sqe == NULL)
+            return -1;
+        uringPrepRw(sqe, IORING_OP_ASYNC_CANCEL, -1, NULL, 0, 0);
+        sqe->addr = userData(fd, op->gen, op->kind);
+        sqe->user_data = userData(fd, 0, REQ_IGNORE);
+    }
+    op->kind = 0;
+    op->gen++;                          /* Ignore any completion */
+    return 0;
+}
+
+static int
+addWatcher(struct evLoop *loop, int fd, int events, evFdCallback cb,
+           void *arg, int counted)
+{
+    struct evFd *e;
+    int s;
+
+    e = getFd(loop, fd);
+    if (e == NULL)
+        return -1;
+    if (e->hasWatcher) {
+        errno = EEXIST;
+        return -1;
+    }
+
+    e->hasWatcher = 1;
+    e->watch = events;
+    e->cb = cb;
+    e->arg = arg;
+
+    s = (loop->backend == EV_BACKEND_EPOLL) ? updateEpoll(loop, fd) :
+                                              armPoll(loop, fd);
+    if (s == -1) {
+        loop->fds[fd].hasWatcher = 0;
+        return -1;
+    }
+
+    e->counted = counted;
+    if (counted)
+        loop->nUser++;
+    return 0;
+}
+
+/* Start the operation described by 'kind', 'buf', and 'len' on 'fd' */
+
+static int
+startOp(struct evLoop *loop, int fd, int kind, void *buf, size_t len,
+        evIoCallback cb, void *arg)
+{
+    struct evFd *e;
+    struct evOp *op;
+    int s;
+
+    e = getFd(loop, fd);
+    if (e == NULL)
+        return -1;
+
+    op = (kind == REQ_WRITE) ? &e->wr : &e->rd;
+    if (op->kind != 0) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    op->kind = kind;
+    op->buf = buf;
+    op->len = len;
+    op->cb = cb;
+    op->arg = arg;
+
+    s = (loop->backend == EV_BACKEND_EPOLL) ? updateEpoll(loop, fd) :
+                                              submitOp(loop, fd, op);
+    if (s == -1) {
+        op->kind = 0;
+        return -1;
+    }
+
+    loop->nUser++;
+    return 0;
+}
+
+/* epoll backend: perform the pending operation 'op' on 'fd', which is
+   ready, and invoke its callback */
+
+static void
+performOp(struct evLoop *loop, int fd, struct evOp *op)
+{
+    struct evOp done;
+    ssize_t s;
+
+    switch (op->kind) {
+    case REQ_READ:      s = read(fd, op->buf, op->len);         break;
+    case REQ_WRITE:     s = write(fd, op->buf, op->len);        break;
+    default:            s = accept(fd, NULL, NULL);             break;
+    }
+    if (s == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;                         /* Spurious readiness */
+
+    done = *op;
+    op->kind = 0;
+    op->gen++;
+    loop->nUser--;
+    updateEpoll(loop, fd);
+
+    done.cb(loop, fd, (s == -1) ? -errno : s, done.arg);
+}
+
+/* Invoke the callbacks for 'fd', which the kernel has reported as ready
+   for 'events'. Since a callback may enlarge 'loop->fds', we must look up
+   the descriptor's state afresh after each callback. */
+
+static void
+dispatchFd(struct evLoop *loop, int fd, int events)
+{
+    struct evFd *e;
+
+    if (loop->backend == EV_BACKEND_EPOLL) {
+        if ((events & EV_READ) && loop->fds[fd].rd.kind != 0)
+            performOp(loop, fd, &loop->fds[fd].rd);
+        if ((events & EV_WRITE) && loop->fds[fd].wr.kind != 0)
+            performOp(loop, fd, &loop->fds[fd].wr);
+    }
+
+    e = &loop->fds[fd];
+    if (e->hasWatcher && (events & e->watch))
+        e->cb(loop, fd, events & e->watch, e->arg);
+}
+
+static int
+runEpoll(struct evLoop *loop)
+{
+    struct epoll_event evlist[MAX_EVENTS];
+    int ready, events, fd, j;
+
+    ready = epoll_wait(loop->epfd, evlist, MAX_EVENTS, -1);
+    if (ready == -1)
+        return (errno == EINTR) ? 0 : -1;
+
+    for (j = 0; j < ready; j++) {
+        fd = evlist[j].data.fd;
+        events = 0;
+        if (evlist[j].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            events |= EV_READ;
+        if (evlist[j].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            events |= EV_WRITE;
+        dispatchFd(loop, fd, events);
+    }
+    return 0;
+}
+
+static int
+runUring(struct evLoop *loop)
+{
+    struct io_uring_cqe *cqe;
+    struct evOp *op, done;
+    struct evFd *e;
+    uint64_t ud;
+    unsigned gen;
+    int res, kind, fd, events;
+
+    /* Submit the requests queued since the last call, and wait for at
+       least one completion */
+
+    if (uringSubmit(&loop->ring, 1) == -1)
+        return -1;
+
+    while (uringPeekCqe(&loop->ring, &cqe) == 0) {
+        ud = cqe->user_data;
+        res = cqe->res;
+        uringCqeSeen(&loop->ring);
+
+        kind = ud & 7;
+        gen = (ud >> 3) & GEN_MASK;
+        fd = ud >> 32;
+        if (kind == REQ_IGNORE || fd >= loop->nfds)
+            continue;
+        e = &loop->fds[fd];
+
+        if (kind == REQ_POLL) {
+            if (!e->pollArmed || gen != (e->pollGen & GEN_MASK))
+                continue;               /* Stale */
+            e->pollArmed = 0;
+
+            /* On error (e.g., EBADF), we report all watched events, so
+               that the callback discovers the error when it does I/O */
+
+            events = (res < 0) ? EV_READ | EV_WRITE :
+                     ((res & (POLLIN | POLLHUP | POLLERR)) ? EV_READ : 0) |
+                     ((res & (POLLOUT | POLLHUP | POLLERR)) ? EV_WRITE : 0);
+            dispatchFd(loop, fd, events);
+
+            /* Rearm, unless the callback did so (via evModFd()), or
+               removed the watcher */
+
+            e = &loop->fds[fd];
+            if (gen == (e->pollGen & GEN_MASK) && !e->pollArmed)
+                armPoll(loop, fd);
+
+        } else {
+            op = (kind == REQ_WRITE) ? &e->wr : &e->rd;
+            if (op->kind != kind || gen != (op->gen & GEN_MASK))
+                continue;               /* Stale (cancelled) */
+
+            done = *op;
+            op->kind = 0;
+            op->gen++;
+            loop->nUser--;
+            done.cb(loop, fd, res, done.arg);
+        }
+    }
+    return 0;
+}
+
+/* Internal callbacks for the timerfds, the signalfd, and the eventfd */
+
+static void
+timerReady(struct evLoop *loop, int fd, int events, void *arg)
+{
+    struct evTimer *t = arg;
+    uint64_t exp;
+
+    if (read(fd, &exp, sizeof(exp)) == sizeof(exp))
+        t->cb(loop, fd, exp, t->arg);
+}
+
+static void
+signalReady(struct evLoop *loop, int fd, int events, void *arg)
+{
+    struct signalfd_siginfo si;
+    int sig;
+
+    while (read(fd, &si, sizeof(si)) == sizeof(si)) {
+        sig = si.ssi_signo;
+        if (sig > 0 && sig < NSIG && loop->sigs[sig].cb != NULL)
+            loop->sigs[sig].cb(loop, sig, loop->sigs[sig].arg);
+    }
+}
+
+static void
+wakeupReady(struct evLoop *loop, int fd, int events, void *arg)
+{
+    uint64_t count;
+
+    if (read(fd, &count, sizeof(count)) == sizeof(count) &&
+            loop->wakeupCb != NULL)
+        loop->wakeupCb(loop, loop->wakeupArg);
+}
+
+/* Create an event loop that uses 'backend' (EV_BACKEND_*). Returns a
+   pointer to the loop, or NULL on error. */
+
+struct evLoop *
+evLoopCreate(int backend)
+{
+    struct evLoop *loop;
+    const char *env;
+    int savedErrno;
+
+    loop = calloc(1, sizeof(struct evLoop));
+    if (loop == NULL)
+        return NULL;
+    loop->epfd = -1;
+    loop->ring.fd = -1;
+    loop->evfd = -1;
+    loop->sigfd = -1;
+    sigemptyset(&loop->sigmask);
+
+    if (backend == EV_BACKEND_DEFAULT) {
+        env = getenv("EV_BACKEND");
+        if (env != NULL && strcmp(env, "epoll") == 0)
+            backend = EV_BACKEND_EPOLL;
+        else if (env != NULL && strcmp(env, "uring") == 0)
+            backend = EV_BACKEND_URING;
+    }
+
+    /* IORING_OP_READ (Linux 5.6) is the most recent io_uring operation
+       that we need */
+
+    if (backend == EV_BACKEND_URING || backend == EV_BACKEND_DEFAULT) {
+        if (uringInit(&loop->ring, URING_ENTRIES, 0) == 0 &&
+                uringOpSupported(&loop->ring, IORING_OP_READ) != 1) {
+            uringFree(&loop->ring);
+            errno = ENOSYS;
+        }
+        if (loop->ring.fd != -1)
+            backend = EV_BACKEND_URING;
+        else if (backend == EV_BACKEND_URING)
+            goto fail;                  /* io_uring requested, but absent */
+        else
+            backend = EV_BACKEND_EPOLL;
+    }
+
+    loop->backend = backend;
+    if (backend == EV_BACKEND_EPOLL) {
+        loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (loop->epfd == -1)
+            goto fail;
+    }
+
+    loop->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->evfd == -1)
+        goto fail;
+    if (addWatcher(loop, loop->evfd, EV_READ, wakeupReady, NULL, 0) == -1)
+        goto fail;
+
+    return loop;
+
+fail:
+    savedErrno = errno;
+    evLoopDestroy(loop);
+    errno = savedErrno;
+    return NULL;
+}
+
+/* Free the loop's resources, including its timers, and unblock the
+   signals accepted by evAddSignal() */
+
+void
+evLoopDestroy(struct evLoop *loop)
+{
+    int fd;
+
+    for (fd = 0; fd < loop->nfds; fd++) {
+        if (loop->fds[fd].hasWatcher && loop->fds[fd].cb == timerReady) {
+            free(loop->fds[fd].arg);
+            close(fd);
+        }
+    }
+
+    if (loop->epfd != -1)
+        close(loop->epfd);
+    if (loop->ring.fd != -1)
+        uringFree(&loop->ring);
+    if (loop->evfd != -1)
+        close(loop->evfd);
+    if (loop->sigfd != -1) {
+        close(loop->sigfd);
+        sigprocmask(SIG_UNBLOCK, &loop->sigmask, NULL);
+    }
+    free(loop->fds);
+    free(loop);
+}
+
+const char *
+evLoopBackend(const struct evLoop *loop)
+{
+    return (loop->backend == EV_BACKEND_EPOLL) ? "epoll" : "io_uring";
+}
+
+/* Dispatch events until evStop() is called, or nothing remains to wait
+   for. Returns 0, or -1 on error. */
+
+int
+evRun(struct evLoop *loop)
+{
+    int s;
+
+    loop->stop = 0;
+    while (!loop->stop && loop->nUser > 0) {
+        s = (loop->backend == EV_BACKEND_EPOLL) ? runEpoll(loop) :
+                                                  runUring(loop);
+        if (s == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/* Make evRun() return once the current callback returns */
+
+void
+evStop(struct evLoop *loop)
+{
+    loop->stop = 1;
+}
+
+/* Invoke 'cb' whenever 'fd' is ready for any of 'events' */
+
+int
+evAddFd(struct evLoop *loop, int fd, int events, evFdCallback cb,
+        void *arg)
+{
+    return addWatcher(loop, fd, events, cb, arg, 1);
+}
+
+/* Change the events watched for 'fd' (0 suspends the watcher) */
+
+int
+evModFd(struct evLoop *loop, int fd, int events)
+{
+    struct evFd *e;
+
+    if (fd < 0 || fd >= loop->nfds || !loop->fds[fd].hasWatcher) {
+        errno = ENOENT;
+        return -1;
+    }
+    e = &loop->fds[fd];
+
+    e->watch = events;
+    if (loop->backend == EV_BACKEND_EPOLL)
+        return updateEpoll(loop, fd);
+    if (disarmPoll(loop, fd) == -1)
+        return -1;
+    return armPoll(loop, fd);
+}
+
+/* Remove the watcher for 'fd', and cancel any pending operations on it.
+   This must be done before 'fd' is closed. */
+
+int
+evDelFd(struct evLoop *loop, int fd)
+{
+    struct evFd *e;
+
+    if (fd < 0 || fd >= loop->nfds) {
+        errno = ENOENT;
+        return -1;
+    }
+    e = &loop->fds[fd];
+
+    if (e->hasWatcher) {
+        e->hasWatcher = 0;
+        if (e->counted)
+            loop->nUser--;
+        if (loop->backend == EV_BACKEND_URING && disarmPoll(loop, fd) == -1)
+            return -1;
+    }
+    if (cancelOp(loop, fd, &e->rd) == -1 || cancelOp(loop, fd, &e->wr) == -1)
+        return -1;
+
+    return (loop->backend == EV_BACKEND_EPOLL) ? updateEpoll(loop, fd) : 0;
+}
+
+/* Create a timer that first expires after 'initialMs' milliseconds, and
+   then (if 'intervalMs' is nonzero) every 'intervalMs' milliseconds.
+   Returns a timer ID (in fact, a timerfd file descriptor) for use with
+   evDelTimer(), or -1 on error. */
+
+int
+evAddTimer(struct evLoop *loop, long initialMs, long intervalMs,
+           evTimerCallback cb, void *arg)
+{
+    struct itimerspec ts;
+    struct evTimer *t;
+    int tfd, savedErrno;
+
+    t = malloc(sizeof(struct evTimer));
+    if (t == NULL)
+        return -1;
+    t->cb = cb;
+    t->arg = arg;
+
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tfd == -1) {
+        free(t);
+        return -1;
+    }
+
+    ts.it_value.tv_sec = initialMs / 1000;
+    ts.it_value.tv_nsec = (initialMs % 1000) * 1000000;
+    if (initialMs == 0)
+        ts.it_value.tv_nsec = 1;        /* A zero value disarms timer */
+    ts.it_interval.tv_sec = intervalMs / 1000;
+    ts.it_interval.tv_nsec = (intervalMs % 1000) * 1000000;
+
+    if (timerfd_settime(tfd, 0, &ts, NULL) == -1 ||
+            addWatcher(loop, tfd, EV_READ, timerReady, t, 1) == -1) {
+        savedErrno = errno;
+        close(tfd);
+        free(t);
+        errno = savedErrno;
+        return -1;
+    }
+    return tfd;
+}
+
+int
+evDelTimer(struct evLoop *loop, int timerId)
+{
+    if (timerId < 0 || timerId >= loop->nfds ||
+            !loop->fds[timerId].hasWatcher ||
+            loop->fds[timerId].cb != timerReady) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    free(loop->fds[timerId].arg);
+    if (evDelFd(loop, timerId) == -1)
+        return -1;
+    return close(timerId);
+}
+
+/* Invoke 'cb' when 'sig' is delivered. The signal is blocked (with
+   sigprocmask(), so that, in a multithreaded program, the caller must
+   ensure that it is blocked in all threads) and read from a signalfd. */
+
+int
+evAddSignal(struct evLoop *loop, int sig, evSignalCallback cb, void *arg)
+{
+    sigset_t set;
+    int fd;
+
+    if (sig <= 0 || sig >= NSIG || cb == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sigemptyset(&set);
+    sigaddset(&set, sig);
+    if (sigprocmask(SIG_BLOCK, &set, NULL) == -1)
+        return -1;
+
+    sigaddset(&loop->sigmask, sig);
+    fd = signalfd(loop->sigfd, &loop->sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    if (loop->sigfd == -1) {
+        loop->sigfd = fd;
+        if (addWatcher(loop, fd, EV_READ, signalReady, NULL, 0) == -1)
+            return -1;
+    }
+
+    if (loop->sigs[sig].cb == NULL)
+        loop->nUser++;
+    loop->sigs[sig].cb = cb;
+    loop->sigs[sig].arg = arg;
+    return 0;
+}
+
+/* Stop handling 'sig', and unblock it */
+
+int
+evDelSignal(struct evLoop *loop, int sig)
+{
+    sigset_t set;
+
+    if (sig <= 0 || sig >= NSIG || loop->sigs[sig].cb == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    loop->sigs[sig].cb = NULL;
+    loop->nUser--;
+
+    sigdelset(&loop->sigmask, sig);
+    if (signalfd(loop->sigfd, &loop->sigmask, 0) == -1)
+        return -1;
+
+    sigemptyset(&set);
+    sigaddset(&set, sig);
+    return sigprocmask(SIG_UNBLOCK, &set, NULL);
+}
+
+/* Set (or, if 'cb' is NULL, clear) the callback invoked after another
+   thread calls evWakeup() */
+
+int
+evSetWakeup(struct evLoop *loop, evWakeupCallback cb, void *arg)
+{
+    if (loop->wakeupCb == NULL && cb != NULL)
+        loop->nUser++;
+    else if (loop->wakeupCb != NULL && cb == NULL)
+        loop->nUser--;
+
+    loop->wakeupCb = cb;
+    loop->wakeupArg = arg;
+    return 0;
+}
+
+/* Wake the loop; this function may be called from any thread (and is
+   async-signal-safe). Several calls before the loop wakes result in a
+   single invocation of the wakeup callback. */
+
+int
+evWakeup(struct evLoop *loop)
+{
+    uint64_t one = 1;
+
+    if (write(loop->evfd, &one, sizeof(one)) == sizeof(one))
+        return 0;
+    return (errno == EAGAIN) ? 0 : -1;  /* EAGAIN: counter is saturated,
+                                           so a wakeup is pending anyway */
+}
+
+/* Start reading up to 'len' bytes from 'fd' into 'buf'; 'cb' is invoked
+   when the read completes */
+
+int
+evRead(struct evLoop *loop, int fd, void *buf, size_t len,
+       evIoCallback cb, void *arg)
+{
+    return startOp(loop, fd, REQ_READ, buf, len, cb, arg);
+}
+
+/* Start writing up to 'len' bytes from 'buf' to 'fd'; 'cb' is invoked
+   when the write completes (possibly after a partial write) */
+
+int
+evWrite(struct evLoop *loop, int fd, const void *buf, size_t len,
+        evIoCallback cb, void *arg)
+{
+    return startOp(loop, fd, REQ_WRITE, (void *) buf, len, cb, arg);
+}
+
+/* Start accepting a connection on the listening socket 'fd'; 'cb' is
+   invoked with the new connected socket as 'res' */
+
+int
+evAccept(struct evLoop *loop, int fd, evIoCallback cb, void *arg)
+{
+    return startOp(loop, fd, REQ_ACCEPT, NULL, 0, cb, arg);
+}
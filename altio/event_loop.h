@@ -0,0 +1,101 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* event_loop.h
+
+   Header file for event_loop.c.
+*/
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H            /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+
+struct evLoop;                  /* Opaque */
+
+/* Backends, for evLoopCreate() */
+
+#define EV_BACKEND_DEFAULT 0    /* $EV_BACKEND ("epoll" or "uring"), else
+                                   io_uring if available, else epoll */
+#define EV_BACKEND_EPOLL   1
+#define EV_BACKEND_URING   2
+
+/* Events, for evAddFd() and evModFd(), and passed to evFdCallback */
+
+#define EV_READ  1
+#define EV_WRITE 2
+
+/* Invoked when 'fd' is ready for 'events' (EV_READ and/or EV_WRITE) */
+
+typedef void (*evFdCallback)(struct evLoop *loop, int fd, int events,
+                             void *arg);
+
+/* Invoked when a timer expires; 'expirations' is the number of
+   expirations since the last invocation (normally 1) */
+
+typedef void (*evTimerCallback)(struct evLoop *loop, int timerId,
+                                unsigned long long expirations, void *arg);
+
+/* Invoked when signal 'sig' is delivered */
+
+typedef void (*evSignalCallback)(struct evLoop *loop, int sig, void *arg);
+
+/* Invoked after evWakeup() has been called */
+
+typedef void (*evWakeupCallback)(struct evLoop *loop, void *arg);
+
+/* Invoked when an operation started by evRead(), evWrite(), or evAccept()
+   completes; 'res' is the value that read(), write(), or accept() would
+   have returned, or, on error, the negated errno value */
+
+typedef void (*evIoCallback)(struct evLoop *loop, int fd, ssize_t res,
+                             void *arg);
+
+struct evLoop *evLoopCreate(int backend);
+
+void evLoopDestroy(struct evLoop *loop);
+
+const char *evLoopBackend(const struct evLoop *loop);
+
+int evRun(struct evLoop *loop);
+
+void evStop(struct evLoop *loop);
+
+int evAddFd(struct evLoop *loop, int fd, int events, evFdCallback cb,
+            void *arg);
+
+int evModFd(struct evLoop *loop, int fd, int events);
+
+int evDelFd(struct evLoop *loop, int fd);
+
+int evAddTimer(struct evLoop *loop, long initialMs, long intervalMs,
+               evTimerCallback cb, void *arg);
+
+int evDelTimer(struct evLoop *loop, int timerId);
+
+int evAddSignal(struct evLoop *loop, int sig, evSignalCallback cb,
+                void *arg);
+
+int evDelSignal(struct evLoop *loop, int sig);
+
+int evSetWakeup(struct evLoop *loop, evWakeupCallback cb, void *arg);
+
+int evWakeup(struct evLoop *loop);
+
+int evRead(struct evLoop *loop, int fd, void *buf, size_t len,
+           evIoCallback cb, void *arg);
+
+int evWrite(struct evLoop *loop, int fd, const void *buf, size_t len,
+            evIoCallback cb, void *arg);
+
+int evAccept(struct evLoop *loop, int fd, evIoCallback cb, void *arg);
+
+#endif
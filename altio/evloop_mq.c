@@ -0,0 +1,384 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* evloop_mq.c
+
+   Serve many POSIX message queues from a single thread, using ev_mq.c
+   and the event loop of event_loop.c. This is a successor to select_mq.c,
+   which needs a child process for each (System V) queue, and can't
+   monitor more than FD_SETSIZE descriptors.
+
+   Usage: evloop_mq [-m mode] [-b backend] [-q nqueues] [-p nprod]
+                    [-n count] [-P nprios] [-B batch] [-g budget]
+                    [-w usecs]
+
+        -m mode      How queues are served:
+                       sched  with ev_mq.c: messages are delivered in
+                              priority order across all queues, with
+                              round-robin among queues whose messages
+                              have equal priority (default)
+                       drain  each queue is registered separately with
+                              the loop, and, when ready, is emptied with
+                              nonblocking mq_receive() calls, without
+                              regard to the other queues
+        -b backend   Event loop backend: "epoll" or "uring" (default: see
+                     evLoopCreate())
+        -q nqueues   Number of queues (default: 256)
+        -p nprod     Number of producer processes (default: 4)
+        -n count     Number of messages sent by each producer (default:
+                     100000)
+        -P nprios    Each message has a random priority in the range
+                     0..nprios-1 (default: 4)
+        -B batch     sched: messages taken from a queue in turn
+                     (default: 8)
+        -g budget    sched: messages delivered per loop iteration
+                     (default: 256)
+        -w usecs     Simulate 'usecs' microseconds of work for each
+                     message (default: 0), so that the consumer, rather
+                     than the producers, is the bottleneck
+
+   Each producer sends its messages, each carrying the time at which it
+   was sent, to queues chosen at random; a queue holds at most 10
+   messages, so that producers block when the consumer falls behind. The
+   program reports the message rate, the number of times that the queues
+   were serviced (and so the messages per service), the number of
+   mq_receive() calls that found a queue empty, and, for each priority,
+   the latency of the messages (from mq_send() until the message was
+   delivered).
+
+   Try: evloop_mq -w 20 -m sched
+        evloop_mq -w 20 -m drain
+   With the consumer as the bottleneck, "sched" gives high-priority
+   messages much lower latency than low-priority messages, while "drain"
+   gives all messages much the same latency.
+
+   More than 256 queues (the default /proc/sys/fs/mqueue/queues_max)
+   require privilege, as may the total size of the queues (see
+   RLIMIT_MSGQUEUE in getrlimit(2)).
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include "event_loop.h"
+#include "ev_mq.h"
+#include "lat_hist.h"
+#include "tlpi_hdr.h"
+
+#define QUEUE_MAXMSG 10
+#define MAX_PRIOS 32
+
+struct msg {
+    long long sentNs;           /* CLOCK_MONOTONIC time of sending */
+    int producer;
+};
+
+static struct evLoop *loop;
+static long long remaining;     /* Messages still to be received */
+static long workUsecs;
+static struct latHist *hist;    /* One histogram per priority */
+static long long drainPasses, drainEmpty;       /* "drain" statistics */
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Record the latency of a message, and then simulate processing it */
+
+static void
+consume(const char *buf, ssize_t len, unsigned int prio)
+{
+    struct msg m;
+    long long start;
+
+    if (len != sizeof(struct msg) || prio >= MAX_PRIOS)
+        fatal("Unexpected message (length %zd, priority %u)", len, prio);
+    memcpy(&m, buf, sizeof(m));
+
+    start = nowNs();
+    latHistRecord(&hist[prio], start - m.sentNs);
+
+    if (workUsecs > 0)
+        while (nowNs() - start < workUsecs * 1000)
+            continue;
+
+    if (--remaining == 0)
+        evStop(loop);
+}
+
+static void
+mqMessage(struct evMqSet *set, int qid, const char *msg, ssize_t len,
+          unsigned int prio, void *arg)
+{
+    if (len < 0)
+        fatal("queue %d: %s", qid, strerror(-len));
+    consume(msg, len, prio);
+}
+
+/* "drain" mode: empty a queue when it becomes ready */
+
+static void
+drainQueue(struct evLoop *loop, int fd, int events, void *arg)
+{
+    char buf[sizeof(struct msg)];
+    unsigned int prio;
+    ssize_t len;
+
+    drainPasses++;
+    for (;;) {
+        len = mq_receive((mqd_t) fd, buf, sizeof(buf), &prio);
+        if (len == -1) {
+            if (errno == EAGAIN)
+                break;
+            if (errno == EINTR)
+                continue;
+            errExit("mq_receive");
+        }
+        consume(buf, len, prio);
+    }
+    drainEmpty++;
+}
+
+/* Send 'count' messages to randomly chosen queues among those named in
+   'names' */
+
+static void
+producer(int id, char **names, int nqueues, long count, int nprios,
+         int syncFd)
+{
+    struct msg m;
+    unsigned int seed;
+    mqd_t *mqd;
+    long j;
+    int q;
+
+    mqd = calloc(nqueues, sizeof(mqd_t));
+    if (mqd == NULL)
+        errExit("calloc");
+    for (q = 0; q < nqueues; q++) {
+        mqd[q] = mq_open(names[q], O_WRONLY);
+        if (mqd[q] == (mqd_t) -1)
+            errExit("mq_open");
+    }
+    close(syncFd);              /* Tell parent we have opened the queues */
+
+    seed = id + 1;
+    memset(&m, 0, sizeof(m));
+    m.producer = id;
+    for (j = 0; j < count; j++) {
+        q = rand_r(&seed) % nqueues;
+        m.sentNs = nowNs();
+        if (mq_send(mqd[q], (char *) &m, sizeof(m),
+                    rand_r(&seed) % nprios) == -1)
+            errExit("mq_send");
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-m sched|drain] [-b epoll|uring] "
+            "[-q nqueues] [-p nprod]\n"
+            "        [-n count] [-P nprios] [-B batch] [-g budget] "
+            "[-w usecs]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct mq_attr attr;
+    struct evMqSet *set;
+    struct evMqStats st;
+    Boolean drain;
+    char **names, dummy;
+    mqd_t *mqd;
+    long count;
+    long long start, elapsed, passes, emptyReads;
+    int opt, backend, nqueues, nprod, nprios, batch, budget, j, p;
+    int savedErrno;
+    int pfd[2];
+
+    drain = FALSE;
+    backend = EV_BACKEND_DEFAULT;
+    nqueues = 256;
+    nprod = 4;
+    count = 100000;
+    nprios = 4;
+    batch = 8;
+    budget = 256;
+    while ((opt = getopt(argc, argv, "m:b:q:p:n:P:B:g:w:")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "sched") == 0)
+                drain = FALSE;
+            else if (strcmp(optarg, "drain") == 0)
+                drain = TRUE;
+            else
+                usageError(argv[0]);
+            break;
+        case 'b':
+            if (strcmp(optarg, "epoll") == 0)
+                backend = EV_BACKEND_EPOLL;
+            else if (strcmp(optarg, "uring") == 0)
+                backend = EV_BACKEND_URING;
+            else
+                usageError(argv[0]);
+            break;
+        case 'q':   nqueues = getInt(optarg, GN_GT_0, "-q");    break;
+        case 'p':   nprod = getInt(optarg, GN_GT_0, "-p");      break;
+        case 'n':   count = getLong(optarg, GN_GT_0, "-n");     break;
+        case 'P':   nprios = getInt(optarg, GN_GT_0, "-P");     break;
+        case 'B':   batch = getInt(optarg, GN_GT_0, "-B");      break;
+        case 'g':   budget = getInt(optarg, GN_GT_0, "-g");     break;
+        case 'w':   workUsecs = getLong(optarg, GN_NONNEG, "-w"); break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+    if (nprios > MAX_PRIOS)
+        cmdLineErr("-P must be at most %d\n", MAX_PRIOS);
+
+    hist = calloc(nprios, sizeof(struct latHist));
+    names = calloc(nqueues, sizeof(char *));
+    mqd = calloc(nqueues, sizeof(mqd_t));
+    if (hist == NULL || names == NULL || mqd == NULL)
+        errExit("calloc");
+    for (p = 0; p < nprios; p++)
+        latHistInit(&hist[p]);
+
+    /* Create the queues; they are unlinked once the producers have
+       opened them */
+
+    attr.mq_flags = 0;
+    attr.mq_maxmsg = QUEUE_MAXMSG;
+    attr.mq_msgsize = sizeof(struct msg);
+    attr.mq_curmsgs = 0;
+    for (j = 0; j < nqueues; j++) {
+        if (asprintf(&names[j], "/evloop_mq.%ld.%d", (long) getpid(), j)
+                == -1)
+            errExit("asprintf");
+        mqd[j] = mq_open(names[j], O_RDONLY | O_CREAT | O_EXCL,
+                         S_IRUSR | S_IWUSR, &attr);
+        if (mqd[j] == (mqd_t) -1) {
+            savedErrno = errno;
+            for (p = 0; p < j; p++)
+                mq_unlink(names[p]);
+            errno = savedErrno;
+            errExit("mq_open (queue %d of %d)", j, nqueues);
+        }
+    }
+
+    if (pipe(pfd) == -1)
+        errExit("pipe");
+    start = nowNs();
+    for (j = 0; j < nprod; j++) {
+        switch (fork()) {
+        case -1:
+            errExit("fork");
+        case 0:
+            close(pfd[0]);
+            for (p = 0; p < nqueues; p++)
+                mq_close(mqd[p]);
+            producer(j, names, nqueues, count, nprios, pfd[1]);
+        default:
+            break;
+        }
+    }
+
+    /* Wait until all producers have opened the queues (and closed their
+       end of the pipe), and then remove the names */
+
+    close(pfd[1]);
+    if (read(pfd[0], &dummy, 1) != 0)
+        fatal("Unexpected data on synchronization pipe");
+    close(pfd[0]);
+    for (j = 0; j < nqueues; j++)
+        mq_unlink(names[j]);
+
+    loop = evLoopCreate(backend);
+    if (loop == NULL)
+        errExit("evLoopCreate");
+
+    set = NULL;
+    if (drain) {
+        for (j = 0; j < nqueues; j++) {
+            if (mq_getattr(mqd[j], &attr) == -1)
+                errExit("mq_getattr");
+            attr.mq_flags |= O_NONBLOCK;
+            if (mq_setattr(mqd[j], &attr, NULL) == -1)
+                errExit("mq_setattr");
+            if (evAddFd(loop, (int) mqd[j], EV_READ, drainQueue, NULL)
+                    == -1)
+                errExit("evAddFd");
+        }
+    } else {
+        set = evMqSetCreate(loop, batch, budget);
+        if (set == NULL)
+            errExit("evMqSetCreate");
+        for (j = 0; j < nqueues; j++)
+            if (evMqAdd(set, mqd[j], mqMessage, NULL) == -1)
+                errExit("evMqAdd");
+    }
+
+    remaining = (long long) nprod * count;
+    if (evRun(loop) == -1)
+        errExit("evRun");
+    elapsed = nowNs() - start;
+
+    for (j = 0; j < nprod; j++)
+        if (wait(NULL) == -1)
+            errExit("wait");
+
+    if (drain) {
+        passes = drainPasses;
+        emptyReads = drainEmpty;
+    } else {
+        evMqGetStats(set, &st);
+        passes = st.passes;
+        emptyReads = st.emptyReads;
+    }
+
+    printf("mode %s, backend %s, %d queues, %lld messages\n",
+           drain ? "drain" : "sched", evLoopBackend(loop), nqueues,
+           (long long) nprod * count);
+    printf("%.0f msgs/sec; %lld services (%.1f msgs/service); "
+           "%lld empty receives\n",
+           nprod * count / (elapsed / 1e9), passes,
+           (double) nprod * count / passes, emptyReads);
+
+    printf("\n%4s %10s %10s %10s %10s %10s\n", "prio", "msgs", "mean-us",
+           "p50-us", "p99-us", "max-us");
+    for (p = nprios - 1; p >= 0; p--)
+        if (hist[p].count > 0)
+            printf("%4d %10lld %10.1f %10.1f %10.1f %10.1f\n", p,
+                   hist[p].count, latHistMean(&hist[p]) / 1000,
+                   latHistPercentile(&hist[p], 0.50) / 1000.0,
+                   latHistPercentile(&hist[p], 0.99) / 1000.0,
+                   hist[p].max / 1000.0);
+
+    if (set != NULL)
+        evMqSetDestroy(set);
+    evLoopDestroy(loop);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,712 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* readiness_bench.c
+
+   Measure how the cost of waiting for I/O readiness with select(),
+   poll(), epoll, io_uring, and signal-driven I/O grows with the number
+   of monitored file descriptors.
+
+   Usage: readiness_bench [-n nfds[,nfds...]] [-a nactive] [-r rounds]
+                          [-s] [method...]
+
+        -n nfds     Comma-separated list of the numbers of descriptors to
+                    monitor (default: 10,100,1000,10000,100000)
+        -a nactive  Number of descriptors made ready in each round
+                    (default: 1)
+        -r rounds   Number of rounds per method and descriptor count
+                    (default: 1000)
+        -s          Use socketpairs rather than pipes
+
+   The methods (by default, all are measured) are:
+
+        select      select(), rebuilding the fd_set for each call
+        poll        poll(), with a pollfd array built once
+        epoll-lt    epoll_wait(), level-triggered
+        epoll-et    epoll_wait(), edge-triggered (EPOLLET)
+        uring       io_uring multishot IORING_OP_POLL_ADD (Linux 5.13)
+        rtsig       Signal-driven I/O (O_ASYNC), with F_SETSIG selecting a
+                    realtime signal whose siginfo_t carries the ready
+                    descriptor; signals are accepted with sigwaitinfo()
+                    and then, in a batch, sigtimedwait() with a zero
+                    timeout
+        rtsig-fd    As rtsig, but reading batches of signals from a
+                    signalfd (Linux 2.6.22)
+
+   Like poll_pipes.c, the program creates 'nfds' pipes (or socketpairs)
+   and writes to randomly selected ones; but it does so repeatedly. In
+   each round, one byte is written to each of 'nactive' distinct,
+   randomly chosen descriptors, and then the method under test waits
+   until those descriptors are reported as ready, locates them, and
+   reads from them. The program reports the average time per round
+   (from the start of the wait until all of the ready descriptors have
+   been drained), and per ready descriptor. This includes one read() per
+   ready descriptor, or two in the edge-triggered case, since an
+   edge-triggered application must read until EAGAIN. The cost of
+   registering the descriptors (epoll_ctl(), or the initial poll
+   requests for io_uring) is not included.
+
+   select() and poll() require the kernel to inspect every monitored
+   descriptor on each call, and the caller to scan the results, so their
+   cost grows linearly with 'nfds'; epoll and io_uring report only the
+   ready descriptors. select() is measured only if all of the
+   descriptors are less than FD_SETSIZE.
+
+   Signal-driven I/O, too, reports only the ready descriptors (like
+   edge-triggered epoll, it reports each new arrival of data, so that
+   the program reads until EAGAIN), but delivers one signal per event,
+   which must be dequeued with a system call (though a signalfd read()
+   can dequeue many). If the queue of realtime signals overflows (see
+   RLIMIT_SIGPENDING), the kernel instead sends SIGIO, which says only
+   that some events were lost, and the program must then poll() all of
+   the descriptors. The rtsig methods count any such overflows, which
+   become likely with high values of -a.
+
+   The program raises its RLIMIT_NOFILE soft limit (and, if privileged,
+   its hard limit) as required; descriptor counts that would exceed the
+   limit are skipped.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include "uring_functions.h"
+#include "tlpi_hdr.h"
+
+#ifndef IORING_POLL_ADD_MULTI
+#define IORING_POLL_ADD_MULTI (1U << 0)
+#endif
+
+#define MAX_COUNTS 16
+#define MAX_EVENTS 1024         /* Max. events per epoll_wait() call */
+#define URING_ENTRIES 4096
+
+static int nfds;                /* Number of monitored descriptors */
+static int *rfds;               /* Read ends (monitored descriptors) */
+static int *wfds;               /* Write ends */
+static int maxFd;
+
+static fd_set masterSet;        /* State for the various methods */
+static struct pollfd *pollFds;
+static int epfd;
+static struct epoll_event evlist[MAX_EVENTS];
+static struct uring ring;
+static Boolean uringFailed;
+static sigset_t rtSet;          /* The realtime signal, plus SIGIO */
+static int sigFd;
+static long rtOverflows;
+
+/* Consume the data in the readable descriptor 'fd'. For the
+   edge-triggered case ('untilEagain'), read until the descriptor would
+   block. */
+
+static void
+consume(int fd, Boolean untilEagain)
+{
+    char buf[64];
+    ssize_t s;
+
+    do {
+        s = read(fd, buf, sizeof(buf));
+    } while (untilEagain && s > 0);
+
+    if (s == -1 && errno != EAGAIN)
+        errExit("read");
+}
+
+/* Each of the following functions waits until at least one descriptor
+   is ready, consumes the data from each of the ready descriptors, and
+   returns the number of descriptors consumed */
+
+static void
+selectSetup(void)
+{
+    int j;
+
+    FD_ZERO(&masterSet);
+    for (j = 0; j < nfds; j++)
+        FD_SET(rfds[j], &masterSet);
+}
+
+static int
+selectWait(void)
+{
+    fd_set readfds;
+    int ready, found, fd;
+
+    readfds = masterSet;
+    ready = select(maxFd + 1, &readfds, NULL, NULL, NULL);
+    if (ready == -1)
+        errExit("select");
+
+    found = 0;
+    for (fd = 0; fd <= maxFd && found < ready; fd++) {
+        if (FD_ISSET(fd, &readfds)) {
+            consume(fd, FALSE);
+            found++;
+        }
+    }
+    return found;
+}
+
+static void
+pollSetup(void)
+{
+    int j;
+
+    pollFds = calloc(nfds, sizeof(struct pollfd));
+    if (pollFds == NULL)
+        errExit("calloc");
+    for (j = 0; j < nfds; j++) {
+        pollFds[j].fd = rfds[j];
+        pollFds[j].events = POLLIN;
+    }
+}
+
+static int
+pollWait(void)
+{
+    int ready, found, j;
+
+    ready = poll(pollFds, nfds, -1);
+    if (ready == -1)
+        errExit("poll");
+
+    found = 0;
+    for (j = 0; j < nfds && found < ready; j++) {
+        if (pollFds[j].revents & POLLIN) {
+            consume(rfds[j], FALSE);
+            found++;
+        }
+    }
+    return found;
+}
+
+static void
+pollTeardown(void)
+{
+    free(pollFds);
+}
+
+static void
+epollSetup(uint32_t flags)
+{
+    struct epoll_event ev;
+    int j;
+
+    epfd = epoll_create1(0);
+    if (epfd == -1)
+        errExit("epoll_create1");
+
+    for (j = 0; j < nfds; j++) {
+        ev.events = EPOLLIN | flags;
+        ev.data.u32 = j;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, rfds[j], &ev) == -1)
+            errExit("epoll_ctl");
+    }
+}
+
+static void
+epollLtSetup(void)
+{
+    epollSetup(0);
+}
+
+static void
+epollEtSetup(void)
+{
+    epollSetup(EPOLLET);
+}
+
+static int
+epollWait(Boolean edge)
+{
+    int ready, j;
+
+    ready = epoll_wait(epfd, evlist, MAX_EVENTS, -1);
+    if (ready == -1)
+        errExit("epoll_wait");
+
+    for (j = 0; j < ready; j++)
+        consume(rfds[evlist[j].data.u32], edge);
+    return ready;
+}
+
+static int
+epollLtWait(void)
+{
+    return epollWait(FALSE);
+}
+
+static int
+epollEtWait(void)
+{
+    return epollWait(TRUE);
+}
+
+static void
+epollTeardown(void)
+{
+    close(epfd);
+}
+
+/* Queue a multishot poll request for rfds[idx], submitting the queued
+   requests to the kernel if the submission queue is full */
+
+static void
+uringArm(int idx)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = uringGetSqe(&ring);
+    if (sqe == NULL) {
+        if (uringSubmit(&ring, 0) == -1)
+            errExit("io_uring_enter");
+        sqe = uringGetSqe(&ring);
+    }
+
+    uringPrepRw(sqe, IORING_OP_POLL_ADD, rfds[idx], NULL,
+                IORING_POLL_ADD_MULTI, 0);
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = idx;
+}
+
+static void
+uringSetup(void)
+{
+    int j;
+
+    if (uringInit(&ring, URING_ENTRIES, 0) == -1)
+        errExit("uringInit");
+    for (j = 0; j < nfds; j++)
+        uringArm(j);
+    if (uringSubmit(&ring, 0) == -1)
+        errExit("io_uring_enter");
+}
+
+static int
+uringWait(void)
+{
+    struct io_uring_cqe *cqe;
+    int found, idx;
+
+    /* Submit any requests queued (by uringArm()) in the last round, and
+       wait for a completion */
+
+    if (uringSubmit(&ring, 1) == -1)
+        errExit("io_uring_enter");
+
+    found = 0;
+    while (uringPeekCqe(&ring, &cqe) == 0) {
+        idx = cqe->user_data;
+        if (cqe->res < 0) {
+            errno = -cqe->res;
+            errMsg("IORING_OP_POLL_ADD");
+            uringFailed = TRUE;
+            uringCqeSeen(&ring);
+            return 1;
+        }
+
+        /* The kernel ends a multishot request (for example, if the CQ
+           ring overflows), in which case we must rearm it */
+
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            uringArm(idx);
+        uringCqeSeen(&ring);
+
+        consume(rfds[idx], FALSE);
+        found++;
+    }
+    return found;
+}
+
+static void
+uringTeardown(void)
+{
+    uringFree(&ring);
+}
+
+/* Enable signal-driven I/O on each descriptor, with the signal set by
+   F_SETSIG, which is blocked so that it can be accepted synchronously */
+
+static void
+rtsigSetup(void)
+{
+    int flags, j;
+
+    sigemptyset(&rtSet);
+    sigaddset(&rtSet, SIGRTMIN);
+    sigaddset(&rtSet, SIGIO);
+    if (sigprocmask(SIG_BLOCK, &rtSet, NULL) == -1)
+        errExit("sigprocmask");
+
+    for (j = 0; j < nfds; j++) {
+        if (fcntl(rfds[j], F_SETOWN, getpid()) == -1)
+            errExit("fcntl-F_SETOWN");
+        if (fcntl(rfds[j], F_SETSIG, SIGRTMIN) == -1)
+            errExit("fcntl-F_SETSIG");
+        flags = fcntl(rfds[j], F_GETFL);
+        if (flags == -1 || fcntl(rfds[j], F_SETFL, flags | O_ASYNC) == -1)
+            errExit("fcntl-F_SETFL");
+    }
+    rtOverflows = 0;
+}
+
+static void
+rtsigFdSetup(void)
+{
+    rtsigSetup();
+    sigFd = signalfd(-1, &rtSet, SFD_CLOEXEC);
+    if (sigFd == -1)
+        errExit("signalfd");
+}
+
+/* Consume the data on 'fd', reading until EAGAIN; returns 1 if there
+   was any (there may be none, if the data that caused the signal was
+   consumed in response to an earlier signal) */
+
+static int
+rtsigConsume(int fd)
+{
+    char buf[64];
+    ssize_t s;
+    int got;
+
+    for (got = 0; (s = read(fd, buf, sizeof(buf))) > 0; got = 1)
+        continue;
+    if (s == -1 && errno != EAGAIN)
+        errExit("read");
+    return got;
+}
+
+/* The realtime signal queue overflowed, so events may have been lost:
+   discard any queued signals, and consume every ready descriptor */
+
+static int
+rtsigOverflow(void)
+{
+    static const struct timespec zero = { 0, 0 };
+    int found, j;
+
+    rtOverflows++;
+    while (sigtimedwait(&rtSet, NULL, &zero) > 0)
+        continue;
+
+    pollSetup();
+    if (poll(pollFds, nfds, 0) == -1)
+        errExit("poll");
+    found = 0;
+    for (j = 0; j < nfds; j++)
+        if (pollFds[j].revents & POLLIN)
+            found += rtsigConsume(rfds[j]);
+    pollTeardown();
+    return found;
+}
+
+static int
+rtsigWait(void)
+{
+    static const struct timespec zero = { 0, 0 };
+    siginfo_t si;
+    int sig, found;
+
+    found = 0;
+    sig = sigwaitinfo(&rtSet, &si);
+    while (sig > 0) {
+        if (sig == SIGIO)
+            return found + rtsigOverflow();
+        found += rtsigConsume(si.si_fd);
+        sig = sigtimedwait(&rtSet, &si, &zero);  /* Any more queued? */
+    }
+    if (sig == -1 && errno != EAGAIN && errno != EINTR)
+        errExit("sigtimedwait");
+    return found;
+}
+
+static int
+rtsigFdWait(void)
+{
+    struct signalfd_siginfo fdsi[MAX_EVENTS];
+    ssize_t numRead;
+    int found, j;
+
+    numRead = read(sigFd, fdsi, sizeof(fdsi));
+    if (numRead == -1)
+        errExit("read-signalfd");
+
+    found = 0;
+    for (j = 0; j < numRead / sizeof(struct signalfd_siginfo); j++) {
+        if (fdsi[j].ssi_signo == SIGIO)
+            return found + rtsigOverflow();
+        found += rtsigConsume(fdsi[j].ssi_fd);
+    }
+    return found;
+}
+
+/* Disable signal-driven I/O, and discard any signals still queued */
+
+static void
+rtsigTeardown(void)
+{
+    static const struct timespec zero = { 0, 0 };
+    int flags, j;
+
+    for (j = 0; j < nfds; j++) {
+        flags = fcntl(rfds[j], F_GETFL);
+        if (flags == -1 || fcntl(rfds[j], F_SETFL, flags & ~O_ASYNC) == -1)
+            errExit("fcntl-F_SETFL");
+    }
+    while (sigtimedwait(&rtSet, NULL, &zero) > 0)
+        continue;
+    if (sigprocmask(SIG_UNBLOCK, &rtSet, NULL) == -1)
+        errExit("sigprocmask");
+    if (rtOverflows > 0)
+        printf("    (%ld realtime signal queue overflows)\n", rtOverflows);
+}
+
+static void
+rtsigFdTeardown(void)
+{
+    close(sigFd);
+    rtsigTeardown();
+}
+
+static const struct {
+    const char *name;
+    void (*setup)(void);
+    int (*wait)(void);
+    void (*teardown)(void);
+} methods[] = {
+    { "select",     selectSetup,    selectWait,     NULL },
+    { "poll",       pollSetup,      pollWait,       pollTeardown },
+    { "epoll-lt",   epollLtSetup,   epollLtWait,    epollTeardown },
+    { "epoll-et",   epollEtSetup,   epollEtWait,    epollTeardown },
+    { "uring",      uringSetup,     uringWait,      uringTeardown },
+    { "rtsig",      rtsigSetup,     rtsigWait,      rtsigTeardown },
+    { "rtsig-fd",   rtsigFdSetup,   rtsigFdWait,    rtsigFdTeardown },
+};
+
+#define NMETHODS (sizeof(methods) / sizeof(methods[0]))
+
+static double
+nowUs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Create 'n' pipes or socketpairs, with nonblocking read ends. Returns
+   FALSE if the RLIMIT_NOFILE limit can't be raised far enough. */
+
+static Boolean
+createFds(int n, Boolean useSockets)
+{
+    struct rlimit rl;
+    int fds[2], j;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+        errExit("getrlimit");
+    if (rl.rlim_cur < 2 * n + 64) {
+        rl.rlim_cur = 2 * n + 64;
+        if (rl.rlim_max < rl.rlim_cur)
+            rl.rlim_max = rl.rlim_cur;
+        if (setrlimit(RLIMIT_NOFILE, &rl) == -1) {
+            errMsg("setrlimit-RLIMIT_NOFILE (need %d descriptors)", 2 * n);
+            return FALSE;
+        }
+    }
+
+    nfds = n;
+    rfds = calloc(n, sizeof(int));
+    wfds = calloc(n, sizeof(int));
+    if (rfds == NULL || wfds == NULL)
+        errExit("calloc");
+
+    maxFd = 0;
+    for (j = 0; j < n; j++) {
+        if (useSockets) {
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+                errExit("socketpair");
+        } else {
+            if (pipe(fds) == -1)
+                errExit("pipe");
+        }
+        if (fcntl(fds[0], F_SETFL, O_NONBLOCK) == -1)
+            errExit("fcntl");
+        rfds[j] = fds[0];
+        wfds[j] = fds[1];
+        if (fds[0] > maxFd)
+            maxFd = fds[0];
+    }
+    return TRUE;
+}
+
+static void
+closeFds(void)
+{
+    int j;
+
+    for (j = 0; j < nfds; j++) {
+        close(rfds[j]);
+        close(wfds[j]);
+    }
+    free(rfds);
+    free(wfds);
+}
+
+static void
+runMethod(int m, int nactive, int rounds)
+{
+    double t0, totalUs;
+    int *perm, r, j, k, tmp, found;
+
+    if (methods[m].setup == selectSetup && maxFd >= FD_SETSIZE) {
+        printf("    %-10s %12s %12s\n", methods[m].name, "-", "-");
+        return;
+    }
+
+    perm = malloc(nfds * sizeof(int));
+    if (perm == NULL)
+        errExit("malloc");
+    for (j = 0; j < nfds; j++)
+        perm[j] = j;
+
+    uringFailed = FALSE;
+    methods[m].setup();
+
+    totalUs = 0;
+    for (r = 0; r < rounds && !uringFailed; r++) {
+
+        /* Make 'nactive' distinct randomly chosen descriptors ready (a
+           partial Fisher-Yates shuffle of 'perm') */
+
+        for (j = 0; j < nactive; j++) {
+            k = j + random() % (nfds - j);
+            tmp = perm[j];
+            perm[j] = perm[k];
+            perm[k] = tmp;
+            if (write(wfds[perm[j]], "x", 1) != 1)
+                errExit("write");
+        }
+
+        t0 = nowUs();
+        for (found = 0; found < nactive; )
+            found += methods[m].wait();
+        totalUs += nowUs() - t0;
+    }
+
+    if (methods[m].teardown != NULL)
+        methods[m].teardown();
+    free(perm);
+
+    if (uringFailed)
+        printf("    %-10s %12s %12s\n", methods[m].name, "-", "-");
+    else
+        printf("    %-10s %12.2f %12.3f\n", methods[m].name,
+                totalUs / rounds, totalUs / rounds / nactive);
+}
+
+static void
+usageError(const char *progName)
+{
+    int m;
+
+    fprintf(stderr, "Usage: %s [-n nfds[,nfds...]] [-a nactive] "
+                    "[-r rounds] [-s] [method...]\n", progName);
+    fprintf(stderr, "Methods:");
+    for (m = 0; m < NMETHODS; m++)
+        fprintf(stderr, " %s", methods[m].name);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int counts[MAX_COUNTS];
+    Boolean selected[NMETHODS], useSockets;
+    int opt, ncounts, nactive, rounds, c, m, j;
+    char *tok;
+
+    ncounts = 0;
+    nactive = 1;
+    rounds = 1000;
+    useSockets = FALSE;
+    while ((opt = getopt(argc, argv, "n:a:r:s")) != -1) {
+        switch (opt) {
+        case 'a':   nactive = getInt(optarg, GN_GT_0, "nactive");       break;
+        case 'r':   rounds = getInt(optarg, GN_GT_0, "rounds");         break;
+        case 's':   useSockets = TRUE;                                  break;
+        case 'n':
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                if (ncounts == MAX_COUNTS)
+                    cmdLineErr("Too many counts (max %d)\n", MAX_COUNTS);
+                counts[ncounts++] = getInt(tok, GN_GT_0, "nfds");
+            }
+            break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    for (m = 0; m < NMETHODS; m++)
+        selected[m] = (optind == argc);
+    for (j = optind; j < argc; j++) {
+        for (m = 0; m < NMETHODS; m++)
+            if (strcmp(argv[j], methods[m].name) == 0)
+                break;
+        if (m == NMETHODS)
+            usageError(argv[0]);
+        selected[m] = TRUE;
+    }
+
+    if (ncounts == 0)
+        for (c = 10; c <= 100000; c *= 10)
+            counts[ncounts++] = c;
+
+    for (c = 0; c < ncounts; c++)
+        if (nactive > counts[c])
+            cmdLineErr("nactive (%d) exceeds nfds (%d)\n", nactive,
+                    counts[c]);
+
+    srandom(1);
+    setbuf(stdout, NULL);
+
+    for (c = 0; c < ncounts; c++) {
+        if (!createFds(counts[c], useSockets)) {
+            printf("%d descriptors: skipped\n", counts[c]);
+            continue;
+        }
+
+        printf("%d %s, %d active per round\n", counts[c],
+                useSockets ? "socketpairs" : "pipes", nactive);
+        printf("    %-10s %12s %12s\n", "method", "us/round", "us/event");
+        for (m = 0; m < NMETHODS; m++)
+            if (selected[m])
+                runMethod(m, nactive, rounds);
+
+        closeFds();
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,381 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* rtsig_echo_sv.c
+
+   A TCP echo server that handles all clients in a single process using
+   signal-driven I/O, in the manner of is_echo_epoll_sv.c (whose
+   per-connection ring buffers it borrows).
+
+   demo_sigio.c catches plain SIGIO, which says only that *some*
+   descriptor is ready, so that a program monitoring many descriptors
+   must then check each one. Here, F_SETSIG selects a realtime signal
+   instead; realtime signals are queued, one per event, and the siginfo_t
+   of each says which descriptor is ready (si_fd) and how (si_band). The
+   signal is blocked, and accepted synchronously, in batches: by default,
+   by reading an array of signalfd_siginfo structures from a signalfd;
+   with -w, by sigwaitinfo() followed by further sigtimedwait() calls
+   with a zero timeout.
+
+   Usage: rtsig_echo_sv [-b batch] [-w] [-s service]
+
+        -b batch     Most signals accepted per batch (default: 256)
+        -s service   Listen on 'service' instead of "echo"
+        -w           Use sigwaitinfo() rather than a signalfd
+
+   Like edge-triggered epoll, a signal reports a change (new input, or
+   new space for output), so that a connection is serviced until neither
+   direction makes progress. If the queue of realtime signals overflows
+   (see RLIMIT_SIGPENDING and /proc/sys/kernel/rtsig-max), the kernel
+   sends SIGIO instead, and events have been lost: the server then
+   discards the queued signals and services every connection. On
+   SIGINT or SIGTERM, the server displays the number of signals and
+   batches it handled, and the number of overflows.
+
+   Try: rtsig_echo_sv -s 50000 &
+        is_load_gen -c 1000 -r 20000 -d 10 localhost 50000
+   and compare with is_echo_epoll_sv (see ../sockets). Each connection
+   requires a descriptor, so the RLIMIT_NOFILE limit may need raising.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include "inet_sockets.h"       /* Declares our socket functions */
+#include "tlpi_hdr.h"
+
+#define SERVICE "echo"          /* Name of TCP service */
+
+#define RING_SIZE 4096          /* Per-connection buffer; must be a power
+                                   of two */
+#define MAX_BATCH 4096
+
+struct conn {                   /* State for one client connection */
+    Boolean eof;                /* Has client shut down its output? */
+    size_t head;                /* Total bytes placed in 'ring' */
+    size_t tail;                /* Total bytes sent from 'ring' */
+    char ring[RING_SIZE];
+};
+
+static struct conn **conns;     /* Indexed by file descriptor */
+static int maxConns;            /* Size of 'conns' */
+static int lfd;
+static int rtSig;
+static sigset_t sigSet;         /* rtSig, SIGIO, SIGINT, SIGTERM */
+static long long numSigs, numBatches, numOverflows;
+
+/* Arrange for input and output events on 'fd' to generate 'rtSig',
+   carrying 'fd' in its siginfo_t, and make 'fd' nonblocking */
+
+static int
+enableSigio(int fd)
+{
+    int flags;
+
+    if (fcntl(fd, F_SETOWN, getpid()) == -1 ||
+            fcntl(fd, F_SETSIG, rtSig) == -1)
+        return -1;
+    flags = fcntl(fd, F_GETFL);
+    if (flags == -1)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_ASYNC | O_NONBLOCK);
+}
+
+/* Build an iovec describing the part of the ring that starts at offset
+   'from' and contains 'len' bytes (which may wrap around the end of the
+   ring). Returns the number of iovec elements used (0, 1, or 2). */
+
+static int
+ringIov(struct conn *c, size_t from, size_t len, struct iovec iov[2])
+{
+    size_t off, first;
+
+    if (len == 0)
+        return 0;
+
+    off = from & (RING_SIZE - 1);
+    first = min(len, RING_SIZE - off);
+    iov[0].iov_base = c->ring + off;
+    iov[0].iov_len = first;
+    if (first == len)
+        return 1;
+
+    iov[1].iov_base = c->ring;
+    iov[1].iov_len = len - first;
+    return 2;
+}
+
+/* Move as much data as possible from the socket into the ring, and from
+   the ring back to the socket, until neither direction makes progress.
+   Returns TRUE if the connection should be closed. */
+
+static Boolean
+serviceConn(int fd, struct conn *c)
+{
+    struct iovec iov[2];
+    ssize_t numRead, numWritten;
+    Boolean progress;
+    int cnt;
+
+    do {
+        progress = FALSE;
+
+        cnt = ringIov(c, c->head, RING_SIZE - (c->head - c->tail), iov);
+        if (!c->eof && cnt > 0) {
+            numRead = readv(fd, iov, cnt);
+            if (numRead > 0) {
+                c->head += numRead;
+                progress = TRUE;
+            } else if (numRead == 0) {
+                c->eof = TRUE;
+            } else if (errno != EAGAIN && errno != EINTR) {
+                if (errno != ECONNRESET)
+                    errMsg("readv");
+                return TRUE;
+            }
+        }
+
+        cnt = ringIov(c, c->tail, c->head - c->tail, iov);
+        if (cnt > 0) {
+            numWritten = writev(fd, iov, cnt);
+            if (numWritten > 0) {
+                c->tail += numWritten;
+                progress = TRUE;
+            } else if (numWritten == -1 && errno != EAGAIN &&
+                       errno != EINTR) {
+                if (errno != EPIPE && errno != ECONNRESET)
+                    errMsg("writev");
+                return TRUE;
+            }
+        }
+    } while (progress);
+
+    return c->eof && c->head == c->tail;
+}
+
+static void
+closeConn(int fd)
+{
+    free(conns[fd]);
+    conns[fd] = NULL;
+    close(fd);          /* Signals already queued for 'fd' are harmless:
+                           see handleEvent() */
+}
+
+/* Accept all pending connections on the (nonblocking) listening socket */
+
+static void
+acceptConns(void)
+{
+    struct conn *c;
+    int cfd;
+
+    for (;;) {
+        cfd = accept(lfd, NULL, NULL);
+        if (cfd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                errMsg("accept");
+            return;
+        }
+
+        c = (cfd < maxConns) ? calloc(1, sizeof(struct conn)) : NULL;
+        if (c == NULL || enableSigio(cfd) == -1) {
+            errMsg("Can't add connection");
+            free(c);
+            close(cfd);
+            continue;
+        }
+        conns[cfd] = c;
+
+        /* Input that arrived before O_ASYNC was set generated no
+           signal, so service the connection now */
+
+        if (serviceConn(cfd, c))
+            closeConn(cfd);
+    }
+}
+
+/* Handle a signal saying that 'fd' is ready. Since a signal may still be
+   queued for a descriptor that has since been closed (and even reused
+   for a new connection), we simply service whatever connection now has
+   that descriptor; at worst, the reads and writes fail with EAGAIN. */
+
+static void
+handleEvent(int fd)
+{
+    if (fd == lfd)
+        acceptConns();
+    else if (fd >= 0 && fd < maxConns && conns[fd] != NULL &&
+             serviceConn(fd, conns[fd]))
+        closeConn(fd);
+}
+
+/* The realtime signal queue overflowed, so some events were lost:
+   discard the queued signals (which the following makes redundant), and
+   service everything */
+
+static void
+handleOverflow(void)
+{
+    static const struct timespec zero = { 0, 0 };
+    sigset_t rtOnly;
+    int fd;
+
+    numOverflows++;
+    sigemptyset(&rtOnly);
+    sigaddset(&rtOnly, rtSig);
+    sigaddset(&rtOnly, SIGIO);
+    while (sigtimedwait(&rtOnly, NULL, &zero) > 0)
+        continue;
+
+    acceptConns();
+    for (fd = 0; fd < maxConns; fd++)
+        if (conns[fd] != NULL && serviceConn(fd, conns[fd]))
+            closeConn(fd);
+}
+
+/* Handle one accepted signal; returns FALSE if the server should stop */
+
+static Boolean
+handleSignal(int sig, int fd)
+{
+    numSigs++;
+    if (sig == rtSig)
+        handleEvent(fd);
+    else if (sig == SIGIO)
+        handleOverflow();
+    else
+        return FALSE;                   /* SIGINT or SIGTERM */
+    return TRUE;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-b batch] [-w] [-s service]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static struct signalfd_siginfo fdsi[MAX_BATCH];
+    static const struct timespec zero = { 0, 0 };
+    struct rlimit rl;
+    siginfo_t si;
+    Boolean useSigwait, running;
+    const char *service;
+    ssize_t numRead;
+    int opt, batch, sfd, sig, n, j;
+
+    batch = 256;
+    useSigwait = FALSE;
+    service = SERVICE;
+    while ((opt = getopt(argc, argv, "b:s:w")) != -1) {
+        switch (opt) {
+        case 'b':   batch = getInt(optarg, GN_GT_0, "batch");   break;
+        case 's':   service = optarg;                           break;
+        case 'w':   useSigwait = TRUE;                          break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+    if (batch > MAX_BATCH)
+        cmdLineErr("batch must be at most %d\n", MAX_BATCH);
+
+    /* Raise the descriptor limit as far as we may */
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+        errExit("getrlimit");
+    rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+        errExit("setrlimit");
+    maxConns = (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > 1 << 20) ?
+               1 << 20 : rl.rlim_cur;
+    conns = calloc(maxConns, sizeof(struct conn *));
+    if (conns == NULL)
+        errExit("calloc");
+
+    /* Block the signals that we accept synchronously; SIGPIPE is
+       ignored, so that write errors are reported by writev() */
+
+    rtSig = SIGRTMIN;
+    sigemptyset(&sigSet);
+    sigaddset(&sigSet, rtSig);
+    sigaddset(&sigSet, SIGIO);
+    sigaddset(&sigSet, SIGINT);
+    sigaddset(&sigSet, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &sigSet, NULL) == -1)
+        errExit("sigprocmask");
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    sfd = -1;
+    if (!useSigwait) {
+        sfd = signalfd(-1, &sigSet, SFD_CLOEXEC);
+        if (sfd == -1)
+            errExit("signalfd");
+    }
+
+    lfd = inetListen(service, SOMAXCONN, NULL);
+    if (lfd == -1)
+        errExit("inetListen");
+    if (enableSigio(lfd) == -1)
+        errExit("enableSigio");
+    acceptConns();              /* In case connections are already queued */
+
+    for (running = TRUE; running; ) {
+        if (useSigwait) {
+            sig = sigwaitinfo(&sigSet, &si);
+            if (sig == -1) {
+                if (errno == EINTR)
+                    continue;
+                errExit("sigwaitinfo");
+            }
+            numBatches++;
+            for (n = 1; running; n++) {
+                running = handleSignal(sig, si.si_fd);
+                if (n == batch)
+                    break;
+                sig = sigtimedwait(&sigSet, &si, &zero);
+                if (sig == -1)
+                    break;              /* EAGAIN: no more queued */
+            }
+        } else {
+            numRead = read(sfd, fdsi, batch * sizeof(fdsi[0]));
+            if (numRead == -1) {
+                if (errno == EINTR)
+                    continue;
+                errExit("read-signalfd");
+            }
+            numBatches++;
+            n = numRead / sizeof(fdsi[0]);
+            for (j = 0; j < n && running; j++)
+                running = handleSignal(fdsi[j].ssi_signo, fdsi[j].ssi_fd);
+        }
+    }
+
+    printf("%lld signals in %lld batches (%.1f per batch); "
+           "%lld overflows\n", numSigs, numBatches,
+           (numBatches > 0) ? (double) numSigs / numBatches : 0.0,
+           numOverflows);
+    exit(EXIT_SUCCESS);
+}
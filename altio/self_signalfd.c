@@ -0,0 +1,242 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* self_signalfd.c
+
+   A variant of self_pipe.c that uses a signalfd instead of the self-pipe
+   trick to wait for signals while also monitoring a set of file
+   descriptors. SIGINT and SIGCHLD are blocked and instead read from the
+   signalfd; no handler is established and no pipe is needed. Each read()
+   from the signalfd retrieves as many as BATCH_SIZE pending signals.
+
+   Usage: self_signalfd [-e] [-c nchildren] {timeout|-} fd...
+
+        -e             Use epoll instead of select()
+        -c nchildren   Create 'nchildren' children that immediately exit,
+                       and loop until all have been reaped after SIGCHLD
+
+   Because standard signals are not queued, several children terminating
+   at about the same time may produce only a single SIGCHLD; therefore,
+   each SIGCHLD read from the signalfd results in a loop that reaps all
+   terminated children using waitpid(WNOHANG).
+
+   For example:
+
+        self_signalfd -c 1000 - 0
+
+   This program is Linux-specific.
+
+   See also signals/sig_speed_methods.c, which compares the speed of the
+   self-pipe trick, sigwaitinfo(), and signalfd.
+*/
+#include <sys/signalfd.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include "tlpi_hdr.h"
+
+#define BATCH_SIZE 64           /* Max. signals retrieved per read() */
+
+static int numChildren;         /* Children created and not yet reaped */
+
+/* Read all pending signals from 'sfd', returning TRUE if SIGINT was
+   among them */
+
+static Boolean
+drainSignalfd(int sfd)
+{
+    struct signalfd_siginfo fdsi[BATCH_SIZE];
+    ssize_t s;
+    int j, nsigs, nreads, reaped;
+    Boolean gotInt;
+
+    gotInt = FALSE;
+    nsigs = nreads = reaped = 0;
+    for (;;) {
+        s = read(sfd, fdsi, sizeof(fdsi));
+        if (s == -1) {
+            if (errno == EAGAIN)
+                break;                  /* No more pending signals */
+            errExit("read");
+        }
+        nreads++;
+
+        for (j = 0; j < s / (ssize_t) sizeof(struct signalfd_siginfo); j++) {
+            nsigs++;
+            if (fdsi[j].ssi_signo == SIGINT) {
+                gotInt = TRUE;
+            } else if (fdsi[j].ssi_signo == SIGCHLD) {
+                while (numChildren > 0 && waitpid(-1, NULL, WNOHANG) > 0) {
+                    numChildren--;
+                    reaped++;
+                }
+            }
+        }
+    }
+
+    printf("Read %d signal(s) in %d read()s", nsigs, nreads);
+    if (reaped > 0)
+        printf("; reaped %d child(ren)", reaped);
+    printf("\n");
+
+    return gotInt;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-e] [-c nchildren] {timeout|-} fd...\n"
+            "\t\t('-' means infinite timeout)\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    fd_set readfds, fds;
+    int ready, nfds, sfd, epfd, opt, timeoutMs, fd, j, n;
+    Boolean useEpoll, done;
+    struct timeval timeout;
+    struct timeval *pto;
+    struct epoll_event ev, evlist[BATCH_SIZE];
+    sigset_t mask;
+
+    useEpoll = FALSE;
+    numChildren = 0;
+    while ((opt = getopt(argc, argv, "ec:")) != -1) {
+        switch (opt) {
+        case 'e':   useEpoll = TRUE;                                    break;
+        case 'c':   numChildren = getInt(optarg, GN_GT_0, "nchildren"); break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind >= argc)
+        usageError(argv[0]);
+
+    if (strcmp(argv[optind], "-") == 0) {
+        pto = NULL;                     /* Infinite timeout */
+        timeoutMs = -1;
+    } else {
+        pto = &timeout;
+        timeout.tv_sec = getLong(argv[optind], 0, "timeout");
+        timeout.tv_usec = 0;
+        timeoutMs = timeout.tv_sec * 1000;
+    }
+
+    /* Block the signals, so that they remain pending and can be read
+       from the signalfd. SIGCHLD must be blocked before the children
+       are created. */
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+        errExit("sigprocmask");
+
+    sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sfd == -1)
+        errExit("signalfd");
+
+    /* Build the set of file descriptors to monitor: the signalfd plus the
+       fd numbers given on the command line */
+
+    epfd = -1;
+    if (useEpoll) {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd == -1)
+            errExit("epoll_create1");
+        ev.events = EPOLLIN;
+        ev.data.fd = sfd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev) == -1)
+            errExit("epoll_ctl");
+    }
+
+    FD_ZERO(&readfds);
+    FD_SET(sfd, &readfds);
+    nfds = sfd + 1;
+    for (j = optind + 1; j < argc; j++) {
+        fd = getInt(argv[j], 0, "fd");
+        if (useEpoll) {
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+                errExit("epoll_ctl");
+        } else {
+            if (fd >= FD_SETSIZE)
+                cmdLineErr("file descriptor exceeds limit (%d)\n",
+                           FD_SETSIZE);
+            if (fd >= nfds)
+                nfds = fd + 1;
+            FD_SET(fd, &readfds);
+        }
+    }
+
+    for (j = numChildren; j > 0; j--) {
+        switch (fork()) {
+        case -1:    errExit("fork");
+        case 0:     _exit(EXIT_SUCCESS);
+        default:    break;
+        }
+    }
+
+    /* Wait until a monitored fd becomes ready, SIGINT is received, or
+       the timeout expires. While children remain to be reaped, SIGCHLD
+       alone does not terminate the loop. */
+
+    FD_ZERO(&fds);
+    for (done = FALSE; !done; ) {
+        if (useEpoll) {
+            ready = epoll_wait(epfd, evlist, BATCH_SIZE, timeoutMs);
+            if (ready == -1)
+                errExit("epoll_wait");
+            FD_ZERO(&fds);
+            for (j = 0; j < ready; j++)
+                if (evlist[j].data.fd < FD_SETSIZE)
+                    FD_SET(evlist[j].data.fd, &fds);
+        } else {
+            fds = readfds;
+            ready = select(nfds, &fds, NULL, NULL, pto);
+            if (ready == -1)
+                errExit("select");
+        }
+
+        n = ready;
+        if (FD_ISSET(sfd, &fds)) {
+            n--;
+            if (drainSignalfd(sfd)) {
+                printf("SIGINT was caught\n");
+                done = TRUE;
+            }
+        }
+
+        if (ready == 0 || n > 0 || numChildren == 0)
+            done = TRUE;        /* Timeout, other fd ready, or all reaped */
+    }
+
+    printf("ready = %d\n", ready);
+    for (j = optind + 1; j < argc; j++) {
+        fd = getInt(argv[j], 0, "fd");
+        printf("%d: %s\n", fd, (fd < FD_SETSIZE && FD_ISSET(fd, &fds)) ?
+                "r" : "");
+    }
+    printf("%d: %s   (signalfd)\n", sfd, FD_ISSET(sfd, &fds) ? "r" : "");
+    if (numChildren > 0)
+        printf("%d child(ren) not yet reaped\n", numChildren);
+
+    if (pto != NULL && !useEpoll)
+        printf("timeout after select(): %ld.%03ld\n",
+               (long) timeout.tv_sec, (long) timeout.tv_usec / 1000);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,297 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* uring_functions.c
+
+   A minimal set of functions for using the Linux io_uring API (Linux 5.1
+   and later) directly via the io_uring_setup(), io_uring_enter(), and
+   io_uring_register() system calls, for systems where liburing is not
+   available.
+
+   The usual pattern of use is:
+
+        uringInit()                     Create the rings
+        uringGetSqe() + uringPrepRw()   Fill in one or more submission
+                                        queue entries (SQEs)
+        uringSubmit()                   Tell the kernel about the new SQEs
+                                        (and optionally wait for
+                                        completions)
+        uringWaitCqe()/uringPeekCqe()   Obtain a completion queue entry
+        uringCqeSeen()                  Tell the kernel that we've finished
+                                        with the CQE
+
+   The kernel and the application share the ring head and tail indexes, so
+   accesses to them must use appropriate memory barriers; we use the gcc
+   __atomic builtins for this purpose.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "uring_functions.h"
+
+#define loadAcquire(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define storeRelease(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* Create an io_uring instance with (at least) 'entries' submission queue
+   entries, and map its rings into memory. 'flags' is passed to
+   io_uring_setup() (in io_uring_params.flags). Returns 0 on success, or
+   -1 on error. */
+
+int
+uringInit(struct uring *ring, unsigned entries, unsigned flags)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+    int savedErrno;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    p.flags = flags;
+
+    ring->fd = syscall(SYS_io_uring_setup, entries, &p);
+    if (ring->fd == -1)
+        return -1;
+
+    ring->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = p.cq_off.cqes +
+                       p.cq_entries * sizeof(struct io_uring_cqe);
+
+    /* Since Linux 5.4, both rings can be mapped with a single mmap() */
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cqRingSize > ring->sqRingSize)
+            ring->sqRingSize = ring->cqRingSize;
+        ring->cqRingSize = ring->sqRingSize;
+    }
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED)
+        goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cqRing = ring->sqRing;
+    } else {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+        if (ring->cqRing == MAP_FAILED)
+            goto fail;
+    }
+
+    ring->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto fail;
+
+    sq = ring->sqRing;
+    ring->sqHead = (unsigned *) (sq + p.sq_off.head);
+    ring->sqTail = (unsigned *) (sq + p.sq_off.tail);
+    ring->sqMask = (unsigned *) (sq + p.sq_off.ring_mask);
+    ring->sqArray = (unsigned *) (sq + p.sq_off.array);
+    ring->sqEntries = p.sq_entries;
+
+    cq = ring->cqRing;
+    ring->cqHead = (unsigned *) (cq + p.cq_off.head);
+    ring->cqTail = (unsigned *) (cq + p.cq_off.tail);
+    ring->cqMask = (unsigned *) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    ring->cqEntries = p.cq_entries;
+
+    return 0;
+
+fail:
+    savedErrno = errno;
+    uringFree(ring);
+    errno = savedErrno;
+    return -1;
+}
+
+/* Unmap the rings and close the io_uring file descriptor */
+
+void
+uringFree(struct uring *ring)
+{
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqesSize);
+    if (ring->cqRing != NULL && ring->cqRing != MAP_FAILED &&
+            ring->cqRing != ring->sqRing)
+        munmap(ring->cqRing, ring->cqRingSize);
+    if (ring->sqRing != NULL && ring->sqRing != MAP_FAILED)
+        munmap(ring->sqRing, ring->sqRingSize);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+/* Return a pointer to the next free submission queue entry, which has
+   been zeroed, or NULL if the submission queue is full */
+
+struct io_uring_sqe *
+uringGetSqe(struct uring *ring)
+{
+    struct io_uring_sqe *sqe;
+
+    if (ring->sqeTail - loadAcquire(ring->sqHead) >= ring->sqEntries)
+        return NULL;
+
+    sqe = &ring->sqes[ring->sqeTail & *ring->sqMask];
+    ring->sqeTail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/* Fill in the common fields of 'sqe' for a read/write style operation */
+
+void
+uringPrepRw(struct io_uring_sqe *sqe, int op, int fd, const void *addr,
+            unsigned len, off_t offset)
+{
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) addr;
+    sqe->len = len;
+    sqe->off = offset;
+}
+
+/* Place all SQEs obtained by uringGetSqe() since the last call into the
+   submission queue, and tell the kernel about them. If 'waitNr' is
+   greater than zero, also wait until at least that many completions are
+   available. Returns the number of SQEs consumed by the kernel, or -1 on
+   error. */
+
+int
+uringSubmit(struct uring *ring, unsigned waitNr)
+{
+    unsigned tail, toSubmit;
+    int s;
+
+    tail = *ring->sqTail;
+    toSubmit = ring->sqeTail - ring->sqeHead;
+    while (ring->sqeHead != ring->sqeTail) {
+        ring->sqArray[tail & *ring->sqMask] =
+                ring->sqeHead & *ring->sqMask;
+        tail++;
+        ring->sqeHead++;
+    }
+
+    /* Make the SQE contents visible to the kernel before the new tail */
+
+    storeRelease(ring->sqTail, tail);
+
+    do {
+        s = syscall(SYS_io_uring_enter, ring->fd, toSubmit, waitNr,
+                    (waitNr > 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (s == -1 && errno == EINTR);
+
+    return s;
+}
+
+/* If a completion queue entry is available, return it via '*cqe' and
+   return 0; otherwise return -1 with errno set to EAGAIN. The CQE must
+   be released with uringCqeSeen(). */
+
+int
+uringPeekCqe(struct uring *ring, struct io_uring_cqe **cqe)
+{
+    unsigned head;
+
+    head = *ring->cqHead;
+    if (head == loadAcquire(ring->cqTail)) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    *cqe = &ring->cqes[head & *ring->cqMask];
+    return 0;
+}
+
+/* Wait for a completion queue entry and return it via '*cqe'. Returns 0
+   on success, or -1 on error. */
+
+int
+uringWaitCqe(struct uring *ring, struct io_uring_cqe **cqe)
+{
+    int s;
+
+    while (uringPeekCqe(ring, cqe) == -1) {
+        s = syscall(SYS_io_uring_enter, ring->fd, 0, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0);
+        if (s == -1 && errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+/* Mark the CQE most recently returned by uringPeekCqe() or uringWaitCqe()
+   as consumed */
+
+void
+uringCqeSeen(struct uring *ring)
+{
+    storeRelease(ring->cqHead, *ring->cqHead + 1);
+}
+
+/* Register 'nr' buffers described by 'iov' for use with
+   IORING_OP_READ_FIXED and IORING_OP_WRITE_FIXED */
+
+int
+uringRegisterBuffers(struct uring *ring, const struct iovec *iov,
+                     unsigned nr)
+{
+    return syscall(SYS_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS,
+                   iov, nr);
+}
+
+/* Register 'nr' file descriptors, which can then be referred to (by their
+   index in 'fds') in SQEs that specify the IOSQE_FIXED_FILE flag */
+
+int
+uringRegisterFiles(struct uring *ring, const int *fds, unsigned nr)
+{
+    return syscall(SYS_io_uring_register, ring->fd, IORING_REGISTER_FILES,
+                   fds, nr);
+}
+
+/* Return 1 if the kernel supports the operation 'op' (an IORING_OP_*
+   value), or 0 if it does not (or is too old (before Linux 5.6) to say);
+   return -1 on error */
+
+int
+uringOpSupported(struct uring *ring, int op)
+{
+    struct io_uring_probe *probe;
+    size_t size;
+    int supported;
+
+    size = sizeof(struct io_uring_probe) +
+           256 * sizeof(struct io_uring_probe_op);
+    probe = calloc(1, size);
+    if (probe == NULL)
+        return -1;
+
+    supported = 0;
+    if (syscall(SYS_io_uring_register, ring->fd, IORING_REGISTER_PROBE,
+                probe, 256) == 0)
+        supported = op <= probe->last_op &&
+                    (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+
+    free(probe);
+    return supported;
+}
@@ -0,0 +1,76 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* uring_functions.h
+
+   Header file for uring_functions.c.
+*/
+#ifndef URING_FUNCTIONS_H
+#define URING_FUNCTIONS_H       /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* An io_uring instance, with pointers to the shared submission queue (SQ)
+   and completion queue (CQ) rings that are mapped from the kernel */
+
+struct uring {
+    int fd;                     /* File descriptor from io_uring_setup() */
+
+    unsigned *sqHead;           /* SQ ring: consumed by kernel */
+    unsigned *sqTail;           /* SQ ring: produced by us */
+    unsigned *sqMask;
+    unsigned *sqArray;          /* Indexes into 'sqes' */
+    unsigned sqEntries;
+    unsigned sqeTail;           /* SQEs handed out by uringGetSqe() */
+    unsigned sqeHead;           /* SQEs already placed in SQ ring */
+    struct io_uring_sqe *sqes;
+
+    unsigned *cqHead;           /* CQ ring: consumed by us */
+    unsigned *cqTail;           /* CQ ring: produced by kernel */
+    unsigned *cqMask;
+    unsigned cqEntries;
+    struct io_uring_cqe *cqes;
+
+    void *sqRing;               /* Mappings, for uringFree() */
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    size_t sqesSize;
+};
+
+int uringInit(struct uring *ring, unsigned entries, unsigned flags);
+
+void uringFree(struct uring *ring);
+
+struct io_uring_sqe *uringGetSqe(struct uring *ring);
+
+void uringPrepRw(struct io_uring_sqe *sqe, int op, int fd, const void *addr,
+                 unsigned len, off_t offset);
+
+int uringSubmit(struct uring *ring, unsigned waitNr);
+
+int uringPeekCqe(struct uring *ring, struct io_uring_cqe **cqe);
+
+int uringWaitCqe(struct uring *ring, struct io_uring_cqe **cqe);
+
+void uringCqeSeen(struct uring *ring);
+
+int uringRegisterBuffers(struct uring *ring, const struct iovec *iov,
+                         unsigned nr);
+
+int uringRegisterFiles(struct uring *ring, const int *fds, unsigned nr);
+
+int uringOpSupported(struct uring *ring, int op);
+
+#endif
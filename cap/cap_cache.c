@@ -0,0 +1,156 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 39 */
+
+/* cap_cache.c
+
+   Functions for changing the calling thread's capabilities cheaply, for
+   programs that raise and lower capabilities often (e.g., around each
+   file that they open).
+
+   modifyCapSetting() (cap_functions.c) retrieves the capabilities with
+   cap_get_proc(), which allocates a cap_t and calls capget(), changes one
+   capability, and calls capset(). The functions here instead keep a copy
+   of the thread's capability sets in memory (loaded by the first call,
+   or by capCacheLoad()), and use the capget() and capset() system calls
+   directly, so that:
+
+     * capCacheHas() answers from the copy, without a system call;
+
+     * capCacheSet() changes any number of capabilities in one set with a
+       single capset(), and makes no system call at all if the sets
+       would not change (e.g., when raising a capability that is already
+       raised);
+
+     * nothing is allocated.
+
+   capCacheRaise() and capCacheLower() are shorthands for changing one
+   capability in the effective set. 'set' is one of CC_EFFECTIVE,
+   CC_PERMITTED, and CC_INHERITABLE, and 'on' is nonzero to add
+   capabilities, or zero to remove them.
+
+   Capabilities are a per-thread attribute, so the copy is kept per
+   thread. The copy becomes stale if the capabilities are changed other
+   than via these functions (e.g., by cap_set_proc(), or by a change of
+   user IDs); call capCacheLoad() after such a change.
+
+   capCacheHas() returns 1 or 0, or -1 on error; the other functions
+   return 0 on success, or -1 on error. After a failed capset() (e.g.,
+   raising a capability that is not permitted), the capabilities and the
+   copy are unchanged.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "cap_cache.h"          /* Declares functions defined here */
+
+typedef struct __user_cap_data_struct capData[_LINUX_CAPABILITY_U32S_3];
+
+static __thread capData cached;
+static __thread int loaded;
+
+int
+capCacheLoad(void)
+{
+    struct __user_cap_header_struct hdr;
+
+    hdr.version = _LINUX_CAPABILITY_VERSION_3;
+    hdr.pid = 0;                        /* Calling thread */
+    if (syscall(SYS_capget, &hdr, cached) == -1)
+        return -1;
+    loaded = 1;
+    return 0;
+}
+
+/* Return a pointer to the word of 'data' that holds 'capability' in
+   'set', or NULL if the arguments are invalid */
+
+static __u32 *
+capWord(capData data, int set, int capability)
+{
+    struct __user_cap_data_struct *d;
+
+    if (capability < 0 || capability >= 32 * _LINUX_CAPABILITY_U32S_3)
+        return NULL;
+    d = &data[capability / 32];
+    switch (set) {
+    case CC_EFFECTIVE:   return &d->effective;
+    case CC_PERMITTED:   return &d->permitted;
+    case CC_INHERITABLE: return &d->inheritable;
+    default:             return NULL;
+    }
+}
+
+int
+capCacheHas(int set, int capability)
+{
+    __u32 *w;
+
+    if (!loaded && capCacheLoad() == -1)
+        return -1;
+    w = capWord(cached, set, capability);
+    if (w == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    return (*w & (1U << (capability % 32))) != 0;
+}
+
+int
+capCacheSet(int set, const int *capList, int ncap, int on)
+{
+    struct __user_cap_header_struct hdr;
+    capData data;
+    __u32 *w;
+    int j;
+
+    if (!loaded && capCacheLoad() == -1)
+        return -1;
+
+    memcpy(data, cached, sizeof(capData));
+    for (j = 0; j < ncap; j++) {
+        w = capWord(data, set, capList[j]);
+        if (w == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (on)
+            *w |= 1U << (capList[j] % 32);
+        else
+            *w &= ~(1U << (capList[j] % 32));
+    }
+
+    if (memcmp(data, cached, sizeof(capData)) == 0)
+        return 0;                       /* No change: nothing to do */
+
+    hdr.version = _LINUX_CAPABILITY_VERSION_3;
+    hdr.pid = 0;
+    if (syscall(SYS_capset, &hdr, data) == -1)
+        return -1;
+    memcpy(cached, data, sizeof(capData));
+    return 0;
+}
+
+int
+capCacheRaise(int capability)
+{
+    return capCacheSet(CC_EFFECTIVE, &capability, 1, 1);
+}
+
+int
+capCacheLower(int capability)
+{
+    return capCacheSet(CC_EFFECTIVE, &capability, 1, 0);
+}
@@ -0,0 +1,36 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 39 */
+
+/* cap_cache.h
+
+   Header file for cap_cache.c.
+*/
+#ifndef CAP_CACHE_H             /* Prevent double inclusion */
+#define CAP_CACHE_H
+
+#include <linux/capability.h>   /* Defines CAP_* constants */
+
+#define CC_EFFECTIVE   0        /* Capability sets */
+#define CC_PERMITTED   1
+#define CC_INHERITABLE 2
+
+int capCacheLoad(void);
+
+int capCacheHas(int set, int capability);
+
+int capCacheSet(int set, const int *capList, int ncap, int on);
+
+int capCacheRaise(int capability);
+
+int capCacheLower(int capability);
+
+#endif
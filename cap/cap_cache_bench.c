@@ -0,0 +1,123 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 39 */
+
+/* cap_cache_bench.c
+
+   Compare the cost of raising and lowering a capability in the effective
+   set around an operation, using modifyCapSetting() (cap_functions.c,
+   which uses libcap) and using capCacheRaise() and capCacheLower()
+   (cap_cache.c).
+
+   Usage: cap_cache_bench [-n iterations] [file]
+
+   Each iteration raises CAP_DAC_READ_SEARCH, opens 'file' (default:
+   /etc/shadow), closes it, and lowers the capability. The program must
+   have CAP_DAC_READ_SEARCH in its permitted set, e.g.:
+
+        $ sudo setcap "cap_dac_read_search=p" cap_cache_bench
+
+   or be run by root.
+
+   This program is Linux-specific.
+*/
+#include <sys/capability.h>
+#include <fcntl.h>
+#include <time.h>
+#include "cap_functions.h"
+#include "cap_cache.h"
+#include "tlpi_hdr.h"
+
+static double
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+openFile(const char *path)
+{
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        errExit("open %s", path);
+    close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *path;
+    long n, j;
+    double t0, base, libcap, cached;
+    int opt;
+
+    n = 100000;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n': n = getLong(optarg, GN_GT_0, "iterations");           break;
+        default:  usageErr("%s [-n iterations] [file]\n", argv[0]);
+        }
+    }
+    path = (optind < argc) ? argv[optind] : "/etc/shadow";
+
+    /* Start with the capability lowered */
+
+    if (capCacheLower(CAP_DAC_READ_SEARCH) == -1)
+        errExit("capCacheLower");
+    if (capCacheHas(CC_PERMITTED, CAP_DAC_READ_SEARCH) != 1)
+        fatal("CAP_DAC_READ_SEARCH is not in the permitted set");
+
+    /* Cost of open() + close() alone, with the capability raised */
+
+    if (capCacheRaise(CAP_DAC_READ_SEARCH) == -1)
+        errExit("capCacheRaise");
+    t0 = nowNs();
+    for (j = 0; j < n; j++)
+        openFile(path);
+    base = (nowNs() - t0) / n;
+    if (capCacheLower(CAP_DAC_READ_SEARCH) == -1)
+        errExit("capCacheLower");
+
+    t0 = nowNs();
+    for (j = 0; j < n; j++) {
+        if (modifyCapSetting(CAP_EFFECTIVE, CAP_DAC_READ_SEARCH,
+                             CAP_SET) == -1)
+            errExit("modifyCapSetting");
+        openFile(path);
+        if (modifyCapSetting(CAP_EFFECTIVE, CAP_DAC_READ_SEARCH,
+                             CAP_CLEAR) == -1)
+            errExit("modifyCapSetting");
+    }
+    libcap = (nowNs() - t0) / n;
+
+    capCacheLoad();                     /* libcap changed the capabilities */
+    t0 = nowNs();
+    for (j = 0; j < n; j++) {
+        if (capCacheRaise(CAP_DAC_READ_SEARCH) == -1)
+            errExit("capCacheRaise");
+        openFile(path);
+        if (capCacheLower(CAP_DAC_READ_SEARCH) == -1)
+            errExit("capCacheLower");
+    }
+    cached = (nowNs() - t0) / n;
+
+    printf("open+close only:    %8.0f ns\n", base);
+    printf("modifyCapSetting(): %8.0f ns (%.0f ns for raise+lower)\n",
+           libcap, libcap - base);
+    printf("capCache*():        %8.0f ns (%.0f ns for raise+lower)\n",
+           cached, cached - base);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,362 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* alloc_mem_pressure.c
+
+   A memory-pressure benchmark: like alloc_mem.c, allocate (and touch)
+   memory block by block, but behave like a well-mannered cache, backing
+   off when the kernel reports memory pressure.
+
+   Usage: alloc_mem_pressure [-b block-KiB] [-r rate-MiB/s] [-l limit-MiB]
+                [-c cgroup-dir] [-T trigger] [-F percent] [-m free|dontneed]
+                [-d secs]
+
+        -b block-KiB    Size of each block (default: 1024)
+        -r rate-MiB/s   Target allocation rate (default: 64)
+        -l limit-MiB    Size of the cache (default: 1024); once it is full,
+                        the oldest block is released for each new block
+        -c cgroup-dir   Monitor the memory.pressure and memory.events
+                        files of this cgroup (v2); by default, the program
+                        monitors /proc/pressure/memory only
+        -T trigger      PSI trigger (default: "some 150000 2000000", i.e.,
+                        150 ms of stall in any 2-second window; since
+                        Linux 6.5, processes without CAP_SYS_RESOURCE can
+                        create only triggers whose window is a multiple
+                        of 2 seconds)
+        -F percent      Percentage of the cache released on each pressure
+                        notification (default: 25)
+        -m method       madvise() advice used to release memory: "free"
+                        (MADV_FREE, the default: the kernel reclaims the
+                        pages only if it needs to) or "dontneed"
+                        (MADV_DONTNEED: the pages are freed at once)
+        -d secs         Duration of the run (default: 10)
+
+   Pressure notifications come from:
+
+   * a PSI (pressure stall information, Linux 4.20 and later) trigger
+     written to the pressure file, which then reports POLLPRI when tasks
+     have stalled waiting for memory for longer than the threshold
+     within the window (see Documentation/accounting/psi.rst);
+
+   * with -c, increases in the "high" (or "max") count in memory.events,
+     which the cgroup reports as POLLPRI when allocations are throttled
+     because the cgroup has exceeded memory.high (via cgroup_stats.c);
+
+   * SIGUSR1, which can be used to simulate pressure.
+
+   On each notification, the program releases a fraction of the cache
+   (oldest blocks first) and halves its allocation rate; for each second
+   without a notification, the rate recovers by a tenth of the target
+   rate (additive increase, multiplicative decrease).
+
+   Once per second, the program prints the cache size, the allocation
+   rate, and the PSI 10-second "some" average. At the end, it reports the
+   time taken to touch each block (a block that needs reclaim before its
+   pages can be allocated takes longer), the stall time that the kernel
+   accumulated in the PSI "some" and "full" totals during the run, and
+   the number of page faults.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "cgroup_stats.h"
+#include "tlpi_hdr.h"
+
+#ifndef MADV_FREE               /* Added in Linux 4.5 */
+#define MADV_FREE 8
+#endif
+
+struct psi {                    /* Values from a PSI file */
+    double someAvg10;
+    unsigned long long someTotal, fullTotal;    /* Microseconds */
+};
+
+static volatile sig_atomic_t gotSigusr1 = 0;
+
+static void
+sigusr1Handler(int sig)
+{
+    gotSigusr1 = 1;
+}
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+readPsi(int fd, struct psi *p)
+{
+    char buf[256], *s;
+    ssize_t n;
+
+    memset(p, 0, sizeof(*p));
+    n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0)
+        return;
+    buf[n] = '\0';
+
+    sscanf(buf, "some avg10=%lf avg60=%*f avg300=%*f total=%llu",
+           &p->someAvg10, &p->someTotal);
+    s = strstr(buf, "full");
+    if (s != NULL)
+        sscanf(s, "full avg10=%*f avg60=%*f avg300=%*f total=%llu",
+               &p->fullTotal);
+}
+
+static int
+cmpDouble(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+usageError(char *pname)
+{
+    fprintf(stderr, "Usage: %s [-b block-KiB] [-r rate-MiB/s] "
+            "[-l limit-MiB]\n\t\t[-c cgroup-dir] [-T trigger] [-F percent] "
+            "[-m free|dontneed]\n\t\t[-d secs]\n", pname);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char *cgroupDir, *trigger, *base, path[PATH_MAX];
+    size_t blockSize, pageSize, off;
+    long nblocks, head, tail, resident, nrel, nlat, maxLat;
+    long allocated, released, events, j;
+    double targetRate, rate, credit, now, last, lastEvent, lastReport;
+    double start, t0, *lat;
+    int opt, releasePct, advice, secs, psiFd, psiStatFd, nfds;
+    uint64_t prevHigh;
+    struct pollfd pfd[2];
+    struct cgStats cg;
+    struct psi psiStart, psiNow;
+    struct rusage ru;
+    struct sigaction sa;
+    Boolean pressure;
+
+    blockSize = 1024 * 1024;
+    targetRate = 64;
+    nblocks = 0;
+    cgroupDir = NULL;
+    trigger = "some 150000 2000000";
+    releasePct = 25;
+    advice = MADV_FREE;
+    secs = 10;
+    while ((opt = getopt(argc, argv, "b:r:l:c:T:F:m:d:")) != -1) {
+        switch (opt) {
+        case 'b': blockSize = getLong(optarg, GN_GT_0, "-b") * 1024;    break;
+        case 'r': targetRate = getInt(optarg, GN_GT_0, "-r");           break;
+        case 'l': nblocks = getLong(optarg, GN_GT_0, "-l");             break;
+        case 'c': cgroupDir = optarg;                                   break;
+        case 'T': trigger = optarg;                                     break;
+        case 'F': releasePct = getInt(optarg, GN_GT_0, "-F");           break;
+        case 'd': secs = getInt(optarg, GN_GT_0, "-d");                 break;
+        case 'm':
+            if (strcmp(optarg, "free") == 0)
+                advice = MADV_FREE;
+            else if (strcmp(optarg, "dontneed") == 0)
+                advice = MADV_DONTNEED;
+            else
+                usageError(argv[0]);
+            break;
+        default:  usageError(argv[0]);
+        }
+    }
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    blockSize = (blockSize + pageSize - 1) / pageSize * pageSize;
+    nblocks = ((nblocks == 0) ? 1024 : nblocks) * 1024 * 1024 / blockSize;
+    if (nblocks < 2)
+        cmdLineErr("Limit must be at least two blocks\n");
+    targetRate = targetRate * 1024 * 1024 / blockSize;  /* Blocks/sec */
+
+    /* Reserve address space for the whole cache; pages are allocated
+       when they are touched */
+
+    base = mmap(NULL, nblocks * blockSize, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+        errExit("mmap");
+
+    /* Set up the PSI trigger; the kernel requires that the trigger is
+       written in a single write() */
+
+    if (cgroupDir != NULL)
+        snprintf(path, sizeof(path), "%s/memory.pressure", cgroupDir);
+    else
+        snprintf(path, sizeof(path), "/proc/pressure/memory");
+
+    psiFd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (psiFd == -1)
+        errExit("open %s", path);
+    if (write(psiFd, trigger, strlen(trigger) + 1) == -1)
+        errExit("write PSI trigger \"%s\"", trigger);
+    psiStatFd = open(path, O_RDONLY | O_CLOEXEC);
+    if (psiStatFd == -1)
+        errExit("open %s", path);
+
+    pfd[0].fd = psiFd;
+    pfd[0].events = POLLPRI;
+    nfds = 1;
+
+    prevHigh = 0;
+    if (cgroupDir != NULL) {
+        if (cgOpen(&cg, AT_FDCWD, cgroupDir, CG_FILE(CG_MEMORY_EVENTS)) == -1)
+            errExit("cgOpen %s", cgroupDir);
+        if (cg.avail != 0) {
+            cgRead(&cg, CG_FILE(CG_MEMORY_EVENTS));
+            prevHigh = cg.v.evHigh + cg.v.evMax;
+            pfd[1].fd = cgEventFd(&cg, CG_MEMORY_EVENTS);
+            pfd[1].events = POLLPRI;
+            nfds = 2;
+        }
+    }
+
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sa.sa_handler = sigusr1Handler;
+    if (sigaction(SIGUSR1, &sa, NULL) == -1)
+        errExit("sigaction");
+
+    printf("PID %ld: %ld blocks of %zu KiB, target %.0f MiB/s, "
+           "watching %s%s\n", (long) getpid(), nblocks, blockSize / 1024,
+           targetRate * blockSize / (1024 * 1024), path,
+           (nfds == 2) ? " and memory.events" : "");
+
+    lat = NULL;
+    nlat = maxLat = 0;
+    head = tail = resident = 0;         /* Cache is a FIFO of blocks */
+    allocated = released = events = 0;
+    rate = targetRate;
+    credit = 0;
+
+    readPsi(psiStatFd, &psiStart);
+    start = last = lastEvent = lastReport = nowSecs();
+
+    while ((now = nowSecs()) - start < secs) {
+
+        /* Allocate the blocks due since the last iteration */
+
+        credit += rate * (now - last);
+        last = now;
+        for (; credit >= 1; credit--) {
+            if (resident == nblocks) {          /* Cache full: evict */
+                if (madvise(base + tail * blockSize, blockSize, advice) == -1)
+                    errExit("madvise");
+                tail = (tail + 1) % nblocks;
+                resident--;
+            }
+
+            t0 = nowSecs();
+            for (off = 0; off < blockSize; off += pageSize)
+                base[head * blockSize + off] = 1;
+            if (nlat == maxLat) {
+                maxLat = (maxLat == 0) ? 1024 : maxLat * 2;
+                lat = realloc(lat, maxLat * sizeof(double));
+                if (lat == NULL)
+                    errExit("realloc");
+            }
+            lat[nlat++] = (nowSecs() - t0) * 1e6;
+
+            head = (head + 1) % nblocks;
+            resident++;
+            allocated++;
+        }
+
+        /* Wait for a pressure notification, or for the next tick */
+
+        if (poll(pfd, nfds, 10) == -1 && errno != EINTR)
+            errExit("poll");
+
+        pressure = FALSE;
+        if (pfd[0].revents & POLLPRI)
+            pressure = TRUE;
+        if (pfd[0].revents & POLLERR)
+            fatal("PSI trigger failed (was the pressure file removed?)");
+        if (nfds == 2 && (pfd[1].revents & POLLPRI)) {
+            cgRead(&cg, CG_FILE(CG_MEMORY_EVENTS));
+            if (cg.v.evHigh + cg.v.evMax > prevHigh)
+                pressure = TRUE;
+            prevHigh = cg.v.evHigh + cg.v.evMax;
+        }
+        if (gotSigusr1) {
+            gotSigusr1 = 0;
+            pressure = TRUE;
+        }
+
+        now = nowSecs();
+        if (pressure) {
+            events++;
+            nrel = resident * releasePct / 100;
+            for (j = 0; j < nrel; j++) {
+                if (madvise(base + tail * blockSize, blockSize, advice) == -1)
+                    errExit("madvise");
+                tail = (tail + 1) % nblocks;
+            }
+            resident -= nrel;
+            released += nrel;
+            rate = (rate / 2 > 1) ? rate / 2 : 1;
+            lastEvent = now;
+        } else if (now - lastEvent >= 1) {
+            rate += targetRate / 10;
+            if (rate > targetRate)
+                rate = targetRate;
+            lastEvent = now;
+        }
+
+        if (now - lastReport >= 1) {
+            readPsi(psiStatFd, &psiNow);
+            printf("%5.1f: cache %6.0f MiB  rate %6.1f MiB/s  "
+                   "PSI some avg10 %5.2f  events %ld\n", now - start,
+                   (double) resident * blockSize / (1024 * 1024),
+                   rate * blockSize / (1024 * 1024), psiNow.someAvg10,
+                   events);
+            lastReport = now;
+        }
+    }
+
+    readPsi(psiStatFd, &psiNow);
+    if (getrusage(RUSAGE_SELF, &ru) == -1)
+        errExit("getrusage");
+
+    printf("Allocated %.0f MiB, released %.0f MiB on %ld pressure events\n",
+           (double) allocated * blockSize / (1024 * 1024),
+           (double) released * blockSize / (1024 * 1024), events);
+    if (nlat > 0) {
+        qsort(lat, nlat, sizeof(double), cmpDouble);
+        printf("Block touch time (us): median %.0f  p99 %.0f  max %.0f\n",
+               lat[nlat / 2], lat[(nlat - 1) * 99 / 100], lat[nlat - 1]);
+    }
+    printf("PSI stall time during run: some %.1f ms, full %.1f ms\n",
+           (psiNow.someTotal - psiStart.someTotal) / 1000.0,
+           (psiNow.fullTotal - psiStart.fullTotal) / 1000.0);
+    printf("Page faults: minor %ld, major %ld\n", ru.ru_minflt,
+           ru.ru_majflt);
+
+    exit(EXIT_SUCCESS);
+}
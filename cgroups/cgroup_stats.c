@@ -0,0 +1,347 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* cgroup_stats.c
+
+   Read the resource-accounting files of a cgroup v2 directory cheaply
+   enough that an agent can sample thousands of cgroups per second.
+
+   cgOpen() opens the requested files of a cgroup once; files that don't
+   exist (because the corresponding controller is not enabled for the
+   cgroup) are skipped. cgRead() then re-reads the files with pread() at
+   offset 0 (a cgroup file is regenerated by the kernel on each read
+   from offset 0, so there is no need to reopen it or to seek) into a
+   per-thread buffer that is reused for every file and cgroup (and grown
+   if a file doesn't fit), and parses the contents in place, without
+   stdio, into the fields of a 'struct cgValues'. Each file has a table
+   of the keys that are of interest; since the kernel emits the keys of
+   a file in a fixed order, the search for each key starts after the
+   previous match, so that a key that is wanted is usually found at the
+   first comparison.
+
+   For push notification of changes, cgEventFd() returns the descriptor
+   of memory.events or cgroup.events: the kernel reports a change to one
+   of these files (e.g., an OOM kill, or the cgroup becoming unpopulated)
+   as an exceptional condition (POLLPRI for poll(), EPOLLPRI for epoll),
+   which remains set until the file is read again with cgRead(). (Such
+   changes also generate IN_MODIFY events for inotify.)
+
+   Reading a file of a cgroup that has been removed fails with ENODEV.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <fcntl.h>
+#include "cgroup_stats.h"
+#include "tlpi_hdr.h"
+
+struct cgKey {
+    const char *name;
+    size_t len;
+    size_t offset;              /* Of field in 'struct cgValues' */
+};
+
+#define KEY(name, field) \
+        { #name, sizeof(#name) - 1, offsetof(struct cgValues, field) }
+
+static const struct cgKey cpuKeys[] = {
+    KEY(usage_usec, usageUsec),
+    KEY(user_usec, userUsec),
+    KEY(system_usec, systemUsec),
+    KEY(nr_periods, nrPeriods),
+    KEY(nr_throttled, nrThrottled),
+    KEY(throttled_usec, throttledUsec),
+};
+
+static const struct cgKey memKeys[] = {
+    KEY(anon, anon),
+    KEY(file, file),
+    KEY(kernel, kernel),
+    KEY(sock, sock),
+    KEY(shmem, shmem),
+    KEY(file_mapped, fileMapped),
+    KEY(file_dirty, fileDirty),
+    KEY(file_writeback, fileWriteback),
+    KEY(pgfault, pgfault),
+    KEY(pgmajfault, pgmajfault),
+};
+
+static const struct cgKey memCurrentKeys[] = {
+    KEY(-, memCurrent),         /* File contains only a value */
+};
+
+static const struct cgKey memEventKeys[] = {
+    KEY(low, evLow),
+    KEY(high, evHigh),
+    KEY(max, evMax),
+    KEY(oom, evOom),
+    KEY(oom_kill, evOomKill),
+};
+
+static const struct cgKey ioKeys[] = {
+    KEY(rbytes, rbytes),
+    KEY(wbytes, wbytes),
+    KEY(rios, rios),
+    KEY(wios, wios),
+    KEY(dbytes, dbytes),
+    KEY(dios, dios),
+};
+
+static const struct cgKey eventKeys[] = {
+    KEY(populated, populated),
+    KEY(frozen, frozen),
+};
+
+enum { FLAT, SINGLE, NESTED };  /* File formats */
+
+#define KEYS(k)         k, sizeof(k) / sizeof(k[0])
+
+static const struct {
+    const char *name;
+    int format;
+    const struct cgKey *keys;
+    int nkeys;
+} cgFiles[CG_NFILES] = {
+    [CG_CPU_STAT] =       { "cpu.stat",       FLAT,   KEYS(cpuKeys) },
+    [CG_MEMORY_STAT] =    { "memory.stat",    FLAT,   KEYS(memKeys) },
+    [CG_MEMORY_CURRENT] = { "memory.current", SINGLE, KEYS(memCurrentKeys) },
+    [CG_MEMORY_EVENTS] =  { "memory.events",  FLAT,   KEYS(memEventKeys) },
+    [CG_IO_STAT] =        { "io.stat",        NESTED, KEYS(ioKeys) },
+    [CG_CGROUP_EVENTS] =  { "cgroup.events",  FLAT,   KEYS(eventKeys) },
+};
+
+static __thread char *buf;      /* Reused for all reads by this thread */
+static __thread size_t bufSize;
+
+/* Open the files specified by the CG_FILE() mask 'files' in the cgroup
+   directory 'path' (interpreted relative to 'dirFd', as for openat()).
+   Returns 0 on success, or -1 on error. */
+
+int
+cgOpen(struct cgStats *cg, int dirFd, const char *path, int files)
+{
+    int fd, f, savedErrno;
+
+    memset(cg, 0, sizeof(*cg));
+    for (f = 0; f < CG_NFILES; f++)
+        cg->fd[f] = -1;
+
+    fd = openat(dirFd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    for (f = 0; f < CG_NFILES; f++) {
+        if (!(files & CG_FILE(f)))
+            continue;
+        cg->fd[f] = openat(fd, cgFiles[f].name, O_RDONLY | O_CLOEXEC);
+        if (cg->fd[f] >= 0) {
+            cg->avail |= CG_FILE(f);
+        } else if (errno != ENOENT) {
+            savedErrno = errno;
+            cgClose(cg);
+            close(fd);
+            errno = savedErrno;
+            return -1;
+        }
+    }
+
+    close(fd);
+    return 0;
+}
+
+void
+cgClose(struct cgStats *cg)
+{
+    int f;
+
+    for (f = 0; f < CG_NFILES; f++)
+        if (cg->fd[f] >= 0) {
+            close(cg->fd[f]);
+            cg->fd[f] = -1;
+        }
+    cg->avail = 0;
+}
+
+/* Return the descriptor that can be monitored (for POLLPRI or EPOLLPRI)
+   for changes to 'file' (CG_MEMORY_EVENTS or CG_CGROUP_EVENTS), or -1 if
+   the file is not open */
+
+int
+cgEventFd(const struct cgStats *cg, int file)
+{
+    return (file >= 0 && file < CG_NFILES) ? cg->fd[file] : -1;
+}
+
+/* Read the whole of the file 'fd' into 'buf', growing the buffer if
+   necessary. Returns the number of bytes read, or -1 on error. */
+
+static ssize_t
+readFile(int fd)
+{
+    ssize_t n;
+    char *p;
+
+    if (buf == NULL) {
+        bufSize = 8192;
+        buf = malloc(bufSize);
+        if (buf == NULL)
+            return -1;
+    }
+
+    for (;;) {
+        n = pread(fd, buf, bufSize, 0);
+        if (n < (ssize_t) bufSize)
+            return n;
+
+        p = realloc(buf, bufSize * 2);  /* May have been truncated */
+        if (p == NULL)
+            return -1;
+        buf = p;
+        bufSize *= 2;
+    }
+}
+
+static const char *
+parseU64(const char *p, const char *end, uint64_t *val)
+{
+    uint64_t v;
+
+    for (v = 0; p < end && *p >= '0' && *p <= '9'; p++)
+        v = v * 10 + (*p - '0');
+    *val = v;
+    return p;
+}
+
+/* Find the key 'name' (of length 'len') in 'keys', starting the search
+   at '*hint', which is updated to the position after the match */
+
+static const struct cgKey *
+findKey(const struct cgKey *keys, int nkeys, const char *name, size_t len,
+        int *hint)
+{
+    int j, k;
+
+    for (j = 0; j < nkeys; j++) {
+        k = (*hint + j) % nkeys;
+        if (keys[k].len == len && memcmp(keys[k].name, name, len) == 0) {
+            *hint = k + 1;
+            return &keys[k];
+        }
+    }
+    return NULL;
+}
+
+#define FIELD(v, key)   ((uint64_t *) ((char *) (v) + (key)->offset))
+
+/* Parse a file of "key value" lines */
+
+static void
+parseFlat(const struct cgKey *keys, int nkeys, const char *p,
+          const char *end, struct cgValues *v)
+{
+    const struct cgKey *k;
+    const char *name;
+    int hint;
+
+    hint = 0;
+    while (p < end) {
+        name = p;
+        while (p < end && *p != ' ' && *p != '\n')
+            p++;
+        k = findKey(keys, nkeys, name, p - name, &hint);
+        if (p < end && *p == ' ')
+            p++;
+        if (k != NULL)
+            p = parseU64(p, end, FIELD(v, k));
+        while (p < end && *p++ != '\n')
+            continue;
+    }
+}
+
+/* Parse a file of "MAJ:MIN key=value key=value..." lines, summing the
+   values for all devices */
+
+static void
+parseNested(const struct cgKey *keys, int nkeys, const char *p,
+            const char *end, struct cgValues *v)
+{
+    const struct cgKey *k;
+    const char *name;
+    uint64_t val;
+    int hint;
+
+    while (p < end) {
+        while (p < end && *p != ' ' && *p != '\n')     /* Skip device */
+            p++;
+        hint = 0;
+        while (p < end && *p == ' ') {
+            name = ++p;
+            while (p < end && *p != '=' && *p != ' ' && *p != '\n')
+                p++;
+            if (p < end && *p == '=') {
+                k = findKey(keys, nkeys, name, p - name, &hint);
+                p = parseU64(p + 1, end, &val);
+                if (k != NULL)
+                    *FIELD(v, k) += val;
+            }
+            while (p < end && *p != ' ' && *p != '\n')
+                p++;
+        }
+        if (p < end)
+            p++;                /* Skip newline */
+    }
+}
+
+/* Re-read the files specified by the CG_FILE() mask 'files' (ignoring
+   files that are not open), updating the fields of 'cg->v' that come
+   from those files. Returns 0 on success, or -1 on error, in which case
+   the fields of the file that could not be read are left at 0. */
+
+int
+cgRead(struct cgStats *cg, int files)
+{
+    ssize_t n;
+    int f, j, status;
+
+    status = 0;
+    files &= cg->avail;
+    for (f = 0; f < CG_NFILES; f++) {
+        if (!(files & CG_FILE(f)))
+            continue;
+
+        for (j = 0; j < cgFiles[f].nkeys; j++)
+            *FIELD(&cg->v, &cgFiles[f].keys[j]) = 0;
+
+        n = readFile(cg->fd[f]);
+        if (n == -1) {
+            status = -1;
+            continue;
+        }
+
+        switch (cgFiles[f].format) {
+        case FLAT:
+            parseFlat(cgFiles[f].keys, cgFiles[f].nkeys, buf, buf + n,
+                      &cg->v);
+            break;
+        case SINGLE:
+            parseU64(buf, buf + n, FIELD(&cg->v, &cgFiles[f].keys[0]));
+            break;
+        case NESTED:
+            parseNested(cgFiles[f].keys, cgFiles[f].nkeys, buf, buf + n,
+                        &cg->v);
+            break;
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,79 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* cgroup_stats.h
+
+   Header file for cgroup_stats.c.
+*/
+#ifndef CGROUP_STATS_H
+#define CGROUP_STATS_H          /* Prevent accidental double inclusion */
+
+#include <stdint.h>
+
+enum {                          /* Files in a cgroup v2 directory */
+    CG_CPU_STAT,                /* cpu.stat */
+    CG_MEMORY_STAT,             /* memory.stat */
+    CG_MEMORY_CURRENT,          /* memory.current */
+    CG_MEMORY_EVENTS,           /* memory.events */
+    CG_IO_STAT,                 /* io.stat */
+    CG_CGROUP_EVENTS,           /* cgroup.events */
+    CG_NFILES
+};
+
+#define CG_FILE(f)      (1 << (f))
+#define CG_ALL          (CG_FILE(CG_NFILES) - 1)
+
+struct cgValues {               /* Values parsed from the files; fields
+                                   from files that aren't open are 0 */
+    /* cpu.stat */
+
+    uint64_t usageUsec, userUsec, systemUsec;
+    uint64_t nrPeriods, nrThrottled, throttledUsec;
+
+    /* memory.stat (bytes, except for the fault counts) */
+
+    uint64_t anon, file, kernel, sock, shmem;
+    uint64_t fileMapped, fileDirty, fileWriteback;
+    uint64_t pgfault, pgmajfault;
+
+    /* memory.current */
+
+    uint64_t memCurrent;
+
+    /* memory.events */
+
+    uint64_t evLow, evHigh, evMax, evOom, evOomKill;
+
+    /* io.stat, summed over all devices */
+
+    uint64_t rbytes, wbytes, rios, wios, dbytes, dios;
+
+    /* cgroup.events */
+
+    uint64_t populated, frozen;
+};
+
+struct cgStats {
+    int fd[CG_NFILES];          /* Open files, or -1 */
+    int avail;                  /* CG_FILE() mask of open files */
+    struct cgValues v;
+};
+
+int cgOpen(struct cgStats *cg, int dirFd, const char *path, int files);
+
+int cgRead(struct cgStats *cg, int files);
+
+int cgEventFd(const struct cgStats *cg, int file);
+
+void cgClose(struct cgStats *cg);
+
+#endif
@@ -0,0 +1,431 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* clone3_launch.c
+
+   Launch processes in new namespaces and in a specified cgroup (v2)
+   using a single clone3() call, with CLONE_INTO_CGROUP and CLONE_PIDFD
+   (Linux 5.7 and later).
+
+   Usage: clone3_launch [options] cmd [arg...]
+          clone3_launch [options] -B n
+
+   Options can be:
+        -c dir       cgroup v2 directory in which to place the children
+                     (default: a temporary child of the caller's cgroup)
+        -j copies    Launch this many copies of 'cmd' (default: 1)
+        -M           Use the multi-step method (see below), rather than
+                     clone3()
+        -B n         Benchmark: launch and reap 'n' children that exit
+                     immediately, using each method in turn
+        -C -i -m -n -p -u -U
+                     Create new cgroup, IPC, mount, network, PID, UTS,
+                     and user namespaces, as for ns_child_exec.c
+
+   The traditional way of doing this (ns_child_exec.c, followed by a
+   write of the child's PID to the cgroup's 'cgroup.procs' file, as the
+   scripts in this directory do) takes several steps, and is racy: the
+   child starts running (and may execute a program, or create children
+   of its own) in the parent's cgroup before it is moved. The
+   multi-step method used for comparison here avoids the race in the
+   usual way, by having the child wait on a pipe until the parent has
+   moved it, and obtains a PID file descriptor with pidfd_open(), so that
+   it costs a pipe, clone(), open()/write()/close() of 'cgroup.procs',
+   pidfd_open(), and two more close() calls. With clone3(), the child is
+   created in the target cgroup, and the PID file descriptor is returned,
+   in one system call.
+
+   In launch mode, the PID file descriptors of the children are monitored
+   with epoll (a PID file descriptor becomes readable when the process
+   terminates), and each child is reaped with waitid(P_PIDFD) as it
+   terminates; this is how an event-driven launcher would reap its
+   children without SIGCHLD handling. In benchmark mode, the results are
+   displayed by the bench.c harness (see bench.h).
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <mntent.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+#ifndef CLONE_NEWCGROUP         /* Added in Linux 4.6 */
+#define CLONE_NEWCGROUP         0x02000000
+#endif
+#ifndef CLONE_PIDFD             /* Added in Linux 5.2 */
+#define CLONE_PIDFD             0x00001000
+#endif
+#ifndef CLONE_INTO_CGROUP       /* Added in Linux 5.7 */
+#define CLONE_INTO_CGROUP       0x200000000ULL
+#endif
+#ifndef P_PIDFD                 /* Added in Linux 5.4 */
+#define P_PIDFD                 3
+#endif
+
+/* The clone3() argument structure, as in <linux/sched.h> (which can't
+   be included alongside <sched.h>); glibc provides no wrapper */
+
+struct clone_args {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+};
+
+struct launcher {               /* What to launch, and where */
+    int nsFlags;                /* CLONE_NEW* flags */
+    int cgroupFd;               /* Open cgroup directory */
+    char **argv;                /* Command, or NULL to just exit */
+};
+
+static void
+usage(char *pname)
+{
+    fprintf(stderr, "Usage: %s [options] cmd [arg...]\n", pname);
+    fprintf(stderr, "       %s [options] -B n\n", pname);
+    fprintf(stderr, "Options can be:\n");
+    fprintf(stderr, "    -c dir     cgroup v2 directory for children\n");
+    fprintf(stderr, "    -j copies  Number of copies of 'cmd' to launch\n");
+    fprintf(stderr, "    -M         Use multi-step method, not clone3()\n");
+    fprintf(stderr, "    -B n       Benchmark both methods with 'n' "
+            "launches\n");
+    fprintf(stderr, "    -C -i -m -n -p -u -U   New cgroup, IPC, mount, "
+            "network, PID, UTS,\n               and user namespaces\n");
+    exit(EXIT_FAILURE);
+}
+
+/* Code executed by the child once it is in its cgroup */
+
+static void
+runChild(char **argv)
+{
+    if (argv == NULL)
+        _exit(EXIT_SUCCESS);
+
+    execvp(argv[0], argv);
+    fprintf(stderr, "execvp %s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+}
+
+/* Launch a child using clone3(). Returns a PID file descriptor for the
+   child, or -1 on error. */
+
+static int
+launchClone3(const struct launcher *l)
+{
+    struct clone_args ca;
+    int pidfd;
+    pid_t pid;
+
+    memset(&ca, 0, sizeof(ca));
+    ca.flags = l->nsFlags | CLONE_PIDFD | CLONE_INTO_CGROUP;
+    ca.pidfd = (uintptr_t) &pidfd;
+    ca.exit_signal = SIGCHLD;
+    ca.cgroup = l->cgroupFd;
+
+    /* With no stack specified, the child returns from clone3() on a
+       copy of the parent's stack, as for fork() */
+
+    pid = syscall(SYS_clone3, &ca, sizeof(ca));
+    if (pid == -1)
+        return -1;
+    if (pid == 0)
+        runChild(l->argv);
+
+    return pidfd;               /* CLONE_PIDFD sets close-on-exec */
+}
+
+/* The multi-step method */
+
+#define STACK_SIZE (64 * 1024)
+
+struct multiStepArgs {
+    int pfd[2];                 /* Pipe used to release the child */
+    char **argv;
+};
+
+static int              /* Start function for cloned child */
+multiStepChild(void *arg)
+{
+    struct multiStepArgs *ma = arg;
+    char ch;
+
+    close(ma->pfd[1]);
+    if (read(ma->pfd[0], &ch, 1) != 0)  /* Wait for EOF */
+        _exit(EXIT_FAILURE);
+
+    runChild(ma->argv);
+    return 0;
+}
+
+/* Launch a child using clone(), move it into the cgroup, and obtain a PID
+   file descriptor for it. Returns the PID file descriptor, or -1 on
+   error. */
+
+static int
+launchMultiStep(const struct launcher *l)
+{
+    static char *stack = NULL;
+    struct multiStepArgs ma;
+    char buf[32];
+    int fd, pidfd, len;
+    pid_t pid;
+
+    /* Since the child doesn't share our memory, each child can use (its
+       copy of) the same stack */
+
+    if (stack == NULL) {
+        stack = mmap(NULL, STACK_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (stack == MAP_FAILED)
+            errExit("mmap");
+    }
+
+    if (pipe2(ma.pfd, O_CLOEXEC) == -1)
+        return -1;
+    ma.argv = l->argv;
+
+    pid = clone(multiStepChild, stack + STACK_SIZE, l->nsFlags | SIGCHLD,
+                &ma);
+    if (pid == -1)
+        return -1;
+    close(ma.pfd[0]);
+
+    fd = openat(l->cgroupFd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        errExit("open cgroup.procs");
+    len = snprintf(buf, sizeof(buf), "%ld", (long) pid);
+    if (write(fd, buf, len) != len)
+        errExit("write cgroup.procs");
+    close(fd);
+
+    pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd == -1)
+        errExit("pidfd_open");
+
+    close(ma.pfd[1]);           /* Release the child */
+    return pidfd;
+}
+
+/* Reap the child referred to by 'pidfd', and close the PID file
+   descriptor */
+
+static void
+reap(int pidfd, siginfo_t *si)
+{
+    if (waitid(P_PIDFD, pidfd, si, WEXITED) == -1)
+        errExit("waitid");
+    close(pidfd);
+}
+
+/* Benchmark functions */
+
+static void
+benchClone3(long ops, void *arg)
+{
+    siginfo_t si;
+    int pidfd;
+    long j;
+
+    for (j = 0; j < ops; j++) {
+        pidfd = launchClone3(arg);
+        if (pidfd == -1)
+            errExit("clone3");
+        reap(pidfd, &si);
+    }
+}
+
+static void
+benchMultiStep(long ops, void *arg)
+{
+    siginfo_t si;
+    int pidfd;
+    long j;
+
+    for (j = 0; j < ops; j++) {
+        pidfd = launchMultiStep(arg);
+        if (pidfd == -1)
+            errExit("clone");
+        reap(pidfd, &si);
+    }
+}
+
+/* Create a temporary cgroup below the caller's own cgroup in the v2
+   hierarchy, placing its pathname in 'dir' */
+
+static void
+makeTempCgroup(char *dir, size_t size)
+{
+    char line[PATH_MAX], mnt[PATH_MAX];
+    struct mntent *ent;
+    FILE *fp;
+
+    mnt[0] = '\0';
+    fp = setmntent("/proc/self/mounts", "r");
+    if (fp == NULL)
+        errExit("setmntent");
+    while ((ent = getmntent(fp)) != NULL)
+        if (strcmp(ent->mnt_type, "cgroup2") == 0) {
+            snprintf(mnt, sizeof(mnt), "%s", ent->mnt_dir);
+            break;
+        }
+    endmntent(fp);
+    if (mnt[0] == '\0')
+        fatal("No cgroup v2 hierarchy is mounted");
+
+    /* Our membership in the v2 hierarchy is the line starting "0::" */
+
+    fp = fopen("/proc/self/cgroup", "r");
+    if (fp == NULL)
+        errExit("fopen /proc/self/cgroup");
+    while (fgets(line, sizeof(line), fp) != NULL)
+        if (strncmp(line, "0::", 3) == 0)
+            break;
+    fclose(fp);
+    if (strncmp(line, "0::", 3) != 0)
+        fatal("Can't find cgroup v2 membership");
+    line[strcspn(line, "\n")] = '\0';
+
+    snprintf(dir, size, "%s%s%sclone3_launch.%ld", mnt, line + 3,
+             (strcmp(line + 3, "/") == 0) ? "" : "/", (long) getpid());
+    if (mkdir(dir, 0755) == -1)
+        errExit("mkdir cgroup");
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct launcher l;
+    struct benchResult res;
+    struct epoll_event ev;
+    siginfo_t si;
+    char cgroupDir[PATH_MAX];
+    Boolean multiStep, tempCgroup;
+    int opt, copies, pidfd, epfd, running, j;
+    long benchOps;
+
+    l.nsFlags = 0;
+    cgroupDir[0] = '\0';
+    copies = 1;
+    multiStep = FALSE;
+    benchOps = 0;
+
+    /* The initial '+' prevents GNU-style permutation of command-line
+       options, since 'cmd' may itself have options */
+
+    while ((opt = getopt(argc, argv, "+c:j:MB:CimnpuU")) != -1) {
+        switch (opt) {
+        case 'c': snprintf(cgroupDir, sizeof(cgroupDir), "%s", optarg);
+                  break;
+        case 'j': copies = getInt(optarg, GN_GT_0, "-j");       break;
+        case 'M': multiStep = TRUE;                             break;
+        case 'B': benchOps = getLong(optarg, GN_GT_0, "-B");    break;
+        case 'C': l.nsFlags |= CLONE_NEWCGROUP;                 break;
+        case 'i': l.nsFlags |= CLONE_NEWIPC;                    break;
+        case 'm': l.nsFlags |= CLONE_NEWNS;                     break;
+        case 'n': l.nsFlags |= CLONE_NEWNET;                    break;
+        case 'p': l.nsFlags |= CLONE_NEWPID;                    break;
+        case 'u': l.nsFlags |= CLONE_NEWUTS;                    break;
+        case 'U': l.nsFlags |= CLONE_NEWUSER;                   break;
+        default:  usage(argv[0]);
+        }
+    }
+
+    if (benchOps == 0 && optind >= argc)
+        usage(argv[0]);
+    l.argv = (benchOps == 0) ? &argv[optind] : NULL;
+
+    tempCgroup = cgroupDir[0] == '\0';
+    if (tempCgroup)
+        makeTempCgroup(cgroupDir, sizeof(cgroupDir));
+
+    l.cgroupFd = open(cgroupDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (l.cgroupFd == -1)
+        errExit("open cgroup directory");
+
+    if (benchOps > 0) {
+        if (benchRun("launch multi-step", benchMultiStep, &l, benchOps,
+                     NULL, &res) == -1)
+            errExit("benchRun");
+        benchReport(&res);
+        if (benchRun("launch clone3", benchClone3, &l, benchOps,
+                     NULL, &res) == -1)
+            errExit("benchRun");
+        benchReport(&res);
+
+    } else {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd == -1)
+            errExit("epoll_create1");
+
+        for (j = 0; j < copies; j++) {
+            pidfd = multiStep ? launchMultiStep(&l) : launchClone3(&l);
+            if (pidfd == -1)
+                errExit(multiStep ? "clone" : "clone3");
+            ev.events = EPOLLIN;
+            ev.data.fd = pidfd;
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, pidfd, &ev) == -1)
+                errExit("epoll_ctl");
+        }
+
+        for (running = copies; running > 0; running--) {
+            if (epoll_wait(epfd, &ev, 1, -1) == -1) {
+                if (errno == EINTR) {
+                    running++;
+                    continue;
+                }
+                errExit("epoll_wait");
+            }
+
+            /* Children that have not yet called execve() hold duplicates
+               of the PID file descriptors created before them, so
+               closing a descriptor would not remove it from the epoll
+               interest list */
+
+            if (epoll_ctl(epfd, EPOLL_CTL_DEL, ev.data.fd, NULL) == -1)
+                errExit("epoll_ctl");
+            reap(ev.data.fd, &si);
+            if (si.si_code == CLD_EXITED)
+                printf("Child %ld exited, status=%d\n",
+                       (long) si.si_pid, si.si_status);
+            else
+                printf("Child %ld killed by signal %d (%s)\n",
+                       (long) si.si_pid, si.si_status,
+                       strsignal(si.si_status));
+        }
+    }
+
+    /* A cgroup can be removed once it has no members; our (reaped)
+       children no longer count */
+
+    if (tempCgroup && rmdir(cgroupDir) == -1)
+        errExit("rmdir cgroup");
+
+    exit(EXIT_SUCCESS);
+}
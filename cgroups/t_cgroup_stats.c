@@ -0,0 +1,270 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* t_cgroup_stats.c
+
+   Demonstrate the cgroup_stats.c functions.
+
+   Usage: t_cgroup_stats [-R] [-p | -w | [-s] [-d secs]] cgroup-dir...
+
+        -R          Also include all descendants of each 'cgroup-dir'
+        -p          Print some of the values for each cgroup, and exit
+        -w          Watch memory.events and cgroup.events of each cgroup
+                    (via epoll, for EPOLLPRI), printing changes as they
+                    occur
+        -d secs     Sample all of the cgroups repeatedly for 'secs'
+                    seconds (default: 2), and report the sampling rate
+                    and the CPU time per sample
+        -s          When sampling, use stdio (fopen(), fgets(), sscanf(),
+                    and fclose() of each file for each sample) instead of
+                    cgRead(), for comparison
+
+   For example, to measure the cost of sampling every cgroup on the
+   system:
+
+        $ ./t_cgroup_stats -R /sys/fs/cgroup
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include "cgroup_stats.h"
+#include "tlpi_hdr.h"
+
+static const char *fileNames[CG_NFILES] = {
+    "cpu.stat", "memory.stat", "memory.current", "memory.events",
+    "io.stat", "cgroup.events"
+};
+
+static char **paths;            /* Cgroups to be sampled */
+static int npaths, maxPaths;
+
+static void
+addPath(const char *path)
+{
+    if (npaths == maxPaths) {
+        maxPaths = (maxPaths == 0) ? 64 : maxPaths * 2;
+        paths = realloc(paths, maxPaths * sizeof(char *));
+        if (paths == NULL)
+            errExit("realloc");
+    }
+    paths[npaths] = strdup(path);
+    if (paths[npaths] == NULL)
+        errExit("strdup");
+    npaths++;
+}
+
+static int
+addDir(const char *path, const struct stat *sb, int type, struct FTW *ftwb)
+{
+    if (type == FTW_D)
+        addPath(path);
+    return 0;
+}
+
+/* Read all of the available files of a cgroup using stdio, in the way
+   that a simple monitoring agent might do it */
+
+static uint64_t
+stdioSample(const char *path, int avail)
+{
+    char fpath[PATH_MAX], line[256], key[64];
+    unsigned long long val;
+    uint64_t sum;
+    FILE *fp;
+    int f;
+
+    sum = 0;
+    for (f = 0; f < CG_NFILES; f++) {
+        if (!(avail & CG_FILE(f)))
+            continue;
+        snprintf(fpath, sizeof(fpath), "%s/%s", path, fileNames[f]);
+        fp = fopen(fpath, "r");
+        if (fp == NULL)
+            continue;
+        while (fgets(line, sizeof(line), fp) != NULL)
+            if (sscanf(line, "%63s %llu", key, &val) == 2)
+                sum += val;
+        fclose(fp);
+    }
+    return sum;
+}
+
+static double
+clockSecs(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+watch(struct cgStats *cgs)
+{
+    static const int watched[] = { CG_MEMORY_EVENTS, CG_CGROUP_EVENTS };
+    struct epoll_event ev;
+    int epfd, fd, f, j, k;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+        errExit("epoll_create1");
+
+    for (j = 0; j < npaths; j++) {
+        for (k = 0; k < 2; k++) {
+            f = watched[k];
+            fd = cgEventFd(&cgs[j], f);
+            if (fd == -1)
+                continue;
+            ev.events = EPOLLPRI;
+            ev.data.u64 = (uint64_t) j << 8 | f;
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+                errExit("epoll_ctl");
+        }
+        cgRead(&cgs[j], CG_FILE(CG_MEMORY_EVENTS) |
+                        CG_FILE(CG_CGROUP_EVENTS));
+    }
+
+    printf("Watching %d cgroups\n", npaths);
+    fflush(stdout);
+    for (;;) {
+        if (epoll_wait(epfd, &ev, 1, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("epoll_wait");
+        }
+
+        j = ev.data.u64 >> 8;
+        f = ev.data.u64 & 0xff;
+        if (cgRead(&cgs[j], CG_FILE(f)) == -1) {
+            printf("%s: %s; no longer watched\n", paths[j], strerror(errno));
+            epoll_ctl(epfd, EPOLL_CTL_DEL, cgEventFd(&cgs[j], f), NULL);
+            continue;
+        }
+
+        if (f == CG_CGROUP_EVENTS)
+            printf("%s: populated %llu, frozen %llu\n", paths[j],
+                   (unsigned long long) cgs[j].v.populated,
+                   (unsigned long long) cgs[j].v.frozen);
+        else
+            printf("%s: low %llu, high %llu, max %llu, oom %llu, "
+                   "oom_kill %llu\n", paths[j],
+                   (unsigned long long) cgs[j].v.evLow,
+                   (unsigned long long) cgs[j].v.evHigh,
+                   (unsigned long long) cgs[j].v.evMax,
+                   (unsigned long long) cgs[j].v.evOom,
+                   (unsigned long long) cgs[j].v.evOomKill);
+        fflush(stdout);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    Boolean recurse, printVals, watchEvents, useStdio;
+    struct cgStats *cgs;
+    double secs, start, cpuStart, elapsed, cpu;
+    long samples;
+    uint64_t sum;
+    int opt, j;
+
+    recurse = printVals = watchEvents = useStdio = FALSE;
+    secs = 2;
+    while ((opt = getopt(argc, argv, "Rpwsd:")) != -1) {
+        switch (opt) {
+        case 'R': recurse = TRUE;                               break;
+        case 'p': printVals = TRUE;                             break;
+        case 'w': watchEvents = TRUE;                           break;
+        case 's': useStdio = TRUE;                              break;
+        case 'd': secs = getInt(optarg, GN_GT_0, "-d");         break;
+        default:
+            usageErr("%s [-R] [-p | -w | [-s] [-d secs]] cgroup-dir...\n",
+                     argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usageErr("%s [-R] [-p | -w | [-s] [-d secs]] cgroup-dir...\n",
+                 argv[0]);
+
+    for (j = optind; j < argc; j++) {
+        if (recurse) {
+            if (nftw(argv[j], addDir, 20, FTW_PHYS) == -1)
+                errExit("nftw");
+        } else {
+            addPath(argv[j]);
+        }
+    }
+
+    cgs = calloc(npaths, sizeof(struct cgStats));
+    if (cgs == NULL)
+        errExit("calloc");
+    for (j = 0; j < npaths; j++)
+        if (cgOpen(&cgs[j], AT_FDCWD, paths[j], CG_ALL) == -1)
+            errExit("cgOpen");
+
+    if (watchEvents)
+        watch(cgs);                     /* Never returns */
+
+    if (printVals) {
+        printf("%-40s %12s %10s %10s %10s %10s %4s %5s\n", "cgroup",
+               "cpu-usec", "mem-cur", "anon", "rbytes", "wbytes", "pop",
+               "oomk");
+        for (j = 0; j < npaths; j++) {
+            if (cgRead(&cgs[j], CG_ALL) == -1)
+                errExit("cgRead");
+            printf("%-40s %12llu %10llu %10llu %10llu %10llu %4llu %5llu\n",
+                   paths[j], (unsigned long long) cgs[j].v.usageUsec,
+                   (unsigned long long) cgs[j].v.memCurrent,
+                   (unsigned long long) cgs[j].v.anon,
+                   (unsigned long long) cgs[j].v.rbytes,
+                   (unsigned long long) cgs[j].v.wbytes,
+                   (unsigned long long) cgs[j].v.populated,
+                   (unsigned long long) cgs[j].v.evOomKill);
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    /* Sample all cgroups repeatedly for 'secs' seconds */
+
+    samples = 0;
+    sum = 0;
+    start = clockSecs(CLOCK_MONOTONIC);
+    cpuStart = clockSecs(CLOCK_PROCESS_CPUTIME_ID);
+    do {
+        for (j = 0; j < npaths; j++) {
+            if (useStdio) {
+                sum += stdioSample(paths[j], cgs[j].avail);
+            } else {
+                if (cgRead(&cgs[j], CG_ALL) == -1)
+                    errExit("cgRead");
+                sum += cgs[j].v.usageUsec;
+            }
+        }
+        samples += npaths;
+        elapsed = clockSecs(CLOCK_MONOTONIC) - start;
+    } while (elapsed < secs);
+    cpu = clockSecs(CLOCK_PROCESS_CPUTIME_ID) - cpuStart;
+
+    printf("%s: %d cgroups, %ld samples in %.2f secs: %.0f samples/sec\n",
+           useStdio ? "stdio" : "cgRead", npaths, samples, elapsed,
+           samples / elapsed);
+    printf("CPU time per sample: %.2f us; CPU needed for 5000 samples/sec: "
+           "%.1f%%\n", cpu / samples * 1e6, cpu / samples * 5000 * 100);
+    if (sum == 1)                       /* Keep 'sum' alive */
+        printf("\n");
+
+    exit(EXIT_SUCCESS);
+}
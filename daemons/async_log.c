@@ -0,0 +1,681 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 37 */
+
+/* async_log.c
+
+   An asynchronous replacement for openlog(), syslog(), setlogmask(), and
+   closelog(), for use by daemons that must not stall when logging.
+
+   syslog() formats each message and sends it to /dev/log with a
+   blocking send() while the caller waits. If the logging daemon falls
+   behind (for example, during a storm of error messages), its socket
+   buffer fills, and every thread that logs blocks. Here, alog() formats
+   the record (in the same format as syslog()) into a buffer belonging to
+   the calling thread, and returns. A background flusher thread collects
+   records from all of the threads' buffers and sends them in batches:
+   with one sendmmsg() call per batch to a UNIX domain datagram socket
+   (one datagram per record, as syslog() sends), or with one writev()
+   call per batch to a file.
+
+   Each thread's buffer is a single-producer, single-consumer ring of
+   fixed-size records (see also lf_queue.c), so that alog() takes no
+   locks and (normally) makes no system calls: the thread's time-stamp
+   prefix is cached by currTimeFast() (fast_time.c), and the flusher is
+   woken (via an eventfd) only when a buffer becomes half full, and
+   otherwise flushes every 'flushMs' milliseconds. If a buffer is full,
+   the record is discarded, and counted. alog() can also apply a per-
+   thread rate limit (a token bucket of 'rate' records per second, with a
+   burst of 'burst'); records over the limit are likewise discarded and
+   counted. After each flush in which records were discarded, the
+   flusher logs a warning giving the number discarded.
+
+   Records longer than ALOG_REC_SIZE bytes are truncated. Records from
+   different threads are not necessarily sent in the order in which they
+   were logged.
+
+   alogOpen() starts the flusher; its 'ident', 'option', and 'facility'
+   arguments are as for openlog() (of the options, only LOG_PID and
+   LOG_PERROR are meaningful). With LOG_PERROR, and with ALOG_DEST_FILE,
+   records are written in the format used in log files (i.e., without
+   the "<priority>" prefix). alogClose() sends any records that remain
+   and terminates the flusher; no thread may call alog() during or after
+   the call to alogClose(). If the socket can't be connected (e.g.,
+   because the logging daemon isn't running), alogOpen() nevertheless
+   succeeds, and the flusher retries the connection for each batch;
+   records that can't be sent are counted as 'sendErrors'.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include "fast_time.h"          /* Declares currTimeFast() */
+#include "async_log.h"          /* Declares functions defined here */
+#include "tlpi_hdr.h"
+
+#define CACHE_LINE 64
+#define ALOG_REC_SIZE 512       /* Max. length of a record, including
+                                   the terminating newline */
+#define BATCH 64                /* Max. records per sendmmsg()/writev() */
+#define TS_FORMAT "%b %e %H:%M:%S"
+
+struct alogRec {
+    unsigned short len;         /* Length of 'text' (including newline) */
+    unsigned short priLen;      /* Length of "<priority>" prefix */
+    char text[ALOG_REC_SIZE];
+};
+
+struct alogBuf {                /* Ring of records for one thread */
+
+    /* Modified only by the owning thread */
+
+    size_t head __attribute__ ((aligned(CACHE_LINE)));
+                                /* Number of records added */
+    unsigned long long logged;
+    unsigned long long droppedFull;
+    unsigned long long droppedRate;
+    double tokens;              /* Token bucket for rate limiting */
+    struct timespec lastRefill;
+
+    /* Modified only by the flusher */
+
+    size_t tail __attribute__ ((aligned(CACHE_LINE)));
+                                /* Number of records sent */
+    unsigned long long reportedFull;    /* Drops already reported */
+    unsigned long long reportedRate;
+
+    int exited;                 /* Owner has terminated */
+    struct alogBuf *next;
+    size_t mask;                /* Capacity - 1 */
+    struct alogRec recs[];
+};
+
+/* Settings; fixed between alogOpen() and alogClose() */
+
+static char ident[64];
+static int option, facility;
+static int dest;
+static struct sockaddr_un addr;
+static size_t nrecs;            /* Records per thread buffer */
+static int flushMs;
+static double rate, burst;
+static int logMask = 0xff;
+
+static Boolean opened;          /* Between alogOpen() and alogClose() */
+static int outFd = -1;          /* Socket or file */
+static Boolean connected;       /* Socket is connected */
+static int wakeFd = -1;         /* eventfd used to wake the flusher */
+static pthread_t flusher;
+static int stopping;
+
+/* List of thread buffers. New buffers are added at the head, with the
+   mutex held; only the flusher removes (and frees) buffers. */
+
+static pthread_mutex_t listMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct alogBuf *bufList;
+static unsigned gen;            /* Incremented by alogClose() */
+
+static pthread_once_t keyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t exitKey;   /* Used to notice thread termination */
+static __thread struct alogBuf *myBuf;
+static __thread unsigned myGen;
+
+/* Counters maintained by the flusher (plus the counts from freed
+   buffers) */
+
+static unsigned long long sent, sendErrors, batches;
+static unsigned long long freedLogged, freedFull, freedRate;
+
+/* Thread-specific data destructor: mark the terminating thread's buffer,
+   so that the flusher frees it once it has been emptied */
+
+static void
+threadExit(void *arg)
+{
+    pthread_mutex_lock(&listMutex);
+    if (myBuf != NULL && myGen == gen)
+        __atomic_store_n(&myBuf->exited, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&listMutex);
+}
+
+static void
+createKey(void)
+{
+    pthread_key_create(&exitKey, threadExit);
+}
+
+/* Return the calling thread's buffer, allocating it on first use */
+
+static struct alogBuf *
+getBuf(void)
+{
+    struct alogBuf *b;
+
+    if (myBuf != NULL && myGen == __atomic_load_n(&gen, __ATOMIC_RELAXED))
+        return myBuf;
+
+    if (posix_memalign((void **) &b, CACHE_LINE, sizeof(struct alogBuf) +
+                       nrecs * sizeof(struct alogRec)) != 0)
+        return NULL;
+    memset(b, 0, sizeof(struct alogBuf));
+    b->mask = nrecs - 1;
+    b->tokens = burst;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &b->lastRefill);
+
+    if (pthread_once(&keyOnce, createKey) != 0 ||
+            pthread_setspecific(exitKey, b) != 0) {
+        free(b);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&listMutex);
+    b->next = bufList;
+    bufList = b;
+    myGen = gen;
+    pthread_mutex_unlock(&listMutex);
+
+    myBuf = b;
+    return b;
+}
+
+/* Take a token from the bucket of 'b'. Returns FALSE if none is left. */
+
+static Boolean
+takeToken(struct alogBuf *b)
+{
+    struct timespec now;
+    double elapsed;
+
+    if (b->tokens < 1) {
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+        elapsed = (now.tv_sec - b->lastRefill.tv_sec) +
+                  (now.tv_nsec - b->lastRefill.tv_nsec) / 1e9;
+        b->lastRefill = now;
+        b->tokens += elapsed * rate;
+        if (b->tokens > burst)
+            b->tokens = burst;
+        if (b->tokens < 1)
+            return FALSE;
+    }
+    b->tokens--;
+    return TRUE;
+}
+
+/* Format a record in the style of syslog() */
+
+static void
+formatRec(struct alogRec *r, int priority, const char *format, va_list ap)
+{
+    const char *ts;
+    char pidStr[16];
+    int n;
+
+    r->priLen = snprintf(r->text, ALOG_REC_SIZE, "<%d>", priority);
+
+    ts = currTimeFast(TS_FORMAT, 0);
+    if (option & LOG_PID)
+        snprintf(pidStr, sizeof(pidStr), "[%ld]", (long) getpid());
+    else
+        pidStr[0] = '\0';
+    n = r->priLen + snprintf(r->text + r->priLen,
+                             ALOG_REC_SIZE - r->priLen, "%s %s%s: ",
+                             (ts != NULL) ? ts : "", ident, pidStr);
+    if (n >= ALOG_REC_SIZE - 1)
+        n = ALOG_REC_SIZE - 2;
+
+    n += vsnprintf(r->text + n, ALOG_REC_SIZE - 1 - n, format, ap);
+    if (n > ALOG_REC_SIZE - 2)          /* Truncated */
+        n = ALOG_REC_SIZE - 2;
+    while (n > r->priLen && r->text[n - 1] == '\n')
+        n--;
+    r->text[n++] = '\n';
+    r->len = n;
+}
+
+void
+valog(int priority, const char *format, va_list ap)
+{
+    struct alogBuf *b;
+    size_t head, tail;
+    int savedErrno;
+    uint64_t one;
+
+    savedErrno = errno;                 /* For %m */
+
+    if (!(LOG_MASK(LOG_PRI(priority)) & logMask) || !opened)
+        return;
+    if ((priority & LOG_FACMASK) == 0)
+        priority |= facility;
+
+    b = getBuf();
+    if (b == NULL)
+        return;
+
+    if (rate > 0 && !takeToken(b)) {
+        __atomic_store_n(&b->droppedRate, b->droppedRate + 1,
+                         __ATOMIC_RELAXED);
+        return;
+    }
+
+    head = b->head;
+    tail = __atomic_load_n(&b->tail, __ATOMIC_ACQUIRE);
+    if (head - tail > b->mask) {        /* Buffer is full */
+        __atomic_store_n(&b->droppedFull, b->droppedFull + 1,
+                         __ATOMIC_RELAXED);
+        return;
+    }
+
+    errno = savedErrno;
+    formatRec(&b->recs[head & b->mask], priority, format, ap);
+    __atomic_store_n(&b->head, head + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&b->logged, b->logged + 1, __ATOMIC_RELAXED);
+
+    if (head + 1 - tail == (b->mask + 1) / 2) {     /* Now half full */
+        one = 1;
+        if (write(wakeFd, &one, sizeof(one)) == -1) {
+            /* Ignore; the flusher will wake up anyway */
+        }
+    }
+    errno = savedErrno;
+}
+
+void
+alog(int priority, const char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    valog(priority, format, ap);
+    va_end(ap);
+}
+
+int
+alogSetMask(int mask)
+{
+    int old = logMask;
+
+    if (mask != 0)
+        logMask = mask;
+    return old;
+}
+
+/* Write all of the 'cnt' buffers in 'iov' (which is modified) to 'fd'.
+   Returns 0 on success, or -1 on error. */
+
+static int
+writevAll(int fd, struct iovec *iov, int cnt)
+{
+    ssize_t n;
+
+    while (cnt > 0) {
+        n = writev(fd, iov, cnt);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (cnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/* (Re)connect the socket to the logging daemon */
+
+static void
+connectSocket(void)
+{
+    if (outFd != -1)
+        close(outFd);
+    outFd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    connected = outFd != -1 &&
+                connect(outFd, (struct sockaddr *) &addr,
+                        sizeof(struct sockaddr_un)) == 0;
+}
+
+/* Send the 'cnt' records in 'recs' */
+
+static void
+sendBatch(struct alogRec **recs, int cnt)
+{
+    struct mmsghdr msgs[BATCH];
+    struct iovec iov[BATCH], errIov[BATCH];
+    int done, n, j, retried;
+
+    if (cnt <= 0)
+        return;
+    batches++;
+
+    if (dest == ALOG_DEST_FILE || (option & LOG_PERROR)) {
+        for (j = 0; j < cnt; j++) {
+            iov[j].iov_base = recs[j]->text + recs[j]->priLen;
+            iov[j].iov_len = recs[j]->len - recs[j]->priLen;
+        }
+        if (option & LOG_PERROR) {      /* writevAll() modifies 'iov' */
+            memcpy(errIov, iov, cnt * sizeof(struct iovec));
+            writevAll(STDERR_FILENO, errIov, cnt);
+        }
+        if (dest == ALOG_DEST_FILE) {
+            if (writevAll(outFd, iov, cnt) == -1) {
+                sendErrors += cnt;
+                return;
+            }
+            sent += cnt;
+            return;
+        }
+    }
+
+    memset(msgs, 0, cnt * sizeof(struct mmsghdr));
+    for (j = 0; j < cnt; j++) {         /* Datagrams have no newline */
+        iov[j].iov_base = recs[j]->text;
+        iov[j].iov_len = recs[j]->len - 1;
+        msgs[j].msg_hdr.msg_iov = &iov[j];
+        msgs[j].msg_hdr.msg_iovlen = 1;
+    }
+
+    done = 0;
+    retried = 0;
+    while (done < cnt) {
+        if (!connected)
+            connectSocket();
+        n = connected ? sendmmsg(outFd, msgs + done, cnt - done, 0) : -1;
+        if (n == -1) {
+            if (connected && errno == EINTR)
+                continue;
+            connected = FALSE;          /* Daemon restarted? Reconnect */
+            if (retried++ == 0)
+                continue;
+            sendErrors += cnt - done;
+            return;
+        }
+        done += n;
+        sent += n;
+    }
+}
+
+/* Format a record reporting discarded records, if there are any */
+
+static Boolean
+dropReport(struct alogRec *r, unsigned long long full,
+           unsigned long long limited)
+{
+    if (full == 0 && limited == 0)
+        return FALSE;
+    r->priLen = snprintf(r->text, ALOG_REC_SIZE, "<%d>",
+                         facility | LOG_WARNING);
+    r->len = r->priLen + snprintf(r->text + r->priLen,
+                    ALOG_REC_SIZE - r->priLen,
+                    "%s %s: alog: discarded %llu records (buffer full), "
+                    "%llu records (rate limit)\n",
+                    currTimeFast(TS_FORMAT, 0), ident, full, limited);
+    return TRUE;
+}
+
+/* Send all records buffered by all threads, packing records from several
+   buffers into each batch, and then send a report of discarded records.
+   Buffers of terminated threads are freed once they are empty. */
+
+static void
+flushAll(void)
+{
+    struct alogRec *recs[BATCH];
+    struct alogBuf *owners[BATCH], *b, **bp, *list;
+    size_t taken[BATCH];
+    unsigned long long full, limited, n;
+    static struct alogRec report;
+    size_t tail, avail, k;
+    int cnt, nOwners, j;
+    Boolean more;
+
+    pthread_mutex_lock(&listMutex);
+    list = bufList;                     /* Newer buffers are ignored */
+    pthread_mutex_unlock(&listMutex);
+
+    do {
+        more = FALSE;
+        cnt = 0;
+        nOwners = 0;
+        for (b = list; b != NULL; b = b->next) {
+            tail = b->tail;
+            avail = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE) - tail;
+            if (avail == 0)
+                continue;
+            if (cnt == BATCH) {
+                more = TRUE;
+                break;
+            }
+            k = (avail < BATCH - cnt) ? avail : BATCH - cnt;
+            for (j = 0; j < k; j++)
+                recs[cnt++] = &b->recs[(tail + j) & b->mask];
+            owners[nOwners] = b;
+            taken[nOwners++] = k;
+            if (k < avail)
+                more = TRUE;
+        }
+
+        sendBatch(recs, cnt);
+        for (j = 0; j < nOwners; j++)
+            __atomic_store_n(&owners[j]->tail, owners[j]->tail + taken[j],
+                             __ATOMIC_RELEASE);
+    } while (more);
+
+    full = limited = 0;
+    for (b = list; b != NULL; b = b->next) {
+        n = __atomic_load_n(&b->droppedFull, __ATOMIC_RELAXED);
+        full += n - b->reportedFull;
+        b->reportedFull = n;
+        n = __atomic_load_n(&b->droppedRate, __ATOMIC_RELAXED);
+        limited += n - b->reportedRate;
+        b->reportedRate = n;
+    }
+    if (dropReport(&report, full, limited)) {
+        recs[0] = &report;
+        sendBatch(recs, 1);
+    }
+
+    /* Free the buffers of terminated threads; since the owner has gone,
+       the buffer can't have been refilled after we emptied it */
+
+    pthread_mutex_lock(&listMutex);
+    for (bp = &bufList; *bp != NULL; ) {
+        b = *bp;
+        if (__atomic_load_n(&b->exited, __ATOMIC_ACQUIRE) &&
+                b->tail == b->head) {
+            *bp = b->next;
+            freedLogged += b->logged;
+            freedFull += b->droppedFull;
+            freedRate += b->droppedRate;
+            free(b);
+        } else {
+            bp = &b->next;
+        }
+    }
+    pthread_mutex_unlock(&listMutex);
+}
+
+static void *
+flusherFunc(void *arg)
+{
+    struct pollfd pfd;
+    uint64_t val;
+    int s;
+
+    pfd.fd = wakeFd;
+    pfd.events = POLLIN;
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        s = poll(&pfd, 1, flushMs);
+        if (s == 1 && read(wakeFd, &val, sizeof(val)) == -1) {
+            /* Ignore; eventfd is nonblocking */
+        }
+        flushAll();
+    }
+
+    flushAll();                         /* Records logged before stop */
+    return NULL;
+}
+
+/* Start logging. 'ident', 'opt', and 'fac' are as for openlog(). If
+   'dst' is ALOG_DEST_SYSLOG, records are sent to the UNIX domain
+   datagram socket 'path' (default: /dev/log); if 'dst' is
+   ALOG_DEST_FILE, they are appended to the file 'path'. 'config' may be
+   NULL. Returns 0 on success, or -1 on error. */
+
+int
+alogOpen(const char *id, int opt, int fac, int dst, const char *path,
+         const struct alogConfig *config)
+{
+    struct alogConfig defaults = { 0 };
+    int s;
+
+    if (opened || (dst != ALOG_DEST_SYSLOG && dst != ALOG_DEST_FILE) ||
+            (dst == ALOG_DEST_FILE && path == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (config == NULL)
+        config = &defaults;
+
+    snprintf(ident, sizeof(ident), "%s",
+             (id != NULL) ? id : program_invocation_short_name);
+    option = opt;
+    facility = (fac != 0) ? fac : LOG_USER;
+    dest = dst;
+
+    for (nrecs = 2; nrecs < config->recsPerThread; nrecs *= 2)
+        continue;
+    if (config->recsPerThread == 0)
+        nrecs = 256;
+    flushMs = (config->flushMs > 0) ? config->flushMs : 100;
+    rate = config->rate;
+    burst = (config->burst > 0) ? config->burst : rate;
+    if (burst < 1)
+        burst = 1;
+    sent = sendErrors = batches = 0;
+    freedLogged = freedFull = freedRate = 0;
+
+    if (dst == ALOG_DEST_FILE) {
+        outFd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (outFd == -1)
+            return -1;
+    } else {
+        if (path == NULL)
+            path = "/dev/log";
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memset(&addr, 0, sizeof(struct sockaddr_un));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+        connectSocket();
+        if (outFd == -1)
+            return -1;
+    }
+
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeFd == -1)
+        goto fail;
+
+    stopping = 0;
+    s = pthread_create(&flusher, NULL, flusherFunc, NULL);
+    if (s != 0) {
+        errno = s;
+        goto fail;
+    }
+    opened = TRUE;
+    return 0;
+
+fail:
+    s = errno;
+    if (outFd != -1)
+        close(outFd);
+    outFd = -1;
+    if (wakeFd != -1)
+        close(wakeFd);
+    wakeFd = -1;
+    errno = s;
+    return -1;
+}
+
+void
+alogGetStats(struct alogStats *stats)
+{
+    struct alogBuf *b;
+
+    pthread_mutex_lock(&listMutex);
+    stats->logged = freedLogged;
+    stats->droppedFull = freedFull;
+    stats->droppedRate = freedRate;
+    for (b = bufList; b != NULL; b = b->next) {
+        stats->logged += __atomic_load_n(&b->logged, __ATOMIC_RELAXED);
+        stats->droppedFull += __atomic_load_n(&b->droppedFull,
+                                              __ATOMIC_RELAXED);
+        stats->droppedRate += __atomic_load_n(&b->droppedRate,
+                                              __ATOMIC_RELAXED);
+    }
+    stats->sent = sent;
+    stats->sendErrors = sendErrors;
+    stats->batches = batches;
+    pthread_mutex_unlock(&listMutex);
+}
+
+/* Send any remaining records, stop the flusher, and free all buffers.
+   alogGetStats() may still be called afterward. */
+
+void
+alogClose(void)
+{
+    struct alogBuf *b;
+    uint64_t one = 1;
+
+    if (!opened)
+        return;
+    opened = FALSE;
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    if (write(wakeFd, &one, sizeof(one)) == -1) {
+        /* Ignore; the flusher will wake up anyway */
+    }
+    pthread_join(flusher, NULL);
+
+    pthread_mutex_lock(&listMutex);
+    while (bufList != NULL) {
+        b = bufList;
+        bufList = b->next;
+        freedLogged += b->logged;
+        freedFull += b->droppedFull;
+        freedRate += b->droppedRate;
+        free(b);
+    }
+    gen++;                              /* Invalidates threads' 'myBuf' */
+    pthread_mutex_unlock(&listMutex);
+
+    if (outFd != -1)
+        close(outFd);
+    outFd = -1;
+    close(wakeFd);
+    wakeFd = -1;
+}
@@ -0,0 +1,66 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 37 */
+
+/* async_log.h
+
+   Header file for async_log.c.
+*/
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H             /* Prevent accidental double inclusion */
+
+#include <stdarg.h>
+#include <syslog.h>
+
+/* Destinations, for alogOpen() */
+
+#define ALOG_DEST_SYSLOG 0      /* UNIX domain datagram socket ('path', or
+                                   /dev/log if 'path' is NULL) */
+#define ALOG_DEST_FILE   1      /* File 'path', opened for appending */
+
+struct alogConfig {             /* Zero in any field selects the default */
+    int recsPerThread;          /* Records buffered by each thread
+                                   (rounded up to a power of 2; default:
+                                   256) */
+    int flushMs;                /* Max. time a record waits before being
+                                   sent (default: 100) */
+    int rate;                   /* Records per second per thread allowed
+                                   by the rate limiter (default: no
+                                   limit) */
+    int burst;                  /* Records that may exceed 'rate' in a
+                                   burst (default: 'rate') */
+};
+
+struct alogStats {
+    unsigned long long logged;      /* Records buffered by alog() */
+    unsigned long long sent;        /* Records sent by the flusher */
+    unsigned long long droppedFull; /* Records discarded: buffer full */
+    unsigned long long droppedRate; /* Records discarded: rate limit */
+    unsigned long long sendErrors;  /* Records that could not be sent */
+    unsigned long long batches;     /* sendmmsg()/writev() calls */
+};
+
+int alogOpen(const char *ident, int option, int facility, int dest,
+             const char *path, const struct alogConfig *config);
+
+void alog(int priority, const char *format, ...)
+            __attribute__ ((format (printf, 2, 3)));
+
+void valog(int priority, const char *format, va_list ap)
+            __attribute__ ((format (printf, 2, 0)));
+
+int alogSetMask(int mask);
+
+void alogGetStats(struct alogStats *stats);
+
+void alogClose(void);
+
+#endif
@@ -0,0 +1,270 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 37 */
+
+/* async_log_bench.c
+
+   Compare the cost to the caller of logging with syslog()-style
+   synchronous sends and with alog() (async_log.c), during a "storm" in
+   which several threads log as fast as they can.
+
+   Usage: async_log_bench [-t threads] [-n records] [-d delay-usecs]
+                          [-b recs-per-thread] [-r rate]
+
+        -t threads          Number of logging threads (default: 4)
+        -n records          Records logged by each thread (default: 100000)
+        -d delay-usecs      Time for which the receiver sleeps after each
+                            record, to simulate a slow logging daemon
+                            (default: 0)
+        -b recs-per-thread  'recsPerThread' for alogOpen() (default: 256)
+        -r rate             'rate' for alogOpen() (default: no limit)
+
+   So as not to flood the real logging daemon, the records are sent to a
+   UNIX domain datagram socket created by this program, which a receiver
+   thread reads. The "sync" test mimics what syslog() does for each call:
+   it formats the record, and sends it (holding a mutex, as glibc does)
+   on a connected datagram socket. (syslog() itself can't be used,
+   because it always sends to /dev/log.)
+
+   For each test, the program shows the rate at which the threads log,
+   the worst-case latency of a logging call, and the numbers of records
+   received and discarded.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <time.h>
+#include "async_log.h"
+#include "tlpi_hdr.h"
+
+static int numRecs;
+static int delayUsecs;
+static Boolean useAlog;
+static long long maxLatencyNs;  /* Max. over all threads */
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int syncFd;              /* For synchronous test */
+static pthread_mutex_t syncMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long received;           /* Updated by receiver */
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Format and send a record, in the manner of syslog() */
+
+static void
+syncLog(int priority, const char *format, ...)
+{
+    char buf[1024];
+    struct tm tm;
+    time_t t;
+    va_list ap;
+    int n;
+
+    pthread_mutex_lock(&syncMutex);
+    t = time(NULL);
+    localtime_r(&t, &tm);
+    n = snprintf(buf, sizeof(buf), "<%d>", LOG_USER | priority);
+    n += strftime(buf + n, sizeof(buf) - n, "%h %e %T ", &tm);
+    n += snprintf(buf + n, sizeof(buf) - n, "async_log_bench[%ld]: ",
+                  (long) getpid());
+    va_start(ap, format);
+    n += vsnprintf(buf + n, sizeof(buf) - n, format, ap);
+    va_end(ap);
+    if (n >= sizeof(buf))
+        n = sizeof(buf) - 1;
+    send(syncFd, buf, n, 0);
+    pthread_mutex_unlock(&syncMutex);
+}
+
+static void *
+loggerFunc(void *arg)
+{
+    long long t0, lat, maxLat;
+    int j;
+
+    maxLat = 0;
+    for (j = 0; j < numRecs; j++) {
+        t0 = nowNs();
+        if (useAlog)
+            alog(LOG_ERR, "request %d failed: connection reset by peer "
+                 "(thread %ld)", j, (long) arg);
+        else
+            syncLog(LOG_ERR, "request %d failed: connection reset by peer "
+                    "(thread %ld)", j, (long) arg);
+        lat = nowNs() - t0;
+        if (lat > maxLat)
+            maxLat = lat;
+    }
+
+    pthread_mutex_lock(&statsMutex);
+    if (maxLat > maxLatencyNs)
+        maxLatencyNs = maxLat;
+    pthread_mutex_unlock(&statsMutex);
+    return NULL;
+}
+
+static void *
+receiverFunc(void *arg)
+{
+    int sfd = (long) arg;
+    struct timespec delay;
+    char buf[1024];
+
+    delay.tv_sec = 0;
+    delay.tv_nsec = delayUsecs * 1000L;
+    for (;;) {
+        if (recv(sfd, buf, sizeof(buf), 0) == -1)
+            errExit("recv");
+        __atomic_add_fetch(&received, 1, __ATOMIC_RELAXED);
+        if (delayUsecs > 0)
+            nanosleep(&delay, NULL);
+    }
+    return NULL;
+}
+
+/* Wait until the receiver has had nothing to read for a while */
+
+static long
+waitReceived(void)
+{
+    long prev, cur;
+
+    cur = __atomic_load_n(&received, __ATOMIC_RELAXED);
+    do {
+        prev = cur;
+        usleep(200000);
+        cur = __atomic_load_n(&received, __ATOMIC_RELAXED);
+    } while (cur != prev);
+    return cur;
+}
+
+static void
+runTest(const char *name, int numThreads)
+{
+    pthread_t *tids;
+    long long start, elapsed;
+    long j;
+    int s;
+
+    tids = calloc(numThreads, sizeof(pthread_t));
+    if (tids == NULL)
+        errExit("calloc");
+
+    maxLatencyNs = 0;
+    start = nowNs();
+    for (j = 0; j < numThreads; j++) {
+        s = pthread_create(&tids[j], NULL, loggerFunc, (void *) j);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    for (j = 0; j < numThreads; j++) {
+        s = pthread_join(tids[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+    elapsed = nowNs() - start;
+
+    printf("%-6s %12.0f %14.1f", name,
+           (double) numRecs * numThreads / (elapsed / 1e9),
+           maxLatencyNs / 1000.0);
+    free(tids);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-t threads] [-n records] [-d delay-usecs] "
+            "[-b recs-per-thread] [-r rate]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct alogConfig config = { 0 };
+    struct alogStats stats;
+    struct sockaddr_un addr;
+    pthread_t rtid;
+    char path[sizeof(addr.sun_path)];
+    int opt, numThreads, rfd, s;
+    long got;
+
+    numThreads = 4;
+    numRecs = 100000;
+    delayUsecs = 0;
+    while ((opt = getopt(argc, argv, "t:n:d:b:r:")) != -1) {
+        switch (opt) {
+        case 't': numThreads = getInt(optarg, GN_GT_0, "threads");      break;
+        case 'n': numRecs = getInt(optarg, GN_GT_0, "records");         break;
+        case 'd': delayUsecs = getInt(optarg, 0, "delay-usecs");        break;
+        case 'b': config.recsPerThread = getInt(optarg, GN_GT_0, "recs"); break;
+        case 'r': config.rate = getInt(optarg, GN_GT_0, "rate");        break;
+        default:  usageError(argv[0]);
+        }
+    }
+
+    /* Create the socket that plays the part of /dev/log */
+
+    snprintf(path, sizeof(path), "/tmp/async_log_bench.%ld", (long) getpid());
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    rfd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (rfd == -1)
+        errExit("socket");
+    if (bind(rfd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) == -1)
+        errExit("bind");
+    s = pthread_create(&rtid, NULL, receiverFunc, (void *) (long) rfd);
+    if (s != 0)
+        errExitEN(s, "pthread_create");
+
+    syncFd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (syncFd == -1)
+        errExit("socket");
+    if (connect(syncFd, (struct sockaddr *) &addr,
+                sizeof(struct sockaddr_un)) == -1)
+        errExit("connect");
+
+    printf("%d threads x %d records; receiver delay %d us\n\n",
+           numThreads, numRecs, delayUsecs);
+    printf("%-6s %12s %14s %10s %10s %10s\n", "test", "records/s",
+           "max-call(us)", "received", "dropped", "batches");
+
+    useAlog = FALSE;
+    runTest("sync", numThreads);
+    got = waitReceived();
+    printf(" %10ld %10s %10s\n", got, "-", "-");
+
+    if (alogOpen("async_log_bench", LOG_PID, LOG_USER, ALOG_DEST_SYSLOG,
+                 path, &config) == -1)
+        errExit("alogOpen");
+    useAlog = TRUE;
+    runTest("alog", numThreads);
+    alogClose();
+    alogGetStats(&stats);
+    printf(" %10ld %10llu %10llu\n", waitReceived() - got,
+           stats.droppedFull + stats.droppedRate, stats.batches);
+
+    unlink(path);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,395 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 37 */
+
+/* daemon_reload.c
+
+   A version of daemon_SIGHUP.c in which SIGHUP (reread the configuration
+   file and reopen the log file) never delays the daemon's work.
+
+   Usage: daemon_reload [-F] [-w workers] [-d delay-ms] [-c config-file]
+                        [-l log-file]
+
+        -F              Don't become a daemon (for testing)
+        -w workers      Number of worker threads (default: 2)
+        -d delay-ms     Add this delay to each reload, to simulate a
+                        slow parse (or a slow file system) (default: 0)
+        -c config-file  Default: /tmp/ds.conf
+        -l log-file     Default: /tmp/ds.log
+
+   In daemon_SIGHUP.c, the main loop itself closes and reopens the log
+   file and rereads the configuration file, so that no work is done
+   while it does so. Here, the work is done by worker threads, and
+   SIGHUP is accepted (with sigwaitinfo()) by the main thread, which
+   does all of the slow steps while the workers carry on:
+
+   * The configuration file is parsed into a new struct config, which is
+     then published by atomically replacing the pointer that the workers
+     read, in the style of RCU (read-copy-update). Each worker reads the
+     pointer once per work item, at the start of a read-side critical
+     section that ends when the item is complete; a worker thus always
+     sees a complete configuration, either the old one or the new one.
+     Once every worker that might still be using the old configuration
+     has left its critical section (a "grace period"), the old
+     configuration is freed. Workers take no locks to read the
+     configuration.
+
+   * The log file is opened afresh (so that, for example, it can have
+     been renamed by a log rotator), and the new descriptor is then
+     installed with dup2() over the descriptor that the workers write
+     to. dup2() replaces the descriptor atomically, so that each write()
+     goes to either the old or the new file, and there is no moment at
+     which the log descriptor is closed or invalid. Each log message is
+     written with a single write() to a file opened with O_APPEND.
+
+   The configuration file contains lines of the form "name value"
+   ('#' introduces a comment):
+
+        message      Text that workers include in their reports
+        work_ms      Duration of each work item (default: 10)
+        report_secs  Interval between workers' reports (default: 15)
+
+   Each worker reports the number of items it has done, the largest
+   amount by which an item took longer than 'work_ms', and the
+   configuration generation that it is using. SIGTERM or SIGINT
+   terminates the daemon.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <time.h>
+#include "become_daemon.h"
+#include "tlpi_hdr.h"
+
+#define CACHE_LINE 64
+#define MSG_SIZE 100
+
+struct config {
+    long gen;                   /* Incremented for each reload */
+    char message[MSG_SIZE];
+    long workMs;
+    int reportSecs;
+};
+
+struct worker {
+    int id;
+    pthread_t tid;
+
+    /* Incremented on entry to and exit from each read-side critical
+       section, so that it is odd while the worker may be using the
+       configuration. In a cache line of its own, since it is written
+       frequently by the worker, and read by the reloader. */
+
+    unsigned long rcuCtr __attribute__ ((aligned(CACHE_LINE)));
+};
+
+static struct config *curConfig;    /* Published configuration */
+static int logFd;                   /* Replaced with dup2() on reload */
+static int stopping;
+static struct worker *workers;
+static int numWorkers;
+
+static long long
+nowUsecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* Write a timestamped message to the log file with a single write() */
+
+static void
+logMessage(const char *format, ...)
+{
+    char buf[512];
+    struct tm tm;
+    time_t t;
+    va_list argList;
+    size_t len;
+
+    t = time(NULL);
+    if (localtime_r(&t, &tm) == NULL ||
+            (len = strftime(buf, sizeof(buf), "%F %X: ", &tm)) == 0)
+        len = snprintf(buf, sizeof(buf), "???Unknown time????: ");
+
+    va_start(argList, format);
+    len += vsnprintf(buf + len, sizeof(buf) - len - 1, format, argList);
+    va_end(argList);
+    if (len > sizeof(buf) - 2)
+        len = sizeof(buf) - 2;
+    buf[len++] = '\n';
+
+    if (write(logFd, buf, len) == -1) {
+        /* Nothing useful we can do */
+    }
+}
+
+/* Open the log file, returning the file descriptor, or -1 on error */
+
+static int
+openLog(const char *logFilename)
+{
+    mode_t m;
+    int fd;
+
+    m = umask(077);
+    fd = open(logFilename, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    umask(m);
+    return fd;
+}
+
+/* Read-side critical section: the configuration returned by
+   rcuReadLock() remains valid until the matching rcuReadUnlock(). The
+   sequentially consistent store and load ensure that either the
+   reloader sees our (odd) counter, or we see its new pointer. */
+
+static const struct config *
+rcuReadLock(struct worker *w)
+{
+    __atomic_store_n(&w->rcuCtr, w->rcuCtr + 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&curConfig, __ATOMIC_SEQ_CST);
+}
+
+static void
+rcuReadUnlock(struct worker *w)
+{
+    __atomic_store_n(&w->rcuCtr, w->rcuCtr + 1, __ATOMIC_RELEASE);
+}
+
+/* Wait until every worker that was in a read-side critical section
+   when we were called has left it */
+
+static void
+synchronizeRcu(void)
+{
+    struct timespec pause = { 0, 1000000 };     /* 1 ms */
+    unsigned long snap;
+    int j;
+
+    for (j = 0; j < numWorkers; j++) {
+        snap = __atomic_load_n(&workers[j].rcuCtr, __ATOMIC_SEQ_CST);
+        if ((snap & 1) == 0)            /* Not in critical section */
+            continue;
+        while (__atomic_load_n(&workers[j].rcuCtr, __ATOMIC_ACQUIRE) == snap)
+            nanosleep(&pause, NULL);
+    }
+}
+
+/* Parse the configuration file into a newly allocated struct config.
+   Settings that are absent (or an absent file) give the defaults. */
+
+static struct config *
+readConfigFile(const char *configFilename, long gen)
+{
+    struct config *cfg;
+    FILE *configfp;
+    char line[200], name[32], value[MSG_SIZE];
+
+    cfg = calloc(1, sizeof(struct config));
+    if (cfg == NULL)
+        errExit("calloc");
+    cfg->gen = gen;
+    cfg->workMs = 10;
+    cfg->reportSecs = 15;
+
+    configfp = fopen(configFilename, "r");
+    if (configfp == NULL)               /* Ignore nonexistent file */
+        return cfg;
+
+    while (fgets(line, sizeof(line), configfp) != NULL) {
+        value[0] = '\0';
+        if (sscanf(line, "%31s %99[^\n]", name, value) < 1 ||
+                name[0] == '#')
+            continue;
+        if (strcmp(name, "message") == 0)
+            snprintf(cfg->message, MSG_SIZE, "%s", value);
+        else if (strcmp(name, "work_ms") == 0 && atol(value) >= 0)
+            cfg->workMs = atol(value);
+        else if (strcmp(name, "report_secs") == 0 && atoi(value) > 0)
+            cfg->reportSecs = atoi(value);
+        else
+            logMessage("Ignoring config line: %s", name);
+    }
+    fclose(configfp);
+    return cfg;
+}
+
+static void *
+workerFunc(void *arg)
+{
+    struct worker *w = arg;
+    const struct config *cfg;
+    struct timespec ts;
+    long long start, late, maxLate, lastReport;
+    long items;
+
+    items = 0;
+    maxLate = 0;
+    lastReport = nowUsecs();
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+        cfg = rcuReadLock(w);
+
+        /* The work item; here, just a sleep of 'work_ms' */
+
+        start = nowUsecs();
+        ts.tv_sec = cfg->workMs / 1000;
+        ts.tv_nsec = (cfg->workMs % 1000) * 1000000;
+        nanosleep(&ts, NULL);
+        items++;
+
+        late = nowUsecs() - start - cfg->workMs * 1000;
+        if (late > maxLate)
+            maxLate = late;
+
+        if (nowUsecs() - lastReport >= cfg->reportSecs * 1000000LL) {
+            logMessage("Worker %d: %s (config %ld): %ld items, "
+                       "max lateness %lld us", w->id, cfg->message,
+                       cfg->gen, items, maxLate);
+            lastReport = nowUsecs();
+            items = 0;
+            maxLate = 0;
+        }
+
+        rcuReadUnlock(w);
+    }
+    return NULL;
+}
+
+/* Reopen the log file and reread the configuration file */
+
+static void
+reload(const char *logFilename, const char *configFilename, int delayMs)
+{
+    struct config *newCfg, *oldCfg;
+    struct timespec ts;
+    long long start;
+    int fd;
+
+    start = nowUsecs();
+
+    fd = openLog(logFilename);          /* Pre-open the new log file */
+    if (fd == -1) {
+        logMessage("Can't reopen log file: %s; keeping old file",
+                   strerror(errno));
+    } else {
+        logMessage("Closing log file");
+        if (dup2(fd, logFd) == -1)      /* Atomic replacement */
+            logMessage("dup2: %s", strerror(errno));
+        close(fd);
+        logMessage("Opened log file");
+    }
+
+    if (delayMs > 0) {                  /* Simulate slow parsing */
+        ts.tv_sec = delayMs / 1000;
+        ts.tv_nsec = (delayMs % 1000) * 1000000;
+        nanosleep(&ts, NULL);
+    }
+
+    newCfg = readConfigFile(configFilename, curConfig->gen + 1);
+    oldCfg = __atomic_exchange_n(&curConfig, newCfg, __ATOMIC_SEQ_CST);
+    synchronizeRcu();                   /* Wait for readers of 'oldCfg' */
+    free(oldCfg);
+
+    logMessage("Read config file (generation %ld): %s; reload took %lld us",
+               newCfg->gen, newCfg->message, nowUsecs() - start);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-F] [-w workers] [-d delay-ms] "
+            "[-c config-file] [-l log-file]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *logFilename = "/tmp/ds.log";
+    const char *configFilename = "/tmp/ds.conf";
+    Boolean foreground;
+    sigset_t set;
+    int opt, sig, delayMs, s, j;
+
+    foreground = FALSE;
+    numWorkers = 2;
+    delayMs = 0;
+    while ((opt = getopt(argc, argv, "Fw:d:c:l:")) != -1) {
+        switch (opt) {
+        case 'F': foreground = TRUE;                                    break;
+        case 'w': numWorkers = getInt(optarg, GN_GT_0, "workers");      break;
+        case 'd': delayMs = getInt(optarg, 0, "delay-ms");              break;
+        case 'c': configFilename = optarg;                              break;
+        case 'l': logFilename = optarg;                                 break;
+        default:  usageError(argv[0]);
+        }
+    }
+
+    if (!foreground && becomeDaemon(BD_NO_CHDIR) == -1)
+        errExit("becomeDaemon");
+
+    /* Block the signals in all threads; the main thread accepts them
+       with sigwaitinfo() */
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    s = pthread_sigmask(SIG_BLOCK, &set, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_sigmask");
+
+    logFd = openLog(logFilename);
+    if (logFd == -1)
+        exit(EXIT_FAILURE);             /* Can't display a message... */
+    logMessage("Opened log file");
+    curConfig = readConfigFile(configFilename, 1);
+    logMessage("Read config file (generation 1): %s", curConfig->message);
+
+    workers = calloc(numWorkers, sizeof(struct worker));
+    if (workers == NULL)
+        errExit("calloc");
+    for (j = 0; j < numWorkers; j++) {
+        workers[j].id = j;
+        s = pthread_create(&workers[j].tid, NULL, workerFunc, &workers[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    for (;;) {
+        sig = sigwaitinfo(&set, NULL);
+        if (sig == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("sigwaitinfo");
+        }
+        if (sig != SIGHUP)
+            break;
+        reload(logFilename, configFilename, delayMs);
+    }
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+    for (j = 0; j < numWorkers; j++) {
+        s = pthread_join(workers[j].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+    logMessage("Terminating on signal %d", sig);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,567 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 18 */
+
+/* bg_unlink.c
+
+   Deferred deletion of files and directory trees, so that removing a
+   large file (whose blocks the file system must free, which can take
+   seconds and stall other I/O on the device) or a large tree costs the
+   caller only a rename().
+
+   buRemove() atomically moves its target, with renameat2()
+   RENAME_NOREPLACE, into a trash directory (which must be on the same
+   file system; otherwise, it fails with EXDEV, and the caller should
+   delete the target itself) under a unique name, and wakes a background
+   thread, which empties the trash. That thread runs with a nice value of
+   19 and in the idle I/O scheduling class (which only some I/O
+   schedulers, such as BFQ, honor), and also paces itself: it shrinks a
+   large file with a series of ftruncate() calls, sleeping between them,
+   so that its blocks are freed in small transactions rather than one
+   long one, and it sleeps after every few unlinks while removing a tree.
+
+   A file is truncated only if it has a single link and no other process
+   has it open: truncation would otherwise destroy data that is still
+   visible to someone. The thread checks this by taking a write lease
+   (F_SETLEASE), which the kernel grants only if there are no other open
+   file descriptions for the file, and it stops truncating (and just
+   unlinks the file) if the lease is broken because someone opens the
+   file in the trash. (The lease is set up to deliver SIGIO to the
+   process if it is broken; the thread disables this with F_SETOWN
+   immediately, but a break in the instant between the two calls would
+   deliver SIGIO, which the caller must be prepared to ignore.)
+
+   The trash directory is itself the queue: entries left there by a
+   process that exited or crashed before they were deleted are deleted
+   when the trash is next opened with buOpen(), and several processes may
+   share a trash directory.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include "bg_unlink.h"          /* Declares functions defined here */
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+
+/* From <linux/ioprio.h>, for ioprio_set(), which glibc doesn't wrap */
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+
+#define MAX_BASE_LEN 200        /* Max. chars of target's name kept in the
+                                   name of its trash entry */
+
+struct bgUnlink {
+    int trashFd;                /* Trash directory */
+    struct buParams p;
+    pthread_t tid;
+    pthread_mutex_t mtx;        /* Protects all of the following */
+    pthread_cond_t workCond;    /* Signaled when 'work' changes or 'stop'
+                                   is set */
+    pthread_cond_t doneCond;    /* Broadcast when 'done' changes */
+    unsigned long work;         /* Incremented by each buRemove() */
+    unsigned long done;         /* 'work' as it was when the thread began
+                                   its last complete pass over the trash */
+    int failed;                 /* Entries that the last pass couldn't
+                                   delete */
+    int stop;                   /* Set by buClose() */
+    unsigned int seq;           /* For naming trash entries */
+    unsigned long unlinks;      /* For pacing (used only by the thread) */
+    struct buStats st;
+};
+
+void
+buDefaultParams(struct buParams *params)
+{
+    params->truncStep = 256 * 1024 * 1024;
+    params->pauseUs = 10000;
+    params->batch = 256;
+    params->nice = 19;
+    params->ioIdle = 1;
+}
+
+static int
+stopping(struct bgUnlink *bu)
+{
+    return __atomic_load_n(&bu->stop, __ATOMIC_RELAXED);
+}
+
+static void
+nap(struct bgUnlink *bu)
+{
+    struct timespec ts;
+
+    if (bu->p.pauseUs == 0)
+        return;
+    ts.tv_sec = bu->p.pauseUs / 1000000;
+    ts.tv_nsec = bu->p.pauseUs % 1000000 * 1000;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        continue;
+}
+
+/* Add to the statistics counter at 'field' */
+
+static void
+count(struct bgUnlink *bu, unsigned long long *field,
+      unsigned long long n)
+{
+    pthread_mutex_lock(&bu->mtx);
+    *field += n;
+    pthread_mutex_unlock(&bu->mtx);
+}
+
+static void
+countError(struct bgUnlink *bu, int err)
+{
+    pthread_mutex_lock(&bu->mtx);
+    bu->st.errors++;
+    bu->st.lastErrno = err;
+    pthread_mutex_unlock(&bu->mtx);
+}
+
+/* Called after each unlink, to pace removal of a tree */
+
+static void
+unlinked(struct bgUnlink *bu)
+{
+    bu->unlinks++;
+    if (bu->p.batch > 0 && bu->unlinks % bu->p.batch == 0)
+        nap(bu);
+}
+
+/* Remove the nondirectory 'name' in 'dirFd', truncating it in steps
+   first if it's large and not in use. Returns 0 on success, 1 if
+   interrupted by buClose(), or -1 on error. */
+
+static int
+removeFile(struct bgUnlink *bu, int dirFd, const char *name)
+{
+    struct stat sb, sb2;
+    blkcnt_t blocks;
+    off_t size;
+    int fd, leased, savedErrno;
+
+    if (fstatat(dirFd, name, &sb, AT_SYMLINK_NOFOLLOW) == -1)
+        return -1;
+
+    fd = -1;
+    leased = 0;
+    if (bu->p.truncStep > 0 && S_ISREG(sb.st_mode) && sb.st_nlink == 1 &&
+            sb.st_blocks * 512 > bu->p.truncStep) {
+
+        /* O_NONBLOCK: fail rather than wait if someone else holds a
+           lease on the file */
+
+        fd = openat(dirFd, name,
+                    O_WRONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+        if (fd != -1 && fcntl(fd, F_SETLEASE, F_WRLCK) == 0) {
+            leased = 1;
+            fcntl(fd, F_SETOWN, 0);     /* No SIGIO if lease is broken */
+        } else {
+            count(bu, &bu->st.busyFiles, 1);
+        }
+    }
+
+    if (leased) {
+        blocks = sb.st_blocks;
+        for (size = sb.st_size; size > bu->p.truncStep; ) {
+            if (stopping(bu)) {
+                fcntl(fd, F_SETLEASE, F_UNLCK);
+                close(fd);
+                return 1;
+            }
+
+            size -= bu->p.truncStep;
+            if (ftruncate(fd, size) == -1)
+                break;
+            count(bu, &bu->st.truncSteps, 1);
+
+            /* A lease that is being broken reports the type to which it
+               is being downgraded */
+
+            if (fcntl(fd, F_GETLEASE) != F_WRLCK)
+                break;
+
+            /* Pause only if blocks were actually freed (not if we cut
+               off a hole in a sparse file) */
+
+            if (fstat(fd, &sb2) == 0 && sb2.st_blocks < blocks) {
+                blocks = sb2.st_blocks;
+                nap(bu);
+            }
+        }
+    }
+
+    /* If we hold the file open, its remaining blocks are freed when we
+       close it */
+
+    if (unlinkat(dirFd, name, 0) == -1) {
+        savedErrno = errno;
+        if (fd != -1)
+            close(fd);
+        errno = savedErrno;
+        return -1;
+    }
+    if (fd != -1) {
+        if (leased)
+            fcntl(fd, F_SETLEASE, F_UNLCK);
+        close(fd);
+    }
+
+    pthread_mutex_lock(&bu->mtx);
+    bu->st.files++;
+    if (sb.st_nlink == 1)
+        bu->st.bytes += (unsigned long long) sb.st_blocks * 512;
+    pthread_mutex_unlock(&bu->mtx);
+    unlinked(bu);
+    return 0;
+}
+
+static int removeEntry(struct bgUnlink *bu, int dirFd, const char *name,
+                       unsigned char type);
+
+/* Remove the directory 'name' in 'dirFd' and everything below it.
+   Returns 0 on success, 1 if interrupted by buClose(), or -1 on error. */
+
+static int
+removeTree(struct bgUnlink *bu, int dirFd, const char *name)
+{
+    struct dirent *de;
+    DIR *dirp;
+    int fd, s;
+
+    fd = openat(dirFd, name,
+                O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    dirp = fdopendir(fd);
+    if (dirp == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    /* On Linux, removing entries while reading a directory doesn't
+       cause entries not yet read to be skipped. Entries that can't be
+       removed are counted as errors, and cause the rmdir() below to fail
+       with ENOTEMPTY. */
+
+    while ((de = readdir(dirp)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        s = removeEntry(bu, dirfd(dirp), de->d_name, de->d_type);
+        if (s == 1 || (s == 0 && stopping(bu))) {
+            closedir(dirp);
+            return 1;
+        }
+    }
+    closedir(dirp);
+
+    if (unlinkat(dirFd, name, AT_REMOVEDIR) == -1)
+        return -1;
+    count(bu, &bu->st.dirs, 1);
+    unlinked(bu);
+    return 0;
+}
+
+/* Remove 'name' in 'dirFd', of type 'type' (a DT_* value, possibly
+   DT_UNKNOWN), counting any error. Returns 0 on success, 1 if
+   interrupted by buClose(), or -1 on error. */
+
+static int
+removeEntry(struct bgUnlink *bu, int dirFd, const char *name,
+            unsigned char type)
+{
+    struct stat sb;
+    int s;
+
+    if (type == DT_UNKNOWN) {
+        if (fstatat(dirFd, name, &sb, AT_SYMLINK_NOFOLLOW) == -1) {
+            countError(bu, errno);
+            return -1;
+        }
+        type = S_ISDIR(sb.st_mode) ? DT_DIR : DT_REG;
+    }
+
+    s = (type == DT_DIR) ? removeTree(bu, dirFd, name) :
+                           removeFile(bu, dirFd, name);
+    if (s == -1)
+        countError(bu, errno);
+    return s;
+}
+
+/* Make one pass over the trash, deleting everything in it. Returns the
+   number of entries that couldn't be deleted, or -1 if interrupted by
+   buClose(). */
+
+static int
+emptyTrash(struct bgUnlink *bu)
+{
+    struct dirent *de;
+    DIR *dirp;
+    int fd, s, failed;
+
+    fd = openat(bu->trashFd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        countError(bu, errno);
+        return 1;
+    }
+    dirp = fdopendir(fd);
+    if (dirp == NULL) {
+        countError(bu, errno);
+        close(fd);
+        return 1;
+    }
+
+    failed = 0;
+    while ((de = readdir(dirp)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        if (stopping(bu)) {
+            failed = -1;
+            break;
+        }
+        s = removeEntry(bu, dirfd(dirp), de->d_name, de->d_type);
+        if (s == 0) {
+            count(bu, &bu->st.removed, 1);
+        } else if (s == 1) {
+            failed = -1;
+            break;
+        } else {
+            failed++;
+        }
+    }
+
+    closedir(dirp);
+    return failed;
+}
+
+static void *
+threadFunc(void *arg)
+{
+    struct bgUnlink *bu = arg;
+    unsigned long work;
+    int failed;
+
+    /* On Linux, both of these affect only the calling thread; failures
+       are harmless */
+
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), bu->p.nice);
+    if (bu->p.ioIdle)
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+    pthread_mutex_lock(&bu->mtx);
+    for (;;) {
+        while (bu->work == bu->done && !bu->stop)
+            pthread_cond_wait(&bu->workCond, &bu->mtx);
+        if (bu->stop)
+            break;
+
+        /* buRemove() calls made after this point will be seen either
+           by this pass or the next one */
+
+        work = bu->work;
+        pthread_mutex_unlock(&bu->mtx);
+
+        failed = emptyTrash(bu);
+
+        pthread_mutex_lock(&bu->mtx);
+        if (failed == -1)
+            break;
+        bu->done = work;
+        bu->failed = failed;
+        pthread_cond_broadcast(&bu->doneCond);
+    }
+    pthread_mutex_unlock(&bu->mtx);
+
+    return NULL;
+}
+
+/* Open (creating it, if necessary) the trash directory 'trashDir', and
+   start a thread to delete anything in it. If 'params' is NULL,
+   buDefaultParams() is used. Returns a handle, or NULL on error. */
+
+struct bgUnlink *
+buOpen(const char *trashDir, const struct buParams *params)
+{
+    struct bgUnlink *bu;
+    sigset_t all, prev;
+    int s;
+
+    if (mkdir(trashDir, S_IRWXU) == -1 && errno != EEXIST)
+        return NULL;
+
+    bu = calloc(1, sizeof(*bu));
+    if (bu == NULL)
+        return NULL;
+    if (params != NULL)
+        bu->p = *params;
+    else
+        buDefaultParams(&bu->p);
+
+    bu->trashFd = open(trashDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (bu->trashFd == -1) {
+        free(bu);
+        return NULL;
+    }
+
+    pthread_mutex_init(&bu->mtx, NULL);
+    pthread_cond_init(&bu->workCond, NULL);
+    pthread_cond_init(&bu->doneCond, NULL);
+    bu->work = 1;               /* Delete any leftovers */
+
+    /* The thread blocks all signals, so that it isn't chosen to handle
+       signals directed at the process */
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &prev);
+    s = pthread_create(&bu->tid, NULL, threadFunc, bu);
+    pthread_sigmask(SIG_SETMASK, &prev, NULL);
+    if (s != 0) {
+        close(bu->trashFd);
+        free(bu);
+        errno = s;
+        return NULL;
+    }
+
+    return bu;
+}
+
+/* Move 'path' (relative to 'dirFd', as for openat()) into the trash, to
+   be deleted in the background. Returns 0 on success, or -1 on error
+   (EXDEV if 'path' is on a different file system from the trash). */
+
+int
+buRemove(struct bgUnlink *bu, int dirFd, const char *path)
+{
+    char name[NAME_MAX + 1];
+    const char *base;
+    size_t len;
+    unsigned int seq;
+
+    /* Name the trash entry after the target's last component (ignoring
+       trailing slashes), for the benefit of anyone looking at the
+       trash */
+
+    for (len = strlen(path); len > 1 && path[len - 1] == '/'; len--)
+        continue;
+    for (base = path + len; base > path && base[-1] != '/'; base--)
+        continue;
+    len -= base - path;
+    if (len > MAX_BASE_LEN)
+        len = MAX_BASE_LEN;
+
+    /* The process ID and sequence number make the name unique among the
+       processes sharing the trash, but an earlier process with our PID
+       may have left entries behind, so we don't replace an existing
+       entry */
+
+    for (;;) {
+        pthread_mutex_lock(&bu->mtx);
+        seq = bu->seq++;
+        pthread_mutex_unlock(&bu->mtx);
+
+        snprintf(name, sizeof(name), "%ld.%u.%.*s", (long) getpid(), seq,
+                 (int) len, base);
+        if (renameat2(dirFd, path, bu->trashFd, name,
+                      RENAME_NOREPLACE) == 0)
+            break;
+        if (errno != EEXIST)
+            return -1;
+    }
+
+    pthread_mutex_lock(&bu->mtx);
+    bu->work++;
+    bu->st.queued++;
+    pthread_cond_signal(&bu->workCond);
+    pthread_mutex_unlock(&bu->mtx);
+    return 0;
+}
+
+/* Wait until everything moved into the trash before the call has been
+   deleted. Returns 0 on success, or -1 if some entries in the trash
+   couldn't be deleted (errno is set from the last such error). */
+
+int
+buDrain(struct bgUnlink *bu)
+{
+    unsigned long work;
+    int failed, err;
+
+    pthread_mutex_lock(&bu->mtx);
+    work = bu->work;
+    while ((long) (bu->done - work) < 0 && !bu->stop)
+        pthread_cond_wait(&bu->doneCond, &bu->mtx);
+    failed = bu->failed;
+    err = bu->st.lastErrno;
+    pthread_mutex_unlock(&bu->mtx);
+
+    if (failed > 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+void
+buGetStats(struct bgUnlink *bu, struct buStats *stats)
+{
+    pthread_mutex_lock(&bu->mtx);
+    *stats = bu->st;
+    pthread_mutex_unlock(&bu->mtx);
+}
+
+/* Stop the background thread and free 'bu'. If 'drain' is nonzero, first
+   wait for the trash to be emptied, as for buDrain(); otherwise, stop as
+   soon as possible, leaving anything not yet deleted in the trash for
+   the next buOpen(). Returns 0 on success, or -1 if draining found
+   entries that couldn't be deleted. */
+
+int
+buClose(struct bgUnlink *bu, int drain)
+{
+    int s, savedErrno;
+
+    s = drain ? buDrain(bu) : 0;
+    savedErrno = errno;
+
+    pthread_mutex_lock(&bu->mtx);
+    __atomic_store_n(&bu->stop, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&bu->workCond);
+    pthread_mutex_unlock(&bu->mtx);
+    pthread_join(bu->tid, NULL);
+
+    close(bu->trashFd);
+    pthread_mutex_destroy(&bu->mtx);
+    pthread_cond_destroy(&bu->workCond);
+    pthread_cond_destroy(&bu->doneCond);
+    free(bu);
+
+    errno = savedErrno;
+    return s;
+}
@@ -0,0 +1,61 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 18 */
+
+/* bg_unlink.h
+
+   Header file for bg_unlink.c.
+*/
+#ifndef BG_UNLINK_H
+#define BG_UNLINK_H             /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+
+struct buParams {               /* See buDefaultParams() for defaults */
+    off_t truncStep;            /* Shrink a large file by this many bytes
+                                   at a time before unlinking it (0: don't
+                                   truncate) */
+    unsigned int pauseUs;       /* Sleep after each truncation step and
+                                   after every 'batch' unlinks */
+    int batch;                  /* Unlinks between pauses in a tree */
+    int nice;                   /* Nice value for the deleting thread */
+    int ioIdle;                 /* Nonzero: put the deleting thread in the
+                                   idle I/O scheduling class */
+};
+
+struct buStats {
+    unsigned long long queued;      /* Entries moved to trash by buRemove() */
+    unsigned long long removed;     /* Trash entries fully deleted (including
+                                       leftovers found by buOpen()) */
+    unsigned long long files;       /* Nondirectories unlinked */
+    unsigned long long dirs;        /* Directories removed */
+    unsigned long long bytes;       /* Bytes of storage freed (by files whose
+                                       last link we removed) */
+    unsigned long long truncSteps;  /* ftruncate() steps taken */
+    unsigned long long busyFiles;   /* Files that were open elsewhere, and so
+                                       were unlinked without truncation */
+    unsigned long long errors;      /* Entries that couldn't be deleted */
+    int lastErrno;                  /* errno from the most recent error */
+};
+
+void buDefaultParams(struct buParams *params);
+
+struct bgUnlink *buOpen(const char *trashDir, const struct buParams *params);
+
+int buRemove(struct bgUnlink *bu, int dirFd, const char *path);
+
+int buDrain(struct bgUnlink *bu);
+
+void buGetStats(struct bgUnlink *bu, struct buStats *stats);
+
+int buClose(struct bgUnlink *bu, int drain);
+
+#endif
@@ -0,0 +1,336 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 18 */
+
+/* bg_unlink_bench.c
+
+   Compare deleting a large file (or a large directory tree) in the
+   caller with deleting it in the background with bg_unlink.c, measuring
+   both how long the caller waits and the effect on the latency of
+   foreground I/O to the same file system.
+
+   Usage: bg_unlink_bench [-s size | -n nfiles] [-m modes] [-i ms]
+                          [-S step] [-p usecs] [-b batch] dir
+
+        -s size   Size of the file to delete (default: 4g; suffixes k, m,
+                  g, and t are allowed); its blocks are allocated with
+                  fallocate()
+        -n nfiles Instead, delete a tree of 'nfiles' files of 4 KiB
+                  each, in subdirectories of 1000 files
+        -m modes  Deletion modes to measure (default: sb): 's' (unlink()
+                  or nftw() and remove() in the caller) and 'b'
+                  (buRemove())
+        -i ms     Interval between foreground writes (default: 5)
+        -S step   Truncation step for 'b' (default: bg_unlink.c's; 0:
+                  don't truncate)
+        -p usecs  Pause between steps for 'b' (default: bg_unlink.c's)
+        -b batch  Unlinks between pauses for 'b' (default: bg_unlink.c's)
+
+   Throughout, a foreground thread writes 4 KiB to a file in 'dir' and
+   calls fdatasync() every 'ms' milliseconds. For each mode, the program
+   creates the victim, syncs the file system, deletes the victim, and
+   reports the time taken by the deleting call, the time until the
+   victim's space was freed (for 'b', when buDrain() returns), and the
+   median, 99th percentile, and maximum latency of the foreground writes
+   made from the start of the deletion until the file system has been
+   synced after it.
+
+   Try: bg_unlink_bench -s 8g /var/tmp
+        bg_unlink_bench -n 200000 /var/tmp
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include "bg_unlink.h"
+#include "lat_hist.h"
+#include "tlpi_hdr.h"
+
+#define FG_WRITE_SIZE 4096
+#define FG_FILE_SIZE (64 * 1024 * 1024)     /* Foreground writes wrap */
+#define TREE_FANOUT 1000
+
+static int fgFd;
+static int fgIntervalMs;
+static pthread_mutex_t histMtx = PTHREAD_MUTEX_INITIALIZER;
+static struct latHist fgHist;   /* Protected by 'histMtx' */
+static Boolean measuring;       /* Protected by 'histMtx' */
+static volatile Boolean stop;
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long
+getSize(const char *arg, const char *name)
+{
+    long long val;
+    char *end;
+    int shift;
+
+    errno = 0;
+    val = strtoll(arg, &end, 10);
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    case 't': case 'T': shift = 40; end++; break;
+    default:            shift = 0;         break;
+    }
+    if (errno != 0 || end == arg || *end != '\0' || val < 0 ||
+            val > (LLONG_MAX >> shift))
+        cmdLineErr("Bad %s: %s\n", name, arg);
+    return val << shift;
+}
+
+/* Foreground thread: small synchronous writes at a steady rate */
+
+static void *
+fgFunc(void *arg)
+{
+    static char buf[FG_WRITE_SIZE];
+    struct timespec ts;
+    long long t0, t;
+    off_t off;
+
+    ts.tv_sec = fgIntervalMs / 1000;
+    ts.tv_nsec = fgIntervalMs % 1000 * 1000000L;
+    memset(buf, 'x', sizeof(buf));
+
+    for (off = 0; !stop; off = (off + FG_WRITE_SIZE) % FG_FILE_SIZE) {
+        t0 = nowNs();
+        if (pwrite(fgFd, buf, sizeof(buf), off) != sizeof(buf))
+            errExit("pwrite");
+        if (fdatasync(fgFd) == -1)
+            errExit("fdatasync");
+        t = nowNs() - t0;
+
+        pthread_mutex_lock(&histMtx);
+        if (measuring)
+            latHistRecord(&fgHist, t);
+        pthread_mutex_unlock(&histMtx);
+
+        nanosleep(&ts, NULL);
+    }
+
+    return NULL;
+}
+
+static void
+setMeasuring(Boolean on)
+{
+    pthread_mutex_lock(&histMtx);
+    if (on)
+        latHistInit(&fgHist);
+    measuring = on;
+    pthread_mutex_unlock(&histMtx);
+}
+
+static void
+createFile(const char *path, long long size)
+{
+    static char buf[1024 * 1024];
+    long long done;
+    int fd;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        errExit("open %s", path);
+
+    if (fallocate(fd, 0, 0, size) == -1) {
+        if (errno != EOPNOTSUPP)
+            errExit("fallocate");
+        for (done = 0; done < size; done += sizeof(buf))
+            if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+                errExit("write");
+    }
+    if (close(fd) == -1)
+        errExit("close");
+}
+
+static void
+createTree(const char *path, long nfiles)
+{
+    static char buf[4096];
+    char name[PATH_MAX];
+    long j;
+    int fd;
+
+    if (mkdir(path, S_IRWXU) == -1)
+        errExit("mkdir %s", path);
+    for (j = 0; j < nfiles; j++) {
+        if (j % TREE_FANOUT == 0) {
+            snprintf(name, sizeof(name), "%s/d%ld", path, j / TREE_FANOUT);
+            if (mkdir(name, S_IRWXU) == -1)
+                errExit("mkdir %s", name);
+        }
+        snprintf(name, sizeof(name), "%s/d%ld/f%ld", path,
+                 j / TREE_FANOUT, j);
+        fd = open(name, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+        if (fd == -1)
+            errExit("open %s", name);
+        if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+            errExit("write");
+        if (close(fd) == -1)
+            errExit("close");
+    }
+}
+
+static int
+removeFn(const char *path, const struct stat *sb, int type,
+         struct FTW *ftwb)
+{
+    if (remove(path) == -1)
+        errExit("remove %s", path);
+    return 0;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-s size | -n nfiles] [-m modes] [-i ms]\n"
+            "        [-S step] [-p usecs] [-b batch] dir\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct buParams params;
+    struct bgUnlink *bu;
+    struct buStats st;
+    char victim[PATH_MAX], trash[PATH_MAX], fgPath[PATH_MAX];
+    const char *modes, *m, *dir;
+    long long size, t0, tCall, tDone;
+    long nfiles;
+    pthread_t tid;
+    int opt, s;
+
+    size = 4LL << 30;
+    nfiles = 0;
+    modes = "sb";
+    fgIntervalMs = 5;
+    buDefaultParams(&params);
+    while ((opt = getopt(argc, argv, "s:n:m:i:S:p:b:")) != -1) {
+        switch (opt) {
+        case 's':   size = getSize(optarg, "size");                 break;
+        case 'n':   nfiles = getInt(optarg, GN_GT_0, "-n");         break;
+        case 'm':   modes = optarg;                                 break;
+        case 'i':   fgIntervalMs = getInt(optarg, GN_GT_0, "-i");   break;
+        case 'S':   params.truncStep = getSize(optarg, "step");     break;
+        case 'p':   params.pauseUs = getInt(optarg, 0, "-p");       break;
+        case 'b':   params.batch = getInt(optarg, 0, "-b");         break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind + 1 != argc)
+        usageError(argv[0]);
+    dir = argv[optind];
+    if (modes[strspn(modes, "sb")] != '\0')
+        cmdLineErr("Bad modes: %s\n", modes);
+
+    snprintf(victim, sizeof(victim), "%s/bg_unlink_bench.victim", dir);
+    snprintf(trash, sizeof(trash), "%s/bg_unlink_bench.trash", dir);
+    snprintf(fgPath, sizeof(fgPath), "%s/bg_unlink_bench.fg", dir);
+
+    fgFd = open(fgPath, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fgFd == -1)
+        errExit("open %s", fgPath);
+    if (fallocate(fgFd, 0, 0, FG_FILE_SIZE) == -1 && errno != EOPNOTSUPP)
+        errExit("fallocate");
+    s = pthread_create(&tid, NULL, fgFunc, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_create");
+
+    bu = buOpen(trash, &params);
+    if (bu == NULL)
+        errExit("buOpen %s", trash);
+
+    if (nfiles > 0)
+        printf("Victim: %ld files\n", nfiles);
+    else
+        printf("Victim: %lld MiB file\n", size >> 20);
+    printf("%-4s %12s %10s %8s %10s %10s %10s\n", "mode", "call-us",
+           "done-ms", "fg-n", "fg-p50-us", "fg-p99-us", "fg-max-us");
+
+    for (m = modes; *m != '\0'; m++) {
+        if (nfiles > 0)
+            createTree(victim, nfiles);
+        else
+            createFile(victim, size);
+        if (syncfs(fgFd) == -1)
+            errExit("syncfs");
+        sleep(1);                       /* Let things settle */
+
+        setMeasuring(TRUE);
+        t0 = nowNs();
+        if (*m == 'b') {
+            if (buRemove(bu, AT_FDCWD, victim) == -1)
+                errExit("buRemove");
+        } else if (nfiles > 0) {
+            if (nftw(victim, removeFn, 20, FTW_DEPTH | FTW_PHYS) == -1)
+                errExit("nftw");
+        } else {
+            if (unlink(victim) == -1)
+                errExit("unlink");
+        }
+        tCall = nowNs() - t0;
+
+        if (*m == 'b' && buDrain(bu) == -1)
+            errExit("buDrain");
+        tDone = nowNs() - t0;
+
+        if (syncfs(fgFd) == -1)
+            errExit("syncfs");
+        usleep(fgIntervalMs * 1000 * 2);  /* A couple more samples */
+        setMeasuring(FALSE);
+
+        pthread_mutex_lock(&histMtx);
+        printf("%-4c %12.1f %10.1f %8lld %10.1f %10.1f %10.1f\n", *m,
+               tCall / 1000.0, tDone / 1e6, fgHist.count,
+               latHistPercentile(&fgHist, 0.50) / 1000.0,
+               latHistPercentile(&fgHist, 0.99) / 1000.0,
+               fgHist.max / 1000.0);
+        pthread_mutex_unlock(&histMtx);
+        fflush(stdout);
+    }
+
+    buGetStats(bu, &st);
+    if (buClose(bu, 1) == -1)
+        errExit("buClose");
+    if (strchr(modes, 'b') != NULL)
+        printf("Background: %llu files, %llu dirs, %llu MiB freed, "
+               "%llu truncation steps, %llu busy, %llu errors\n",
+               st.files, st.dirs, st.bytes >> 20, st.truncSteps,
+               st.busyFiles, st.errors);
+
+    stop = TRUE;
+    s = pthread_join(tid, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_join");
+    if (unlink(fgPath) == -1)
+        errExit("unlink %s", fgPath);
+    if (rmdir(trash) == -1)
+        errMsg("rmdir %s", trash);
+
+    exit(EXIT_SUCCESS);
+}
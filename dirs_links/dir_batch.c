@@ -0,0 +1,141 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 18 */
+
+/* dir_batch.c
+
+   Functions for reading directories in large batches, by calling the
+   Linux getdents64() system call directly, with a buffer supplied by the
+   caller. (readdir(3) also uses getdents64(), but with a buffer of only a
+   few kilobytes, so that reading a directory that contains millions of
+   entries requires many thousands of system calls.)
+
+   dirBatchInit() prepares to read the directory referred to by a file
+   descriptor. Each call to dirBatchRead() makes a single getdents64()
+   call and returns an array describing all of the entries that it
+   obtained (excluding "." and ".."). dirBatchSortByInode() can be used to
+   sort a batch by i-node number, so that subsequent stat() calls access
+   the i-nodes in (roughly) disk order.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "dir_batch.h"
+#include "tlpi_hdr.h"
+
+struct linuxDirent64 {          /* Record returned by getdents64() */
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/* The smallest possible record: header, 1-byte name plus terminating
+   null byte, rounded up to a multiple of 8 bytes */
+
+#define MIN_RECLEN ((offsetof(struct linuxDirent64, d_name) + 2 + 7) & ~7)
+
+/* Prepare to read the directory referred to by 'fd' via 'db', using a
+   buffer of 'bufSize' bytes (or DB_DEFAULT_BUF_SIZE, if 'bufSize' is 0).
+   The caller remains responsible for closing 'fd'. Returns 0 on success,
+   or -1 on error. */
+
+int
+dirBatchInit(struct dirBatch *db, int fd, size_t bufSize)
+{
+    if (bufSize == 0)
+        bufSize = DB_DEFAULT_BUF_SIZE;
+
+    db->fd = fd;
+    db->bufSize = bufSize;
+    db->maxEnts = bufSize / MIN_RECLEN + 1;
+    db->calls = 0;
+    db->buf = malloc(bufSize);
+    db->ents = malloc(db->maxEnts * sizeof(struct dirBatchEnt));
+    if (db->buf == NULL || db->ents == NULL) {
+        free(db->buf);
+        free(db->ents);
+        return -1;
+    }
+    return 0;
+}
+
+/* Read the next batch of entries, returning a pointer to them in '*ents'.
+   The entries (and the filenames that they point to) remain valid until
+   the next call to dirBatchRead(). Returns the number of entries, 0 at
+   end of directory, or -1 on error. (Because "." and ".." are omitted, a
+   batch could in principle be empty even though the end of the directory
+   has not been reached; in that case, we simply read again.) */
+
+ssize_t
+dirBatchRead(struct dirBatch *db, struct dirBatchEnt **ents)
+{
+    struct linuxDirent64 *d;
+    long numRead, pos;
+    size_t n;
+
+    do {
+        numRead = syscall(SYS_getdents64, db->fd, db->buf, db->bufSize);
+        db->calls++;
+        if (numRead <= 0)
+            return numRead;
+
+        n = 0;
+        for (pos = 0; pos < numRead; pos += d->d_reclen) {
+            d = (struct linuxDirent64 *) (db->buf + pos);
+            if (d->d_name[0] == '.' && (d->d_name[1] == '\0' ||
+                        (d->d_name[1] == '.' && d->d_name[2] == '\0')))
+                continue;
+
+            db->ents[n].ino = d->d_ino;
+            db->ents[n].type = d->d_type;
+            db->ents[n].name = d->d_name;
+            n++;
+        }
+    } while (n == 0);
+
+    *ents = db->ents;
+    return n;
+}
+
+static int
+cmpIno(const void *a, const void *b)
+{
+    ino_t ia = ((const struct dirBatchEnt *) a)->ino;
+    ino_t ib = ((const struct dirBatchEnt *) b)->ino;
+
+    return (ia > ib) - (ia < ib);
+}
+
+/* Sort 'n' entries by i-node number */
+
+void
+dirBatchSortByInode(struct dirBatchEnt *ents, size_t n)
+{
+    qsort(ents, n, sizeof(struct dirBatchEnt), cmpIno);
+}
+
+/* Free the buffers allocated by dirBatchInit() (but don't close the
+   directory file descriptor) */
+
+void
+dirBatchFree(struct dirBatch *db)
+{
+    free(db->buf);
+    free(db->ents);
+    db->buf = NULL;
+    db->ents = NULL;
+}
@@ -0,0 +1,47 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 18 */
+
+/* dir_batch.h
+
+   Header file for dir_batch.c.
+*/
+#ifndef DIR_BATCH_H
+#define DIR_BATCH_H             /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+
+struct dirBatchEnt {            /* One directory entry */
+    ino_t ino;                  /* I-node number */
+    unsigned char type;         /* DT_* file type (maybe DT_UNKNOWN) */
+    const char *name;           /* Filename; points into batch buffer */
+};
+
+struct dirBatch {
+    int fd;                     /* Directory file descriptor */
+    char *buf;                  /* Buffer for getdents64() */
+    size_t bufSize;
+    struct dirBatchEnt *ents;   /* Entries from last dirBatchRead() */
+    size_t maxEnts;             /* Allocated size of 'ents' */
+    unsigned long calls;        /* Number of getdents64() calls made */
+};
+
+#define DB_DEFAULT_BUF_SIZE (1024 * 1024)
+
+int dirBatchInit(struct dirBatch *db, int fd, size_t bufSize);
+
+ssize_t dirBatchRead(struct dirBatch *db, struct dirBatchEnt **ents);
+
+void dirBatchSortByInode(struct dirBatchEnt *ents, size_t n);
+
+void dirBatchFree(struct dirBatch *db);
+
+#endif
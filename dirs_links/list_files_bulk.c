@@ -0,0 +1,174 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 18 */
+
+/* list_files_bulk.c
+
+   A version of list_files.c that reads each directory in large batches
+   using the functions in dir_batch.c (which call getdents64() directly),
+   rather than one entry at a time with readdir().
+
+   Usage: list_files_bulk [-b bufsize] [-l] [-i] [-q] [dir...]
+
+        -b bufsize   Size of getdents64() buffer (default: 1 MiB)
+        -l           For each entry, also call fstatat() and display the
+                     i-node number, file type, and size. Without this
+                     option, the program never calls stat(): the file type
+                     is the one supplied by the file system in 'd_type'.
+        -i           Sort each batch by i-node number before calling
+                     fstatat() (useful with -l on rotating disks)
+        -q           Don't display the entries (useful for timing)
+
+   On completion, the program displays (on stderr) the number of entries,
+   the number of getdents64() calls, and the number of entries per second.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include "dir_batch.h"
+#include "tlpi_hdr.h"
+
+static size_t bufSize = DB_DEFAULT_BUF_SIZE;
+static Boolean doStat = FALSE, sortIno = FALSE, quiet = FALSE;
+static unsigned long numEnts, numCalls;
+
+static char
+typeChar(unsigned char type)    /* Map DT_* to an "ls -l" style letter */
+{
+    switch (type) {
+    case DT_REG:  return '-';
+    case DT_DIR:  return 'd';
+    case DT_CHR:  return 'c';
+    case DT_BLK:  return 'b';
+    case DT_LNK:  return 'l';
+    case DT_FIFO: return 'p';
+    case DT_SOCK: return 's';
+    default:      return '?';
+    }
+}
+
+static void             /* List all files in directory 'dirpath' */
+listFiles(const char *dirpath)
+{
+    struct dirBatch db;
+    struct dirBatchEnt *ents;
+    struct stat sb;
+    Boolean isCurrent;          /* True if 'dirpath' is "." */
+    ssize_t n, j;
+    int fd;
+
+    isCurrent = strcmp(dirpath, ".") == 0;
+
+    fd = open(dirpath, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        errMsg("open failed on '%s'", dirpath);
+        return;
+    }
+
+    if (dirBatchInit(&db, fd, bufSize) == -1)
+        errExit("dirBatchInit");
+
+    while ((n = dirBatchRead(&db, &ents)) > 0) {
+        if (doStat && sortIno)
+            dirBatchSortByInode(ents, n);
+
+        for (j = 0; j < n; j++) {
+            if (doStat) {
+                if (fstatat(fd, ents[j].name, &sb,
+                            AT_SYMLINK_NOFOLLOW) == -1) {
+                    errMsg("fstatat: %s", ents[j].name);
+                    continue;
+                }
+            }
+
+            if (quiet)
+                continue;
+
+            if (doStat)
+                printf("%8ld %c %10lld  ", (long) sb.st_ino,
+                        typeChar(IFTODT(sb.st_mode)),
+                        (long long) sb.st_size);
+            else
+                printf("%c  ", typeChar(ents[j].type));
+            if (!isCurrent)
+                printf("%s/", dirpath);
+            printf("%s\n", ents[j].name);
+        }
+
+        numEnts += n;
+    }
+
+    if (n == -1)
+        errExit("getdents64");
+
+    numCalls += db.calls;
+    dirBatchFree(&db);
+    if (close(fd) == -1)
+        errMsg("close");
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-b bufsize] [-l] [-i] [-q] [dir...]\n",
+            progName);
+    fprintf(stderr, "    -b bufsize   getdents64() buffer size "
+                    "(default: 1 MiB)\n");
+    fprintf(stderr, "    -l           stat() each entry\n");
+    fprintf(stderr, "    -i           Sort by i-node number before "
+                    "stat()-ing\n");
+    fprintf(stderr, "    -q           Don't list entries\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct timespec start, end;
+    double secs;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:liq")) != -1) {
+        switch (opt) {
+        case 'b':
+            bufSize = getLong(optarg, GN_GT_0 | GN_ANY_BASE, "bufsize");
+            break;
+        case 'l':   doStat = TRUE;      break;
+        case 'i':   sortIno = TRUE;     break;
+        case 'q':   quiet = TRUE;       break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+
+    if (optind == argc)         /* No arguments - use current directory */
+        listFiles(".");
+    else
+        for (; optind < argc; optind++)
+            listFiles(argv[optind]);
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    fflush(stdout);
+    fprintf(stderr, "%lu entries, %lu getdents64() calls, %.3f s "
+            "(%.0f entries/s)\n", numEnts, numCalls, secs,
+            (secs > 0) ? numEnts / secs : 0.0);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,836 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 18 */
+
+/* path_cache.c
+
+   A replacement for realpath(3) and readlink(2) for programs that resolve
+   many pathnames sharing long directory prefixes.
+
+   realpath() walks every component of every pathname it is given,
+   calling lstat() (and readlink(), for symbolic links) on each. Here,
+   each directory pathname (as given, after removing redundant slashes
+   and "." components) is resolved once, one component at a time, to an
+   O_PATH file descriptor and its canonical pathname, and both are
+   cached; a symbolic link met along the way is read with readlinkat(),
+   and its target (itself resolved through the cache) is cached under
+   the link's pathname. Resolving a pathname whose directory is cached
+   then takes a single fstatat() of its last component relative to the
+   cached descriptor (plus a readlinkat() and a further lookup if that
+   component is itself a symbolic link). Components are opened with
+   openat2() and RESOLVE_NO_MAGICLINKS (falling back to openat() on
+   kernels before 5.6), so that /proc's "magic" links are read as text,
+   as realpath() does, rather than jumped through.
+
+   A cached directory becomes stale if one of the components by which it
+   was reached is renamed, removed, or replaced. pcOpen()'s 'validate'
+   argument selects how this is detected:
+
+   PC_VALIDATE_INOTIFY: each cached directory is watched with inotify
+        for entries being moved or deleted, and for itself being moved
+        or deleted. Pending events are read at the start of a call (at
+        most every 'checkMs' milliseconds; 0 means every call), and an
+        event naming a cached component (or any event that can't be
+        matched, such as a queue overflow) flushes the whole cache. If a
+        watch can't be added (for example, because the directory is not
+        readable, or the watch limit has been reached), the cache
+        switches to PC_VALIDATE_MTIME.
+
+   PC_VALIDATE_MTIME: when a cached directory is used (at most every
+        'checkMs' milliseconds for each directory), its ancestors'
+        modification times are compared (with fstat()) with those seen
+        when it was cached, and the cache is flushed if any differs.
+        Note that creating or deleting any file in an ancestor also
+        changes its modification time.
+
+   PC_VALIDATE_NONE: the caller guarantees that the tree doesn't change,
+        or calls pcFlush() after changing it.
+
+   A call that meets a stale entry flushes the cache and starts again,
+   and after a few failed attempts falls back to realpath() or
+   readlink(). A pathname that reaches a directory through a symbolic
+   link or ".." is cached as an alias of the directory's canonical
+   pathname, so that each directory is open only once. The number of
+   directories cached (and so, of file descriptors held open) is limited
+   by pcOpen()'s 'maxDirs' argument (and the number of aliases to
+   MAX_ALIASES times that); the cache is flushed when the limit is
+   reached.
+
+   Relative pathnames are interpreted relative to the current working
+   directory at the time of pcOpen(). A pathCache is not thread-safe.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include "path_cache.h"         /* Declares functions defined here */
+
+#define MAX_LINKS 40            /* Symbolic links followed in resolving a
+                                   pathname (as the kernel's MAXSYMLINKS) */
+#define MAX_TRIES 3             /* Attempts before falling back to
+                                   realpath() */
+#define MAX_ALIASES 16          /* Entries allowed for each directory */
+#define INITIAL_BUCKETS 1024
+#define FILTER_BITS 16          /* log2 of bits in 'filter' */
+#define WATCH_MASK (IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE | \
+                    IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+struct pcDir {
+    struct pcDir *next;         /* Next entry in hash chain */
+    uint32_t hash;
+    size_t keyLen;
+    char *key;                  /* Directory pathname, as looked up */
+    char *canon;                /* Canonical pathname */
+    int fd;                     /* O_PATH file descriptor */
+    int wd;                     /* inotify watch descriptor, or -1 */
+    struct pcDir *parent;       /* Entry for parent of 'key' (NULL for
+                                   "/") */
+    struct pcDir *alias;        /* If 'key' is a symbolic link, the entry
+                                   for its target, whose 'canon', 'fd',
+                                   'wd', and 'mtime' are shared */
+    struct timespec mtime;      /* Directory's mtime when cached */
+    struct timespec checked;    /* When ancestors were last checked
+                                   (PC_VALIDATE_MTIME) */
+};
+
+struct pathCache {
+    int validate;               /* PC_VALIDATE_* */
+    long checkMs;
+    long maxDirs;
+    struct pcDir **buckets;     /* Hash table of directories, by key */
+    size_t numBuckets;          /* Always a power of 2 */
+    long numDirs;
+    long numFds;                /* Entries that aren't aliases */
+    int inotifyFd;              /* PC_VALIDATE_INOTIFY only */
+    struct timespec lastCheck;  /* When events were last read */
+    int stale;                  /* Flush before the next lookup */
+    int noOpenat2;              /* Kernel lacks openat2() */
+    uint64_t filter[(1 << FILTER_BITS) / 64];
+                                /* Bits set for (watch, name) pairs of
+                                   cached components; see setFilter() */
+    char cwd[PATH_MAX];
+    struct pcStats st;
+};
+
+static uint32_t
+hashBytes(const char *s, size_t len)    /* FNV-1a */
+{
+    uint32_t h;
+    size_t j;
+
+    h = 2166136261u;
+    for (j = 0; j < len; j++)
+        h = (h ^ (unsigned char) s[j]) * 16777619u;
+    return h;
+}
+
+/* The filter records which names in watched directories are cached
+   components, so that events for other names (files being created and
+   deleted) can be ignored. Collisions merely cause unnecessary
+   flushes. */
+
+static unsigned int
+filterBit(int wd, const char *name)
+{
+    return (hashBytes(name, strlen(name)) ^ (uint32_t) wd * 2654435761u) &
+           ((1 << FILTER_BITS) - 1);
+}
+
+static void
+setFilter(struct pathCache *pc, int wd, const char *name)
+{
+    unsigned int b = filterBit(wd, name);
+
+    pc->filter[b / 64] |= (uint64_t) 1 << (b % 64);
+}
+
+static int
+testFilter(struct pathCache *pc, int wd, const char *name)
+{
+    unsigned int b = filterBit(wd, name);
+
+    return (pc->filter[b / 64] >> (b % 64)) & 1;
+}
+
+/* Has 'checkMs' elapsed between 'then' and 'now'? */
+
+static int
+due(struct pathCache *pc, const struct timespec *then,
+    const struct timespec *now)
+{
+    return (now->tv_sec - then->tv_sec) * 1000 +
+           (now->tv_nsec - then->tv_nsec) / 1000000 >= pc->checkMs;
+}
+
+/* Open 'name' (a single component) in the directory 'dirFd' as an
+   O_PATH descriptor. Returns a file descriptor, or -1 on error. */
+
+static int
+openComponent(struct pathCache *pc, int dirFd, const char *name, int flags)
+{
+    struct open_how how;
+    int fd;
+
+    if (!pc->noOpenat2) {
+        memset(&how, 0, sizeof(how));
+        how.flags = flags | O_PATH | O_CLOEXEC;
+        how.resolve = RESOLVE_NO_MAGICLINKS;
+        fd = syscall(SYS_openat2, dirFd, name, &how, sizeof(how));
+        if (fd != -1 || errno != ENOSYS)
+            return fd;
+        pc->noOpenat2 = 1;
+    }
+    return openat(dirFd, name, flags | O_PATH | O_CLOEXEC);
+}
+
+/* Normalize 'path' into 'out' (PATH_MAX bytes): an absolute pathname
+   (relative pathnames are taken relative to 'base', which must be
+   canonical) with no empty or "." components and no trailing slash.
+   ".." components are kept, since they can't be removed without knowing
+   which components are symbolic links. '*isDir' is set nonzero if
+   'path' must name a directory (it ends with a slash, ".", or ".."). Returns
+   the length of 'out', or -1 on error. */
+
+static ssize_t
+normalize(const char *base, const char *path, char *out, int *isDir)
+{
+    const char *p, *end;
+    size_t len, n, plen;
+
+    plen = strlen(path);
+    if (plen == 0) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    len = 0;
+    if (path[0] != '/') {
+        len = strlen(base);
+        if (len == 1)                   /* Base is "/" */
+            len = 0;
+        memcpy(out, base, len);
+    }
+
+    for (p = path; *p != '\0'; p = end) {
+        while (*p == '/')
+            p++;
+        if (*p == '\0')
+            break;
+        end = strchrnul(p, '/');
+        n = end - p;
+        if (n == 1 && p[0] == '.')
+            continue;
+        if (len + 1 + n >= PATH_MAX) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        out[len++] = '/';
+        memcpy(out + len, p, n);
+        len += n;
+    }
+
+    if (len == 0)
+        out[len++] = '/';
+    out[len] = '\0';
+
+    *isDir = path[plen - 1] == '/' ||
+             (path[plen - 1] == '.' && (plen == 1 || path[plen - 2] == '/' ||
+                    (path[plen - 2] == '.' &&
+                     (plen == 2 || path[plen - 3] == '/'))));
+    return len;
+}
+
+/* Place 'dir'/'name' in 'out' (PATH_MAX bytes). Returns 'out', or NULL
+   if the result is too long. */
+
+static char *
+joinPath(const char *dir, const char *name, char *out)
+{
+    int n;
+
+    n = snprintf(out, PATH_MAX, "%s/%s", (strcmp(dir, "/") == 0) ? "" : dir,
+                 name);
+    if (n >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    return out;
+}
+
+static struct pcDir *
+findDir(struct pathCache *pc, const char *key, size_t len)
+{
+    struct pcDir *e;
+    uint32_t h;
+
+    h = hashBytes(key, len);
+    for (e = pc->buckets[h & (pc->numBuckets - 1)]; e != NULL; e = e->next)
+        if (e->hash == h && e->keyLen == len &&
+                memcmp(e->key, key, len) == 0)
+            return e;
+    return NULL;
+}
+
+static void
+insertDir(struct pathCache *pc, struct pcDir *e)
+{
+    struct pcDir **nb, *x, *next;
+    size_t j, n;
+
+    if ((size_t) pc->numDirs >= pc->numBuckets) {
+        n = pc->numBuckets * 2;
+        nb = calloc(n, sizeof(struct pcDir *));
+        if (nb != NULL) {               /* Otherwise, chains just grow */
+            for (j = 0; j < pc->numBuckets; j++) {
+                for (x = pc->buckets[j]; x != NULL; x = next) {
+                    next = x->next;
+                    x->next = nb[x->hash & (n - 1)];
+                    nb[x->hash & (n - 1)] = x;
+                }
+            }
+            free(pc->buckets);
+            pc->buckets = nb;
+            pc->numBuckets = n;
+        }
+    }
+
+    e->next = pc->buckets[e->hash & (pc->numBuckets - 1)];
+    pc->buckets[e->hash & (pc->numBuckets - 1)] = e;
+    pc->numDirs++;
+    if (e->alias == NULL)
+        pc->numFds++;
+    if (pc->numFds >= pc->maxDirs || pc->numDirs >= MAX_ALIASES * pc->maxDirs)
+        pc->stale = 1;
+}
+
+/* Give up on inotify (see the comment at the top of this file) */
+
+static void
+useMtime(struct pathCache *pc)
+{
+    pc->validate = PC_VALIDATE_MTIME;
+    pc->stale = 1;
+    if (pc->inotifyFd != -1)
+        close(pc->inotifyFd);
+    pc->inotifyFd = -1;
+}
+
+/* Cache the directory 'key', which is the component 'comp' of 'parent'.
+   'alias' is NULL for a directory, which is open as 'fd', with
+   canonical pathname 'canon' and modification time 'mtime'; for a
+   symbolic link, it is the entry for the link's target. Returns the new
+   entry, or NULL on error. */
+
+static struct pcDir *
+newDir(struct pathCache *pc, const char *key, size_t len, const char *comp,
+       struct pcDir *parent, struct pcDir *alias, int fd,
+       const char *canon, const struct timespec *mtime)
+{
+    char procPath[64];
+    struct pcDir *e;
+    size_t canonLen;
+
+    canonLen = (alias == NULL) ? strlen(canon) + 1 : 0;
+    e = malloc(sizeof(struct pcDir) + len + 1 + canonLen);
+    if (e == NULL) {
+        if (fd != -1)
+            close(fd);
+        return NULL;
+    }
+
+    e->key = (char *) (e + 1);
+    memcpy(e->key, key, len);
+    e->key[len] = '\0';
+    e->keyLen = len;
+    e->hash = hashBytes(key, len);
+    e->parent = parent;
+    e->alias = alias;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &e->checked);
+
+    if (alias != NULL) {
+        e->canon = alias->canon;
+        e->fd = alias->fd;
+        e->wd = alias->wd;
+        e->mtime = alias->mtime;
+    } else {
+        e->canon = e->key + len + 1;
+        memcpy(e->canon, canon, canonLen);
+        e->fd = fd;
+        e->mtime = *mtime;
+        e->wd = -1;
+        if (pc->validate == PC_VALIDATE_INOTIFY) {
+            snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", fd);
+            e->wd = inotify_add_watch(pc->inotifyFd, procPath, WATCH_MASK);
+            if (e->wd == -1)
+                useMtime(pc);
+        }
+    }
+
+    if (parent != NULL && strcmp(comp, "..") != 0 && parent->wd != -1)
+        setFilter(pc, parent->wd, comp);
+
+    insertDir(pc, e);
+    return e;
+}
+
+static struct pcDir *lookupDir(struct pathCache *pc, const char *key,
+                               size_t len, int *links);
+
+/* Resolve and cache the directory 'key', which is the component 'comp'
+   of the cached directory 'parent'. '*links' counts the symbolic links
+   followed so far. Returns the new entry, or NULL on error. */
+
+static struct pcDir *
+addComponent(struct pathCache *pc, struct pcDir *parent, const char *key,
+             size_t len, const char *comp, int *links)
+{
+    char canon[PATH_MAX], target[PATH_MAX];
+    struct pcDir *t;
+    struct stat sb;
+    ssize_t n, tlen;
+    char *p;
+    int fd, isDir;
+
+    fd = openComponent(pc, parent->fd, comp,
+                       (strcmp(comp, "..") == 0) ? O_DIRECTORY : O_NOFOLLOW);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &sb) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    if (S_ISLNK(sb.st_mode)) {
+        n = readlinkat(fd, "", target, sizeof(target) - 1);
+        close(fd);
+        if (n == -1)
+            return NULL;
+        target[n] = '\0';
+        if (++*links > MAX_LINKS) {
+            errno = ELOOP;
+            return NULL;
+        }
+        pc->st.links++;
+
+        /* A relative link is relative to the directory containing it */
+
+        tlen = normalize(parent->canon, target, canon, &isDir);
+        if (tlen == -1)
+            return NULL;
+        t = lookupDir(pc, canon, tlen, links);
+        if (t == NULL)
+            return NULL;
+        return newDir(pc, key, len, comp, parent, t, -1, NULL, NULL);
+    }
+
+    if (!S_ISDIR(sb.st_mode)) {
+        close(fd);
+        errno = ENOTDIR;
+        return NULL;
+    }
+
+    if (strcmp(comp, "..") == 0) {      /* Canonical parent of 'parent' */
+        strcpy(canon, parent->canon);
+        p = strrchr(canon, '/');
+        if (p == canon)
+            p++;
+        *p = '\0';
+    } else if (joinPath(parent->canon, comp, canon) == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    /* If 'key' isn't canonical (it was reached through a symbolic link or
+       ".."), make it an alias of the entry for the canonical pathname,
+       so that each directory holds only one file descriptor */
+
+    if (strlen(canon) != len || memcmp(canon, key, len) != 0) {
+        close(fd);
+        t = lookupDir(pc, canon, strlen(canon), links);
+        if (t == NULL)
+            return NULL;
+        return newDir(pc, key, len, comp, parent, t, -1, NULL, NULL);
+    }
+
+    return newDir(pc, key, len, comp, parent, NULL, fd, canon, &sb.st_mtim);
+}
+
+static int
+sameMtime(const struct pcDir *e)
+{
+    struct stat sb;
+
+    return fstat(e->fd, &sb) == 0 && sb.st_mtim.tv_sec == e->mtime.tv_sec &&
+           sb.st_mtim.tv_nsec == e->mtime.tv_nsec;
+}
+
+/* For PC_VALIDATE_MTIME: check (if 'checkMs' has elapsed since the last
+   check) that none of the directories through which 'e' was reached has
+   changed since it was cached. Returns nonzero if 'e' is valid. */
+
+static int
+chainValid(struct pathCache *pc, struct pcDir *e)
+{
+    struct timespec now;
+    struct pcDir *x;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    if (!due(pc, &e->checked, &now))
+        return 1;
+
+    for (x = e; x != NULL; x = x->parent) {
+        if (x->alias != NULL && !chainValid(pc, x->alias))
+            return 0;
+        if (x != e && !sameMtime(x))
+            return 0;
+    }
+
+    e->checked = now;
+    return 1;
+}
+
+/* Return the entry for the directory 'key' (normalized, of length
+   'len'), resolving and caching it and its ancestors if necessary.
+   Returns NULL on error, with errno set to ESTALE if a stale entry was
+   found. */
+
+static struct pcDir *
+lookupDir(struct pathCache *pc, const char *key, size_t len, int *links)
+{
+    char comp[NAME_MAX + 1];
+    struct pcDir *e, *parent;
+    struct stat sb;
+    size_t slash;
+    int fd;
+
+    e = findDir(pc, key, len);
+    if (e != NULL) {
+        if (pc->validate == PC_VALIDATE_MTIME && !chainValid(pc, e)) {
+            errno = ESTALE;
+            return NULL;
+        }
+        pc->st.hits++;
+        return e;
+    }
+    pc->st.misses++;
+
+    if (len == 1) {                     /* "/" */
+        fd = open("/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1)
+            return NULL;
+        if (fstat(fd, &sb) == -1) {
+            close(fd);
+            return NULL;
+        }
+        return newDir(pc, "/", 1, "/", NULL, NULL, fd, "/", &sb.st_mtim);
+    }
+
+    for (slash = len - 1; key[slash] != '/'; slash--)
+        continue;
+    if (len - slash - 1 > NAME_MAX) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    memcpy(comp, key + slash + 1, len - slash - 1);
+    comp[len - slash - 1] = '\0';
+
+    parent = lookupDir(pc, key, (slash == 0) ? 1 : slash, links);
+    if (parent == NULL)
+        return NULL;
+    return addComponent(pc, parent, key, len, comp, links);
+}
+
+static void
+freeDirs(struct pathCache *pc)
+{
+    struct pcDir *e, *next;
+    size_t j;
+
+    for (j = 0; j < pc->numBuckets; j++) {
+        for (e = pc->buckets[j]; e != NULL; e = next) {
+            next = e->next;
+            if (e->alias == NULL)
+                close(e->fd);
+            free(e);
+        }
+        pc->buckets[j] = NULL;
+    }
+    pc->numDirs = 0;
+    pc->numFds = 0;
+    memset(pc->filter, 0, sizeof(pc->filter));
+}
+
+/* Discard all cached directories */
+
+void
+pcFlush(struct pathCache *pc)
+{
+    freeDirs(pc);
+
+    /* Closing the inotify descriptor is the quickest way to remove all
+       of the watches (and any events they have queued) */
+
+    if (pc->validate == PC_VALIDATE_INOTIFY) {
+        close(pc->inotifyFd);
+        pc->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (pc->inotifyFd == -1)
+            useMtime(pc);
+    }
+    pc->stale = 0;
+}
+
+/* Read pending inotify events, noting whether any affects a cached
+   component */
+
+static void
+readEvents(struct pathCache *pc)
+{
+    char buf[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    ssize_t numRead;
+    char *p;
+
+    while ((numRead = read(pc->inotifyFd, buf, sizeof(buf))) > 0) {
+        for (p = buf; p < buf + numRead; p += sizeof(*ev) + ev->len) {
+            ev = (const struct inotify_event *) p;
+            if ((ev->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF |
+                             IN_MOVE_SELF | IN_UNMOUNT)) ||
+                    (ev->len > 0 && testFilter(pc, ev->wd, ev->name)))
+                pc->stale = 1;
+        }
+    }
+}
+
+/* Called at the start of each attempt to resolve a pathname */
+
+static void
+prepare(struct pathCache *pc)
+{
+    struct timespec now;
+
+    if (pc->validate == PC_VALIDATE_INOTIFY) {
+        if (pc->checkMs == 0) {
+            readEvents(pc);
+        } else {
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+            if (due(pc, &pc->lastCheck, &now)) {
+                readEvents(pc);
+                pc->lastCheck = now;
+            }
+        }
+    }
+
+    if (pc->stale) {
+        pcFlush(pc);
+        pc->st.flushes++;
+    }
+}
+
+static char *
+realpathOnce(struct pathCache *pc, const char *path, char *resolved)
+{
+    char buf[PATH_MAX], target[PATH_MAX];
+    const char *base;
+    struct pcDir *d;
+    struct stat sb;
+    ssize_t len, n;
+    size_t slash;
+    int isDir, links;
+
+    links = 0;
+    len = normalize(pc->cwd, path, buf, &isDir);
+    for (;;) {
+        if (len == -1)
+            return NULL;
+
+        if (isDir || len == 1) {
+            d = lookupDir(pc, buf, len, &links);
+            if (d == NULL)
+                return NULL;
+            strcpy(resolved, d->canon);
+            return resolved;
+        }
+
+        for (slash = len - 1; buf[slash] != '/'; slash--)
+            continue;
+        d = lookupDir(pc, buf, (slash == 0) ? 1 : slash, &links);
+        if (d == NULL)
+            return NULL;
+        base = buf + slash + 1;
+
+        if (fstatat(d->fd, base, &sb, AT_SYMLINK_NOFOLLOW) == -1)
+            return NULL;
+        if (!S_ISLNK(sb.st_mode))
+            return joinPath(d->canon, base, resolved);
+
+        if (++links > MAX_LINKS) {
+            errno = ELOOP;
+            return NULL;
+        }
+        n = readlinkat(d->fd, base, target, sizeof(target) - 1);
+        if (n == -1)
+            return NULL;
+        target[n] = '\0';
+        pc->st.links++;
+        len = normalize(d->canon, target, buf, &isDir);
+    }
+}
+
+/* As realpath(3): place the canonical form of 'path' in 'resolved'
+   (PATH_MAX bytes, or, if NULL, allocated with malloc()). Returns the
+   result, or NULL on error. */
+
+char *
+pcRealpath(struct pathCache *pc, const char *path, char *resolved)
+{
+    char *buf, *r;
+    int tries;
+
+    pc->st.calls++;
+    buf = (resolved != NULL) ? resolved : malloc(PATH_MAX);
+    if (buf == NULL)
+        return NULL;
+
+    for (tries = 0; tries < MAX_TRIES; tries++) {
+        prepare(pc);
+        r = realpathOnce(pc, path, buf);
+        if (r != NULL || errno != ESTALE)
+            break;
+        pc->stale = 1;
+    }
+
+    if (tries == MAX_TRIES) {
+        pc->st.fallbacks++;
+        r = realpath(path, buf);
+    }
+    if (r == NULL && resolved == NULL)
+        free(buf);
+    return r;
+}
+
+static ssize_t
+readlinkOnce(struct pathCache *pc, const char *path, char *buf,
+             size_t bufsiz)
+{
+    char key[PATH_MAX];
+    struct pcDir *d;
+    ssize_t len;
+    size_t slash;
+    int isDir, links;
+
+    len = normalize(pc->cwd, path, key, &isDir);
+    if (len == -1)
+        return -1;
+    if (isDir || len == 1) {            /* Names a directory */
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (slash = len - 1; key[slash] != '/'; slash--)
+        continue;
+    links = 0;
+    d = lookupDir(pc, key, (slash == 0) ? 1 : slash, &links);
+    if (d == NULL)
+        return -1;
+    return readlinkat(d->fd, key + slash + 1, buf, bufsiz);
+}
+
+/* As readlink(2) */
+
+ssize_t
+pcReadlink(struct pathCache *pc, const char *path, char *buf, size_t bufsiz)
+{
+    ssize_t n;
+    int tries;
+
+    pc->st.calls++;
+    for (tries = 0; tries < MAX_TRIES; tries++) {
+        prepare(pc);
+        n = readlinkOnce(pc, path, buf, bufsiz);
+        if (n != -1 || errno != ESTALE)
+            return n;
+        pc->stale = 1;
+    }
+
+    pc->st.fallbacks++;
+    return readlink(path, buf, bufsiz);
+}
+
+/* Create a cache, validated as described by 'validate' (PC_VALIDATE_*)
+   at most every 'checkMs' milliseconds, of up to 'maxDirs' directories
+   (if 'maxDirs' is 0 or less: half the limit on open files). Returns a
+   handle, or NULL on error. */
+
+struct pathCache *
+pcOpen(int validate, int checkMs, long maxDirs)
+{
+    struct pathCache *pc;
+
+    if (validate < PC_VALIDATE_INOTIFY || validate > PC_VALIDATE_NONE ||
+            checkMs < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pc = calloc(1, sizeof(struct pathCache));
+    if (pc == NULL)
+        return NULL;
+    pc->validate = validate;
+    pc->checkMs = checkMs;
+    pc->maxDirs = (maxDirs > 0) ? maxDirs : sysconf(_SC_OPEN_MAX) / 2;
+    pc->numBuckets = INITIAL_BUCKETS;
+    pc->buckets = calloc(pc->numBuckets, sizeof(struct pcDir *));
+    pc->inotifyFd = -1;
+    if (pc->buckets == NULL || getcwd(pc->cwd, sizeof(pc->cwd)) == NULL)
+        goto fail;
+
+    if (validate == PC_VALIDATE_INOTIFY) {
+        pc->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (pc->inotifyFd == -1)
+            goto fail;
+    }
+    return pc;
+
+fail:
+    free(pc->buckets);
+    free(pc);
+    return NULL;
+}
+
+void
+pcGetStats(struct pathCache *pc, struct pcStats *stats)
+{
+    *stats = pc->st;
+    stats->dirs = pc->numDirs;
+}
+
+void
+pcClose(struct pathCache *pc)
+{
+    freeDirs(pc);
+    if (pc->inotifyFd != -1)
+        close(pc->inotifyFd);
+    free(pc->buckets);
+    free(pc);
+}
@@ -0,0 +1,55 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 18 */
+
+/* path_cache.h
+
+   Header file for path_cache.c.
+*/
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H            /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+
+/* How cached directories are checked for changes, for pcOpen() */
+
+#define PC_VALIDATE_INOTIFY 0   /* Watch cached directories with inotify */
+#define PC_VALIDATE_MTIME   1   /* Check that no ancestor of a cached
+                                   directory has changed its mtime */
+#define PC_VALIDATE_NONE    2   /* Trust the cache; the caller must call
+                                   pcFlush() after changing the tree */
+
+struct pcStats {
+    unsigned long long calls;       /* pcRealpath() and pcReadlink() calls */
+    unsigned long long hits;        /* Directory lookups found in cache */
+    unsigned long long misses;      /* Directory lookups not found */
+    unsigned long long links;       /* Symbolic links followed */
+    unsigned long long flushes;     /* Cache flushes (other than by
+                                       pcFlush()) */
+    unsigned long long fallbacks;   /* Calls that gave up on the cache (too
+                                       many changes) and used realpath() */
+    long dirs;                      /* Directories now cached */
+};
+
+struct pathCache *pcOpen(int validate, int checkMs, long maxDirs);
+
+char *pcRealpath(struct pathCache *pc, const char *path, char *resolved);
+
+ssize_t pcReadlink(struct pathCache *pc, const char *path, char *buf,
+                   size_t bufsiz);
+
+void pcFlush(struct pathCache *pc);
+
+void pcGetStats(struct pathCache *pc, struct pcStats *stats);
+
+void pcClose(struct pathCache *pc);
+
+#endif
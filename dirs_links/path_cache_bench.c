@@ -0,0 +1,258 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 18 */
+
+/* path_cache_bench.c
+
+   Compare the throughput of realpath(3) with that of pcRealpath() (see
+   path_cache.c), in each of its validation modes, on pathnames that
+   share long directory prefixes.
+
+   Usage: path_cache_bench [-d depth] [-w width] [-f files] [-n count]
+                           [-r reps] dir
+
+        -d depth  Levels of directories above the leaf directories
+                  (default: 8)
+        -w width  Number of leaf directories (default: 100)
+        -f files  Files in each leaf directory (default: 100)
+        -n count  Number of pathnames resolved in each pass (default:
+                  1000000)
+        -r reps   Passes for each method; the best is reported
+                  (default: 3)
+
+   The program builds a tree under 'dir'/path_cache_bench.tree, with
+   'depth' nested directories with long names, then 'width' leaf
+   directories each holding 'files' files. It also creates a symbolic
+   link ("link") to the first of the nested directories. It then makes
+   'count' pathnames, chosen at random, of files in the leaf
+   directories: a quarter of them via "link", a quarter with a ".."
+   component ("leafA/../leafB/file"), and the rest direct. Each method
+   resolves each pathname, and the results are checked against
+   realpath()'s. For each method, the program reports the pathnames
+   resolved per second, and, for the cache, the directory lookups that
+   hit and missed the cache, and the number of flushes.
+
+   Try: path_cache_bench /tmp
+
+   This program is Linux-specific.
+*/
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <time.h>
+#include "path_cache.h"
+#include "tlpi_hdr.h"
+
+#define M_REALPATH (-1)         /* Pseudo-mode: realpath() */
+
+static const struct {
+    const char *name;
+    int validate;
+    int checkMs;
+} methods[] = {
+    { "realpath", M_REALPATH, 0 },
+    { "inotify", PC_VALIDATE_INOTIFY, 0 },
+    { "inotify/10ms", PC_VALIDATE_INOTIFY, 10 },
+    { "mtime", PC_VALIDATE_MTIME, 0 },
+    { "mtime/10ms", PC_VALIDATE_MTIME, 10 },
+    { "none", PC_VALIDATE_NONE, 0 },
+};
+#define NUM_METHODS (sizeof(methods) / sizeof(methods[0]))
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+makePath(char *buf, const char *format, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, format);
+    n = vsnprintf(buf, PATH_MAX, format, ap);
+    va_end(ap);
+    if (n >= PATH_MAX)
+        fatal("Pathname too long");
+}
+
+static void
+makeDir(const char *path)
+{
+    if (mkdir(path, S_IRWXU) == -1 && errno != EEXIST)
+        errExit("mkdir %s", path);
+}
+
+static void
+makeFile(const char *path)
+{
+    int fd;
+
+    fd = open(path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        errExit("open %s", path);
+    close(fd);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-d depth] [-w width] [-f files] [-n count] "
+            "[-r reps] dir\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char top[PATH_MAX], deep[PATH_MAX], path[PATH_MAX], res[PATH_MAX];
+    char **paths, **expect;
+    struct pathCache *pc;
+    struct pcStats st;
+    int opt, depth, width, files, reps, r, j, k, kind;
+    long count, i;
+    long long t0, t, best, realpathNs;
+    size_t m, topLen;
+
+    depth = 8;
+    width = 100;
+    files = 100;
+    count = 1000000;
+    reps = 3;
+    while ((opt = getopt(argc, argv, "d:w:f:n:r:")) != -1) {
+        switch (opt) {
+        case 'd':   depth = getInt(optarg, GN_GT_0, "-d");      break;
+        case 'w':   width = getInt(optarg, GN_GT_0, "-w");      break;
+        case 'f':   files = getInt(optarg, GN_GT_0, "-f");      break;
+        case 'n':   count = getLong(optarg, GN_GT_0, "-n");     break;
+        case 'r':   reps = getInt(optarg, GN_GT_0, "-r");       break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind + 1 != argc)
+        usageError(argv[0]);
+
+    /* Build the tree */
+
+    makePath(top, "%s/path_cache_bench.tree", argv[optind]);
+    makeDir(top);
+    topLen = strlen(top);
+    strcpy(deep, top);
+    for (j = 0; j < depth; j++) {
+        if (strlen(deep) + 40 >= PATH_MAX)
+            fatal("-d is too large");
+        sprintf(deep + strlen(deep), "/level-%02d-with-a-longish-name", j);
+        makeDir(deep);
+    }
+    makePath(path, "%s/link", top);
+    if (symlink(deep + topLen + 1, path) == -1 && errno != EEXIST)
+        errExit("symlink");
+    for (j = 0; j < width; j++) {
+        makePath(path, "%s/leaf%d", deep, j);
+        makeDir(path);
+        for (k = 0; k < files; k++) {
+            makePath(path, "%s/leaf%d/file%d", deep, j, k);
+            makeFile(path);
+        }
+    }
+
+    /* Make the pathnames, and the expected results */
+
+    paths = malloc(count * sizeof(char *));
+    expect = malloc(count * sizeof(char *));
+    if (paths == NULL || expect == NULL)
+        errExit("malloc");
+    srandom(1);
+    for (i = 0; i < count; i++) {
+        j = random() % width;
+        k = random() % files;
+        kind = random() % 4;
+        if (kind == 0) {                /* Via the link */
+            makePath(path, "%s/link/leaf%d/file%d", top, j, k);
+        } else if (kind == 1) {         /* With ".." */
+            makePath(path, "%s/leaf%ld/../leaf%d/file%d", deep,
+                     random() % width, j, k);
+        } else {
+            makePath(path, "%s/leaf%d/file%d", deep, j, k);
+        }
+        paths[i] = strdup(path);
+        if (paths[i] == NULL)
+            errExit("strdup");
+        if (realpath(path, res) == NULL)
+            errExit("realpath %s", path);
+        expect[i] = strdup(res);
+        if (expect[i] == NULL)
+            errExit("strdup");
+    }
+
+    printf("%ld pathnames, %zu bytes long, in %d directories\n", count,
+           strlen(paths[count - 1]), width);
+    printf("%-13s %12s %8s %10s %10s %8s\n", "method", "paths/sec",
+           "speedup", "hits", "misses", "flushes");
+
+    realpathNs = 0;
+    for (m = 0; m < NUM_METHODS; m++) {
+        best = 0;
+        pc = NULL;
+        memset(&st, 0, sizeof(st));
+        for (r = 0; r < reps; r++) {
+            if (methods[m].validate != M_REALPATH) {
+                pc = pcOpen(methods[m].validate, methods[m].checkMs, 0);
+                if (pc == NULL)
+                    errExit("pcOpen");
+            }
+
+            t0 = nowNs();
+            for (i = 0; i < count; i++) {
+                if (pc == NULL) {
+                    if (realpath(paths[i], res) == NULL)
+                        errExit("realpath %s", paths[i]);
+                } else {
+                    if (pcRealpath(pc, paths[i], res) == NULL)
+                        errExit("pcRealpath %s", paths[i]);
+                }
+                if (r == 0 && strcmp(res, expect[i]) != 0)
+                    fatal("%s: %s: got %s, expected %s", methods[m].name,
+                          paths[i], res, expect[i]);
+            }
+            t = nowNs() - t0;
+            if (best == 0 || t < best)
+                best = t;
+
+            if (pc != NULL) {
+                pcGetStats(pc, &st);
+                pcClose(pc);
+                pc = NULL;
+            }
+        }
+
+        if (methods[m].validate == M_REALPATH) {
+            realpathNs = best;
+            printf("%-13s %12.0f %8s\n", methods[m].name, count * 1e9 / best,
+                   "");
+        } else {
+            printf("%-13s %12.0f %7.1fx %10llu %10llu %8llu\n",
+                   methods[m].name, count * 1e9 / best,
+                   (double) realpathNs / best, st.hits, st.misses,
+                   st.flushes);
+        }
+        fflush(stdout);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,757 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 18 */
+
+/* tree_copy.c
+
+   Copy a directory tree, preserving file types, permissions, ownership
+   (where permitted), timestamps, extended attributes (and thus ACLs),
+   and hard links, in the manner of "cp -a", but with the work spread
+   over two sets of threads, so that reading the source tree overlaps
+   with copying file data:
+
+   * Walker threads traverse the source tree with treeWalk() (see
+     tree_walk.c), obtaining each file's attributes with statx(). They
+     create each directory in the copy as soon as it is seen (since its
+     contents may follow immediately), create symbolic links and special
+     files (which have no data), and, for each regular file, open the
+     source file and place it on a bounded queue.
+
+   * Copier threads take files from the queue, create each copy, copy
+     the data, and then set the copy's attributes, using the open file
+     descriptors (fchown(), fchmod(), fsetxattr(), futimens()), so that
+     no further pathname lookups are required.
+
+   * When both stages have finished, the second and later links to each
+     multiply-linked file are made with link() (files are remembered in a
+     hash table keyed by device and i-node number), and then the
+     directories' attributes are set, deepest first (setting a
+     directory's timestamps before its contents have been created would
+     be pointless).
+
+   File data is copied with the first of the following that works: the
+   FICLONE ioctl(), which makes the copy share the source's blocks on file
+   systems that support this (such as Btrfs and XFS), copy_file_range(),
+   which copies within the kernel (and may itself share blocks, or, on
+   NFS, copy on the server), and read() plus write(). Holes in the source
+   are preserved (except by FICLONE, which preserves them anyway).
+
+   Usage: tree_copy [-t walkers] [-c copiers] [-m method] [-X] [-q]
+                    src-dir new-dir
+
+        -t walkers  Number of walker threads (default: 4)
+        -c copiers  Number of copier threads (default: 4)
+        -m method   Copy method to start with: "clone", "cfr", or "rdwr"
+                    (default: "clone"); methods that fail as unsupported
+                    fall back to the next
+        -X          Don't copy extended attributes
+        -q          Don't display statistics
+
+   'new-dir' must not already exist. On completion, the program displays
+   the number of files of each kind copied, the number of bytes copied by
+   each method, and the rate in files per second and MiB per second.
+
+   Try: tree_copy -c 8 /usr/include /tmp/inc-copy
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/xattr.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "tree_walk.h"
+#include "tlpi_hdr.h"
+
+#define QUEUE_LEN 256           /* Files opened but not yet copied */
+#define BUF_SIZE (256 * 1024)   /* Buffer for read()/write() */
+#define MAX_CHUNK (1024 * 1024 * 1024)  /* Max. bytes per system call */
+#define MAX_THREADS 256
+#define LINK_BUCKETS 4096
+
+#define STATX_WANTED (STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | \
+                      STATX_GID | STATX_ATIME | STATX_MTIME | STATX_INO | \
+                      STATX_SIZE)
+
+enum { M_CLONE, M_CFR, M_RDWR, M_NUM };
+
+static const char *methodName[M_NUM] = {
+    "FICLONE", "copy_file_range", "read/write"
+};
+
+struct attrs {                  /* Attributes to be given to a copy */
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    struct timespec times[2];   /* Access and modification times */
+};
+
+struct job {                    /* A regular file to be copied */
+    int inFd;
+    off_t size;
+    char *dstPath;
+    struct attrs at;
+};
+
+struct dirAttrs {               /* A directory whose attributes are set
+                                   at the end */
+    char *dstPath;
+    int level;
+    struct attrs at;
+};
+
+struct linkNode {               /* Copy of a multiply-linked file */
+    struct linkNode *next;
+    dev_t dev;
+    ino_t ino;
+    char *dstPath;              /* Pathname of first copy */
+};
+
+struct pendingLink {            /* A link to be made at the end */
+    char *dstPath;
+    char *target;               /* 'dstPath' of the first copy */
+};
+
+static const char *srcRoot, *dstRoot;
+static size_t srcRootLen;
+static int startMethod;
+static int cloneFailed;         /* FICLONE unsupported: don't try again */
+static Boolean copyXattrs;
+
+/* Queue from walkers to copiers */
+
+static pthread_mutex_t qMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t qNotEmpty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t qNotFull = PTHREAD_COND_INITIALIZER;
+static struct job queue[QUEUE_LEN];     /* Protected by 'qMtx', as are */
+static int qHead, qCount;               /* these */
+static Boolean qDone;                   /* No more jobs will be added */
+
+static pthread_mutex_t listMtx = PTHREAD_MUTEX_INITIALIZER;
+                                /* Protects the following */
+static struct linkNode *linkTable[LINK_BUCKETS];
+static struct pendingLink *pending;
+static long numPending, maxPending;
+static struct dirAttrs *dirs;
+static long numDirs, maxDirs;
+
+static struct {                 /* Updated with __atomic builtins */
+    long files, dirs, symlinks, others, links, errors;
+    long long bytes[M_NUM];
+    long long holeBytes;
+} st;
+
+#define COUNT(field, n) __atomic_fetch_add(&st.field, (n), __ATOMIC_RELAXED)
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Report an error concerning 'path' (errno describes it), and count it */
+
+static void
+fileErr(const char *what, const char *path)
+{
+    errMsg("%s: %s", what, path);
+    COUNT(errors, 1);
+}
+
+static void *
+xmalloc(size_t size)
+{
+    void *p;
+
+    p = malloc(size);
+    if (p == NULL)
+        errExit("malloc");
+    return p;
+}
+
+/* Return (in allocated memory) the pathname in the copy that
+   corresponds to the source pathname 'srcPath' */
+
+static char *
+dstPathOf(const char *srcPath)
+{
+    char *p;
+
+    if (asprintf(&p, "%s%s", dstRoot, srcPath + srcRootLen) == -1)
+        errExit("asprintf");
+    return p;
+}
+
+static void
+getAttrs(const struct statx *stx, struct attrs *at)
+{
+    at->mode = stx->stx_mode & 07777;
+    at->uid = stx->stx_uid;
+    at->gid = stx->stx_gid;
+    at->times[0].tv_sec = stx->stx_atime.tv_sec;
+    at->times[0].tv_nsec = stx->stx_atime.tv_nsec;
+    at->times[1].tv_sec = stx->stx_mtime.tv_sec;
+    at->times[1].tv_nsec = stx->stx_mtime.tv_nsec;
+}
+
+/* Set the attributes of 'path' (if 'fd' is -1) or 'fd'. Ownership is
+   set first, since changing it may clear the set-user-ID and
+   set-group-ID bits. Failure to set ownership (we may not be privileged)
+   is ignored, as by "cp -a". */
+
+static void
+setAttrs(int fd, const char *path, const struct attrs *at, Boolean isLink)
+{
+    int s;
+
+    s = (fd != -1) ? fchown(fd, at->uid, at->gid) :
+            fchownat(AT_FDCWD, path, at->uid, at->gid,
+                     isLink ? AT_SYMLINK_NOFOLLOW : 0);
+    if (s == -1 && errno != EPERM)
+        fileErr("chown", path);
+
+    if (!isLink) {              /* A symbolic link's mode can't be set */
+        s = (fd != -1) ? fchmod(fd, at->mode) : chmod(path, at->mode);
+        if (s == -1)
+            fileErr("chmod", path);
+    }
+
+    s = (fd != -1) ? futimens(fd, at->times) :
+            utimensat(AT_FDCWD, path, at->times,
+                      isLink ? AT_SYMLINK_NOFOLLOW : 0);
+    if (s == -1)
+        fileErr("utimensat", path);
+}
+
+/* Copy the extended attributes of 'inFd' to 'outFd'. Attributes that
+   the destination file system or our privileges don't allow (such as
+   "trusted." attributes for an unprivileged user) are silently
+   skipped. */
+
+static void
+copyXattrsFd(int inFd, int outFd, const char *path)
+{
+    char *list, *name, *val;
+    ssize_t listLen, valLen;
+
+    listLen = flistxattr(inFd, NULL, 0);
+    if (listLen <= 0) {
+        if (listLen == -1 && errno != ENOTSUP)
+            fileErr("flistxattr", path);
+        return;
+    }
+
+    list = xmalloc(listLen);
+    val = xmalloc(XATTR_SIZE_MAX);
+    listLen = flistxattr(inFd, list, listLen);
+    if (listLen == -1)
+        fileErr("flistxattr", path);
+
+    for (name = list; name < list + listLen; name += strlen(name) + 1) {
+        valLen = fgetxattr(inFd, name, val, XATTR_SIZE_MAX);
+        if (valLen == -1) {
+            fileErr("fgetxattr", path);
+            continue;
+        }
+        if (fsetxattr(outFd, name, val, valLen, 0) == -1 &&
+                errno != ENOTSUP && errno != EPERM)
+            fileErr("fsetxattr", path);
+    }
+
+    free(val);
+    free(list);
+}
+
+static Boolean          /* Does 'err' mean "method can't be used here"? */
+isUnsupported(int err)
+{
+    return err == EINVAL || err == ENOSYS || err == EXDEV ||
+           err == EOPNOTSUPP || err == ENOTTY || err == EBADF;
+}
+
+/* Copy 'len' bytes at offset 'off' from 'inFd' to 'outFd' with
+   copy_file_range() or (if '*method' is M_RDWR, or copy_file_range() is
+   unsupported, in which case '*method' is updated) pread() and pwrite().
+   Returns 0 on success, or -1 on error. */
+
+static int
+copyRange(int inFd, int outFd, off_t off, off_t len, int *method, char *buf)
+{
+    ssize_t n, w, done;
+
+    while (len > 0) {
+        if (*method == M_CFR) {
+            n = copy_file_range(inFd, &(off_t) { off }, outFd,
+                                &(off_t) { off }, min(len, MAX_CHUNK), 0);
+            if (n == -1 && isUnsupported(errno)) {
+                *method = M_RDWR;
+                continue;
+            }
+        } else {
+            n = pread(inFd, buf, min(len, BUF_SIZE), off);
+            for (done = 0; n > 0 && done < n; done += w) {
+                w = pwrite(outFd, buf + done, n - done, off + done);
+                if (w == -1)
+                    return -1;
+            }
+        }
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)                     /* File shrank */
+            break;
+
+        COUNT(bytes[*method], n);
+        off += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Copy the data of 'inFd' ('size' bytes) to the empty file 'outFd'.
+   Returns 0 on success, or -1 on error. */
+
+static int
+copyData(int inFd, int outFd, off_t size, char *buf)
+{
+    off_t pos, data, hole;
+    int method;
+
+    method = startMethod;
+    if (method == M_CLONE) {
+        if (!__atomic_load_n(&cloneFailed, __ATOMIC_RELAXED)) {
+            if (ioctl(outFd, FICLONE, inFd) == 0) {
+                COUNT(bytes[M_CLONE], size);
+                return 0;
+            }
+            if (!isUnsupported(errno))
+                return -1;
+            __atomic_store_n(&cloneFailed, 1, __ATOMIC_RELAXED);
+        }
+        method = M_CFR;
+    }
+
+    /* Copy only the data regions, leaving holes in the copy where there
+       are holes in the source */
+
+    for (pos = 0; pos < size; pos = hole) {
+        data = lseek(inFd, pos, SEEK_DATA);
+        if (data == -1) {
+            if (errno == ENXIO)         /* Only a hole remains */
+                data = size;
+            else if (errno == EINVAL)   /* Not supported */
+                data = pos;
+            else
+                return -1;
+        }
+        hole = size;
+        if (data < size) {
+            hole = lseek(inFd, data, SEEK_HOLE);
+            if (hole == -1 || hole > size)
+                hole = size;
+        }
+
+        COUNT(holeBytes, data - pos);
+        if (data < hole && copyRange(inFd, outFd, data, hole - data,
+                                     &method, buf) == -1)
+            return -1;
+    }
+
+    /* In case the file ends with a hole */
+
+    return ftruncate(outFd, size);
+}
+
+static void
+copyFile(struct job *j, char *buf)
+{
+    int outFd;
+
+    outFd = open(j->dstPath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                 S_IRUSR | S_IWUSR);
+    if (outFd == -1) {
+        fileErr("open", j->dstPath);
+        return;
+    }
+
+    if (copyData(j->inFd, outFd, j->size, buf) == -1)
+        fileErr("copy", j->dstPath);
+    if (copyXattrs)
+        copyXattrsFd(j->inFd, outFd, j->dstPath);
+    setAttrs(outFd, j->dstPath, &j->at, FALSE);
+
+    if (close(outFd) == -1)
+        fileErr("close", j->dstPath);
+    COUNT(files, 1);
+}
+
+static void *
+copierFunc(void *arg)
+{
+    struct job j;
+    char *buf;
+
+    buf = xmalloc(BUF_SIZE);
+    for (;;) {
+        pthread_mutex_lock(&qMtx);
+        while (qCount == 0 && !qDone)
+            pthread_cond_wait(&qNotEmpty, &qMtx);
+        if (qCount == 0) {             /* And 'done' */
+            pthread_mutex_unlock(&qMtx);
+            break;
+        }
+        j = queue[qHead];
+        qHead = (qHead + 1) % QUEUE_LEN;
+        qCount--;
+        pthread_cond_signal(&qNotFull);
+        pthread_mutex_unlock(&qMtx);
+
+        copyFile(&j, buf);
+        close(j.inFd);
+        free(j.dstPath);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+static void
+addJob(const struct job *j)
+{
+    pthread_mutex_lock(&qMtx);
+    while (qCount == QUEUE_LEN)
+        pthread_cond_wait(&qNotFull, &qMtx);
+    queue[(qHead + qCount) % QUEUE_LEN] = *j;
+    qCount++;
+    pthread_cond_signal(&qNotEmpty);
+    pthread_mutex_unlock(&qMtx);
+}
+
+/* If the file described by 'stx' has more than one link and has already
+   been seen, arrange for 'dstPath' to be made a link to its copy, and
+   return TRUE. Otherwise, record 'dstPath' as the copy (if necessary),
+   and return FALSE. */
+
+static Boolean
+isLinkToCopy(const struct statx *stx, char *dstPath)
+{
+    struct linkNode *n;
+    Boolean found;
+    dev_t dev;
+    unsigned int b;
+
+    if (stx->stx_nlink < 2)
+        return FALSE;
+
+    dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    b = (stx->stx_ino ^ (stx->stx_ino >> 16) ^ dev) % LINK_BUCKETS;
+
+    pthread_mutex_lock(&listMtx);
+    for (n = linkTable[b]; n != NULL; n = n->next)
+        if (n->ino == stx->stx_ino && n->dev == dev)
+            break;
+
+    found = n != NULL;
+    if (found) {
+        if (numPending == maxPending) {
+            maxPending = (maxPending == 0) ? 64 : maxPending * 2;
+            pending = realloc(pending, maxPending * sizeof(*pending));
+            if (pending == NULL)
+                errExit("realloc");
+        }
+        pending[numPending].dstPath = dstPath;
+        pending[numPending].target = n->dstPath;
+        numPending++;
+    } else {
+        n = xmalloc(sizeof(*n));
+        n->dev = dev;
+        n->ino = stx->stx_ino;
+        n->dstPath = strdup(dstPath);
+        if (n->dstPath == NULL)
+            errExit("strdup");
+        n->next = linkTable[b];
+        linkTable[b] = n;
+    }
+    pthread_mutex_unlock(&listMtx);
+
+    return found;
+}
+
+static void
+addDir(char *dstPath, int level, const struct attrs *at)
+{
+    pthread_mutex_lock(&listMtx);
+    if (numDirs == maxDirs) {
+        maxDirs = (maxDirs == 0) ? 64 : maxDirs * 2;
+        dirs = realloc(dirs, maxDirs * sizeof(*dirs));
+        if (dirs == NULL)
+            errExit("realloc");
+    }
+    dirs[numDirs].dstPath = dstPath;
+    dirs[numDirs].level = level;
+    dirs[numDirs].at = *at;
+    numDirs++;
+    pthread_mutex_unlock(&listMtx);
+}
+
+/* Create the copy of the directory 'ent'. It is created writable and
+   searchable by us, so that its contents can be created; its real
+   attributes are set at the end. */
+
+static void
+copyDir(const struct twEntry *ent, char *dstPath)
+{
+    struct attrs at;
+    int inFd, outFd;
+
+    if (mkdir(dstPath, S_IRWXU) == -1) {
+        if (ent->dirFd == -1)           /* Top directory: give up */
+            errExit("mkdir %s", dstPath);
+        fileErr("mkdir", dstPath);
+        free(dstPath);
+        return;
+    }
+
+    if (copyXattrs) {
+        inFd = openat((ent->dirFd == -1) ? AT_FDCWD : ent->dirFd,
+                      (ent->dirFd == -1) ? ent->path : ent->name,
+                      O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        outFd = open(dstPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (inFd != -1 && outFd != -1)
+            copyXattrsFd(inFd, outFd, dstPath);
+        else
+            fileErr("open", (inFd == -1) ? ent->path : dstPath);
+        if (inFd != -1)
+            close(inFd);
+        if (outFd != -1)
+            close(outFd);
+    }
+
+    getAttrs(ent->stx, &at);
+    addDir(dstPath, ent->level, &at);
+    COUNT(dirs, 1);
+}
+
+/* Create a copy of the symbolic link or special file 'ent' */
+
+static void
+copySpecial(const struct twEntry *ent, const char *dstPath)
+{
+    char target[PATH_MAX];
+    struct attrs at;
+    ssize_t n;
+    dev_t rdev;
+
+    if (S_ISLNK(ent->type)) {
+        n = readlinkat(ent->dirFd, ent->name, target, sizeof(target) - 1);
+        if (n == -1) {
+            fileErr("readlink", ent->path);
+            return;
+        }
+        target[n] = '\0';
+        if (symlink(target, dstPath) == -1) {
+            fileErr("symlink", dstPath);
+            return;
+        }
+        COUNT(symlinks, 1);
+    } else {
+        rdev = makedev(ent->stx->stx_rdev_major, ent->stx->stx_rdev_minor);
+        if (mknod(dstPath, ent->type | S_IRUSR | S_IWUSR, rdev) == -1) {
+            fileErr("mknod", dstPath);
+            return;
+        }
+        COUNT(others, 1);
+    }
+
+    getAttrs(ent->stx, &at);
+    setAttrs(-1, dstPath, &at, S_ISLNK(ent->type));
+}
+
+/* treeWalk() callback */
+
+static int
+walkFunc(const struct twEntry *ent, int flag, void *arg)
+{
+    struct job j;
+    char *dstPath;
+
+    switch (flag) {
+    case TW_NS:
+        fileErr("statx", ent->path);
+        return 0;
+    case TW_DNR:
+        fileErr("Couldn't read directory", ent->path);
+        return 0;
+    case TW_D:
+        copyDir(ent, dstPathOf(ent->path));
+        return 0;
+    }
+
+    if (ent->dirFd == -1) {
+        errno = ENOTDIR;
+        fileErr("Source", ent->path);
+        return 0;
+    }
+
+    dstPath = dstPathOf(ent->path);
+    if (isLinkToCopy(ent->stx, dstPath))
+        return 0;                       /* 'dstPath' is now in 'pending' */
+
+    if (!S_ISREG(ent->type)) {
+        copySpecial(ent, dstPath);
+        free(dstPath);
+        return 0;
+    }
+
+    j.inFd = openat(ent->dirFd, ent->name,
+                    O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (j.inFd == -1) {
+        fileErr("open", ent->path);
+        free(dstPath);
+        return 0;
+    }
+    j.size = ent->stx->stx_size;
+    j.dstPath = dstPath;
+    getAttrs(ent->stx, &j.at);
+    addJob(&j);
+    return 0;
+}
+
+static int
+cmpLevelDesc(const void *a, const void *b)
+{
+    return ((const struct dirAttrs *) b)->level -
+           ((const struct dirAttrs *) a)->level;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-t walkers] [-c copiers] [-m method] [-X] "
+            "[-q] src-dir new-dir\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    pthread_t tid[MAX_THREADS];
+    int opt, nwalkers, ncopiers, j, s;
+    long long start, bytes;
+    Boolean quiet;
+    double secs;
+    long k;
+
+    nwalkers = 4;
+    ncopiers = 4;
+    startMethod = M_CLONE;
+    copyXattrs = TRUE;
+    quiet = FALSE;
+    while ((opt = getopt(argc, argv, "t:c:m:Xq")) != -1) {
+        switch (opt) {
+        case 't':   nwalkers = getInt(optarg, GN_GT_0, "-t");       break;
+        case 'c':   ncopiers = getInt(optarg, GN_GT_0, "-c");       break;
+        case 'X':   copyXattrs = FALSE;                             break;
+        case 'q':   quiet = TRUE;                                   break;
+        case 'm':
+            if (strcmp(optarg, "clone") == 0)           startMethod = M_CLONE;
+            else if (strcmp(optarg, "cfr") == 0)        startMethod = M_CFR;
+            else if (strcmp(optarg, "rdwr") == 0)       startMethod = M_RDWR;
+            else usageError(argv[0]);
+            break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind + 2 != argc)
+        usageError(argv[0]);
+    if (ncopiers > MAX_THREADS)
+        cmdLineErr("At most %d copiers\n", MAX_THREADS);
+
+    srcRoot = argv[optind];
+    srcRootLen = strlen(srcRoot);
+    dstRoot = argv[optind + 1];
+
+    umask(0);                   /* We set all permissions explicitly */
+    start = nowNs();
+
+    for (j = 0; j < ncopiers; j++) {
+        s = pthread_create(&tid[j], NULL, copierFunc, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    if (treeWalk(srcRoot, nwalkers, STATX_WANTED, 0, walkFunc, NULL) == -1)
+        errExit("treeWalk");
+
+    pthread_mutex_lock(&qMtx);
+    qDone = TRUE;
+    pthread_cond_broadcast(&qNotEmpty);
+    pthread_mutex_unlock(&qMtx);
+    for (j = 0; j < ncopiers; j++) {
+        s = pthread_join(tid[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    /* Now that all files exist, make the extra hard links, and then set
+       the directories' attributes, deepest first */
+
+    for (k = 0; k < numPending; k++) {
+        if (link(pending[k].target, pending[k].dstPath) == -1)
+            fileErr("link", pending[k].dstPath);
+        else
+            COUNT(links, 1);
+        free(pending[k].dstPath);
+    }
+
+    qsort(dirs, numDirs, sizeof(*dirs), cmpLevelDesc);
+    for (k = 0; k < numDirs; k++) {
+        setAttrs(-1, dirs[k].dstPath, &dirs[k].at, FALSE);
+        free(dirs[k].dstPath);
+    }
+
+    secs = (nowNs() - start) / 1e9;
+
+    if (!quiet) {
+        printf("%ld files, %ld directories, %ld symlinks, %ld others, "
+               "%ld hard links\n", st.files, st.dirs, st.symlinks,
+               st.others, st.links);
+        bytes = 0;
+        for (j = 0; j < M_NUM; j++) {
+            if (st.bytes[j] > 0)
+                printf("%-16s %.1f MiB\n", methodName[j],
+                       st.bytes[j] / 1048576.0);
+            bytes += st.bytes[j];
+        }
+        if (st.holeBytes > 0)
+            printf("%-16s %.1f MiB\n", "Skipped holes",
+                   st.holeBytes / 1048576.0);
+        printf("%.3f s: %.0f files/s, %.1f MiB/s\n", secs,
+               (st.files + st.dirs + st.symlinks + st.others) / secs,
+               bytes / 1048576.0 / secs);
+        if (st.errors > 0)
+            printf("%ld errors\n", st.errors);
+    }
+
+    exit((st.errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
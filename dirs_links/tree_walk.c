@@ -0,0 +1,568 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 18 */
+
+/* tree_walk.c
+
+   treeWalk(): a parallel alternative to nftw(3).
+
+   The directory tree is traversed by a set of threads. Each thread has
+   its own queue of directories that remain to be read. When a thread
+   reads a directory, it adds the subdirectories that it finds to the end
+   of its own queue, and it takes its next directory from the end of that
+   queue, so that each thread walks its part of the tree depth-first. A
+   thread whose queue is empty steals a directory from the start of
+   another thread's queue (that is, a directory near the root of the
+   other thread's part of the tree, which is thus likely to represent a
+   large amount of work).
+
+   The implementation aims to make as few system calls (and pathname
+   lookups) as possible:
+
+   * Subdirectories are opened using openat() relative to a file
+     descriptor for their parent, and read via fdopendir(). (To avoid
+     running out of file descriptors, at most half of the RLIMIT_NOFILE
+     limit is used for queued directories; once this limit is reached,
+     directories are queued by pathname instead.)
+
+   * The file type returned by readdir() in 'd_type' is used, so that no
+     stat call is required for most entries. When the file system doesn't
+     supply 'd_type', or the caller asks for more information, statx() is
+     called with only the requested fields in its 'mask' argument.
+
+   As with nftw(FTW_PHYS), symbolic links are not followed. The tree is
+   visited in no particular order, except that a directory is passed to
+   the callback before its contents.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "tree_walk.h"
+#include "tlpi_hdr.h"
+
+struct dirItem {                /* A directory that remains to be read */
+    char *path;
+    int fd;                     /* Open FD for directory, or -1 */
+    int level;
+};
+
+struct dirQueue {               /* Per-thread queue of directories */
+    pthread_mutex_t mtx;
+    struct dirItem *items;
+    size_t head;                /* Index of oldest item (stolen first) */
+    size_t tail;                /* One past newest item (taken by owner) */
+    size_t size;                /* Allocated size of 'items' */
+    char pad[64];               /* Avoid false sharing between queues */
+};
+
+struct walk {                   /* State shared by all walker threads */
+    twFunc fn;
+    void *arg;
+    unsigned int statxMask;
+    int statxFlags;
+    int nthreads;
+    struct dirQueue *queues;
+
+    long pending;               /* Directories queued or being read */
+    long queuedFds;             /* FDs held by queued directories */
+    long maxQueuedFds;
+
+    pthread_mutex_t idleMtx;    /* Protects 'nidle', 'stop', 'error' */
+    pthread_cond_t idleCond;
+    int nidle;
+    int stop;                   /* Nonzero value returned by callback */
+    int error;                  /* First serious errno value, if any */
+};
+
+struct walker {                 /* Per-thread arguments */
+    struct walk *w;
+    int thread;
+    pthread_t tid;
+};
+
+static void
+setStop(struct walk *w, int stop, int err)
+{
+    pthread_mutex_lock(&w->idleMtx);
+    if (w->stop == 0) {
+        w->stop = stop;
+        w->error = err;
+    }
+    pthread_cond_broadcast(&w->idleCond);
+    pthread_mutex_unlock(&w->idleMtx);
+}
+
+static Boolean
+stopped(struct walk *w)
+{
+    return __atomic_load_n(&w->stop, __ATOMIC_RELAXED) != 0;
+}
+
+/* Add 'item' to the end of 'q'. Returns 0 on success, or -1 on error. */
+
+static int
+pushItem(struct dirQueue *q, const struct dirItem *item)
+{
+    struct dirItem *n;
+    size_t newSize;
+
+    pthread_mutex_lock(&q->mtx);
+
+    if (q->tail == q->size) {
+        if (q->head > 0) {              /* Reclaim space at start */
+            memmove(q->items, q->items + q->head,
+                    (q->tail - q->head) * sizeof(struct dirItem));
+            q->tail -= q->head;
+            q->head = 0;
+        } else {
+            newSize = (q->size == 0) ? 64 : q->size * 2;
+            n = realloc(q->items, newSize * sizeof(struct dirItem));
+            if (n == NULL) {
+                pthread_mutex_unlock(&q->mtx);
+                return -1;
+            }
+            q->items = n;
+            q->size = newSize;
+        }
+    }
+
+    q->items[q->tail++] = *item;
+    pthread_mutex_unlock(&q->mtx);
+    return 0;
+}
+
+/* Remove an item from 'q': the newest item if 'steal' is false, or the
+   oldest if 'steal' is true. Return TRUE if an item was obtained. */
+
+static Boolean
+popItem(struct dirQueue *q, Boolean steal, struct dirItem *item)
+{
+    Boolean found;
+
+    pthread_mutex_lock(&q->mtx);
+
+    found = q->head < q->tail;
+    if (found) {
+        *item = steal ? q->items[q->head++] : q->items[--q->tail];
+        if (q->head == q->tail)
+            q->head = q->tail = 0;
+    }
+
+    pthread_mutex_unlock(&q->mtx);
+    return found;
+}
+
+/* Obtain the next directory for thread 'self': first from its own queue,
+   and otherwise from another thread's queue */
+
+static Boolean
+findWork(struct walk *w, int self, struct dirItem *item)
+{
+    int j;
+
+    if (popItem(&w->queues[self], FALSE, item))
+        return TRUE;
+
+    for (j = 1; j < w->nthreads; j++)
+        if (popItem(&w->queues[(self + j) % w->nthreads], TRUE, item))
+            return TRUE;
+
+    return FALSE;
+}
+
+/* Wait until a directory is available for thread 'self' (return TRUE) or
+   the walk is finished (return FALSE) */
+
+static Boolean
+getWork(struct walk *w, int self, struct dirItem *item)
+{
+    Boolean found;
+
+    if (stopped(w))
+        return FALSE;
+    if (findWork(w, self, item))
+        return TRUE;
+
+    /* We recheck for work while holding 'idleMtx', and threads that queue
+       work signal 'idleCond' while holding the mutex, so that wake-ups
+       can't be lost */
+
+    pthread_mutex_lock(&w->idleMtx);
+    w->nidle++;
+    for (;;) {
+        found = (w->stop == 0) && findWork(w, self, item);
+        if (found || w->stop != 0 ||
+                __atomic_load_n(&w->pending, __ATOMIC_ACQUIRE) == 0)
+            break;
+        pthread_cond_wait(&w->idleCond, &w->idleMtx);
+    }
+    w->nidle--;
+    pthread_mutex_unlock(&w->idleMtx);
+
+    return found;
+}
+
+static void
+wakeIdlers(struct walk *w, Boolean all)
+{
+    pthread_mutex_lock(&w->idleMtx);
+    if (w->nidle > 0) {
+        if (all)
+            pthread_cond_broadcast(&w->idleCond);
+        else
+            pthread_cond_signal(&w->idleCond);
+    }
+    pthread_mutex_unlock(&w->idleMtx);
+}
+
+/* Release the resources held by a queued directory */
+
+static void
+discardItem(struct walk *w, struct dirItem *item)
+{
+    if (item->fd != -1) {
+        close(item->fd);
+        __atomic_sub_fetch(&w->queuedFds, 1, __ATOMIC_RELAXED);
+    }
+    free(item->path);
+}
+
+/* Build "dir/name" in the buffer '*buf' (of size '*bufSize'), growing
+   the buffer if necessary. Returns 0 on success, or -1 on error. */
+
+static int
+buildPath(char **buf, size_t *bufSize, const char *dir, const char *name)
+{
+    size_t dlen, nlen;
+    char *n;
+
+    dlen = strlen(dir);
+    nlen = strlen(name);
+    if (dlen + nlen + 2 > *bufSize) {
+        n = realloc(*buf, dlen + nlen + 2 + 256);
+        if (n == NULL)
+            return -1;
+        *buf = n;
+        *bufSize = dlen + nlen + 2 + 256;
+    }
+
+    memcpy(*buf, dir, dlen);
+    if (dlen == 0 || dir[dlen - 1] != '/')
+        (*buf)[dlen++] = '/';
+    memcpy(*buf + dlen, name, nlen + 1);
+    return 0;
+}
+
+/* Call the callback with TW_DNR for a directory that can't be read */
+
+static void
+reportDnr(struct walk *w, int self, const struct dirItem *dir)
+{
+    struct twEntry ent;
+    int s;
+
+    ent.path = dir->path;
+    ent.name = strrchr(dir->path, '/');
+    ent.name = (ent.name == NULL) ? dir->path : ent.name + 1;
+    ent.dirFd = -1;
+    ent.level = dir->level;
+    ent.thread = self;
+    ent.type = S_IFDIR;
+    ent.stx = NULL;
+    s = w->fn(&ent, TW_DNR, w->arg);
+    if (s != 0 && s != TW_SKIP_SUBTREE)
+        setStop(w, s, 0);
+}
+
+/* Read one directory, invoking the callback for each entry, and queuing
+   each subdirectory on the queue of thread 'self'. Returns 0 on success,
+   or -1 on a serious error (which stops the walk). */
+
+static int
+readDir(struct walk *w, int self, struct dirItem *dir, char **pathBuf,
+        size_t *pathBufSize)
+{
+    struct twEntry ent;
+    struct dirItem sub;
+    struct statx stx;
+    struct dirent *dp;
+    DIR *dirp;
+    unsigned int mask;
+    int dfd, flag, s, queued, readErr;
+
+    /* Open the directory, if that wasn't done when it was found */
+
+    dfd = dir->fd;
+    if (dfd == -1)
+        dfd = open(dir->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW |
+                              O_CLOEXEC);
+    else
+        __atomic_sub_fetch(&w->queuedFds, 1, __ATOMIC_RELAXED);
+
+    dirp = (dfd == -1) ? NULL : fdopendir(dfd);
+    if (dirp == NULL) {
+        if (dfd != -1)
+            close(dfd);
+        reportDnr(w, self, dir);
+        free(dir->path);
+        return 0;
+    }
+
+    ent.dirFd = dfd;
+    ent.level = dir->level + 1;
+    ent.thread = self;
+    queued = 0;
+    readErr = 0;
+
+    while (!stopped(w)) {
+        errno = 0;
+        dp = readdir(dirp);
+        if (dp == NULL) {
+            readErr = errno;
+            break;
+        }
+
+        if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0)
+            continue;
+
+        if (buildPath(pathBuf, pathBufSize, dir->path, dp->d_name) == -1)
+            goto fail;
+        ent.path = *pathBuf;
+        ent.name = dp->d_name;
+        ent.type = (dp->d_type == DT_UNKNOWN) ? 0 : DTTOIF(dp->d_type);
+        ent.stx = NULL;
+
+        /* Call statx() only if we must, asking only for the fields that
+           we need */
+
+        mask = w->statxMask;
+        if (ent.type == 0)
+            mask |= STATX_TYPE;
+        if (mask != 0) {
+            if (statx(dfd, dp->d_name, AT_SYMLINK_NOFOLLOW | w->statxFlags,
+                      mask, &stx) == 0) {
+                ent.stx = &stx;
+                if (stx.stx_mask & STATX_TYPE)
+                    ent.type = stx.stx_mode & S_IFMT;
+            }
+        }
+
+        flag = (ent.type == 0) ? TW_NS : S_ISDIR(ent.type) ? TW_D : TW_F;
+        s = w->fn(&ent, flag, w->arg);
+        if (s == TW_SKIP_SUBTREE)
+            continue;
+        if (s != 0) {
+            setStop(w, s, 0);
+            break;
+        }
+
+        if (flag != TW_D)
+            continue;
+
+        /* Queue the subdirectory, opening it now (relative to its parent)
+           if we are within our file descriptor budget */
+
+        sub.path = strdup(*pathBuf);
+        if (sub.path == NULL)
+            goto fail;
+        sub.level = ent.level;
+        sub.fd = -1;
+        if (__atomic_add_fetch(&w->queuedFds, 1, __ATOMIC_RELAXED) <=
+                w->maxQueuedFds)
+            sub.fd = openat(dfd, dp->d_name, O_RDONLY | O_DIRECTORY |
+                                             O_NOFOLLOW | O_CLOEXEC);
+        if (sub.fd == -1)
+            __atomic_sub_fetch(&w->queuedFds, 1, __ATOMIC_RELAXED);
+
+        __atomic_add_fetch(&w->pending, 1, __ATOMIC_RELEASE);
+        if (pushItem(&w->queues[self], &sub) == -1) {
+            __atomic_sub_fetch(&w->pending, 1, __ATOMIC_RELEASE);
+            discardItem(w, &sub);
+            goto fail;
+        }
+        queued++;
+    }
+
+    if (readErr != 0 && !stopped(w))   /* E.g., in /proc, for a process
+                                           that has terminated */
+        reportDnr(w, self, dir);
+
+    closedir(dirp);
+    free(dir->path);
+    if (queued > 0)
+        wakeIdlers(w, queued > 1);
+    return 0;
+
+fail:
+    s = errno;
+    closedir(dirp);
+    free(dir->path);
+    setStop(w, -1, s);
+    return -1;
+}
+
+static void *
+walkThread(void *arg)
+{
+    struct walker *wk = arg;
+    struct walk *w = wk->w;
+    struct dirItem item;
+    char *pathBuf;
+    size_t pathBufSize;
+
+    pathBuf = NULL;
+    pathBufSize = 0;
+
+    while (getWork(w, wk->thread, &item)) {
+        readDir(w, wk->thread, &item, &pathBuf, &pathBufSize);
+
+        /* If that was the last outstanding directory, the walk is done */
+
+        if (__atomic_sub_fetch(&w->pending, 1, __ATOMIC_ACQ_REL) == 0)
+            wakeIdlers(w, TRUE);
+    }
+
+    free(pathBuf);
+    return NULL;
+}
+
+/* Walk the tree rooted at 'dirpath' using 'nthreads' threads (if
+   'nthreads' is 0 or less, use one thread per online CPU), calling 'fn'
+   for each file in the tree (including 'dirpath' itself). 'arg' is
+   passed as the final argument of 'fn'. 'fn' may be called concurrently
+   by several threads; a thread index is provided in 'ent->thread' so
+   that the caller can maintain per-thread state.
+
+   'statxMask' specifies the STATX_* fields that the callback requires in
+   'ent->stx'. If it is 0, statx() is called only when readdir() does not
+   supply the file type, with a mask of STATX_TYPE.
+
+   The 'flag' argument of the callback is one of TW_F, TW_D, or TW_NS. If
+   a directory (previously reported as TW_D) later can't be opened, or an
+   error occurs while reading it, the callback is called for it again,
+   with TW_DNR.
+
+   If the callback returns TW_SKIP_SUBTREE for a directory, the contents
+   of the directory are not visited. If it returns any other nonzero
+   value, the walk is stopped and treeWalk() returns that value.
+   Otherwise, treeWalk() returns 0 when the walk is finished, or -1 on
+   error. */
+
+int
+treeWalk(const char *dirpath, int nthreads, unsigned int statxMask,
+         int flags, twFunc fn, void *arg)
+{
+    struct walk w;
+    struct walker *wks;
+    struct dirItem root;
+    struct twEntry ent;
+    struct statx stx;
+    struct rlimit rl;
+    int j, s, fd, result;
+
+    if (nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0)
+        nthreads = 1;
+
+    /* Report the starting directory */
+
+    memset(&ent, 0, sizeof(ent));
+    ent.path = dirpath;
+    ent.name = dirpath;
+    ent.dirFd = -1;
+    ent.type = 0;
+    if (statx(AT_FDCWD, dirpath, AT_SYMLINK_NOFOLLOW |
+                ((flags & TW_DONT_SYNC) ? AT_STATX_DONT_SYNC : 0),
+                statxMask | STATX_TYPE, &stx) == 0) {
+        ent.stx = &stx;
+        ent.type = stx.stx_mode & S_IFMT;
+    }
+
+    s = fn(&ent, (ent.type == 0) ? TW_NS : S_ISDIR(ent.type) ? TW_D : TW_F,
+           arg);
+    if (s == TW_SKIP_SUBTREE || (s == 0 && !S_ISDIR(ent.type)))
+        return 0;
+    if (s != 0)
+        return s;
+
+    fd = open(dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+
+    memset(&w, 0, sizeof(w));
+    w.fn = fn;
+    w.arg = arg;
+    w.statxMask = statxMask;
+    w.statxFlags = (flags & TW_DONT_SYNC) ? AT_STATX_DONT_SYNC : 0;
+    w.nthreads = nthreads;
+    w.maxQueuedFds = (getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+                      rl.rlim_cur != RLIM_INFINITY) ? rl.rlim_cur / 2 : 512;
+    pthread_mutex_init(&w.idleMtx, NULL);
+    pthread_cond_init(&w.idleCond, NULL);
+
+    w.queues = calloc(nthreads, sizeof(struct dirQueue));
+    wks = calloc(nthreads, sizeof(struct walker));
+    root.path = strdup(dirpath);
+    if (w.queues == NULL || wks == NULL || root.path == NULL) {
+        free(w.queues);
+        free(wks);
+        free(root.path);
+        close(fd);
+        return -1;
+    }
+    for (j = 0; j < nthreads; j++)
+        pthread_mutex_init(&w.queues[j].mtx, NULL);
+
+    root.fd = fd;
+    root.level = 0;
+    w.pending = 1;
+    w.queuedFds = 1;
+    pushItem(&w.queues[0], &root);      /* Can't fail: queue is empty */
+
+    for (j = 0; j < nthreads; j++) {
+        wks[j].w = &w;
+        wks[j].thread = j;
+        s = pthread_create(&wks[j].tid, NULL, walkThread, &wks[j]);
+        if (s != 0) {
+            setStop(&w, -1, s);
+            break;
+        }
+    }
+    nthreads = j;                       /* Number of threads created */
+
+    for (j = 0; j < nthreads; j++)
+        pthread_join(wks[j].tid, NULL);
+
+    /* If the walk was stopped, discard the directories that remain */
+
+    for (j = 0; j < w.nthreads; j++) {
+        while (popItem(&w.queues[j], FALSE, &root))
+            discardItem(&w, &root);
+        free(w.queues[j].items);
+        pthread_mutex_destroy(&w.queues[j].mtx);
+    }
+
+    result = w.stop;
+    if (result == -1)
+        errno = w.error;
+
+    free(w.queues);
+    free(wks);
+    pthread_mutex_destroy(&w.idleMtx);
+    pthread_cond_destroy(&w.idleCond);
+    return result;
+}
@@ -0,0 +1,63 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 18 */
+
+/* tree_walk.h
+
+   Header file for tree_walk.c.
+*/
+#ifndef TREE_WALK_H
+#define TREE_WALK_H             /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+struct twEntry {                /* Information passed to callback */
+    const char *path;           /* Pathname (prefixed by walk's 'dirpath') */
+    const char *name;           /* Final component of 'path' */
+    int dirFd;                  /* FD for directory containing entry (-1 for
+                                   the starting directory); 'name' can be
+                                   used relative to this FD, e.g., with
+                                   fstatat() or openat() */
+    int level;                  /* Depth relative to starting directory */
+    int thread;                 /* Index (0..nthreads-1) of calling thread */
+    mode_t type;                /* File type (S_IFMT bits), or 0 if not
+                                   known (TW_NS) */
+    const struct statx *stx;    /* Result of statx(), or NULL if no statx()
+                                   call was needed */
+};
+
+/* Values for 'flag' argument of callback function */
+
+#define TW_F    0               /* Not a directory */
+#define TW_D    1               /* Directory */
+#define TW_DNR  2               /* Directory that could not be read, or
+                                   could be read only in part (see
+                                   treeWalk() in tree_walk.c) */
+#define TW_NS   3               /* Type could not be determined (statx()
+                                   failed) */
+
+/* Value that callback may return for TW_D to skip directory's contents */
+
+#define TW_SKIP_SUBTREE 1
+
+/* Bit values for treeWalk() 'flags' argument */
+
+#define TW_DONT_SYNC    01      /* Use AT_STATX_DONT_SYNC for statx(), so
+                                   that network file systems may return
+                                   cached attributes */
+
+typedef int (*twFunc)(const struct twEntry *ent, int flag, void *arg);
+
+int treeWalk(const char *dirpath, int nthreads, unsigned int statxMask,
+             int flags, twFunc fn, void *arg);
+
+#endif
@@ -0,0 +1,331 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 13 */
+
+/* direct_io.c
+
+   Functions for performing direct I/O (O_DIRECT; see Section 13.6):
+
+   dioGetAlignment() determines the buffer and file offset alignment that
+   direct I/O requires on a file.
+
+   dioPoolInit(), dioPoolGet(), dioPoolPut(), and dioPoolFree() manage a
+   pool of equal-sized buffers that are suitably aligned for direct I/O.
+
+   dioEngineInit(), dioEngineRead(), dioEngineWrite(), dioEngineSubmit(),
+   dioEngineComplete(), and dioEngineFree() implement a simple engine that
+   keeps several reads and writes in flight at once, using io_uring (see
+   uring_functions.c). The engine's buffers come from a pool that is
+   registered with the kernel, so that the kernel doesn't need to map the
+   buffers on each I/O operation.
+
+   The engine can also be used on a file descriptor that was opened
+   without O_DIRECT, which allows comparison of direct I/O with I/O via
+   the page cache.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "direct_io.h"
+
+/* Determine the alignment that direct I/O on 'fd' requires, returning it
+   in '*da'. Since Linux 6.1, statx() can tell us the requirements for an
+   individual file (STATX_DIOALIGN); if that isn't available, we use the
+   logical sector size if 'fd' refers to a block device, or otherwise the
+   file's preferred I/O block size (st_blksize), which is always at least
+   as large as the logical block size of the underlying device. Returns
+   0 on success, or -1 on error (with errno set to EINVAL if the file
+   does not support direct I/O). */
+
+int
+dioGetAlignment(int fd, struct dioAlign *da)
+{
+    struct stat sb;
+    long pageSize;
+    int sectorSize;
+
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+            (stx.stx_mask & STATX_DIOALIGN)) {
+        if (stx.stx_dio_offset_align == 0) {   /* No direct I/O support */
+            errno = EINVAL;
+            return -1;
+        }
+        da->memAlign = stx.stx_dio_mem_align;
+        da->offsetAlign = stx.stx_dio_offset_align;
+        return 0;
+    }
+#endif
+
+    if (fstat(fd, &sb) == -1)
+        return -1;
+
+    if (S_ISBLK(sb.st_mode) && ioctl(fd, BLKSSZGET, &sectorSize) == 0) {
+        da->offsetAlign = sectorSize;
+    } else {
+        pageSize = sysconf(_SC_PAGESIZE);
+        da->offsetAlign = (sb.st_blksize > 0) ? sb.st_blksize : pageSize;
+    }
+    da->memAlign = da->offsetAlign;
+    return 0;
+}
+
+/* Initialize 'pool' with 'nbufs' buffers of 'bufSize' bytes, each of
+   which is aligned to both 'align' and the system page size. 'bufSize' is
+   rounded up to a multiple of the alignment. Returns 0 on success, or -1
+   on error. */
+
+int
+dioPoolInit(struct dioPool *pool, int nbufs, size_t bufSize, size_t align)
+{
+    long pageSize;
+    int j, s;
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    if (align < (size_t) pageSize)
+        align = pageSize;
+    bufSize = ((bufSize + align - 1) / align) * align;
+
+    pool->freeList = malloc(nbufs * sizeof(int));
+    if (pool->freeList == NULL)
+        return -1;
+
+    s = posix_memalign((void **) &pool->mem, align, nbufs * bufSize);
+    if (s != 0) {
+        free(pool->freeList);
+        errno = s;
+        return -1;
+    }
+
+    pool->bufSize = bufSize;
+    pool->nbufs = nbufs;
+    for (j = 0; j < nbufs; j++)
+        pool->freeList[j] = nbufs - 1 - j;
+    pool->nfree = nbufs;
+    return 0;
+}
+
+/* Return a free buffer from 'pool', or NULL if there is none */
+
+char *
+dioPoolGet(struct dioPool *pool)
+{
+    if (pool->nfree == 0)
+        return NULL;
+    pool->nfree--;
+    return pool->mem + pool->freeList[pool->nfree] * pool->bufSize;
+}
+
+/* Return 'buf' (obtained by dioPoolGet()) to 'pool' */
+
+void
+dioPoolPut(struct dioPool *pool, char *buf)
+{
+    pool->freeList[pool->nfree] = (buf - pool->mem) / pool->bufSize;
+    pool->nfree++;
+}
+
+void
+dioPoolFree(struct dioPool *pool)
+{
+    free(pool->mem);
+    free(pool->freeList);
+    memset(pool, 0, sizeof(*pool));
+}
+
+/* Initialize 'eng' to perform I/O on 'fd', with up to 'depth' operations
+   in flight, each of up to 'bufSize' bytes. If 'da' is NULL, the alignment
+   is obtained using dioGetAlignment(). Returns 0 on success, or -1 on
+   error. */
+
+int
+dioEngineInit(struct dioEngine *eng, int fd, int depth, size_t bufSize,
+              const struct dioAlign *da)
+{
+    struct dioAlign align;
+    struct iovec *iov;
+    int j, savedErrno;
+
+    if (da == NULL) {
+        if (dioGetAlignment(fd, &align) == -1)
+            return -1;
+        da = &align;
+    }
+
+    if (dioPoolInit(&eng->pool, depth, bufSize,
+                    (da->memAlign > da->offsetAlign) ?
+                            da->memAlign : da->offsetAlign) == -1)
+        return -1;
+
+    eng->offsets = calloc(depth, sizeof(off_t));
+    if (eng->offsets == NULL)
+        goto failPool;
+
+    if (uringInit(&eng->ring, depth, 0) == -1)
+        goto failOffsets;
+
+    /* Register each pool buffer; buffer 'j' is at index 'j' */
+
+    iov = calloc(depth, sizeof(struct iovec));
+    if (iov == NULL)
+        goto failRing;
+    for (j = 0; j < depth; j++) {
+        iov[j].iov_base = eng->pool.mem + j * eng->pool.bufSize;
+        iov[j].iov_len = eng->pool.bufSize;
+    }
+    if (uringRegisterBuffers(&eng->ring, iov, depth) == -1) {
+        savedErrno = errno;
+        free(iov);
+        errno = savedErrno;
+        goto failRing;
+    }
+    free(iov);
+
+    eng->fd = fd;
+    eng->inFlight = 0;
+    return 0;
+
+failRing:
+    savedErrno = errno;
+    uringFree(&eng->ring);
+    errno = savedErrno;
+failOffsets:
+    free(eng->offsets);
+failPool:
+    savedErrno = errno;
+    dioPoolFree(&eng->pool);
+    errno = savedErrno;
+    return -1;
+}
+
+/* Queue an operation on 'buf'. The buffer's index within the pool is also
+   its registered buffer index; we record the index and the operation type
+   in the SQE's 'user_data', and the offset in 'eng->offsets'. */
+
+static int
+queueOp(struct dioEngine *eng, int op, char *buf, off_t offset, size_t len)
+{
+    struct io_uring_sqe *sqe;
+    int idx;
+
+    if (len > eng->pool.bufSize) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sqe = uringGetSqe(&eng->ring);
+    if (sqe == NULL) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    idx = (buf - eng->pool.mem) / eng->pool.bufSize;
+    uringPrepRw(sqe, (op == DIO_READ) ? IORING_OP_READ_FIXED :
+                                        IORING_OP_WRITE_FIXED,
+                eng->fd, buf, len, offset);
+    sqe->buf_index = idx;
+    sqe->user_data = ((unsigned long) idx << 1) | op;
+    eng->offsets[idx] = offset;
+    eng->inFlight++;
+    return 0;
+}
+
+/* Queue a read of 'len' bytes at 'offset' into a buffer taken from the
+   engine's pool. The buffer is returned by dioEngineComplete(). Returns 0
+   on success, or -1 on error (EAGAIN if no buffer is free). The read is
+   not started until dioEngineSubmit() or dioEngineComplete() is called. */
+
+int
+dioEngineRead(struct dioEngine *eng, off_t offset, size_t len)
+{
+    char *buf;
+
+    buf = dioPoolGet(&eng->pool);
+    if (buf == NULL) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if (queueOp(eng, DIO_READ, buf, offset, len) == -1) {
+        dioPoolPut(&eng->pool, buf);
+        return -1;
+    }
+    return 0;
+}
+
+/* Queue a write of 'len' bytes at 'offset' from 'buf', which must have
+   been obtained from the engine's pool (via dioPoolGet() on 'eng->pool')
+   and which belongs to the engine until it is returned by
+   dioEngineComplete(). Returns 0 on success, or -1 on error. */
+
+int
+dioEngineWrite(struct dioEngine *eng, char *buf, off_t offset, size_t len)
+{
+    return queueOp(eng, DIO_WRITE, buf, offset, len);
+}
+
+/* Start all queued operations. Returns 0 on success, or -1 on error. */
+
+int
+dioEngineSubmit(struct dioEngine *eng)
+{
+    return (uringSubmit(&eng->ring, 0) == -1) ? -1 : 0;
+}
+
+/* Start any queued operations, and wait for one operation to complete,
+   returning its details in '*c'. After processing the data, the caller
+   must return 'c->buf' to the pool using dioPoolPut(&eng->pool, c->buf)
+   (or reuse it for dioEngineWrite()). Returns 0 on success, or -1 on
+   error (with errno set to ENOENT if no operations are in flight). */
+
+int
+dioEngineComplete(struct dioEngine *eng, struct dioCompletion *c)
+{
+    struct io_uring_cqe *cqe;
+    unsigned long ud;
+
+    if (eng->inFlight == 0) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if (uringSubmit(&eng->ring, 0) == -1)
+        return -1;
+    if (uringWaitCqe(&eng->ring, &cqe) == -1)
+        return -1;
+
+    ud = cqe->user_data;
+    c->op = ud & 1;
+    c->buf = eng->pool.mem + (ud >> 1) * eng->pool.bufSize;
+    c->offset = eng->offsets[ud >> 1];
+    c->res = (cqe->res >= 0) ? cqe->res : -1;
+    c->err = (cqe->res >= 0) ? 0 : -cqe->res;
+
+    uringCqeSeen(&eng->ring);
+    eng->inFlight--;
+    return 0;
+}
+
+void
+dioEngineFree(struct dioEngine *eng)
+{
+    uringFree(&eng->ring);
+    free(eng->offsets);
+    dioPoolFree(&eng->pool);
+}
@@ -0,0 +1,80 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 13 */
+
+/* direct_io.h
+
+   Header file for direct_io.c.
+*/
+#ifndef DIRECT_IO_H
+#define DIRECT_IO_H             /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include "uring_functions.h"
+
+struct dioAlign {               /* Alignment requirements for O_DIRECT */
+    size_t memAlign;            /* Alignment of user-space buffers */
+    size_t offsetAlign;         /* Alignment of file offsets and lengths */
+};
+
+struct dioPool {                /* A pool of equal-sized, aligned buffers */
+    char *mem;                  /* Start of the single allocation */
+    size_t bufSize;             /* Size of each buffer */
+    int nbufs;                  /* Number of buffers in pool */
+    int nfree;                  /* Number of entries in 'freeList' */
+    int *freeList;              /* Stack of indexes of free buffers */
+};
+
+struct dioEngine {              /* Queue of asynchronous reads and writes */
+    struct uring ring;
+    struct dioPool pool;        /* Buffers, registered with 'ring' */
+    off_t *offsets;             /* File offset of operation on each buffer */
+    int fd;
+    int inFlight;               /* Operations submitted but not reaped */
+};
+
+struct dioCompletion {          /* Returned by dioEngineComplete() */
+    int op;                     /* DIO_READ or DIO_WRITE */
+    char *buf;                  /* Pool buffer used by operation */
+    off_t offset;               /* File offset of operation */
+    ssize_t res;                /* Bytes transferred, or -1 on error */
+    int err;                    /* errno value if 'res' is -1 */
+};
+
+#define DIO_READ  0
+#define DIO_WRITE 1
+
+int dioGetAlignment(int fd, struct dioAlign *da);
+
+int dioPoolInit(struct dioPool *pool, int nbufs, size_t bufSize,
+                size_t align);
+
+char *dioPoolGet(struct dioPool *pool);
+
+void dioPoolPut(struct dioPool *pool, char *buf);
+
+void dioPoolFree(struct dioPool *pool);
+
+int dioEngineInit(struct dioEngine *eng, int fd, int depth, size_t bufSize,
+                  const struct dioAlign *da);
+
+int dioEngineRead(struct dioEngine *eng, off_t offset, size_t len);
+
+int dioEngineWrite(struct dioEngine *eng, char *buf, off_t offset,
+                   size_t len);
+
+int dioEngineSubmit(struct dioEngine *eng);
+
+int dioEngineComplete(struct dioEngine *eng, struct dioCompletion *c);
+
+void dioEngineFree(struct dioEngine *eng);
+
+#endif
@@ -0,0 +1,201 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 13 */
+
+/* direct_scan.c
+
+   Read a file sequentially, using the direct I/O engine in direct_io.c,
+   and display the throughput. This allows comparison of reads performed
+   via the page cache with direct I/O (O_DIRECT) reads of the same file.
+
+   Usage: direct_scan [-b bufsize] [-q depth] [-m mode] [-c] file
+
+        -b bufsize   Size of each read (default: 1 MiB); rounded up to a
+                     multiple of the direct I/O alignment
+        -q depth     Number of reads kept in flight (default: 8)
+        -m mode      "buffered", "direct", or "both" (the default)
+        -c           Before the buffered scan, ask the kernel to discard
+                     the file's pages from the page cache (using
+                     posix_fadvise(POSIX_FADV_DONTNEED)), so that the scan
+                     starts with a cold cache
+
+   The program displays the alignment requirements for direct I/O on the
+   file, and then, for each mode, the number of bytes read, the elapsed
+   time, and the throughput.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include "direct_io.h"
+#include "tlpi_hdr.h"
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-b bufsize] [-q depth] [-m mode] [-c] file\n",
+            progName);
+    fprintf(stderr, "    -b bufsize   Size of each read (default: 1 MiB)\n");
+    fprintf(stderr, "    -q depth     Reads in flight (default: 8)\n");
+    fprintf(stderr, "    -m mode      buffered, direct, or both "
+                    "(default: both)\n");
+    fprintf(stderr, "    -c           Drop cached pages before buffered "
+                    "scan\n");
+    exit(EXIT_FAILURE);
+}
+
+/* Read the whole of 'file' (opened with the additional 'openFlags'),
+   keeping 'depth' reads in flight; return the elapsed time in seconds
+   and the number of bytes read in '*numBytes' */
+
+static double
+scanFile(const char *file, int openFlags, int depth, size_t bufSize,
+         const struct dioAlign *da, Boolean dropCache, long long *numBytes)
+{
+    struct dioEngine eng;
+    struct dioCompletion c;
+    struct timespec start, end;
+    struct stat sb;
+    off_t offset;
+    int fd, s;
+
+    fd = open(file, O_RDONLY | openFlags);
+    if (fd == -1)
+        errExit("open");
+    if (fstat(fd, &sb) == -1)
+        errExit("fstat");
+
+    if (dropCache) {
+        s = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        if (s != 0)
+            errExitEN(s, "posix_fadvise");
+    }
+
+    if (dioEngineInit(&eng, fd, depth, bufSize, da) == -1)
+        errExit("dioEngineInit");
+
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+
+    *numBytes = 0;
+    offset = 0;
+    for (;;) {
+
+        /* Queue reads until all buffers are in use */
+
+        while (offset < sb.st_size &&
+                dioEngineRead(&eng, offset, eng.pool.bufSize) == 0)
+            offset += eng.pool.bufSize;
+
+        if (dioEngineComplete(&eng, &c) == -1) {
+            if (errno == ENOENT)        /* Nothing left in flight */
+                break;
+            errExit("dioEngineComplete");
+        }
+
+        if (c.res == -1)
+            errExitEN(c.err, "read at offset %lld", (long long) c.offset);
+        *numBytes += c.res;
+        dioPoolPut(&eng.pool, c.buf);
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+
+    dioEngineFree(&eng);
+    if (close(fd) == -1)
+        errExit("close");
+
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void
+report(const char *mode, long long numBytes, double secs)
+{
+    printf("%-10s %lld bytes in %.3f s (%.1f MiB/s)\n", mode, numBytes,
+            secs, (secs > 0) ? numBytes / (1024.0 * 1024) / secs : 0.0);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct dioAlign da;
+    Boolean buffered, direct, dropCache;
+    long long numBytes;
+    size_t bufSize;
+    int opt, depth, fd;
+    double secs;
+
+    bufSize = 1024 * 1024;
+    depth = 8;
+    buffered = direct = TRUE;
+    dropCache = FALSE;
+    while ((opt = getopt(argc, argv, "b:q:m:c")) != -1) {
+        switch (opt) {
+        case 'b':
+            bufSize = getLong(optarg, GN_GT_0 | GN_ANY_BASE, "bufsize");
+            break;
+        case 'q':
+            depth = getInt(optarg, GN_GT_0, "depth");
+            break;
+        case 'm':
+            if (strcmp(optarg, "both") == 0) {
+                buffered = direct = TRUE;
+            } else if (strcmp(optarg, "buffered") == 0) {
+                buffered = TRUE;
+                direct = FALSE;
+            } else if (strcmp(optarg, "direct") == 0) {
+                buffered = FALSE;
+                direct = TRUE;
+            } else {
+                usageError(argv[0]);
+            }
+            break;
+        case 'c':
+            dropCache = TRUE;
+            break;
+        default:
+            usageError(argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc)
+        usageError(argv[0]);
+
+    /* Use the same (direct I/O) alignment for both scans, so that both
+       use the same read size */
+
+    fd = open(argv[optind], O_RDONLY | O_DIRECT);
+    if (fd == -1)
+        errExit("open");
+    if (dioGetAlignment(fd, &da) == -1)
+        errExit("dioGetAlignment");
+    close(fd);
+
+    printf("Direct I/O alignment: memory %zu, offset/length %zu\n",
+            da.memAlign, da.offsetAlign);
+
+    if (buffered) {
+        secs = scanFile(argv[optind], 0, depth, bufSize, &da, dropCache,
+                        &numBytes);
+        report("buffered", numBytes, secs);
+    }
+
+    if (direct) {
+        secs = scanFile(argv[optind], O_DIRECT, depth, bufSize, &da, FALSE,
+                        &numBytes);
+        report("direct", numBytes, secs);
+    }
+
+    exit(EXIT_SUCCESS);
+}
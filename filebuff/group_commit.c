@@ -0,0 +1,436 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 13 */
+
+/* group_commit.c
+
+   A "group commit" writer: many threads append records to a file, and
+   each learns when its record is durable, but the cost of fdatasync()
+   is shared by all of the records that are committed together.
+
+   write_bytes.c shows that calling fdatasync() after every write
+   reduces throughput enormously, since each call waits for the device.
+   Here, a committer thread collects the records that are appended by
+   gcAppend() into a batch, writes the batch with a single pwrite(), and
+   makes it durable with a single fdatasync() (or fsync()). Records that
+   are appended while a commit is in progress go into a second buffer,
+   which becomes the next batch. gcWaitDurable() waits until the batch
+   that holds a given record has been committed; gcWrite() combines the
+   two calls.
+
+   The trade-off between durability latency and throughput is set by the
+   gcConfig structure given to gcOpen():
+
+   windowUsecs  After the first record of a batch arrives, the committer
+                waits up to this long for others to join it. With 0, a
+                batch is committed as soon as the previous commit has
+                finished, so batches form naturally while commits are in
+                progress; larger values produce larger (and fewer)
+                batches, at the cost of added latency for each record.
+
+   maxBatch     A batch is committed as soon as it holds this many bytes,
+                without waiting for the end of the window.
+
+   bufSize      Each of the two batch buffers has this size. When the
+                filling batch is full, gcAppend() blocks until a commit
+                finishes (back pressure).
+
+   sync         GC_FDATASYNC, GC_FSYNC, or GC_SYNC_NONE (which makes
+                nothing durable, but shows the cost of batching alone).
+                GC_SFR adds write-behind: while a batch fills, the
+                committer writes out the records that have arrived and
+                starts their writeback with sync_file_range(), so that
+                the final fdatasync() has less to wait for. Note that
+                sync_file_range() alone guarantees nothing about
+                durability: it neither flushes metadata nor the device's
+                write cache.
+
+   If a write or sync fails, the records of that batch are not reported
+   as durable, and all later calls fail with the same error.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include "group_commit.h"       /* Declares functions defined here */
+
+#define SFR_CHUNK 65536         /* GC_SFR: write behind in pieces of at
+                                   least this size */
+
+struct batch {
+    char *buf;
+    size_t len;                 /* Bytes appended */
+    size_t written;             /* Bytes already written (GC_SFR) */
+    off_t off;                  /* File offset of buf[0] */
+    uint64_t lastTicket;        /* Ticket of the last record */
+    uint64_t firstNs;           /* When the first record was appended */
+};
+
+struct gcWriter {
+    int fd;
+    struct gcConfig cfg;
+    pthread_mutex_t mtx;        /* Protects all of the following */
+    pthread_cond_t work;        /* Committer waits for records */
+    pthread_cond_t space;       /* Appenders wait for a free buffer */
+    pthread_cond_t done;        /* Waiters wait for a commit */
+    struct batch b[2];
+    struct batch *fill;         /* Batch to which records are appended */
+    uint64_t nextTicket;        /* Ticket of the most recent record */
+    uint64_t durable;           /* Last ticket that has been committed */
+    int err;                    /* errno of a failed write or sync */
+    int closing;
+    pthread_t committer;
+    struct gcStats stats;
+};
+
+static uint64_t
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Write 'len' bytes at 'off', continuing after partial writes. Returns
+   0 on success, or -1 on error. */
+
+static int
+writeAll(int fd, const char *buf, size_t len, off_t off)
+{
+    ssize_t s;
+
+    while (len > 0) {
+        s = pwrite(fd, buf, len, off);
+        if (s == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += s;
+        len -= s;
+        off += s;
+    }
+    return 0;
+}
+
+/* GC_SFR: write out the records that have arrived in 'b' since the last
+   write-behind, and start their writeback. Called with the mutex held;
+   drops it during the I/O. Appenders may add to 'b' meanwhile, but they
+   don't touch the bytes that are being written. */
+
+static void
+writeBehind(struct gcWriter *gw, struct batch *b)
+{
+    size_t start, end;
+    int s, savedErrno;
+
+    start = b->written;
+    end = b->len;
+    pthread_mutex_unlock(&gw->mtx);
+
+    s = writeAll(gw->fd, b->buf + start, end - start, b->off + start);
+    if (s == 0)
+        s = sync_file_range(gw->fd, b->off + start, end - start,
+                            SYNC_FILE_RANGE_WRITE);
+    savedErrno = errno;
+
+    pthread_mutex_lock(&gw->mtx);
+    if (s == -1 && gw->err == 0)
+        gw->err = savedErrno;
+    b->written = end;
+    gw->stats.earlyWrites++;
+}
+
+/* Write 'b' and make it durable. Called with the mutex held; drops it
+   during the I/O. Returns 0 on success, or -1 on error. */
+
+static int
+commit(struct gcWriter *gw, struct batch *b)
+{
+    int s, savedErrno;
+
+    pthread_mutex_unlock(&gw->mtx);
+
+    s = writeAll(gw->fd, b->buf + b->written, b->len - b->written,
+                 b->off + b->written);
+    if (s == 0) {
+        switch (gw->cfg.sync) {
+        case GC_FDATASYNC:
+        case GC_SFR:        s = fdatasync(gw->fd);     break;
+        case GC_FSYNC:      s = fsync(gw->fd);         break;
+        }
+    }
+    savedErrno = errno;
+
+    pthread_mutex_lock(&gw->mtx);
+    errno = savedErrno;
+    return s;
+}
+
+static void *
+committer(void *arg)
+{
+    struct gcWriter *gw = arg;
+    struct batch *b, *next;
+    struct timespec ts;
+    uint64_t deadline;
+
+    pthread_mutex_lock(&gw->mtx);
+    for (;;) {
+        b = gw->fill;
+        while (b->len == 0 && !gw->closing)
+            pthread_cond_wait(&gw->work, &gw->mtx);
+        if (b->len == 0)
+            break;                      /* Closing, and nothing to do */
+
+        /* Let the batch grow until the window ends or the batch is
+           large enough */
+
+        deadline = b->firstNs + (uint64_t) gw->cfg.windowUsecs * 1000;
+        while (!gw->closing && gw->err == 0 && b->len < gw->cfg.maxBatch) {
+            if (gw->cfg.sync == GC_SFR && b->len - b->written >= SFR_CHUNK) {
+                writeBehind(gw, b);
+                continue;
+            }
+            if (nowNs() >= deadline)
+                break;
+            ts.tv_sec = deadline / 1000000000;
+            ts.tv_nsec = deadline % 1000000000;
+            pthread_cond_timedwait(&gw->work, &gw->mtx, &ts);
+        }
+
+        /* Direct appenders to the other buffer, and commit this one */
+
+        next = (b == &gw->b[0]) ? &gw->b[1] : &gw->b[0];
+        next->len = next->written = 0;
+        next->off = b->off + b->len;
+        gw->fill = next;
+        pthread_cond_broadcast(&gw->space);
+
+        if (gw->err == 0 && commit(gw, b) == 0) {
+            gw->durable = b->lastTicket;
+            gw->stats.commits++;
+            gw->stats.bytes += b->len;
+        } else if (gw->err == 0) {
+            gw->err = errno;
+        }
+        pthread_cond_broadcast(&gw->done);
+        if (gw->err != 0)
+            pthread_cond_broadcast(&gw->space);
+    }
+    pthread_mutex_unlock(&gw->mtx);
+    return NULL;
+}
+
+/* Set the default configuration in '*cfg' */
+
+void
+gcConfigInit(struct gcConfig *cfg)
+{
+    cfg->windowUsecs = 0;
+    cfg->maxBatch = 256 * 1024;
+    cfg->bufSize = 1024 * 1024;
+    cfg->sync = GC_FDATASYNC;
+}
+
+/* Create a writer that appends records to the end of the file referred
+   to by 'fd', with the configuration in 'cfg' (or the defaults, if 'cfg'
+   is NULL). Returns a pointer to the writer, or NULL on error. */
+
+struct gcWriter *
+gcOpen(int fd, const struct gcConfig *cfg)
+{
+    pthread_condattr_t attr;
+    struct gcWriter *gw;
+    off_t end;
+    int s;
+
+    end = lseek(fd, 0, SEEK_END);
+    if (end == -1)
+        return NULL;
+
+    gw = calloc(1, sizeof(struct gcWriter));
+    if (gw == NULL)
+        return NULL;
+    if (cfg != NULL)
+        gw->cfg = *cfg;
+    else
+        gcConfigInit(&gw->cfg);
+    if (gw->cfg.bufSize == 0 || gw->cfg.sync < GC_SYNC_NONE ||
+            gw->cfg.sync > GC_SFR) {
+        free(gw);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    gw->b[0].buf = malloc(gw->cfg.bufSize);
+    gw->b[1].buf = malloc(gw->cfg.bufSize);
+    if (gw->b[0].buf == NULL || gw->b[1].buf == NULL)
+        goto fail;
+    gw->fd = fd;
+    gw->fill = &gw->b[0];
+    gw->fill->off = end;
+
+    /* The committer's window is timed with CLOCK_MONOTONIC */
+
+    pthread_mutex_init(&gw->mtx, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&gw->work, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&gw->space, NULL);
+    pthread_cond_init(&gw->done, NULL);
+
+    s = pthread_create(&gw->committer, NULL, committer, gw);
+    if (s != 0) {
+        errno = s;
+        goto fail;
+    }
+    return gw;
+
+fail:
+    s = errno;
+    free(gw->b[0].buf);
+    free(gw->b[1].buf);
+    free(gw);
+    errno = s;
+    return NULL;
+}
+
+/* Append the 'len'-byte record 'rec' to the file. The record is copied,
+   and will be written by the committer thread; '*ticket' is set to a
+   number that can be passed to gcWaitDurable() to wait until it is
+   durable. Records are written in the order of their tickets. Returns 0
+   on success, or -1 on error. */
+
+int
+gcAppend(struct gcWriter *gw, const void *rec, size_t len, uint64_t *ticket)
+{
+    struct batch *b;
+    int wake;
+
+    if (len > gw->cfg.bufSize) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&gw->mtx);
+    for (;;) {
+        if (gw->err != 0) {
+            errno = gw->err;
+            pthread_mutex_unlock(&gw->mtx);
+            return -1;
+        }
+        b = gw->fill;
+        if (gw->cfg.bufSize - b->len >= len)
+            break;
+        pthread_cond_wait(&gw->space, &gw->mtx);
+    }
+
+    if (b->len == 0)
+        b->firstNs = nowNs();
+    memcpy(b->buf + b->len, rec, len);
+    b->len += len;
+    b->lastTicket = ++gw->nextTicket;
+    *ticket = gw->nextTicket;
+    gw->stats.records++;
+
+    /* Wake the committer only if this record might change what it
+       does */
+
+    wake = b->len == len || (b->len >= gw->cfg.maxBatch &&
+                             b->len - len < gw->cfg.maxBatch) ||
+           (gw->cfg.sync == GC_SFR && b->len - b->written >= SFR_CHUNK);
+    if (wake)
+        pthread_cond_signal(&gw->work);
+    pthread_mutex_unlock(&gw->mtx);
+    return 0;
+}
+
+/* Wait until the record with the given ticket is durable. Returns 0 on
+   success, or -1 on error (if the record's batch could not be written
+   or synced). */
+
+int
+gcWaitDurable(struct gcWriter *gw, uint64_t ticket)
+{
+    int s;
+
+    pthread_mutex_lock(&gw->mtx);
+    while (gw->durable < ticket && gw->err == 0)
+        pthread_cond_wait(&gw->done, &gw->mtx);
+    s = 0;
+    if (gw->durable < ticket) {
+        errno = gw->err;
+        s = -1;
+    }
+    pthread_mutex_unlock(&gw->mtx);
+    return s;
+}
+
+/* Append a record and wait until it is durable. Returns 0 on success, or
+   -1 on error. */
+
+int
+gcWrite(struct gcWriter *gw, const void *rec, size_t len)
+{
+    uint64_t ticket;
+
+    if (gcAppend(gw, rec, len, &ticket) == -1)
+        return -1;
+    return gcWaitDurable(gw, ticket);
+}
+
+void
+gcGetStats(struct gcWriter *gw, struct gcStats *stats)
+{
+    pthread_mutex_lock(&gw->mtx);
+    *stats = gw->stats;
+    pthread_mutex_unlock(&gw->mtx);
+}
+
+/* Commit any records that are waiting, and free the writer. (The file
+   descriptor is not closed.) No other thread may be using the writer.
+   Returns 0 on success, or -1 if any commit failed. */
+
+int
+gcClose(struct gcWriter *gw)
+{
+    int err;
+
+    pthread_mutex_lock(&gw->mtx);
+    gw->closing = 1;
+    pthread_cond_signal(&gw->work);
+    pthread_mutex_unlock(&gw->mtx);
+    pthread_join(gw->committer, NULL);
+
+    err = gw->err;
+    pthread_mutex_destroy(&gw->mtx);
+    pthread_cond_destroy(&gw->work);
+    pthread_cond_destroy(&gw->space);
+    pthread_cond_destroy(&gw->done);
+    free(gw->b[0].buf);
+    free(gw->b[1].buf);
+    free(gw);
+
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 13 */
+
+/* group_commit.h
+
+   Header file for group_commit.c.
+*/
+#ifndef GROUP_COMMIT_H
+#define GROUP_COMMIT_H          /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <stdint.h>
+
+struct gcWriter;                /* Opaque; defined in group_commit.c */
+
+#define GC_SYNC_NONE  0         /* No sync: measures batching alone */
+#define GC_FDATASYNC  1         /* fdatasync() per commit */
+#define GC_FSYNC      2         /* fsync() per commit */
+#define GC_SFR        3         /* sync_file_range() write-behind while a
+                                   batch fills, then fdatasync() */
+
+struct gcConfig {
+    long windowUsecs;           /* Longest time that the first record of
+                                   a batch waits for others to join it
+                                   (default: 0) */
+    size_t maxBatch;            /* Commit as soon as a batch reaches this
+                                   many bytes (default: 256 kB) */
+    size_t bufSize;             /* Size of each of the two batch buffers;
+                                   the largest record (default: 1 MB) */
+    int sync;                   /* GC_* (default: GC_FDATASYNC) */
+};
+
+struct gcStats {
+    unsigned long records;      /* Records appended */
+    unsigned long commits;      /* Batches written and synced */
+    unsigned long long bytes;   /* Bytes written */
+    unsigned long earlyWrites;  /* Write-behind calls (GC_SFR) */
+};
+
+void gcConfigInit(struct gcConfig *cfg);
+
+struct gcWriter *gcOpen(int fd, const struct gcConfig *cfg);
+
+int gcAppend(struct gcWriter *gw, const void *rec, size_t len,
+             uint64_t *ticket);
+
+int gcWaitDurable(struct gcWriter *gw, uint64_t ticket);
+
+int gcWrite(struct gcWriter *gw, const void *rec, size_t len);
+
+void gcGetStats(struct gcWriter *gw, struct gcStats *stats);
+
+int gcClose(struct gcWriter *gw);
+
+#endif
@@ -0,0 +1,239 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 13 */
+
+/* out_buf.c
+
+   A simple output buffer for programs that write large volumes of
+   output to a file descriptor (for example, to standard output).
+
+   stdio buffers output in the same way, but a stream's buffering mode
+   depends on what it refers to (standard output to a terminal is
+   line-buffered), and a program that mixes stdio output with write()
+   calls on the same file descriptor gets its output out of order (see
+   mix23io.c). An outBuf writes only when its buffer is full or when the
+   caller calls obFlush(), so the caller decides where the flush points
+   are: for example, after each complete record, or before a write() on
+   the same file descriptor.
+
+   Small pieces of output are copied into the buffer. When a piece does
+   not fit in the rest of the buffer, it is not copied: instead, the
+   buffered data and the new piece are written together by a single
+   writev() call. obWriteRef() adds a piece without copying it at all;
+   the caller must leave the data unchanged until the next obFlush() (or
+   until the output is written because the buffer fills). This suits
+   string constants and large blocks of data.
+
+   obPrintf() formats with vsnprintf(), which, in glibc, sets up a
+   string stream on each call, so it costs somewhat more than fprintf()
+   on a fully buffered stream; where output volume matters most, format
+   numbers directly and use obWrite().
+
+   Once a write fails, all later calls fail with the same error (as with
+   the error indicator of a stdio stream), so that a caller can check
+   just the final obFlush().
+*/
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "out_buf.h"            /* Declares functions defined here */
+
+/* Initialize an outBuf that will write to 'fd', using 'buf' (of size
+   'bufSize') to hold output that has not yet been written */
+
+void
+obInit(struct outBuf *ob, int fd, void *buf, size_t bufSize)
+{
+    ob->fd = fd;
+    ob->buf = buf;
+    ob->bufSize = bufSize;
+    ob->len = 0;
+    ob->segStart = 0;
+    ob->niov = 0;
+    ob->err = 0;
+    ob->writes = 0;
+}
+
+/* Add the bytes in 'buf' that are not yet in 'iov' to 'iov' */
+
+static void
+closeSegment(struct outBuf *ob)
+{
+    if (ob->len > ob->segStart) {
+        ob->iov[ob->niov].iov_base = ob->buf + ob->segStart;
+        ob->iov[ob->niov].iov_len = ob->len - ob->segStart;
+        ob->niov++;
+        ob->segStart = ob->len;
+    }
+}
+
+/* Write all of the output that is waiting, with as few writev() calls
+   as possible. Returns 0 on success, or -1 on error. */
+
+int
+obFlush(struct outBuf *ob)
+{
+    struct iovec *iov;
+    ssize_t numWritten;
+    int niov;
+
+    if (ob->err != 0) {
+        errno = ob->err;
+        return -1;
+    }
+
+    closeSegment(ob);
+    iov = ob->iov;
+    niov = ob->niov;
+    while (niov > 0) {
+        numWritten = writev(ob->fd, iov, niov);
+        ob->writes++;
+        if (numWritten == -1) {
+            if (errno == EINTR)
+                continue;
+            ob->err = errno;
+            return -1;
+        }
+
+        /* Skip the pieces that were written completely, and the written
+           part of the piece that was written partially */
+
+        while (niov > 0 && (size_t) numWritten >= iov->iov_len) {
+            numWritten -= iov->iov_len;
+            iov++;
+            niov--;
+        }
+        if (niov > 0) {
+            iov->iov_base = (char *) iov->iov_base + numWritten;
+            iov->iov_len -= numWritten;
+        }
+    }
+
+    ob->len = ob->segStart = 0;
+    ob->niov = 0;
+    return 0;
+}
+
+/* Add 'len' bytes of 'data' (which need not remain valid after the call)
+   to the output. Returns 0 on success, or -1 on error. */
+
+int
+obWrite(struct outBuf *ob, const void *data, size_t len)
+{
+    if (ob->err != 0) {
+        errno = ob->err;
+        return -1;
+    }
+
+    if (len <= ob->bufSize - ob->len) {
+        memcpy(ob->buf + ob->len, data, len);
+        ob->len += len;
+        if (ob->len < ob->bufSize)
+            return 0;
+        return obFlush(ob);
+    }
+
+    /* Doesn't fit: write the waiting output and 'data' together */
+
+    closeSegment(ob);
+    ob->iov[ob->niov].iov_base = (void *) data;
+    ob->iov[ob->niov].iov_len = len;
+    ob->niov++;
+    return obFlush(ob);
+}
+
+/* Add 'len' bytes of 'data' to the output without copying them. The
+   data must not be modified until the next call to obFlush(), or until
+   a call to obWrite() or one of its relatives writes the output. Returns
+   0 on success, or -1 on error. */
+
+int
+obWriteRef(struct outBuf *ob, const void *data, size_t len)
+{
+    if (ob->err != 0) {
+        errno = ob->err;
+        return -1;
+    }
+
+    closeSegment(ob);
+    ob->iov[ob->niov].iov_base = (void *) data;
+    ob->iov[ob->niov].iov_len = len;
+    ob->niov++;
+
+    /* Leave room in 'iov' for another piece of 'buf' and a piece added by
+       obWrite() */
+
+    if (ob->niov >= OB_MAX_IOV - 2)
+        return obFlush(ob);
+    return 0;
+}
+
+/* Add the string 's' (without its terminating null byte) to the output.
+   Returns 0 on success, or -1 on error. */
+
+int
+obPuts(struct outBuf *ob, const char *s)
+{
+    return obWrite(ob, s, strlen(s));
+}
+
+/* Format output as for printf(). Returns 0 on success, or -1 on error. */
+
+int
+obPrintf(struct outBuf *ob, const char *format, ...)
+{
+    va_list ap;
+    char *big;
+    int n, s;
+
+    if (ob->err != 0) {
+        errno = ob->err;
+        return -1;
+    }
+
+    /* Format directly into the free part of the buffer; if the result
+       doesn't fit, flush the buffer and try again */
+
+    va_start(ap, format);
+    n = vsnprintf(ob->buf + ob->len, ob->bufSize - ob->len, format, ap);
+    va_end(ap);
+    if (n < 0)
+        return -1;
+    if ((size_t) n < ob->bufSize - ob->len) {
+        ob->len += n;
+        return 0;
+    }
+
+    if (obFlush(ob) == -1)
+        return -1;
+    if ((size_t) n < ob->bufSize) {
+        va_start(ap, format);
+        vsnprintf(ob->buf, ob->bufSize, format, ap);
+        va_end(ap);
+        ob->len = n;
+        return 0;
+    }
+
+    /* Larger than the whole buffer */
+
+    big = malloc(n + 1);
+    if (big == NULL)
+        return -1;
+    va_start(ap, format);
+    vsnprintf(big, n + 1, format, ap);
+    va_end(ap);
+    s = obWrite(ob, big, n);
+    free(big);
+    return s;
+}
@@ -0,0 +1,61 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 13 */
+
+/* out_buf.h
+
+   Header file for out_buf.c.
+*/
+#ifndef OUT_BUF_H
+#define OUT_BUF_H               /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define OB_MAX_IOV 64           /* Pieces gathered by one writev() */
+
+/* Output buffer for 'fd'. The caller supplies the buffer ('buf', of
+   'bufSize' bytes) in which small writes are accumulated. */
+
+struct outBuf {
+    int fd;                     /* File descriptor to which to write */
+    char *buf;                  /* Caller-supplied buffer */
+    size_t bufSize;             /* Size of 'buf' */
+    size_t len;                 /* Bytes used in 'buf' */
+    size_t segStart;            /* Start of bytes in 'buf' that are not
+                                   yet described by 'iov' */
+    struct iovec iov[OB_MAX_IOV];       /* Output that is waiting */
+    int niov;
+    int err;                    /* errno of first failed write, or 0 */
+    unsigned long writes;       /* writev() calls */
+};
+
+#define OB_DEFAULT_BUF_SIZE 65536
+                        /* A reasonable size for the 'buf' that the caller
+                           passes to obInit() */
+
+void obInit(struct outBuf *ob, int fd, void *buf, size_t bufSize);
+
+int obWrite(struct outBuf *ob, const void *data, size_t len);
+
+int obWriteRef(struct outBuf *ob, const void *data, size_t len);
+
+int obPuts(struct outBuf *ob, const char *s);
+
+int obPrintf(struct outBuf *ob, const char *format, ...)
+#ifdef __GNUC__
+    __attribute__ ((format (printf, 2, 3)))
+#endif
+    ;
+
+int obFlush(struct outBuf *ob);
+
+#endif
@@ -0,0 +1,266 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 13 */
+
+/* out_buf_bench.c
+
+   Compare the cost of writing many lines of output with stdio in each of
+   its buffering modes, with a write() call per line, and with the output
+   buffer implemented in out_buf.c.
+
+   Usage: out_buf_bench [-n nlines] [-l line-len] [-s sizes] [-f] [file]
+
+        -n nlines    Lines written by each repetition (default: 200000)
+        -l line-len  Length of each line, including the newline
+                     (default: 60)
+        -s sizes     Comma-separated list of buffer sizes for setvbuf()
+                     and obInit() (default: 512,4096,65536)
+        -f           Also measure formatting each line with fprintf()
+                     and obPrintf(), rather than writing a preformatted
+                     line
+        file         File to write (default: /dev/null). A regular file
+                     is truncated before each repetition.
+
+   The lines are written to a stdio stream, or to an outBuf, for the
+   file, and the stream or outBuf is flushed at the end of each
+   repetition. So that the program can count the write() calls that
+   stdio makes, the stream is created with fopencookie(), with a write
+   function that calls write(). The results are reported in the common
+   format of lib/bench.c, in terms of the cost per line, and each is
+   followed by the number of write() or writev() calls per 1000 lines.
+
+   Try: ./out_buf_bench
+        ./out_buf_bench -s 4096 -f /tmp/out_buf_bench.out
+        ./out_buf_bench -l 2000 -s 4096,1048576
+
+   This program uses the GNU-specific fopencookie().
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <fcntl.h>
+#include "out_buf.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+#define MAX_SIZES 16
+
+enum method { M_WRITE, M_STDIO, M_OUTBUF, M_FPRINTF, M_OBPRINTF };
+
+struct run {
+    enum method method;
+    int mode;                   /* For stdio: _IONBF, _IOLBF, or _IOFBF */
+    size_t size;                /* Buffer size */
+    unsigned long calls;        /* System calls made by last repetition */
+};
+
+static int fd;
+static Boolean regular;         /* Is 'fd' a regular file? */
+static char *line;
+static size_t lineLen;
+
+/* Count system calls made by a stdio stream, via fopencookie() */
+
+static unsigned long streamWrites;
+
+static ssize_t
+cookieWrite(void *cookie, const char *buf, size_t size)
+{
+    ssize_t numWritten;
+
+    streamWrites++;
+    numWritten = write(fd, buf, size);
+    return (numWritten == -1) ? 0 : numWritten;
+}
+
+static void
+emit(long ops, void *arg)
+{
+    cookie_io_functions_t funcs = { NULL, cookieWrite, NULL, NULL };
+    struct run *r = arg;
+    struct outBuf ob;
+    char *buf;
+    FILE *fp;
+    long j;
+
+    if (regular && (ftruncate(fd, 0) == -1 || lseek(fd, 0, SEEK_SET) == -1))
+        errExit("ftruncate/lseek");
+
+    switch (r->method) {
+    case M_WRITE:
+        for (j = 0; j < ops; j++)
+            if (write(fd, line, lineLen) != (ssize_t) lineLen)
+                errExit("write");
+        r->calls = ops;
+        break;
+
+    case M_STDIO:
+    case M_FPRINTF:
+
+        /* We must supply the buffer: given NULL, glibc's setvbuf()
+           ignores the size, and later allocates a buffer of BUFSIZ */
+
+        buf = NULL;
+        if (r->size > 0) {
+            buf = malloc(r->size);
+            if (buf == NULL)
+                errExit("malloc");
+        }
+        fp = fopencookie(NULL, "w", funcs);
+        if (fp == NULL)
+            errExit("fopencookie");
+        if (setvbuf(fp, buf, r->mode, r->size) != 0)
+            errExit("setvbuf");
+        streamWrites = 0;
+        if (r->method == M_STDIO) {
+            for (j = 0; j < ops; j++)
+                fwrite(line, 1, lineLen, fp);
+        } else {
+            for (j = 0; j < ops; j++)
+                fprintf(fp, "%08ld %.*s\n", j, (int) lineLen - 10, line);
+        }
+        if (fclose(fp) == EOF)
+            errExit("fclose");
+        free(buf);
+        r->calls = streamWrites;
+        break;
+
+    case M_OUTBUF:
+    case M_OBPRINTF:
+        buf = malloc(r->size);
+        if (buf == NULL)
+            errExit("malloc");
+        obInit(&ob, fd, buf, r->size);
+        if (r->method == M_OUTBUF) {
+            for (j = 0; j < ops; j++)
+                obWrite(&ob, line, lineLen);
+        } else {
+            for (j = 0; j < ops; j++)
+                obPrintf(&ob, "%08ld %.*s\n", j, (int) lineLen - 10, line);
+        }
+        if (obFlush(&ob) == -1)
+            errExit("obFlush");
+        r->calls = ob.writes;
+        free(buf);
+        break;
+    }
+}
+
+static void
+run(const char *name, struct run *r, long nlines)
+{
+    struct benchResult res;
+
+    if (benchRun(name, emit, r, nlines, NULL, &res) == -1)
+        errExit("benchRun");
+    benchReport(&res);
+    printf("    %.1f system calls per 1000 lines\n",
+           r->calls * 1000.0 / nlines);
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t sizes[MAX_SIZES];
+    int opt, nsizes, j;
+    Boolean fmt;
+    char name[64], *p, *saveptr;
+    const char *file;
+    struct stat sb;
+    struct run r;
+    long nlines;
+
+    nlines = 200000;
+    lineLen = 60;
+    nsizes = 3;
+    sizes[0] = 512;
+    sizes[1] = 4096;
+    sizes[2] = 65536;
+    fmt = FALSE;
+    while ((opt = getopt(argc, argv, "n:l:s:f")) != -1) {
+        switch (opt) {
+        case 'n': nlines = getLong(optarg, GN_GT_0, "-n");      break;
+        case 'l': lineLen = getLong(optarg, GN_GT_0, "-l");     break;
+        case 'f': fmt = TRUE;                                   break;
+        case 's':
+            nsizes = 0;
+            for (p = strtok_r(optarg, ",", &saveptr); p != NULL;
+                    p = strtok_r(NULL, ",", &saveptr)) {
+                if (nsizes == MAX_SIZES)
+                    cmdLineErr("Too many sizes\n");
+                sizes[nsizes++] = getLong(p, GN_GT_0, "-s");
+            }
+            break;
+        default:
+            usageErr("%s [-n nlines] [-l line-len] [-s sizes] [-f] [file]\n",
+                     argv[0]);
+        }
+    }
+    if (optind < argc - 1)
+        usageErr("%s [-n nlines] [-l line-len] [-s sizes] [-f] [file]\n",
+                 argv[0]);
+    if (lineLen < 11)
+        cmdLineErr("Line length must be at least 11\n");
+
+    file = (optind < argc) ? argv[optind] : "/dev/null";
+    fd = open(file, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        errExit("open %s", file);
+    if (fstat(fd, &sb) == -1)
+        errExit("fstat");
+    regular = S_ISREG(sb.st_mode);
+
+    line = malloc(lineLen);
+    if (line == NULL)
+        errExit("malloc");
+    for (j = 0; j < (int) lineLen - 1; j++)
+        line[j] = 'a' + j % 26;
+    line[lineLen - 1] = '\n';
+
+    printf("%ld lines of %zu bytes to %s\n", nlines, lineLen, file);
+
+    r.method = M_WRITE;
+    run("write() per line", &r, nlines);
+
+    r.method = M_STDIO;
+    r.mode = _IONBF;
+    r.size = 0;
+    run("stdio, unbuffered", &r, nlines);
+    r.mode = _IOLBF;
+    r.size = BUFSIZ;
+    run("stdio, line-buffered", &r, nlines);
+
+    for (j = 0; j < nsizes; j++) {
+        r.method = M_STDIO;
+        r.mode = _IOFBF;
+        r.size = sizes[j];
+        snprintf(name, sizeof(name), "stdio, fully buffered %zu", sizes[j]);
+        run(name, &r, nlines);
+        r.method = M_OUTBUF;
+        snprintf(name, sizeof(name), "outBuf %zu", sizes[j]);
+        run(name, &r, nlines);
+    }
+
+    if (fmt) {
+        for (j = 0; j < nsizes; j++) {
+            r.method = M_FPRINTF;
+            r.mode = _IOFBF;
+            r.size = sizes[j];
+            snprintf(name, sizeof(name), "fprintf(), buffered %zu",
+                     sizes[j]);
+            run(name, &r, nlines);
+            r.method = M_OBPRINTF;
+            snprintf(name, sizeof(name), "obPrintf() %zu", sizes[j]);
+            run(name, &r, nlines);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -14,7 +14,7 @@
 
    Write bytes to a file. (A simple program for file I/O benchmarking.)
 
-   Usage: write_bytes file num-bytes buf-size
+   Usage: write_bytes file num-bytes buf-size [queue-depth]
 
    Writes 'num-bytes' bytes to 'file', using a buffer size of 'buf-size'
    for each write().
@@ -27,20 +27,236 @@
 
    If compiled with -DUSE_FSYNC, perform an fsync() after each write, so that
    data and metadata are flushed to the disk.
+
+   If compiled with -DUSE_IO_URING (Linux 5.1 and later), the writes are
+   instead performed using io_uring (see uring_functions.c), with up to
+   'queue-depth' (default: 1) writes in flight at any one time. The buffer
+   and the file descriptor are registered with the kernel, and each write
+   is an IORING_OP_WRITE_FIXED operation at an explicit file offset. When
+   combined with -DUSE_FSYNC or -DUSE_FDATASYNC, each write is linked
+   (IOSQE_IO_LINK) to an IORING_OP_FSYNC operation (with
+   IORING_FSYNC_DATASYNC in the fdatasync() case), so that the sync is
+   started by the kernel as soon as the write completes. -DUSE_O_SYNC can
+   also be combined with -DUSE_IO_URING.
+
+   If compiled with -DUSE_GROUP_COMMIT, the writes are instead made by
+   'num-threads' (default: 1) threads, each of which writes its share of
+   the bytes with gcWrite() (see group_commit.c), which returns only when
+   the data is durable. The committer thread makes one sync call per
+   batch of writes: fdatasync() if also compiled with -DUSE_FDATASYNC,
+   fsync() with -DUSE_FSYNC, sync_file_range() write-behind followed by
+   fdatasync() with -DUSE_SYNC_FILE_RANGE, or none at all. 'window-usecs'
+   (default: 0) is the longest time for which the first write of a batch
+   waits for others to join it. At the end, the program prints the
+   number of commits and the mean number of writes per commit.
 */
 #include <sys/stat.h>
 #include <fcntl.h>
 #include "tlpi_hdr.h"
+#ifdef USE_GROUP_COMMIT
+#include <pthread.h>
+#include "group_commit.h"
+
+struct gcThread {
+    pthread_t tid;
+    struct gcWriter *gw;
+    size_t numBytes;            /* This thread's share */
+    char *buf;
+    size_t bufSize;
+};
+
+static void *
+gcWriteBytes(void *arg)
+{
+    struct gcThread *t = arg;
+    size_t thisWrite, totWritten;
+
+    for (totWritten = 0; totWritten < t->numBytes;
+            totWritten += thisWrite) {
+        thisWrite = min(t->bufSize, t->numBytes - totWritten);
+        if (gcWrite(t->gw, t->buf, thisWrite) == -1)
+            errExit("gcWrite");
+    }
+    return NULL;
+}
+
+/* Write 'numBytes' bytes to 'fd' using a group-commit writer, shared by
+   'numThreads' threads */
+
+static void
+groupCommitWriteBytes(int fd, size_t numBytes, char *buf, size_t bufSize,
+                      int numThreads, long windowUsecs)
+{
+    struct gcThread *threads;
+    struct gcWriter *gw;
+    struct gcConfig cfg;
+    struct gcStats st;
+    int j, s;
+
+    gcConfigInit(&cfg);
+    cfg.windowUsecs = windowUsecs;
+    if (cfg.bufSize < bufSize)
+        cfg.bufSize = bufSize;
+#if defined(USE_SYNC_FILE_RANGE)
+    cfg.sync = GC_SFR;
+#elif defined(USE_FSYNC)
+    cfg.sync = GC_FSYNC;
+#elif defined(USE_FDATASYNC)
+    cfg.sync = GC_FDATASYNC;
+#else
+    cfg.sync = GC_SYNC_NONE;
+#endif
+
+    gw = gcOpen(fd, &cfg);
+    if (gw == NULL)
+        errExit("gcOpen");
+
+    threads = calloc(numThreads, sizeof(struct gcThread));
+    if (threads == NULL)
+        errExit("calloc");
+    for (j = 0; j < numThreads; j++) {
+        threads[j].gw = gw;
+        threads[j].numBytes = numBytes / numThreads +
+                              (j == 0 ? numBytes % numThreads : 0);
+        threads[j].buf = buf;
+        threads[j].bufSize = bufSize;
+        s = pthread_create(&threads[j].tid, NULL, gcWriteBytes, &threads[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    for (j = 0; j < numThreads; j++) {
+        s = pthread_join(threads[j].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    gcGetStats(gw, &st);
+    if (gcClose(gw) == -1)
+        errExit("gcClose");
+    printf("%lu writes in %lu commits (%.1f per commit)\n", st.records,
+           st.commits, (double) st.records / (st.commits ? st.commits : 1));
+    free(threads);
+}
+#endif
+#ifdef USE_IO_URING
+#include "uring_functions.h"
+
+#if defined(USE_FSYNC) || defined(USE_FDATASYNC)
+#define OPS_PER_WRITE 2         /* Each write is followed by a linked sync */
+#else
+#define OPS_PER_WRITE 1
+#endif
+
+/* Write 'numBytes' bytes from 'buf' to 'fd' using io_uring, with up to
+   'queueDepth' writes (each of at most 'bufSize' bytes) in flight. All
+   writes are from the same registered buffer. The 'user_data' field of
+   each write records its length, so that short writes can be detected;
+   the 'user_data' of a sync operation is 0. */
+
+static void
+uringWriteBytes(int fd, size_t numBytes, char *buf, size_t bufSize,
+                int queueDepth)
+{
+    struct uring ring;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    struct iovec iov;
+    size_t thisWrite, totQueued;
+    int inFlight;
+
+    if (uringInit(&ring, queueDepth * OPS_PER_WRITE, 0) == -1)
+        errExit("uringInit");
+
+    iov.iov_base = buf;
+    iov.iov_len = bufSize;
+    if (uringRegisterBuffers(&ring, &iov, 1) == -1)
+        errExit("uringRegisterBuffers");
+    if (uringRegisterFiles(&ring, &fd, 1) == -1)
+        errExit("uringRegisterFiles");
+
+    inFlight = 0;
+    for (totQueued = 0; totQueued < numBytes || inFlight > 0; ) {
+
+        /* Keep the queue full */
+
+        while (totQueued < numBytes &&
+                inFlight < queueDepth * OPS_PER_WRITE) {
+            thisWrite = min(bufSize, numBytes - totQueued);
+
+            sqe = uringGetSqe(&ring);           /* 0 == index of 'fd' */
+            uringPrepRw(sqe, IORING_OP_WRITE_FIXED, 0, buf, thisWrite,
+                        totQueued);
+            sqe->flags = IOSQE_FIXED_FILE;
+            sqe->buf_index = 0;
+            sqe->user_data = thisWrite;
+
+#if OPS_PER_WRITE == 2
+            sqe->flags |= IOSQE_IO_LINK;
+
+            sqe = uringGetSqe(&ring);
+            uringPrepRw(sqe, IORING_OP_FSYNC, 0, NULL, 0, 0);
+            sqe->flags = IOSQE_FIXED_FILE;
+#ifdef USE_FDATASYNC
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+#endif
+            sqe->user_data = 0;
+#endif
+            totQueued += thisWrite;
+            inFlight += OPS_PER_WRITE;
+        }
+
+        /* Submit new operations, wait for at least one completion, and
+           then reap all of the completions that are available */
+
+        if (uringSubmit(&ring, 1) == -1)
+            errExit("uringSubmit");
+
+        while (uringPeekCqe(&ring, &cqe) == 0) {
+            if (cqe->res < 0) {
+                errno = -cqe->res;
+                errExit("%s", (cqe->user_data != 0) ? "write" : "fsync");
+            }
+            if (cqe->user_data != 0 && cqe->res != cqe->user_data)
+                fatal("partial write");
+
+            uringCqeSeen(&ring);
+            inFlight--;
+        }
+    }
+
+    uringFree(&ring);
+}
+#endif
 
 int
 main(int argc, char *argv[])
 {
-    size_t bufSize, numBytes, thisWrite, totWritten;
+    size_t bufSize, numBytes;
     char *buf;
     int fd, openFlags;
+#if defined(USE_GROUP_COMMIT)
+    int numThreads;
+    long windowUsecs;
+
+    if (argc < 4 || argc > 6 || strcmp(argv[1], "--help") == 0)
+        usageErr("%s file num-bytes buf-size [num-threads "
+                 "[window-usecs]]\n", argv[0]);
+
+    numThreads = (argc > 4) ? getInt(argv[4], GN_GT_0, "num-threads") : 1;
+    windowUsecs = (argc > 5) ? getLong(argv[5], 0, "window-usecs") : 0;
+#elif defined(USE_IO_URING)
+    int queueDepth;
+
+    if (argc < 4 || argc > 5 || strcmp(argv[1], "--help") == 0)
+        usageErr("%s file num-bytes buf-size [queue-depth]\n", argv[0]);
+
+    queueDepth = (argc > 4) ? getInt(argv[4], GN_GT_0, "queue-depth") : 1;
+#else
+    size_t thisWrite, totWritten;
 
     if (argc != 4 || strcmp(argv[1], "--help") == 0)
         usageErr("%s file num-bytes buf-size\n", argv[0]);
+#endif
 
     numBytes = getLong(argv[2], GN_GT_0, "num-bytes");
     bufSize = getLong(argv[3], GN_GT_0, "buf-size");
@@ -59,6 +275,12 @@ main(int argc, char *argv[])
     if (fd == -1)
         errExit("open");
 
+#if defined(USE_GROUP_COMMIT)
+    groupCommitWriteBytes(fd, numBytes, buf, bufSize, numThreads,
+                          windowUsecs);
+#elif defined(USE_IO_URING)
+    uringWriteBytes(fd, numBytes, buf, bufSize, queueDepth);
+#else
     for (totWritten = 0; totWritten < numBytes;
             totWritten += thisWrite) {
         thisWrite = min(bufSize, numBytes - totWritten);
@@ -75,6 +297,7 @@ main(int argc, char *argv[])
             errExit("fdatasync");
 #endif
     }
+#endif
 
     if (close(fd) == -1)
         errExit("close");
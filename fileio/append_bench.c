@@ -0,0 +1,364 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 5 */
+
+/* append_bench.c
+
+   Measure the rate at which several processes can append records to one
+   file (as, for example, the processes of a server write to a shared log
+   file), using four techniques:
+
+        append   Open the file with O_APPEND, and write() each record.
+
+        lock     Lock the file (an fcntl() write lock; see Chapter 55),
+                 lseek() to the end of the file, write() the record, and
+                 unlock the file.
+
+        reserve  Reserve the offset for each record by atomically adding
+                 the record size to a counter in a shared anonymous
+                 mapping, and then pwrite() the record at that offset.
+                 (If a writer dies between reserving space and writing
+                 the record, the file will contain a hole.)
+
+        pipe     Write each record to a pipe, from which a single
+                 aggregator process reads and writes to the file. The
+                 records stay intact only if they are no larger than
+                 PIPE_BUF, since larger writes to a pipe are not atomic.
+
+   Usage: append_bench [-w writers] [-r recsize] [-n nrecs] [-m methods]
+                       [-u] [file]
+
+        -w writers   Number of writer processes (default: 4)
+        -r recsize   Record size in bytes, at least 20 (default: 100)
+        -n nrecs     Total number of records written by each repetition
+                     (default: 40000)
+        -m methods   Any of 'a' (append), 'l' (lock), 'r' (reserve), and
+                     'p' (pipe) (default: alrp)
+        -u           Also measure lseek() + write() without the lock, to
+                     show the race that atomic_append.c (Exercise 5-3)
+                     demonstrates
+        file         The file to write (default: "append_bench.out" in
+                     the current directory; removed at the end)
+
+   Each writer opens the file itself (so that it has its own open file
+   description), and writes records of the form
+
+        w<writer> s<sequence-number> <filler...>\n
+
+   For each method, the program first writes the records once and checks
+   the file: every record must be intact (not interleaved with another)
+   and every record of every writer must appear exactly once. It then
+   measures the method, and reports the cost per record in the common
+   format of lib/bench.c, followed by the rate in records per second.
+
+   Try: ./append_bench
+        ./append_bench -w 16 -r 4000 -u
+*/
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <limits.h>
+#include "region_locking.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+#define HDR_LEN 18              /* "wNNNN sNNNNNNNNNN " */
+
+enum method { M_APPEND, M_LOCK, M_RESERVE, M_PIPE, M_RACE };
+
+static const char *methodNames[] = {
+    "O_APPEND write()", "lock, lseek() + write()", "reserve + pwrite()",
+    "pipe to aggregator", "lseek() + write(), no lock"
+};
+
+static const char *file;
+static int nwriters;
+static size_t recSize;
+static volatile off_t *nextOff;         /* In a shared mapping */
+
+/* Number of records written by writer 'w' when 'ops' are written in all */
+
+static long
+writerRecs(long ops, int w)
+{
+    return ops / nwriters + (w < ops % nwriters);
+}
+
+static void
+writeAll(int fd, const char *buf, size_t len)
+{
+    ssize_t s;
+
+    for (; len > 0; buf += s, len -= s) {
+        s = write(fd, buf, len);
+        if (s == -1)
+            err_exit("write");
+    }
+}
+
+static void
+writer(enum method m, int w, long nrecs, int pfd)
+{
+    char *rec, hdr[64];
+    long seq;
+    off_t off;
+    int fd;
+
+    fd = open(file, O_WRONLY | (m == M_APPEND ? O_APPEND : 0));
+    if (fd == -1)
+        err_exit("open %s", file);
+
+    rec = malloc(recSize);
+    if (rec == NULL)
+        err_exit("malloc");
+    memset(rec, 'a' + w % 26, recSize);
+    rec[recSize - 1] = '\n';
+
+    for (seq = 0; seq < nrecs; seq++) {
+        snprintf(hdr, sizeof(hdr), "w%04d s%010ld ", w, seq);
+        memcpy(rec, hdr, HDR_LEN);
+
+        switch (m) {
+        case M_APPEND:
+            if (write(fd, rec, recSize) != (ssize_t) recSize)
+                err_exit("write");
+            break;
+
+        case M_LOCK:
+        case M_RACE:
+            if (m == M_LOCK && lockRegionWait(fd, F_WRLCK, SEEK_SET, 0, 0)
+                    == -1)
+                err_exit("lockRegionWait");
+            if (lseek(fd, 0, SEEK_END) == -1)
+                err_exit("lseek");
+            if (write(fd, rec, recSize) != (ssize_t) recSize)
+                err_exit("write");
+            if (m == M_LOCK && lockRegion(fd, F_UNLCK, SEEK_SET, 0, 0)
+                    == -1)
+                err_exit("lockRegion");
+            break;
+
+        case M_RESERVE:
+            off = __atomic_fetch_add(nextOff, (off_t) recSize,
+                                     __ATOMIC_RELAXED);
+            if (pwrite(fd, rec, recSize, off) != (ssize_t) recSize)
+                err_exit("pwrite");
+            break;
+
+        case M_PIPE:
+            if (write(pfd, rec, recSize) != (ssize_t) recSize)
+                err_exit("write pipe");
+            break;
+        }
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+/* Copy everything read from the pipe 'pfd' to the file */
+
+static void
+aggregator(int pfd)
+{
+    char buf[65536];
+    ssize_t numRead;
+    int fd;
+
+    fd = open(file, O_WRONLY);
+    if (fd == -1)
+        err_exit("open %s", file);
+    while ((numRead = read(pfd, buf, sizeof(buf))) > 0)
+        writeAll(fd, buf, numRead);
+    if (numRead == -1)
+        err_exit("read");
+    _exit(EXIT_SUCCESS);
+}
+
+/* Write 'ops' records to an empty file, using the method in 'arg' */
+
+static void
+appendRecs(long ops, void *arg)
+{
+    enum method m = *(enum method *) arg;
+    int pfd[2], fd, w, status;
+
+    fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        errExit("open %s", file);
+    close(fd);
+    *nextOff = 0;
+    pfd[1] = -1;
+
+    fflush(stdout);                     /* Don't duplicate in children */
+    if (m == M_PIPE) {
+        if (pipe(pfd) == -1)
+            errExit("pipe");
+        switch (fork()) {
+        case -1:
+            errExit("fork");
+        case 0:
+            close(pfd[1]);
+            aggregator(pfd[0]);
+        }
+        close(pfd[0]);
+    }
+
+    for (w = 0; w < nwriters; w++) {
+        switch (fork()) {
+        case -1:
+            errExit("fork");
+        case 0:
+            writer(m, w, writerRecs(ops, w), pfd[1]);
+        }
+    }
+    if (m == M_PIPE)
+        close(pfd[1]);                  /* So that aggregator sees EOF */
+
+    while (wait(&status) != -1)
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fatal("a child process failed");
+    if (errno != ECHILD)
+        errExit("wait");
+}
+
+/* Check the file written by appendRecs(ops, ...). Returns TRUE if it
+   is correct. */
+
+static Boolean
+checkFile(long ops)
+{
+    long nextSeq[nwriters];
+    long j, bad, lost, seq, expect;
+    char *buf, *rec, fill;
+    struct stat sb;
+    size_t k;
+    int fd, w;
+
+    fd = open(file, O_RDONLY);
+    if (fd == -1)
+        errExit("open %s", file);
+    if (fstat(fd, &sb) == -1)
+        errExit("fstat");
+    buf = malloc(sb.st_size + 1);
+    if (buf == NULL)
+        errExit("malloc");
+    if (read(fd, buf, sb.st_size) != sb.st_size)
+        fatal("short read of %s", file);
+    close(fd);
+
+    /* Each writer writes its records in order; a record that is not
+       intact, or that is out of sequence, counts as bad */
+
+    for (w = 0; w < nwriters; w++)
+        nextSeq[w] = 0;
+    bad = 0;
+    for (j = 0; j + (long) recSize <= sb.st_size; j += recSize) {
+        rec = buf + j;
+        if (sscanf(rec, "w%4d s%10ld ", &w, &seq) != 2 ||
+                w < 0 || w >= nwriters || seq != nextSeq[w]) {
+            bad++;
+            continue;
+        }
+        fill = 'a' + w % 26;
+        for (k = HDR_LEN; k < recSize - 1; k++)
+            if (rec[k] != fill)
+                break;
+        if (k < recSize - 1 || rec[recSize - 1] != '\n') {
+            bad++;
+            continue;
+        }
+        nextSeq[w]++;
+    }
+
+    lost = 0;
+    for (w = 0; w < nwriters; w++) {
+        expect = writerRecs(ops, w);
+        if (nextSeq[w] < expect)
+            lost += expect - nextSeq[w];
+    }
+    free(buf);
+
+    if (bad == 0 && lost == 0 && sb.st_size == ops * (long) recSize)
+        return TRUE;
+    printf("    FAIL: file size %lld (expected %ld); "
+           "%ld bad records; %ld records missing\n",
+           (long long) sb.st_size, ops * (long) recSize, bad, lost);
+    return FALSE;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct benchResult res;
+    const char *methods;
+    enum method m;
+    Boolean race;
+    long nrecs;
+    int opt;
+
+    nwriters = 4;
+    recSize = 100;
+    nrecs = 40000;
+    methods = "alrp";
+    race = FALSE;
+    while ((opt = getopt(argc, argv, "w:r:n:m:u")) != -1) {
+        switch (opt) {
+        case 'w': nwriters = getInt(optarg, GN_GT_0, "-w");     break;
+        case 'r': recSize = getInt(optarg, GN_GT_0, "-r");      break;
+        case 'n': nrecs = getLong(optarg, GN_GT_0, "-n");       break;
+        case 'm': methods = optarg;                             break;
+        case 'u': race = TRUE;                                  break;
+        default:
+            usageErr("%s [-w writers] [-r recsize] [-n nrecs] [-m methods] "
+                     "[-u] [file]\n", argv[0]);
+        }
+    }
+    if (optind < argc - 1)
+        usageErr("%s [-w writers] [-r recsize] [-n nrecs] [-m methods] "
+                 "[-u] [file]\n", argv[0]);
+    file = (optind < argc) ? argv[optind] : "append_bench.out";
+    if (nwriters > 9999)
+        cmdLineErr("At most 9999 writers\n");
+    if (recSize < HDR_LEN + 2)
+        cmdLineErr("Record size must be at least %d\n", HDR_LEN + 2);
+    if (strspn(methods, "alrp") != strlen(methods))
+        cmdLineErr("Bad method list: %s\n", methods);
+
+    nextOff = mmap(NULL, sizeof(off_t), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (nextOff == MAP_FAILED)
+        errExit("mmap");
+
+    printf("%d writers; %ld records of %zu bytes\n", nwriters, nrecs,
+           recSize);
+
+    for (m = M_APPEND; m <= M_RACE; m++) {
+        if (m == M_RACE ? !race : strchr(methods, "alrp"[m]) == NULL)
+            continue;
+        if (m == M_PIPE && recSize > PIPE_BUF)
+            printf("%s: records are larger than PIPE_BUF (%d), so may "
+                   "be interleaved\n", methodNames[m], PIPE_BUF);
+
+        appendRecs(nrecs, &m);
+        if (!checkFile(nrecs) && m != M_RACE)
+            printf("    (%s doesn't preserve records)\n", methodNames[m]);
+
+        if (benchRun(methodNames[m], appendRecs, &m, nrecs, NULL,
+                     &res) == -1)
+            errExit("benchRun");
+        benchReport(&res);
+        printf("    %.0f records/sec\n", 1e9 / res.medianNs);
+    }
+
+    if (unlink(file) == -1)
+        errExit("unlink");
+    exit(EXIT_SUCCESS);
+}
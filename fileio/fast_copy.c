@@ -0,0 +1,372 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 4 */
+
+/* fast_copy.c
+
+   Copy the file named argv[1] to a new file named in argv[2], like copy.c,
+   but choosing at run time among several copying strategies:
+
+        cfr        copy_file_range() (Linux 4.5 and later), which copies
+                   entirely within the kernel, and which, on some file
+                   systems, can share the data blocks rather than copying
+                   them (a "reflink")
+        sendfile   sendfile() (file-to-file since Linux 2.6.33)
+        rdwr       read() and write() through a page-aligned buffer whose
+                   size is a multiple of the files' st_blksize
+
+   Usage: fast_copy [-m method] [-b bufsize] [-H] old-file new-file
+
+        -m method    "auto" (the default), "cfr", "sendfile", or "rdwr". In
+                     "auto" mode (and also in "cfr" and "sendfile" modes),
+                     if a strategy is not supported for the given files, we
+                     fall back to the next strategy in the list above.
+        -b bufsize   Buffer size for "rdwr" (default: the smallest multiple
+                     of st_blksize that is at least 128 kB)
+        -H           Don't look for holes in the input file
+
+   Unless -H is specified, the program uses lseek(SEEK_DATA) and
+   lseek(SEEK_HOLE) to find the holes in the input file, and copies only
+   the data regions, so that the holes are preserved in the output file.
+   The program also uses posix_fadvise(POSIX_FADV_SEQUENTIAL) to inform
+   the kernel that the input file will be read sequentially.
+
+   On completion, the program displays the number of bytes copied and the
+   throughput for each strategy that was used.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include "tlpi_hdr.h"
+
+#define MIN_BUF_SIZE (128 * 1024)
+#define MAX_CHUNK (1024 * 1024 * 1024)  /* Max. bytes per system call */
+
+enum { M_AUTO, M_CFR, M_SENDFILE, M_RDWR, M_NUM };
+
+static const char *methodName[M_NUM] = {
+    "auto", "copy_file_range", "sendfile", "read/write"
+};
+
+static long long methodBytes[M_NUM];    /* Bytes copied by each method */
+static double methodSecs[M_NUM];        /* Time spent in each method */
+
+static char *buf;                       /* Buffer for M_RDWR */
+static size_t bufSize;
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-m method] [-b bufsize] [-H] "
+                    "old-file new-file\n", progName);
+    fprintf(stderr, "    -m method    auto, cfr, sendfile, or rdwr "
+                    "(default: auto)\n");
+    fprintf(stderr, "    -b bufsize   Buffer size for rdwr\n");
+    fprintf(stderr, "    -H           Don't preserve holes\n");
+    exit(EXIT_FAILURE);
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static Boolean          /* Does 'err' mean "method can't be used here"? */
+isUnsupported(int err)
+{
+    return err == EINVAL || err == ENOSYS || err == EXDEV ||
+           err == EOPNOTSUPP || err == EBADF;
+}
+
+/* Each of the following functions copies 'len' bytes starting at offset
+   'off' in 'inFd' to the same offset in 'outFd', stopping early only at
+   end of file. If 'off' is -1, the current file offsets are used instead.
+   The number of bytes copied is returned in '*done'. The function result
+   is 0 on success, or -1 on error. */
+
+static int
+copyCfr(int inFd, int outFd, off_t off, off_t len, off_t *done)
+{
+    off_t inOff, outOff;
+    ssize_t s;
+
+    inOff = outOff = off;
+    for (*done = 0; *done < len; *done += s) {
+        s = copy_file_range(inFd, (off == -1) ? NULL : &inOff,
+                            outFd, (off == -1) ? NULL : &outOff,
+                            min(len - *done, MAX_CHUNK), 0);
+        if (s == -1) {
+            if (errno == EINTR) {
+                s = 0;
+                continue;
+            }
+            return -1;
+        }
+        if (s == 0)                     /* EOF */
+            break;
+    }
+    return 0;
+}
+
+static int
+copySendfile(int inFd, int outFd, off_t off, off_t len, off_t *done)
+{
+    off_t inOff;
+    ssize_t s;
+
+    /* sendfile() writes at the current offset of the output file */
+
+    if (off != -1 && lseek(outFd, off, SEEK_SET) == -1)
+        return -1;
+
+    inOff = off;
+    for (*done = 0; *done < len; *done += s) {
+        s = sendfile(outFd, inFd, (off == -1) ? NULL : &inOff,
+                     min(len - *done, MAX_CHUNK));
+        if (s == -1) {
+            if (errno == EINTR) {
+                s = 0;
+                continue;
+            }
+            return -1;
+        }
+        if (s == 0)                     /* EOF */
+            break;
+    }
+    return 0;
+}
+
+static int
+copyRdwr(int inFd, int outFd, off_t off, off_t len, off_t *done)
+{
+    ssize_t numRead, numWritten, w;
+
+    for (*done = 0; *done < len; *done += numRead) {
+        numRead = (off == -1) ?
+                read(inFd, buf, min(len - *done, bufSize)) :
+                pread(inFd, buf, min(len - *done, bufSize), off + *done);
+        if (numRead == -1) {
+            if (errno == EINTR) {
+                numRead = 0;
+                continue;
+            }
+            return -1;
+        }
+        if (numRead == 0)               /* EOF */
+            break;
+
+        for (numWritten = 0; numWritten < numRead; numWritten += w) {
+            w = (off == -1) ?
+                    write(outFd, buf + numWritten, numRead - numWritten) :
+                    pwrite(outFd, buf + numWritten, numRead - numWritten,
+                           off + *done + numWritten);
+            if (w == -1) {
+                if (errno == EINTR) {
+                    w = 0;
+                    continue;
+                }
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Copy a region of the input file using the method '*method', falling
+   back to later methods if that method is unsupported for these files.
+   '*method' is updated to the method that succeeded, so that subsequent
+   regions don't retry methods that have already failed. */
+
+static void
+copyRegion(int inFd, int outFd, off_t off, off_t len, int *method,
+           Boolean fallback)
+{
+    off_t done;
+    double start;
+    int s;
+
+    while (len > 0) {
+        start = now();
+        switch (*method) {
+        case M_CFR:      s = copyCfr(inFd, outFd, off, len, &done);      break;
+        case M_SENDFILE: s = copySendfile(inFd, outFd, off, len, &done); break;
+        default:         s = copyRdwr(inFd, outFd, off, len, &done);     break;
+        }
+        methodSecs[*method] += now() - start;
+        methodBytes[*method] += done;
+
+        if (s == 0)
+            return;
+
+        /* Fall back to the next method, continuing from where the
+           failed method left off */
+
+        if (!fallback || *method == M_RDWR || !isUnsupported(errno))
+            errExit("%s", methodName[*method]);
+
+        (*method)++;
+        if (off != -1)
+            off += done;
+        len -= done;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    int inputFd, outputFd, openFlags, opt, method, s;
+    Boolean findHoles, fallback;
+    mode_t filePerms;
+    struct stat inSb, outSb;
+    off_t pos, data, hole, holeBytes;
+    long pageSize, blkSize;
+    int j;
+
+    method = M_AUTO;
+    bufSize = 0;
+    findHoles = TRUE;
+    while ((opt = getopt(argc, argv, "m:b:H")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "auto") == 0)            method = M_AUTO;
+            else if (strcmp(optarg, "cfr") == 0)        method = M_CFR;
+            else if (strcmp(optarg, "sendfile") == 0)   method = M_SENDFILE;
+            else if (strcmp(optarg, "rdwr") == 0)       method = M_RDWR;
+            else usageError(argv[0]);
+            break;
+        case 'b':
+            bufSize = getLong(optarg, GN_GT_0 | GN_ANY_BASE, "bufsize");
+            break;
+        case 'H':
+            findHoles = FALSE;
+            break;
+        default:
+            usageError(argv[0]);
+        }
+    }
+
+    if (argc != optind + 2)
+        usageError(argv[0]);
+
+    /* Open input and output files */
+
+    inputFd = open(argv[optind], O_RDONLY);
+    if (inputFd == -1)
+        errExit("opening file %s", argv[optind]);
+
+    openFlags = O_CREAT | O_WRONLY | O_TRUNC;
+    filePerms = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP |
+                S_IROTH | S_IWOTH;      /* rw-rw-rw- */
+    outputFd = open(argv[optind + 1], openFlags, filePerms);
+    if (outputFd == -1)
+        errExit("opening file %s", argv[optind + 1]);
+
+    if (fstat(inputFd, &inSb) == -1 || fstat(outputFd, &outSb) == -1)
+        errExit("fstat");
+
+    /* Tell the kernel to perform aggressive read-ahead on the input file.
+       (This fails for a pipe, which doesn't matter.) */
+
+    s = posix_fadvise(inputFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (s != 0 && s != ESPIPE)
+        errExitEN(s, "posix_fadvise");
+
+    /* Allocate a page-aligned buffer whose size is a multiple of the
+       preferred I/O block size of both files */
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    if (bufSize == 0) {
+        blkSize = max(inSb.st_blksize, outSb.st_blksize);
+        if (blkSize <= 0)
+            blkSize = pageSize;
+        bufSize = ((MIN_BUF_SIZE + blkSize - 1) / blkSize) * blkSize;
+    }
+    s = posix_memalign((void **) &buf, pageSize, bufSize);
+    if (s != 0)
+        errExitEN(s, "posix_memalign");
+
+    fallback = (method != M_RDWR);
+    if (method == M_AUTO)
+        method = M_CFR;
+
+    holeBytes = 0;
+    if (!S_ISREG(inSb.st_mode)) {
+
+        /* Size of input is unknown: copy until EOF using the current
+           file offsets. copy_file_range() requires regular files. */
+
+        if (method == M_CFR)
+            method = M_SENDFILE;
+        copyRegion(inputFd, outputFd, -1, (off_t) 1 << 62, &method, fallback);
+
+    } else {
+        for (pos = 0; pos < inSb.st_size; pos = hole) {
+            data = pos;
+            hole = inSb.st_size;
+
+            if (findHoles) {
+                data = lseek(inputFd, pos, SEEK_DATA);
+                if (data == -1) {
+                    if (errno == ENXIO)         /* Only a hole remains */
+                        data = inSb.st_size;
+                    else if (errno == EINVAL)   /* Not supported */
+                        data = pos;
+                    else
+                        errExit("lseek-SEEK_DATA");
+                }
+
+                if (data < inSb.st_size) {
+                    hole = lseek(inputFd, data, SEEK_HOLE);
+                    if (hole == -1)
+                        hole = inSb.st_size;
+                }
+            }
+
+            holeBytes += data - pos;
+            if (data < hole)
+                copyRegion(inputFd, outputFd, data, hole - data,
+                           &method, fallback);
+        }
+
+        /* Set the size of the output file explicitly, in case the input
+           file ends with a hole */
+
+        if (ftruncate(outputFd, inSb.st_size) == -1)
+            errExit("ftruncate");
+    }
+
+    for (j = M_CFR; j < M_NUM; j++)
+        if (methodBytes[j] > 0)
+            printf("%-16s %lld bytes in %.3f s (%.1f MiB/s)\n",
+                    methodName[j], methodBytes[j], methodSecs[j],
+                    (methodSecs[j] > 0) ?
+                        methodBytes[j] / (1024.0 * 1024) / methodSecs[j] :
+                        0.0);
+    if (methodBytes[M_RDWR] > 0)
+        printf("Buffer size: %zu bytes\n", bufSize);
+    if (holeBytes > 0)
+        printf("Skipped %lld bytes in holes\n", (long long) holeBytes);
+
+    if (close(inputFd) == -1)
+        errExit("close input");
+    if (close(outputFd) == -1)
+        errExit("close output");
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,472 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 5 */
+
+/* rand_io_bench.c
+
+   Measure random-access I/O on a file, reporting operations per second
+   and the distribution of the latency of individual operations.
+
+   Usage: rand_io_bench [-s size] [-b io-size] [-r read-pct] [-q depth]
+                        [-t secs] [-e engines] [-D] [-k] file
+
+        -s size      Size of the region of the file that is accessed; a
+                     number with an optional suffix 'k', 'm', 'g', or 't'
+                     (powers of 1024) (default: 1g)
+        -b io-size   Size of each read or write (default: 4k)
+        -r read-pct  Percentage of operations that are reads; the rest
+                     are writes (default: 100)
+        -q depth     Number of operations in flight: the number of threads
+                     for the 'p' and 'm' engines, and the number of
+                     operations queued in io_uring for 'u' (default: 1)
+        -t secs      Duration of each test (default: 5)
+        -e engines   Any of 'p' (pread() and pwrite()), 'm' (memcpy() to
+                     and from a shared mapping of the file), and 'u'
+                     (io_uring, via direct_io.c) (default: pmu)
+        -D           Open the file with O_DIRECT (the 'm' engine is then
+                     skipped)
+        -k           Keep the file (by default, it is removed at the end
+                     if this program created it)
+
+   If the file is smaller than 'size', it is extended with ftruncate(),
+   which creates a sparse file (see Section 4.7), so a region of any size
+   that the file system allows (many terabytes) can be tested without
+   consuming disk space. Bear in mind that reading a hole returns zeros
+   without any device I/O; to measure the device, first fill the file
+   (for example, with a run with "-r 0", which allocates the blocks that
+   it writes), or use an existing file. Offsets are chosen uniformly at
+   random, aligned to 'io-size'.
+
+   For each engine, the program prints:
+
+        IOPS       Operations completed per second
+        MB/s       Data transferred per second (MB = 1,000,000 bytes)
+        p50...max  Latency percentiles, in microseconds: the time from
+                   the start of each operation (for io_uring, from when
+                   it was queued) until its completion
+
+   The latencies are counted in a histogram whose buckets are 1/16 of a
+   power of two wide, so the percentiles are accurate to about 6%.
+
+   Try: ./rand_io_bench -s 1t -t 2 /tmp/rio
+        ./rand_io_bench -s 256m -r 70 -q 16 -e pu -k /var/tmp/rio
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "direct_io.h"
+#include "tlpi_hdr.h"
+
+#define SUB_BITS 4              /* Histogram: 2^SUB_BITS buckets per
+                                   power of two */
+#define NBUCKETS (64 << SUB_BITS)
+
+enum engine { E_PREAD, E_MMAP, E_URING };
+
+struct stats {
+    long reads, writes;
+    long hist[NBUCKETS];        /* Latency counts */
+};
+
+struct worker {
+    pthread_t thread;
+    enum engine engine;
+    uint64_t seed;
+    struct stats st;
+};
+
+static int fd;
+static char *map;               /* For E_MMAP */
+static off_t fileSize;
+static size_t ioSize;
+static int readPct;
+static int depth;
+static uint64_t durationNs;
+
+static uint64_t
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Return a pseudorandom number (xorshift64*) */
+
+static uint64_t
+nextRand(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+/* Choose the offset and the kind (TRUE for a read) of an operation */
+
+static off_t
+nextOp(uint64_t *state, Boolean *isRead)
+{
+    uint64_t r;
+
+    r = nextRand(state);
+    *isRead = (int) (r % 100) < readPct;
+    return (off_t) ((r >> 7) % (fileSize / ioSize)) * ioSize;
+}
+
+/* Histogram bucket for 'ns': values below 2^SUB_BITS have their own
+   buckets; above that, each power of two is split into 2^SUB_BITS */
+
+static int
+bucketOf(uint64_t ns)
+{
+    int msb;
+
+    if (ns < (1 << SUB_BITS))
+        return ns;
+    msb = 63 - __builtin_clzll(ns);
+    return ((msb - SUB_BITS + 1) << SUB_BITS) +
+           ((ns >> (msb - SUB_BITS)) & ((1 << SUB_BITS) - 1));
+}
+
+/* Smallest value that falls in bucket 'b' */
+
+static uint64_t
+bucketMin(int b)
+{
+    int msb;
+
+    if (b < (1 << SUB_BITS))
+        return b;
+    msb = (b >> SUB_BITS) + SUB_BITS - 1;
+    return (uint64_t) ((1 << SUB_BITS) + (b & ((1 << SUB_BITS) - 1))) <<
+           (msb - SUB_BITS);
+}
+
+static void
+record(struct stats *st, Boolean isRead, uint64_t ns)
+{
+    if (isRead)
+        st->reads++;
+    else
+        st->writes++;
+    st->hist[bucketOf(ns)]++;
+}
+
+/* Perform synchronous operations (E_PREAD or E_MMAP) until the time is
+   up */
+
+static void *
+syncWorker(void *arg)
+{
+    struct worker *w = arg;
+    uint64_t start, end, done;
+    Boolean isRead;
+    char *buf;
+    off_t off;
+    int s;
+
+    s = posix_memalign((void **) &buf, 4096, ioSize);
+    if (s != 0)
+        errExitEN(s, "posix_memalign");
+    memset(buf, 'x', ioSize);
+
+    end = nowNs() + durationNs;
+    for (start = nowNs(); start < end; ) {
+        off = nextOp(&w->seed, &isRead);
+        if (w->engine == E_MMAP) {
+            if (isRead)
+                memcpy(buf, map + off, ioSize);
+            else
+                memcpy(map + off, buf, ioSize);
+        } else if (isRead) {
+            if (pread(fd, buf, ioSize, off) != (ssize_t) ioSize)
+                errExit("pread");
+        } else {
+            if (pwrite(fd, buf, ioSize, off) != (ssize_t) ioSize)
+                errExit("pwrite");
+        }
+        done = nowNs();
+        record(&w->st, isRead, done - start);
+        start = done;
+    }
+
+    free(buf);
+    return NULL;
+}
+
+/* Keep 'depth' operations in flight with io_uring until the time is up,
+   and then wait for the operations that are in flight */
+
+static void
+uringRun(struct worker *w, const struct dioAlign *da)
+{
+    struct dioCompletion c;
+    struct dioEngine eng;
+    uint64_t *startNs, end, now;
+    Boolean isRead;
+    char *buf;
+    off_t off;
+    int j, idx;
+
+    if (dioEngineInit(&eng, fd, depth, ioSize, da) == -1)
+        errExit("dioEngineInit");
+    startNs = calloc(depth, sizeof(uint64_t));
+    if (startNs == NULL)
+        errExit("calloc");
+    memset(eng.pool.mem, 'x', (size_t) depth * eng.pool.bufSize);
+
+    /* A buffer's index in the pool identifies the operation that uses
+       it. For a read, dioEngineRead() takes a buffer from the pool itself;
+       since the pool's free list is a stack, that is the buffer that we
+       have just put back. */
+
+    end = nowNs() + durationNs;
+    for (j = 0; ; j++) {
+        if (j >= depth) {
+            if (dioEngineComplete(&eng, &c) == -1)
+                errExit("dioEngineComplete");
+            if (c.res != (ssize_t) ioSize)
+                fatal("%s failed: %s", (c.op == DIO_READ) ? "read" : "write",
+                      (c.res == -1) ? strerror(c.err) : "short transfer");
+            now = nowNs();
+            idx = (c.buf - eng.pool.mem) / eng.pool.bufSize;
+            record(&w->st, c.op == DIO_READ, now - startNs[idx]);
+            dioPoolPut(&eng.pool, c.buf);
+            if (now >= end) {
+                if (eng.inFlight == 0)
+                    break;
+                continue;
+            }
+        }
+
+        off = nextOp(&w->seed, &isRead);
+        buf = dioPoolGet(&eng.pool);
+        idx = (buf - eng.pool.mem) / eng.pool.bufSize;
+        startNs[idx] = nowNs();
+        if (isRead) {
+            dioPoolPut(&eng.pool, buf);
+            if (dioEngineRead(&eng, off, ioSize) == -1)
+                errExit("dioEngineRead");
+        } else {
+            if (dioEngineWrite(&eng, buf, off, ioSize) == -1)
+                errExit("dioEngineWrite");
+        }
+    }
+
+    free(startNs);
+    dioEngineFree(&eng);
+}
+
+/* Print the 'frac' percentile of 'hist' (which counts 'n' operations) in
+   microseconds */
+
+static void
+printPercentile(const long *hist, long n, double frac)
+{
+    long seen;
+    int b;
+
+    seen = 0;
+    for (b = 0; b < NBUCKETS; b++) {
+        seen += hist[b];
+        if (seen >= n * frac)
+            break;
+    }
+    printf(" %9.1f", bucketMin(b) / 1000.0);
+}
+
+static void
+runEngine(enum engine engine, const struct dioAlign *da)
+{
+    static const char *names[] = { "pread", "mmap", "io_uring" };
+    struct worker *w;
+    struct stats tot;
+    uint64_t start, elapsed;
+    int j, k, nthreads, s;
+    long n;
+
+    nthreads = (engine == E_URING) ? 1 : depth;
+    w = calloc(nthreads, sizeof(struct worker));
+    if (w == NULL)
+        errExit("calloc");
+    for (j = 0; j < nthreads; j++) {
+        w[j].engine = engine;
+        w[j].seed = 0x9e3779b97f4a7c15ULL * (j + 1);
+    }
+
+    start = nowNs();
+    if (engine == E_URING) {
+        uringRun(&w[0], da);
+    } else {
+        for (j = 0; j < nthreads; j++) {
+            s = pthread_create(&w[j].thread, NULL, syncWorker, &w[j]);
+            if (s != 0)
+                errExitEN(s, "pthread_create");
+        }
+        for (j = 0; j < nthreads; j++) {
+            s = pthread_join(w[j].thread, NULL);
+            if (s != 0)
+                errExitEN(s, "pthread_join");
+        }
+    }
+    elapsed = nowNs() - start;
+
+    memset(&tot, 0, sizeof(tot));
+    for (j = 0; j < nthreads; j++) {
+        tot.reads += w[j].st.reads;
+        tot.writes += w[j].st.writes;
+        for (k = 0; k < NBUCKETS; k++)
+            tot.hist[k] += w[j].st.hist[k];
+    }
+    free(w);
+
+    n = tot.reads + tot.writes;
+    printf("%-9s %10.0f %9.1f", names[engine], n * 1e9 / elapsed,
+           (double) n * ioSize * 1e3 / elapsed);
+    printPercentile(tot.hist, n, 0.50);
+    printPercentile(tot.hist, n, 0.90);
+    printPercentile(tot.hist, n, 0.99);
+    printPercentile(tot.hist, n, 0.999);
+    printPercentile(tot.hist, n, 1.0);
+    printf("\n");
+}
+
+/* Convert a size with an optional 'k', 'm', 'g', or 't' suffix */
+
+static long long
+getSize(const char *arg, const char *name)
+{
+    long long val;
+    char *end;
+    int shift;
+
+    errno = 0;
+    val = strtoll(arg, &end, 10);
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    case 't': case 'T': shift = 40; end++; break;
+    default:            shift = 0;         break;
+    }
+    if (errno != 0 || end == arg || *end != '\0' || val <= 0 ||
+            val > (LLONG_MAX >> shift))
+        cmdLineErr("Bad %s: %s\n", name, arg);
+    return val << shift;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct dioAlign align, *da;
+    Boolean direct, keep, created;
+    const char *engines;
+    struct stat sb;
+    int opt, flags;
+
+    fileSize = 1LL << 30;
+    ioSize = 4096;
+    readPct = 100;
+    depth = 1;
+    durationNs = 5000000000ULL;
+    engines = "pmu";
+    direct = keep = FALSE;
+    while ((opt = getopt(argc, argv, "s:b:r:q:t:e:Dk")) != -1) {
+        switch (opt) {
+        case 's': fileSize = getSize(optarg, "size");                 break;
+        case 'b': ioSize = getSize(optarg, "I/O size");               break;
+        case 'r': readPct = getInt(optarg, 0, "-r");                  break;
+        case 'q': depth = getInt(optarg, GN_GT_0, "-q");              break;
+        case 't': durationNs = getInt(optarg, GN_GT_0, "-t") *
+                               1000000000ULL;                         break;
+        case 'e': engines = optarg;                                   break;
+        case 'D': direct = TRUE;                                      break;
+        case 'k': keep = TRUE;                                        break;
+        default:
+            usageErr("%s [-s size] [-b io-size] [-r read-pct] [-q depth]\n"
+                     "        [-t secs] [-e engines] [-D] [-k] file\n",
+                     argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usageErr("%s [-s size] [-b io-size] [-r read-pct] [-q depth]\n"
+                 "        [-t secs] [-e engines] [-D] [-k] file\n", argv[0]);
+    if (readPct > 100)
+        cmdLineErr("Read percentage must be at most 100\n");
+    if ((off_t) ioSize > fileSize)
+        cmdLineErr("I/O size is larger than the file size\n");
+    if (strspn(engines, "pmu") != strlen(engines))
+        cmdLineErr("Bad engine list: %s\n", engines);
+
+    /* Create or extend the file */
+
+    created = access(argv[optind], F_OK) == -1;
+    flags = O_RDWR | O_CREAT | (direct ? O_DIRECT : 0);
+    fd = open(argv[optind], flags, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        errExit("open %s", argv[optind]);
+    if (fstat(fd, &sb) == -1)
+        errExit("fstat");
+    if (sb.st_size < fileSize && ftruncate(fd, fileSize) == -1)
+        errExit("ftruncate");
+
+    /* Without O_DIRECT, the io_uring engine needs no particular
+       alignment */
+
+    if (direct) {
+        if (dioGetAlignment(fd, &align) == -1)
+            errExit("dioGetAlignment");
+        if (ioSize % align.offsetAlign != 0)
+            cmdLineErr("I/O size must be a multiple of %zu for O_DIRECT\n",
+                       align.offsetAlign);
+        da = NULL;
+    } else {
+        align.memAlign = align.offsetAlign = 1;
+        da = &align;
+    }
+
+    printf("%s: %lld bytes; %zu-byte I/Os; %d%% reads; depth %d%s\n",
+           argv[optind], (long long) fileSize, ioSize, readPct, depth,
+           direct ? "; O_DIRECT" : "");
+    printf("%-9s %10s %9s %9s %9s %9s %9s %9s\n", "engine", "IOPS", "MB/s",
+           "p50-us", "p90-us", "p99-us", "p99.9-us", "max-us");
+
+    if (strchr(engines, 'p') != NULL)
+        runEngine(E_PREAD, da);
+    if (strchr(engines, 'm') != NULL) {
+        if (direct) {
+            printf("mmap      (skipped with O_DIRECT)\n");
+        } else {
+            map = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+            if (map == MAP_FAILED)
+                errExit("mmap");
+            runEngine(E_MMAP, da);
+            if (munmap(map, fileSize) == -1)
+                errExit("munmap");
+        }
+    }
+    if (strchr(engines, 'u') != NULL)
+        runEngine(E_URING, da);
+
+    if (created && !keep && unlink(argv[optind]) == -1)
+        errExit("unlink");
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,263 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 5 */
+
+/* rec_io.c
+
+   Read and write the records of a file of fixed-size binary records,
+   transferring many records with each system call.
+
+   t_readv.c (Listing 5-2) shows how readv() gathers the pieces of one
+   record into separate buffers with a single system call. The functions
+   here do the same for runs of records: a request for 'n' consecutive
+   records, each with its own buffer, is performed by preadv() or
+   pwritev() with one iovec per record (up to IOV_MAX records per call),
+   rather than by 'n' calls to pread() or pwrite().
+
+   The calls are made with preadv2() and pwritev2() (Linux 4.6 and
+   later), which add a 'flags' argument:
+
+   RWF_DSYNC    (REC_DSYNC) Each write is synchronized as though the file
+                had been opened with O_DSYNC, without the cost being paid
+                by other writes to the file.
+
+   RWF_HIPRI    (REC_HIPRI) Use polled completion, which reduces latency
+                on fast devices. This has an effect only for files opened
+                with O_DIRECT, on devices with polling queues.
+
+   RWF_NOWAIT   (REC_NOWAIT) Transfer only data that is available without
+                blocking, such as data in the page cache (Linux 4.14 and
+                later; whether writes are supported depends on the
+                filesystem).
+
+   recSubmit() is for a program built around an event loop, which must
+   not block. If REC_NOWAIT was given to recInit(), recSubmit() first
+   tries the transfer with RWF_NOWAIT. If all of the data was transferred,
+   the request is complete when recSubmit() returns; otherwise, the rest
+   of the transfer is handed to a helper thread (from a thread pool; see
+   threads/thread_pool.c) that performs it without RWF_NOWAIT, and then
+   calls the request's 'done' function. In this way, the common case (the
+   data is cached) costs one system call and no thread switches. If the
+   file doesn't support RWF_NOWAIT (EOPNOTSUPP), requests are done by the
+   helper threads from then on.
+
+   recRead() and recWrite() are the blocking equivalents.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/uio.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include "rec_io.h"             /* Declares functions defined here */
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/* Initialize 'rf' for transfers of records of 'recSize' bytes on 'fd',
+   with the REC_* 'flags'. If REC_NOWAIT is specified, 'nthreads' helper
+   threads are created (at least one). Returns 0 on success, or -1 on
+   error. */
+
+int
+recInit(struct recFile *rf, int fd, size_t recSize, int flags,
+        int nthreads)
+{
+    if (recSize == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    rf->fd = fd;
+    rf->recSize = recSize;
+    rf->flags = flags;
+    rf->rwf = 0;
+    if (flags & REC_HIPRI)
+        rf->rwf |= RWF_HIPRI;
+    if (flags & REC_DSYNC)
+        rf->rwf |= RWF_DSYNC;
+    rf->noWaitOk = (flags & REC_NOWAIT) != 0;
+    rf->calls = rf->inlined = rf->deferred = 0;
+
+    rf->pool = NULL;
+    if (flags & REC_NOWAIT) {
+        rf->pool = tpCreate((nthreads > 0) ? nthreads : 1, 0);
+        if (rf->pool == NULL)
+            return -1;
+    }
+    return 0;
+}
+
+/* Perform as much of the rest of 'req' as possible, with the RWF_* flags
+   in 'extra' as well as the file's flags. Returns 0 when the request is
+   complete (or a read reaches end-of-file), or -1 on error; in either
+   case, 'doneBytes' records the progress. */
+
+static int
+transfer(struct recReq *req, int extra)
+{
+    struct recFile *rf = req->rf;
+    struct iovec iov[IOV_MAX];
+    size_t total, rec, skip, cnt, k;
+    ssize_t s;
+    off_t off;
+
+    total = req->n * rf->recSize;
+    while (req->doneBytes < total) {
+
+        /* Build an iovec for up to IOV_MAX records, starting part way
+           through a record if an earlier call transferred part of it */
+
+        rec = req->doneBytes / rf->recSize;
+        skip = req->doneBytes % rf->recSize;
+        cnt = (req->n - rec < IOV_MAX) ? req->n - rec : IOV_MAX;
+        for (k = 0; k < cnt; k++) {
+            iov[k].iov_base = req->bufs[rec + k];
+            iov[k].iov_len = rf->recSize;
+        }
+        iov[0].iov_base = (char *) iov[0].iov_base + skip;
+        iov[0].iov_len -= skip;
+        off = (req->first + rec) * rf->recSize + skip;
+
+        if (req->write)
+            s = pwritev2(rf->fd, iov, cnt, off, rf->rwf | extra);
+        else
+            s = preadv2(rf->fd, iov, cnt, off, rf->rwf | extra);
+        __atomic_add_fetch(&rf->calls, 1, __ATOMIC_RELAXED);
+
+        if (s == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (s == 0)                     /* End-of-file */
+            break;
+        req->doneBytes += s;
+    }
+    req->result = req->doneBytes / rf->recSize;
+    return 0;
+}
+
+/* Complete a request in a helper thread */
+
+static void
+helper(void *arg)
+{
+    struct recReq *req = arg;
+
+    if (transfer(req, 0) == -1) {
+        req->err = errno;
+        req->result = -1;
+    }
+    if (req->done != NULL)
+        req->done(req);
+}
+
+/* Start the transfer described by 'req'. Returns 1 if the request has
+   completed (successfully or not; see 'result' and 'err'), 0 if it has
+   been handed to a helper thread (which calls req->done() when it
+   completes), or -1 if the request could not be started. 'req' and its
+   buffers must not be touched while the request is in progress. */
+
+int
+recSubmit(struct recFile *rf, struct recReq *req)
+{
+    req->rf = rf;
+    req->doneBytes = 0;
+    req->result = -1;
+    req->err = 0;
+
+    if (!(rf->flags & REC_NOWAIT)) {
+        if (transfer(req, 0) == -1) {
+            req->err = errno;
+            req->result = -1;
+        }
+        return 1;
+    }
+
+    if (__atomic_load_n(&rf->noWaitOk, __ATOMIC_RELAXED)) {
+        if (transfer(req, RWF_NOWAIT) == 0) {
+            __atomic_add_fetch(&rf->inlined, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+        if (errno == EOPNOTSUPP)
+            __atomic_store_n(&rf->noWaitOk, 0, __ATOMIC_RELAXED);
+        else if (errno != EAGAIN) {
+            req->err = errno;
+            req->result = -1;
+            return 1;
+        }
+    }
+
+    /* The transfer would block: let a helper thread finish it */
+
+    if (tpSubmit(rf->pool, helper, req) == -1)
+        return -1;
+    __atomic_add_fetch(&rf->deferred, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Wait until all of the requests handed to helper threads have
+   completed */
+
+void
+recWait(struct recFile *rf)
+{
+    if (rf->pool != NULL)
+        tpWait(rf->pool);
+}
+
+static ssize_t
+blocking(struct recFile *rf, int write, off_t first, void **bufs,
+         size_t n)
+{
+    struct recReq req;
+
+    req.write = write;
+    req.first = first;
+    req.n = n;
+    req.bufs = bufs;
+    req.rf = rf;
+    req.doneBytes = 0;
+    return (transfer(&req, 0) == -1) ? -1 : req.result;
+}
+
+/* Read the 'n' records starting at record 'first' into the buffers
+   'bufs[0]'..'bufs[n - 1]'. Returns the number of whole records read
+   (fewer than 'n' at end-of-file), or -1 on error. */
+
+ssize_t
+recRead(struct recFile *rf, off_t first, void **bufs, size_t n)
+{
+    return blocking(rf, 0, first, bufs, n);
+}
+
+/* Write the 'n' records in 'bufs' as records 'first' onward. Returns 'n',
+   or -1 on error. */
+
+ssize_t
+recWrite(struct recFile *rf, off_t first, void **bufs, size_t n)
+{
+    return blocking(rf, 1, first, bufs, n);
+}
+
+/* Wait for deferred requests, and free the helper threads. (The file
+   descriptor is not closed.) */
+
+void
+recFree(struct recFile *rf)
+{
+    if (rf->pool != NULL)
+        tpDestroy(rf->pool);
+    rf->pool = NULL;
+}
@@ -0,0 +1,74 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 5 */
+
+/* rec_io.h
+
+   Header file for rec_io.c.
+*/
+#ifndef REC_IO_H
+#define REC_IO_H                /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include "thread_pool.h"
+
+#define REC_NOWAIT  01          /* Try RWF_NOWAIT; finish blocking transfers
+                                   in a helper thread */
+#define REC_HIPRI   02          /* RWF_HIPRI (polled I/O; needs O_DIRECT) */
+#define REC_DSYNC   04          /* RWF_DSYNC (each write is synchronized) */
+
+struct recFile {
+    int fd;
+    size_t recSize;             /* Bytes per record */
+    int flags;                  /* REC_* */
+    int rwf;                    /* RWF_* flags for every transfer */
+    int noWaitOk;               /* Cleared if RWF_NOWAIT is unsupported */
+    struct threadPool *pool;    /* Helper threads (REC_NOWAIT only) */
+    unsigned long calls;        /* preadv2() and pwritev2() calls */
+    unsigned long inlined;      /* REC_NOWAIT requests done without
+                                   blocking */
+    unsigned long deferred;     /* REC_NOWAIT requests given to a helper */
+};
+
+struct recReq;
+
+typedef void (*recDoneFunc)(struct recReq *req);
+
+struct recReq {                 /* A transfer of 'n' consecutive records */
+    int write;                  /* 0 for read, 1 for write */
+    off_t first;                /* Number of the first record */
+    size_t n;
+    void **bufs;                /* 'n' buffers, each of 'recSize' bytes */
+    recDoneFunc done;           /* Called (in a helper thread) when a
+                                   deferred request completes; may be NULL */
+    void *arg;                  /* For use by the caller */
+
+    ssize_t result;             /* Records transferred, or -1 */
+    int err;                    /* errno value, if 'result' is -1 */
+
+    struct recFile *rf;         /* Private to rec_io.c */
+    size_t doneBytes;
+};
+
+int recInit(struct recFile *rf, int fd, size_t recSize, int flags,
+            int nthreads);
+
+ssize_t recRead(struct recFile *rf, off_t first, void **bufs, size_t n);
+
+ssize_t recWrite(struct recFile *rf, off_t first, void **bufs, size_t n);
+
+int recSubmit(struct recFile *rf, struct recReq *req);
+
+void recWait(struct recFile *rf);
+
+void recFree(struct recFile *rf);
+
+#endif
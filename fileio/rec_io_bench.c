@@ -0,0 +1,286 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 5 */
+
+/* rec_io_bench.c
+
+   Compare the cost of reading and writing the records of a file of
+   fixed-size records one at a time, with pread() and pwrite(), and in
+   batches, with the functions in rec_io.c.
+
+   Usage: rec_io_bench [-r recsize] [-n nrecs] [-b batch] [-s] [-H] [-D]
+                       file
+
+        -r recsize   Record size in bytes (default: 128)
+        -n nrecs     Number of records in the file (default: 65536)
+        -b batch     Records per batch (default: 64)
+        -s           Use REC_DSYNC for the batched writes, and a file
+                     descriptor opened with O_DSYNC for pwrite() (slow)
+        -H           Use REC_HIPRI (and open the file with O_DIRECT, so
+                     'recsize' must be a multiple of the device's block
+                     size)
+        -D           Open the file with O_DIRECT
+
+   'file' is created (or truncated), filled with 'nrecs' records, and
+   removed at the end. Each benchmark transfers batches of 'batch'
+   consecutive records, beginning at randomly chosen records, each into
+   or out of its own buffer: one system call per record with pread() and
+   pwrite(), and one per batch with recRead() and recWrite(). The
+   REC_NOWAIT benchmark uses recSubmit(), which, when the data is in the
+   page cache, completes each batch with a single preadv2() call; the
+   counts of requests that completed at once and that were given to a
+   helper thread are shown. Before it is measured, each read method is
+   checked to return the right records. The results are reported in the
+   common format of lib/bench.c, in terms of the cost per record.
+
+   Try: ./rec_io_bench /tmp/recs
+        ./rec_io_bench -b 8 -r 32 /tmp/recs
+        ./rec_io_bench -r 4096 -D /var/tmp/recs
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include "rec_io.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+enum method { M_PREAD, M_PWRITE, M_READ, M_WRITE, M_SUBMIT };
+
+struct run {
+    enum method method;
+    struct recFile *rf;
+    long next;                  /* Index in 'starts' of the next batch */
+};
+
+static int fd, wfd;             /* 'wfd' is used by pwrite() */
+static size_t recSize;
+static long nrecs;
+static size_t batch;
+static void **bufs;             /* 'batch' record buffers */
+static long *starts;            /* First records of the batches */
+static long nstarts;
+
+static volatile unsigned long sink;     /* Defeats dead code elimination */
+
+/* Fill 'buf' with the contents of record 'rec' */
+
+static void
+fillRec(char *buf, long rec)
+{
+    size_t j;
+
+    for (j = 0; j < recSize; j++)
+        buf[j] = (char) (rec * 31 + j);
+}
+
+static void
+transfer(long ops, void *arg)
+{
+    struct run *r = arg;
+    struct recReq req;
+    unsigned long sum;
+    long j, first;
+    size_t k;
+
+    sum = 0;
+    for (j = 0; j < ops; j += batch) {
+        first = starts[r->next++ % nstarts];
+
+        switch (r->method) {
+        case M_PREAD:
+            for (k = 0; k < batch; k++)
+                if (pread(fd, bufs[k], recSize,
+                          (first + k) * recSize) != (ssize_t) recSize)
+                    fatal("pread() failed");
+            break;
+
+        case M_PWRITE:
+            for (k = 0; k < batch; k++)
+                if (pwrite(wfd, bufs[k], recSize,
+                           (first + k) * recSize) != (ssize_t) recSize)
+                    fatal("pwrite() failed");
+            break;
+
+        case M_READ:
+            if (recRead(r->rf, first, bufs, batch) != (ssize_t) batch)
+                fatal("recRead() failed");
+            break;
+
+        case M_WRITE:
+            if (recWrite(r->rf, first, bufs, batch) != (ssize_t) batch)
+                fatal("recWrite() failed");
+            break;
+
+        case M_SUBMIT:
+            req.write = 0;
+            req.first = first;
+            req.n = batch;
+            req.bufs = bufs;
+            req.done = NULL;
+            if (recSubmit(r->rf, &req) == -1)
+                errExit("recSubmit");
+            recWait(r->rf);             /* In case it was deferred */
+            if (req.result != (ssize_t) batch)
+                fatal("recSubmit() failed");
+            break;
+        }
+        sum += *(unsigned char *) bufs[batch - 1];
+    }
+    sink = sum;
+}
+
+/* Check that a read method returns the right records */
+
+static void
+check(const char *name, struct run *r)
+{
+    char *expect;
+    long j, first;
+    size_t k;
+
+    expect = malloc(recSize);
+    if (expect == NULL)
+        errExit("malloc");
+
+    r->next = 0;
+    for (j = 0; j < nstarts && j < 100; j++) {
+        for (k = 0; k < batch; k++)
+            memset(bufs[k], 0, recSize);
+        first = starts[r->next];
+        transfer(batch, r);             /* Reads one batch */
+        for (k = 0; k < batch; k++) {
+            fillRec(expect, first + k);
+            if (memcmp(bufs[k], expect, recSize) != 0)
+                fatal("%s: record %ld is wrong", name, first + (long) k);
+        }
+    }
+    free(expect);
+}
+
+static void
+run(const char *name, struct run *r)
+{
+    struct benchResult res;
+
+    if (r->method != M_PWRITE && r->method != M_WRITE)
+        check(name, r);
+    if (benchRun(name, transfer, r, nstarts * batch, NULL, &res) == -1)
+        errExit("benchRun");
+    benchReport(&res);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct recFile rfSync, rfNoWait, rfWrite;
+    int opt, openFlags, recFlags;
+    struct run r;
+    char name[64];
+    long j;
+    size_t k;
+
+    recSize = 128;
+    nrecs = 65536;
+    batch = 64;
+    openFlags = 0;
+    recFlags = 0;
+    while ((opt = getopt(argc, argv, "r:n:b:sHD")) != -1) {
+        switch (opt) {
+        case 'r': recSize = getLong(optarg, GN_GT_0, "-r");     break;
+        case 'n': nrecs = getLong(optarg, GN_GT_0, "-n");       break;
+        case 'b': batch = getLong(optarg, GN_GT_0, "-b");       break;
+        case 's': recFlags |= REC_DSYNC;                        break;
+        case 'H': recFlags |= REC_HIPRI; openFlags |= O_DIRECT; break;
+        case 'D': openFlags |= O_DIRECT;                        break;
+        default:
+            usageErr("%s [-r recsize] [-n nrecs] [-b batch] [-s] [-H] [-D] "
+                     "file\n", argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usageErr("%s [-r recsize] [-n nrecs] [-b batch] [-s] [-H] [-D] "
+                 "file\n", argv[0]);
+    if ((long) batch > nrecs)
+        cmdLineErr("Batch is larger than the file\n");
+
+    /* Record buffers are page-aligned, as O_DIRECT may require */
+
+    bufs = calloc(batch, sizeof(void *));
+    if (bufs == NULL)
+        errExit("calloc");
+    for (k = 0; k < batch; k++)
+        if (posix_memalign(&bufs[k], 4096, recSize) != 0)
+            fatal("posix_memalign() failed");
+
+    nstarts = nrecs / batch;
+    starts = calloc(nstarts, sizeof(long));
+    if (starts == NULL)
+        errExit("calloc");
+    srandom(1);
+    for (j = 0; j < nstarts; j++)
+        starts[j] = random() % (nrecs - batch + 1);
+
+    fd = open(argv[optind], O_RDWR | O_CREAT | O_TRUNC | openFlags,
+              S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        errExit("open %s", argv[optind]);
+
+    wfd = fd;
+    if (recFlags & REC_DSYNC) {
+        wfd = open(argv[optind], O_WRONLY | O_DSYNC | openFlags);
+        if (wfd == -1)
+            errExit("open %s", argv[optind]);
+    }
+
+    if (recInit(&rfSync, fd, recSize, recFlags & ~REC_DSYNC, 0) == -1 ||
+            recInit(&rfNoWait, fd, recSize,
+                    (recFlags & ~REC_DSYNC) | REC_NOWAIT, 1) == -1 ||
+            recInit(&rfWrite, fd, recSize, recFlags, 0) == -1)
+        errExit("recInit");
+
+    /* Create the file, writing one batch at a time */
+
+    for (j = 0; j < nrecs; j += k) {
+        for (k = 0; k < batch && j + (long) k < nrecs; k++)
+            fillRec(bufs[k], j + k);
+        if (recWrite(&rfSync, j, bufs, k) != (ssize_t) k)
+            errExit("recWrite");
+    }
+
+    printf("%ld records of %zu bytes; batches of %zu records\n",
+           nrecs, recSize, batch);
+
+    r.next = 0;
+    r.method = M_PREAD;
+    run("pread(), per record", &r);
+    r.method = M_READ;
+    r.rf = &rfSync;
+    snprintf(name, sizeof(name), "recRead(), %zu per call", batch);
+    run(name, &r);
+    r.method = M_SUBMIT;
+    r.rf = &rfNoWait;
+    run("recSubmit(), REC_NOWAIT", &r);
+    printf("    %lu requests completed at once; %lu deferred\n",
+           rfNoWait.inlined, rfNoWait.deferred);
+
+    r.method = M_PWRITE;
+    run("pwrite(), per record", &r);
+    r.method = M_WRITE;
+    r.rf = &rfWrite;
+    snprintf(name, sizeof(name), "recWrite(), %zu per call", batch);
+    run(name, &r);
+
+    recFree(&rfNoWait);
+    if (unlink(argv[optind]) == -1)
+        errExit("unlink");
+    exit(EXIT_SUCCESS);
+}
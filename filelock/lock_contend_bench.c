@@ -0,0 +1,313 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 55 */
+
+/* lock_contend_bench.c
+
+   Measure how well flock() locks, traditional fcntl() record locks, and
+   open file description (OFD) record locks perform when several
+   processes (or threads) contend for an exclusive lock on a whole file.
+
+   Usage: lock_contend_bench [-T] [-w workers-list] [-d secs]
+                             [-h hold-usecs] [-m methods] [file]
+
+        -T               Use threads rather than processes. Traditional
+                         fcntl() locks don't exclude threads of the same
+                         process, so that method is then skipped.
+        -w workers-list  Comma-separated list of numbers of workers
+                         (default: 1,2,4,8)
+        -d secs          Duration of each test (default: 2)
+        -h hold-usecs    Time for which each worker holds the lock,
+                         busy-waiting (default: 0)
+        -m methods       Any of 'f' (flock), 'p' (fcntl), and 'o' (OFD)
+                         (default: fpo)
+        file             File to lock (default: a temporary file in the
+                         current directory). To measure the locks of a
+                         network file system such as NFS, give the name
+                         of a file on that file system.
+
+   Each worker opens the file itself, and then repeatedly locks the file,
+   holds the lock for the specified time, and unlocks it. For each test,
+   the program shows:
+
+        acq/s      Lock acquisitions per second, by all workers together
+        mean-wait  Mean time that a worker waited to acquire the lock
+        max-wait   Maximum time that any worker waited
+        fairness   The number of acquisitions made by the least
+                   successful worker, divided by that of the most
+                   successful one (1.00 means that they had equal shares)
+        excl       "ok", or "FAIL" if two workers ever held the lock at
+                   the same time
+
+   The statistics are kept in a shared anonymous mapping, so that the
+   same code serves for processes and threads.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include "region_locking.h"
+#include "tlpi_hdr.h"
+
+#define MAX_WORKERS 1024
+
+struct workerStats {
+    long acquisitions;
+    long long totalWaitNs;
+    long long maxWaitNs;
+};
+
+struct shared {
+    int stop;                           /* Set when test should end */
+    int holders;                        /* Workers now holding the lock */
+    int violations;                     /* Times 'holders' exceeded 1 */
+    struct workerStats ws[MAX_WORKERS];
+};
+
+static struct shared *sh;
+static const char *path;
+static char method;                     /* 'f', 'p', or 'o' */
+static long holdNs;
+static int goFd;                        /* Read end of "start" pipe */
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int
+lockFile(int fd, Boolean lock)
+{
+    switch (method) {
+    case 'f':
+        return flock(fd, lock ? LOCK_EX : LOCK_UN);
+    case 'p':
+        return lockRegionWait(fd, lock ? F_WRLCK : F_UNLCK, SEEK_SET, 0, 0);
+    default:
+        return lockRegionOfdWait(fd, lock ? F_WRLCK : F_UNLCK,
+                                 SEEK_SET, 0, 0);
+    }
+}
+
+static void
+worker(long id)
+{
+    struct workerStats *ws = &sh->ws[id];
+    long long t0, waitNs, until;
+    char ch;
+    int fd;
+
+    fd = open(path, O_RDWR);
+    if (fd == -1)
+        errExit("open");
+
+    if (read(goFd, &ch, 1) == -1)       /* Returns 0 when test starts */
+        errExit("read");
+
+    while (!__atomic_load_n(&sh->stop, __ATOMIC_RELAXED)) {
+        t0 = nowNs();
+        if (lockFile(fd, TRUE) == -1)
+            errExit("lock");
+        waitNs = nowNs() - t0;
+
+        if (__atomic_add_fetch(&sh->holders, 1, __ATOMIC_SEQ_CST) > 1)
+            __atomic_add_fetch(&sh->violations, 1, __ATOMIC_RELAXED);
+        if (holdNs > 0)
+            for (until = nowNs() + holdNs; nowNs() < until; )
+                continue;
+        __atomic_sub_fetch(&sh->holders, 1, __ATOMIC_SEQ_CST);
+
+        if (lockFile(fd, FALSE) == -1)
+            errExit("unlock");
+
+        ws->acquisitions++;
+        ws->totalWaitNs += waitNs;
+        if (waitNs > ws->maxWaitNs)
+            ws->maxWaitNs = waitNs;
+    }
+
+    close(fd);
+}
+
+static void *
+threadFunc(void *arg)
+{
+    worker((long) arg);
+    return NULL;
+}
+
+/* Run one test with 'n' workers, and print its results */
+
+static void
+runTest(int n, Boolean useThreads, int secs)
+{
+    pthread_t tids[MAX_WORKERS];
+    long long elapsed, totalWait, maxWait;
+    long j, total, minAcq, maxAcq;
+    int pfd[2], s;
+    const char *name;
+
+    memset(sh, 0, sizeof(struct shared));
+    if (pipe(pfd) == -1)
+        errExit("pipe");
+    goFd = pfd[0];
+    fflush(stdout);                     /* Don't duplicate in children */
+
+    for (j = 0; j < n; j++) {
+        if (useThreads) {
+            s = pthread_create(&tids[j], NULL, threadFunc, (void *) j);
+            if (s != 0)
+                errExitEN(s, "pthread_create");
+        } else {
+            switch (fork()) {
+            case -1:
+                errExit("fork");
+            case 0:
+                close(pfd[1]);
+                worker(j);
+                _exit(EXIT_SUCCESS);
+            default:
+                break;
+            }
+        }
+    }
+
+    /* Start all workers at once by closing the pipe, and stop them after
+       'secs' seconds */
+
+    elapsed = nowNs();
+    close(pfd[1]);
+    sleep(secs);
+    __atomic_store_n(&sh->stop, 1, __ATOMIC_RELAXED);
+
+    for (j = 0; j < n; j++) {
+        if (useThreads) {
+            s = pthread_join(tids[j], NULL);
+            if (s != 0)
+                errExitEN(s, "pthread_join");
+        } else {
+            if (wait(NULL) == -1)
+                errExit("wait");
+        }
+    }
+    elapsed = nowNs() - elapsed;
+    close(pfd[0]);
+
+    total = 0;
+    totalWait = maxWait = 0;
+    minAcq = maxAcq = sh->ws[0].acquisitions;
+    for (j = 0; j < n; j++) {
+        total += sh->ws[j].acquisitions;
+        totalWait += sh->ws[j].totalWaitNs;
+        if (sh->ws[j].maxWaitNs > maxWait)
+            maxWait = sh->ws[j].maxWaitNs;
+        if (sh->ws[j].acquisitions < minAcq)
+            minAcq = sh->ws[j].acquisitions;
+        if (sh->ws[j].acquisitions > maxAcq)
+            maxAcq = sh->ws[j].acquisitions;
+    }
+
+    name = (method == 'f') ? "flock" : (method == 'p') ? "fcntl" : "ofd";
+    printf("%8d %-6s %12.0f %14.1f %14.1f %9.2f %5s\n", n, name,
+           total / (elapsed / 1e9),
+           (total > 0) ? totalWait / 1000.0 / total : 0.0,
+           maxWait / 1000.0,
+           (maxAcq > 0) ? (double) minAcq / maxAcq : 0.0,
+           (sh->violations == 0) ? "ok" : "FAIL");
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-T] [-w workers-list] [-d secs] "
+            "[-h hold-usecs] [-m methods] [file]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char tmpl[] = "lock_contend_bench_XXXXXX";
+    char *workersList, *tok, *saveptr;
+    const char *methods, *m;
+    Boolean useThreads;
+    int opt, n, fd, secs;
+
+    useThreads = FALSE;
+    workersList = NULL;
+    secs = 2;
+    holdNs = 0;
+    methods = "fpo";
+    while ((opt = getopt(argc, argv, "Tw:d:h:m:")) != -1) {
+        switch (opt) {
+        case 'T': useThreads = TRUE;                                    break;
+        case 'w': workersList = strdup(optarg);                         break;
+        case 'd': secs = getInt(optarg, GN_GT_0, "secs");               break;
+        case 'h': holdNs = getLong(optarg, 0, "hold-usecs") * 1000;     break;
+        case 'm': methods = optarg;                                     break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (optind + 1 < argc || methods[strspn(methods, "fpo")] != '\0')
+        usageError(argv[0]);
+    if (workersList == NULL)
+        workersList = strdup("1,2,4,8");
+    if (workersList == NULL)
+        errExit("strdup");
+
+    if (optind < argc) {
+        path = argv[optind];
+        fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    } else {
+        fd = mkstemp(tmpl);
+        path = tmpl;
+    }
+    if (fd == -1)
+        errExit("open");
+    close(fd);
+
+    sh = mmap(NULL, sizeof(struct shared), PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (sh == MAP_FAILED)
+        errExit("mmap");
+
+    printf("%s; hold %ld us; %d s per test\n\n",
+           useThreads ? "threads" : "processes", holdNs / 1000, secs);
+    printf("%8s %-6s %12s %14s %14s %9s %5s\n", "workers", "method",
+           "acq/s", "mean-wait(us)", "max-wait(us)", "fairness", "excl");
+
+    for (tok = strtok_r(workersList, ",", &saveptr); tok != NULL;
+            tok = strtok_r(NULL, ",", &saveptr)) {
+        n = getInt(tok, GN_GT_0, "workers");
+        if (n > MAX_WORKERS)
+            cmdLineErr("At most %d workers\n", MAX_WORKERS);
+
+        for (m = methods; *m != '\0'; m++) {
+            if (*m == 'p' && useThreads)
+                continue;
+            method = *m;
+            runTest(n, useThreads, secs);
+        }
+    }
+
+    if (optind == argc)
+        unlink(tmpl);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,301 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 55 */
+
+/* lock_range_bench.c
+
+   Measure the throughput of record lock/unlock operations made by many
+   threads on non-overlapping ranges of a file, using traditional
+   (process-associated) locks (lockRegionWait()), open file description
+   locks (lockRegionOfdWait(); see region_locking.c), and a range lock
+   table shared by the threads (rlLock(); see range_lock.c).
+
+   Usage: lock_range_bench [-t threads-list] [-n ops] [-w window]
+                           [-c] [file]
+
+        -t threads-list  Comma-separated list of thread counts
+                         (default: 1,2,4,8)
+        -n ops           Lock/unlock pairs per thread (default: 100000)
+        -w window        Number of locks each thread holds at once
+                         (default: 1). Each thread locks successive
+                         ranges, and unlocks each range 'window'
+                         operations after locking it, so that the
+                         file has threads * window locks at any time.
+        -c               Instead, have all threads contend for a lock
+                         on the same byte, and, while holding it,
+                         increment a shared counter non-atomically
+                         (yielding the CPU in between);
+                         report the number of lost increments
+        file             File to lock (default: a temporary file)
+
+   Each thread opens the file itself (as is required for OFD locks to
+   exclude one another; traditional locks never conflict between
+   threads of one process). For the range lock table, all threads use a
+   single table, created on one file descriptor. Each thread's ranges
+   are 1 byte long, and interleaved with those of the other threads.
+
+   The -c option shows why traditional locks can't be used between
+   threads: every thread's lock request is granted at once, and
+   increments are lost, whereas OFD locks and the range lock table
+   exclude one another. For the range lock table, the program also
+   shows the number of fcntl() calls made per lock; with -c, the kernel
+   lock is handed from thread to thread, and this number is small.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "region_locking.h"
+#include "range_lock.h"
+#include "tlpi_hdr.h"
+
+#define MAX_THREADS 1024
+
+#define M_POSIX 0                       /* Values for 'method' */
+#define M_OFD   1
+#define M_RL    2
+
+static const char *path;
+static long numOps;
+static long window;
+static Boolean contend;
+static int method;
+static int numThreads;
+static struct rlTable *table;           /* For M_RL */
+static pthread_barrier_t barrier;
+
+static volatile long sharedCounter;     /* For -c */
+
+/* Lock or unlock a range; for M_RL, 'handle' is where the handle
+   returned by rlLock() is stored and retrieved */
+
+static int
+lockRange(int fd, int type, off_t start, struct rlRange **handle)
+{
+    switch (method) {
+    case M_POSIX:
+        return lockRegionWait(fd, type, SEEK_SET, start, 1);
+    case M_OFD:
+        return lockRegionOfdWait(fd, type, SEEK_SET, start, 1);
+    default:
+        if (type == F_UNLCK)
+            return rlUnlock(table, *handle);
+        *handle = rlLock(table, type, start, 1);
+        return (*handle == NULL) ? -1 : 0;
+    }
+}
+
+static void *
+threadFunc(void *arg)
+{
+    long id = (long) arg;
+    struct rlRange **handles;
+    off_t start;
+    long j, val;
+    int fd, s;
+
+    fd = open(path, O_RDWR);
+    if (fd == -1)
+        errExit("open");
+    handles = calloc(window, sizeof(struct rlRange *));
+    if (handles == NULL)
+        errExit("calloc");
+
+    s = pthread_barrier_wait(&barrier);
+    if (s != 0 && s != PTHREAD_BARRIER_SERIAL_THREAD)
+        errExitEN(s, "pthread_barrier_wait");
+
+    for (j = 0; j < numOps; j++) {
+        if (contend) {
+            if (lockRange(fd, F_WRLCK, 0, &handles[0]) == -1)
+                errExit("lock");
+            val = sharedCounter;
+            sched_yield();              /* Invite another thread in */
+            sharedCounter = val + 1;
+            if (lockRange(fd, F_UNLCK, 0, &handles[0]) == -1)
+                errExit("unlock");
+            continue;
+        }
+
+        /* Ranges j * numThreads + id are ours */
+
+        start = j * numThreads + id;
+        if (lockRange(fd, F_WRLCK, start, &handles[j % window]) == -1)
+            errExit("lock");
+        if (j >= window - 1 &&
+                lockRange(fd, F_UNLCK, start - (window - 1) * numThreads,
+                          &handles[(j + 1) % window]) == -1)
+            errExit("unlock");
+    }
+
+    if (method == M_RL)                 /* Release remaining locks */
+        for (j = (numOps < window - 1) ? 0 : numOps - (window - 1);
+                j < numOps; j++)
+            if (rlUnlock(table, handles[j % window]) == -1)
+                errExit("rlUnlock");
+
+    free(handles);
+    close(fd);                          /* Releases remaining OFD locks */
+    return NULL;
+}
+
+/* Run one test, returning lock/unlock pairs per second. For M_RL, the
+   table's statistics are returned in '*stats'. */
+
+static double
+runTest(int nthreads, int meth, struct rlStats *stats)
+{
+    pthread_t tids[MAX_THREADS];
+    struct timespec t0, t1;
+    double secs;
+    long j;
+    int s, fd;
+
+    numThreads = nthreads;
+    method = meth;
+    sharedCounter = 0;
+
+    fd = -1;
+    if (method == M_RL) {
+        fd = open(path, O_RDWR);
+        if (fd == -1)
+            errExit("open");
+        table = rlCreate(fd);
+        if (table == NULL)
+            errExit("rlCreate");
+    }
+
+    s = pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_init");
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_create(&tids[j], NULL, threadFunc, (void *) j);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    s = pthread_barrier_wait(&barrier);
+    if (s != 0 && s != PTHREAD_BARRIER_SERIAL_THREAD)
+        errExitEN(s, "pthread_barrier_wait");
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_join(tids[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_barrier_destroy(&barrier);
+
+    if (method == M_RL) {
+        rlGetStats(table, stats);
+        rlDestroy(table);
+        close(fd);
+    }
+
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    return nthreads * numOps / secs;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-t threads-list] [-n ops] [-w window] "
+            "[-c] [file]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char tmpl[] = "/tmp/lock_range_bench_XXXXXX";
+    char *threadsList, *tok, *saveptr;
+    double posixRate, ofdRate, rlRate;
+    long posixLost, ofdLost, rlLost;
+    struct rlStats stats;
+    int opt, nthreads, fd;
+
+    threadsList = NULL;
+    numOps = 100000;
+    window = 1;
+    contend = FALSE;
+    while ((opt = getopt(argc, argv, "t:n:w:c")) != -1) {
+        switch (opt) {
+        case 't': threadsList = strdup(optarg);                         break;
+        case 'n': numOps = getLong(optarg, GN_GT_0, "ops");             break;
+        case 'w': window = getLong(optarg, GN_GT_0, "window");          break;
+        case 'c': contend = TRUE;                                       break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (optind + 1 < argc)
+        usageError(argv[0]);
+    if (threadsList == NULL)
+        threadsList = strdup("1,2,4,8");
+    if (threadsList == NULL)
+        errExit("strdup");
+
+    if (optind < argc) {
+        path = argv[optind];
+        fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    } else {
+        fd = mkstemp(tmpl);
+        path = tmpl;
+    }
+    if (fd == -1)
+        errExit("open");
+    close(fd);
+
+    /* Verify that OFD locks are available */
+
+    fd = open(path, O_RDWR);
+    if (fd == -1)
+        errExit("open");
+    if (lockRegionOfd(fd, F_WRLCK, SEEK_SET, 0, 1) == -1)
+        errExit("lockRegionOfd");
+    close(fd);
+
+    if (contend)
+        printf("%8s %12s %10s %12s %10s %12s %10s %9s\n", "threads",
+               "posix ops/s", "posix lost", "ofd ops/s", "ofd lost",
+               "rl ops/s", "rl lost", "calls/op");
+    else
+        printf("%8s %14s %14s %14s %9s   (window = %ld)\n", "threads",
+               "posix ops/s", "ofd ops/s", "rl ops/s", "calls/op", window);
+
+    for (tok = strtok_r(threadsList, ",", &saveptr); tok != NULL;
+            tok = strtok_r(NULL, ",", &saveptr)) {
+        nthreads = getInt(tok, GN_GT_0, "threads");
+        if (nthreads > MAX_THREADS)
+            cmdLineErr("At most %d threads\n", MAX_THREADS);
+
+        posixRate = runTest(nthreads, M_POSIX, NULL);
+        posixLost = nthreads * numOps - sharedCounter;
+        ofdRate = runTest(nthreads, M_OFD, NULL);
+        ofdLost = nthreads * numOps - sharedCounter;
+        rlRate = runTest(nthreads, M_RL, &stats);
+        rlLost = nthreads * numOps - sharedCounter;
+
+        if (contend)
+            printf("%8d %12.0f %10ld %12.0f %10ld %12.0f %10ld %9.3f\n",
+                   nthreads, posixRate, posixLost, ofdRate, ofdLost,
+                   rlRate, rlLost, (double) stats.syscalls / stats.locks);
+        else
+            printf("%8d %14.0f %14.0f %14.0f %9.3f\n", nthreads, posixRate,
+                   ofdRate, rlRate, (double) stats.syscalls / stats.locks);
+    }
+
+    if (optind == argc)
+        unlink(tmpl);
+    exit(EXIT_SUCCESS);
+}
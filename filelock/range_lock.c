@@ -0,0 +1,654 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 55 */
+
+/* range_lock.c
+
+   A table of byte-range locks that arbitrates between the threads of a
+   process in user space, and uses open file description (OFD) locks
+   (see region_locking.c) only to exclude other processes.
+
+   rlCreate() creates a table for the file open on 'fd'; all of the
+   process's kernel locks on the file are then placed via that one open
+   file description, on behalf of all threads. rlLock() locks 'len'
+   bytes (0 means "to the end of the file, however large it grows")
+   starting at 'start' for reading (F_RDLCK) or writing (F_WRLCK),
+   waiting if another thread or process holds a conflicting lock, and
+   returns a handle for rlUnlock(). rlTryLock() instead fails with
+   EAGAIN. Functions that return a pointer return NULL on error; the
+   others return 0 on success, or -1 on error, with 'errno' set.
+
+   Each lock is a node in an interval tree (a treap ordered by start
+   offset, in which each node also records the largest end offset in its
+   subtree), so that a conflicting lock is found in O(log n) time. A
+   thread that must wait for another thread's lock waits on a condition
+   variable of its own, in a list attached to that lock. When the lock is
+   released, the waiters are reconsidered in order; each is either
+   granted, or moved to the list of another lock that it conflicts with.
+
+   The table also records the "coverage" of the kernel locks held via
+   'fd': for each byte, the strongest mode in which any thread holds it.
+   Acquiring a lock makes a (single) fcntl() call only if the coverage
+   doesn't already include the range in the required mode, and releasing
+   a lock makes calls only for the parts no longer needed by any other
+   holder. Crucially, a released lock's waiters are granted before the
+   coverage is reduced, so that when threads contend for the same range,
+   the kernel lock is handed from one thread to the next without any
+   system calls, and it is placed and removed once per contended episode
+   rather than once per thread.
+
+   While a thread acquires a kernel lock (possibly waiting for another
+   process), its range is marked as "acquiring", and conflicts with all
+   other requests, so that no other thread can rely on coverage that is
+   not yet in place. Kernel locks are acquired without the table's mutex
+   held; unlocking and downgrading never block, and are done with the
+   mutex held.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "range_lock.h"         /* Declares functions defined here */
+#include "tlpi_hdr.h"
+
+#define OFF_MAX ((off_t) ((((uintmax_t) 1) << \
+                           (sizeof(off_t) * CHAR_BIT - 1)) - 1))
+
+#define M_NONE  0               /* Lock modes, in increasing strength */
+#define M_READ  1
+#define M_WRITE 2
+
+#define RL_WAITING   0          /* States of a lock request */
+#define RL_ACQUIRING 1
+#define RL_HELD      2
+
+struct rlRange {
+    off_t start;
+    off_t end;                  /* Exclusive; OFF_MAX means "to EOF" */
+    int mode;
+    int state;
+
+    struct rlRange *left;       /* Treap links and augmentation */
+    struct rlRange *right;
+    unsigned prio;
+    off_t maxEnd;               /* Largest 'end' in this subtree */
+
+    struct rlRange *waitHead;   /* Requests waiting for this lock */
+    struct rlRange *waitTail;
+    struct rlRange *waitNext;   /* Link in list of the lock we wait for */
+    pthread_cond_t cond;        /* Signaled when we are granted */
+};
+
+struct rlSeg {                  /* Part of the kernel lock coverage */
+    off_t start;
+    off_t end;
+    int mode;
+};
+
+struct rlTable {
+    int fd;
+    pthread_mutex_t mutex;
+    struct rlRange *root;       /* Granted (acquiring or held) locks */
+    long nRequests;             /* Granted and waiting */
+    unsigned seed;              /* For treap priorities */
+
+    struct rlSeg *cov;          /* Coverage: sorted, non-overlapping, */
+    size_t ncov;                /*  mode != M_NONE; since segment bounds */
+    size_t covCap;              /*  are lock bounds, ncov <= 2 * locks */
+
+    struct rlStats stats;
+};
+
+/* Treap operations */
+
+static void
+fixup(struct rlRange *n)
+{
+    n->maxEnd = n->end;
+    if (n->left != NULL && n->left->maxEnd > n->maxEnd)
+        n->maxEnd = n->left->maxEnd;
+    if (n->right != NULL && n->right->maxEnd > n->maxEnd)
+        n->maxEnd = n->right->maxEnd;
+}
+
+static Boolean
+keyLess(const struct rlRange *a, const struct rlRange *b)
+{
+    return a->start < b->start ||
+           (a->start == b->start && (uintptr_t) a < (uintptr_t) b);
+}
+
+static struct rlRange *
+treapInsert(struct rlRange *root, struct rlRange *n)
+{
+    struct rlRange *c;
+
+    if (root == NULL) {
+        n->left = n->right = NULL;
+        fixup(n);
+        return n;
+    }
+
+    if (keyLess(n, root)) {
+        root->left = treapInsert(root->left, n);
+        if (root->left->prio > root->prio) {    /* Rotate right */
+            c = root->left;
+            root->left = c->right;
+            fixup(root);
+            c->right = root;
+            root = c;
+        }
+    } else {
+        root->right = treapInsert(root->right, n);
+        if (root->right->prio > root->prio) {   /* Rotate left */
+            c = root->right;
+            root->right = c->left;
+            fixup(root);
+            c->left = root;
+            root = c;
+        }
+    }
+    fixup(root);
+    return root;
+}
+
+static struct rlRange *         /* All keys in 'a' precede those in 'b' */
+treapMerge(struct rlRange *a, struct rlRange *b)
+{
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+    if (a->prio > b->prio) {
+        a->right = treapMerge(a->right, b);
+        fixup(a);
+        return a;
+    }
+    b->left = treapMerge(a, b->left);
+    fixup(b);
+    return b;
+}
+
+static struct rlRange *
+treapRemove(struct rlRange *root, struct rlRange *n)
+{
+    if (root == n)
+        return treapMerge(n->left, n->right);
+    if (keyLess(n, root))
+        root->left = treapRemove(root->left, n);
+    else
+        root->right = treapRemove(root->right, n);
+    fixup(root);
+    return root;
+}
+
+/* Return a lock in subtree 'n' that conflicts with request 'r', or NULL */
+
+static struct rlRange *
+findConflict(struct rlRange *n, const struct rlRange *r)
+{
+    struct rlRange *c;
+
+    if (n == NULL || n->maxEnd <= r->start)
+        return NULL;
+    c = findConflict(n->left, r);
+    if (c != NULL)
+        return c;
+    if (n->start >= r->end)             /* As are all in right subtree */
+        return NULL;
+    if (n != r && n->end > r->start && (n->state == RL_ACQUIRING ||
+                n->mode == M_WRITE || r->mode == M_WRITE))
+        return n;
+    return findConflict(n->right, r);
+}
+
+/* Return the strongest mode of the locks in subtree 'n' that include
+   offset 'p' */
+
+static int
+modeAt(const struct rlRange *n, off_t p)
+{
+    int m, c;
+
+    if (n == NULL || n->maxEnd <= p)
+        return M_NONE;
+    m = modeAt(n->left, p);
+    if (n->start <= p) {
+        if (n->end > p && n->mode > m)
+            m = n->mode;
+        c = modeAt(n->right, p);
+        if (c > m)
+            m = c;
+    }
+    return m;
+}
+
+/* Return the first lock boundary in subtree 'n' that is after 'p', or
+   'b' if there is none before 'b' */
+
+static off_t
+nextBoundary(const struct rlRange *n, off_t p, off_t b)
+{
+    if (n == NULL || n->maxEnd <= p)
+        return b;
+    b = nextBoundary(n->left, p, b);
+    if (n->start < b) {
+        if (n->start > p)
+            b = n->start;
+        else if (n->end > p && n->end < b)
+            b = n->end;
+        b = nextBoundary(n->right, p, b);
+    }
+    return b;
+}
+
+/* Coverage operations */
+
+/* Return the index of the first coverage segment that ends after 'p' */
+
+static size_t
+covFind(const struct rlTable *t, off_t p)
+{
+    size_t lo, hi, mid;
+
+    lo = 0;
+    hi = t->ncov;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (t->cov[mid].end <= p)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Return the coverage mode at 'p', and, in '*next', the offset at which
+   the coverage next changes */
+
+static int
+covAt(const struct rlTable *t, off_t p, off_t *next)
+{
+    size_t i;
+
+    i = covFind(t, p);
+    if (i < t->ncov && t->cov[i].start <= p) {
+        *next = t->cov[i].end;
+        return t->cov[i].mode;
+    }
+    *next = (i < t->ncov) ? t->cov[i].start : OFF_MAX;
+    return M_NONE;
+}
+
+/* Set the coverage of [s, e) to 'mode'. The caller ensures that 'cov'
+   has room for two more segments. */
+
+static void
+covSet(struct rlTable *t, off_t s, off_t e, int mode)
+{
+    struct rlSeg repl[3];
+    size_t i, j, k, n;
+
+    i = covFind(t, s);
+    for (j = i; j < t->ncov && t->cov[j].start < e; j++)
+        continue;
+
+    n = 0;                              /* Segments replacing i..j-1 */
+    if (i < j && t->cov[i].start < s) {
+        repl[n] = t->cov[i];
+        repl[n++].end = s;
+    }
+    if (mode != M_NONE) {
+        repl[n].start = s;
+        repl[n].end = e;
+        repl[n++].mode = mode;
+    }
+    if (i < j && t->cov[j - 1].end > e) {
+        repl[n] = t->cov[j - 1];
+        repl[n++].start = e;
+    }
+
+    memmove(&t->cov[i + n], &t->cov[j],
+            (t->ncov - j) * sizeof(struct rlSeg));
+    memcpy(&t->cov[i], repl, n * sizeof(struct rlSeg));
+    t->ncov += n - (j - i);
+
+    /* Merge adjacent segments of the same mode around the change */
+
+    k = (i > 0) ? i - 1 : 0;
+    while (k + 1 < t->ncov && k <= i + n) {
+        if (t->cov[k].end == t->cov[k + 1].start &&
+                t->cov[k].mode == t->cov[k + 1].mode) {
+            t->cov[k].end = t->cov[k + 1].end;
+            memmove(&t->cov[k + 1], &t->cov[k + 2],
+                    (t->ncov - k - 2) * sizeof(struct rlSeg));
+            t->ncov--;
+        } else {
+            k++;
+        }
+    }
+}
+
+/* Make sure that the coverage array can't overflow, given the number of
+   requests, including the one about to be made */
+
+static int
+covReserve(struct rlTable *t)
+{
+    struct rlSeg *p;
+    size_t need;
+
+    need = 2 * (t->nRequests + 1) + 4;
+    if (need <= t->covCap)
+        return 0;
+    p = realloc(t->cov, 2 * need * sizeof(struct rlSeg));
+    if (p == NULL)
+        return -1;
+    t->cov = p;
+    t->covCap = 2 * need;
+    return 0;
+}
+
+/* Place or remove a kernel lock on [s, e) */
+
+static int
+kernelLock(struct rlTable *t, int cmd, int mode, off_t s, off_t e)
+{
+    struct flock fl;
+
+    fl.l_type = (mode == M_WRITE) ? F_WRLCK :
+                (mode == M_READ) ? F_RDLCK : F_UNLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = s;
+    fl.l_len = (e == OFF_MAX) ? 0 : e - s;
+    fl.l_pid = 0;
+
+    return fcntl(t->fd, cmd, &fl);
+}
+
+/* Reduce the kernel locks on [s, e) to the strongest mode in which each
+   byte is still held by some (acquiring or held) lock. Adjacent pieces
+   that are reduced to the same mode are changed by a single call. */
+
+static int
+lowerCoverage(struct rlTable *t, off_t s, off_t e)
+{
+    off_t p, q, runStart, runEnd;
+    int cur, want, runMode, ret;
+
+    ret = 0;
+    runStart = runEnd = -1;
+    runMode = M_NONE;
+    for (p = s; ; p = q) {
+        if (p < e) {
+            cur = covAt(t, p, &q);
+            if (q > e)
+                q = e;
+            q = nextBoundary(t->root, p, q);
+            want = modeAt(t->root, p);
+            if (cur > want && runEnd == p && want == runMode) {
+                runEnd = q;             /* Extend the current run */
+                continue;
+            }
+        }
+
+        if (runEnd != -1) {             /* Apply the current run */
+            t->stats.syscalls++;
+            if (kernelLock(t, F_OFD_SETLK, runMode, runStart, runEnd) == -1)
+                ret = -1;
+            covSet(t, runStart, runEnd, runMode);
+            runEnd = -1;
+        }
+        if (p >= e)
+            break;
+
+        if (cur > want) {               /* Start a new run */
+            runStart = p;
+            runEnd = q;
+            runMode = want;
+        }
+    }
+    return ret;
+}
+
+/* Return TRUE if the kernel locks already cover 'r' in its mode */
+
+static Boolean
+covered(const struct rlTable *t, const struct rlRange *r)
+{
+    off_t p, q;
+
+    for (p = r->start; p < r->end; p = q)
+        if (covAt(t, p, &q) < r->mode)
+            return FALSE;
+    return TRUE;
+}
+
+/* Grant a request: it conflicts with anything that overlaps it until its
+   kernel lock is in place */
+
+static void
+grant(struct rlTable *t, struct rlRange *r)
+{
+    r->state = RL_ACQUIRING;
+    t->seed ^= t->seed << 13;
+    t->seed ^= t->seed >> 17;
+    t->seed ^= t->seed << 5;
+    r->prio = t->seed;
+    t->root = treapInsert(t->root, r);
+}
+
+static void
+addWaiter(struct rlRange *blocker, struct rlRange *r)
+{
+    r->waitNext = NULL;
+    if (blocker->waitHead == NULL)
+        blocker->waitHead = r;
+    else
+        blocker->waitTail->waitNext = r;
+    blocker->waitTail = r;
+}
+
+/* Reconsider, in order, the requests waiting for 'h': grant each one
+   that no longer conflicts with any lock, and move the others to the
+   list of a lock that they conflict with */
+
+static void
+regrantWaiters(struct rlTable *t, struct rlRange *h)
+{
+    struct rlRange *w, *next, *blocker;
+
+    w = h->waitHead;
+    h->waitHead = h->waitTail = NULL;
+    for ( ; w != NULL; w = next) {
+        next = w->waitNext;
+        blocker = findConflict(t->root, w);
+        if (blocker == NULL) {
+            grant(t, w);
+            pthread_cond_signal(&w->cond);
+        } else {
+            addWaiter(blocker, w);
+        }
+    }
+}
+
+/* Remove a granted lock, hand on its waiters, and then release the
+   kernel locks that are no longer needed */
+
+static int
+removeRange(struct rlTable *t, struct rlRange *r)
+{
+    t->root = treapRemove(t->root, r);
+    t->nRequests--;
+    regrantWaiters(t, r);
+    return lowerCoverage(t, r->start, r->end);
+}
+
+struct rlTable *
+rlCreate(int fd)
+{
+    struct rlTable *t;
+    int s;
+
+    t = calloc(1, sizeof(struct rlTable));
+    if (t == NULL)
+        return NULL;
+    t->fd = fd;
+    t->seed = 2463534242U;
+    s = pthread_mutex_init(&t->mutex, NULL);
+    if (s != 0) {
+        free(t);
+        errno = s;
+        return NULL;
+    }
+    return t;
+}
+
+static struct rlRange *
+doLock(struct rlTable *t, int type, off_t start, off_t len, Boolean wait)
+{
+    struct rlRange *r, *blocker;
+    int s, savedErrno;
+
+    if ((type != F_RDLCK && type != F_WRLCK) || start < 0 || len < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    r = calloc(1, sizeof(struct rlRange));
+    if (r == NULL)
+        return NULL;
+    s = pthread_cond_init(&r->cond, NULL);
+    if (s != 0) {
+        free(r);
+        errno = s;
+        return NULL;
+    }
+    r->start = start;
+    r->end = (len == 0 || start > OFF_MAX - len) ? OFF_MAX : start + len;
+    r->mode = (type == F_WRLCK) ? M_WRITE : M_READ;
+
+    pthread_mutex_lock(&t->mutex);
+
+    if (covReserve(t) == -1) {
+        savedErrno = errno;
+        goto fail;
+    }
+    t->nRequests++;
+
+    blocker = findConflict(t->root, r);
+    if (blocker == NULL) {
+        grant(t, r);
+    } else if (!wait) {
+        t->nRequests--;
+        savedErrno = EAGAIN;
+        goto fail;
+    } else {                            /* Wait until granted */
+        t->stats.localWaits++;
+        r->state = RL_WAITING;
+        addWaiter(blocker, r);
+        while (r->state == RL_WAITING)
+            pthread_cond_wait(&r->cond, &t->mutex);
+    }
+
+    /* The request has been granted; acquire the kernel lock, unless
+       the process already holds it */
+
+    if (covered(t, r)) {
+        t->stats.noSyscall++;
+    } else {
+        pthread_mutex_unlock(&t->mutex);
+        do {
+            s = kernelLock(t, wait ? F_OFD_SETLKW : F_OFD_SETLK, r->mode,
+                           r->start, r->end);
+        } while (s == -1 && errno == EINTR);
+        savedErrno = errno;
+        pthread_mutex_lock(&t->mutex);
+
+        t->stats.syscalls++;
+        if (s == -1) {
+            removeRange(t, r);
+            goto fail;
+        }
+        covSet(t, r->start, r->end, r->mode);
+    }
+
+    r->state = RL_HELD;
+    t->stats.locks++;
+    regrantWaiters(t, r);               /* Those that conflicted only
+                                           because we were acquiring */
+    pthread_mutex_unlock(&t->mutex);
+    return r;
+
+fail:
+    pthread_mutex_unlock(&t->mutex);
+    pthread_cond_destroy(&r->cond);
+    free(r);
+    errno = savedErrno;
+    return NULL;
+}
+
+/* Lock the range, waiting for other threads and processes if necessary */
+
+struct rlRange *
+rlLock(struct rlTable *t, int type, off_t start, off_t len)
+{
+    return doLock(t, type, start, len, TRUE);
+}
+
+/* Lock the range, failing with EAGAIN if it is locked by another thread
+   or process */
+
+struct rlRange *
+rlTryLock(struct rlTable *t, int type, off_t start, off_t len)
+{
+    return doLock(t, type, start, len, FALSE);
+}
+
+int
+rlUnlock(struct rlTable *t, struct rlRange *r)
+{
+    int s;
+
+    pthread_mutex_lock(&t->mutex);
+    if (r->state != RL_HELD) {
+        pthread_mutex_unlock(&t->mutex);
+        errno = EINVAL;
+        return -1;
+    }
+    s = removeRange(t, r);
+    pthread_mutex_unlock(&t->mutex);
+
+    pthread_cond_destroy(&r->cond);
+    free(r);
+    return s;
+}
+
+void
+rlGetStats(struct rlTable *t, struct rlStats *stats)
+{
+    pthread_mutex_lock(&t->mutex);
+    *stats = t->stats;
+    pthread_mutex_unlock(&t->mutex);
+}
+
+/* Free the table; all locks must have been released */
+
+void
+rlDestroy(struct rlTable *t)
+{
+    pthread_mutex_destroy(&t->mutex);
+    free(t->cov);
+    free(t);
+}
@@ -0,0 +1,45 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 55 */
+
+/* range_lock.h
+
+   Header file for range_lock.c.
+*/
+#ifndef RANGE_LOCK_H
+#define RANGE_LOCK_H            /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+
+struct rlTable;                 /* Opaque; defined in range_lock.c */
+struct rlRange;                 /* Opaque; a lock held by a thread */
+
+struct rlStats {
+    unsigned long locks;        /* Locks granted */
+    unsigned long localWaits;   /* Locks that waited for another thread */
+    unsigned long noSyscall;    /* Locks granted without a system call */
+    unsigned long syscalls;     /* fcntl() calls made */
+};
+
+struct rlTable *rlCreate(int fd);
+
+struct rlRange *rlLock(struct rlTable *t, int type, off_t start, off_t len);
+
+struct rlRange *rlTryLock(struct rlTable *t, int type, off_t start,
+                          off_t len);
+
+int rlUnlock(struct rlTable *t, struct rlRange *r);
+
+void rlGetStats(struct rlTable *t, struct rlStats *stats);
+
+void rlDestroy(struct rlTable *t);
+
+#endif
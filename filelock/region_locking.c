@@ -13,14 +13,28 @@
 /* region_locking.c
 
    Some useful functions for file region (fcntl()) locking.
+
+   The lockRegionOfd(), lockRegionOfdWait(), and regionIsLockedOfd()
+   variants use Linux open file description locks (Linux 3.15 and
+   later). These locks are owned by the open file description, rather
+   than by the process, so that they can be used to synchronize threads
+   (each of which must then open the file itself), and they are not
+   released when the process closes some other descriptor for the file.
 */
+#define _GNU_SOURCE             /* For F_OFD_* definitions */
 #include <fcntl.h>
 #include "region_locking.h"             /* Declares functions defined here */
 
+#ifndef F_OFD_SETLK             /* No OFD locks; fcntl() fails with EINVAL */
+#define F_OFD_GETLK -1
+#define F_OFD_SETLK -1
+#define F_OFD_SETLKW -1
+#endif
+
 /* Lock a file region (private; public interfaces below) */
 
 static int
-lockReg(int fd, int cmd, int type, int whence, int start, off_t len)
+lockReg(int fd, int cmd, int type, int whence, off_t start, off_t len)
 {
     struct flock fl;
 
@@ -28,6 +42,7 @@ lockReg(int fd, int cmd, int type, int whence, int start, off_t len)
     fl.l_whence = whence;
     fl.l_start = start;
     fl.l_len = len;
+    fl.l_pid = 0;                       /* Must be 0 for OFD locks */
 
     return fcntl(fd, cmd, &fl);
 }
@@ -62,3 +77,36 @@ regionIsLocked(int fd, int type, int whence, int start, int len)
 
     return (fl.l_type == F_UNLCK) ? 0 : fl.l_pid;
 }
+
+int                     /* Lock a file region using nonblocking F_OFD_SETLK */
+lockRegionOfd(int fd, int type, int whence, off_t start, off_t len)
+{
+    return lockReg(fd, F_OFD_SETLK, type, whence, start, len);
+}
+
+int                     /* Lock a file region using blocking F_OFD_SETLKW */
+lockRegionOfdWait(int fd, int type, int whence, off_t start, off_t len)
+{
+    return lockReg(fd, F_OFD_SETLKW, type, whence, start, len);
+}
+
+/* Test if a file region is lockable via 'fd' using F_OFD_GETLK. Return 0
+   if lockable, 1 if an incompatible lock is held (the owner of an OFD
+   lock can't be identified by PID), or -1 on error. */
+
+int
+regionIsLockedOfd(int fd, int type, int whence, off_t start, off_t len)
+{
+    struct flock fl;
+
+    fl.l_type = type;
+    fl.l_whence = whence;
+    fl.l_start = start;
+    fl.l_len = len;
+    fl.l_pid = 0;
+
+    if (fcntl(fd, F_OFD_GETLK, &fl) == -1)
+        return -1;
+
+    return (fl.l_type == F_UNLCK) ? 0 : 1;
+}
@@ -25,4 +25,10 @@ int lockRegionWait(int fd, int type, int whence, int start, int len);
 
 pid_t regionIsLocked(int fd, int type, int whence, int start, int len);
 
+int lockRegionOfd(int fd, int type, int whence, off_t start, off_t len);
+
+int lockRegionOfdWait(int fd, int type, int whence, off_t start, off_t len);
+
+int regionIsLockedOfd(int fd, int type, int whence, off_t start, off_t len);
+
 #endif
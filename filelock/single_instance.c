@@ -0,0 +1,83 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 55 */
+
+/* single_instance.c
+
+   An alternative to createPidFile() (create_pid_file.c) that ensures that
+   only one instance of a program is running, without any file I/O.
+
+   createInstanceLock() binds a UNIX domain socket to 'name' in the
+   Linux-specific abstract namespace (see sockets/us_abstract_bind.c).
+   Only one socket can be bound to a given name, so the bind() fails with
+   EADDRINUSE if another instance holds the name. The name is released
+   automatically when the socket is closed, which happens at the latest
+   when the process (and any children to which it passed the descriptor)
+   terminates, so there is no stale file to remove, and nothing to do on
+   slow or remote storage: the check costs two system calls.
+
+   The abstract namespace is private to a network namespace, so processes
+   in different network namespaces (e.g., containers) don't exclude one
+   another; nor is there a way for other programs to read the PID of the
+   running instance. Where those matter, or where the abstract namespace
+   is unavailable (bind() or socket() fails for some other reason), a
+   caller that supplies 'pidFile' gets the traditional PID file instead:
+   createPidFile() is called, with CPF_CLOEXEC if SI_CLOEXEC was given.
+
+   As with createPidFile(), the function returns a file descriptor that
+   the caller must keep open while running, and, if another instance is
+   running or an error occurs, prints a diagnostic and terminates.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stddef.h>
+#include "create_pid_file.h"            /* Declares createPidFile() */
+#include "single_instance.h"            /* Declares createInstanceLock() */
+#include "tlpi_hdr.h"
+
+int
+createInstanceLock(const char *progName, const char *name,
+                   const char *pidFile, int flags)
+{
+    struct sockaddr_un addr;
+    size_t len;
+    int sfd;
+
+    len = strlen(name);
+    if (len == 0 || len > sizeof(addr.sun_path) - 1)
+        fatal("Invalid instance name '%s'", name);
+
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    memcpy(&addr.sun_path[1], name, len);       /* Abstract: "\0name" */
+
+    sfd = socket(AF_UNIX, SOCK_DGRAM |
+                 ((flags & SI_CLOEXEC) ? SOCK_CLOEXEC : 0), 0);
+    if (sfd != -1) {
+        if (bind(sfd, (struct sockaddr *) &addr,
+                 offsetof(struct sockaddr_un, sun_path) + 1 + len) == 0)
+            return sfd;
+
+        if (errno == EADDRINUSE)
+            fatal("Instance name '%s' is in use; probably "
+                  "'%s' is already running", name, progName);
+        close(sfd);
+    }
+
+    if (pidFile == NULL)
+        errExit("Unable to bind instance name '%s'", name);
+
+    return createPidFile(progName, pidFile,
+                         (flags & SI_CLOEXEC) ? CPF_CLOEXEC : 0);
+}
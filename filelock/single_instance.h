@@ -0,0 +1,25 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 55 */
+
+/* single_instance.h
+
+   Header file for single_instance.c.
+*/
+#ifndef SINGLE_INSTANCE_H       /* Prevent accidental double inclusion */
+#define SINGLE_INSTANCE_H
+
+#define SI_CLOEXEC 1            /* Don't pass the lock across exec() */
+
+int createInstanceLock(const char *progName, const char *name,
+                       const char *pidFile, int flags);
+
+#endif
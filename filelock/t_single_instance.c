@@ -0,0 +1,91 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 55 */
+
+/* t_single_instance.c
+
+   Demonstrate createInstanceLock() (single_instance.c).
+
+   Usage: t_single_instance [-f pid-file] [-b count] name [sleep-time]
+
+   The program acquires the instance lock 'name' (falling back to
+   'pid-file' if the abstract namespace can't be used), and holds it for
+   'sleep-time' seconds (default: 10). Run a second instance while the
+   first is sleeping to see it refused.
+
+   With -b, the program instead acquires and releases the lock 'count'
+   times, and shows the mean time taken; if -f is also given, it does
+   the same with createPidFile() and 'pid-file', for comparison.
+
+   This program is Linux-specific.
+*/
+#include <time.h>
+#include "create_pid_file.h"
+#include "single_instance.h"
+#include "tlpi_hdr.h"
+
+static double
+nowUs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *pidFile;
+    double t0;
+    long count, j;
+    int opt, fd;
+
+    pidFile = NULL;
+    count = 0;
+    while ((opt = getopt(argc, argv, "f:b:")) != -1) {
+        switch (opt) {
+        case 'f': pidFile = optarg;                                     break;
+        case 'b': count = getLong(optarg, GN_GT_0, "count");            break;
+        default:  usageErr("%s [-f pid-file] [-b count] name "
+                           "[sleep-time]\n", argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usageErr("%s [-f pid-file] [-b count] name [sleep-time]\n", argv[0]);
+
+    if (count > 0) {
+        t0 = nowUs();
+        for (j = 0; j < count; j++)
+            close(createInstanceLock(argv[0], argv[optind], NULL, 0));
+        printf("createInstanceLock(): %8.2f us\n", (nowUs() - t0) / count);
+
+        if (pidFile != NULL) {
+            t0 = nowUs();
+            for (j = 0; j < count; j++) {
+                fd = createPidFile(argv[0], pidFile, 0);
+                unlink(pidFile);
+                close(fd);
+            }
+            printf("createPidFile():      %8.2f us\n", (nowUs() - t0) / count);
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    createInstanceLock(argv[0], argv[optind], pidFile, SI_CLOEXEC);
+    printf("PID %ld: holding instance lock '%s'\n", (long) getpid(),
+           argv[optind]);
+
+    sleep((optind + 1 < argc) ?
+            getInt(argv[optind + 1], GN_NONNEG, "sleep-time") : 10);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,405 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 15 */
+
+/* batch_touch.c
+
+   Update the timestamps of a list of files (for example, to maintain the
+   least-recently-used order of the files in a cache), efficiently.
+
+   Usage: batch_touch [-a | -m] [-d time] [-h] [-t nthreads] [-w secs]
+                      [-P] [-q] [-v] [list-file...]
+
+        -a           Change only the last access time
+        -m           Change only the last modification time
+        -d time      Set the timestamps to 'time' (seconds[.fraction]
+                     since the Epoch), rather than to the current time
+        -h           Don't follow symbolic links
+        -t nthreads  Number of threads (default: 1)
+        -w secs      Don't update a file whose timestamp(s) are already
+                     within 'secs' seconds of the new time
+        -P           Pass each full pathname to utimensat(), rather than
+                     a name relative to a descriptor for its directory
+                     (for comparison)
+        -q           Don't report errors for individual files
+        -v           Display statistics when done
+
+   The pathnames are read, one per line, from the list files, or, if
+   there are none, from standard input.
+
+   Unlike utime() and utimes() (see t_utime.c and t_utimes.c), which take
+   a pathname that the kernel must resolve, component by component, on
+   every call, and which can't leave one timestamp unchanged without first
+   fetching it with stat(), this program:
+
+   - sorts the list by directory, removing duplicate pathnames, opens each
+     directory once (with O_PATH), and calls utimensat() with the file's
+     name relative to that directory, so that only the last component of
+     each pathname is looked up;
+
+   - uses UTIME_OMIT for the timestamp that isn't being changed, and
+     UTIME_NOW (unless -d is given) for the other, with nanosecond
+     precision;
+
+   - with -w, coalesces updates: it first fetches the current timestamps
+     with statx() (with AT_STATX_DONT_SYNC), and skips the update (which
+     would dirty the inode, and cause it to be written back to disk) if
+     they are recent enough;
+
+   - with -t, distributes the directories among several threads.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include "parse_num.h"
+#include "tlpi_hdr.h"
+
+struct item {
+    char *path;
+    size_t dirLen;              /* Length of directory part (0 if none) */
+    const char *base;           /* Last component of 'path' */
+};
+
+struct stats {                  /* Per-thread counts */
+    long updated;
+    long skipped;               /* Within -w window */
+    long errors;
+};
+
+static struct item *items;
+static long nitems;
+static long *groups;            /* Index of first item of each directory,
+                                   and, at the end, 'nitems' */
+static long ngroups;
+static long nextGroup;          /* Next group for a thread to take */
+
+static struct timespec newTimes[2];     /* For utimensat() */
+static struct timespec target;          /* The new time, for -w */
+static unsigned statxMask;              /* Timestamps being changed */
+static long window;                     /* -w, in seconds; 0 if none */
+static int atFlags;                     /* 0 or AT_SYMLINK_NOFOLLOW */
+static Boolean fullPaths, quiet;
+
+static void
+addPath(char *path, long *max)
+{
+    struct item *it;
+    char *slash;
+    size_t len;
+
+    len = strlen(path);
+    while (len > 1 && path[len - 1] == '/')     /* Strip trailing slashes */
+        path[--len] = '\0';
+    if (len == 0)
+        return;
+
+    if (nitems == *max) {
+        *max = 2 * *max + 1024;
+        items = realloc(items, *max * sizeof(struct item));
+        if (items == NULL)
+            errExit("realloc");
+    }
+    it = &items[nitems++];
+    it->path = strdup(path);
+    if (it->path == NULL)
+        errExit("strdup");
+
+    slash = strrchr(it->path, '/');
+    if (slash == NULL) {
+        it->dirLen = 0;
+        it->base = it->path;
+    } else if (slash[1] == '\0') {      /* The path is "/" */
+        it->dirLen = 1;
+        it->base = ".";
+    } else {
+        it->dirLen = (slash == it->path) ? 1 : slash - it->path;
+        it->base = slash + 1;
+    }
+}
+
+static void
+readList(FILE *fp, long *max)
+{
+    char line[PATH_MAX + 2];
+    size_t len;
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        len = strlen(line);
+        if (len > 0 && line[len - 1] == '\n')
+            line[--len] = '\0';
+        else if (len == sizeof(line) - 1)
+            fatal("Pathname too long: %.40s...", line);
+        addPath(line, max);
+    }
+    if (ferror(fp))
+        errExit("fgets");
+}
+
+/* Order items by directory, then by name */
+
+static int
+cmpItem(const void *a, const void *b)
+{
+    const struct item *x = a, *y = b;
+    size_t len;
+    int c;
+
+    len = (x->dirLen < y->dirLen) ? x->dirLen : y->dirLen;
+    c = memcmp(x->path, y->path, len);
+    if (c != 0)
+        return c;
+    if (x->dirLen != y->dirLen)
+        return (x->dirLen < y->dirLen) ? -1 : 1;
+    return strcmp(x->base, y->base);
+}
+
+/* Sort the items, remove duplicates, and find the start of each
+   directory's group of items. Returns the number of duplicates. */
+
+static long
+makeGroups(void)
+{
+    long j, k;
+
+    qsort(items, nitems, sizeof(struct item), cmpItem);
+
+    k = 0;
+    for (j = 0; j < nitems; j++) {
+        if (k > 0 && cmpItem(&items[k - 1], &items[j]) == 0) {
+            free(items[j].path);
+            continue;
+        }
+        items[k++] = items[j];
+    }
+    j = nitems - k;
+    nitems = k;
+
+    groups = malloc((nitems + 1) * sizeof(long));
+    if (groups == NULL)
+        errExit("malloc");
+    ngroups = 0;
+    for (k = 0; k < nitems; k++)
+        if (k == 0 || fullPaths || items[k].dirLen != items[k - 1].dirLen ||
+                memcmp(items[k].path, items[k - 1].path,
+                       items[k].dirLen) != 0)
+            groups[ngroups++] = k;
+    groups[ngroups] = nitems;
+    return j;
+}
+
+/* Is 'ts' within 'window' seconds of the target time? */
+
+static Boolean
+recent(const struct statx_timestamp *ts)
+{
+    long long diff;
+
+    diff = (long long) target.tv_sec - ts->tv_sec;
+    return diff > -window && diff < window;
+}
+
+static void
+touch(int dirFd, const char *name, const char *path, struct stats *st)
+{
+    struct statx stx;
+
+    if (window > 0 && statx(dirFd, name, atFlags | AT_STATX_DONT_SYNC,
+                            statxMask, &stx) == 0 &&
+            (!(statxMask & STATX_ATIME) || recent(&stx.stx_atime)) &&
+            (!(statxMask & STATX_MTIME) || recent(&stx.stx_mtime))) {
+        st->skipped++;
+        return;
+    }
+
+    if (utimensat(dirFd, name, newTimes, atFlags) == -1) {
+        st->errors++;
+        if (!quiet)
+            errMsg("utimensat: %s", path);
+        return;
+    }
+    st->updated++;
+}
+
+static void *
+worker(void *arg)
+{
+    struct stats *st = arg;
+    char dir[PATH_MAX];
+    struct item *it;
+    long g, j;
+    int dirFd;
+
+    while ((g = __atomic_fetch_add(&nextGroup, 1, __ATOMIC_RELAXED)) <
+            ngroups) {
+        it = &items[groups[g]];
+
+        if (fullPaths || it->dirLen == 0) {
+            dirFd = AT_FDCWD;
+        } else {
+            memcpy(dir, it->path, it->dirLen);
+            dir[it->dirLen] = '\0';
+            dirFd = open(dir, O_PATH | O_DIRECTORY);
+            if (dirFd == -1) {
+                st->errors += groups[g + 1] - groups[g];
+                if (!quiet)
+                    errMsg("open: %s", dir);
+                continue;
+            }
+        }
+
+        for (j = groups[g]; j < groups[g + 1]; j++) {
+            it = &items[j];
+            touch(dirFd, fullPaths ? it->path : it->base, it->path, st);
+        }
+
+        if (dirFd != AT_FDCWD)
+            close(dirFd);
+    }
+    return NULL;
+}
+
+/* Parse 'str', of the form seconds[.fraction], into 'ts' */
+
+static void
+parseTime(const char *str, struct timespec *ts)
+{
+    size_t used, len;
+    long secs, frac;
+    int digits;
+
+    len = strlen(str);
+    if (pnLong(str, len, &secs, &used) != PN_OK ||
+            (used < len && str[used] != '.'))
+        cmdLineErr("Bad time: %s\n", str);
+
+    frac = 0;
+    digits = 0;
+    if (used < len)
+        for (str += used + 1; *str != '\0'; str++, digits++) {
+            if (*str < '0' || *str > '9')
+                cmdLineErr("Bad time fraction: %s\n", str);
+            if (digits < 9)
+                frac = frac * 10 + (*str - '0');
+        }
+    for (; digits < 9; digits++)
+        frac *= 10;
+
+    ts->tv_sec = secs;
+    ts->tv_nsec = frac;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct timespec start, end;
+    Boolean onlyA, onlyM, haveTime, verbose;
+    struct stats *st, total;
+    pthread_t *thr;
+    long max, dups;
+    int opt, nthreads, j, s;
+    double secs;
+    FILE *fp;
+
+    onlyA = onlyM = haveTime = verbose = FALSE;
+    nthreads = 1;
+    while ((opt = getopt(argc, argv, "amd:ht:w:Pqv")) != -1) {
+        switch (opt) {
+        case 'a': onlyA = TRUE;                                 break;
+        case 'm': onlyM = TRUE;                                 break;
+        case 'd': parseTime(optarg, &target); haveTime = TRUE;  break;
+        case 'h': atFlags = AT_SYMLINK_NOFOLLOW;                break;
+        case 't': nthreads = getInt(optarg, GN_GT_0, "-t");     break;
+        case 'w': window = getLong(optarg, GN_GT_0, "-w");      break;
+        case 'P': fullPaths = TRUE;                             break;
+        case 'q': quiet = TRUE;                                 break;
+        case 'v': verbose = TRUE;                               break;
+        default:
+            usageErr("%s [-a | -m] [-d time] [-h] [-t nthreads] [-w secs] "
+                     "[-P] [-q] [-v] [list-file...]\n", argv[0]);
+        }
+    }
+    if (onlyA && onlyM)
+        cmdLineErr("-a and -m are mutually exclusive\n");
+
+    /* Set up the 'newTimes' argument for utimensat() */
+
+    if (!haveTime && clock_gettime(CLOCK_REALTIME, &target) == -1)
+        errExit("clock_gettime");
+    newTimes[0] = newTimes[1] = target;
+    if (!haveTime)
+        newTimes[0].tv_nsec = newTimes[1].tv_nsec = UTIME_NOW;
+    if (onlyM)
+        newTimes[0].tv_nsec = UTIME_OMIT;
+    if (onlyA)
+        newTimes[1].tv_nsec = UTIME_OMIT;
+    statxMask = (onlyM ? 0 : STATX_ATIME) | (onlyA ? 0 : STATX_MTIME);
+
+    /* Read and organize the list of pathnames */
+
+    max = 0;
+    if (optind == argc)
+        readList(stdin, &max);
+    for (j = optind; j < argc; j++) {
+        fp = fopen(argv[j], "r");
+        if (fp == NULL)
+            errExit("fopen %s", argv[j]);
+        readList(fp, &max);
+        fclose(fp);
+    }
+    dups = makeGroups();
+
+    /* Update the files */
+
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+
+    thr = calloc(nthreads, sizeof(pthread_t));
+    st = calloc(nthreads, sizeof(struct stats));
+    if (thr == NULL || st == NULL)
+        errExit("calloc");
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_create(&thr[j], NULL, worker, &st[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    memset(&total, 0, sizeof(total));
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_join(thr[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+        total.updated += st[j].updated;
+        total.skipped += st[j].skipped;
+        total.errors += st[j].errors;
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+    secs = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (verbose) {
+        printf("%ld files (%ld duplicates removed)", nitems, dups);
+        if (!fullPaths)
+            printf(" in %ld directories", ngroups);
+        printf("\n");
+        printf("Updated: %ld; skipped (within %ld s): %ld; errors: %ld\n",
+               total.updated, window, total.skipped, total.errors);
+        printf("%.3f seconds (%.0f files/sec) with %d thread(s)\n",
+               secs, (secs > 0) ? nitems / secs : 0.0, nthreads);
+    }
+
+    exit((total.errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,197 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 15 */
+
+/* stat_batch.c
+
+   Fetch the metadata of a list of files with statx(), asking only for
+   the fields that the caller needs.
+
+   stat() must return every field of the stat structure, and so, on a
+   network filesystem (such as NFS or CIFS), it may need to fetch up-to-
+   date attributes from the server. statx() lets the caller say which
+   fields it wants (the 'mask' argument, a set of STATX_* flags), and,
+   with the AT_STATX_DONT_SYNC flag, accept attributes that the client
+   has cached, so that a program that needs only the sizes of files, say,
+   need not wait for the server. (On local filesystems the difference is
+   small, since all of the fields are in the in-memory inode.)
+
+   statBatchRun() fetches the metadata for an array of files, each named
+   by a path relative to a directory file descriptor. If 'depth' was
+   nonzero in the call to statBatchInit(), the statx() operations are
+   submitted through io_uring (IORING_OP_STATX, Linux 5.6 and later; see
+   uring_functions.c), with up to 'depth' in flight, so that a single
+   system call submits many operations and collects many results. The
+   kernel performs each IORING_OP_STATX in a worker thread, so this pays
+   off when the operations block (as they do on a network filesystem, or
+   when inodes must be read from disk); when the metadata is cached, a
+   loop of statx() calls is faster. If io_uring or IORING_OP_STATX is not
+   available, statBatchInit() silently sets 'depth' to 0.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "stat_batch.h"         /* Declares functions defined here */
+
+/* Initialize 'sb' to fetch the fields in 'mask' (STATX_*), with statx()
+   flags 'flags' (for example, AT_STATX_DONT_SYNC or AT_SYMLINK_NOFOLLOW),
+   using io_uring with up to 'depth' operations in flight, or, if 'depth'
+   is 0, statx(). Returns 0 on success, or -1 on error. */
+
+int
+statBatchInit(struct statBatch *sb, unsigned mask, int flags,
+              unsigned depth)
+{
+    if (mask == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sb->mask = mask;
+    sb->flags = flags;
+    sb->calls = 0;
+    sb->depth = 0;
+
+    if (depth > 0 && uringInit(&sb->ring, depth, 0) == 0) {
+        if (uringOpSupported(&sb->ring, IORING_OP_STATX) == 1)
+            sb->depth = (depth < sb->ring.sqEntries) ? depth :
+                                                       sb->ring.sqEntries;
+        else
+            uringFree(&sb->ring);
+    }
+    return 0;
+}
+
+static void
+runSync(struct statBatch *sb, struct statBatchEnt *ents, size_t n)
+{
+    size_t j;
+
+    for (j = 0; j < n; j++) {
+        ents[j].err = (statx(ents[j].dirfd, ents[j].path, sb->flags,
+                             sb->mask, &ents[j].stx) == -1) ? errno : 0;
+        sb->calls++;
+    }
+}
+
+static int
+runUring(struct statBatch *sb, struct statBatchEnt *ents, size_t n)
+{
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    size_t next, done;
+    unsigned inFlight;
+
+    next = done = 0;
+    inFlight = 0;
+    while (done < n) {
+
+        /* Keep up to 'depth' operations in flight */
+
+        while (next < n && inFlight < sb->depth) {
+            sqe = uringGetSqe(&sb->ring);
+            if (sqe == NULL)
+                break;
+            uringPrepRw(sqe, IORING_OP_STATX, ents[next].dirfd,
+                        ents[next].path, sb->mask,
+                        (off_t) (uintptr_t) &ents[next].stx);
+            sqe->statx_flags = sb->flags;
+            sqe->user_data = next;
+            next++;
+            inFlight++;
+        }
+
+        if (uringSubmit(&sb->ring, 1) == -1)
+            return -1;
+        sb->calls++;
+
+        /* Collect all of the completions that are available */
+
+        while (uringPeekCqe(&sb->ring, &cqe) == 0) {
+            ents[cqe->user_data].err = (cqe->res < 0) ? -cqe->res : 0;
+            uringCqeSeen(&sb->ring);
+            inFlight--;
+            done++;
+        }
+    }
+    return 0;
+}
+
+/* Fetch the metadata of the 'n' files in 'ents', setting 'err' and 'stx'
+   in each entry. Returns the number of entries for which the fetch
+   succeeded, or -1 if io_uring failed. */
+
+ssize_t
+statBatchRun(struct statBatch *sb, struct statBatchEnt *ents, size_t n)
+{
+    ssize_t ok;
+    size_t j;
+
+    if (sb->depth == 0)
+        runSync(sb, ents, n);
+    else if (runUring(sb, ents, n) == -1)
+        return -1;
+
+    ok = 0;
+    for (j = 0; j < n; j++)
+        if (ents[j].err == 0)
+            ok++;
+    return ok;
+}
+
+void
+statBatchFree(struct statBatch *sb)
+{
+    if (sb->depth > 0)
+        uringFree(&sb->ring);
+    sb->depth = 0;
+}
+
+/* Convert 'fields', a comma-separated list of field names ("type",
+   "mode", "nlink", "uid", "gid", "atime", "mtime", "ctime", "btime",
+   "ino", "size", "blocks", "basic" (all but "btime"), or "all"), to a
+   STATX_* mask. Returns 0 on success, or -1 (with errno set to EINVAL)
+   if a name is not recognized. */
+
+int
+statBatchParseMask(const char *fields, unsigned *mask)
+{
+    static const struct { const char *name; unsigned mask; } names[] = {
+        { "type", STATX_TYPE },         { "mode", STATX_MODE },
+        { "nlink", STATX_NLINK },       { "uid", STATX_UID },
+        { "gid", STATX_GID },           { "atime", STATX_ATIME },
+        { "mtime", STATX_MTIME },       { "ctime", STATX_CTIME },
+        { "btime", STATX_BTIME },       { "ino", STATX_INO },
+        { "size", STATX_SIZE },         { "blocks", STATX_BLOCKS },
+        { "basic", STATX_BASIC_STATS }, { "all", STATX_ALL },
+    };
+    const char *p, *end;
+    size_t len, j;
+
+    *mask = 0;
+    for (p = fields; *p != '\0'; p = (*end == ',') ? end + 1 : end) {
+        end = strchrnul(p, ',');
+        len = end - p;
+        for (j = 0; j < sizeof(names) / sizeof(names[0]); j++)
+            if (strlen(names[j].name) == len &&
+                    strncmp(p, names[j].name, len) == 0)
+                break;
+        if (j == sizeof(names) / sizeof(names[0])) {
+            errno = EINVAL;
+            return -1;
+        }
+        *mask |= names[j].mask;
+    }
+    return 0;
+}
@@ -0,0 +1,51 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 15 */
+
+/* stat_batch.h
+
+   Header file for stat_batch.c.
+*/
+#ifndef STAT_BATCH_H
+#define STAT_BATCH_H            /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "uring_functions.h"
+
+struct statBatchEnt {           /* One file; set 'dirfd' and 'path' */
+    int dirfd;                  /* 'path' is relative to this directory
+                                   (or AT_FDCWD) */
+    const char *path;
+    int err;                    /* 0, or an errno value */
+    struct statx stx;           /* Result (if 'err' is 0) */
+};
+
+struct statBatch {
+    unsigned mask;              /* STATX_* fields wanted */
+    int flags;                  /* AT_* flags for statx() */
+    unsigned depth;             /* Maximum io_uring operations in flight;
+                                   0 if statx() is called directly */
+    struct uring ring;
+    unsigned long calls;        /* statx() or io_uring_enter() calls */
+};
+
+int statBatchInit(struct statBatch *sb, unsigned mask, int flags,
+                  unsigned depth);
+
+ssize_t statBatchRun(struct statBatch *sb, struct statBatchEnt *ents,
+                     size_t n);
+
+void statBatchFree(struct statBatch *sb);
+
+int statBatchParseMask(const char *fields, unsigned *mask);
+
+#endif
@@ -0,0 +1,253 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 15 */
+
+/* stat_batch_bench.c
+
+   Compare the rate at which the metadata of the files in a directory can
+   be fetched with fstatat(), with statx() asking for all of the basic
+   fields, and with statBatchRun() (stat_batch.c) asking for only some
+   fields, with and without io_uring.
+
+   Usage: stat_batch_bench [-f fields] [-s] [-u depth] [-b batch] dir
+
+        -f fields    Fields for statBatchRun(), as a comma-separated list
+                     (see statBatchParseMask()) (default: "size,mtime")
+        -s           Use AT_STATX_DONT_SYNC with statBatchRun()
+        -u depth     Operations in flight with io_uring (default: 64)
+        -b batch     Files per call to statBatchRun() (default: 1024)
+
+   The files are the entries in 'dir' (not including subdirectories'
+   contents); each repetition of each benchmark fetches the metadata of
+   all of them, by names relative to a file descriptor for 'dir'. The
+   results are reported in the common format of lib/bench.c, each
+   followed by the rate, in files per second.
+
+   To see the effect of the field mask and AT_STATX_DONT_SYNC, run the
+   program on a directory on a network filesystem; to see the effect of
+   io_uring when the metadata is not cached, first run (as root)
+   "echo 2 > /proc/sys/vm/drop_caches", and use a benchmark with
+   TLPI_BENCH_REPS=1.
+
+   Try: ./stat_batch_bench /usr/bin
+        ./stat_batch_bench -f size -s /usr/lib
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include "stat_batch.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+enum method { M_FSTATAT, M_STATX, M_BATCH };
+
+struct run {
+    enum method method;
+    struct statBatch *sb;       /* For M_BATCH */
+};
+
+static int dirFd;
+static char **names;
+static long nnames;
+static struct statBatchEnt *ents;
+static size_t batch;
+
+static volatile unsigned long sink;     /* Defeats dead code elimination */
+
+static void
+readNames(const char *dir)
+{
+    struct dirent *d;
+    long max;
+    DIR *dp;
+
+    dp = opendir(dir);
+    if (dp == NULL)
+        errExit("opendir %s", dir);
+    dirFd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (dirFd == -1)
+        errExit("open %s", dir);
+
+    max = 0;
+    nnames = 0;
+    while ((d = readdir(dp)) != NULL) {
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+            continue;
+        if (nnames == max) {
+            max = 2 * max + 64;
+            names = realloc(names, max * sizeof(char *));
+            if (names == NULL)
+                errExit("realloc");
+        }
+        names[nnames] = strdup(d->d_name);
+        if (names[nnames] == NULL)
+            errExit("strdup");
+        nnames++;
+    }
+    closedir(dp);
+    if (nnames == 0)
+        fatal("%s is empty", dir);
+}
+
+/* Fetch the metadata of 'ops' files (starting again at the first file
+   if 'ops' is greater than the number of files) */
+
+static void
+fetch(long ops, void *arg)
+{
+    struct run *r = arg;
+    struct statBatchEnt *e;
+    unsigned long sum;
+    struct stat sb;
+    struct statx stx;
+    long j, k;
+    size_t n;
+
+    sum = 0;
+    switch (r->method) {
+    case M_FSTATAT:
+        for (j = 0; j < ops; j++)
+            if (fstatat(dirFd, names[j % nnames], &sb,
+                        AT_SYMLINK_NOFOLLOW) == 0)
+                sum += sb.st_size;
+        break;
+
+    case M_STATX:
+        for (j = 0; j < ops; j++)
+            if (statx(dirFd, names[j % nnames], AT_SYMLINK_NOFOLLOW,
+                      STATX_BASIC_STATS, &stx) == 0)
+                sum += stx.stx_size;
+        break;
+
+    case M_BATCH:
+        for (j = 0; j < ops; j += n) {
+            n = (ops - j < (long) batch) ? ops - j : (long) batch;
+            for (k = 0; k < (long) n; k++) {
+                ents[k].dirfd = dirFd;
+                ents[k].path = names[(j + k) % nnames];
+            }
+            if (statBatchRun(r->sb, ents, n) == -1)
+                errExit("statBatchRun");
+            for (e = ents; e < ents + n; e++)
+                if (e->err == 0)
+                    sum += e->stx.stx_size;
+        }
+        break;
+    }
+    sink = sum;
+}
+
+/* Check that statBatchRun() with io_uring gives the same results as
+   fstatat() */
+
+static void
+check(struct statBatch *sb)
+{
+    struct stat st;
+    size_t k, n;
+    long j;
+
+    for (j = 0; j < nnames; j += batch) {
+        n = (nnames - j < (long) batch) ? nnames - j : (long) batch;
+        for (k = 0; k < n; k++) {
+            ents[k].dirfd = dirFd;
+            ents[k].path = names[j + k];
+        }
+        if (statBatchRun(sb, ents, n) == -1)
+            errExit("statBatchRun");
+        for (k = 0; k < n; k++) {
+            if (fstatat(dirFd, names[j + k], &st,
+                        AT_SYMLINK_NOFOLLOW) == -1)
+                continue;           /* Removed since readNames()? */
+            if (ents[k].err != 0)
+                fatal("statBatchRun(): %s: %s", names[j + k],
+                      strerror(ents[k].err));
+            if ((ents[k].stx.stx_mask & STATX_SIZE) &&
+                    (off_t) ents[k].stx.stx_size != st.st_size)
+                fatal("statBatchRun(): %s: wrong size", names[j + k]);
+        }
+    }
+}
+
+static void
+run(const char *name, struct run *r)
+{
+    struct benchResult res;
+
+    if (benchRun(name, fetch, r, nnames, NULL, &res) == -1)
+        errExit("benchRun");
+    benchReport(&res);
+    printf("    %.0f files/sec\n", 1e9 / res.medianNs);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct statBatch sbSync, sbUring;
+    struct run r;
+    const char *fields;
+    char name[64];
+    unsigned mask;
+    int opt, flags, depth;
+
+    fields = "size,mtime";
+    flags = AT_SYMLINK_NOFOLLOW;
+    depth = 64;
+    batch = 1024;
+    while ((opt = getopt(argc, argv, "f:su:b:")) != -1) {
+        switch (opt) {
+        case 'f': fields = optarg;                              break;
+        case 's': flags |= AT_STATX_DONT_SYNC;                  break;
+        case 'u': depth = getInt(optarg, GN_GT_0, "-u");        break;
+        case 'b': batch = getInt(optarg, GN_GT_0, "-b");        break;
+        default:  usageErr("%s [-f fields] [-s] [-u depth] [-b batch] dir\n",
+                           argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usageErr("%s [-f fields] [-s] [-u depth] [-b batch] dir\n", argv[0]);
+    if (statBatchParseMask(fields, &mask) == -1)
+        cmdLineErr("Bad field list: %s\n", fields);
+
+    readNames(argv[optind]);
+    ents = calloc(batch, sizeof(struct statBatchEnt));
+    if (ents == NULL)
+        errExit("calloc");
+    if (statBatchInit(&sbSync, mask, flags, 0) == -1 ||
+            statBatchInit(&sbUring, mask, flags, depth) == -1)
+        errExit("statBatchInit");
+
+    printf("%ld files in %s; fields: %s%s\n", nnames, argv[optind], fields,
+           (flags & AT_STATX_DONT_SYNC) ? " (AT_STATX_DONT_SYNC)" : "");
+
+    r.method = M_FSTATAT;
+    run("fstatat()", &r);
+    r.method = M_STATX;
+    run("statx(), basic fields", &r);
+
+    r.method = M_BATCH;
+    r.sb = &sbSync;
+    run("statBatchRun(), statx()", &r);
+    if (sbUring.depth > 0) {
+        check(&sbUring);
+        r.sb = &sbUring;
+        snprintf(name, sizeof(name), "statBatchRun(), io_uring %u",
+                 sbUring.depth);
+        run(name, &r);
+    } else {
+        printf("IORING_OP_STATX is not available\n");
+    }
+
+    statBatchFree(&sbUring);
+    exit(EXIT_SUCCESS);
+}
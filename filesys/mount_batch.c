@@ -0,0 +1,503 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 14 */
+
+/* mount_batch.c
+
+   Set up a declared tree of mounts (as a container runtime might do for
+   each container that it starts) several times, and report how long
+   each setup takes, using the classic mount(2) API and the "new" mount
+   API (fsopen(), fsconfig(), fsmount(), open_tree(), move_mount(), and
+   mount_setattr(), available since Linux 5.2 and 5.12).
+
+   Usage: mount_batch [-m modes] [-n count] spec-file dir
+
+        -m modes   Any of the letters 'c' (classic), 'n' (new), and 't'
+                   (new, cloning a template), in the order in which the
+                   modes are to be run (default: "cnt")
+        -n count   Number of trees (containers) to set up in each mode
+                   (default: 100)
+
+   Each tree is set up at dir/<mode>-<number> (the directories are
+   created if necessary), with its root being a new tmpfs mount, on
+   which the mount points are created. Once all trees have been set up,
+   the time taken for each is reported, and the trees are unmounted.
+
+   The spec file contains one line for each mount, in one of the forms:
+
+        bind  source target [ro] [rec]
+        tmpfs target [ro] [size=nbytes]
+
+   'target' is relative to the root of the tree. The mounts are created
+   in the order given. 'rec' creates a recursive bind mount (i.e., one
+   that includes the mounts below 'source'); 'ro' makes the mount (with
+   'rec', all of the mounts) read-only. Blank lines and lines starting
+   with '#' are ignored. Finally, the propagation type of all of the
+   mounts in the tree is set to private.
+
+   The modes differ as follows:
+
+   c    Each mount costs a mount() call, plus a second call (a
+        bind remount) to make a bind mount read-only, plus the lookups of
+        the absolute 'source' and 'target' pathnames. A recursive bind
+        mount can be made read-only only at its top.
+
+   n    The 'source' directories are opened (with O_PATH) once, at
+        startup. For each tree, a detached tmpfs mount is created with
+        fsopen() and fsmount(); each bind mount is cloned from an O_PATH
+        descriptor with open_tree() and, if 'ro' was specified, made
+        read-only (recursively, with 'rec') by a single mount_setattr()
+        call; and the mount is moved into place with move_mount(), with
+        'target' looked up relative to the tree's root. The propagation
+        type of the whole tree is changed by one mount_setattr() call,
+        and the tree is attached to 'dir' by a final move_mount().
+
+   t    A single detached tree is built once, as for 'n', and each tree
+        is then a clone of it, created with one open_tree() and attached
+        with one move_mount() call. Note that the clones share the
+        template's tmpfs file systems (but not its mounts), so that,
+        unlike in the other modes, a file created in the root directory
+        of one tree is visible in the others.
+
+   Before Linux 6.15 (approximately), move_mount() can't move a mount
+   into a detached tree. In that case, mode 'n' attaches each tree
+   before moving the other mounts into it, and mode 't' isn't possible.
+
+   This program requires privilege (CAP_SYS_ADMIN), and should be run in
+   a new mount namespace (e.g., under "unshare -m") so that the trees are
+   invisible to other processes.
+
+   This program is Linux-specific.
+
+   See also t_mount.c.
+*/
+#define _GNU_SOURCE
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#define MAX_MOUNTS 1024
+
+struct mountSpec {
+    Boolean isBind;             /* Else tmpfs */
+    char *source;               /* For bind */
+    int sourceFd;               /* O_PATH descriptor for 'source' */
+    char *target;               /* Relative to root of tree */
+    Boolean ro;
+    Boolean rec;
+    char *size;                 /* For tmpfs, or NULL */
+};
+
+static struct mountSpec specs[MAX_MOUNTS];
+static int numSpecs;
+
+static long numCalls;           /* Mount-related system calls made */
+static Boolean attachFirst;     /* move_mount() into detached tree fails */
+
+/* Read the spec file 'path' into 'specs' */
+
+static void
+readSpecs(const char *path)
+{
+    struct mountSpec *sp;
+    char line[4096], *tok, *save;
+    FILE *fp;
+    int lineNum;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        errExit("fopen: %s", path);
+
+    for (lineNum = 1; fgets(line, sizeof(line), fp) != NULL; lineNum++) {
+        tok = strtok_r(line, " \t\n", &save);
+        if (tok == NULL || tok[0] == '#')
+            continue;
+
+        if (numSpecs == MAX_MOUNTS)
+            fatal("%s: too many mounts (maximum %d)", path, MAX_MOUNTS);
+        sp = &specs[numSpecs++];
+        memset(sp, 0, sizeof(*sp));
+        sp->sourceFd = -1;
+
+        if (strcmp(tok, "bind") == 0) {
+            sp->isBind = TRUE;
+            tok = strtok_r(NULL, " \t\n", &save);
+            if (tok == NULL)
+                fatal("%s:%d: missing source", path, lineNum);
+            sp->source = strdup(tok);
+        } else if (strcmp(tok, "tmpfs") != 0) {
+            fatal("%s:%d: unknown mount type '%s'", path, lineNum, tok);
+        }
+
+        tok = strtok_r(NULL, " \t\n", &save);
+        if (tok == NULL)
+            fatal("%s:%d: missing target", path, lineNum);
+        while (*tok == '/')
+            tok++;
+        sp->target = strdup(tok);
+
+        while ((tok = strtok_r(NULL, " \t\n", &save)) != NULL) {
+            if (strcmp(tok, "ro") == 0)
+                sp->ro = TRUE;
+            else if (strcmp(tok, "rec") == 0 && sp->isBind)
+                sp->rec = TRUE;
+            else if (strncmp(tok, "size=", 5) == 0 && !sp->isBind) {
+                sp->size = strdup(tok + 5);
+                if (sp->size == NULL)
+                    errExit("strdup");
+            } else {
+                fatal("%s:%d: bad option '%s'", path, lineNum, tok);
+            }
+        }
+
+        if ((sp->isBind && sp->source == NULL) || sp->target == NULL)
+            errExit("strdup");
+    }
+
+    if (ferror(fp))
+        errExit("fgets");
+    fclose(fp);
+}
+
+/* Create the directory 'path' (relative to 'dirFd'), and any missing
+   parent directories */
+
+static void
+mkdirAll(int dirFd, const char *path)
+{
+    char buf[PATH_MAX];
+    char *p, save;
+
+    snprintf(buf, sizeof(buf), "%s", path);
+    for (p = buf; ; p++) {
+        if (*p != '/' && *p != '\0')
+            continue;
+        if (p > buf) {
+            save = *p;
+            *p = '\0';
+            if (mkdirat(dirFd, buf, 0755) == -1 && errno != EEXIST)
+                errExit("mkdirat: %s", buf);
+            *p = save;
+        }
+        if (*p == '\0')
+            break;
+    }
+}
+
+/* Set up the tree at 'root' using the classic API */
+
+static void
+setupClassic(const char *root)
+{
+    char target[PATH_MAX], opts[64];
+    struct mountSpec *sp;
+    int j;
+
+    numCalls++;
+    if (mount("tmpfs", root, "tmpfs", 0, NULL) == -1)
+        errExit("mount: %s", root);
+
+    for (j = 0; j < numSpecs; j++) {
+        sp = &specs[j];
+        snprintf(target, sizeof(target), "%s/%s", root, sp->target);
+        mkdirAll(AT_FDCWD, target);
+
+        numCalls++;
+        if (sp->isBind) {
+            if (mount(sp->source, target, NULL,
+                      MS_BIND | (sp->rec ? MS_REC : 0), NULL) == -1)
+                errExit("mount: %s", sp->source);
+
+            if (sp->ro) {
+                numCalls++;
+                if (mount(NULL, target, NULL, MS_REMOUNT | MS_BIND | MS_RDONLY,
+                          NULL) == -1)
+                    errExit("mount-remount: %s", target);
+            }
+        } else {
+            snprintf(opts, sizeof(opts), "size=%s", sp->size);
+            if (mount("tmpfs", target, "tmpfs", sp->ro ? MS_RDONLY : 0,
+                      sp->size != NULL ? opts : NULL) == -1)
+                errExit("mount: %s", target);
+        }
+    }
+
+    numCalls++;
+    if (mount(NULL, root, NULL, MS_REC | MS_PRIVATE, NULL) == -1)
+        errExit("mount-private: %s", root);
+}
+
+/* Return a descriptor for a new detached tmpfs mount */
+
+static int
+newTmpfs(const char *size, Boolean ro)
+{
+    int fsFd, mntFd;
+
+    numCalls += 3;
+    fsFd = fsopen("tmpfs", FSOPEN_CLOEXEC);
+    if (fsFd == -1)
+        errExit("fsopen");
+
+    if (size != NULL) {
+        numCalls++;
+        if (fsconfig(fsFd, FSCONFIG_SET_STRING, "size", size, 0) == -1)
+            errExit("fsconfig-size");
+    }
+    if (fsconfig(fsFd, FSCONFIG_CMD_CREATE, NULL, NULL, 0) == -1)
+        errExit("fsconfig-create");
+
+    mntFd = fsmount(fsFd, FSMOUNT_CLOEXEC, ro ? MOUNT_ATTR_RDONLY : 0);
+    if (mntFd == -1)
+        errExit("fsmount");
+
+    close(fsFd);
+    return mntFd;
+}
+
+/* Attach the detached tree 'treeFd' at 'root' */
+
+static void
+attachTree(int treeFd, const char *root)
+{
+    numCalls++;
+    if (move_mount(treeFd, "", AT_FDCWD, root, MOVE_MOUNT_F_EMPTY_PATH) == -1)
+        errExit("move_mount: %s", root);
+}
+
+/* Set up a tree using the new API. If 'root' is NULL, leave the tree
+   detached. Return a descriptor referring to the root of the tree. */
+
+static int
+setupNew(const char *root)
+{
+    struct mount_attr attr;
+    struct mountSpec *sp;
+    int j, rootFd, mntFd;
+
+    rootFd = newTmpfs(NULL, FALSE);
+    if (attachFirst)
+        attachTree(rootFd, root);
+
+    for (j = 0; j < numSpecs; j++) {
+        sp = &specs[j];
+        mkdirAll(rootFd, sp->target);
+
+        if (sp->isBind) {
+            numCalls++;
+            mntFd = open_tree(sp->sourceFd, "", OPEN_TREE_CLONE |
+                              OPEN_TREE_CLOEXEC | AT_EMPTY_PATH |
+                              (sp->rec ? AT_RECURSIVE : 0));
+            if (mntFd == -1)
+                errExit("open_tree: %s", sp->source);
+
+            if (sp->ro) {
+                memset(&attr, 0, sizeof(attr));
+                attr.attr_set = MOUNT_ATTR_RDONLY;
+                numCalls++;
+                if (mount_setattr(mntFd, "", AT_EMPTY_PATH |
+                                  (sp->rec ? AT_RECURSIVE : 0),
+                                  &attr, sizeof(attr)) == -1)
+                    errExit("mount_setattr: %s", sp->source);
+            }
+        } else {
+            mntFd = newTmpfs(sp->size, sp->ro);
+        }
+
+        numCalls++;
+        if (move_mount(mntFd, "", rootFd, sp->target,
+                       MOVE_MOUNT_F_EMPTY_PATH) == -1) {
+
+            /* On older kernels, the tree must be attached first */
+
+            if (errno != EINVAL || j != 0 || attachFirst || root == NULL)
+                errExit("move_mount: %s", sp->target);
+
+            attachFirst = TRUE;
+            attachTree(rootFd, root);
+            numCalls++;
+            if (move_mount(mntFd, "", rootFd, sp->target,
+                           MOVE_MOUNT_F_EMPTY_PATH) == -1)
+                errExit("move_mount: %s", sp->target);
+        }
+        close(mntFd);
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.propagation = MS_PRIVATE;
+    numCalls++;
+    if (mount_setattr(rootFd, "", AT_EMPTY_PATH | AT_RECURSIVE,
+                      &attr, sizeof(attr)) == -1)
+        errExit("mount_setattr-private");
+
+    if (root != NULL && !attachFirst)
+        attachTree(rootFd, root);
+
+    return rootFd;
+}
+
+/* Set up a tree by cloning the detached tree 'templateFd' */
+
+static void
+setupFromTemplate(int templateFd, const char *root)
+{
+    int treeFd;
+
+    numCalls++;
+    treeFd = open_tree(templateFd, "", OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC |
+                       AT_EMPTY_PATH | AT_RECURSIVE);
+    if (treeFd == -1)
+        errExit("open_tree-template");
+
+    attachTree(treeFd, root);
+    close(treeFd);
+}
+
+static int
+cmpLong(const void *a, const void *b)
+{
+    long la = *(const long *) a, lb = *(const long *) b;
+
+    return (la > lb) - (la < lb);
+}
+
+static long
+usecsSince(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000L +
+           (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/* Set up 'count' trees below 'dir' in the mode 'mode', report the time
+   taken for each, and then unmount them */
+
+static void
+runMode(char mode, const char *dir, int count)
+{
+    const char *name;
+    struct timespec start;
+    char root[PATH_MAX];
+    long *usecs, total, calls;
+    int j, templateFd, fd;
+
+    name = (mode == 'c') ? "classic" : (mode == 'n') ? "new" : "template";
+    usecs = calloc(count, sizeof(long));
+    if (usecs == NULL)
+        errExit("calloc");
+
+    templateFd = -1;
+    if (mode == 't') {
+        if (attachFirst)
+            fatal("Template mode requires move_mount() into a detached tree");
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        templateFd = setupNew(NULL);
+        printf("%-8s template built in %ld usec\n", name, usecsSince(&start));
+    }
+
+    for (j = 0; j < count; j++) {
+        snprintf(root, sizeof(root), "%s/%s-%d", dir, name, j);
+        if (mkdir(root, 0755) == -1 && errno != EEXIST)
+            errExit("mkdir: %s", root);
+    }
+
+    calls = numCalls;
+    total = 0;
+    for (j = 0; j < count; j++) {
+        snprintf(root, sizeof(root), "%s/%s-%d", dir, name, j);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        switch (mode) {
+        case 'c':
+            setupClassic(root);
+            break;
+        case 'n':
+            fd = setupNew(root);
+            close(fd);
+            break;
+        case 't':
+            setupFromTemplate(templateFd, root);
+            break;
+        }
+        usecs[j] = usecsSince(&start);
+        total += usecs[j];
+    }
+    calls = numCalls - calls;
+
+    qsort(usecs, count, sizeof(long), cmpLong);
+    printf("%-8s %d trees of %d mounts: per tree: mean %ld, median %ld, "
+           "max %ld usec; %.1f calls\n", name, count, numSpecs + 1,
+           total / count, usecs[count / 2], usecs[count - 1],
+           (double) calls / count);
+
+    for (j = 0; j < count; j++) {
+        snprintf(root, sizeof(root), "%s/%s-%d", dir, name, j);
+        if (umount2(root, MNT_DETACH) == -1)
+            errExit("umount2: %s", root);
+        if (rmdir(root) == -1)
+            errExit("rmdir: %s", root);
+    }
+
+    if (templateFd != -1)
+        close(templateFd);
+    free(usecs);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-m modes] [-n count] spec-file dir\n",
+            progName);
+#define fpe(str) fprintf(stderr, "    " str)
+    fpe("-m modes   Letters from 'c' (classic), 'n' (new), 't' (template)\n");
+    fpe("           (default: \"cnt\")\n");
+    fpe("-n count   Number of trees to set up in each mode (default: 100)\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *modes, *m;
+    int opt, count, j;
+
+    modes = "cnt";
+    count = 100;
+    while ((opt = getopt(argc, argv, "m:n:")) != -1) {
+        switch (opt) {
+        case 'm': modes = optarg;                                       break;
+        case 'n': count = getInt(optarg, GN_GT_0, "-n");                break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (optind + 2 != argc || modes[strspn(modes, "cnt")] != '\0')
+        usageError(argv[0]);
+
+    readSpecs(argv[optind]);
+
+    for (j = 0; j < numSpecs; j++) {
+        if (specs[j].isBind) {
+            specs[j].sourceFd = open(specs[j].source, O_PATH | O_CLOEXEC);
+            if (specs[j].sourceFd == -1)
+                errExit("open: %s", specs[j].source);
+        }
+    }
+
+    for (m = modes; *m != '\0'; m++)
+        runMode(*m, argv[optind + 1], count);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,579 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 14 */
+
+/* statfs_collect.c
+
+   Periodically collect statfs() information for every mounted file
+   system, reporting the changes since the previous collection.
+
+   Usage: statfs_collect [-i secs] [-T msecs] [-t nthreads] [-c count] [-a]
+
+        -i secs      Collection interval (default: 5)
+        -T msecs     Per-mount timeout (default: 1000)
+        -t nthreads  Number of worker threads (default: 4)
+        -c count     Stop after 'count' collections (default: never)
+        -a           Report every mount each time, rather than only those
+                     whose figures changed; also include file systems
+                     that report no data blocks (e.g., proc, sysfs)
+
+   The mounts are listed in /proc/self/mountinfo, which is reread only
+   when it changes (which is indicated by poll() returning POLLPRI).
+
+   A statfs() call on a mount whose server is unresponsive (e.g., a hard
+   NFS mount) can block indefinitely, and cannot be interrupted. So that
+   one such mount doesn't stall the collection of the others, the calls
+   are made by a pool of worker threads, and the main thread waits for
+   each call for at most the per-mount timeout. A mount whose call is
+   still outstanding after that time is reported as hung, and is not
+   polled again until the call returns. The worker blocked in that call
+   is no longer counted as part of the pool, and (up to a limit) a new
+   worker is created to replace it.
+
+   Each collection reports, for each mount, the space used and available
+   (in kB) and the number of free i-nodes, and the change in each of
+   those values since the previous collection. After startup, no memory
+   is allocated: the mount table is a fixed-size array, and mounts that
+   persist across a reread of the mount table keep their entries.
+
+   This program is Linux-specific.
+
+   See also t_statfs.c.
+*/
+#define _GNU_SOURCE
+#include <sys/statfs.h>
+#include <pthread.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#define MAX_MOUNTS 2048
+#define MAX_PATH 1024
+#define MAX_WORKERS 64                  /* Including those that are hung */
+
+enum mountState {
+    M_IDLE,             /* Not (yet) polled in this collection */
+    M_BUSY,             /* statfs() in progress */
+    M_DONE,             /* statfs() completed */
+    M_HUNG              /* statfs() timed out (in this or an earlier
+                           collection) and has not yet returned */
+};
+
+struct mount {
+    int id;                             /* Mount ID from mountinfo */
+    char path[MAX_PATH];
+    char fstype[32];
+    enum mountState state;
+    Boolean busy;                       /* A worker is in statfs() */
+    struct timespec started;            /* When statfs() was called */
+    int err;                            /* errno from statfs(), or 0 */
+    Boolean havePrev;                   /* 'prev' is valid */
+    struct statfs cur, prev;
+};
+
+/* The following are protected by 'mtx' */
+
+static struct mount mounts[MAX_MOUNTS];
+static int numMounts;
+static struct mount newMounts[MAX_MOUNTS];      /* Used by readMountInfo() */
+static int tableGen;                    /* Incremented on table reread */
+static int nextMount;                   /* Next mount for workers to poll */
+static int poolSize;                    /* Workers wanted (-t) */
+static int numWorkers;                  /* Worker threads, including... */
+static int numStuck;                    /* ...those in a hung statfs() */
+
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t doneCond;         /* Uses CLOCK_MONOTONIC */
+
+static long long
+tsDiffMsecs(const struct timespec *a, const struct timespec *b)
+{
+    return (a->tv_sec - b->tv_sec) * 1000LL +
+           (a->tv_nsec - b->tv_nsec) / 1000000;
+}
+
+static void
+tsAddMsecs(struct timespec *ts, long long msecs)
+{
+    ts->tv_sec += msecs / 1000;
+    ts->tv_nsec += (msecs % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+/* Copy the space-delimited mountinfo field at 'p' into 'buf', decoding
+   octal escapes (e.g., "\040" for a space). Return a pointer to the
+   character following the field. */
+
+static char *
+copyField(char *p, char *buf, size_t size)
+{
+    size_t n;
+
+    for (n = 0; *p != ' ' && *p != '\n' && *p != '\0'; p++) {
+        if (p[0] == '\\' && p[1] >= '0' && p[1] <= '3' &&
+                p[2] >= '0' && p[2] <= '7' && p[3] >= '0' && p[3] <= '7') {
+            if (n < size - 1)
+                buf[n++] = (p[1] - '0') << 6 | (p[2] - '0') << 3 | (p[3] - '0');
+            p += 3;
+        } else if (n < size - 1) {
+            buf[n++] = *p;
+        }
+    }
+    buf[n] = '\0';
+    return p;
+}
+
+/* Return a pointer to the start of the 'n'th (counting from 0)
+   space-delimited field of 'line', or NULL if there is none */
+
+static char *
+field(char *line, int n)
+{
+    for (; n > 0 && line != NULL; n--) {
+        line = strchr(line, ' ');
+        if (line != NULL)
+            line++;
+    }
+    return line;
+}
+
+/* (Re)read the mount table from the mountinfo file 'fp'. Entries for
+   mounts that were already in the table keep their state. Must be called
+   with 'mtx' held. */
+
+static void
+readMountInfo(FILE *fp)
+{
+    static char line[4 * MAX_PATH];
+    static Boolean kept[MAX_MOUNTS];
+    struct mount *m;
+    char *p;
+    int n, j, id, hint;
+
+    rewind(fp);
+
+    memset(kept, 0, sizeof(kept));
+    n = 0;
+    hint = 0;
+    while (fgets(line, sizeof(line), fp) != NULL && n < MAX_MOUNTS) {
+        if (sscanf(line, "%d", &id) != 1)
+            continue;
+
+        /* Look for an existing entry; mountinfo is usually unchanged
+           apart from additions and removals, so try the next entry
+           first */
+
+        m = NULL;
+        for (j = 0; j < numMounts; j++) {
+            if (mounts[(hint + j) % numMounts].id == id) {
+                m = &mounts[(hint + j) % numMounts];
+                kept[(hint + j) % numMounts] = TRUE;
+                hint = (hint + j + 1) % numMounts;
+                break;
+            }
+        }
+
+        if (m != NULL) {
+            newMounts[n] = *m;
+        } else {
+            m = &newMounts[n];
+            memset(m, 0, sizeof(*m));
+            m->id = id;
+            m->state = M_IDLE;
+
+            p = field(line, 4);                 /* Mount point */
+            if (p == NULL)
+                continue;
+            copyField(p, m->path, sizeof(m->path));
+
+            p = strstr(line, " - ");            /* File system type */
+            if (p == NULL)
+                continue;
+            copyField(p + 3, m->fstype, sizeof(m->fstype));
+        }
+        n++;
+    }
+    if (ferror(fp))
+        errExit("fgets");
+
+    /* A worker that is in statfs() for a mount that has gone will not
+       find its entry on return; count it as stuck, since that is what
+       it will assume */
+
+    for (j = 0; j < numMounts; j++)
+        if (!kept[j] && mounts[j].state == M_BUSY)
+            numStuck++;
+
+    memcpy(mounts, newMounts, n * sizeof(struct mount));
+    numMounts = n;
+    tableGen++;
+}
+
+/* Worker thread: perform statfs() calls for the mounts of the current
+   collection, until there are none left, and then wait for more */
+
+static void *
+workerFunc(void *arg)
+{
+    char path[MAX_PATH];
+    struct statfs sfs;
+    struct mount *m;
+    Boolean hung;
+    int s, j, gen, id, idx, err;
+
+    s = pthread_mutex_lock(&mtx);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_lock");
+
+    for (;;) {
+        while (nextMount < numMounts && (mounts[nextMount].state != M_IDLE ||
+                mounts[nextMount].busy))
+            nextMount++;
+
+        if (nextMount >= numMounts) {
+            s = pthread_cond_wait(&workCond, &mtx);
+            if (s != 0)
+                errExitEN(s, "pthread_cond_wait");
+            continue;
+        }
+
+        idx = nextMount++;
+        m = &mounts[idx];
+        m->state = M_BUSY;
+        m->busy = TRUE;
+        clock_gettime(CLOCK_MONOTONIC, &m->started);
+        memcpy(path, m->path, sizeof(path));
+        id = m->id;
+        gen = tableGen;
+
+        s = pthread_mutex_unlock(&mtx);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_unlock");
+
+        err = (statfs(path, &sfs) == -1) ? errno : 0;
+
+        s = pthread_mutex_lock(&mtx);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_lock");
+
+        /* The table may have been reread while we were in statfs() */
+
+        m = NULL;
+        if (gen == tableGen) {
+            m = &mounts[idx];
+        } else {
+            for (j = 0; j < numMounts; j++)
+                if (mounts[j].id == id)
+                    m = &mounts[j];
+        }
+
+        hung = FALSE;
+        if (m != NULL) {
+            hung = m->state == M_HUNG;
+            m->busy = FALSE;
+            if (m->state == M_BUSY) {
+                m->err = err;
+                if (err == 0)
+                    m->cur = sfs;
+                m->state = M_DONE;
+            }
+        }
+
+        /* If the main thread gave up on this call (or the mount has gone),
+           we were no longer counted as a member of the pool; rejoin it,
+           unless there are now enough workers */
+
+        if (hung || m == NULL) {
+            numStuck--;
+            if (numWorkers - numStuck > poolSize) {
+                numWorkers--;
+                break;
+            }
+        }
+
+        s = pthread_cond_signal(&doneCond);
+        if (s != 0)
+            errExitEN(s, "pthread_cond_signal");
+    }
+
+    s = pthread_mutex_unlock(&mtx);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_unlock");
+    return NULL;
+}
+
+static void
+startWorker(void)
+{
+    pthread_attr_t attr;
+    pthread_t t;
+    int s;
+
+    s = pthread_attr_init(&attr);
+    if (s != 0)
+        errExitEN(s, "pthread_attr_init");
+    s = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (s != 0)
+        errExitEN(s, "pthread_attr_setdetachstate");
+    s = pthread_attr_setstacksize(&attr, 64 * 1024 + sizeof(struct statfs));
+    if (s != 0)
+        errExitEN(s, "pthread_attr_setstacksize");
+
+    s = pthread_create(&t, &attr, workerFunc, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_create");
+    numWorkers++;
+
+    pthread_attr_destroy(&attr);
+}
+
+/* Perform one collection: have the workers call statfs() for every
+   mount, waiting at most 'timeoutMs' for each call, and at most until
+   'endBy' in all. Must be called with 'mtx' held. */
+
+static void
+collect(int nthreads, long timeoutMs, const struct timespec *endBy)
+{
+    struct timespec now, wake, t;
+    long long left;
+    Boolean pending;
+    int j, s;
+
+    for (j = 0; j < numMounts; j++) {
+        if (mounts[j].state == M_DONE && mounts[j].err == 0) {
+            mounts[j].prev = mounts[j].cur;
+            mounts[j].havePrev = TRUE;
+        }
+        if (mounts[j].state != M_HUNG)
+            mounts[j].state = M_IDLE;
+        else if (!mounts[j].busy)       /* Hung call has since returned */
+            mounts[j].state = M_IDLE;
+    }
+    nextMount = 0;
+
+    s = pthread_cond_broadcast(&workCond);
+    if (s != 0)
+        errExitEN(s, "pthread_cond_broadcast");
+
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        /* Give up on calls that have exceeded the timeout, and find the
+           earliest time at which an outstanding call will do so */
+
+        wake = *endBy;
+        pending = FALSE;
+        for (j = 0; j < numMounts; j++) {
+            if (mounts[j].state == M_IDLE && !mounts[j].busy) {
+                pending = TRUE;
+            } else if (mounts[j].state == M_BUSY) {
+                left = timeoutMs - tsDiffMsecs(&now, &mounts[j].started);
+                if (left <= 0) {
+                    mounts[j].state = M_HUNG;
+                    numStuck++;
+                } else {
+                    pending = TRUE;
+                    t = mounts[j].started;
+                    tsAddMsecs(&t, timeoutMs);
+                    if (tsDiffMsecs(&t, &wake) < 0)
+                        wake = t;
+                }
+            }
+        }
+
+        if (!pending || tsDiffMsecs(&now, endBy) >= 0)
+            break;
+
+        /* Replace workers that are stuck in hung calls */
+
+        while (numWorkers - numStuck < nthreads && numWorkers < MAX_WORKERS)
+            startWorker();
+
+        s = pthread_cond_timedwait(&doneCond, &mtx, &wake);
+        if (s != 0 && s != ETIMEDOUT)
+            errExitEN(s, "pthread_cond_timedwait");
+    }
+}
+
+static void
+printDelta(long long cur, long long prev, Boolean havePrev)
+{
+    if (havePrev)
+        printf(" (%+lld)", cur - prev);
+}
+
+/* Report the results of the latest collection */
+
+static void
+report(int count, Boolean all)
+{
+    struct mount *m;
+    long long kbUsed, kbAvail, prevUsed, prevAvail;
+    int j, ok, hung, err, skipped;
+    time_t t;
+    char ts[32];
+
+    ok = hung = err = skipped = 0;
+    for (j = 0; j < numMounts; j++) {
+        switch (mounts[j].state) {
+        case M_DONE:    if (mounts[j].err == 0) ok++; else err++;  break;
+        case M_HUNG:    hung++;                                     break;
+        default:        skipped++;                                  break;
+        }
+    }
+
+    t = time(NULL);
+    strftime(ts, sizeof(ts), "%T", localtime(&t));
+    printf("--- %s [%d]: %d mounts, %d ok, %d hung, %d errors, "
+           "%d not polled; %d workers (%d stuck)\n", ts, count, numMounts,
+           ok, hung, err, skipped, numWorkers, numStuck);
+
+    for (j = 0; j < numMounts; j++) {
+        m = &mounts[j];
+
+        if (m->state == M_HUNG) {
+            printf("%s [%s]: HUNG\n", m->path, m->fstype);
+            continue;
+        }
+        if (m->state != M_DONE)
+            continue;
+        if (m->err != 0) {
+            printf("%s [%s]: %s\n", m->path, m->fstype, strerror(m->err));
+            continue;
+        }
+        if (!all && (m->cur.f_blocks == 0 ||
+                (m->havePrev && m->cur.f_bfree == m->prev.f_bfree &&
+                 m->cur.f_bavail == m->prev.f_bavail &&
+                 m->cur.f_ffree == m->prev.f_ffree)))
+            continue;
+
+        kbUsed = (long long) (m->cur.f_blocks - m->cur.f_bfree) *
+                 m->cur.f_bsize / 1024;
+        kbAvail = (long long) m->cur.f_bavail * m->cur.f_bsize / 1024;
+        prevUsed = (long long) (m->prev.f_blocks - m->prev.f_bfree) *
+                   m->prev.f_bsize / 1024;
+        prevAvail = (long long) m->prev.f_bavail * m->prev.f_bsize / 1024;
+
+        printf("%s [%s]: used %lld kB", m->path, m->fstype, kbUsed);
+        printDelta(kbUsed, prevUsed, m->havePrev);
+        printf(", avail %lld kB", kbAvail);
+        printDelta(kbAvail, prevAvail, m->havePrev);
+        printf(", free inodes %lld", (long long) m->cur.f_ffree);
+        printDelta(m->cur.f_ffree, m->prev.f_ffree, m->havePrev);
+        printf("\n");
+    }
+
+    fflush(stdout);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-i secs] [-T msecs] [-t nthreads] "
+            "[-c count] [-a]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct timespec next;
+    pthread_condattr_t cattr;
+    struct pollfd pfd;
+    FILE *fp;
+    Boolean all;
+    int opt, s, interval, nthreads, count, maxCount;
+    long timeoutMs;
+
+    interval = 5;
+    timeoutMs = 1000;
+    nthreads = 4;
+    maxCount = 0;
+    all = FALSE;
+    while ((opt = getopt(argc, argv, "i:T:t:c:a")) != -1) {
+        switch (opt) {
+        case 'i': interval = getInt(optarg, GN_GT_0, "-i");             break;
+        case 'T': timeoutMs = getLong(optarg, GN_GT_0, "-T");           break;
+        case 't': nthreads = getInt(optarg, GN_GT_0, "-t");             break;
+        case 'c': maxCount = getInt(optarg, GN_GT_0, "-c");             break;
+        case 'a': all = TRUE;                                           break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+    if (nthreads > MAX_WORKERS)
+        nthreads = MAX_WORKERS;
+    poolSize = nthreads;
+
+    s = pthread_condattr_init(&cattr);
+    if (s != 0)
+        errExitEN(s, "pthread_condattr_init");
+    s = pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    if (s != 0)
+        errExitEN(s, "pthread_condattr_setclock");
+    s = pthread_cond_init(&doneCond, &cattr);
+    if (s != 0)
+        errExitEN(s, "pthread_cond_init");
+
+    fp = fopen("/proc/self/mountinfo", "re");
+    if (fp == NULL)
+        errExit("fopen");
+    pfd.fd = fileno(fp);
+    pfd.events = POLLPRI;
+
+    s = pthread_mutex_lock(&mtx);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_lock");
+
+    readMountInfo(fp);
+    while (numWorkers < nthreads)
+        startWorker();
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (count = 1; maxCount == 0 || count <= maxCount; count++) {
+
+        /* Reread the mount table if it has changed */
+
+        if (poll(&pfd, 1, 0) == -1)
+            errExit("poll");
+        if (pfd.revents & (POLLPRI | POLLERR))
+            readMountInfo(fp);
+
+        /* Allow the collection to take at most the whole interval */
+
+        tsAddMsecs(&next, interval * 1000LL);
+        collect(nthreads, timeoutMs, &next);
+        report(count, all);
+
+        if (count == maxCount)
+            break;
+
+        s = pthread_mutex_unlock(&mtx);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_unlock");
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+                               NULL) == EINTR)
+            continue;
+
+        s = pthread_mutex_lock(&mtx);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_lock");
+    }
+
+    exit(EXIT_SUCCESS);         /* Terminates any hung workers */
+}
@@ -0,0 +1,476 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 19 */
+
+/* dtree_bench.c
+
+   A benchmark harness that measures how well inotify_dtree.c keeps up
+   with the directory operations performed by rand_dtree.c.
+
+   Usage: dtree_bench [-r rate] [-p nprocs] [-t secs] [-w secs] [-k]
+                      dirpath [-- inotify_dtree-options]
+
+        -r rate     Total number of operations per second performed by
+                    the rand_dtree processes (default: 1000)
+        -p nprocs   Number of rand_dtree processes for each kind of
+                    operation (create, delete, rename); default: 1
+        -t secs     Duration of the run (default: 10 seconds)
+        -w secs     Time allowed for inotify_dtree to catch up once the
+                    rand_dtree processes have been stopped (default: 2)
+        -k          Keep the log and trace files (in a temporary
+                    directory whose name is displayed on stderr)
+
+   Any arguments following "--" are passed to inotify_dtree (e.g., "-n"
+   to disable event coalescing).
+
+   The program starts inotify_dtree (with the -T option) to monitor
+   'dirpath', which should be an empty directory, waits for it to display
+   its prompt, and then starts the rand_dtree processes (with the -r and
+   -T options). Each rand_dtree process logs a timestamp when it starts
+   an operation, and inotify_dtree logs a timestamp when it updates its
+   cache; both use CLOCK_MONOTONIC, so the difference between the two
+   timestamps for a pathname is the time taken for the change to be
+   reflected in the cache.
+
+   At the end of the run, the program writes a single JSON object to
+   stdout, containing:
+
+   * the number of operations performed, and the number for which a
+     matching cache update was found (updates can legitimately be missed;
+     for example, inotify_dtree doesn't watch a directory that has already
+     been deleted by the time that the creation event is processed);
+   * percentiles of the operation-to-cache-update latency (microseconds);
+   * the number of queue overflows, and overflows per minute;
+   * the numbers of inotify events read, coalesced, and applied by
+     inotify_dtree;
+   * the CPU time (user + system) consumed by inotify_dtree, in total and
+     per 1000 events read.
+
+   The rand_dtree and inotify_dtree programs are expected to reside in
+   the same directory as this program.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <limits.h>
+#include <libgen.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#define MAX_PROCS 64
+#define MAX_ARGS 64
+#define MATCH_SLACK 0.001       /* Tolerance (seconds) for a cache update
+                                   that is timestamped fractionally before
+                                   the operation that it reflects */
+
+/* A timestamped record, from either a rand_dtree log or the
+   inotify_dtree trace */
+
+struct rec {
+    double ts;
+    char type;                  /* 'A' (added), 'D' (deleted), 'R' (renamed),
+                                   or 'O' (overflow) */
+    char *path;
+};
+
+struct recList {
+    struct rec *recs;
+    size_t num, max;
+};
+
+static void
+addRec(struct recList *rl, double ts, char type, const char *path)
+{
+    if (rl->num >= rl->max) {
+        rl->max = (rl->max == 0) ? 1024 : rl->max * 2;
+        rl->recs = realloc(rl->recs, rl->max * sizeof(struct rec));
+        if (rl->recs == NULL)
+            errExit("realloc");
+    }
+
+    rl->recs[rl->num].ts = ts;
+    rl->recs[rl->num].type = type;
+    rl->recs[rl->num].path = strdup(path);
+    if (rl->recs[rl->num].path == NULL)
+        errExit("strdup");
+    rl->num++;
+}
+
+/* Order trace records by (type, pathname, timestamp), so that the
+   updates for a given pathname can be found by binary search */
+
+static int
+cmpRec(const void *a, const void *b)
+{
+    const struct rec *ra = a, *rb = b;
+    int s;
+
+    if (ra->type != rb->type)
+        return ra->type - rb->type;
+    s = strcmp(ra->path, rb->path);
+    if (s != 0)
+        return s;
+    return (ra->ts > rb->ts) - (ra->ts < rb->ts);
+}
+
+static int
+cmpDouble(const void *a, const void *b)
+{
+    double da = *(const double *) a, db = *(const double *) b;
+
+    return (da > db) - (da < db);
+}
+
+/* Return the timestamp of the earliest trace record of type 'type' for
+   'path' that is no earlier than 'ts' (less MATCH_SLACK), or -1 if there
+   is none */
+
+static double
+findUpdate(const struct recList *trace, char type, const char *path,
+           double ts)
+{
+    struct rec key;
+    size_t lo, hi, mid;
+
+    key.type = type;
+    key.path = (char *) path;
+    key.ts = ts - MATCH_SLACK;
+
+    lo = 0;
+    hi = trace->num;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (cmpRec(&trace->recs[mid], &key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < trace->num && trace->recs[lo].type == type &&
+            strcmp(trace->recs[lo].path, path) == 0)
+        return trace->recs[lo].ts;
+    return -1;
+}
+
+/* Read a rand_dtree log file (created with -T), adding a record for each
+   operation to 'ops'. A rename is recorded under its new pathname. */
+
+static void
+readOpLog(const char *file, struct recList *ops)
+{
+    char line[2 * PATH_MAX + 64], op[16], *p, *q;
+    double ts;
+    FILE *fp;
+
+    fp = fopen(file, "r");
+    if (fp == NULL)
+        errExit("fopen: %s", file);
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%lf %15s", &ts, op) != 2)
+            continue;
+
+        p = strchr(line, ' ');
+        p = (p == NULL) ? NULL : strchr(p + 1, ' ');
+        if (p == NULL)
+            continue;
+        p++;
+
+        if (strcmp(op, "mkdir:") == 0) {
+            addRec(ops, ts, 'A', p);
+        } else if (strcmp(op, "rmdir:") == 0) {
+            addRec(ops, ts, 'D', p);
+        } else if (strcmp(op, "rename:") == 0) {
+            q = strstr(p, " ==> ");
+            if (q != NULL)
+                addRec(ops, ts, 'R', q + 5);
+        }
+    }
+
+    fclose(fp);
+}
+
+/* Read the inotify_dtree trace; the final statistics line is returned
+   via 'evRead', 'evCoalesced', and 'evApplied' */
+
+static void
+readTrace(const char *file, struct recList *trace, unsigned long *evRead,
+          unsigned long *evCoalesced, unsigned long *evApplied)
+{
+    char line[PATH_MAX + 64], type;
+    double ts;
+    int off;
+    FILE *fp;
+
+    fp = fopen(file, "r");
+    if (fp == NULL)
+        errExit("fopen: %s", file);
+
+    *evRead = *evCoalesced = *evApplied = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == 'S') {
+            sscanf(line, "S %lu %lu %lu", evRead, evCoalesced, evApplied);
+        } else if (sscanf(line, "%lf %c %n", &ts, &type, &off) == 2) {
+            addRec(trace, ts, type, (off > 0) ? line + off : "");
+        }
+    }
+
+    fclose(fp);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+sleepSecs(double secs)
+{
+    struct timespec ts;
+
+    ts.tv_sec = secs;
+    ts.tv_nsec = (secs - ts.tv_sec) * 1e9;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        continue;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-r rate] [-p nprocs] [-t secs] [-w secs] "
+                    "[-k]\n\t\tdirpath [-- inotify_dtree-options]\n",
+                    progName);
+    fprintf(stderr, "    -r rate     Total operations per second "
+                    "(default: 1000)\n");
+    fprintf(stderr, "    -p nprocs   rand_dtree processes per operation "
+                    "type (default: 1)\n");
+    fprintf(stderr, "    -t secs     Duration of run (default: 10)\n");
+    fprintf(stderr, "    -w secs     Catch-up time after run (default: 2)\n");
+    fprintf(stderr, "    -k          Keep log and trace files\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char opTypes[] = "cdm";
+    char binDir[PATH_MAX], prog[PATH_MAX + 32], rateStr[32];
+    char workDir[] = "/tmp/dtree_bench.XXXXXX";
+    char traceFile[PATH_MAX], logFile[PATH_MAX], *treeDir;
+    char *idArgv[MAX_ARGS + 8];
+    pid_t idPid, randPid[MAX_PROCS * 3];
+    int toId[2], fromId[2];
+    int opt, nprocs, nrand, idArgc, status, j;
+    Boolean keep;
+    double rate, duration, wait, start, runSecs, cpuSecs, ts, *lat;
+    struct recList ops = { NULL, 0, 0 }, trace = { NULL, 0, 0 };
+    unsigned long evRead, evCoalesced, evApplied, overflows;
+    size_t numLat;
+    struct rusage ru;
+    char ch;
+
+    rate = 1000;
+    nprocs = 1;
+    duration = 10;
+    wait = 2;
+    keep = FALSE;
+    while ((opt = getopt(argc, argv, "r:p:t:w:k")) != -1) {
+        switch (opt) {
+        case 'r':   rate = atof(optarg);                            break;
+        case 'p':   nprocs = getInt(optarg, GN_GT_0, "nprocs");     break;
+        case 't':   duration = atof(optarg);                        break;
+        case 'w':   wait = atof(optarg);                            break;
+        case 'k':   keep = TRUE;                                    break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind >= argc || nprocs > MAX_PROCS || rate <= 0 || duration <= 0)
+        usageError(argv[0]);
+    if (argc - optind - 1 > MAX_ARGS)
+        usageError(argv[0]);
+
+    /* The cache pathnames and the rand_dtree pathnames must be comparable,
+       so use an absolute pathname for the tree */
+
+    treeDir = realpath(argv[optind], NULL);
+    if (treeDir == NULL)
+        errExit("realpath: %s", argv[optind]);
+
+    snprintf(prog, sizeof(prog), "%s", argv[0]);
+    snprintf(binDir, sizeof(binDir), "%s", dirname(prog));
+
+    if (mkdtemp(workDir) == NULL)
+        errExit("mkdtemp");
+    snprintf(traceFile, sizeof(traceFile), "%s/trace", workDir);
+
+    /* Start inotify_dtree, connected to us via pipes for its stdin and
+       stdout */
+
+    if (pipe(toId) == -1 || pipe(fromId) == -1)
+        errExit("pipe");
+
+    snprintf(prog, sizeof(prog), "%s/inotify_dtree", binDir);
+    idArgc = 0;
+    idArgv[idArgc++] = prog;
+    idArgv[idArgc++] = "-T";
+    idArgv[idArgc++] = traceFile;
+    for (j = optind + 1; j < argc; j++)
+        idArgv[idArgc++] = argv[j];
+    idArgv[idArgc++] = treeDir;
+    idArgv[idArgc] = NULL;
+
+    idPid = fork();
+    if (idPid == -1)
+        errExit("fork");
+    if (idPid == 0) {
+        if (dup2(toId[0], STDIN_FILENO) == -1 ||
+                dup2(fromId[1], STDOUT_FILENO) == -1)
+            errExit("dup2");
+        close(toId[0]);
+        close(toId[1]);
+        close(fromId[0]);
+        close(fromId[1]);
+        execv(prog, idArgv);
+        errExit("execv: %s", prog);
+    }
+
+    close(toId[0]);
+    close(fromId[1]);
+
+    /* inotify_dtree displays its prompt once its cache is initialized */
+
+    for (;;) {
+        if (read(fromId[0], &ch, 1) != 1)
+            fatal("inotify_dtree failed to start");
+        if (ch == '>')
+            break;
+    }
+
+    /* Start the rand_dtree processes */
+
+    snprintf(prog, sizeof(prog), "%s/rand_dtree", binDir);
+    snprintf(rateStr, sizeof(rateStr), "%f", rate / (3 * nprocs));
+    nrand = 0;
+    start = now();
+    for (j = 0; j < 3 * nprocs; j++) {
+        char opStr[2] = { opTypes[j % 3], '\0' };
+
+        snprintf(logFile, sizeof(logFile), "%s/ops.%d", workDir, j);
+
+        randPid[nrand] = fork();
+        if (randPid[nrand] == -1)
+            errExit("fork");
+        if (randPid[nrand] == 0) {
+            close(toId[1]);
+            close(fromId[0]);
+            execl(prog, prog, "-T", "-r", rateStr, "-l", logFile,
+                  treeDir, opStr, (char *) NULL);
+            errExit("execl: %s", prog);
+        }
+        nrand++;
+    }
+
+    sleepSecs(duration);
+
+    for (j = 0; j < nrand; j++)
+        kill(randPid[j], SIGTERM);
+    for (j = 0; j < nrand; j++)
+        waitpid(randPid[j], NULL, 0);
+    runSecs = now() - start;
+
+    /* Give inotify_dtree time to catch up, and then tell it to quit */
+
+    sleepSecs(wait);
+
+    if (write(toId[1], "q\n", 2) != 2)
+        errExit("write");
+    if (wait4(idPid, &status, 0, &ru) == -1)
+        errExit("wait4");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        fatal("inotify_dtree terminated abnormally (status %#x)", status);
+
+    cpuSecs = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+              ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+
+    /* Gather the results */
+
+    for (j = 0; j < nrand; j++) {
+        snprintf(logFile, sizeof(logFile), "%s/ops.%d", workDir, j);
+        readOpLog(logFile, &ops);
+    }
+    readTrace(traceFile, &trace, &evRead, &evCoalesced, &evApplied);
+
+    overflows = 0;
+    for (size_t k = 0; k < trace.num; k++)
+        if (trace.recs[k].type == 'O')
+            overflows++;
+
+    qsort(trace.recs, trace.num, sizeof(struct rec), cmpRec);
+
+    /* A rename of an uncached directory may be reflected in the cache
+       as an addition rather than a rename */
+
+    lat = malloc((ops.num + 1) * sizeof(double));
+    if (lat == NULL)
+        errExit("malloc");
+    numLat = 0;
+    for (size_t k = 0; k < ops.num; k++) {
+        struct rec *r = &ops.recs[k];
+
+        ts = findUpdate(&trace, r->type, r->path, r->ts);
+        if (ts < 0 && r->type == 'R')
+            ts = findUpdate(&trace, 'A', r->path, r->ts);
+        if (ts >= 0)
+            lat[numLat++] = (ts > r->ts) ? (ts - r->ts) * 1e6 : 0;
+    }
+    qsort(lat, numLat, sizeof(double), cmpDouble);
+
+#define PCTILE(p) ((numLat == 0) ? 0.0 : lat[(size_t) ((numLat - 1) * (p))])
+
+    printf("{\"rate\": %.0f, \"nprocs\": %d, \"duration\": %.3f, "
+           "\"ops\": %zu, \"matched\": %zu, "
+           "\"latency_us\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+           "\"p999\": %.1f, \"max\": %.1f}, "
+           "\"overflows\": %lu, \"overflows_per_min\": %.2f, "
+           "\"events_read\": %lu, \"events_coalesced\": %lu, "
+           "\"events_applied\": %lu, \"cpu_secs\": %.3f, "
+           "\"cpu_ms_per_1k_events\": %.3f}\n",
+           rate, nprocs, runSecs, ops.num, numLat,
+           PCTILE(0.5), PCTILE(0.9), PCTILE(0.99), PCTILE(0.999),
+           PCTILE(1.0), overflows, overflows * 60 / runSecs,
+           evRead, evCoalesced, evApplied, cpuSecs,
+           (evRead > 0) ? cpuSecs * 1e3 / (evRead / 1000.0) : 0.0);
+
+    if (keep) {
+        fprintf(stderr, "Logs and trace kept in %s\n", workDir);
+    } else {
+        for (j = 0; j < nrand; j++) {
+            snprintf(logFile, sizeof(logFile), "%s/ops.%d", workDir, j);
+            unlink(logFile);
+        }
+        unlink(traceFile);
+        rmdir(workDir);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,810 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 19 */
+
+/* fanotify_dtree.c
+
+   A counterpart to inotify_dtree.c that uses fanotify (rather than
+   inotify) to monitor directory operations in the trees named on its
+   command line.
+
+   inotify_dtree.c must place one watch on every directory in the trees,
+   which means that it must scan the trees at start-up (and after queue
+   overflows), and that both its own memory use and the kernel's grow with
+   the size of the trees. This program instead places a single fanotify
+   mark on each filesystem that contains one of the trees
+   (FAN_MARK_FILESYSTEM), and initializes the fanotify group with
+   FAN_REPORT_DFID_NAME (Linux 5.9 and later), so that directory entry
+   events (creation, deletion, and renaming) identify the parent directory
+   by a file handle, plus the name of the affected entry.
+
+   File handles are converted to pathnames lazily, using a cache (the
+   "path cache"). On a cache miss, the handle is opened with
+   open_by_handle_at(2), and the pathname is obtained by reading the
+   /proc/self/fd symbolic link for the resulting file descriptor. When a
+   directory is deleted or renamed, the cache entries for the directory
+   and its descendants are discarded, to be looked up afresh when next
+   needed. Thus, the cache contains entries only for directories in which
+   events have occurred, and recovery from a queue overflow consists
+   simply of discarding the whole cache.
+
+   The command interface is the same as for inotify_dtree.c (so that the
+   two programs can be compared), except that the cache that is listed
+   and checked is the path cache, and the 's' command displays event and
+   cache statistics.
+
+   This program requires the CAP_SYS_ADMIN capability (for fanotify) and
+   the CAP_DAC_READ_SEARCH capability (for open_by_handle_at()). Events
+   are reported only for directories (in the same way that inotify_dtree.c
+   monitors only directories).
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/fanotify.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+/* logMessage() flags */
+
+#define VB_BASIC 1      /* Basic messages */
+#define VB_NOISY 2      /* Verbose messages */
+
+static int verboseMask;
+static int checkCache;
+static int dumpCache;
+static int readBufferSize = 0;
+static char *stopFile;
+static int abortOnCacheProblem;
+
+static FILE *logfp = NULL;
+
+#define READ_BUF_LEN (64 * 1024)
+
+static void dumpCacheToLog(void);
+
+/* Statistics displayed by the 's' command */
+
+static unsigned long numReads, numEvents, numDirEvents;
+static unsigned long cacheHits, cacheMisses, cacheInvalidations;
+static unsigned long numOverflows;
+
+/* Something went badly wrong. Create a 'stop' file to signal the
+   'rand_dtree' processes to stop, dump a copy of the cache to the
+   log file, and abort. */
+
+__attribute__ ((__noreturn__))
+static void
+createStopFileAndAbort(void)
+{
+    open(stopFile, O_CREAT | O_RDWR, 0600);
+    dumpCacheToLog();
+    abort();
+}
+
+/* Write a log message. The message is sent to none, either, or both of
+   stderr and the log file, depending on 'vb_mask' and whether a log file
+   has been specified via command-line options . */
+
+static void
+logMessage(int vb_mask, const char *format, ...)
+{
+    va_list argList;
+
+    if ((vb_mask == 0) || (vb_mask & verboseMask)) {
+        va_start(argList, format);
+        vfprintf(stderr, format, argList);
+        va_end(argList);
+    }
+
+    if (logfp != NULL) {
+        va_start(argList, format);
+        vfprintf(logfp, format, argList);
+        va_end(argList);
+    }
+}
+
+/***********************************************************************/
+
+/* The root directories (command-line arguments). For each, we record its
+   absolute pathname (as returned by realpath()), the ID of the filesystem
+   that contains it, and a file descriptor that refers to that filesystem,
+   for use with open_by_handle_at(). */
+
+struct root {
+    char *path;
+    size_t len;
+    fsid_t fsid;
+    int mountFd;
+};
+
+static struct root *roots;
+static int numRoots;
+
+/* Is 'path' inside one of the root directories? */
+
+static Boolean
+inRoots(const char *path)
+{
+    for (int j = 0; j < numRoots; j++)
+        if (strncmp(path, roots[j].path, roots[j].len) == 0 &&
+                (path[roots[j].len] == '/' || path[roots[j].len] == '\0' ||
+                 roots[j].len == 1))
+            return TRUE;
+    return FALSE;
+}
+
+/* Return a file descriptor for the filesystem whose ID is 'fsid', or -1
+   if that filesystem is not one that we are monitoring */
+
+static int
+fsidToMountFd(const fsid_t *fsid)
+{
+    for (int j = 0; j < numRoots; j++)
+        if (memcmp(&roots[j].fsid, fsid, sizeof(fsid_t)) == 0)
+            return roots[j].mountFd;
+    return -1;
+}
+
+/***********************************************************************/
+
+/* The path cache: a hash table that maps (filesystem ID, file handle)
+   to pathname. Each entry records the handle in a single buffer
+   containing the filesystem ID, the handle type, and the handle bytes. */
+
+struct pathEnt {
+    struct pathEnt *next;       /* Next entry in hash chain */
+    unsigned int hash;
+    size_t keyLen;
+    unsigned char *key;
+    char *path;
+};
+
+#define HASH_SIZE 4096          /* Must be a power of 2 */
+
+static struct pathEnt *pathHash[HASH_SIZE];
+static long cacheEntries;
+
+/* Build the lookup key for a handle in 'buf' (which must be large
+   enough); return the key length */
+
+static size_t
+makeKey(unsigned char *buf, const fsid_t *fsid, const struct file_handle *fh)
+{
+    memcpy(buf, fsid, sizeof(fsid_t));
+    memcpy(buf + sizeof(fsid_t), &fh->handle_type, sizeof(int));
+    memcpy(buf + sizeof(fsid_t) + sizeof(int), fh->f_handle,
+           fh->handle_bytes);
+    return sizeof(fsid_t) + sizeof(int) + fh->handle_bytes;
+}
+
+static unsigned int
+hashKey(const unsigned char *key, size_t len)   /* FNV-1a */
+{
+    unsigned int h = 2166136261U;
+
+    for (size_t j = 0; j < len; j++)
+        h = (h ^ key[j]) * 16777619U;
+    return h;
+}
+
+static struct pathEnt *
+cacheLookup(const unsigned char *key, size_t keyLen, unsigned int h)
+{
+    for (struct pathEnt *e = pathHash[h & (HASH_SIZE - 1)]; e != NULL;
+            e = e->next)
+        if (e->hash == h && e->keyLen == keyLen &&
+                memcmp(e->key, key, keyLen) == 0)
+            return e;
+    return NULL;
+}
+
+static void
+cacheInsert(const unsigned char *key, size_t keyLen, unsigned int h,
+            const char *path)
+{
+    struct pathEnt *e;
+
+    e = malloc(sizeof(struct pathEnt));
+    if (e == NULL)
+        errExit("malloc");
+    e->key = malloc(keyLen);
+    e->path = strdup(path);
+    if (e->key == NULL || e->path == NULL)
+        errExit("malloc");
+
+    memcpy(e->key, key, keyLen);
+    e->keyLen = keyLen;
+    e->hash = h;
+    e->next = pathHash[h & (HASH_SIZE - 1)];
+    pathHash[h & (HASH_SIZE - 1)] = e;
+    cacheEntries++;
+}
+
+static void
+freeEnt(struct pathEnt *e)
+{
+    free(e->key);
+    free(e->path);
+    free(e);
+    cacheEntries--;
+}
+
+/* Discard the cache entries for 'path' and everything below it. (This
+   requires a scan of the whole cache, but the cache contains entries
+   only for recently active directories.) */
+
+static void
+cacheInvalidate(const char *path)
+{
+    size_t len = strlen(path);
+
+    for (int b = 0; b < HASH_SIZE; b++) {
+        for (struct pathEnt **ep = &pathHash[b]; *ep != NULL; ) {
+            struct pathEnt *e = *ep;
+
+            if (strncmp(e->path, path, len) == 0 &&
+                    (e->path[len] == '/' || e->path[len] == '\0')) {
+                logMessage(VB_NOISY, "    invalidate: %s\n", e->path);
+                *ep = e->next;
+                freeEnt(e);
+                cacheInvalidations++;
+            } else {
+                ep = &e->next;
+            }
+        }
+    }
+}
+
+static void
+freeCache(void)
+{
+    for (int b = 0; b < HASH_SIZE; b++) {
+        while (pathHash[b] != NULL) {
+            struct pathEnt *e = pathHash[b];
+
+            pathHash[b] = e->next;
+            freeEnt(e);
+        }
+    }
+}
+
+/* Obtain the current pathname of the object referred to by 'fh' (on the
+   filesystem referred to by 'mountFd'), placing it in 'path'. Returns 0
+   on success, or -1 on error (e.g., ESTALE if the object no longer
+   exists). */
+
+static int
+handleToPath(int mountFd, struct file_handle *fh, char *path, size_t size)
+{
+    char procPath[64];
+    ssize_t len;
+    int fd;
+
+    fd = open_by_handle_at(mountFd, fh, O_PATH);
+    if (fd == -1)
+        return -1;
+
+    snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", fd);
+    len = readlink(procPath, path, size - 1);
+    close(fd);
+    if (len == -1)
+        return -1;
+
+    path[len] = '\0';
+    return 0;
+}
+
+/* Return (in 'path') the pathname of the directory identified by 'fsid'
+   and 'fh', consulting the cache first */
+
+static int
+resolveHandle(const fsid_t *fsid, struct file_handle *fh, char *path,
+              size_t size)
+{
+    unsigned char key[sizeof(fsid_t) + sizeof(int) + MAX_HANDLE_SZ];
+    struct pathEnt *e;
+    unsigned int h;
+    size_t keyLen;
+    int mountFd;
+
+    if (fh->handle_bytes > MAX_HANDLE_SZ) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    keyLen = makeKey(key, fsid, fh);
+    h = hashKey(key, keyLen);
+
+    e = cacheLookup(key, keyLen, h);
+    if (e != NULL) {
+        cacheHits++;
+        snprintf(path, size, "%s", e->path);
+        return 0;
+    }
+
+    cacheMisses++;
+    mountFd = fsidToMountFd(fsid);
+    if (mountFd == -1) {
+        errno = EXDEV;
+        return -1;
+    }
+    if (handleToPath(mountFd, fh, path, size) == -1)
+        return -1;
+
+    /* The mark covers the whole filesystem, so we may see events in
+       directories that lie outside the trees; don't let those fill the
+       cache */
+
+    if (inRoots(path)) {
+        cacheInsert(key, keyLen, h, path);
+        logMessage(VB_NOISY, "    cached: %s\n", path);
+    }
+    return 0;
+}
+
+/* Check that each cached handle still resolves to its cached pathname.
+   Returns the number of failures; '*verified' returns the number of
+   entries that were correct. */
+
+static int
+verifyCache(Boolean logEach, int *verified)
+{
+    char path[PATH_MAX];
+    struct file_handle *fh;
+    fsid_t fsid;
+    int failures, mountFd;
+
+    fh = malloc(sizeof(struct file_handle) + MAX_HANDLE_SZ);
+    if (fh == NULL)
+        errExit("malloc");
+
+    failures = 0;
+    *verified = 0;
+    for (int b = 0; b < HASH_SIZE; b++) {
+        for (struct pathEnt *e = pathHash[b]; e != NULL; e = e->next) {
+            memcpy(&fsid, e->key, sizeof(fsid_t));
+            memcpy(&fh->handle_type, e->key + sizeof(fsid_t), sizeof(int));
+            fh->handle_bytes = e->keyLen - sizeof(fsid_t) - sizeof(int);
+            memcpy(fh->f_handle, e->key + sizeof(fsid_t) + sizeof(int),
+                   fh->handle_bytes);
+
+            mountFd = fsidToMountFd(&fsid);
+            if (handleToPath(mountFd, fh, path, sizeof(path)) == -1) {
+                if (logEach)
+                    logMessage(VB_BASIC, "resolve: %s: %s\n", e->path,
+                               strerror(errno));
+                failures++;
+            } else if (strcmp(path, e->path) != 0) {
+                logMessage(0, "Stale cache entry: %s (now %s)\n",
+                           e->path, path);
+                failures++;
+            } else {
+                if (logEach)
+                    logMessage(VB_NOISY, "OK: %s\n", e->path);
+                (*verified)++;
+            }
+        }
+    }
+
+    free(fh);
+    return failures;
+}
+
+static void
+checkCacheConsistency(void)
+{
+    int failures, verified;
+
+    failures = verifyCache(FALSE, &verified);
+    if (failures > 0) {
+        logMessage(VB_NOISY, "checkCacheConsistency: %d failures\n",
+                   failures);
+        if (abortOnCacheProblem)
+            createStopFileAndAbort();
+    }
+}
+
+static void
+dumpCacheToLog(void)
+{
+    if (logfp == NULL)
+        return;
+
+    for (int b = 0; b < HASH_SIZE; b++)
+        for (struct pathEnt *e = pathHash[b]; e != NULL; e = e->next)
+            fprintf(logfp, "%s\n", e->path);
+
+    fprintf(logfp, "Total entries: %ld\n", cacheEntries);
+}
+
+/***********************************************************************/
+
+/* Process one fanotify event */
+
+static void
+processEvent(struct fanotify_event_metadata *ev)
+{
+    struct fanotify_event_info_fid *fid;
+    struct file_handle *fh;
+    char dirPath[PATH_MAX], fullPath[PATH_MAX + NAME_MAX + 1];
+    const char *name;
+
+    numEvents++;
+
+    if (ev->mask & FAN_Q_OVERFLOW) {
+
+        /* Events were lost. Since the cache is populated lazily, we
+           can recover simply by discarding the entire cache. */
+
+        numOverflows++;
+        logMessage(0, "Queue overflow (%lu); discarding %ld cache "
+                "entries\n", numOverflows, cacheEntries);
+        freeCache();
+        return;
+    }
+
+    if (!(ev->mask & FAN_ONDIR))
+        return;                 /* We monitor only directories */
+
+    /* With FAN_REPORT_DFID_NAME, the metadata is followed by a record
+       identifying the parent directory and the name of the entry */
+
+    fid = (struct fanotify_event_info_fid *) (ev + 1);
+    if ((char *) fid >= (char *) ev + ev->event_len ||
+            fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+        return;
+
+    fh = (struct file_handle *) fid->handle;
+    name = (const char *) fh->f_handle + fh->handle_bytes;
+
+    if (resolveHandle((fsid_t *) &fid->fsid, fh, dirPath, sizeof(dirPath)) == -1) {
+
+        /* The parent directory has itself already been deleted */
+
+        logMessage(VB_BASIC, "Could not resolve parent of '%s': %s\n",
+                name, strerror(errno));
+        return;
+    }
+
+    if (strcmp(dirPath, "/") == 0)
+        snprintf(fullPath, sizeof(fullPath), "/%s", name);
+    else
+        snprintf(fullPath, sizeof(fullPath), "%s/%s", dirPath, name);
+
+    if (!inRoots(fullPath))
+        return;
+
+    numDirEvents++;
+
+    if (ev->mask & FAN_CREATE) {
+        logMessage(VB_BASIC, "Directory creation: %s\n", fullPath);
+
+    } else if (ev->mask & FAN_DELETE) {
+        logMessage(VB_BASIC, "Directory deletion: %s\n", fullPath);
+        cacheInvalidate(fullPath);
+
+    } else if (ev->mask & FAN_MOVED_FROM) {
+
+        /* Unlike inotify_dtree.c, we don't need to match this event
+           with a following FAN_MOVED_TO event: we simply discard the
+           cached pathnames under the old name, and they'll be resolved
+           afresh when they are next needed */
+
+        logMessage(VB_BASIC, "Rename from: %s\n", fullPath);
+        cacheInvalidate(fullPath);
+
+    } else if (ev->mask & FAN_MOVED_TO) {
+        logMessage(VB_BASIC, "Rename to: %s\n", fullPath);
+        cacheInvalidate(fullPath);      /* In case a directory was
+                                           replaced */
+    }
+
+    if (checkCache)
+        checkCacheConsistency();
+
+    if (dumpCache)
+        dumpCacheToLog();
+}
+
+/* Read and process a buffer of events from the fanotify file descriptor */
+
+static void
+processFanotifyEvents(int fanFd)
+{
+    char buf[READ_BUF_LEN]
+        __attribute__ ((aligned(__alignof__(struct fanotify_event_metadata))));
+    struct fanotify_event_metadata *ev;
+    ssize_t numRead;
+    size_t cnt;
+
+    cnt = (readBufferSize > 0 && readBufferSize < READ_BUF_LEN) ?
+                readBufferSize : READ_BUF_LEN;
+    numRead = read(fanFd, buf, cnt);
+    if (numRead == -1)
+        errExit("read");
+
+    numReads++;
+    logMessage(VB_NOISY, "\n==========> Read %lu: got %zd bytes\n",
+               numReads, numRead);
+
+    for (ev = (struct fanotify_event_metadata *) buf;
+            FAN_EVENT_OK(ev, numRead); ev = FAN_EVENT_NEXT(ev, numRead)) {
+        if (ev->vers != FANOTIFY_METADATA_VERSION)
+            fatal("Unexpected fanotify metadata version");
+        processEvent(ev);
+        if (ev->fd >= 0)        /* Shouldn't happen with FID reporting */
+            close(ev->fd);
+    }
+}
+
+/***********************************************************************/
+
+/* Create the fanotify group, and mark each filesystem that contains one
+   of the root directories */
+
+static int
+initialize(void)
+{
+    struct timespec start, end;
+    struct statfs sfs;
+    int fanFd;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+
+    fanFd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME,
+                          O_RDONLY | O_LARGEFILE);
+    if (fanFd == -1)
+        errExit("fanotify_init");
+
+    for (int j = 0; j < numRoots; j++) {
+        if (fstatfs(roots[j].mountFd, &sfs) == -1)
+            errExit("fstatfs");
+        roots[j].fsid = sfs.f_fsid;
+
+        if (fanotify_mark(fanFd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+                          FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM |
+                          FAN_MOVED_TO | FAN_ONDIR, AT_FDCWD,
+                          roots[j].path) == -1)
+            errExit("fanotify_mark: %s", roots[j].path);
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+
+    logMessage(0, "Initialized %d root(s) in %.6f s\n", numRoots,
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    return fanFd;
+}
+
+/* We allow the same simple interactive commands as inotify_dtree.c */
+
+static void
+executeCommand(void)
+{
+    const int MAX_LINE = 100;
+    ssize_t numRead;
+    char line[MAX_LINE], arg[MAX_LINE];
+    char cmd;
+    int ns, failures, verified;
+    FILE *fp;
+
+    numRead = read(STDIN_FILENO, line, MAX_LINE);
+    if (numRead <= 0) {
+        printf("bye!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    line[numRead - 1] = '\0';
+
+    if (strlen(line) == 0)
+        return;
+
+    ns = sscanf(line, "%c %s\n", &cmd, arg);
+
+    switch (cmd) {
+
+    case 'c':   /* Check that all cached handles resolve to cached paths */
+    case 'C':
+        failures = verifyCache(cmd == 'c', &verified);
+        logMessage(0, "Successfully verified %d entries\n", verified);
+        logMessage(0, "Failures: %d\n", failures);
+        break;
+
+    case 'l':   /* List entries in the cache */
+        for (int b = 0; b < HASH_SIZE; b++)
+            for (struct pathEnt *e = pathHash[b]; e != NULL; e = e->next)
+                logMessage(0, "%s\n", e->path);
+        logMessage(VB_BASIC, "Total entries: %ld\n", cacheEntries);
+        break;
+
+    case 'q':   /* Quit */
+        exit(EXIT_SUCCESS);
+
+    case 's':   /* Display statistics */
+        logMessage(0, "reads: %lu; events: %lu (directory events in "
+                "trees: %lu); overflows: %lu\n", numReads, numEvents,
+                numDirEvents, numOverflows);
+        logMessage(0, "cache: %ld entries; %lu hits; %lu misses; "
+                "%lu invalidations\n", cacheEntries, cacheHits,
+                cacheMisses, cacheInvalidations);
+        break;
+
+    case 'v':   /* Set log verbosity level */
+        if (ns == 2)
+            verboseMask = atoi(arg);
+        else {
+            verboseMask = !verboseMask;
+            printf("%s\n", verboseMask ? "on" : "off");
+        }
+        break;
+
+    case 'd':   /* Toggle cache dumping */
+        dumpCache = !dumpCache;
+        printf("%s\n", dumpCache ? "on" : "off");
+        break;
+
+    case 'x':   /* Toggle cache checking */
+        checkCache = !checkCache;
+        printf("%s\n", checkCache ? "on" : "off");
+        break;
+
+    case 'w':   /* Write cached pathname list to file */
+        fp = fopen(arg, "w+");
+        if (fp == NULL) {
+            perror("fopen");
+            break;
+        }
+        for (int b = 0; b < HASH_SIZE; b++)
+            for (struct pathEnt *e = pathHash[b]; e != NULL; e = e->next)
+                fprintf(fp, "%s\n", e->path);
+        fclose(fp);
+        break;
+
+    case '0':   /* Discard cache */
+        freeCache();
+        break;
+
+    default:
+        printf("Unrecognized command: %c\n", cmd);
+        printf("Commands:\n");
+        printf("0        Discard path cache\n");
+        printf("c        Verify cached pathnames\n");
+        printf("d        Toggle cache dumping\n");
+        printf("l        List cached pathnames\n");
+        printf("q        Quit\n");
+        printf("s        Display statistics\n");
+        printf("v [n]    Toggle/set verbose level for messages to stderr\n");
+        printf("             0 = no messages\n");
+        printf("             1 = basic messages\n");
+        printf("             2 = verbose messages\n");
+        printf("             3 = basic and verbose messages\n");
+        printf("w file   Write cached pathname list to file\n");
+        printf("x        Toggle cache checking\n");
+        break;
+    }
+}
+
+/***********************************************************************/
+
+static void
+usageError(const char *pname)
+{
+    fprintf(stderr, "Usage: %s [options] directory-path...\n\n", pname);
+    fprintf(stderr, "    -v lvl   Display logging information\n");
+    fprintf(stderr, "    -l file  Send logging information to a file\n");
+    fprintf(stderr, "    -x       Check cache consistency after each "
+                                  "operation\n");
+    fprintf(stderr, "    -d       Dump cache to log after every operation\n");
+    fprintf(stderr, "    -b size  Set buffer size for read() from "
+                                  "fanotify FD\n");
+    fprintf(stderr, "    -a file  Abort when cache inconsistency detected, "
+            "and create 'stop' file\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    fd_set rfds;
+    int opt, fanFd;
+
+    verboseMask = 0;
+    checkCache = 0;
+    dumpCache = 0;
+    stopFile = NULL;
+    abortOnCacheProblem = 0;
+
+    while ((opt = getopt(argc, argv, "a:dxl:v:b:")) != -1) {
+        switch (opt) {
+        case 'a':
+            abortOnCacheProblem = 1;
+            stopFile = optarg;
+            break;
+        case 'x':
+            checkCache = 1;
+            break;
+        case 'd':
+            dumpCache = 1;
+            break;
+        case 'v':
+            verboseMask = atoi(optarg);
+            break;
+        case 'b':
+            readBufferSize = atoi(optarg);
+            break;
+        case 'l':
+            logfp = fopen(optarg, "w+");
+            if (logfp == NULL)
+                errExit("fopen");
+            setbuf(logfp, NULL);
+            break;
+        default:
+            usageError(argv[0]);
+        }
+    }
+
+    if (optind >= argc)
+        usageError(argv[0]);
+
+    /* Record the root directories */
+
+    numRoots = argc - optind;
+    roots = calloc(numRoots, sizeof(struct root));
+    if (roots == NULL)
+        errExit("calloc");
+
+    for (int j = 0; j < numRoots; j++) {
+        roots[j].path = realpath(argv[optind + j], NULL);
+        if (roots[j].path == NULL)
+            errExit("realpath: %s", argv[optind + j]);
+        roots[j].len = strlen(roots[j].path);
+
+        roots[j].mountFd = open(roots[j].path, O_RDONLY | O_DIRECTORY);
+        if (roots[j].mountFd == -1)
+            errExit("open: %s", roots[j].path);
+    }
+
+    fanFd = initialize();
+
+    /* Loop to handle fanotify events and keyboard commands */
+
+    printf("%s> ", argv[0]);
+    fflush(stdout);
+
+    for (;;) {
+        FD_ZERO(&rfds);
+        FD_SET(STDIN_FILENO, &rfds);
+        FD_SET(fanFd, &rfds);
+        if (select(fanFd + 1, &rfds, NULL, NULL, NULL) == -1)
+            errExit("select");
+
+        if (FD_ISSET(STDIN_FILENO, &rfds)) {
+            executeCommand();
+
+            printf("%s> ", argv[0]);
+            fflush(stdout);
+        }
+
+        if (FD_ISSET(fanFd, &rfds))
+            processFanotifyEvents(fanFd);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -28,6 +28,23 @@
    running a consistency check of the cache against the current state of
    the directory tree(s).
 
+   The trees are scanned using several threads in parallel (see
+   watchDir()). If the inotify event queue overflows, the program
+   rescans only the parts of the trees that have changed (see
+   resyncCache()), rather than rebuilding the whole cache.
+
+   To reduce the risk of queue overflows during bursts of activity (e.g.,
+   'git checkout' or 'rm -rf'), the program drains all of the queued
+   events into a large buffer before processing them, and then merges
+   redundant events in the buffer (see coalesceEvents()). For example, a
+   directory that is created and then deleted (or renamed out of the
+   trees) within a single buffer is never watched at all.
+
+   With the -S option, the cache is saved to a snapshot file when the
+   program terminates, and is restored from that file when the program
+   starts, so that only the directories that changed in the meantime need
+   to be read (see restoreSnapshot()).
+
    Testing of this program is ongoing, and bug reports (to mtk@man7.org)
    are welcome.
 
@@ -50,16 +67,22 @@
 #include <limits.h>
 #include <sys/select.h>
 #include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
 #include <fcntl.h>
-#include <ftw.h>
+#include <pthread.h>
+#include <dirent.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <time.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include "tree_walk.h"
 
 #define errExit(msg)    do { perror(msg); exit(EXIT_FAILURE); \
                         } while (0)
@@ -73,10 +96,13 @@ static int verboseMask;
 static int checkCache;
 static int dumpCache;
 static int readBufferSize = 0;
+static int batchBufferSize = 1024 * 1024;
+static int coalesce = 1;
 static char *stopFile;
 static int abortOnCacheProblem;
 
 static FILE *logfp = NULL;
+static FILE *tracefp = NULL;
 
 static int inotifyReadCnt = 0;          /* Counts number of read()s from
                                            inotify file descriptor */
@@ -86,6 +112,46 @@ static const int INOTIFY_READ_BUF_LEN =
 
 static void dumpCacheToLog(void);
 
+/* Event statistics, displayed by the 's' command and (at verbosity
+   level VB_BASIC) once per second while events are arriving */
+
+struct eventStats {
+    unsigned long read;         /* Events read from inotify FD */
+    unsigned long coalesced;    /* Events discarded by coalesceEvents() */
+    unsigned long applied;      /* Events used to update the cache */
+};
+
+static struct eventStats totStats, intStats;   /* Totals, and counts for
+                                                   current interval */
+static struct timespec intStart;                /* Start of interval */
+
+/* If tracing is enabled (-T), record a change to the cache in the trace
+   file. Each line contains a CLOCK_MONOTONIC timestamp, a letter
+   describing the change, and a pathname:
+
+        A path      Directory added to cache
+        D path      Directory removed from cache
+        R path      Directory renamed; 'path' is the new name
+        O           Queue overflow
+
+   When the program exits (via the 'q' command), a final line of the form
+   "S read coalesced applied" records the event statistics. The trace is
+   used by dtree_bench.c to measure the time taken to update the cache
+   after each filesystem operation. */
+
+static void
+traceCacheUpdate(char type, const char *path)
+{
+    struct timespec ts;
+
+    if (tracefp == NULL)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    fprintf(tracefp, "%ld.%09ld %c %s\n", (long) ts.tv_sec, ts.tv_nsec,
+            type, path);
+}
+
 /* Something went badly wrong. Create a 'stop' file to signal the
    'rand_dtree' processes to stop, dump a copy of the cache to the
    log file, and abort. */
@@ -145,6 +211,8 @@ displayInotifyEvent(struct inotify_event *ev)
 
     if (ev->mask & IN_CREATE)
         logMessage(VB_NOISY, "IN_CREATE ");
+    if (ev->mask & IN_DELETE)
+        logMessage(VB_NOISY, "IN_DELETE ");
 
     if (ev->mask & IN_DELETE_SELF)
         logMessage(VB_NOISY, "IN_DELETE_SELF ");
@@ -173,36 +241,264 @@ displayInotifyEvent(struct inotify_event *ev)
 
 /* Data structures and functions for the watch list cache */
 
-/* We use a very simple data structure for caching watched directory
-   paths: a dynamically sized array that is searched linearly. Not
-   efficient, but our main goal is to demonstrate the use of inotify. */
+/* The cache is a dynamically sized array of slots, one per watched
+   directory. So that each inotify event can be handled in constant time
+   (rather than requiring a scan of the whole cache), the slots are
+   indexed in three ways:
+
+   * Two hash tables map watch descriptors and pathnames to slots. Each
+     hash bucket contains the slot number of the first entry in a chain;
+     the chains are linked through the 'wdNext' and 'pathNext' fields.
+
+   * The 'parent', 'firstChild', 'nextSibling', and 'prevSibling' fields
+     form a tree that mirrors the directory hierarchy, so that a rename or
+     removal of a directory need visit only the entries for that directory
+     and its descendants.
+
+   Unused slots are kept on a free list, linked through 'nextFree'. */
 
 struct watch {
     int wd;                     /* Watch descriptor (-1 if slot unused) */
-    char path[PATH_MAX];        /* Cached pathname */
+    char *path;                 /* Cached pathname (NULL if slot unused) */
+    unsigned int pathHashVal;   /* Hash of 'path' */
+    int wdNext;                 /* Next slot in 'wdHash' chain */
+    int pathNext;               /* Next slot in 'pathHash' chain */
+    int parent;                 /* Slot of parent directory, or -1 */
+    int firstChild;             /* Slot of first subdirectory, or -1 */
+    int nextSibling;            /* Other subdirectories of 'parent' */
+    int prevSibling;
+    int nextFree;               /* Next slot on free list */
+    ino_t ino;                  /* Snapshot of directory's i-node number, */
+    dev_t dev;                  /*   device, and modification time when */
+    struct timespec mtime;      /*   it was last scanned (see
+                                   resyncCache()) */
 };
 
 struct watch *wlCache = NULL;   /* Array of cached items */
 
 static int cacheSize = 0;       /* Current size of the array */
+static int numCached = 0;       /* Number of slots in use */
+static int freeHead = -1;       /* First slot on free list */
+static unsigned long cacheUpdates;  /* Counts changes to the cache (see
+                                       saveSnapshot()) */
+
+static int *wdHash = NULL;      /* Hash tables: the head of each chain */
+static int *pathHash = NULL;
+static int hashSize = 0;        /* Number of buckets (a power of 2) */
+
+static unsigned int
+hashWd(int wd)
+{
+    return (unsigned int) wd * 2654435761U;
+}
+
+static unsigned int
+hashPath(const char *path)      /* FNV-1a */
+{
+    unsigned int h = 2166136261U;
+
+    for (const unsigned char *p = (const unsigned char *) path; *p; p++)
+        h = (h ^ *p) * 16777619U;
+    return h;
+}
+
+static void
+hashInsert(int slot)
+{
+    unsigned int b;
+
+    b = hashWd(wlCache[slot].wd) & (hashSize - 1);
+    wlCache[slot].wdNext = wdHash[b];
+    wdHash[b] = slot;
+
+    b = wlCache[slot].pathHashVal & (hashSize - 1);
+    wlCache[slot].pathNext = pathHash[b];
+    pathHash[b] = slot;
+}
+
+static void
+hashRemove(int slot)
+{
+    int *p;
+
+    for (p = &wdHash[hashWd(wlCache[slot].wd) & (hashSize - 1)];
+            *p != slot; p = &wlCache[*p].wdNext)
+        ;
+    *p = wlCache[slot].wdNext;
+
+    for (p = &pathHash[wlCache[slot].pathHashVal & (hashSize - 1)];
+            *p != slot; p = &wlCache[*p].pathNext)
+        ;
+    *p = wlCache[slot].pathNext;
+}
+
+/* (Re)build the hash tables with 'newSize' buckets */
+
+static void
+rebuildHashTables(int newSize)
+{
+    free(wdHash);
+    free(pathHash);
+
+    hashSize = newSize;
+    wdHash = malloc(hashSize * sizeof(int));
+    pathHash = malloc(hashSize * sizeof(int));
+    if (wdHash == NULL || pathHash == NULL)
+        errExit("malloc");
+
+    for (int j = 0; j < hashSize; j++)
+        wdHash[j] = pathHash[j] = -1;
+
+    for (int j = 0; j < cacheSize; j++)
+        if (wlCache[j].wd >= 0)
+            hashInsert(j);
+}
+
+/* Make 'slot' a child of 'parent' in the directory tree */
+
+static void
+treeLink(int slot, int parent)
+{
+    wlCache[slot].parent = parent;
+    wlCache[slot].prevSibling = -1;
+    wlCache[slot].nextSibling = -1;
+
+    if (parent >= 0) {
+        wlCache[slot].nextSibling = wlCache[parent].firstChild;
+        if (wlCache[parent].firstChild >= 0)
+            wlCache[wlCache[parent].firstChild].prevSibling = slot;
+        wlCache[parent].firstChild = slot;
+    }
+}
+
+/* Remove 'slot' from its parent's list of children */
+
+static void
+treeUnlink(int slot)
+{
+    struct watch *w = &wlCache[slot];
+
+    if (w->prevSibling >= 0)
+        wlCache[w->prevSibling].nextSibling = w->nextSibling;
+    else if (w->parent >= 0)
+        wlCache[w->parent].firstChild = w->nextSibling;
+    if (w->nextSibling >= 0)
+        wlCache[w->nextSibling].prevSibling = w->prevSibling;
+
+    w->parent = w->prevSibling = w->nextSibling = -1;
+}
+
+/* Replace the pathname cached in 'slot' */
+
+static void
+setCachedPath(int slot, const char *path)
+{
+    char *p;
+
+    p = strdup(path);
+    if (p == NULL)
+        errExit("strdup");
+
+    if (wlCache[slot].wd >= 0)
+        hashRemove(slot);
+    free(wlCache[slot].path);
+    wlCache[slot].path = p;
+    cacheUpdates++;
+    wlCache[slot].pathHashVal = hashPath(p);
+    if (wlCache[slot].wd >= 0)
+        hashInsert(slot);
+}
 
 /* Deallocate the watch cache */
 
 static void
 freeCache(void)
 {
+    for (int j = 0; j < cacheSize; j++)
+        free(wlCache[j].path);
     free(wlCache);
+    free(wdHash);
+    free(pathHash);
     cacheSize = 0;
+    numCached = 0;
+    cacheUpdates++;
+    hashSize = 0;
+    freeHead = -1;
     wlCache = NULL;
+    wdHash = NULL;
+    pathHash = NULL;
+}
+
+/* Check whether the cache contains the watch descriptor 'wd'.
+   If found, return the slot number, otherwise return -1. */
+
+static int
+findWatch(int wd)
+{
+    if (hashSize == 0)
+        return -1;
+
+    for (int j = wdHash[hashWd(wd) & (hashSize - 1)]; j >= 0;
+            j = wlCache[j].wdNext)
+        if (wlCache[j].wd == wd)
+            return j;
+
+    return -1;
+}
+
+/* Return the cache slot that corresponds to a particular pathname,
+   or -1 if the pathname is not in the cache */
+
+static int
+pathnameToCacheSlot(const char *pathname)
+{
+    unsigned int h;
+
+    if (hashSize == 0)
+        return -1;
+
+    h = hashPath(pathname);
+    for (int j = pathHash[h & (hashSize - 1)]; j >= 0;
+            j = wlCache[j].pathNext)
+        if (wlCache[j].pathHashVal == h &&
+                strcmp(wlCache[j].path, pathname) == 0)
+            return j;
+
+    return -1;
+}
+
+/* Is 'pathname' in the watch cache? */
+
+static int
+pathnameInCache(const char *pathname)
+{
+    return pathnameToCacheSlot(pathname) >= 0;
+}
+
+/* Return the cache slot of the parent directory of 'pathname', or -1
+   if the parent is not in the cache */
+
+static int
+parentCacheSlot(const char *pathname)
+{
+    char parent[PATH_MAX];
+    char *p;
+
+    snprintf(parent, sizeof(parent), "%s", pathname);
+    p = strrchr(parent, '/');
+    if (p == NULL)
+        return -1;
+    *p = '\0';
+    return pathnameToCacheSlot(parent);
 }
 
 /* Check that all pathnames in the cache are valid, and refer
-   to directories */
+   to directories, and that the cache indexes are consistent */
 
 static void
 checkCacheConsistency(void)
 {
-    int failures;
+    int failures, p;
     struct stat sb;
 
     failures = 0;
@@ -219,6 +515,21 @@ checkCacheConsistency(void)
                                 wlCache[j].path);
                     exit(EXIT_FAILURE);
             }
+
+            if (findWatch(wlCache[j].wd) != j) {
+                logMessage(0, "checkCacheConsistency: wd %d (%s) not "
+                        "indexed\n", wlCache[j].wd, wlCache[j].path);
+                failures++;
+            }
+
+            p = wlCache[j].parent;
+            if (p >= 0 && (strncmp(wlCache[p].path, wlCache[j].path,
+                                   strlen(wlCache[p].path)) != 0 ||
+                           wlCache[j].path[strlen(wlCache[p].path)] != '/')) {
+                logMessage(0, "checkCacheConsistency: %s is not a child "
+                        "of %s\n", wlCache[j].path, wlCache[p].path);
+                failures++;
+            }
         }
     }
 
@@ -227,19 +538,6 @@ checkCacheConsistency(void)
                    failures);
 }
 
-/* Check whether the cache contains the watch descriptor 'wd'.
-   If found, return the slot number, otherwise return -1. */
-
-static int
-findWatch(int wd)
-{
-    for (int j = 0; j < cacheSize; j++)
-        if (wlCache[j].wd == wd)
-            return j;
-
-    return -1;
-}
-
 /* Find and return the cache slot for the watch descriptor 'wd'.
    The caller expects this watch descriptor to exist.  If it does not,
    there is a problem, which is signaled by the -1 return. */
@@ -258,7 +556,7 @@ findWatchChecked(int wd)
 
     /* With multiple renamers there are still rare cases where
        the cache is missing entries after a 'Could not find watch'
-       event. It looks as though this is because of races with nftw(),
+       event. It looks as though this is because of races with the tree scan,
        since the cache is (occasionally) re-created with fewer
        entries than there are objects in the tree(s). Returning
        -1 to our caller identifies that there's a problem, and the
@@ -271,17 +569,40 @@ findWatchChecked(int wd)
     }
 }
 
-/* Mark a cache entry as unused */
+/* Mark a cache entry as unused, removing it from the indexes and
+   placing it on the free list */
 
 static void
 markCacheSlotEmpty(int slot)
 {
+    struct watch *w = &wlCache[slot];
+
     logMessage(VB_NOISY,
             "        markCacheSlotEmpty: slot = %d;  wd = %d; path = %s\n",
-            slot, wlCache[slot].wd, wlCache[slot].path);
+            slot, w->wd, (w->path != NULL) ? w->path : "");
+
+    if (w->wd >= 0) {
+        traceCacheUpdate('D', w->path);
+        hashRemove(slot);
+        numCached--;
+        cacheUpdates++;
+
+        /* Normally, a directory has no cached subdirectories by the time
+           that it is removed from the cache; if it does, they become
+           orphans */
 
-    wlCache[slot].wd = -1;
-    wlCache[slot].path[0] = '\0';
+        while (w->firstChild >= 0)
+            treeUnlink(w->firstChild);
+        treeUnlink(slot);
+    }
+
+    free(w->path);
+    w->path = NULL;
+    w->wd = -1;
+    w->parent = w->firstChild = w->nextSibling = w->prevSibling = -1;
+
+    w->nextFree = freeHead;
+    freeHead = slot;
 }
 
 /* Find a free slot in the cache */
@@ -289,61 +610,61 @@ markCacheSlotEmpty(int slot)
 static int
 findEmptyCacheSlot(void)
 {
-    const int ALLOC_INCR = 200;
+    int oldSize, slot;
 
-    for (int j = 0; j < cacheSize; j++)
-        if (wlCache[j].wd == -1)
-            return j;
+    if (freeHead == -1) {
 
-    /* No free slot found; resize cache */
+        /* No free slot; resize cache, and place the new slots on the
+           free list (lowest-numbered slot first) */
 
-    cacheSize += ALLOC_INCR;
+        oldSize = cacheSize;
+        cacheSize = (cacheSize == 0) ? 200 : cacheSize * 2;
 
-    wlCache = realloc(wlCache, cacheSize * sizeof(struct watch));
-    if (wlCache == NULL)
-        errExit("realloc");
+        wlCache = realloc(wlCache, cacheSize * sizeof(struct watch));
+        if (wlCache == NULL)
+            errExit("realloc");
 
-    for (int j = cacheSize - ALLOC_INCR; j < cacheSize; j++)
-        markCacheSlotEmpty(j);
+        for (int j = cacheSize - 1; j >= oldSize; j--) {
+            wlCache[j].wd = -1;
+            wlCache[j].path = NULL;
+            markCacheSlotEmpty(j);
+        }
+    }
 
-    return cacheSize - ALLOC_INCR;      /* Return first slot in
-                                           newly allocated space */
+    slot = freeHead;
+    freeHead = wlCache[slot].nextFree;
+    return slot;
 }
 
-/* Add an item to the cache */
+/* Add an item to the cache, as a child of the directory cached in slot
+   'parent' (-1 if none) */
 
 static int
-addWatchToCache(int wd, const char *pathname)
+addWatchToCache(int wd, const char *pathname, int parent)
 {
     int slot;
 
     slot = findEmptyCacheSlot();
 
+    wlCache[slot].path = strdup(pathname);
+    if (wlCache[slot].path == NULL)
+        errExit("strdup");
+    wlCache[slot].pathHashVal = hashPath(pathname);
     wlCache[slot].wd = wd;
-    strncpy(wlCache[slot].path, pathname, PATH_MAX);
-
-    return slot;
-}
+    wlCache[slot].firstChild = -1;
+    treeLink(slot, parent);
+    numCached++;
+    cacheUpdates++;
+    traceCacheUpdate('A', pathname);
 
-/* Return the cache slot that corresponds to a particular pathname,
-   or -1 if the pathname is not in the cache */
-
-static int
-pathnameToCacheSlot(const char *pathname)
-{
-    for (int j = 0; j < cacheSize; j++)
-        if (wlCache[j].wd >= 0 && strcmp(wlCache[j].path, pathname) == 0)
-            return j;
+    /* Keep the hash tables' load factor no greater than 1 */
 
-    return -1;
-}
-
-/* Is 'pathname' in the watch cache? */
+    if (numCached > hashSize)
+        rebuildHashTables((hashSize == 0) ? 256 : hashSize * 2);
+    else
+        hashInsert(slot);
 
-static int
-pathnameInCache(const char *pathname)
-{
-    return pathnameToCacheSlot(pathname) >= 0;
+    return slot;
 }
 
 /* Dump contents of watch cache to the log file */
@@ -496,35 +817,71 @@ zapRootDirPath(const char *path)
 
 /***********************************************************************/
 
-/* Below is a function called by nftw() to traverse a directory tree.
-   The function adds a watch for each directory in the tree. Each
-   successful call to this function should return 0 to indicate to
-   nftw() that the tree traversal should continue. */
-
-/* The usual hack for nftw()...  We can't pass arguments to the
-   function invoked by nftw(), so we use these global variables to
-   exchange information with the function. */
+/* The initial population of the cache, and the addition of new subtrees,
+   is performed by treeWalk() (tree_walk.c), which scans the tree with
+   several threads in parallel, without stat()-ing nondirectory files.
+   Each thread adds watches for the directories that it finds; the cache is
+   protected by a mutex, but the inotify_add_watch() calls are made
+   concurrently. The information that treeWalk() passes to scanTree() is
+   shared via the following global variables. */
 
 static int dirCnt;      /* Count of directories added to watch list */
 static int ifd;         /* Inotify file descriptor */
+static int subtreeParent;   /* Cache slot of parent of subtree root */
+static int scanThreads = 0; /* Number of scanning threads (0 == one per
+                               CPU) */
+static pthread_mutex_t cacheMtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* Record a snapshot of the i-node number, device, and last modification
+   time of the directory in 'slot' (see resyncCache()) */
+
+static void
+setSnapshot(int slot, const struct statx *stx)
+{
+    cacheUpdates++;
+    wlCache[slot].ino = stx->stx_ino;
+    wlCache[slot].dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    wlCache[slot].mtime.tv_sec = stx->stx_mtime.tv_sec;
+    wlCache[slot].mtime.tv_nsec = stx->stx_mtime.tv_nsec;
+}
+
+/* Called by treeWalk() for each file in the tree */
 
 static int
-traverseTree(const char *pathname, const struct stat *sb, int tflag,
-             struct FTW *ftwbuf)
+scanTree(const struct twEntry *ent, int flag, void *arg)
 {
-    int wd, slot, flags;
+    struct statx stx;
+    int wd, slot, parent, flags, s;
 
-    if (! S_ISDIR(sb->st_mode))
+    if (flag != TW_D)
         return 0;               /* Ignore nondirectory files */
 
-    /* Create a watch for this directory */
+    /* Obtain the directory's i-node number and modification time before
+       treeWalk() reads the directory, so that any subsequent changes
+       to the directory will be detected by resyncCache() */
+
+    s = (ent->dirFd == -1) ?
+            statx(AT_FDCWD, ent->path, AT_SYMLINK_NOFOLLOW,
+                  STATX_INO | STATX_MTIME, &stx) :
+            statx(ent->dirFd, ent->name, AT_SYMLINK_NOFOLLOW,
+                  STATX_INO | STATX_MTIME, &stx);
+    if (s == -1) {
+        logMessage(VB_BASIC, "statx: %s: %s\n", ent->path, strerror(errno));
+        return TW_SKIP_SUBTREE;
+    }
+
+    /* Create a watch for this directory. We don't need IN_DELETE to
+       maintain the cache (IN_DELETE_SELF does that), but it allows
+       coalesceEvents() to recognize a directory that was created and
+       then deleted. */
 
-    flags = IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF;
+    flags = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+            IN_DELETE_SELF;
 
-    if (isRootDirPath(pathname))
+    if (isRootDirPath(ent->path))
         flags |= IN_MOVE_SELF;
 
-    wd = inotify_add_watch(ifd, pathname, flags | IN_ONLYDIR);
+    wd = inotify_add_watch(ifd, ent->path, flags | IN_ONLYDIR);
     if (wd == -1) {
 
         /* By the time we come to create a watch, the directory might
@@ -534,32 +891,42 @@ traverseTree(const char *pathname, const struct stat *sb, int tflag,
            hit them, we give up. */
 
         logMessage(VB_BASIC, "inotify_add_watch: %s: %s\n",
-                pathname, strerror(errno));
+                ent->path, strerror(errno));
         if (errno == ENOENT)
-            return 0;
+            return TW_SKIP_SUBTREE;
         else
             exit(EXIT_FAILURE);
     }
 
-    if (findWatch(wd) >= 0) {
+    pthread_mutex_lock(&cacheMtx);
+
+    slot = findWatch(wd);
+    if (slot >= 0) {
 
         /* This watch descriptor is already in the cache;
            nothing more to do. */
 
-        logMessage(VB_BASIC, "WD %d already in cache (%s)\n", wd, pathname);
+        pthread_mutex_unlock(&cacheMtx);
+        logMessage(VB_BASIC, "WD %d already in cache (%s)\n", wd, ent->path);
         return 0;
     }
 
     dirCnt++;
 
-    /* Cache information about the watch */
+    /* Cache information about the watch. treeWalk() reports each
+       directory before it reads the directory, so the parent is
+       already in the cache. */
 
-    slot = addWatchToCache(wd, pathname);
+    parent = (ent->level == 0) ? subtreeParent : parentCacheSlot(ent->path);
+    slot = addWatchToCache(wd, ent->path, parent);
+    setSnapshot(slot, &stx);
+
+    pthread_mutex_unlock(&cacheMtx);
 
     /* Print the name of the current directory */
 
     logMessage(VB_NOISY, "    watchDir: wd = %d [cache slot: %d]; %s\n",
-                wd, slot, pathname);
+                wd, slot, ent->path);
 
     return 0;
 }
@@ -567,37 +934,40 @@ traverseTree(const char *pathname, const struct stat *sb, int tflag,
 /* Add the directory in 'pathname' to the watch list of the inotify
    file descriptor 'inotifyFd'. The process is recursive: watch items
    are also created for all of the subdirectories of 'pathname'.
+   'parent' is the cache slot of the parent of 'pathname' (-1 if none).
    Returns number of watches/cache entries added for this subtree. */
 
 static int
-watchDir(int inotifyFd, const char *pathname)
+watchDir(int inotifyFd, const char *pathname, int parent)
 {
     dirCnt = 0;
     ifd = inotifyFd;
+    subtreeParent = parent;
 
-    /* Use FTW_PHYS to avoid following soft links to directories (which
-       could lead us in circles) */
+    /* treeWalk() doesn't follow soft links to directories (which could
+       lead us in circles) */
 
     /* By the time we come to process 'pathname', it may already have
-       been deleted, so we log errors from nftw(), but keep on going */
+       been deleted, so we log errors from treeWalk(), but keep on going */
 
-    if (nftw(pathname, traverseTree, 20, FTW_PHYS) == -1)
+    if (treeWalk(pathname, scanThreads, 0, 0, scanTree, NULL) == -1)
         logMessage(VB_BASIC,
-                "nftw: %s: %s (directory probably deleted before we "
+                "treeWalk: %s: %s (directory probably deleted before we "
                 "could watch)\n", pathname, strerror(errno));
 
     return dirCnt;
 }
 
-/* Add watches and cache entries for a subtree, logging a message
-   noting the number entries added. */
+/* Add watches and cache entries for a subtree whose parent is cached
+   in slot 'parent' (-1 if none), logging a message noting the number
+   entries added. */
 
 static void
-watchSubtree(int inotifyFd, char *path)
+watchSubtree(int inotifyFd, char *path, int parent)
 {
     int cnt;
 
-    cnt = watchDir(inotifyFd, path);
+    cnt = watchDir(inotifyFd, path, parent);
 
     logMessage(VB_BASIC, "    watchSubtree: %s: %d entries added\n",
             path, cnt);
@@ -605,97 +975,143 @@ watchSubtree(int inotifyFd, char *path)
 
 /***********************************************************************/
 
-/* The directory oldPathPrefix/oldName was renamed to
-   newPathPrefix/newName. Fix up cache entries for
-   oldPathPrefix/oldName and all of its subdirectories
-   to reflect the change. */
+/* The directory oldName in the directory cached in slot 'oldParent' was
+   renamed to newName in the directory cached in slot 'newParent'. Fix up
+   cache entries for the directory and all of its subdirectories to
+   reflect the change, moving the directory to its new place in the
+   cache tree. Only the entries in the renamed subtree are visited. */
 
 static void
-rewriteCachedPaths(const char *oldPathPrefix, const char *oldName,
-                   const char *newPathPrefix, const char *newName)
+rewriteCachedPaths(int oldParent, const char *oldName,
+                   int newParent, const char *newName)
 {
     char fullPath[PATH_MAX], newPrefix[PATH_MAX];
     char newPath[PATH_MAX];
-    size_t len;
-    int s;
+    const char *base;
+    int slot, s;
 
-    snprintf(fullPath, sizeof(fullPath), "%s/%s", oldPathPrefix, oldName);
-    snprintf(newPrefix, sizeof(newPrefix), "%s/%s", newPathPrefix, newName);
-    len = strlen(fullPath);
+    snprintf(fullPath, sizeof(fullPath), "%s/%s", wlCache[oldParent].path,
+             oldName);
+    snprintf(newPrefix, sizeof(newPrefix), "%s/%s", wlCache[newParent].path,
+             newName);
 
     logMessage(VB_BASIC, "Rename: %s ==> %s\n", fullPath, newPrefix);
 
-    for (int j = 0; j < cacheSize; j++) {
-        if (strncmp(fullPath, wlCache[j].path, len) == 0 &&
-                    (wlCache[j].path[len] == '/' ||
-                     wlCache[j].path[len] == '\0')) {
-            s = snprintf(newPath, sizeof(newPath), "%s%s", newPrefix,
-                    &wlCache[j].path[len]);
-            if (s > sizeof(newPath))
-                logMessage(VB_BASIC, "Truncated pathname: %s\n", newPath);
-
-            strncpy(wlCache[j].path, newPath, PATH_MAX);
-
-            logMessage(VB_NOISY, "    wd %d [cache slot %d] ==> %s\n",
-                    wlCache[j].wd, j, newPath);
+    slot = pathnameToCacheSlot(fullPath);
+    if (slot == -1)
+        return;
+
+    treeUnlink(slot);
+    treeLink(slot, newParent);
+    setCachedPath(slot, newPrefix);
+    traceCacheUpdate('R', newPrefix);
+    logMessage(VB_NOISY, "    wd %d [cache slot %d] ==> %s\n",
+            wlCache[slot].wd, slot, newPrefix);
+
+    /* Visit the descendants in preorder; each one's new pathname is its
+       parent's (already rewritten) pathname plus its own basename */
+
+    for (int j = wlCache[slot].firstChild; j >= 0 && j != slot; ) {
+        base = strrchr(wlCache[j].path, '/');
+        s = snprintf(newPath, sizeof(newPath), "%s%s",
+                     wlCache[wlCache[j].parent].path, base);
+        if (s >= sizeof(newPath))
+            logMessage(VB_BASIC, "Truncated pathname: %s\n", newPath);
+
+        setCachedPath(j, newPath);
+
+        logMessage(VB_NOISY, "    wd %d [cache slot %d] ==> %s\n",
+                wlCache[j].wd, j, newPath);
+
+        if (wlCache[j].firstChild >= 0) {
+            j = wlCache[j].firstChild;
+        } else {
+            while (j != slot && wlCache[j].nextSibling == -1)
+                j = wlCache[j].parent;
+            if (j != slot)
+                j = wlCache[j].nextSibling;
         }
     }
 }
 
 /* Zap watches and cache entries for directory 'path' and all of its
-   subdirectories. Returns number of entries that we (tried to) zap,
-   or -1 if an inotify_rm_watch() call failed. */
+   subdirectories. If 'staleOk' is true, then it is not an error if a
+   watch no longer exists (because the kernel removed it when the
+   directory was deleted). Returns number of entries that we (tried to)
+   zap, or -1 if an inotify_rm_watch() call failed. */
 
 static int
-zapSubtree(int inotifyFd, char *path)
+zapSubtree(int inotifyFd, char *path, int staleOk)
 {
-    size_t len;
-    int cnt;
-    char *pn;
+    int *slots, nslots, maxSlots, slot, cnt;
 
     logMessage(VB_NOISY, "Zapping subtree: %s\n", path);
 
-    len = strlen(path);
+    /* Note that 'path' might be a pointer to a pathname string that is
+       actually stored in the cache, and thus is freed when we zap that
+       entry. But we don't use 'path' after this point. */
 
-    /* The argument we receive might be a pointer to a pathname string
-       that is actually stored in the cache.  If we zap that pathname
-       part way through scanning the whole cache, then chaos results.
-       So, create a temporary copy. */
+    slot = pathnameToCacheSlot(path);
+    if (slot == -1)
+        return 0;
 
-    pn = strdup(path);
+    /* Collect the slots of the subtree in preorder */
 
-    cnt = 0;
+    maxSlots = 64;
+    slots = malloc(maxSlots * sizeof(int));
+    if (slots == NULL)
+        errExit("malloc");
 
-    for (int j = 0; j < cacheSize; j++) {
-        if (wlCache[j].wd >= 0) {
-            if (strncmp(pn, wlCache[j].path, len) == 0 &&
-                    (wlCache[j].path[len] == '/' ||
-                     wlCache[j].path[len] == '\0')) {
+    nslots = 0;
+    for (int j = slot; j >= 0; ) {
+        if (nslots == maxSlots) {
+            maxSlots *= 2;
+            slots = realloc(slots, maxSlots * sizeof(int));
+            if (slots == NULL)
+                errExit("realloc");
+        }
+        slots[nslots++] = j;
 
-                logMessage(VB_NOISY,
-                           "    removing watch: wd = %d (%s)\n",
-                           wlCache[j].wd, wlCache[j].path);
+        if (wlCache[j].firstChild >= 0) {
+            j = wlCache[j].firstChild;
+        } else {
+            while (j != slot && wlCache[j].nextSibling == -1)
+                j = wlCache[j].parent;
+            j = (j == slot) ? -1 : wlCache[j].nextSibling;
+        }
+    }
 
-                if (inotify_rm_watch(inotifyFd, wlCache[j].wd) == -1) {
-                    logMessage(0, "inotify_rm_watch wd = %d (%s): %s\n",
-                            wlCache[j].wd, wlCache[j].path, strerror(errno));
+    /* Remove entries in reverse order, so that each directory is
+       removed after its descendants */
 
-                    /* When we have multiple renamers, sometimes
-                       inotify_rm_watch() fails. In this case, we force a
-                       cache rebuild by returning -1.
-                       (TODO: Is there a better solution?) */
+    cnt = 0;
 
-                    cnt = -1;
-                    break;
-                }
+    for (int k = nslots - 1; k >= 0; k--) {
+        int j = slots[k];
 
-                markCacheSlotEmpty(j);
-                cnt++;
-            }
+        logMessage(VB_NOISY,
+                   "    removing watch: wd = %d (%s)\n",
+                   wlCache[j].wd, wlCache[j].path);
+
+        if (inotify_rm_watch(inotifyFd, wlCache[j].wd) == -1 &&
+                !(staleOk && errno == EINVAL)) {
+            logMessage(0, "inotify_rm_watch wd = %d (%s): %s\n",
+                    wlCache[j].wd, wlCache[j].path, strerror(errno));
+
+            /* When we have multiple renamers, sometimes
+               inotify_rm_watch() fails. In this case, we force a
+               cache rebuild by returning -1.
+               (TODO: Is there a better solution?) */
+
+            cnt = -1;
+            break;
         }
+
+        markCacheSlotEmpty(j);
+        cnt++;
     }
 
-    free(pn);
+    free(slots);
     return cnt;
 }
 
@@ -712,7 +1128,6 @@ reinitialize(int oldInotifyFd)
 {
     int inotifyFd;
     static int reinitCnt;
-    int cnt;
 
     if (oldInotifyFd >= 0) {
         close(oldInotifyFd);
@@ -736,19 +1151,657 @@ reinitialize(int oldInotifyFd)
 
     for (int j = 0; j < numRootDirs; j++)
         if (rootDirPaths[j] != NULL)
-            watchSubtree(inotifyFd, rootDirPaths[j]);
-
-    cnt = 0;
-    for (int j = 0; j < cacheSize; j++)
-        if (wlCache[j].wd >= 0)
-            cnt++;
+            watchSubtree(inotifyFd, rootDirPaths[j], -1);
 
     if (oldInotifyFd >= 0)
-        logMessage(0, "Rebuilt cache with %d entries\n", cnt);
+        logMessage(0, "Rebuilt cache with %d entries\n", numCached);
+
+    return inotifyFd;
+}
+
+struct slotRef {                /* Identifies a slot's current occupant */
+    int slot;
+    int wd;
+};
+
+/* Reread each of the 'ndirty' directories listed in 'dirty' (whose
+   contents have changed since they were last scanned), and add subtrees
+   for any subdirectories that are not yet in the cache. We take the new
+   snapshot before reading each directory, so that changes made while we
+   are reading will be caught next time. Returns the number of subtrees
+   added. */
+
+static int
+rescanChangedDirs(int inotifyFd, const struct slotRef *dirty, int ndirty)
+{
+    char path[PATH_MAX];
+    struct statx stx;
+    struct dirent *dp;
+    struct stat sb;
+    int slot, added, isDir;
+    DIR *dirp;
+
+    added = 0;
+    for (int k = 0; k < ndirty; k++) {
+        slot = dirty[k].slot;
+        if (wlCache[slot].wd != dirty[k].wd)
+            continue;
+
+        if (statx(AT_FDCWD, wlCache[slot].path, AT_SYMLINK_NOFOLLOW,
+                  STATX_INO | STATX_MTIME, &stx) == -1)
+            continue;           /* Gone again; a later event will tell */
+        setSnapshot(slot, &stx);
+
+        logMessage(VB_BASIC, "    rescan: changed: %s\n", wlCache[slot].path);
+
+        dirp = opendir(wlCache[slot].path);
+        if (dirp == NULL)
+            continue;
+
+        while ((dp = readdir(dirp)) != NULL) {
+            if (strcmp(dp->d_name, ".") == 0 || strcmp(dp->d_name, "..") == 0)
+                continue;
+
+            snprintf(path, sizeof(path), "%s/%s", wlCache[slot].path,
+                     dp->d_name);
+
+            isDir = dp->d_type == DT_DIR;
+            if (dp->d_type == DT_UNKNOWN)
+                isDir = lstat(path, &sb) == 0 && S_ISDIR(sb.st_mode);
+
+            if (isDir && !pathnameInCache(path)) {
+                watchSubtree(inotifyFd, path, slot);
+                added++;
+            }
+        }
+
+        closedir(dirp);
+    }
+
+    return added;
+}
+
+/* After an inotify queue overflow, bring the cache back into line with
+   the filesystem without discarding the inotify file descriptor, by
+   rescanning only those parts of the tree that have changed since they
+   were last scanned:
+
+   1. Each cached directory is lstat()-ed. If it no longer exists (or its
+      pathname now refers to a different i-node), then it was deleted or
+      renamed while events were being lost, and its subtree is zapped.
+
+   2. If a directory's modification time differs from the snapshot taken
+      when the directory was last scanned, then entries were created in,
+      renamed into, or removed from the directory. So, we reread that
+      directory (only), and add subtrees for any subdirectories that are
+      not yet in the cache. (Subdirectories that have disappeared were
+      already dealt with in step 1.)
+
+   Directories whose modification time is unchanged are not read. (This
+   relies on the file system's timestamp granularity being fine enough
+   that a change made within the same timestamp "tick" as a scan is not
+   missed.)
+
+   Returns 0 on success, or -1 if the cache could not be made consistent,
+   in which case the caller should rebuild it from scratch. */
+
+static int
+resyncCache(int inotifyFd)
+{
+    struct slotRef *gone, *dirty;
+    int ngone, ndirty, slot, zapped, added;
+    char path[PATH_MAX];
+    struct statx stx;
+
+    gone = malloc(cacheSize * sizeof(struct slotRef));
+    dirty = malloc(cacheSize * sizeof(struct slotRef));
+    if (gone == NULL || dirty == NULL)
+        errExit("malloc");
+
+    ngone = ndirty = 0;
+    for (int j = 0; j < cacheSize; j++) {
+        if (wlCache[j].wd < 0)
+            continue;
+
+        if (statx(AT_FDCWD, wlCache[j].path, AT_SYMLINK_NOFOLLOW,
+                  STATX_TYPE | STATX_INO | STATX_MTIME, &stx) == -1 ||
+                !S_ISDIR(stx.stx_mode) || stx.stx_ino != wlCache[j].ino) {
+            gone[ngone].slot = j;
+            gone[ngone++].wd = wlCache[j].wd;
+        } else if (stx.stx_mtime.tv_sec != wlCache[j].mtime.tv_sec ||
+                   stx.stx_mtime.tv_nsec != wlCache[j].mtime.tv_nsec) {
+            dirty[ndirty].slot = j;
+            dirty[ndirty++].wd = wlCache[j].wd;
+        }
+    }
+
+    /* Step 1: zap vanished subtrees. An entry may already have been
+       zapped as part of an earlier subtree. */
+
+    zapped = 0;
+    for (int k = 0; k < ngone; k++) {
+        slot = gone[k].slot;
+        if (wlCache[slot].wd != gone[k].wd)
+            continue;
+
+        logMessage(VB_BASIC, "    resync: gone: %s\n", wlCache[slot].path);
+
+        snprintf(path, sizeof(path), "%s", wlCache[slot].path);
+        if (isRootDirPath(path))
+            zapRootDirPath(path);
+        if (zapSubtree(inotifyFd, path, 1) == -1) {
+            free(gone);
+            free(dirty);
+            return -1;
+        }
+        zapped++;
+    }
+
+    /* Step 2: reread changed directories */
+
+    added = rescanChangedDirs(inotifyFd, dirty, ndirty);
+
+    logMessage(0, "Resynchronized cache: %d vanished subtrees, %d changed "
+            "directories, %d new subtrees; %d entries\n",
+            zapped, ndirty, added, numCached);
+
+    free(gone);
+    free(dirty);
+    return 0;
+}
+
+/***********************************************************************/
+
+/* Saving and restoring the cache
+
+   Building the cache means reading every directory in the trees, which,
+   for a tree of a million directories, can take minutes. With the -S
+   option, the cache is saved to a snapshot file when the program exits
+   (and every -P seconds, and on request), and, on start-up, the cache is
+   rebuilt from the snapshot, rather than by scanning the trees:
+
+   1. For each directory in the snapshot, a watch is added, and then the
+      directory is statx()-ed (in that order, so that any change made
+      after the statx() is reported by the watch). Since these steps are
+      independent for each directory, they are performed by several
+      threads in parallel (as many as are used to scan the trees).
+
+   2. Each directory that was successfully watched is added to the cache.
+      If its i-node number, device, and modification time are those
+      recorded in the snapshot, then its subdirectories are (at least)
+      those recorded in the snapshot, and there is no need to read it.
+      Otherwise, it is reread, as in step 2 of resyncCache().
+      Subdirectories that have been created (or renamed into the tree)
+      since the snapshot was saved are found when their parents are
+      reread; those that have gone fail to be watched in step 1.
+
+   As with resyncCache(), this relies on the filesystem's timestamp
+   granularity.
+
+   The snapshot file consists of a header followed by a record for each
+   directory, in preorder (so that a directory's parent precedes it).
+   Each record is followed by the directory's name. For a root directory,
+   the name is the pathname given on the command line; the pathname of
+   any other directory is formed by appending its name to the pathname
+   of its parent. The snapshot is written to a temporary file that is
+   then renamed, so that a crash while saving leaves the previous
+   snapshot intact. */
+
+#define SNAP_MAGIC "IDTSNAP"    /* Includes terminating null byte */
+#define SNAP_VERSION 1
+
+struct snapHeader {
+    char magic[8];              /* SNAP_MAGIC */
+    uint32_t version;           /* SNAP_VERSION */
+    uint32_t numEntries;        /* Number of records that follow */
+};
+
+struct snapEntry {
+    uint64_t ino;               /* I-node number, */
+    uint64_t dev;               /*   device, and modification time */
+    int64_t mtimeSec;           /*   of directory when it was last */
+    uint32_t mtimeNsec;         /*   scanned */
+    int32_t parent;             /* Index of parent's record, or -1 */
+    uint32_t nameLen;           /* Length of name that follows record */
+    uint32_t pad;
+};
+
+static char *snapFile;          /* -S: snapshot file (NULL if none) */
+static int snapInterval;        /* -P: seconds between saves (0 == only
+                                   on exit and on request) */
+static unsigned long savedUpdates = -1;
+                                /* Value of 'cacheUpdates' at last save */
+
+/* Save the cache to 'snapFile'. Returns 0 on success, or -1 on error. */
+
+static int
+saveSnapshot(void)
+{
+    char tmpPath[PATH_MAX];
+    struct snapHeader hdr;
+    struct snapEntry ent;
+    const char *name;
+    int *index, n, ok, savedErrno;
+    FILE *fp;
+
+    if (cacheUpdates == savedUpdates)
+        return 0;               /* Nothing has changed */
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", snapFile);
+    fp = fopen(tmpPath, "w");
+    if (fp == NULL)
+        return -1;
+
+    index = malloc((cacheSize + 1) * sizeof(int));
+    if (index == NULL)
+        errExit("malloc");
+
+    /* The header is rewritten once we know the number of records */
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAP_VERSION;
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+
+    memset(&ent, 0, sizeof(ent));
+    n = 0;
+    for (int root = 0; root < cacheSize; root++) {
+        if (wlCache[root].wd < 0 || wlCache[root].parent != -1 ||
+                !isRootDirPath(wlCache[root].path))
+            continue;
+
+        /* Write the subtree under this root directory, in preorder */
+
+        for (int j = root; j >= 0; ) {
+            index[j] = n++;
+
+            ent.ino = wlCache[j].ino;
+            ent.dev = wlCache[j].dev;
+            ent.mtimeSec = wlCache[j].mtime.tv_sec;
+            ent.mtimeNsec = wlCache[j].mtime.tv_nsec;
+            ent.parent = (j == root) ? -1 : index[wlCache[j].parent];
+            name = (j == root) ? wlCache[j].path :
+                                 strrchr(wlCache[j].path, '/') + 1;
+            ent.nameLen = strlen(name);
+            fwrite(&ent, sizeof(ent), 1, fp);
+            fwrite(name, 1, ent.nameLen, fp);
+
+            if (wlCache[j].firstChild >= 0) {
+                j = wlCache[j].firstChild;
+            } else {
+                while (j != root && wlCache[j].nextSibling == -1)
+                    j = wlCache[j].parent;
+                j = (j == root) ? -1 : wlCache[j].nextSibling;
+            }
+        }
+    }
+
+    free(index);
+
+    hdr.numEntries = n;
+    rewind(fp);
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+
+    ok = !ferror(fp) && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    savedErrno = errno;
+    if (fclose(fp) != 0 && ok) {
+        ok = 0;
+        savedErrno = errno;
+    }
+
+    if (ok && rename(tmpPath, snapFile) == -1) {
+        ok = 0;
+        savedErrno = errno;
+    }
+
+    if (!ok) {
+        unlink(tmpPath);
+        errno = savedErrno;
+        return -1;
+    }
+
+    savedUpdates = cacheUpdates;
+    logMessage(VB_BASIC, "Saved %d entries to snapshot %s\n", n, snapFile);
+    return 0;
+}
+
+/* Save the cache to 'snapFile' (if -S was specified), logging any error */
+
+static void
+saveSnapshotOrLog(void)
+{
+    if (snapFile != NULL && saveSnapshot() == -1)
+        logMessage(0, "Could not save snapshot %s: %s\n", snapFile,
+                   strerror(errno));
+}
+
+/* The snapshot records read by restoreSnapshot(), and the results of
+   step 1, shared with the threads that perform that step */
+
+enum snapState { SNAP_GONE, SNAP_SAME, SNAP_CHANGED };
+
+static struct {
+    struct snapEntry *ents;     /* Records read from snapshot */
+    char **paths;               /* Pathnames (NULL if not restored) */
+    int *wds;                   /* Watch descriptors (-1 if none) */
+    unsigned char *states;      /* 'enum snapState' values */
+    int num;                    /* Number of records */
+    int nthreads;               /* Number of threads performing step 1 */
+    int inotifyFd;
+    int failErrno;              /* Unexpected inotify_add_watch() error */
+} snap;
+
+struct snapThread {
+    pthread_t tid;
+    int self;                   /* Handles records self, self + nthreads,
+                                   self + 2 * nthreads, ... */
+};
+
+/* Step 1: add watches for, and statx(), a share of the directories */
+
+static void *
+snapCheckThread(void *arg)
+{
+    struct snapThread *th = arg;
+    const struct snapEntry *e;
+    struct statx stx;
+    int flags, wd;
+
+    for (int j = th->self; j < snap.num; j += snap.nthreads) {
+        snap.wds[j] = -1;
+        snap.states[j] = SNAP_GONE;
+        if (snap.paths[j] == NULL)
+            continue;
+
+        flags = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                IN_DELETE_SELF;
+        if (snap.ents[j].parent == -1)
+            flags |= IN_MOVE_SELF;
+
+        wd = inotify_add_watch(snap.inotifyFd, snap.paths[j],
+                               flags | IN_ONLYDIR);
+        if (wd == -1) {
+            logMessage(VB_NOISY, "    restore: gone: %s: %s\n",
+                       snap.paths[j], strerror(errno));
+            if (errno != ENOENT && errno != ENOTDIR && errno != EACCES)
+                snap.failErrno = errno;
+            continue;
+        }
+        snap.wds[j] = wd;
+
+        /* If the directory vanishes after being watched, an event will
+           tell us; meanwhile, we treat it as changed */
+
+        e = &snap.ents[j];
+        snap.states[j] =
+            (statx(AT_FDCWD, snap.paths[j], AT_SYMLINK_NOFOLLOW,
+                   STATX_INO | STATX_MTIME, &stx) == 0 &&
+             stx.stx_ino == e->ino &&
+             makedev(stx.stx_dev_major, stx.stx_dev_minor) == e->dev &&
+             stx.stx_mtime.tv_sec == e->mtimeSec &&
+             stx.stx_mtime.tv_nsec == e->mtimeNsec) ? SNAP_SAME : SNAP_CHANGED;
+    }
+
+    return NULL;
+}
+
+/* Read the snapshot records from 'fp' into 'snap', forming the pathname
+   of each directory. Records under root directories that are not on
+   the command line are ignored. Returns 0 on success, or -1 if the file
+   is not a valid snapshot. */
+
+static int
+readSnapshot(FILE *fp)
+{
+    struct snapHeader hdr;
+    struct snapEntry *e;
+    struct stat sb;
+    char name[PATH_MAX];
+    char *parentPath;
+    size_t len;
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+            memcmp(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic)) != 0 ||
+            hdr.version != SNAP_VERSION)
+        return -1;
+
+    /* Each record is followed by a name of at least one byte, so the
+       file's size bounds the number of records; a larger count (which
+       might also overflow 'snap.num') means the file is corrupt */
+
+    if (fstat(fileno(fp), &sb) == -1 || sb.st_size < (off_t) sizeof(hdr) ||
+            hdr.numEntries > INT_MAX - 1 ||
+            hdr.numEntries > (sb.st_size - sizeof(hdr)) /
+                             (sizeof(struct snapEntry) + 1))
+        return -1;
+
+    snap.num = hdr.numEntries;
+    snap.ents = malloc((snap.num + 1) * sizeof(struct snapEntry));
+    snap.paths = calloc(snap.num + 1, sizeof(char *));
+    snap.wds = malloc((snap.num + 1) * sizeof(int));
+    snap.states = malloc(snap.num + 1);
+    if (snap.ents == NULL || snap.paths == NULL || snap.wds == NULL ||
+            snap.states == NULL)
+        errExit("malloc");
+
+    for (int j = 0; j < snap.num; j++) {
+        e = &snap.ents[j];
+        if (fread(e, sizeof(*e), 1, fp) != 1 || e->parent >= j ||
+                e->nameLen == 0 || e->nameLen >= PATH_MAX ||
+                fread(name, 1, e->nameLen, fp) != e->nameLen)
+            return -1;
+        name[e->nameLen] = '\0';
+
+        if (e->parent < 0) {
+            if (!isRootDirPath(name))
+                continue;
+            for (int k = 0; k < j; k++)
+                if (snap.ents[k].parent < 0 && snap.paths[k] != NULL &&
+                        strcmp(snap.paths[k], name) == 0)
+                    return -1;          /* Duplicate root directory */
+            snap.paths[j] = strdup(name);
+
+        } else {
+            if (strchr(name, '/') != NULL)
+                return -1;
+
+            parentPath = snap.paths[e->parent];
+            if (parentPath == NULL)
+                continue;
+            len = strlen(parentPath) + 1 + e->nameLen;
+            if (len >= PATH_MAX)
+                continue;               /* See "Known limitations" */
+            snap.paths[j] = malloc(len + 1);
+            if (snap.paths[j] != NULL)
+                sprintf(snap.paths[j], "%s/%s", parentPath, name);
+        }
+
+        if (snap.paths[j] == NULL)
+            errExit("malloc");
+    }
+
+    return 0;
+}
+
+/* Free the storage allocated by readSnapshot() */
+
+static void
+freeSnapshot(void)
+{
+    if (snap.paths != NULL)
+        for (int j = 0; j < snap.num; j++)
+            free(snap.paths[j]);
+    free(snap.ents);
+    free(snap.paths);
+    free(snap.wds);
+    free(snap.states);
+    memset(&snap, 0, sizeof(snap));
+}
+
+/* Create an inotify instance, and populate it and the cache from the
+   snapshot in 'snapFile'. Returns the inotify file descriptor, or -1 if
+   the snapshot could not be used (in which case the caller should build
+   the cache from scratch). */
+
+static int
+restoreSnapshot(void)
+{
+    struct snapThread *threads;
+    struct slotRef *dirty;
+    int inotifyFd, ndirty, ngone, added, parent, slot, s;
+    int restored, current;
+    int *slots;
+    FILE *fp;
+
+    fp = fopen(snapFile, "r");
+    if (fp == NULL) {
+        logMessage(VB_BASIC, "Snapshot %s: %s\n", snapFile, strerror(errno));
+        return -1;
+    }
+
+    s = readSnapshot(fp);
+    fclose(fp);
+    if (s == -1) {
+        logMessage(0, "%s is not a valid snapshot; ignoring it\n", snapFile);
+        freeSnapshot();
+        return -1;
+    }
+
+    logMessage(0, "Initializing cache from snapshot (%d entries)\n",
+               snap.num);
+
+    inotifyFd = inotify_init();
+    if (inotifyFd == -1)
+        errExit("inotify_init");
+
+    freeCache();
+
+    /* Step 1: add the watches and check the directories, in parallel */
+
+    snap.inotifyFd = inotifyFd;
+    snap.nthreads = (scanThreads > 0) ? scanThreads :
+                                        sysconf(_SC_NPROCESSORS_ONLN);
+    if (snap.nthreads <= 0)
+        snap.nthreads = 1;
+
+    threads = calloc(snap.nthreads, sizeof(struct snapThread));
+    if (threads == NULL)
+        errExit("calloc");
+
+    for (int t = 0; t < snap.nthreads; t++) {
+        threads[t].self = t;
+        s = pthread_create(&threads[t].tid, NULL, snapCheckThread,
+                           &threads[t]);
+        if (s != 0) {
+            errno = s;
+            errExit("pthread_create");
+        }
+    }
+    for (int t = 0; t < snap.nthreads; t++) {
+        s = pthread_join(threads[t].tid, NULL);
+        if (s != 0) {
+            errno = s;
+            errExit("pthread_join");
+        }
+    }
+    free(threads);
+
+    if (snap.failErrno != 0) {
+        errno = snap.failErrno;
+        errExit("inotify_add_watch");
+    }
+
+    /* Step 2: build the cache, noting the directories that have changed.
+       A directory whose parent was not restored (because the parent
+       vanished just as we checked it) is left for the parent's parent to
+       rediscover. */
+
+    slots = malloc((snap.num + 1) * sizeof(int));
+    dirty = malloc((snap.num + 1) * sizeof(struct slotRef));
+    if (slots == NULL || dirty == NULL)
+        errExit("malloc");
+
+    ndirty = ngone = 0;
+    for (int j = 0; j < snap.num; j++) {
+        slots[j] = -1;
+        if (snap.paths[j] == NULL)
+            continue;
+
+        parent = (snap.ents[j].parent < 0) ? -1 : slots[snap.ents[j].parent];
+        if (snap.states[j] == SNAP_GONE ||
+                (snap.ents[j].parent >= 0 && parent == -1)) {
+            if (snap.wds[j] >= 0 && findWatch(snap.wds[j]) == -1)
+                inotify_rm_watch(inotifyFd, snap.wds[j]);
+            ngone++;
+            continue;
+        }
+
+        if (findWatch(snap.wds[j]) >= 0) {
+            logMessage(VB_BASIC, "WD %d already in cache (%s)\n",
+                       snap.wds[j], snap.paths[j]);
+            continue;
+        }
+
+        slot = addWatchToCache(snap.wds[j], snap.paths[j], parent);
+        wlCache[slot].ino = snap.ents[j].ino;
+        wlCache[slot].dev = snap.ents[j].dev;
+        wlCache[slot].mtime.tv_sec = snap.ents[j].mtimeSec;
+        wlCache[slot].mtime.tv_nsec = snap.ents[j].mtimeNsec;
+        slots[j] = slot;
+
+        if (snap.states[j] == SNAP_CHANGED) {
+            dirty[ndirty].slot = slot;
+            dirty[ndirty++].wd = snap.wds[j];
+        }
+    }
+
+    restored = numCached;
+    current = ngone == 0 && ndirty == 0 && restored == snap.num;
+
+    freeSnapshot();
+    free(slots);
+
+    /* Scan any root directories that were missing from the snapshot
+       (or that had changed beyond recognition), and then reread the
+       directories that have changed */
+
+    for (int j = 0; j < numRootDirs; j++)
+        if (rootDirPaths[j] != NULL && !pathnameInCache(rootDirPaths[j]))
+            watchSubtree(inotifyFd, rootDirPaths[j], -1);
+
+    added = rescanChangedDirs(inotifyFd, dirty, ndirty);
+    free(dirty);
+
+    if (current && numCached == restored)
+        savedUpdates = cacheUpdates;    /* Snapshot file is up to date */
+
+    logMessage(0, "Restored cache: %d vanished directories, %d changed "
+            "directories, %d new subtrees; %d entries\n",
+            ngone, ndirty, added, numCached);
 
     return inotifyFd;
 }
 
+/* Discard any events that are queued on 'inotifyFd' */
+
+static void
+drainInotifyFd(int inotifyFd)
+{
+    char buf[INOTIFY_READ_BUF_LEN]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    int flags;
+
+    flags = fcntl(inotifyFd, F_GETFL);
+    if (flags == -1 || fcntl(inotifyFd, F_SETFL, flags | O_NONBLOCK) == -1)
+        errExit("fcntl");
+
+    while (read(inotifyFd, buf, INOTIFY_READ_BUF_LEN) > 0)
+        continue;
+
+    if (fcntl(inotifyFd, F_SETFL, flags) == -1)
+        errExit("fcntl");
+}
+
 /* Process the next inotify event in the buffer specified by 'buf'
    and 'bufSize'. In most cases, a single event is consumed, but
    if there is an IN_MOVED_FROM+IN_MOVED_TO pair that share a cookie
@@ -768,6 +1821,8 @@ processNextInotifyEvent(int *inotifyFd, char *buf, int bufSize, int firstTry)
 
     displayInotifyEvent(ev);
 
+    intStats.applied++;
+
     if (ev->wd != -1 && !(ev->mask & IN_IGNORED)) {
 
                 /* IN_Q_OVERFLOW has (ev->wd == -1) */
@@ -786,7 +1841,7 @@ processNextInotifyEvent(int *inotifyFd, char *buf, int bufSize, int firstTry)
 
             /* Discard all remaining events in current read() buffer */
 
-            return INOTIFY_READ_BUF_LEN;
+            return bufSize;
         }
     }
 
@@ -834,7 +1889,7 @@ processNextInotifyEvent(int *inotifyFd, char *buf, int bufSize, int firstTry)
                   state.) */
 
         if (!pathnameInCache(fullPath))
-            watchSubtree(*inotifyFd, fullPath);
+            watchSubtree(*inotifyFd, fullPath, evCacheSlot);
 
     } else if (ev->mask & IN_DELETE_SELF) {
 
@@ -958,16 +2013,17 @@ processNextInotifyEvent(int *inotifyFd, char *buf, int bufSize, int firstTry)
 
                 /* Discard all remaining events in current read() buffer */
 
-                return INOTIFY_READ_BUF_LEN;
+                return bufSize;
             }
 
-            rewriteCachedPaths(wlCache[evCacheSlot].path, ev->name,
-                               wlCache[nextEvCacheSlot].path, nextEv->name);
+            rewriteCachedPaths(evCacheSlot, ev->name,
+                               nextEvCacheSlot, nextEv->name);
 
             /* We have also processed the next (IN_MOVED_TO) event,
                so skip over it */
 
             evLen += sizeof(struct inotify_event) + nextEv->len;
+            intStats.applied++;
 
         } else if (((char *) nextEv < buf + bufSize) || !firstTry) {
 
@@ -984,7 +2040,7 @@ processNextInotifyEvent(int *inotifyFd, char *buf, int bufSize, int firstTry)
             snprintf(fullPath, sizeof(fullPath), "%s/%s",
                      wlCache[evCacheSlot].path, ev->name);
 
-            if (zapSubtree(*inotifyFd, fullPath) == -1) {
+            if (zapSubtree(*inotifyFd, fullPath, 0) == -1) {
 
                 /* Cache reached an inconsistent state */
 
@@ -992,12 +2048,13 @@ processNextInotifyEvent(int *inotifyFd, char *buf, int bufSize, int firstTry)
 
                 /* Discard all remaining events in current read() buffer */
 
-                return INOTIFY_READ_BUF_LEN;
+                return bufSize;
             }
 
         } else {
             logMessage(VB_NOISY, "HANGING IN_MOVED_FROM\n");
 
+            intStats.applied--;     /* We'll see this event again */
             return -1;  /* Tell our caller to do another read() */
         }
 
@@ -1006,21 +2063,26 @@ processNextInotifyEvent(int *inotifyFd, char *buf, int bufSize, int firstTry)
         static int overflowCnt = 0;
 
         overflowCnt++;
+        traceCacheUpdate('O', "");
 
         logMessage(0, "Queue overflow (%d) (inotifyReadCnt = %d)\n",
                     overflowCnt, inotifyReadCnt);
 
         /* When the queue overflows, some events are lost, at which
-           point we've lost any chance of keeping our cache consistent
-           with the state of the filesystem. So, discard this inotify
-           file descriptor and create a new one, and zap and rebuild
-           the cache. */
-
-        *inotifyFd = reinitialize(*inotifyFd);
+           point our cache may no longer be consistent with the state
+           of the filesystem. Discard any queued events (which we can't
+           interpret reliably), and then rescan the parts of the tree
+           that have changed. If that fails, discard this inotify file
+           descriptor and create a new one, and zap and rebuild the
+           cache. */
+
+        drainInotifyFd(*inotifyFd);
+        if (resyncCache(*inotifyFd) == -1)
+            *inotifyFd = reinitialize(*inotifyFd);
 
         /* Discard all remaining events in current read() buffer */
 
-        evLen = INOTIFY_READ_BUF_LEN;
+        evLen = bufSize;
 
     } else if (ev->mask & IN_UNMOUNT) {
 
@@ -1051,7 +2113,7 @@ processNextInotifyEvent(int *inotifyFd, char *buf, int bufSize, int firstTry)
 
         zapRootDirPath(wlCache[evCacheSlot].path);
 
-        if (zapSubtree(*inotifyFd, wlCache[evCacheSlot].path) == -1) {
+        if (zapSubtree(*inotifyFd, wlCache[evCacheSlot].path, 0) == -1) {
 
             /* Cache reached an inconsistent state */
 
@@ -1059,7 +2121,7 @@ processNextInotifyEvent(int *inotifyFd, char *buf, int bufSize, int firstTry)
 
             /* Discard all remaining events in current read() buffer */
 
-            return INOTIFY_READ_BUF_LEN;
+            return bufSize;
         }
     }
 
@@ -1078,6 +2140,212 @@ alarmHandler(int sig)
     return;             /* Just interrupt read() */
 }
 
+static volatile sig_atomic_t gotTermSig;
+
+static void
+termHandler(int sig)
+{
+    gotTermSig = 1;     /* Tell main() to save snapshot and exit */
+}
+
+/* Return the number of events in the 'len' bytes of events in 'buf' */
+
+static unsigned long
+countEvents(const char *buf, ssize_t len)
+{
+    unsigned long cnt = 0;
+
+    for (const char *p = buf; p < buf + len;
+            p += sizeof(struct inotify_event) +
+                 ((const struct inotify_event *) p)->len)
+        cnt++;
+
+    return cnt;
+}
+
+/* Merge redundant events in the 'len' bytes of events in 'buf' before
+   they are used to update the cache, compacting the buffer in place.
+   Returns the number of bytes of events that remain. The following
+   events are discarded:
+
+   * Events for objects other than directories (which we don't cache).
+
+   * An IN_CREATE event for a subdirectory, together with a later
+     IN_DELETE event for the same name in the same directory. Processing
+     the IN_CREATE would have been a wasted attempt to watch a directory
+     that no longer exists. (If the directory was already cached, the
+     IN_DELETE_SELF event for the directory will remove it.)
+
+   * An IN_CREATE event for a subdirectory that is not yet cached and
+     that is later renamed, together with the IN_MOVED_FROM event. If
+     the rename was within our trees, the IN_MOVED_TO event remains,
+     and is handled as the creation of a directory; if the directory was
+     renamed out of our trees, nothing remains. (We can't tell which
+     case applies for an IN_MOVED_FROM that is the last event in the
+     buffer, so that event is left for processNextInotifyEvent().)
+
+   * An IN_CREATE event for a subdirectory that is later replaced by a
+     rename (IN_MOVED_TO) onto the same name.
+
+   IN_CREATE events that have not yet been paired with a later event
+   are found via a hash table keyed on (watch descriptor, name). */
+
+struct evRef {
+    struct inotify_event *ev;
+    int next;                   /* Next pending IN_CREATE in hash chain */
+    int pending;                /* IN_CREATE not yet paired */
+    int drop;                   /* Discard this event */
+};
+
+static ssize_t
+coalesceEvents(char *buf, ssize_t len)
+{
+    static struct evRef *refs = NULL;
+    static int *bucket = NULL;
+    static int maxRefs = 0, nBuckets = 0;
+    char path[PATH_MAX + NAME_MAX];
+    struct inotify_event *ev, *cev;
+    unsigned int h;
+    int n, c, slot;
+    char *dst;
+
+    n = countEvents(buf, len);
+    if (n > maxRefs) {
+        maxRefs = n * 2;
+        refs = realloc(refs, maxRefs * sizeof(struct evRef));
+        if (refs == NULL)
+            errExit("realloc");
+    }
+
+    if (nBuckets < n) {
+        while (nBuckets < n)
+            nBuckets = (nBuckets == 0) ? 64 : nBuckets * 2;
+        bucket = realloc(bucket, nBuckets * sizeof(int));
+        if (bucket == NULL)
+            errExit("realloc");
+    }
+    for (int b = 0; b < nBuckets; b++)
+        bucket[b] = -1;
+
+    n = 0;
+    for (char *p = buf; p < buf + len; n++) {
+        refs[n].ev = (struct inotify_event *) p;
+        refs[n].pending = 0;
+        refs[n].drop = 0;
+        p += sizeof(struct inotify_event) + refs[n].ev->len;
+    }
+
+    for (int j = 0; j < n; j++) {
+        ev = refs[j].ev;
+
+        if (ev->len == 0 || !(ev->mask & (IN_CREATE | IN_DELETE |
+                                          IN_MOVED_FROM | IN_MOVED_TO)))
+            continue;
+
+        if (!(ev->mask & IN_ISDIR)) {
+            refs[j].drop = 1;
+            continue;
+        }
+
+        /* Find the pending IN_CREATE (if any) for this name */
+
+        h = (hashPath(ev->name) ^ hashWd(ev->wd)) & (nBuckets - 1);
+        for (c = bucket[h]; c != -1; c = refs[c].next) {
+            cev = refs[c].ev;
+            if (refs[c].pending && cev->wd == ev->wd &&
+                    strcmp(cev->name, ev->name) == 0)
+                break;
+        }
+
+        if (ev->mask & IN_CREATE) {
+            if (c != -1)
+                refs[c].pending = 0;
+            refs[j].pending = 1;
+            refs[j].next = bucket[h];
+            bucket[h] = j;
+            continue;
+        }
+
+        if (c == -1)
+            continue;
+
+        if (ev->mask & IN_DELETE) {
+            refs[c].drop = refs[j].drop = 1;
+
+        } else if (ev->mask & IN_MOVED_TO) {
+            refs[c].drop = 1;
+
+        } else if (j + 1 < n) {         /* IN_MOVED_FROM */
+
+            /* If the directory is already cached (because an earlier
+               scan found it), the rename must be handled normally, so
+               that the cached pathnames are changed or removed */
+
+            slot = findWatch(ev->wd);
+            if (slot == -1)
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", wlCache[slot].path,
+                     ev->name);
+            if (pathnameInCache(path))
+                continue;
+
+            refs[c].drop = refs[j].drop = 1;
+        } else {
+            continue;
+        }
+
+        refs[c].pending = 0;
+        logMessage(VB_NOISY, "Coalesced events for wd %d, name %s\n",
+                   ev->wd, ev->name);
+    }
+
+    /* Compact the buffer, preserving the order of the remaining events */
+
+    dst = buf;
+    for (int j = 0; j < n; j++) {
+        ev = refs[j].ev;
+        if (refs[j].drop) {
+            intStats.coalesced++;
+        } else {
+            if ((char *) ev != dst)
+                memmove(dst, ev, sizeof(struct inotify_event) + ev->len);
+            dst += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    return dst - buf;
+}
+
+/* Fold the statistics for the current interval into the totals and,
+   if there was activity, log the per-second rates. This is done if at
+   least a second has passed since the start of the interval, or if
+   'force' is nonzero. */
+
+static void
+updateEventStats(int force)
+{
+    struct timespec now;
+    double secs;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+        errExit("clock_gettime");
+    secs = (now.tv_sec - intStart.tv_sec) +
+           (now.tv_nsec - intStart.tv_nsec) / 1e9;
+    if (secs < 1.0 && !force)
+        return;
+
+    if (intStats.read > 0 && secs > 0)
+        logMessage(VB_BASIC, "Events/sec: read %.0f; coalesced %.0f; "
+                "applied %.0f\n", intStats.read / secs,
+                intStats.coalesced / secs, intStats.applied / secs);
+
+    totStats.read += intStats.read;
+    totStats.coalesced += intStats.coalesced;
+    totStats.applied += intStats.applied;
+    memset(&intStats, 0, sizeof(intStats));
+    intStart = now;
+}
+
 /* Read a block of events from the inotify file descriptor, 'inotifyFd'.
    Process the events relating to directories in the subtree we are
    monitoring, in order to keep our cached view of the subtree in sync
@@ -1086,14 +2354,23 @@ alarmHandler(int sig)
 static void
 processInotifyEvents(int *inotifyFd)
 {
-    char buf[INOTIFY_READ_BUF_LEN]
-        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    static char *buf = NULL;
+    const size_t MIN_SPACE = sizeof(struct inotify_event) + NAME_MAX + 1;
     ssize_t numRead, nr;
     size_t cnt;
-    int evLen;
+    int evLen, avail;
     int firstTry;
     struct sigaction sa;
 
+    /* The buffer is allocated with malloc(), so it is suitably aligned
+       for inotify_event structures */
+
+    if (buf == NULL) {
+        buf = malloc(batchBufferSize);
+        if (buf == NULL)
+            errExit("malloc");
+    }
+
     /* SIGALRM handler is designed simply to interrupt read() */
 
     sigemptyset(&sa.sa_mask);
@@ -1121,6 +2398,33 @@ processInotifyEvents(int *inotifyFd)
                "\n==========> Read %d: got %zd bytes\n",
                inotifyReadCnt, numRead);
 
+    /* If we are coalescing events, drain the rest of the queue (as far
+       as the buffer allows), so that related events can be merged, and
+       so that the kernel queue is emptied as quickly as possible during
+       bursts of activity */
+
+    while (coalesce && batchBufferSize - numRead >= MIN_SPACE &&
+            ioctl(*inotifyFd, FIONREAD, &avail) == 0 && avail > 0) {
+        cnt = batchBufferSize - numRead;
+        if (readBufferSize > 0 && cnt > readBufferSize)
+            cnt = readBufferSize;
+
+        nr = read(*inotifyFd, buf + numRead, cnt);
+        if (nr == -1)
+            errExit("read");
+
+        numRead += nr;
+        inotifyReadCnt++;
+
+        logMessage(VB_NOISY,
+                   "\n==========> Drain read %d: got %zd bytes\n",
+                   inotifyReadCnt, nr);
+    }
+
+    intStats.read += countEvents(buf, numRead);
+    if (coalesce)
+        numRead = coalesceEvents(buf, numRead);
+
     /* Process each event in the buffer returned by read() */
 
     for (char *evp = buf; evp < buf + numRead; ) {
@@ -1169,7 +2473,7 @@ processInotifyEvents(int *inotifyFd)
             ualarm(2000, 0);
 
             nr = read(*inotifyFd, buf + numRead,
-                      INOTIFY_READ_BUF_LEN - numRead);
+                      batchBufferSize - numRead);
 
             savedErrno = errno; /* In case ualarm() should change errno */
             ualarm(0, 0);       /* Cancel alarm */
@@ -1182,7 +2486,8 @@ processInotifyEvents(int *inotifyFd)
                 exit(EXIT_FAILURE);
             }
 
-            if (errno != -1) {
+            if (nr > 0) {
+                intStats.read += countEvents(buf + numRead, nr);
                 numRead += nr;
                 inotifyReadCnt++;
 
@@ -1198,10 +2503,28 @@ processInotifyEvents(int *inotifyFd)
             evp = buf;          /* Start again at beginning of buffer */
         }
     }
+
+    updateEventStats(0);
 }
 
 /***********************************************************************/
 
+/* Save the cache snapshot (if -S was specified) and the event
+   statistics (if -T was specified), and terminate */
+
+static void __attribute__ ((noreturn))
+quit(int status)
+{
+    saveSnapshotOrLog();
+
+    if (tracefp != NULL) {
+        updateEventStats(1);
+        fprintf(tracefp, "S %lu %lu %lu\n", totStats.read,
+                totStats.coalesced, totStats.applied);
+    }
+    exit(status);
+}
+
 /* We allow some simple interactive commands, mainly to check the
    operation of the program */
 
@@ -1219,7 +2542,7 @@ executeCommand(int *inotifyFd)
     numRead = read(STDIN_FILENO, line, MAX_LINE);
     if (numRead <= 0) {
         printf("bye!\n");
-        exit(EXIT_FAILURE);
+        quit(EXIT_FAILURE);
     }
 
     line[numRead - 1] = '\0';
@@ -1233,14 +2556,14 @@ executeCommand(int *inotifyFd)
 
     case 'a':   /* Add/refresh a subtree */
 
-        cnt = zapSubtree(*inotifyFd, arg);
+        cnt = zapSubtree(*inotifyFd, arg, 0);
         if (cnt == 0) {
             logMessage(VB_BASIC, "Adding new subtree: %s\n", arg);
         } else {
             logMessage(VB_BASIC, "Zapped: %s, %d entries\n", arg, cnt);
         }
 
-        watchSubtree(*inotifyFd, arg);
+        watchSubtree(*inotifyFd, arg, parentCacheSlot(arg));
         break;
 
     case 'c':   /* Check that all cached pathnames exist */
@@ -1291,9 +2614,25 @@ executeCommand(int *inotifyFd)
         logMessage(VB_BASIC, "Total entries: %d\n", cnt);
         break;
 
+    case 'p':   /* Save cache snapshot */
+
+        if (snapFile == NULL)
+            printf("No snapshot file (-S)\n");
+        else
+            saveSnapshotOrLog();
+        break;
+
     case 'q':   /* Quit */
 
-        exit(EXIT_SUCCESS);
+        quit(EXIT_SUCCESS);
+
+    case 's':   /* Display event statistics */
+
+        updateEventStats(1);
+        logMessage(0, "Events read: %lu; coalesced: %lu; applied: %lu\n",
+                totStats.read, totStats.coalesced, totStats.applied);
+        logMessage(0, "read() calls: %d\n", inotifyReadCnt);
+        break;
 
     case 'v':   /* Set log verbosity level */
 
@@ -1336,7 +2675,7 @@ executeCommand(int *inotifyFd)
 
     case 'z':   /* Stop watching a subtree, and zap its cache entries */
 
-        cnt = zapSubtree(*inotifyFd, arg);
+        cnt = zapSubtree(*inotifyFd, arg, 0);
         logMessage(VB_BASIC, "Zapped: %s, %d entries\n", arg, cnt);
         break;
 
@@ -1353,7 +2692,9 @@ executeCommand(int *inotifyFd)
         printf("c        Verify cached pathnames\n");
         printf("d        Toggle cache dumping\n");
         printf("l        List cached pathnames\n");
+        printf("p        Save cache snapshot (-S)\n");
         printf("q        Quit\n");
+        printf("s        Display event statistics\n");
         printf("v [n]    Toggle/set verbose level for messages to stderr\n");
         printf("             0 = no messages\n");
         printf("             1 = basic messages\n");
@@ -1380,8 +2721,19 @@ usageError(const char *pname)
     fprintf(stderr, "    -d       Dump cache to log after every operation\n");
     fprintf(stderr, "    -b size  Set buffer size for read() from "
                                   "inotify FD\n");
+    fprintf(stderr, "    -B size  Set size of buffer into which queued "
+                                  "events are drained (default: 1 MiB)\n");
+    fprintf(stderr, "    -n       Don't drain and coalesce queued events\n");
+    fprintf(stderr, "    -T file  Record timestamped cache updates in "
+                                  "'file' (see dtree_bench.c)\n");
     fprintf(stderr, "    -a file  Abort when cache inconsistency detected, "
             "and create 'stop' file\n");
+    fprintf(stderr, "    -t num   Number of threads used to scan the tree "
+            "(default: one per CPU)\n");
+    fprintf(stderr, "    -S file  Restore cache from snapshot 'file' at "
+            "start-up; save it on exit\n");
+    fprintf(stderr, "    -P secs  Also save snapshot every 'secs' seconds "
+            "(if changed)\n");
 
     exit(EXIT_FAILURE);
 }
@@ -1392,6 +2744,10 @@ main(int argc, char *argv[])
     fd_set rfds;
     int opt;
     int inotifyFd;
+    struct timeval tv, *tvp;
+    struct timespec now;
+    struct sigaction sa;
+    time_t nextSave;
 
     /* Parse command-line options */
 
@@ -1401,7 +2757,7 @@ main(int argc, char *argv[])
     stopFile = NULL;
     abortOnCacheProblem = 0;
 
-    while ((opt = getopt(argc, argv, "a:dxl:v:b:")) != -1) {
+    while ((opt = getopt(argc, argv, "a:dxl:v:b:B:nP:S:t:T:")) != -1) {
         switch (opt) {
 
         case 'a':
@@ -1425,6 +2781,26 @@ main(int argc, char *argv[])
             readBufferSize = atoi(optarg);
             break;
 
+        case 'B':
+            batchBufferSize = atoi(optarg);
+            break;
+
+        case 'n':
+            coalesce = 0;
+            break;
+
+        case 'P':
+            snapInterval = atoi(optarg);
+            break;
+
+        case 'S':
+            snapFile = optarg;
+            break;
+
+        case 't':
+            scanThreads = atoi(optarg);
+            break;
+
         case 'l':
             logfp = fopen(optarg, "w+");
             if (logfp == NULL)
@@ -1432,6 +2808,12 @@ main(int argc, char *argv[])
             setbuf(logfp, NULL);
             break;
 
+        case 'T':               /* Fully buffered, to minimize overhead */
+            tracefp = fopen(optarg, "w");
+            if (tracefp == NULL)
+                errExit("fopen");
+            break;
+
         default:
             usageError(argv[0]);
         }
@@ -1440,14 +2822,45 @@ main(int argc, char *argv[])
     if (optind >= argc)
         usageError(argv[0]);
 
+    /* The first read() in processInotifyEvents() may need up to
+       INOTIFY_READ_BUF_LEN bytes (or the -b size) */
+
+    if (batchBufferSize < INOTIFY_READ_BUF_LEN)
+        batchBufferSize = INOTIFY_READ_BUF_LEN;
+    if (batchBufferSize < readBufferSize)
+        batchBufferSize = readBufferSize;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &intStart) == -1)
+        errExit("clock_gettime");
+
     /* Save a copy of the directories on the command line */
 
     copyRootDirPaths(&argv[optind]);
 
     /* Create an inotify instance and populate it with entries for
-       directory named on command line */
+       directory named on command line, from the snapshot if there
+       is one */
+
+    inotifyFd = (snapFile != NULL) ? restoreSnapshot() : -1;
+    if (inotifyFd == -1)
+        inotifyFd = reinitialize(-1);
+
+    /* If we are saving snapshots, then the signals that normally
+       terminate the program cause it to save a snapshot first */
+
+    if (snapFile != NULL) {
+        sigemptyset(&sa.sa_mask);
+        sa.sa_handler = termHandler;
+        sa.sa_flags = 0;
+        if (sigaction(SIGTERM, &sa, NULL) == -1 ||
+                sigaction(SIGINT, &sa, NULL) == -1 ||
+                sigaction(SIGHUP, &sa, NULL) == -1)
+            errExit("sigaction");
+    }
 
-    inotifyFd = reinitialize(-1);
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+        errExit("clock_gettime");
+    nextSave = now.tv_sec + snapInterval;
 
     /* Loop to handle inotify events and keyboard commands */
 
@@ -1458,8 +2871,31 @@ main(int argc, char *argv[])
         FD_ZERO(&rfds);
         FD_SET(STDIN_FILENO, &rfds);
         FD_SET(inotifyFd, &rfds);
-        if (select(inotifyFd + 1, &rfds, NULL, NULL, NULL) == -1)
-            errExit("select");
+
+        tvp = NULL;
+        if (snapFile != NULL && snapInterval > 0) {
+            tv.tv_sec = (nextSave > now.tv_sec) ? nextSave - now.tv_sec : 0;
+            tv.tv_usec = 0;
+            tvp = &tv;
+        }
+
+        if (select(inotifyFd + 1, &rfds, NULL, NULL, tvp) == -1) {
+            if (errno != EINTR)
+                errExit("select");
+            FD_ZERO(&rfds);
+        }
+
+        if (gotTermSig)
+            quit(EXIT_SUCCESS);
+
+        if (tvp != NULL) {
+            if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+                errExit("clock_gettime");
+            if (now.tv_sec >= nextSave) {
+                saveSnapshotOrLog();
+                nextSave = now.tv_sec + snapInterval;
+            }
+        }
 
         if (FD_ISSET(STDIN_FILENO, &rfds)) {
             executeCommand(&inotifyFd);
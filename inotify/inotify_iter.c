@@ -0,0 +1,213 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 19 */
+
+/* inotify_iter.c
+
+   Reading events from an inotify file descriptor without copying them.
+
+   The events returned by a read() from an inotify descriptor are
+   variable-length inotify_event structures, packed one after another
+   (each padded so that the next is suitably aligned). Rather than
+   copying each event out of the buffer, iiNext() returns a pointer to
+   the event in place; the pointer remains valid until the next call to
+   iiNext() or iiRead().
+
+   iiRead() fills the buffer (of 'bufSize' bytes, II_DEFAULT_BUF_SIZE if
+   0 is given to iiInit()) in as few read()s as it can: after the first
+   read(), which blocks unless the descriptor was created with
+   IN_NONBLOCK, it goes on reading for as long as FIONREAD says that
+   events are queued and the buffer has room for an event with the
+   longest possible name. A program that monitors the descriptor with
+   epoll (level-triggered or edge-triggered) should call iiRead() and
+   consume the events with iiNext() until iiRead() fails with EAGAIN. A
+   large buffer reduces the number of read()s during bursts of events
+   (the demo_inotify.c buffer holds just 10 events with the longest
+   names), and so the chance that the kernel queue overflows.
+
+   A rename() within or between monitored directories produces an
+   IN_MOVED_FROM event and an IN_MOVED_TO event with the same cookie,
+   which the kernel queues together. If a non-NULL 'to' is given to
+   iiNext(), then for an IN_MOVED_FROM event whose matching IN_MOVED_TO
+   event follows it, iiNext() consumes both, returning the first and
+   setting '*to' to the second; otherwise, '*to' is set to NULL. (As
+   discussed in inotify_dtree.c, when several processes rename files at
+   the same time, the events of different renames may be interleaved,
+   and such pairs are not recognized.) When an IN_MOVED_FROM event is the
+   last in the buffer, its partner may not yet have been read (or the
+   file may have been moved outside the monitored directories, in which
+   case there is no partner); iiNext() then waits up to 'moveWaitMs'
+   milliseconds for more events to arrive, and reads them. Thus, a
+   rename out of the monitored directories that is the last event in a
+   batch delays the caller by up to 'moveWaitMs'; if 'moveWaitMs' is 0,
+   pairs that straddle read()s are not recognized. inotify_dtree.c found
+   2 milliseconds to be enough for almost all pairs.
+
+   Counts of read()s, events, pairs, unpaired IN_MOVED_FROM events, and
+   waits are kept in the inotifyIter structure.
+
+   iiInit() and iiRead() return -1 with errno set on error.
+
+   This module is Linux-specific.
+*/
+#include <sys/ioctl.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include "inotify_iter.h"       /* Declares functions defined here */
+
+/* Room for an event with the longest possible name; read() fails with
+   EINVAL if given less than the size of the next event */
+
+#define MIN_SPACE (sizeof(struct inotify_event) + NAME_MAX + 1)
+
+/* Prepare 'it' for reading events from the inotify descriptor 'fd',
+   with a buffer of 'bufSize' bytes (or II_DEFAULT_BUF_SIZE, if 0), and
+   waiting up to 'moveWaitMs' milliseconds for an IN_MOVED_TO event. */
+
+int
+iiInit(struct inotifyIter *it, int fd, size_t bufSize, int moveWaitMs)
+{
+    memset(it, 0, sizeof(*it));
+
+    if (bufSize == 0)
+        bufSize = II_DEFAULT_BUF_SIZE;
+    if (bufSize < MIN_SPACE || moveWaitMs < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    it->buf = malloc(bufSize);  /* Suitably aligned for inotify_event */
+    if (it->buf == NULL)
+        return -1;
+
+    it->fd = fd;
+    it->bufSize = bufSize;
+    it->moveWaitMs = moveWaitMs;
+    return 0;
+}
+
+/* Move the unconsumed events to the start of the buffer, and read()
+   once into the space that follows them. Returns the number of bytes
+   read, or -1 on error. */
+
+static ssize_t
+readMore(struct inotifyIter *it)
+{
+    ssize_t numRead;
+
+    if (it->pos > 0) {
+        memmove(it->buf, it->buf + it->pos, it->len - it->pos);
+        it->len -= it->pos;
+        it->pos = 0;
+    }
+
+    numRead = read(it->fd, it->buf + it->len, it->bufSize - it->len);
+    if (numRead > 0) {
+        it->len += numRead;
+        it->reads++;
+    }
+    return numRead;
+}
+
+/* Read as many queued events as the buffer can hold. Returns the number
+   of bytes of events that are waiting to be consumed by iiNext(), or
+   -1 on error (in particular, EAGAIN if 'fd' is nonblocking and no
+   events are queued). */
+
+ssize_t
+iiRead(struct inotifyIter *it)
+{
+    int avail;
+
+    if (it->bufSize - (it->len - it->pos) < MIN_SPACE)
+        return it->len - it->pos;       /* Already full */
+
+    if (readMore(it) == -1)
+        return -1;
+
+    while (it->bufSize - it->len >= MIN_SPACE &&
+            ioctl(it->fd, FIONREAD, &avail) == 0 && avail > 0)
+        if (readMore(it) <= 0)
+            break;
+
+    return it->len - it->pos;
+}
+
+/* Return a pointer to the next event in the buffer, or NULL if all
+   events have been consumed. If 'to' is not NULL, IN_MOVED_FROM and
+   IN_MOVED_TO events are paired, as described above. */
+
+const struct inotify_event *
+iiNext(struct inotifyIter *it, const struct inotify_event **to)
+{
+    struct inotify_event *ev, *next;
+    struct pollfd pfd;
+    size_t evLen;
+
+    if (it->pos >= it->len) {
+        it->pos = it->len = 0;
+        return NULL;
+    }
+
+    ev = (struct inotify_event *) (it->buf + it->pos);
+    evLen = sizeof(struct inotify_event) + ev->len;
+    it->pos += evLen;
+    it->events++;
+
+    if (to == NULL)
+        return ev;
+
+    *to = NULL;
+    if (!(ev->mask & IN_MOVED_FROM))
+        return ev;
+
+    if (it->pos >= it->len && it->moveWaitMs > 0) {
+
+        /* The partner, if any, hasn't been read yet. Keep this event
+           (moved to the start of the buffer by readMore()), and wait
+           a little for more. */
+
+        it->pos -= evLen;
+        it->waits++;
+        pfd.fd = it->fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, it->moveWaitMs) > 0)
+            readMore(it);               /* On error, don't pair */
+
+        ev = (struct inotify_event *) (it->buf + it->pos);
+        it->pos += evLen;
+    }
+
+    if (it->pos < it->len) {
+        next = (struct inotify_event *) (it->buf + it->pos);
+        if ((next->mask & IN_MOVED_TO) && next->cookie == ev->cookie) {
+            it->pos += sizeof(struct inotify_event) + next->len;
+            it->events++;
+            it->pairs++;
+            *to = next;
+            return ev;
+        }
+    }
+
+    it->unpaired++;
+    return ev;
+}
+
+void
+iiFree(struct inotifyIter *it)
+{
+    free(it->buf);
+    it->buf = NULL;
+}
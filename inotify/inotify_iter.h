@@ -0,0 +1,59 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 19 */
+
+/* inotify_iter.h
+
+   Header file for inotify_iter.c.
+
+   Typical use, with an inotify descriptor created with IN_NONBLOCK and
+   monitored with epoll:
+
+        iiInit(&it, fd, 0, 2);
+        ...
+        while (iiRead(&it) > 0)                 // On EPOLLIN
+            while ((ev = iiNext(&it, &to)) != NULL)
+                ...                             // 'to' is the IN_MOVED_TO
+                                                // paired with 'ev', or NULL
+*/
+#ifndef INOTIFY_ITER_H
+#define INOTIFY_ITER_H          /* Prevent accidental double inclusion */
+
+#include <sys/inotify.h>
+#include <sys/types.h>
+
+#define II_DEFAULT_BUF_SIZE (64 * 1024)
+
+struct inotifyIter {
+    int fd;                     /* inotify file descriptor */
+    char *buf;                  /* Events read from 'fd' */
+    size_t bufSize;
+    size_t len;                 /* Bytes of events in 'buf' */
+    size_t pos;                 /* Offset of next event in 'buf' */
+    int moveWaitMs;             /* Longest wait for an IN_MOVED_TO */
+
+    unsigned long reads;        /* Successful read()s */
+    unsigned long events;       /* Events read */
+    unsigned long pairs;        /* IN_MOVED_FROM+IN_MOVED_TO pairs */
+    unsigned long unpaired;     /* IN_MOVED_FROM with no IN_MOVED_TO */
+    unsigned long waits;        /* Waits for an IN_MOVED_TO */
+};
+
+int iiInit(struct inotifyIter *it, int fd, size_t bufSize, int moveWaitMs);
+
+ssize_t iiRead(struct inotifyIter *it);
+
+const struct inotify_event *iiNext(struct inotifyIter *it,
+                                   const struct inotify_event **to);
+
+void iiFree(struct inotifyIter *it);
+
+#endif
@@ -0,0 +1,224 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 19 */
+
+/* inotify_iter_bench.c
+
+   Measure how an inotify reader using inotify_iter.c keeps up with a
+   burst of file creations, renames, and deletions.
+
+   Usage: inotify_iter_bench [-b bufsize] [-n files] [-o] [-w ms]
+
+        -b bufsize  Size of the iterator's read buffer (default:
+                    II_DEFAULT_BUF_SIZE; demo_inotify.c uses about 2800)
+        -n files    Number of files (default: 20000)
+        -o          Rename each file out of the monitored directory,
+                    rather than within it
+        -w ms       Longest wait for an IN_MOVED_TO event (default: 2)
+
+   A child process creates each file in a temporary directory, renames
+   it, and removes it, as fast as it can. Meanwhile, the parent, having
+   created a nonblocking inotify descriptor that monitors the directory,
+   waits for events with epoll, and reads and pairs them with iiRead()
+   and iiNext(). When the child has finished, the program shows the
+   elapsed time, the number of events, read()s, and events per read(),
+   the number of IN_MOVED_FROM+IN_MOVED_TO pairs recognized, the number
+   of IN_MOVED_FROM events without a partner, the number of times that
+   iiNext() waited for a partner, and the number of queue overflows
+   (see /proc/sys/fs/inotify/max_queued_events).
+
+   Try: "-b 2800" and "-b 2800 -w 0" (with the smaller buffer, some
+   pairs straddle read()s, and are recognized only because iiNext()
+   waits); and "-o" and "-o -w 0" (every rename is unpaired, and
+   iiNext() waits whenever one ends a batch, though the wait usually
+   ends early, when the child's next event arrives).
+
+   This program is Linux-specific.
+*/
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include "inotify_iter.h"
+#include "tlpi_hdr.h"
+
+#define DONE_NAME "done"        /* Created by the child when it finishes */
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Create, rename, and remove 'numFiles' files in 'dir', renaming them
+   into 'outDir' if it is not NULL, and then create DONE_NAME */
+
+static void
+makeEvents(const char *dir, const char *outDir, long numFiles)
+{
+    char from[PATH_MAX], to[PATH_MAX];
+    long j;
+    int fd;
+
+    for (j = 0; j < numFiles; j++) {
+        snprintf(from, sizeof(from), "%s/f%ld", dir, j);
+        snprintf(to, sizeof(to), "%s/g%ld",
+                 (outDir != NULL) ? outDir : dir, j);
+
+        fd = open(from, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+        if (fd == -1)
+            errExit("open");
+        close(fd);
+        if (rename(from, to) == -1)
+            errExit("rename");
+        if (unlink(to) == -1)
+            errExit("unlink");
+    }
+
+    snprintf(from, sizeof(from), "%s/%s", dir, DONE_NAME);
+    fd = open(from, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        errExit("open");
+    close(fd);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-b bufsize] [-n files] [-o] [-w ms]\n",
+            progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char base[] = "/tmp/inotify_iter_bench.XXXXXX";
+    char dir[PATH_MAX], outDir[PATH_MAX];
+    char donePath[PATH_MAX + sizeof(DONE_NAME) + 1];
+    const struct inotify_event *ev, *to;
+    struct inotifyIter it;
+    struct epoll_event epev;
+    long numFiles, overflows;
+    long long start, elapsed;
+    Boolean moveOut, done;
+    size_t bufSize;
+    int opt, inotifyFd, epfd, waitMs;
+    pid_t childPid;
+
+    bufSize = 0;
+    numFiles = 20000;
+    moveOut = FALSE;
+    waitMs = 2;
+    while ((opt = getopt(argc, argv, "b:n:ow:")) != -1) {
+        switch (opt) {
+        case 'b':   bufSize = getLong(optarg, GN_GT_0, "-b");     break;
+        case 'n':   numFiles = getLong(optarg, GN_GT_0, "-n");    break;
+        case 'o':   moveOut = TRUE;                               break;
+        case 'w':   waitMs = getInt(optarg, GN_NONNEG, "-w");     break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+
+    if (mkdtemp(base) == NULL)
+        errExit("mkdtemp");
+    snprintf(dir, sizeof(dir), "%s/w", base);
+    snprintf(outDir, sizeof(outDir), "%s/o", base);
+    if (mkdir(dir, S_IRWXU) == -1 || mkdir(outDir, S_IRWXU) == -1)
+        errExit("mkdir");
+
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd == -1)
+        errExit("inotify_init1");
+    if (inotify_add_watch(inotifyFd, dir,
+                          IN_CREATE | IN_DELETE | IN_MOVE) == -1)
+        errExit("inotify_add_watch");
+    if (iiInit(&it, inotifyFd, bufSize, waitMs) == -1)
+        errExit("iiInit");
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+        errExit("epoll_create1");
+    epev.events = EPOLLIN;
+    epev.data.fd = inotifyFd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, inotifyFd, &epev) == -1)
+        errExit("epoll_ctl");
+
+    start = nowNs();
+
+    childPid = fork();
+    if (childPid == -1)
+        errExit("fork");
+    if (childPid == 0) {
+        makeEvents(dir, moveOut ? outDir : NULL, numFiles);
+        _exit(EXIT_SUCCESS);
+    }
+
+    overflows = 0;
+    for (done = FALSE; !done; ) {
+        if (epoll_wait(epfd, &epev, 1, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("epoll_wait");
+        }
+
+        /* Consume events until the queue is empty */
+
+        while (!done) {
+            if (iiRead(&it) == -1) {
+                if (errno == EAGAIN)
+                    break;
+                errExit("iiRead");
+            }
+
+            while ((ev = iiNext(&it, &to)) != NULL) {
+                if (ev->mask & IN_Q_OVERFLOW)
+                    overflows++;
+                else if ((ev->mask & IN_CREATE) &&
+                         strcmp(ev->name, DONE_NAME) == 0)
+                    done = TRUE;
+            }
+        }
+    }
+    elapsed = nowNs() - start;
+
+    if (waitpid(childPid, NULL, 0) == -1)
+        errExit("waitpid");
+
+    printf("Buffer size:            %zu\n", it.bufSize);
+    printf("Elapsed:                %.3f s\n", elapsed / 1e9);
+    printf("Events:                 %lu (%ld expected)\n",
+           it.events, 4 * numFiles + 1 - (moveOut ? 2 * numFiles : 0));
+    printf("read()s:                %lu (%.1f events per read())\n",
+           it.reads, (double) it.events / it.reads);
+    printf("Pairs:                  %lu (%ld renames)\n",
+           it.pairs, numFiles);
+    printf("Unpaired IN_MOVED_FROM: %lu\n", it.unpaired);
+    printf("Waits for IN_MOVED_TO:  %lu\n", it.waits);
+    printf("Queue overflows:        %ld\n", overflows);
+
+    iiFree(&it);
+    snprintf(donePath, sizeof(donePath), "%s/%s", dir, DONE_NAME);
+    if (unlink(donePath) == -1)
+        errExit("unlink");
+    if (rmdir(dir) == -1 || rmdir(outDir) == -1 || rmdir(base) == -1)
+        errExit("rmdir");
+    exit(EXIT_SUCCESS);
+}
@@ -17,6 +17,12 @@
    This program randomly creates, deletes, or renames
    subdirectories underneath the pathname specified in its
    sole command-line argument.
+
+   The -r option paces the operations at a fixed rate, and the -T
+   option prefixes each log message with a CLOCK_MONOTONIC timestamp
+   recorded just before the operation was started. dtree_bench.c uses
+   these options to measure how quickly inotify_dtree.c updates its
+   cache.
 */
 #if ! defined(_XOPEN_SOURCE) || _XOPEN_SOURCE < 700
 #undef _XOPEN_SOURCE
@@ -25,6 +31,7 @@
 #include <stdarg.h>
 #include <limits.h>
 #include <ftw.h>
+#include <time.h>
 #include "tlpi_hdr.h"
 
 #define DLIM 60
@@ -73,12 +80,26 @@ getDirList(const char *pathname)
 }
 
 static FILE *logfp = NULL;
+static Boolean timestamps = FALSE;
+static struct timespec opTime;          /* Start time of last operation */
+
+/* Record the start time of an operation, for use by logMessage() */
+
+static void
+stampOp(void)
+{
+    if (timestamps)
+        clock_gettime(CLOCK_MONOTONIC, &opTime);
+}
 
 static void
 logMessage(const char *format, ...)
 {
     va_list argList;
 
+    if (logfp != NULL && timestamps)
+        fprintf(logfp, "%ld.%09ld ", (long) opTime.tv_sec, opTime.tv_nsec);
+
     va_start(argList, format);
 
     if (logfp != NULL)
@@ -100,8 +121,11 @@ usageError(char *pname)
     fprintf(stderr, "    -l logfile     Record activity in log file\n");
     fprintf(stderr, "    -m maxops      Do at most 'maxops' operations "
             "(default is unlimited)\n");
+    fprintf(stderr, "    -r rate        Perform 'rate' operations per "
+            "second (overrides -s)\n");
     fprintf(stderr, "    -s usecs       Sleep 'usecs' microseconds "
             "between each operation\n");
+    fprintf(stderr, "    -T             Timestamp log messages\n");
     fprintf(stderr, "    -z stopfile    Immediately stop when the file "
             "'stopfile' is created\n");
     exit(EXIT_FAILURE);
@@ -126,6 +150,8 @@ main(int argc, char *argv[])
     char *stopFile;
     int scnt;
     int s;
+    double rate;
+    struct timespec next;
 
     opcnt = 0;
 
@@ -134,12 +160,21 @@ main(int argc, char *argv[])
     stopFile = NULL;
     maxops = 0;
     usecs = 1;
-    while ((opt = getopt(argc, argv, "l:m:s:z:")) != -1) {
+    rate = 0;
+    while ((opt = getopt(argc, argv, "l:m:r:s:Tz:")) != -1) {
         switch (opt) {
         case 's':
             usecs = atoi(optarg);
             break;
 
+        case 'r':
+            rate = atof(optarg);
+            break;
+
+        case 'T':
+            timestamps = TRUE;
+            break;
+
         case 'z':
             stopFile = optarg;
             break;
@@ -165,6 +200,9 @@ main(int argc, char *argv[])
 
     opcnt = 0;
 
+    if (clock_gettime(CLOCK_MONOTONIC, &next) == -1)
+        errExit("clock_gettime");
+
     for (;;) {
 
         getDirList(argv[optind]);
@@ -185,6 +223,7 @@ main(int argc, char *argv[])
                 if (random() % nslashes > 0)
                     continue;
 
+            stampOp();
             if (mkdir(path, 0700) == 0)
                 logMessage("mkdir: %s\n", path);
 
@@ -196,6 +235,7 @@ main(int argc, char *argv[])
                 if (s > DLIM)
                     break;
 
+                stampOp();
                 if (mkdir(spath, 0700) == 0)
                     logMessage("mkdir: %s\n", spath);
 
@@ -212,6 +252,7 @@ main(int argc, char *argv[])
             snprintf(path, sizeof(path), "%s", dirList[random() % dcnt]);
             while (strstr(path, MARKER_STRING) != NULL) {
 
+                stampOp();
                 if (rmdir(path) == -1)
                     break;
                 logMessage("rmdir: %s\n", path);
@@ -244,6 +285,7 @@ main(int argc, char *argv[])
                 if (s > DLIM)
                     break;
 
+                stampOp();
                 if (rename(to_move, target) == 0)
                     logMessage("rename: %s ==> %s\n", to_move, target);
             }
@@ -258,7 +300,21 @@ main(int argc, char *argv[])
 
         opcnt++;
 
-        usleep(usecs);
+        /* With -r, sleep until the next operation is due. Sleeping until
+           an absolute time means that the rate is not reduced by the
+           time taken to perform the operations (unless they take longer
+           than the interval between operations). */
+
+        if (rate > 0) {
+            next.tv_nsec += 1e9 / rate;
+            next.tv_sec += next.tv_nsec / 1000000000;
+            next.tv_nsec %= 1000000000;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                                   &next, NULL) == EINTR)
+                continue;
+        } else {
+            usleep(usecs);
+        }
 
         if (maxops > 0 && opcnt >= maxops)
             break;
@@ -0,0 +1 @@
+../memalloc/arena.c
\ No newline at end of file
@@ -0,0 +1 @@
+../memalloc/arena.h
\ No newline at end of file
@@ -0,0 +1 @@
+../daemons/async_log.c
\ No newline at end of file
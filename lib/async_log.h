@@ -0,0 +1 @@
+../daemons/async_log.h
\ No newline at end of file
@@ -0,0 +1 @@
+../time/bench.c
\ No newline at end of file
@@ -0,0 +1 @@
+../time/bench.h
\ No newline at end of file
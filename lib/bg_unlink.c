@@ -0,0 +1 @@
+../dirs_links/bg_unlink.c
\ No newline at end of file
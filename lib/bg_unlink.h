@@ -0,0 +1 @@
+../dirs_links/bg_unlink.h
\ No newline at end of file
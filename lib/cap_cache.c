@@ -0,0 +1 @@
+../cap/cap_cache.c
\ No newline at end of file
@@ -0,0 +1 @@
+../cap/cap_cache.h
\ No newline at end of file
@@ -0,0 +1 @@
+../pipes/case_conv.c
\ No newline at end of file
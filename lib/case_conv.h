@@ -0,0 +1 @@
+../pipes/case_conv.h
\ No newline at end of file
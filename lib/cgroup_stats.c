@@ -0,0 +1 @@
+../cgroups/cgroup_stats.c
\ No newline at end of file
@@ -0,0 +1 @@
+../cgroups/cgroup_stats.h
\ No newline at end of file
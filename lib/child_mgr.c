@@ -0,0 +1 @@
+../procexec/child_mgr.c
\ No newline at end of file
@@ -0,0 +1 @@
+../procexec/child_mgr.h
\ No newline at end of file
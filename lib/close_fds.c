@@ -0,0 +1 @@
+../procexec/close_fds.c
\ No newline at end of file
@@ -0,0 +1 @@
+../procexec/close_fds.h
\ No newline at end of file
@@ -0,0 +1 @@
+../procpri/cpu_topology.c
\ No newline at end of file
@@ -0,0 +1 @@
+../dirs_links/dir_batch.c
\ No newline at end of file
@@ -0,0 +1 @@
+../dirs_links/dir_batch.h
\ No newline at end of file
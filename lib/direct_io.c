@@ -0,0 +1 @@
+../filebuff/direct_io.c
\ No newline at end of file
@@ -0,0 +1 @@
+../filebuff/direct_io.h
\ No newline at end of file
@@ -0,0 +1 @@
+../vmem/dirty_track.c
\ No newline at end of file
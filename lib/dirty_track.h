@@ -0,0 +1 @@
+../vmem/dirty_track.h
\ No newline at end of file
@@ -0,0 +1 @@
+../proc/env_builder.c
\ No newline at end of file
@@ -0,0 +1 @@
+../proc/env_builder.h
\ No newline at end of file
@@ -56,15 +56,22 @@ outputError(Boolean useErr, int err, Boolean flushStdout,
 {
 #define BUF_SIZE 500
     char buf[BUF_SIZE], userMsg[BUF_SIZE], errText[BUF_SIZE];
+    char errStr[256];
 
     vsnprintf(userMsg, BUF_SIZE, format, ap);
 
-    if (useErr)
+    /* Use strerror_r() (the XSI version), since strerror() need not be
+       thread-safe */
+
+    if (useErr) {
+        if (strerror_r(err, errStr, sizeof(errStr)) != 0)
+            snprintf(errStr, sizeof(errStr), "Unknown error %d", err);
         snprintf(errText, BUF_SIZE, " [%s %s]",
                 (err > 0 && err <= MAX_ENAME) ?
-                ename[err] : "?UNKNOWN?", strerror(err));
-    else
+                ename[err] : "?UNKNOWN?", errStr);
+    } else {
         snprintf(errText, BUF_SIZE, ":");
+    }
 
 #if __GNUC__ >= 7
 #pragma GCC diagnostic push
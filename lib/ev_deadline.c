@@ -0,0 +1 @@
+../altio/ev_deadline.c
\ No newline at end of file
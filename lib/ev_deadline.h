@@ -0,0 +1 @@
+../altio/ev_deadline.h
\ No newline at end of file
@@ -0,0 +1 @@
+../altio/ev_mq.c
\ No newline at end of file
@@ -0,0 +1 @@
+../altio/ev_mq.h
\ No newline at end of file
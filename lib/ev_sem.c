@@ -0,0 +1 @@
+../psem/ev_sem.c
\ No newline at end of file
@@ -0,0 +1 @@
+../psem/ev_sem.h
\ No newline at end of file
@@ -0,0 +1 @@
+../altio/event_loop.c
\ No newline at end of file
@@ -0,0 +1 @@
+../altio/event_loop.h
\ No newline at end of file
@@ -0,0 +1 @@
+../threads/fast_err.c
\ No newline at end of file
@@ -0,0 +1 @@
+../threads/fast_err.h
\ No newline at end of file
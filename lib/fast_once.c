@@ -0,0 +1 @@
+../threads/fast_once.c
\ No newline at end of file
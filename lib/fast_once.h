@@ -0,0 +1 @@
+../threads/fast_once.h
\ No newline at end of file
@@ -0,0 +1 @@
+../time/fast_time.c
\ No newline at end of file
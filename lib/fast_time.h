@@ -0,0 +1 @@
+../time/fast_time.h
\ No newline at end of file
@@ -0,0 +1 @@
+../sockets/file_xfer.c
\ No newline at end of file
@@ -0,0 +1 @@
+../sockets/file_xfer.h
\ No newline at end of file
@@ -0,0 +1 @@
+../svsem/futex_binary_sems.c
\ No newline at end of file
@@ -0,0 +1 @@
+../svsem/futex_binary_sems.h
\ No newline at end of file
@@ -0,0 +1 @@
+../svsem/futex_event_flags.c
\ No newline at end of file
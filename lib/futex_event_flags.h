@@ -0,0 +1 @@
+../svsem/futex_event_flags.h
\ No newline at end of file
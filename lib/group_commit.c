@@ -0,0 +1 @@
+../filebuff/group_commit.c
\ No newline at end of file
@@ -0,0 +1 @@
+../filebuff/group_commit.h
\ No newline at end of file
@@ -0,0 +1 @@
+../xattr/hash_cache.c
\ No newline at end of file
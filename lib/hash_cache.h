@@ -0,0 +1 @@
+../xattr/hash_cache.h
\ No newline at end of file
@@ -0,0 +1 @@
+../pshm/huge_shm.c
\ No newline at end of file
@@ -0,0 +1 @@
+../pshm/huge_shm.h
\ No newline at end of file
@@ -0,0 +1 @@
+../mmap/huge_text.c
\ No newline at end of file
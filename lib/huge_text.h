@@ -0,0 +1 @@
+../mmap/huge_text.h
\ No newline at end of file
@@ -0,0 +1 @@
+../sockets/if_watch.c
\ No newline at end of file
@@ -0,0 +1 @@
+../sockets/if_watch.h
\ No newline at end of file
@@ -0,0 +1 @@
+../sockets/inet_resolve.c
\ No newline at end of file
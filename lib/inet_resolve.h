@@ -0,0 +1 @@
+../sockets/inet_resolve.h
\ No newline at end of file
@@ -0,0 +1 @@
+../sockets/inetd_worker.c
\ No newline at end of file
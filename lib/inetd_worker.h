@@ -0,0 +1 @@
+../sockets/inetd_worker.h
\ No newline at end of file
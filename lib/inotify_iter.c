@@ -0,0 +1 @@
+../inotify/inotify_iter.c
\ No newline at end of file
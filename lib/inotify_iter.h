@@ -0,0 +1 @@
+../inotify/inotify_iter.h
\ No newline at end of file
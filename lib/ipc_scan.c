@@ -0,0 +1 @@
+../svipc/ipc_scan.c
\ No newline at end of file
@@ -0,0 +1 @@
+../svipc/ipc_scan.h
\ No newline at end of file
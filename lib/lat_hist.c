@@ -0,0 +1 @@
+../time/lat_hist.c
\ No newline at end of file
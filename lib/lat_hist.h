@@ -0,0 +1 @@
+../time/lat_hist.h
\ No newline at end of file
@@ -0,0 +1 @@
+../threads/lf_queue.c
\ No newline at end of file
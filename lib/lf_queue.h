@@ -0,0 +1 @@
+../threads/lf_queue.h
\ No newline at end of file
@@ -0,0 +1 @@
+../sockets/line_reader.h
\ No newline at end of file
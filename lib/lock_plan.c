@@ -0,0 +1 @@
+../vmem/lock_plan.c
\ No newline at end of file
@@ -0,0 +1 @@
+../vmem/lock_plan.h
\ No newline at end of file
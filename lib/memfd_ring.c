@@ -0,0 +1 @@
+../sockets/memfd_ring.c
\ No newline at end of file
@@ -0,0 +1 @@
+../sockets/memfd_ring.h
\ No newline at end of file
@@ -0,0 +1 @@
+../svmsg/msgq_adapt.c
\ No newline at end of file
@@ -0,0 +1 @@
+../svmsg/msgq_adapt.h
\ No newline at end of file
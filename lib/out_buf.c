@@ -0,0 +1 @@
+../filebuff/out_buf.c
\ No newline at end of file
@@ -0,0 +1 @@
+../filebuff/out_buf.h
\ No newline at end of file
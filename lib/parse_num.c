@@ -0,0 +1 @@
+../progconc/parse_num.c
\ No newline at end of file
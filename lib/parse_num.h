@@ -0,0 +1 @@
+../progconc/parse_num.h
\ No newline at end of file
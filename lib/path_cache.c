@@ -0,0 +1 @@
+../dirs_links/path_cache.c
\ No newline at end of file
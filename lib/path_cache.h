@@ -0,0 +1 @@
+../dirs_links/path_cache.h
\ No newline at end of file
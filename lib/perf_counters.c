@@ -0,0 +1 @@
+../time/perf_counters.c
\ No newline at end of file
@@ -0,0 +1 @@
+../time/perf_counters.h
\ No newline at end of file
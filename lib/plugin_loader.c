@@ -0,0 +1 @@
+../shlibs/plugin_loader.c
\ No newline at end of file
@@ -0,0 +1 @@
+../shlibs/plugin_loader.h
\ No newline at end of file
@@ -0,0 +1 @@
+../timers/precise_sleep.c
\ No newline at end of file
@@ -0,0 +1 @@
+../timers/precise_sleep.h
\ No newline at end of file
@@ -0,0 +1 @@
+../pipes/proc_barrier.c
\ No newline at end of file
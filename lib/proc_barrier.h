@@ -0,0 +1 @@
+../pipes/proc_barrier.h
\ No newline at end of file
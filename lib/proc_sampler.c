@@ -0,0 +1 @@
+../procres/proc_sampler.c
\ No newline at end of file
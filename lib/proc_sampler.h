@@ -0,0 +1 @@
+../procres/proc_sampler.h
\ No newline at end of file
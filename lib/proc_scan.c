@@ -0,0 +1 @@
+../sysinfo/proc_scan.c
\ No newline at end of file
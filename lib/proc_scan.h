@@ -0,0 +1 @@
+../sysinfo/proc_scan.h
\ No newline at end of file
@@ -0,0 +1 @@
+../pty/pty_pool.c
\ No newline at end of file
@@ -0,0 +1 @@
+../pty/pty_pool.h
\ No newline at end of file
@@ -0,0 +1 @@
+../users_groups/pw_verify.c
\ No newline at end of file
@@ -0,0 +1 @@
+../users_groups/pw_verify.h
\ No newline at end of file
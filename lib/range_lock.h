@@ -0,0 +1 @@
+../filelock/range_lock.h
\ No newline at end of file
@@ -0,0 +1 @@
+../threads/read_mostly.c
\ No newline at end of file
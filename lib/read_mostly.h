@@ -0,0 +1 @@
+../threads/read_mostly.h
\ No newline at end of file
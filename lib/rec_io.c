@@ -0,0 +1 @@
+../fileio/rec_io.c
\ No newline at end of file
@@ -0,0 +1 @@
+../fileio/rec_io.h
\ No newline at end of file
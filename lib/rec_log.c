@@ -0,0 +1 @@
+../mmap/rec_log.c
\ No newline at end of file
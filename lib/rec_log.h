@@ -0,0 +1 @@
+../mmap/rec_log.h
\ No newline at end of file
@@ -0,0 +1 @@
+../timers/sample_prof.c
\ No newline at end of file
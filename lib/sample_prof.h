@@ -0,0 +1 @@
+../timers/sample_prof.h
\ No newline at end of file
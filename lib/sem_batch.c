@@ -0,0 +1 @@
+../svsem/sem_batch.c
\ No newline at end of file
@@ -0,0 +1 @@
+../svsem/sem_batch.h
\ No newline at end of file
@@ -0,0 +1 @@
+../sockets/seqnum_bin.c
\ No newline at end of file
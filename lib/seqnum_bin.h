@@ -0,0 +1 @@
+../sockets/seqnum_bin.h
\ No newline at end of file
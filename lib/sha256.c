@@ -0,0 +1 @@
+../xattr/sha256.c
\ No newline at end of file
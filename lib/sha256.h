@@ -0,0 +1 @@
+../xattr/sha256.h
\ No newline at end of file
@@ -0,0 +1 @@
+../threads/sharded_counter.c
\ No newline at end of file
@@ -0,0 +1 @@
+../threads/sharded_counter.h
\ No newline at end of file
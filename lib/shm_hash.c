@@ -0,0 +1 @@
+../pshm/shm_hash.c
\ No newline at end of file
@@ -0,0 +1 @@
+../pshm/shm_hash.h
\ No newline at end of file
@@ -0,0 +1 @@
+../pshm/shm_heap.c
\ No newline at end of file
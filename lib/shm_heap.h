@@ -0,0 +1 @@
+../pshm/shm_heap.h
\ No newline at end of file
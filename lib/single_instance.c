@@ -0,0 +1 @@
+../filelock/single_instance.c
\ No newline at end of file
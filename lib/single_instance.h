@@ -0,0 +1 @@
+../filelock/single_instance.h
\ No newline at end of file
@@ -0,0 +1 @@
+../sockets/sock_handoff.c
\ No newline at end of file
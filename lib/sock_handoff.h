@@ -0,0 +1 @@
+../sockets/sock_handoff.h
\ No newline at end of file
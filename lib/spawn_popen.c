@@ -0,0 +1 @@
+../pipes/spawn_popen.c
\ No newline at end of file
@@ -0,0 +1 @@
+../pipes/spawn_popen.h
\ No newline at end of file
@@ -0,0 +1 @@
+../procexec/spawn_system.c
\ No newline at end of file
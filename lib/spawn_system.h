@@ -0,0 +1 @@
+../procexec/spawn_system.h
\ No newline at end of file
@@ -0,0 +1 @@
+../threads/stack_pool.c
\ No newline at end of file
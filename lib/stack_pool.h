@@ -0,0 +1 @@
+../threads/stack_pool.h
\ No newline at end of file
@@ -0,0 +1 @@
+../files/stat_batch.c
\ No newline at end of file
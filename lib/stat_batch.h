@@ -0,0 +1 @@
+../files/stat_batch.h
\ No newline at end of file
@@ -0,0 +1 @@
+../procexec/taskstats_listen.c
\ No newline at end of file
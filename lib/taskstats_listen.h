@@ -0,0 +1 @@
+../procexec/taskstats_listen.h
\ No newline at end of file
@@ -0,0 +1 @@
+../threads/thread_barrier.c
\ No newline at end of file
@@ -0,0 +1 @@
+../threads/thread_barrier.h
\ No newline at end of file
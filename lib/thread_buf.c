@@ -0,0 +1 @@
+../threads/thread_buf.c
\ No newline at end of file
@@ -0,0 +1 @@
+../threads/thread_buf.h
\ No newline at end of file
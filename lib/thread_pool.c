@@ -0,0 +1 @@
+../threads/thread_pool.c
\ No newline at end of file
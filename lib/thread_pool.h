@@ -0,0 +1 @@
+../threads/thread_pool.h
\ No newline at end of file
@@ -0,0 +1 @@
+../time/time_conv.c
\ No newline at end of file
@@ -0,0 +1 @@
+../time/time_conv.h
\ No newline at end of file
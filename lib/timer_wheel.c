@@ -0,0 +1 @@
+../timers/timer_wheel.c
\ No newline at end of file
@@ -0,0 +1 @@
+../pshm/trace_buf.c
\ No newline at end of file
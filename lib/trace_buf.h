@@ -0,0 +1 @@
+../pshm/trace_buf.h
\ No newline at end of file
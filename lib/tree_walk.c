@@ -0,0 +1 @@
+../dirs_links/tree_walk.c
\ No newline at end of file
@@ -0,0 +1 @@
+../tty/tty_batch.c
\ No newline at end of file
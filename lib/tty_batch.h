@@ -0,0 +1 @@
+../tty/tty_batch.h
\ No newline at end of file
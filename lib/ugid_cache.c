@@ -0,0 +1 @@
+../users_groups/ugid_cache.c
\ No newline at end of file
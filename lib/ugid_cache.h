@@ -0,0 +1 @@
+../users_groups/ugid_cache.h
\ No newline at end of file
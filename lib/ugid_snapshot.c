@@ -0,0 +1 @@
+../users_groups/ugid_snapshot.c
\ No newline at end of file
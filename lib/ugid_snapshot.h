@@ -0,0 +1 @@
+../users_groups/ugid_snapshot.h
\ No newline at end of file
@@ -0,0 +1 @@
+../sockets/unix_auth.c
\ No newline at end of file
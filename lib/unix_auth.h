@@ -0,0 +1 @@
+../sockets/unix_auth.h
\ No newline at end of file
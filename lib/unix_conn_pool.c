@@ -0,0 +1 @@
+../sockets/unix_conn_pool.c
\ No newline at end of file
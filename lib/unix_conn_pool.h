@@ -0,0 +1 @@
+../sockets/unix_conn_pool.h
\ No newline at end of file
@@ -0,0 +1 @@
+../altio/uring_functions.c
\ No newline at end of file
@@ -0,0 +1 @@
+../altio/uring_functions.h
\ No newline at end of file
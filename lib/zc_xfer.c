@@ -0,0 +1 @@
+../sockets/zc_xfer.c
\ No newline at end of file
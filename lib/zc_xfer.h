@@ -0,0 +1 @@
+../sockets/zc_xfer.h
\ No newline at end of file
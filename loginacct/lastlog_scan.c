@@ -0,0 +1,152 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 40 */
+
+/* lastlog_scan.c
+
+   Display all nonempty entries in the lastlog file.
+
+   Usage: lastlog_scan [-n] [file]
+
+        -n     Show user IDs rather than user names
+        file   The file to scan (default: _PATH_LASTLOG)
+
+   The lastlog file is indexed by user ID (see view_lastlog.c), so on a
+   system with high user IDs (e.g., allocated by LDAP) it is a sparse
+   file whose apparent size can be terabytes, of which only a few blocks
+   are allocated. Rather than reading every entry, this program uses
+   lseek() SEEK_DATA and SEEK_HOLE to find the allocated parts of the
+   file (holes read as zeros, which is an empty entry), maps each of
+   them with mmap(), and examines only the entries that they contain.
+   File systems that don't support SEEK_DATA/SEEK_HOLE report the whole
+   file as data, which gives the same result, more slowly.
+
+   The program reports the number of data extents, and the number of
+   bytes examined, on stderr.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <lastlog.h>
+#include <paths.h>                      /* Definition of _PATH_LASTLOG */
+#include <fcntl.h>
+#include "ugid_functions.h"             /* Declaration of userNameFromId() */
+#include "tlpi_hdr.h"
+
+#define RS ((off_t) sizeof(struct lastlog))
+
+static Boolean numeric;
+
+static void
+printEntry(uid_t uid, const struct lastlog *llog)
+{
+    time_t ll_time;
+    char *name;
+
+    name = numeric ? NULL : userNameFromId(uid);
+    if (name != NULL)
+        printf("%-8.8s ", name);
+    else
+        printf("%-8ld ", (long) uid);
+
+    ll_time = llog->ll_time;
+    printf("%-6.6s %-20.20s %s", llog->ll_line, llog->ll_host,
+            ctime(&ll_time));
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *path;
+    struct stat sb;
+    off_t data, hole, first, last, nextRec, mapStart, rec;
+    long pageSize, extents;
+    long long scanned;
+    char *addr;
+    size_t len;
+    int opt, fd;
+
+    numeric = FALSE;
+    while ((opt = getopt(argc, argv, "n")) != -1) {
+        switch (opt) {
+        case 'n': numeric = TRUE;                               break;
+        default:  usageErr("%s [-n] [file]\n", argv[0]);
+        }
+    }
+    path = (optind < argc) ? argv[optind] : _PATH_LASTLOG;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        errExit("open %s", path);
+    if (fstat(fd, &sb) == -1)
+        errExit("fstat");
+    pageSize = sysconf(_SC_PAGESIZE);
+
+    extents = 0;
+    scanned = 0;
+    nextRec = 0;                        /* Entries before this are done */
+    for (hole = 0; hole < sb.st_size; ) {
+
+        /* Find the next data extent, [data, hole) */
+
+        data = lseek(fd, hole, SEEK_DATA);
+        if (data == -1) {
+            if (errno == ENXIO)         /* No more data */
+                break;
+            errExit("lseek SEEK_DATA");
+        }
+        hole = lseek(fd, data, SEEK_HOLE);
+        if (hole == -1)
+            errExit("lseek SEEK_HOLE");
+        extents++;
+
+        /* Map the whole entries that the extent touches (an entry may
+           straddle the boundary of an extent) */
+
+        first = data / RS;
+        if (first < nextRec)
+            first = nextRec;
+        last = (hole + RS - 1) / RS;
+        if (last > sb.st_size / RS)
+            last = sb.st_size / RS;     /* Ignore a partial final entry */
+        if (first >= last)
+            continue;
+
+        mapStart = (first * RS) / pageSize * pageSize;
+        len = last * RS - mapStart;
+        addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, mapStart);
+        if (addr == MAP_FAILED)
+            errExit("mmap");
+        madvise(addr, len, MADV_SEQUENTIAL);
+
+        for (rec = first; rec < last; rec++) {
+            const struct lastlog *llog =
+                    (const struct lastlog *) (addr + rec * RS - mapStart);
+
+            if (llog->ll_time != 0)
+                printEntry(rec, llog);
+        }
+
+        scanned += (last - first) * RS;
+        nextRec = last;
+        if (munmap(addr, len) == -1)
+            errExit("munmap");
+    }
+
+    fprintf(stderr, "%s: size %lld; %ld data extent(s); %lld bytes scanned\n",
+            path, (long long) sb.st_size, extents, scanned);
+
+    close(fd);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,435 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 40 */
+
+/* wtmp_query.c
+
+   Display selected records of a utmp-style file (by default, wtmp), in
+   the format used by dump_utmpx.c.
+
+   Usage: wtmp_query [-u user] [-s start] [-e end] [-L] [-n num]
+                     [-i | -I] [-x index-file] [file]
+
+        -u user        Show only records for 'user'
+        -s start       Show only records from time 'start' onward
+        -e end         Show only records up to time 'end'
+        -L             Show only login (USER_PROCESS) records
+        -n num         Show only the last 'num' matching records
+        -i             Use an index (see below), creating it if needed
+        -I             (Re)create the index, and then use it
+        -x index-file  Pathname of the index (default: 'file' + ".idx")
+
+   Times are given as seconds since the Epoch, or as "YYYY-MM-DD" or
+   "YYYY-MM-DD HH:MM:SS" (local time). For example, the last 10 logins
+   by 'mtk' in March 2019 are shown by:
+
+        wtmp_query -i -u mtk -L -n 10 -s 2019-03-01 -e 2019-03-31
+
+   Unlike dump_utmpx.c, which reads the file one record at a time using
+   getutxent(), this program maps the file with mmap() and walks the
+   'utmpx' structures in place.
+
+   wtmp files on busy systems can be very large, and a query about one
+   user must otherwise examine every record. With -i or -I, the program
+   uses a side index: a file containing an entry (user name, time,
+   record number) for each record with a user name, sorted by user and
+   time, so that the records of one user in a time range are found by a
+   binary search. wtmp is only ever appended to, so an index made
+   earlier remains valid for the records that it covers; records added
+   since are scanned linearly. Use -I to bring the index up to date. An
+   index for a different file (e.g., one that has since been rotated) is
+   ignored (-i then recreates it).
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <utmpx.h>
+#include <paths.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "tlpi_hdr.h"
+
+#define USER_LEN sizeof(((struct utmpx *) NULL)->ut_user)
+
+#define IDX_MAGIC "TLPIWTX1"
+
+struct idxHeader {
+    char magic[8];
+    uint32_t recSize;           /* sizeof(struct utmpx) */
+    uint32_t userLen;           /* USER_LEN */
+    uint64_t dev;               /* Identify the indexed file */
+    uint64_t ino;
+    uint64_t nrecs;             /* Records of the file that are indexed */
+    uint64_t nentries;          /* Entries that follow this header */
+};
+
+struct idxEntry {
+    char user[USER_LEN];        /* Not necessarily null-terminated */
+    int64_t time;
+    uint64_t recno;
+};
+
+/* Selection criteria */
+
+static char selUser[USER_LEN];
+static Boolean haveUser;
+static time_t selStart, selEnd;
+static Boolean loginsOnly;
+
+/* For -n: ring of the last 'lastNum' matching records */
+
+static long lastNum;
+static const struct utmpx **lastRing;
+static long lastCount;
+
+static void
+printRecord(const struct utmpx *ut)
+{
+    struct in_addr in;
+    time_t tv_sec;
+
+    printf("%-8.*s ", (int) USER_LEN, ut->ut_user);
+    printf("%-9.9s ",
+            (ut->ut_type == EMPTY) ?         "EMPTY" :
+            (ut->ut_type == RUN_LVL) ?       "RUN_LVL" :
+            (ut->ut_type == BOOT_TIME) ?     "BOOT_TIME" :
+            (ut->ut_type == NEW_TIME) ?      "NEW_TIME" :
+            (ut->ut_type == OLD_TIME) ?      "OLD_TIME" :
+            (ut->ut_type == INIT_PROCESS) ?  "INIT_PR" :
+            (ut->ut_type == LOGIN_PROCESS) ? "LOGIN_PR" :
+            (ut->ut_type == USER_PROCESS) ?  "USER_PR" :
+            (ut->ut_type == DEAD_PROCESS) ?  "DEAD_PR" : "???");
+    printf("(%1d) ", ut->ut_type);
+    printf("%5ld %-6.6s %-3.4s %-9.9s ", (long) ut->ut_pid,
+            ut->ut_line, ut->ut_id, ut->ut_host);
+    printf("%3d %3d ", ut->ut_exit.e_termination, ut->ut_exit.e_exit);
+    printf("%8ld ", (long) ut->ut_session);
+
+    in.s_addr = ut->ut_addr_v6[0];
+    printf(" %-15.15s ", inet_ntoa(in));
+    tv_sec = ut->ut_tv.tv_sec;
+    printf("%s", ctime(&tv_sec));
+}
+
+/* Check a record against the selection criteria, and display it (or,
+   for -n, remember it) if it matches */
+
+static void
+considerRecord(const struct utmpx *ut)
+{
+    time_t t;
+
+    if (haveUser && strncmp(ut->ut_user, selUser, USER_LEN) != 0)
+        return;
+    if (loginsOnly && ut->ut_type != USER_PROCESS)
+        return;
+    t = ut->ut_tv.tv_sec;
+    if (t < selStart || t > selEnd)
+        return;
+
+    if (lastNum == 0)
+        printRecord(ut);
+    else
+        lastRing[lastCount++ % lastNum] = ut;
+}
+
+static void
+printLast(void)
+{
+    long j;
+
+    for (j = (lastCount > lastNum) ? lastCount - lastNum : 0;
+            j < lastCount; j++)
+        printRecord(lastRing[j % lastNum]);
+}
+
+static int
+cmpEntry(const void *a, const void *b)
+{
+    const struct idxEntry *x = a, *y = b;
+    int c;
+
+    c = strncmp(x->user, y->user, USER_LEN);
+    if (c != 0)
+        return c;
+    if (x->time != y->time)
+        return (x->time < y->time) ? -1 : 1;
+    return (x->recno < y->recno) ? -1 : (x->recno > y->recno);
+}
+
+/* Write an index for the 'nrecs' records at 'recs' to 'idxPath'. The
+   index is written to a temporary file that is then renamed, so that
+   readers never see a partial index. */
+
+static void
+buildIndex(const char *idxPath, const struct utmpx *recs, size_t nrecs,
+           const struct stat *sb)
+{
+    struct idxHeader hdr;
+    struct idxEntry *ent;
+    size_t j, n;
+    char *tmpPath;
+    FILE *fp;
+    int fd;
+
+    ent = malloc((nrecs > 0 ? nrecs : 1) * sizeof(struct idxEntry));
+    if (ent == NULL)
+        errExit("malloc");
+
+    n = 0;
+    for (j = 0; j < nrecs; j++) {
+        if (recs[j].ut_user[0] == '\0')
+            continue;
+        memset(ent[n].user, 0, USER_LEN);
+        strncpy(ent[n].user, recs[j].ut_user, USER_LEN);
+        ent[n].time = recs[j].ut_tv.tv_sec;
+        ent[n].recno = j;
+        n++;
+    }
+    qsort(ent, n, sizeof(struct idxEntry), cmpEntry);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, IDX_MAGIC, sizeof(hdr.magic));
+    hdr.recSize = sizeof(struct utmpx);
+    hdr.userLen = USER_LEN;
+    hdr.dev = sb->st_dev;
+    hdr.ino = sb->st_ino;
+    hdr.nrecs = nrecs;
+    hdr.nentries = n;
+
+    if (asprintf(&tmpPath, "%s.XXXXXX", idxPath) == -1)
+        errExit("asprintf");
+    fd = mkstemp(tmpPath);
+    if (fd == -1)
+        errExit("mkstemp %s", tmpPath);
+    fp = fdopen(fd, "w");
+    if (fp == NULL)
+        errExit("fdopen");
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+            fwrite(ent, sizeof(struct idxEntry), n, fp) != n ||
+            fclose(fp) == EOF)
+        errExit("writing %s", tmpPath);
+    if (rename(tmpPath, idxPath) == -1)
+        errExit("rename %s", idxPath);
+
+    free(tmpPath);
+    free(ent);
+}
+
+/* Map the index at 'idxPath', returning NULL if it doesn't exist or
+   isn't an index of the file described by 'sb' */
+
+static const struct idxHeader *
+mapIndex(const char *idxPath, const struct stat *sb, size_t *len)
+{
+    const struct idxHeader *hdr;
+    struct stat isb;
+    int fd;
+
+    fd = open(idxPath, O_RDONLY);
+    if (fd == -1) {
+        if (errno == ENOENT)
+            return NULL;
+        errExit("open %s", idxPath);
+    }
+    if (fstat(fd, &isb) == -1)
+        errExit("fstat");
+    if (isb.st_size < sizeof(struct idxHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    hdr = mmap(NULL, isb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED)
+        errExit("mmap %s", idxPath);
+    close(fd);
+    *len = isb.st_size;
+
+    if (memcmp(hdr->magic, IDX_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->recSize != sizeof(struct utmpx) ||
+            hdr->userLen != USER_LEN ||
+            hdr->dev != sb->st_dev || hdr->ino != sb->st_ino ||
+            hdr->nrecs > sb->st_size / sizeof(struct utmpx) ||
+            sizeof(struct idxHeader) +
+                hdr->nentries * sizeof(struct idxEntry) != isb.st_size) {
+        munmap((void *) hdr, isb.st_size);
+        return NULL;
+    }
+    return hdr;
+}
+
+/* Consider the records of the user selected by -u that the index
+   covers, in time order; return the number of records covered */
+
+static size_t
+queryIndex(const struct idxHeader *hdr, const struct utmpx *recs)
+{
+    const struct idxEntry *ent;
+    struct idxEntry key;
+    size_t lo, hi, mid;
+
+    ent = (const struct idxEntry *) (hdr + 1);
+
+    memcpy(key.user, selUser, USER_LEN);        /* Find first entry */
+    key.time = selStart;                        /* >= (user, start) */
+    key.recno = 0;
+    lo = 0;
+    hi = hdr->nentries;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (cmpEntry(&ent[mid], &key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for ( ; lo < hdr->nentries; lo++) {
+        if (strncmp(ent[lo].user, selUser, USER_LEN) != 0 ||
+                ent[lo].time > selEnd)
+            break;
+        considerRecord(&recs[ent[lo].recno]);
+    }
+    return hdr->nrecs;
+}
+
+static time_t
+getTime(const char *arg, const char *name)
+{
+    struct tm tm;
+    const char *p;
+
+    if (arg[strspn(arg, "0123456789")] == '\0')
+        return getLong(arg, 0, name);
+
+    memset(&tm, 0, sizeof(tm));
+    p = strptime(arg, "%Y-%m-%d", &tm);
+    if (p != NULL && *p != '\0')
+        p = strptime(p, " %H:%M:%S", &tm);
+    if (p == NULL || *p != '\0')
+        cmdLineErr("Bad %s time: %s\n", name, arg);
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-u user] [-s start] [-e end] [-L] [-n num]\n"
+            "               [-i | -I] [-x index-file] [file]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *path, *idxPath;
+    const struct idxHeader *hdr;
+    const struct utmpx *recs;
+    Boolean useIndex, rebuild;
+    struct stat sb;
+    size_t nrecs, j, idxLen;
+    char *defIdxPath;
+    int opt, fd;
+
+    idxPath = NULL;
+    useIndex = rebuild = FALSE;
+    selStart = 0;
+    selEnd = (time_t) LONG_MAX;
+    while ((opt = getopt(argc, argv, "u:s:e:Ln:iIx:")) != -1) {
+        switch (opt) {
+        case 'u':
+            if (strlen(optarg) > USER_LEN)
+                cmdLineErr("User name too long: %s\n", optarg);
+            strncpy(selUser, optarg, USER_LEN);
+            haveUser = TRUE;
+            break;
+        case 's': selStart = getTime(optarg, "start");                  break;
+        case 'e': selEnd = getTime(optarg, "end");                      break;
+        case 'L': loginsOnly = TRUE;                                    break;
+        case 'n': lastNum = getLong(optarg, GN_GT_0, "num");            break;
+        case 'i': useIndex = TRUE;                                      break;
+        case 'I': useIndex = rebuild = TRUE;                            break;
+        case 'x': idxPath = optarg;                                     break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (optind + 1 < argc)
+        usageError(argv[0]);
+    path = (optind < argc) ? argv[optind] : _PATH_WTMP;
+
+    if (idxPath == NULL) {
+        if (asprintf(&defIdxPath, "%s.idx", path) == -1)
+            errExit("asprintf");
+        idxPath = defIdxPath;
+    }
+
+    if (lastNum > 0) {
+        lastRing = calloc(lastNum, sizeof(struct utmpx *));
+        if (lastRing == NULL)
+            errExit("calloc");
+    }
+
+    /* Map the file; a partial record at the end (being written by
+       another process) is ignored */
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        errExit("open %s", path);
+    if (fstat(fd, &sb) == -1)
+        errExit("fstat");
+    nrecs = sb.st_size / sizeof(struct utmpx);
+    recs = NULL;
+    if (nrecs > 0) {
+        recs = mmap(NULL, nrecs * sizeof(struct utmpx), PROT_READ,
+                    MAP_SHARED, fd, 0);
+        if (recs == MAP_FAILED)
+            errExit("mmap");
+    }
+    close(fd);
+
+    hdr = NULL;
+    if (useIndex) {
+        if (!rebuild)
+            hdr = mapIndex(idxPath, &sb, &idxLen);
+        if (hdr == NULL) {
+            buildIndex(idxPath, recs, nrecs, &sb);
+            hdr = mapIndex(idxPath, &sb, &idxLen);
+            if (hdr == NULL)
+                fatal("Index %s changed while in use", idxPath);
+        }
+    }
+
+    printf("user     type            PID line   id  host     ");
+    printf("term exit session  address         date/time\n");
+
+    /* Use the index if it can help; then scan the records that it
+       doesn't cover */
+
+    j = 0;
+    if (hdr != NULL && haveUser)
+        j = queryIndex(hdr, recs);
+    else if (nrecs > 0)
+        madvise((void *) recs, nrecs * sizeof(struct utmpx),
+                MADV_SEQUENTIAL);
+    for ( ; j < nrecs; j++)
+        considerRecord(&recs[j]);
+
+    if (lastNum > 0)
+        printLast();
+
+    exit(EXIT_SUCCESS);
+}
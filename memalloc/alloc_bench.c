@@ -0,0 +1,508 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 7 */
+
+/* alloc_bench.c
+
+   Run common allocation patterns against malloc() (glibc's, or whichever
+   allocator has been interposed with LD_PRELOAD), and the pool and arena
+   allocators of arena.c.
+
+   Usage: alloc_bench [-p pattern,...] [-a alloc,...] [-n ops] [-t npairs]
+                      [-o mallopt=value,...]
+
+        -p          Patterns to run (default: all):
+                      small    Allocate 'ops' / 10 objects of random sizes
+                               from 16 to 256 bytes, then free them all,
+                               10 times
+                      xthread  'npairs' producer threads allocate 64-byte
+                               objects and pass them (via single-producer,
+                               single-consumer queues; see lf_queue.c) to
+                               consumer threads, which free them
+                      churn    Keep 10000 objects of random sizes (16 bytes
+                               to 32 KiB, log-uniformly) live, replacing
+                               a random one at each step
+        -a          Allocators (default: all): 'malloc', 'pool' (a pool
+                    of objects of the largest size in the pattern), and
+                    'arena' (for 'small' only: the frees are replaced by
+                    one arenaReset(); an arena is single-threaded and
+                    can't free individual objects)
+        -n ops      Number of allocations per pattern (default: 2000000)
+        -t npairs   Number of producer/consumer pairs (default: 2)
+        -o          mallopt() settings for malloc(): mmap_threshold,
+                    trim_threshold, top_pad, arena_max, arena_test
+
+   Every page of each allocated object is touched, so that the object is
+   resident. Each combination of pattern and allocator is run in a child
+   process, so that its peak RSS (ru_maxrss, from wait4()) is its own.
+   The program reports:
+
+        Mops/s   Allocations (and the matching frees) per second
+        peakRSS  Peak resident set size, less the RSS of the child at the
+                 start
+        live     Peak number of bytes requested and not yet freed
+        frag%    Fragmentation: the part of the peak RSS that was not
+                 live data, (peakRSS - live) / peakRSS, which includes
+                 allocator metadata, padding, and free memory that has
+                 not been returned to the kernel
+
+   For example, to compare glibc with another allocator, and to see the
+   effect of limiting glibc to one arena:
+
+        $ ./alloc_bench
+        $ LD_PRELOAD=/usr/lib/x86_64-linux-gnu/libjemalloc.so.2 ./alloc_bench
+        $ ./alloc_bench -o arena_max=1 -p xthread
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "arena.h"
+#include "lf_queue.h"
+#include "tlpi_hdr.h"
+
+enum { P_SMALL, P_XTHREAD, P_CHURN, NPATTERNS };
+enum { A_MALLOC, A_POOL, A_ARENA, NALLOCS };
+
+static const char *patternNames[] = { "small", "xthread", "churn" };
+static const char *allocNames[] = { "malloc", "pool", "arena" };
+
+#define SMALL_MAX 256
+#define XTHREAD_SIZE 64
+#define CHURN_LIVE 10000
+#define CHURN_MAX (32 * 1024)
+
+static long nops = 2000000;
+static int npairs = 2;
+static int alloc;               /* Allocator used in this child */
+static struct pool pool;
+static struct arena arena;
+
+static long pageSize;
+static long liveBytes, peakLive;        /* Updated atomically */
+
+struct result {                 /* Sent from child to parent */
+    Boolean ok;
+    double secs;
+    long baseRssKb;
+    long peakLive;
+};
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long
+xorshift(unsigned long *state)
+{
+    unsigned long x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static void
+addLive(long n)
+{
+    long live, peak;
+
+    live = __atomic_add_fetch(&liveBytes, n, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&peakLive, __ATOMIC_RELAXED);
+    while (live > peak &&
+           !__atomic_compare_exchange_n(&peakLive, &peak, live, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        continue;
+}
+
+static void *
+allocObj(size_t size)
+{
+    size_t k;
+    char *p;
+
+    switch (alloc) {
+    case A_MALLOC: p = malloc(size);                    break;
+    case A_POOL:   p = poolAlloc(&pool);                break;
+    default:       p = arenaAlloc(&arena, size);        break;
+    }
+    if (p == NULL)
+        errExit("allocation");
+
+    /* Touch each page of the object, so that it is resident */
+
+    for (k = 0; k < size; k += pageSize)
+        p[k] = 1;
+    p[size - 1] = 1;
+    return p;
+}
+
+static void
+freeObj(void *p)
+{
+    if (alloc == A_MALLOC)
+        free(p);
+    else if (alloc == A_POOL)
+        poolFree(&pool, p);
+}
+
+/* Pattern: many small objects, allocated and then freed together */
+
+static void
+runSmall(void)
+{
+    unsigned long seed = 88172645463325252UL;
+    long batch, r, j, bytes;
+    size_t *sizes;
+    void **objs;
+
+    batch = nops / 10;
+    objs = malloc(batch * sizeof(void *));
+    sizes = malloc(batch * sizeof(size_t));
+    if (objs == NULL || sizes == NULL)
+        errExit("malloc");
+
+    for (r = 0; r < 10; r++) {
+        bytes = 0;
+        for (j = 0; j < batch; j++) {
+            sizes[j] = 16 + xorshift(&seed) % (SMALL_MAX - 16 + 1);
+            objs[j] = allocObj(sizes[j]);
+            bytes += sizes[j];
+        }
+        addLive(bytes);
+
+        if (alloc == A_ARENA)
+            arenaReset(&arena);
+        else
+            for (j = 0; j < batch; j++)
+                freeObj(objs[j]);
+        addLive(-bytes);
+    }
+}
+
+/* Pattern: objects allocated in one thread and freed in another */
+
+struct pair {
+    struct spscQueue q;
+    long count;
+};
+
+static void *
+producer(void *arg)
+{
+    struct pair *pr = arg;
+    long j;
+    void *p;
+
+    for (j = 0; j < pr->count; j++) {
+        p = allocObj(XTHREAD_SIZE);
+        addLive(XTHREAD_SIZE);
+        while (!spscPush(&pr->q, p))
+            sched_yield();
+    }
+    while (!spscPush(&pr->q, NULL))     /* End marker */
+        sched_yield();
+    return NULL;
+}
+
+static void *
+consumer(void *arg)
+{
+    struct pair *pr = arg;
+    void *p;
+
+    for (;;) {
+        if (!spscPop(&pr->q, &p)) {
+            sched_yield();
+            continue;
+        }
+        if (p == NULL)
+            break;
+        freeObj(p);
+        addLive(-XTHREAD_SIZE);
+    }
+    return NULL;
+}
+
+static void
+runXthread(void)
+{
+    struct pair *pairs;
+    pthread_t *thr;
+    int j, s;
+
+    pairs = calloc(npairs, sizeof(struct pair));
+    thr = calloc(2 * npairs, sizeof(pthread_t));
+    if (pairs == NULL || thr == NULL)
+        errExit("calloc");
+
+    for (j = 0; j < npairs; j++) {
+        if (spscInit(&pairs[j].q, 1024) == -1)
+            errExit("spscInit");
+        pairs[j].count = nops / npairs;
+        s = pthread_create(&thr[2 * j], NULL, producer, &pairs[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+        s = pthread_create(&thr[2 * j + 1], NULL, consumer, &pairs[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    for (j = 0; j < 2 * npairs; j++) {
+        s = pthread_join(thr[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+}
+
+/* Pattern: a live set of objects of widely varying sizes, in which a
+   random object is replaced at each step, so that holes of all sizes
+   are created */
+
+static size_t
+churnSize(unsigned long *seed)
+{
+    size_t base;
+
+    base = 16UL << (xorshift(seed) % 11);       /* 16 .. 16384 */
+    return base + xorshift(seed) % base;        /* .. 32767 */
+}
+
+static void
+runChurn(void)
+{
+    unsigned long seed = 2463534242UL;
+    size_t sizes[CHURN_LIVE];
+    void **objs;
+    long j, k;
+
+    objs = malloc(CHURN_LIVE * sizeof(void *));
+    if (objs == NULL)
+        errExit("malloc");
+
+    for (k = 0; k < CHURN_LIVE; k++) {
+        sizes[k] = churnSize(&seed);
+        objs[k] = allocObj(sizes[k]);
+        addLive(sizes[k]);
+    }
+    for (j = CHURN_LIVE; j < nops; j++) {
+        k = xorshift(&seed) % CHURN_LIVE;
+        freeObj(objs[k]);
+        addLive(-sizes[k]);
+        sizes[k] = churnSize(&seed);
+        objs[k] = allocObj(sizes[k]);
+        addLive(sizes[k]);
+    }
+    for (k = 0; k < CHURN_LIVE; k++)
+        freeObj(objs[k]);
+}
+
+static long
+currentRssKb(void)
+{
+    long pages, rss;
+    FILE *fp;
+
+    fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL)
+        return 0;
+    if (fscanf(fp, "%ld %ld", &pages, &rss) != 2)
+        rss = 0;
+    fclose(fp);
+    return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* Run 'pattern' with allocator 'a' in a child process, and print the
+   results */
+
+static void
+runChild(int pattern, int a)
+{
+    static const size_t poolSize[] = { SMALL_MAX, XTHREAD_SIZE, CHURN_MAX };
+    struct result res;
+    struct rusage ru;
+    int pfd[2], status;
+    long rssKb;
+    double start;
+    pid_t pid;
+
+    if (pipe(pfd) == -1)
+        errExit("pipe");
+    fflush(stdout);
+
+    pid = fork();
+    if (pid == -1)
+        errExit("fork");
+
+    if (pid == 0) {
+        close(pfd[0]);
+        alloc = a;
+        if (alloc == A_POOL && poolInit(&pool, poolSize[pattern],
+                                         1024 * 1024) == -1)
+            errExit("poolInit");
+        if (alloc == A_ARENA)
+            arenaInit(&arena, 1024 * 1024, 0);
+
+        memset(&res, 0, sizeof(res));
+        res.baseRssKb = currentRssKb();
+        start = nowSecs();
+        switch (pattern) {
+        case P_SMALL:   runSmall();     break;
+        case P_XTHREAD: runXthread();   break;
+        case P_CHURN:   runChurn();     break;
+        }
+        res.secs = nowSecs() - start;
+        res.peakLive = peakLive;
+        res.ok = TRUE;
+        if (write(pfd[1], &res, sizeof(res)) != sizeof(res))
+            errExit("write");
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(pfd[1]);
+    if (read(pfd[0], &res, sizeof(res)) != sizeof(res))
+        res.ok = FALSE;
+    close(pfd[0]);
+    if (wait4(pid, &status, 0, &ru) == -1)
+        errExit("wait4");
+
+    printf("%-8s %-7s ", patternNames[pattern], allocNames[a]);
+    if (!res.ok) {
+        printf("failed\n");
+        return;
+    }
+    rssKb = ru.ru_maxrss - res.baseRssKb;
+    printf("%9.2f %10.1f %10.1f", nops / res.secs / 1e6, rssKb / 1024.0,
+           res.peakLive / 1048576.0);
+    if (rssKb > 0)
+        printf(" %6.1f%%", 100.0 * (rssKb * 1024.0 - res.peakLive) /
+                                    (rssKb * 1024.0));
+    printf("\n");
+}
+
+/* Apply a comma-separated list of mallopt() settings */
+
+static void
+setMallopts(char *str)
+{
+    static const struct { const char *name; int param; } opts[] = {
+        { "mmap_threshold", M_MMAP_THRESHOLD },
+        { "trim_threshold", M_TRIM_THRESHOLD },
+        { "top_pad",        M_TOP_PAD },
+        { "arena_max",      M_ARENA_MAX },
+        { "arena_test",     M_ARENA_TEST },
+    };
+    char *tok, *eq;
+    int j;
+
+    for (tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        eq = strchr(tok, '=');
+        if (eq == NULL)
+            cmdLineErr("Bad -o setting: %s\n", tok);
+        *eq = '\0';
+        for (j = 0; j < sizeof(opts) / sizeof(opts[0]); j++)
+            if (strcmp(tok, opts[j].name) == 0)
+                break;
+        if (j == sizeof(opts) / sizeof(opts[0]))
+            cmdLineErr("Unknown mallopt setting: %s\n", tok);
+        if (mallopt(opts[j].param, getInt(eq + 1, GN_NONNEG, tok)) != 1)
+            fatal("mallopt %s failed", tok);
+        printf("mallopt(%s, %s)\n", tok, eq + 1);
+    }
+}
+
+/* Convert a comma-separated list of names into a bit mask */
+
+static int
+parseNames(char *str, const char **names, int n)
+{
+    char *tok;
+    int mask, j;
+
+    mask = 0;
+    for (tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        for (j = 0; j < n; j++)
+            if (strcmp(tok, names[j]) == 0)
+                break;
+        if (j == n)
+            cmdLineErr("Unknown name: %s\n", tok);
+        mask |= 1 << j;
+    }
+    return mask;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int patterns, allocs, opt, p, a;
+    void *(*mallocFn)(size_t);
+    char *malloptStr;
+    Dl_info info;
+
+    patterns = (1 << NPATTERNS) - 1;
+    allocs = (1 << NALLOCS) - 1;
+    malloptStr = NULL;
+    while ((opt = getopt(argc, argv, "p:a:n:t:o:")) != -1) {
+        switch (opt) {
+        case 'p': patterns = parseNames(optarg, patternNames, NPATTERNS); break;
+        case 'a': allocs = parseNames(optarg, allocNames, NALLOCS);       break;
+        case 'n': nops = getLong(optarg, GN_GT_0, "-n");                  break;
+        case 't': npairs = getInt(optarg, GN_GT_0, "-t");                 break;
+        case 'o': malloptStr = optarg;                                    break;
+        default:
+            usageErr("%s [-p pattern,...] [-a alloc,...] [-n ops] "
+                     "[-t npairs] [-o mallopt=value,...]\n", argv[0]);
+        }
+    }
+    pageSize = sysconf(_SC_PAGESIZE);
+    if (nops < 10 * CHURN_LIVE)
+        cmdLineErr("-n must be at least %d\n", 10 * CHURN_LIVE);
+
+    /* Report where malloc() comes from (e.g., a preloaded library) */
+
+    mallocFn = malloc;
+    if (dladdr(*(void **) &mallocFn, &info) != 0 && info.dli_fname != NULL)
+        printf("malloc() is from %s\n", info.dli_fname);
+    if (malloptStr != NULL)
+        setMallopts(malloptStr);
+
+    printf("%ld ops per pattern; %d producer/consumer pairs\n\n",
+           nops, npairs);
+    printf("%-8s %-7s %9s %10s %10s %7s\n", "pattern", "alloc", "Mops/s",
+           "peakRSS", "live", "frag%");
+    printf("%-8s %-7s %9s %10s %10s\n", "", "", "", "(MiB)", "(MiB)");
+
+    for (p = 0; p < NPATTERNS; p++) {
+        if (!(patterns & (1 << p)))
+            continue;
+        for (a = 0; a < NALLOCS; a++) {
+            if (!(allocs & (1 << a)))
+                continue;
+            if (a == A_ARENA && p != P_SMALL)
+                continue;               /* See comments above */
+            runChild(p, a);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,404 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 7 */
+
+/* arena.c
+
+   An arena (bump) allocator and a fixed-size object pool, as
+   alternatives to malloc() for memory whose lifetime is known.
+
+   An arena allocates by advancing an offset in the current chunk, a
+   region obtained with mmap() (so that chunks are independent of the
+   program break; compare free_and_sbrk.c). Individual allocations can't
+   be freed; instead, arenaReset() frees everything allocated from the
+   arena at once, in constant time, by moving the whole list of chunks
+   to a list of spare chunks, which are reused by later allocations. The
+   pages of spare chunks remain resident unless arenaTrim() is called
+   (or the arena was created with ARENA_MADV_FREE, in which case
+   arenaReset() calls arenaTrim() itself): arenaTrim() applies
+   madvise(MADV_FREE) to the spare chunks, so that the kernel may reclaim
+   the pages if memory becomes short, but if they are not reclaimed
+   before the chunk is reused, no page faults are needed to reuse them.
+   (On kernels before 4.5, which lack MADV_FREE, MADV_DONTNEED, which
+   discards the pages immediately, is used instead.) A request larger
+   than the chunk size gets a chunk of its own. An arena is not
+   thread-safe; each thread should use its own.
+
+   A pool hands out objects of a single size. Free objects are kept on
+   singly linked lists that are threaded through the objects themselves.
+   Each thread has a cache (found via a pthread_key_t) from which it
+   allocates and to which it frees without locking; a cache is refilled
+   from (or, when it grows too large, partly returned to) the pool's
+   shared free list in batches, under a mutex. New objects are carved
+   from an arena, a batch at a time. When a thread terminates, the
+   objects in its cache are returned to the shared list. Memory is
+   returned to the system only by poolDestroy().
+
+   Allocations are aligned on 16-byte boundaries.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include "arena.h"
+#include "tlpi_hdr.h"
+
+#define ALIGN 16
+#define ROUND_UP(n, m) (((n) + (m) - 1) & ~((size_t) (m) - 1))
+
+struct arenaChunk {
+    struct arenaChunk *next;
+    size_t size;                /* Including this header */
+    size_t used;                /* Offset of first free byte */
+};
+
+#define HDR_SIZE ROUND_UP(sizeof(struct arenaChunk), ALIGN)
+
+static long pageSize;
+
+/* Initialize 'a' to allocate from chunks of 'chunkSize' bytes. Returns
+   0 on success, or -1 on error. */
+
+int
+arenaInit(struct arena *a, size_t chunkSize, int flags)
+{
+    if (pageSize == 0)
+        pageSize = sysconf(_SC_PAGESIZE);
+
+    memset(a, 0, sizeof(*a));
+    a->chunkSize = ROUND_UP(chunkSize > 0 ? chunkSize : 1, pageSize);
+    a->flags = flags;
+    return 0;
+}
+
+/* Allocate a chunk that can hold at least 'need' bytes (including the
+   header), reusing a spare chunk if possible, and add it to the list of
+   chunks in use */
+
+static struct arenaChunk *
+newChunk(struct arena *a, size_t need)
+{
+    struct arenaChunk *c;
+    size_t size;
+
+    if (need <= a->chunkSize && a->spare != NULL) {
+        c = a->spare;                   /* Every spare chunk is large enough */
+        a->spare = c->next;
+    } else {
+        size = (need <= a->chunkSize) ? a->chunkSize :
+                                        ROUND_UP(need, pageSize);
+        c = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (c == MAP_FAILED)
+            return NULL;
+        c->size = size;
+        a->mapped += size;
+    }
+    c->used = HDR_SIZE;
+
+    /* A chunk for a single large request goes after the current chunk,
+       so that the free space in the current chunk is not abandoned */
+
+    if (need > a->chunkSize && a->head != NULL) {
+        c->next = a->head->next;
+        a->head->next = c;
+        if (a->tail == a->head)
+            a->tail = c;
+    } else {
+        c->next = a->head;
+        a->head = c;
+        if (a->tail == NULL)
+            a->tail = c;
+    }
+    return c;
+}
+
+/* Return a pointer to 'size' bytes allocated from 'a', or NULL (with
+   'errno' set) on error */
+
+void *
+arenaAlloc(struct arena *a, size_t size)
+{
+    struct arenaChunk *c;
+    void *p;
+
+    size = ROUND_UP(size, ALIGN);
+    c = a->head;
+    if (c == NULL || c->size - c->used < size) {
+        c = newChunk(a, HDR_SIZE + size);
+        if (c == NULL)
+            return NULL;
+    }
+
+    p = (char *) c + c->used;
+    c->used += size;
+    a->used += size;
+    return p;
+}
+
+/* Free everything allocated from 'a', keeping the chunks for reuse */
+
+void
+arenaReset(struct arena *a)
+{
+    if (a->head != NULL) {
+        a->tail->next = a->spare;
+        a->spare = a->head;
+        a->head = a->tail = NULL;
+    }
+    a->used = 0;
+
+    if (a->flags & ARENA_MADV_FREE)
+        arenaTrim(a);
+}
+
+/* Allow the kernel to reclaim the pages of the spare chunks of 'a'.
+   Returns 0 on success, or -1 on error. */
+
+int
+arenaTrim(struct arena *a)
+{
+    static int advice = MADV_FREE;
+    struct arenaChunk *c;
+
+    /* The first page, which holds the chunk header, must be kept */
+
+    for (c = a->spare; c != NULL; c = c->next) {
+        if (c->size <= pageSize)
+            continue;
+        if (madvise((char *) c + pageSize, c->size - pageSize, advice) == -1) {
+            if (errno != EINVAL || advice == MADV_DONTNEED)
+                return -1;
+            advice = MADV_DONTNEED;     /* No MADV_FREE: retry */
+            if (madvise((char *) c + pageSize, c->size - pageSize,
+                        advice) == -1)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/* Unmap all of the chunks of 'a' */
+
+void
+arenaDestroy(struct arena *a)
+{
+    struct arenaChunk *c, *next;
+
+    arenaReset(a);
+    for (c = a->spare; c != NULL; c = next) {
+        next = c->next;
+        munmap(c, c->size);
+    }
+    a->spare = NULL;
+    a->mapped = 0;
+}
+
+/* Pools */
+
+struct poolCache {              /* A thread's cache of free objects */
+    void *head;                 /* List linked through first word */
+    int count;
+    struct pool *pool;
+    struct poolCache *prev, *next;      /* In list of pool's caches */
+};
+
+#define NEXT(obj) (*(void **) (obj))
+
+/* Called at thread termination: return the objects in the thread's
+   cache to the shared list */
+
+static void
+cacheDestructor(void *arg)
+{
+    struct poolCache *c = arg;
+    struct pool *p = c->pool;
+    void *tail;
+
+    pthread_mutex_lock(&p->mtx);
+    if (c->head != NULL) {
+        for (tail = c->head; NEXT(tail) != NULL; tail = NEXT(tail))
+            continue;
+        NEXT(tail) = p->freeList;
+        p->freeList = c->head;
+    }
+    if (c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        p->caches = c->next;
+    if (c->next != NULL)
+        c->next->prev = c->prev;
+    pthread_mutex_unlock(&p->mtx);
+
+    free(c);
+}
+
+/* Initialize 'p' to hand out objects of 'objSize' bytes, carved from
+   arena chunks of 'chunkSize' bytes. Returns 0 on success, or -1 on
+   error. */
+
+int
+poolInit(struct pool *p, size_t objSize, size_t chunkSize)
+{
+    int s;
+
+    memset(p, 0, sizeof(*p));
+    p->objSize = ROUND_UP(objSize < sizeof(void *) ? sizeof(void *) : objSize,
+                          ALIGN);
+    p->batch = 32;
+
+    s = pthread_key_create(&p->key, cacheDestructor);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    pthread_mutex_init(&p->mtx, NULL);
+    return arenaInit(&p->arena, chunkSize, 0);
+}
+
+static struct poolCache *
+getCache(struct pool *p)
+{
+    struct poolCache *c;
+
+    c = pthread_getspecific(p->key);
+    if (c != NULL)
+        return c;
+
+    c = calloc(1, sizeof(struct poolCache));
+    if (c == NULL)
+        return NULL;
+    c->pool = p;
+    pthread_mutex_lock(&p->mtx);
+    c->next = p->caches;
+    if (c->next != NULL)
+        c->next->prev = c;
+    p->caches = c;
+    pthread_mutex_unlock(&p->mtx);
+
+    if (pthread_setspecific(p->key, c) != 0) {
+        cacheDestructor(c);
+        return NULL;
+    }
+    return c;
+}
+
+/* Move up to a batch of objects from the shared list (or, if that is
+   empty, from new arena memory) to the cache 'c' */
+
+static void
+refill(struct pool *p, struct poolCache *c)
+{
+    char *block;
+    int j;
+
+    pthread_mutex_lock(&p->mtx);
+
+    for (j = 0; j < p->batch && p->freeList != NULL; j++) {
+        void *obj = p->freeList;
+
+        p->freeList = NEXT(obj);
+        NEXT(obj) = c->head;
+        c->head = obj;
+        c->count++;
+    }
+
+    if (j == 0) {
+        block = arenaAlloc(&p->arena, p->batch * p->objSize);
+        if (block != NULL) {
+            for (j = p->batch - 1; j >= 0; j--) {
+                NEXT(block + j * p->objSize) = c->head;
+                c->head = block + j * p->objSize;
+            }
+            c->count += p->batch;
+        }
+    }
+
+    pthread_mutex_unlock(&p->mtx);
+}
+
+/* Return a pointer to an object from 'p', or NULL (with 'errno' set) on
+   error */
+
+void *
+poolAlloc(struct pool *p)
+{
+    struct poolCache *c;
+    void *obj;
+
+    c = getCache(p);
+    if (c == NULL)
+        return NULL;
+    if (c->head == NULL) {
+        refill(p, c);
+        if (c->head == NULL)
+            return NULL;
+    }
+
+    obj = c->head;
+    c->head = NEXT(obj);
+    c->count--;
+    return obj;
+}
+
+/* Return 'obj' (which must have been allocated from 'p') to the pool */
+
+void
+poolFree(struct pool *p, void *obj)
+{
+    struct poolCache *c;
+    void *first, *last;
+    int j;
+
+    c = getCache(p);
+    if (c == NULL) {                    /* Can't cache: free directly */
+        pthread_mutex_lock(&p->mtx);
+        NEXT(obj) = p->freeList;
+        p->freeList = obj;
+        pthread_mutex_unlock(&p->mtx);
+        return;
+    }
+
+    NEXT(obj) = c->head;
+    c->head = obj;
+    c->count++;
+
+    /* If the cache has grown to two batches, return one batch */
+
+    if (c->count >= 2 * p->batch) {
+        first = last = c->head;
+        for (j = 1; j < p->batch; j++)
+            last = NEXT(last);
+        c->head = NEXT(last);
+        c->count -= p->batch;
+
+        pthread_mutex_lock(&p->mtx);
+        NEXT(last) = p->freeList;
+        p->freeList = first;
+        pthread_mutex_unlock(&p->mtx);
+    }
+}
+
+/* Free all of the memory of 'p', including objects still allocated */
+
+void
+poolDestroy(struct pool *p)
+{
+    struct poolCache *c, *next;
+
+    pthread_key_delete(p->key);         /* No more destructor calls */
+    for (c = p->caches; c != NULL; c = next) {
+        next = c->next;
+        free(c);
+    }
+    p->caches = NULL;
+    p->freeList = NULL;
+    arenaDestroy(&p->arena);
+    pthread_mutex_destroy(&p->mtx);
+}
@@ -0,0 +1,69 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 7 */
+
+/* arena.h
+
+   Header file for arena.c.
+*/
+#ifndef ARENA_H
+#define ARENA_H                 /* Prevent accidental double inclusion */
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define ARENA_MADV_FREE 0x1     /* Release the pages of idle chunks with
+                                   MADV_FREE when an arena is reset */
+
+struct arenaChunk;
+
+struct arena {                  /* Not thread-safe: one per thread */
+    struct arenaChunk *head;    /* Chunk being allocated from; older
+                                   chunks follow */
+    struct arenaChunk *tail;    /* Last chunk in the 'head' list */
+    struct arenaChunk *spare;   /* Chunks retained after a reset */
+    size_t chunkSize;
+    int flags;
+    size_t mapped;              /* Bytes mapped for chunks */
+    size_t used;                /* Bytes handed out since last reset */
+};
+
+struct poolCache;
+
+struct pool {                   /* Thread-safe */
+    size_t objSize;
+    int batch;                  /* Objects moved to/from a cache at once */
+    pthread_key_t key;          /* Per-thread 'struct poolCache' */
+    pthread_mutex_t mtx;        /* Protects the following fields */
+    void *freeList;             /* Objects not in any cache */
+    struct poolCache *caches;   /* All per-thread caches */
+    struct arena arena;         /* Backing store */
+};
+
+int arenaInit(struct arena *a, size_t chunkSize, int flags);
+
+void *arenaAlloc(struct arena *a, size_t size);
+
+void arenaReset(struct arena *a);
+
+int arenaTrim(struct arena *a);
+
+void arenaDestroy(struct arena *a);
+
+int poolInit(struct pool *p, size_t objSize, size_t chunkSize);
+
+void *poolAlloc(struct pool *p);
+
+void poolFree(struct pool *p, void *obj);
+
+void poolDestroy(struct pool *p);
+
+#endif
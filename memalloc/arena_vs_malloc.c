@@ -0,0 +1,287 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 7 */
+
+/* arena_vs_malloc.c
+
+   Compare malloc() with the pool and arena allocators of arena.c, using
+   the allocation pattern of free_and_sbrk.c.
+
+   Usage: arena_vs_malloc [-r rounds] [-t nthreads] [-c chunk-KiB] [-F]
+                          num-allocs block-size [step [min [max]]]
+
+        -r rounds    Repeat the pattern 'rounds' times (default: 5)
+        -t nthreads  Run the pattern in 'nthreads' threads at once
+                     (default: 1); each thread has its own arena, while
+                     the pool and malloc() are shared
+        -c KiB       Arena chunk size (default: 1024)
+        -F           Create the arenas with ARENA_MADV_FREE
+
+   In each round, each thread allocates 'num-allocs' blocks of
+   'block-size' bytes (touching each page of each block), then frees the
+   blocks from 'min' to 'max' in steps of 'step' (as in free_and_sbrk.c),
+   and then frees the remaining blocks. An arena can't free individual
+   blocks, so for the arena, the first free phase does nothing, and the
+   second is a single arenaReset().
+
+   For each round, the program reports the allocation and free rates
+   (operations per second, over all threads), and the resident set size
+   (Rss in /proc/self/smaps_rollup) after the allocations, after the
+   first free phase, and at the end of the round. Memory freed with
+   MADV_FREE remains in the RSS until the kernel reclaims it, so the
+   amount of such memory (LazyFree) is shown too. For malloc(), the
+   program break is also shown. The RSS is that of the whole process, so
+   the RSS at the start of each allocator's rounds is shown, and after the
+   malloc() rounds, malloc_trim() is called to return free memory from
+   the malloc() heap, so that it does not obscure the figures for the
+   other allocators.
+
+   Try: arena_vs_malloc 1000 10240 2 1 1000
+        arena_vs_malloc -F 100000 64
+        arena_vs_malloc -t 4 100000 64
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <malloc.h>
+#include <pthread.h>
+#include <time.h>
+#include "arena.h"
+#include "tlpi_hdr.h"
+
+enum { A_MALLOC, A_POOL, A_ARENA };
+
+static const char *allocNames[] = { "malloc", "pool", "arena" };
+
+static int numAllocs, blockSize, freeStep, freeMin, freeMax;
+static int rounds, nthreads, which;
+static size_t chunkSize;
+static int arenaFlags;
+static struct pool pool;
+static pthread_barrier_t barrier;
+static long pageSize;
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Get the process's RSS and LazyFree (in KiB) from smaps_rollup */
+
+static void
+getRss(long *rss, long *lazy)
+{
+    char line[256];
+    FILE *fp;
+
+    *rss = *lazy = 0;
+    fp = fopen("/proc/self/smaps_rollup", "r");
+    if (fp == NULL)
+        return;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        sscanf(line, "Rss: %ld", rss);
+        sscanf(line, "LazyFree: %ld", lazy);
+    }
+    fclose(fp);
+}
+
+static void
+freeBlock(char *p)
+{
+    if (which == A_MALLOC)
+        free(p);
+    else if (which == A_POOL)
+        poolFree(&pool, p);
+}
+
+/* Thread 0 takes the measurements, at points where all threads have
+   finished a phase */
+
+static double phaseStart;
+
+static void
+endPhase(int tnum, double *secs, long *rss, long *lazy)
+{
+    pthread_barrier_wait(&barrier);
+    if (tnum == 0) {
+        *secs = nowSecs() - phaseStart;
+        getRss(rss, lazy);
+        phaseStart = nowSecs();
+    }
+    pthread_barrier_wait(&barrier);
+}
+
+static void *
+threadFunc(void *arg)
+{
+    int tnum = (long) arg;
+    double allocSecs, freeSecs, restSecs;
+    long rssAlloc, rssFree, rssEnd, lazy, nfreed;
+    struct arena arena;
+    char **ptr;
+    void *brkFree;
+    int r, j, k;
+
+    ptr = calloc(numAllocs, sizeof(char *));
+    if (ptr == NULL)
+        errExit("calloc");
+    if (which == A_ARENA)
+        arenaInit(&arena, chunkSize, arenaFlags);
+
+    nfreed = 0;
+    for (j = freeMin - 1; j < freeMax; j += freeStep)
+        nfreed++;
+
+    for (r = 0; r < rounds; r++) {
+        pthread_barrier_wait(&barrier);
+        if (tnum == 0)
+            phaseStart = nowSecs();
+        pthread_barrier_wait(&barrier);
+
+        for (j = 0; j < numAllocs; j++) {
+            switch (which) {
+            case A_MALLOC: ptr[j] = malloc(blockSize);                break;
+            case A_POOL:   ptr[j] = poolAlloc(&pool);                 break;
+            case A_ARENA:  ptr[j] = arenaAlloc(&arena, blockSize);    break;
+            }
+            if (ptr[j] == NULL)
+                errExit("allocation");
+            for (k = 0; k < blockSize; k += pageSize)
+                ptr[j][k] = 1;
+        }
+        endPhase(tnum, &allocSecs, &rssAlloc, &lazy);
+
+        if (which != A_ARENA) {
+            for (j = freeMin - 1; j < freeMax; j += freeStep) {
+                freeBlock(ptr[j]);
+                ptr[j] = NULL;
+            }
+        }
+        endPhase(tnum, &freeSecs, &rssFree, &lazy);
+        brkFree = sbrk(0);
+
+        if (which == A_ARENA) {
+            arenaReset(&arena);
+        } else {
+            for (j = 0; j < numAllocs; j++)
+                if (ptr[j] != NULL)
+                    freeBlock(ptr[j]);
+        }
+        endPhase(tnum, &restSecs, &rssEnd, &lazy);
+
+        if (tnum == 0) {
+            printf("%-7s %5d %10.2f", allocNames[which], r,
+                   (double) numAllocs * nthreads / allocSecs / 1e6);
+            if (which == A_ARENA)
+                printf(" %9s %8.1fus", "-", restSecs * 1e6);
+            else if (nfreed == numAllocs)
+                printf(" %10.2f %10s", nfreed * nthreads / freeSecs / 1e6,
+                       "-");
+            else
+                printf(" %10.2f %10.2f",
+                       nfreed * nthreads / freeSecs / 1e6,
+                       (numAllocs - nfreed) * nthreads / restSecs / 1e6);
+            printf(" %9.1f %9.1f %9.1f %8.1f", rssAlloc / 1024.0,
+                   rssFree / 1024.0, rssEnd / 1024.0, lazy / 1024.0);
+            if (which == A_MALLOC)
+                printf("  %p", brkFree);
+            printf("\n");
+        }
+    }
+
+    if (which == A_ARENA)
+        arenaDestroy(&arena);
+    free(ptr);
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    pthread_t *thr;
+    long rss, lazy, j;
+    int opt, s;
+
+    rounds = 5;
+    nthreads = 1;
+    chunkSize = 1024 * 1024;
+    while ((opt = getopt(argc, argv, "r:t:c:F")) != -1) {
+        switch (opt) {
+        case 'r': rounds = getInt(optarg, GN_GT_0, "-r");               break;
+        case 't': nthreads = getInt(optarg, GN_GT_0, "-t");             break;
+        case 'c': chunkSize = getInt(optarg, GN_GT_0, "-c") * 1024L;    break;
+        case 'F': arenaFlags = ARENA_MADV_FREE;                         break;
+        default:  optind = argc + 1;                                    break;
+        }
+    }
+    if (optind + 2 > argc)
+        usageErr("%s [-r rounds] [-t nthreads] [-c chunk-KiB] [-F]\n"
+                 "        num-allocs block-size [step [min [max]]]\n",
+                 argv[0]);
+
+    numAllocs = getInt(argv[optind], GN_GT_0, "num-allocs");
+    blockSize = getInt(argv[optind + 1], GN_GT_0 | GN_ANY_BASE, "block-size");
+    freeStep = (argc > optind + 2) ? getInt(argv[optind + 2], GN_GT_0, "step")
+                                   : 1;
+    freeMin = (argc > optind + 3) ? getInt(argv[optind + 3], GN_GT_0, "min")
+                                  : 1;
+    freeMax = (argc > optind + 4) ? getInt(argv[optind + 4], GN_GT_0, "max")
+                                  : numAllocs;
+    if (freeMax > numAllocs)
+        cmdLineErr("free-max > num-allocs\n");
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    thr = calloc(nthreads, sizeof(pthread_t));
+    if (thr == NULL)
+        errExit("calloc");
+    s = pthread_barrier_init(&barrier, NULL, nthreads);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_init");
+
+    printf("%d thread(s) x %d allocs of %d bytes; freeing %d..%d step %d\n\n",
+           nthreads, numAllocs, blockSize, freeMin, freeMax, freeStep);
+    printf("%-7s %5s %10s %10s %10s %9s %9s %9s %8s\n", "", "round",
+           "alloc M/s", "free M/s", "rest M/s", "RSS-alloc", "RSS-free",
+           "RSS-end", "LazyFree");
+    printf("%-7s %5s %10s %10s %10s %9s %9s %9s %8s\n", "", "", "", "", "",
+           "(MiB)", "(MiB)", "(MiB)", "(MiB)");
+
+    for (which = A_MALLOC; which <= A_ARENA; which++) {
+        if (which == A_POOL && poolInit(&pool, blockSize, chunkSize) == -1)
+            errExit("poolInit");
+
+        getRss(&rss, &lazy);
+        printf("%-7s (RSS at start: %.1f MiB)\n", allocNames[which],
+               rss / 1024.0);
+
+        for (j = 0; j < nthreads; j++) {
+            s = pthread_create(&thr[j], NULL, threadFunc, (void *) j);
+            if (s != 0)
+                errExitEN(s, "pthread_create");
+        }
+        for (j = 0; j < nthreads; j++) {
+            s = pthread_join(thr[j], NULL);
+            if (s != 0)
+                errExitEN(s, "pthread_join");
+        }
+
+        if (which == A_MALLOC)
+            malloc_trim(0);
+        if (which == A_POOL)
+            poolDestroy(&pool);
+    }
+
+    exit(EXIT_SUCCESS);
+}
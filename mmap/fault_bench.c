@@ -0,0 +1,443 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* fault_bench.c
+
+   Measure the cost of touching each page of a new mapping, for various
+   types of mapping.
+
+   Usage: fault_bench [-n npages] [-r reps] [-t type[,type...]] [-R] [-c]
+                      [-f file]
+
+        -n npages    Number of pages to map and touch (default: 16384)
+        -r reps      Repeat each measurement 'reps' times, with a new
+                     mapping each time (default: 3)
+        -t types     Comma-separated list of the mapping types to measure
+                     (default: all of them):
+
+             anon-priv    MAP_PRIVATE | MAP_ANONYMOUS
+             anon-shared  MAP_SHARED | MAP_ANONYMOUS
+             file-priv    MAP_PRIVATE mapping of a file
+             file-shared  MAP_SHARED mapping of a file
+             populate     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE; the
+                          faults happen inside mmap(), whose time is shown
+                          separately
+             thp          Anonymous mapping, aligned to 2 MiB, with
+                          madvise(MADV_HUGEPAGE): one fault maps a whole
+                          transparent huge page
+             hugetlb      MAP_HUGETLB (needs pages in
+                          /proc/sys/vm/nr_hugepages)
+             uffd-zero    Anonymous mapping registered with userfaultfd(2),
+                          whose missing-page faults are resolved by a
+                          handler thread with UFFDIO_ZEROPAGE
+             uffd-copy    As uffd-zero, but resolved with UFFDIO_COPY, as
+                          when pages are filled lazily from elsewhere
+
+        -R           Touch the pages by reading rather than writing
+        -c           Before each repetition, drop the file's pages from
+                     the page cache with posix_fadvise(POSIX_FADV_DONTNEED),
+                     so that faults on the file mappings are major faults
+        -f file      File to use for the file mappings (default: a
+                     temporary file in the current directory, which is
+                     removed afterward); it must be on a file system that
+                     is backed by a device if -c is to have an effect
+
+   For each type, the program reports the time taken by mmap(), the time
+   taken to touch all of the pages (per page, and per fault), the number
+   of minor and major faults (from getrusage()), and the median, 99th
+   percentile, and maximum of the time taken by the individual touches.
+   The figures are averages over the repetitions, except for the
+   percentiles, which are computed over all of the touches.
+
+   When file pages are read (-R), the kernel maps the neighbouring pages
+   that are already in the page cache on each fault ("fault-around"; see
+   /sys/kernel/debug/fault_around_bytes), so there are fewer faults than
+   pages.
+
+   Faults are counted with RUSAGE_SELF, so that the faults taken while a
+   userfaultfd handler thread resolves a fault are included. With
+   UFFDIO_ZEROPAGE, a read fault maps the zero page, and a later write
+   then takes a further (copy-on-write) fault; in this program, each page
+   is touched only once.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#define HPAGE_SIZE (2 * 1024 * 1024)
+
+enum { T_ANON_PRIV, T_ANON_SHARED, T_FILE_PRIV, T_FILE_SHARED,
+       T_POPULATE, T_THP, T_HUGETLB, T_UFFD_ZERO, T_UFFD_COPY, T_NTYPES };
+
+static const char *typeNames[] = {
+    "anon-priv", "anon-shared", "file-priv", "file-shared", "populate",
+    "thp", "hugetlb", "uffd-zero", "uffd-copy"
+};
+
+static long pageSize;
+static size_t npages, mapLen;
+static Boolean readTouch;
+
+struct uffdHandler {
+    int fd;
+    Boolean copy;               /* UFFDIO_COPY rather than UFFDIO_ZEROPAGE */
+    char *srcPage;              /* Source for UFFDIO_COPY */
+    pthread_t thr;
+};
+
+static uint64_t
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+cmpU32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Resolve missing-page faults on the registered range until cancelled */
+
+static void *
+uffdThread(void *arg)
+{
+    struct uffdHandler *h = arg;
+    struct uffd_msg msg;
+    struct uffdio_zeropage zp;
+    struct uffdio_copy cp;
+    unsigned long addr;
+    ssize_t n;
+
+    for (;;) {
+        n = read(h->fd, &msg, sizeof(msg));     /* Cancellation point */
+        if (n == -1) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            errExit("read-userfaultfd");
+        }
+        if (msg.event != UFFD_EVENT_PAGEFAULT)
+            continue;
+
+        addr = msg.arg.pagefault.address & ~(pageSize - 1);
+        if (h->copy) {
+            cp.dst = addr;
+            cp.src = (unsigned long) h->srcPage;
+            cp.len = pageSize;
+            cp.mode = 0;
+            if (ioctl(h->fd, UFFDIO_COPY, &cp) == -1 && errno != EEXIST)
+                errExit("ioctl-UFFDIO_COPY");
+        } else {
+            zp.range.start = addr;
+            zp.range.len = pageSize;
+            zp.mode = 0;
+            if (ioctl(h->fd, UFFDIO_ZEROPAGE, &zp) == -1 && errno != EEXIST)
+                errExit("ioctl-UFFDIO_ZEROPAGE");
+        }
+    }
+    return NULL;
+}
+
+/* Register 'addr' with a new userfaultfd, and start a handler thread.
+   Returns 0 on success, or -1 if userfaultfd is unavailable. */
+
+static int
+uffdStart(struct uffdHandler *h, char *addr, Boolean copy)
+{
+    struct uffdio_api api;
+    struct uffdio_register reg;
+    int s;
+
+    h->fd = syscall(SYS_userfaultfd, O_CLOEXEC | UFFD_USER_MODE_ONLY);
+    if (h->fd == -1 && errno == EINVAL)         /* Before Linux 5.11 */
+        h->fd = syscall(SYS_userfaultfd, O_CLOEXEC);
+    if (h->fd == -1)
+        return -1;
+
+    api.api = UFFD_API;
+    api.features = 0;
+    if (ioctl(h->fd, UFFDIO_API, &api) == -1)
+        errExit("ioctl-UFFDIO_API");
+
+    reg.range.start = (unsigned long) addr;
+    reg.range.len = mapLen;
+    reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+    if (ioctl(h->fd, UFFDIO_REGISTER, &reg) == -1)
+        errExit("ioctl-UFFDIO_REGISTER");
+
+    h->copy = copy;
+    h->srcPage = malloc(pageSize);
+    if (h->srcPage == NULL)
+        errExit("malloc");
+    memset(h->srcPage, 'x', pageSize);
+
+    s = pthread_create(&h->thr, NULL, uffdThread, h);
+    if (s != 0)
+        errExitEN(s, "pthread_create");
+    return 0;
+}
+
+static void
+uffdStop(struct uffdHandler *h)
+{
+    int s;
+
+    s = pthread_cancel(h->thr);
+    if (s != 0)
+        errExitEN(s, "pthread_cancel");
+    s = pthread_join(h->thr, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_join");
+    close(h->fd);
+    free(h->srcPage);
+}
+
+/* Create the mapping for 'type'. On return, '*base' and '*baseLen'
+   describe what must be unmapped. Returns NULL if the mapping type is
+   unavailable. */
+
+static char *
+makeMapping(int type, int fd, char **base, size_t *baseLen)
+{
+    int flags, prot;
+    char *p;
+
+    prot = PROT_READ | PROT_WRITE;
+    *baseLen = mapLen;
+
+    switch (type) {
+    case T_ANON_PRIV:
+    case T_UFFD_ZERO:
+    case T_UFFD_COPY:
+        p = mmap(NULL, mapLen, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        break;
+    case T_ANON_SHARED:
+        p = mmap(NULL, mapLen, prot, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        break;
+    case T_FILE_PRIV:
+    case T_FILE_SHARED:
+        flags = (type == T_FILE_PRIV) ? MAP_PRIVATE : MAP_SHARED;
+        p = mmap(NULL, mapLen, prot, flags, fd, 0);
+        break;
+    case T_POPULATE:
+        p = mmap(NULL, mapLen, prot,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        break;
+    case T_HUGETLB:
+        *baseLen = (mapLen + HPAGE_SIZE - 1) & ~(size_t) (HPAGE_SIZE - 1);
+        p = mmap(NULL, *baseLen, prot,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+        break;
+    default:            /* T_THP: over-allocate, so as to align to 2 MiB */
+        *baseLen = mapLen + HPAGE_SIZE;
+        *base = mmap(NULL, *baseLen, prot,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (*base == MAP_FAILED)
+            errExit("mmap");
+        p = (char *) (((uintptr_t) *base + HPAGE_SIZE - 1) &
+                      ~(uintptr_t) (HPAGE_SIZE - 1));
+        if (madvise(p, mapLen, MADV_HUGEPAGE) == -1) {
+            munmap(*base, *baseLen);
+            return NULL;
+        }
+        return p;
+    }
+
+    if (p == MAP_FAILED)
+        errExit("mmap-%s", typeNames[type]);
+    *base = p;
+    return p;
+}
+
+static void
+runType(int type, int fd, int reps, Boolean dropCache, uint32_t *lat)
+{
+    struct uffdHandler h;
+    struct rusage ru0, ru1;
+    uint64_t t0, t1, mapNs, touchNs;
+    long minflt, majflt, faults;
+    size_t j, nlat;
+    volatile char sink;
+    char *p, *base;
+    size_t baseLen;
+    int r;
+
+    mapNs = touchNs = 0;
+    minflt = majflt = 0;
+    nlat = 0;
+
+    for (r = 0; r < reps; r++) {
+        if (dropCache && (type == T_FILE_PRIV || type == T_FILE_SHARED)) {
+            if (fdatasync(fd) == -1)
+                errExit("fdatasync");
+            posix_fadvise(fd, 0, mapLen, POSIX_FADV_DONTNEED);
+        }
+
+        t0 = nowNs();
+        p = makeMapping(type, fd, &base, &baseLen);
+        t1 = nowNs();
+        if (p == NULL) {
+            printf("%-12s unavailable (%s)\n", typeNames[type],
+                   strerror(errno));
+            return;
+        }
+        mapNs += t1 - t0;
+
+        if (type == T_UFFD_ZERO || type == T_UFFD_COPY) {
+            if (uffdStart(&h, p, type == T_UFFD_COPY) == -1) {
+                printf("%-12s unavailable (userfaultfd: %s)\n",
+                       typeNames[type], strerror(errno));
+                munmap(base, baseLen);
+                return;
+            }
+        }
+
+        if (getrusage(RUSAGE_SELF, &ru0) == -1)
+            errExit("getrusage");
+        t0 = nowNs();
+        for (j = 0; j < mapLen; j += pageSize) {
+            t1 = nowNs();
+            if (readTouch)
+                sink = p[j];
+            else
+                p[j] = 1;
+            lat[nlat++] = nowNs() - t1;
+        }
+        touchNs += nowNs() - t0;
+        if (getrusage(RUSAGE_SELF, &ru1) == -1)
+            errExit("getrusage");
+        minflt += ru1.ru_minflt - ru0.ru_minflt;
+        majflt += ru1.ru_majflt - ru0.ru_majflt;
+
+        if (type == T_UFFD_ZERO || type == T_UFFD_COPY)
+            uffdStop(&h);
+        if (munmap(base, baseLen) == -1)
+            errExit("munmap");
+    }
+    (void) sink;
+
+    qsort(lat, nlat, sizeof(uint32_t), cmpU32);
+    faults = minflt + majflt;
+    printf("%-12s %9.1f %9.1f", typeNames[type], mapNs / 1e3 / reps,
+           (double) touchNs / reps / npages);
+    if (faults > 0)
+        printf(" %9.0f", (double) touchNs / faults);
+    else
+        printf(" %9s", "-");
+    printf(" %8ld %8ld %7u %7u %8u\n", minflt / reps, majflt / reps,
+           lat[nlat / 2], lat[nlat * 99 / 100], lat[nlat - 1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+    Boolean want[T_NTYPES], dropCache, tmpFile;
+    char *types, *tok, *file;
+    char tmpl[] = "fault_bench.XXXXXX";
+    uint32_t *lat;
+    int opt, reps, t, fd;
+    char *buf;
+    size_t off;
+
+    npages = 16384;
+    reps = 3;
+    types = NULL;
+    file = NULL;
+    dropCache = FALSE;
+    readTouch = FALSE;
+    while ((opt = getopt(argc, argv, "n:r:t:Rcf:")) != -1) {
+        switch (opt) {
+        case 'n': npages = getLong(optarg, GN_GT_0, "-n");      break;
+        case 'r': reps = getInt(optarg, GN_GT_0, "-r");         break;
+        case 't': types = optarg;                               break;
+        case 'R': readTouch = TRUE;                             break;
+        case 'c': dropCache = TRUE;                             break;
+        case 'f': file = optarg;                                break;
+        default:
+            usageErr("%s [-n npages] [-r reps] [-t type[,type...]] [-R] "
+                     "[-c] [-f file]\n", argv[0]);
+        }
+    }
+
+    for (t = 0; t < T_NTYPES; t++)
+        want[t] = (types == NULL);
+    tok = (types != NULL) ? strtok(types, ",") : NULL;
+    for ( ; tok != NULL; tok = strtok(NULL, ",")) {
+        for (t = 0; t < T_NTYPES; t++)
+            if (strcmp(tok, typeNames[t]) == 0)
+                break;
+        if (t == T_NTYPES)
+            cmdLineErr("Unknown mapping type: %s\n", tok);
+        want[t] = TRUE;
+    }
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    mapLen = npages * pageSize;
+    lat = malloc(npages * reps * sizeof(uint32_t));
+    if (lat == NULL)
+        errExit("malloc");
+
+    /* Create (or extend) the file, and write its contents, so that the
+       file mappings have real data behind them */
+
+    tmpFile = (file == NULL);
+    if (tmpFile) {
+        fd = mkstemp(tmpl);
+        file = tmpl;
+    } else {
+        fd = open(file, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    }
+    if (fd == -1)
+        errExit("open %s", file);
+    buf = malloc(pageSize);
+    if (buf == NULL)
+        errExit("malloc");
+    memset(buf, 'f', pageSize);
+    for (off = 0; off < mapLen; off += pageSize)
+        if (pwrite(fd, buf, pageSize, off) != pageSize)
+            errExit("pwrite");
+    free(buf);
+
+    printf("%zu pages (%zu KiB), %s touches, %d rep(s)%s\n\n", npages,
+           mapLen / 1024, readTouch ? "read" : "write", reps,
+           dropCache ? ", file pages dropped from cache" : "");
+    printf("%-12s %9s %9s %9s %8s %8s %7s %7s %8s\n", "type", "mmap(us)",
+           "ns/page", "ns/fault", "minflt", "majflt", "p50(ns)", "p99(ns)",
+           "max(ns)");
+
+    for (t = 0; t < T_NTYPES; t++)
+        if (want[t])
+            runType(t, fd, reps, dropCache, lat);
+
+    close(fd);
+    if (tmpFile)
+        unlink(file);
+    free(lat);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,222 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* huge_text.c
+
+   Move a program's code onto transparent huge pages.
+
+   The code of a large program can be spread over thousands of 4 KiB
+   pages, more than the processor's instruction TLB can map at once, so
+   that execution keeps stalling on page-table walks (which show up as
+   iTLB misses in perf(1)). A 2 MiB huge page needs a single TLB entry.
+   But file mappings, such as the text of an executable, get huge pages
+   only in limited circumstances (CONFIG_READ_ONLY_THP_FOR_FS and
+   khugepaged, or a file system with large folios), whereas anonymous
+   memory gets them whenever transparent huge pages are enabled.
+
+   hugeTextRemap(), called early in main(), does the following:
+
+   1. Find the executable mapping of the main program that contains the
+      function itself (this module is linked statically into the
+      program), from /proc/self/maps, and the largest range within it
+      that starts and ends on a 2 MiB boundary. If there is none (the
+      text is smaller than about 4 MiB, unless the program was linked
+      with "-z max-page-size=0x200000" so that its segments are aligned),
+      nothing is done.
+
+   2. Create an anonymous mapping, 2 MiB-aligned, mark it with
+      madvise(MADV_HUGEPAGE), copy the code into it (the first write to
+      each 2 MiB region allocates a huge page, if one is available), and
+      make it read-only and executable.
+
+   3. Use mremap(MREMAP_FIXED) to move the copy over the original range.
+      mremap() replaces the old mapping atomically, so code in that range
+      (including the code of this function, and of other threads) keeps
+      running, finding the same instructions at the same addresses.
+
+   The cost is a copy of the text (a few milliseconds for tens of MiB)
+   plus memory that, unlike the page cache, is private to the process and
+   can't be reclaimed except by swapping. Tools that inspect the process
+   (perf, gdb, /proc/PID/maps) see an anonymous mapping in place of the
+   executable, so perf can no longer resolve symbols in the remapped
+   range unless it is given the executable explicitly.
+
+   Calling the function more than once is harmless: the second call
+   finds that the range is no longer a file mapping.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "huge_text.h"          /* Declares functions defined here */
+
+#define HUGE_SIZE (2UL * 1024 * 1024)   /* x86-64 and arm64 (4 KiB base
+                                           pages) PMD size */
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25
+#endif
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Find the line of /proc/self/maps describing the mapping that contains
+   'addr'. Returns 1 if it is found and is an executable file mapping,
+   with its range in '*start' and '*end', or 0 otherwise; returns -1 on
+   error. */
+
+static int
+findMapping(uintptr_t addr, uintptr_t *start, uintptr_t *end)
+{
+    char line[4096], perms[8];
+    unsigned long lo, hi, inode;
+    FILE *fp;
+    int found;
+
+    fp = fopen("/proc/self/maps", "re");
+    if (fp == NULL)
+        return -1;
+
+    found = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%lx-%lx %7s %*s %*s %lu", &lo, &hi, perms,
+                   &inode) != 4)
+            continue;
+        if (addr < lo || addr >= hi)
+            continue;
+        if (perms[2] == 'x' && inode != 0) {
+            *start = lo;
+            *end = hi;
+            found = 1;
+        }
+        break;
+    }
+    fclose(fp);
+    return found;
+}
+
+/* Return the number of bytes of the mapping starting at 'start' that are
+   in transparent huge pages, from /proc/self/smaps */
+
+static size_t
+hugeBytes(uintptr_t start)
+{
+    char line[4096];
+    unsigned long lo, hi, kb;
+    FILE *fp;
+    int inRange;
+    size_t n;
+
+    fp = fopen("/proc/self/smaps", "re");
+    if (fp == NULL)
+        return 0;
+
+    n = 0;
+    inRange = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%lx-%lx", &lo, &hi) == 2) {   /* New mapping */
+            if (inRange)
+                break;
+            inRange = (lo == start);
+        } else if (inRange &&
+                   sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            n = kb * 1024;
+            break;
+        }
+    }
+    fclose(fp);
+    return n;
+}
+
+/* Remap the aligned part of the program's text onto an anonymous mapping
+   backed by transparent huge pages. If 'st' is not NULL, return details
+   in it. Returns 0 on success (including when there was nothing to
+   remap; check st->len), or -1 on error, in which case the program
+   continues to run from its original text. */
+
+int
+hugeTextRemap(int flags, struct htStats *st)
+{
+    struct htStats dummy;
+    uintptr_t textStart, textEnd, start, end;
+    char *raw, *copy;
+    size_t len;
+    int s;
+
+    if (st == NULL)
+        st = &dummy;
+    memset(st, 0, sizeof(*st));
+    st->ns = nowNs();
+
+    s = findMapping((uintptr_t) hugeTextRemap, &textStart, &textEnd);
+    if (s != 1)
+        goto done;                      /* Error, or already remapped */
+
+    st->textLen = textEnd - textStart;
+    start = (textStart + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1);
+    end = textEnd & ~(HUGE_SIZE - 1);
+    if (end <= start)
+        goto done;                      /* No whole huge page */
+    len = end - start;
+
+    /* Allocate with room to spare, and trim to a 2 MiB-aligned range */
+
+    raw = mmap(NULL, len + HUGE_SIZE, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        s = -1;
+        goto done;
+    }
+    copy = (char *) (((uintptr_t) raw + HUGE_SIZE - 1) & ~(HUGE_SIZE - 1));
+    if (copy > raw)
+        munmap(raw, copy - raw);
+    if (copy + len < raw + len + HUGE_SIZE)
+        munmap(copy + len, raw + len + HUGE_SIZE - (copy + len));
+
+    if (madvise(copy, len, MADV_HUGEPAGE) == -1) {
+        munmap(copy, len);              /* E.g., THP not configured */
+        s = -1;
+        goto done;
+    }
+    memcpy(copy, (void *) start, len);
+    if (mprotect(copy, len, PROT_READ | PROT_EXEC) == -1 ||
+            mremap(copy, len, len, MREMAP_MAYMOVE | MREMAP_FIXED,
+                   (void *) start) == MAP_FAILED) {
+        munmap(copy, len);
+        s = -1;
+        goto done;
+    }
+
+    /* From here on, we're running from the copy */
+
+    if (flags & HT_COLLAPSE)
+        madvise((void *) start, len, MADV_COLLAPSE);    /* Best effort */
+
+    st->start = (void *) start;
+    st->len = len;
+    st->hugeBytes = hugeBytes(start);
+    s = 0;
+
+done:
+    st->ns = nowNs() - st->ns;
+    return (s == -1) ? -1 : 0;
+}
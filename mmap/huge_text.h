@@ -0,0 +1,39 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* huge_text.h
+
+   Header file for huge_text.c.
+*/
+#ifndef HUGE_TEXT_H
+#define HUGE_TEXT_H             /* Prevent accidental double inclusion */
+
+#include <stddef.h>
+
+/* Flags for hugeTextRemap() */
+
+#define HT_COLLAPSE     0x1     /* Also use MADV_COLLAPSE (Linux 6.1),
+                                   to get huge pages even if none could be
+                                   allocated when the copy was made */
+
+struct htStats {
+    void *start;                /* Range that was remapped */
+    size_t len;                 /* 0 if nothing was remapped */
+    size_t textLen;             /* Size of the whole text mapping */
+    size_t hugeBytes;           /* Of 'len', bytes in huge pages (from
+                                   /proc/self/smaps) */
+    long long ns;               /* Time taken */
+};
+
+int hugeTextRemap(int flags, struct htStats *st);
+
+#endif
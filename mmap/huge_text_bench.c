@@ -0,0 +1,228 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* huge_text_bench.c
+
+   Measure the effect of hugeTextRemap() (huge_text.c) on a program whose
+   code is spread over many pages.
+
+   Usage: huge_text_bench [-n passes] [-c] [-s]
+
+        -n passes   Passes over the functions in each measurement
+                    (default: 500)
+        -c          Pass HT_COLLAPSE to hugeTextRemap()
+        -s          Call the functions in address order rather than in
+                    a random order
+
+   The program contains NFUNCS small functions, each aligned on its own
+   4 KiB page, so that its text is about 16 MiB: more than the
+   second-level TLB of most processors can map with 4 KiB pages (and
+   the executable is correspondingly large). It measures the time
+   taken to call every function once (in a fixed random order), and, if
+   the kernel allows access to the hardware counter, the number of iTLB
+   misses per call; calls hugeTextRemap() and reports its cost and how
+   much of the text it moved onto huge pages; and then repeats the
+   measurement. For comparison, it also shows the cost of calling a
+   single function repeatedly.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <time.h>
+#include "huge_text.h"
+#include "tlpi_hdr.h"
+
+/* NFUNCS (4000) functions, named f0000 to f3999, each on its own page */
+
+#define FN(t, a, b, c) \
+    __attribute__((noinline, aligned(4096))) static int \
+    f##t##a##b##c(int x) { return x + (t * 1000 + a * 100 + b * 10 + c); }
+#define FB(t, a, b) \
+    FN(t, a, b, 0) FN(t, a, b, 1) FN(t, a, b, 2) FN(t, a, b, 3) \
+    FN(t, a, b, 4) FN(t, a, b, 5) FN(t, a, b, 6) FN(t, a, b, 7) \
+    FN(t, a, b, 8) FN(t, a, b, 9)
+#define FA(t, a) \
+    FB(t, a, 0) FB(t, a, 1) FB(t, a, 2) FB(t, a, 3) FB(t, a, 4) \
+    FB(t, a, 5) FB(t, a, 6) FB(t, a, 7) FB(t, a, 8) FB(t, a, 9)
+#define FT(t) \
+    FA(t, 0) FA(t, 1) FA(t, 2) FA(t, 3) FA(t, 4) \
+    FA(t, 5) FA(t, 6) FA(t, 7) FA(t, 8) FA(t, 9)
+
+FT(0) FT(1) FT(2) FT(3)
+
+#define PN(t, a, b, c) f##t##a##b##c,
+#define PB(t, a, b) \
+    PN(t, a, b, 0) PN(t, a, b, 1) PN(t, a, b, 2) PN(t, a, b, 3) \
+    PN(t, a, b, 4) PN(t, a, b, 5) PN(t, a, b, 6) PN(t, a, b, 7) \
+    PN(t, a, b, 8) PN(t, a, b, 9)
+#define PA(t, a) \
+    PB(t, a, 0) PB(t, a, 1) PB(t, a, 2) PB(t, a, 3) PB(t, a, 4) \
+    PB(t, a, 5) PB(t, a, 6) PB(t, a, 7) PB(t, a, 8) PB(t, a, 9)
+#define PT(t) \
+    PA(t, 0) PA(t, 1) PA(t, 2) PA(t, 3) PA(t, 4) \
+    PA(t, 5) PA(t, 6) PA(t, 7) PA(t, 8) PA(t, 9)
+
+static int (*const funcs[])(int) = {
+    PT(0) PT(1) PT(2) PT(3)
+};
+
+#define NFUNCS (sizeof(funcs) / sizeof(funcs[0]))
+
+static int order[NFUNCS];       /* Order in which to call the functions */
+static volatile int sink;
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Open a counter of user-mode iTLB read misses for this thread. Returns
+   a file descriptor, or -1 if the counter isn't available (as in many
+   virtual machines). */
+
+static int
+openItlbCounter(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_ITLB |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long
+readCounter(int fd)
+{
+    long long val;
+
+    if (fd == -1)
+        return 0;
+    if (read(fd, &val, sizeof(val)) != sizeof(val))
+        errExit("read perf counter");
+    return val;
+}
+
+/* Call all of the functions 'passes' times, and print the time and iTLB
+   misses per call */
+
+static void
+measure(const char *label, int passes, int pfd)
+{
+    long long t0, t1, m0, m1, hot;
+    size_t j;
+    int p, x;
+
+    /* Warm up, then time the spread-out calls */
+
+    for (x = 0, j = 0; j < NFUNCS; j++)
+        x = funcs[order[j]](x);
+
+    m0 = readCounter(pfd);
+    t0 = nowNs();
+    for (p = 0; p < passes; p++)
+        for (j = 0; j < NFUNCS; j++)
+            x = funcs[order[j]](x);
+    t1 = nowNs();
+    m1 = readCounter(pfd);
+
+    /* For comparison: the same number of calls to one function */
+
+    hot = nowNs();
+    for (p = 0; p < passes; p++)
+        for (j = 0; j < NFUNCS; j++)
+            x = funcs[0](x);
+    hot = nowNs() - hot;
+    sink = x;
+
+    printf("%-8s %10.2f %10.2f ", label,
+           (double) (t1 - t0) / (passes * NFUNCS),
+           (double) hot / (passes * NFUNCS));
+    if (pfd == -1)
+        printf("%12s\n", "n/a");
+    else
+        printf("%12.3f\n", (double) (m1 - m0) / (passes * NFUNCS));
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n passes] [-c] [-s]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct htStats st;
+    size_t j, k;
+    int opt, passes, flags, pfd, tmp;
+    Boolean sequential;
+
+    passes = 500;
+    flags = 0;
+    sequential = FALSE;
+    while ((opt = getopt(argc, argv, "n:cs")) != -1) {
+        switch (opt) {
+        case 'n':   passes = getInt(optarg, GN_GT_0, "-n");     break;
+        case 'c':   flags |= HT_COLLAPSE;                       break;
+        case 's':   sequential = TRUE;                          break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+
+    for (j = 0; j < NFUNCS; j++)
+        order[j] = j;
+    if (!sequential) {
+        srandom(1);
+        for (j = NFUNCS - 1; j > 0; j--) {      /* Fisher-Yates shuffle */
+            k = random() % (j + 1);
+            tmp = order[j];
+            order[j] = order[k];
+            order[k] = tmp;
+        }
+    }
+
+    pfd = openItlbCounter();
+    printf("%zu functions, one per page, called in %s order\n", NFUNCS,
+           sequential ? "address" : "random");
+    printf("%-8s %10s %10s %12s\n", "text", "ns/call", "hot ns/call",
+           "iTLB-miss/call");
+
+    measure("4k", passes, pfd);
+
+    if (hugeTextRemap(flags, &st) == -1)
+        errExit("hugeTextRemap");
+    if (st.len == 0)
+        fatal("Nothing remapped (text mapping is %zu bytes)", st.textLen);
+
+    measure("huge", passes, pfd);
+
+    printf("hugeTextRemap: %zu of %zu KiB of text remapped in %.3f ms; "
+           "%zu KiB in huge pages\n", st.len / 1024, st.textLen / 1024,
+           st.ns / 1e6, st.hugeBytes / 1024);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,294 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* mmcat_stream.c
+
+   A version of mmcat.c that can handle files of any size: instead of
+   mapping the whole file, it maps one window of the file at a time, and
+   while the current window is being written, the kernel is asked to read
+   in the next one.
+
+   Usage: mmcat_stream [-m mode[,mode...]] [-w window-KiB] [-b buf-KiB]
+                       [-c] [-v] file
+
+        -m modes     How to copy the file to standard output; a comma-
+                     separated list causes the file to be copied once in
+                     each mode, for comparison (default: prefetch):
+
+             read       read() and write() with a buffer (like cat(1))
+             mmap       Map each window and write() it
+             prefetch   As mmap, but map the next window ahead of time,
+                        and apply MADV_WILLNEED to it before writing the
+                        current window, so that its I/O overlaps with the
+                        write()
+             vmsplice   As prefetch, but rather than write(), vmsplice()
+                        the window's pages into a pipe, and (if standard
+                        output is not itself a pipe) splice() them from
+                        there to standard output, so that the data is not
+                        copied through a user-space buffer
+
+        -w KiB       Window size; rounded up to a multiple of the page
+                     size (default: 4096)
+        -b KiB       Buffer size for 'read' mode (default: 128)
+        -c           Before each copy, drop the file's pages from the page
+                     cache with posix_fadvise(POSIX_FADV_DONTNEED), so that
+                     the copy includes the cost of reading from the device
+        -v           Report the elapsed time and throughput of each copy
+                     on standard error
+
+   MADV_SEQUENTIAL is applied to each window, so that the kernel reads
+   ahead aggressively and frees pages behind the current position.
+
+   Pages that have been vmsplice()d into a pipe are referenced by the
+   pipe, not copied: if the file is modified before the data is read from
+   the pipe, the reader sees the modified data.
+
+   A write() to /dev/null does not look at the data, so the pages of a
+   mapping written there are never faulted in; to compare the modes,
+   write to a pipe or a regular file instead.
+
+   Try: mmcat_stream -v -m read,mmap,prefetch,vmsplice -c bigfile | wc -c
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+enum { M_READ, M_MMAP, M_PREFETCH, M_VMSPLICE, M_NMODES };
+
+static const char *modeNames[] = { "read", "mmap", "prefetch", "vmsplice" };
+
+static int fd;
+static off_t fileSize;
+static size_t windowSize, bufSize;
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Write all of 'buf' to standard output, which may be a pipe */
+
+static void
+writeAll(const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(STDOUT_FILENO, buf, len);
+        if (n == -1)
+            errExit("write");
+        buf += n;
+        len -= n;
+    }
+}
+
+static void
+catRead(void)
+{
+    char *buf;
+    ssize_t n;
+
+    buf = malloc(bufSize);
+    if (buf == NULL)
+        errExit("malloc");
+    while ((n = read(fd, buf, bufSize)) > 0)
+        writeAll(buf, n);
+    if (n == -1)
+        errExit("read");
+    free(buf);
+}
+
+/* Map the window at 'off' (or return NULL if 'off' is past the end of
+   the file) */
+
+static char *
+mapWindow(off_t off, size_t *len)
+{
+    char *p;
+
+    if (off >= fileSize)
+        return NULL;
+    *len = (fileSize - off < (off_t) windowSize) ? fileSize - off
+                                                 : windowSize;
+    p = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, off);
+    if (p == MAP_FAILED)
+        errExit("mmap");
+    if (madvise(p, *len, MADV_SEQUENTIAL) == -1)
+        errExit("madvise");
+    return p;
+}
+
+/* Move 'len' bytes at 'p' into the pipe 'pfd', and if 'pfd' is not
+   standard output, splice them on to standard output */
+
+static void
+spliceOut(char *p, size_t len, int pfd[2])
+{
+    struct iovec iov;
+    ssize_t n, m;
+
+    iov.iov_base = p;
+    iov.iov_len = len;
+    while (iov.iov_len > 0) {
+        n = vmsplice(pfd[1], &iov, 1, 0);
+        if (n == -1)
+            errExit("vmsplice");
+        iov.iov_base = (char *) iov.iov_base + n;
+        iov.iov_len -= n;
+
+        while (pfd[0] != -1 && n > 0) {
+            m = splice(pfd[0], NULL, STDOUT_FILENO, NULL, n, SPLICE_F_MOVE);
+            if (m == -1)
+                errExit("splice");
+            n -= m;
+        }
+    }
+}
+
+static void
+catMmap(int mode)
+{
+    char *cur, *next;
+    size_t curLen, nextLen;
+    off_t off;
+    int pfd[2];
+    struct stat sb;
+
+    if (mode == M_VMSPLICE) {
+        if (fstat(STDOUT_FILENO, &sb) == -1)
+            errExit("fstat");
+        if (S_ISFIFO(sb.st_mode)) {
+            pfd[0] = -1;                /* vmsplice() straight to stdout */
+            pfd[1] = STDOUT_FILENO;
+        } else {
+            if (pipe(pfd) == -1)
+                errExit("pipe");
+            fcntl(pfd[1], F_SETPIPE_SZ, 1024 * 1024);   /* Best effort */
+        }
+    }
+
+    off = 0;
+    cur = mapWindow(off, &curLen);
+    while (cur != NULL) {
+        next = NULL;
+        if (mode != M_MMAP) {
+            next = mapWindow(off + curLen, &nextLen);
+            if (next != NULL && madvise(next, nextLen, MADV_WILLNEED) == -1)
+                errExit("madvise");
+        }
+
+        if (mode == M_VMSPLICE)
+            spliceOut(cur, curLen, pfd);
+        else
+            writeAll(cur, curLen);
+
+        if (munmap(cur, curLen) == -1)
+            errExit("munmap");
+        off += curLen;
+
+        if (mode == M_MMAP) {
+            cur = mapWindow(off, &curLen);
+        } else {
+            cur = next;
+            curLen = nextLen;
+        }
+    }
+
+    if (mode == M_VMSPLICE && pfd[0] != -1) {
+        close(pfd[0]);
+        close(pfd[1]);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    Boolean want[M_NMODES], dropCache, verbose;
+    char *modes, *tok;
+    struct stat sb;
+    double t;
+    long pageSize;
+    int opt, m;
+
+    modes = NULL;
+    windowSize = 4096 * 1024;
+    bufSize = 128 * 1024;
+    dropCache = FALSE;
+    verbose = FALSE;
+    while ((opt = getopt(argc, argv, "m:w:b:cv")) != -1) {
+        switch (opt) {
+        case 'm': modes = optarg;                                       break;
+        case 'w': windowSize = getLong(optarg, GN_GT_0, "-w") * 1024;   break;
+        case 'b': bufSize = getLong(optarg, GN_GT_0, "-b") * 1024;      break;
+        case 'c': dropCache = TRUE;                                     break;
+        case 'v': verbose = TRUE;                                       break;
+        default:  optind = argc;                                        break;
+        }
+    }
+    if (optind != argc - 1)
+        usageErr("%s [-m mode[,mode...]] [-w window-KiB] [-b buf-KiB] "
+                 "[-c] [-v] file\n", argv[0]);
+
+    for (m = 0; m < M_NMODES; m++)
+        want[m] = (modes == NULL && m == M_PREFETCH);
+    tok = (modes != NULL) ? strtok(modes, ",") : NULL;
+    for ( ; tok != NULL; tok = strtok(NULL, ",")) {
+        for (m = 0; m < M_NMODES; m++)
+            if (strcmp(tok, modeNames[m]) == 0)
+                break;
+        if (m == M_NMODES)
+            cmdLineErr("Unknown mode: %s\n", tok);
+        want[m] = TRUE;
+    }
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    windowSize = (windowSize + pageSize - 1) & ~(pageSize - 1);
+
+    fd = open(argv[optind], O_RDONLY);
+    if (fd == -1)
+        errExit("open");
+    if (fstat(fd, &sb) == -1)
+        errExit("fstat");
+    fileSize = sb.st_size;
+
+    for (m = 0; m < M_NMODES; m++) {
+        if (!want[m])
+            continue;
+        if (dropCache)
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        if (lseek(fd, 0, SEEK_SET) == -1)
+            errExit("lseek");
+
+        t = nowSecs();
+        if (m == M_READ)
+            catRead();
+        else
+            catMmap(m);
+        t = nowSecs() - t;
+
+        if (verbose)
+            fprintf(stderr, "%-9s %10.3f s %10.1f MiB/s\n", modeNames[m],
+                    t, fileSize / t / (1024 * 1024));
+    }
+
+    exit(EXIT_SUCCESS);
+}
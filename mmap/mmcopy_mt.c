@@ -0,0 +1,240 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* mmcopy_mt.c
+
+   Copy the contents of one file to another file, using memory mappings,
+   as in mmcopy.c. However, rather than mapping both files in their
+   entirety and performing a single memcpy(), this program divides the
+   file into windows, and a set of worker threads copy the windows in
+   parallel. Each worker maps one window of each file, copies the data,
+   and then unmaps the window before taking the next one, so that the
+   amount of mapped memory (and thus the program's RSS) is bounded by
+   (nthreads * 2 * window-size), irrespective of the size of the file.
+   This also allows the copying of files that are larger than the
+   available address space.
+
+   Usage: mmcopy_mt [-t nthreads[,nthreads...]] [-w window-size] [-H] [-p]
+                    source-file dest-file
+
+        -t nthreads  Number of worker threads (default: 1). A comma-
+                     separated list causes the copy to be performed once
+                     for each thread count, so that the results can be
+                     compared.
+        -w size      Window size, in bytes; it is rounded up to a multiple
+                     of 2 MiB (default: 64 MiB)
+        -H           Apply MADV_HUGEPAGE to the mappings (useful where the
+                     files reside on a file system that supports huge
+                     pages in the page cache, such as tmpfs)
+        -p           Use MAP_POPULATE, so that each window is faulted in
+                     by a single mmap() call, rather than one page at a
+                     time by memcpy()
+
+   MADV_SEQUENTIAL is always applied to the source window.
+
+   For each thread count, the program displays the elapsed time and the
+   throughput in GiB/s. The time includes an fsync() of the destination
+   file.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define MAX_THREADS 256
+
+static int fdSrc, fdDst;
+static off_t fileSize;
+static off_t windowSize;
+static Boolean useHugePages = FALSE;
+static int populateFlag = 0;
+
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static off_t nextOffset;                /* Start of next window to copy */
+
+static void *
+copyWindows(void *arg)
+{
+    char *src, *dst;
+    off_t off;
+    size_t len;
+    int s;
+
+    for (;;) {
+
+        /* Claim the next window */
+
+        s = pthread_mutex_lock(&mtx);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_lock");
+        off = nextOffset;
+        nextOffset += windowSize;
+        s = pthread_mutex_unlock(&mtx);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_unlock");
+
+        if (off >= fileSize)
+            break;
+        len = min(windowSize, fileSize - off);
+
+        src = mmap(NULL, len, PROT_READ, MAP_SHARED | populateFlag,
+                   fdSrc, off);
+        if (src == MAP_FAILED)
+            errExit("mmap-source");
+
+        dst = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | populateFlag, fdDst, off);
+        if (dst == MAP_FAILED)
+            errExit("mmap-dest");
+
+        if (madvise(src, len, MADV_SEQUENTIAL) == -1)
+            errExit("madvise-MADV_SEQUENTIAL");
+
+        /* MADV_HUGEPAGE fails with EINVAL if the kernel was built without
+           transparent huge page support; that's not fatal */
+
+        if (useHugePages) {
+            if (madvise(src, len, MADV_HUGEPAGE) == -1 && errno != EINVAL)
+                errExit("madvise-MADV_HUGEPAGE");
+            if (madvise(dst, len, MADV_HUGEPAGE) == -1 && errno != EINVAL)
+                errExit("madvise-MADV_HUGEPAGE");
+        }
+
+        memcpy(dst, src, len);
+
+        if (munmap(src, len) == -1 || munmap(dst, len) == -1)
+            errExit("munmap");
+    }
+
+    return NULL;
+}
+
+/* Perform one complete copy using 'nthreads' workers; return the
+   elapsed time in seconds */
+
+static double
+doCopy(int nthreads)
+{
+    pthread_t tid[MAX_THREADS];
+    struct timespec start, end;
+    int j, s;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+
+    nextOffset = 0;
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_create(&tid[j], NULL, copyWindows, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_join(tid[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    /* The windows have all been unmapped, so we can't use msync() (as
+       mmcopy.c does); fsync() has the same effect */
+
+    if (fsync(fdDst) == -1)
+        errExit("fsync");
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-t nthreads[,nthreads...]] [-w window-size] "
+                    "[-H] [-p]\n\t\tsource-file dest-file\n", progName);
+    fprintf(stderr, "    -t nthreads  Thread count(s) (default: 1)\n");
+    fprintf(stderr, "    -w size      Window size (default: 64 MiB)\n");
+    fprintf(stderr, "    -H           Use MADV_HUGEPAGE\n");
+    fprintf(stderr, "    -p           Use MAP_POPULATE\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct stat sb;
+    char *threadList, *tok;
+    char dfltList[] = "1";
+    int opt, nthreads;
+    double secs;
+
+    threadList = NULL;
+    windowSize = 64 * 1024 * 1024;
+    while ((opt = getopt(argc, argv, "t:w:Hp")) != -1) {
+        switch (opt) {
+        case 't':   threadList = optarg;                                break;
+        case 'w':   windowSize = getLong(optarg, GN_GT_0 | GN_ANY_BASE,
+                                         "window-size");                break;
+        case 'H':   useHugePages = TRUE;                                break;
+        case 'p':   populateFlag = MAP_POPULATE;                        break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (argc != optind + 2)
+        usageError(argv[0]);
+
+    /* Windows must start at a multiple of the page size; using a multiple
+       of the huge page size allows huge pages to be used */
+
+    windowSize = ((windowSize + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) *
+                 HUGE_PAGE_SIZE;
+
+    fdSrc = open(argv[optind], O_RDONLY);
+    if (fdSrc == -1)
+        errExit("open");
+
+    if (fstat(fdSrc, &sb) == -1)
+        errExit("fstat");
+    fileSize = sb.st_size;
+
+    fdDst = open(argv[optind + 1], O_RDWR | O_CREAT | O_TRUNC,
+                 S_IRUSR | S_IWUSR);
+    if (fdDst == -1)
+        errExit("open");
+
+    if (ftruncate(fdDst, fileSize) == -1)
+        errExit("ftruncate");
+
+    if (fileSize == 0)                  /* Nothing to copy */
+        exit(EXIT_SUCCESS);
+
+    if (threadList == NULL)
+        threadList = dfltList;
+
+    for (tok = strtok(threadList, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        nthreads = getInt(tok, GN_GT_0, "nthreads");
+        if (nthreads > MAX_THREADS)
+            usageError(argv[0]);
+
+        secs = doCopy(nthreads);
+        printf("%3d thread(s): %lld bytes in %.3f s (%.2f GiB/s)\n",
+                nthreads, (long long) fileSize, secs,
+                fileSize / (1024.0 * 1024 * 1024) / secs);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,484 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* rec_log.c
+
+   An append-only record log in a memory-mapped file (see rec_log.h for
+   the operations).
+
+   The first page of the file is a header; the rest of the file holds the
+   data, and is divided into segments (4 MiB by default), each of which
+   is mapped separately, when first needed. The file grows one segment at
+   a time, using fallocate() (or ftruncate(), where the file system does
+   not support fallocate()), so that the writer never takes SIGBUS
+   because the blocks for a page could not be allocated.
+
+   Each record is an 8-byte header (length and checksum) followed by the
+   data, padded to a multiple of 8 bytes. A record never spans two
+   segments: if it does not fit in what is left of a segment, the rest of
+   the segment is skipped, by means of a padding record. The maximum size
+   of a record is thus the segment size less 8 bytes.
+
+   The writer first copies a record into the mapping, and then publishes
+   it by storing the new end-of-data offset ('tail') in the header, with
+   release semantics. Readers load 'tail' with acquire semantics, and may
+   then read any record before it, without locks or system calls (other
+   than mmap() when a reader reaches a new segment). Only one process
+   may open a log for writing at a time; this is enforced with flock().
+
+   Durability is controlled by rlSetSync(). Every 'every' appends (and
+   when rlSync() is called, or the log is closed), the data written since
+   the last sync is either scheduled for writeback (RL_SYNC_ASYNC), or
+   written back before the call returns (RL_SYNC_SYNC). On Linux,
+   msync(MS_ASYNC) does not itself start any I/O (the kernel already
+   knows which pages are dirty), so for RL_SYNC_ASYNC, writeback is
+   started with sync_file_range(SYNC_FILE_RANGE_WRITE). RL_SYNC_SYNC
+   uses fdatasync(), and records in the header's 'synced' field the
+   offset up to which the data is known to have been written back. When
+   a log is opened for writing, the records from 'synced' to 'tail' are
+   verified by their checksums, and 'tail' is cut back to the end of the
+   last good record; this discards any records that were only partly
+   written back when the system crashed.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include "rec_log.h"
+#include "tlpi_hdr.h"
+
+#define RL_MAGIC 0x474f4c5250494c54ULL  /* "TLPIRLOG" (little-endian) */
+#define RL_VERSION 1
+#define RL_PAD 0xffffffffU              /* Length of a padding record */
+#define DEFAULT_SEG_SIZE (4 * 1024 * 1024)
+
+#define ALIGN8(n) (((n) + 7) & ~(uint64_t) 7)
+
+struct rlHeader {               /* Occupies the first page of the file */
+    uint64_t magic;             /* Stored last, when the log is created */
+    uint32_t version;
+    uint32_t segSize;
+    uint64_t tail;              /* End of published data (offset in data
+                                   area); accessed atomically */
+    uint64_t synced;            /* Data before here has been written back */
+    uint64_t capacity;          /* Bytes allocated for data */
+};
+
+struct recHdr {                 /* Precedes each record */
+    uint32_t len;               /* Length of data, or RL_PAD */
+    uint32_t sum;               /* Checksum of data */
+};
+
+struct recLog {
+    int fd;
+    int flags;                  /* RL_WRITE */
+    long pageSize;
+    struct rlHeader *hdr;
+    size_t segSize;
+    char **segs;                /* Mapped segments (NULL if not yet) */
+    int nsegs;                  /* Size of 'segs' */
+
+    /* The following fields are used only by the writer */
+
+    uint64_t tail;              /* Private copy of hdr->tail */
+    uint64_t capacity;          /* Private copy of hdr->capacity */
+    uint64_t syncFrom;          /* Start of data not yet synced */
+    int syncMode;               /* RL_SYNC_* */
+    int syncEvery;
+    int unsynced;               /* Appends since last sync */
+};
+
+static uint32_t
+checksum(const char *p, uint32_t len)   /* FNV-1a, seeded with length */
+{
+    uint32_t h;
+    uint32_t j;
+
+    h = 2166136261U ^ len;
+    for (j = 0; j < len; j++)
+        h = (h ^ (unsigned char) p[j]) * 16777619U;
+    return h;
+}
+
+/* Return the address of segment 'k', mapping it if necessary */
+
+static char *
+getSeg(struct recLog *l, uint64_t k)
+{
+    char **segs;
+    int n, prot;
+
+    if (k >= (uint64_t) l->nsegs) {
+        n = (l->nsegs == 0) ? 16 : l->nsegs;
+        while ((uint64_t) n <= k)
+            n *= 2;
+        segs = realloc(l->segs, n * sizeof(char *));
+        if (segs == NULL)
+            return NULL;
+        memset(segs + l->nsegs, 0, (n - l->nsegs) * sizeof(char *));
+        l->segs = segs;
+        l->nsegs = n;
+    }
+
+    if (l->segs[k] == NULL) {
+        prot = (l->flags & RL_WRITE) ? PROT_READ | PROT_WRITE : PROT_READ;
+        l->segs[k] = mmap(NULL, l->segSize, prot, MAP_SHARED, l->fd,
+                          l->pageSize + k * l->segSize);
+        if (l->segs[k] == MAP_FAILED) {
+            l->segs[k] = NULL;
+            return NULL;
+        }
+    }
+    return l->segs[k];
+}
+
+/* Allocate one more segment at the end of the file */
+
+static int
+grow(struct recLog *l)
+{
+    off_t off;
+
+    off = l->pageSize + l->capacity;
+    if (fallocate(l->fd, 0, off, l->segSize) == -1) {
+        if (errno != EOPNOTSUPP)
+            return -1;
+        if (ftruncate(l->fd, off + l->segSize) == -1)
+            return -1;
+    }
+    l->capacity += l->segSize;
+    l->hdr->capacity = l->capacity;
+    return 0;
+}
+
+/* Create the header of a new (empty) log */
+
+static int
+initHeader(struct recLog *l, size_t segSize)
+{
+    if (ftruncate(l->fd, l->pageSize) == -1)
+        return -1;
+    l->hdr = mmap(NULL, l->pageSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  l->fd, 0);
+    if (l->hdr == MAP_FAILED)
+        return -1;
+
+    l->hdr->version = RL_VERSION;
+    l->hdr->segSize = segSize;
+    l->hdr->tail = l->hdr->synced = l->hdr->capacity = 0;
+    __atomic_store_n(&l->hdr->magic, RL_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Check the records after the last sync, and cut the log back to the
+   end of the last good one */
+
+static int
+recover(struct recLog *l)
+{
+    struct recHdr *rh;
+    uint64_t pos, end, off;
+    char *seg;
+
+    pos = l->hdr->synced;
+    end = l->hdr->tail;
+    if (end > l->capacity)
+        end = l->capacity;
+
+    while (pos < end) {
+        seg = getSeg(l, pos / l->segSize);
+        if (seg == NULL)
+            return -1;
+        off = pos % l->segSize;
+        rh = (struct recHdr *) (seg + off);
+        if (rh->len == RL_PAD) {
+            pos += l->segSize - off;
+            continue;
+        }
+        if (off + ALIGN8(sizeof(struct recHdr) + rh->len) > l->segSize ||
+                pos + ALIGN8(sizeof(struct recHdr) + rh->len) > end ||
+                checksum((char *) (rh + 1), rh->len) != rh->sum)
+            break;
+        pos += ALIGN8(sizeof(struct recHdr) + rh->len);
+    }
+
+    l->tail = (pos < end) ? pos : end;
+    __atomic_store_n(&l->hdr->tail, l->tail, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Open the log at 'path'. 'flags' may include RL_WRITE and RL_CREATE.
+   'segSize' (rounded up to a multiple of the page size) is used only
+   when a log is created; 0 means the default. Returns a handle, or NULL
+   on error (EBUSY: another process has the log open for writing;
+   EINVAL: the file is not a log). */
+
+struct recLog *
+rlOpen(const char *path, int flags, size_t segSize)
+{
+    struct recLog *l;
+    struct stat sb;
+    int oflags, savedErrno;
+
+    l = calloc(1, sizeof(struct recLog));
+    if (l == NULL)
+        return NULL;
+    l->flags = flags;
+    l->pageSize = sysconf(_SC_PAGESIZE);
+    l->hdr = MAP_FAILED;
+
+    oflags = (flags & RL_WRITE) ? O_RDWR : O_RDONLY;
+    if (flags & RL_CREATE)
+        oflags |= O_CREAT;
+    l->fd = open(path, oflags | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP);
+    if (l->fd == -1)
+        goto fail;
+
+    if ((flags & RL_WRITE) && flock(l->fd, LOCK_EX | LOCK_NB) == -1) {
+        if (errno == EWOULDBLOCK)
+            errno = EBUSY;
+        goto fail;
+    }
+
+    if (fstat(l->fd, &sb) == -1)
+        goto fail;
+
+    if (sb.st_size == 0 && (flags & RL_WRITE)) {
+        if (segSize == 0)
+            segSize = DEFAULT_SEG_SIZE;
+        segSize = (segSize + l->pageSize - 1) & ~(l->pageSize - 1);
+        if (initHeader(l, segSize) == -1)
+            goto fail;
+    } else {
+        errno = EINVAL;
+        if (sb.st_size < l->pageSize)
+            goto fail;
+        l->hdr = mmap(NULL, l->pageSize, (flags & RL_WRITE) ?
+                      PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+                      l->fd, 0);
+        if (l->hdr == MAP_FAILED)
+            goto fail;
+        errno = EINVAL;
+        if (__atomic_load_n(&l->hdr->magic, __ATOMIC_ACQUIRE) != RL_MAGIC ||
+                l->hdr->version != RL_VERSION || l->hdr->segSize == 0 ||
+                l->hdr->segSize % l->pageSize != 0)
+            goto fail;
+    }
+    l->segSize = l->hdr->segSize;
+
+    if (flags & RL_WRITE) {
+
+        /* Trust the file size rather than the header, which may not
+           have been written back */
+
+        l->capacity = (sb.st_size > l->pageSize) ?
+                (sb.st_size - l->pageSize) / l->segSize * l->segSize : 0;
+        l->hdr->capacity = l->capacity;
+        if (recover(l) == -1)
+            goto fail;
+        l->syncFrom = l->tail;
+        l->syncMode = RL_SYNC_NONE;
+        l->syncEvery = 1;
+    }
+    return l;
+
+fail:
+    savedErrno = errno;
+    rlClose(l);
+    errno = savedErrno;
+    return NULL;
+}
+
+/* Set the durability mode (RL_SYNC_*) for subsequent appends */
+
+int
+rlSetSync(struct recLog *l, int mode, int every)
+{
+    if (!(l->flags & RL_WRITE) || mode < RL_SYNC_NONE ||
+            mode > RL_SYNC_SYNC || every < 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    l->syncMode = mode;
+    l->syncEvery = every;
+    return 0;
+}
+
+/* Return the largest record that can be appended */
+
+size_t
+rlMaxRecord(struct recLog *l)
+{
+    return l->segSize - sizeof(struct recHdr);
+}
+
+/* Append a record, and publish it to readers. Returns 0 on success, or
+   -1 on error (EMSGSIZE: 'len' exceeds rlMaxRecord()). */
+
+int
+rlAppend(struct recLog *l, const void *buf, uint32_t len)
+{
+    struct recHdr *rh;
+    uint64_t need, off;
+    char *seg;
+
+    if (!(l->flags & RL_WRITE)) {
+        errno = EBADF;
+        return -1;
+    }
+    if (len > rlMaxRecord(l)) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    need = ALIGN8(sizeof(struct recHdr) + len);
+
+    /* If the record won't fit in the current segment, skip to the next */
+
+    off = l->tail % l->segSize;
+    if (off + need > l->segSize) {
+        seg = getSeg(l, l->tail / l->segSize);
+        if (seg == NULL)
+            return -1;
+        rh = (struct recHdr *) (seg + off);
+        rh->len = RL_PAD;
+        rh->sum = 0;
+        l->tail += l->segSize - off;
+    }
+
+    while (l->tail + need > l->capacity)
+        if (grow(l) == -1)
+            return -1;
+
+    seg = getSeg(l, l->tail / l->segSize);
+    if (seg == NULL)
+        return -1;
+    rh = (struct recHdr *) (seg + l->tail % l->segSize);
+    rh->len = len;
+    rh->sum = checksum(buf, len);
+    memcpy(rh + 1, buf, len);
+
+    l->tail += need;
+    __atomic_store_n(&l->hdr->tail, l->tail, __ATOMIC_RELEASE);
+
+    if (l->syncMode != RL_SYNC_NONE && ++l->unsynced >= l->syncEvery)
+        return rlSync(l);
+    return 0;
+}
+
+/* Write back (or, for RL_SYNC_ASYNC, start writing back) the data
+   appended since the last sync. Returns 0 on success, or -1 on error. */
+
+int
+rlSync(struct recLog *l)
+{
+    uint64_t pos, segEnd, start;
+
+    if (!(l->flags & RL_WRITE)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (l->syncMode == RL_SYNC_SYNC) {
+
+        /* The data before 'syncFrom' went out in the previous sync, so
+           that can be recorded in the header now, and the header and the
+           new data are then written back together, by one fdatasync()
+           (rather than an msync(MS_SYNC) for each mapping, each of which
+           would be a separate flush) */
+
+        l->hdr->synced = l->syncFrom;
+        if (fdatasync(l->fd) == -1)
+            return -1;
+
+    } else {
+        for (pos = l->syncFrom; pos < l->tail; pos = segEnd) {
+            segEnd = (pos / l->segSize + 1) * l->segSize;
+            if (segEnd > l->tail)
+                segEnd = l->tail;
+            start = pos & ~(uint64_t) (l->pageSize - 1);
+            if (msync(l->segs[pos / l->segSize] + start % l->segSize,
+                      segEnd - start, MS_ASYNC) == -1)
+                return -1;
+            if (sync_file_range(l->fd, l->pageSize + start, segEnd - start,
+                                SYNC_FILE_RANGE_WRITE) == -1)
+                return -1;
+        }
+    }
+
+    l->syncFrom = l->tail;
+    l->unsynced = 0;
+    return 0;
+}
+
+/* Return the offset of the end of the published records */
+
+uint64_t
+rlTail(struct recLog *l)
+{
+    return __atomic_load_n(&l->hdr->tail, __ATOMIC_ACQUIRE);
+}
+
+/* Return a pointer to the data of the record at offset '*pos' (0 for the
+   first record), and its length in '*len', and advance '*pos' to the
+   next record. Returns NULL if there is no further published record
+   (with 'errno' unchanged), or on error. The data remains valid until
+   the log is closed. */
+
+const void *
+rlNext(struct recLog *l, uint64_t *pos, uint32_t *len)
+{
+    struct recHdr *rh;
+    uint64_t tail, off;
+    char *seg;
+
+    tail = rlTail(l);
+    while (*pos < tail) {
+        seg = getSeg(l, *pos / l->segSize);
+        if (seg == NULL)
+            return NULL;
+        off = *pos % l->segSize;
+        rh = (struct recHdr *) (seg + off);
+        if (rh->len == RL_PAD) {
+            *pos += l->segSize - off;
+            continue;
+        }
+        *len = rh->len;
+        *pos += ALIGN8(sizeof(struct recHdr) + rh->len);
+        return rh + 1;
+    }
+    return NULL;
+}
+
+/* Close the log; a writer first syncs any outstanding records */
+
+void
+rlClose(struct recLog *l)
+{
+    int j;
+
+    if ((l->flags & RL_WRITE) && l->hdr != MAP_FAILED &&
+            l->syncMode != RL_SYNC_NONE && l->syncFrom < l->tail)
+        rlSync(l);
+
+    for (j = 0; j < l->nsegs; j++)
+        if (l->segs[j] != NULL)
+            munmap(l->segs[j], l->segSize);
+    free(l->segs);
+    if (l->hdr != MAP_FAILED)
+        munmap(l->hdr, l->pageSize);
+    if (l->fd != -1)
+        close(l->fd);               /* Also releases the flock() lock */
+    free(l);
+}
@@ -0,0 +1,62 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* rec_log.h
+
+   Header file for rec_log.c.
+
+   An append-only log of variable-length records in a file, written by
+   one process and read, concurrently and without locking, by any number
+   of others. The operations are:
+
+        writer opens (or creates) a log:    l = rlOpen(path, RL_WRITE, 0)
+        writer chooses durability:          rlSetSync(l, RL_SYNC_SYNC, 64)
+        writer appends a record:            rlAppend(l, buf, len)
+        writer forces out records:          rlSync(l)
+        reader opens the log:               l = rlOpen(path, 0, 0)
+        reader fetches the next record:     p = rlNext(l, &pos, &len)
+        either side closes the log:         rlClose(l)
+*/
+#ifndef REC_LOG_H
+#define REC_LOG_H               /* Prevent accidental double inclusion */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RL_WRITE        0x1     /* Open as the (only) writer */
+#define RL_CREATE       0x2     /* Create the log if it doesn't exist */
+
+enum {                          /* Durability of appended records */
+    RL_SYNC_NONE,               /* Leave writeback to the kernel */
+    RL_SYNC_ASYNC,              /* Start writeback every 'every' records */
+    RL_SYNC_SYNC                /* Wait for writeback every 'every' records */
+};
+
+struct recLog;                  /* Opaque; defined in rec_log.c */
+
+struct recLog *rlOpen(const char *path, int flags, size_t segSize);
+
+int rlSetSync(struct recLog *l, int mode, int every);
+
+int rlAppend(struct recLog *l, const void *buf, uint32_t len);
+
+int rlSync(struct recLog *l);
+
+uint64_t rlTail(struct recLog *l);
+
+const void *rlNext(struct recLog *l, uint64_t *pos, uint32_t *len);
+
+size_t rlMaxRecord(struct recLog *l);
+
+void rlClose(struct recLog *l);
+
+#endif
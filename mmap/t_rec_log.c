@@ -0,0 +1,267 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 49 */
+
+/* t_rec_log.c
+
+   Demonstrate rec_log.c: append records to a log, or read them back,
+   possibly while they are being appended by another process.
+
+   Usage: t_rec_log -w [-n nrecs] [-l len] [-S mode] [-b batch]
+                    [-g seg-KiB] [-j] file
+          t_rec_log [-f] [-n nrecs] file
+
+        -w           Append 'nrecs' records (default: 100000) of 'len'
+                     bytes (default: 64; at least 16)
+        -S mode      Durability: 'none' (the default), 'async', or 'sync'
+        -b batch     Sync every 'batch' records (default: 1)
+        -g KiB       Segment size, if the log is created (default: 4096)
+        -j           For comparison, append the records with write() to
+                     a plain file opened with O_APPEND (as a write()-based
+                     journal would), and sync it with fdatasync() ('sync')
+                     or sync_file_range() ('async'); the file can't be
+                     read with this program
+        -f           Follow the log (like 'tail -f'), until 'nrecs'
+                     records have been read
+
+   Each record contains a sequence number and the time at which it was
+   appended. A reader checks that the sequence numbers are consecutive,
+   and with -f, reports the time from append to read.
+
+   Try: t_rec_log -w -n 1000000 log & t_rec_log -f -n 1000000 log
+        t_rec_log -w -n 10000 -S sync -b 16 log
+        t_rec_log -w -j -n 10000 -S sync -b 16 journal
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <time.h>
+#include "rec_log.h"
+#include "tlpi_hdr.h"
+
+struct payload {                /* Start of each record */
+    uint64_t seq;
+    uint64_t when;              /* CLOCK_MONOTONIC, in ns */
+};
+
+static uint64_t
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+usageError(const char *progName)
+{
+    usageErr("%s -w [-n nrecs] [-l len] [-S mode] [-b batch] [-g seg-KiB] "
+             "[-j] file\n       %s [-f] [-n nrecs] file\n",
+             progName, progName);
+}
+
+/* Append records with write(), as a conventional journal would */
+
+static void
+writeJournal(const char *path, char *buf, int nrecs, int len, int mode,
+             int batch)
+{
+    struct payload *pl = (struct payload *) buf;
+    uint32_t rlen;
+    int fd, j;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        errExit("open");
+
+    rlen = len;
+    for (j = 0; j < nrecs; j++) {
+        pl->seq = j;
+        pl->when = nowNs();
+        memcpy(buf - sizeof(rlen), &rlen, sizeof(rlen));
+        if (write(fd, buf - sizeof(rlen), len + sizeof(rlen)) !=
+                (ssize_t) (len + sizeof(rlen)))
+            fatal("write");
+        if ((j + 1) % batch == 0 || j == nrecs - 1) {
+            if (mode == RL_SYNC_SYNC && fdatasync(fd) == -1)
+                errExit("fdatasync");
+            if (mode == RL_SYNC_ASYNC &&
+                    sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE) == -1)
+                errExit("sync_file_range");
+        }
+    }
+    close(fd);
+}
+
+static void
+writeLog(const char *path, char *buf, int nrecs, int len, int mode,
+         int batch, size_t segSize)
+{
+    struct payload *pl = (struct payload *) buf;
+    struct recLog *l;
+    uint64_t seq0, pos;
+    const struct payload *p, *last;
+    uint32_t rlen;
+    int j;
+
+    l = rlOpen(path, RL_WRITE | RL_CREATE, segSize);
+    if (l == NULL)
+        errExit("rlOpen");
+    if (rlSetSync(l, mode, batch) == -1)
+        errExit("rlSetSync");
+
+    /* Continue the sequence from the last record in the log */
+
+    seq0 = 0;
+    pos = 0;
+    last = NULL;
+    while ((p = rlNext(l, &pos, &rlen)) != NULL)
+        last = p;
+    if (last != NULL)
+        seq0 = last->seq + 1;
+
+    for (j = 0; j < nrecs; j++) {
+        pl->seq = seq0 + j;
+        pl->when = nowNs();
+        if (rlAppend(l, buf, len) == -1)
+            errExit("rlAppend");
+    }
+    rlClose(l);
+}
+
+static void
+readLog(const char *path, int nrecs, Boolean follow)
+{
+    const struct payload *pl;
+    uint64_t pos, nextSeq, lat, latSum, latMax, bytes, t0;
+    struct recLog *l;
+    long n, gaps;
+    uint32_t len;
+    double secs;
+
+    /* When following, wait for the writer to create the log */
+
+    while ((l = rlOpen(path, 0, 0)) == NULL) {
+        if (!follow || (errno != ENOENT && errno != EINVAL))
+            errExit("rlOpen");
+        usleep(1000);
+    }
+
+    pos = 0;
+    n = gaps = 0;
+    bytes = latSum = latMax = 0;
+    nextSeq = 0;
+    t0 = nowNs();
+    for (;;) {
+        pl = rlNext(l, &pos, &len);
+        if (pl == NULL) {
+            if (!follow || n >= nrecs)
+                break;
+            usleep(100);
+            continue;
+        }
+        if (n > 0 && pl->seq != nextSeq)
+            gaps++;
+        nextSeq = pl->seq + 1;
+        n++;
+        bytes += len;
+        if (follow) {
+            lat = nowNs() - pl->when;
+            latSum += lat;
+            if (lat > latMax)
+                latMax = lat;
+        }
+    }
+    secs = (nowNs() - t0) / 1e9;
+
+    printf("Read %ld records (%.1f MiB) in %.3f s (%.2f M records/s)\n",
+           n, bytes / 1048576.0, secs, n / secs / 1e6);
+    printf("Sequence gaps: %ld\n", gaps);
+    if (follow && n > 0)
+        printf("Append-to-read latency: mean %.1f us, max %.1f us\n",
+               latSum / 1e3 / n, latMax / 1e3);
+    rlClose(l);
+}
+
+int
+main(int argc, char *argv[])
+{
+    Boolean writer, journal, follow;
+    int opt, nrecs, len, mode, batch;
+    size_t segSize;
+    uint64_t t0;
+    char *buf;
+    double secs;
+
+    writer = journal = follow = FALSE;
+    nrecs = 100000;
+    len = 64;
+    mode = RL_SYNC_NONE;
+    batch = 1;
+    segSize = 0;
+    while ((opt = getopt(argc, argv, "wn:l:S:b:g:jf")) != -1) {
+        switch (opt) {
+        case 'w': writer = TRUE;                                        break;
+        case 'n': nrecs = getInt(optarg, GN_GT_0, "-n");                break;
+        case 'l': len = getInt(optarg, GN_GT_0, "-l");                  break;
+        case 'b': batch = getInt(optarg, GN_GT_0, "-b");                break;
+        case 'g': segSize = getLong(optarg, GN_GT_0, "-g") * 1024;      break;
+        case 'j': journal = TRUE;                                       break;
+        case 'f': follow = TRUE;                                        break;
+        case 'S':
+            if (strcmp(optarg, "none") == 0)
+                mode = RL_SYNC_NONE;
+            else if (strcmp(optarg, "async") == 0)
+                mode = RL_SYNC_ASYNC;
+            else if (strcmp(optarg, "sync") == 0)
+                mode = RL_SYNC_SYNC;
+            else
+                usageError(argv[0]);
+            break;
+        default:
+            usageError(argv[0]);
+        }
+    }
+    if (optind != argc - 1)
+        usageError(argv[0]);
+    if (len < (int) sizeof(struct payload))
+        cmdLineErr("Record length must be at least %zu\n",
+                   sizeof(struct payload));
+
+    if (!writer) {
+        readLog(argv[optind], nrecs, follow);
+        exit(EXIT_SUCCESS);
+    }
+
+    buf = malloc(len + sizeof(uint32_t));       /* Room for the length
+                                                   prefix used by -j */
+    if (buf == NULL)
+        errExit("malloc");
+    memset(buf, 'r', len + sizeof(uint32_t));
+    buf += sizeof(uint32_t);
+
+    t0 = nowNs();
+    if (journal)
+        writeJournal(argv[optind], buf, nrecs, len, mode, batch);
+    else
+        writeLog(argv[optind], buf, nrecs, len, mode, batch, segSize);
+    secs = (nowNs() - t0) / 1e9;
+
+    printf("%s: appended %d records of %d bytes in %.3f s "
+           "(%.2f M records/s, %.1f MiB/s)\n", journal ? "write()" : "log",
+           nrecs, len, secs, nrecs / secs / 1e6,
+           (double) nrecs * len / secs / 1048576);
+
+    free(buf - sizeof(uint32_t));
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,344 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* epoll_init.c
+
+   An init(1)-style program, to be used as the init process of a PID
+   namespace (e.g., a container) that runs many short-lived processes.
+
+   Usage: epoll_init [-v]
+          epoll_init -S nprocs [-j concurrent] [cmd [arg...]]
+
+   In the first form, the program reads commands (one per line, expanded
+   with wordexp(3), but without command substitution) from standard input,
+   and launches each one in the background as soon as it is read.
+
+   In the second form, the program is a stress test: it keeps up to
+   'concurrent' (default: 64) children running until 'nprocs' children
+   have been created and reaped, and then reports the throughput. Each
+   child executes 'cmd', or, if no command is given, simply exits.
+
+   Unlike simple_init.c, which reaps its children in a SIGCHLD handler
+   and waits (in pause()) for each command to finish before reading the
+   next, this program:
+
+   * blocks SIGCHLD and accepts it via a signalfd, which is monitored,
+     along with standard input, in an epoll loop, so that neither
+     reaping nor command dispatch ever waits for the other;
+
+   * reaps in batches: since multiple SIGCHLD signals that arrive while
+     one is pending are merged into one, a signalfd notification says
+     only that at least one child has changed state, so each notification
+     is followed by calls to waitid(P_ALL, WEXITED | WNOHANG) until no
+     more terminated children remain. This also reaps orphaned
+     descendants that have been reparented to us (as the init of a PID
+     namespace), which we did not create;
+
+   * launches commands with posix_spawnp(), which (in glibc) uses
+     clone(CLONE_VM | CLONE_VFORK), so that the cost of launching does
+     not grow with the size of the init process.
+
+   For example, to run the stress test as the init of a new PID
+   namespace:
+
+        $ sudo unshare --pid --fork ./epoll_init -S 100000
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <wordexp.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include "tlpi_hdr.h"
+
+static Boolean verbose = FALSE;
+static long running;            /* Children created but not yet reaped */
+static long reaped, batches, max_batch;
+static posix_spawnattr_t spawn_attr;
+
+/* Launch the command in 'cmd'. Returns the child's PID, or -1 on
+   error. */
+
+static pid_t
+spawn_command(char *cmd)
+{
+    wordexp_t we;
+    pid_t pid;
+    int s;
+
+    s = wordexp(cmd, &we, WRDE_NOCMD);
+    if (s != 0) {
+        fprintf(stderr, "init: word expansion failed for: %s\n", cmd);
+        return -1;
+    }
+    if (we.we_wordc == 0) {
+        wordfree(&we);
+        return -1;
+    }
+
+    s = posix_spawnp(&pid, we.we_wordv[0], NULL, &spawn_attr,
+                     we.we_wordv, environ);
+    wordfree(&we);
+    if (s != 0) {
+        fprintf(stderr, "init: %s: %s\n", cmd, strerror(s));
+        return -1;
+    }
+
+    running++;
+    if (verbose)
+        printf("\tinit: created child %ld\n", (long) pid);
+    return pid;
+}
+
+/* Reap all children that have terminated. Returns the number reaped. */
+
+static long
+reap_batch(void)
+{
+    siginfo_t si;
+    long n;
+
+    for (n = 0; ; n++) {
+        si.si_pid = 0;          /* See waitid(2) */
+        if (waitid(P_ALL, 0, &si, WEXITED | WNOHANG) == -1) {
+            if (errno == ECHILD)
+                break;
+            errExit("waitid");
+        }
+        if (si.si_pid == 0)     /* Children remain, but none terminated */
+            break;
+
+        if (verbose)
+            printf("\tinit: PID %ld %s %d\n", (long) si.si_pid,
+                   (si.si_code == CLD_EXITED) ? "exited, status" :
+                   "killed by signal", si.si_status);
+    }
+
+    /* 'running' counts only our own children; reaped orphans are counted
+       only in 'reaped' */
+
+    running = (running > n) ? running - n : 0;
+    reaped += n;
+    if (n > 0) {
+        batches++;
+        if (n > max_batch)
+            max_batch = n;
+    }
+    return n;
+}
+
+/* Read all pending signals from the signalfd 'sfd' */
+
+static void
+drain_signalfd(int sfd)
+{
+    struct signalfd_siginfo fdsi[16];
+
+    while (read(sfd, fdsi, sizeof(fdsi)) > 0)
+        continue;
+    if (errno != EAGAIN)
+        errExit("read-signalfd");
+}
+
+/* Read available input from standard input, and launch each complete
+   line as a command. Returns FALSE on end of file. */
+
+static Boolean
+dispatch_input(void)
+{
+    static char buf[10000];
+    static size_t len = 0;
+    char *line, *nl;
+    ssize_t n;
+
+    n = read(STDIN_FILENO, buf + len, sizeof(buf) - 1 - len);
+    if (n == -1) {
+        if (errno == EINTR)
+            return TRUE;
+        errExit("read-stdin");
+    }
+    if (n == 0 && len == 0)
+        return FALSE;
+    len += n;
+    buf[len] = '\0';
+
+    /* Launch each complete line; at end of file, or if the buffer is
+       full, treat the remainder as a complete line */
+
+    line = buf;
+    while ((nl = strchr(line, '\n')) != NULL ||
+           ((n == 0 || len == sizeof(buf) - 1) && *line != '\0')) {
+        if (nl != NULL)
+            *nl = '\0';
+        if (*line != '\0')
+            spawn_command(line);
+        line = (nl != NULL) ? nl + 1 : buf + len;
+    }
+    len -= line - buf;
+    memmove(buf, line, len);
+
+    return n > 0;
+}
+
+static double
+now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+usage(char *pname)
+{
+    fprintf(stderr, "Usage: %s [-v]\n", pname);
+    fprintf(stderr, "       %s -S nprocs [-j concurrent] [cmd [arg...]]\n",
+            pname);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct epoll_event ev, evlist[8];
+    sigset_t mask, empty;
+    long nprocs, spawned, concurrent;
+    Boolean input_open;
+    double start, elapsed;
+    int sfd, epfd, opt, ready, j;
+    pid_t pid;
+
+    nprocs = 0;
+    concurrent = 64;
+    while ((opt = getopt(argc, argv, "+vS:j:")) != -1) {
+        switch (opt) {
+        case 'v': verbose = TRUE;                               break;
+        case 'S': nprocs = getLong(optarg, GN_GT_0, "-S");      break;
+        case 'j': concurrent = getLong(optarg, GN_GT_0, "-j");  break;
+        default:  usage(argv[0]);
+        }
+    }
+    if (nprocs == 0 && optind < argc)
+        usage(argv[0]);
+
+    /* Accept SIGCHLD via a signalfd; children must not inherit the
+       blocked signal mask */
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+        errExit("sigprocmask");
+    sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sfd == -1)
+        errExit("signalfd");
+
+    sigemptyset(&empty);
+    posix_spawnattr_init(&spawn_attr);
+    posix_spawnattr_setsigmask(&spawn_attr, &empty);
+    posix_spawnattr_setflags(&spawn_attr, POSIX_SPAWN_SETSIGMASK);
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+        errExit("epoll_create1");
+    ev.events = EPOLLIN;
+    ev.data.fd = sfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev) == -1)
+        errExit("epoll_ctl");
+
+    if (verbose)
+        printf("\tinit: my PID is %ld\n", (long) getpid());
+
+    /* Stress test */
+
+    if (nprocs > 0) {
+        spawned = 0;
+        start = now_secs();
+        while (reaped < nprocs) {
+            while (spawned < nprocs && running < concurrent) {
+                if (optind < argc) {
+                    j = posix_spawnp(&pid, argv[optind], NULL, &spawn_attr,
+                                     &argv[optind], environ);
+                    if (j != 0)
+                        errExitEN(j, "posix_spawnp");
+                } else {
+                    pid = fork();
+                    if (pid == -1)
+                        errExit("fork");
+                    if (pid == 0)
+                        _exit(EXIT_SUCCESS);
+                }
+                spawned++;
+                running++;
+            }
+
+            if (epoll_wait(epfd, evlist, 8, -1) == -1 && errno != EINTR)
+                errExit("epoll_wait");
+            drain_signalfd(sfd);
+            reap_batch();
+        }
+        elapsed = now_secs() - start;
+
+        printf("%ld processes created and reaped in %.3f secs: "
+               "%.0f/sec\n", spawned, elapsed, spawned / elapsed);
+        printf("%ld reap batches (average %.1f, maximum %ld children)\n",
+               batches, (double) reaped / batches, max_batch);
+        exit(EXIT_SUCCESS);
+    }
+
+    /* Command loop: launch commands as they are read, and reap children
+       as they terminate; after end of file on standard input, wait for
+       the remaining children */
+
+    input_open = TRUE;
+    ev.events = EPOLLIN;
+    ev.data.fd = STDIN_FILENO;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == -1) {
+
+        /* epoll can't monitor a regular file (EPERM); a regular file is
+           always readable, so just read it all now */
+
+        if (errno != EPERM)
+            errExit("epoll_ctl");
+        while (dispatch_input())
+            continue;
+        input_open = FALSE;
+    }
+
+    while (input_open || running > 0) {
+        ready = epoll_wait(epfd, evlist, 8, -1);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("epoll_wait");
+        }
+
+        for (j = 0; j < ready; j++) {
+            if (evlist[j].data.fd == sfd) {
+                drain_signalfd(sfd);
+                reap_batch();
+            } else if (!dispatch_input()) {
+                if (epoll_ctl(epfd, EPOLL_CTL_DEL, STDIN_FILENO, NULL) == -1)
+                    errExit("epoll_ctl");
+                input_open = FALSE;
+            }
+        }
+    }
+
+    if (verbose)
+        printf("\tinit: exiting after reaping %ld children\n", reaped);
+    exit(EXIT_SUCCESS);
+}
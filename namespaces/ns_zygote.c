@@ -0,0 +1,432 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* ns_zygote.c
+
+   Launch many short-lived jobs, each in its own user, mount, and network
+   namespaces, and measure the launch latency (the time from the start of
+   fork() until the child is running inside the namespaces).
+
+   Usage: ns_zygote [-m pool|fresh] [-n jobs] [-j concurrent] [-P pool-size]
+                    [-R reuse] [-c] [cmd [arg...]]
+
+        -m mode      "fresh": each job's child calls unshare() to create
+                     new namespaces, and the parent writes its UID and GID
+                     maps, as userns_child_exec.c does.
+                     "pool" (default): sets of namespaces are created in
+                     advance, and held open by file descriptors; each
+                     job's child joins a set with setns(), as ns_exec.c
+                     does for a single namespace.
+        -n jobs      Number of jobs to launch (default: 1000)
+        -j concurrent  Maximum number of jobs running at once (default: 1)
+        -P pool-size Number of namespace sets in the pool (default: the
+                     value of -j); each set is used by one job at a time
+        -R reuse     Recycle a set after it has been used by this many
+                     jobs: the set is closed (so that the kernel can
+                     destroy the namespaces once the last member has
+                     gone) and replaced by a fresh one (default: 100;
+                     0 means reuse without limit)
+        -c           In pool mode, have each child also unshare its mount
+                     namespace after joining the set, so that the job
+                     works on a private copy of the mount table, and
+                     mounts made by one job are not seen by the next job
+                     that uses the same set
+
+   If 'cmd' is specified, each child executes it; otherwise the child
+   simply exits once it is inside the namespaces.
+
+   Creating the namespaces (in particular, the network namespace) and
+   writing the ID maps costs hundreds of microseconds, or milliseconds
+   on a loaded system, while joining existing namespaces with setns()
+   costs a few microseconds, so that in pool mode the launch latency is
+   dominated by the cost of fork(). The pool moves the creation cost out
+   of the launch path. The price is that
+   state left behind by one job (network interfaces, sockets bound to
+   abstract names, mounts when -c is not used) is visible to later jobs
+   that use the same set; the -R limit bounds how long such state can
+   accumulate. (A production launcher would also refill the pool from a
+   separate process, rather than when a job is reaped, as here.)
+
+   The user namespace in each set has a single mapping that maps root in
+   the namespace to the caller's UID (and likewise for the GID), so that
+   the jobs run with UID 0 and full capabilities inside the namespaces.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "scm_functions.h"
+#include "userns_functions.h"
+#include "tlpi_hdr.h"
+
+#define NS_CNT 3
+
+static const struct {
+    const char *name;           /* Name in /proc/PID/ns */
+    int type;                   /* CLONE_NEW* constant */
+} ns_types[NS_CNT] = {
+    { "user", CLONE_NEWUSER },  /* Must be first: the other namespaces */
+    { "mnt",  CLONE_NEWNS },    /* are owned by this one, and joining it */
+    { "net",  CLONE_NEWNET },   /* gives us the capabilities needed to */
+};                              /* join them */
+
+struct ns_set {
+    int fd[NS_CNT];             /* Open /proc/PID/ns files */
+    int uses;                   /* Number of jobs that have used the set */
+    Boolean busy;               /* In use by a running job? */
+};
+
+struct job_slot {
+    pid_t pid;                  /* Child running the job, or 0 */
+    int set;                    /* Index of set used by the job, or -1 */
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Create a child process in new user, mount, and network namespaces.
+   As with fork(), returns the child's PID in the parent, and 0 in the
+   child. The parent writes the child's UID and GID maps, as in
+   userns_child_exec.c (since Linux 5.12, a process can't itself write a
+   mapping for root in a namespace that it has created, unless it has
+   CAP_SETFCAP in the parent namespace), so the child waits until the
+   parent closes a pipe to say that this has been done. */
+
+static pid_t
+fork_new_namespaces(void)
+{
+    char map_path[PATH_MAX], map_buf[64], ch;
+    int to_parent[2], to_child[2];
+    pid_t pid;
+
+    if (pipe2(to_parent, O_CLOEXEC) == -1)
+        errExit("pipe2");
+    if (pipe2(to_child, O_CLOEXEC) == -1)
+        errExit("pipe2");
+
+    pid = fork();
+    if (pid == -1)
+        errExit("fork");
+
+    if (pid == 0) {
+        close(to_parent[0]);
+        close(to_child[1]);
+
+        if (unshare(CLONE_NEWUSER) == -1)
+            errExit("unshare-CLONE_NEWUSER");
+        if (write(to_parent[1], "x", 1) != 1)
+            errExit("write");
+        if (read(to_child[0], &ch, 1) != 0)     /* Wait for EOF */
+            fatal("Unexpected data from parent");
+        close(to_parent[1]);
+        close(to_child[0]);
+
+        if (unshare(CLONE_NEWNS | CLONE_NEWNET) == -1)
+            errExit("unshare-CLONE_NEWNS|CLONE_NEWNET");
+
+        /* Ensure that mounts made by jobs don't propagate to the parent
+           mount namespace */
+
+        if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) == -1)
+            errExit("mount-MS_PRIVATE");
+
+        return 0;
+    }
+
+    close(to_parent[1]);
+    close(to_child[0]);
+
+    if (read(to_parent[0], &ch, 1) != 1)
+        fatal("Child failed to create a user namespace");
+
+    snprintf(map_buf, sizeof(map_buf), "0 %ld 1", (long) geteuid());
+    snprintf(map_path, sizeof(map_path), "/proc/%ld/uid_map", (long) pid);
+    if (update_map(map_buf, map_path) == -1)
+        fatal("update_map: uid_map");
+
+    if (proc_setgroups_write(pid, "deny") == -1)
+        fatal("proc_setgroups_write");
+
+    snprintf(map_buf, sizeof(map_buf), "0 %ld 1", (long) getegid());
+    snprintf(map_path, sizeof(map_path), "/proc/%ld/gid_map", (long) pid);
+    if (update_map(map_buf, map_path) == -1)
+        fatal("update_map: gid_map");
+
+    close(to_parent[0]);
+    close(to_child[1]);         /* Child continues */
+
+    return pid;
+}
+
+/* Create a set of namespaces for the pool: a helper child creates the
+   namespaces, and passes back file descriptors that refer to them.
+   The namespaces persist after the helper has terminated, for as long
+   as the descriptors remain open. */
+
+static void
+create_ns_set(struct ns_set *s)
+{
+    char path[PATH_MAX];
+    int sv[2], nfds, j;
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+        errExit("socketpair");
+
+    pid = fork_new_namespaces();
+    if (pid == 0) {
+        for (j = 0; j < NS_CNT; j++) {
+            snprintf(path, sizeof(path), "/proc/self/ns/%s",
+                     ns_types[j].name);
+            s->fd[j] = open(path, O_RDONLY | O_CLOEXEC);
+            if (s->fd[j] == -1)
+                errExit("open");
+        }
+        if (sendfds(sv[1], s->fd, NS_CNT, NULL, 0, 0) == -1)
+            errExit("sendfds");
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(sv[1]);
+    nfds = NS_CNT;
+    if (recvfds(sv[0], s->fd, &nfds, NULL, 0, NULL) == -1)
+        errExit("recvfds");
+    if (nfds != NS_CNT)
+        fatal("Namespace helper sent %d descriptors", nfds);
+    close(sv[0]);
+
+    if (waitpid(pid, NULL, 0) == -1)
+        errExit("waitpid");
+
+    s->uses = 0;
+    s->busy = FALSE;
+}
+
+static void
+close_ns_set(struct ns_set *s)
+{
+    int j;
+
+    for (j = 0; j < NS_CNT; j++)
+        close(s->fd[j]);
+}
+
+/* Code executed by the child that runs a job. If 's' is NULL, the
+   child was created in fresh namespaces; otherwise, join those in 's'. */
+
+static void
+run_job(struct ns_set *s, Boolean copy_mnt, uint64_t *ready, char *argv[])
+{
+    int j;
+
+    if (s != NULL) {
+        for (j = 0; j < NS_CNT; j++)
+            if (setns(s->fd[j], ns_types[j].type) == -1)
+                errExit("setns");
+        if (copy_mnt && unshare(CLONE_NEWNS) == -1)
+            errExit("unshare-CLONE_NEWNS");
+    }
+
+    *ready = now_ns();
+
+    if (argv[0] != NULL) {
+        execvp(argv[0], argv);
+        errExit("execvp");
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+usage(char *pname)
+{
+    fprintf(stderr, "Usage: %s [-m pool|fresh] [-n jobs] [-j concurrent] "
+            "[-P pool-size]\n\t\t[-R reuse] [-c] [cmd [arg...]]\n", pname);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    Boolean pool, copy_mnt;
+    int njobs, max_running, pool_size, reuse, opt, job, running, failed;
+    int recycled, slot, status, j;
+    struct ns_set *sets;
+    struct job_slot *slots;
+    uint64_t *start, *ready, t0, pool_ns, elapsed_ns;
+    pid_t pid;
+
+    pool = TRUE;
+    copy_mnt = FALSE;
+    njobs = 1000;
+    max_running = 1;
+    pool_size = 0;
+    reuse = 100;
+
+    /* The initial '+' character in the final getopt() argument prevents
+       GNU-style permutation of command-line options, since 'cmd' may
+       itself have options */
+
+    while ((opt = getopt(argc, argv, "+m:n:j:P:R:c")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "pool") == 0)
+                pool = TRUE;
+            else if (strcmp(optarg, "fresh") == 0)
+                pool = FALSE;
+            else
+                usage(argv[0]);
+            break;
+        case 'n': njobs = getInt(optarg, GN_GT_0, "-n");        break;
+        case 'j': max_running = getInt(optarg, GN_GT_0, "-j");  break;
+        case 'P': pool_size = getInt(optarg, GN_GT_0, "-P");    break;
+        case 'R': reuse = getInt(optarg, GN_NONNEG, "-R");      break;
+        case 'c': copy_mnt = TRUE;                              break;
+        default:  usage(argv[0]);
+        }
+    }
+
+    if (pool_size == 0)
+        pool_size = max_running;
+    if (pool && pool_size < max_running)
+        cmdLineErr("Pool size (%d) must be at least the number of "
+                   "concurrent jobs (%d)\n", pool_size, max_running);
+
+    /* The children record the time at which they are ready in shared
+       memory */
+
+    ready = mmap(NULL, njobs * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ready == MAP_FAILED)
+        errExit("mmap");
+    start = calloc(njobs, sizeof(uint64_t));
+    slots = calloc(max_running, sizeof(struct job_slot));
+    sets = calloc(pool_size, sizeof(struct ns_set));
+    if (start == NULL || slots == NULL || sets == NULL)
+        errExit("calloc");
+
+    pool_ns = 0;
+    if (pool) {
+        t0 = now_ns();
+        for (j = 0; j < pool_size; j++)
+            create_ns_set(&sets[j]);
+        pool_ns = now_ns() - t0;
+        printf("Created %d namespace sets in %.3f ms (%.1f us per set)\n",
+               pool_size, pool_ns / 1e6, pool_ns / 1e3 / pool_size);
+    }
+
+    failed = 0;
+    recycled = 0;
+    running = 0;
+    t0 = now_ns();
+
+    for (job = 0; job < njobs || running > 0; ) {
+
+        /* Launch another job if we can */
+
+        if (job < njobs && running < max_running) {
+            for (slot = 0; slots[slot].pid != 0; slot++)
+                continue;
+
+            slots[slot].set = -1;
+            if (pool) {
+                for (j = 0; sets[j].busy; j++)
+                    continue;
+                sets[j].busy = TRUE;
+                slots[slot].set = j;
+            }
+
+            start[job] = now_ns();
+            if (pool) {
+                pid = fork();
+                if (pid == -1)
+                    errExit("fork");
+            } else {
+                pid = fork_new_namespaces();
+            }
+            if (pid == 0)
+                run_job(pool ? &sets[slots[slot].set] : NULL, copy_mnt,
+                        &ready[job], &argv[optind]);
+
+            slots[slot].pid = pid;
+            running++;
+            job++;
+            continue;
+        }
+
+        /* Otherwise, reap a job and release its namespace set */
+
+        pid = waitpid(-1, &status, 0);
+        if (pid == -1)
+            errExit("waitpid");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed++;
+
+        for (slot = 0; slots[slot].pid != pid; slot++)
+            continue;
+        slots[slot].pid = 0;
+        running--;
+
+        j = slots[slot].set;
+        if (j >= 0) {
+            sets[j].busy = FALSE;
+            if (++sets[j].uses == reuse) {
+                close_ns_set(&sets[j]);
+                create_ns_set(&sets[j]);
+                recycled++;
+            }
+        }
+    }
+
+    elapsed_ns = now_ns() - t0;
+
+    /* Compute the launch latencies; a child that failed before becoming
+       ready has a zero entry, and is excluded */
+
+    for (j = 0, job = 0; job < njobs; job++)
+        if (ready[job] != 0)
+            start[j++] = ready[job] - start[job];
+    qsort(start, j, sizeof(uint64_t), cmp_u64);
+
+    printf("Mode %s: %d jobs (%d failed) in %.3f secs: %.0f jobs/sec\n",
+           pool ? "pool" : "fresh", njobs, failed, elapsed_ns / 1e9,
+           njobs / (elapsed_ns / 1e9));
+    if (pool)
+        printf("Namespace sets recycled: %d\n", recycled);
+    if (j > 0)
+        printf("Launch latency (us): min %.1f  median %.1f  "
+               "p99 %.1f  max %.1f\n", start[0] / 1e3, start[j / 2] / 1e3,
+               start[(j - 1) * 99 / 100] / 1e3, start[j - 1] / 1e3);
+
+    exit((failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,353 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* barrier_bench.c
+
+   Measure how long it takes a group of processes to pass through a
+   barrier, using several mechanisms.
+
+   Usage: barrier_bench [-m method]... [-p nprocs] [-n phases] [-w usecs]
+
+        -m method    One of:
+                       futex    proc_barrier.c, PB_FUTEX
+                       eventfd  proc_barrier.c, PB_EVENTFD
+                       pthread  a pthread barrier in shared memory, with
+                                the PTHREAD_PROCESS_SHARED attribute
+                       pipe     the technique of pipe_sync.c: in each
+                                phase, the children close a pipe's write
+                                end, and the parent waits for end-of-file;
+                                the parent then releases the children in
+                                the same way with a second pipe
+                     This option may be repeated; the default is to run
+                     each method in turn.
+        -p nprocs    Number of processes, including the parent (default: 4)
+        -n phases    Number of phases (default: 20000)
+        -w usecs     Each process spins for 'usecs' microseconds in each
+                     phase, before arriving at the barrier (default: 0)
+
+   The parent creates nprocs - 1 children, and all of the processes then
+   pass through the barrier 'phases' times (after one untimed phase, in
+   which the processes start up). For each method, the program reports
+   the mean time per phase, percentiles of the time taken by each phase
+   as seen by the parent, and the CPU time (user + system, summed over
+   all processes) consumed per phase.
+
+   Since pipe_sync.c's technique is one-shot, the "pipe" method needs two
+   pipes (four file descriptors in each process) per phase, all created
+   before the children; the number of phases is limited accordingly (the
+   program raises its RLIMIT_NOFILE soft limit to the hard limit).
+
+   This program is Linux-specific.
+*/
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <time.h>
+#include "proc_barrier.h"
+#include "lat_hist.h"
+#include "tlpi_hdr.h"
+
+enum method { M_FUTEX, M_EVENTFD, M_PTHREAD, M_PIPE, NUM_METHODS };
+
+static const char *methodNames[NUM_METHODS] = {
+    "futex", "eventfd", "pthread", "pipe"
+};
+
+static struct procBarrier pb;           /* M_FUTEX, M_EVENTFD */
+static pthread_barrier_t *pbar;         /* M_PTHREAD */
+static int (*pipes)[4];                 /* M_PIPE: per phase, arrival
+                                           pipe (read, write) and release
+                                           pipe (read, write) */
+static long workUsecs;
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double
+cpuSecs(int who)
+{
+    struct rusage ru;
+
+    if (getrusage(who, &ru) == -1)
+        errExit("getrusage");
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/* Pass through the barrier for phase 'k' ('isParent' says which side of
+   the pipes we use) */
+
+static void
+barrier(enum method m, long k, Boolean isParent)
+{
+    char ch;
+    int s;
+
+    switch (m) {
+    case M_FUTEX:
+    case M_EVENTFD:
+        if (pbWait(&pb, -1) == -1)
+            errExit("pbWait");
+        break;
+
+    case M_PTHREAD:
+        s = pthread_barrier_wait(pbar);
+        if (s != 0 && s != PTHREAD_BARRIER_SERIAL_THREAD)
+            errExitEN(s, "pthread_barrier_wait");
+        break;
+
+    case M_PIPE:
+        if (isParent) {
+            if (read(pipes[k][0], &ch, 1) != 0)     /* Wait for EOF */
+                fatal("Unexpected data on pipe");
+            close(pipes[k][0]);
+            close(pipes[k][3]);                     /* Release children */
+        } else {
+            close(pipes[k][1]);                     /* Arrive */
+            if (read(pipes[k][2], &ch, 1) != 0)     /* Wait for EOF */
+                fatal("Unexpected data on pipe");
+            close(pipes[k][2]);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* Close the pipe ends that the parent or a child doesn't use, so that
+   closing the others produces end-of-file */
+
+static void
+closeUnusedEnds(long phases, Boolean isParent)
+{
+    long k;
+
+    for (k = 0; k < phases; k++) {
+        if (isParent) {
+            close(pipes[k][1]);
+            close(pipes[k][2]);
+        } else {
+            close(pipes[k][0]);
+            close(pipes[k][3]);
+        }
+    }
+}
+
+static void
+spin(void)
+{
+    long long start;
+
+    if (workUsecs > 0)
+        for (start = nowNs(); nowNs() - start < workUsecs * 1000; )
+            continue;
+}
+
+static void
+runMethod(enum method m, int nprocs, long phases)
+{
+    pthread_barrierattr_t attr;
+    struct latHist *hist;
+    long long t0, prev, now;
+    double cpu0, cpu1;
+    long k;
+    int j, s;
+
+    hist = malloc(sizeof(struct latHist));
+    if (hist == NULL)
+        errExit("malloc");
+    latHistInit(hist);
+
+    switch (m) {
+    case M_FUTEX:
+    case M_EVENTFD:
+        if (pbInit(&pb, (m == M_FUTEX) ? PB_FUTEX : PB_EVENTFD,
+                   nprocs) == -1)
+            errExit("pbInit");
+        break;
+
+    case M_PTHREAD:
+        pbar = mmap(NULL, sizeof(pthread_barrier_t), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (pbar == MAP_FAILED)
+            errExit("mmap");
+        s = pthread_barrierattr_init(&attr);
+        if (s != 0)
+            errExitEN(s, "pthread_barrierattr_init");
+        s = pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        if (s != 0)
+            errExitEN(s, "pthread_barrierattr_setpshared");
+        s = pthread_barrier_init(pbar, &attr, nprocs);
+        if (s != 0)
+            errExitEN(s, "pthread_barrier_init");
+        pthread_barrierattr_destroy(&attr);
+        break;
+
+    case M_PIPE:
+        pipes = calloc(phases + 1, sizeof(*pipes));
+        if (pipes == NULL)
+            errExit("calloc");
+        for (k = 0; k <= phases; k++)
+            if (pipe(&pipes[k][0]) == -1 || pipe(&pipes[k][2]) == -1)
+                errExit("pipe");
+        break;
+
+    default:
+        break;
+    }
+
+    cpu0 = cpuSecs(RUSAGE_SELF) + cpuSecs(RUSAGE_CHILDREN);
+
+    /* Phase 0 is untimed; phases 1..'phases' are timed */
+
+    for (j = 1; j < nprocs; j++) {
+        switch (fork()) {
+        case -1:
+            errExit("fork");
+        case 0:
+            if (m == M_PIPE)
+                closeUnusedEnds(phases + 1, FALSE);
+            for (k = 0; k <= phases; k++) {
+                if (k > 0)
+                    spin();
+                barrier(m, k, FALSE);
+            }
+            _exit(EXIT_SUCCESS);
+        default:
+            break;
+        }
+    }
+
+    if (m == M_PIPE)
+        closeUnusedEnds(phases + 1, TRUE);
+    barrier(m, 0, TRUE);
+
+    t0 = prev = nowNs();
+    for (k = 1; k <= phases; k++) {
+        spin();
+        barrier(m, k, TRUE);
+        now = nowNs();
+        latHistRecord(hist, now - prev);
+        prev = now;
+    }
+
+    for (j = 1; j < nprocs; j++)
+        if (wait(NULL) == -1)
+            errExit("wait");
+    cpu1 = cpuSecs(RUSAGE_SELF) + cpuSecs(RUSAGE_CHILDREN);
+
+    printf("%-8s %10.0f %10.1f %10.1f %10.1f %10.1f\n", methodNames[m],
+           (double) (prev - t0) / phases,
+           latHistPercentile(hist, 0.50) / 1000.0,
+           latHistPercentile(hist, 0.99) / 1000.0, hist->max / 1000.0,
+           (cpu1 - cpu0) * 1e6 / phases);
+
+    switch (m) {
+    case M_FUTEX:
+    case M_EVENTFD:
+        pbDestroy(&pb);
+        break;
+    case M_PTHREAD:
+        pthread_barrier_destroy(pbar);
+        munmap(pbar, sizeof(pthread_barrier_t));
+        break;
+    case M_PIPE:
+        free(pipes);
+        break;
+    default:
+        break;
+    }
+    free(hist);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-m method]... [-p nprocs] [-n phases] "
+            "[-w usecs]\n", progName);
+    fprintf(stderr, "        method is futex, eventfd, pthread, or pipe\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    Boolean run[NUM_METHODS], any;
+    struct rlimit rl;
+    long phases, pipePhases;
+    int opt, nprocs, m;
+
+    memset(run, 0, sizeof(run));
+    any = FALSE;
+    nprocs = 4;
+    phases = 20000;
+    while ((opt = getopt(argc, argv, "m:p:n:w:")) != -1) {
+        switch (opt) {
+        case 'm':
+            for (m = 0; m < NUM_METHODS; m++)
+                if (strcmp(optarg, methodNames[m]) == 0)
+                    break;
+            if (m == NUM_METHODS)
+                usageError(argv[0]);
+            run[m] = TRUE;
+            any = TRUE;
+            break;
+        case 'p':   nprocs = getInt(optarg, GN_GT_0, "-p");         break;
+        case 'n':   phases = getLong(optarg, GN_GT_0, "-n");        break;
+        case 'w':   workUsecs = getLong(optarg, GN_NONNEG, "-w");   break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+    if (!any)
+        for (m = 0; m < NUM_METHODS; m++)
+            run[m] = TRUE;
+
+    /* Each phase of the "pipe" method needs four descriptors */
+
+    pipePhases = phases;
+    if (run[M_PIPE]) {
+        if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+            errExit("getrlimit");
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+            errExit("setrlimit");
+        if (rl.rlim_cur != RLIM_INFINITY &&
+                (long) (rl.rlim_cur - 32) / 4 - 1 < phases) {
+            pipePhases = (long) (rl.rlim_cur - 32) / 4 - 1;
+            if (pipePhases < 1)
+                fatal("RLIMIT_NOFILE is too low for the pipe method");
+            printf("(pipe method limited to %ld phases by RLIMIT_NOFILE)\n",
+                   pipePhases);
+        }
+    }
+
+    printf("%d processes, %ld phases, %ld usecs of work per phase\n\n",
+           nprocs, phases, workUsecs);
+    printf("%-8s %10s %10s %10s %10s %10s\n", "method", "ns/phase",
+           "p50-us", "p99-us", "max-us", "cpu-us");
+    for (m = 0; m < NUM_METHODS; m++)
+        if (run[m])
+            runMethod(m, nprocs, (m == M_PIPE) ? pipePhases : phases);
+
+    exit(EXIT_SUCCESS);
+}
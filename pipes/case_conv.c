@@ -0,0 +1,262 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* case_conv.c
+
+   Convert the ASCII letters in a buffer, in place, to uppercase
+   (caseToUpper()) or lowercase (caseToLower()). All other bytes
+   (including those with the top bit set) are unchanged, so that the
+   result is the same as applying toupper() or tolower() to each byte in
+   the "C" locale. Calling toupper() per byte costs a function call and a
+   locale table lookup; these functions instead convert 8, 16, or 32
+   bytes at a time, testing all of the bytes of a word or vector register
+   for the range of letters at once and flipping the case bit (0x20) of
+   those that are in the range.
+
+   There are several implementations:
+
+        scalar  one byte at a time
+        swar    eight bytes at a time, in a 64-bit integer
+        sse2    16 bytes at a time (x86)
+        avx2    32 bytes at a time (x86, if supported by the CPU)
+        neon    16 bytes at a time (ARM)
+
+   The implementation is chosen at the first call, according to what the
+   CPU supports; caseConvSetImpl() can be used to select a particular one
+   (e.g., for benchmarking; see case_conv_bench.c).
+*/
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "case_conv.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2                       /* Can compile AVX2 code */
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* Each of the following functions flips the case bit of the bytes in
+   'buf' that are in the range 'first' to 'first' + 25 */
+
+static void
+convScalar(char *buf, size_t len, unsigned char first)
+{
+    unsigned char *p = (unsigned char *) buf;
+    size_t j;
+
+    for (j = 0; j < len; j++)
+        p[j] ^= ((unsigned char) (p[j] - first) < 26) << 5;
+}
+
+/* Handle 64-bit words. For each byte of 'w', the sums below compute (in
+   bit 7 of the byte) whether its low 7 bits are >= 'first' and > 'first'
+   + 25; adding to the low 7 bits can't carry into the next byte. Bytes
+   with the top bit set are excluded. */
+
+static size_t
+convWords(char *buf, size_t len, unsigned char first)
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    uint64_t w, low7, ge, gt, mask;
+    size_t j;
+
+    for (j = 0; j + 8 <= len; j += 8) {
+        memcpy(&w, buf + j, 8);
+        low7 = w & (0x7f * ones);
+        ge = low7 + (0x80 - first) * ones;
+        gt = low7 + (0x80 - first - 26) * ones;
+        mask = ge & ~gt & ~w & (0x80 * ones);
+        w ^= mask >> 2;                         /* 0x80 >> 2 == 0x20 */
+        memcpy(buf + j, &w, 8);
+    }
+    return j;
+}
+
+static void
+convSwar(char *buf, size_t len, unsigned char first)
+{
+    size_t j;
+
+    j = convWords(buf, len, first);
+    convScalar(buf + j, len - j, first);
+}
+
+/* The vector implementations use a single signed comparison per vector:
+   adding (-128 - 'first') maps the range of letters to -128..-103 */
+
+#if defined(__SSE2__)
+static void
+convSse2(char *buf, size_t len, unsigned char first)
+{
+    const __m128i bias = _mm_set1_epi8((char) (0x80 - first));
+    const __m128i limit = _mm_set1_epi8((char) (0x80 + 26));
+    const __m128i bit = _mm_set1_epi8(0x20);
+    __m128i v, in;
+    size_t j;
+
+    for (j = 0; j + 16 <= len; j += 16) {
+        v = _mm_loadu_si128((const __m128i *) (buf + j));
+        in = _mm_cmplt_epi8(_mm_add_epi8(v, bias), limit);
+        v = _mm_xor_si128(v, _mm_and_si128(in, bit));
+        _mm_storeu_si128((__m128i *) (buf + j), v);
+    }
+    convSwar(buf + j, len - j, first);
+}
+#endif
+
+#ifdef HAVE_AVX2
+__attribute__((target("avx2")))
+static void
+convAvx2(char *buf, size_t len, unsigned char first)
+{
+    const __m256i bias = _mm256_set1_epi8((char) (0x80 - first));
+    const __m256i limit = _mm256_set1_epi8((char) (0x80 + 26));
+    const __m256i bit = _mm256_set1_epi8(0x20);
+    __m256i v, in;
+    size_t j;
+
+    /* AVX2 has only a "greater than" byte comparison */
+
+    for (j = 0; j + 32 <= len; j += 32) {
+        v = _mm256_loadu_si256((const __m256i *) (buf + j));
+        in = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(v, bias));
+        v = _mm256_xor_si256(v, _mm256_and_si256(in, bit));
+        _mm256_storeu_si256((__m256i *) (buf + j), v);
+    }
+    convSwar(buf + j, len - j, first);
+}
+#endif
+
+#if defined(__ARM_NEON)
+static void
+convNeon(char *buf, size_t len, unsigned char first)
+{
+    const uint8x16_t base = vdupq_n_u8(first);
+    const uint8x16_t count = vdupq_n_u8(26);
+    const uint8x16_t bit = vdupq_n_u8(0x20);
+    uint8x16_t v, in;
+    size_t j;
+
+    /* NEON has unsigned comparisons, so no bias is needed */
+
+    for (j = 0; j + 16 <= len; j += 16) {
+        v = vld1q_u8((const uint8_t *) (buf + j));
+        in = vcltq_u8(vsubq_u8(v, base), count);
+        v = veorq_u8(v, vandq_u8(in, bit));
+        vst1q_u8((uint8_t *) (buf + j), v);
+    }
+    convSwar(buf + j, len - j, first);
+}
+#endif
+
+static int
+haveAvx2(void)
+{
+#ifdef HAVE_AVX2
+    return __builtin_cpu_supports("avx2");
+#else
+    return 0;
+#endif
+}
+
+static const struct {
+    const char *name;
+    void (*conv)(char *buf, size_t len, unsigned char first);
+    int (*supported)(void);             /* NULL means always supported */
+} impls[] = {                           /* In decreasing order of speed */
+#ifdef HAVE_AVX2
+    { "avx2",   convAvx2,   haveAvx2 },
+#endif
+#if defined(__SSE2__)
+    { "sse2",   convSse2,   NULL },
+#endif
+#if defined(__ARM_NEON)
+    { "neon",   convNeon,   NULL },
+#endif
+    { "swar",   convSwar,   NULL },
+    { "scalar", convScalar, NULL },
+};
+
+#define NIMPLS (sizeof(impls) / sizeof(impls[0]))
+
+static int currImpl = -1;               /* Index in 'impls', or -1 */
+
+/* Select the fastest implementation supported by the CPU. (If several
+   threads call this at once, they all store the same value.) */
+
+static int
+selectImpl(void)
+{
+    int j;
+
+    for (j = 0; j < NIMPLS - 1; j++)
+        if (impls[j].supported == NULL || impls[j].supported())
+            break;
+    currImpl = j;
+    return j;
+}
+
+void
+caseToUpper(char *buf, size_t len)
+{
+    impls[currImpl >= 0 ? currImpl : selectImpl()].conv(buf, len, 'a');
+}
+
+void
+caseToLower(char *buf, size_t len)
+{
+    impls[currImpl >= 0 ? currImpl : selectImpl()].conv(buf, len, 'A');
+}
+
+/* Return the name of the implementation in use */
+
+const char *
+caseConvImpl(void)
+{
+    return impls[currImpl >= 0 ? currImpl : selectImpl()].name;
+}
+
+/* Use the implementation 'name', or, if 'name' is NULL, the fastest one
+   supported by the CPU. Returns 0 on success, or -1 with errno set to
+   EINVAL if there is no such implementation in this build, or ENOTSUP
+   if the CPU does not support it. */
+
+int
+caseConvSetImpl(const char *name)
+{
+    int j;
+
+    if (name == NULL) {
+        selectImpl();
+        return 0;
+    }
+
+    for (j = 0; j < NIMPLS; j++) {
+        if (strcmp(name, impls[j].name) == 0) {
+            if (impls[j].supported != NULL && !impls[j].supported()) {
+                errno = ENOTSUP;
+                return -1;
+            }
+            currImpl = j;
+            return 0;
+        }
+    }
+
+    errno = EINVAL;
+    return -1;
+}
@@ -0,0 +1,30 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* case_conv.h
+
+   Header file for case_conv.c.
+*/
+#ifndef CASE_CONV_H
+#define CASE_CONV_H             /* Prevent accidental double inclusion */
+
+#include <stddef.h>
+
+void caseToUpper(char *buf, size_t len);
+
+void caseToLower(char *buf, size_t len);
+
+const char *caseConvImpl(void);
+
+int caseConvSetImpl(const char *name);
+
+#endif
@@ -0,0 +1,230 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* case_conv_bench.c
+
+   Compare the throughput of the case conversion functions in
+   case_conv.c, in each of their implementations, with that of calling
+   toupper() and tolower() for each byte (as change_case.c once did).
+
+   Usage: case_conv_bench [-n MiB] [-s size[,size...]] [-i impl[,impl...]]
+
+        -n MiB    Amount of data converted in each test (default: 1024)
+        -s size   Comma-separated list of buffer sizes, in bytes
+                  (default: 64,256,4096,65536,1048576)
+        -i impl   Comma-separated list of implementations: "toupper" or
+                  any of those listed in case_conv.c (default: toupper,
+                  scalar, swar, sse2, avx2, neon). Implementations that are
+                  not available in this build or on this CPU are skipped.
+
+   Each test repeatedly converts a buffer of random bytes (mostly ASCII
+   letters) to uppercase and back to lowercase, and reports the rate in
+   GB/s. Before the tests, each implementation is checked against
+   toupper() and tolower() for all byte values and a range of lengths and
+   alignments.
+*/
+#include <ctype.h>
+#include <time.h>
+#include "case_conv.h"
+#include "tlpi_hdr.h"
+
+#define MAX_SIZES 16
+#define MAX_IMPLS 16
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+libcToUpper(char *buf, size_t len)
+{
+    size_t j;
+
+    for (j = 0; j < len; j++)
+        buf[j] = toupper((unsigned char) buf[j]);
+}
+
+static void
+libcToLower(char *buf, size_t len)
+{
+    size_t j;
+
+    for (j = 0; j < len; j++)
+        buf[j] = tolower((unsigned char) buf[j]);
+}
+
+/* Check the current case_conv.c implementation against toupper() and
+   tolower() for buffers of every length up to 100 bytes, at several
+   alignments. Returns FALSE if a result differs. */
+
+static Boolean
+verify(void)
+{
+    char in[128], a[128], b[128];
+    size_t len, off;
+    int j;
+
+    for (j = 0; j < sizeof(in); j++)
+        in[j] = (char) (j * 2 + (j & 1) * 128);        /* All byte values */
+
+    for (len = 0; len <= 100; len++) {
+        for (off = 0; off < 8; off++) {
+            memcpy(a, in + off, len);
+            memcpy(b, in + off, len);
+            caseToUpper(a, len);
+            libcToUpper(b, len);
+            if (memcmp(a, b, len) != 0)
+                return FALSE;
+            caseToLower(a, len);
+            libcToLower(b, len);
+            if (memcmp(a, b, len) != 0)
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n MiB] [-s size[,size...]] "
+            "[-i impl[,impl...]]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *defImpls[] = { "toupper", "scalar", "swar", "sse2", "avx2",
+                               "neon" };
+    const char *impls[MAX_IMPLS];
+    long sizes[MAX_SIZES], maxSize;
+    long long total, done;
+    int opt, nsizes, nimpls, j, k;
+    char *buf, *tok;
+    double start, secs;
+    Boolean libc;
+
+    total = 1024LL * 1024 * 1024;
+    nsizes = nimpls = 0;
+    while ((opt = getopt(argc, argv, "n:s:i:")) != -1) {
+        switch (opt) {
+        case 'n':
+            total = getLong(optarg, GN_GT_0, "MiB") * 1024LL * 1024;
+            break;
+        case 's':
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                if (nsizes == MAX_SIZES)
+                    cmdLineErr("Too many sizes (max %d)\n", MAX_SIZES);
+                sizes[nsizes++] = getLong(tok, GN_GT_0, "size");
+            }
+            break;
+        case 'i':
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                if (nimpls == MAX_IMPLS)
+                    cmdLineErr("Too many implementations (max %d)\n",
+                            MAX_IMPLS);
+                impls[nimpls++] = tok;
+            }
+            break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc)
+        usageError(argv[0]);
+
+    if (nsizes == 0) {
+        sizes[nsizes++] = 64;
+        sizes[nsizes++] = 256;
+        sizes[nsizes++] = 4096;
+        sizes[nsizes++] = 65536;
+        sizes[nsizes++] = 1048576;
+    }
+    if (nimpls == 0)
+        for (nimpls = 0; nimpls < sizeof(defImpls) / sizeof(defImpls[0]);
+                nimpls++)
+            impls[nimpls] = defImpls[nimpls];
+
+    maxSize = 0;
+    for (j = 0; j < nsizes; j++)
+        if (sizes[j] > maxSize)
+            maxSize = sizes[j];
+
+    /* Mostly letters, with some digits, punctuation, and non-ASCII */
+
+    buf = malloc(maxSize);
+    if (buf == NULL)
+        errExit("malloc");
+    srandom(1);
+    for (j = 0; j < maxSize; j++)
+        buf[j] = (random() % 8 == 0) ? (char) (random() % 256) :
+                 (char) ("aA"[random() % 2] + random() % 26);
+
+    /* Drop implementations that are unavailable or incorrect */
+
+    for (j = 0; j < nimpls; ) {
+        if (strcmp(impls[j], "toupper") != 0) {
+            if (caseConvSetImpl(impls[j]) == -1) {
+                printf("%s: %s; skipped\n", impls[j], (errno == ENOTSUP) ?
+                        "not supported by this CPU" : "not in this build");
+                impls[j] = impls[--nimpls];
+                continue;
+            }
+            if (!verify())
+                fatal("%s: results differ from toupper()/tolower()",
+                        impls[j]);
+        }
+        j++;
+    }
+
+    caseConvSetImpl(NULL);
+    printf("Default implementation: %s\n", caseConvImpl());
+
+    printf("%-10s", "size");
+    for (k = 0; k < nimpls; k++)
+        printf(" %9s", impls[k]);
+    printf("   (GB/s)\n");
+
+    for (j = 0; j < nsizes; j++) {
+        printf("%-10ld", sizes[j]);
+        for (k = 0; k < nimpls; k++) {
+            libc = strcmp(impls[k], "toupper") == 0;
+            if (!libc)
+                caseConvSetImpl(impls[k]);
+
+            start = nowSecs();
+            for (done = 0; done < total; done += 2 * sizes[j]) {
+                if (libc) {
+                    libcToUpper(buf, sizes[j]);
+                    libcToLower(buf, sizes[j]);
+                } else {
+                    caseToUpper(buf, sizes[j]);
+                    caseToLower(buf, sizes[j]);
+                }
+            }
+            secs = nowSecs() - start;
+            printf(" %9.2f", done / secs / 1e9);
+        }
+        printf("\n");
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -18,8 +18,11 @@
    The child reads text from this pipe, converts it to uppercase, and
    sends it back to the parent using the other pipe. The parent reads
    the text returned by the child and echoes it on standard output.
+
+   The conversion is done by caseToUpper() (case_conv.c), which, unlike a
+   loop calling toupper() for each byte, converts many bytes at a time.
 */
-#include <ctype.h>
+#include "case_conv.h"
 #include "tlpi_hdr.h"
 
 #define BUF_SIZE 100    /* Should be <= PIPE_BUF bytes */
@@ -30,7 +33,6 @@ main(int argc, char *argv[])
     char buf[BUF_SIZE];
     int outbound[2];            /* Pipe to send data from parent to child */
     int inbound[2];             /* Pipe to send data from child to parent */
-    int j;
     ssize_t cnt;
 
     if (pipe(outbound) == -1)
@@ -55,8 +57,7 @@ main(int argc, char *argv[])
            and send back to parent on inbound pipe */
 
         while ((cnt = read(outbound[0], buf, BUF_SIZE)) > 0) {
-            for (j = 0; j < cnt; j++)
-                buf[j] = toupper((unsigned char) buf[j]);
+            caseToUpper(buf, cnt);
             if (write(inbound[1], buf, cnt) != cnt)
                 fatal("failed/partial write(): inbound pipe");
         }
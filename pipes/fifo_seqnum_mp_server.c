@@ -0,0 +1,192 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* fifo_seqnum_mp_server.c
+
+   A concurrent version of the FIFO sequence-number server in
+   fifo_seqnum_server.c. That server handles requests one at a time, and
+   because it must open each client's FIFO (which blocks until the client
+   opens the FIFO for reading), a single slow client stalls all of the
+   others. This server instead creates, at startup, a pool of worker
+   processes (or, with -t, threads), all of which read requests from the
+   server's well-known FIFO. Because each request is smaller than
+   PIPE_BUF bytes, it is written atomically, and each read() of
+   sizeof(struct request) bytes by a worker obtains exactly one request.
+
+   Usage: fifo_seqnum_mp_server [-n nworkers] [-t]
+
+        -n nworkers  Number of workers (default: 8)
+        -t           Use threads rather than processes as workers
+
+   The sequence number lives in a shared anonymous mapping created before
+   the workers are forked, and each request is granted its sequence with
+   an atomic fetch-and-add.
+
+   The protocol is the same as that of fifo_seqnum_server.c, so that the
+   server can be used with fifo_seqnum_client.c, or loaded with
+   fifo_seqnum_load.c.
+*/
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <pthread.h>
+#include "fifo_seqnum.h"
+
+static int *seqNum;             /* In shared memory */
+static int serverFd;
+static pid_t *workerPids;       /* Multiprocess case */
+static int nworkers = 8;
+
+/* In the multiprocess case, terminating the parent also terminates the
+   workers */
+
+static void
+termHandler(int sig)
+{
+    int j;
+
+    for (j = 0; j < nworkers; j++)
+        if (workerPids[j] > 0)
+            kill(workerPids[j], SIGTERM);
+    _exit(EXIT_SUCCESS);
+}
+
+static void *
+workerFunc(void *arg)
+{
+    char clientFifo[CLIENT_FIFO_NAME_LEN];
+    struct request req;
+    struct response resp;
+    int clientFd;
+
+    for (;;) {                          /* Read requests and send responses */
+        if (read(serverFd, &req, sizeof(struct request))
+                != sizeof(struct request)) {
+            fprintf(stderr, "Error reading request; discarding\n");
+            continue;                   /* Either partial read or error */
+        }
+
+        /* Open client FIFO (previously created by client) */
+
+        snprintf(clientFifo, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE,
+                (long) req.pid);
+        clientFd = open(clientFifo, O_WRONLY);
+        if (clientFd == -1) {           /* Open failed, give up on client */
+            errMsg("open %s", clientFifo);
+            continue;
+        }
+
+        /* Send response and close FIFO */
+
+        resp.seqNum = __atomic_fetch_add(seqNum, req.seqLen,
+                                         __ATOMIC_RELAXED);
+        if (write(clientFd, &resp, sizeof(struct response))
+                != sizeof(struct response))
+            fprintf(stderr, "Error writing to FIFO %s\n", clientFifo);
+        if (close(clientFd) == -1)
+            errMsg("close");
+    }
+    return NULL;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n nworkers] [-t]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    Boolean useThreads;
+    pthread_t tid;
+    int opt, dummyFd, j, s;
+
+    useThreads = FALSE;
+    while ((opt = getopt(argc, argv, "n:t")) != -1) {
+        switch (opt) {
+        case 'n':   nworkers = getInt(optarg, GN_GT_0, "nworkers");     break;
+        case 't':   useThreads = TRUE;                                  break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc)
+        usageError(argv[0]);
+
+    seqNum = mmap(NULL, sizeof(*seqNum), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (seqNum == MAP_FAILED)
+        errExit("mmap");
+
+    /* Create well-known FIFO, and open it for reading */
+
+    umask(0);                           /* So we get the permissions we want */
+    if (mkfifo(SERVER_FIFO, S_IRUSR | S_IWUSR | S_IWGRP) == -1
+            && errno != EEXIST)
+        errExit("mkfifo %s", SERVER_FIFO);
+    serverFd = open(SERVER_FIFO, O_RDONLY);
+    if (serverFd == -1)
+        errExit("open %s", SERVER_FIFO);
+
+    /* Open an extra write descriptor, so that we never see EOF */
+
+    dummyFd = open(SERVER_FIFO, O_WRONLY);
+    if (dummyFd == -1)
+        errExit("open %s", SERVER_FIFO);
+
+    /* Let's find out about broken client pipe via failed write() */
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)    errExit("signal");
+
+    if (!useThreads) {
+        workerPids = calloc(nworkers, sizeof(pid_t));
+        if (workerPids == NULL)
+            errExit("calloc");
+
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = 0;
+        sa.sa_handler = termHandler;
+        if (sigaction(SIGINT, &sa, NULL) == -1 ||
+                sigaction(SIGTERM, &sa, NULL) == -1)
+            errExit("sigaction");
+    }
+
+    for (j = 0; j < nworkers; j++) {
+        if (useThreads) {
+            s = pthread_create(&tid, NULL, workerFunc, NULL);
+            if (s != 0)
+                errExitEN(s, "pthread_create");
+        } else {
+            switch (workerPids[j] = fork()) {
+            case -1:
+                errExit("fork");
+            case 0:
+                signal(SIGINT, SIG_DFL);
+                signal(SIGTERM, SIG_DFL);
+                workerFunc(NULL);
+                _exit(EXIT_SUCCESS);    /* Not reached */
+            default:
+                break;
+            }
+        }
+    }
+
+    if (useThreads)
+        pthread_exit(NULL);
+
+    while (wait(NULL) != -1)
+        continue;
+    errExit("wait");
+}
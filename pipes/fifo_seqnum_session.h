@@ -0,0 +1,36 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* fifo_seqnum_session.h
+
+   Header file used by fifo_seqnum_session_server.c and
+   fifo_seqnum_session_client.c.
+
+   The messages are those of fifo_seqnum.h, with two additions to the
+   protocol:
+
+   - A client may send several requests with a single write(), so long as
+     it writes no more than MAX_BATCH requests (so that the write() is
+     atomic). The server sends the responses to the requests in the same
+     order.
+
+   - A request whose 'seqLen' is SESSION_END (0) ends the client's
+     session: the server closes its descriptor for the client's FIFO, and
+     sends no response.
+*/
+#include <limits.h>
+#include "fifo_seqnum.h"
+
+#define MAX_BATCH (PIPE_BUF / sizeof(struct request))
+                                /* Most requests that can be written
+                                   atomically with a single write() */
+#define SESSION_END 0           /* 'seqLen' value that ends a session */
@@ -0,0 +1,167 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* fifo_seqnum_session_client.c
+
+   A client for fifo_seqnum_session_server.c that keeps its FIFO open for
+   the whole of a session, and pipelines its requests. Unlike
+   fifo_seqnum_client.c, which sends one request and then opens its FIFO
+   to wait for the response, this client opens its FIFO before sending any
+   requests, sends its requests in batches, each with a single write(),
+   and reads all of the responses to a batch with (usually) a single
+   read().
+
+   Usage: fifo_seqnum_session_client [-n nreqs] [-b batch] [-q] [seq-len]
+
+        -n nreqs   Number of requests to send (default: 1)
+        -b batch   Number of requests sent with each write() (default: 1;
+                   at most MAX_BATCH)
+        -q         Don't display the responses; instead, display the
+                   number of requests per second
+
+   Each request asks for a sequence of 'seq-len' (default: 1) numbers.
+
+   The client holds its FIFO open for writing as well as reading. This
+   ensures that the server's nonblocking open() of the FIFO succeeds, and
+   that our reads never see end-of-file if the server should close its
+   descriptor for the FIFO while we wait for a response. (The downside is
+   that the client blocks forever if the server terminates.)
+
+   See fifo_seqnum_session.h for the protocol.
+*/
+#include <time.h>
+#include "fifo_seqnum_session.h"
+
+static char clientFifo[CLIENT_FIFO_NAME_LEN];
+
+static void             /* Invoked on exit to delete client FIFO */
+removeFifo(void)
+{
+    unlink(clientFifo);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n nreqs] [-b batch] [-q] [seq-len]\n",
+            progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct request reqs[MAX_BATCH];
+    struct response resps[MAX_BATCH];
+    struct timespec start, end;
+    int serverFd, clientFd, dummyFd, flags, opt;
+    long nreqs, sent;
+    int batch, seqLen, n, j;
+    size_t len, got;
+    ssize_t numRead;
+    Boolean quiet;
+    double secs;
+
+    nreqs = 1;
+    batch = 1;
+    quiet = FALSE;
+    while ((opt = getopt(argc, argv, "n:b:q")) != -1) {
+        switch (opt) {
+        case 'n':   nreqs = getLong(optarg, GN_GT_0, "nreqs");          break;
+        case 'b':   batch = getInt(optarg, GN_GT_0, "batch");           break;
+        case 'q':   quiet = TRUE;                                       break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind + 1 < argc)
+        usageError(argv[0]);
+    if (batch > MAX_BATCH)
+        cmdLineErr("batch must be at most %ld\n", (long) MAX_BATCH);
+    seqLen = (optind < argc) ? getInt(argv[optind], GN_GT_0, "seq-len") : 1;
+
+    /* Create our FIFO, and open it for both reading and writing, before
+       sending any request. Opening the read end with O_NONBLOCK lets us
+       avoid blocking until the write end is opened. */
+
+    umask(0);                   /* So we get the permissions we want */
+    snprintf(clientFifo, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE,
+            (long) getpid());
+    if (mkfifo(clientFifo, S_IRUSR | S_IWUSR | S_IWGRP) == -1
+                && errno != EEXIST)
+        errExit("mkfifo %s", clientFifo);
+
+    if (atexit(removeFifo) != 0)
+        errExit("atexit");
+
+    clientFd = open(clientFifo, O_RDONLY | O_NONBLOCK);
+    if (clientFd == -1)
+        errExit("open %s", clientFifo);
+    dummyFd = open(clientFifo, O_WRONLY);
+    if (dummyFd == -1)
+        errExit("open %s", clientFifo);
+    flags = fcntl(clientFd, F_GETFL);
+    if (flags == -1 || fcntl(clientFd, F_SETFL, flags & ~O_NONBLOCK) == -1)
+        errExit("fcntl");
+
+    serverFd = open(SERVER_FIFO, O_WRONLY);
+    if (serverFd == -1)
+        errExit("open %s", SERVER_FIFO);
+
+    for (j = 0; j < batch; j++) {
+        reqs[j].pid = getpid();
+        reqs[j].seqLen = seqLen;
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+
+    for (sent = 0; sent < nreqs; sent += n) {
+        n = (nreqs - sent < batch) ? nreqs - sent : batch;
+
+        if (write(serverFd, reqs, n * sizeof(struct request)) !=
+                n * sizeof(struct request))
+            fatal("Can't write to server");
+
+        /* The server may send the responses to a batch with more than
+           one write() (if it read the batch in two pieces) */
+
+        len = n * sizeof(struct response);
+        for (got = 0; got < len; got += numRead) {
+            numRead = read(clientFd, (char *) resps + got, len - got);
+            if (numRead <= 0)
+                fatal("Can't read response from server");
+        }
+
+        if (!quiet)
+            for (j = 0; j < n; j++)
+                printf("%d\n", resps[j].seqNum);
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+
+    /* Tell the server that it can close its descriptor for our FIFO */
+
+    reqs[0].seqLen = SESSION_END;
+    if (write(serverFd, reqs, sizeof(struct request)) !=
+            sizeof(struct request))
+        fatal("Can't write to server");
+
+    if (quiet) {
+        secs = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%ld requests in %.3f s (%.0f requests/s)\n", nreqs, secs,
+                nreqs / secs);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,250 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* fifo_seqnum_session_server.c
+
+   A version of the FIFO sequence-number server in fifo_seqnum_server.c
+   that keeps client FIFOs open between requests. That server opens the
+   client's FIFO by name (a pathname lookup, and a wait for the client to
+   open the FIFO for reading), writes a single response, and closes the
+   FIFO, for every request: four system calls per request, plus the
+   client's own open() and close().
+
+   This server instead caches open descriptors for client FIFOs, keyed by
+   client PID; when the cache is full, the least recently used
+   descriptor is closed. Furthermore, it reads as many requests as are
+   available with a single read(), and sends the responses for a run of
+   requests from the same client with a single write(). Thus, a client
+   that keeps its FIFO open and pipelines its requests (see
+   fifo_seqnum_session_client.c) costs the server little more than one
+   write() per batch of requests.
+
+   Usage: fifo_seqnum_session_server [-c cache-size]
+
+        -c cache-size  Maximum number of cached client FIFO descriptors
+                       (default: 64)
+
+   The server opens a client's FIFO with O_NONBLOCK, which succeeds only
+   if the client already has the FIFO open for reading, as a session
+   client does. If the open() fails with ENXIO, the client is presumably
+   one (such as fifo_seqnum_client.c) that opens its FIFO only after
+   sending its request, and the server falls back to the behavior of
+   fifo_seqnum_server.c: a blocking open(), one write(), and a close().
+
+   See fifo_seqnum_session.h for the protocol.
+*/
+#include <signal.h>
+#include "fifo_seqnum_session.h"
+
+struct cacheEntry {
+    pid_t pid;                  /* Client PID, or 0 if entry is free */
+    int fd;                     /* Write descriptor for client FIFO */
+    unsigned long lastUse;      /* Value of 'useCount' at last use */
+};
+
+static struct cacheEntry *cache;
+static int cacheSize = 64;
+static unsigned long useCount;
+
+/* Close the cached descriptor (if any) for the FIFO of client 'pid' */
+
+static void
+evictClient(pid_t pid)
+{
+    int j;
+
+    for (j = 0; j < cacheSize; j++) {
+        if (cache[j].pid == pid) {
+            if (close(cache[j].fd) == -1)
+                errMsg("close");
+            cache[j].pid = 0;
+            return;
+        }
+    }
+}
+
+/* Return a write descriptor for the FIFO of client 'pid', from the cache
+   if possible, or else by opening the FIFO and caching the descriptor.
+   Return -1 if the FIFO could not be opened; in that case, if the client
+   has not (yet) opened the FIFO for reading, errno is ENXIO. */
+
+static int
+getClientFd(pid_t pid)
+{
+    char clientFifo[CLIENT_FIFO_NAME_LEN];
+    int j, victim, fd, flags;
+
+    victim = 0;
+    for (j = 0; j < cacheSize; j++) {
+        if (cache[j].pid == pid) {
+            cache[j].lastUse = ++useCount;
+            return cache[j].fd;
+        }
+        if (cache[j].pid == 0)
+            victim = j;
+        else if (cache[victim].pid != 0 &&
+                cache[j].lastUse < cache[victim].lastUse)
+            victim = j;
+    }
+
+    snprintf(clientFifo, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE,
+            (long) pid);
+    fd = open(clientFifo, O_WRONLY | O_NONBLOCK);
+    if (fd == -1)
+        return -1;
+
+    /* Responses are small, and the client reads them promptly, so we
+       can use blocking writes */
+
+    flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == -1)
+        errExit("fcntl");
+
+    if (cache[victim].pid != 0)         /* Evict least recently used */
+        evictClient(cache[victim].pid);
+    cache[victim].pid = pid;
+    cache[victim].fd = fd;
+    cache[victim].lastUse = ++useCount;
+    return fd;
+}
+
+/* Send the 'n' responses in 'resps' to client 'pid' */
+
+static void
+sendResponses(pid_t pid, struct response *resps, int n)
+{
+    char clientFifo[CLIENT_FIFO_NAME_LEN];
+    size_t len;
+    int clientFd, attempt, savedErrno;
+
+    len = n * sizeof(struct response);
+
+    /* If the write to a cached descriptor fails with EPIPE, the client
+       that opened the FIFO has gone, and this request is from a new
+       process with the same PID; we open the new client's FIFO, and
+       try again */
+
+    for (attempt = 0; attempt < 2; attempt++) {
+        clientFd = getClientFd(pid);
+        if (clientFd == -1)
+            break;
+        if (write(clientFd, resps, len) == len)
+            return;
+        savedErrno = errno;
+        evictClient(pid);
+        errno = savedErrno;
+        if (errno != EPIPE)
+            break;
+    }
+
+    snprintf(clientFifo, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE,
+            (long) pid);
+
+    if (clientFd == -1 && errno == ENXIO) {
+        clientFd = open(clientFifo, O_WRONLY);  /* One-shot client */
+        if (clientFd != -1) {
+            if (write(clientFd, resps, len) != len)
+                fprintf(stderr, "Error writing to FIFO %s\n", clientFifo);
+            if (close(clientFd) == -1)
+                errMsg("close");
+            return;
+        }
+    }
+
+    errMsg("Error sending response to %s", clientFifo);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-c cache-size]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct request reqs[MAX_BATCH];
+    struct response resps[MAX_BATCH];
+    int serverFd, dummyFd, opt, nreqs, n, j;
+    int seqNum = 0;                     /* This is our "service" */
+    ssize_t numRead;
+    pid_t pid;
+
+    while ((opt = getopt(argc, argv, "c:")) != -1) {
+        switch (opt) {
+        case 'c':   cacheSize = getInt(optarg, GN_GT_0, "cache-size");  break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc)
+        usageError(argv[0]);
+
+    cache = calloc(cacheSize, sizeof(struct cacheEntry));
+    if (cache == NULL)
+        errExit("calloc");
+
+    /* Create well-known FIFO, and open it for reading */
+
+    umask(0);                           /* So we get the permissions we want */
+    if (mkfifo(SERVER_FIFO, S_IRUSR | S_IWUSR | S_IWGRP) == -1
+            && errno != EEXIST)
+        errExit("mkfifo %s", SERVER_FIFO);
+    serverFd = open(SERVER_FIFO, O_RDONLY);
+    if (serverFd == -1)
+        errExit("open %s", SERVER_FIFO);
+
+    /* Open an extra write descriptor, so that we never see EOF */
+
+    dummyFd = open(SERVER_FIFO, O_WRONLY);
+    if (dummyFd == -1)
+        errExit("open %s", SERVER_FIFO);
+
+    /* Let's find out about broken client pipe via failed write() */
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)    errExit("signal");
+
+    for (;;) {                          /* Read requests and send responses */
+
+        /* Since every write() to the FIFO is atomic, and transfers a
+           whole number of requests, a read() whose size is a multiple
+           of the request size always obtains whole requests */
+
+        numRead = read(serverFd, reqs, sizeof(reqs));
+        if (numRead <= 0 || numRead % sizeof(struct request) != 0) {
+            fprintf(stderr, "Error reading requests; discarding\n");
+            continue;                   /* Either partial read or error */
+        }
+        nreqs = numRead / sizeof(struct request);
+
+        /* Handle each run of consecutive requests from the same client,
+           sending all of the responses with a single write() */
+
+        for (j = 0; j < nreqs; ) {
+            pid = reqs[j].pid;
+            for (n = 0; j < nreqs && reqs[j].pid == pid &&
+                    reqs[j].seqLen != SESSION_END; j++, n++) {
+                resps[n].seqNum = seqNum;
+                seqNum += reqs[j].seqLen;   /* Update our sequence number */
+            }
+            if (n > 0)
+                sendResponses(pid, resps, n);
+
+            if (j < nreqs && reqs[j].pid == pid &&
+                    reqs[j].seqLen == SESSION_END) {
+                evictClient(pid);
+                j++;
+            }
+        }
+    }
+}
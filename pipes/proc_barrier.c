@@ -0,0 +1,316 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* proc_barrier.c
+
+   A reusable barrier for related processes: a successor to the technique
+   of pipe_sync.c, which lets a parent wait for its children (when each
+   has closed its copy of a pipe's write end), but only once, and without
+   the children waiting for one another.
+
+   pbInit() creates a barrier for 'parties' processes, before they are
+   created with fork(). Thereafter, each call to pbWait() blocks until
+   all 'parties' processes have called pbWait() (that is, have arrived
+   at the barrier), and then returns in all of them, completing a
+   phase; the barrier can then be used for the next phase. In each phase,
+   pbWait() returns PB_SERIAL in exactly one process, and 0 in the others.
+
+   There are two implementations:
+
+   PB_FUTEX     The barrier is a counter of arrivals and a phase number,
+                in a shared anonymous mapping. A process arrives by
+                incrementing the counter; the process that makes it equal
+                to 'parties' resets it, increments the phase number, and
+                wakes the others, which wait with FUTEX_WAIT on the phase
+                number. No system call is made when no process has to
+                sleep, or be woken.
+
+   PB_EVENTFD   The process that called pbInit() coordinates the barrier,
+                and must be one of the parties. The other processes arrive
+                by adding 1 to an eventfd, which the coordinator reads
+                until it has counted parties - 1 arrivals; it then adds
+                parties - 1 to a second eventfd, in semaphore mode (see
+                eventfd(2)), from which each of the others reads 1. Two
+                such semaphores are used alternately, so that a process
+                that has already left one phase and arrives in the next
+                can't consume a wakeup meant for a process that has not
+                yet left the previous phase. This version needs no shared
+                memory, and its descriptors can be passed to processes
+                that are not descended from the creator (see
+                scm_multi_send.c), but every phase costs the coordinator
+                a system call per arrival (at worst).
+
+   If 'timeoutMs' is nonnegative, pbWait() gives up after that many
+   milliseconds, failing with ETIMEDOUT. The caller still counts as
+   having arrived in the current phase; calling pbWait() again resumes
+   the wait (without arriving again). Waits are not interrupted by
+   signal handlers.
+
+   Functions return 0 (or, for pbWait(), 0 or PB_SERIAL) on success, and
+   -1 with errno set on error.
+
+   This module is Linux-specific.
+*/
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include "proc_barrier.h"       /* Declares functions defined here */
+
+int
+pbInit(struct procBarrier *pb, int kind, unsigned int parties)
+{
+    int savedErrno;
+
+    if (parties == 0 || (kind != PB_FUTEX && kind != PB_EVENTFD)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pb->kind = kind;
+    pb->parties = parties;
+    pb->phase = 0;
+    pb->arrived = 0;
+    pb->shm = NULL;
+    pb->arriveFd = pb->releaseFd[0] = pb->releaseFd[1] = -1;
+    pb->collected = 0;
+
+    if (kind == PB_FUTEX) {
+        pb->shm = mmap(NULL, sizeof(struct pbShared),
+                       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                       -1, 0);
+        if (pb->shm == MAP_FAILED) {
+            pb->shm = NULL;
+            return -1;
+        }
+        pb->shm->count = pb->shm->phase = pb->shm->waiters = 0;
+        return 0;
+    }
+
+    pb->coordinator = getpid();
+    pb->arriveFd = eventfd(0, EFD_CLOEXEC);
+    pb->releaseFd[0] = eventfd(0, EFD_CLOEXEC | EFD_SEMAPHORE);
+    pb->releaseFd[1] = eventfd(0, EFD_CLOEXEC | EFD_SEMAPHORE);
+    if (pb->arriveFd == -1 || pb->releaseFd[0] == -1 ||
+            pb->releaseFd[1] == -1) {
+        savedErrno = errno;
+        pbDestroy(pb);
+        errno = savedErrno;
+        return -1;
+    }
+    return 0;
+}
+
+/* Convert a timeout into an absolute CLOCK_MONOTONIC deadline */
+
+static int
+makeDeadline(long timeoutMs, struct timespec *deadline)
+{
+    if (clock_gettime(CLOCK_MONOTONIC, deadline) == -1)
+        return -1;
+    deadline->tv_sec += timeoutMs / 1000;
+    deadline->tv_nsec += (timeoutMs % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+    return 0;
+}
+
+/* Wait until 'fd' is readable, or (if 'deadline' is not NULL) the
+   deadline passes. Returns 0, or -1 on error (ETIMEDOUT on timeout). */
+
+static int
+waitReadable(int fd, const struct timespec *deadline)
+{
+    struct timespec now;
+    struct pollfd pfd;
+    long ms;
+    int n;
+
+    if (deadline == NULL)       /* Let the caller's read() block */
+        return 0;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    for (;;) {
+        if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+            return -1;
+        ms = (deadline->tv_sec - now.tv_sec) * 1000 +
+             (deadline->tv_nsec - now.tv_nsec + 999999) / 1000000;
+        n = poll(&pfd, 1, (ms > 0) ? ms : 0);
+        if (n > 0)
+            return 0;
+        if (n == 0 && ms <= 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (n == -1 && errno != EINTR)
+            return -1;
+    }
+}
+
+static int
+readCounter(int fd, uint64_t *val)
+{
+    while (read(fd, val, sizeof(*val)) != sizeof(*val))
+        if (errno != EINTR)
+            return -1;
+    return 0;
+}
+
+static int
+writeCounter(int fd, uint64_t val)
+{
+    while (write(fd, &val, sizeof(val)) != sizeof(val))
+        if (errno != EINTR)
+            return -1;
+    return 0;
+}
+
+static int
+futexWait(struct procBarrier *pb, const struct timespec *deadline)
+{
+    struct pbShared *shm = pb->shm;
+    int s, savedErrno;
+
+    if (!pb->arrived) {
+        pb->arrived = 1;
+        if (__atomic_add_fetch(&shm->count, 1, __ATOMIC_SEQ_CST) ==
+                pb->parties) {
+
+            /* Last to arrive: start the next phase. No process can
+               arrive in that phase (and increment 'count') until it has
+               seen the new phase number, so resetting 'count' first is
+               safe. */
+
+            __atomic_store_n(&shm->count, 0, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&shm->phase, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&shm->waiters, __ATOMIC_SEQ_CST) > 0 &&
+                    syscall(SYS_futex, &shm->phase, FUTEX_WAKE, INT_MAX,
+                            NULL, NULL, 0) == -1)
+                return -1;
+            pb->phase++;
+            pb->arrived = 0;
+            return PB_SERIAL;
+        }
+    }
+
+    /* Sleep until the phase number changes. We announce ourselves as a
+       waiter before the final check of the phase number, so that the
+       last process to arrive either sees us, or changes the phase number
+       before we check it. */
+
+    while (__atomic_load_n(&shm->phase, __ATOMIC_ACQUIRE) == pb->phase) {
+        __atomic_fetch_add(&shm->waiters, 1, __ATOMIC_SEQ_CST);
+        s = 0;
+        if (__atomic_load_n(&shm->phase, __ATOMIC_SEQ_CST) == pb->phase)
+            s = syscall(SYS_futex, &shm->phase, FUTEX_WAIT_BITSET,
+                        pb->phase, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+        savedErrno = errno;
+        __atomic_fetch_sub(&shm->waiters, 1, __ATOMIC_SEQ_CST);
+
+        if (s == -1 && savedErrno != EAGAIN && savedErrno != EINTR) {
+            errno = savedErrno;         /* ETIMEDOUT, ... */
+            return -1;
+        }
+    }
+
+    pb->phase++;
+    pb->arrived = 0;
+    return 0;
+}
+
+static int
+eventfdWait(struct procBarrier *pb, const struct timespec *deadline)
+{
+    uint64_t val;
+    int fd;
+
+    if (getpid() == pb->coordinator) {
+        while (pb->collected < pb->parties - 1) {
+            if (waitReadable(pb->arriveFd, deadline) == -1 ||
+                    readCounter(pb->arriveFd, &val) == -1)
+                return -1;
+            pb->collected += val;
+        }
+
+        /* All have arrived: release them */
+
+        if (pb->parties > 1 &&
+                writeCounter(pb->releaseFd[pb->phase & 1],
+                             pb->parties - 1) == -1)
+            return -1;
+        pb->collected = 0;
+        pb->phase++;
+        return PB_SERIAL;
+    }
+
+    fd = pb->releaseFd[pb->phase & 1];
+    if (!pb->arrived) {
+        if (writeCounter(pb->arriveFd, 1) == -1)
+            return -1;
+        pb->arrived = 1;
+    }
+
+    /* Since there is one wakeup for each of the processes waiting in this
+       phase, a read() that follows a successful poll() can't block */
+
+    if (waitReadable(fd, deadline) == -1 || readCounter(fd, &val) == -1)
+        return -1;
+
+    pb->phase++;
+    pb->arrived = 0;
+    return 0;
+}
+
+/* Wait until all parties have arrived at the barrier; if 'timeoutMs' is
+   nonnegative, wait at most that many milliseconds. Returns PB_SERIAL in
+   one process in each phase, 0 in the others, or -1 on error. */
+
+int
+pbWait(struct procBarrier *pb, long timeoutMs)
+{
+    struct timespec deadline;
+
+    if (timeoutMs >= 0 && makeDeadline(timeoutMs, &deadline) == -1)
+        return -1;
+
+    return (pb->kind == PB_FUTEX) ?
+            futexWait(pb, (timeoutMs >= 0) ? &deadline : NULL) :
+            eventfdWait(pb, (timeoutMs >= 0) ? &deadline : NULL);
+}
+
+/* Release the calling process's resources for the barrier */
+
+int
+pbDestroy(struct procBarrier *pb)
+{
+    int j;
+
+    if (pb->shm != NULL && munmap(pb->shm, sizeof(struct pbShared)) == -1)
+        return -1;
+    pb->shm = NULL;
+
+    if (pb->arriveFd != -1)
+        close(pb->arriveFd);
+    for (j = 0; j < 2; j++)
+        if (pb->releaseFd[j] != -1)
+            close(pb->releaseFd[j]);
+    pb->arriveFd = pb->releaseFd[0] = pb->releaseFd[1] = -1;
+    return 0;
+}
@@ -0,0 +1,71 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* proc_barrier.h
+
+   Header file for proc_barrier.c.
+
+   A barrier for a fixed number of related processes, which can be used
+   for any number of successive phases. The operations are:
+
+        create a barrier (before fork()):   pbInit(pb, kind, parties)
+        wait for the other parties:         pbWait(pb, timeoutMs)
+        free the caller's resources:        pbDestroy(pb)
+*/
+#ifndef PROC_BARRIER_H
+#define PROC_BARRIER_H          /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/* Kinds of barrier, for pbInit() */
+
+#define PB_FUTEX   1            /* Counter and futex in shared memory */
+#define PB_EVENTFD 2            /* eventfds, with a coordinating process */
+
+/* Returned by pbWait() in one process in each phase (compare
+   PTHREAD_BARRIER_SERIAL_THREAD) */
+
+#define PB_SERIAL 1
+
+struct pbShared {               /* PB_FUTEX: in a shared mapping */
+    uint32_t count;             /* Parties that have arrived */
+    uint32_t phase;             /* Incremented as each phase completes;
+                                   used as the futex word */
+    uint32_t waiters;           /* Number of processes sleeping */
+};
+
+/* Each process has its own copy of this structure (inherited across
+   fork()), which records where that process has got to */
+
+struct procBarrier {
+    int kind;
+    unsigned int parties;
+    uint32_t phase;             /* The phase that this process is in */
+    int arrived;                /* Has this process arrived in 'phase'
+                                   (that is, did pbWait() time out)? */
+    struct pbShared *shm;       /* PB_FUTEX */
+    pid_t coordinator;          /* PB_EVENTFD: PID of pbInit() caller */
+    int arriveFd;               /* PB_EVENTFD: counts arrivals */
+    int releaseFd[2];           /* PB_EVENTFD: semaphores for releasing
+                                   even and odd phases */
+    uint64_t collected;         /* PB_EVENTFD: arrivals counted so far in
+                                   this phase by the coordinator */
+};
+
+int pbInit(struct procBarrier *pb, int kind, unsigned int parties);
+
+int pbWait(struct procBarrier *pb, long timeoutMs);
+
+int pbDestroy(struct procBarrier *pb);
+
+#endif
@@ -0,0 +1,327 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* spawn_popen.c
+
+   Replacements for popen() and pclose() that create the child with
+   posix_spawn(), plugging the pipe into the child's standard input or
+   output with file actions. Because posix_spawn() doesn't copy the
+   caller's page tables (glibc implements it with clone(CLONE_VM |
+   CLONE_VFORK)), the cost of starting a command doesn't grow with the
+   size of the caller, as it does when popen() is implemented with
+   fork() (as in glibc before version 2.29, and in many other C
+   libraries).
+
+   spawnPopen(command, mode) and spawnPclose(stream) are used in the same
+   way as popen() and pclose(). 'mode' is "r" or "w", optionally followed
+   by "+", which (as on the BSDs) makes the stream bidirectional: the
+   child's standard input and output are both connected to a UNIX domain
+   stream socket, and the caller can use shutdown(fileno(stream),
+   SHUT_WR) to give the child end-of-file on its input while continuing
+   to read its output. An "e" in 'mode' is accepted for compatibility
+   with glibc; the caller's end of the pipe is always close-on-exec, so
+   that it is not inherited by other children (in particular, by those
+   of later spawnPopen() calls, as POSIX requires).
+
+   spawnPopenv(argv, mode) is like spawnPopen(), but executes the
+   program named by argv[0] (searching PATH) directly, rather than by way
+   of "sh -c", which saves the exec of the shell and avoids any need to
+   quote the arguments. Unlike popen(), if the program can't be executed,
+   the call fails (with errno set by the failed exec), rather than
+   creating a child that exits with status 127.
+
+   spawnPipes(argv, flags, &toChild, &fromChild) provides raw file
+   descriptors: separate pipes to the child's standard input (SP_STDIN)
+   and from its standard output (SP_STDOUT, optionally also carrying its
+   standard error if SP_STDERR is specified); with SP_SHELL, argv[0] is
+   passed to "sh -c". The caller can read the output through a
+   ReadLineBuf (read_line_buf.c), and must close the descriptors and call
+   spawnWait() with the returned process ID. A caller that uses both
+   pipes must avoid deadlock (for example, by writing all input before
+   reading output only if the child's output fits in the pipe, or by
+   using poll()).
+
+   All of these functions return NULL or -1, with errno set, on error.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "spawn_popen.h"        /* Declares functions defined here */
+
+extern char **environ;
+
+/* The streams returned by spawnPopen() and spawnPopenv(), and the
+   corresponding children, for spawnPclose() */
+
+struct spEntry {
+    FILE *stream;
+    pid_t pid;
+    struct spEntry *next;
+};
+
+static struct spEntry *spList;
+static pthread_mutex_t spMtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* Ensure that 'fd' (which is close-on-exec) is not 0, 1, or 2, so that
+   the file actions that place the child's ends of the pipes on its
+   standard descriptors can't overwrite one another (as could happen if
+   the caller had closed any of those descriptors). Returns the new
+   descriptor, or -1 on error. */
+
+static int
+aboveStdFds(int fd)
+{
+    int newFd;
+
+    if (fd > STDERR_FILENO)
+        return fd;
+    newFd = fcntl(fd, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+    close(fd);
+    return newFd;
+}
+
+static void
+closeIfOpen(int fd)
+{
+    int savedErrno;
+
+    if (fd != -1) {
+        savedErrno = errno;
+        close(fd);
+        errno = savedErrno;
+    }
+}
+
+/* Create a child that executes 'argv' (or, if 'shell' is nonzero, passes
+   argv[0] to the shell), with 'childIn' and 'childOut' (unless -1) as its
+   standard input and output, and, if 'errToOut' is nonzero, its standard
+   output as its standard error. All other descriptors that we create
+   are close-on-exec, so they need no file actions. Returns the child's
+   PID, or -1 on error. */
+
+static pid_t
+spawnChild(char *const argv[], int shell, int childIn, int childOut,
+           int errToOut)
+{
+    posix_spawn_file_actions_t fa;
+    char *shArgv[4];
+    pid_t pid;
+    int s;
+
+    s = posix_spawn_file_actions_init(&fa);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+
+    if (childIn != -1)
+        s = posix_spawn_file_actions_adddup2(&fa, childIn, STDIN_FILENO);
+    if (s == 0 && childOut != -1)
+        s = posix_spawn_file_actions_adddup2(&fa, childOut, STDOUT_FILENO);
+    if (s == 0 && errToOut)
+        s = posix_spawn_file_actions_adddup2(&fa, STDOUT_FILENO,
+                                             STDERR_FILENO);
+
+    if (s == 0) {
+        if (shell) {
+            shArgv[0] = "sh";
+            shArgv[1] = "-c";
+            shArgv[2] = argv[0];
+            shArgv[3] = NULL;
+            s = posix_spawn(&pid, "/bin/sh", &fa, NULL, shArgv, environ);
+        } else {
+            s = posix_spawnp(&pid, argv[0], &fa, NULL, argv, environ);
+        }
+    }
+
+    posix_spawn_file_actions_destroy(&fa);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return pid;
+}
+
+pid_t
+spawnPipes(char *const argv[], int flags, int *toChild, int *fromChild)
+{
+    int inPipe[2] = { -1, -1 }, outPipe[2] = { -1, -1 };
+    pid_t pid;
+
+    if ((flags & SP_STDIN) && pipe2(inPipe, O_CLOEXEC) == -1)
+        goto fail;
+    if ((flags & SP_STDOUT) && pipe2(outPipe, O_CLOEXEC) == -1)
+        goto fail;
+    if (inPipe[0] != -1 && (inPipe[0] = aboveStdFds(inPipe[0])) == -1)
+        goto fail;
+    if (outPipe[1] != -1 && (outPipe[1] = aboveStdFds(outPipe[1])) == -1)
+        goto fail;
+
+    pid = spawnChild(argv, flags & SP_SHELL, inPipe[0], outPipe[1],
+                     (flags & (SP_STDOUT | SP_STDERR)) ==
+                            (SP_STDOUT | SP_STDERR));
+    if (pid == -1)
+        goto fail;
+
+    closeIfOpen(inPipe[0]);
+    closeIfOpen(outPipe[1]);
+    if (toChild != NULL)
+        *toChild = inPipe[1];
+    if (fromChild != NULL)
+        *fromChild = outPipe[0];
+    return pid;
+
+fail:
+    closeIfOpen(inPipe[0]);
+    closeIfOpen(inPipe[1]);
+    closeIfOpen(outPipe[0]);
+    closeIfOpen(outPipe[1]);
+    return -1;
+}
+
+/* Wait for the child 'pid' to terminate. Returns its wait status, or -1
+   on error. */
+
+int
+spawnWait(pid_t pid)
+{
+    int status;
+
+    while (waitpid(pid, &status, 0) == -1)
+        if (errno != EINTR)
+            return -1;
+    return status;
+}
+
+static FILE *
+spawnStream(char *const argv[], int shell, const char *mode)
+{
+    struct spEntry *ent;
+    const char *p;
+    int fds[2], parentFd, childFd, bidir;
+    FILE *stream;
+    pid_t pid;
+
+    bidir = 0;
+    for (p = mode + 1; *p != '\0'; p++) {
+        if (*p == '+')
+            bidir = 1;
+        else if (*p != 'e')
+            break;
+    }
+    if ((mode[0] != 'r' && mode[0] != 'w') || *p != '\0') {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    ent = malloc(sizeof(struct spEntry));
+    if (ent == NULL)
+        return NULL;
+
+    if (bidir) {
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+            goto failFree;
+        parentFd = fds[0];
+        childFd = fds[1];
+    } else {
+        if (pipe2(fds, O_CLOEXEC) == -1)
+            goto failFree;
+        parentFd = (mode[0] == 'r') ? fds[0] : fds[1];
+        childFd = (mode[0] == 'r') ? fds[1] : fds[0];
+    }
+
+    childFd = aboveStdFds(childFd);
+    if (childFd == -1)
+        goto failClose;
+
+    pid = spawnChild(argv, shell,
+                     (bidir || mode[0] == 'w') ? childFd : -1,
+                     (bidir || mode[0] == 'r') ? childFd : -1, 0);
+    closeIfOpen(childFd);
+    childFd = -1;
+    if (pid == -1)
+        goto failClose;
+
+    stream = fdopen(parentFd, bidir ? "r+" : (mode[0] == 'r') ? "r" : "w");
+    if (stream == NULL) {
+        closeIfOpen(parentFd);
+        spawnWait(pid);
+        goto failFree;
+    }
+
+    ent->stream = stream;
+    ent->pid = pid;
+    pthread_mutex_lock(&spMtx);
+    ent->next = spList;
+    spList = ent;
+    pthread_mutex_unlock(&spMtx);
+    return stream;
+
+failClose:
+    closeIfOpen(parentFd);
+    closeIfOpen(childFd);
+failFree:
+    free(ent);
+    return NULL;
+}
+
+FILE *
+spawnPopen(const char *command, const char *mode)
+{
+    char *argv[2];
+
+    argv[0] = (char *) command;
+    argv[1] = NULL;
+    return spawnStream(argv, 1, mode);
+}
+
+FILE *
+spawnPopenv(char *const argv[], const char *mode)
+{
+    return spawnStream(argv, 0, mode);
+}
+
+/* Close 'stream' (from spawnPopen() or spawnPopenv()) and wait for the
+   child. Returns the child's wait status, or -1 on error. */
+
+int
+spawnPclose(FILE *stream)
+{
+    struct spEntry **pp, *ent;
+    pid_t pid;
+
+    pthread_mutex_lock(&spMtx);
+    for (pp = &spList; *pp != NULL && (*pp)->stream != stream;
+            pp = &(*pp)->next)
+        continue;
+    ent = *pp;
+    if (ent != NULL)
+        *pp = ent->next;
+    pthread_mutex_unlock(&spMtx);
+
+    if (ent == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pid = ent->pid;
+    free(ent);
+    fclose(stream);
+    return spawnWait(pid);
+}
@@ -0,0 +1,42 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* spawn_popen.h
+
+   Header file for spawn_popen.c.
+*/
+#ifndef SPAWN_POPEN_H
+#define SPAWN_POPEN_H           /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <stdio.h>
+
+/* Flags for spawnPipes() */
+
+#define SP_STDIN 01             /* Create a pipe to the child's stdin */
+#define SP_STDOUT 02            /* Create a pipe from the child's stdout */
+#define SP_STDERR 04            /* Send the child's stderr down the
+                                   stdout pipe too */
+#define SP_SHELL 010            /* argv[0] is a shell command line */
+
+FILE *spawnPopen(const char *command, const char *mode);
+
+FILE *spawnPopenv(char *const argv[], const char *mode);
+
+int spawnPclose(FILE *stream);
+
+pid_t spawnPipes(char *const argv[], int flags, int *toChild,
+                 int *fromChild);
+
+int spawnWait(pid_t pid);
+
+#endif
@@ -0,0 +1,350 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* spawn_popen_bench.c
+
+   Measure the latency of running a command and reading its output with
+   popen() and with the posix_spawn()-based replacements in
+   spawn_popen.c, as the size of the parent's memory footprint grows.
+
+   Usage: spawn_popen_bench [-n ncmds] [-m MiB[,MiB...]] [-c command]
+                            [method...]
+
+        -n ncmds     Number of commands run per method and footprint
+                     (default: 1000)
+        -m MiB       Comma-separated list of parent footprints: before
+                     each set of measurements, the parent allocates and
+                     touches this many MiB of memory (default: 0,256,1024)
+        -c command   The command (default: "/bin/ls /"). For the methods
+                     that don't use the shell, it is split into words at
+                     spaces, with no other processing.
+
+   The methods (by default, all are measured) are:
+
+        fork_popen    A popen() implemented with fork() and execl() of
+                      the shell, as in glibc before version 2.29 and in
+                      many other C libraries
+        popen         The C library's popen()
+        spawn_popen   spawnPopen()
+        spawn_popenv  spawnPopenv(), without the shell
+        spawn_pipes   spawnPipes(), without the shell, reading the
+                      output (stdout and stderr) with readLineBuf()
+
+   Each method reads the command's output line by line, and the time
+   for each command runs from the start of the call that creates the
+   child to the return of the call that waits for it. For each
+   footprint, the program shows, for each method, the number of commands
+   run per second, the median and 99th percentile times, and the number
+   of lines read per command (which should agree between methods that
+   use the same command line).
+
+   Try: spawn_popen_bench -m 0,1024,4096
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <time.h>
+#include "spawn_popen.h"
+#include "read_line_buf.h"
+#include "lat_hist.h"
+#include "tlpi_hdr.h"
+
+#define MAX_FOOTPRINTS 16
+#define MAX_WORDS 64
+#define LINE_MAX_LEN 4096
+
+static char *command = "/bin/ls /";
+static char *cmdArgv[MAX_WORDS + 1];
+
+/* The methods. Each runs 'command', reads its output, and returns the
+   number of lines read; the child must exit with status 0. */
+
+static void
+checkStatus(const char *name, int status)
+{
+    if (status == -1)
+        errExit(name);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        fatal("%s: child failed (status %#x)", name, status);
+}
+
+static long
+readStream(FILE *fp)
+{
+    char line[LINE_MAX_LEN];
+    long nlines;
+
+    for (nlines = 0; fgets(line, sizeof(line), fp) != NULL; nlines++)
+        continue;
+    return nlines;
+}
+
+/* A minimal popen("...", "r") and pclose() in the style of the C
+   libraries that create the child with fork() */
+
+static long
+doForkPopen(void)
+{
+    int pfd[2], status;
+    long nlines;
+    pid_t pid;
+    FILE *fp;
+
+    if (pipe2(pfd, O_CLOEXEC) == -1)
+        errExit("pipe2");
+    pid = fork();
+    if (pid == -1)
+        errExit("fork");
+    if (pid == 0) {
+        if (dup2(pfd[1], STDOUT_FILENO) == -1)
+            _exit(127);
+        execl("/bin/sh", "sh", "-c", command, (char *) NULL);
+        _exit(127);
+    }
+    close(pfd[1]);
+
+    fp = fdopen(pfd[0], "r");
+    if (fp == NULL)
+        errExit("fdopen");
+    nlines = readStream(fp);
+    fclose(fp);
+    while (waitpid(pid, &status, 0) == -1)
+        if (errno != EINTR)
+            errExit("waitpid");
+    checkStatus("fork_popen", status);
+    return nlines;
+}
+
+static long
+doPopen(void)
+{
+    long nlines;
+    FILE *fp;
+
+    fp = popen(command, "r");
+    if (fp == NULL)
+        errExit("popen");
+    nlines = readStream(fp);
+    checkStatus("pclose", pclose(fp));
+    return nlines;
+}
+
+static long
+doSpawnPopen(void)
+{
+    long nlines;
+    FILE *fp;
+
+    fp = spawnPopen(command, "r");
+    if (fp == NULL)
+        errExit("spawnPopen");
+    nlines = readStream(fp);
+    checkStatus("spawnPclose", spawnPclose(fp));
+    return nlines;
+}
+
+static long
+doSpawnPopenv(void)
+{
+    long nlines;
+    FILE *fp;
+
+    fp = spawnPopenv(cmdArgv, "r");
+    if (fp == NULL)
+        errExit("spawnPopenv");
+    nlines = readStream(fp);
+    checkStatus("spawnPclose", spawnPclose(fp));
+    return nlines;
+}
+
+static long
+doSpawnPipes(void)
+{
+    struct ReadLineBuf rlbuf;
+    char buf[LINE_MAX_LEN];
+    const char *line;
+    ssize_t len;
+    long nlines;
+    pid_t pid;
+    int fd;
+
+    pid = spawnPipes(cmdArgv, SP_STDOUT | SP_STDERR, NULL, &fd);
+    if (pid == -1)
+        errExit("spawnPipes");
+    if (readLineBufInitSize(fd, &rlbuf, buf, sizeof(buf)) == -1)
+        errExit("readLineBufInitSize");
+    nlines = 0;
+    while ((len = readLineBufView(&rlbuf, &line)) > 0)
+        nlines++;
+    if (len == -1)
+        errExit("readLineBufView");
+    readLineBufFree(&rlbuf);
+    close(fd);
+    checkStatus("spawnWait", spawnWait(pid));
+    return nlines;
+}
+
+static const struct {
+    const char *name;
+    long (*fn)(void);
+} methods[] = {
+    { "fork_popen",     doForkPopen },
+    { "popen",          doPopen },
+    { "spawn_popen",    doSpawnPopen },
+    { "spawn_popenv",   doSpawnPopenv },
+    { "spawn_pipes",    doSpawnPipes },
+};
+
+#define NMETHODS (sizeof(methods) / sizeof(methods[0]))
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+runMethod(int m, int ncmds)
+{
+    struct latHist h;
+    long long start, t0;
+    long nlines;
+    int j;
+
+    latHistInit(&h);
+    nlines = 0;
+    start = nowNs();
+    for (j = 0; j < ncmds; j++) {
+        t0 = nowNs();
+        nlines += methods[m].fn();
+        latHistRecord(&h, nowNs() - t0);
+    }
+
+    printf("    %-14s %10.0f %10.1f %10.1f %8.1f\n", methods[m].name,
+            ncmds / ((nowNs() - start) / 1e9),
+            latHistPercentile(&h, 0.50) / 1e3,
+            latHistPercentile(&h, 0.99) / 1e3, (double) nlines / ncmds);
+}
+
+static void
+usageError(const char *progName)
+{
+    int m;
+
+    fprintf(stderr, "Usage: %s [-n ncmds] [-m MiB[,MiB...]] [-c command] "
+                    "[method...]\n", progName);
+    fprintf(stderr, "Methods:");
+    for (m = 0; m < NMETHODS; m++)
+        fprintf(stderr, " %s", methods[m].name);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long footprints[MAX_FOOTPRINTS];
+    Boolean selected[NMETHODS];
+    size_t len;
+    char *tok, *mem, *words;
+    int opt, ncmds, nfoot, nwords, f, m, j;
+
+    ncmds = 1000;
+    nfoot = 0;
+    while ((opt = getopt(argc, argv, "n:m:c:")) != -1) {
+        switch (opt) {
+        case 'n':   ncmds = getInt(optarg, GN_GT_0, "ncmds");           break;
+        case 'c':   command = optarg;                                   break;
+        case 'm':
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                if (nfoot == MAX_FOOTPRINTS)
+                    cmdLineErr("Too many footprints (max %d)\n",
+                            MAX_FOOTPRINTS);
+                footprints[nfoot++] = getLong(tok, GN_NONNEG, "MiB");
+            }
+            break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    for (m = 0; m < NMETHODS; m++)
+        selected[m] = (optind == argc);
+    for (j = optind; j < argc; j++) {
+        for (m = 0; m < NMETHODS; m++)
+            if (strcmp(argv[j], methods[m].name) == 0)
+                break;
+        if (m == NMETHODS)
+            usageError(argv[0]);
+        selected[m] = TRUE;
+    }
+
+    if (nfoot == 0) {
+        footprints[nfoot++] = 0;
+        footprints[nfoot++] = 256;
+        footprints[nfoot++] = 1024;
+    }
+
+    /* Split the command into words for the methods that bypass the
+       shell */
+
+    words = strdup(command);
+    if (words == NULL)
+        errExit("strdup");
+    nwords = 0;
+    for (tok = strtok(words, " "); tok != NULL; tok = strtok(NULL, " ")) {
+        if (nwords == MAX_WORDS)
+            cmdLineErr("Too many words in command (max %d)\n", MAX_WORDS);
+        cmdArgv[nwords++] = tok;
+    }
+    if (nwords == 0)
+        cmdLineErr("Empty command\n");
+    cmdArgv[nwords] = NULL;
+
+    setbuf(stdout, NULL);
+
+    for (f = 0; f < nfoot; f++) {
+
+        /* Allocate and touch the footprint, so that the parent's page
+           tables are populated */
+
+        len = footprints[f] * 1024 * 1024;
+        mem = NULL;
+        if (len > 0) {
+            mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED)
+                errExit("mmap");
+            memset(mem, 1, len);
+        }
+
+        printf("Footprint %ld MiB\n", footprints[f]);
+        printf("    %-14s %10s %10s %10s %8s\n", "method", "cmds/s",
+                "p50-us", "p99-us", "lines");
+        for (m = 0; m < NMETHODS; m++)
+            if (selected[m])
+                runMethod(m, ncmds);
+
+        if (mem != NULL && munmap(mem, len) == -1)
+            errExit("munmap");
+    }
+
+    free(words);
+    exit(EXIT_SUCCESS);
+}
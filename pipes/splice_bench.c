@@ -0,0 +1,279 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* splice_bench.c
+
+   Compare the throughput of a pass-through pipeline stage that copies
+   data through a user-space buffer with that of stages that use
+   splice() and tee(), at a range of pipe capacities.
+
+   Usage: splice_bench [-s MiB] [-p kB[,kB...]]
+
+        -s MiB   Amount of data passed through the pipeline in each
+                 test (default: 1024)
+        -p kB    Comma-separated list of pipe capacities, set with
+                 F_SETPIPE_SZ (default: 64,256,1024)
+
+   Each test creates a pipeline
+
+        producer --> pipe --> stage --> pipe --> consumer
+
+   in which the producer and consumer are child processes and the stage
+   is the parent. The producer generates data either with write() or
+   with vmsplice(), which maps the pages of its buffer into the pipe
+   rather than copying them. The stage is one of:
+
+        rw       read() and write() through a buffer (as in change_case.c)
+        splice   splice() from the input pipe to the output pipe
+        tee      tee() from the input pipe to the output pipe, and then
+                 splice() from the input pipe to /dev/null, as does
+                 splice_tee.c when it copies its input to a log file
+
+   The consumer discards its input by splice()ing it to /dev/null. The
+   program reports the rate (MiB/s) at which data passed through the
+   pipeline. Each system call moves up to one pipe's worth of data.
+
+   Note that, because the producer reuses its buffer, the producer's
+   data is constant; a real program that employs vmsplice() must not
+   modify a buffer until the consumer has used the data.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#define MAX_SIZES 16
+
+enum stage { STAGE_RW, STAGE_SPLICE, STAGE_TEE };
+
+static const char *stageNames[] = { "rw", "splice", "tee" };
+
+static char *buf;               /* Producer's data, and 'rw' stage buffer */
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Write 'total' bytes to the pipe 'fd', 'chunk' bytes at a time */
+
+static void
+produce(int fd, long long total, size_t chunk, Boolean useVmsplice)
+{
+    struct iovec iov;
+    ssize_t s;
+    size_t len;
+
+    while (total > 0) {
+        len = (total < chunk) ? total : chunk;
+        if (useVmsplice) {
+            iov.iov_base = buf;
+            iov.iov_len = len;
+            s = vmsplice(fd, &iov, 1, 0);
+        } else {
+            s = write(fd, buf, len);
+        }
+        if (s == -1)
+            errExit(useVmsplice ? "vmsplice" : "write");
+        total -= s;
+    }
+}
+
+/* Move data from the pipe 'inFd' to 'outFd' until end of input */
+
+static void
+spliceAll(int inFd, int outFd, size_t chunk)
+{
+    ssize_t s;
+
+    for (;;) {
+        s = splice(inFd, NULL, outFd, NULL, chunk, SPLICE_F_MOVE);
+        if (s == -1)
+            errExit("splice");
+        if (s == 0)
+            break;
+    }
+}
+
+static void
+runStage(enum stage stage, int inFd, int outFd, int nullFd, size_t chunk)
+{
+    ssize_t numRead, len, s;
+
+    switch (stage) {
+    case STAGE_RW:
+        while ((numRead = read(inFd, buf, chunk)) > 0)
+            if (write(outFd, buf, numRead) != numRead)
+                fatal("partial/failed write");
+        if (numRead == -1)
+            errExit("read");
+        break;
+
+    case STAGE_SPLICE:
+        spliceAll(inFd, outFd, chunk);
+        break;
+
+    case STAGE_TEE:
+        for (;;) {
+            len = tee(inFd, outFd, chunk, 0);
+            if (len == -1)
+                errExit("tee");
+            if (len == 0)
+                break;
+            while (len > 0) {           /* Consume what we duplicated */
+                s = splice(inFd, NULL, nullFd, NULL, len, SPLICE_F_MOVE);
+                if (s <= 0)
+                    errExit("splice");
+                len -= s;
+            }
+        }
+        break;
+    }
+}
+
+/* Run one test; return the throughput in MiB/s */
+
+static double
+runTest(enum stage stage, Boolean useVmsplice, size_t pipeSize,
+        long long total, int nullFd)
+{
+    int inPipe[2], outPipe[2], status, j;
+    pid_t producer, consumer;
+    double start;
+
+    if (pipe(inPipe) == -1 || pipe(outPipe) == -1)
+        errExit("pipe");
+    if (fcntl(inPipe[0], F_SETPIPE_SZ, pipeSize) == -1 ||
+            fcntl(outPipe[0], F_SETPIPE_SZ, pipeSize) == -1)
+        errExit("fcntl-F_SETPIPE_SZ");
+
+    start = nowSecs();
+
+    switch (producer = fork()) {
+    case -1:
+        errExit("fork");
+    case 0:
+        close(inPipe[0]);
+        close(outPipe[0]);
+        close(outPipe[1]);
+        produce(inPipe[1], total, pipeSize, useVmsplice);
+        _exit(EXIT_SUCCESS);
+    default:
+        break;
+    }
+
+    switch (consumer = fork()) {
+    case -1:
+        errExit("fork");
+    case 0:
+        close(inPipe[0]);
+        close(inPipe[1]);
+        close(outPipe[1]);
+        spliceAll(outPipe[0], nullFd, pipeSize);
+        _exit(EXIT_SUCCESS);
+    default:
+        break;
+    }
+
+    close(inPipe[1]);
+    close(outPipe[0]);
+    runStage(stage, inPipe[0], outPipe[1], nullFd, pipeSize);
+    close(inPipe[0]);
+    close(outPipe[1]);
+
+    for (j = 0; j < 2; j++) {
+        if (wait(&status) == -1)
+            errExit("wait");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fatal("child failed (status %#x)", status);
+    }
+
+    return total / (1024.0 * 1024.0) / (nowSecs() - start);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-s MiB] [-p kB[,kB...]]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long sizes[MAX_SIZES];
+    long long total;
+    size_t maxSize;
+    char *tok;
+    int opt, nsizes, nullFd, j, st, v;
+
+    total = 1024LL * 1024 * 1024;
+    nsizes = 0;
+    while ((opt = getopt(argc, argv, "s:p:")) != -1) {
+        switch (opt) {
+        case 's':
+            total = getLong(optarg, GN_GT_0, "MiB") * 1024LL * 1024;
+            break;
+        case 'p':
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                if (nsizes == MAX_SIZES)
+                    cmdLineErr("Too many pipe sizes (max %d)\n", MAX_SIZES);
+                sizes[nsizes++] = getLong(tok, GN_GT_0, "kB") * 1024;
+            }
+            break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc)
+        usageError(argv[0]);
+
+    if (nsizes == 0) {
+        sizes[nsizes++] = 64 * 1024;
+        sizes[nsizes++] = 256 * 1024;
+        sizes[nsizes++] = 1024 * 1024;
+    }
+
+    maxSize = 0;
+    for (j = 0; j < nsizes; j++)
+        if (sizes[j] > maxSize)
+            maxSize = sizes[j];
+    buf = malloc(maxSize);
+    if (buf == NULL)
+        errExit("malloc");
+    memset(buf, 'x', maxSize);
+
+    nullFd = open("/dev/null", O_WRONLY);
+    if (nullFd == -1)
+        errExit("open /dev/null");
+
+    printf("%8s  %-8s %-6s %10s\n", "pipe-kB", "producer", "stage",
+            "MiB/s");
+    for (j = 0; j < nsizes; j++)
+        for (v = 0; v < 2; v++)
+            for (st = STAGE_RW; st <= STAGE_TEE; st++)
+                printf("%8ld  %-8s %-6s %10.0f\n", sizes[j] / 1024,
+                        v ? "vmsplice" : "write", stageNames[st],
+                        runTest(st, v, sizes[j], total, nullFd));
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,189 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 44 */
+
+/* splice_tee.c
+
+   A version of tee(1) for use as a pass-through stage in a pipeline:
+   copy standard input to standard output, and also to 'file', without
+   copying the data through user space.
+
+   Usage: splice_tee [-a] [-p pipe-size] file
+
+        -a            Append to 'file', rather than truncating it
+        -p pipe-size  Set the capacity (in bytes) of the pipes used by
+                      the program (with F_SETPIPE_SZ)
+
+   A filter such as change_case.c moves data through a user-space buffer,
+   so that each byte is copied twice (into the buffer by read(), and out
+   again by write()). This program instead uses tee() to duplicate the
+   data in the input pipe into the output pipe, and splice() to move the
+   data from the input pipe to the file: the kernel transfers references
+   to the pipe's pages, rather than the data.
+
+   tee() requires that both its input and its output be pipes. If
+   standard input is not a pipe, we first splice() the input into a pipe
+   of our own. If standard output is not a pipe (for example, it is a
+   socket or a regular file), we tee() the data into another pipe of our
+   own, and splice() it from there to standard output. A larger pipe
+   capacity (-p) means that each system call transfers more data.
+
+   See splice_bench.c for a comparison of the throughput of this
+   technique with that of read() and write().
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include "tlpi_hdr.h"
+
+static int pipeSize;            /* 0 means leave pipe capacity unchanged */
+
+static Boolean
+isPipe(int fd)
+{
+    struct stat sb;
+
+    if (fstat(fd, &sb) == -1)
+        errExit("fstat");
+    return S_ISFIFO(sb.st_mode);
+}
+
+static void
+setPipeSize(int fd)
+{
+    if (pipeSize > 0 && fcntl(fd, F_SETPIPE_SZ, pipeSize) == -1)
+        errExit("fcntl-F_SETPIPE_SZ");
+}
+
+/* Create a pipe of our own, returning its file descriptors in 'pfd' */
+
+static void
+makePipe(int pfd[2])
+{
+    if (pipe(pfd) == -1)
+        errExit("pipe");
+    setPipeSize(pfd[0]);
+}
+
+/* Move exactly 'len' bytes from the pipe 'inFd' to 'outFd' */
+
+static void
+spliceAll(int inFd, int outFd, size_t len)
+{
+    ssize_t s;
+
+    while (len > 0) {
+        s = splice(inFd, NULL, outFd, NULL, len, SPLICE_F_MOVE);
+        if (s == -1)
+            errExit("splice");
+        if (s == 0)
+            fatal("splice: unexpected end of input");
+        len -= s;
+    }
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-a] [-p pipe-size] file\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int inPipe[2], outPipe[2];
+    int inFd, teeFd, fileFd, opt;
+    Boolean append;
+    ssize_t numIn, len;
+
+    append = FALSE;
+    while ((opt = getopt(argc, argv, "ap:")) != -1) {
+        switch (opt) {
+        case 'a':   append = TRUE;                                      break;
+        case 'p':   pipeSize = getInt(optarg, GN_GT_0 | GN_ANY_BASE,
+                                      "pipe-size");
+                    break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc)
+        usageError(argv[0]);
+
+    /* splice() fails with EINVAL if its output file was opened with
+       O_APPEND, so for -a we instead seek to the end of the file. (Unlike
+       O_APPEND, this doesn't prevent data written by another process
+       from being overwritten.) */
+
+    fileFd = open(argv[optind], O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC),
+                  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP |
+                  S_IROTH | S_IWOTH);                           /* rw-rw-rw- */
+    if (fileFd == -1)
+        errExit("open %s", argv[optind]);
+    if (append && lseek(fileFd, 0, SEEK_END) == -1)
+        errExit("lseek");
+
+    if (isPipe(STDIN_FILENO)) {
+        inFd = STDIN_FILENO;
+        setPipeSize(inFd);
+    } else {
+        makePipe(inPipe);
+        inFd = inPipe[0];
+    }
+
+    if (isPipe(STDOUT_FILENO)) {
+        teeFd = STDOUT_FILENO;
+        setPipeSize(teeFd);
+    } else {
+        makePipe(outPipe);
+        teeFd = outPipe[1];
+    }
+
+    for (;;) {
+
+        /* If necessary, fill our input pipe from standard input */
+
+        if (inFd != STDIN_FILENO) {
+            numIn = splice(STDIN_FILENO, NULL, inPipe[1], NULL, INT_MAX,
+                           SPLICE_F_MOVE);
+            if (numIn == -1)
+                errExit("splice-stdin");
+            if (numIn == 0)             /* End of input */
+                break;
+        }
+
+        /* Duplicate the data in the input pipe. This returns 0 only if
+           the input pipe is empty and has no writers (i.e., at end of
+           input). */
+
+        len = tee(inFd, teeFd, INT_MAX, 0);
+        if (len == -1)
+            errExit("tee");
+        if (len == 0)
+            break;
+
+        if (teeFd != STDOUT_FILENO)
+            spliceAll(outPipe[0], STDOUT_FILENO, len);
+
+        /* Consume the same amount of data from the input pipe, moving
+           it to the file */
+
+        spliceAll(inFd, fileFd, len);
+    }
+
+    if (close(fileFd) == -1)
+        errExit("close");
+    exit(EXIT_SUCCESS);
+}
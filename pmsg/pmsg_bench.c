@@ -0,0 +1,632 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 52 */
+
+/* pmsg_bench.c
+
+   Measure the throughput and latency of a stream of messages passed
+   through a POSIX message queue, using each of several ways of
+   receiving the messages.
+
+   Usage: pmsg_bench [-m mode]... [-n count] [-s msg-size] [-P nprios]
+                     [-q maxmsg] [-r rate] [-b batch]
+
+        -m mode      Receive messages using 'mode', which is one of:
+                       block   blocking mq_receive() calls
+                       epoll   a nonblocking queue descriptor that is
+                               monitored with epoll_wait()
+                       thread  mq_notify() with SIGEV_THREAD
+                       signal  mq_notify() with SIGEV_SIGNAL; the signal
+                               is accepted with sigwaitinfo()
+                     This option may be repeated; the default is to run
+                     each mode in turn.
+        -n count     Number of messages to send (default: 1000000)
+        -s msg-size  Size of each message (default: 64 bytes)
+        -P nprios    Give each message a random priority in the range
+                     0..nprios-1 (default: 1, so all messages have
+                     priority 0)
+        -q maxmsg    Capacity of the queue (default: 10); values above
+                     /proc/sys/fs/mqueue/msg_max require privilege
+        -r rate      Send at most 'rate' messages per second (default: as
+                     fast as possible). Since a full queue blocks the
+                     sender, latencies measured without a rate limit
+                     mostly reflect the time that messages spend queued.
+        -b batch     When a rate is specified, send messages in bursts of
+                     'batch' messages (default: 1)
+
+   For each mode, a child process sends the messages, each carrying the
+   time at which it was sent, while the parent receives them. The
+   program reports the message rate, the number of times that the
+   receiver woke up (and so the average number of messages that it
+   collected per wakeup), the CPU time consumed per message by sender and
+   receiver, and a histogram of the latency of each message (the time from
+   just before mq_send() until mq_receive() returned it).
+
+   Since the program uses epoll to monitor a message queue descriptor,
+   it is Linux-specific.
+*/
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <mqueue.h>
+#include <fcntl.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#define NOTIFY_SIG SIGRTMIN     /* Signal used by "signal" mode */
+
+/* Latencies are recorded in a log-linear histogram: each power-of-2
+   range of nanoseconds is divided into (1 << SUB_BITS) buckets, so that
+   a bucket's width is at most 1/8 of its lower bound */
+
+#define SUB_BITS 3
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define NUM_BUCKETS (64 * SUB_BUCKETS)
+
+enum mode { MODE_BLOCK, MODE_EPOLL, MODE_THREAD, MODE_SIGNAL, NUM_MODES };
+
+static const char *modeNames[NUM_MODES] = {
+    "block", "epoll", "thread", "signal"
+};
+
+struct benchMsg {               /* Start of each message */
+    struct timespec sent;       /* CLOCK_MONOTONIC time before mq_send() */
+    long seq;
+};
+
+struct runResult {              /* Results for one mode */
+    enum mode mode;
+    long msgs;
+    long wakeups;               /* Times that receiver woke for messages */
+    double secs;                /* Elapsed time */
+    double rcvCpu;              /* Receiver and sender CPU time (secs) */
+    double sndCpu;
+    long long min, max;         /* Latencies (nanoseconds) */
+    long long sum;
+    long hist[NUM_BUCKETS];
+};
+
+static long count = 1000000;
+static int msgSize = 64;
+static int nprios = 1;
+static long maxmsg = 10;
+static long rate = 0;
+static int batch = 1;
+
+/* State shared between main() and the "thread" mode notification
+   function */
+
+static mqd_t rcvMqd;
+static char *rcvBuf;
+static struct runResult *curRes;
+static pthread_mutex_t rcvMutex = PTHREAD_MUTEX_INITIALIZER;
+static sem_t rcvDone;
+static int curGen;              /* Incremented for each "thread" run */
+
+static long long
+tsDiffNs(const struct timespec *a, const struct timespec *b)
+{
+    return (a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+static double
+tvSecs(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static int
+bucketIndex(long long ns)
+{
+    int e;
+
+    if (ns < SUB_BUCKETS)
+        return (ns < 0) ? 0 : ns;
+    e = 63 - __builtin_clzll(ns);           /* Position of leading 1 bit */
+    return (e - SUB_BITS + 1) * SUB_BUCKETS +
+           ((ns >> (e - SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+static long long                /* Inverse of bucketIndex() */
+bucketLow(int idx)
+{
+    int e;
+
+    if (idx < SUB_BUCKETS)
+        return idx;
+    e = idx / SUB_BUCKETS + SUB_BITS - 1;
+    return (1LL << e) + ((long long) (idx % SUB_BUCKETS) << (e - SUB_BITS));
+}
+
+/* Record the message in 'rcvBuf', which has just been received */
+
+static void
+recordMsg(struct runResult *res)
+{
+    struct benchMsg *msg = (struct benchMsg *) rcvBuf;
+    struct timespec now;
+    long long lat;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+        errExit("clock_gettime");
+    lat = tsDiffNs(&now, &msg->sent);
+
+    if (res->msgs == 0 || lat < res->min)
+        res->min = lat;
+    if (lat > res->max)
+        res->max = lat;
+    res->sum += lat;
+    res->hist[bucketIndex(lat)]++;
+    res->msgs++;
+}
+
+/* Receive messages from the nonblocking descriptor 'rcvMqd' until the
+   queue is empty or all messages have been received */
+
+static void
+drainQueue(struct runResult *res)
+{
+    while (res->msgs < count) {
+        if (mq_receive(rcvMqd, rcvBuf, msgSize, NULL) == -1) {
+            if (errno == EAGAIN)
+                break;
+            errExit("mq_receive");
+        }
+        recordMsg(res);
+    }
+}
+
+static void notifySetup(int gen);
+
+static void                     /* "thread" mode notification function */
+threadFunc(union sigval sv)
+{
+    if (pthread_mutex_lock(&rcvMutex) != 0)
+        fatal("pthread_mutex_lock");
+
+    /* A notification that was triggered during an earlier run (or was
+       already in progress when the current run completed) is ignored */
+
+    if (sv.sival_int == curGen && curRes->msgs < count) {
+        curRes->wakeups++;
+        notifySetup(sv.sival_int);      /* Reregister, then empty queue */
+        drainQueue(curRes);
+        if (curRes->msgs == count)
+            if (sem_post(&rcvDone) == -1)
+                errExit("sem_post");
+    }
+
+    if (pthread_mutex_unlock(&rcvMutex) != 0)
+        fatal("pthread_mutex_unlock");
+}
+
+static void
+notifySetup(int gen)
+{
+    struct sigevent sev;
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD;
+    sev.sigev_notify_function = threadFunc;
+    sev.sigev_notify_attributes = NULL;
+    sev.sigev_value.sival_int = gen;
+
+    if (mq_notify(rcvMqd, &sev) == -1)
+        errExit("mq_notify");
+}
+
+static void
+signalSetup(void)
+{
+    struct sigevent sev;
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = NOTIFY_SIG;
+
+    if (mq_notify(rcvMqd, &sev) == -1)
+        errExit("mq_notify");
+}
+
+/* Send 'count' messages on the queue 'name', then exit; executed in
+   the child process */
+
+static void
+sender(const char *name)
+{
+    struct benchMsg *msg;
+    struct timespec next;
+    unsigned int prio;
+    long interval;
+    mqd_t mqd;
+    char *buf;
+    int j;
+
+    mqd = mq_open(name, O_WRONLY);
+    if (mqd == (mqd_t) -1)
+        errExit("mq_open");
+
+    buf = calloc(1, msgSize);
+    if (buf == NULL)
+        errExit("calloc");
+    msg = (struct benchMsg *) buf;
+    srandom(getpid());
+
+    interval = (rate > 0) ? 1000000000.0 * batch / rate : 0;
+    if (clock_gettime(CLOCK_MONOTONIC, &next) == -1)
+        errExit("clock_gettime");
+
+    for (msg->seq = 0; msg->seq < count; ) {
+
+        /* Under a rate limit, sleep until the next burst is due */
+
+        if (interval > 0) {
+            next.tv_nsec += interval;
+            while (next.tv_nsec >= 1000000000) {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000;
+            }
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                                   &next, NULL) == EINTR)
+                continue;
+        }
+
+        for (j = 0; j < batch && msg->seq < count; j++, msg->seq++) {
+            prio = (nprios > 1) ? random() % nprios : 0;
+            if (clock_gettime(CLOCK_MONOTONIC, &msg->sent) == -1)
+                errExit("clock_gettime");
+            if (mq_send(mqd, buf, msgSize, prio) == -1)
+                errExit("mq_send");
+        }
+    }
+
+    _exit(EXIT_SUCCESS);
+}
+
+/* Run the benchmark using 'mode', placing the results in 'res' */
+
+static void
+runMode(enum mode mode, struct runResult *res)
+{
+    struct epoll_event ev;
+    struct rusage ruStart, ruEnd, ruChild;
+    struct timespec start, end;
+    struct mq_attr attr;
+    char name[64];
+    int epfd, status, sig;
+    sigset_t notifySet;
+    pid_t childPid;
+
+    memset(res, 0, sizeof(*res));
+    res->mode = mode;
+
+    snprintf(name, sizeof(name), "/pmsg_bench.%ld", (long) getpid());
+    attr.mq_flags = 0;
+    attr.mq_maxmsg = maxmsg;
+    attr.mq_msgsize = msgSize;
+    rcvMqd = mq_open(name, O_RDONLY | O_CREAT | O_EXCL |
+                     ((mode == MODE_BLOCK) ? 0 : O_NONBLOCK),
+                     S_IRUSR | S_IWUSR, &attr);
+    if (rcvMqd == (mqd_t) -1)
+        errExit("mq_open (maxmsg=%ld, msgsize=%d)", maxmsg, msgSize);
+
+    /* Set up the notification mechanism before the sender starts, so
+       that the queue is known to be empty */
+
+    epfd = -1;
+    sigemptyset(&notifySet);
+    sigaddset(&notifySet, NOTIFY_SIG);
+
+    switch (mode) {
+    case MODE_EPOLL:
+        epfd = epoll_create1(0);
+        if (epfd == -1)
+            errExit("epoll_create1");
+        ev.events = EPOLLIN;
+        ev.data.fd = rcvMqd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, rcvMqd, &ev) == -1)
+            errExit("epoll_ctl");
+        break;
+    case MODE_THREAD:
+        if (pthread_mutex_lock(&rcvMutex) != 0)
+            fatal("pthread_mutex_lock");
+        curRes = res;
+        curGen++;
+        notifySetup(curGen);
+        if (pthread_mutex_unlock(&rcvMutex) != 0)
+            fatal("pthread_mutex_unlock");
+        break;
+    case MODE_SIGNAL:
+        signalSetup();
+        break;
+    default:
+        break;
+    }
+
+    if (getrusage(RUSAGE_SELF, &ruStart) == -1)
+        errExit("getrusage");
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+
+    childPid = fork();
+    if (childPid == -1)
+        errExit("fork");
+    if (childPid == 0)
+        sender(name);
+
+    switch (mode) {
+    case MODE_BLOCK:
+        while (res->msgs < count) {
+            if (mq_receive(rcvMqd, rcvBuf, msgSize, NULL) == -1)
+                errExit("mq_receive");
+            res->wakeups++;
+            recordMsg(res);
+        }
+        break;
+
+    case MODE_EPOLL:
+        while (res->msgs < count) {
+            if (epoll_wait(epfd, &ev, 1, -1) == -1) {
+                if (errno == EINTR)
+                    continue;
+                errExit("epoll_wait");
+            }
+            res->wakeups++;
+            drainQueue(res);
+        }
+        break;
+
+    case MODE_THREAD:
+        while (sem_wait(&rcvDone) == -1)
+            if (errno != EINTR)
+                errExit("sem_wait");
+
+        /* Ensure that the notification thread that posted the semaphore
+           has finished with 'res' */
+
+        if (pthread_mutex_lock(&rcvMutex) != 0)
+            fatal("pthread_mutex_lock");
+        if (pthread_mutex_unlock(&rcvMutex) != 0)
+            fatal("pthread_mutex_unlock");
+        break;
+
+    case MODE_SIGNAL:
+        drainQueue(res);
+        while (res->msgs < count) {
+            sig = sigwaitinfo(&notifySet, NULL);
+            if (sig == -1) {
+                if (errno == EINTR)
+                    continue;
+                errExit("sigwaitinfo");
+            }
+            res->wakeups++;
+            signalSetup();              /* Reregister, then empty queue */
+            drainQueue(res);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+    if (getrusage(RUSAGE_SELF, &ruEnd) == -1)
+        errExit("getrusage");
+    if (wait4(childPid, &status, 0, &ruChild) == -1)
+        errExit("wait4");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        fatal("sender terminated abnormally");
+
+    res->secs = tsDiffNs(&end, &start) / 1e9;
+    res->rcvCpu = tvSecs(&ruEnd.ru_utime) - tvSecs(&ruStart.ru_utime) +
+                  tvSecs(&ruEnd.ru_stime) - tvSecs(&ruStart.ru_stime);
+    res->sndCpu = tvSecs(&ruChild.ru_utime) + tvSecs(&ruChild.ru_stime);
+
+    /* In "thread" and "signal" modes, we may still be registered for
+       notification; that registration is removed when the queue is
+       closed */
+
+    if (epfd != -1)
+        close(epfd);
+    if (mq_close(rcvMqd) == -1)
+        errExit("mq_close");
+    if (mq_unlink(name) == -1)
+        errExit("mq_unlink");
+
+    /* Discard any notification signal that was generated during the
+       last drainQueue() */
+
+    if (mode == MODE_SIGNAL) {
+        struct timespec zero = { 0, 0 };
+
+        while (sigtimedwait(&notifySet, NULL, &zero) > 0)
+            continue;
+    }
+}
+
+/* Return the latency (in nanoseconds) below which fraction 'p' of the
+   messages were received; the result is the upper bound of the
+   histogram bucket that contains that fraction */
+
+static long long
+percentile(const struct runResult *res, double p)
+{
+    long target, seen;
+    int j;
+
+    target = p * res->msgs;
+    if (target >= res->msgs)
+        target = res->msgs - 1;
+
+    seen = 0;
+    for (j = 0; j < NUM_BUCKETS; j++) {
+        seen += res->hist[j];
+        if (seen > target)
+            return min(bucketLow(j + 1) - 1, res->max);
+    }
+    return res->max;
+}
+
+static void
+printResult(const struct runResult *res)
+{
+    long long lo;
+    long maxCnt, cnt;
+    int j, k, first, last;
+
+    printf("%s: %ld messages of %d bytes in %.3f s: %.0f msgs/s; %.2f MB/s\n",
+            modeNames[res->mode], res->msgs, msgSize, res->secs,
+            res->msgs / res->secs, res->msgs * (double) msgSize / 1e6 /
+            res->secs);
+    printf("    wakeups: %ld (%.1f msgs/wakeup); CPU per message: "
+            "receiver %.3f us, sender %.3f us\n", res->wakeups,
+            (double) res->msgs / res->wakeups, res->rcvCpu * 1e6 / res->msgs,
+            res->sndCpu * 1e6 / res->msgs);
+    printf("    latency (us): min %.1f; mean %.1f; p50 %.1f; p90 %.1f; "
+            "p99 %.1f; p99.9 %.1f; max %.1f\n", res->min / 1e3,
+            res->sum / 1e3 / res->msgs, percentile(res, 0.5) / 1e3,
+            percentile(res, 0.9) / 1e3, percentile(res, 0.99) / 1e3,
+            percentile(res, 0.999) / 1e3, res->max / 1e3);
+
+    /* Display the histogram with one row per power of 2 */
+
+    first = last = -1;
+    maxCnt = 0;
+    for (j = 0; j < 64; j++) {
+        cnt = 0;
+        for (k = 0; k < SUB_BUCKETS; k++)
+            if (j * SUB_BUCKETS + k < NUM_BUCKETS)
+                cnt += res->hist[j * SUB_BUCKETS + k];
+        if (cnt > 0) {
+            if (first == -1)
+                first = j;
+            last = j;
+            maxCnt = max(maxCnt, cnt);
+        }
+    }
+
+    for (j = first; j >= 0 && j <= last; j++) {
+        cnt = 0;
+        for (k = 0; k < SUB_BUCKETS; k++)
+            cnt += res->hist[j * SUB_BUCKETS + k];
+        lo = bucketLow(j * SUB_BUCKETS);
+        printf("    %10.3f - %10.3f us %10ld |%.*s\n", lo / 1e3,
+                (bucketLow((j + 1) * SUB_BUCKETS) - 1) / 1e3, cnt,
+                (int) (cnt * 50 / maxCnt), "**************************"
+                "************************");
+    }
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-m mode]... [-n count] [-s msg-size] "
+                    "[-P nprios]\n\t\t[-q maxmsg] [-r rate] [-b batch]\n",
+                    progName);
+    fprintf(stderr, "    -m mode      block, epoll, thread, or signal "
+                    "(default: all)\n");
+    fprintf(stderr, "    -n count     Number of messages (default: %ld)\n",
+                    count);
+    fprintf(stderr, "    -s msg-size  Message size (default: %d)\n", msgSize);
+    fprintf(stderr, "    -P nprios    Number of message priorities "
+                    "(default: %d)\n", nprios);
+    fprintf(stderr, "    -q maxmsg    Queue capacity (default: %ld)\n",
+                    maxmsg);
+    fprintf(stderr, "    -r rate      Messages per second (default: "
+                    "unlimited)\n");
+    fprintf(stderr, "    -b batch     Messages per burst when rate "
+                    "limited (default: %d)\n", batch);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static struct runResult res[NUM_MODES];
+    enum mode modes[NUM_MODES];
+    sigset_t blockSet;
+    int opt, nmodes, m, j;
+
+    nmodes = 0;
+    while ((opt = getopt(argc, argv, "m:n:s:P:q:r:b:")) != -1) {
+        switch (opt) {
+        case 'm':
+            for (m = 0; m < NUM_MODES; m++)
+                if (strcmp(optarg, modeNames[m]) == 0)
+                    break;
+            if (m == NUM_MODES || nmodes == NUM_MODES)
+                usageError(argv[0]);
+            modes[nmodes++] = m;
+            break;
+        case 'n':   count = getLong(optarg, GN_GT_0, "count");          break;
+        case 's':   msgSize = getInt(optarg, GN_GT_0 | GN_ANY_BASE,
+                                     "msg-size");                       break;
+        case 'P':   nprios = getInt(optarg, GN_GT_0, "nprios");         break;
+        case 'q':   maxmsg = getLong(optarg, GN_GT_0, "maxmsg");        break;
+        case 'r':   rate = getLong(optarg, GN_GT_0, "rate");            break;
+        case 'b':   batch = getInt(optarg, GN_GT_0, "batch");           break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc)
+        usageError(argv[0]);
+    if (msgSize < (int) sizeof(struct benchMsg))
+        cmdLineErr("msg-size must be at least %ld\n",
+                (long) sizeof(struct benchMsg));
+    if (nprios > sysconf(_SC_MQ_PRIO_MAX))
+        cmdLineErr("nprios must be at most %ld\n",
+                sysconf(_SC_MQ_PRIO_MAX));
+
+    if (nmodes == 0)
+        for (m = 0; m < NUM_MODES; m++)
+            modes[nmodes++] = m;
+
+    /* Block the notification signal (before any notification thread
+       is created), so that it can be accepted with sigwaitinfo() */
+
+    sigemptyset(&blockSet);
+    sigaddset(&blockSet, NOTIFY_SIG);
+    if (sigprocmask(SIG_BLOCK, &blockSet, NULL) == -1)
+        errExit("sigprocmask");
+
+    if (sem_init(&rcvDone, 0, 0) == -1)
+        errExit("sem_init");
+
+    rcvBuf = malloc(msgSize);
+    if (rcvBuf == NULL)
+        errExit("malloc");
+
+    for (j = 0; j < nmodes; j++) {
+        runMode(modes[j], &res[j]);
+        printResult(&res[j]);
+    }
+
+    /* Summarize, if more than one mode was run */
+
+    if (nmodes > 1) {
+        printf("\n%-8s %12s %14s %12s %12s %12s\n", "mode", "msgs/s",
+                "msgs/wakeup", "rcv us/msg", "p50 us", "p99 us");
+        for (j = 0; j < nmodes; j++)
+            printf("%-8s %12.0f %14.1f %12.3f %12.1f %12.1f\n",
+                    modeNames[res[j].mode], res[j].msgs / res[j].secs,
+                    (double) res[j].msgs / res[j].wakeups,
+                    res[j].rcvCpu * 1e6 / res[j].msgs,
+                    percentile(&res[j], 0.5) / 1e3,
+                    percentile(&res[j], 0.99) / 1e3);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,506 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 6 */
+
+/* env_builder.c
+
+   Build environment lists for execve(), as changes to a base
+   environment.
+
+   getenv() searches the 'environ' list linearly, and setenv() (see
+   setenv.c, the solution to Exercise 6-3) does the same search and then
+   allocates a new string (and perhaps a new list) on the heap. A program
+   that launches many children, each with its own variations on a large
+   environment, does a lot of such searching and allocation, and must
+   then undo its changes (or copy the whole environment) before preparing
+   the next child.
+
+   Here, an envBase holds a copy of an environment (by default, 'environ'),
+   with a hash table on the variable names; it is not changed after
+   envBaseInit(), so one base can be shared by many builders (and by
+   threads). An envBuilder records changes to a base (variables set,
+   replaced, or removed) in a small hash table of its own; its strings
+   are allocated from an arena (see memalloc/arena.c), so that
+   envBuilderReset() discards all of the changes at once, ready for the
+   next child, without freeing anything. Looking up a variable with
+   envGet() costs one probe of each hash table.
+
+   envBuild() then produces the environment list in a single allocation
+   (freed with a single free()): the array of pointers is followed by
+   the strings. envBuildInto() instead builds the list in memory
+   supplied by the caller (of at least envBuildSize() bytes, suitably
+   aligned for a pointer), which might be reused from one child to the
+   next, or taken from an arena that is reset for each child. The
+   variables of the base appear in their original order, with replaced
+   variables in their original positions, followed by new variables in
+   the order in which they were first set (the order that repeated
+   setenv() calls would produce).
+
+   As with getenv(), if the base contains more than one definition of a
+   name, the first is used; later ones are dropped.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "env_builder.h"        /* Declares functions defined here */
+
+#define MIN_TABLE 16
+
+extern char **environ;
+
+/* FNV-1a hash of the 'len' bytes of 'name' */
+
+static uint32_t
+hashName(const char *name, size_t len)
+{
+    uint32_t h;
+    size_t j;
+
+    h = 2166136261u;
+    for (j = 0; j < len; j++) {
+        h ^= (unsigned char) name[j];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Find 'name' (of 'len' bytes, with hash 'h') in the hash table 'table'
+   (of 'mask' + 1 slots) of indexes into 'vars'. Returns the slot that
+   holds its index, or, if it is not present, the empty slot (containing
+   -1) where it belongs. */
+
+static uint32_t
+findSlot(const struct envVar *vars, const int *table, uint32_t mask,
+         const char *name, size_t len, uint32_t h)
+{
+    const struct envVar *v;
+    uint32_t slot;
+
+    for (slot = h & mask; table[slot] != -1; slot = (slot + 1) & mask) {
+        v = &vars[table[slot]];
+        if (v->hash == h && v->nameLen == len &&
+                memcmp(v->str, name, len) == 0)
+            break;
+    }
+    return slot;
+}
+
+static int *
+newTable(uint32_t size)
+{
+    int *table;
+
+    table = malloc(size * sizeof(int));
+    if (table != NULL)
+        memset(table, -1, size * sizeof(int));
+    return table;
+}
+
+static int
+validName(const char *name)
+{
+    if (name == NULL || name[0] == '\0' || strchr(name, '=') != NULL) {
+        errno = EINVAL;
+        return 0;
+    }
+    return 1;
+}
+
+/* Initialize 'eb' with a copy of the environment list 'envp' (or of
+   'environ', if 'envp' is NULL). Strings that don't contain '=' are
+   ignored. Returns 0 on success, or -1 on error. */
+
+int
+envBaseInit(struct envBase *eb, char *const envp[])
+{
+    struct envVar *v;
+    size_t bytes, nameLen, len;
+    uint32_t size, slot, h;
+    const char *eq;
+    char *p;
+    int n, j;
+
+    if (envp == NULL)
+        envp = environ;
+
+    n = 0;
+    bytes = 0;
+    for (j = 0; envp[j] != NULL; j++) {
+        n++;
+        bytes += strlen(envp[j]) + 1;
+    }
+
+    for (size = MIN_TABLE; size < 2 * (uint32_t) n; size *= 2)
+        ;
+    eb->vars = malloc((n > 0 ? n : 1) * sizeof(struct envVar));
+    eb->strs = malloc(bytes > 0 ? bytes : 1);
+    eb->table = newTable(size);
+    if (eb->vars == NULL || eb->strs == NULL || eb->table == NULL) {
+        envBaseFree(eb);
+        return -1;
+    }
+    eb->mask = size - 1;
+    eb->nvars = 0;
+
+    p = eb->strs;
+    for (j = 0; envp[j] != NULL; j++) {
+        eq = strchr(envp[j], '=');
+        if (eq == NULL || eq == envp[j])
+            continue;
+        nameLen = eq - envp[j];
+        h = hashName(envp[j], nameLen);
+        slot = findSlot(eb->vars, eb->table, eb->mask, envp[j], nameLen, h);
+        if (eb->table[slot] != -1)
+            continue;                   /* Duplicate: the first one wins */
+
+        len = strlen(envp[j]);
+        memcpy(p, envp[j], len + 1);
+        v = &eb->vars[eb->nvars];
+        v->str = p;
+        v->nameLen = nameLen;
+        v->len = len;
+        v->hash = h;
+        v->baseIdx = -1;
+        eb->table[slot] = eb->nvars++;
+        p += len + 1;
+    }
+    eb->strBytes = p - eb->strs;
+    return 0;
+}
+
+/* Return the value of 'name' in 'eb', or NULL if it is not defined */
+
+const char *
+envBaseGet(const struct envBase *eb, const char *name)
+{
+    uint32_t slot;
+    size_t len;
+    int idx;
+
+    len = strlen(name);
+    slot = findSlot(eb->vars, eb->table, eb->mask, name, len,
+                    hashName(name, len));
+    idx = eb->table[slot];
+    return (idx == -1) ? NULL : eb->vars[idx].str + len + 1;
+}
+
+void
+envBaseFree(struct envBase *eb)
+{
+    free(eb->vars);
+    free(eb->strs);
+    free(eb->table);
+    eb->vars = NULL;
+    eb->strs = NULL;
+    eb->table = NULL;
+    eb->nvars = 0;
+}
+
+/* Initialize 'b' to describe changes to 'base' (which may be NULL, for
+   an initially empty environment). 'base' must not be freed while 'b' is
+   in use. Returns 0 on success, or -1 on error. */
+
+int
+envBuilderInit(struct envBuilder *b, const struct envBase *base)
+{
+    b->base = base;
+    b->vars = NULL;
+    b->nvars = 0;
+    b->maxVars = 0;
+    b->hidden = 0;
+    b->table = newTable(MIN_TABLE);
+    if (b->table == NULL)
+        return -1;
+    b->mask = MIN_TABLE - 1;
+    return arenaInit(&b->arena, 16384, 0);
+}
+
+/* Double the size of the builder's hash table */
+
+static int
+growTable(struct envBuilder *b)
+{
+    uint32_t size, slot;
+    int *table, j;
+
+    size = 2 * (b->mask + 1);
+    table = newTable(size);
+    if (table == NULL)
+        return -1;
+    for (j = 0; j < b->nvars; j++) {
+        for (slot = b->vars[j].hash & (size - 1); table[slot] != -1;
+                slot = (slot + 1) & (size - 1))
+            ;
+        table[slot] = j;
+    }
+    free(b->table);
+    b->table = table;
+    b->mask = size - 1;
+    return 0;
+}
+
+/* Record that 'name' (of 'nameLen' bytes) has the value 'value' (of
+   'valueLen' bytes), or, if 'value' is NULL, that it is unset */
+
+static int
+change(struct envBuilder *b, const char *name, size_t nameLen,
+       const char *value, size_t valueLen)
+{
+    const struct envBase *base = b->base;
+    struct envVar *v;
+    uint32_t slot, h;
+    size_t len;
+    char *str;
+    int baseIdx;
+
+    h = hashName(name, nameLen);
+    slot = findSlot(b->vars, b->table, b->mask, name, nameLen, h);
+
+    baseIdx = -1;
+    if (b->table[slot] == -1) {
+        if (base != NULL)
+            baseIdx = base->table[findSlot(base->vars, base->table,
+                                           base->mask, name, nameLen, h)];
+        if (value == NULL && baseIdx == -1)
+            return 0;                   /* Unsetting an undefined name */
+    }
+
+    len = (value != NULL) ? nameLen + 1 + valueLen : nameLen;
+    str = arenaAlloc(&b->arena, len + 1);
+    if (str == NULL)
+        return -1;
+    memcpy(str, name, nameLen);
+    if (value != NULL) {
+        str[nameLen] = '=';
+        memcpy(str + nameLen + 1, value, valueLen);
+    }
+    str[len] = '\0';
+
+    if (b->table[slot] != -1) {         /* Already changed: change again */
+        v = &b->vars[b->table[slot]];
+        v->str = str;
+        v->len = len;
+        return 0;
+    }
+
+    if (b->nvars == b->maxVars) {
+        b->maxVars = (b->maxVars > 0) ? 2 * b->maxVars : 16;
+        v = realloc(b->vars, b->maxVars * sizeof(struct envVar));
+        if (v == NULL)
+            return -1;
+        b->vars = v;
+    }
+    if (2 * (uint32_t) (b->nvars + 1) > b->mask + 1) {
+        if (growTable(b) == -1)
+            return -1;
+        slot = findSlot(b->vars, b->table, b->mask, name, nameLen, h);
+    }
+
+    v = &b->vars[b->nvars];
+    v->str = str;
+    v->nameLen = nameLen;
+    v->len = len;
+    v->hash = h;
+    v->baseIdx = baseIdx;
+    b->table[slot] = b->nvars++;
+    if (baseIdx != -1)
+        b->hidden++;
+    return 0;
+}
+
+/* Set 'name' to 'value', replacing any earlier definition (as for
+   setenv() with 'overwrite' nonzero). Returns 0 on success, or -1 on
+   error. */
+
+int
+envSet(struct envBuilder *b, const char *name, const char *value)
+{
+    if (!validName(name))
+        return -1;
+    return change(b, name, strlen(name), value, strlen(value));
+}
+
+/* Add a "name=value" string (which is copied, unlike with putenv()).
+   Returns 0 on success, or -1 on error. */
+
+int
+envPut(struct envBuilder *b, const char *string)
+{
+    const char *eq;
+
+    eq = strchr(string, '=');
+    if (eq == NULL || eq == string) {
+        errno = EINVAL;
+        return -1;
+    }
+    return change(b, string, eq - string, eq + 1, strlen(eq + 1));
+}
+
+/* Remove 'name'. Returns 0 on success, or -1 on error. */
+
+int
+envUnset(struct envBuilder *b, const char *name)
+{
+    if (!validName(name))
+        return -1;
+    return change(b, name, strlen(name), NULL, 0);
+}
+
+/* Return the value of 'name', or NULL if it is not defined */
+
+const char *
+envGet(const struct envBuilder *b, const char *name)
+{
+    const struct envVar *v;
+    uint32_t slot;
+    size_t len;
+
+    len = strlen(name);
+    slot = findSlot(b->vars, b->table, b->mask, name, len,
+                    hashName(name, len));
+    if (b->table[slot] == -1)
+        return (b->base != NULL) ? envBaseGet(b->base, name) : NULL;
+
+    v = &b->vars[b->table[slot]];
+    return (v->len == v->nameLen) ? NULL : v->str + len + 1;
+}
+
+/* Count the variables in the environment list that 'b' describes, and
+   the bytes in their strings */
+
+static void
+countVars(const struct envBuilder *b, long *count, size_t *bytes)
+{
+    const struct envVar *v;
+
+    *count = 0;
+    *bytes = 0;
+    if (b->base != NULL) {
+        *count = b->base->nvars;
+        *bytes = b->base->strBytes;
+    }
+    for (v = b->vars; v < b->vars + b->nvars; v++) {
+        if (v->baseIdx != -1) {
+            (*count)--;
+            *bytes -= b->base->vars[v->baseIdx].len + 1;
+        }
+        if (v->len != v->nameLen) {
+            (*count)++;
+            *bytes += v->len + 1;
+        }
+    }
+}
+
+/* Return the number of bytes needed by envBuildInto() */
+
+size_t
+envBuildSize(const struct envBuilder *b)
+{
+    size_t bytes;
+    long count;
+
+    countVars(b, &count, &bytes);
+    return (count + 1) * sizeof(char *) + bytes;
+}
+
+/* Build the environment list in 'mem', which has room for 'size' bytes.
+   Returns a pointer to the list (which is at the start of 'mem'), or
+   NULL (with errno set to ERANGE) if 'size' is too small. */
+
+char **
+envBuildInto(const struct envBuilder *b, void *mem, size_t size)
+{
+    const struct envBase *base = b->base;
+    const struct envVar *v, *bv;
+    uint32_t slot;
+    char **ep, *p;
+    size_t bytes;
+    long count;
+    int j;
+
+    countVars(b, &count, &bytes);
+    if (size < (count + 1) * sizeof(char *) + bytes) {
+        errno = ERANGE;
+        return NULL;
+    }
+
+    ep = mem;
+    p = (char *) (ep + count + 1);      /* The strings follow the list */
+
+    /* The base variables, in order, except where they have been changed
+       (there is no need to look if nothing was changed) */
+
+    if (base != NULL) {
+        for (j = 0; j < base->nvars; j++) {
+            bv = &base->vars[j];
+            v = bv;
+            if (b->hidden > 0) {
+                slot = findSlot(b->vars, b->table, b->mask, bv->str,
+                                bv->nameLen, bv->hash);
+                if (b->table[slot] != -1) {
+                    v = &b->vars[b->table[slot]];
+                    if (v->len == v->nameLen)
+                        continue;               /* Unset */
+                }
+            }
+            memcpy(p, v->str, v->len + 1);
+            *ep++ = p;
+            p += v->len + 1;
+        }
+    }
+
+    /* Followed by the new variables */
+
+    for (v = b->vars; v < b->vars + b->nvars; v++) {
+        if (v->baseIdx == -1 && v->len != v->nameLen) {
+            memcpy(p, v->str, v->len + 1);
+            *ep++ = p;
+            p += v->len + 1;
+        }
+    }
+    *ep = NULL;
+    return mem;
+}
+
+/* Build the environment list in a single allocation, which the caller
+   frees with free(). Returns a pointer to the list, or NULL on error. */
+
+char **
+envBuild(const struct envBuilder *b)
+{
+    size_t size;
+    void *mem;
+
+    size = envBuildSize(b);
+    mem = malloc(size);
+    if (mem == NULL)
+        return NULL;
+    return envBuildInto(b, mem, size);
+}
+
+/* Discard all of the changes, keeping the memory for reuse */
+
+void
+envBuilderReset(struct envBuilder *b)
+{
+    memset(b->table, -1, (b->mask + 1) * sizeof(int));
+    b->nvars = 0;
+    b->hidden = 0;
+    arenaReset(&b->arena);
+}
+
+void
+envBuilderFree(struct envBuilder *b)
+{
+    free(b->vars);
+    free(b->table);
+    arenaDestroy(&b->arena);
+}
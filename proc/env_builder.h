@@ -0,0 +1,81 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 6 */
+
+/* env_builder.h
+
+   Header file for env_builder.c.
+*/
+#ifndef ENV_BUILDER_H
+#define ENV_BUILDER_H           /* Prevent accidental double inclusion */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+struct envVar {                 /* One "name=value" string */
+    const char *str;            /* Just "name" if a builder unsets the
+                                   variable */
+    size_t nameLen;             /* Length of "name" */
+    size_t len;                 /* strlen(str); equal to 'nameLen' if the
+                                   variable is unset */
+    uint32_t hash;              /* Hash of "name" */
+    int baseIdx;                /* Builder: index of the base variable
+                                   that this replaces, or -1 */
+};
+
+struct envBase {                /* An immutable, hashed environment */
+    struct envVar *vars;        /* In their original order */
+    int nvars;
+    int *table;                 /* Hash table of indexes in 'vars' */
+    uint32_t mask;              /* Size of 'table' minus 1 */
+    char *strs;                 /* Copies of the strings */
+    size_t strBytes;            /* Bytes in 'strs' */
+};
+
+struct envBuilder {             /* Changes to a base environment */
+    const struct envBase *base; /* May be NULL (an empty base) */
+    struct envVar *vars;        /* Variables set or unset, in order */
+    int nvars;
+    int maxVars;                /* Allocated size of 'vars' */
+    int *table;                 /* Hash table of indexes in 'vars' */
+    uint32_t mask;
+    int hidden;                 /* Base variables replaced or unset */
+    struct arena arena;         /* Holds the strings that are set */
+};
+
+int envBaseInit(struct envBase *eb, char *const envp[]);
+
+const char *envBaseGet(const struct envBase *eb, const char *name);
+
+void envBaseFree(struct envBase *eb);
+
+int envBuilderInit(struct envBuilder *b, const struct envBase *base);
+
+int envSet(struct envBuilder *b, const char *name, const char *value);
+
+int envPut(struct envBuilder *b, const char *string);
+
+int envUnset(struct envBuilder *b, const char *name);
+
+const char *envGet(const struct envBuilder *b, const char *name);
+
+size_t envBuildSize(const struct envBuilder *b);
+
+char **envBuildInto(const struct envBuilder *b, void *mem, size_t size);
+
+char **envBuild(const struct envBuilder *b);
+
+void envBuilderReset(struct envBuilder *b);
+
+void envBuilderFree(struct envBuilder *b);
+
+#endif
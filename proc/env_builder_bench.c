@@ -0,0 +1,384 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 6 */
+
+/* env_builder_bench.c
+
+   Compare the cost of preparing environment lists for many children
+   (as a program that launches children would) by copying the parent's
+   environment and changing it with a linear search for each variable
+   (in the manner of setenv() and unsetenv(); see setenv.c), and by using
+   the environment builder implemented in env_builder.c. Also compare
+   the cost of looking up variables with getenv() and with envBaseGet().
+
+   Usage: env_builder_bench [-n nvars] [-d ndelta] [-c nchildren] [-e]
+
+        -n nvars      Variables in the synthetic base environment
+                      (default: 200)
+        -d ndelta     Variables changed for each child (default: 10): a
+                      quarter of them are unset, a quarter are replaced,
+                      and the rest are new
+        -c nchildren  Environment lists built by each repetition
+                      (default: 10000)
+        -e            Use this program's own environment as the base,
+                      instead of a synthetic one
+
+   Before measuring, the program checks that both methods produce the
+   same list. The lists built by the environment builder are either
+   each allocated with malloc() (envBuild()), or built in a block taken
+   from an arena that is reset for each child (envBuildInto()). The
+   results are reported in the common format of lib/bench.c, in terms
+   of the cost per child (or per lookup).
+
+   Try: ./env_builder_bench
+        ./env_builder_bench -n 1000 -d 50
+        ./env_builder_bench -e -d 4
+*/
+#include "env_builder.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+extern char **environ;
+
+static char **baseEnv;          /* The base environment list */
+static int nbase;
+static struct envBase base;
+
+static int ndelta;
+static char **deltaName;        /* Name of each changed variable */
+static char **deltaValue;       /* Its new value, or NULL to unset it */
+
+/* Build a child's list the straightforward way: copy the base list, and
+   then, for each change, search the list and replace, remove, or append
+   a string allocated on the heap. Strings allocated here are marked in
+   'owned', so that freeEnv() can free them. */
+
+static char **
+linearEnv(Boolean **ownedp)
+{
+    char **ep, *str;
+    Boolean *owned;
+    size_t len;
+    int n, j, k;
+
+    ep = malloc((nbase + ndelta + 1) * sizeof(char *));
+    owned = calloc(nbase + ndelta + 1, sizeof(Boolean));
+    if (ep == NULL || owned == NULL)
+        errExit("malloc");
+    memcpy(ep, baseEnv, (nbase + 1) * sizeof(char *));
+    n = nbase;
+
+    for (j = 0; j < ndelta; j++) {
+        len = strlen(deltaName[j]);
+        for (k = 0; k < n; k++)
+            if (strncmp(ep[k], deltaName[j], len) == 0 && ep[k][len] == '=')
+                break;
+
+        if (deltaValue[j] == NULL) {            /* Unset */
+            if (k < n) {
+                if (owned[k])
+                    free(ep[k]);
+                memmove(&ep[k], &ep[k + 1], (n - k) * sizeof(char *));
+                memmove(&owned[k], &owned[k + 1], (n - k) * sizeof(Boolean));
+                n--;
+            }
+            continue;
+        }
+
+        str = malloc(len + strlen(deltaValue[j]) + 2);
+        if (str == NULL)
+            errExit("malloc");
+        sprintf(str, "%s=%s", deltaName[j], deltaValue[j]);
+        if (k < n) {
+            if (owned[k])
+                free(ep[k]);
+        } else {
+            ep[++n] = NULL;
+        }
+        ep[k] = str;
+        owned[k] = TRUE;
+    }
+
+    *ownedp = owned;
+    return ep;
+}
+
+static void
+freeEnv(char **ep, Boolean *owned)
+{
+    int j;
+
+    for (j = 0; ep[j] != NULL; j++)
+        if (owned[j])
+            free(ep[j]);
+    free(ep);
+    free(owned);
+}
+
+static void
+applyDelta(struct envBuilder *b)
+{
+    int j;
+
+    for (j = 0; j < ndelta; j++) {
+        if (deltaValue[j] == NULL) {
+            if (envUnset(b, deltaName[j]) == -1)
+                errExit("envUnset");
+        } else {
+            if (envSet(b, deltaName[j], deltaValue[j]) == -1)
+                errExit("envSet");
+        }
+    }
+}
+
+/* A checksum over a list, so that the compiler can't discard the work */
+
+static volatile unsigned long sink;
+
+static void
+touch(char **ep)
+{
+    sink += (unsigned long) ep[0] + (unsigned long) ep[nbase / 2];
+}
+
+static void
+linearChildren(long ops, void *arg)
+{
+    Boolean *owned;
+    char **ep;
+    long j;
+
+    for (j = 0; j < ops; j++) {
+        ep = linearEnv(&owned);
+        touch(ep);
+        freeEnv(ep, owned);
+    }
+}
+
+static void
+builderChildren(long ops, void *arg)
+{
+    struct envBuilder b;
+    char **ep;
+    long j;
+
+    if (envBuilderInit(&b, &base) == -1)
+        errExit("envBuilderInit");
+    for (j = 0; j < ops; j++) {
+        envBuilderReset(&b);
+        applyDelta(&b);
+        ep = envBuild(&b);
+        if (ep == NULL)
+            errExit("envBuild");
+        touch(ep);
+        free(ep);
+    }
+    envBuilderFree(&b);
+}
+
+static void
+builderArenaChildren(long ops, void *arg)
+{
+    struct envBuilder b;
+    struct arena a;
+    size_t size;
+    void *mem;
+    char **ep;
+    long j;
+
+    if (envBuilderInit(&b, &base) == -1)
+        errExit("envBuilderInit");
+    if (arenaInit(&a, 1024 * 1024, 0) == -1)
+        errExit("arenaInit");
+    for (j = 0; j < ops; j++) {
+        envBuilderReset(&b);
+        arenaReset(&a);
+        applyDelta(&b);
+        size = envBuildSize(&b);
+        mem = arenaAlloc(&a, size);
+        if (mem == NULL)
+            errExit("arenaAlloc");
+        ep = envBuildInto(&b, mem, size);
+        if (ep == NULL)
+            errExit("envBuildInto");
+        touch(ep);
+    }
+    arenaDestroy(&a);
+    envBuilderFree(&b);
+}
+
+/* Look up each base variable in turn */
+
+static void
+getenvLookups(long ops, void *arg)
+{
+    char **names = arg;
+    long j;
+
+    for (j = 0; j < ops; j++)
+        if (getenv(names[j % nbase]) == NULL)
+            fatal("getenv: %s not found", names[j % nbase]);
+}
+
+static void
+baseLookups(long ops, void *arg)
+{
+    char **names = arg;
+    long j;
+
+    for (j = 0; j < ops; j++)
+        if (envBaseGet(&base, names[j % nbase]) == NULL)
+            fatal("envBaseGet: %s not found", names[j % nbase]);
+}
+
+static void
+run(const char *name, benchFn fn, void *arg, long ops)
+{
+    struct benchResult res;
+
+    if (benchRun(name, fn, arg, ops, NULL, &res) == -1)
+        errExit("benchRun");
+    benchReport(&res);
+}
+
+/* Return a copy of 's', allocated on the heap */
+
+static char *
+copyStr(const char *s)
+{
+    char *p;
+
+    p = strdup(s);
+    if (p == NULL)
+        errExit("strdup");
+    return p;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct envBuilder b;
+    Boolean useOwn, *owned;
+    char **names, **ep1, **ep2, **saveEnviron, buf[64];
+    long nchildren;
+    int opt, j, k;
+
+    nbase = 200;
+    ndelta = 10;
+    nchildren = 10000;
+    useOwn = FALSE;
+    while ((opt = getopt(argc, argv, "n:d:c:e")) != -1) {
+        switch (opt) {
+        case 'n': nbase = getInt(optarg, GN_GT_0, "-n");            break;
+        case 'd': ndelta = getInt(optarg, GN_NONNEG, "-d");         break;
+        case 'c': nchildren = getLong(optarg, GN_GT_0, "-c");       break;
+        case 'e': useOwn = TRUE;                                    break;
+        default:
+            usageErr("%s [-n nvars] [-d ndelta] [-c nchildren] [-e]\n",
+                     argv[0]);
+        }
+    }
+
+    /* Create the base environment, and the names of its variables */
+
+    if (useOwn) {
+        for (nbase = 0; environ[nbase] != NULL; nbase++)
+            ;
+        if (nbase == 0)
+            fatal("The environment is empty");
+        baseEnv = environ;
+    } else {
+        baseEnv = calloc(nbase + 1, sizeof(char *));
+        if (baseEnv == NULL)
+            errExit("calloc");
+        for (j = 0; j < nbase; j++) {
+            snprintf(buf, sizeof(buf), "TLPI_VAR_%05d=value-of-variable-%d",
+                     j, j);
+            baseEnv[j] = copyStr(buf);
+        }
+    }
+
+    names = calloc(nbase, sizeof(char *));
+    if (names == NULL)
+        errExit("calloc");
+    for (j = 0; j < nbase; j++) {
+        names[j] = copyStr(baseEnv[j]);
+        *strchr(names[j], '=') = '\0';
+    }
+
+    /* Spread the changes to existing variables evenly over the base, so
+       that no variable is changed twice */
+
+    deltaName = calloc(ndelta + 1, sizeof(char *));
+    deltaValue = calloc(ndelta + 1, sizeof(char *));
+    if (deltaName == NULL || deltaValue == NULL)
+        errExit("calloc");
+    for (j = 0; j < ndelta; j++) {
+        k = (int) ((long) j * nbase / ndelta);
+        if (j % 4 == 0 && j < nbase) {
+            deltaName[j] = names[k];            /* Unset */
+        } else if (j % 4 == 1 && j < nbase) {
+            deltaName[j] = names[k];            /* Replace */
+            deltaValue[j] = copyStr("replaced");
+        } else {
+            snprintf(buf, sizeof(buf), "TLPI_NEW_%05d", j);
+            deltaName[j] = copyStr(buf);
+            snprintf(buf, sizeof(buf), "new-value-%d", j);
+            deltaValue[j] = copyStr(buf);
+        }
+    }
+
+    if (envBaseInit(&base, baseEnv) == -1)
+        errExit("envBaseInit");
+    if (base.nvars != nbase)
+        fatal("The base environment contains duplicate names");
+
+    /* Check that both methods produce the same list */
+
+    if (envBuilderInit(&b, &base) == -1)
+        errExit("envBuilderInit");
+    applyDelta(&b);
+    ep1 = linearEnv(&owned);
+    ep2 = envBuild(&b);
+    if (ep2 == NULL)
+        errExit("envBuild");
+    for (j = 0; ep1[j] != NULL && ep2[j] != NULL; j++)
+        if (strcmp(ep1[j], ep2[j]) != 0)
+            fatal("Lists differ at %d: %s / %s", j, ep1[j], ep2[j]);
+    if (ep1[j] != NULL || ep2[j] != NULL)
+        fatal("Lists differ in length");
+    printf("%d base variables, %d changes: %d variables, %zu bytes "
+           "per child\n", nbase, ndelta, j, envBuildSize(&b));
+
+    for (j = 0; j < ndelta; j++) {
+        const char *v = envGet(&b, deltaName[j]);
+
+        if ((v == NULL) != (deltaValue[j] == NULL) ||
+                (v != NULL && strcmp(v, deltaValue[j]) != 0))
+            fatal("envGet(%s) gives the wrong value", deltaName[j]);
+    }
+    freeEnv(ep1, owned);
+    free(ep2);
+    envBuilderFree(&b);
+
+    run("copy + linear search", linearChildren, NULL, nchildren);
+    run("envBuilder + envBuild()", builderChildren, NULL, nchildren);
+    run("envBuilder + envBuildInto() arena", builderArenaChildren, NULL,
+        nchildren);
+
+    saveEnviron = environ;
+    environ = baseEnv;
+    run("getenv()", getenvLookups, names, 100 * (long) nbase);
+    environ = saveEnviron;
+    run("envBaseGet()", baseLookups, names, 100 * (long) nbase);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,346 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 28 */
+
+/* acct_stats.c
+
+   Summarize a process accounting file: for each user, and for each
+   (user, command) pair, show the number of processes, and their total
+   CPU time, total elapsed time, and average memory usage.
+
+   Usage: acct_stats [-t threads] [-n num] file
+
+        -t threads   Number of threads that analyze the file (default:
+                     the number of online CPUs)
+        -n num       Show only the 'num' commands that used the most CPU
+                     time (default: 20; 0 means all)
+
+   Whereas acct_view.c and acct_v3_view.c read and print one record at a
+   time, this program is intended for large files. It maps the file with
+   mmap(), divides the records into one chunk per thread, and has each
+   thread build a hash table of totals for its chunk; the tables are
+   then merged. User names are looked up only when the results are
+   printed, via the cache in ugid_cache.c.
+
+   Linux accounting files may contain both Version 3 records (see
+   acct_v3_view.c) and older ones (see acct_view.c); both are 64 bytes,
+   and the format of each record is determined from its 'ac_version'
+   field.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/acct.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "ugid_cache.h"                 /* Declares userNameFromIdCached() */
+#include "tlpi_hdr.h"
+
+#define REC_SIZE 64                     /* Size of both record formats */
+
+struct statEntry {                      /* Totals for one (uid, command) */
+    uint32_t uid;
+    char comm[ACCT_COMM + 1];           /* Empty string: slot unused */
+    long procs;
+    long long cpuTicks;
+    double elapsedTicks;
+    long long memKB;
+};
+
+struct table {                          /* Open-addressing hash table */
+    struct statEntry *slots;
+    size_t size;                        /* A power of 2 */
+    size_t used;
+};
+
+struct chunk {                          /* Work for one thread */
+    const char *recs;
+    size_t nrecs;
+    struct table tab;
+};
+
+static long long                /* Convert comp_t value into long long */
+comptToLL(comp_t ct)
+{
+    const int EXP_SIZE = 3;             /* 3-bit, base-8 exponent */
+    const int MANTISSA_SIZE = 13;       /* Followed by 13-bit mantissa */
+    const int MANTISSA_MASK = (1 << MANTISSA_SIZE) - 1;
+    long long mantissa, exp;
+
+    mantissa = ct & MANTISSA_MASK;
+    exp = (ct >> MANTISSA_SIZE) & ((1 << EXP_SIZE) - 1);
+    return mantissa << (exp * 3);       /* Power of 8 = left shift 3 bits */
+}
+
+static size_t
+hashKey(uint32_t uid, const char *comm)
+{
+    size_t h = 2166136261U ^ uid;
+    int j;
+
+    for (j = 0; j <= ACCT_COMM && comm[j] != '\0'; j++)
+        h = (h ^ (unsigned char) comm[j]) * 16777619U;
+    return h;
+}
+
+static void tableInit(struct table *tab, size_t size);
+
+/* Return the entry for (uid, comm), creating it if necessary */
+
+static struct statEntry *
+tableLookup(struct table *tab, uint32_t uid, const char *comm)
+{
+    struct statEntry *e, *old;
+    size_t j, oldSize;
+
+    if (2 * (tab->used + 1) > tab->size) {      /* Keep load <= 1/2 */
+        old = tab->slots;
+        oldSize = tab->size;
+        tableInit(tab, 2 * oldSize);
+        for (j = 0; j < oldSize; j++) {
+            if (old[j].comm[0] != '\0') {
+                e = tableLookup(tab, old[j].uid, old[j].comm);
+                *e = old[j];
+            }
+        }
+        free(old);
+    }
+
+    for (j = hashKey(uid, comm) & (tab->size - 1); ;
+            j = (j + 1) & (tab->size - 1)) {
+        e = &tab->slots[j];
+        if (e->comm[0] == '\0') {
+            e->uid = uid;
+            strcpy(e->comm, comm);
+            tab->used++;
+            return e;
+        }
+        if (e->uid == uid && strcmp(e->comm, comm) == 0)
+            return e;
+    }
+}
+
+static void
+tableInit(struct table *tab, size_t size)
+{
+    tab->slots = calloc(size, sizeof(struct statEntry));
+    if (tab->slots == NULL)
+        errExit("calloc");
+    tab->size = size;
+    tab->used = 0;
+}
+
+/* Add the records of one chunk to its table */
+
+static void *
+threadFunc(void *arg)
+{
+    struct chunk *ch = arg;
+    const struct acct_v3 *v3;
+    const struct acct *v2;
+    struct statEntry *e;
+    char comm[ACCT_COMM + 1];
+    size_t j;
+
+    for (j = 0; j < ch->nrecs; j++) {
+        v3 = (const struct acct_v3 *) (ch->recs + j * REC_SIZE);
+        v2 = (const struct acct *) v3;
+
+        if ((v3->ac_version & 0x7f) == 3) {
+            memcpy(comm, v3->ac_comm, ACCT_COMM);
+            comm[ACCT_COMM] = '\0';
+            if (comm[0] == '\0')
+                strcpy(comm, "?");
+            e = tableLookup(&ch->tab, v3->ac_uid, comm);
+            e->cpuTicks += comptToLL(v3->ac_utime) + comptToLL(v3->ac_stime);
+            e->elapsedTicks += v3->ac_etime;
+            e->memKB += comptToLL(v3->ac_mem);
+        } else {
+            memcpy(comm, v2->ac_comm, ACCT_COMM);
+            comm[ACCT_COMM] = '\0';
+            if (comm[0] == '\0')
+                strcpy(comm, "?");
+            e = tableLookup(&ch->tab, v2->ac_uid, comm);
+            e->cpuTicks += comptToLL(v2->ac_utime) + comptToLL(v2->ac_stime);
+            e->elapsedTicks += comptToLL(v2->ac_etime);
+            e->memKB += comptToLL(v2->ac_mem);
+        }
+        e->procs++;
+    }
+    return NULL;
+}
+
+/* Return the name for 'uid', or the UID as a string if it has none */
+
+static const char *
+userName(uid_t uid)
+{
+    static char buf[32];
+    char *name;
+
+    name = userNameFromIdCached(uid);
+    if (name == NULL) {
+        snprintf(buf, sizeof(buf), "%ld", (long) uid);
+        name = buf;
+    }
+    return name;
+}
+
+static int
+cmpCpu(const void *a, const void *b)
+{
+    const struct statEntry *x = a, *y = b;
+
+    return (x->cpuTicks < y->cpuTicks) - (x->cpuTicks > y->cpuTicks);
+}
+
+static void
+printEntry(const struct statEntry *e, Boolean showComm, long clkTck)
+{
+    printf("%-10.10s ", userName(e->uid));
+    if (showComm)
+        printf("%-16s ", e->comm);
+    printf("%10ld %12.2f %14.2f %12lld\n", e->procs,
+           (double) e->cpuTicks / clkTck, e->elapsedTicks / clkTck,
+           e->memKB / e->procs);
+}
+
+/* Return an array of the entries of 'tab', sorted by decreasing CPU
+   time, and their number in '*n' */
+
+static struct statEntry *
+sortedEntries(const struct table *tab, size_t *n)
+{
+    struct statEntry *arr;
+    size_t j;
+
+    arr = malloc((tab->used + 1) * sizeof(struct statEntry));
+    if (arr == NULL)
+        errExit("malloc");
+    *n = 0;
+    for (j = 0; j < tab->size; j++)
+        if (tab->slots[j].comm[0] != '\0')
+            arr[(*n)++] = tab->slots[j];
+    qsort(arr, *n, sizeof(struct statEntry), cmpCpu);
+    return arr;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct chunk *chunks;
+    pthread_t *tids;
+    struct table total, users;
+    struct statEntry *e, *arr;
+    struct stat sb;
+    const char *recs;
+    size_t nrecs, per, j, k, n;
+    long numThreads, numShow, clkTck;
+    int opt, fd, s;
+
+    numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numThreads < 1)
+        numThreads = 1;
+    numShow = 20;
+    while ((opt = getopt(argc, argv, "t:n:")) != -1) {
+        switch (opt) {
+        case 't': numThreads = getLong(optarg, GN_GT_0, "threads");     break;
+        case 'n': numShow = getLong(optarg, 0, "num");                  break;
+        default:  usageErr("%s [-t threads] [-n num] file\n", argv[0]);
+        }
+    }
+    if (optind + 1 != argc)
+        usageErr("%s [-t threads] [-n num] file\n", argv[0]);
+
+    fd = open(argv[optind], O_RDONLY);
+    if (fd == -1)
+        errExit("open");
+    if (fstat(fd, &sb) == -1)
+        errExit("fstat");
+    nrecs = sb.st_size / REC_SIZE;      /* Ignore a partial final record */
+    if (nrecs == 0)
+        fatal("No records in %s", argv[optind]);
+    recs = mmap(NULL, nrecs * REC_SIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (recs == MAP_FAILED)
+        errExit("mmap");
+    madvise((void *) recs, nrecs * REC_SIZE, MADV_WILLNEED);
+    close(fd);
+
+    /* Give each thread a run of whole records */
+
+    if (numThreads > nrecs)
+        numThreads = nrecs;
+    chunks = calloc(numThreads, sizeof(struct chunk));
+    tids = calloc(numThreads, sizeof(pthread_t));
+    if (chunks == NULL || tids == NULL)
+        errExit("calloc");
+
+    per = nrecs / numThreads;
+    for (j = 0; j < numThreads; j++) {
+        chunks[j].recs = recs + j * per * REC_SIZE;
+        chunks[j].nrecs = (j == numThreads - 1) ? nrecs - j * per : per;
+        tableInit(&chunks[j].tab, 1024);
+        s = pthread_create(&tids[j], NULL, threadFunc, &chunks[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    /* Merge the per-thread tables, and derive per-user totals */
+
+    tableInit(&total, 1024);
+    tableInit(&users, 64);
+    for (j = 0; j < numThreads; j++) {
+        s = pthread_join(tids[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+
+        for (k = 0; k < chunks[j].tab.size; k++) {
+            const struct statEntry *c = &chunks[j].tab.slots[k];
+
+            if (c->comm[0] == '\0')
+                continue;
+            e = tableLookup(&total, c->uid, c->comm);
+            e->procs += c->procs;
+            e->cpuTicks += c->cpuTicks;
+            e->elapsedTicks += c->elapsedTicks;
+            e->memKB += c->memKB;
+
+            e = tableLookup(&users, c->uid, "*");
+            e->procs += c->procs;
+            e->cpuTicks += c->cpuTicks;
+            e->elapsedTicks += c->elapsedTicks;
+            e->memKB += c->memKB;
+        }
+        free(chunks[j].tab.slots);
+    }
+
+    clkTck = sysconf(_SC_CLK_TCK);
+    printf("%zu records, %ld thread(s)\n\n", nrecs, numThreads);
+
+    printf("%-10s %10s %12s %14s %12s\n", "user", "procs", "cpu(s)",
+           "elapsed(s)", "avg-mem(KB)");
+    arr = sortedEntries(&users, &n);
+    for (j = 0; j < n; j++)
+        printEntry(&arr[j], FALSE, clkTck);
+    free(arr);
+
+    printf("\n%-10s %-16s %10s %12s %14s %12s\n", "user", "command",
+           "procs", "cpu(s)", "elapsed(s)", "avg-mem(KB)");
+    arr = sortedEntries(&total, &n);
+    for (j = 0; j < n && (numShow == 0 || j < numShow); j++)
+        printEntry(&arr[j], TRUE, clkTck);
+    free(arr);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,399 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 26 */
+
+/* child_mgr.c
+
+   Manage a large number of children using PID file descriptors.
+
+   multi_wait.c reaps children by calling wait() in a loop, and
+   multi_SIGCHLD.c by calling waitpid(-1, WNOHANG) in a loop in a SIGCHLD
+   handler. Both reap whichever children happen to have terminated, so
+   any other code in the process that waits for particular children (for
+   example, system(3), or a library that runs helper programs) can have
+   its child reaped from under it, or can reap ours; and neither fits
+   naturally into an event loop built on epoll or poll().
+
+   Here, each child is represented by a PID file descriptor (Linux 5.3
+   and later), which becomes readable when the child terminates. The
+   manager registers each pidfd in an epoll instance; cmReap() waits for
+   (at most a given time for) some children to terminate, and reaps each
+   of them, and only them, with waitid(P_PIDFD) (Linux 5.4 and later),
+   recording its wait status and resource usage (the raw waitid() system
+   call, unlike the glibc wrapper, can return a 'struct rusage', as
+   wait4() does). The epoll file descriptor returned by cmFd() can itself
+   be added to a caller's epoll instance or poll() set: it is readable
+   whenever cmReap() has children to reap. The cost of a cmReap() call
+   depends on the number of children that have terminated, not on the
+   number of children that are running.
+
+   Children are obtained in one of three ways:
+
+   * cmFork() is like fork(), followed by pidfd_open(): the child may do
+     anything that a child of fork() may do.
+
+   * cmSpawn() creates a child that execs a program, using clone3() with
+     CLONE_PIDFD (Linux 5.3 and later), so that the pidfd is returned by
+     the same system call that creates the child. (Without a wrapper
+     from glibc, the child of clone3() must restrict itself to system
+     calls, which is why it serves only to exec a program.) If the exec
+     fails, the child exits with status 127, as for system(3). If
+     clone3() is unavailable, cmSpawn() uses fork() instead.
+
+   * cmAdd() takes a child created in some other way (for example, by
+     posix_spawn()).
+
+   Since a child can't be reaped by anyone else until it terminates,
+   its PID can't be reused before pidfd_open() is called, unless some
+   other code in the process reaps arbitrary children; that code should
+   be changed to use this module.
+
+   Each child holds a file descriptor until it is reaped, so a program
+   with, say, 50000 children must raise its RLIMIT_NOFILE limit to more
+   than that. The manager is not thread-safe.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include "child_mgr.h"          /* Declares functions defined here */
+
+#ifndef CLONE_PIDFD             /* Added in Linux 5.2 */
+#define CLONE_PIDFD             0x00001000
+#endif
+#ifndef P_PIDFD                 /* Added in Linux 5.4 */
+#define P_PIDFD                 3
+#endif
+
+#define MAX_EVENTS 256          /* Events fetched by one epoll_wait() */
+
+/* The clone3() argument structure, as in <linux/sched.h> (which can't
+   be included alongside <sched.h>); glibc provides no wrapper */
+
+struct cloneArgs {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+};
+
+struct cmNode {                 /* A 'struct cmChild', with our links */
+    struct cmChild c;           /* Must be first */
+    struct cmNode *next;        /* In the free list */
+    struct cmNode *allNext;     /* In the list of all nodes */
+};
+
+struct childMgr {
+    int epfd;
+    int live;                   /* Children not yet reaped */
+    struct cmNode *free;        /* Released nodes, for reuse */
+    struct cmNode *all;         /* All nodes, so that we can free them */
+};
+
+/* Create a manager. Returns a pointer to it, or NULL on error. */
+
+struct childMgr *
+cmCreate(void)
+{
+    struct childMgr *cm;
+
+    cm = malloc(sizeof(struct childMgr));
+    if (cm == NULL)
+        return NULL;
+    cm->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (cm->epfd == -1) {
+        free(cm);
+        return NULL;
+    }
+    cm->live = 0;
+    cm->free = NULL;
+    cm->all = NULL;
+    return cm;
+}
+
+/* Return a file descriptor that is readable when there are children to
+   reap */
+
+int
+cmFd(const struct childMgr *cm)
+{
+    return cm->epfd;
+}
+
+/* Return the number of children that have not yet been reaped */
+
+int
+cmCount(const struct childMgr *cm)
+{
+    return cm->live;
+}
+
+/* Record the child 'pid', whose pidfd is 'pidfd'. Returns a pointer to
+   the new child, or NULL on error (in which case 'pidfd' is closed). */
+
+static struct cmChild *
+track(struct childMgr *cm, pid_t pid, int pidfd, void *data)
+{
+    struct epoll_event ev;
+    struct cmNode *n;
+    int savedErrno;
+
+    n = cm->free;
+    if (n != NULL) {
+        cm->free = n->next;
+    } else {
+        n = malloc(sizeof(struct cmNode));
+        if (n == NULL) {
+            close(pidfd);
+            return NULL;
+        }
+        n->allNext = cm->all;
+        cm->all = n;
+    }
+
+    n->c.pid = pid;
+    n->c.pidfd = pidfd;
+    n->c.status = 0;
+    memset(&n->c.ru, 0, sizeof(struct rusage));
+    clock_gettime(CLOCK_MONOTONIC, &n->c.start);
+    n->c.end = n->c.start;
+    n->c.data = data;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = n;
+    if (epoll_ctl(cm->epfd, EPOLL_CTL_ADD, pidfd, &ev) == -1) {
+        savedErrno = errno;
+        close(pidfd);
+        n->c.pidfd = -1;
+        n->next = cm->free;
+        cm->free = n;
+        errno = savedErrno;
+        return NULL;
+    }
+
+    cm->live++;
+    return &n->c;
+}
+
+/* Start managing the existing child 'pid'. Returns a pointer to the new
+   child, or NULL on error. */
+
+struct cmChild *
+cmAdd(struct childMgr *cm, pid_t pid, void *data)
+{
+    int pidfd;
+
+    pidfd = syscall(SYS_pidfd_open, pid, 0);    /* Sets close-on-exec */
+    if (pidfd == -1)
+        return NULL;
+    return track(cm, pid, pidfd, data);
+}
+
+/* Create a child, as for fork(). In the parent, returns the child's PID,
+   and sets '*child' to point to the new child; in the child, returns 0.
+   Returns -1 on error. If the child was created, but couldn't be added
+   to the manager, it is killed and reaped, and -1 is returned. */
+
+pid_t
+cmFork(struct childMgr *cm, void *data, struct cmChild **child)
+{
+    int savedErrno;
+    pid_t pid;
+
+    pid = fork();
+    if (pid <= 0)
+        return pid;
+
+    *child = cmAdd(cm, pid, data);
+    if (*child == NULL) {
+        savedErrno = errno;
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        errno = savedErrno;
+        return -1;
+    }
+    return pid;
+}
+
+/* Create a child that execs 'path' with the arguments 'argv' and the
+   environment 'envp'. Returns a pointer to the new child, or NULL on
+   error. */
+
+struct cmChild *
+cmSpawn(struct childMgr *cm, const char *path, char *const argv[],
+        char *const envp[], void *data)
+{
+    struct cloneArgs ca;
+    struct cmChild *c;
+    int pidfd, savedErrno;
+    pid_t pid;
+
+    memset(&ca, 0, sizeof(ca));
+    ca.flags = CLONE_PIDFD;
+    ca.pidfd = (uintptr_t) &pidfd;
+    ca.exit_signal = SIGCHLD;
+
+    /* With no stack specified, the child returns from clone3() on a
+       copy of the parent's stack, as for fork() */
+
+    pid = syscall(SYS_clone3, &ca, sizeof(ca));
+    if (pid == 0) {
+        execve(path, argv, envp);
+        _exit(127);
+    }
+    if (pid > 0) {
+        c = track(cm, pid, pidfd, data);
+        if (c == NULL) {
+            savedErrno = errno;
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            errno = savedErrno;
+        }
+        return c;
+    }
+    if (errno != ENOSYS)
+        return NULL;
+
+    /* No clone3(): fall back to fork() */
+
+    pid = cmFork(cm, data, &c);
+    if (pid == 0) {
+        execve(path, argv, envp);
+        _exit(127);
+    }
+    return (pid == -1) ? NULL : c;
+}
+
+/* Send the signal 'sig' to the child 'c'. Unlike kill(), this can't
+   signal some other process that has been given the child's PID, even
+   if the child has been reaped by someone else. Returns 0 on success,
+   or -1 on error. */
+
+int
+cmKill(struct childMgr *cm, struct cmChild *c, int sig)
+{
+    if (c->pidfd == -1) {
+        errno = ESRCH;
+        return -1;
+    }
+    return syscall(SYS_pidfd_send_signal, c->pidfd, sig, NULL, 0);
+}
+
+/* Reap the terminated child 'n', which stops being live. Returns 1 if
+   the child was reaped (or has been reaped by someone else), or 0 if it
+   hasn't terminated after all. */
+
+static int
+reapOne(struct childMgr *cm, struct cmNode *n)
+{
+    siginfo_t si;
+    long s;
+
+    /* We call waitid() directly, to obtain the child's resource usage */
+
+    si.si_pid = 0;
+    s = syscall(SYS_waitid, P_PIDFD, n->c.pidfd, &si, WEXITED | WNOHANG,
+                &n->c.ru);
+    if (s == -1 && errno != ECHILD)
+        return 0;
+    if (s == 0 && si.si_pid == 0)
+        return 0;                       /* Not yet terminated */
+
+    if (s == -1) {                      /* Someone else reaped it */
+        n->c.status = -1;
+    } else {
+        switch (si.si_code) {           /* Convert to a wait status */
+        case CLD_EXITED: n->c.status = (si.si_status & 0xff) << 8;    break;
+        case CLD_KILLED: n->c.status = si.si_status;                  break;
+        case CLD_DUMPED: n->c.status = si.si_status | 0x80;           break;
+        default:         n->c.status = -1;                            break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &n->c.end);
+
+    close(n->c.pidfd);                  /* Also removes it from 'epfd' */
+    n->c.pidfd = -1;
+    cm->live--;
+    return 1;
+}
+
+/* Wait for up to 'timeoutMs' milliseconds (-1: indefinitely; 0: don't
+   wait) for children to terminate, and reap up to 'max' of them, placing
+   pointers to them in 'done'. Returns the number of children reaped
+   (which may be 0, on timeout), or -1 on error. Each child reaped
+   remains valid until passed to cmRelease(). */
+
+int
+cmReap(struct childMgr *cm, struct cmChild **done, int max, int timeoutMs)
+{
+    struct epoll_event evs[MAX_EVENTS];
+    struct cmNode *n;
+    int nready, cnt, j;
+
+    if (cm->live == 0) {
+        errno = ECHILD;
+        return -1;
+    }
+
+    nready = epoll_wait(cm->epfd, evs, max < MAX_EVENTS ? max : MAX_EVENTS,
+                        timeoutMs);
+    if (nready == -1)
+        return -1;
+
+    cnt = 0;
+    for (j = 0; j < nready; j++) {
+        n = evs[j].data.ptr;
+        if (reapOne(cm, n))
+            done[cnt++] = &n->c;
+    }
+    return cnt;
+}
+
+/* Release a reaped child, for reuse by the manager */
+
+void
+cmRelease(struct childMgr *cm, struct cmChild *c)
+{
+    struct cmNode *n = (struct cmNode *) c;
+
+    n->next = cm->free;
+    cm->free = n;
+}
+
+/* Free the manager. Children that have not been reaped remain zombies
+   (once they terminate) until reaped in some other way. */
+
+void
+cmDestroy(struct childMgr *cm)
+{
+    struct cmNode *n, *next;
+
+    for (n = cm->all; n != NULL; n = next) {
+        next = n->allNext;
+        if (n->c.pidfd != -1)
+            close(n->c.pidfd);
+        free(n);
+    }
+    close(cm->epfd);
+    free(cm);
+}
@@ -0,0 +1,62 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 26 */
+
+/* child_mgr.h
+
+   Header file for child_mgr.c.
+*/
+#ifndef CHILD_MGR_H
+#define CHILD_MGR_H             /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <time.h>
+
+struct childMgr;                /* Opaque; defined in child_mgr.c */
+
+struct cmChild {
+    pid_t pid;
+    int pidfd;                  /* PID file descriptor; -1 once reaped */
+    int status;                 /* Once reaped: wait status, as returned
+                                   by waitpid(), or -1 if the child was
+                                   reaped by someone else */
+    struct rusage ru;           /* Once reaped: resources used by the
+                                   child and its waited-for children */
+    struct timespec start;      /* CLOCK_MONOTONIC time when the child
+                                   was created (or added) */
+    struct timespec end;        /* ... and when it was reaped */
+    void *data;                 /* For use by the caller */
+};
+
+struct childMgr *cmCreate(void);
+
+int cmFd(const struct childMgr *cm);
+
+pid_t cmFork(struct childMgr *cm, void *data, struct cmChild **child);
+
+struct cmChild *cmSpawn(struct childMgr *cm, const char *path,
+                        char *const argv[], char *const envp[], void *data);
+
+struct cmChild *cmAdd(struct childMgr *cm, pid_t pid, void *data);
+
+int cmKill(struct childMgr *cm, struct cmChild *c, int sig);
+
+int cmReap(struct childMgr *cm, struct cmChild **done, int max,
+           int timeoutMs);
+
+int cmCount(const struct childMgr *cm);
+
+void cmRelease(struct childMgr *cm, struct cmChild *c);
+
+void cmDestroy(struct childMgr *cm);
+
+#endif
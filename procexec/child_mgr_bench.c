@@ -0,0 +1,322 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 26 */
+
+/* child_mgr_bench.c
+
+   Compare ways of running many children, with a given number running at
+   once: reaping them with wait() (as in multi_wait.c), with
+   waitpid(-1, WNOHANG) in a SIGCHLD handler (as in multi_SIGCHLD.c),
+   and with the pidfd-based child manager in child_mgr.c.
+
+   Usage: child_mgr_bench [-n nchildren] [-c concurrency] [-s usecs]
+                          [-x prog]
+
+        -n nchildren    Children created by each repetition
+                        (default: 2000)
+        -c concurrency  Children running at once (default: 100)
+        -s usecs        Each child sleeps this long before exiting
+                        (default: 0)
+        -x prog         Each child execs 'prog' (with no arguments)
+                        instead of exiting; 'prog' should exit with
+                        status 0. With this option, cmSpawn() (which uses
+                        clone3()) is also measured.
+
+   Unless -x is given, each child exits with a status derived from its
+   sequence number, and each method checks that the statuses it collects
+   add up to the expected total. The results are reported in the common
+   format of lib/bench.c, in terms of the cost per child; with -c 1 and
+   no -s, they show the cost of creating and reaping a child, and with
+   higher concurrency and -s, the cost of finding and reaping the
+   children that have terminated among many that have not. After the
+   measurements, the program shows the average lifetime and CPU time of
+   the children, as recorded by the child manager.
+
+   The child manager is not the cheapest way to reap children: each
+   child costs a few more system calls (pidfd_open(), epoll_ctl(),
+   close()), and, since each running child holds a descriptor in the
+   parent, each fork() has more descriptors to duplicate. What it buys
+   is that it reaps only its own children, and that it fits into an
+   event loop.
+
+   Try: ./child_mgr_bench
+        ./child_mgr_bench -c 1000 -s 1000 -n 5000
+        ./child_mgr_bench -x /bin/true -n 500
+
+   This program is Linux-specific.
+*/
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include "child_mgr.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+extern char **environ;
+
+static long nchildren;
+static int concurrency;
+static int sleepUsecs;
+static char *prog;
+static long expectedSum;        /* Total of the children's exit statuses */
+
+/* Totals recorded by the child manager, for the final report */
+
+static double totalLifeSecs, totalCpuSecs;
+static long totalReaped;
+
+/* The work of child number 'idx' */
+
+static void
+childBody(long idx)
+{
+    if (prog != NULL) {
+        execl(prog, prog, (char *) NULL);
+        _exit(127);
+    }
+    if (sleepUsecs > 0)
+        usleep(sleepUsecs);
+    _exit(idx % 251);
+}
+
+static void
+checkSum(const char *method, long sum)
+{
+    if (sum != expectedSum)
+        fatal("%s: exit statuses total %ld, not %ld", method, sum,
+              expectedSum);
+}
+
+/* Add the exit status of a child to '*sum' */
+
+static void
+addStatus(int status, long *sum)
+{
+    if (!WIFEXITED(status))
+        fatal("Child terminated abnormally (status 0x%x)", status);
+    *sum += WEXITSTATUS(status);
+}
+
+static pid_t
+forkChild(long idx)
+{
+    pid_t pid;
+
+    pid = fork();
+    if (pid == -1)
+        errExit("fork");
+    if (pid == 0)
+        childBody(idx);
+    return pid;
+}
+
+/* Reap with wait(), as in multi_wait.c */
+
+static void
+waitMethod(long ops, void *arg)
+{
+    long started, reaped, sum;
+    int live, status;
+
+    started = reaped = sum = 0;
+    live = 0;
+    while (reaped < ops) {
+        while (live < concurrency && started < ops) {
+            forkChild(started++);
+            live++;
+        }
+        if (wait(&status) == -1)
+            errExit("wait");
+        addStatus(status, &sum);
+        live--;
+        reaped++;
+    }
+    checkSum("wait()", sum);
+}
+
+/* Reap in a SIGCHLD handler, as in multi_SIGCHLD.c */
+
+static volatile long handlerReaped;
+static volatile long handlerSum;
+
+static void
+sigchldHandler(int sig)
+{
+    int status, savedErrno;
+
+    savedErrno = errno;
+    while (waitpid(-1, &status, WNOHANG) > 0) {
+        handlerReaped++;
+        handlerSum += WIFEXITED(status) ? WEXITSTATUS(status) : 100000;
+    }
+    errno = savedErrno;
+}
+
+static void
+sigchldMethod(long ops, void *arg)
+{
+    struct sigaction sa, saOrig;
+    sigset_t blockMask, origMask;
+    long started;
+
+    handlerReaped = handlerSum = 0;
+
+    /* Block SIGCHLD except while waiting in sigsuspend(), so that we
+       don't miss a signal between checking the count and waiting */
+
+    sigemptyset(&blockMask);
+    sigaddset(&blockMask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &blockMask, &origMask) == -1)
+        errExit("sigprocmask");
+
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sa.sa_handler = sigchldHandler;
+    if (sigaction(SIGCHLD, &sa, &saOrig) == -1)
+        errExit("sigaction");
+
+    started = 0;
+    while (handlerReaped < ops) {
+        while (started - handlerReaped < concurrency && started < ops)
+            forkChild(started++);
+        if (handlerReaped < ops)
+            sigsuspend(&origMask);
+    }
+
+    if (sigaction(SIGCHLD, &saOrig, NULL) == -1)
+        errExit("sigaction");
+    if (sigprocmask(SIG_SETMASK, &origMask, NULL) == -1)
+        errExit("sigprocmask");
+    checkSum("SIGCHLD", handlerSum);
+}
+
+/* Reap with the child manager; children are created with cmFork(), or,
+   if 'arg' is not NULL, with cmSpawn() */
+
+static void
+managerMethod(long ops, void *arg)
+{
+    struct cmChild *done[64], *c;
+    struct childMgr *cm;
+    char *argv[2];
+    long started, sum;
+    pid_t pid;
+    int n, j;
+
+    cm = cmCreate();
+    if (cm == NULL)
+        errExit("cmCreate");
+    argv[0] = prog;
+    argv[1] = NULL;
+
+    started = sum = 0;
+    totalLifeSecs = totalCpuSecs = 0;
+    totalReaped = 0;
+    while (started < ops || cmCount(cm) > 0) {
+        while (cmCount(cm) < concurrency && started < ops) {
+            if (arg != NULL) {
+                if (cmSpawn(cm, prog, argv, environ, NULL) == NULL)
+                    errExit("cmSpawn");
+            } else {
+                pid = cmFork(cm, NULL, &c);
+                if (pid == -1)
+                    errExit("cmFork");
+                if (pid == 0)
+                    childBody(started);
+            }
+            started++;
+        }
+
+        n = cmReap(cm, done, 64, -1);
+        if (n == -1)
+            errExit("cmReap");
+        for (j = 0; j < n; j++) {
+            c = done[j];
+            addStatus(c->status, &sum);
+            totalLifeSecs += (c->end.tv_sec - c->start.tv_sec) +
+                             (c->end.tv_nsec - c->start.tv_nsec) / 1e9;
+            totalCpuSecs += c->ru.ru_utime.tv_sec + c->ru.ru_stime.tv_sec +
+                    (c->ru.ru_utime.tv_usec + c->ru.ru_stime.tv_usec) / 1e6;
+            totalReaped++;
+            cmRelease(cm, c);
+        }
+    }
+    cmDestroy(cm);
+    checkSum("childMgr", sum);
+}
+
+static void
+run(const char *name, benchFn fn, void *arg)
+{
+    struct benchResult res;
+
+    if (benchRun(name, fn, arg, nchildren, NULL, &res) == -1)
+        errExit("benchRun");
+    benchReport(&res);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct rlimit rl;
+    int opt;
+    long j;
+
+    nchildren = 2000;
+    concurrency = 100;
+    sleepUsecs = 0;
+    prog = NULL;
+    while ((opt = getopt(argc, argv, "n:c:s:x:")) != -1) {
+        switch (opt) {
+        case 'n': nchildren = getLong(optarg, GN_GT_0, "-n");      break;
+        case 'c': concurrency = getInt(optarg, GN_GT_0, "-c");     break;
+        case 's': sleepUsecs = getInt(optarg, GN_NONNEG, "-s");    break;
+        case 'x': prog = optarg;                                    break;
+        default:
+            usageErr("%s [-n nchildren] [-c concurrency] [-s usecs] "
+                     "[-x prog]\n", argv[0]);
+        }
+    }
+
+    /* The child manager needs a file descriptor per running child */
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+        errExit("getrlimit");
+    if (rl.rlim_cur < (rlim_t) concurrency + 64) {
+        rl.rlim_cur = concurrency + 64;
+        if (rl.rlim_max < rl.rlim_cur)
+            rl.rlim_max = rl.rlim_cur;
+        if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+            errExit("setrlimit (need %d descriptors)", concurrency + 64);
+    }
+
+    expectedSum = 0;
+    if (prog == NULL)
+        for (j = 0; j < nchildren; j++)
+            expectedSum += j % 251;
+
+    printf("%ld children, %d at once%s%s\n", nchildren, concurrency,
+           (prog != NULL) ? ", executing " : "",
+           (prog != NULL) ? prog : "");
+    fflush(stdout);             /* Before the children inherit the buffer */
+
+    run("wait()", waitMethod, NULL);
+    run("SIGCHLD + waitpid(WNOHANG)", sigchldMethod, NULL);
+    run("childMgr, cmFork()", managerMethod, NULL);
+    if (prog != NULL)
+        run("childMgr, cmSpawn() (clone3)", managerMethod, prog);
+
+    printf("Average child lifetime %.1f us, CPU time %.1f us\n",
+           totalLifeSecs * 1e6 / totalReaped,
+           totalCpuSecs * 1e6 / totalReaped);
+
+    exit(EXIT_SUCCESS);
+}
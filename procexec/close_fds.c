@@ -0,0 +1,240 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 27 */
+
+/* close_fds.c
+
+   Close (or mark close-on-exec) all of the file descriptors at or above
+   a given number, as a child created by fork() should before it execs
+   another program, so that the program does not inherit descriptors
+   that it knows nothing about. (closeonexec.c shows how to set the
+   close-on-exec flag of a single descriptor.)
+
+   The traditional way to do this is closeFdsLoop(): call close() (or
+   fcntl()) for every descriptor number up to the RLIMIT_NOFILE soft
+   limit (which is what sysconf(_SC_OPEN_MAX) returns). That is one
+   system call per possible descriptor, which, where the limit is raised
+   to 1048576 (as it commonly is for servers and containers), costs far
+   more than the exec that follows. closeFdsFrom() instead uses, in order
+   of preference:
+
+   * close_range(2) (Linux 5.9 and later), which closes the whole range
+     in one system call; with CF_CLOEXEC, it uses CLOSE_RANGE_CLOEXEC
+     (Linux 5.11 and later) to mark the descriptors close-on-exec;
+
+   * a scan of /proc/self/fd, which lists only the descriptors that are
+     actually open, so that the cost depends on the number of open
+     descriptors rather than on the limit;
+
+   * the loop, if /proc is not mounted.
+
+   The flags CF_NO_CLOSE_RANGE and CF_NO_PROC skip the corresponding
+   steps (for testing and measurement; see close_fds_bench.c).
+
+   CF_CLOEXEC (mark, rather than close) suits a child that still needs
+   its descriptors until it execs: for example, a pipe used to report a
+   failed exec to the parent, or a descriptor that the child's own code
+   is about to dup2() onto standard input.
+
+   These functions make only system calls (in particular, the directory
+   is read with getdents64(2) rather than readdir(3), which allocates
+   memory), so they can be called in the child after fork() in a
+   multithreaded program.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "close_fds.h"          /* Declares functions defined here */
+
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+struct linuxDirent64 {          /* As returned by getdents64() */
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+enum action { A_CLOSE, A_CLOEXEC, A_LIST };
+
+static int
+apply(int fd, enum action act)
+{
+    if (act == A_CLOSE)
+        return close(fd);
+    else
+        return fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+/* Apply 'act' to each open descriptor at or above 'lowfd', as listed in
+   /proc/self/fd; for A_LIST, record up to 'maxFds' of them in 'fds'.
+   Returns the number of descriptors found, or -1 if /proc/self/fd can't
+   be read. */
+
+static int
+scanProcFds(int lowfd, enum action act, int *fds, int maxFds)
+{
+    uint64_t buf[512];          /* Aligned for struct linuxDirent64 */
+    struct linuxDirent64 *d;
+    long nread, off;
+    int dirFd, fd, cnt;
+    const char *p;
+
+    dirFd = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd == -1)
+        return -1;
+
+    /* On Linux, closing descriptors while reading this directory doesn't
+       disturb the reading, since the directory offset is derived from
+       the descriptor number */
+
+    cnt = 0;
+    for (;;) {
+        nread = syscall(SYS_getdents64, dirFd, buf, sizeof(buf));
+        if (nread == -1) {
+            close(dirFd);
+            return -1;
+        }
+        if (nread == 0)
+            break;
+
+        for (off = 0; off < nread; off += d->d_reclen) {
+            d = (struct linuxDirent64 *) ((char *) buf + off);
+            if (d->d_name[0] < '0' || d->d_name[0] > '9')
+                continue;                       /* "." and ".." */
+            fd = 0;
+            for (p = d->d_name; *p != '\0'; p++)
+                fd = fd * 10 + (*p - '0');
+            if (fd < lowfd || fd == dirFd)
+                continue;
+
+            if (act == A_LIST) {
+                if (cnt < maxFds)
+                    fds[cnt] = fd;
+            } else {
+                apply(fd, act);
+            }
+            cnt++;
+        }
+    }
+
+    close(dirFd);
+    return cnt;
+}
+
+/* Return the highest descriptor number that might be open, plus one */
+
+static int
+fdLimit(void)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur > INT_MAX)
+        return INT_MAX;
+    return rl.rlim_cur;
+}
+
+/* Close (or, if 'flags' includes CF_CLOEXEC, mark close-on-exec) every
+   descriptor from 'lowfd' up to the RLIMIT_NOFILE soft limit, one at a
+   time. Returns 0 on success, or -1 on error. */
+
+int
+closeFdsLoop(int lowfd, int flags)
+{
+    enum action act;
+    int fd, max;
+
+    if (lowfd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    act = (flags & CF_CLOEXEC) ? A_CLOEXEC : A_CLOSE;
+    max = fdLimit();
+    for (fd = lowfd; fd < max; fd++)
+        apply(fd, act);                 /* Fails with EBADF if not open */
+    return 0;
+}
+
+/* Close (or, if 'flags' includes CF_CLOEXEC, mark close-on-exec) all
+   open descriptors at or above 'lowfd', as cheaply as possible. Returns
+   0 on success, or -1 on error. */
+
+int
+closeFdsFrom(int lowfd, int flags)
+{
+    if (lowfd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#ifdef SYS_close_range
+
+    /* ENOSYS: kernel older than 5.9; EINVAL: CLOSE_RANGE_CLOEXEC is not
+       supported (before 5.11) */
+
+    if (!(flags & CF_NO_CLOSE_RANGE)) {
+        if (syscall(SYS_close_range, (unsigned int) lowfd, ~0U,
+                    (flags & CF_CLOEXEC) ? CLOSE_RANGE_CLOEXEC : 0) == 0)
+            return 0;
+        if (errno != ENOSYS && errno != EINVAL)
+            return -1;
+    }
+#endif
+
+    if (!(flags & CF_NO_PROC) &&
+            scanProcFds(lowfd, (flags & CF_CLOEXEC) ? A_CLOEXEC : A_CLOSE,
+                        NULL, 0) != -1)
+        return 0;
+
+    return closeFdsLoop(lowfd, flags);
+}
+
+/* Place in 'fds' (of 'maxFds' elements) the numbers of the open
+   descriptors at or above 'lowfd', in ascending order. Returns the number
+   of such descriptors (which may be greater than 'maxFds'), or -1 on
+   error. */
+
+int
+listFds(int lowfd, int *fds, int maxFds)
+{
+    int fd, max, cnt;
+
+    if (lowfd < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    cnt = scanProcFds(lowfd, A_LIST, fds, maxFds);
+    if (cnt != -1)
+        return cnt;
+
+    cnt = 0;
+    max = fdLimit();
+    for (fd = lowfd; fd < max; fd++) {
+        if (fcntl(fd, F_GETFD) != -1) {
+            if (cnt < maxFds)
+                fds[cnt] = fd;
+            cnt++;
+        }
+    }
+    return cnt;
+}
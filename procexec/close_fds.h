@@ -0,0 +1,30 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 27 */
+
+/* close_fds.h
+
+   Header file for close_fds.c.
+*/
+#ifndef CLOSE_FDS_H
+#define CLOSE_FDS_H             /* Prevent accidental double inclusion */
+
+#define CF_CLOEXEC      1       /* Set FD_CLOEXEC instead of closing */
+#define CF_NO_CLOSE_RANGE 2     /* Don't use close_range() */
+#define CF_NO_PROC      4       /* Don't scan /proc/self/fd */
+
+int closeFdsFrom(int lowfd, int flags);
+
+int closeFdsLoop(int lowfd, int flags);
+
+int listFds(int lowfd, int *fds, int maxFds);
+
+#endif
@@ -0,0 +1,226 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 27 */
+
+/* close_fds_bench.c
+
+   Measure the cost, in a child created by fork(), of closing (or marking
+   close-on-exec) all file descriptors other than 0, 1, and 2, using each
+   of the techniques in close_fds.c, and the cost of spawnSystemFlags()
+   with and without SPAWN_SYSTEM_CLOSE_FDS.
+
+   Usage: close_fds_bench [-l limit] [-n nopen] [-c nchildren]
+
+        -l limit      Set the RLIMIT_NOFILE soft limit (and, if need be
+                      and permitted, the hard limit) to this value
+                      (default: 1048576, or the hard limit if that is
+                      lower and can't be raised)
+        -n nopen      Extra descriptors to open, scattered over the range
+                      below the limit (default: 16)
+        -c nchildren  Children created by each repetition (default: 50)
+
+   Each child applies the technique, checks that the extra descriptors
+   were closed (or marked close-on-exec), and exits; the cost reported
+   (in the common format of lib/bench.c) is per child, and includes the
+   fork() and wait, which the line "fork() only" shows alone. The loop
+   makes one system call per descriptor number up to the limit, while
+   close_range() makes one in all, and the /proc/self/fd scan makes one
+   per open descriptor (plus a few to read the directory).
+
+   Try: ./close_fds_bench
+        ./close_fds_bench -l 1024
+        ./close_fds_bench -n 1000 -c 20
+
+   This program is Linux-specific.
+*/
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include "close_fds.h"
+#include "spawn_system.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+#define M_NONE -1               /* 'flags' value for "fork() only" */
+
+static int *openFds;            /* The extra descriptors */
+static int nopen;
+
+/* In a child, apply closeFdsFrom() or closeFdsLoop() with 'flags', and
+   check the result; the child's exit status reports the result */
+
+static void
+childWork(int flags, Boolean loop)
+{
+    int j, fdFlags;
+
+    if (flags != M_NONE) {
+        if ((loop ? closeFdsLoop(3, flags) : closeFdsFrom(3, flags)) == -1)
+            _exit(2);
+
+        for (j = 0; j < nopen; j++) {
+            fdFlags = fcntl(openFds[j], F_GETFD);
+            if ((flags & CF_CLOEXEC) ? !(fdFlags & FD_CLOEXEC) ||
+                                        fdFlags == -1
+                                     : fdFlags != -1)
+                _exit(1);
+        }
+        if (fcntl(STDERR_FILENO, F_GETFD) == -1)
+            _exit(1);
+    }
+    _exit(0);
+}
+
+struct method {
+    const char *name;
+    int flags;                  /* CF_* flags, or M_NONE */
+    Boolean loop;               /* Use closeFdsLoop()? */
+};
+
+static void
+forkChildren(long ops, void *arg)
+{
+    struct method *m = arg;
+    pid_t childPid;
+    int status;
+    long j;
+
+    for (j = 0; j < ops; j++) {
+        childPid = fork();
+        if (childPid == -1)
+            errExit("fork");
+        if (childPid == 0)
+            childWork(m->flags, m->loop);       /* Doesn't return */
+
+        if (waitpid(childPid, &status, 0) == -1)
+            errExit("waitpid");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fatal("%s: child failed (status 0x%x)", m->name, status);
+    }
+}
+
+static void
+spawnChildren(long ops, void *arg)
+{
+    int *flags = arg;
+    long j;
+
+    for (j = 0; j < ops; j++)
+        if (spawnSystemFlags("true", *flags) != 0)
+            fatal("spawnSystemFlags() failed");
+}
+
+static void
+run(const char *name, benchFn fn, void *arg, long ops)
+{
+    struct benchResult res;
+
+    if (benchRun(name, fn, arg, ops, NULL, &res) == -1)
+        errExit("benchRun");
+    benchReport(&res);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static struct method methods[] = {
+        { "fork() only",                M_NONE,                 FALSE },
+        { "loop close()",               0,                      TRUE  },
+        { "loop fcntl(FD_CLOEXEC)",     CF_CLOEXEC,             TRUE  },
+        { "/proc/self/fd close()",      CF_NO_CLOSE_RANGE,      FALSE },
+        { "/proc/self/fd FD_CLOEXEC",   CF_NO_CLOSE_RANGE | CF_CLOEXEC,
+                                                                FALSE },
+        { "close_range()",              0,                      FALSE },
+        { "close_range(CLOEXEC)",       CF_CLOEXEC,             FALSE },
+        { NULL, 0, FALSE }
+    };
+    struct rlimit rl;
+    rlim_t limit;
+    long nchildren;
+    int opt, j, fd, flags;
+    char cmd[64];
+
+    limit = 1048576;
+    nopen = 16;
+    nchildren = 50;
+    while ((opt = getopt(argc, argv, "l:n:c:")) != -1) {
+        switch (opt) {
+        case 'l': limit = getLong(optarg, GN_GT_0, "-l");       break;
+        case 'n': nopen = getInt(optarg, GN_NONNEG, "-n");      break;
+        case 'c': nchildren = getLong(optarg, GN_GT_0, "-c");   break;
+        default:
+            usageErr("%s [-l limit] [-n nopen] [-c nchildren]\n", argv[0]);
+        }
+    }
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+        errExit("getrlimit");
+    if (limit > rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max = limit;
+        if (setrlimit(RLIMIT_NOFILE, &rl) == -1) {
+            if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+                errExit("getrlimit");
+            limit = rl.rlim_max;
+        }
+    }
+    rl.rlim_cur = limit;
+    if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+        errExit("setrlimit");
+    if (nopen > (long) limit - 3)
+        cmdLineErr("-n must be less than the limit minus 3\n");
+
+    /* Open the extra descriptors: half at the bottom of the range, and
+       the rest spread over it, as a long-running program might have */
+
+    openFds = calloc(nopen > 0 ? nopen : 1, sizeof(int));
+    if (openFds == NULL)
+        errExit("calloc");
+    for (j = 0; j < nopen; j++) {
+        fd = open("/dev/null", O_RDONLY);
+        if (fd == -1)
+            errExit("open");
+        if (j >= nopen / 2) {
+            openFds[j] = fcntl(fd, F_DUPFD,
+                               (int) ((limit - 1) * (j + 1) / (nopen + 1)));
+            if (openFds[j] == -1)
+                errExit("F_DUPFD");
+            close(fd);
+        } else {
+            openFds[j] = fd;
+        }
+    }
+
+    printf("RLIMIT_NOFILE soft limit %ld; %d extra descriptors, highest %d\n",
+           (long) limit, nopen, nopen > 0 ? openFds[nopen - 1] : 2);
+    fflush(stdout);             /* Before the children inherit the buffer */
+
+    for (j = 0; methods[j].name != NULL; j++)
+        run(methods[j].name, forkChildren, &methods[j], nchildren);
+
+    /* Check that SPAWN_SYSTEM_CLOSE_FDS works, then measure it */
+
+    if (nopen > 0) {
+        snprintf(cmd, sizeof(cmd), "test -e /proc/self/fd/%d",
+                 openFds[nopen - 1]);
+        if (spawnSystemFlags(cmd, 0) != 0)
+            fatal("Descriptor %d wasn't inherited", openFds[nopen - 1]);
+        if (spawnSystemFlags(cmd, SPAWN_SYSTEM_CLOSE_FDS) == 0)
+            fatal("Descriptor %d was inherited", openFds[nopen - 1]);
+    }
+
+    flags = SPAWN_SYSTEM_DIRECT;
+    run("spawnSystemFlags(DIRECT)", spawnChildren, &flags, nchildren);
+    flags = SPAWN_SYSTEM_DIRECT | SPAWN_SYSTEM_CLOSE_FDS;
+    run("spawnSystemFlags(DIRECT|CLOSE_FDS)", spawnChildren, &flags,
+        nchildren);
+
+    exit(EXIT_SUCCESS);
+}
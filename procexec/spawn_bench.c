@@ -0,0 +1,400 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 28 */
+
+/* spawn_bench.c
+
+   Measure how the cost of creating a child process that execs a program
+   depends on the technique used and on the size of the parent's memory
+   footprint.
+
+   Usage: spawn_bench [-n nspawns] [-m MiB[,MiB...]] [-p prog] [-T]
+                      [method...]
+
+        -n nspawns   Number of children created per method and footprint
+                     (default: 1000)
+        -m MiB       Comma-separated list of parent footprints: before
+                     each set of measurements, the parent allocates and
+                     touches this many MiB of memory (default: 0,256,1024)
+        -p prog      Program that the children execute (default:
+                     /bin/true)
+        -T           Ask for the parent's memory to be backed by
+                     transparent huge pages (madvise(MADV_HUGEPAGE)), so
+                     that fork() copies one page-table entry per 2 MiB
+                     rather than per 4 kB page
+
+   The methods (by default, all are measured) are:
+
+        fork          fork() + execv()
+        vfork         vfork() + execv()
+        posix_spawn   posix_spawn()
+        clone         clone(CLONE_VM | CLONE_VFORK) + execv()
+        clone3        clone3(CLONE_VM | CLONE_VFORK | CLONE_CLEAR_SIGHAND)
+                      + execv() (x86-64 only)
+        system        system(3), with 'prog' as the command
+        spawn_system  spawnSystem() (spawn_system.c), likewise
+        spawn_direct  spawnSystemFlags(SPAWN_SYSTEM_DIRECT), likewise
+
+   For each footprint, the program shows the size of the parent's page
+   tables (VmPTE in /proc/self/status) and, for each method, the number
+   of children created (and waited for) per second, the average time for
+   which the parent was blocked in the call that created the child, and
+   the average time for the whole create-exec-wait cycle. For fork(),
+   the call time is dominated by copying the parent's page tables, and so
+   grows with the footprint, while for the techniques that share the
+   parent's memory with the child until it execs, the call time (which
+   includes the child's exec) does not.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include "spawn_system.h"
+#include "tlpi_hdr.h"
+
+#define MAX_FOOTPRINTS 16
+#define STACK_SIZE (64 * 1024)      /* Stack for clone() children */
+
+#ifndef CLONE_CLEAR_SIGHAND
+#define CLONE_CLEAR_SIGHAND 0x100000000ULL
+#endif
+
+extern char **environ;
+
+struct cloneArgs {                  /* As for 'struct clone_args' of
+                                       <linux/sched.h> (Linux 5.5) */
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+};
+
+static char *prog = "/bin/true";
+static char *childArgv[2];
+static char *childStack;
+
+/* The methods. Each creates a child that execs 'prog', storing the
+   child's PID in '*pid', and returns 0 on success or -1 on error. Methods
+   that also wait for the child return its status in '*pid' instead. */
+
+static int
+childFunc(void *arg)
+{
+    execv(prog, childArgv);
+    _exit(127);
+}
+
+static int
+doFork(pid_t *pid)
+{
+    *pid = fork();
+    if (*pid == 0)
+        childFunc(NULL);
+    return (*pid == -1) ? -1 : 0;
+}
+
+static int
+doVfork(pid_t *pid)
+{
+    *pid = vfork();
+    if (*pid == 0) {
+        execv(prog, childArgv);
+        _exit(127);
+    }
+    return (*pid == -1) ? -1 : 0;
+}
+
+static int
+doPosixSpawn(pid_t *pid)
+{
+    int s;
+
+    s = posix_spawn(pid, prog, NULL, NULL, childArgv, environ);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+static int
+doClone(pid_t *pid)
+{
+    *pid = clone(childFunc, childStack + STACK_SIZE,
+                 CLONE_VM | CLONE_VFORK | SIGCHLD, NULL);
+    return (*pid == -1) ? -1 : 0;
+}
+
+/* glibc provides no wrapper for clone3(). When CLONE_VM is specified, the
+   child must run on its own stack, which means that it can't return from
+   a function call made by the parent; so, as in glibc's clone(), the
+   child calls childFunc() from assembler code and then terminates. */
+
+#if defined(__x86_64__)
+static pid_t
+clone3Vm(struct cloneArgs *args)
+{
+    register int (*fn)(void *) __asm__("r12") = childFunc;
+    long ret;
+
+    __asm__ __volatile__(
+            "syscall\n\t"
+            "test %%rax, %%rax\n\t"
+            "jnz 1f\n\t"
+            "xor %%ebp, %%ebp\n\t"      /* Child: call fn(NULL) */
+            "xor %%edi, %%edi\n\t"
+            "call *%%r12\n\t"
+            "mov %%eax, %%edi\n\t"      /* ... and _exit(result) */
+            "mov %[exitNr], %%eax\n\t"
+            "syscall\n\t"
+            "ud2\n"
+            "1:"
+            : "=a" (ret)
+            : "0" ((long) SYS_clone3), "D" (args), "S" (sizeof(*args)),
+              "r" (fn), [exitNr] "i" (SYS_exit)
+            : "rcx", "r11", "memory");
+
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+    return ret;
+}
+
+static int
+doClone3(pid_t *pid)
+{
+    struct cloneArgs args;
+
+    memset(&args, 0, sizeof(args));
+    args.flags = CLONE_VM | CLONE_VFORK | CLONE_CLEAR_SIGHAND;
+    args.exit_signal = SIGCHLD;
+    args.stack = (uintptr_t) childStack;
+    args.stack_size = STACK_SIZE;
+
+    *pid = clone3Vm(&args);
+    return (*pid == -1) ? -1 : 0;
+}
+#endif
+
+static int
+doSystem(pid_t *status)
+{
+    *status = system(prog);
+    return (*status == -1) ? -1 : 0;
+}
+
+static int
+doSpawnSystem(pid_t *status)
+{
+    *status = spawnSystem(prog);
+    return (*status == -1) ? -1 : 0;
+}
+
+static int
+doSpawnDirect(pid_t *status)
+{
+    *status = spawnSystemFlags(prog, SPAWN_SYSTEM_DIRECT);
+    return (*status == -1) ? -1 : 0;
+}
+
+static const struct {
+    const char *name;
+    int (*fn)(pid_t *pid);
+    Boolean waits;          /* Does 'fn' itself wait for the child? */
+} methods[] = {
+    { "fork",           doFork,         FALSE },
+    { "vfork",          doVfork,        FALSE },
+    { "posix_spawn",    doPosixSpawn,   FALSE },
+    { "clone",          doClone,        FALSE },
+#if defined(__x86_64__)
+    { "clone3",         doClone3,       FALSE },
+#endif
+    { "system",         doSystem,       TRUE },
+    { "spawn_system",   doSpawnSystem,  TRUE },
+    { "spawn_direct",   doSpawnDirect,  TRUE },
+};
+
+#define NMETHODS (sizeof(methods) / sizeof(methods[0]))
+
+static double
+nowUs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Return the size of this process's page tables, in kB */
+
+static long
+getVmPTE(void)
+{
+    char line[256];
+    long kb;
+    FILE *fp;
+
+    kb = -1;
+    fp = fopen("/proc/self/status", "r");
+    if (fp == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), fp) != NULL)
+        if (sscanf(line, "VmPTE: %ld", &kb) == 1)
+            break;
+    fclose(fp);
+    return kb;
+}
+
+static void
+runMethod(int m, int nspawns)
+{
+    double start, t0, callUs, totalUs;
+    pid_t pid;
+    int j, status;
+
+    callUs = 0;
+    start = nowUs();
+    for (j = 0; j < nspawns; j++) {
+        t0 = nowUs();
+        if (methods[m].fn(&pid) == -1)
+            errExit(methods[m].name);
+        callUs += nowUs() - t0;
+
+        if (methods[m].waits) {
+            status = pid;
+        } else if (waitpid(pid, &status, 0) == -1) {
+            errExit("waitpid");
+        }
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fatal("%s: child failed (status %#x)", methods[m].name, status);
+    }
+    totalUs = nowUs() - start;
+
+    printf("    %-14s %10.0f %10.1f %10.1f\n", methods[m].name,
+            nspawns / (totalUs / 1e6),
+            methods[m].waits ? totalUs / nspawns : callUs / nspawns,
+            totalUs / nspawns);
+}
+
+static void
+usageError(const char *progName)
+{
+    int m;
+
+    fprintf(stderr, "Usage: %s [-n nspawns] [-m MiB[,MiB...]] [-p prog] "
+                    "[-T] [method...]\n", progName);
+    fprintf(stderr, "Methods:");
+    for (m = 0; m < NMETHODS; m++)
+        fprintf(stderr, " %s", methods[m].name);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long footprints[MAX_FOOTPRINTS];
+    Boolean selected[NMETHODS], thp;
+    size_t len;
+    char *tok, *mem;
+    int opt, nspawns, nfoot, f, m, j;
+
+    nspawns = 1000;
+    nfoot = 0;
+    thp = FALSE;
+    while ((opt = getopt(argc, argv, "n:m:p:T")) != -1) {
+        switch (opt) {
+        case 'n':   nspawns = getInt(optarg, GN_GT_0, "nspawns");       break;
+        case 'p':   prog = optarg;                                      break;
+        case 'T':   thp = TRUE;                                         break;
+        case 'm':
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                if (nfoot == MAX_FOOTPRINTS)
+                    cmdLineErr("Too many footprints (max %d)\n",
+                            MAX_FOOTPRINTS);
+                footprints[nfoot++] = getLong(tok, GN_NONNEG, "MiB");
+            }
+            break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    for (m = 0; m < NMETHODS; m++)
+        selected[m] = (optind == argc);
+    for (j = optind; j < argc; j++) {
+        for (m = 0; m < NMETHODS; m++)
+            if (strcmp(argv[j], methods[m].name) == 0)
+                break;
+        if (m == NMETHODS)
+            usageError(argv[0]);
+        selected[m] = TRUE;
+    }
+
+    if (nfoot == 0) {
+        footprints[nfoot++] = 0;
+        footprints[nfoot++] = 256;
+        footprints[nfoot++] = 1024;
+    }
+
+    childArgv[0] = prog;
+    childArgv[1] = NULL;
+    childStack = malloc(STACK_SIZE);
+    if (childStack == NULL)
+        errExit("malloc");
+
+    setbuf(stdout, NULL);
+
+    for (f = 0; f < nfoot; f++) {
+
+        /* Allocate and touch the footprint, so that the parent's page
+           tables are populated */
+
+        len = footprints[f] * 1024 * 1024;
+        mem = NULL;
+        if (len > 0) {
+            mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED)
+                errExit("mmap");
+            if (thp && madvise(mem, len, MADV_HUGEPAGE) == -1)
+                errExit("madvise");
+            memset(mem, 1, len);
+        }
+
+        printf("Footprint %ld MiB (VmPTE %ld kB)\n", footprints[f],
+                getVmPTE());
+        printf("    %-14s %10s %10s %10s\n", "method", "spawns/s",
+                "call-us", "cycle-us");
+        for (m = 0; m < NMETHODS; m++)
+            if (selected[m])
+                runMethod(m, nspawns);
+
+        if (mem != NULL && munmap(mem, len) == -1)
+            errExit("munmap");
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,289 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 27 */
+
+/* spawn_system.c
+
+   spawnSystem(): a faster implementation of system(3), with the same
+   signal semantics as the implementation in system.c; and
+   spawnSystemFlags(), which can optionally avoid executing the shell.
+
+   The implementation in system.c uses fork(), whose cost grows with the
+   size of the caller's address space, since the kernel must duplicate
+   the caller's page tables (and then mark all private pages
+   copy-on-write), only for the child to discard them at once by calling
+   exec(). (See spawn_bench.c for measurements.) spawnSystem() instead
+   uses posix_spawn(), which on Linux is implemented using
+   clone(CLONE_VM | CLONE_VFORK): the child shares the caller's memory
+   until it execs, so that the cost is independent of the caller's size.
+   The signal mask and dispositions that system.c resets in the child
+   after fork() are instead specified via posix_spawnattr_setsigmask()
+   and posix_spawnattr_setsigdefault().
+
+   Furthermore, when 'command' is a simple command--a list of words that
+   contain no characters that are special to the shell, and whose first
+   word is not a shell builtin or reserved word--the shell would do no
+   more than search PATH for the command and execute it. If the
+   SPAWN_SYSTEM_DIRECT flag is given to spawnSystemFlags(), such
+   commands are executed directly, saving the cost of executing the
+   shell. This is not the default, since the result can differ in
+   (rare) corner cases: for example, the shell may be configured to
+   report errors differently, or (as with bash) may implement further
+   commands as builtins.
+
+   Like system(3), spawnSystem() lets the command inherit all of the
+   caller's open file descriptors that are not marked close-on-exec.
+   With the SPAWN_SYSTEM_CLOSE_FDS flag, spawnSystemFlags() gives the
+   command only standard input, output, and error. Where glibc provides
+   posix_spawn_file_actions_addclosefrom_np() (glibc 2.34 and later),
+   the child closes the other descriptors with close_range(2);
+   otherwise, the caller lists its open descriptors with listFds() (see
+   close_fds.c) and adds a close action for each one.
+*/
+#define _GNU_SOURCE
+#include <sys/wait.h>
+#include <spawn.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "close_fds.h"
+#include "spawn_system.h"       /* Declares function defined here */
+
+#ifdef __GLIBC_PREREQ
+#if __GLIBC_PREREQ(2, 34)
+#define HAVE_ADDCLOSEFROM
+#endif
+#endif
+
+#define MAX_WORDS 64            /* More complex commands use the shell */
+#define MAX_CMD_LEN 4096
+
+extern char **environ;
+
+/* Characters (other than spaces and tabs) that may appear in the words
+   of a command that we execute directly */
+
+static const char plainChars[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+    "-_./,:+@%^";
+
+/* Shell reserved words and builtins (including the POSIX "regular
+   builtins", which the shell need not look up in PATH) */
+
+static const char *shellWords[] = {
+    ".", ":", "!", "[", "{", "}", "alias", "bg", "break", "case", "cd",
+    "command", "continue", "do", "done", "elif", "else", "esac", "eval",
+    "exec", "exit", "export", "false", "fc", "fg", "fi", "for",
+    "getopts", "hash", "if", "in", "jobs", "kill", "newgrp", "pwd",
+    "read", "readonly", "return", "set", "shift", "test", "then",
+    "times", "trap", "true", "type", "ulimit", "umask", "unalias",
+    "unset", "until", "wait", "while", NULL
+};
+
+/* If 'command' is a simple command, split it into words in 'buf',
+   placing pointers to the words in 'argv', and return 1; otherwise,
+   return 0. Trailing newlines (as left by fgets()) are ignored. */
+
+static int
+splitSimpleCommand(const char *command, char *buf, char *argv[])
+{
+    char *p;
+    int argc, j;
+
+    if (strlen(command) >= MAX_CMD_LEN)
+        return 0;
+
+    strcpy(buf, command);
+    argc = 0;
+    for (p = buf; *p != '\0'; ) {
+        p += strspn(p, " \t");
+        if (*p == '\0')
+            break;
+        if (argc == MAX_WORDS)
+            return 0;
+        argv[argc++] = p;
+        p += strspn(p, plainChars);
+        if (*p == '\n' && strspn(p, " \t\n") == strlen(p))
+            *p = '\0';
+        if (*p != '\0' && *p != ' ' && *p != '\t')
+            return 0;                   /* Special character */
+        if (*p != '\0')
+            *p++ = '\0';
+    }
+    argv[argc] = NULL;
+
+    if (argc == 0)
+        return 0;
+    for (j = 0; shellWords[j] != NULL; j++)
+        if (strcmp(argv[0], shellWords[j]) == 0)
+            return 0;
+    return 1;
+}
+
+/* Add to 'fa' actions that close all descriptors other than 0, 1, and
+   2. Returns 0 on success, or an error number. */
+
+static int
+addCloseActions(posix_spawn_file_actions_t *fa)
+{
+#ifdef HAVE_ADDCLOSEFROM
+    return posix_spawn_file_actions_addclosefrom_np(fa, 3);
+#else
+    int *fds, n, max, j, s;
+
+    for (max = 64; ; max *= 2) {
+        fds = malloc(max * sizeof(int));
+        if (fds == NULL)
+            return ENOMEM;
+        n = listFds(3, fds, max);
+        if (n == -1) {
+            s = errno;
+            free(fds);
+            return s;
+        }
+        if (n <= max)
+            break;
+        free(fds);
+    }
+
+    s = 0;
+    for (j = 0; j < n && s == 0; j++)
+        s = posix_spawn_file_actions_addclose(fa, fds[j]);
+    free(fds);
+    return s;
+#endif
+}
+
+/* Execute 'command' as for system(3). 'flags' is 0, or the OR of
+   SPAWN_SYSTEM_DIRECT and SPAWN_SYSTEM_CLOSE_FDS. As with system(3),
+   -1 is returned (with errno set) if a child couldn't be created,
+   including when the spawn attributes or file actions can't be set up;
+   a status of 127 means that the shell couldn't be executed. */
+
+int
+spawnSystemFlags(const char *command, int flags)
+{
+    sigset_t blockMask, origMask, defaultSigs;
+    struct sigaction saIgnore, saOrigQuit, saOrigInt;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t fileActions, *fa;
+    char buf[MAX_CMD_LEN];
+    char *argv[MAX_WORDS + 1];
+    pid_t childPid;
+    int status, savedErrno, s, attrInit;
+
+    if (command == NULL)                /* Is a shell available? */
+        return spawnSystemFlags(":", 0) == 0;
+
+    /* As in system.c, the caller blocks SIGCHLD and ignores SIGINT and
+       SIGQUIT while the child executes */
+
+    sigemptyset(&blockMask);
+    sigaddset(&blockMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &blockMask, &origMask);
+
+    saIgnore.sa_handler = SIG_IGN;
+    saIgnore.sa_flags = 0;
+    sigemptyset(&saIgnore.sa_mask);
+    sigaction(SIGINT, &saIgnore, &saOrigInt);
+    sigaction(SIGQUIT, &saIgnore, &saOrigQuit);
+
+    /* The child gets the caller's original signal mask, and default
+       dispositions for SIGINT and SIGQUIT unless the caller was
+       ignoring them */
+
+    sigemptyset(&defaultSigs);
+    if (saOrigInt.sa_handler != SIG_IGN)
+        sigaddset(&defaultSigs, SIGINT);
+    if (saOrigQuit.sa_handler != SIG_IGN)
+        sigaddset(&defaultSigs, SIGQUIT);
+
+    s = posix_spawnattr_init(&attr);
+    attrInit = (s == 0);
+    if (s == 0)
+        s = posix_spawnattr_setsigmask(&attr, &origMask);
+    if (s == 0)
+        s = posix_spawnattr_setsigdefault(&attr, &defaultSigs);
+    if (s == 0)
+        s = posix_spawnattr_setflags(&attr,
+                POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    fa = NULL;
+    if (s == 0 && (flags & SPAWN_SYSTEM_CLOSE_FDS)) {
+        s = posix_spawn_file_actions_init(&fileActions);
+        if (s == 0) {
+            fa = &fileActions;
+            s = addCloseActions(fa);
+        }
+    }
+
+    /* A failure to set up the attributes or file actions means that we
+       couldn't create a child (below, we return -1), not that the
+       shell couldn't be executed */
+
+    if (s != 0 && s != ENOMEM)
+        s = EAGAIN;
+
+    /* If the command can't be executed directly (for example, because it
+       isn't found, or is a script without a "#!" line), we let the shell
+       try, so that the shell diagnoses the error and sets the status */
+
+    if (s == 0) {
+        s = -1;
+        if ((flags & SPAWN_SYSTEM_DIRECT) &&
+                splitSimpleCommand(command, buf, argv))
+            s = posix_spawnp(&childPid, argv[0], fa, &attr, argv, environ);
+        if (s != 0 && s != EAGAIN && s != ENOMEM) {
+            argv[0] = "sh";
+            argv[1] = "-c";
+            argv[2] = (char *) command;
+            argv[3] = NULL;
+            s = posix_spawn(&childPid, "/bin/sh", fa, &attr, argv, environ);
+        }
+    }
+    if (fa != NULL)
+        posix_spawn_file_actions_destroy(fa);
+    if (attrInit)
+        posix_spawnattr_destroy(&attr);
+
+    if (s == EAGAIN || s == ENOMEM) {   /* Couldn't create a child */
+        errno = s;
+        status = -1;
+    } else if (s != 0) {                /* Couldn't exec the shell */
+        status = 127 << 8;
+    } else {
+        while (waitpid(childPid, &status, 0) == -1) {
+            if (errno != EINTR) {
+                status = -1;
+                break;
+            }
+        }
+    }
+
+    /* Unblock SIGCHLD, restore dispositions of SIGINT and SIGQUIT */
+
+    savedErrno = errno;
+
+    sigprocmask(SIG_SETMASK, &origMask, NULL);
+    sigaction(SIGINT, &saOrigInt, NULL);
+    sigaction(SIGQUIT, &saOrigQuit, NULL);
+
+    errno = savedErrno;
+
+    return status;
+}
+
+int
+spawnSystem(const char *command)
+{
+    return spawnSystemFlags(command, 0);
+}
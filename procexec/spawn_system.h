@@ -0,0 +1,29 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 27 */
+
+/* spawn_system.h
+
+   Header file for spawn_system.c.
+*/
+#ifndef SPAWN_SYSTEM_H
+#define SPAWN_SYSTEM_H          /* Prevent accidental double inclusion */
+
+#define SPAWN_SYSTEM_DIRECT 1   /* Execute simple commands without
+                                   using the shell */
+#define SPAWN_SYSTEM_CLOSE_FDS 2 /* Don't let the command inherit
+                                   descriptors other than 0, 1, and 2 */
+
+int spawnSystem(const char *command);
+
+int spawnSystemFlags(const char *command, int flags);
+
+#endif
@@ -0,0 +1,79 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 27 */
+
+/* t_spawn_system.c
+
+   Demonstrate the use of spawnSystem() (spawn_system.c) to execute a
+   shell command. This program is the same as t_system.c, except that it
+   uses spawnSystemFlags() instead of system(3).
+
+   Usage: t_spawn_system [-d] [-c]
+
+        -d      Pass the SPAWN_SYSTEM_DIRECT flag, so that simple commands
+                are executed without using the shell
+        -c      Pass the SPAWN_SYSTEM_CLOSE_FDS flag, so that commands
+                inherit only file descriptors 0, 1, and 2
+
+   Try, for example, the commands "true", "exit 3", "ls | wc -l", and
+   "no-such-command", with and without -d. To see the effect of -c, run
+   the program with an extra descriptor open, and use the command
+   "ls -l /proc/self/fd":
+
+        ./t_spawn_system -c 5</dev/null
+*/
+#include <sys/wait.h>
+#include "print_wait_status.h"
+#include "spawn_system.h"
+#include "tlpi_hdr.h"
+
+#define MAX_CMD_LEN 200
+
+int
+main(int argc, char *argv[])
+{
+    char str[MAX_CMD_LEN];      /* Command to be executed */
+    int status;                 /* Status return from spawnSystemFlags() */
+    int flags, opt;
+
+    flags = 0;
+    while ((opt = getopt(argc, argv, "dc")) != -1) {
+        switch (opt) {
+        case 'd': flags |= SPAWN_SYSTEM_DIRECT;         break;
+        case 'c': flags |= SPAWN_SYSTEM_CLOSE_FDS;      break;
+        default:  usageErr("%s [-d] [-c]\n", argv[0]);
+        }
+    }
+    if (optind < argc)
+        usageErr("%s [-d] [-c]\n", argv[0]);
+
+    for (;;) {                  /* Read and execute a shell command */
+        printf("Command: ");
+        fflush(stdout);
+        if (fgets(str, MAX_CMD_LEN, stdin) == NULL)
+            break;              /* end-of-file */
+
+        status = spawnSystemFlags(str, flags);
+        printf("spawnSystemFlags() returned: status=0x%04x (%d,%d)\n",
+                (unsigned int) status, status >> 8, status & 0xff);
+
+        if (status == -1) {
+            errExit("spawnSystemFlags");
+        } else {
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 127)
+                printf("(Probably) could not invoke shell or command\n");
+            else                /* Command was successfully executed */
+                printWaitStatus(NULL, status);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
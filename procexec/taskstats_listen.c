@@ -0,0 +1,380 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 28 */
+
+/* taskstats_listen.c
+
+   Receive a record of the resource usage of each thread as it exits,
+   using the taskstats interface (see the kernel source file
+   Documentation/accounting/taskstats.rst), rather than waiting for
+   process accounting (acct_on.c) to write a record to a file when each
+   process exits.
+
+   tslOpen() creates a generic netlink socket, looks up the ID of the
+   "TASKSTATS" family, and registers the socket as a listener for exits
+   on the CPUs in 'cpuMask' (a list such as "0-3,8"; if it is NULL, all
+   possible CPUs). The kernel sends a record for each thread that exits
+   on one of those CPUs to each listener registered for that CPU; a
+   program that wants every exit must register for every CPU (as the
+   default does), and a collector that has one thread per CPU can
+   instead open one listener per CPU. Registration requires the
+   CAP_NET_ADMIN capability, in the initial user and PID namespaces.
+
+   The kernel doesn't wait for a listener: if the socket's receive
+   buffer is full, records are lost, and the next recvmmsg() fails with
+   ENOBUFS. tslOpen() therefore sets the receive buffer to 'rcvBufSize'
+   bytes (4 MiB if 'rcvBufSize' is 0; a privileged process can exceed
+   the 'rmem_max' limit), room for several thousand records.
+   tslProcess() reads all of the waiting records without blocking (use
+   poll() or epoll on tslFd() to wait for them), in batches of up to
+   BATCH messages per recvmmsg() call, and reports each record by
+   calling 'cb'. The number of times that records were lost is counted
+   (in 'overruns'), but the number of records lost is unknown.
+
+   Each record is a taskstats structure describing one thread: its
+   command name, IDs, start time, elapsed and CPU times, page faults,
+   memory high-water marks, I/O counts, context switches, the time spent
+   waiting for a CPU, and (if delay accounting is enabled; see the
+   'delayacct' boot option and the kernel.task_delayacct sysctl) the
+   time spent waiting for block I/O, swapping in, and so on. Records are
+   copied into a local structure, so that a kernel whose structure is
+   longer or shorter (see 'version') than the one in <linux/taskstats.h>
+   can be handled (missing fields are 0). When the last thread of a
+   multithreaded process exits, the kernel adds the totals for the
+   process, and 'groupExit' is passed to the callback as 1; for a
+   single-threaded process, 'groupExit' is 0, and 'ac_pid' equals
+   'ac_tgid'.
+
+   tslOpen() returns a handle, or NULL on error. tslProcess() returns
+   the number of records reported, or -1 on error.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "taskstats_listen.h"   /* Declares functions defined here */
+
+#define BATCH 64                /* Messages per recvmmsg() */
+#define MSG_BUF_SIZE 4096       /* An exit message is about 1 kB */
+#define DEFAULT_RCVBUF (4 * 1024 * 1024)
+
+/* Step through attributes, in the manner of NLMSG_OK() and NLMSG_NEXT() */
+
+#define ATTR_OK(na, len) ((len) >= (int) NLA_HDRLEN && \
+        (na)->nla_len >= NLA_HDRLEN && (na)->nla_len <= (len))
+#define ATTR_NEXT(na, len) ((len) -= NLA_ALIGN((na)->nla_len), \
+        (struct nlattr *) ((char *) (na) + NLA_ALIGN((na)->nla_len)))
+#define ATTR_DATA(na) ((void *) ((char *) (na) + NLA_HDRLEN))
+#define ATTR_LEN(na) ((int) ((na)->nla_len - NLA_HDRLEN))
+
+struct tsListener {
+    int fd;
+    int family;                 /* Generic netlink ID of "TASKSTATS" */
+    unsigned int seq;           /* Sequence number of last request */
+    char *cpuMask;              /* As registered */
+    char *bufs;                 /* BATCH buffers of MSG_BUF_SIZE bytes */
+    struct mmsghdr msgs[BATCH];
+    struct iovec iov[BATCH];
+    struct sockaddr_nl addrs[BATCH];
+    struct tslStats stats;
+};
+
+/* Send a generic netlink request for 'cmd' to 'family', with a single
+   attribute, and wait for the acknowledgement. If 'family' is
+   GENL_ID_CTRL (a request for a family ID), l->family is set from the
+   reply. Other messages that arrive meanwhile (exit records, if we are
+   already registered on some CPU) are discarded. Returns 0 on success,
+   or -1 on error. */
+
+static int
+request(struct tsListener *l, int family, int cmd, int version,
+        int attrType, const void *data, int dataLen)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct genlmsghdr g;
+        char attrs[512];
+    } req;
+    struct nlmsghdr *nlh;
+    struct nlmsgerr *err;
+    struct nlattr *na;
+    ssize_t nr;
+    int len, alen;
+
+    if (dataLen > (int) (sizeof(req.attrs) - NLA_HDRLEN)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    na = (struct nlattr *) req.attrs;
+    na->nla_type = attrType;
+    na->nla_len = NLA_HDRLEN + dataLen;
+    memcpy(ATTR_DATA(na), data, dataLen);
+    req.nlh.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN) + NLA_ALIGN(na->nla_len);
+    req.nlh.nlmsg_type = family;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    req.nlh.nlmsg_seq = ++l->seq;
+    req.g.cmd = cmd;
+    req.g.version = version;
+
+    if (send(l->fd, &req, req.nlh.nlmsg_len, 0) == -1)
+        return -1;
+
+    for (;;) {
+        nr = recv(l->fd, l->bufs, BATCH * MSG_BUF_SIZE, 0);
+        if (nr == -1) {
+            if (errno == EINTR || errno == ENOBUFS)
+                continue;
+            return -1;
+        }
+
+        len = nr;
+        for (nlh = (struct nlmsghdr *) l->bufs; NLMSG_OK(nlh, len);
+                nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_seq != l->seq)
+                continue;
+
+            if (nlh->nlmsg_type == NLMSG_ERROR) {   /* Including the ACK */
+                err = NLMSG_DATA(nlh);
+                if (err->error == 0)
+                    return 0;
+                errno = -err->error;
+                return -1;
+            }
+
+            if (nlh->nlmsg_type != GENL_ID_CTRL ||
+                    nlh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+                continue;
+
+            na = (struct nlattr *) ((char *) NLMSG_DATA(nlh) + GENL_HDRLEN);
+            alen = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+            for (; ATTR_OK(na, alen); na = ATTR_NEXT(na, alen))
+                if (na->nla_type == CTRL_ATTR_FAMILY_ID &&
+                        ATTR_LEN(na) >= (int) sizeof(__u16))
+                    l->family = *(__u16 *) ATTR_DATA(na);
+        }
+    }
+}
+
+/* Return the list of possible CPUs (e.g., "0-7"), allocated with
+   malloc(), or NULL on error */
+
+static char *
+possibleCpus(void)
+{
+    char buf[4096];
+    FILE *fp;
+    long n;
+
+    fp = fopen("/sys/devices/system/cpu/possible", "r");
+    if (fp != NULL) {
+        if (fgets(buf, sizeof(buf), fp) == NULL)
+            buf[0] = '\0';
+        fclose(fp);
+        buf[strcspn(buf, "\n")] = '\0';
+        if (buf[0] != '\0')
+            return strdup(buf);
+    }
+
+    n = sysconf(_SC_NPROCESSORS_CONF);
+    snprintf(buf, sizeof(buf), "0-%ld", (n > 1) ? n - 1 : 0);
+    return strdup(buf);
+}
+
+struct tsListener *
+tslOpen(const char *cpuMask, int rcvBufSize)
+{
+    struct tsListener *l;
+    int savedErrno, j;
+
+    l = calloc(1, sizeof(struct tsListener));
+    if (l == NULL)
+        return NULL;
+    l->fd = -1;
+    l->bufs = malloc(BATCH * MSG_BUF_SIZE);
+    l->cpuMask = (cpuMask != NULL) ? strdup(cpuMask) : possibleCpus();
+    if (l->bufs == NULL || l->cpuMask == NULL)
+        goto fail;
+
+    for (j = 0; j < BATCH; j++) {
+        l->iov[j].iov_base = l->bufs + j * MSG_BUF_SIZE;
+        l->iov[j].iov_len = MSG_BUF_SIZE;
+        l->msgs[j].msg_hdr.msg_iov = &l->iov[j];
+        l->msgs[j].msg_hdr.msg_iovlen = 1;
+        l->msgs[j].msg_hdr.msg_name = &l->addrs[j];
+    }
+
+    l->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (l->fd == -1)
+        goto fail;
+
+    if (rcvBufSize <= 0)
+        rcvBufSize = DEFAULT_RCVBUF;
+    if (setsockopt(l->fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvBufSize,
+                   sizeof(rcvBufSize)) == -1 &&
+            setsockopt(l->fd, SOL_SOCKET, SO_RCVBUF, &rcvBufSize,
+                       sizeof(rcvBufSize)) == -1)
+        goto fail;
+
+    l->family = -1;
+    if (request(l, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, 1,
+                CTRL_ATTR_FAMILY_NAME, TASKSTATS_GENL_NAME,
+                sizeof(TASKSTATS_GENL_NAME)) == -1)
+        goto fail;
+    if (l->family == -1) {
+        errno = ENOENT;
+        goto fail;
+    }
+
+    if (request(l, l->family, TASKSTATS_CMD_GET, TASKSTATS_GENL_VERSION,
+                TASKSTATS_CMD_ATTR_REGISTER_CPUMASK, l->cpuMask,
+                strlen(l->cpuMask) + 1) == -1)
+        goto fail;
+
+    return l;
+
+fail:
+    savedErrno = errno;
+    tslClose(l);
+    errno = savedErrno;
+    return NULL;
+}
+
+int
+tslFd(const struct tsListener *l)
+{
+    return l->fd;
+}
+
+/* Report the exit record in the message 'nlh' (if it is one) */
+
+static void
+applyMsg(struct tsListener *l, struct nlmsghdr *nlh, tslCallback cb,
+         void *arg)
+{
+    struct taskstats ts;
+    struct nlattr *na, *nna;
+    int len, nlen, gotStats, groupExit;
+
+    if (nlh->nlmsg_type != l->family ||
+            nlh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+        return;
+
+    gotStats = groupExit = 0;
+    na = (struct nlattr *) ((char *) NLMSG_DATA(nlh) + GENL_HDRLEN);
+    len = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    for (; ATTR_OK(na, len); na = ATTR_NEXT(na, len)) {
+        if (na->nla_type == TASKSTATS_TYPE_AGGR_TGID) {
+            groupExit = 1;
+            continue;
+        }
+        if (na->nla_type != TASKSTATS_TYPE_AGGR_PID)
+            continue;
+
+        /* A nested PID attribute and STATS attribute. The structure
+           is copied, since it needn't be 8-byte aligned. */
+
+        nna = ATTR_DATA(na);
+        nlen = ATTR_LEN(na);
+        for (; ATTR_OK(nna, nlen); nna = ATTR_NEXT(nna, nlen)) {
+            if (nna->nla_type == TASKSTATS_TYPE_STATS) {
+                memset(&ts, 0, sizeof(ts));
+                memcpy(&ts, ATTR_DATA(nna),
+                       (ATTR_LEN(nna) < (int) sizeof(ts)) ?
+                                ATTR_LEN(nna) : (int) sizeof(ts));
+                gotStats = 1;
+            }
+        }
+    }
+
+    if (gotStats) {
+        l->stats.records++;
+        if (cb != NULL)
+            cb(arg, &ts, groupExit);
+    }
+}
+
+int
+tslProcess(struct tsListener *l, tslCallback cb, void *arg)
+{
+    struct nlmsghdr *nlh;
+    long records;
+    int n, j, len;
+
+    records = l->stats.records;
+    for (;;) {
+        for (j = 0; j < BATCH; j++)
+            l->msgs[j].msg_hdr.msg_namelen = sizeof(struct sockaddr_nl);
+
+        n = recvmmsg(l->fd, l->msgs, BATCH, MSG_DONTWAIT, NULL);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            if (errno == ENOBUFS) {     /* Lost records */
+                l->stats.overruns++;
+                continue;
+            }
+            return -1;
+        }
+
+        l->stats.batches++;
+        for (j = 0; j < n; j++) {
+            if (l->addrs[j].nl_pid != 0)        /* Not from the kernel */
+                continue;
+
+            l->stats.msgs++;
+            len = l->msgs[j].msg_len;
+            for (nlh = l->iov[j].iov_base; NLMSG_OK(nlh, len);
+                    nlh = NLMSG_NEXT(nlh, len))
+                applyMsg(l, nlh, cb, arg);
+        }
+
+        if (n < BATCH)                  /* Probably nothing more */
+            break;
+    }
+
+    return l->stats.records - records;
+}
+
+void
+tslGetStats(const struct tsListener *l, struct tslStats *stats)
+{
+    *stats = l->stats;
+}
+
+void
+tslClose(struct tsListener *l)
+{
+    if (l == NULL)
+        return;
+
+    if (l->fd != -1) {
+        if (l->family > 0)              /* Not strictly needed: the kernel
+                                           drops listeners that have gone */
+            request(l, l->family, TASKSTATS_CMD_GET, TASKSTATS_GENL_VERSION,
+                    TASKSTATS_CMD_ATTR_DEREGISTER_CPUMASK, l->cpuMask,
+                    strlen(l->cpuMask) + 1);
+        close(l->fd);
+    }
+    free(l->cpuMask);
+    free(l->bufs);
+    free(l);
+}
@@ -0,0 +1,48 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 28 */
+
+/* taskstats_listen.h
+
+   Header file for taskstats_listen.c.
+*/
+#ifndef TASKSTATS_LISTEN_H
+#define TASKSTATS_LISTEN_H      /* Prevent accidental double inclusion */
+
+#include <linux/taskstats.h>
+
+/* Called for each exit record; 'groupExit' is nonzero if the exiting
+   thread was the last of a multithreaded process */
+
+typedef void (*tslCallback)(void *arg, const struct taskstats *ts,
+                            int groupExit);
+
+struct tslStats {
+    long batches;               /* recvmmsg() calls that returned data */
+    long msgs;                  /* Messages received */
+    long records;               /* Exit records reported to callbacks */
+    long overruns;              /* Times that records were lost because
+                                   the receive buffer was full */
+};
+
+struct tsListener;              /* Opaque; defined in taskstats_listen.c */
+
+struct tsListener *tslOpen(const char *cpuMask, int rcvBufSize);
+
+int tslFd(const struct tsListener *l);
+
+int tslProcess(struct tsListener *l, tslCallback cb, void *arg);
+
+void tslGetStats(const struct tsListener *l, struct tslStats *stats);
+
+void tslClose(struct tsListener *l);
+
+#endif
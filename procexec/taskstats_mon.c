@@ -0,0 +1,532 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 28 */
+
+/* taskstats_mon.c
+
+   Collect accounting information for processes as they exit, using
+   taskstats (see taskstats_listen.c), and either print a line for each
+   process in the format of acct_view.c, or periodically summarize the
+   resource usage of the processes that exited, by user and command.
+
+   Usage: taskstats_mon [-a] [-b rcvbuf] [-c cpus] [-d secs] [-i secs]
+                        [-n num]
+
+        -a          Print a line for each process that exits, in the
+                    format of acct_view.c, instead of summaries
+        -b rcvbuf   Size of the socket receive buffer (default: 4 MiB)
+        -c cpus     Listen for exits on these CPUs (e.g., "0-3,8";
+                    default: all)
+        -d secs     Stop after 'secs' seconds (default: run until
+                    interrupted with Control-C)
+        -i secs     Interval between summaries (default: 5)
+        -n num      Show only the 'num' commands that used the most CPU
+                    time in each summary (default: 10; 0 means all)
+
+   Unlike process accounting (acct_on.c), which appends a record to a
+   file when a process exits, to be read later (acct_view.c,
+   acct_stats.c), this program receives each record within moments of
+   the exit, keeps its totals in memory, and needs no file. Each summary
+   shows, for the interval, the number of processes and threads that
+   exited, the number of records received, the recvmmsg() calls
+   (batches) that returned them, and the times that records were lost
+   (overruns), followed by a table of the processes and threads that
+   exited, by user and command (threads are counted under their own
+   names; see prctl(PR_SET_NAME)), with their CPU time, the time that
+   they waited for a CPU, the time that they waited for block I/O (0
+   unless delay accounting is enabled: "sysctl kernel.task_delayacct=1"),
+   the bytes that they read and wrote to storage, and the largest
+   resident set size.
+
+   The kernel sends a record for each thread. The records of the
+   threads of a multithreaded process are added together, and the
+   process is complete when the kernel reports that its last thread has
+   exited; a single-threaded process is complete when its record
+   arrives. (If the main thread of a multithreaded process terminates
+   before the other threads, with pthread_exit(), the process is
+   reported twice: once when the main thread exits, and again when the
+   last thread does.) Threads of processes whose completion was lost in
+   an overrun are discarded when the process no longer exists.
+
+   The program needs the CAP_NET_ADMIN capability.
+
+   Try: running this program, and in another terminal, a command that
+   creates many processes, e.g., "make -C .. clean all".
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/acct.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include "taskstats_listen.h"
+#include "ugid_cache.h"                 /* Declares userNameFromIdCached() */
+#include "tlpi_hdr.h"
+
+#define TIME_BUF_SIZE 100
+
+struct statEntry {                      /* Totals for one (uid, command) */
+    uint32_t uid;
+    char comm[TS_COMM_LEN + 1];         /* Empty string: slot unused */
+    long procs;
+    long threads;
+    unsigned long long cpuUs;
+    unsigned long long cpuDelayNs;
+    unsigned long long blkioDelayNs;
+    unsigned long long readBytes;
+    unsigned long long writeBytes;
+    unsigned long long maxRssKB;
+};
+
+struct table {                          /* Open-addressing hash table */
+    struct statEntry *slots;
+    size_t size;                        /* A power of 2 */
+    size_t used;
+};
+
+struct pendingProc {            /* A multithreaded process, some of
+                                   whose threads have exited */
+    uint32_t tgid;
+    Boolean haveLeader;         /* Main thread's record in 'leader'? */
+    struct taskstats leader;
+    long threads;
+    unsigned long long cpuUs;   /* Totals over the exited threads */
+    unsigned long long maxEtime;
+};
+
+static struct table tab;                /* Current interval */
+static long procsExited, threadsExited; /* ... */
+
+static struct pendingProc *pending;     /* Unordered array */
+static size_t numPending, maxPending;
+
+static Boolean acctFormat;              /* -a */
+static volatile sig_atomic_t stop;
+
+static size_t
+hashKey(uint32_t uid, const char *comm)
+{
+    size_t h = 2166136261U ^ uid;
+    int j;
+
+    for (j = 0; j <= TS_COMM_LEN && comm[j] != '\0'; j++)
+        h = (h ^ (unsigned char) comm[j]) * 16777619U;
+    return h;
+}
+
+static void tableInit(struct table *tab, size_t size);
+
+/* Return the entry for (uid, comm), creating it if necessary */
+
+static struct statEntry *
+tableLookup(struct table *tab, uint32_t uid, const char *comm)
+{
+    struct statEntry *e, *old;
+    size_t j, oldSize;
+
+    if (2 * (tab->used + 1) > tab->size) {      /* Keep load <= 1/2 */
+        old = tab->slots;
+        oldSize = tab->size;
+        tableInit(tab, 2 * oldSize);
+        for (j = 0; j < oldSize; j++) {
+            if (old[j].comm[0] != '\0') {
+                e = tableLookup(tab, old[j].uid, old[j].comm);
+                *e = old[j];
+            }
+        }
+        free(old);
+    }
+
+    for (j = hashKey(uid, comm) & (tab->size - 1); ;
+            j = (j + 1) & (tab->size - 1)) {
+        e = &tab->slots[j];
+        if (e->comm[0] == '\0') {
+            e->uid = uid;
+            strcpy(e->comm, comm);
+            tab->used++;
+            return e;
+        }
+        if (e->uid == uid && strcmp(e->comm, comm) == 0)
+            return e;
+    }
+}
+
+static void
+tableInit(struct table *tab, size_t size)
+{
+    tab->slots = calloc(size, sizeof(struct statEntry));
+    if (tab->slots == NULL)
+        errExit("calloc");
+    tab->size = size;
+    tab->used = 0;
+}
+
+/* Return the command name in 'ts' as a string in 'comm' */
+
+static char *
+commName(const struct taskstats *ts, char comm[TS_COMM_LEN + 1])
+{
+    memcpy(comm, ts->ac_comm, TS_COMM_LEN);
+    comm[TS_COMM_LEN] = '\0';
+    if (comm[0] == '\0')
+        strcpy(comm, "?");
+    return comm;
+}
+
+/* Return the name for 'uid', or the UID as a string if it has none */
+
+static const char *
+userName(uid_t uid)
+{
+    static char buf[32];
+    char *name;
+
+    name = userNameFromIdCached(uid);
+    if (name == NULL) {
+        snprintf(buf, sizeof(buf), "%ld", (long) uid);
+        name = buf;
+    }
+    return name;
+}
+
+/* Print a line for a process, in the format of acct_view.c. 'ts' is the
+   main thread's record, 'exitcode' is the process's termination status,
+   and 'cpuUs' and 'etime' are for the whole process. */
+
+static void
+printAcct(const struct taskstats *ts, uint32_t exitcode,
+          unsigned long long cpuUs, unsigned long long etime)
+{
+    char comm[TS_COMM_LEN + 1], timeBuf[TIME_BUF_SIZE];
+    struct tm *loc;
+    time_t t;
+
+    printf("%-8.8s  ", commName(ts, comm));
+
+    printf("%c", (ts->ac_flag & AFORK) ? 'F' : '-') ;
+    printf("%c", (ts->ac_flag & ASU)   ? 'S' : '-') ;
+    printf("%c", (ts->ac_flag & AXSIG) ? 'X' : '-') ;
+    printf("%c", (ts->ac_flag & ACORE) ? 'C' : '-') ;
+
+    printf(" %#6lx   ", (unsigned long) exitcode);
+
+    printf("%-8.8s ", userName(ts->ac_uid));
+
+    t = (ts->ac_btime64 != 0) ? (time_t) ts->ac_btime64 : ts->ac_btime;
+    loc = localtime(&t);
+    if (loc == NULL) {
+        printf("???Unknown time???  ");
+    } else {
+        strftime(timeBuf, TIME_BUF_SIZE, "%Y-%m-%d %T ", loc);
+        printf("%s ", timeBuf);
+    }
+
+    printf("%5.2f %7.2f ", cpuUs / 1e6, etime / 1e6);
+    printf("\n");
+}
+
+/* Record that a process has exited; 'p' is NULL for a single-threaded
+   process, and 'ts' is the record of its last thread */
+
+static void
+procExited(const struct pendingProc *p, const struct taskstats *ts)
+{
+    const struct taskstats *leader;
+    char comm[TS_COMM_LEN + 1];
+    unsigned long long cpuUs, etime;
+
+    leader = (p != NULL && p->haveLeader) ? &p->leader : ts;
+    cpuUs = ts->ac_utime + ts->ac_stime;
+    etime = ts->ac_etime;
+    if (p != NULL) {
+        cpuUs += p->cpuUs;
+        if (p->maxEtime > etime)
+            etime = p->maxEtime;
+    }
+
+    procsExited++;
+    tableLookup(&tab, leader->ac_uid, commName(leader, comm))->procs++;
+
+    if (acctFormat)
+        printAcct(leader, ts->ac_exitcode, cpuUs, etime);
+}
+
+/* Return the pending entry for 'tgid', or NULL if there is none */
+
+static struct pendingProc *
+findPending(uint32_t tgid)
+{
+    size_t j;
+
+    for (j = 0; j < numPending; j++)
+        if (pending[j].tgid == tgid)
+            return &pending[j];
+    return NULL;
+}
+
+static struct pendingProc *
+addPending(uint32_t tgid)
+{
+    if (numPending == maxPending) {
+        maxPending = (maxPending == 0) ? 16 : 2 * maxPending;
+        pending = realloc(pending, maxPending * sizeof(struct pendingProc));
+        if (pending == NULL)
+            errExit("realloc");
+    }
+    memset(&pending[numPending], 0, sizeof(struct pendingProc));
+    pending[numPending].tgid = tgid;
+    return &pending[numPending++];
+}
+
+static void
+removePending(struct pendingProc *p)
+{
+    *p = pending[--numPending];
+}
+
+/* Discard the pending entries of processes that no longer exist (whose
+   final record was lost) */
+
+static void
+prunePending(void)
+{
+    size_t j;
+
+    for (j = 0; j < numPending; )
+        if (kill(pending[j].tgid, 0) == -1 && errno == ESRCH)
+            removePending(&pending[j]);
+        else
+            j++;
+}
+
+/* Called for each thread's exit record */
+
+static void
+recordExit(void *arg, const struct taskstats *ts, int groupExit)
+{
+    struct pendingProc *p;
+    struct statEntry *e;
+    char comm[TS_COMM_LEN + 1];
+    uint32_t tgid;
+
+    threadsExited++;
+    e = tableLookup(&tab, ts->ac_uid, commName(ts, comm));
+    e->threads++;
+    e->cpuUs += ts->ac_utime + ts->ac_stime;
+    e->cpuDelayNs += ts->cpu_delay_total;
+    e->blkioDelayNs += ts->blkio_delay_total;
+    e->readBytes += ts->read_bytes;
+    e->writeBytes += ts->write_bytes;
+    if (ts->hiwater_rss > e->maxRssKB)
+        e->maxRssKB = ts->hiwater_rss;
+
+    tgid = (ts->ac_tgid != 0) ? ts->ac_tgid : ts->ac_pid;
+    p = findPending(tgid);
+
+    if (groupExit || (p == NULL && ts->ac_pid == tgid)) {
+        procExited(p, ts);
+        if (p != NULL)
+            removePending(p);
+        return;
+    }
+
+    /* A thread of a multithreaded process that is still running */
+
+    if (p == NULL)
+        p = addPending(tgid);
+    p->threads++;
+    p->cpuUs += ts->ac_utime + ts->ac_stime;
+    if (ts->ac_etime > p->maxEtime)
+        p->maxEtime = ts->ac_etime;
+    if (ts->ac_pid == tgid) {
+        p->leader = *ts;
+        p->haveLeader = TRUE;
+    }
+}
+
+static int
+cmpCpu(const void *a, const void *b)
+{
+    const struct statEntry *x = a, *y = b;
+
+    return (x->cpuUs < y->cpuUs) - (x->cpuUs > y->cpuUs);
+}
+
+/* Print a summary of the interval that has just ended, and start a new
+   one */
+
+static void
+printSummary(struct tsListener *l, struct tslStats *prev, long numShow)
+{
+    char timeBuf[TIME_BUF_SIZE];
+    struct statEntry *arr, *e;
+    struct tslStats st;
+    time_t t;
+    size_t j, n;
+
+    tslGetStats(l, &st);
+    t = time(NULL);
+    strftime(timeBuf, TIME_BUF_SIZE, "%T", localtime(&t));
+    printf("%s: %ld processes, %ld threads; %ld records in %ld batches, "
+           "%ld overruns\n", timeBuf, procsExited, threadsExited,
+           st.records - prev->records, st.batches - prev->batches,
+           st.overruns - prev->overruns);
+    *prev = st;
+
+    arr = malloc((tab.used + 1) * sizeof(struct statEntry));
+    if (arr == NULL)
+        errExit("malloc");
+    n = 0;
+    for (j = 0; j < tab.size; j++)
+        if (tab.slots[j].comm[0] != '\0')
+            arr[n++] = tab.slots[j];
+    qsort(arr, n, sizeof(struct statEntry), cmpCpu);
+
+    if (n > 0)
+        printf("%-10s %-16s %6s %6s %9s %9s %9s %10s %10s %9s\n",
+               "user", "command", "procs", "thr", "cpu(s)", "cpu-dly",
+               "io-dly", "read(KB)", "write(KB)", "rss(KB)");
+    for (j = 0; j < n && (numShow == 0 || j < numShow); j++) {
+        e = &arr[j];
+        printf("%-10.10s %-16.16s %6ld %6ld %9.2f %9.3f %9.3f "
+               "%10llu %10llu %9llu\n", userName(e->uid), e->comm,
+               e->procs, e->threads, e->cpuUs / 1e6,
+               e->cpuDelayNs / 1e9, e->blkioDelayNs / 1e9,
+               e->readBytes / 1024, e->writeBytes / 1024, e->maxRssKB);
+    }
+    printf("\n");
+    fflush(stdout);
+    free(arr);
+
+    memset(tab.slots, 0, tab.size * sizeof(struct statEntry));
+    tab.used = 0;
+    procsExited = threadsExited = 0;
+}
+
+static void
+handler(int sig)
+{
+    stop = 1;
+}
+
+static long long
+nowMs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-a] [-b rcvbuf] [-c cpus] [-d secs] "
+                    "[-i secs] [-n num]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct tsListener *l;
+    struct tslStats prev;
+    struct sigaction sa;
+    struct pollfd pfd;
+    long long endMs, nextMs, now;
+    long numShow;
+    char *cpus;
+    int opt, rcvBufSize, duration, interval, timeout;
+
+    rcvBufSize = 0;
+    cpus = NULL;
+    duration = 0;
+    interval = 5;
+    numShow = 10;
+    while ((opt = getopt(argc, argv, "ab:c:d:i:n:")) != -1) {
+        switch (opt) {
+        case 'a':   acctFormat = TRUE;                              break;
+        case 'b':   rcvBufSize = getInt(optarg, GN_GT_0, "-b");     break;
+        case 'c':   cpus = optarg;                                  break;
+        case 'd':   duration = getInt(optarg, GN_GT_0, "-d");       break;
+        case 'i':   interval = getInt(optarg, GN_GT_0, "-i");       break;
+        case 'n':   numShow = getLong(optarg, GN_NONNEG, "-n");     break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sa.sa_handler = handler;
+    if (sigaction(SIGINT, &sa, NULL) == -1 ||
+            sigaction(SIGTERM, &sa, NULL) == -1)
+        errExit("sigaction");
+
+    tableInit(&tab, 256);
+
+    l = tslOpen(cpus, rcvBufSize);
+    if (l == NULL)
+        errExit("tslOpen");
+    memset(&prev, 0, sizeof(prev));
+
+    if (acctFormat) {
+        printf("command  flags   term.  user     "
+                "start time            CPU   elapsed\n");
+        printf("                status           "
+                "                      time    time\n");
+    }
+
+    now = nowMs();
+    endMs = (duration > 0) ? now + duration * 1000LL : 0;
+    nextMs = now + interval * 1000LL;
+
+    pfd.fd = tslFd(l);
+    pfd.events = POLLIN;
+    while (!stop) {
+        now = nowMs();
+        if (endMs != 0 && now >= endMs)
+            break;
+        if (now >= nextMs) {
+            if (!acctFormat)
+                printSummary(l, &prev, numShow);
+            prunePending();
+            nextMs += interval * 1000LL;
+            continue;
+        }
+
+        timeout = nextMs - now;
+        if (endMs != 0 && endMs - now < timeout)
+            timeout = endMs - now;
+        if (poll(&pfd, 1, timeout) == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("poll");
+        }
+
+        if (tslProcess(l, recordExit, NULL) == -1)
+            errExit("tslProcess");
+        if (acctFormat)
+            fflush(stdout);
+    }
+
+    if (tslProcess(l, recordExit, NULL) == -1)
+        errExit("tslProcess");
+    if (!acctFormat)
+        printSummary(l, &prev, numShow);
+
+    tslClose(l);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,522 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 35 */
+
+/* cpu_topology.c
+
+   Discover the CPU topology of the system from sysfs, choose CPUs on
+   which to place worker threads, and bind threads and memory to CPUs
+   and NUMA nodes.
+
+   topoRead() examines each online CPU (/sys/devices/system/cpu/online)
+   under /sys/devices/system/cpu/cpuN:
+
+        topology/physical_package_id    the CPU's package (socket)
+        topology/thread_siblings_list   the hardware (SMT) threads that
+                                        share the CPU's physical core
+        cache/indexK/{level,shared_cpu_list}
+                                        the CPUs that share the L3 cache
+                                        (if there is no L3 cache, each
+                                        package is treated as a domain)
+        nodeM                           a link that gives the CPU's node
+
+   Cores and L3 domains are identified by the lowest-numbered CPU in the
+   sibling list, and then renumbered densely from 0.
+
+   topoPlace() returns a list of CPUs for a given number of workers,
+   according to a policy (see cpu_topology.h). With TOPO_PER_CORE, the
+   first hardware thread of each core is used, and successive workers are
+   spread round-robin across nodes, and across the L3 domains of each
+   node, so that a small number of workers gets as much cache and memory
+   bandwidth as possible. With TOPO_COMPACT, the workers fill all of the
+   hardware threads of a core, and then the cores of the same L3 domain
+   and node, so that they share caches. (Note that CPU numbering does not
+   do this: SMT siblings are often numbered N apart.)
+
+   The memory policy functions use the system calls directly, rather than
+   libnuma: topoBindMemory() sets the calling thread's policy (which
+   applies to pages that it subsequently touches for the first time),
+   topoMbind() binds (and, if necessary, migrates) a range of memory, and
+   topoPageNode() returns the node that holds a page, which can be used
+   to verify where memory was actually placed.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "cpu_topology.h"
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+#define MAX_NODES 1024
+#define LONG_BITS (8 * sizeof(unsigned long))
+
+/* Read the sysfs file 'path' into 'buf' as a string. Returns the string
+   length, or -1 on error. */
+
+static ssize_t
+readSysfs(const char *path, char *buf, size_t size)
+{
+    ssize_t n;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    n = read(fd, buf, size - 1);
+    close(fd);
+    if (n == -1)
+        return -1;
+    buf[n] = '\0';
+    return n;
+}
+
+/* Return the integer in the file SYSFS_CPU/cpuN/'file', or 'def' if the
+   file can't be read */
+
+static int
+readCpuInt(int cpu, const char *file, int def)
+{
+    char path[PATH_MAX], buf[64];
+
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/%s", cpu, file);
+    return (readSysfs(path, buf, sizeof(buf)) > 0) ? atoi(buf) : def;
+}
+
+/* Parse a CPU list such as "0-3,8,10-11" into 'list' (of size 'max').
+   Returns the number of CPUs in the list. */
+
+static int
+parseCpuList(const char *s, int *list, int max)
+{
+    char *end;
+    long lo, hi;
+    int n;
+
+    n = 0;
+    while (*s != '\0' && *s != '\n') {
+        lo = strtol(s, &end, 10);
+        if (end == s)
+            break;
+        hi = lo;
+        if (*end == '-')
+            hi = strtol(end + 1, &end, 10);
+        for (; lo <= hi && n < max; lo++)
+            list[n++] = lo;
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return n;
+}
+
+/* Read the CPU list in SYSFS_CPU/cpuN/'file' into 'list'. Returns the
+   number of CPUs, or 0 if the file can't be read. */
+
+static int
+readCpuList(int cpu, const char *file, int *list, int max)
+{
+    char path[PATH_MAX], buf[4096];
+
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/%s", cpu, file);
+    if (readSysfs(path, buf, sizeof(buf)) <= 0)
+        return 0;
+    return parseCpuList(buf, list, max);
+}
+
+/* Return the node of 'cpu', from the "nodeM" link in its directory */
+
+static int
+cpuNode(int cpu)
+{
+    char path[PATH_MAX];
+    struct dirent *d;
+    DIR *dirp;
+    int node;
+
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d", cpu);
+    dirp = opendir(path);
+    if (dirp == NULL)
+        return 0;
+
+    node = 0;
+    while ((d = readdir(dirp)) != NULL)
+        if (strncmp(d->d_name, "node", 4) == 0 &&
+                d->d_name[4] >= '0' && d->d_name[4] <= '9') {
+            node = atoi(d->d_name + 4);
+            break;
+        }
+    closedir(dirp);
+    return node;
+}
+
+/* Return the lowest-numbered CPU that shares the L3 cache of 'cpu', or
+   -1 if there is no L3 cache */
+
+static int
+l3Key(int cpu, int *list, int max)
+{
+    char file[64];
+    int idx;
+
+    for (idx = 0; ; idx++) {
+        snprintf(file, sizeof(file), "cache/index%d/level", idx);
+        switch (readCpuInt(cpu, file, -1)) {
+        case -1:
+            return -1;
+        case 3:
+            snprintf(file, sizeof(file), "cache/index%d/shared_cpu_list", idx);
+            return (readCpuList(cpu, file, list, max) > 0) ? list[0] : -1;
+        }
+    }
+}
+
+/* Replace the (sparse) values 'key[0..n-1]' with dense indexes, assigned
+   in order of first appearance. Returns the number of distinct values. */
+
+static int
+densify(int *key, int n)
+{
+    int *map, nmap, j, k;
+
+    map = malloc(n * sizeof(int));
+    if (map == NULL)
+        return -1;
+
+    nmap = 0;
+    for (j = 0; j < n; j++) {
+        for (k = 0; k < nmap; k++)
+            if (map[k] == key[j])
+                break;
+        if (k == nmap)
+            map[nmap++] = key[j];
+        key[j] = k;
+    }
+
+    free(map);
+    return nmap;
+}
+
+/* Fill in 't' with the topology of the online CPUs. Returns 0 on
+   success, or -1 on error. */
+
+int
+topoRead(struct cpuTopology *t)
+{
+    char buf[4096];
+    int *online, *list, *coreKey, *l3, *nodeSeen;
+    int j, k, n;
+    struct topoCpu *c;
+
+    memset(t, 0, sizeof(*t));
+    l3 = nodeSeen = NULL;
+    online = malloc(3 * CPU_SETSIZE * sizeof(int));
+    if (online == NULL)
+        return -1;
+    list = online + CPU_SETSIZE;
+    coreKey = list + CPU_SETSIZE;
+
+    if (readSysfs(SYSFS_CPU "/online", buf, sizeof(buf)) <= 0)
+        goto fail;
+    t->ncpus = parseCpuList(buf, online, CPU_SETSIZE);
+
+    t->cpus = calloc(t->ncpus, sizeof(struct topoCpu));
+    l3 = malloc(t->ncpus * sizeof(int));
+    nodeSeen = calloc(MAX_NODES, sizeof(int));
+    if (t->cpus == NULL || l3 == NULL || nodeSeen == NULL)
+        goto fail;
+
+    for (j = 0; j < t->ncpus; j++) {
+        c = &t->cpus[j];
+        c->cpu = online[j];
+        c->package = readCpuInt(c->cpu, "topology/physical_package_id", 0);
+        c->node = cpuNode(c->cpu);
+
+        n = readCpuList(c->cpu, "topology/thread_siblings_list", list,
+                        CPU_SETSIZE);
+        coreKey[j] = (n > 0) ? list[0] : c->cpu;
+        for (k = 0; k < n && list[k] != c->cpu; k++)
+            continue;
+        c->smt = (k < n) ? k : 0;
+
+        l3[j] = l3Key(c->cpu, list, CPU_SETSIZE);
+        if (l3[j] == -1)                /* No L3: use the package */
+            l3[j] = CPU_SETSIZE + c->package;
+
+        if (c->node >= 0 && c->node < MAX_NODES && !nodeSeen[c->node]) {
+            nodeSeen[c->node] = 1;
+            t->nnodes++;
+            if (c->node > t->maxNode)
+                t->maxNode = c->node;
+        }
+    }
+
+    t->ncores = densify(coreKey, t->ncpus);
+    t->nl3 = densify(l3, t->ncpus);
+    if (t->ncores == -1 || t->nl3 == -1)
+        goto fail;
+    for (j = 0; j < t->ncpus; j++) {
+        t->cpus[j].core = coreKey[j];
+        t->cpus[j].l3 = l3[j];
+    }
+
+    free(l3);
+    free(nodeSeen);
+    free(online);
+    return 0;
+
+fail:
+    free(l3);
+    free(nodeSeen);
+    free(online);
+    topoFree(t);
+    return -1;
+}
+
+void
+topoFree(struct cpuTopology *t)
+{
+    free(t->cpus);
+    t->cpus = NULL;
+    t->ncpus = 0;
+}
+
+/* Return the entry for CPU number 'cpu', or NULL if it is not online */
+
+const struct topoCpu *
+topoFindCpu(const struct cpuTopology *t, int cpu)
+{
+    int j;
+
+    for (j = 0; j < t->ncpus; j++)
+        if (t->cpus[j].cpu == cpu)
+            return &t->cpus[j];
+    return NULL;
+}
+
+struct candidate {              /* A CPU, and its key for sorting */
+    int key[4];
+    int cpu;
+};
+
+static int
+compareCandidates(const void *a, const void *b)
+{
+    const struct candidate *ca = a, *cb = b;
+    int j;
+
+    for (j = 0; j < 4; j++)
+        if (ca->key[j] != cb->key[j])
+            return (ca->key[j] < cb->key[j]) ? -1 : 1;
+    return (ca->cpu < cb->cpu) ? -1 : (ca->cpu > cb->cpu);
+}
+
+/* Choose CPUs for 'nworkers' workers according to 'policy', placing the
+   CPU number for worker 'j' in 'cpus[j]'. Returns the number of distinct
+   placement units (cores, L3 domains, nodes, or CPUs); if 'nworkers' is
+   larger, the placement wraps around, so that some CPUs are assigned to
+   more than one worker. Returns -1 on error. */
+
+int
+topoPlace(const struct cpuTopology *t, int policy, int nworkers, int *cpus)
+{
+    struct candidate *cand, *p;
+    int *coreRank, *l3Rank, *coreCount, *l3Count;
+    const struct topoCpu *c, *d;
+    int ncand, j, k;
+
+    if (t->ncpus == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    cand = calloc(t->ncpus, sizeof(struct candidate));
+    coreRank = calloc(3 * t->ncpus + t->maxNode + 1, sizeof(int));
+    if (cand == NULL || coreRank == NULL) {
+        free(cand);
+        free(coreRank);
+        return -1;
+    }
+    l3Rank = coreRank + t->ncpus;       /* Indexed by L3 domain */
+    coreCount = l3Rank + t->ncpus;      /* Cores seen so far, per L3 */
+    l3Count = coreCount + t->ncpus;     /* L3 domains seen so far, per node */
+
+    /* Rank each core within its L3 domain, and each L3 domain within its
+       node, in CPU-number order. 'coreRank' is indexed by CPU position. */
+
+    for (j = 0; j < t->ncpus; j++) {
+        c = &t->cpus[j];
+        for (k = 0; k < j; k++)
+            if (t->cpus[k].core == c->core)
+                break;
+        coreRank[j] = (k < j) ? coreRank[k] : coreCount[c->l3]++;
+
+        for (k = 0; k < j; k++)
+            if (t->cpus[k].l3 == c->l3)
+                break;
+        if (k == j)
+            l3Rank[c->l3] = l3Count[c->node]++;
+    }
+
+    ncand = 0;
+    for (j = 0; j < t->ncpus; j++) {
+        c = &t->cpus[j];
+        p = &cand[ncand];
+
+        switch (policy) {
+        case TOPO_PER_CORE:
+            if (c->smt != 0)
+                continue;
+            p->key[0] = coreRank[j];
+            p->key[1] = l3Rank[c->l3];
+            p->key[2] = c->node;
+            break;
+
+        case TOPO_PER_L3:
+        case TOPO_PER_NODE:
+
+            /* The first CPU (in CPU-number order) of each domain */
+
+            for (k = 0; k < j; k++) {
+                d = &t->cpus[k];
+                if ((policy == TOPO_PER_L3) ? d->l3 == c->l3 :
+                                              d->node == c->node)
+                    break;
+            }
+            if (k < j)
+                continue;
+            p->key[0] = (policy == TOPO_PER_L3) ? l3Rank[c->l3] : 0;
+            p->key[1] = c->node;
+            break;
+
+        case TOPO_COMPACT:
+            p->key[0] = c->node;
+            p->key[1] = c->l3;
+            p->key[2] = c->core;
+            p->key[3] = c->smt;
+            break;
+
+        default:
+            free(cand);
+            free(coreRank);
+            errno = EINVAL;
+            return -1;
+        }
+        p->cpu = c->cpu;
+        ncand++;
+    }
+
+    qsort(cand, ncand, sizeof(struct candidate), compareCandidates);
+    for (j = 0; j < nworkers; j++)
+        cpus[j] = cand[j % ncand].cpu;
+
+    free(cand);
+    free(coreRank);
+    return ncand;
+}
+
+/* Place the numbers of the nodes that have memory (which may include
+   nodes without CPUs) in 'nodes' (of size 'max'). Returns the number of
+   nodes, or -1 on error. */
+
+int
+topoMemNodes(int *nodes, int max)
+{
+    char buf[4096];
+
+    if (readSysfs("/sys/devices/system/node/has_memory", buf,
+                  sizeof(buf)) <= 0 &&
+            readSysfs("/sys/devices/system/node/online", buf,
+                      sizeof(buf)) <= 0)
+        return -1;
+    return parseCpuList(buf, nodes, max);       /* Same format */
+}
+
+/* Restrict the calling thread to 'cpu'. Returns 0 on success, or -1 on
+   error. */
+
+int
+topoBindCpu(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+static void
+nodeMask(unsigned long *mask, int node)
+{
+    memset(mask, 0, MAX_NODES / 8);
+    mask[node / LONG_BITS] = 1UL << (node % LONG_BITS);
+}
+
+/* Set the memory policy of the calling thread so that pages it allocates
+   come from 'node': only from 'node' if 'strict' is TRUE (MPOL_BIND), or
+   preferably from 'node' otherwise (MPOL_PREFERRED). If 'node' is -1,
+   restore the default policy (allocate on the node of the CPU that first
+   touches the page). Returns 0 on success, or -1 on error. */
+
+int
+topoBindMemory(int node, Boolean strict)
+{
+    unsigned long mask[MAX_NODES / LONG_BITS];
+
+    if (node == -1)
+        return syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+
+    if (node < 0 || node >= MAX_NODES) {
+        errno = EINVAL;
+        return -1;
+    }
+    nodeMask(mask, node);
+
+    /* The kernel uses one bit less than 'maxnode' */
+
+    return syscall(SYS_set_mempolicy, strict ? MPOL_BIND : MPOL_PREFERRED,
+                   mask, MAX_NODES + 1);
+}
+
+/* Bind the memory in the range 'addr' (page-aligned) to 'addr + len' to
+   'node', migrating any pages that are already elsewhere. Returns 0 on
+   success, or -1 on error. */
+
+int
+topoMbind(void *addr, size_t len, int node)
+{
+    unsigned long mask[MAX_NODES / LONG_BITS];
+
+    if (node < 0 || node >= MAX_NODES) {
+        errno = EINVAL;
+        return -1;
+    }
+    nodeMask(mask, node);
+    return syscall(SYS_mbind, addr, len, MPOL_BIND, mask, MAX_NODES + 1,
+                   MPOL_MF_MOVE | MPOL_MF_STRICT);
+}
+
+/* Return the node that holds the page containing 'addr' (faulting the
+   page in, if necessary), or -1 on error */
+
+int
+topoPageNode(void *addr)
+{
+    int node;
+
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr,
+                MPOL_F_NODE | MPOL_F_ADDR) == -1)
+        return -1;
+    return node;
+}
@@ -0,0 +1,68 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 35 */
+
+/* cpu_topology.h
+
+   Header file for cpu_topology.c.
+*/
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H          /* Prevent accidental double inclusion */
+
+#include <stddef.h>
+#include "tlpi_hdr.h"
+
+struct topoCpu {                /* One online CPU */
+    int cpu;                    /* CPU number */
+    int package;                /* physical_package_id */
+    int core;                   /* Physical core (dense index, 0..) */
+    int l3;                     /* Last-level cache domain (dense index) */
+    int node;                   /* NUMA node number */
+    int smt;                    /* Index among the core's hardware threads */
+};
+
+struct cpuTopology {
+    int ncpus;                  /* Number of online CPUs */
+    struct topoCpu *cpus;       /* Sorted by CPU number */
+    int ncores;                 /* Number of physical cores */
+    int nl3;                    /* Number of L3 domains */
+    int nnodes;                 /* Number of NUMA nodes with CPUs */
+    int maxNode;                /* Highest node number */
+};
+
+enum {                          /* Placement policies for topoPlace() */
+    TOPO_PER_CORE,              /* One worker per physical core */
+    TOPO_PER_L3,                /* One worker per L3 domain */
+    TOPO_PER_NODE,              /* One worker per NUMA node */
+    TOPO_COMPACT                /* Fill all hardware threads of a core,
+                                   then the next core of the same L3... */
+};
+
+int topoRead(struct cpuTopology *t);
+
+void topoFree(struct cpuTopology *t);
+
+const struct topoCpu *topoFindCpu(const struct cpuTopology *t, int cpu);
+
+int topoPlace(const struct cpuTopology *t, int policy, int nworkers,
+              int *cpus);
+
+int topoMemNodes(int *nodes, int max);
+
+int topoBindCpu(int cpu);
+
+int topoBindMemory(int node, Boolean strict);
+
+int topoMbind(void *addr, size_t len, int node);
+
+int topoPageNode(void *addr);
+
+#endif
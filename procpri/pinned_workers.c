@@ -0,0 +1,478 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 35 */
+
+/* pinned_workers.c
+
+   Launch worker threads pinned according to the CPU topology, with their
+   memory bound to the NUMA node of their CPU, and verify the placement.
+   Optionally, measure what placement is worth on this system.
+
+   Usage: pinned_workers [-p core|l3|node|compact] [-n nworkers]
+                         [-m strict|preferred|default] [-s MiB] [-B]
+
+        -p policy   Placement policy (default: core): one worker per
+                    physical core, per L3 domain, or per NUMA node, or
+                    'compact' (fill SMT siblings and caches first); see
+                    cpu_topology.c
+        -n nworkers Number of workers (default: the number of placement
+                    units, e.g., the number of physical cores)
+        -m mode     Memory policy for each worker: MPOL_BIND to the node
+                    of its CPU (default), MPOL_PREFERRED, or the default
+                    (first-touch) policy
+        -s MiB      Size of each worker's buffer (default: 16)
+        -B          Instead of launching workers, run the benchmarks below
+
+   Where t_sched_setaffinity.c sets an arbitrary CPU mask given on the
+   command line, this program derives the CPUs from the topology (see
+   cpu_topology.c). Each worker pins itself with sched_setaffinity(), sets
+   its memory policy with set_mempolicy(), allocates and touches (so
+   allocates, under that policy) its buffer, and then verifies that it is
+   running on its CPU (sched_getcpu()) and that a sample of the pages of
+   its buffer are on its node (get_mempolicy(MPOL_F_NODE | MPOL_F_ADDR)).
+   Each worker then measures its read bandwidth.
+
+   With -B, the program measures:
+
+   * the memory latency (a dependent pointer chase through a random
+     cyclic permutation of the cache lines of the buffer) and sequential
+     read bandwidth from the first CPU of each node to memory bound
+     (with mbind()) to each node that has memory, so that remote access
+     can be compared with local access;
+
+   * the round-trip time for two threads bouncing a cache line between
+     two CPUs that are SMT siblings, that share an L3 cache, that are on
+     the same node but in different L3 domains, and that are on different
+     nodes. Pairs that don't exist on this system are reported as such.
+
+   For example, on a two-socket system:
+
+        $ ./pinned_workers -p l3 -m strict
+        $ ./pinned_workers -B -s 256
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "cpu_topology.h"
+#include "tlpi_hdr.h"
+
+#define LINE 64                 /* Assumed cache-line size */
+
+enum { MEM_STRICT, MEM_PREFERRED, MEM_DEFAULT };
+
+static struct cpuTopology topo;
+static size_t bufSize;
+static int memMode;
+
+struct worker {
+    pthread_t tid;
+    int cpu;                    /* Assigned CPU */
+    int node;                   /* Node of assigned CPU */
+    int ranOn;                  /* CPU reported by sched_getcpu() */
+    long pagesChecked;
+    long pagesLocal;            /* ... that were on 'node' */
+    double gbps;                /* Read bandwidth */
+};
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *
+allocBuf(size_t len)
+{
+    char *p;
+
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        errExit("mmap");
+    return p;
+}
+
+/* Return the sequential read bandwidth (GB/s) of 'buf' */
+
+static double
+readBandwidth(const char *buf, size_t len)
+{
+    const unsigned long *p, *end;
+    unsigned long sum;
+    double start, elapsed;
+    long passes;
+
+    end = (const unsigned long *) (buf + len);
+    sum = 0;
+    passes = 0;
+    start = nowSecs();
+    do {
+        for (p = (const unsigned long *) buf; p < end; p += 4)
+            sum += p[0] + p[1] + p[2] + p[3];
+        passes++;
+        elapsed = nowSecs() - start;
+    } while (elapsed < 0.2);
+
+    if (sum == 1)                       /* Keep 'sum' alive */
+        printf("\n");
+    return (double) len * passes / elapsed / 1e9;
+}
+
+/* Link the cache lines of 'buf' into a random cycle, and follow it.
+   Returns the average time (ns) per load. */
+
+static double
+chaseLatency(char *buf, size_t len)
+{
+    size_t nlines, j, k, tmp, *order;
+    unsigned int seed;
+    double start;
+    long steps, n;
+    char *p;
+
+    nlines = len / LINE;
+    order = malloc(nlines * sizeof(size_t));
+    if (order == NULL)
+        errExit("malloc");
+    for (j = 0; j < nlines; j++)
+        order[j] = j;
+    seed = 1;
+    for (j = nlines - 1; j > 0; j--) {          /* Fisher-Yates shuffle */
+        k = rand_r(&seed) % (j + 1);
+        tmp = order[j];
+        order[j] = order[k];
+        order[k] = tmp;
+    }
+    for (j = 0; j < nlines; j++)
+        *(char **) (buf + order[j] * LINE) =
+                buf + order[(j + 1) % nlines] * LINE;
+    free(order);
+
+    steps = (nlines < 1000000) ? 2000000 : 2 * nlines;
+    p = buf;
+    start = nowSecs();
+    for (n = 0; n < steps; n++)
+        p = *(char **) p;
+    return (nowSecs() - start) * 1e9 / steps + (p == NULL);
+}
+
+static void *
+workerFunc(void *arg)
+{
+    struct worker *w = arg;
+    long pageSize, npages, step, j;
+    char *buf;
+
+    if (topoBindCpu(w->cpu) == -1)
+        errExit("topoBindCpu");
+    if (memMode != MEM_DEFAULT &&
+            topoBindMemory(w->node, memMode == MEM_STRICT) == -1)
+        errExit("topoBindMemory");
+
+    buf = allocBuf(bufSize);
+    memset(buf, 1, bufSize);            /* First touch allocates the pages */
+
+    /* Verify the placement of the thread, and of (up to 64) pages */
+
+    w->ranOn = sched_getcpu();
+    pageSize = sysconf(_SC_PAGESIZE);
+    npages = bufSize / pageSize;
+    step = (npages > 64) ? npages / 64 : 1;
+    for (j = 0; j < npages; j += step) {
+        w->pagesChecked++;
+        if (topoPageNode(buf + j * pageSize) == w->node)
+            w->pagesLocal++;
+    }
+
+    w->gbps = readBandwidth(buf, bufSize);
+
+    munmap(buf, bufSize);
+    return NULL;
+}
+
+static void
+printTopology(void)
+{
+    int j;
+
+    printf("%d CPUs, %d physical cores, %d L3 domains, %d NUMA nodes\n",
+           topo.ncpus, topo.ncores, topo.nl3, topo.nnodes);
+    printf("%5s %8s %5s %5s %5s %4s\n",
+           "CPU", "package", "core", "L3", "node", "SMT");
+    for (j = 0; j < topo.ncpus; j++)
+        printf("%5d %8d %5d %5d %5d %4d\n", topo.cpus[j].cpu,
+               topo.cpus[j].package, topo.cpus[j].core, topo.cpus[j].l3,
+               topo.cpus[j].node, topo.cpus[j].smt);
+    printf("\n");
+}
+
+/* Latency and bandwidth from the first CPU of each node to memory on
+   each node */
+
+static void
+memoryMatrix(void)
+{
+    int nodeCpus[CPU_SETSIZE], memNodes[1024];
+    int ncpuNodes, nmem, j, k, cpu;
+    const struct topoCpu *c;
+    double lat, bw, localLat, localBw;
+    char *buf;
+
+    ncpuNodes = topoPlace(&topo, TOPO_PER_NODE, topo.nnodes, nodeCpus);
+    nmem = topoMemNodes(memNodes, 1024);
+    if (ncpuNodes == -1 || nmem == -1)
+        errExit("topoPlace/topoMemNodes");
+
+    printf("Memory latency and read bandwidth (%ld MiB buffer)\n",
+           (long) (bufSize >> 20));
+    printf("%8s %8s %10s %10s %8s %8s\n", "CPU-node", "mem-node",
+           "ns/load", "GB/s", "lat-x", "bw-x");
+
+    for (j = 0; j < ncpuNodes; j++) {
+        cpu = nodeCpus[j];
+        c = topoFindCpu(&topo, cpu);
+        if (topoBindCpu(cpu) == -1)
+            errExit("topoBindCpu");
+
+        localLat = localBw = 0;
+        for (k = 0; k < nmem; k++) {
+            buf = allocBuf(bufSize);
+            if (topoMbind(buf, bufSize, memNodes[k]) == -1)
+                errExit("topoMbind");
+            memset(buf, 1, bufSize);
+
+            lat = chaseLatency(buf, bufSize);
+            bw = readBandwidth(buf, bufSize);
+            munmap(buf, bufSize);
+
+            if (memNodes[k] == c->node) {
+                localLat = lat;
+                localBw = bw;
+            }
+            printf("%8d %8d %10.1f %10.2f", c->node, memNodes[k], lat, bw);
+            if (memNodes[k] == c->node)
+                printf(" %8s %8s\n", "(local)", "");
+            else if (localLat > 0)
+                printf(" %8.2f %8.2f\n", lat / localLat, bw / localBw);
+            else
+                printf("\n");
+        }
+    }
+
+    if (nmem < 2)
+        printf("(Only one node has memory: no remote access to compare)\n");
+    printf("\n");
+}
+
+static int pingFlag __attribute__((aligned(LINE)));
+static long pingRounds;
+
+static void *
+pongFunc(void *arg)
+{
+    long j;
+
+    if (topoBindCpu(*(int *) arg) == -1)
+        errExit("topoBindCpu");
+    for (j = 0; j < pingRounds; j++) {
+        while (__atomic_load_n(&pingFlag, __ATOMIC_ACQUIRE) != 1)
+            continue;
+        __atomic_store_n(&pingFlag, 0, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/* Return the round-trip time (ns) for a cache line bounced between
+   'cpuA' and 'cpuB' */
+
+static double
+pingPong(int cpuA, int cpuB)
+{
+    pthread_t tid;
+    double start, elapsed;
+    long j;
+    int s;
+
+    pingRounds = 200000;
+    pingFlag = 0;
+    if (topoBindCpu(cpuA) == -1)
+        errExit("topoBindCpu");
+    s = pthread_create(&tid, NULL, pongFunc, &cpuB);
+    if (s != 0)
+        errExitEN(s, "pthread_create");
+
+    start = nowSecs();
+    for (j = 0; j < pingRounds; j++) {
+        __atomic_store_n(&pingFlag, 1, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&pingFlag, __ATOMIC_ACQUIRE) != 0)
+            continue;
+    }
+    elapsed = nowSecs() - start;
+
+    s = pthread_join(tid, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_join");
+    return elapsed * 1e9 / pingRounds;
+}
+
+/* Cache-line round trips between pairs of CPUs of each relationship */
+
+static void
+cacheMatrix(void)
+{
+    static const char *names[] = {
+        "SMT siblings", "same L3", "same node, other L3", "other node"
+    };
+    const struct topoCpu *a, *b;
+    int pair[4][2], rel, j, k;
+
+    for (rel = 0; rel < 4; rel++)
+        pair[rel][0] = -1;
+
+    a = &topo.cpus[0];
+    for (k = 1; k < topo.ncpus; k++) {
+        b = &topo.cpus[k];
+        if (b->core == a->core)
+            rel = 0;
+        else if (b->l3 == a->l3)
+            rel = 1;
+        else if (b->node == a->node)
+            rel = 2;
+        else
+            rel = 3;
+        if (pair[rel][0] == -1) {
+            pair[rel][0] = a->cpu;
+            pair[rel][1] = b->cpu;
+        }
+    }
+
+    printf("Cache-line round trip between two CPUs\n");
+    for (j = 0; j < 4; j++) {
+        printf("%-22s", names[j]);
+        if (pair[j][0] == -1)
+            printf("(no such pair on this system)\n");
+        else
+            printf("CPUs %d and %d: %.1f ns\n", pair[j][0], pair[j][1],
+                   pingPong(pair[j][0], pair[j][1]));
+    }
+}
+
+static void
+usageError(char *pname)
+{
+    fprintf(stderr, "Usage: %s [-p core|l3|node|compact] [-n nworkers]\n"
+            "        [-m strict|preferred|default] [-s MiB] [-B]\n", pname);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char *policies[] = { "core", "l3", "node", "compact" };
+    static const char *modes[] = { "strict", "preferred", "default" };
+    struct worker *w;
+    int policy, nworkers, nunits, *cpus, opt, j, s;
+    Boolean bench, ok;
+    const struct topoCpu *c;
+
+    policy = TOPO_PER_CORE;
+    memMode = MEM_STRICT;
+    nworkers = 0;
+    bufSize = 16;
+    bench = FALSE;
+    while ((opt = getopt(argc, argv, "p:n:m:s:B")) != -1) {
+        switch (opt) {
+        case 'p':
+            for (policy = 0; policy < 4; policy++)
+                if (strcmp(optarg, policies[policy]) == 0)
+                    break;
+            if (policy == 4)
+                usageError(argv[0]);
+            break;
+        case 'm':
+            for (memMode = 0; memMode < 3; memMode++)
+                if (strcmp(optarg, modes[memMode]) == 0)
+                    break;
+            if (memMode == 3)
+                usageError(argv[0]);
+            break;
+        case 'n': nworkers = getInt(optarg, GN_GT_0, "-n");     break;
+        case 's': bufSize = getInt(optarg, GN_GT_0, "-s");      break;
+        case 'B': bench = TRUE;                                 break;
+        default:  usageError(argv[0]);
+        }
+    }
+    bufSize <<= 20;
+
+    if (topoRead(&topo) == -1)
+        errExit("topoRead");
+    printTopology();
+
+    if (bench) {
+        memoryMatrix();
+        cacheMatrix();
+        exit(EXIT_SUCCESS);
+    }
+
+    /* Place and launch the workers */
+
+    nunits = topoPlace(&topo, policy, 0, NULL);
+    if (nunits == -1)
+        errExit("topoPlace");
+    if (nworkers == 0)
+        nworkers = nunits;
+    cpus = calloc(nworkers, sizeof(int));
+    w = calloc(nworkers, sizeof(struct worker));
+    if (cpus == NULL || w == NULL)
+        errExit("calloc");
+    if (topoPlace(&topo, policy, nworkers, cpus) == -1)
+        errExit("topoPlace");
+    if (nworkers > nunits)
+        printf("Note: %d workers, but only %d placement units (%s): "
+               "some CPUs are shared\n\n", nworkers, nunits, policies[policy]);
+
+    for (j = 0; j < nworkers; j++) {
+        w[j].cpu = cpus[j];
+        w[j].node = topoFindCpu(&topo, cpus[j])->node;
+        s = pthread_create(&w[j].tid, NULL, workerFunc, &w[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    ok = TRUE;
+    printf("%6s %5s %5s %5s %5s %7s %12s %8s\n", "worker", "CPU", "core",
+           "L3", "node", "ran-on", "pages-local", "GB/s");
+    for (j = 0; j < nworkers; j++) {
+        s = pthread_join(w[j].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+
+        c = topoFindCpu(&topo, w[j].cpu);
+        printf("%6d %5d %5d %5d %5d %7d %5ld/%-6ld %8.2f", j, c->cpu,
+               c->core, c->l3, c->node, w[j].ranOn, w[j].pagesLocal,
+               w[j].pagesChecked, w[j].gbps);
+        if (w[j].ranOn != w[j].cpu || w[j].pagesLocal != w[j].pagesChecked) {
+            printf("  MISPLACED");
+            ok = FALSE;
+        }
+        printf("\n");
+    }
+
+    printf("\nPlacement %s\n", ok ? "verified" : "NOT as requested");
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,394 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 35 */
+
+/* rt_latency.c
+
+   Measure wakeup latency under each scheduling policy, in the manner of
+   cyclictest(8).
+
+   Usage: rt_latency [-p policy] [-P prio] [-i usecs] [-d secs] [-t nthreads]
+                     [-a cpu] [-r usecs] [-H max-usecs] [-U]
+
+        -p policy   'other', 'fifo', 'rr', 'deadline', or 'all' (the
+                    default), which measures each policy in turn
+        -P prio     Priority for SCHED_FIFO and SCHED_RR (default: 80)
+        -i usecs    Wakeup interval (default: 1000)
+        -d secs     Duration of the measurement for each policy
+                    (default: 5)
+        -t nthreads Number of measuring threads (default: 1)
+        -a cpu      Pin all measuring threads to 'cpu' (not permitted
+                    for SCHED_DEADLINE, whose threads must be allowed to
+                    run on all CPUs of their root domain)
+        -r usecs    Runtime budget per interval for SCHED_DEADLINE
+                    (default: 100); the deadline and period are the
+                    wakeup interval
+        -H max      Print the latency histogram (1-microsecond buckets)
+                    up to 'max' microseconds
+        -U          Don't lock memory
+
+   Each thread sets its scheduling policy (with sched_setscheduler(), or,
+   for SCHED_DEADLINE, with sched_setattr(), for which glibc provides no
+   wrapper), and then repeatedly sleeps until an absolute time on
+   CLOCK_MONOTONIC with clock_nanosleep(TIMER_ABSTIME), so that the
+   intervals don't drift, and records the difference between the time at
+   which it was due to wake and the time at which it actually ran. The
+   latencies are counted in a histogram of 1-microsecond buckets, from
+   which the percentiles are computed.
+
+   Unless -U is specified, the program first locks all of its current
+   and future memory with mlockall(MCL_CURRENT | MCL_FUTURE) (see
+   vmem/memlock.c); MCL_FUTURE also locks (and so populates) the thread
+   stacks and histograms that are allocated later. Each thread also
+   touches the deeper part of its stack before the measurement starts,
+   so that no page fault can add to a latency.
+
+   The program must be run as superuser, or with a suitable RLIMIT_RTPRIO
+   (and RLIMIT_MEMLOCK) resource limit. For example, to compare the
+   policies while a load runs on the same CPU:
+
+        # ./rt_latency -a 1 -d 10 -p fifo &
+        # taskset -c 1 sh -c 'while :; do :; done'
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "tlpi_hdr.h"
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+struct sched_attr {             /* See sched_setattr(2) */
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;     /* For SCHED_DEADLINE (nanoseconds) */
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+};
+
+#define STACK_PREFAULT (64 * 1024)
+
+static const struct {
+    const char *name;
+    int policy;
+} policies[] = {
+    { "other",    SCHED_OTHER },
+    { "fifo",     SCHED_FIFO },
+    { "rr",       SCHED_RR },
+    { "deadline", SCHED_DEADLINE },
+};
+
+#define NPOLICIES (sizeof(policies) / sizeof(policies[0]))
+
+static int prio = 80;
+static long intervalUsecs = 1000;
+static long runtimeUsecs = 100;
+static long loops;
+static int pinCpu = -1;
+static long histMax = 10000;    /* Histogram covers 0..histMax-1 usecs */
+
+struct thread {
+    pthread_t tid;
+    int policy;
+    long *hist;                 /* Latency counts, by microsecond */
+    long samples, overflows;
+    long minLat, maxLat;        /* Microseconds */
+    double sumLat;
+    const char *err;            /* Description of error, or NULL */
+};
+
+/* Set the scheduling policy of the calling thread. Returns 0 on success,
+   or -1 on error. */
+
+static int
+setPolicy(int policy)
+{
+    struct sched_param sp;
+    struct sched_attr attr;
+
+    if (policy == SCHED_DEADLINE) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.sched_policy = SCHED_DEADLINE;
+        attr.sched_runtime = runtimeUsecs * 1000;
+        attr.sched_deadline = attr.sched_period = intervalUsecs * 1000;
+        return syscall(SYS_sched_setattr, 0, &attr, 0);
+    }
+
+    sp.sched_priority = (policy == SCHED_OTHER) ? 0 : prio;
+    return sched_setscheduler(0, policy, &sp);
+}
+
+static void
+prefaultStack(void)
+{
+    volatile char stack[STACK_PREFAULT];
+
+    memset((char *) stack, 0, sizeof(stack));
+}
+
+static void
+tsAdd(struct timespec *ts, long usecs)
+{
+    ts->tv_nsec += usecs * 1000;
+    while (ts->tv_nsec >= 1000000000) {
+        ts->tv_nsec -= 1000000000;
+        ts->tv_sec++;
+    }
+}
+
+static void *
+threadFunc(void *arg)
+{
+    struct thread *t = arg;
+    struct timespec next, now;
+    cpu_set_t set;
+    long lat, j;
+    int s;
+
+    if (pinCpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(pinCpu, &set);
+        s = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (s != 0) {
+            t->err = "pthread_setaffinity_np";
+            return NULL;
+        }
+    }
+
+    prefaultStack();
+
+    if (setPolicy(t->policy) == -1) {
+        t->err = strerror(errno);
+        return NULL;
+    }
+
+    t->minLat = LONG_MAX;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (j = 0; j < loops; j++) {
+        tsAdd(&next, intervalUsecs);
+        s = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        if (s != 0) {
+            t->err = strerror(s);
+            return NULL;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        lat = ((now.tv_sec - next.tv_sec) * 1000000000L +
+               now.tv_nsec - next.tv_nsec) / 1000;
+        if (lat < histMax)
+            t->hist[lat]++;
+        else
+            t->overflows++;
+        if (lat < t->minLat)
+            t->minLat = lat;
+        if (lat > t->maxLat)
+            t->maxLat = lat;
+        t->sumLat += lat;
+        t->samples++;
+    }
+
+    return NULL;
+}
+
+/* Return the latency below which 'frac' of the samples lie, or -1 if
+   that lies beyond the histogram */
+
+static long
+percentile(const long *hist, long samples, double frac)
+{
+    long j, n;
+
+    n = 0;
+    for (j = 0; j < histMax; j++) {
+        n += hist[j];
+        if (n >= frac * samples)
+            return j;
+    }
+    return -1;
+}
+
+static void
+printPercentile(const long *hist, long samples, double frac)
+{
+    long p;
+
+    p = percentile(hist, samples, frac);
+    if (p >= 0)
+        printf(" %7ld", p);
+    else
+        printf(" %6ld+", histMax);
+}
+
+/* Measure with 'nthreads' threads under 'policy', and print a summary
+   line for each thread. Returns the merged histogram of all threads, or
+   NULL if there was an error. */
+
+static long *
+measure(int policy, const char *name, int nthreads)
+{
+    struct thread *threads;
+    long *merged, j;
+    int k, s;
+    Boolean ok;
+
+    threads = calloc(nthreads, sizeof(struct thread));
+    merged = calloc(histMax, sizeof(long));
+    if (threads == NULL || merged == NULL)
+        errExit("calloc");
+
+    for (k = 0; k < nthreads; k++) {
+        threads[k].policy = policy;
+        threads[k].hist = calloc(histMax, sizeof(long));
+        if (threads[k].hist == NULL)
+            errExit("calloc");
+        s = pthread_create(&threads[k].tid, NULL, threadFunc, &threads[k]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    ok = TRUE;
+    for (k = 0; k < nthreads; k++) {
+        s = pthread_join(threads[k].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+
+        printf("%-9s T%-3d ", name, k);
+        if (threads[k].err != NULL) {
+            printf("failed: %s\n", threads[k].err);
+            ok = FALSE;
+        } else {
+            printf("%8ld %7ld %7.1f", threads[k].samples, threads[k].minLat,
+                   threads[k].sumLat / threads[k].samples);
+            printPercentile(threads[k].hist, threads[k].samples, 0.50);
+            printPercentile(threads[k].hist, threads[k].samples, 0.99);
+            printPercentile(threads[k].hist, threads[k].samples, 0.9999);
+            printf(" %7ld %6ld\n", threads[k].maxLat, threads[k].overflows);
+
+            for (j = 0; j < histMax; j++)
+                merged[j] += threads[k].hist[j];
+        }
+        free(threads[k].hist);
+    }
+
+    free(threads);
+    if (!ok) {
+        free(merged);
+        return NULL;
+    }
+    return merged;
+}
+
+static void
+usageError(char *pname)
+{
+    fprintf(stderr, "Usage: %s [-p other|fifo|rr|deadline|all] [-P prio] "
+            "[-i usecs] [-d secs]\n"
+            "        [-t nthreads] [-a cpu] [-r usecs] [-H max-usecs] [-U]\n",
+            pname);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long *hist[NPOLICIES], printMax, j;
+    int opt, nthreads, secs, which, p;
+    Boolean lock;
+
+    which = -1;                         /* All policies */
+    secs = 5;
+    nthreads = 1;
+    printMax = 0;
+    lock = TRUE;
+    while ((opt = getopt(argc, argv, "p:P:i:d:t:a:r:H:U")) != -1) {
+        switch (opt) {
+        case 'p':
+            for (which = 0; which < NPOLICIES; which++)
+                if (strcmp(optarg, policies[which].name) == 0)
+                    break;
+            if (which == NPOLICIES) {
+                if (strcmp(optarg, "all") != 0)
+                    usageError(argv[0]);
+                which = -1;
+            }
+            break;
+        case 'P': prio = getInt(optarg, GN_GT_0, "-P");                 break;
+        case 'i': intervalUsecs = getLong(optarg, GN_GT_0, "-i");       break;
+        case 'd': secs = getInt(optarg, GN_GT_0, "-d");                 break;
+        case 't': nthreads = getInt(optarg, GN_GT_0, "-t");             break;
+        case 'a': pinCpu = getInt(optarg, GN_NONNEG, "-a");             break;
+        case 'r': runtimeUsecs = getLong(optarg, GN_GT_0, "-r");        break;
+        case 'H': printMax = getLong(optarg, GN_GT_0, "-H");            break;
+        case 'U': lock = FALSE;                                         break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (printMax > histMax)
+        histMax = printMax;
+    loops = secs * 1000000L / intervalUsecs;
+
+    /* Lock all current and future pages (including the stacks of the
+       threads and the histograms, which are allocated later) */
+
+    if (lock && mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+        errExit("mlockall");
+
+    printf("Interval %ld us, %ld loops per thread, memory %slocked\n\n",
+           intervalUsecs, loops, lock ? "" : "NOT ");
+    printf("%-9s %-4s %8s %7s %7s %7s %7s %7s %7s %6s\n", "policy", "thr",
+           "samples", "min", "avg", "p50", "p99", "p99.99", "max", "over");
+
+    for (p = 0; p < NPOLICIES; p++) {
+        hist[p] = NULL;
+        if (which == -1 || which == p)
+            hist[p] = measure(policies[p].policy, policies[p].name,
+                              nthreads);
+    }
+
+    /* Print the histograms side by side, omitting rows that are zero
+       for all policies */
+
+    if (printMax > 0) {
+        printf("\n%6s", "usecs");
+        for (p = 0; p < NPOLICIES; p++)
+            if (hist[p] != NULL)
+                printf(" %9s", policies[p].name);
+        printf("\n");
+
+        for (j = 0; j < printMax; j++) {
+            for (p = 0; p < NPOLICIES; p++)
+                if (hist[p] != NULL && hist[p][j] != 0)
+                    break;
+            if (p == NPOLICIES)
+                continue;
+
+            printf("%6ld", j);
+            for (p = 0; p < NPOLICIES; p++)
+                if (hist[p] != NULL)
+                    printf(" %9ld", hist[p][j]);
+            printf("\n");
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -14,8 +14,21 @@
 
    Print the contents of an 'rusage' (resource usage) structure
    (returned by a call to getrusage()).
+
+   Supplementary functions: rusageSnap() records the resource usage of
+   the caller (RUSAGE_SELF), the calling thread (RUSAGE_THREAD), or its
+   waited-for children (RUSAGE_CHILDREN) along with a monotonic timestamp,
+   and rusageDiff() converts two such snapshots into a 'rusageDelta'
+   structure that includes derived rates (CPU utilization, context
+   switches per second, and, given an operation count, faults and CPU
+   time per operation). rusageToJson(), rusageCsvHeader(), and
+   rusageToCsv() format a delta into a caller-supplied buffer; none of
+   these functions allocates memory or performs stdio, so they can be
+   used at fine granularity, and from multiple threads.
 */
+#define _GNU_SOURCE             /* For RUSAGE_THREAD */
 #include <sys/resource.h>
+#include <stdarg.h>
 #include "print_rusage.h"
 #include "tlpi_hdr.h"
 
@@ -44,3 +57,186 @@ printRusage(const char *leader, const struct rusage *ru)
     printf("%sContext switches:        voluntary=%ld; "
             "involuntary=%ld\n", ldr, ru->ru_nvcsw, ru->ru_nivcsw);
 }
+
+int
+rusageSnap(int who, struct rusageSnapshot *snap)
+{
+    snap->who = who;
+    if (clock_gettime(CLOCK_MONOTONIC, &snap->when) == -1)
+        return -1;
+    return getrusage(who, &snap->ru);
+}
+
+static double
+tvSecs(const struct timeval *end, const struct timeval *start)
+{
+    return (end->tv_sec - start->tv_sec) +
+           (end->tv_usec - start->tv_usec) / 1000000.0;
+}
+
+void
+rusageDiff(const struct rusageSnapshot *start,
+           const struct rusageSnapshot *end, long ops, struct rusageDelta *d)
+{
+    const struct rusage *s = &start->ru, *e = &end->ru;
+    double cpuSecs;
+
+    d->who = end->who;
+    d->wallSecs = (end->when.tv_sec - start->when.tv_sec) +
+                  (end->when.tv_nsec - start->when.tv_nsec) / 1e9;
+    d->userSecs = tvSecs(&e->ru_utime, &s->ru_utime);
+    d->sysSecs = tvSecs(&e->ru_stime, &s->ru_stime);
+    d->maxrssKb = e->ru_maxrss;
+    d->maxrssGrowthKb = e->ru_maxrss - s->ru_maxrss;
+    d->minflt = e->ru_minflt - s->ru_minflt;
+    d->majflt = e->ru_majflt - s->ru_majflt;
+    d->inblock = e->ru_inblock - s->ru_inblock;
+    d->oublock = e->ru_oublock - s->ru_oublock;
+    d->nsignals = e->ru_nsignals - s->ru_nsignals;
+    d->nvcsw = e->ru_nvcsw - s->ru_nvcsw;
+    d->nivcsw = e->ru_nivcsw - s->ru_nivcsw;
+
+    cpuSecs = d->userSecs + d->sysSecs;
+    d->ops = ops;
+    d->cpuUtil = (d->wallSecs > 0) ? cpuSecs / d->wallSecs : 0;
+    d->cswPerSec = (d->wallSecs > 0) ?
+                   (d->nvcsw + d->nivcsw) / d->wallSecs : 0;
+    d->faultsPerOp = (ops > 0) ? (double) (d->minflt + d->majflt) / ops : 0;
+    d->cpuUsecsPerOp = (ops > 0) ? cpuSecs * 1e6 / ops : 0;
+}
+
+/* An output buffer that, like snprintf(), keeps counting once full */
+
+struct outBuf {
+    char *buf;
+    size_t size;
+    size_t len;                 /* Length of the complete output */
+};
+
+static void
+outPrintf(struct outBuf *ob, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(ob->len < ob->size ? ob->buf + ob->len : NULL,
+                  ob->len < ob->size ? ob->size - ob->len : 0, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        ob->len += n;
+}
+
+static void
+outChar(struct outBuf *ob, char c)
+{
+    if (ob->len + 1 < ob->size) {
+        ob->buf[ob->len] = c;
+        ob->buf[ob->len + 1] = '\0';
+    } else if (ob->len < ob->size) {
+        ob->buf[ob->len] = '\0';       /* Truncated */
+    }
+    ob->len++;
+}
+
+static int
+outDone(struct outBuf *ob)
+{
+    if (ob->size > 0 && ob->len == 0)
+        ob->buf[0] = '\0';
+    return ob->len;
+}
+
+static const char *
+whoName(int who)
+{
+    switch (who) {
+    case RUSAGE_SELF:           return "self";
+    case RUSAGE_THREAD:         return "thread";
+    case RUSAGE_CHILDREN:       return "children";
+    default:                    return "unknown";
+    }
+}
+
+int
+rusageToJson(char *buf, size_t size, const char *label,
+             const struct rusageDelta *d)
+{
+    struct outBuf ob = { buf, size, 0 };
+    const char *p;
+
+    outPrintf(&ob, "{\"label\":\"");
+    for (p = (label == NULL) ? "" : label; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\')
+            outPrintf(&ob, "\\%c", *p);
+        else if ((unsigned char) *p < 0x20)
+            outPrintf(&ob, "\\u%04x", (unsigned char) *p);
+        else
+            outChar(&ob, *p);
+    }
+
+    outPrintf(&ob, "\",\"who\":\"%s\",\"wall_s\":%.6f,\"user_s\":%.6f,"
+              "\"sys_s\":%.6f,\"maxrss_kb\":%ld,\"maxrss_growth_kb\":%ld,"
+              "\"minflt\":%ld,\"majflt\":%ld,\"inblock\":%ld,"
+              "\"oublock\":%ld,\"nsignals\":%ld,\"nvcsw\":%ld,"
+              "\"nivcsw\":%ld,\"cpu_util\":%.4f,\"csw_per_s\":%.1f",
+              whoName(d->who), d->wallSecs, d->userSecs, d->sysSecs,
+              d->maxrssKb, d->maxrssGrowthKb, d->minflt, d->majflt,
+              d->inblock, d->oublock, d->nsignals, d->nvcsw, d->nivcsw,
+              d->cpuUtil, d->cswPerSec);
+    if (d->ops > 0)
+        outPrintf(&ob, ",\"ops\":%ld,\"faults_per_op\":%.6f,"
+                  "\"cpu_us_per_op\":%.6f}", d->ops, d->faultsPerOp,
+                  d->cpuUsecsPerOp);
+    else
+        outPrintf(&ob, ",\"ops\":null,\"faults_per_op\":null,"
+                  "\"cpu_us_per_op\":null}");
+
+    return outDone(&ob);
+}
+
+int
+rusageCsvHeader(char *buf, size_t size)
+{
+    return snprintf(buf, size, "label,who,wall_s,user_s,sys_s,maxrss_kb,"
+                    "maxrss_growth_kb,minflt,majflt,inblock,oublock,"
+                    "nsignals,nvcsw,nivcsw,cpu_util,csw_per_s,ops,"
+                    "faults_per_op,cpu_us_per_op");
+}
+
+int
+rusageToCsv(char *buf, size_t size, const char *label,
+            const struct rusageDelta *d)
+{
+    struct outBuf ob = { buf, size, 0 };
+    const char *p;
+
+    /* Quote the label only if it contains a separator or quote */
+
+    if (label == NULL)
+        label = "";
+    if (strpbrk(label, ",\"\r\n") != NULL) {
+        outChar(&ob, '"');
+        for (p = label; *p != '\0'; p++) {
+            if (*p == '"')
+                outChar(&ob, '"');
+            outChar(&ob, *p);
+        }
+        outChar(&ob, '"');
+    } else {
+        outPrintf(&ob, "%s", label);
+    }
+
+    outPrintf(&ob, ",%s,%.6f,%.6f,%.6f,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,"
+              "%.4f,%.1f", whoName(d->who), d->wallSecs, d->userSecs,
+              d->sysSecs, d->maxrssKb, d->maxrssGrowthKb, d->minflt,
+              d->majflt, d->inblock, d->oublock, d->nsignals, d->nvcsw,
+              d->nivcsw, d->cpuUtil, d->cswPerSec);
+    if (d->ops > 0)
+        outPrintf(&ob, ",%ld,%.6f,%.6f", d->ops, d->faultsPerOp,
+                  d->cpuUsecsPerOp);
+    else
+        outPrintf(&ob, ",,,");
+
+    return outDone(&ob);
+}
@@ -13,12 +13,61 @@
 /* print_rusage.h
 
    Header file for print_rusage.c.
+
+   Supplementary functions: the snapshot/delta interface (rusageSnap(),
+   rusageDiff()) and its formatters were added for use by benchmark programs.
 */
 #ifndef PRINT_RUSAGE_H      /* Prevent accidental double inclusion */
 #define PRINT_RUSAGE_H
 
 #include <sys/resource.h>
+#include <stddef.h>
+#include <time.h>
 
 void printRusage(const char *leader, const struct rusage *ru);
 
+struct rusageSnapshot {         /* Resource usage at a point in time */
+    int who;                    /* RUSAGE_SELF, RUSAGE_THREAD, or
+                                   RUSAGE_CHILDREN */
+    struct timespec when;       /* CLOCK_MONOTONIC time of snapshot */
+    struct rusage ru;
+};
+
+struct rusageDelta {            /* Difference between two snapshots */
+    int who;
+    double wallSecs;            /* Elapsed (CLOCK_MONOTONIC) time */
+    double userSecs;            /* CPU time consumed in user mode */
+    double sysSecs;             /* CPU time consumed in kernel mode */
+    long maxrssKb;              /* Peak RSS at end (a high-water mark) */
+    long maxrssGrowthKb;        /* Growth of peak RSS during the interval */
+    long minflt, majflt;        /* Page faults (reclaims, real faults) */
+    long inblock, oublock;      /* Block I/Os */
+    long nsignals;
+    long nvcsw, nivcsw;         /* Voluntary, involuntary context switches */
+
+    /* Derived values; the per-operation values are meaningful only if
+       'ops' is greater than zero */
+
+    long ops;                   /* Operations performed (caller-supplied) */
+    double cpuUtil;             /* (user + sys) / wall */
+    double cswPerSec;           /* Context switches per second of wall time */
+    double faultsPerOp;         /* (minflt + majflt) / ops */
+    double cpuUsecsPerOp;       /* (user + sys) microseconds / ops */
+};
+
+int rusageSnap(int who, struct rusageSnapshot *snap);
+
+void rusageDiff(const struct rusageSnapshot *start,
+                const struct rusageSnapshot *end, long ops,
+                struct rusageDelta *d);
+
+/* The following return the length of the formatted text, as does
+   snprintf(); if this is >= 'size', the output was truncated */
+
+int rusageToJson(char *buf, size_t size, const char *label,
+                 const struct rusageDelta *d);
+int rusageCsvHeader(char *buf, size_t size);
+int rusageToCsv(char *buf, size_t size, const char *label,
+                const struct rusageDelta *d);
+
 #endif
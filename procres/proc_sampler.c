@@ -0,0 +1,537 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 36 */
+
+/* proc_sampler.c
+
+   Functions for periodically sampling the CPU time and resident set size
+   of every process on the system (as top(1) does), reporting the change
+   in each since the previous sample.
+
+   psmCreate() creates a sampler, and records a baseline for all existing
+   processes. Each subsequent call to psmSample() returns an array (owned
+   by the sampler, and valid until the next call) describing each live
+   process. psmGetStats() returns counters, and psmDestroy() frees the
+   sampler.
+
+   The sampler holds an open file descriptor for each process's /proc/PID
+   directory, and reads /proc/PID/stat and /proc/PID/statm with openat()
+   relative to that descriptor. Once the process has terminated, those
+   openat() calls fail (with ESRCH), even if the PID has since been
+   reused, so that the stale entry is simply dropped.
+
+   /proc is scanned only once, when the sampler is created. Thereafter,
+   new processes are learned of from the kernel's process events
+   connector (a NETLINK_CONNECTOR socket subscribed to CN_IDX_PROC), which
+   reports each fork() and process termination. The pending events are
+   processed by psmSample() or, if the caller wants to prevent the socket
+   buffer from overflowing between samples, by psmUpdate() whenever the
+   descriptor returned by psmEventFd() is readable. If events are lost
+   (recv() fails with ENOBUFS), /proc is rescanned once to recover.
+
+   Using the connector requires privilege (CAP_NET_ADMIN). If it is not
+   available (or if psmCreate() is given the PSM_NO_CONNECTOR flag), /proc
+   is instead rescanned by each call to psmSample(); only the PIDs not
+   already known are opened.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include "dir_batch.h"
+#include "proc_sampler.h"
+#include "tlpi_hdr.h"
+
+#define NUM_BUCKETS 16384       /* Must be a power of 2 */
+#define RCVBUF_SIZE (8 * 1024 * 1024)
+
+struct psmEntry {               /* One tracked process */
+    pid_t pid;
+    int dirFd;                  /* Open on /proc/PID */
+    size_t idx;                 /* Index in 'ents' */
+    struct psmEntry *next;      /* Next in hash chain */
+    Boolean sampled;            /* 'prev*' fields are valid */
+    unsigned long long prevTicks;
+    long prevRssKb;
+};
+
+struct procSampler {
+    int procFd;                 /* Open on /proc */
+    int nlFd;                   /* Connector socket, or -1 */
+    Boolean needRescan;         /* Connector events were lost */
+    struct dirBatch db;
+    struct psmEntry *buckets[NUM_BUCKETS];
+    struct psmEntry **ents;     /* All tracked processes */
+    size_t numEnts;
+    size_t maxEnts;
+    struct procSample *samples; /* Returned by psmSample() */
+    size_t maxSamples;
+    struct timespec last;       /* Time of previous sample */
+    long clkTck;
+    long pageKb;
+    struct psmStats stats;
+    char buf[8192];             /* For reading files and events */
+};
+
+/* Read the file 'name' in the directory 'dirFd' into 's->buf' and
+   null-terminate it. Return 0 on success, or -1 on error. */
+
+static int
+readFile(struct procSampler *s, int dirFd, const char *name)
+{
+    ssize_t numRead;
+    int fd;
+
+    fd = openat(dirFd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    numRead = pread(fd, s->buf, sizeof(s->buf) - 1, 0);
+    close(fd);
+    if (numRead == -1)
+        return -1;
+    s->buf[numRead] = '\0';
+    return 0;
+}
+
+static unsigned long long
+parseNum(const char **pp)
+{
+    const char *p = *pp;
+    unsigned long long n;
+
+    while (*p == ' ')
+        p++;
+    for (n = 0; *p >= '0' && *p <= '9'; p++)
+        n = n * 10 + (*p - '0');
+    *pp = p;
+    return n;
+}
+
+/* Read the stat and statm files of the process 'e' into 'ps' (leaving the
+   delta fields untouched). Return 0 on success, or -1 if the process has
+   gone. */
+
+static int
+readProcess(struct procSampler *s, struct psmEntry *e, struct procSample *ps)
+{
+    const char *p, *q;
+    size_t len;
+    int j;
+
+    if (readFile(s, e->dirFd, "stat") == -1)
+        return -1;
+
+    /* The command name is in parentheses, and may itself contain ')' */
+
+    p = strchr(s->buf, '(');
+    q = strrchr(s->buf, ')');
+    if (p == NULL || q == NULL || q < p)
+        return -1;
+    len = q - p - 1;
+    if (len >= sizeof(ps->comm))
+        len = sizeof(ps->comm) - 1;
+    memcpy(ps->comm, p + 1, len);
+    ps->comm[len] = '\0';
+
+    p = q + 2;
+    ps->state = *p++;                   /* Field 3 (see proc(5)) */
+    for (j = 4; j < 14; j++) {          /* Skip fields 4 to 13 */
+        while (*p == ' ')
+            p++;
+        while (*p != ' ' && *p != '\0')
+            p++;
+    }
+    ps->cpuTicks = parseNum(&p);        /* Field 14: utime */
+    ps->cpuTicks += parseNum(&p);       /* Field 15: stime */
+
+    if (readFile(s, e->dirFd, "statm") == -1)
+        return -1;
+    p = s->buf;
+    parseNum(&p);                       /* Total program size */
+    ps->rssKb = parseNum(&p) * s->pageKb;
+
+    ps->pid = e->pid;
+    return 0;
+}
+
+static struct psmEntry *
+lookup(const struct procSampler *s, pid_t pid)
+{
+    struct psmEntry *e;
+
+    for (e = s->buckets[pid & (NUM_BUCKETS - 1)]; e != NULL; e = e->next)
+        if (e->pid == pid)
+            return e;
+    return NULL;
+}
+
+/* Start tracking 'pid' (unless it is already tracked, or has gone). If
+   'baseline' is TRUE, the process was found by the initial scan of /proc,
+   and psmSample() should report the change since now; otherwise, it is
+   new. Return 0 on success, or -1 if memory could not be allocated. */
+
+static int
+addPid(struct procSampler *s, pid_t pid, Boolean baseline)
+{
+    struct psmEntry *e, **newEnts;
+    struct procSample ps;
+    char name[32];
+    size_t newMax;
+    int fd;
+
+    if (lookup(s, pid) != NULL)
+        return 0;
+
+    snprintf(name, sizeof(name), "%ld", (long) pid);
+    fd = openat(s->procFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return 0;                       /* Already gone */
+
+    if (s->numEnts == s->maxEnts) {
+        newMax = (s->maxEnts == 0) ? 1024 : s->maxEnts * 2;
+        newEnts = realloc(s->ents, newMax * sizeof(struct psmEntry *));
+        if (newEnts == NULL)
+            goto fail;
+        s->ents = newEnts;
+        s->maxEnts = newMax;
+    }
+
+    e = calloc(1, sizeof(struct psmEntry));
+    if (e == NULL)
+        goto fail;
+    e->pid = pid;
+    e->dirFd = fd;
+
+    if (baseline && readProcess(s, e, &ps) == 0) {
+        e->prevTicks = ps.cpuTicks;
+        e->prevRssKb = ps.rssKb;
+        e->sampled = TRUE;
+    }
+
+    e->idx = s->numEnts;
+    s->ents[s->numEnts++] = e;
+    e->next = s->buckets[pid & (NUM_BUCKETS - 1)];
+    s->buckets[pid & (NUM_BUCKETS - 1)] = e;
+    s->stats.added++;
+    return 0;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+static void
+removeEntry(struct procSampler *s, struct psmEntry *e)
+{
+    struct psmEntry **pp;
+
+    for (pp = &s->buckets[e->pid & (NUM_BUCKETS - 1)]; *pp != e;
+            pp = &(*pp)->next)
+        continue;
+    *pp = e->next;
+
+    s->ents[e->idx] = s->ents[--s->numEnts];
+    s->ents[e->idx]->idx = e->idx;
+
+    close(e->dirFd);
+    free(e);
+    s->stats.removed++;
+}
+
+/* Add any processes in /proc that are not already tracked. Return 0 on
+   success, or -1 on error. */
+
+static int
+rescan(struct procSampler *s, Boolean baseline)
+{
+    struct dirBatchEnt *ents;
+    ssize_t n, j;
+    const char *p;
+    pid_t pid;
+
+    if (lseek(s->procFd, 0, SEEK_SET) == -1)
+        return -1;
+
+    while ((n = dirBatchRead(&s->db, &ents)) > 0) {
+        for (j = 0; j < n; j++) {
+            if (ents[j].type != DT_DIR || ents[j].name[0] < '1' ||
+                    ents[j].name[0] > '9')
+                continue;
+            for (pid = 0, p = ents[j].name; *p >= '0' && *p <= '9'; p++)
+                pid = pid * 10 + (*p - '0');
+            if (addPid(s, pid, baseline) == -1)
+                return -1;
+        }
+    }
+
+    s->stats.rescans++;
+    s->needRescan = FALSE;
+    return (n == -1) ? -1 : 0;
+}
+
+/* Subscribe to process events; return a socket descriptor, or -1 */
+
+static int
+openConnector(void)
+{
+    char buf[NLMSG_SPACE(sizeof(struct cn_msg) +
+                         sizeof(enum proc_cn_mcast_op))];
+    struct sockaddr_nl addr;
+    enum proc_cn_mcast_op op;
+    struct nlmsghdr *nlh;
+    struct cn_msg *cn;
+    int fd, size;
+
+    fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                NETLINK_CONNECTOR);
+    if (fd == -1)
+        return -1;
+
+    /* Ensure that a burst of events is unlikely to overflow the socket
+       buffer; SO_RCVBUFFORCE (which requires privilege) exceeds the
+       'rmem_max' limit */
+
+    size = RCVBUF_SIZE;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == -1)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+        goto fail;
+
+    memset(buf, 0, sizeof(buf));
+    nlh = (struct nlmsghdr *) buf;
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+    nlh->nlmsg_type = NLMSG_DONE;
+    cn = NLMSG_DATA(nlh);
+    cn->id.idx = CN_IDX_PROC;
+    cn->id.val = CN_VAL_PROC;
+    cn->len = sizeof(op);
+    op = PROC_CN_MCAST_LISTEN;
+    memcpy(cn->data, &op, sizeof(op));
+
+    if (send(fd, buf, nlh->nlmsg_len, 0) == -1)
+        goto fail;
+
+    return fd;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+/* Create a sampler. Return NULL on error. */
+
+struct procSampler *
+psmCreate(int flags)
+{
+    struct procSampler *s;
+
+    s = calloc(1, sizeof(struct procSampler));
+    if (s == NULL)
+        return NULL;
+    s->clkTck = sysconf(_SC_CLK_TCK);
+    s->pageKb = sysconf(_SC_PAGESIZE) / 1024;
+
+    s->procFd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (s->procFd == -1) {
+        free(s);
+        return NULL;
+    }
+    if (dirBatchInit(&s->db, s->procFd, 256 * 1024) == -1) {
+        close(s->procFd);
+        free(s);
+        return NULL;
+    }
+
+    /* Subscribe before scanning, so that no process is missed; a fork
+       event for a process that the scan has already found is ignored */
+
+    s->nlFd = (flags & PSM_NO_CONNECTOR) ? -1 : openConnector();
+
+    clock_gettime(CLOCK_MONOTONIC, &s->last);
+    if (rescan(s, TRUE) == -1) {
+        psmDestroy(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+/* Return the connector socket (which becomes readable when there are
+   events for psmUpdate() to process), or -1 if there is none */
+
+int
+psmEventFd(const struct procSampler *s)
+{
+    return s->nlFd;
+}
+
+/* Process pending connector events. Return the number of events, or -1
+   on error. */
+
+int
+psmUpdate(struct procSampler *s)
+{
+    struct nlmsghdr *nlh;
+    struct cn_msg *cn;
+    struct proc_event *ev;
+    struct psmEntry *e;
+    ssize_t len;
+    int n;
+
+    if (s->nlFd == -1)
+        return 0;
+
+    for (n = 0; ; ) {
+        len = recv(s->nlFd, s->buf, sizeof(s->buf), 0);
+        if (len == -1) {
+            if (errno == EAGAIN)
+                break;
+            if (errno == ENOBUFS) {     /* Events were lost */
+                s->needRescan = TRUE;
+                continue;
+            }
+            return -1;
+        }
+
+        for (nlh = (struct nlmsghdr *) s->buf; NLMSG_OK(nlh, len);
+                nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type != NLMSG_DONE)
+                continue;
+            cn = NLMSG_DATA(nlh);
+            if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC)
+                continue;
+
+            ev = (struct proc_event *) cn->data;
+            n++;
+            s->stats.events++;
+
+            /* Ignore the creation and termination of threads other than
+               the main thread */
+
+            switch (ev->what) {
+            case PROC_EVENT_FORK:
+                if (ev->event_data.fork.child_pid ==
+                        ev->event_data.fork.child_tgid)
+                    if (addPid(s, ev->event_data.fork.child_tgid,
+                               FALSE) == -1)
+                        return -1;
+                break;
+
+            case PROC_EVENT_EXIT:
+                if (ev->event_data.exit.process_pid ==
+                        ev->event_data.exit.process_tgid) {
+                    e = lookup(s, ev->event_data.exit.process_tgid);
+                    if (e != NULL)
+                        removeEntry(s, e);
+                }
+                break;
+
+            default:
+                break;
+            }
+        }
+    }
+
+    return n;
+}
+
+/* Sample all processes, returning a pointer to an array describing them
+   in '*samples'. Return the number of processes, or -1 on error. */
+
+ssize_t
+psmSample(struct procSampler *s, struct procSample **samples)
+{
+    struct procSample *ps, *newSamples;
+    struct psmEntry *e;
+    struct timespec now;
+    double elapsed;
+    size_t j, n;
+
+    if (psmUpdate(s) == -1)
+        return -1;
+    if (s->nlFd == -1 || s->needRescan)
+        if (rescan(s, FALSE) == -1)
+            return -1;
+
+    if (s->numEnts > s->maxSamples) {
+        newSamples = realloc(s->samples,
+                             s->maxEnts * sizeof(struct procSample));
+        if (newSamples == NULL)
+            return -1;
+        s->samples = newSamples;
+        s->maxSamples = s->maxEnts;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - s->last.tv_sec) +
+              (now.tv_nsec - s->last.tv_nsec) / 1e9;
+    s->last = now;
+
+    /* Iterate backward, since removeEntry() moves the last entry into
+       the slot of the removed one */
+
+    n = 0;
+    for (j = s->numEnts; j > 0; j--) {
+        e = s->ents[j - 1];
+        ps = &s->samples[n];
+
+        if (readProcess(s, e, ps) == -1) {
+            removeEntry(s, e);
+            continue;
+        }
+
+        ps->isNew = !e->sampled;
+        ps->cpuDelta = (ps->cpuTicks >= e->prevTicks) ?
+                            ps->cpuTicks - e->prevTicks : 0;
+        ps->cpuPercent = (elapsed > 0) ?
+                            ps->cpuDelta * 100.0 / s->clkTck / elapsed : 0;
+        ps->rssDeltaKb = ps->rssKb - e->prevRssKb;
+
+        e->prevTicks = ps->cpuTicks;
+        e->prevRssKb = ps->rssKb;
+        e->sampled = TRUE;
+        n++;
+    }
+
+    *samples = s->samples;
+    return n;
+}
+
+void
+psmGetStats(const struct procSampler *s, struct psmStats *stats)
+{
+    *stats = s->stats;
+    stats->tracked = s->numEnts;
+}
+
+void
+psmDestroy(struct procSampler *s)
+{
+    while (s->numEnts > 0)
+        removeEntry(s, s->ents[s->numEnts - 1]);
+    free(s->ents);
+    free(s->samples);
+    if (s->nlFd != -1)
+        close(s->nlFd);
+    dirBatchFree(&s->db);
+    close(s->procFd);
+    free(s);
+}
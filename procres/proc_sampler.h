@@ -0,0 +1,64 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 36 */
+
+/* proc_sampler.h
+
+   Header file for proc_sampler.c.
+*/
+#ifndef PROC_SAMPLER_H
+#define PROC_SAMPLER_H          /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+
+#define PSM_NO_CONNECTOR 1      /* psmCreate() flag: track process creation
+                                   by rescanning /proc, not by proc
+                                   connector events */
+
+struct procSample {             /* One process in one sample */
+    pid_t pid;
+    char comm[32];              /* Command name (from /proc/PID/stat) */
+    char state;                 /* Process state, e.g., 'R' */
+    unsigned long long cpuTicks;        /* User + system CPU time */
+    unsigned long long cpuDelta;        /* Ticks since previous sample
+                                           (or since the process started,
+                                           if that was more recent) */
+    double cpuPercent;          /* 'cpuDelta' as a percentage of elapsed
+                                   time (may exceed 100 for multithreaded
+                                   processes) */
+    long rssKb;                 /* Resident set size */
+    long rssDeltaKb;            /* Change since previous sample */
+    int isNew;                  /* First sample of this process */
+};
+
+struct psmStats {
+    long tracked;               /* Processes currently tracked */
+    long events;                /* Connector events received */
+    long added;                 /* Processes added (events or rescans) */
+    long removed;               /* Processes removed */
+    long rescans;               /* Scans of /proc (including the first) */
+};
+
+struct procSampler;             /* Opaque; defined in proc_sampler.c */
+
+struct procSampler *psmCreate(int flags);
+
+int psmEventFd(const struct procSampler *s);
+
+int psmUpdate(struct procSampler *s);
+
+ssize_t psmSample(struct procSampler *s, struct procSample **samples);
+
+void psmGetStats(const struct procSampler *s, struct psmStats *stats);
+
+void psmDestroy(struct procSampler *s);
+
+#endif
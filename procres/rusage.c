@@ -16,6 +16,13 @@
    by getrusage()) that it used.
 
    See also print_rudage.c.
+
+   Supplementary feature: with '-f json' or '-f csv', the children's
+   resource usage is instead reported as a single JSON object or CSV
+   record (with a header line), using rusageSnap()/rusageDiff(), and
+   including the wall-clock time taken by the command.
+
+   Usage: rusage [-f json|csv] command arg...
 */
 #include <sys/resource.h>
 #include <sys/wait.h>
@@ -27,22 +34,54 @@ main(int argc, char *argv[])
 {
     pid_t childPid;
     struct rusage ru;
+    struct rusageSnapshot start, end;
+    struct rusageDelta d;
+    char buf[1024];
+    const char *fmt;
+    int opt;
+
+    fmt = NULL;
+    while ((opt = getopt(argc, argv, "+f:")) != -1) {
+        if (opt != 'f' || (strcmp(optarg, "json") != 0 &&
+                           strcmp(optarg, "csv") != 0))
+            usageErr("%s [-f json|csv] command arg...\n", argv[0]);
+        fmt = optarg;
+    }
+
+    if (optind >= argc || strcmp(argv[optind], "--help") == 0)
+        usageErr("%s [-f json|csv] command arg...\n", argv[0]);
 
-    if (argc < 2 || strcmp(argv[1], "--help") == 0)
-        usageErr("%s command arg...\n", argv[0]);
+    if (fmt != NULL && rusageSnap(RUSAGE_CHILDREN, &start) == -1)
+        errExit("rusageSnap");
 
     switch (childPid = fork()) {
     case -1:
         errExit("fork");
 
     case 0:
-        execvp(argv[1], &argv[1]);
+        execvp(argv[optind], &argv[optind]);
         errExit("execvp");
 
     default:
-        printf("Command PID: %ld\n", (long) childPid);
+        if (fmt == NULL)
+            printf("Command PID: %ld\n", (long) childPid);
         if (wait(NULL) == -1)
             errExit("wait");
+
+        if (fmt != NULL) {
+            if (rusageSnap(RUSAGE_CHILDREN, &end) == -1)
+                errExit("rusageSnap");
+            rusageDiff(&start, &end, 0, &d);
+            if (strcmp(fmt, "csv") == 0) {
+                rusageCsvHeader(buf, sizeof(buf));
+                printf("%s\n", buf);
+                rusageToCsv(buf, sizeof(buf), argv[optind], &d);
+            } else {
+                rusageToJson(buf, sizeof(buf), argv[optind], &d);
+            }
+            printf("%s\n", buf);
+            exit(EXIT_SUCCESS);
+        }
         if (getrusage(RUSAGE_CHILDREN, &ru) == -1)
             errExit("getrusage");
 
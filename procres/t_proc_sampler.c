@@ -0,0 +1,131 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 36 */
+
+/* t_proc_sampler.c
+
+   Demonstrate the proc_sampler.c functions: a minimal top(1).
+
+   Usage: t_proc_sampler [-i secs] [-c count] [-n num] [-R]
+
+        -i secs   Sampling interval (default: 2)
+        -c count  Number of samples to display (default: unlimited)
+        -n num    Number of processes to display per sample, in order of
+                  CPU usage (default: 10)
+        -R        Rescan /proc at each sample, instead of using the
+                  process events connector
+
+   Between samples, the program waits in poll() on the sampler's connector
+   socket, calling psmUpdate() to process events as they arrive. Each
+   sample also shows the time taken by psmSample().
+
+   This program is Linux-specific.
+*/
+#include <poll.h>
+#include <time.h>
+#include "proc_sampler.h"
+#include "tlpi_hdr.h"
+
+static int
+cmpCpu(const void *a, const void *b)
+{
+    const struct procSample *pa = a, *pb = b;
+
+    if (pa->cpuDelta != pb->cpuDelta)
+        return (pa->cpuDelta < pb->cpuDelta) ? 1 : -1;
+    return (pa->rssKb < pb->rssKb) - (pa->rssKb > pb->rssKb);
+}
+
+static long long
+msecsNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct procSampler *s;
+    struct procSample *samples;
+    struct psmStats st;
+    struct pollfd pfd;
+    long long deadline, left, t0, t1;
+    int opt, interval, count, num, flags, j, k;
+    ssize_t n;
+
+    interval = 2;
+    count = 0;
+    num = 10;
+    flags = 0;
+    while ((opt = getopt(argc, argv, "i:c:n:R")) != -1) {
+        switch (opt) {
+        case 'i': interval = getInt(optarg, GN_GT_0, "-i");     break;
+        case 'c': count = getInt(optarg, GN_GT_0, "-c");        break;
+        case 'n': num = getInt(optarg, GN_GT_0, "-n");          break;
+        case 'R': flags |= PSM_NO_CONNECTOR;                    break;
+        default:
+            usageErr("%s [-i secs] [-c count] [-n num] [-R]\n", argv[0]);
+        }
+    }
+
+    s = psmCreate(flags);
+    if (s == NULL)
+        errExit("psmCreate");
+    if (!(flags & PSM_NO_CONNECTOR) && psmEventFd(s) == -1)
+        fprintf(stderr, "Process events connector unavailable; "
+                "rescanning /proc instead\n");
+
+    pfd.fd = psmEventFd(s);
+    pfd.events = POLLIN;
+
+    for (j = 0; count == 0 || j < count; j++) {
+
+        /* Wait for the interval, processing connector events */
+
+        deadline = msecsNow() + interval * 1000LL;
+        while ((left = deadline - msecsNow()) > 0) {
+            if (poll(&pfd, 1, left) == -1) {    /* fd -1 is ignored */
+                if (errno == EINTR)
+                    continue;
+                errExit("poll");
+            }
+            if (psmUpdate(s) == -1)
+                errExit("psmUpdate");
+        }
+
+        t0 = msecsNow();
+        n = psmSample(s, &samples);
+        if (n == -1)
+            errExit("psmSample");
+        t1 = msecsNow();
+
+        qsort(samples, n, sizeof(struct procSample), cmpCpu);
+
+        psmGetStats(s, &st);
+        printf("\n%ld processes; sampled in %lld ms; %ld events, "
+               "%ld added, %ld removed, %ld /proc scans\n", (long) n,
+               t1 - t0, st.events, st.added, st.removed, st.rescans);
+        printf("%7s %-16s %s %6s %10s %10s\n", "PID", "COMMAND", "S",
+               "%CPU", "RSS kB", "dRSS kB");
+
+        for (k = 0; k < n && k < num; k++)
+            printf("%7ld %-16s %c %6.1f %10ld %+10ld%s\n",
+                   (long) samples[k].pid, samples[k].comm, samples[k].state,
+                   samples[k].cpuPercent, samples[k].rssKb,
+                   samples[k].rssDeltaKb, samples[k].isNew ? " (new)" : "");
+    }
+
+    psmDestroy(s);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,341 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 3 */
+
+/* parse_num.c
+
+   Functions to parse numbers in data (for example, numeric fields in a
+   file that has been read into a buffer), as opposed to getLong() and
+   getInt() (get_num.c), which are for command-line arguments and which
+   terminate the program if an argument is not a valid number.
+
+   Each function parses a number at the start of the 'len' bytes at 's',
+   which need not be null-terminated, and returns PN_OK, or, on error,
+   one of the (negative) PN_* values defined in parse_num.h; pnStrerror()
+   returns a description of the error. On success, the value is returned
+   via 'val'; on error, 'val' is not changed. If 'used' is NULL, all
+   'len' bytes must form the number; otherwise, parsing stops at the
+   first byte that is not part of the number, and the number of bytes
+   that form the number is returned in '*used' (also for PN_RANGE, so
+   that the caller can step over the field).
+
+        pnLong()   decimal, with optional '+' or '-' sign, into a long
+        pnInt()    as pnLong(), into an int
+        pnULong()  decimal, no sign, into an unsigned long
+        pnHex()    hexadecimal, no sign, with optional "0x" or "0X"
+                   prefix, into an unsigned long
+
+   Unlike strtol(), these functions don't skip leading white space, and
+   don't depend on the locale. Digits are validated and converted 8 at a
+   time, in a 64-bit integer ("SIMD within a register"), which is
+   portable and is as fast for the short numbers typical of data files
+   as SSE or AVX code would be. When at least 8 bytes remain in the
+   buffer, a number shorter than 8 digits that is followed by some other
+   byte (such as a delimiter) is also converted in this way; only a
+   number at the very end of the buffer is converted a byte at a time.
+*/
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include "parse_num.h"
+
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+#define ZEROS 0x3030303030303030ULL     /* Eight '0' characters */
+
+#define ULONG_BITS (sizeof(unsigned long) * CHAR_BIT)
+
+/* Load 8 bytes so that the first byte is in the least significant byte
+   of the result, whatever the byte order of the machine */
+
+static inline uint64_t
+load8(const char *s)
+{
+    uint64_t x;
+
+    memcpy(&x, s, sizeof(x));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    return x;
+}
+
+/* Return a mask with the top bit set in each byte of 'x' (whose bytes
+   must all be less than 0x80) that is >= 'lo' and <= 'hi' */
+
+static inline uint64_t
+inRange(uint64_t x, unsigned lo, unsigned hi)
+{
+    return ((x | HIGHS) - ONES * lo) & ((ONES * (0x80 + hi)) - x) & HIGHS;
+}
+
+/* Return a mask with the top bit set in each byte of 'x' that is not a
+   decimal digit */
+
+static inline uint64_t
+nonDigits(uint64_t x)
+{
+    return (~inRange(x & ~HIGHS, '0', '9') | x) & HIGHS;
+}
+
+/* Convert 8 decimal digits to their value */
+
+static inline uint64_t
+dec8(uint64_t x)
+{
+    x -= ZEROS;
+    x = x * 10 + (x >> 8);              /* Pairs of digits */
+    return (((x & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+            (((x >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32))))
+            >> 32;
+}
+
+/* Convert the bytes of 'x' to hexadecimal digit values, and return a
+   mask with the top bit set in each byte that is not a hexadecimal
+   digit */
+
+static inline uint64_t
+hexNibbles(uint64_t x, uint64_t *nib)
+{
+    uint64_t x7, alpha;
+
+    x7 = x & ~HIGHS;
+    alpha = inRange(x7 | (ONES * 0x20), 'a', 'f');  /* Either case */
+    *nib = (x7 & (ONES * 0x0F)) + (alpha >> 7) * 9;
+    return (~(inRange(x7, '0', '9') | alpha) | x) & HIGHS;
+}
+
+/* Pack 8 hexadecimal digit values (one per byte, the first in the least
+   significant byte) into a 32-bit value */
+
+static inline uint64_t
+hex8(uint64_t nib)
+{
+    nib = __builtin_bswap64(nib);
+    nib = (nib | (nib >> 4)) & 0x00FF00FF00FF00FFULL;
+    nib = (nib | (nib >> 8)) & 0x0000FFFF0000FFFFULL;
+    return (nib | (nib >> 16)) & 0xFFFFFFFFULL;
+}
+
+static inline int
+hexVal(unsigned char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+/* Scan the run of decimal digits at the start of 's', returning the
+   number of digits, and their value via 'val'. '*ovf' is set nonzero if
+   the value doesn't fit in an unsigned long. */
+
+static size_t
+scanDec(const char *s, size_t len, unsigned long *val, int *ovf)
+{
+    static const unsigned long pow10[] = { 1, 10, 100, 1000, 10000,
+                                           100000, 1000000, 10000000,
+                                           100000000 };
+    unsigned long v;
+    uint64_t x, nd;
+    size_t j, n;
+
+    v = 0;
+    *ovf = 0;
+    j = 0;
+    while (len - j >= 8) {
+        x = load8(s + j);
+        nd = nonDigits(x);
+        n = (nd == 0) ? 8 : (size_t) __builtin_ctzll(nd) >> 3;
+        if (n == 0)
+            break;
+        if (n < 8)              /* Right-align the digits, after '0's */
+            x = (x << (64 - 8 * n)) | (ZEROS >> (8 * n));
+        if (__builtin_mul_overflow(v, pow10[n], &v) ||
+                __builtin_add_overflow(v, dec8(x), &v))
+            *ovf = 1;
+        j += n;
+        if (n < 8) {
+            *val = v;
+            return j;
+        }
+    }
+
+    for (; j < len && s[j] >= '0' && s[j] <= '9'; j++)
+        if (__builtin_mul_overflow(v, 10, &v) ||
+                __builtin_add_overflow(v, s[j] - '0', &v))
+            *ovf = 1;
+
+    *val = v;
+    return j;
+}
+
+/* As scanDec(), for hexadecimal digits */
+
+static size_t
+scanHex(const char *s, size_t len, unsigned long *val, int *ovf)
+{
+    unsigned long v;
+    uint64_t x, nib, nh;
+    size_t j, n, bits;
+    int d;
+
+    v = 0;
+    *ovf = 0;
+    j = 0;
+    while (len - j >= 8) {
+        x = load8(s + j);
+        nh = hexNibbles(x, &nib);
+        n = (nh == 0) ? 8 : (size_t) __builtin_ctzll(nh) >> 3;
+        if (n == 0)
+            break;
+        if (n < 8)              /* Right-align, after zero nibbles */
+            nib <<= 64 - 8 * n;
+        bits = 4 * n;
+        if (bits >= ULONG_BITS) {
+            if (v != 0)
+                *ovf = 1;
+            v = hex8(nib);
+        } else {
+            if ((v >> (ULONG_BITS - bits)) != 0)
+                *ovf = 1;
+            v = (v << bits) | hex8(nib);
+        }
+        j += n;
+        if (n < 8) {
+            *val = v;
+            return j;
+        }
+    }
+
+    for (; j < len && (d = hexVal(s[j])) >= 0; j++) {
+        if ((v >> (ULONG_BITS - 4)) != 0)
+            *ovf = 1;
+        v = (v << 4) | d;
+    }
+
+    *val = v;
+    return j;
+}
+
+/* Finish a parse: 'start' is the offset of the first digit, and 'end'
+   the offset of the byte after the last digit */
+
+static int
+finish(size_t start, size_t end, size_t len, size_t *used, int ovf)
+{
+    if (used != NULL) {
+        *used = (end > start) ? end : 0;
+        if (end == start)
+            return PN_EMPTY;
+    } else {
+        if (end < len)
+            return PN_INVALID;
+        if (end == start)
+            return PN_EMPTY;
+    }
+    return ovf ? PN_RANGE : PN_OK;
+}
+
+/* Parse a decimal number, with optional sign, into a long */
+
+int
+pnLong(const char *s, size_t len, long *val, size_t *used)
+{
+    unsigned long mag;
+    size_t start, end;
+    int neg, ovf, res;
+
+    neg = 0;
+    start = 0;
+    if (len > 0 && (s[0] == '-' || s[0] == '+')) {
+        neg = (s[0] == '-');
+        start = 1;
+    }
+
+    end = start + scanDec(s + start, len - start, &mag, &ovf);
+    if (!ovf && mag > (unsigned long) LONG_MAX + neg)
+        ovf = 1;
+    res = finish(start, end, len, used, ovf);
+    if (res == PN_OK)
+        *val = (!neg) ? (long) mag : (mag == 0) ? 0 : -(long) (mag - 1) - 1;
+    return res;
+}
+
+/* Parse a decimal number, with optional sign, into an int */
+
+int
+pnInt(const char *s, size_t len, int *val, size_t *used)
+{
+    long v;
+    int res;
+
+    res = pnLong(s, len, &v, used);
+    if (res == PN_OK && (v > INT_MAX || v < INT_MIN))
+        res = PN_RANGE;
+    if (res == PN_OK)
+        *val = v;
+    return res;
+}
+
+/* Parse an unsigned decimal number into an unsigned long */
+
+int
+pnULong(const char *s, size_t len, unsigned long *val, size_t *used)
+{
+    unsigned long v;
+    size_t end;
+    int ovf, res;
+
+    end = scanDec(s, len, &v, &ovf);
+    res = finish(0, end, len, used, ovf);
+    if (res == PN_OK)
+        *val = v;
+    return res;
+}
+
+/* Parse a hexadecimal number, with optional "0x" prefix, into an
+   unsigned long. As with strtoul(), the prefix is treated as part of the
+   number only if it is followed by a hexadecimal digit. */
+
+int
+pnHex(const char *s, size_t len, unsigned long *val, size_t *used)
+{
+    unsigned long v;
+    size_t start, end;
+    int ovf, res;
+
+    start = 0;
+    if (len > 2 && s[0] == '0' && (s[1] | 0x20) == 'x' && hexVal(s[2]) >= 0)
+        start = 2;
+
+    end = start + scanHex(s + start, len - start, &v, &ovf);
+    res = finish(start, end, len, used, ovf);
+    if (res == PN_OK)
+        *val = v;
+    return res;
+}
+
+/* Return a string describing one of the PN_* return values */
+
+const char *
+pnStrerror(int err)
+{
+    switch (err) {
+    case PN_OK:         return "success";
+    case PN_EMPTY:      return "no digits";
+    case PN_INVALID:    return "nonnumeric characters";
+    case PN_RANGE:      return "value out of range";
+    default:            return "unknown error";
+    }
+}
@@ -0,0 +1,39 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 3 */
+
+/* parse_num.h
+
+   Header file for parse_num.c.
+*/
+#ifndef PARSE_NUM_H
+#define PARSE_NUM_H             /* Prevent accidental double inclusion */
+
+#include <stddef.h>
+
+/* Return values of the functions below */
+
+#define PN_OK           0       /* Success */
+#define PN_EMPTY        (-1)    /* No digits */
+#define PN_INVALID      (-2)    /* Character that is not part of number */
+#define PN_RANGE        (-3)    /* Value out of range for result type */
+
+int pnLong(const char *s, size_t len, long *val, size_t *used);
+
+int pnInt(const char *s, size_t len, int *val, size_t *used);
+
+int pnULong(const char *s, size_t len, unsigned long *val, size_t *used);
+
+int pnHex(const char *s, size_t len, unsigned long *val, size_t *used);
+
+const char *pnStrerror(int err);
+
+#endif
@@ -0,0 +1,266 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 3 */
+
+/* parse_num_bench.c
+
+   Compare the cost of parsing the numeric fields of a large buffer with
+   strtol() and strtoul() and with the functions in parse_num.c.
+
+   Usage: parse_num_bench [-n nums] [-d max-digits] [-o ops]
+
+        -n nums      Number of numbers in each input buffer
+                     (default: 1000000)
+        -d digits    Numbers have from 1 to 'digits' digits (default: 10;
+                     at most 18, and at most 16 for hexadecimal numbers)
+        -o ops       Numbers parsed in each repetition of each benchmark
+                     (default: 'nums')
+
+   The program builds two buffers of newline-separated numbers: signed
+   decimal numbers, and hexadecimal numbers in mixed case, half of them
+   with a "0x" prefix. It first checks that every function returns the
+   sum of the numbers that were written, and then reports the cost of
+   parsing a number with each function, in the common format of
+   lib/bench.c. pnLong() and pnHex() are called with 'used' non-NULL, so
+   that, like strtol() and strtoul(), they find the end of each field
+   themselves.
+
+   Try: ./parse_num_bench
+        ./parse_num_bench -d 4
+        ./parse_num_bench -d 18
+*/
+#include "parse_num.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+struct input {
+    char *buf;                  /* Newline-separated numbers */
+    size_t len;                 /* Bytes in 'buf', excluding final '\0' */
+    long nums;                  /* Number of numbers */
+    unsigned long sum;          /* Sum of numbers (modulo ULONG_MAX + 1) */
+};
+
+static struct input dec, hex;
+
+static volatile unsigned long sink;     /* Defeats dead code elimination */
+
+/* Build 'in', containing 'nums' numbers of up to 'maxDigits' digits */
+
+static void
+makeInput(struct input *in, long nums, int maxDigits, Boolean isHex)
+{
+    static const char xdigits[] = "0123456789abcdef0123456789ABCDEF";
+    unsigned long v;
+    char *p;
+    long j;
+    int d, k, c, neg;
+
+    in->buf = malloc(nums * (maxDigits + 3) + 1);
+    if (in->buf == NULL)
+        errExit("malloc");
+    in->nums = nums;
+    in->sum = 0;
+
+    p = in->buf;
+    for (j = 0; j < nums; j++) {
+        d = 1 + random() % maxDigits;
+        neg = !isHex && random() % 3 == 0;
+        if (neg)
+            *p++ = '-';
+        if (isHex && random() % 2 == 0) {
+            *p++ = '0';
+            *p++ = 'x';
+        }
+        v = 0;
+        for (k = 0; k < d; k++) {
+            c = random() % (isHex ? 16 : 10);
+            if (k == 0 && d > 1 && c == 0)
+                c = 1;
+            *p++ = isHex ? xdigits[c + 16 * (random() % 2)] : '0' + c;
+            v = v * (isHex ? 16 : 10) + c;
+        }
+        *p++ = '\n';
+        in->sum += neg ? -v : v;
+    }
+    *p = '\0';                  /* For strtol() and strtoul() */
+    in->len = p - in->buf;
+}
+
+/* Each of the following functions parses 'ops' numbers from the input
+   'arg', starting again at the beginning of the buffer if necessary */
+
+static void
+benchStrtol(long ops, void *arg)
+{
+    struct input *in = arg;
+    unsigned long sum;
+    const char *p;
+    char *end;
+    long j, k;
+
+    sum = 0;
+    p = in->buf;
+    for (j = 0, k = 0; j < ops; j++) {
+        errno = 0;
+        sum += strtol(p, &end, 10);
+        if (errno != 0 || end == p)
+            fatal("strtol() failed at offset %ld", (long) (p - in->buf));
+        p = end + 1;
+        if (++k == in->nums) {
+            p = in->buf;
+            k = 0;
+        }
+    }
+    sink = sum;
+}
+
+static void
+benchPnLong(long ops, void *arg)
+{
+    struct input *in = arg;
+    unsigned long sum;
+    const char *p;
+    size_t used;
+    long j, k, v;
+    int s;
+
+    sum = 0;
+    p = in->buf;
+    for (j = 0, k = 0; j < ops; j++) {
+        s = pnLong(p, in->buf + in->len - p, &v, &used);
+        if (s != PN_OK)
+            fatal("pnLong() failed at offset %ld: %s",
+                  (long) (p - in->buf), pnStrerror(s));
+        sum += v;
+        p += used + 1;
+        if (++k == in->nums) {
+            p = in->buf;
+            k = 0;
+        }
+    }
+    sink = sum;
+}
+
+static void
+benchStrtoul(long ops, void *arg)
+{
+    struct input *in = arg;
+    unsigned long sum;
+    const char *p;
+    char *end;
+    long j, k;
+
+    sum = 0;
+    p = in->buf;
+    for (j = 0, k = 0; j < ops; j++) {
+        errno = 0;
+        sum += strtoul(p, &end, 16);
+        if (errno != 0 || end == p)
+            fatal("strtoul() failed at offset %ld", (long) (p - in->buf));
+        p = end + 1;
+        if (++k == in->nums) {
+            p = in->buf;
+            k = 0;
+        }
+    }
+    sink = sum;
+}
+
+static void
+benchPnHex(long ops, void *arg)
+{
+    struct input *in = arg;
+    unsigned long sum, v;
+    const char *p;
+    size_t used;
+    long j, k;
+    int s;
+
+    sum = 0;
+    p = in->buf;
+    for (j = 0, k = 0; j < ops; j++) {
+        s = pnHex(p, in->buf + in->len - p, &v, &used);
+        if (s != PN_OK)
+            fatal("pnHex() failed at offset %ld: %s",
+                  (long) (p - in->buf), pnStrerror(s));
+        sum += v;
+        p += used + 1;
+        if (++k == in->nums) {
+            p = in->buf;
+            k = 0;
+        }
+    }
+    sink = sum;
+}
+
+/* Parse all of the numbers in 'in' with 'fn', and check the sum */
+
+static void
+check(const char *name, benchFn fn, struct input *in)
+{
+    fn(in->nums, in);
+    if (sink != in->sum)
+        fatal("%s: wrong result (sum %lx; expected %lx)", name,
+              (unsigned long) sink, in->sum);
+}
+
+static void
+run(const char *name, benchFn fn, struct input *in, long ops)
+{
+    struct benchResult res;
+
+    if (benchRun(name, fn, in, ops, NULL, &res) == -1)
+        errExit("benchRun");
+    benchReport(&res);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long nums, ops;
+    int opt, digits;
+
+    nums = 1000000;
+    digits = 10;
+    ops = 0;
+    while ((opt = getopt(argc, argv, "n:d:o:")) != -1) {
+        switch (opt) {
+        case 'n': nums = getLong(optarg, GN_GT_0, "-n");        break;
+        case 'd': digits = getInt(optarg, GN_GT_0, "-d");       break;
+        case 'o': ops = getLong(optarg, GN_GT_0, "-o");         break;
+        default:
+            usageErr("%s [-n nums] [-d max-digits] [-o ops]\n", argv[0]);
+        }
+    }
+    if (digits > 18)
+        cmdLineErr("At most 18 digits\n");
+    if (ops == 0)
+        ops = nums;
+
+    srandom(1);
+    makeInput(&dec, nums, digits, FALSE);
+    makeInput(&hex, nums, (digits > 16) ? 16 : digits, TRUE);
+
+    check("strtol", benchStrtol, &dec);
+    check("pnLong", benchPnLong, &dec);
+    check("strtoul", benchStrtoul, &hex);
+    check("pnHex", benchPnHex, &hex);
+
+    printf("Input: %ld numbers of up to %d digits (%ld bytes decimal, "
+           "%ld bytes hexadecimal)\n", nums, digits, (long) dec.len,
+           (long) hex.len);
+    run("strtol (base 10)", benchStrtol, &dec, ops);
+    run("pnLong", benchPnLong, &dec, ops);
+    run("strtoul (base 16)", benchStrtoul, &hex, ops);
+    run("pnHex", benchPnHex, &hex, ops);
+
+    exit(EXIT_SUCCESS);
+}
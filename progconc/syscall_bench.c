@@ -0,0 +1,369 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 3 */
+
+/* syscall_bench.c
+
+   A generalization of syscall_speed.c: measure the cost of each of a
+   table of common (and cheap) system calls, reporting the cost per call
+   as an average and as percentiles, so that results from different
+   kernels, machines, and mitigation settings can be compared.
+
+   Usage: syscall_bench [-n loops] [-b batch] [-s nfilters] [test...]
+
+        -n loops     Number of calls per test (default: 1000000)
+        -b batch     Calls per timed sample (default: 100)
+        -s nfilters  Install 'nfilters' seccomp filters before running the
+                     tests (default: 0); each filter is the one used in
+                     seccomp/seccomp_perf.c, which allows every system
+                     call except open()
+
+   If no tests are named, all are run. The available tests are:
+
+        func            A call to an empty function, for comparison
+        getppid         getppid()
+        read            read() of 1 byte from /dev/zero
+        write           write() of 1 byte to /dev/null
+        clock_vdso      clock_gettime(CLOCK_MONOTONIC), via the VDSO
+        clock_sys       clock_gettime(CLOCK_MONOTONIC), via syscall(2)
+        futex_wake      FUTEX_WAKE on a futex with no waiters
+        epoll_wait      epoll_wait() with a timeout of 0, on an empty
+                        epoll instance
+
+   Each test makes 'loops' calls, timed in samples of 'batch' calls; the
+   percentiles are of the per-call cost in each sample. The program
+   also displays the kernel version and the state of the CPU
+   vulnerability mitigations (from /sys/devices/system/cpu/vulnerabilities),
+   since these can greatly affect the cost of entering the kernel. To
+   compare mitigation settings, reboot with (for example)
+   "mitigations=off" on the kernel command line.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <linux/futex.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <linux/audit.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#define VULN_DIR "/sys/devices/system/cpu/vulnerabilities"
+
+static int zeroFd, nullFd, epfd;
+static uint32_t futexWord;
+
+/* Keep the compiler from optimizing away calls to func() */
+
+static __attribute__((noinline)) int
+func(void)
+{
+    __asm__ __volatile__("" ::: "memory");
+    return 1;
+}
+
+static void
+doFunc(void)
+{
+    func();
+}
+
+static void
+doGetppid(void)
+{
+    getppid();
+}
+
+static void
+doRead(void)
+{
+    char c;
+
+    if (read(zeroFd, &c, 1) != 1)
+        errExit("read");
+}
+
+static void
+doWrite(void)
+{
+    if (write(nullFd, "x", 1) != 1)
+        errExit("write");
+}
+
+static void
+doClockVdso(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+}
+
+static void
+doClockSys(void)
+{
+    struct timespec ts;
+
+    syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+}
+
+static void
+doFutexWake(void)
+{
+    syscall(SYS_futex, &futexWord, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void
+doEpollWait(void)
+{
+    struct epoll_event ev;
+
+    if (epoll_wait(epfd, &ev, 1, 0) == -1)
+        errExit("epoll_wait");
+}
+
+static const struct {
+    const char *name;
+    void (*fn)(void);
+} tests[] = {
+    { "func",           doFunc },
+    { "getppid",        doGetppid },
+    { "read",           doRead },
+    { "write",          doWrite },
+    { "clock_vdso",     doClockVdso },
+    { "clock_sys",      doClockSys },
+    { "futex_wake",     doFutexWake },
+    { "epoll_wait",     doEpollWait },
+};
+
+#define NTESTS (sizeof(tests) / sizeof(tests[0]))
+
+/* Install the filter from seccomp/seccomp_perf.c (which is adapted here
+   to the other architectures that seccomp supports) */
+
+#if defined(__x86_64__)
+#define SECCOMP_ARCH AUDIT_ARCH_X86_64
+#elif defined(__i386__)
+#define SECCOMP_ARCH AUDIT_ARCH_I386
+#elif defined(__aarch64__)
+#define SECCOMP_ARCH AUDIT_ARCH_AARCH64
+#endif
+
+#define X32_SYSCALL_BIT 0x40000000
+
+#ifndef SECCOMP_RET_KILL_PROCESS
+#define SECCOMP_RET_KILL_PROCESS SECCOMP_RET_KILL
+#endif
+
+#ifndef __NR_open                       /* E.g., aarch64 */
+#define __NR_open __NR_openat
+#endif
+
+static void
+installFilter(void)
+{
+#ifdef SECCOMP_ARCH
+    struct sock_filter filter[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                 (offsetof(struct seccomp_data, arch))),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SECCOMP_ARCH, 0, 2),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                 (offsetof(struct seccomp_data, nr))),
+
+        /* On x86-64, kill the process if this is an x32 system call;
+           elsewhere, the test is the same but never true */
+
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, X32_SYSCALL_BIT, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS),
+
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_open, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS)
+    };
+    struct sock_fprog prog = {
+        .len = (unsigned short) (sizeof(filter) / sizeof(filter[0])),
+        .filter = filter,
+    };
+
+    if (syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, 0, &prog) == -1)
+        errExit("seccomp");
+#else
+    fatal("seccomp filter not supported on this architecture");
+#endif
+}
+
+/* Show the kernel version and the mitigation state */
+
+static void
+showSystem(void)
+{
+    struct utsname uts;
+    struct dirent *dp;
+    char path[PATH_MAX], line[256];
+    DIR *dirp;
+    FILE *fp;
+
+    if (uname(&uts) == -1)
+        errExit("uname");
+    printf("Kernel: %s %s %s\n", uts.sysname, uts.release, uts.machine);
+
+    dirp = opendir(VULN_DIR);
+    if (dirp == NULL)
+        return;
+    printf("Mitigations:\n");
+    while ((dp = readdir(dirp)) != NULL) {
+        if (dp->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", VULN_DIR, dp->d_name);
+        fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+        if (fgets(line, sizeof(line), fp) != NULL)
+            printf("    %-26s %s", dp->d_name, line);
+        fclose(fp);
+    }
+    closedir(dirp);
+}
+
+static int
+cmpDouble(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+static double
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+runTest(int t, long loops, int batch, double *samples)
+{
+    void (*fn)(void) = tests[t].fn;
+    long nsamples, s;
+    double start, total;
+    int j;
+
+    nsamples = loops / batch;
+
+    for (j = 0; j < batch; j++)         /* Warm up */
+        fn();
+
+    total = 0;
+    for (s = 0; s < nsamples; s++) {
+        start = nowNs();
+        for (j = 0; j < batch; j++)
+            fn();
+        samples[s] = (nowNs() - start) / batch;
+        total += samples[s];
+    }
+
+    qsort(samples, nsamples, sizeof(double), cmpDouble);
+    printf("%-12s %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n", tests[t].name,
+            total / nsamples, samples[0], samples[nsamples / 2],
+            samples[nsamples * 90 / 100], samples[nsamples * 99 / 100],
+            samples[nsamples - 1]);
+}
+
+static void
+usageError(const char *progName)
+{
+    int t;
+
+    fprintf(stderr, "Usage: %s [-n loops] [-b batch] [-s nfilters] "
+                    "[test...]\n", progName);
+    fprintf(stderr, "Tests:");
+    for (t = 0; t < NTESTS; t++)
+        fprintf(stderr, " %s", tests[t].name);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    Boolean selected[NTESTS];
+    double *samples;
+    long loops;
+    int opt, batch, nfilters, t, j;
+
+    loops = 1000000;
+    batch = 100;
+    nfilters = 0;
+    while ((opt = getopt(argc, argv, "n:b:s:")) != -1) {
+        switch (opt) {
+        case 'n':   loops = getLong(optarg, GN_GT_0, "loops");          break;
+        case 'b':   batch = getInt(optarg, GN_GT_0, "batch");           break;
+        case 's':   nfilters = getInt(optarg, GN_NONNEG, "nfilters");   break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (loops < batch)
+        cmdLineErr("'loops' must be at least 'batch'\n");
+
+    for (t = 0; t < NTESTS; t++)
+        selected[t] = (optind == argc);
+    for (j = optind; j < argc; j++) {
+        for (t = 0; t < NTESTS; t++)
+            if (strcmp(argv[j], tests[t].name) == 0)
+                break;
+        if (t == NTESTS)
+            usageError(argv[0]);
+        selected[t] = TRUE;
+    }
+
+    zeroFd = open("/dev/zero", O_RDONLY);
+    if (zeroFd == -1)
+        errExit("open-/dev/zero");
+    nullFd = open("/dev/null", O_WRONLY);
+    if (nullFd == -1)
+        errExit("open-/dev/null");
+    epfd = epoll_create1(0);
+    if (epfd == -1)
+        errExit("epoll_create1");
+
+    samples = malloc((loops / batch) * sizeof(double));
+    if (samples == NULL)
+        errExit("malloc");
+
+    showSystem();
+
+    if (nfilters > 0) {
+        if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1)
+            errExit("prctl");
+        for (j = 0; j < nfilters; j++)
+            installFilter();
+    }
+    printf("Seccomp filters: %d\n\n", nfilters);
+
+    printf("%-12s %9s %9s %9s %9s %9s %9s\n", "test (ns)", "avg", "min",
+            "p50", "p90", "p99", "max");
+    for (t = 0; t < NTESTS; t++)
+        if (selected[t])
+            runTest(t, loops, batch, samples);
+
+    exit(EXIT_SUCCESS);
+}
@@ -21,17 +21,53 @@
    Compiling with -DNOSYSCALL causes a call to a simple function
    returning an integer, which can be used to compare the overhead
    of a simple function call against that of a system call.
+
+   Supplementary feature: with the '-B' option (syscall_speed -B
+   [numcalls]), the program instead measures itself using the bench.c
+   harness (so that time(1) is not needed), reporting the per-call cost
+   of both the function call and getppid(). This is the form used by
+   "make bench".
 */
+#include "bench.h"
 #include "tlpi_hdr.h"
 
-#ifdef NOSYSCALL
 static int myfunc() { return 1; }
-#endif
+
+static void
+benchFunc(long ops, void *arg)
+{
+    int (*volatile fp)() = myfunc;      /* Prevent inlining */
+
+    for (long j = 0; j < ops; j++)
+        fp();
+}
+
+static void
+benchGetppid(long ops, void *arg)
+{
+    for (long j = 0; j < ops; j++)
+        getppid();
+}
 
 int
 main(int argc, char *argv[])
 {
     int numCalls, j;
+    struct benchResult res;
+
+    if (argc > 1 && strcmp(argv[1], "-B") == 0) {
+        numCalls = (argc > 2) ? getInt(argv[2], GN_GT_0, "num-calls") :
+                                1000000;
+        if (benchRun("syscall_speed: function call", benchFunc, NULL,
+                     numCalls, NULL, &res) == -1)
+            errExit("benchRun");
+        benchReport(&res);
+        if (benchRun("syscall_speed: getppid()", benchGetppid, NULL,
+                     numCalls, NULL, &res) == -1)
+            errExit("benchRun");
+        benchReport(&res);
+        exit(EXIT_SUCCESS);
+    }
 
     numCalls = (argc > 1) ? getInt(argv[1], GN_GT_0, "num-calls") : 10000000;
 
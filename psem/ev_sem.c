@@ -0,0 +1,420 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 53 */
+
+/* ev_sem.c
+
+   A counting semaphore that, unlike a POSIX semaphore, can be waited
+   for in the same poll(), select(), or epoll_wait() call as sockets,
+   pipes, and timers, so that an event-driven program needn't dedicate a
+   thread to blocking in sem_wait().
+
+   There are two implementations:
+
+   ES_EVENTFD   The semaphore is an eventfd in semaphore mode (see
+                eventfd(2)): esPost() adds 1 to its counter, and each
+                read() subtracts 1, so that the descriptor is readable
+                exactly when the semaphore's value is nonzero. Every
+                operation is a system call.
+
+   ES_SHARED    The semaphore's value is a counter in a small memfd
+                mapping, which esPost() and esTryWait() change with
+                atomic instructions, making no system call unless a
+                process needs to sleep or be woken; esWait() sleeps with
+                FUTEX_WAIT on the counter (as glibc's sem_wait() does).
+                Processes monitoring the semaphore with epoll (or poll()
+                or select()) instead register with esWatch(), and while
+                any process is registered, esPost() also adds 1 to an
+                eventfd, the "doorbell", making it readable.
+
+   Either way, a process that finds esFd(s) readable should call
+   esTryWait() until it fails with EAGAIN (the descriptor may be
+   readable even though another process has already taken the unit that
+   made it so). With ES_SHARED, the doorbell is cleared by esTryWait()
+   only when it finds the value to be 0, so that level-triggered
+   notification is sufficient. A process that starts watching an
+   ES_SHARED semaphore should call esTryWait() once after esWatch(), in
+   case the value was already nonzero.
+
+   The semaphore can be shared with child processes created after
+   esInit(), and with other processes by passing them its descriptors
+   (esFd(s), and, for ES_SHARED, s->memfd) with sendfd() (see
+   scm_functions.c); the recipient calls esAttach().
+
+   As with POSIX semaphores, esPost() fails with EOVERFLOW if the value
+   would exceed SEM_VALUE_MAX; esWait() and esTimedWait() fail with EINTR
+   if interrupted by a signal handler; esTryWait() fails with EAGAIN if
+   the value is 0; and esTimedWait() fails with ETIMEDOUT once the
+   absolute CLOCK_REALTIME time 'abstime' has passed (or with EINVAL if
+   'abstime' is invalid and the call would block).
+
+   Functions return 0 on success, and -1 with errno set on error.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "ev_sem.h"             /* Declares functions defined here */
+
+#ifndef SEM_VALUE_MAX
+#define SEM_VALUE_MAX INT_MAX
+#endif
+
+static int
+mapShared(struct evSem *s)
+{
+    s->shm = mmap(NULL, sizeof(struct esShared), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, s->memfd, 0);
+    if (s->shm == MAP_FAILED) {
+        s->shm = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Create a semaphore of kind 'kind' (ES_EVENTFD or ES_SHARED), with the
+   initial value 'value' */
+
+int
+esInit(struct evSem *s, int kind, unsigned int value)
+{
+    int savedErrno;
+
+    if ((kind != ES_EVENTFD && kind != ES_SHARED) || value > SEM_VALUE_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    s->kind = kind;
+    s->memfd = -1;
+    s->shm = NULL;
+    s->efd = eventfd((kind == ES_EVENTFD) ? value : 0,
+                     EFD_CLOEXEC | EFD_NONBLOCK |
+                     ((kind == ES_EVENTFD) ? EFD_SEMAPHORE : 0));
+    if (s->efd == -1)
+        return -1;
+    if (kind == ES_EVENTFD)
+        return 0;
+
+    s->memfd = memfd_create("ev_sem", MFD_CLOEXEC);
+    if (s->memfd == -1 ||
+            ftruncate(s->memfd, sizeof(struct esShared)) == -1 ||
+            mapShared(s) == -1) {
+        savedErrno = errno;
+        esDestroy(s);
+        errno = savedErrno;
+        return -1;
+    }
+    s->shm->value = value;
+    s->shm->sleepers = s->shm->watchers = 0;
+    return 0;
+}
+
+/* Use the semaphore whose descriptors ('memfd' is ignored for
+   ES_EVENTFD) were received from another process */
+
+int
+esAttach(struct evSem *s, int kind, int efd, int memfd)
+{
+    if (kind != ES_EVENTFD && kind != ES_SHARED) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    s->kind = kind;
+    s->efd = efd;
+    s->memfd = (kind == ES_SHARED) ? memfd : -1;
+    s->shm = NULL;
+    if (kind == ES_SHARED && mapShared(s) == -1)
+        return -1;
+
+    /* The descriptors may have come without O_NONBLOCK */
+
+    if (fcntl(efd, F_SETFL, fcntl(efd, F_GETFL) | O_NONBLOCK) == -1)
+        return -1;
+    return 0;
+}
+
+static int
+readCounter(int fd)
+{
+    uint64_t val;
+
+    while (read(fd, &val, sizeof(val)) != sizeof(val))
+        if (errno != EINTR)
+            return -1;
+    return 0;
+}
+
+static int
+writeCounter(int fd, uint64_t val)
+{
+    while (write(fd, &val, sizeof(val)) != sizeof(val))
+        if (errno != EINTR)
+            return -1;
+    return 0;
+}
+
+/* ES_SHARED: decrement the value if it's nonzero. Returns 1 if it was
+   decremented, or 0 if it was 0. */
+
+static int
+tryDecrement(struct esShared *shm)
+{
+    uint32_t v;
+
+    v = __atomic_load_n(&shm->value, __ATOMIC_SEQ_CST);
+    while (v > 0)
+        if (__atomic_compare_exchange_n(&shm->value, &v, v - 1, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            return 1;
+    return 0;
+}
+
+int
+esPost(struct evSem *s)
+{
+    struct esShared *shm = s->shm;
+    uint32_t v;
+
+    if (s->kind == ES_EVENTFD) {
+
+        /* The eventfd counter can hold far more than SEM_VALUE_MAX, so
+           (unlike sem_post()) this doesn't detect overflow */
+
+        return writeCounter(s->efd, 1);
+    }
+
+    v = __atomic_load_n(&shm->value, __ATOMIC_SEQ_CST);
+    do {
+        if (v >= SEM_VALUE_MAX) {
+            errno = EOVERFLOW;
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&shm->value, &v, v + 1, 0,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+    /* A waiter increments 'sleepers' (or 'watchers') before checking
+       the value for the last time; since we incremented the value
+       before looking at these, either it sees our increment, or we see
+       it, and wake it */
+
+    if (__atomic_load_n(&shm->sleepers, __ATOMIC_SEQ_CST) > 0 &&
+            syscall(SYS_futex, &shm->value, FUTEX_WAKE, 1,
+                    NULL, NULL, 0) == -1)
+        return -1;
+    if (__atomic_load_n(&shm->watchers, __ATOMIC_SEQ_CST) > 0)
+        return writeCounter(s->efd, 1);
+    return 0;
+}
+
+int
+esTryWait(struct evSem *s)
+{
+    struct esShared *shm = s->shm;
+
+    if (s->kind == ES_EVENTFD)
+        return readCounter(s->efd);     /* EAGAIN if value is 0 */
+
+    if (tryDecrement(shm))
+        return 0;
+
+    /* The value is 0: clear the doorbell, and check again, in case a
+       post came before we cleared it */
+
+    if (__atomic_load_n(&shm->watchers, __ATOMIC_SEQ_CST) > 0 &&
+            readCounter(s->efd) == -1 && errno != EAGAIN)
+        return -1;
+    if (tryDecrement(shm))
+        return 0;
+
+    errno = EAGAIN;
+    return -1;
+}
+
+/* ES_EVENTFD: wait until the eventfd is readable or 'abstime' (if not
+   NULL) passes. Returns 0, or -1 on error. */
+
+static int
+pollUntil(int fd, const struct timespec *abstime)
+{
+    struct timespec now, rel;
+    struct pollfd pfd;
+    int n;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (abstime == NULL) {
+        n = poll(&pfd, 1, -1);
+    } else {
+        if (clock_gettime(CLOCK_REALTIME, &now) == -1)
+            return -1;
+        rel.tv_sec = abstime->tv_sec - now.tv_sec;
+        rel.tv_nsec = abstime->tv_nsec - now.tv_nsec;
+        if (rel.tv_nsec < 0) {
+            rel.tv_sec--;
+            rel.tv_nsec += 1000000000;
+        }
+        if (rel.tv_sec < 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        n = ppoll(&pfd, 1, &rel, NULL);
+        if (n == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+    return (n == -1) ? -1 : 0;
+}
+
+/* Wait (if 'abstime' is NULL, indefinitely) to decrement the value */
+
+static int
+waitUntil(struct evSem *s, const struct timespec *abstime)
+{
+    struct esShared *shm = s->shm;
+    int s1, savedErrno;
+
+    for (;;) {
+        if (esTryWait(s) == 0)
+            return 0;
+        if (errno != EAGAIN)
+            return -1;
+
+        if (abstime != NULL && (abstime->tv_nsec < 0 ||
+                                abstime->tv_nsec >= 1000000000)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (s->kind == ES_EVENTFD) {
+            if (pollUntil(s->efd, abstime) == -1)
+                return -1;
+            continue;
+        }
+
+        __atomic_add_fetch(&shm->sleepers, 1, __ATOMIC_SEQ_CST);
+        if (abstime == NULL)
+            s1 = syscall(SYS_futex, &shm->value, FUTEX_WAIT, 0,
+                         NULL, NULL, 0);
+        else
+            s1 = syscall(SYS_futex, &shm->value,
+                         FUTEX_WAIT_BITSET | FUTEX_CLOCK_REALTIME, 0,
+                         abstime, NULL, FUTEX_BITSET_MATCH_ANY);
+        savedErrno = errno;
+        __atomic_sub_fetch(&shm->sleepers, 1, __ATOMIC_SEQ_CST);
+        if (s1 == -1 && savedErrno != EAGAIN) {
+            errno = savedErrno;         /* EINTR or ETIMEDOUT */
+            return -1;
+        }
+    }
+}
+
+int
+esWait(struct evSem *s)
+{
+    return waitUntil(s, NULL);
+}
+
+int
+esTimedWait(struct evSem *s, const struct timespec *abstime)
+{
+    return waitUntil(s, abstime);
+}
+
+/* Return the current value in '*sval'. For ES_EVENTFD, the value is
+   obtained from the "eventfd-count" field of /proc/self/fdinfo/FD. */
+
+int
+esGetValue(struct evSem *s, int *sval)
+{
+    char path[64], line[128];
+    unsigned long long cnt;
+    FILE *fp;
+    int found;
+
+    if (s->kind == ES_SHARED) {
+        *sval = __atomic_load_n(&s->shm->value, __ATOMIC_SEQ_CST);
+        return 0;
+    }
+
+    snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", s->efd);
+    fp = fopen(path, "re");
+    if (fp == NULL)
+        return -1;
+    found = 0;
+    while (!found && fgets(line, sizeof(line), fp) != NULL)
+        found = sscanf(line, "eventfd-count: %llx", &cnt) == 1;
+    fclose(fp);
+    if (!found) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    *sval = (cnt > SEM_VALUE_MAX) ? SEM_VALUE_MAX : cnt;
+    return 0;
+}
+
+/* Return the descriptor to monitor for readability */
+
+int
+esFd(const struct evSem *s)
+{
+    return s->efd;
+}
+
+/* Tell ES_SHARED posters that the caller is starting ('on' nonzero) or
+   stopping monitoring esFd(s); each call with 'on' nonzero must be
+   matched by one with 'on' zero. (A no-op for ES_EVENTFD, whose
+   descriptor always reflects the value.) */
+
+int
+esWatch(struct evSem *s, int on)
+{
+    if (s->kind == ES_SHARED) {
+        if (on)
+            __atomic_add_fetch(&s->shm->watchers, 1, __ATOMIC_SEQ_CST);
+        else
+            __atomic_sub_fetch(&s->shm->watchers, 1, __ATOMIC_SEQ_CST);
+    }
+    return 0;
+}
+
+/* Free the caller's resources for the semaphore (other processes that
+   share it are unaffected) */
+
+int
+esDestroy(struct evSem *s)
+{
+    int s1;
+
+    s1 = 0;
+    if (s->shm != NULL && munmap(s->shm, sizeof(struct esShared)) == -1)
+        s1 = -1;
+    if (s->memfd != -1 && close(s->memfd) == -1)
+        s1 = -1;
+    if (s->efd != -1 && close(s->efd) == -1)
+        s1 = -1;
+    s->shm = NULL;
+    s->memfd = s->efd = -1;
+    return s1;
+}
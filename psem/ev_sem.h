@@ -0,0 +1,81 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 53 */
+
+/* ev_sem.h
+
+   Header file for ev_sem.c.
+
+   A counting semaphore that can be waited for with poll(), select(), or
+   epoll, and shared between processes. The operations correspond to
+   those on POSIX semaphores:
+
+        create (before fork()):         esInit(s, kind, value)
+        use descriptors received
+            from another process:       esAttach(s, kind, efd, memfd)
+        sem_post():                     esPost(s)
+        sem_wait():                     esWait(s)
+        sem_trywait():                  esTryWait(s)
+        sem_timedwait():                esTimedWait(s, abstime)
+        sem_getvalue():                 esGetValue(s, &sval)
+        sem_destroy() / sem_close():    esDestroy(s)
+
+   and, for use with poll(), select(), and epoll:
+
+        descriptor to monitor:          esFd(s)
+        start or stop monitoring:       esWatch(s, on)
+*/
+#ifndef EV_SEM_H
+#define EV_SEM_H                /* Prevent accidental double inclusion */
+
+#include <stdint.h>
+#include <time.h>
+
+/* Kinds of semaphore, for esInit() */
+
+#define ES_EVENTFD 1            /* An eventfd in semaphore mode */
+#define ES_SHARED  2            /* Counter and futex in shared memory,
+                                   with an eventfd as a doorbell */
+
+struct esShared {               /* ES_SHARED: in a shared mapping */
+    uint32_t value;             /* Semaphore value; the futex word */
+    uint32_t sleepers;          /* Processes blocked in esWait() */
+    uint32_t watchers;          /* Callers of esWatch(s, 1) */
+};
+
+struct evSem {
+    int kind;
+    int efd;                    /* eventfd */
+    int memfd;                  /* ES_SHARED: holds 'shm' */
+    struct esShared *shm;       /* ES_SHARED */
+};
+
+int esInit(struct evSem *s, int kind, unsigned int value);
+
+int esAttach(struct evSem *s, int kind, int efd, int memfd);
+
+int esPost(struct evSem *s);
+
+int esWait(struct evSem *s);
+
+int esTryWait(struct evSem *s);
+
+int esTimedWait(struct evSem *s, const struct timespec *abstime);
+
+int esGetValue(struct evSem *s, int *sval);
+
+int esFd(const struct evSem *s);
+
+int esWatch(struct evSem *s, int on);
+
+int esDestroy(struct evSem *s);
+
+#endif
@@ -0,0 +1,261 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 53 */
+
+/* ev_sem_bench.c
+
+   Compare POSIX semaphores with the semaphores of ev_sem.c.
+
+   Usage: ev_sem_bench [-n iters] [-m methods]
+
+        -n iters    Iterations of each measurement (default: 100000)
+        -m methods  Methods to measure (default: pesES):
+                      p  POSIX unnamed semaphore (sem_init() with
+                         'pshared' nonzero, in a shared mapping)
+                      e  ES_EVENTFD, with esWait()
+                      s  ES_SHARED, with esWait()
+                      E  ES_EVENTFD, waiting with epoll_wait()
+                      S  ES_SHARED, waiting with epoll_wait()
+
+   For each method, the program reports:
+
+   - the cost of a post followed by a trywait, in one process, with no
+     waiters (for E and S, with the process watching the semaphore, as
+     an event-driven program would be);
+
+   - the wakeup latency: the parent and a child process pass control
+     back and forth, each posting a semaphore that the other is waiting
+     for and then waiting for its own, and the time per pass is shown
+     (this includes a context switch on a single CPU).
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <semaphore.h>
+#include <time.h>
+#include "ev_sem.h"
+#include "tlpi_hdr.h"
+
+struct bsem {                   /* A semaphore of any of the methods */
+    int method;
+    sem_t *psem;                /* 'p' */
+    struct evSem es;            /* 'e', 's', 'E', 'S' */
+    int epfd;                   /* 'E', 'S': this process's epoll FD */
+};
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+bInit(struct bsem *b, int method)
+{
+    b->method = method;
+    b->epfd = -1;
+    if (method == 'p') {
+        b->psem = mmap(NULL, sizeof(sem_t), PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (b->psem == MAP_FAILED)
+            errExit("mmap");
+        if (sem_init(b->psem, 1, 0) == -1)
+            errExit("sem_init");
+    } else {
+        if (esInit(&b->es, (method == 'e' || method == 'E') ?
+                   ES_EVENTFD : ES_SHARED, 0) == -1)
+            errExit("esInit");
+    }
+}
+
+/* Start monitoring 'b' with epoll, if the method requires. Each process
+   must have its own epoll instance, so this is called after fork(). */
+
+static void
+bWatch(struct bsem *b)
+{
+    struct epoll_event ev;
+
+    if (b->method != 'E' && b->method != 'S')
+        return;
+    b->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (b->epfd == -1)
+        errExit("epoll_create1");
+    ev.events = EPOLLIN;
+    ev.data.ptr = b;
+    if (epoll_ctl(b->epfd, EPOLL_CTL_ADD, esFd(&b->es), &ev) == -1)
+        errExit("epoll_ctl");
+    esWatch(&b->es, 1);
+}
+
+static void
+bUnwatch(struct bsem *b)
+{
+    if (b->epfd == -1)
+        return;
+    esWatch(&b->es, 0);
+    close(b->epfd);
+    b->epfd = -1;
+}
+
+static void
+bPost(struct bsem *b)
+{
+    if (b->method == 'p') {
+        if (sem_post(b->psem) == -1)
+            errExit("sem_post");
+    } else if (esPost(&b->es) == -1) {
+        errExit("esPost");
+    }
+}
+
+/* Returns 0 on success, or -1 if the value was 0 */
+
+static int
+bTryWait(struct bsem *b)
+{
+    int s;
+
+    s = (b->method == 'p') ? sem_trywait(b->psem) : esTryWait(&b->es);
+    if (s == -1 && errno != EAGAIN)
+        errExit("trywait");
+    return s;
+}
+
+static void
+bWait(struct bsem *b)
+{
+    struct epoll_event ev;
+
+    switch (b->method) {
+    case 'p':
+        while (sem_wait(b->psem) == -1)
+            if (errno != EINTR)
+                errExit("sem_wait");
+        break;
+
+    case 'e':
+    case 's':
+        while (esWait(&b->es) == -1)
+            if (errno != EINTR)
+                errExit("esWait");
+        break;
+
+    default:            /* As an event loop would: wait for readiness,
+                           then take a unit if one is still there */
+        while (bTryWait(b) == -1)
+            if (epoll_wait(b->epfd, &ev, 1, -1) == -1 && errno != EINTR)
+                errExit("epoll_wait");
+        break;
+    }
+}
+
+static void
+bDestroy(struct bsem *b)
+{
+    if (b->method == 'p') {
+        sem_destroy(b->psem);
+        munmap(b->psem, sizeof(sem_t));
+    } else {
+        esDestroy(&b->es);
+    }
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n iters] [-m methods]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct bsem ping, pong;
+    const char *methods, *m;
+    long long t0, postTry, pass;
+    int opt, iters, j;
+    pid_t child;
+
+    iters = 100000;
+    methods = "pesES";
+    while ((opt = getopt(argc, argv, "n:m:")) != -1) {
+        switch (opt) {
+        case 'n':   iters = getInt(optarg, GN_GT_0, "-n");  break;
+        case 'm':   methods = optarg;                       break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+    if (methods[strspn(methods, "pesES")] != '\0')
+        cmdLineErr("Bad methods: %s\n", methods);
+
+    printf("%-6s %14s %10s\n", "method", "post+try (ns)", "wake (ns)");
+    for (m = methods; *m != '\0'; m++) {
+        bInit(&ping, *m);
+        bInit(&pong, *m);
+
+        /* Uncontended: post and take in one process */
+
+        bWatch(&ping);
+        t0 = nowNs();
+        for (j = 0; j < iters; j++) {
+            bPost(&ping);
+            if (bTryWait(&ping) == -1)
+                fatal("trywait found no unit");
+        }
+        postTry = (nowNs() - t0) / iters;
+        bUnwatch(&ping);
+
+        /* Ping-pong between two processes */
+
+        switch (child = fork()) {
+        case -1:
+            errExit("fork");
+
+        case 0:
+            bWatch(&ping);
+            for (j = 0; j < iters; j++) {
+                bWait(&ping);
+                bPost(&pong);
+            }
+            bUnwatch(&ping);
+            _exit(EXIT_SUCCESS);
+
+        default:
+            bWatch(&pong);
+            t0 = nowNs();
+            for (j = 0; j < iters; j++) {
+                bPost(&ping);
+                bWait(&pong);
+            }
+            pass = (nowNs() - t0) / (2LL * iters);
+            bUnwatch(&pong);
+            if (waitpid(child, NULL, 0) == -1)
+                errExit("waitpid");
+        }
+
+        printf("%-6c %14lld %10lld\n", *m, postTry, pass);
+        fflush(stdout);
+        bDestroy(&ping);
+        bDestroy(&pong);
+    }
+
+    exit(EXIT_SUCCESS);
+}
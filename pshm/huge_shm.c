@@ -0,0 +1,234 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* huge_shm.c
+
+   Functions for creating shared memory backed by huge pages, either as
+   named files in a hugetlbfs file system (which play the role of POSIX
+   shared memory objects, whose names are files in the tmpfs file system
+   mounted at /dev/shm), or as anonymous files created by
+   memfd_create(MFD_HUGETLB).
+
+   hugetlbfs files have some restrictions compared with POSIX shared
+   memory objects: their size (as set by ftruncate()) is rounded up to a
+   multiple of the huge page size, and they can't be accessed using
+   read() and write(), only via mmap(). Huge pages must have been
+   reserved, e.g., via /proc/sys/vm/nr_hugepages, or
+   /sys/kernel/mm/hugepages/hugepages-<size>kB/nr_hugepages; otherwise,
+   mmap() (or, when the pages are touched, the process) fails.
+
+   This code is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <mntent.h>
+#include "huge_shm.h"
+#include "tlpi_hdr.h"
+
+#ifndef MFD_HUGE_SHIFT
+#define MFD_HUGE_SHIFT 26
+#endif
+
+/* Convert a size such as "4096", "4K", "2M", or "1G" to a number of
+   bytes. Return -1 (with errno set to EINVAL) if 'str' is invalid. */
+
+long
+hugeParseSize(const char *str)
+{
+    char *end;
+    long val;
+
+    errno = 0;
+    val = strtol(str, &end, 10);
+    if (errno != 0 || end == str || val <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    switch (*end) {
+    case 'k': case 'K': val <<= 10; end++; break;
+    case 'm': case 'M': val <<= 20; end++; break;
+    case 'g': case 'G': val <<= 30; end++; break;
+    default:                               break;
+    }
+
+    if (*end != '\0' && strcmp(end, "B") != 0 && strcmp(end, "iB") != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    return val;
+}
+
+/* Return the default huge page size (from the "Hugepagesize" line of
+   /proc/meminfo), or -1 on error */
+
+long
+hugeDefaultPageSize(void)
+{
+    FILE *fp;
+    char line[256];
+    long kB;
+
+    fp = fopen("/proc/meminfo", "r");
+    if (fp == NULL)
+        return -1;
+
+    kB = -1;
+    while (fgets(line, sizeof(line), fp) != NULL)
+        if (sscanf(line, "Hugepagesize: %ld kB", &kB) == 1)
+            break;
+    fclose(fp);
+
+    if (kB <= 0) {
+        errno = ENOENT;
+        return -1;
+    }
+    return kB * 1024;
+}
+
+size_t
+hugeRoundUp(size_t len, long pageSize)
+{
+    return (len + pageSize - 1) / pageSize * pageSize;
+}
+
+/* Return the mount point of a hugetlbfs file system whose page size is
+   'pageSize' (0 means the default huge page size). The environment
+   variable HUGETLBFS_DIR, if set, overrides the search of /proc/mounts.
+   Returns NULL (with errno set to ENOENT) if there is no such mount. */
+
+const char *
+hugetlbfsDir(long pageSize)
+{
+    static char dir[PATH_MAX];
+    FILE *fp;
+    struct mntent *ent;
+    char *opt;
+    long defSize, mntSize;
+    int found;
+
+    if (getenv("HUGETLBFS_DIR") != NULL)
+        return getenv("HUGETLBFS_DIR");
+
+    defSize = hugeDefaultPageSize();
+    if (pageSize == 0)
+        pageSize = defSize;
+
+    fp = setmntent("/proc/mounts", "r");
+    if (fp == NULL)
+        return NULL;
+
+    found = 0;
+    while (!found && (ent = getmntent(fp)) != NULL) {
+        if (strcmp(ent->mnt_type, "hugetlbfs") != 0)
+            continue;
+
+        /* A mount without a "pagesize=" option uses the default size */
+
+        opt = hasmntopt(ent, "pagesize");
+        if (opt == NULL) {
+            mntSize = defSize;
+        } else {
+            opt += strlen("pagesize=");
+            opt[strcspn(opt, ",")] = '\0';
+            mntSize = hugeParseSize(opt);
+        }
+
+        if (mntSize == pageSize) {
+            snprintf(dir, sizeof(dir), "%s", ent->mnt_dir);
+            found = 1;
+        }
+    }
+    endmntent(fp);
+
+    if (!found) {
+        errno = ENOENT;
+        return NULL;
+    }
+    return dir;
+}
+
+/* Build the pathname of the hugetlbfs file corresponding to the shared
+   memory object 'name' (which, as for shm_open(), should begin with a
+   slash). Return -1 on error. */
+
+static int
+hugeShmPath(const char *name, long pageSize, char *path, size_t len)
+{
+    const char *dir;
+
+    dir = hugetlbfsDir(pageSize);
+    if (dir == NULL)
+        return -1;
+
+    while (*name == '/')
+        name++;
+    if (*name == '\0' || strchr(name, '/') != NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (snprintf(path, len, "%s/%s", dir, name) >= len) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+/* Analogous to shm_open(), but opens (and, with O_CREAT, creates) a file
+   in a hugetlbfs file system with pages of size 'pageSize' (0 means
+   the default huge page size) */
+
+int
+hugeShmOpen(const char *name, int flags, mode_t perms, long pageSize)
+{
+    char path[PATH_MAX];
+
+    if (hugeShmPath(name, pageSize, path, sizeof(path)) == -1)
+        return -1;
+    return open(path, flags | O_CLOEXEC, perms);
+}
+
+int
+hugeShmUnlink(const char *name, long pageSize)
+{
+    char path[PATH_MAX];
+
+    if (hugeShmPath(name, pageSize, path, sizeof(path)) == -1)
+        return -1;
+    return unlink(path);
+}
+
+/* Create an anonymous file backed by huge pages of size 'pageSize' (0
+   means the default huge page size). 'pageSize' must be a power of 2. */
+
+int
+hugeMemfd(const char *name, long pageSize)
+{
+    unsigned int flags;
+    int shift;
+
+    flags = MFD_CLOEXEC | MFD_HUGETLB;
+    if (pageSize != 0) {
+        if ((pageSize & (pageSize - 1)) != 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        for (shift = 0; (1L << shift) < pageSize; shift++)
+            continue;
+        flags |= (unsigned int) shift << MFD_HUGE_SHIFT;
+    }
+
+    return memfd_create(name, flags);
+}
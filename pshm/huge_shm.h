@@ -0,0 +1,36 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* huge_shm.h
+
+   Header file for huge_shm.c.
+*/
+#ifndef HUGE_SHM_H
+#define HUGE_SHM_H              /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+
+long hugeParseSize(const char *str);
+
+long hugeDefaultPageSize(void);
+
+size_t hugeRoundUp(size_t len, long pageSize);
+
+const char *hugetlbfsDir(long pageSize);
+
+int hugeShmOpen(const char *name, int flags, mode_t perms, long pageSize);
+
+int hugeShmUnlink(const char *name, long pageSize);
+
+int hugeMemfd(const char *name, long pageSize);
+
+#endif
@@ -0,0 +1,368 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* pshm_heap_hash.c
+
+   Demonstrate shm_heap.c: several processes concurrently update a hash
+   table that lives in a shared memory heap, each with the heap mapped at
+   its own address.
+
+   Usage: pshm_heap_hash [-p procs] [-n ops] [-k keys] [-s max-size]
+                         [-m heap-MiB] [-K] [-v] [shm-name]
+
+        -p procs      Number of worker processes (default: 4)
+        -n ops        Operations per worker (default: 200000)
+        -k keys       Number of distinct keys (default: 10000)
+        -s max-size   Maximum size of a value (default: 256; sizes above
+                      about 4 kB exercise the heap's large-block list)
+        -m heap-MiB   Size of the heap (default: 64)
+        -K            Kill one worker (with SIGKILL) part way through
+        -v            Show where each process mapped the heap
+
+   If 'shm-name' is given, the heap is created in that POSIX shared
+   memory object (which is removed at the end); otherwise, it is created
+   in a memfd, whose file descriptor the workers inherit.
+
+   The parent creates the heap, and in it a hash table whose buckets are
+   protected by striped robust mutexes, and leaves the table's offset in
+   root slot 0. Each worker attaches to the heap again (so that it is
+   mapped at a different address from the one inherited from the
+   parent), finds the table through the root slot, and performs random
+   operations on it: putting a value (allocated from the heap, and
+   replacing and freeing any previous value for the key), getting a
+   value (and checking its contents), and deleting a value (and freeing
+   it). Entries are linked by offset, so that any process can follow the
+   links. At the end, the parent checks every entry in the table, and
+   shows the operation rate and the state of the heap.
+
+   With -K, a worker is killed, possibly while holding a lock; the other
+   processes recover the locks (see "recoveries" in the output), and
+   the memory that the worker had cached is leaked.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include "shm_heap.h"
+#include "tlpi_hdr.h"
+
+#define NLOCKS 64               /* Bucket lock stripes */
+#define MAX_PROCS 64
+
+struct entry {
+    shmOff next;                /* Next entry in the bucket's chain */
+    uint32_t key;
+    uint32_t len;               /* Bytes in 'data' */
+    uint32_t fill;              /* data[j] == (unsigned char) (fill + j) */
+    unsigned char data[];
+};
+
+struct workerStats {
+    long puts, gets, dels, misses, bad;
+};
+
+struct table {
+    uint32_t nbuckets;
+    pthread_mutex_t locks[NLOCKS];
+    struct workerStats stats[MAX_PROCS];
+    shmOff buckets[];           /* Heads of the chains */
+};
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static Boolean
+entryOk(const struct entry *e, uint32_t key)
+{
+    uint32_t j;
+
+    if (e->key != key)
+        return FALSE;
+    for (j = 0; j < e->len; j++)
+        if (e->data[j] != (unsigned char) (e->fill + j))
+            return FALSE;
+    return TRUE;
+}
+
+static void
+lockBucket(struct shmHeap *h, struct table *t, uint32_t b)
+{
+    if (shmMutexLock(h, &t->locks[b % NLOCKS]) == -1)
+        errExit("shmMutexLock");
+}
+
+static void
+unlockBucket(struct table *t, uint32_t b)
+{
+    pthread_mutex_unlock(&t->locks[b % NLOCKS]);
+}
+
+/* Body of a worker process. 'fd' refers to the heap's segment. */
+
+static void
+worker(int fd, int idx, long ops, int keys, int maxSize, Boolean verbose)
+{
+    struct workerStats *ws;
+    struct entry *e, *old, *prev;
+    struct shmHeap *h;
+    struct table *t;
+    unsigned int seed;
+    uint32_t key, b, len, j;
+    shmOff *link;
+    long n;
+
+    h = shmHeapAttach(fd);
+    if (h == NULL)
+        errExit("shmHeapAttach");
+    if (verbose) {
+        printf("worker %d: heap mapped at %p\n", idx, (void *) h->base);
+        fflush(stdout);
+    }
+
+    t = shmPtr(h, shmHeapGetRoot(h, 0));
+    ws = &t->stats[idx];
+    seed = idx + 1;
+
+    for (n = 0; n < ops; n++) {
+        key = rand_r(&seed) % keys;
+        b = key % t->nbuckets;
+
+        switch (rand_r(&seed) % 4) {
+        case 0:
+        case 1:                         /* Put */
+            len = 1 + rand_r(&seed) % maxSize;
+            e = shmAlloc(h, sizeof(struct entry) + len);
+            if (e == NULL)
+                errExit("shmAlloc");
+            e->key = key;
+            e->len = len;
+            e->fill = rand_r(&seed);
+            for (j = 0; j < len; j++)
+                e->data[j] = (unsigned char) (e->fill + j);
+
+            lockBucket(h, t, b);
+            old = NULL;
+            for (link = &t->buckets[b]; *link != 0; link = &old->next) {
+                old = shmPtr(h, *link);
+                if (old->key == key)
+                    break;
+                old = NULL;
+            }
+            e->next = (old != NULL) ? old->next : 0;
+            *link = shmOffOf(h, e);     /* Replaces 'old', or appends */
+            unlockBucket(t, b);
+
+            shmFree(h, old);
+            ws->puts++;
+            break;
+
+        case 2:                         /* Get */
+            lockBucket(h, t, b);
+            for (e = shmPtr(h, t->buckets[b]); e != NULL;
+                    e = shmPtr(h, e->next))
+                if (e->key == key)
+                    break;
+            if (e == NULL)
+                ws->misses++;
+            else if (!entryOk(e, key))
+                ws->bad++;
+            unlockBucket(t, b);
+            ws->gets++;
+            break;
+
+        case 3:                         /* Delete */
+            lockBucket(h, t, b);
+            prev = NULL;
+            for (e = shmPtr(h, t->buckets[b]); e != NULL;
+                    prev = e, e = shmPtr(h, e->next))
+                if (e->key == key)
+                    break;
+            if (e != NULL) {
+                if (prev == NULL)
+                    t->buckets[b] = e->next;
+                else
+                    prev->next = e->next;
+            }
+            unlockBucket(t, b);
+
+            shmFree(h, e);
+            ws->dels++;
+            break;
+        }
+    }
+
+    shmHeapDetach(h);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-p procs] [-n ops] [-k keys] [-s max-size]"
+                    "\n\t\t[-m heap-MiB] [-K] [-v] [shm-name]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int procs, keys, maxSize, heapMiB, opt, fd, j, status;
+    struct timespec killDelay = { 0, 20000000 };
+    struct workerStats tot;
+    struct shmHeapStats st;
+    struct shmHeap *h;
+    struct table *t;
+    struct entry *e;
+    pid_t pids[MAX_PROCS];
+    Boolean killOne, verbose;
+    long long start, ns;
+    long ops, entries, bad;
+    char *name;
+    uint32_t b;
+
+    procs = 4;
+    ops = 200000;
+    keys = 10000;
+    maxSize = 256;
+    heapMiB = 64;
+    killOne = FALSE;
+    verbose = FALSE;
+    while ((opt = getopt(argc, argv, "p:n:k:s:m:Kv")) != -1) {
+        switch (opt) {
+        case 'p':   procs = getInt(optarg, GN_GT_0, "procs");       break;
+        case 'n':   ops = getLong(optarg, GN_GT_0, "ops");          break;
+        case 'k':   keys = getInt(optarg, GN_GT_0, "keys");         break;
+        case 's':   maxSize = getInt(optarg, GN_GT_0, "max-size");  break;
+        case 'm':   heapMiB = getInt(optarg, GN_GT_0, "heap-MiB");  break;
+        case 'K':   killOne = TRUE;                                 break;
+        case 'v':   verbose = TRUE;                                 break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind < argc - 1)
+        usageError(argv[0]);
+    if (procs > MAX_PROCS)
+        cmdLineErr("At most %d processes\n", MAX_PROCS);
+    name = (optind < argc) ? argv[optind] : NULL;
+
+    /* Create the heap, and the table in it */
+
+    if (name != NULL) {
+        h = shmHeapOpen(name, O_CREAT | O_EXCL, S_IRUSR | S_IWUSR,
+                        (size_t) heapMiB << 20);
+        if (h == NULL)
+            errExit("shmHeapOpen");
+    } else {
+        fd = memfd_create("pshm_heap_hash", MFD_CLOEXEC);
+        if (fd == -1)
+            errExit("memfd_create");
+        h = shmHeapCreate(fd, (size_t) heapMiB << 20);
+        if (h == NULL)
+            errExit("shmHeapCreate");
+    }
+    if (verbose)
+        printf("parent:   heap mapped at %p\n", (void *) h->base);
+
+    t = shmAlloc(h, sizeof(struct table) + keys * sizeof(shmOff));
+    if (t == NULL)
+        errExit("shmAlloc");
+    memset(t, 0, sizeof(struct table) + keys * sizeof(shmOff));
+    t->nbuckets = keys;
+    for (j = 0; j < NLOCKS; j++)
+        if (shmMutexInit(&t->locks[j]) == -1)
+            errExit("shmMutexInit");
+    shmHeapSetRoot(h, 0, shmOffOf(h, t));
+
+    /* Run the workers. Each attaches to the heap through its own file
+       descriptor (so that shmHeapDetach() can close it). */
+
+    fflush(stdout);             /* Don't duplicate buffered output */
+    start = nowNs();
+    for (j = 0; j < procs; j++) {
+        pids[j] = fork();
+        if (pids[j] == -1)
+            errExit("fork");
+        if (pids[j] == 0) {
+            fd = (name != NULL) ? shm_open(name, O_RDWR, 0) : dup(h->fd);
+            if (fd == -1)
+                errExit("open heap");
+            worker(fd, j, ops, keys, maxSize, verbose);
+            _exit(EXIT_SUCCESS);
+        }
+    }
+
+    if (killOne) {
+        nanosleep(&killDelay, NULL);
+        if (kill(pids[0], SIGKILL) == -1)
+            errExit("kill");
+    }
+
+    for (j = 0; j < procs; j++) {
+        if (waitpid(pids[j], &status, 0) == -1)
+            errExit("waitpid");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            printf("worker %d terminated abnormally (status %#x)\n",
+                   j, status);
+    }
+    ns = nowNs() - start;
+
+    /* Check every entry in the table */
+
+    entries = 0;
+    bad = 0;
+    for (b = 0; b < t->nbuckets; b++) {
+        for (e = shmPtr(h, t->buckets[b]); e != NULL;
+                e = shmPtr(h, e->next)) {
+            entries++;
+            if (e->key % t->nbuckets != b || !entryOk(e, e->key))
+                bad++;
+        }
+    }
+
+    memset(&tot, 0, sizeof(tot));
+    for (j = 0; j < procs; j++) {
+        tot.puts += t->stats[j].puts;
+        tot.gets += t->stats[j].gets;
+        tot.dels += t->stats[j].dels;
+        tot.misses += t->stats[j].misses;
+        tot.bad += t->stats[j].bad;
+    }
+
+    printf("%ld ops in %.3f s (%.0f ops/s): %ld puts, %ld gets "
+           "(%ld misses), %ld deletes\n",
+           tot.puts + tot.gets + tot.dels, ns / 1e9,
+           (tot.puts + tot.gets + tot.dels) / (ns / 1e9),
+           tot.puts, tot.gets, tot.misses, tot.dels);
+    printf("Table: %ld entries; bad values seen by workers: %ld; "
+           "bad entries at end: %ld\n", entries, tot.bad, bad);
+
+    shmHeapGetStats(h, &st);
+    printf("Heap: %zu bytes carved of %zu, %zu on shared free lists, "
+           "recoveries: %lu\n", st.carved, st.size, st.listed,
+           st.recoveries);
+
+    shmHeapDetach(h);
+    if (name != NULL && shm_unlink(name) == -1)
+        errExit("shm_unlink");
+
+    exit((tot.bad == 0 && bad == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
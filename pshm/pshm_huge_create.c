@@ -0,0 +1,125 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* pshm_huge_create.c
+
+   A variant of pshm_create.c that creates a shared memory object backed
+   by huge pages: the object is a file in a hugetlbfs file system (see
+   huge_shm.c).
+
+   Usage as shown in usageError().
+
+   The size of the object is rounded up to a multiple of the huge page
+   size. With -P, the mapping is created with MAP_POPULATE, so that all
+   pages are allocated (and zeroed) at creation time rather than on first
+   access; this also shows immediately whether enough huge pages are
+   available. The object can be removed with rm(1), or with
+   "pshm_huge_create -u".
+
+   This program is Linux-specific.
+
+   See also pshm_huge_write.c, pshm_huge_read.c, and pshm_page_bench.c.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "huge_shm.h"
+#include "tlpi_hdr.h"
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-cxP] [-p page-size] shm-name size "
+            "[octal-perms]\n", progName);
+    fprintf(stderr, "       %s -u [-p page-size] shm-name\n", progName);
+    fprintf(stderr, "    -c   Create shared memory (O_CREAT)\n");
+    fprintf(stderr, "    -x   Create exclusively (O_EXCL)\n");
+    fprintf(stderr, "    -P   Prefault the pages (MAP_POPULATE)\n");
+    fprintf(stderr, "    -p   Huge page size, e.g., 2M or 1G (default: "
+            "system default)\n");
+    fprintf(stderr, "    -u   Remove the object\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int flags, mapFlags, opt, fd;
+    Boolean unlinkObj;
+    long pageSize;
+    mode_t perms;
+    size_t size;
+    void *addr;
+
+    flags = O_RDWR;
+    mapFlags = MAP_SHARED;
+    pageSize = 0;
+    unlinkObj = FALSE;
+    while ((opt = getopt(argc, argv, "cxPp:u")) != -1) {
+        switch (opt) {
+        case 'c':   flags |= O_CREAT;                   break;
+        case 'x':   flags |= O_EXCL;                    break;
+        case 'P':   mapFlags |= MAP_POPULATE;           break;
+        case 'u':   unlinkObj = TRUE;                   break;
+        case 'p':
+            pageSize = hugeParseSize(optarg);
+            if (pageSize == -1)
+                cmdLineErr("Bad page size: %s\n", optarg);
+            break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (unlinkObj) {
+        if (optind + 1 != argc)
+            usageError(argv[0]);
+        if (hugeShmUnlink(argv[optind], pageSize) == -1)
+            errExit("hugeShmUnlink");
+        exit(EXIT_SUCCESS);
+    }
+
+    if (optind + 1 >= argc)
+        usageError(argv[0]);
+
+    if (pageSize == 0) {
+        pageSize = hugeDefaultPageSize();
+        if (pageSize == -1)
+            errExit("hugeDefaultPageSize");
+    }
+
+    size = hugeRoundUp(getLong(argv[optind + 1], GN_ANY_BASE, "size"),
+                       pageSize);
+    perms = (argc <= optind + 2) ? (S_IRUSR | S_IWUSR) :
+                getLong(argv[optind + 2], GN_BASE_8, "octal-perms");
+
+    /* Create shared memory object and set its size */
+
+    fd = hugeShmOpen(argv[optind], flags, perms, pageSize);
+    if (fd == -1)
+        errExit("hugeShmOpen");
+
+    if (ftruncate(fd, size) == -1)
+        errExit("ftruncate");
+
+    /* Map shared memory object */
+
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, mapFlags, fd, 0);
+    if (addr == MAP_FAILED)
+        errExit("mmap");
+
+    printf("%s/%s: %ld bytes (%ld pages of %ld kB)\n",
+            hugetlbfsDir(pageSize), argv[optind] + (argv[optind][0] == '/'),
+            (long) size, (long) (size / pageSize), pageSize / 1024);
+
+    exit(EXIT_SUCCESS);
+}
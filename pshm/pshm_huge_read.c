@@ -0,0 +1,83 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* pshm_huge_read.c
+
+   Usage: pshm_huge_read [-p page-size] shm-name
+
+   A variant of pshm_read.c for objects created by pshm_huge_create.c.
+   Copy the string at the start of the huge-page-backed shared memory
+   object named in 'shm-name' (up to the first null byte, or the end of
+   the object) to stdout.
+
+   This program is Linux-specific.
+
+   See also pshm_huge_write.c.
+*/
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "huge_shm.h"
+#include "tlpi_hdr.h"
+
+int
+main(int argc, char *argv[])
+{
+    int fd, opt;
+    long pageSize;
+    char *addr, *end;
+    size_t len;
+    struct stat sb;
+
+    pageSize = 0;
+    while ((opt = getopt(argc, argv, "p:")) != -1) {
+        switch (opt) {
+        case 'p':
+            pageSize = hugeParseSize(optarg);
+            if (pageSize == -1)
+                cmdLineErr("Bad page size: %s\n", optarg);
+            break;
+        default:
+            usageErr("%s [-p page-size] shm-name\n", argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc)
+        usageErr("%s [-p page-size] shm-name\n", argv[0]);
+
+    fd = hugeShmOpen(argv[optind], O_RDONLY, 0, pageSize);
+    if (fd == -1)
+        errExit("hugeShmOpen");
+
+    if (fstat(fd, &sb) == -1)
+        errExit("fstat");
+    if (sb.st_size == 0)
+        fatal("object is empty");
+
+    addr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        errExit("mmap");
+
+    if (close(fd) == -1)                /* 'fd' is no longer needed */
+        errExit("close");
+
+    /* hugetlbfs doesn't support write(), so we can't simply copy the
+       whole object; instead, find the end of the string */
+
+    end = memchr(addr, '\0', sb.st_size);
+    len = (end == NULL) ? sb.st_size : end - addr;
+
+    if (write(STDOUT_FILENO, addr, len) != len)
+        fatal("partial/failed write");
+    printf("\n");
+    exit(EXIT_SUCCESS);
+}
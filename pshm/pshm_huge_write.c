@@ -0,0 +1,88 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* pshm_huge_write.c
+
+   Usage: pshm_huge_write [-p page-size] shm-name string
+
+   A variant of pshm_write.c for objects created by pshm_huge_create.c.
+   Copy 'string', followed by a null byte, into the huge-page-backed
+   shared memory object named in 'shm-name'.
+
+   Since the size of a hugetlbfs file is always a multiple of the huge
+   page size, the object is resized only if it is too small to hold the
+   string; the terminating null byte tells pshm_huge_read.c where the
+   string ends.
+
+   This program is Linux-specific.
+*/
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "huge_shm.h"
+#include "tlpi_hdr.h"
+
+int
+main(int argc, char *argv[])
+{
+    int fd, opt;
+    long pageSize;
+    size_t len;                 /* Bytes to copy, including null byte */
+    struct stat sb;
+    char *addr;
+
+    pageSize = 0;
+    while ((opt = getopt(argc, argv, "p:")) != -1) {
+        switch (opt) {
+        case 'p':
+            pageSize = hugeParseSize(optarg);
+            if (pageSize == -1)
+                cmdLineErr("Bad page size: %s\n", optarg);
+            break;
+        default:
+            usageErr("%s [-p page-size] shm-name string\n", argv[0]);
+        }
+    }
+
+    if (optind + 2 != argc)
+        usageErr("%s [-p page-size] shm-name string\n", argv[0]);
+
+    if (pageSize == 0) {
+        pageSize = hugeDefaultPageSize();
+        if (pageSize == -1)
+            errExit("hugeDefaultPageSize");
+    }
+
+    fd = hugeShmOpen(argv[optind], O_RDWR, 0, pageSize);
+    if (fd == -1)
+        errExit("hugeShmOpen");
+
+    len = strlen(argv[optind + 1]) + 1;
+    if (fstat(fd, &sb) == -1)
+        errExit("fstat");
+    if (sb.st_size < len) {             /* Grow object to hold string */
+        if (ftruncate(fd, hugeRoundUp(len, pageSize)) == -1)
+            errExit("ftruncate");
+        printf("Resized to %ld bytes\n", (long) hugeRoundUp(len, pageSize));
+    }
+
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        errExit("mmap");
+
+    if (close(fd) == -1)                /* 'fd' is no longer needed */
+        errExit("close");
+
+    printf("copying %ld bytes\n", (long) len);
+    memcpy(addr, argv[optind + 1], len);
+    exit(EXIT_SUCCESS);
+}
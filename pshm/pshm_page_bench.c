@@ -0,0 +1,255 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* pshm_page_bench.c
+
+   Compare shared memory backed by normal (4 kB) pages with shared memory
+   backed by 2 MB and 1 GB huge pages.
+
+   Usage: pshm_page_bench [-s size-MiB] [-n accesses] [-P] [-f] [backing...]
+
+        -s size-MiB     Size of the region (default: 64)
+        -n accesses     Number of accesses in the latency test (default:
+                        10000000)
+        -P              Prefault the region when mapping it (MAP_POPULATE)
+        -f              Create the huge page regions as files in hugetlbfs
+                        (see huge_shm.c), rather than with memfd_create()
+
+   'backing' is one of "4k" (a POSIX shared memory object), "2m", or "1g";
+   by default, all three are tested. For each backing, the program
+   reports the time taken by mmap() (which includes allocating the pages,
+   if -P was specified), the time taken to first touch every page of the
+   region (i.e., the cost of the page faults, if -P was not specified),
+   and the mean latency of a chain of dependent loads that visits the
+   64-byte cache lines of the region in a random order. With a region much
+   larger than the coverage of the TLB, the latency test mostly measures
+   the cost of TLB misses, which huge pages reduce.
+
+   A backing for which no huge pages are available (e.g., because none
+   have been reserved via
+   /sys/kernel/mm/hugepages/hugepages-<size>kB/nr_hugepages) is reported
+   and skipped.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "huge_shm.h"
+#include "tlpi_hdr.h"
+
+#define LINE_SIZE 64            /* Assumed cache line size */
+
+static struct {
+    const char *name;
+    long pageSize;              /* 0 means a normal page */
+} backings[] = {
+    { "4k",     0 },
+    { "2m",     2L * 1024 * 1024 },
+    { "1g",     1024L * 1024 * 1024 },
+};
+
+#define NBACKINGS (sizeof(backings) / sizeof(backings[0]))
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Create (and immediately remove the name of) a shared memory object of
+   'size' bytes using the specified backing. Returns -1 on error. */
+
+static int
+createRegion(long pageSize, size_t size, Boolean useFiles)
+{
+    char name[64];
+    int fd;
+
+    snprintf(name, sizeof(name), "/pshm_page_bench.%ld", (long) getpid());
+
+    if (pageSize == 0) {
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+        if (fd != -1)
+            shm_unlink(name);
+    } else if (useFiles) {
+        fd = hugeShmOpen(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR,
+                         pageSize);
+        if (fd != -1)
+            hugeShmUnlink(name, pageSize);
+    } else {
+        fd = hugeMemfd(name + 1, pageSize);
+    }
+    if (fd == -1)
+        return -1;
+
+    if (ftruncate(fd, size) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Link the cache lines of the region into a single cycle in random order
+   (using Sattolo's algorithm), and return the start of the cycle */
+
+static void **
+buildChain(char *addr, size_t size)
+{
+    size_t nlines, j, k, tmp;
+    size_t *order;
+
+    nlines = size / LINE_SIZE;
+    order = malloc(nlines * sizeof(size_t));
+    if (order == NULL)
+        errExit("malloc");
+
+    for (j = 0; j < nlines; j++)
+        order[j] = j;
+    for (j = nlines - 1; j > 0; j--) {
+        k = random() % j;
+        tmp = order[j];
+        order[j] = order[k];
+        order[k] = tmp;
+    }
+
+    for (j = 0; j < nlines; j++)
+        *(void **) (addr + order[j] * LINE_SIZE) =
+                addr + order[(j + 1) % nlines] * LINE_SIZE;
+
+    free(order);
+    return (void **) addr;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-s size-MiB] [-n accesses] [-P] [-f] "
+            "[backing...]\n", progName);
+    fprintf(stderr, "    'backing' is one of:");
+    for (int j = 0; j < NBACKINGS; j++)
+        fprintf(stderr, " %s", backings[j].name);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int opt, fd, mapFlags, numNames, b, j;
+    long numAccesses, pageSize, pg;     /* 'pg' also counts accesses */
+    size_t size, regionSize;
+    Boolean useFiles, prefault;
+    char **names;
+    char *addr;
+    void **p;
+    double t0, tMap, tTouch, tChase;
+
+    size = 64;
+    numAccesses = 10000000;
+    prefault = FALSE;
+    useFiles = FALSE;
+    while ((opt = getopt(argc, argv, "s:n:Pf")) != -1) {
+        switch (opt) {
+        case 's':   size = getLong(optarg, GN_GT_0, "size-MiB");        break;
+        case 'n':   numAccesses = getLong(optarg, GN_GT_0, "accesses"); break;
+        case 'P':   prefault = TRUE;                                    break;
+        case 'f':   useFiles = TRUE;                                    break;
+        default:    usageError(argv[0]);
+        }
+    }
+    size *= 1024 * 1024;
+
+    numNames = argc - optind;
+    names = argv + optind;
+    for (j = 0; j < numNames; j++) {
+        for (b = 0; b < NBACKINGS; b++)
+            if (strcmp(names[j], backings[b].name) == 0)
+                break;
+        if (b == NBACKINGS)
+            usageError(argv[0]);
+    }
+
+    mapFlags = MAP_SHARED | (prefault ? MAP_POPULATE : 0);
+
+    printf("Region size: %ld MiB; %ld accesses; %s%s\n",
+            (long) (size >> 20), numAccesses,
+            prefault ? "prefaulted" : "faulted on first touch",
+            useFiles ? "; hugetlbfs files" : "");
+    printf("%-8s %10s %10s %10s %12s\n", "backing", "pages", "map-ms",
+            "touch-ms", "ns/access");
+
+    for (b = 0; b < NBACKINGS; b++) {
+        if (numNames > 0) {
+            for (j = 0; j < numNames; j++)
+                if (strcmp(names[j], backings[b].name) == 0)
+                    break;
+            if (j == numNames)
+                continue;
+        }
+
+        pageSize = (backings[b].pageSize == 0) ? sysconf(_SC_PAGESIZE) :
+                        backings[b].pageSize;
+        regionSize = hugeRoundUp(size, pageSize);
+
+        fd = createRegion(backings[b].pageSize, regionSize, useFiles);
+        if (fd == -1) {
+            printf("%-8s unavailable: %s\n", backings[b].name,
+                    strerror(errno));
+            continue;
+        }
+
+        t0 = nowSecs();
+        addr = mmap(NULL, regionSize, PROT_READ | PROT_WRITE, mapFlags,
+                    fd, 0);
+        tMap = nowSecs() - t0;
+        if (close(fd) == -1)
+            errExit("close");
+        if (addr == MAP_FAILED) {
+            printf("%-8s unavailable: %s\n", backings[b].name,
+                    strerror(errno));
+            continue;
+        }
+
+        /* Touch one byte in each page. Without -P, this is where the
+           pages are allocated; if too few huge pages are available, the
+           process is killed by SIGBUS. */
+
+        t0 = nowSecs();
+        for (pg = 0; pg < regionSize / pageSize; pg++)
+            addr[pg * pageSize] = 1;
+        tTouch = nowSecs() - t0;
+
+        p = buildChain(addr, regionSize);
+
+        t0 = nowSecs();
+        for (pg = 0; pg < numAccesses; pg++)
+            p = (void **) *p;
+        tChase = nowSecs() - t0;
+
+        printf("%-8s %10ld %10.2f %10.2f %12.2f%s\n", backings[b].name,
+                (long) (regionSize / pageSize), tMap * 1e3, tTouch * 1e3,
+                tChase * 1e9 / numAccesses,
+                (p == NULL) ? "?" : "");        /* Keep 'p' live */
+
+        if (munmap(addr, regionSize) == -1)
+            errExit("munmap");
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,511 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* shm_hash.c
+
+   A hash table that lives in shared memory (for example, in a heap
+   created with shm_heap.c), and can be used concurrently by many
+   processes: for instance, by the processes of a multiprocess server,
+   to share the state of client sessions. Keys are nonzero 64-bit
+   integers; values are of a fixed size, set when the table is created.
+
+   The table contains no pointers, so that each process may map it at a
+   different address. It is an array of buckets, each occupying a
+   64-byte cache line: a version number and SHT_SLOTS keys (the values
+   are kept in a separate array). A key may live in either of two
+   buckets chosen by its hash (open addressing with two choices, which
+   keeps lookups to at most two cache lines, yet allows a load factor of
+   more than 90%); a new key goes in the emptier one. Keys never move
+   between buckets, and a deleted key's slot is simply emptied (there
+   are no tombstones).
+
+   Reads take no locks: shtGet() reads a bucket's version, scans its
+   keys, copies the value, and rereads the version, retrying if it was
+   odd or has changed (as with the sequence lock in read_mostly.c).
+   Writes lock the stripes (from a fixed array of process-shared, robust
+   mutexes) of both of the key's buckets, and make the version of the
+   bucket they change odd during the change.
+
+   A writer that dies while holding a lock leaves a bucket's version odd.
+   The next process to take the lock (pthread_mutex_lock() returns
+   EOWNERDEAD) makes the versions of the stripe's buckets even again; a
+   reader that retries too often takes the locks itself, so that it
+   can't spin forever waiting for a dead writer. An insertion or
+   deletion is committed by a single store of the key; a value that
+   was being changed when the writer died may be left partly written.
+
+   The table does not grow: shtPut() and shtUpdate() fail with ENOSPC if
+   both of a new key's buckets are full.
+*/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include "shm_heap.h"           /* For shmMutexInit() */
+#include "shm_hash.h"           /* Declares functions defined here */
+
+#define SHT_MAGIC 0x53485448U   /* "SHTH" */
+#define SHT_SLOTS 7             /* Keys per bucket */
+#define SHT_MAX_STRIPES 256
+#define SHT_SPIN_LIMIT 100      /* Read retries before taking the locks */
+#define SHT_ALIGN 64
+
+struct shtBucket {
+    uint32_t version;           /* Odd while the bucket is being changed */
+    uint32_t pad;
+    uint64_t keys[SHT_SLOTS];   /* 0 means the slot is empty */
+};
+
+struct shmHash {
+    uint32_t magic;
+    uint32_t valSize;           /* Rounded up to a multiple of 8 */
+    uint64_t nbuckets;          /* A power of 2 */
+    uint32_t nstripes;          /* A power of 2 */
+    uint64_t count;             /* Updated atomically */
+    uint64_t recoveries;        /* Updated atomically */
+    uint64_t bucketsOff;        /* From the start of the table */
+    uint64_t valuesOff;
+    pthread_mutex_t locks[SHT_MAX_STRIPES];
+};
+
+#define ROUND_UP(n, a) (((n) + (a) - 1) / (a) * (a))
+
+static struct shtBucket *
+bucketAt(struct shmHash *t, uint64_t b)
+{
+    return (struct shtBucket *) ((char *) t + t->bucketsOff) + b;
+}
+
+static void *
+valueAt(struct shmHash *t, uint64_t b, int slot)
+{
+    return (char *) t + t->valuesOff +
+           (b * SHT_SLOTS + slot) * t->valSize;
+}
+
+/* Compute the table geometry for the given parameters; returns the
+   number of bytes needed */
+
+static size_t
+geometry(size_t maxKeys, size_t valSize, uint64_t *nbuckets,
+         uint64_t *bucketsOff, uint64_t *valuesOff)
+{
+    uint64_t nb, want;
+
+    want = maxKeys * 20 / (SHT_SLOTS * 17) + 1;     /* Aim for 85% full */
+    for (nb = 2; nb < want; nb <<= 1)
+        continue;
+    *nbuckets = nb;
+    *bucketsOff = ROUND_UP(sizeof(struct shmHash), SHT_ALIGN);
+    *valuesOff = *bucketsOff + nb * sizeof(struct shtBucket);
+    return *valuesOff + nb * SHT_SLOTS * ROUND_UP(valSize, 8);
+}
+
+/* Return the number of bytes of (shared) memory needed for a table that
+   will hold up to about 'maxKeys' keys, with values of 'valSize' bytes */
+
+size_t
+shtMemSize(size_t maxKeys, size_t valSize)
+{
+    uint64_t nb, bo, vo;
+
+    return geometry(maxKeys, valSize, &nb, &bo, &vo);
+}
+
+/* Create an empty table in 'mem' (at least shtMemSize(maxKeys, valSize)
+   bytes of shared memory, aligned on at least an 8-byte boundary, and
+   preferably on a 64-byte boundary, so that each bucket occupies one
+   cache line). Returns a pointer to the table (== mem), or NULL on
+   error. */
+
+struct shmHash *
+shtInit(void *mem, size_t maxKeys, size_t valSize)
+{
+    struct shmHash *t = mem;
+    uint64_t nb, bo, vo;
+    size_t len;
+    int j;
+
+    if (valSize == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    len = geometry(maxKeys, valSize, &nb, &bo, &vo);
+    memset(mem, 0, len);
+
+    t->valSize = ROUND_UP(valSize, 8);
+    t->nbuckets = nb;
+    t->nstripes = (nb < SHT_MAX_STRIPES) ? nb : SHT_MAX_STRIPES;
+    t->bucketsOff = bo;
+    t->valuesOff = vo;
+    for (j = 0; j < (int) t->nstripes; j++)
+        if (shmMutexInit(&t->locks[j]) == -1)
+            return NULL;
+
+    __atomic_store_n(&t->magic, SHT_MAGIC, __ATOMIC_RELEASE);
+    return t;
+}
+
+/* Check that 'mem' (in this process's mapping of the shared memory)
+   contains a table. Returns a pointer to the table, or NULL (with errno
+   set to EINVAL) if it does not. */
+
+struct shmHash *
+shtCheck(void *mem)
+{
+    struct shmHash *t = mem;
+
+    if (t == NULL ||
+            __atomic_load_n(&t->magic, __ATOMIC_ACQUIRE) != SHT_MAGIC) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return t;
+}
+
+static uint64_t
+hashKey(uint64_t k)             /* Finalizer of the SplitMix64 generator */
+{
+    k ^= k >> 30;
+    k *= 0xbf58476d1ce4e5b9ULL;
+    k ^= k >> 27;
+    k *= 0x94d049bb133111ebULL;
+    k ^= k >> 31;
+    return k;
+}
+
+static void
+keyBuckets(struct shmHash *t, uint64_t key, uint64_t *b1, uint64_t *b2)
+{
+    uint64_t h = hashKey(key);
+
+    *b1 = h & (t->nbuckets - 1);
+    *b2 = (h >> 32) & (t->nbuckets - 1);
+    if (*b2 == *b1)
+        *b2 ^= 1;
+}
+
+/* Lock stripe 's'. If its previous owner died, make the versions of the
+   stripe's buckets even, so that readers stop retrying. */
+
+static int
+lockStripe(struct shmHash *t, uint32_t s)
+{
+    struct shtBucket *bk;
+    uint64_t b;
+    int r;
+
+    r = pthread_mutex_lock(&t->locks[s]);
+    if (r == EOWNERDEAD) {
+        for (b = s; b < t->nbuckets; b += t->nstripes) {
+            bk = bucketAt(t, b);
+            if (bk->version & 1)
+                __atomic_store_n(&bk->version, bk->version + 1,
+                                 __ATOMIC_RELEASE);
+        }
+        __atomic_fetch_add(&t->recoveries, 1, __ATOMIC_RELAXED);
+        r = pthread_mutex_consistent(&t->locks[s]);
+    }
+    if (r != 0) {
+        errno = r;
+        return -1;
+    }
+    return 0;
+}
+
+/* Lock the stripes of buckets 'b1' and 'b2' (in a fixed order, so that
+   writers can't deadlock) */
+
+static int
+lockBuckets(struct shmHash *t, uint64_t b1, uint64_t b2)
+{
+    uint32_t s1 = b1 & (t->nstripes - 1), s2 = b2 & (t->nstripes - 1);
+    uint32_t tmp;
+
+    if (s1 > s2) {
+        tmp = s1;
+        s1 = s2;
+        s2 = tmp;
+    }
+    if (lockStripe(t, s1) == -1)
+        return -1;
+    if (s2 != s1 && lockStripe(t, s2) == -1) {
+        pthread_mutex_unlock(&t->locks[s1]);
+        return -1;
+    }
+    return 0;
+}
+
+static void
+unlockBuckets(struct shmHash *t, uint64_t b1, uint64_t b2)
+{
+    uint32_t s1 = b1 & (t->nstripes - 1), s2 = b2 & (t->nstripes - 1);
+
+    pthread_mutex_unlock(&t->locks[s1]);
+    if (s2 != s1)
+        pthread_mutex_unlock(&t->locks[s2]);
+}
+
+static void
+beginWrite(struct shtBucket *bk)
+{
+    __atomic_store_n(&bk->version, bk->version + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+endWrite(struct shtBucket *bk)
+{
+    __atomic_store_n(&bk->version, bk->version + 1, __ATOMIC_RELEASE);
+}
+
+/* Copy 'len' bytes (a multiple of 8) that a writer may be changing */
+
+static void
+loadRelaxed(void *dst, const void *src, size_t len)
+{
+    const uint64_t *s = src;
+    uint64_t *d = dst;
+
+    for (; len > 0; len -= sizeof(uint64_t))
+        *d++ = __atomic_load_n(s++, __ATOMIC_RELAXED);
+}
+
+/* Look for 'key' in bucket 'b', without locking. Returns the slot, or -1
+   if the key is absent, or -2 if the bucket changed while we read it. */
+
+static int
+readBucket(struct shmHash *t, uint64_t b, uint64_t key, void *buf)
+{
+    struct shtBucket *bk = bucketAt(t, b);
+    uint32_t v;
+    int j;
+
+    v = __atomic_load_n(&bk->version, __ATOMIC_ACQUIRE);
+    if (v & 1)
+        return -2;
+    for (j = 0; j < SHT_SLOTS; j++)
+        if (__atomic_load_n(&bk->keys[j], __ATOMIC_RELAXED) == key)
+            break;
+    if (j == SHT_SLOTS)
+        j = -1;
+    else if (buf != NULL)
+        loadRelaxed(buf, valueAt(t, b, j), t->valSize);
+
+    /* Order the loads above before the second load of the version */
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (__atomic_load_n(&bk->version, __ATOMIC_RELAXED) == v) ? j : -2;
+}
+
+static int
+findSlot(struct shmHash *t, uint64_t b, uint64_t key)
+{
+    struct shtBucket *bk = bucketAt(t, b);
+    int j;
+
+    for (j = 0; j < SHT_SLOTS; j++)
+        if (bk->keys[j] == key)
+            return j;
+    return -1;
+}
+
+/* Copy the value for 'key' to 'val' (if 'val' is not NULL). Returns 1 if
+   the key was found, 0 if not, or -1 on error. */
+
+int
+shtGet(struct shmHash *t, uint64_t key, void *val)
+{
+    uint64_t b1, b2, buf[t->valSize / sizeof(uint64_t)];
+    void *dst = (val != NULL) ? buf : NULL;
+    int tries, s1, s2;
+
+    if (key == 0)
+        return 0;
+    keyBuckets(t, key, &b1, &b2);
+
+    for (tries = 0; tries < SHT_SPIN_LIMIT; tries++) {
+        s1 = readBucket(t, b1, key, dst);
+        if (s1 == -2)
+            continue;
+        if (s1 < 0) {
+            s2 = readBucket(t, b2, key, dst);
+            if (s2 == -2)
+                continue;
+            if (s2 < 0)
+                return 0;
+        }
+        if (val != NULL)
+            memcpy(val, buf, t->valSize);
+        return 1;
+    }
+
+    /* Writers keep getting in the way (or one has died): read with the
+       locks held */
+
+    if (lockBuckets(t, b1, b2) == -1)
+        return -1;
+    if ((s1 = findSlot(t, b1, key)) >= 0) {
+        if (val != NULL)
+            memcpy(val, valueAt(t, b1, s1), t->valSize);
+    } else if ((s2 = findSlot(t, b2, key)) >= 0) {
+        if (val != NULL)
+            memcpy(val, valueAt(t, b2, s2), t->valSize);
+    }
+    unlockBuckets(t, b1, b2);
+    return (s1 >= 0 || s2 >= 0) ? 1 : 0;
+}
+
+/* Update the value for 'key' with fn(value, found, arg), as described in
+   shm_hash.h. The value is changed in place, while the bucket's version
+   is odd. Returns 0 on success, or -1 on error (ENOSPC if the key is
+   absent and there is no room for it, in which case 'fn' is not
+   called). */
+
+int
+shtUpdate(struct shmHash *t, uint64_t key, shtUpdateFunc fn, void *arg)
+{
+    struct shtBucket *bk, *bk2;
+    uint64_t b1, b2, b;
+    int slot, n1, n2, j, action;
+    void *val;
+
+    if (key == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    keyBuckets(t, key, &b1, &b2);
+    if (lockBuckets(t, b1, b2) == -1)
+        return -1;
+
+    b = b1;
+    slot = findSlot(t, b1, key);
+    if (slot < 0) {
+        b = b2;
+        slot = findSlot(t, b2, key);
+    }
+
+    if (slot >= 0) {                    /* Update in place */
+        bk = bucketAt(t, b);
+        beginWrite(bk);
+        action = fn(valueAt(t, b, slot), 1, arg);
+        if (action == SHT_DELETE) {
+            __atomic_store_n(&bk->keys[slot], 0, __ATOMIC_RELAXED);
+            __atomic_fetch_sub(&t->count, 1, __ATOMIC_RELAXED);
+        }
+        endWrite(bk);
+
+    } else {                            /* Insert in the emptier bucket */
+        bk = bucketAt(t, b1);
+        bk2 = bucketAt(t, b2);
+        for (j = 0, n1 = n2 = 0; j < SHT_SLOTS; j++) {
+            n1 += bk->keys[j] != 0;
+            n2 += bk2->keys[j] != 0;
+        }
+        if (n2 < n1) {
+            bk = bk2;
+            b = b2;
+        } else {
+            b = b1;
+        }
+        slot = findSlot(t, b, 0);
+        if (slot < 0) {
+            unlockBuckets(t, b1, b2);
+            errno = ENOSPC;
+            return -1;
+        }
+
+        /* Readers don't look at the value of an empty slot, so we can
+           build it before changing the version */
+
+        val = valueAt(t, b, slot);
+        memset(val, 0, t->valSize);
+        if (fn(val, 0, arg) == SHT_STORE) {
+            beginWrite(bk);
+            __atomic_store_n(&bk->keys[slot], key, __ATOMIC_RELAXED);
+            endWrite(bk);
+            __atomic_fetch_add(&t->count, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    unlockBuckets(t, b1, b2);
+    return 0;
+}
+
+struct copyArgs {
+    const void *src;
+    void *dst;
+    size_t len;
+    int found;
+};
+
+static int
+putFunc(void *val, int found, void *arg)
+{
+    struct copyArgs *ca = arg;
+
+    memcpy(val, ca->src, ca->len);
+    return SHT_STORE;
+}
+
+/* Set the value for 'key' (inserting the key if necessary) to the value
+   at 'val'. Returns 0 on success, or -1 on error. */
+
+int
+shtPut(struct shmHash *t, uint64_t key, const void *val)
+{
+    struct copyArgs ca;
+
+    ca.src = val;
+    ca.len = t->valSize;
+    return shtUpdate(t, key, putFunc, &ca);
+}
+
+static int
+deleteFunc(void *val, int found, void *arg)
+{
+    struct copyArgs *ca = arg;
+
+    ca->found = found;
+    if (!found)
+        return SHT_KEEP;
+    if (ca->dst != NULL)
+        memcpy(ca->dst, val, ca->len);
+    return SHT_DELETE;
+}
+
+/* Remove 'key' from the table, copying its value to 'val' (if 'val' is
+   not NULL). Returns 1 if the key was removed, 0 if it was absent, or -1
+   on error. */
+
+int
+shtDelete(struct shmHash *t, uint64_t key, void *val)
+{
+    struct copyArgs ca;
+
+    ca.dst = val;
+    ca.len = t->valSize;
+    ca.found = 0;
+    if (shtGet(t, key, NULL) == 0)      /* Cheap check, without locking */
+        return 0;
+    if (shtUpdate(t, key, deleteFunc, &ca) == -1)
+        return (errno == ENOSPC) ? 0 : -1;
+    return ca.found;
+}
+
+void
+shtGetStats(struct shmHash *t, struct shtStats *stats)
+{
+    stats->capacity = t->nbuckets * SHT_SLOTS;
+    stats->count = __atomic_load_n(&t->count, __ATOMIC_RELAXED);
+    stats->recoveries = __atomic_load_n(&t->recoveries, __ATOMIC_RELAXED);
+}
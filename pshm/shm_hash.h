@@ -0,0 +1,60 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* shm_hash.h
+
+   Header file for shm_hash.c.
+*/
+#ifndef SHM_HASH_H
+#define SHM_HASH_H              /* Prevent accidental double inclusion */
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct shmHash;                 /* In shared memory; defined in shm_hash.c */
+
+/* Called by shtUpdate(), with the table locked, to update the value for
+   a key. 'found' says whether the key was present; if it was not, 'val'
+   is zero-filled. Return SHT_STORE to store 'val' (inserting the key if
+   necessary), SHT_KEEP to leave the table unchanged, or SHT_DELETE to
+   remove the key. */
+
+typedef int (*shtUpdateFunc)(void *val, int found, void *arg);
+
+#define SHT_KEEP   0
+#define SHT_STORE  1
+#define SHT_DELETE 2
+
+struct shtStats {
+    size_t capacity;            /* Slots in the table */
+    size_t count;               /* Keys in the table */
+    unsigned long recoveries;   /* Locks recovered from dead owners */
+};
+
+size_t shtMemSize(size_t maxKeys, size_t valSize);
+
+struct shmHash *shtInit(void *mem, size_t maxKeys, size_t valSize);
+
+struct shmHash *shtCheck(void *mem);
+
+int shtGet(struct shmHash *t, uint64_t key, void *val);
+
+int shtPut(struct shmHash *t, uint64_t key, const void *val);
+
+int shtDelete(struct shmHash *t, uint64_t key, void *val);
+
+int shtUpdate(struct shmHash *t, uint64_t key, shtUpdateFunc fn,
+              void *arg);
+
+void shtGetStats(struct shmHash *t, struct shtStats *stats);
+
+#endif
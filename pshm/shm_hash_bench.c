@@ -0,0 +1,349 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* shm_hash_bench.c
+
+   Measure shm_hash.c: several processes share the state of a
+   sequence-number service, as the workers of a multiprocess server
+   (such as is_seqnum_mp_sv.c, extended so that each client session has
+   its own sequence) would.
+
+   Usage: shm_hash_bench [-p procs,...] [-n ops] [-k sessions]
+                         [-r read-pct] [-m method,...] [-C]
+
+        -p procs      Numbers of worker processes (default: 1,2,4)
+        -n ops        Operations per worker (default: 1000000)
+        -k sessions   Number of session IDs (default: 100000)
+        -r read-pct   Percentage of operations that only read a session's
+                      state (default: 90)
+        -m methods    sht (lock-free reads, striped locks for writes), or
+                      mutex (every operation holds a single process-shared
+                      mutex, as a simple port of a single-process server
+                      would do) (default: both)
+        -C            CSV output
+
+   The table (in a shm_heap.c heap, whose offset is left in root slot 0)
+   maps a session ID to the session's state: the next sequence number to
+   be granted, and the number of requests granted. Each worker process
+   attaches to the heap and performs random operations on random
+   sessions: a status query (shtGet()), a request for a run of sequence
+   numbers (shtUpdate(), which creates the session if necessary), or, for
+   1% of operations, closing the session (shtDelete()). At the end, the
+   program checks that no grant was lost: the sequence numbers granted
+   by all workers must equal the sequences of the open sessions plus
+   those of the sessions that were closed.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "shm_heap.h"
+#include "shm_hash.h"
+#include "tlpi_hdr.h"
+
+#define MAX_LIST 16
+#define MAX_PROCS 64
+
+struct session {                /* Value in the table */
+    uint64_t nextSeq;
+    uint64_t requests;
+};
+
+struct workerStats {            /* In the heap; one per worker */
+    uint64_t granted;           /* Total length of the runs granted */
+    uint64_t closedSeq;         /* Sum of 'nextSeq' of closed sessions */
+    uint64_t gets, updates, deletes;
+    uint64_t pad[3];            /* Avoid false sharing */
+};
+
+struct benchState {             /* In the heap, at root slot 0 */
+    shmOff table;
+    pthread_mutex_t mtx;        /* For the "mutex" method */
+    struct workerStats stats[MAX_PROCS];
+};
+
+enum { M_SHT, M_MUTEX, NUM_METHODS };
+static const char *methodNames[] = { "sht", "mutex" };
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int
+grantFunc(void *val, int found, void *arg)
+{
+    struct session *s = val;
+    uint64_t *len = arg;
+
+    s->nextSeq += *len;         /* A new session starts at 0 */
+    s->requests++;
+    return SHT_STORE;
+}
+
+static void
+worker(struct shmHeap *h, int idx, int method, long ops, int sessions,
+       int readPct)
+{
+    struct benchState *bs;
+    struct workerStats *ws;
+    struct shmHash *t;
+    struct session s;
+    unsigned int seed;
+    Boolean locked;
+    uint64_t key, len;
+    int r;
+    long n;
+
+    bs = shmPtr(h, shmHeapGetRoot(h, 0));
+    t = shtCheck(shmPtr(h, bs->table));
+    if (t == NULL)
+        errExit("shtCheck");
+    ws = &bs->stats[idx];
+    seed = idx + 1;
+
+    for (n = 0; n < ops; n++) {
+        key = 1 + rand_r(&seed) % sessions;
+        r = rand_r(&seed) % 100;
+
+        locked = method == M_MUTEX;
+        if (locked && shmMutexLock(h, &bs->mtx) == -1)
+            errExit("shmMutexLock");
+
+        if (r < readPct) {
+            if (shtGet(t, key, &s) == -1)
+                errExit("shtGet");
+            ws->gets++;
+        } else if (r < 99 || readPct == 100) {
+            len = 1 + rand_r(&seed) % 10;
+            if (shtUpdate(t, key, grantFunc, &len) == -1)
+                errExit("shtUpdate");
+            ws->granted += len;
+            ws->updates++;
+        } else {
+            r = shtDelete(t, key, &s);
+            if (r == -1)
+                errExit("shtDelete");
+            if (r == 1)
+                ws->closedSeq += s.nextSeq;
+            ws->deletes++;
+        }
+
+        if (locked)
+            pthread_mutex_unlock(&bs->mtx);
+    }
+}
+
+/* Run one measurement; returns the elapsed time in nanoseconds */
+
+static long long
+runBench(int method, int procs, long ops, int sessions, int readPct,
+         size_t heapSize)
+{
+    struct benchState *bs;
+    struct shtStats st;
+    struct shmHash *t;
+    struct session s;
+    struct shmHeap *h, *wh;
+    uint64_t granted, seqs, key;
+    long long start, ns;
+    size_t tlen;
+    char *mem;
+    pid_t pid;
+    int fd, j, status;
+
+    fd = memfd_create("shm_hash_bench", MFD_CLOEXEC);
+    if (fd == -1)
+        errExit("memfd_create");
+    h = shmHeapCreate(fd, heapSize);
+    if (h == NULL)
+        errExit("shmHeapCreate");
+
+    bs = shmAlloc(h, sizeof(struct benchState));
+    if (bs == NULL)
+        errExit("shmAlloc");
+    memset(bs, 0, sizeof(struct benchState));
+    if (shmMutexInit(&bs->mtx) == -1)
+        errExit("shmMutexInit");
+
+    tlen = shtMemSize(sessions, sizeof(struct session));
+    mem = shmAlloc(h, tlen + 64);
+    if (mem == NULL)
+        errExit("shmAlloc");
+    mem = (char *) (((uintptr_t) mem + 63) & ~(uintptr_t) 63);
+    t = shtInit(mem, sessions, sizeof(struct session));
+    if (t == NULL)
+        errExit("shtInit");
+    bs->table = shmOffOf(h, t);
+    shmHeapSetRoot(h, 0, shmOffOf(h, bs));
+
+    start = nowNs();
+    for (j = 0; j < procs; j++) {
+        pid = fork();
+        if (pid == -1)
+            errExit("fork");
+        if (pid == 0) {
+            wh = shmHeapAttach(dup(h->fd));
+            if (wh == NULL)
+                errExit("shmHeapAttach");
+            worker(wh, j, method, ops, sessions, readPct);
+            _exit(EXIT_SUCCESS);
+        }
+    }
+    for (j = 0; j < procs; j++) {
+        if (wait(&status) == -1)
+            errExit("wait");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fatal("a worker failed (status %#x)", status);
+    }
+    ns = nowNs() - start;
+
+    /* Check that every grant is accounted for */
+
+    granted = 0;
+    seqs = 0;
+    for (j = 0; j < procs; j++) {
+        granted += bs->stats[j].granted;
+        seqs += bs->stats[j].closedSeq;
+    }
+    for (key = 1; key <= (uint64_t) sessions; key++)
+        if (shtGet(t, key, &s) == 1)
+            seqs += s.nextSeq;
+    if (seqs != granted)
+        fatal("%s: granted %llu sequence numbers, but sessions account "
+              "for %llu", methodNames[method], (unsigned long long) granted,
+              (unsigned long long) seqs);
+
+    shtGetStats(t, &st);
+    if (st.recoveries != 0)
+        printf("%s: %lu lock recoveries\n", methodNames[method],
+               st.recoveries);
+
+    shmHeapDetach(h);
+    return ns;
+}
+
+static int
+parseList(char *str, int *list, const char *name)
+{
+    char *tok;
+    int n;
+
+    n = 0;
+    for (tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (n == MAX_LIST)
+            cmdLineErr("Too many items in %s list\n", name);
+        list[n++] = getInt(tok, GN_GT_0, name);
+    }
+    if (n == 0)
+        cmdLineErr("Empty %s list\n", name);
+    return n;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-p procs,...] [-n ops] [-k sessions]\n"
+                    "\t\t[-r read-pct] [-m method,...] [-C]\n", progName);
+    fprintf(stderr, "    -p procs      Worker processes (default: 1,2,4)\n");
+    fprintf(stderr, "    -n ops        Operations per worker "
+                    "(default: 1000000)\n");
+    fprintf(stderr, "    -k sessions   Session IDs (default: 100000)\n");
+    fprintf(stderr, "    -r read-pct   Read-only operations (default: 90)\n");
+    fprintf(stderr, "    -m methods    sht,mutex (default: both)\n");
+    fprintf(stderr, "    -C            CSV output\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int procs[MAX_LIST], meth[NUM_METHODS];
+    int nprocs, nmeth, sessions, readPct, opt, m, j;
+    long long ns;
+    size_t heapSize;
+    Boolean csv;
+    char *tok;
+    long ops;
+
+    nprocs = 0;
+    nmeth = 0;
+    ops = 1000000;
+    sessions = 100000;
+    readPct = 90;
+    csv = FALSE;
+    while ((opt = getopt(argc, argv, "p:n:k:r:m:C")) != -1) {
+        switch (opt) {
+        case 'p':   nprocs = parseList(optarg, procs, "procs");     break;
+        case 'n':   ops = getLong(optarg, GN_GT_0, "ops");          break;
+        case 'k':   sessions = getInt(optarg, GN_GT_0, "sessions"); break;
+        case 'r':   readPct = getInt(optarg, GN_NONNEG, "read-pct"); break;
+        case 'm':
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                for (m = 0; m < NUM_METHODS; m++)
+                    if (strcmp(tok, methodNames[m]) == 0)
+                        break;
+                if (m == NUM_METHODS || nmeth == NUM_METHODS)
+                    usageError(argv[0]);
+                meth[nmeth++] = m;
+            }
+            break;
+        case 'C':   csv = TRUE;                                     break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind != argc || readPct > 100)
+        usageError(argv[0]);
+
+    if (nprocs == 0) {
+        procs[nprocs++] = 1;
+        procs[nprocs++] = 2;
+        procs[nprocs++] = 4;
+    }
+    for (j = 0; j < nprocs; j++)
+        if (procs[j] > MAX_PROCS)
+            cmdLineErr("At most %d processes\n", MAX_PROCS);
+    if (nmeth == 0)
+        for (m = 0; m < NUM_METHODS; m++)
+            meth[nmeth++] = m;
+
+    heapSize = shtMemSize(sessions, sizeof(struct session)) + 1024 * 1024;
+
+    if (csv)
+        printf("method,procs,read_pct,ops_per_sec,ns_per_op\n");
+    else
+        printf("%-6s %6s %6s %12s %10s\n", "method", "procs", "read%",
+               "ops/s", "ns/op");
+
+    for (m = 0; m < nmeth; m++) {
+        for (j = 0; j < nprocs; j++) {
+            ns = runBench(meth[m], procs[j], ops, sessions, readPct,
+                          heapSize);
+            printf(csv ? "%s,%d,%d,%.0f,%.1f\n" :
+                         "%-6s %6d %6d %12.0f %10.1f\n",
+                   methodNames[meth[m]], procs[j], readPct,
+                   procs[j] * ops / (ns / 1e9),
+                   (double) ns / (procs[j] * ops));
+            fflush(stdout);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,740 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* shm_heap.c
+
+   A memory allocator for a segment of shared memory (a POSIX shared
+   memory object, or a memfd) used by several processes, so that they can
+   build linked data structures (hash tables, queues, trees) in it,
+   rather than serializing data into a flat byte string as pshm_write.c
+   and pshm_read.c do.
+
+   Each process may map the segment at a different address (shmHeapAttach()
+   lets mmap() choose one), so data structures in the heap must refer to
+   one another by offset (shmOff) rather than by pointer; shmPtr() and
+   shmOffOf() convert between the two in the calling process. A process
+   finds the structures it shares with others through the heap's root
+   slots (shmHeapSetRoot() and shmHeapGetRoot()).
+
+   The segment begins with a header, containing a process-shared, robust
+   mutex that protects the shared state: a free list for each of a set
+   of size classes (with four classes per power of two, up to
+   SH_MAX_BINNED bytes), an address-ordered free list of larger blocks
+   (first fit, coalesced on free), and the boundary of the space from
+   which no block has yet been carved. A request is rounded up to the
+   size of its class, and is served from the class's free list, or else
+   carved from fresh space, or, failing that, taken from the list of a
+   larger class. Freed blocks are not coalesced (except for the largest
+   ones), so memory freed in one size class is reused only by requests
+   of that class or smaller ones; a heap whose mix of sizes changes over
+   time needs room to spare.
+
+   To avoid taking the mutex for every allocation, each attachment keeps
+   a cache of free blocks of each class up to SH_MAX_SMALL bytes,
+   refilled from (and, when it grows too large, flushed to) the shared
+   lists a batch at a time; new small blocks are carved a batch at a
+   time. Caches are flushed by shmHeapFlush() and shmHeapDetach().
+
+   If a process dies while holding the mutex, the next process to lock it
+   gets EOWNERDEAD, marks it consistent, and carries on: each change to
+   the shared lists is committed by a single store, ordered so that a
+   change interrupted part way leaks memory rather than corrupting the
+   lists. The blocks in a dead process's cache are also leaked. A heap
+   does not grow; shmAlloc() fails with ENOMEM when it is full.
+
+   shmMutexInit() and shmMutexLock() give applications the same kind of
+   robust, process-shared mutex, for the data structures they build in
+   the heap.
+
+   This module is Linux-specific (because of memfd, and the use of
+   robust mutexes; these are in SUSv4, but are not universally
+   implemented).
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include "shm_heap.h"           /* Declares functions defined here */
+
+#define SH_MAGIC 0x53484850U    /* "SHHP" */
+#define SH_VERSION 1
+#define SH_ALIGN 16             /* Alignment of blocks (and their data) */
+#define SH_LARGE_ALIGN 64       /* Large block sizes are rounded to this */
+#define SH_BATCH 16             /* Blocks moved to/from a cache at once */
+#define SH_CACHE_MAX (2 * SH_BATCH)
+#define ATTACH_WAIT_MS 1000     /* Max. wait for a creator to initialize */
+
+/* Size classes, by block size (including the block header): 32 to 128
+   bytes in steps of 16, then four classes per power of two */
+
+#define SH_MAX_SMALL 4096       /* Classes up to this size are cached */
+#define SH_SMALL_CLASSES 27
+#define SH_MAX_BINNED (1024 * 1024)
+#define SH_CLASSES 59           /* Classes up to SH_MAX_BINNED */
+
+struct shmBlock {               /* Precedes the data of every block */
+    uint64_t size;              /* Of the whole block */
+    shmOff next;                /* Next free block, when on a free list */
+};
+
+struct shmHeapHdr {
+    uint32_t magic;             /* Set last, when initialization is done */
+    uint32_t version;
+    uint64_t size;
+    pthread_mutex_t mtx;        /* Protects the following fields */
+    uint64_t top;               /* Start of uncarved space */
+    shmOff freeList[SH_CLASSES];
+    shmOff largeFree;           /* Address-ordered */
+    uint64_t recoveries;
+    shmOff roots[SH_ROOTS];     /* Accessed atomically, without 'mtx' */
+};
+
+struct shmCache {
+    int count;
+    shmOff blocks[SH_CACHE_MAX];
+};
+
+#define BLOCK(h, off) ((struct shmBlock *) ((h)->base + (off)))
+#define HDR_SIZE ((sizeof(struct shmHeapHdr) + SH_LARGE_ALIGN - 1) / \
+                  SH_LARGE_ALIGN * SH_LARGE_ALIGN)
+
+/* Initialize 'mtx' (in shared memory) as a robust, process-shared mutex.
+   Returns 0 on success, or -1 on error. */
+
+int
+shmMutexInit(pthread_mutex_t *mtx)
+{
+    pthread_mutexattr_t attr;
+    int s;
+
+    s = pthread_mutexattr_init(&attr);
+    if (s == 0)
+        s = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if (s == 0)
+        s = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    if (s == 0)
+        s = pthread_mutex_init(mtx, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+/* Lock a mutex initialized by shmMutexInit(). Returns 0 on success, 1 if
+   the previous owner died holding the mutex (which has been made
+   consistent; the caller may need to repair the data that the mutex
+   protects), or -1 on error. */
+
+int
+shmMutexLock(struct shmHeap *h, pthread_mutex_t *mtx)
+{
+    int s;
+
+    s = pthread_mutex_lock(mtx);
+    if (s == EOWNERDEAD) {
+        __atomic_fetch_add(&h->hdr->recoveries, 1, __ATOMIC_RELAXED);
+        s = pthread_mutex_consistent(mtx);
+        if (s == 0)
+            return 1;
+    }
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+static int
+heapLock(struct shmHeap *h)
+{
+    return (shmMutexLock(h, &h->hdr->mtx) == -1) ? -1 : 0;
+}
+
+static void
+heapUnlock(struct shmHeap *h)
+{
+    pthread_mutex_unlock(&h->hdr->mtx);
+}
+
+/* Map the segment referred to by 'fd' (of 'size' bytes), and allocate the
+   per-process state */
+
+static struct shmHeap *
+mapHeap(int fd, size_t size)
+{
+    struct shmHeap *h;
+    int savedErrno;
+
+    h = calloc(1, sizeof(struct shmHeap));
+    if (h == NULL)
+        return NULL;
+    h->cache = calloc(SH_SMALL_CLASSES, sizeof(struct shmCache));
+    if (h->cache == NULL)
+        goto fail;
+    h->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (h->base == MAP_FAILED)
+        goto fail;
+    h->size = size;
+    h->fd = fd;
+    h->hdr = (struct shmHeapHdr *) h->base;
+    pthread_mutex_init(&h->cacheMtx, NULL);
+    return h;
+
+fail:
+    savedErrno = errno;
+    free(h->cache);
+    free(h);
+    errno = savedErrno;
+    return NULL;
+}
+
+static void
+unmapHeap(struct shmHeap *h)
+{
+    munmap(h->base, h->size);
+    pthread_mutex_destroy(&h->cacheMtx);
+    free(h->cache);
+    free(h);
+}
+
+/* Make the segment referred to by 'fd' 'size' bytes long, and create an
+   empty heap in it. 'fd' (which belongs to the heap from now on) might
+   come from shm_open() or memfd_create(); other processes can attach
+   to the heap via the same name, or via a duplicate of 'fd' (inherited
+   across fork(), or passed through a UNIX domain socket). Returns a
+   pointer to the heap, or NULL on error. */
+
+struct shmHeap *
+shmHeapCreate(int fd, size_t size)
+{
+    struct shmHeapHdr *hdr;
+    struct shmHeap *h;
+    int savedErrno;
+
+    if (size < HDR_SIZE + SH_MAX_SMALL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (ftruncate(fd, size) == -1)
+        return NULL;
+    h = mapHeap(fd, size);
+    if (h == NULL)
+        return NULL;
+
+    hdr = h->hdr;
+    hdr->version = SH_VERSION;
+    hdr->size = size;
+    hdr->top = HDR_SIZE;
+    if (shmMutexInit(&hdr->mtx) == -1) {
+        savedErrno = errno;
+        unmapHeap(h);
+        errno = savedErrno;
+        return NULL;
+    }
+    __atomic_store_n(&hdr->magic, SH_MAGIC, __ATOMIC_RELEASE);
+    return h;
+}
+
+/* Attach to the heap in the segment referred to by 'fd' (which belongs
+   to the heap from now on), at an address chosen by the kernel. If the
+   segment is still being initialized by its creator, wait (a little)
+   for it to finish. Returns a pointer to the heap, or NULL on error. */
+
+struct shmHeap *
+shmHeapAttach(int fd)
+{
+    struct timespec ts = { 0, 1000000 };
+    struct shmHeap *h;
+    struct stat sb;
+    int ms;
+
+    for (ms = 0; ; ms++) {
+        if (fstat(fd, &sb) == -1)
+            return NULL;
+        if (sb.st_size >= (off_t) HDR_SIZE)
+            break;
+        if (ms == ATTACH_WAIT_MS) {
+            errno = EINVAL;
+            return NULL;
+        }
+        nanosleep(&ts, NULL);
+    }
+
+    h = mapHeap(fd, sb.st_size);
+    if (h == NULL)
+        return NULL;
+    for (ms = 0; __atomic_load_n(&h->hdr->magic, __ATOMIC_ACQUIRE) !=
+                 SH_MAGIC; ms++) {
+        if (ms == ATTACH_WAIT_MS) {
+            unmapHeap(h);
+            errno = EINVAL;             /* Not a heap */
+            return NULL;
+        }
+        nanosleep(&ts, NULL);
+    }
+    if (h->hdr->version != SH_VERSION || h->hdr->size != h->size) {
+        unmapHeap(h);
+        errno = EINVAL;
+        return NULL;
+    }
+    return h;
+}
+
+/* Open the heap in the POSIX shared memory object 'name'. If 'oflag'
+   includes O_CREAT, and the object does not exist, it is created (with
+   permissions 'mode') and a heap of 'size' bytes is created in it;
+   otherwise, the existing heap is attached. Returns a pointer to the
+   heap, or NULL on error. */
+
+struct shmHeap *
+shmHeapOpen(const char *name, int oflag, mode_t mode, size_t size)
+{
+    struct shmHeap *h;
+    int fd, savedErrno;
+
+    oflag &= ~O_ACCMODE;
+    fd = -1;
+    if (oflag & O_CREAT) {
+        fd = shm_open(name, O_RDWR | O_CLOEXEC | O_CREAT | O_EXCL, mode);
+        if (fd == -1 && (errno != EEXIST || (oflag & O_EXCL)))
+            return NULL;
+        if (fd != -1) {
+            h = shmHeapCreate(fd, size);
+            if (h == NULL) {
+                savedErrno = errno;
+                shm_unlink(name);
+                close(fd);
+                errno = savedErrno;
+            }
+            return h;
+        }
+    }
+
+    fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+    if (fd == -1)
+        return NULL;
+    h = shmHeapAttach(fd);
+    if (h == NULL) {
+        savedErrno = errno;
+        close(fd);
+        errno = savedErrno;
+    }
+    return h;
+}
+
+/* Return the class for blocks of 'blockSize' bytes (at most
+   SH_MAX_BINNED), and the block size of class 'c' */
+
+static int
+sizeClass(uint64_t blockSize)
+{
+    int p;
+
+    if (blockSize <= 128)
+        return (blockSize <= 32) ? 0 : (blockSize - 32 + 15) / 16;
+    p = 63 - __builtin_clzll(blockSize - 1);    /* 2^p < blockSize */
+    return 7 + (p - 7) * 4 + ((blockSize - 1 - (1ULL << p)) >> (p - 2));
+}
+
+static uint64_t
+classSize(int c)
+{
+    int p;
+
+    if (c < 7)
+        return 32 + 16 * c;
+    p = 7 + (c - 7) / 4;
+    return (1ULL << p) + ((uint64_t) ((c - 7) % 4 + 1) << (p - 2));
+}
+
+/* Pop a block from the free list of a class larger than 'c'. Called with
+   the heap locked. Returns the block's offset, or 0 if there is none. */
+
+static shmOff
+stealLocked(struct shmHeap *h, int c)
+{
+    shmOff off;
+
+    for (c++; c < SH_CLASSES; c++) {
+        off = h->hdr->freeList[c];
+        if (off != 0) {
+            h->hdr->freeList[c] = BLOCK(h, off)->next;  /* Commits */
+            return off;
+        }
+    }
+    return 0;
+}
+
+/* Refill the (empty) cache for class 'c' from the shared free list, and
+   if that is not enough, from uncarved space. Called with 'cacheMtx'
+   held. Returns 0 on success, or -1 on error. */
+
+static int
+refillCache(struct shmHeap *h, int c)
+{
+    struct shmHeapHdr *hdr = h->hdr;
+    struct shmCache *sc = &h->cache[c];
+    struct shmBlock *b;
+    uint64_t top;
+    shmOff off;
+    int n;
+
+    if (heapLock(h) == -1)
+        return -1;
+
+    while (sc->count < SH_BATCH && hdr->freeList[c] != 0) {
+        off = hdr->freeList[c];
+        hdr->freeList[c] = BLOCK(h, off)->next;     /* Commits the pop */
+        sc->blocks[sc->count++] = off;
+    }
+
+    if (sc->count == 0) {
+        top = hdr->top;
+        n = (hdr->size - top) / classSize(c);
+        if (n > SH_BATCH)
+            n = SH_BATCH;
+        if (n > 0) {
+            hdr->top = top + n * classSize(c);         /* Commits */
+            for (; n > 0; n--, top += classSize(c)) {
+                b = BLOCK(h, top);
+                b->size = classSize(c);
+                sc->blocks[sc->count++] = top;
+            }
+        } else {
+            off = stealLocked(h, c);
+            if (off == 0) {
+                heapUnlock(h);
+                errno = ENOMEM;
+                return -1;
+            }
+            sc->blocks[sc->count++] = off;
+        }
+    }
+
+    heapUnlock(h);
+    h->refills++;
+    return 0;
+}
+
+/* Return 'n' blocks from the cache for class 'c' to the shared free list.
+   Called with 'cacheMtx' held. */
+
+static void
+flushCache(struct shmHeap *h, int c, int n)
+{
+    struct shmCache *sc = &h->cache[c];
+    shmOff off;
+
+    if (n == 0 || heapLock(h) == -1)
+        return;
+    while (n-- > 0) {
+        off = sc->blocks[--sc->count];
+        BLOCK(h, off)->next = h->hdr->freeList[c];
+        h->hdr->freeList[c] = off;                  /* Commits the push */
+    }
+    heapUnlock(h);
+    h->flushes++;
+}
+
+/* Allocate a block of class 'c' (too large to be cached). Returns its
+   offset, or 0 on error. */
+
+static shmOff
+allocBinned(struct shmHeap *h, int c)
+{
+    struct shmHeapHdr *hdr = h->hdr;
+    shmOff off;
+
+    if (heapLock(h) == -1)
+        return 0;
+    off = hdr->freeList[c];
+    if (off != 0) {
+        hdr->freeList[c] = BLOCK(h, off)->next;     /* Commits the pop */
+    } else if (hdr->size - hdr->top >= classSize(c)) {
+        off = hdr->top;
+        hdr->top += classSize(c);                   /* Commits */
+        BLOCK(h, off)->size = classSize(c);
+    } else {
+        off = stealLocked(h, c);
+        if (off == 0)
+            errno = ENOMEM;
+    }
+    heapUnlock(h);
+    return off;
+}
+
+static void
+freeBinned(struct shmHeap *h, shmOff off)
+{
+    int c = sizeClass(BLOCK(h, off)->size);
+
+    if (heapLock(h) == -1)
+        return;
+    BLOCK(h, off)->next = h->hdr->freeList[c];
+    h->hdr->freeList[c] = off;                      /* Commits the push */
+    heapUnlock(h);
+}
+
+/* Allocate a block of at least 'blockSize' bytes (a multiple of
+   SH_LARGE_ALIGN) from the large-block list, or else from uncarved
+   space. Returns its offset, or 0 on error. */
+
+static shmOff
+allocLarge(struct shmHeap *h, uint64_t blockSize)
+{
+    struct shmHeapHdr *hdr = h->hdr;
+    shmOff off, rest, *prevNext;
+    struct shmBlock *b, *r;
+
+    if (heapLock(h) == -1)
+        return 0;
+
+    for (prevNext = &hdr->largeFree; *prevNext != 0;
+            prevNext = &b->next) {
+        off = *prevNext;
+        b = BLOCK(h, off);
+        if (b->size < blockSize)
+            continue;
+
+        if (b->size - blockSize >= SH_LARGE_ALIGN) {
+
+            /* Split: the remainder takes this block's place in the list */
+
+            rest = off + blockSize;
+            r = BLOCK(h, rest);
+            r->size = b->size - blockSize;
+            r->next = b->next;
+            *prevNext = rest;                       /* Commits */
+            b->size = blockSize;
+        } else {
+            *prevNext = b->next;                    /* Commits */
+        }
+        heapUnlock(h);
+        return off;
+    }
+
+    if (hdr->size - hdr->top < blockSize) {
+        heapUnlock(h);
+        errno = ENOMEM;
+        return 0;
+    }
+    off = hdr->top;
+    hdr->top += blockSize;                          /* Commits */
+    BLOCK(h, off)->size = blockSize;
+    heapUnlock(h);
+    return off;
+}
+
+/* Put the large block at 'off' on the large-block list, merging it with
+   its neighbors. Each merge first unlinks the block being absorbed, so
+   that if we die part way, the block is leaked rather than listed twice */
+
+static void
+freeLarge(struct shmHeap *h, shmOff off)
+{
+    struct shmHeapHdr *hdr = h->hdr;
+    struct shmBlock *b, *prev, *next;
+    shmOff *prevNext, prevOff;
+
+    if (heapLock(h) == -1)
+        return;
+
+    prevOff = 0;
+    for (prevNext = &hdr->largeFree; *prevNext != 0 && *prevNext < off;
+            prevNext = &BLOCK(h, prevOff)->next)
+        prevOff = *prevNext;
+
+    b = BLOCK(h, off);
+    b->next = *prevNext;
+    if (b->next != 0 && off + b->size == b->next) {     /* Merge next */
+        next = BLOCK(h, b->next);
+        b->next = next->next;
+        b->size += next->size;
+    }
+
+    if (prevOff != 0 && prevOff + BLOCK(h, prevOff)->size == off) {
+        prev = BLOCK(h, prevOff);                       /* Merge into prev */
+        prev->next = b->next;           /* Unlinks the absorbed next */
+        prev->size += b->size;
+    } else {
+        *prevNext = off;                                /* Commits */
+    }
+    heapUnlock(h);
+}
+
+/* Allocate 'size' bytes from the heap. Returns a pointer to the memory
+   (aligned on a 16-byte boundary; use shmOffOf() to obtain an offset that
+   can be stored in the heap), or NULL on error. */
+
+void *
+shmAlloc(struct shmHeap *h, size_t size)
+{
+    struct shmCache *sc;
+    uint64_t blockSize;
+    shmOff off;
+    int c;
+
+    if (size > h->size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    blockSize = (sizeof(struct shmBlock) + size + SH_ALIGN - 1) &
+                ~(uint64_t) (SH_ALIGN - 1);
+
+    if (blockSize > SH_MAX_SMALL) {
+        if (blockSize > SH_MAX_BINNED) {
+            blockSize = (blockSize + SH_LARGE_ALIGN - 1) &
+                        ~(uint64_t) (SH_LARGE_ALIGN - 1);
+            off = allocLarge(h, blockSize);
+        } else {
+            off = allocBinned(h, sizeClass(blockSize));
+        }
+        if (off == 0)
+            return NULL;
+        pthread_mutex_lock(&h->cacheMtx);
+        h->allocs++;
+        pthread_mutex_unlock(&h->cacheMtx);
+        return h->base + off + sizeof(struct shmBlock);
+    }
+
+    c = sizeClass(blockSize);
+    sc = &h->cache[c];
+    pthread_mutex_lock(&h->cacheMtx);
+    if (sc->count == 0 && refillCache(h, c) == -1) {
+        pthread_mutex_unlock(&h->cacheMtx);
+        return NULL;
+    }
+    off = sc->blocks[--sc->count];
+    h->allocs++;
+    pthread_mutex_unlock(&h->cacheMtx);
+
+    return h->base + off + sizeof(struct shmBlock);
+}
+
+/* Free memory returned by shmAlloc() (in this or any other process) */
+
+void
+shmFree(struct shmHeap *h, void *p)
+{
+    struct shmCache *sc;
+    shmOff off;
+    int c;
+
+    if (p == NULL)
+        return;
+
+    off = (char *) p - h->base - sizeof(struct shmBlock);
+    if (BLOCK(h, off)->size > SH_MAX_SMALL) {
+        if (BLOCK(h, off)->size > SH_MAX_BINNED)
+            freeLarge(h, off);
+        else
+            freeBinned(h, off);
+        pthread_mutex_lock(&h->cacheMtx);
+        h->frees++;
+        pthread_mutex_unlock(&h->cacheMtx);
+        return;
+    }
+
+    c = sizeClass(BLOCK(h, off)->size);
+    sc = &h->cache[c];
+    pthread_mutex_lock(&h->cacheMtx);
+    if (sc->count == SH_CACHE_MAX)
+        flushCache(h, c, SH_BATCH);
+    if (sc->count < SH_CACHE_MAX)       /* Else flush failed: leak */
+        sc->blocks[sc->count++] = off;
+    h->frees++;
+    pthread_mutex_unlock(&h->cacheMtx);
+}
+
+/* Set and get root slots, in which processes leave the offsets of the
+   data structures they share */
+
+void
+shmHeapSetRoot(struct shmHeap *h, int slot, shmOff off)
+{
+    if (slot >= 0 && slot < SH_ROOTS)
+        __atomic_store_n(&h->hdr->roots[slot], off, __ATOMIC_RELEASE);
+}
+
+shmOff
+shmHeapGetRoot(const struct shmHeap *h, int slot)
+{
+    if (slot < 0 || slot >= SH_ROOTS)
+        return 0;
+    return __atomic_load_n(&h->hdr->roots[slot], __ATOMIC_ACQUIRE);
+}
+
+/* Return the blocks in this process's cache to the shared lists */
+
+void
+shmHeapFlush(struct shmHeap *h)
+{
+    int c;
+
+    pthread_mutex_lock(&h->cacheMtx);
+    for (c = 0; c < SH_SMALL_CLASSES; c++)
+        flushCache(h, c, h->cache[c].count);
+    pthread_mutex_unlock(&h->cacheMtx);
+}
+
+void
+shmHeapGetStats(struct shmHeap *h, struct shmHeapStats *stats)
+{
+    shmOff off;
+    int c;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->size = h->size;
+
+    pthread_mutex_lock(&h->cacheMtx);
+    for (c = 0; c < SH_SMALL_CLASSES; c++)
+        stats->cached += h->cache[c].count * classSize(c);
+    stats->allocs = h->allocs;
+    stats->frees = h->frees;
+    stats->refills = h->refills;
+    stats->flushes = h->flushes;
+    pthread_mutex_unlock(&h->cacheMtx);
+
+    if (heapLock(h) == 0) {
+        stats->carved = h->hdr->top - HDR_SIZE;
+        for (c = 0; c < SH_CLASSES; c++)
+            for (off = h->hdr->freeList[c]; off != 0;
+                    off = BLOCK(h, off)->next)
+                stats->listed += BLOCK(h, off)->size;
+        for (off = h->hdr->largeFree; off != 0; off = BLOCK(h, off)->next)
+            stats->listed += BLOCK(h, off)->size;
+        heapUnlock(h);
+    }
+    stats->recoveries = __atomic_load_n(&h->hdr->recoveries,
+                                        __ATOMIC_RELAXED);
+}
+
+/* Flush this process's cache, unmap the heap, and close its file
+   descriptor. The heap itself persists (until the shared memory object
+   is unlinked, or the last descriptor for the memfd is closed). */
+
+void
+shmHeapDetach(struct shmHeap *h)
+{
+    int fd = h->fd;
+
+    shmHeapFlush(h);
+    unmapHeap(h);
+    close(fd);
+}
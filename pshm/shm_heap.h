@@ -0,0 +1,98 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* shm_heap.h
+
+   Header file for shm_heap.c.
+*/
+#ifndef SHM_HEAP_H
+#define SHM_HEAP_H              /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* A location in a heap, as an offset from the start of the segment, so
+   that it means the same thing in every process, wherever the segment is
+   mapped. 0 is the null offset. */
+
+typedef uint64_t shmOff;
+
+#define SH_ROOTS 16             /* Root slots in each heap */
+
+struct shmHeapHdr;              /* In the segment; defined in shm_heap.c */
+struct shmCache;
+
+struct shmHeap {                /* One per process (or per attachment) */
+    char *base;                 /* Where the segment is mapped */
+    size_t size;
+    int fd;
+    struct shmHeapHdr *hdr;     /* == base */
+    pthread_mutex_t cacheMtx;   /* Protects 'cache' and the counters */
+    struct shmCache *cache;     /* Blocks held by this process */
+    unsigned long allocs;
+    unsigned long frees;
+    unsigned long refills;      /* Batches taken from the shared lists */
+    unsigned long flushes;      /* Batches returned to the shared lists */
+};
+
+struct shmHeapStats {
+    size_t size;                /* Size of the segment */
+    size_t carved;              /* Bytes handed out from fresh space */
+    size_t listed;              /* Bytes on the shared free lists */
+    size_t cached;              /* Bytes in this process's cache */
+    unsigned long allocs;       /* The following are for this process */
+    unsigned long frees;
+    unsigned long refills;
+    unsigned long flushes;
+    unsigned long recoveries;   /* Heap locks recovered from dead owners
+                                   (all processes) */
+};
+
+static inline void *
+shmPtr(const struct shmHeap *h, shmOff off)
+{
+    return (off == 0) ? NULL : h->base + off;
+}
+
+static inline shmOff
+shmOffOf(const struct shmHeap *h, const void *p)
+{
+    return (p == NULL) ? 0 : (shmOff) ((const char *) p - h->base);
+}
+
+struct shmHeap *shmHeapCreate(int fd, size_t size);
+
+struct shmHeap *shmHeapAttach(int fd);
+
+struct shmHeap *shmHeapOpen(const char *name, int oflag, mode_t mode,
+                            size_t size);
+
+void *shmAlloc(struct shmHeap *h, size_t size);
+
+void shmFree(struct shmHeap *h, void *p);
+
+void shmHeapSetRoot(struct shmHeap *h, int slot, shmOff off);
+
+shmOff shmHeapGetRoot(const struct shmHeap *h, int slot);
+
+int shmMutexInit(pthread_mutex_t *mtx);
+
+int shmMutexLock(struct shmHeap *h, pthread_mutex_t *mtx);
+
+void shmHeapGetStats(struct shmHeap *h, struct shmHeapStats *stats);
+
+void shmHeapFlush(struct shmHeap *h);
+
+void shmHeapDetach(struct shmHeap *h);
+
+#endif
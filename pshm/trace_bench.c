@@ -0,0 +1,210 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* trace_bench.c
+
+   Measure the cost of recording an event with trace_buf.c.
+
+   Usage: trace_bench [-n events] [-t threads] [-d]
+
+        -n events       Number of operations per thread, for each
+                        measurement (default: 1000000)
+        -t threads      Number of threads performing the operations
+                        concurrently (default: 1)
+        -d              Disable tracing at run time (by removing
+                        TLPI_TRACE from the environment before the first
+                        event is recorded)
+
+   Tracing is enabled by setting TLPI_TRACE in the environment (if it
+   isn't set, and -d is not specified, the program sets it to "1", so
+   that the trace goes to /tlpi_trace.<pid>, which the program reports).
+   For each of the following operations, the program reports the mean
+   CPU time per operation, averaged over the threads:
+
+        loop            An empty loop iteration (the measurement's own
+                        overhead)
+        record          traceTicks() and traceRecord(), as called by the
+                        wrapper of a traced function
+        read            A 1-byte read() from /dev/zero
+        readn           A 1-byte readn() from /dev/zero; the difference
+                        from "read" is the cost of readn() itself,
+                        including tracing if the library was built with
+                        TLPI_TRACE defined
+
+   Compare "readn" with the library built with and without TLPI_TRACE
+   (see Makefile.inc) to see the total cost of tracing a library
+   function.
+
+   Try: trace_bench -t 4; trace_read -a -u <pid>
+
+   This program is Linux-specific.
+*/
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include "trace_buf.h"
+#include "rdwrn.h"
+#include "tlpi_hdr.h"
+
+enum { OP_LOOP, OP_RECORD, OP_READ, OP_READN, NOPS };
+
+static const char *opNames[NOPS] = { "loop", "record", "read", "readn" };
+
+static long numOps;
+static pthread_barrier_t barrier;
+
+struct thread {
+    pthread_t tid;
+    long long ns[NOPS];
+};
+
+/* CPU time (so that threads sharing a CPU don't inflate each other's
+   times) */
+
+static long long
+cpuNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *
+threadFunc(void *arg)
+{
+    struct thread *t = arg;
+    long long start;
+    char ch;
+    long j;
+    int fd, op;
+
+    fd = open("/dev/zero", O_RDONLY);
+    if (fd == -1)
+        errExit("open");
+
+    /* Claim this thread's ring (if tracing) before timing */
+
+    traceRecord(TR_READN, fd, 0, traceTicks());
+
+    for (op = 0; op < NOPS; op++) {
+        pthread_barrier_wait(&barrier);     /* All threads start together */
+        start = cpuNs();
+        switch (op) {
+        case OP_LOOP:
+            for (j = 0; j < numOps; j++)
+                __asm__ __volatile__ ("" ::: "memory");
+            break;
+        case OP_RECORD:
+            for (j = 0; j < numOps; j++)
+                traceRecord(TR_READN, fd, j, traceTicks());
+            break;
+        case OP_READ:
+            for (j = 0; j < numOps; j++)
+                if (read(fd, &ch, 1) != 1)
+                    errExit("read");
+            break;
+        case OP_READN:
+            for (j = 0; j < numOps; j++)
+                if (readn(fd, &ch, 1) != 1)
+                    errExit("readn");
+            break;
+        }
+        t->ns[op] = cpuNs() - start;
+    }
+
+    close(fd);
+    return NULL;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n events] [-t threads] [-d]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct thread *thr;
+    Boolean disable;
+    long long totNs;
+    int opt, nthreads, op, j, s;
+
+    numOps = 1000000;
+    nthreads = 1;
+    disable = FALSE;
+    while ((opt = getopt(argc, argv, "n:t:d")) != -1) {
+        switch (opt) {
+        case 'n':   numOps = getLong(optarg, GN_GT_0, "-n");    break;
+        case 't':   nthreads = getInt(optarg, GN_GT_0, "-t");   break;
+        case 'd':   disable = TRUE;                             break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+
+    if (disable) {
+        if (unsetenv("TLPI_TRACE") == -1)
+            errExit("unsetenv");
+    } else if (getenv("TLPI_TRACE") == NULL) {
+        if (setenv("TLPI_TRACE", "1", 0) == -1)
+            errExit("setenv");
+    }
+
+    /* Record an event in the main thread, which creates the trace */
+
+    traceRecord(TR_READN, -1, 0, traceTicks());
+    if (traceMyRing == NULL)
+        printf("Tracing disabled\n");
+    else if (getenv("TLPI_TRACE")[0] == '/')
+        printf("Tracing to %s\n", getenv("TLPI_TRACE"));
+    else
+        printf("Tracing to /tlpi_trace.%ld\n", (long) getpid());
+#ifndef TLPI_TRACE
+    printf("(readn() is not traced unless the library and this program "
+           "are built with TLPI_TRACE)\n");
+#endif
+
+    thr = calloc(nthreads, sizeof(struct thread));
+    if (thr == NULL)
+        errExit("calloc");
+    s = pthread_barrier_init(&barrier, NULL, nthreads);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_init");
+
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_create(&thr[j].tid, NULL, threadFunc, &thr[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_join(thr[j].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    printf("%-8s %10s\n", "op", "ns/op");
+    for (op = 0; op < NOPS; op++) {
+        totNs = 0;
+        for (j = 0; j < nthreads; j++)
+            totNs += thr[j].ns[op];
+        printf("%-8s %10.1f\n", opNames[op],
+               (double) totNs / nthreads / numOps);
+    }
+
+    free(thr);
+    exit(EXIT_SUCCESS);
+}
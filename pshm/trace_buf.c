@@ -0,0 +1,526 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* trace_buf.c
+
+   A trace of calls to some of the library's functions, recorded in a
+   POSIX shared memory object, so that it can be read (by trace_read.c)
+   while the traced program runs, or after it has terminated.
+
+   Tracing is compiled in only if the library and programs are built
+   with TLPI_TRACE defined (see Makefile.inc, and the wrapper functions
+   below), and is then switched on at run time by setting the
+   environment variable TLPI_TRACE: if its value begins with "/", it names the shared memory object; otherwise, the object is named
+   /tlpi_trace.<pid>. TLPI_TRACE_EVENTS sets the number of events kept
+   per thread (rounded up to a power of two; default 16384), and
+   TLPI_TRACE_THREADS the number of threads that can be traced (default
+   64); the object is (TLPI_TRACE_THREADS * (64 + 32 *
+   TLPI_TRACE_EVENTS)) bytes, plus a page.
+
+   Each thread, on recording its first event, claims a ring of events in
+   the object, and thereafter records events without locking or system
+   calls: an event is written to the next slot, and then the ring's
+   'head' counter is advanced with a release store. When a ring is full,
+   the oldest events are overwritten. A reader keeps its own position in
+   each ring; having copied events, it rereads 'head', and discards any
+   copied events whose slots might have been overwritten meanwhile
+   (counting them as lost). Rings are not reused when threads terminate;
+   threads beyond the limit are not traced (and are counted). A child
+   created by fork() records its events in new rings in the same
+   object.
+
+   Timestamps are taken from the CPU's timestamp counter (on x86 and
+   ARM64), whose rate is calibrated against CLOCK_MONOTONIC (for 2 ms)
+   when the object is created.
+
+   The shared memory object is not removed when the traced process
+   terminates; see trace_read.c.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "trace_buf.h"          /* Declares functions defined here */
+
+#define TRACE_MAGIC 0x54726331  /* "Trc1" */
+#define HDR_SIZE 4096
+#define DEFAULT_EVENTS 16384
+#define DEFAULT_THREADS 64
+#define CALIBRATE_NS 2000000
+
+struct traceHeader {            /* At the start of the object */
+    uint32_t magic;             /* Set last, once the header is valid */
+    uint32_t nrings;
+    uint32_t nevents;           /* Per ring */
+    uint32_t ringsUsed;         /* Rings claimed (may exceed 'nrings') */
+    int32_t pid;
+    double nsPerTick;
+    uint64_t tick0;             /* Ticks when the object was created, */
+    uint64_t mono0;             /* and the CLOCK_MONOTONIC and */
+    uint64_t real0;             /* CLOCK_REALTIME times, in ns */
+};
+
+const char *traceFuncNames[TR_NFUNCS] = {
+    "readn", "writen", "readLine", "inetConnect", "reserveSem",
+    "releaseSem", "lockRegion", "lockRegionWait", "sendfd", "recvfd"
+};
+
+__thread struct traceRing *traceMyRing;
+static __thread int triedRing;          /* traceRingSlow() called? */
+
+static pthread_once_t setupOnce = PTHREAD_ONCE_INIT;
+static struct traceHeader *hdr;         /* NULL if not tracing */
+
+static size_t
+ringSize(uint32_t nevents)
+{
+    return sizeof(struct traceRing) + nevents * sizeof(struct traceEvent);
+}
+
+static struct traceRing *
+ringAt(struct traceHeader *h, uint32_t idx)
+{
+    return (struct traceRing *) ((char *) h + HDR_SIZE +
+                                 idx * ringSize(h->nevents));
+}
+
+static uint64_t
+clockNs(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static long
+envLong(const char *name, long dflt)
+{
+    const char *s;
+    long v;
+
+    s = getenv(name);
+    if (s == NULL || (v = strtol(s, NULL, 0)) <= 0)
+        return dflt;
+    return v;
+}
+
+/* In a child created by fork(), the parent's rings belong to the
+   parent's threads */
+
+static void
+atforkChild(void)
+{
+    traceMyRing = NULL;
+    triedRing = 0;
+}
+
+static void
+setup(void)
+{
+    struct traceHeader *h;
+    const char *env;
+    char name[64];
+    uint64_t t1, m1;
+    uint32_t nevents, nrings;
+    size_t size;
+    int fd;
+
+    env = getenv("TLPI_TRACE");
+    if (env == NULL || *env == '\0')
+        return;
+    if (*env == '/')
+        snprintf(name, sizeof(name), "%s", env);
+    else
+        snprintf(name, sizeof(name), "/tlpi_trace.%ld", (long) getpid());
+
+    for (nevents = 1; nevents < envLong("TLPI_TRACE_EVENTS", DEFAULT_EVENTS)
+            && nevents < (1U << 30); nevents <<= 1)
+        continue;
+    nrings = envLong("TLPI_TRACE_THREADS", DEFAULT_THREADS);
+    size = HDR_SIZE + nrings * ringSize(nevents);
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        return;
+    if (ftruncate(fd, size) == -1) {
+        close(fd);
+        return;
+    }
+    h = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED)
+        return;
+
+    h->nrings = nrings;
+    h->nevents = nevents;
+    h->pid = getpid();
+
+    /* Calibrate the tick counter */
+
+    h->real0 = clockNs(CLOCK_REALTIME);
+    h->mono0 = clockNs(CLOCK_MONOTONIC);
+    h->tick0 = traceTicks();
+    do
+        m1 = clockNs(CLOCK_MONOTONIC);
+    while (m1 - h->mono0 < CALIBRATE_NS);
+    t1 = traceTicks();
+    h->nsPerTick = (t1 > h->tick0) ? (double) (m1 - h->mono0) /
+                                     (t1 - h->tick0) : 1.0;
+
+    __atomic_store_n(&h->magic, TRACE_MAGIC, __ATOMIC_RELEASE);
+
+    pthread_atfork(NULL, NULL, atforkChild);
+    hdr = h;
+}
+
+/* Claim a ring for the calling thread, setting up tracing first if this
+   is the first event in the process. Returns the ring, or NULL if the
+   thread isn't being traced. Preserves errno. */
+
+struct traceRing *
+traceRingSlow(void)
+{
+    struct traceRing *r;
+    uint32_t idx;
+    int savedErrno;
+
+    if (triedRing)
+        return NULL;
+    triedRing = 1;
+
+    savedErrno = errno;
+    pthread_once(&setupOnce, setup);
+    r = NULL;
+    if (hdr != NULL) {
+        idx = __atomic_fetch_add(&hdr->ringsUsed, 1, __ATOMIC_RELAXED);
+        if (idx < hdr->nrings) {
+            r = ringAt(hdr, idx);
+            r->mask = hdr->nevents - 1;
+            r->tid = syscall(SYS_gettid);
+            traceMyRing = r;
+        }
+    }
+    errno = savedErrno;
+    return r;
+}
+
+#ifdef TLPI_TRACE
+
+/* Tracing of the library's functions. When TLPI_TRACE is defined,
+   Makefile.inc links programs with "-Wl,--wrap=readn" (and so on), so
+   that calls to readn() are resolved to __wrap_readn(), below, which
+   calls the real function as __real_readn(). The traced functions
+   themselves (mostly listings from the book) are unchanged. */
+
+ssize_t __real_readn(int fd, void *buf, size_t len);
+ssize_t __wrap_readn(int fd, void *buf, size_t len);
+ssize_t __real_writen(int fd, const void *buf, size_t len);
+ssize_t __wrap_writen(int fd, const void *buf, size_t len);
+ssize_t __real_readLine(int fd, void *buffer, size_t n);
+ssize_t __wrap_readLine(int fd, void *buffer, size_t n);
+int __real_inetConnect(const char *host, const char *service, int type);
+int __wrap_inetConnect(const char *host, const char *service, int type);
+int __real_reserveSem(int semId, int semNum);
+int __wrap_reserveSem(int semId, int semNum);
+int __real_releaseSem(int semId, int semNum);
+int __wrap_releaseSem(int semId, int semNum);
+int __real_lockRegion(int fd, int type, int whence, int start, int len);
+int __wrap_lockRegion(int fd, int type, int whence, int start, int len);
+int __real_lockRegionWait(int fd, int type, int whence, int start, int len);
+int __wrap_lockRegionWait(int fd, int type, int whence, int start, int len);
+int __real_sendfd(int sockfd, int fd);
+int __wrap_sendfd(int sockfd, int fd);
+int __real_recvfd(int sockfd);
+int __wrap_recvfd(int sockfd);
+
+ssize_t
+__wrap_readn(int fd, void *buf, size_t len)
+{
+    uint64_t t0 = traceTicks();
+    ssize_t r = __real_readn(fd, buf, len);
+
+    traceRecord(TR_READN, fd, r, t0);
+    return r;
+}
+
+ssize_t
+__wrap_writen(int fd, const void *buf, size_t len)
+{
+    uint64_t t0 = traceTicks();
+    ssize_t r = __real_writen(fd, buf, len);
+
+    traceRecord(TR_WRITEN, fd, r, t0);
+    return r;
+}
+
+ssize_t
+__wrap_readLine(int fd, void *buffer, size_t n)
+{
+    uint64_t t0 = traceTicks();
+    ssize_t r = __real_readLine(fd, buffer, n);
+
+    traceRecord(TR_READLINE, fd, r, t0);
+    return r;
+}
+
+/* The event's 'fd' is the connected socket (or -1, on failure) */
+
+int
+__wrap_inetConnect(const char *host, const char *service, int type)
+{
+    uint64_t t0 = traceTicks();
+    int r = __real_inetConnect(host, service, type);
+
+    traceRecord(TR_INET_CONNECT, r, r, t0);
+    return r;
+}
+
+/* For the System V semaphore functions, the event's 'fd' is the
+   semaphore set identifier */
+
+int
+__wrap_reserveSem(int semId, int semNum)
+{
+    uint64_t t0 = traceTicks();
+    int r = __real_reserveSem(semId, semNum);
+
+    traceRecord(TR_RESERVE_SEM, semId, r, t0);
+    return r;
+}
+
+int
+__wrap_releaseSem(int semId, int semNum)
+{
+    uint64_t t0 = traceTicks();
+    int r = __real_releaseSem(semId, semNum);
+
+    traceRecord(TR_RELEASE_SEM, semId, r, t0);
+    return r;
+}
+
+int
+__wrap_lockRegion(int fd, int type, int whence, int start, int len)
+{
+    uint64_t t0 = traceTicks();
+    int r = __real_lockRegion(fd, type, whence, start, len);
+
+    traceRecord(TR_LOCK_REGION, fd, r, t0);
+    return r;
+}
+
+int
+__wrap_lockRegionWait(int fd, int type, int whence, int start, int len)
+{
+    uint64_t t0 = traceTicks();
+    int r = __real_lockRegionWait(fd, type, whence, start, len);
+
+    traceRecord(TR_LOCK_REGION_WAIT, fd, r, t0);
+    return r;
+}
+
+int
+__wrap_sendfd(int sockfd, int fd)
+{
+    uint64_t t0 = traceTicks();
+    int r = __real_sendfd(sockfd, fd);
+
+    traceRecord(TR_SENDFD, sockfd, r, t0);
+    return r;
+}
+
+int
+__wrap_recvfd(int sockfd)
+{
+    uint64_t t0 = traceTicks();
+    int r = __real_recvfd(sockfd);
+
+    traceRecord(TR_RECVFD, sockfd, r, t0);
+    return r;
+}
+
+#endif
+
+/* Reading a trace */
+
+struct traceReader {
+    struct traceHeader *hdr;
+    size_t size;
+    uint64_t *pos;              /* Reader's position in each ring */
+    uint64_t lost;              /* Events overwritten before being read */
+    uint32_t nextRing;          /* Ring to start from in the next poll */
+};
+
+/* Open the trace in the shared memory object 'name'. Returns a handle,
+   or NULL on error. */
+
+struct traceReader *
+traceReaderOpen(const char *name)
+{
+    struct traceReader *tr;
+    struct traceHeader *h;
+    struct stat sb;
+    int fd, savedErrno;
+
+    fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &sb) == -1)
+        goto fail;
+    if (sb.st_size < HDR_SIZE) {
+        errno = EINVAL;
+        goto fail;
+    }
+    h = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (h == MAP_FAILED)
+        goto fail;
+    close(fd);
+
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != TRACE_MAGIC ||
+            HDR_SIZE + h->nrings * ringSize(h->nevents) > sb.st_size) {
+        munmap(h, sb.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    tr = calloc(1, sizeof(struct traceReader));
+    if (tr == NULL || (tr->pos = calloc(h->nrings, sizeof(uint64_t))) ==
+                NULL) {
+        savedErrno = errno;
+        free(tr);
+        munmap(h, sb.st_size);
+        errno = savedErrno;
+        return NULL;
+    }
+    tr->hdr = h;
+    tr->size = sb.st_size;
+    return tr;
+
+fail:
+    savedErrno = errno;                 /* close() might change errno */
+    close(fd);
+    errno = savedErrno;
+    return NULL;
+}
+
+/* Copy up to 'max' events that have not yet been read into 'recs'.
+   Returns the number copied. */
+
+int
+traceReaderPoll(struct traceReader *tr, struct traceRec *recs, int max)
+{
+    struct traceHeader *h = tr->hdr;
+    struct traceRing *r;
+    uint64_t head, pos, oldest;
+    uint32_t used, k, idx;
+    int n, first, j;
+
+    used = __atomic_load_n(&h->ringsUsed, __ATOMIC_ACQUIRE);
+    if (used > h->nrings)
+        used = h->nrings;
+
+    /* Rotate the starting ring, so that if 'max' is reached, no ring is
+       starved */
+
+    n = 0;
+    for (k = 0; k < used && n < max; k++) {
+        idx = (tr->nextRing + k) % used;
+        r = ringAt(h, idx);
+        head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        pos = tr->pos[idx];
+        if (head - pos > h->nevents) {          /* Overwritten */
+            tr->lost += head - pos - h->nevents;
+            pos = head - h->nevents;
+        }
+
+        first = n;
+        for (; pos < head && n < max; pos++, n++) {
+            recs[n].ev = r->ev[pos & (h->nevents - 1)];
+            recs[n].tid = r->tid;
+        }
+
+        /* Discard the events whose slots may have been reused while we
+           were copying */
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+        oldest = (head > h->nevents) ? head - h->nevents : 0;
+        if (tr->pos[idx] < oldest || pos - (n - first) < oldest) {
+            for (j = first; j < n && pos - (n - j) < oldest; )
+                j++;
+            tr->lost += j - first;
+            memmove(&recs[first], &recs[j], (n - j) * sizeof(recs[0]));
+            n -= j - first;
+        }
+        tr->pos[idx] = pos;
+    }
+    tr->nextRing = (used > 0) ? (tr->nextRing + 1) % used : 0;
+    return n;
+}
+
+/* Convert 'ticks' to nanoseconds since the trace started */
+
+double
+traceReaderNs(struct traceReader *tr, uint64_t ticks)
+{
+    return ((double) ticks - (double) tr->hdr->tick0) * tr->hdr->nsPerTick;
+}
+
+/* Return the time (CLOCK_REALTIME, in nanoseconds since the Epoch) when
+   the trace started */
+
+uint64_t
+traceReaderStartTime(struct traceReader *tr)
+{
+    return tr->hdr->real0;
+}
+
+double
+traceReaderNsPerTick(struct traceReader *tr)
+{
+    return tr->hdr->nsPerTick;
+}
+
+uint64_t
+traceReaderLost(struct traceReader *tr)
+{
+    return tr->lost;
+}
+
+/* Return the number of threads being traced; '*dropped' returns the
+   number that weren't traced because there were no rings left */
+
+int
+traceReaderThreads(struct traceReader *tr, int *dropped)
+{
+    uint32_t used;
+
+    used = __atomic_load_n(&tr->hdr->ringsUsed, __ATOMIC_RELAXED);
+    *dropped = (used > tr->hdr->nrings) ? used - tr->hdr->nrings : 0;
+    return (used > tr->hdr->nrings) ? tr->hdr->nrings : used;
+}
+
+void
+traceReaderClose(struct traceReader *tr)
+{
+    munmap(tr->hdr, tr->size);
+    free(tr->pos);
+    free(tr);
+}
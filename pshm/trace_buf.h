@@ -0,0 +1,146 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* trace_buf.h
+
+   Header file for trace_buf.c.
+
+   The library functions that are traced (readn(), readLine(), and so
+   on) are not themselves changed: when TLPI_TRACE is defined (see
+   Makefile.inc), programs are linked so that calls to them go to
+   wrapper functions in trace_buf.c, which call traceRecord().
+*/
+#ifndef TRACE_BUF_H
+#define TRACE_BUF_H             /* Prevent accidental double inclusion */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+
+/* Instrumented functions */
+
+enum {
+    TR_READN, TR_WRITEN, TR_READLINE, TR_INET_CONNECT, TR_RESERVE_SEM,
+    TR_RELEASE_SEM, TR_LOCK_REGION, TR_LOCK_REGION_WAIT, TR_SENDFD,
+    TR_RECVFD, TR_NFUNCS
+};
+
+extern const char *traceFuncNames[TR_NFUNCS];
+
+struct traceEvent {             /* 32 bytes */
+    uint64_t start;             /* Ticks (see traceTicks()) at entry */
+    int64_t result;             /* Return value (e.g., bytes transferred) */
+    uint32_t ticks;             /* Duration (saturated at UINT32_MAX) */
+    int32_t fd;                 /* File descriptor (or semaphore set ID) */
+    uint16_t func;              /* TR_* */
+    uint16_t err;               /* errno, if 'result' is -1 */
+    uint32_t pad;
+};
+
+struct traceRing {              /* One per thread, in shared memory */
+    uint64_t head;              /* Events written (next slot is
+                                   head & mask); updated with a release
+                                   store after the event is written */
+    uint32_t mask;              /* Number of slots - 1 */
+    int32_t tid;                /* Writing thread */
+    char pad[48];               /* Keep 'ev' off the header's cache line */
+    struct traceEvent ev[];
+};
+
+/* A cheap, monotonic, tick counter: the CPU's timestamp counter where
+   there is one (its rate is calibrated by trace_buf.c), or else the
+   CLOCK_MONOTONIC clock, in nanoseconds */
+
+#if !defined(__x86_64__) && !defined(__i386__) && !defined(__aarch64__)
+#include <time.h>
+#endif
+
+static inline uint64_t
+traceTicks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t) hi << 32) | lo;
+#elif defined(__aarch64__)
+    uint64_t val;
+
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (val));
+    return val;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+extern __thread struct traceRing *traceMyRing;
+
+struct traceRing *traceRingSlow(void);
+
+/* Record an event that started at 'start' (from traceTicks()). Doesn't
+   change errno. */
+
+static inline void
+traceRecord(int func, int fd, int64_t result, uint64_t start)
+{
+    struct traceRing *r;
+    struct traceEvent *e;
+    uint64_t h, d;
+
+    r = traceMyRing;
+    if (r == NULL) {            /* First event in this thread, or tracing */
+        r = traceRingSlow();    /* is not enabled */
+        if (r == NULL)
+            return;
+    }
+
+    d = traceTicks() - start;
+    h = r->head;
+    e = &r->ev[h & r->mask];
+    e->start = start;
+    e->result = result;
+    e->ticks = (d > UINT32_MAX) ? UINT32_MAX : d;
+    e->fd = fd;
+    e->func = func;
+    e->err = (result == -1) ? errno : 0;
+    __atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+}
+
+/* For readers of a trace (see trace_read.c) */
+
+struct traceRec {
+    struct traceEvent ev;
+    int tid;
+};
+
+struct traceReader;
+
+struct traceReader *traceReaderOpen(const char *name);
+
+int traceReaderPoll(struct traceReader *tr, struct traceRec *recs, int max);
+
+double traceReaderNs(struct traceReader *tr, uint64_t ticks);
+
+uint64_t traceReaderStartTime(struct traceReader *tr);
+
+double traceReaderNsPerTick(struct traceReader *tr);
+
+uint64_t traceReaderLost(struct traceReader *tr);
+
+int traceReaderThreads(struct traceReader *tr, int *dropped);
+
+void traceReaderClose(struct traceReader *tr);
+
+#endif
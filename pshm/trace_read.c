@@ -0,0 +1,265 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 54 */
+
+/* trace_read.c
+
+   Read the trace of library calls recorded by a program that was linked
+   with a library built with TLPI_TRACE defined, and run with the
+   TLPI_TRACE environment variable set (see trace_buf.c).
+
+   Usage: trace_read [-a] [-c] [-f] [-i ms] [-u] {/name | pid}
+
+   The argument is either the name of the shared memory object holding
+   the trace, or the PID of the traced process (whose trace is in
+   /tlpi_trace.<pid>).
+
+        -a      Instead of listing the events, show a summary for each
+                function: the number of calls, the number that failed,
+                the bytes transferred (for readn(), writen(), and
+                readLine()), and the median, 99th percentile, and
+                maximum latency
+        -c      List the events as CSV (wall-clock time in nanoseconds,
+                thread ID, function, fd, result, errno, and latency in
+                nanoseconds), for loading into a spreadsheet or database
+        -f      Follow the trace: keep reading new events (every -i
+                milliseconds; default 200) until the traced process
+                terminates or we are interrupted (then, with -a, show the
+                summary)
+        -u      Unlink the shared memory object when done
+
+   Otherwise, each event is shown with its time (in seconds since the
+   trace began), the thread ID, the function, the file descriptor (the
+   semaphore set ID, for reserveSem() and releaseSem()), the result (and
+   the error, if the call failed), and the latency in microseconds.
+   Events that were overwritten before they could be read are counted;
+   if -f is not used, only the events still in the trace are available.
+
+   Try:
+
+        cd lib; make clean; make TLPI_TRACE=1; cd ../pshm
+        make clean; make TLPI_TRACE=1 trace_bench
+        TLPI_TRACE=/demo ./trace_bench -n 100000
+        ./trace_read -a -u /demo
+
+   (and "cd lib; make clean; make" to rebuild the library without
+   tracing).
+
+   This program is Linux-specific.
+*/
+#include <sys/mman.h>
+#include <signal.h>
+#include <time.h>
+#include "trace_buf.h"
+#include "lat_hist.h"
+#include "tlpi_hdr.h"
+
+#define MAX_RECS 65536
+
+struct funcStats {
+    long long calls;
+    long long errors;
+    long long bytes;
+    struct latHist lat;         /* Nanoseconds */
+};
+
+static struct funcStats stats[TR_NFUNCS];
+static volatile sig_atomic_t gotSig = 0;
+
+static void
+handler(int sig)
+{
+    gotSig = 1;
+}
+
+static int
+cmpRec(const void *a, const void *b)
+{
+    const struct traceRec *ra = a, *rb = b;
+
+    return (ra->ev.start > rb->ev.start) - (ra->ev.start < rb->ev.start);
+}
+
+static const char *
+funcName(int func)
+{
+    return (func < TR_NFUNCS) ? traceFuncNames[func] : "?";
+}
+
+static void
+showRecs(struct traceReader *tr, struct traceRec *recs, int n,
+         Boolean csv)
+{
+    struct traceEvent *e;
+    double lat;
+    int j;
+
+    for (j = 0; j < n; j++) {
+        e = &recs[j].ev;
+        lat = e->ticks * traceReaderNsPerTick(tr);
+        if (csv) {
+            printf("%lld,%d,%s,%d,%lld,%d,%.0f\n",
+                   (long long) traceReaderStartTime(tr) +
+                        (long long) (traceReaderNs(tr, e->start) + 0.5),
+                   recs[j].tid, funcName(e->func), e->fd, (long long) e->result,
+                   e->err, lat);
+        } else {
+            printf("%12.6f %7d %-15s %6d %8lld %-10s %10.1f\n",
+                   traceReaderNs(tr, e->start) / 1e9, recs[j].tid,
+                   funcName(e->func), e->fd, (long long) e->result,
+                   (e->result == -1) ? strerror(e->err) : "", lat / 1e3);
+        }
+    }
+}
+
+static void
+addStats(struct traceReader *tr, struct traceRec *recs, int n)
+{
+    struct traceEvent *e;
+    struct funcStats *fs;
+    int j;
+
+    for (j = 0; j < n; j++) {
+        e = &recs[j].ev;
+        if (e->func >= TR_NFUNCS)
+            continue;
+        fs = &stats[e->func];
+        fs->calls++;
+        if (e->result == -1)
+            fs->errors++;
+        else if (e->func <= TR_READLINE)
+            fs->bytes += e->result;
+        latHistRecord(&fs->lat, e->ticks * traceReaderNsPerTick(tr) + 0.5);
+    }
+}
+
+static void
+showStats(void)
+{
+    struct funcStats *fs;
+    int j;
+
+    printf("%-15s %9s %7s %12s %9s %9s %9s\n", "function", "calls",
+           "errors", "bytes", "p50-us", "p99-us", "max-us");
+    for (j = 0; j < TR_NFUNCS; j++) {
+        fs = &stats[j];
+        if (fs->calls == 0)
+            continue;
+        printf("%-15s %9lld %7lld %12lld %9.1f %9.1f %9.1f\n",
+               traceFuncNames[j], fs->calls, fs->errors, fs->bytes,
+               latHistPercentile(&fs->lat, 0.50) / 1e3,
+               latHistPercentile(&fs->lat, 0.99) / 1e3, fs->lat.max / 1e3);
+    }
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-a] [-c] [-f] [-i ms] [-u] {/name | pid}\n",
+            progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct traceReader *tr;
+    struct traceRec *recs;
+    struct sigaction sa;
+    struct timespec interval;
+    Boolean aggregate, csv, follow, doUnlink, alive;
+    char name[64];
+    pid_t pid;
+    int opt, intervalMs, n, threads, dropped, j;
+
+    aggregate = csv = follow = doUnlink = FALSE;
+    intervalMs = 200;
+    while ((opt = getopt(argc, argv, "acfi:u")) != -1) {
+        switch (opt) {
+        case 'a':   aggregate = TRUE;                           break;
+        case 'c':   csv = TRUE;                                 break;
+        case 'f':   follow = TRUE;                              break;
+        case 'i':   intervalMs = getInt(optarg, GN_GT_0, "-i"); break;
+        case 'u':   doUnlink = TRUE;                            break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind + 1 != argc)
+        usageError(argv[0]);
+
+    pid = 0;
+    if (argv[optind][0] == '/') {
+        snprintf(name, sizeof(name), "%s", argv[optind]);
+    } else {
+        pid = getInt(argv[optind], GN_GT_0, "pid");
+        snprintf(name, sizeof(name), "/tlpi_trace.%ld", (long) pid);
+    }
+
+    tr = traceReaderOpen(name);
+    if (tr == NULL)
+        errExit("traceReaderOpen: %s", name);
+
+    recs = malloc(MAX_RECS * sizeof(struct traceRec));
+    if (recs == NULL)
+        errExit("malloc");
+    for (j = 0; j < TR_NFUNCS; j++)
+        latHistInit(&stats[j].lat);
+
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sa.sa_handler = handler;
+    if (sigaction(SIGINT, &sa, NULL) == -1 ||
+            sigaction(SIGTERM, &sa, NULL) == -1)
+        errExit("sigaction");
+
+    if (csv && !aggregate)
+        printf("time_ns,tid,function,fd,result,errno,latency_ns\n");
+    else if (!aggregate)
+        printf("%12s %7s %-15s %6s %8s %-10s %10s\n", "secs", "tid",
+               "function", "fd", "result", "error", "lat-us");
+
+    interval.tv_sec = intervalMs / 1000;
+    interval.tv_nsec = (intervalMs % 1000) * 1000000L;
+
+    /* Each poll returns events in order within each thread; sorting
+       them interleaves the threads (although an event in a later poll
+       may have started before one in an earlier poll) */
+
+    while (!gotSig) {
+        alive = pid == 0 || kill(pid, 0) == 0 || errno != ESRCH;
+        n = traceReaderPoll(tr, recs, MAX_RECS);
+        qsort(recs, n, sizeof(struct traceRec), cmpRec);
+        if (aggregate)
+            addStats(tr, recs, n);
+        else
+            showRecs(tr, recs, n, csv);
+
+        if (n == MAX_RECS)              /* There may be more waiting */
+            continue;
+        if (!follow || !alive)
+            break;
+        fflush(stdout);
+        nanosleep(&interval, NULL);
+    }
+
+    if (aggregate)
+        showStats();
+    threads = traceReaderThreads(tr, &dropped);
+    fprintf(stderr, "%d thread(s) traced, %d not traced; "
+            "%llu event(s) lost\n", threads, dropped,
+            (unsigned long long) traceReaderLost(tr));
+
+    traceReaderClose(tr);
+    if (doUnlink && shm_unlink(name) == -1)
+        errExit("shm_unlink");
+    free(recs);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,384 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 64 */
+
+/* pty_pool.c
+
+   A pool of pseudoterminal master/slave pairs that are created and
+   configured in advance, so that a server that starts many sessions
+   (such as pty_sess_sv.c) can obtain one without waiting.
+
+   Creating a pair, as ptyMasterOpen() (pty_master_open.c) and ptyFork()
+   (pty_fork.c) do, takes posix_openpt(), grantpt(), unlockpt(),
+   ptsname(), an open() of the slave, and then tcsetattr() and
+   ioctl(TIOCSWINSZ) for the slave's settings; on some systems,
+   grantpt() runs a set-user-ID helper program. Here, a thread creates
+   pairs in the background: when fewer than 'lowWater' pairs are ready,
+   it creates pairs until 'highWater' are ready. Each pair is configured
+   according to 'mode' (using ttySetCbreak() or ttySetRaw() from
+   tty_functions.c) or 'termios', and 'winSize'. The slave is opened
+   (with O_NOCTTY) along with the master, using ioctl(TIOCGPTPEER) where
+   available (Linux 4.13 and later), which avoids looking up the slave's
+   pathname.
+
+   ptyPoolGet() takes a pair from the pool, returning the master and
+   slave file descriptors, and optionally the slave's name; if the pool
+   is empty, it creates a pair itself (a "miss"). ptyPoolFork() is the
+   equivalent of ptyFork() using a pair from the pool; if 'slaveWS' is
+   not NULL, it sets the slave's window size. All descriptors returned
+   are close-on-exec, so that pairs are not inherited by programs that
+   the caller (or its other threads) execute.
+
+   Settings that are applied to the pairs should not be changed once
+   the pool is open, since pairs already in the pool keep the old ones.
+*/
+#define _GNU_SOURCE
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include "tty_functions.h"
+#include "pty_pool.h"                   /* Declares functions defined here */
+#include "tlpi_hdr.h"
+
+#ifndef TIOCGPTPEER
+#define TIOCGPTPEER _IO('T', 0x41)      /* Linux 4.13 */
+#endif
+
+#define NAME_LEN 64                     /* Space for a slave's name */
+#define RETRY_NSECS 100000000           /* Wait after failing to create a
+                                           pair (100 ms) */
+
+struct ptyPair {
+    int masterFd;
+    int slaveFd;
+    char name[NAME_LEN];
+};
+
+struct ptyPool {
+    struct ptyPoolParams p;
+    struct termios termios;             /* Copies of p.termios and */
+    struct winsize winSize;             /* p.winSize, if not NULL */
+    pthread_t tid;
+    pthread_mutex_t mtx;
+    pthread_cond_t refillCond;          /* Signaled when below low water */
+    struct ptyPair *ring;               /* Ready pairs ('highWater' slots) */
+    int head;                           /* Next pair to hand out */
+    int count;                          /* Pairs in 'ring' */
+    Boolean stop;
+    struct ptyPoolStats stats;
+};
+
+void
+ptyPoolDefaultParams(struct ptyPoolParams *params)
+{
+    params->lowWater = 16;
+    params->highWater = 64;
+    params->mode = PTY_POOL_COOKED;
+    params->termios = NULL;
+    params->winSize = NULL;
+}
+
+/* Create and configure a master/slave pair in '*pair'. Returns 0 on
+   success, or -1 on error. */
+
+static int
+createPair(struct ptyPool *pp, struct ptyPair *pair)
+{
+    int savedErrno, s;
+
+    pair->slaveFd = -1;
+    pair->masterFd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (pair->masterFd == -1)
+        return -1;
+
+    if (grantpt(pair->masterFd) == -1 || unlockpt(pair->masterFd) == -1)
+        goto fail;
+    s = ptsname_r(pair->masterFd, pair->name, NAME_LEN);
+    if (s != 0) {
+        errno = s;
+        goto fail;
+    }
+
+    pair->slaveFd = ioctl(pair->masterFd, TIOCGPTPEER,
+                          O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (pair->slaveFd == -1 && (errno == EINVAL || errno == ENOTTY))
+        pair->slaveFd = open(pair->name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (pair->slaveFd == -1)
+        goto fail;
+
+    if (pp->p.termios != NULL) {
+        if (tcsetattr(pair->slaveFd, TCSANOW, &pp->termios) == -1)
+            goto fail;
+    } else if (pp->p.mode == PTY_POOL_CBREAK) {
+        if (ttySetCbreak(pair->slaveFd, NULL) == -1)
+            goto fail;
+    } else if (pp->p.mode == PTY_POOL_RAW) {
+        if (ttySetRaw(pair->slaveFd, NULL) == -1)
+            goto fail;
+    }
+
+    if (pp->p.winSize != NULL &&
+            ioctl(pair->slaveFd, TIOCSWINSZ, &pp->winSize) == -1)
+        goto fail;
+
+    return 0;
+
+fail:
+    savedErrno = errno;
+    if (pair->slaveFd != -1)
+        close(pair->slaveFd);
+    close(pair->masterFd);
+    errno = savedErrno;
+    return -1;
+}
+
+/* The refill thread: whenever the pool falls below the low water mark,
+   fill it to the high water mark */
+
+static void *
+threadFunc(void *arg)
+{
+    struct ptyPool *pp = arg;
+    struct ptyPair pair;
+    struct timespec ts;
+    int r;
+
+    pthread_mutex_lock(&pp->mtx);
+    while (!pp->stop) {
+        if (pp->count >= pp->p.lowWater) {
+            pthread_cond_wait(&pp->refillCond, &pp->mtx);
+            continue;
+        }
+
+        while (!pp->stop && pp->count < pp->p.highWater) {
+            pthread_mutex_unlock(&pp->mtx);
+            r = createPair(pp, &pair);
+            pthread_mutex_lock(&pp->mtx);
+
+            if (r == -1) {              /* For example, EMFILE; try again
+                                           a little later */
+                pp->stats.errors++;
+                pp->stats.lastErrno = errno;
+                pthread_mutex_unlock(&pp->mtx);
+                ts.tv_sec = 0;
+                ts.tv_nsec = RETRY_NSECS;
+                while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+                    continue;
+                pthread_mutex_lock(&pp->mtx);
+                break;
+            }
+
+            pp->ring[(pp->head + pp->count) % pp->p.highWater] = pair;
+            pp->count++;
+            pp->stats.created++;
+        }
+    }
+    pthread_mutex_unlock(&pp->mtx);
+
+    return NULL;
+}
+
+/* Create a pool, and start the thread that fills it. If 'params' is
+   NULL, ptyPoolDefaultParams() is used. Returns a handle, or NULL on
+   error. */
+
+struct ptyPool *
+ptyPoolOpen(const struct ptyPoolParams *params)
+{
+    struct ptyPool *pp;
+    sigset_t all, prev;
+    int s;
+
+    pp = calloc(1, sizeof(*pp));
+    if (pp == NULL)
+        return NULL;
+    if (params != NULL)
+        pp->p = *params;
+    else
+        ptyPoolDefaultParams(&pp->p);
+
+    if (pp->p.highWater < 1 || pp->p.lowWater < 1 ||
+            pp->p.lowWater > pp->p.highWater) {
+        free(pp);
+        errno = EINVAL;
+        return NULL;
+    }
+    if (pp->p.termios != NULL)
+        pp->termios = *pp->p.termios;
+    if (pp->p.winSize != NULL)
+        pp->winSize = *pp->p.winSize;
+
+    pp->ring = calloc(pp->p.highWater, sizeof(struct ptyPair));
+    if (pp->ring == NULL) {
+        free(pp);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pp->mtx, NULL);
+    pthread_cond_init(&pp->refillCond, NULL);
+
+    /* The thread blocks all signals, so that it isn't chosen to handle
+       signals directed at the process */
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &prev);
+    s = pthread_create(&pp->tid, NULL, threadFunc, pp);
+    pthread_sigmask(SIG_SETMASK, &prev, NULL);
+    if (s != 0) {
+        free(pp->ring);
+        free(pp);
+        errno = s;
+        return NULL;
+    }
+
+    return pp;
+}
+
+/* Take a master/slave pair from the pool (or, if it is empty, create
+   one). The slave's file descriptor is returned in '*slaveFd', and if
+   'slaveName' is not NULL, its name is returned in the buffer of
+   'snLen' bytes to which it points. Returns the master's file
+   descriptor, or -1 on error. */
+
+int
+ptyPoolGet(struct ptyPool *pp, int *slaveFd, char *slaveName, size_t snLen)
+{
+    struct ptyPair pair;
+    Boolean hit;
+
+    pthread_mutex_lock(&pp->mtx);
+    hit = pp->count > 0;
+    if (hit) {
+        pair = pp->ring[pp->head];
+        pp->head = (pp->head + 1) % pp->p.highWater;
+        pp->count--;
+        pp->stats.hits++;
+    } else {
+        pp->stats.misses++;
+    }
+    if (pp->count < pp->p.lowWater)
+        pthread_cond_signal(&pp->refillCond);
+    pthread_mutex_unlock(&pp->mtx);
+
+    if (!hit && createPair(pp, &pair) == -1)
+        return -1;
+
+    if (slaveName != NULL) {
+        if (strlen(pair.name) >= snLen) {
+            close(pair.slaveFd);
+            close(pair.masterFd);
+            errno = EOVERFLOW;
+            return -1;
+        }
+        strcpy(slaveName, pair.name);
+    }
+
+    *slaveFd = pair.slaveFd;
+    return pair.masterFd;
+}
+
+/* As ptyFork(), but using a pair from the pool. The slave's attributes
+   are those given to ptyPoolOpen(); if 'slaveWS' is not NULL, it gives
+   the slave's window size. */
+
+pid_t
+ptyPoolFork(struct ptyPool *pp, int *masterFd, char *slaveName,
+            size_t snLen, const struct winsize *slaveWS)
+{
+    int mfd, slaveFd, savedErrno;
+    pid_t childPid;
+
+    mfd = ptyPoolGet(pp, &slaveFd, slaveName, snLen);
+    if (mfd == -1)
+        return -1;
+
+    if (slaveWS != NULL && ioctl(slaveFd, TIOCSWINSZ, slaveWS) == -1)
+        goto fail;
+
+    childPid = fork();
+    if (childPid == -1)
+        goto fail;
+
+    if (childPid != 0) {                /* Parent */
+        close(slaveFd);                 /* So that the master sees EOF
+                                           when the child's session ends */
+        *masterFd = mfd;
+        return childPid;
+    }
+
+    /* Child: the slave is already open, so we need only make it our
+       controlling terminal once we are a session leader */
+
+    if (setsid() == -1)
+        err_exit("ptyPoolFork:setsid");
+
+    close(mfd);
+
+    if (ioctl(slaveFd, TIOCSCTTY, 0) == -1)
+        err_exit("ptyPoolFork:ioctl-TIOCSCTTY");
+
+    if (dup2(slaveFd, STDIN_FILENO) != STDIN_FILENO)
+        err_exit("ptyPoolFork:dup2-STDIN_FILENO");
+    if (dup2(slaveFd, STDOUT_FILENO) != STDOUT_FILENO)
+        err_exit("ptyPoolFork:dup2-STDOUT_FILENO");
+    if (dup2(slaveFd, STDERR_FILENO) != STDERR_FILENO)
+        err_exit("ptyPoolFork:dup2-STDERR_FILENO");
+
+    if (slaveFd > STDERR_FILENO)
+        close(slaveFd);
+
+    return 0;
+
+fail:
+    savedErrno = errno;
+    close(slaveFd);
+    close(mfd);
+    errno = savedErrno;
+    return -1;
+}
+
+void
+ptyPoolGetStats(struct ptyPool *pp, struct ptyPoolStats *stats)
+{
+    pthread_mutex_lock(&pp->mtx);
+    *stats = pp->stats;
+    stats->ready = pp->count;
+    pthread_mutex_unlock(&pp->mtx);
+}
+
+/* Stop the refill thread, close the pairs remaining in the pool, and
+   free the pool */
+
+void
+ptyPoolClose(struct ptyPool *pp)
+{
+    struct ptyPair *pair;
+
+    pthread_mutex_lock(&pp->mtx);
+    pp->stop = TRUE;
+    pthread_cond_signal(&pp->refillCond);
+    pthread_mutex_unlock(&pp->mtx);
+    pthread_join(pp->tid, NULL);
+
+    for (; pp->count > 0; pp->count--) {
+        pair = &pp->ring[pp->head];
+        close(pair->slaveFd);
+        close(pair->masterFd);
+        pp->head = (pp->head + 1) % pp->p.highWater;
+    }
+
+    pthread_cond_destroy(&pp->refillCond);
+    pthread_mutex_destroy(&pp->mtx);
+    free(pp->ring);
+    free(pp);
+}
@@ -0,0 +1,62 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 64 */
+
+/* pty_pool.h
+
+   Header file for pty_pool.c.
+*/
+#ifndef PTY_POOL_H
+#define PTY_POOL_H              /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+
+#define PTY_POOL_COOKED 0       /* Values for 'mode': leave the slave with */
+#define PTY_POOL_CBREAK 1       /* the kernel's default settings, or apply */
+#define PTY_POOL_RAW 2          /* ttySetCbreak() or ttySetRaw() */
+
+struct ptyPoolParams {          /* See ptyPoolDefaultParams() for defaults */
+    int lowWater;               /* Refill when fewer pairs than this are
+                                   ready... */
+    int highWater;              /* ...until this many are ready */
+    int mode;                   /* PTY_POOL_COOKED, _CBREAK, or _RAW */
+    const struct termios *termios;  /* If not NULL, slave attributes
+                                   (instead of 'mode') */
+    const struct winsize *winSize;  /* If not NULL, initial window size */
+};
+
+struct ptyPoolStats {
+    unsigned long long hits;        /* ptyPoolGet() calls served from pool */
+    unsigned long long misses;      /* ... that had to create a pair */
+    unsigned long long created;     /* Pairs created by the refill thread */
+    unsigned long long errors;      /* Failures to create a pair in the
+                                       refill thread */
+    int lastErrno;                  /* errno from the most recent error */
+    int ready;                      /* Pairs now in the pool */
+};
+
+void ptyPoolDefaultParams(struct ptyPoolParams *params);
+
+struct ptyPool *ptyPoolOpen(const struct ptyPoolParams *params);
+
+int ptyPoolGet(struct ptyPool *pp, int *slaveFd, char *slaveName,
+               size_t snLen);
+
+pid_t ptyPoolFork(struct ptyPool *pp, int *masterFd, char *slaveName,
+                  size_t snLen, const struct winsize *slaveWS);
+
+void ptyPoolGetStats(struct ptyPool *pp, struct ptyPoolStats *stats);
+
+void ptyPoolClose(struct ptyPool *pp);
+
+#endif
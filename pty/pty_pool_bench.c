@@ -0,0 +1,289 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 64 */
+
+/* pty_pool_bench.c
+
+   Measure the time taken to obtain a configured pseudoterminal with
+   ptyMasterOpen() (pty_master_open.c) and with a pool of pairs created
+   in advance (pty_pool.c).
+
+   Usage: pty_pool_bench [-n count] [-r rate] [-l low] [-h high]
+                         [-m mode] [-f] [method...]
+
+        -n count   Number of pseudoterminals obtained per method
+                   (default: 10000)
+        -r rate    Obtain this many pseudoterminals per second, rather
+                   than one after another as fast as possible
+        -l low     Pool's low water mark (default: 16)
+        -h high    Pool's high water mark (default: 64)
+        -m mode    Slave's mode: cooked (the default), cbreak, or raw
+        -f         Start a session on each pseudoterminal, a child that
+                   executes /bin/true (using ptyFork() or ptyPoolFork()),
+                   and measure the time until the child has been waited
+                   for
+
+   The methods (by default, both are measured) are:
+
+        open    ptyMasterOpen(), then open() the slave, set its mode
+                (ttySetCbreak() or ttySetRaw()), and set its window size
+                (with -f, ptyFork() does this in the child)
+        pool    ptyPoolGet() (with -f, ptyPoolFork())
+
+   For each method, the program shows the number of pseudoterminals
+   obtained per second, the median, 99th percentile, and maximum times
+   taken to obtain one, and, for the pool, the number of requests that
+   found the pool empty and had to create a pair. Without -r, the pool
+   is emptied faster than the refill thread can fill it (unless there
+   are spare CPUs to run the thread), and so most requests miss; with a
+   rate that the refill thread can sustain, almost all requests hit.
+
+   Try: pty_pool_bench -r 500 -n 5000
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <time.h>
+#include "pty_fork.h"           /* Declaration of ptyFork() */
+#include "pty_master_open.h"    /* Declaration of ptyMasterOpen() */
+#include "pty_pool.h"
+#include "tty_functions.h"
+#include "lat_hist.h"
+#include "tlpi_hdr.h"
+
+#define MAX_SNAME 1000
+
+static const char *methodNames[] = { "open", "pool" };
+
+#define NMETHODS (sizeof(methodNames) / sizeof(methodNames[0]))
+
+static struct ptyPoolParams params;
+static struct winsize ws = { 24, 80, 0, 0 };
+static struct termios slaveTermios;     /* Used by ptyFork() */
+static Boolean forkSession;
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Obtain a pseudoterminal configured in the same way as those in the
+   pool, without the pool */
+
+static int
+openPty(int *slaveFd)
+{
+    char slaveName[MAX_SNAME];
+    int masterFd;
+
+    masterFd = ptyMasterOpen(slaveName, MAX_SNAME);
+    if (masterFd == -1)
+        errExit("ptyMasterOpen");
+    *slaveFd = open(slaveName, O_RDWR | O_NOCTTY);
+    if (*slaveFd == -1)
+        errExit("open-slave");
+    if (params.mode == PTY_POOL_CBREAK && ttySetCbreak(*slaveFd, NULL) == -1)
+        errExit("ttySetCbreak");
+    if (params.mode == PTY_POOL_RAW && ttySetRaw(*slaveFd, NULL) == -1)
+        errExit("ttySetRaw");
+    if (ioctl(*slaveFd, TIOCSWINSZ, &ws) == -1)
+        errExit("ioctl-TIOCSWINSZ");
+    return masterFd;
+}
+
+/* Start a session running /bin/true on a pseudoterminal obtained with
+   method 'm', and wait for it to finish */
+
+static void
+runSession(int m, struct ptyPool *pp)
+{
+    int masterFd, status;
+    pid_t pid;
+
+    if (m == 0)
+        pid = ptyFork(&masterFd, NULL, 0,
+                      (params.mode == PTY_POOL_COOKED) ? NULL : &slaveTermios,
+                      &ws);
+    else
+        pid = ptyPoolFork(pp, &masterFd, NULL, 0, NULL);
+    if (pid == -1)
+        errExit("ptyFork");
+
+    if (pid == 0) {
+        execl("/bin/true", "true", (char *) NULL);
+        _exit(127);
+    }
+
+    if (waitpid(pid, &status, 0) == -1)
+        errExit("waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        fatal("child failed (status %#x)", status);
+    close(masterFd);
+}
+
+static void
+runMethod(int m, int count, int rate)
+{
+    struct ptyPoolStats stats;
+    struct ptyPool *pp;
+    struct latHist h;
+    struct timespec next;
+    long long start, t0, elapsed;
+    int masterFd, slaveFd, j;
+
+    pp = NULL;
+    if (m == 1) {
+        pp = ptyPoolOpen(&params);
+        if (pp == NULL)
+            errExit("ptyPoolOpen");
+        sleep(1);               /* Let the pool fill */
+    }
+
+    latHistInit(&h);
+    if (clock_gettime(CLOCK_MONOTONIC, &next) == -1)
+        errExit("clock_gettime");
+    start = nowNs();
+    for (j = 0; j < count; j++) {
+        if (rate > 0) {         /* Wait until this request is due */
+            next.tv_nsec += 1000000000L / rate;
+            if (next.tv_nsec >= 1000000000L) {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000L;
+            }
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+                                   NULL) == EINTR)
+                continue;
+        }
+
+        t0 = nowNs();
+        if (forkSession) {
+            runSession(m, pp);
+            latHistRecord(&h, nowNs() - t0);
+            continue;
+        }
+
+        if (m == 0) {
+            masterFd = openPty(&slaveFd);
+        } else {
+            masterFd = ptyPoolGet(pp, &slaveFd, NULL, 0);
+            if (masterFd == -1)
+                errExit("ptyPoolGet");
+        }
+        latHistRecord(&h, nowNs() - t0);
+        close(slaveFd);
+        close(masterFd);
+    }
+    elapsed = nowNs() - start;
+
+    printf("%-6s %10.0f %10.1f %10.1f %10.1f", methodNames[m],
+           count / (elapsed / 1e9), latHistPercentile(&h, 0.50) / 1e3,
+           latHistPercentile(&h, 0.99) / 1e3, h.max / 1e3);
+    if (pp != NULL) {
+        ptyPoolGetStats(pp, &stats);
+        printf(" %8llu", stats.misses);
+        if (stats.errors > 0)
+            printf(" (%llu refill errors: %s)", stats.errors,
+                   strerror(stats.lastErrno));
+        ptyPoolClose(pp);
+    }
+    printf("\n");
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n count] [-r rate] [-l low] [-h high] "
+                    "[-m mode] [-f] [method...]\n", progName);
+    fprintf(stderr, "Methods: open pool; modes: cooked cbreak raw\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    Boolean selected[NMETHODS];
+    int opt, count, rate, m, j, fd;
+    char slaveName[MAX_SNAME];
+
+    ptyPoolDefaultParams(&params);
+    count = 10000;
+    rate = 0;
+    while ((opt = getopt(argc, argv, "n:r:l:h:m:f")) != -1) {
+        switch (opt) {
+        case 'n': count = getInt(optarg, GN_GT_0, "count");             break;
+        case 'r': rate = getInt(optarg, GN_GT_0, "rate");               break;
+        case 'l': params.lowWater = getInt(optarg, GN_GT_0, "low");     break;
+        case 'h': params.highWater = getInt(optarg, GN_GT_0, "high");   break;
+        case 'f': forkSession = TRUE;                                   break;
+        case 'm':
+            if (strcmp(optarg, "cooked") == 0)
+                params.mode = PTY_POOL_COOKED;
+            else if (strcmp(optarg, "cbreak") == 0)
+                params.mode = PTY_POOL_CBREAK;
+            else if (strcmp(optarg, "raw") == 0)
+                params.mode = PTY_POOL_RAW;
+            else
+                usageError(argv[0]);
+            break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (params.lowWater > params.highWater)
+        cmdLineErr("low water mark exceeds high water mark\n");
+    params.winSize = &ws;
+
+    for (m = 0; m < NMETHODS; m++)
+        selected[m] = (optind == argc);
+    for (j = optind; j < argc; j++) {
+        for (m = 0; m < NMETHODS; m++)
+            if (strcmp(argv[j], methodNames[m]) == 0)
+                break;
+        if (m == NMETHODS)
+            usageError(argv[0]);
+        selected[m] = TRUE;
+    }
+
+    /* ptyFork() takes the slave's attributes as a termios structure, so
+       obtain one in the required mode */
+
+    if (forkSession && params.mode != PTY_POOL_COOKED) {
+        fd = ptyMasterOpen(slaveName, MAX_SNAME);
+        if (fd == -1)
+            errExit("ptyMasterOpen");
+        j = open(slaveName, O_RDWR | O_NOCTTY);
+        if (j == -1)
+            errExit("open-slave");
+        if ((params.mode == PTY_POOL_CBREAK ? ttySetCbreak(j, NULL) :
+                    ttySetRaw(j, NULL)) == -1)
+            errExit("ttySet");
+        if (tcgetattr(j, &slaveTermios) == -1)
+            errExit("tcgetattr");
+        close(j);
+        close(fd);
+    }
+
+    setbuf(stdout, NULL);
+    printf("%-6s %10s %10s %10s %10s %8s\n", "method", "ptys/s", "p50-us",
+           "p99-us", "max-us", "misses");
+    for (m = 0; m < NMETHODS; m++)
+        if (selected[m])
+            runMethod(m, count, rate);
+
+    exit(EXIT_SUCCESS);
+}
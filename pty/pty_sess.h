@@ -0,0 +1,61 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 64 */
+
+/* pty_sess.h
+
+   Header file for pty_sess_sv.c and pty_sess_cl.c.
+
+   A client connects to the server's UNIX domain stream socket and sends
+   one request, a line of text (at most PS_MAX_REQ bytes, including the
+   terminating newline):
+
+        new ROWS COLS TERM [command]    Create a session, and attach to it
+        run ROWS COLS TERM [command]    Create a session, but don't attach
+        attach ID ROWS COLS             Attach to an existing session
+        list                            List the sessions
+        kill ID                         Terminate a session
+
+   The server replies with a line "ok ID" (for "new", "run", "attach",
+   and "kill") or "err message". For "list", the reply is one line per
+   session. Except after a successful "new" or "attach", the server then
+   closes the connection.
+
+   Once attached, the server sends the session's output: first, the
+   output held in the session's ring buffer, and then new output as it
+   is produced. The client sends messages consisting of a struct
+   psHdr followed by 'len' bytes: PS_DATA carries input for the session,
+   and PS_WINSIZE carries a struct winsize. The client detaches by
+   closing the connection. When the session ends, the server closes the
+   connection once all of the output has been sent.
+*/
+#ifndef PTY_SESS_H
+#define PTY_SESS_H
+
+#include <sys/un.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include "tlpi_hdr.h"
+
+#define PS_MAX_REQ 512          /* Max. length of request line */
+
+#define PS_MAX_PAYLOAD 1024     /* Max. length of data in a message */
+
+struct psHdr {                  /* Header for client-to-server messages */
+    uint8_t type;               /* PS_DATA or PS_WINSIZE */
+    uint8_t pad;
+    uint16_t len;               /* Bytes that follow the header */
+};
+
+#define PS_DATA    'd'
+#define PS_WINSIZE 'w'
+
+#endif
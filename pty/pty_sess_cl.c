@@ -0,0 +1,267 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 64 */
+
+/* pty_sess_cl.c
+
+   A client for the session server in pty_sess_sv.c.
+
+   Usage: pty_sess_cl socket-path [command...]     Create a session running
+                                                   'command' (default: a
+                                                   shell), and attach to it
+          pty_sess_cl -d socket-path [command...]  Create a session, but
+                                                   don't attach to it
+          pty_sess_cl -a id socket-path            Attach to a session
+          pty_sess_cl -l socket-path               List sessions
+          pty_sess_cl -k id socket-path            Kill a session
+
+   While attached, the terminal is placed in raw mode, and input is
+   relayed to the session. Typing Control-] detaches from the session
+   (which carries on running). Changes in the terminal window size are
+   passed on to the session.
+*/
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include "pty_sess.h"
+#include "unix_sockets.h"       /* Declaration of unixConnect() */
+#include "tty_functions.h"      /* Declaration of ttySetRaw() */
+#include "read_line.h"          /* Declaration of readLine() */
+#include "rdwrn.h"              /* Declaration of writen() */
+#include "tlpi_hdr.h"
+
+#define DETACH_CHAR 0x1d        /* Control-] */
+#define BUF_SIZE 4096
+
+static struct termios ttyOrig;
+
+static volatile sig_atomic_t gotSigwinch = 0;
+
+static void             /* Reset terminal mode on program exit */
+ttyReset(void)
+{
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &ttyOrig) == -1)
+        errExit("tcsetattr");
+}
+
+static void
+sigwinchHandler(int sig)
+{
+    gotSigwinch = 1;
+}
+
+static void
+getWinsize(struct winsize *ws)
+{
+    if (ioctl(STDIN_FILENO, TIOCGWINSZ, ws) == -1 || ws->ws_row == 0) {
+        ws->ws_row = 24;
+        ws->ws_col = 80;
+        ws->ws_xpixel = ws->ws_ypixel = 0;
+    }
+}
+
+/* Send a message of type 'type' to the server */
+
+static void
+sendMsg(int sfd, int type, const void *buf, size_t len)
+{
+    struct psHdr hdr;
+
+    hdr.type = type;
+    hdr.pad = 0;
+    hdr.len = len;
+    if (writen(sfd, &hdr, sizeof(struct psHdr)) != sizeof(struct psHdr) ||
+            writen(sfd, buf, len) != len)
+        fatal("lost connection to server");
+}
+
+/* Relay data between the terminal and the session, until the session
+   ends or the user types DETACH_CHAR */
+
+static void
+relay(int sfd)
+{
+    struct pollfd pfd[2];
+    struct sigaction sa;
+    struct winsize ws;
+    char buf[BUF_SIZE], *p;
+    Boolean stdinOpen;
+    ssize_t numRead, len;
+
+    if (isatty(STDIN_FILENO)) {
+        if (ttySetRaw(STDIN_FILENO, &ttyOrig) == -1)
+            errExit("ttySetRaw");
+        if (atexit(ttyReset) != 0)
+            errExit("atexit");
+    }
+
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;                    /* Interrupt poll() */
+    sa.sa_handler = sigwinchHandler;
+    if (sigaction(SIGWINCH, &sa, NULL) == -1)
+        errExit("sigaction");
+
+    pfd[0].fd = STDIN_FILENO;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = sfd;
+    pfd[1].events = POLLIN;
+    stdinOpen = TRUE;
+
+    for (;;) {
+        if (gotSigwinch) {
+            gotSigwinch = 0;
+            getWinsize(&ws);
+            sendMsg(sfd, PS_WINSIZE, &ws, sizeof(struct winsize));
+        }
+
+        pfd[0].fd = stdinOpen ? STDIN_FILENO : -1;
+        if (poll(pfd, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("poll");
+        }
+
+        if (pfd[0].revents != 0) {      /* Input from terminal */
+            numRead = read(STDIN_FILENO, buf, PS_MAX_PAYLOAD);
+            if (numRead <= 0) {
+                stdinOpen = FALSE;
+            } else {
+                p = memchr(buf, DETACH_CHAR, numRead);
+                len = (p == NULL) ? numRead : p - buf;
+                if (len > 0)
+                    sendMsg(sfd, PS_DATA, buf, len);
+                if (p != NULL) {
+                    fprintf(stderr, "\r\n[detached]\r\n");
+                    return;
+                }
+            }
+        }
+
+        if (pfd[1].revents != 0) {      /* Output from session */
+            numRead = read(sfd, buf, BUF_SIZE);
+            if (numRead <= 0) {
+                fprintf(stderr, "\r\n[session ended or detached]\r\n");
+                return;
+            }
+            if (writen(STDOUT_FILENO, buf, numRead) != numRead)
+                fatal("partial/failed write (stdout)");
+        }
+    }
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-d] socket-path [command...]\n", progName);
+    fprintf(stderr, "       %s -a id socket-path\n", progName);
+    fprintf(stderr, "       %s -l socket-path\n", progName);
+    fprintf(stderr, "       %s -k id socket-path\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct winsize ws;
+    char req[PS_MAX_REQ], reply[PS_MAX_REQ], buf[BUF_SIZE];
+    const char *term;
+    int opt, sfd, id, j;
+    char mode;
+    size_t len;
+    ssize_t numRead;
+
+    mode = 'n';
+    id = 0;
+    while ((opt = getopt(argc, argv, "+a:dk:l")) != -1) {
+        switch (opt) {
+        case 'a':
+        case 'k':
+            mode = opt;
+            id = getInt(optarg, 0, "id");
+            break;
+        case 'd':
+        case 'l':
+            mode = opt;
+            break;
+        default:
+            usageError(argv[0]);
+        }
+    }
+
+    if (optind >= argc || (mode != 'n' && mode != 'd' && optind + 1 != argc))
+        usageError(argv[0]);
+
+    getWinsize(&ws);
+    term = getenv("TERM");
+    if (term == NULL || *term == '\0')
+        term = "vt100";
+
+    switch (mode) {
+    case 'n':
+    case 'd':
+        len = snprintf(req, PS_MAX_REQ, "%s %d %d %s", (mode == 'n') ?
+                       "new" : "run", ws.ws_row, ws.ws_col, term);
+        for (j = optind + 1; j < argc && len < PS_MAX_REQ; j++)
+            len += snprintf(req + len, PS_MAX_REQ - len, " %s", argv[j]);
+        break;
+    case 'a':
+        len = snprintf(req, PS_MAX_REQ, "attach %d %d %d", id, ws.ws_row,
+                       ws.ws_col);
+        break;
+    case 'k':
+        len = snprintf(req, PS_MAX_REQ, "kill %d", id);
+        break;
+    default:    /* 'l' */
+        len = snprintf(req, PS_MAX_REQ, "list");
+        break;
+    }
+    if (len >= PS_MAX_REQ - 1)
+        fatal("command is too long");
+
+    sfd = unixConnect(argv[optind], SOCK_STREAM);
+    if (sfd == -1)
+        errExit("unixConnect");
+
+    req[len++] = '\n';
+    if (writen(sfd, req, len) != len)
+        fatal("partial/failed write (socket)");
+
+    if (mode == 'l') {                  /* Copy listing to stdout */
+        printf("%-4s %-7s %-18s %-8s %-12s %s %s\n", "ID", "PID", "STATE",
+               "CLIENT", "OUTPUT", "SECS", "COMMAND");
+        fflush(stdout);
+        while ((numRead = read(sfd, buf, BUF_SIZE)) > 0)
+            if (writen(STDOUT_FILENO, buf, numRead) != numRead)
+                fatal("partial/failed write (stdout)");
+        if (numRead == -1)
+            errExit("read");
+        exit(EXIT_SUCCESS);
+    }
+
+    numRead = readLine(sfd, reply, PS_MAX_REQ);
+    if (numRead == -1)
+        errExit("readLine");
+    if (numRead == 0)
+        fatal("unexpected EOF from server");
+    if (strncmp(reply, "ok ", 3) != 0) {
+        fprintf(stderr, "%s", (strncmp(reply, "err ", 4) == 0) ?
+                reply + 4 : reply);
+        exit(EXIT_FAILURE);
+    }
+
+    if (mode == 'd')
+        printf("%s", reply + 3);        /* Session ID */
+    else if (mode == 'n' || mode == 'a')
+        relay(sfd);
+
+    exit(EXIT_SUCCESS);
+}
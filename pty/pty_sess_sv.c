@@ -0,0 +1,761 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 64 */
+
+/* pty_sess_sv.c
+
+   A server that hosts many sessions, each a shell (or other program)
+   running on a pseudoterminal created with ptyFork(), from a single
+   event loop (event_loop.c). Clients (see pty_sess_cl.c) connect via a
+   UNIX domain stream socket to create, list, attach to, and kill
+   sessions; the protocol is described in pty_sess.h. A session carries
+   on running while no client is attached, and any number of clients
+   may attach to it in turn. Attaching to a session that already has a
+   client detaches that client.
+
+   Usage: pty_sess_sv [-m max-sessions] [-p pool-size] [-r ring-KiB]
+                      socket-path
+
+        -m max-sessions   Maximum number of sessions (default: 1024)
+        -p pool-size      Create pseudoterminals in advance with a pool
+                          (pty_pool.c) that keeps up to this many ready,
+                          refilling it when fewer than half remain, so
+                          that sessions start faster
+        -r ring-KiB       Size of each session's output buffer
+                          (default: 16)
+
+   Each session's output is kept in a ring buffer, so that a client
+   that attaches is first sent the most recent output. While no client
+   is attached, the oldest output is overwritten. While a client is
+   attached, no output is discarded: if the client falls a whole ring
+   buffer behind, the server stops reading from the pty master until the
+   client catches up, so that the session's program blocks, as it would
+   when writing to a slow terminal. Thus, the memory used by a session
+   is fixed: its ring buffer, plus a struct session of a little over 100
+   bytes (the copy of the command shown by "list" is truncated), plus,
+   while a client is connected, a struct client of about 1 KiB.
+
+   A session ends when all processes have closed the pty slave (usually,
+   when the shell terminates). If a client is attached, the server
+   closes the connection once the remaining output has been sent, and
+   frees the session. Otherwise, the session is kept (and is shown as
+   "exited" by "list") so that a client can attach and see its final
+   output, or until it is killed. The "kill" request closes the pty
+   master, so that the kernel sends SIGHUP to the session's processes.
+
+   On receipt of SIGINT or SIGTERM, the server closes all of the pty
+   masters, removes the socket, and terminates.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <time.h>
+#include "pty_sess.h"
+#include "pty_fork.h"           /* Declaration of ptyFork() */
+#include "pty_pool.h"
+#include "event_loop.h"
+#include "unix_sockets.h"       /* Declaration of unixBind() */
+#include "tlpi_hdr.h"
+
+#define MAX_CMD 64              /* Bytes of command kept for "list" */
+
+struct session;
+
+struct client {                 /* A connection from a client */
+    int fd;
+    int events;                 /* Events currently watched on 'fd' */
+    struct session *sess;       /* Attached session, or NULL */
+    char *reply;                /* Reply, sent before session output */
+    size_t replyLen;
+    size_t replySent;
+    Boolean closeWhenSent;      /* Close once reply and output are sent */
+    Boolean inputBlocked;       /* Waiting for pty master to be writable */
+    uint64_t pos;               /* Offset in session's output of next byte
+                                   to send */
+    size_t inLen;               /* Bytes in 'in' */
+    char in[sizeof(struct psHdr) + PS_MAX_PAYLOAD];
+};
+
+struct session {
+    int id;                     /* Index in 'sessTab' */
+    pid_t pid;
+    int masterFd;               /* -1 once the session has ended */
+    int events;                 /* Events currently watched on 'masterFd' */
+    Boolean reaped;             /* Child has been waited for */
+    int status;                 /* Child's wait status, if 'reaped' */
+    time_t started;
+    struct client *client;      /* Attached client, or NULL */
+    uint64_t head;              /* Total bytes of output read from master;
+                                   the last 'ringSize' bytes are in 'ring' */
+    char cmd[MAX_CMD];
+    char ring[];                /* 'ringSize' bytes */
+};
+
+static struct evLoop *loop;
+static struct session **sessTab;
+static int maxSess;
+static size_t ringSize;
+static sigset_t origMask;       /* Signal mask to be restored in children */
+static const char *sockPath;
+static struct ptyPool *ptyPool; /* NULL if not using a pool */
+
+static void closeClient(struct client *c);
+static void masterReady(struct evLoop *lp, int fd, int events, void *arg);
+
+/* Change the events watched for 'fd', if they differ from '*cur' */
+
+static void
+setEvents(int fd, int *cur, int events)
+{
+    if (events != *cur) {
+        if (evModFd(loop, fd, events) == -1)
+            errExit("evModFd");
+        *cur = events;
+    }
+}
+
+/* Bytes that can be read into the ring buffer of 's' without
+   overwriting data that the attached client (if any) has yet to be
+   sent, or wrapping around */
+
+static size_t
+ringSpace(const struct session *s)
+{
+    size_t n, avail;
+
+    n = ringSize - s->head % ringSize;
+    if (s->client != NULL) {
+        avail = ringSize - (s->head - s->client->pos);
+        if (avail < n)
+            n = avail;
+    }
+    return n;
+}
+
+/* Set the events to be watched for the pty master of 's', and for the
+   attached client, according to the state of their buffers */
+
+static void
+updateEvents(struct session *s)
+{
+    struct client *c = s->client;
+
+    if (s->masterFd != -1)
+        setEvents(s->masterFd, &s->events,
+                  (ringSpace(s) > 0 ? EV_READ : 0) |
+                  ((c != NULL && c->inputBlocked) ? EV_WRITE : 0));
+
+    if (c != NULL)
+        setEvents(c->fd, &c->events,
+                  (c->inputBlocked ? 0 : EV_READ) |
+                  ((c->replySent < c->replyLen || c->pos < s->head) ?
+                        EV_WRITE : 0));
+}
+
+static void
+freeSession(struct session *s)
+{
+    if (s->masterFd != -1) {
+        if (evDelFd(loop, s->masterFd) == -1)
+            errExit("evDelFd");
+        close(s->masterFd);             /* Hangs up the pty slave */
+    }
+    sessTab[s->id] = NULL;
+    free(s);
+}
+
+/* The pty slave has been closed by all processes in the session */
+
+static void
+sessionEnded(struct session *s)
+{
+    if (evDelFd(loop, s->masterFd) == -1)
+        errExit("evDelFd");
+    close(s->masterFd);
+    s->masterFd = -1;
+
+    if (s->client != NULL) {            /* Close after sending the rest */
+        s->client->closeWhenSent = TRUE;
+        s->client->inputBlocked = FALSE;
+        s->client->inLen = 0;
+        updateEvents(s);
+    }
+}
+
+/* Set up the reply to be sent to a client */
+
+static void
+setReply(struct client *c, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vasprintf(&c->reply, fmt, ap);
+    va_end(ap);
+    if (n == -1)
+        errExit("vasprintf");
+    c->replyLen = n;
+    c->replySent = 0;
+}
+
+/* Send as much as possible of the reply and of the attached session's
+   unsent output. Returns -1 if the client has gone away. */
+
+static int
+flushClient(struct client *c)
+{
+    struct session *s = c->sess;
+    struct iovec iov[2];
+    size_t off, len;
+    ssize_t n;
+    int cnt;
+
+    while (c->replySent < c->replyLen) {
+        n = write(c->fd, c->reply + c->replySent, c->replyLen - c->replySent);
+        if (n == -1)
+            return (errno == EAGAIN) ? 0 : -1;
+        c->replySent += n;
+    }
+
+    while (s != NULL && c->pos < s->head) {
+        off = c->pos % ringSize;
+        len = s->head - c->pos;
+        cnt = 1;
+        iov[0].iov_base = s->ring + off;
+        iov[0].iov_len = len;
+        if (off + len > ringSize) {     /* Data wraps around end of ring */
+            iov[0].iov_len = ringSize - off;
+            iov[1].iov_base = s->ring;
+            iov[1].iov_len = len - iov[0].iov_len;
+            cnt = 2;
+        }
+        n = writev(c->fd, iov, cnt);
+        if (n == -1)
+            return (errno == EAGAIN) ? 0 : -1;
+        c->pos += n;
+    }
+    return 0;
+}
+
+/* Pass complete messages in the client's input buffer to the session.
+   If the pty master can't accept all of the data, what remains is kept,
+   and the client is marked as blocked. */
+
+static void
+processInput(struct client *c)
+{
+    struct session *s = c->sess;
+    struct psHdr hdr;
+    size_t msgLen;
+    ssize_t n;
+
+    c->inputBlocked = FALSE;
+    while (c->inLen >= sizeof(struct psHdr)) {
+        memcpy(&hdr, c->in, sizeof(struct psHdr));
+        if (hdr.len > PS_MAX_PAYLOAD) {
+            closeClient(c);             /* Protocol error */
+            return;
+        }
+        msgLen = sizeof(struct psHdr) + hdr.len;
+        if (c->inLen < msgLen)
+            break;
+
+        if (hdr.type == PS_WINSIZE && hdr.len == sizeof(struct winsize)) {
+            if (ioctl(s->masterFd, TIOCSWINSZ,
+                      c->in + sizeof(struct psHdr)) == -1)
+                errMsg("ioctl-TIOCSWINSZ");
+
+        } else if (hdr.type == PS_DATA) {
+            n = write(s->masterFd, c->in + sizeof(struct psHdr), hdr.len);
+            if (n == -1)
+                n = (errno == EAGAIN) ? 0 : hdr.len;    /* Discard on error */
+            if (n < hdr.len) {          /* Keep the rest for later */
+                hdr.len -= n;
+                memcpy(c->in, &hdr, sizeof(struct psHdr));
+                memmove(c->in + sizeof(struct psHdr),
+                        c->in + sizeof(struct psHdr) + n,
+                        c->inLen - sizeof(struct psHdr) - n);
+                c->inLen -= n;
+                c->inputBlocked = TRUE;
+                break;
+            }
+        }
+
+        memmove(c->in, c->in + msgLen, c->inLen - msgLen);
+        c->inLen -= msgLen;
+    }
+    updateEvents(s);
+}
+
+/* Attach client 'c' to session 's', detaching any current client */
+
+static void
+attachClient(struct client *c, struct session *s)
+{
+    if (s->client != NULL) {
+        s->client->sess = NULL;         /* So that 's' isn't freed */
+        closeClient(s->client);
+    }
+
+    s->client = c;
+    c->sess = s;
+    c->pos = (s->head > ringSize) ? s->head - ringSize : 0;
+    if (s->masterFd == -1)              /* Session has ended */
+        c->closeWhenSent = TRUE;
+}
+
+static void
+closeClient(struct client *c)
+{
+    struct session *s = c->sess;
+
+    if (evDelFd(loop, c->fd) == -1)
+        errExit("evDelFd");
+    close(c->fd);
+    free(c->reply);
+    free(c);
+
+    if (s != NULL) {
+        s->client = NULL;
+        if (s->masterFd == -1)          /* Ended, and output collected */
+            freeSession(s);
+        else
+            updateEvents(s);
+    }
+}
+
+/* Create a session running 'cmd' (or, if 'cmd' is empty, the user's
+   shell). Returns the new session, or NULL with 'errno' set on error. */
+
+static struct session *
+newSession(int rows, int cols, const char *term, const char *cmd)
+{
+    struct session *s;
+    struct winsize ws;
+    const char *shell;
+    int id, savedErrno;
+
+    for (id = 0; id < maxSess; id++)
+        if (sessTab[id] == NULL)
+            break;
+    if (id == maxSess) {
+        errno = EAGAIN;
+        return NULL;
+    }
+
+    s = malloc(sizeof(struct session) + ringSize);
+    if (s == NULL)
+        return NULL;
+
+    ws.ws_row = rows;
+    ws.ws_col = cols;
+    ws.ws_xpixel = ws.ws_ypixel = 0;
+
+    if (ptyPool != NULL)
+        s->pid = ptyPoolFork(ptyPool, &s->masterFd, NULL, 0, &ws);
+    else
+        s->pid = ptyFork(&s->masterFd, NULL, 0, NULL, &ws);
+    if (s->pid == -1) {
+        savedErrno = errno;
+        free(s);
+        errno = savedErrno;
+        return NULL;
+    }
+
+    if (s->pid == 0) {                  /* Child: execute command */
+        if (sigprocmask(SIG_SETMASK, &origMask, NULL) == -1)
+            err_exit("sigprocmask");
+        signal(SIGPIPE, SIG_DFL);
+        if (setenv("TERM", term, 1) == -1)
+            err_exit("setenv");
+
+        if (*cmd != '\0') {
+            execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+        } else {
+            shell = getenv("SHELL");
+            if (shell == NULL || *shell == '\0')
+                shell = "/bin/sh";
+            execlp(shell, shell, (char *) NULL);
+        }
+        err_exit("execl");              /* If we get here, exec failed */
+    }
+
+    /* Parent: the master must not be inherited by later sessions */
+
+    if (fcntl(s->masterFd, F_SETFD, FD_CLOEXEC) == -1 ||
+            fcntl(s->masterFd, F_SETFL, O_NONBLOCK) == -1)
+        errExit("fcntl");
+    if (evAddFd(loop, s->masterFd, EV_READ, masterReady, s) == -1)
+        errExit("evAddFd");
+
+    s->id = id;
+    s->events = EV_READ;
+    s->reaped = FALSE;
+    s->started = time(NULL);
+    s->client = NULL;
+    s->head = 0;
+    snprintf(s->cmd, MAX_CMD, "%s", (*cmd != '\0') ? cmd : "(shell)");
+    sessTab[id] = s;
+    return s;
+}
+
+/* Append a line describing each session to the reply for 'c' */
+
+static void
+listSessions(struct client *c)
+{
+    struct session *s;
+    char state[40];
+    FILE *fp;
+    int id;
+
+    fp = open_memstream(&c->reply, &c->replyLen);
+    if (fp == NULL)
+        errExit("open_memstream");
+
+    for (id = 0; id < maxSess; id++) {
+        s = sessTab[id];
+        if (s == NULL)
+            continue;
+
+        if (s->masterFd != -1)
+            snprintf(state, sizeof(state), "running");
+        else if (!s->reaped)
+            snprintf(state, sizeof(state), "exited");
+        else if (WIFEXITED(s->status))
+            snprintf(state, sizeof(state), "exited(%d)",
+                     WEXITSTATUS(s->status));
+        else if (WIFSIGNALED(s->status))
+            snprintf(state, sizeof(state), "killed(%s)",
+                     strsignal(WTERMSIG(s->status)));
+        else
+            snprintf(state, sizeof(state), "exited");
+
+        fprintf(fp, "%-4d %-7ld %-18s %-8s %-12llu %ld %s\n", s->id,
+                (long) s->pid, state,
+                (s->client != NULL) ? "attached" : "detached",
+                (unsigned long long) s->head,
+                (long) (time(NULL) - s->started), s->cmd);
+    }
+
+    if (fclose(fp) == EOF)
+        errExit("fclose");
+    c->replySent = 0;
+}
+
+/* Handle the request line 'req' (with the newline removed) */
+
+static void
+handleRequest(struct client *c, char *req)
+{
+    struct session *s;
+    struct winsize ws;
+    int rows, cols, id, n;
+    char verb[8], term[32];
+
+    c->closeWhenSent = TRUE;            /* Unless we attach */
+    n = 0;
+
+    if (sscanf(req, "%7s", verb) != 1) {
+        setReply(c, "err empty request\n");
+
+    } else if (strcmp(verb, "new") == 0 || strcmp(verb, "run") == 0) {
+        if (sscanf(req, "%*s %d %d %31s %n", &rows, &cols, term, &n) < 3) {
+            setReply(c, "err usage: %s ROWS COLS TERM [command]\n", verb);
+            return;
+        }
+        s = newSession(rows, cols, term, (n > 0) ? req + n : "");
+        if (s == NULL) {
+            setReply(c, "err %s\n", strerror(errno));
+            return;
+        }
+        setReply(c, "ok %d\n", s->id);
+        if (verb[0] == 'n') {
+            c->closeWhenSent = FALSE;
+            attachClient(c, s);
+        }
+
+    } else if (strcmp(verb, "attach") == 0) {
+        if (sscanf(req, "%*s %d %d %d", &id, &rows, &cols) != 3) {
+            setReply(c, "err usage: attach ID ROWS COLS\n");
+            return;
+        }
+        s = (id >= 0 && id < maxSess) ? sessTab[id] : NULL;
+        if (s == NULL) {
+            setReply(c, "err no session %d\n", id);
+            return;
+        }
+        setReply(c, "ok %d\n", s->id);
+        c->closeWhenSent = FALSE;
+        attachClient(c, s);
+        if (s->masterFd != -1) {
+            ws.ws_row = rows;
+            ws.ws_col = cols;
+            ws.ws_xpixel = ws.ws_ypixel = 0;
+            if (ioctl(s->masterFd, TIOCSWINSZ, &ws) == -1)
+                errMsg("ioctl-TIOCSWINSZ");
+        }
+
+    } else if (strcmp(verb, "list") == 0) {
+        listSessions(c);
+
+    } else if (strcmp(verb, "kill") == 0) {
+        if (sscanf(req, "%*s %d", &id) != 1) {
+            setReply(c, "err usage: kill ID\n");
+            return;
+        }
+        s = (id >= 0 && id < maxSess) ? sessTab[id] : NULL;
+        if (s == NULL) {
+            setReply(c, "err no session %d\n", id);
+            return;
+        }
+        if (s->client != NULL)
+            closeClient(s->client);     /* Frees 's' if it has ended */
+        if (sessTab[id] != NULL)
+            freeSession(s);
+        setReply(c, "ok %d\n", id);
+
+    } else {
+        setReply(c, "err unknown request '%s'\n", verb);
+    }
+}
+
+/* Input from a client, or the client can be sent more data */
+
+static void
+clientReady(struct evLoop *lp, int fd, int events, void *arg)
+{
+    struct client *c = arg;
+    char *nl;
+    size_t reqLen;
+    ssize_t n;
+
+    if (events & EV_READ) {
+        n = read(fd, c->in + c->inLen, sizeof(c->in) - c->inLen);
+        if (n == -1 && errno == EAGAIN)
+            return;
+        if (n <= 0) {                   /* EOF (detach) or error */
+            closeClient(c);
+            return;
+        }
+        c->inLen += n;
+
+        if (c->reply == NULL) {         /* Still waiting for request line */
+            nl = memchr(c->in, '\n', c->inLen);
+            if (nl == NULL) {
+                if (c->inLen >= PS_MAX_REQ)
+                    closeClient(c);
+                return;
+            }
+            *nl = '\0';
+            reqLen = nl - c->in + 1;
+            handleRequest(c, c->in);
+            memmove(c->in, c->in + reqLen, c->inLen - reqLen);
+            c->inLen -= reqLen;
+        }
+
+        if (c->closeWhenSent)           /* Ignore any further input */
+            c->inLen = 0;
+        else if (c->sess != NULL) {
+            processInput(c);
+            return;
+        }
+    }
+
+    if (flushClient(c) == -1 || (c->closeWhenSent &&
+            c->replySent == c->replyLen &&
+            (c->sess == NULL || c->pos == c->sess->head))) {
+        closeClient(c);
+        return;
+    }
+
+    if (c->sess != NULL)
+        updateEvents(c->sess);
+    else
+        setEvents(fd, &c->events, (c->replySent < c->replyLen) ?
+                                  EV_WRITE : EV_READ);
+}
+
+/* Output from a session, or the pty master can accept more input */
+
+static void
+masterReady(struct evLoop *lp, int fd, int events, void *arg)
+{
+    struct session *s = arg;
+    struct client *c = s->client;
+    ssize_t n;
+
+    if ((events & EV_READ) && ringSpace(s) > 0) {
+        n = read(fd, s->ring + s->head % ringSize, ringSpace(s));
+        if (n == -1 && errno == EAGAIN)
+            return;
+        if (n <= 0) {                   /* EIO: slave has been closed */
+            sessionEnded(s);
+            if (c != NULL)
+                clientReady(loop, c->fd, EV_WRITE, c);
+            return;
+        }
+        s->head += n;
+    }
+
+    if (c != NULL) {
+        if ((events & EV_WRITE) && c->inputBlocked)
+            processInput(c);            /* May close 'c' */
+        if (s->client != NULL)
+            clientReady(loop, c->fd, EV_WRITE, c);
+        else
+            updateEvents(s);
+    } else {
+        updateEvents(s);
+    }
+}
+
+static void
+acceptReady(struct evLoop *lp, int lfd, int events, void *arg)
+{
+    struct client *c;
+    int cfd;
+
+    cfd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd == -1) {
+        if (errno != EAGAIN && errno != ECONNABORTED)
+            errMsg("accept4");
+        return;
+    }
+
+    c = calloc(1, sizeof(struct client));
+    if (c == NULL)
+        errExit("calloc");
+    c->fd = cfd;
+    c->events = EV_READ;
+    if (evAddFd(loop, cfd, EV_READ, clientReady, c) == -1)
+        errExit("evAddFd");
+}
+
+/* Reap terminated children, and record their status */
+
+static void
+childSignal(struct evLoop *lp, int sig, void *arg)
+{
+    pid_t pid;
+    int status, id;
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (id = 0; id < maxSess; id++) {
+            if (sessTab[id] != NULL && sessTab[id]->pid == pid) {
+                sessTab[id]->reaped = TRUE;
+                sessTab[id]->status = status;
+                break;
+            }
+        }
+    }
+}
+
+static void
+termSignal(struct evLoop *lp, int sig, void *arg)
+{
+    int id;
+
+    for (id = 0; id < maxSess; id++) {
+        if (sessTab[id] == NULL)
+            continue;
+        if (sessTab[id]->client != NULL)
+            closeClient(sessTab[id]->client);
+        if (sessTab[id] != NULL)
+            freeSession(sessTab[id]);
+    }
+    unlink(sockPath);
+    evStop(loop);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-m max-sessions] [-p pool-size] "
+            "[-r ring-KiB] socket-path\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct ptyPoolParams poolParams;
+    int opt, lfd, poolSize;
+
+    maxSess = 1024;
+    ringSize = 16 * 1024;
+    poolSize = 0;
+    while ((opt = getopt(argc, argv, "m:p:r:")) != -1) {
+        switch (opt) {
+        case 'm': maxSess = getInt(optarg, GN_GT_0, "max-sessions");   break;
+        case 'p': poolSize = getInt(optarg, GN_GT_0, "pool-size");     break;
+        case 'r': ringSize = getInt(optarg, GN_GT_0, "ring-KiB") * 1024; break;
+        default:  usageError(argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc)
+        usageError(argv[0]);
+    sockPath = argv[optind];
+
+    sessTab = calloc(maxSess, sizeof(struct session *));
+    if (sessTab == NULL)
+        errExit("calloc");
+
+    if (poolSize > 0) {
+        ptyPoolDefaultParams(&poolParams);
+        poolParams.highWater = poolSize;
+        poolParams.lowWater = (poolSize + 1) / 2;
+        ptyPool = ptyPoolOpen(&poolParams);
+        if (ptyPool == NULL)
+            errExit("ptyPoolOpen");
+    }
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+    if (sigprocmask(SIG_BLOCK, NULL, &origMask) == -1)
+        errExit("sigprocmask");
+
+    if (remove(sockPath) == -1 && errno != ENOENT)
+        errExit("remove-%s", sockPath);
+    lfd = unixBind(sockPath, SOCK_STREAM);
+    if (lfd == -1)
+        errExit("unixBind");
+    if (listen(lfd, SOMAXCONN) == -1)
+        errExit("listen");
+    if (fcntl(lfd, F_SETFD, FD_CLOEXEC) == -1 ||
+            fcntl(lfd, F_SETFL, O_NONBLOCK) == -1)
+        errExit("fcntl");
+
+    loop = evLoopCreate(EV_BACKEND_DEFAULT);
+    if (loop == NULL)
+        errExit("evLoopCreate");
+
+    if (evAddFd(loop, lfd, EV_READ, acceptReady, NULL) == -1)
+        errExit("evAddFd");
+    if (evAddSignal(loop, SIGCHLD, childSignal, NULL) == -1 ||
+            evAddSignal(loop, SIGINT, termSignal, NULL) == -1 ||
+            evAddSignal(loop, SIGTERM, termSignal, NULL) == -1)
+        errExit("evAddSignal");
+
+    if (evRun(loop) == -1)
+        errExit("evRun");
+
+    evLoopDestroy(loop);
+    exit(EXIT_SUCCESS);
+}
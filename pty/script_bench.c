@@ -0,0 +1,248 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 64 */
+
+/* script_bench.c
+
+   Measure the overhead that script.c and script_fast.c add to a program
+   that writes a large volume of output to the terminal.
+
+   Usage: script_bench [-s MiB] [-l line-len] [-f typescript] [prog...]
+
+        -s MiB          Amount of output (default: 256)
+        -l line-len     Length of each output line (default: 80)
+        -f typescript   Typescript file (default: /tmp/script_bench.ts)
+
+   Each 'prog' (default: "./script ./script_fast") is run with a newly
+   created pseudoterminal as its standard input (script.c requires a
+   terminal) and with standard output redirected to /dev/null, and with
+   the SHELL environment variable set to the pathname of this program.
+   When this program is executed as the "shell" (which it detects from
+   the environment variable SCRIPT_BENCH_BYTES), it writes the required
+   amount of output, in lines of 'line-len' bytes, 64 kB at a time, and
+   exits.
+
+   For comparison, the first line of the results ("(pty only)") shows the
+   time taken when the output is written to a pseudoterminal whose master
+   is read (using 64 kB reads) and discarded directly by this program.
+   For each program, the results show the elapsed time, the rate, and the
+   CPU time consumed by the relaying process, and check the size of the
+   typescript file (which is larger than the output, since the terminal
+   driver converts each newline to a carriage return plus newline).
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include "pty_fork.h"           /* Declaration of ptyFork() */
+#include "pty_master_open.h"    /* Declaration of ptyMasterOpen() */
+#include "tlpi_hdr.h"
+
+#define CHUNK 65536
+#define MAX_SNAME 1000
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Act as the "shell": write 'total' bytes of text to standard output */
+
+static void
+generate(long long total, int lineLen)
+{
+    char buf[CHUNK];
+    long long done;
+    ssize_t n, bufLen;
+    int j;
+
+    /* Make the buffer a whole number of lines, so that each write()
+       continues the pattern */
+
+    bufLen = (lineLen < CHUNK) ? CHUNK - CHUNK % lineLen : CHUNK;
+    for (j = 0; j < bufLen; j++)
+        buf[j] = (j % lineLen == lineLen - 1) ? '\n' : 'a' + j % 26;
+
+    for (done = 0; done < total; done += n) {
+        n = (total - done < bufLen) ? total - done : bufLen;
+        if (write(STDOUT_FILENO, buf, n) != n)
+            errExit("write");
+    }
+    exit(EXIT_SUCCESS);
+}
+
+/* Run the generator on a pty, and read and discard its output */
+
+static double
+ptyOnly(long long total)
+{
+    char buf[CHUNK];
+    char slaveName[MAX_SNAME];
+    int masterFd;
+    double start;
+    long long done;
+    ssize_t numRead;
+    pid_t pid;
+
+    start = nowSecs();
+    pid = ptyFork(&masterFd, slaveName, MAX_SNAME, NULL, NULL);
+    if (pid == -1)
+        errExit("ptyFork");
+    if (pid == 0) {
+        execl("/proc/self/exe", "script_bench", (char *) NULL);
+        errExit("execl");
+    }
+
+    for (done = 0; (numRead = read(masterFd, buf, CHUNK)) > 0; )
+        done += numRead;        /* Read fails with EIO at end */
+    if (waitpid(pid, NULL, 0) == -1)
+        errExit("waitpid");
+    close(masterFd);
+
+    if (done < total)
+        fatal("(pty only): read %lld bytes, expected %lld", done, total);
+    return nowSecs() - start;
+}
+
+/* Run 'prog' with a pty as standard input and /dev/null as standard
+   output; return the elapsed time and the CPU time used by 'prog' */
+
+static double
+runScript(const char *prog, const char *tsFile, double *cpu)
+{
+    char slaveName[MAX_SNAME];
+    struct rusage ru;
+    int masterFd, fd, status;
+    double start;
+    pid_t pid;
+
+    masterFd = ptyMasterOpen(slaveName, MAX_SNAME);
+    if (masterFd == -1)
+        errExit("ptyMasterOpen");
+
+    start = nowSecs();
+    pid = fork();
+    if (pid == -1)
+        errExit("fork");
+
+    if (pid == 0) {
+        if (setsid() == -1)
+            errExit("setsid");
+        close(masterFd);
+        fd = open(slaveName, O_RDWR);   /* Becomes controlling terminal */
+        if (fd == -1)
+            errExit("open %s", slaveName);
+        if (dup2(fd, STDIN_FILENO) == -1)
+            errExit("dup2");
+        fd = open("/dev/null", O_WRONLY);
+        if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1)
+            errExit("open /dev/null");
+        execl(prog, prog, tsFile, (char *) NULL);
+        errExit("execl %s", prog);
+    }
+
+    if (wait4(pid, &status, 0, &ru) == -1)
+        errExit("wait4");
+    close(masterFd);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        fatal("%s failed (status 0x%x)", prog, status);
+
+    *cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    return nowSecs() - start;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-s MiB] [-l line-len] [-f typescript] "
+            "[prog...]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *defProgs[] = { "./script", "./script_fast" };
+    const char *tsFile;
+    char *env, self[PATH_MAX], num[32];
+    int opt, lineLen, nprogs, j;
+    long long total;
+    double secs, cpu, mib;
+    struct stat sb;
+    ssize_t len;
+
+    env = getenv("SCRIPT_BENCH_BYTES");         /* We are the "shell" */
+    if (env != NULL)
+        generate(strtoll(env, NULL, 10), getInt(getenv("SCRIPT_BENCH_LINE"),
+                 GN_GT_0, "SCRIPT_BENCH_LINE"));
+
+    total = 256LL * 1024 * 1024;
+    lineLen = 80;
+    tsFile = "/tmp/script_bench.ts";
+    while ((opt = getopt(argc, argv, "s:l:f:")) != -1) {
+        switch (opt) {
+        case 's':
+            total = getLong(optarg, GN_GT_0, "MiB") * 1024LL * 1024;
+            break;
+        case 'l':   lineLen = getInt(optarg, GN_GT_0, "line-len");      break;
+        case 'f':   tsFile = optarg;                                    break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len == -1)
+        errExit("readlink");
+    self[len] = '\0';
+
+    snprintf(num, sizeof(num), "%lld", total);
+    if (setenv("SCRIPT_BENCH_BYTES", num, 1) == -1)
+        errExit("setenv");
+    snprintf(num, sizeof(num), "%d", lineLen);
+    if (setenv("SCRIPT_BENCH_LINE", num, 1) == -1 ||
+            setenv("SHELL", self, 1) == -1)
+        errExit("setenv");
+
+    mib = total / 1048576.0;
+    printf("%.0f MiB in %d-byte lines\n", mib, lineLen);
+    printf("%-24s %9s %9s %9s %12s\n", "program", "secs", "MiB/s",
+            "cpu-secs", "typescript");
+
+    secs = ptyOnly(total);
+    printf("%-24s %9.3f %9.0f %9s %12s\n", "(pty only)", secs, mib / secs,
+            "-", "-");
+
+    nprogs = (optind < argc) ? argc - optind : 2;
+    for (j = 0; j < nprogs; j++) {
+        const char *prog = (optind < argc) ? argv[optind + j] : defProgs[j];
+
+        secs = runScript(prog, tsFile, &cpu);
+        if (stat(tsFile, &sb) == -1)
+            errExit("stat %s", tsFile);
+        printf("%-24s %9.3f %9.0f %9.3f %12lld%s\n", prog, secs, mib / secs,
+                cpu, (long long) sb.st_size,
+                (sb.st_size < total) ? " (short!)" : "");
+        unlink(tsFile);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,342 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 64 */
+
+/* script_fast.c
+
+   A version of script.c designed to add little overhead when the
+   program being recorded produces a large volume of output.
+
+   Usage: script_fast [-b buf-KiB] [-c command] [typescript-file]
+
+        -b buf-KiB   Size of the buffer used for reads from the pty master
+                     and from standard input (default: 64)
+        -c command   Run 'command' (using sh -c) rather than an
+                     interactive shell, and terminate when it does, with
+                     its termination status
+
+   The differences from script.c are:
+
+   * The relay loop uses epoll (rather than select()), and reads with a
+     large buffer rather than 256 bytes at a time.
+
+   * The typescript file is written by a separate thread. The main thread
+     copies the output into one of two large buffers, and passes a buffer
+     to the writer thread when it fills, or whenever the writer is idle,
+     so that the relay loop rarely waits for the file to be written (only
+     if the writer falls a full buffer behind).
+
+   * Standard input need not be a terminal (e.g., when recording a batch
+     job). If it isn't, the pty slave gets default attributes, and if
+     standard input can't be monitored with epoll (e.g., it is
+     /dev/null or a regular file), it is not relayed. End-of-file on
+     standard input stops the relaying of input, rather than terminating
+     the program.
+
+   See also script_bench.c.
+
+   This program is Linux-specific.
+*/
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <termios.h>
+#include "pty_fork.h"           /* Declaration of ptyFork() */
+#include "tty_functions.h"      /* Declaration of ttySetRaw() */
+#include "rdwrn.h"              /* Declaration of writen() */
+#include "tlpi_hdr.h"
+
+#define MAX_SNAME 1000
+#define TS_BUF_SIZE (4 * 1024 * 1024)   /* Size of each typescript buffer */
+
+static struct termios ttyOrig;
+
+static void             /* Reset terminal mode on program exit */
+ttyReset(void)
+{
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &ttyOrig) == -1)
+        errExit("tcsetattr");
+}
+
+/* State shared between the main thread and the typescript writer */
+
+static int scriptFd;
+static char *fillBuf;                   /* Being filled by main thread */
+static size_t fillLen;
+static char *pendBuf;                   /* Being written by writer */
+static size_t pendLen;                  /* 0 if writer is idle */
+static Boolean finished;                /* No more data will be passed */
+static pthread_mutex_t tsMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tsDataCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t tsIdleCond = PTHREAD_COND_INITIALIZER;
+
+static void *
+tsWriter(void *arg)
+{
+    int s;
+
+    s = pthread_mutex_lock(&tsMutex);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_lock");
+
+    for (;;) {
+        while (pendLen == 0 && !finished) {
+            s = pthread_cond_wait(&tsDataCond, &tsMutex);
+            if (s != 0)
+                errExitEN(s, "pthread_cond_wait");
+        }
+        if (pendLen == 0)               /* Finished, and all written */
+            break;
+
+        /* 'pendBuf' belongs to us until we reset 'pendLen' */
+
+        s = pthread_mutex_unlock(&tsMutex);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_unlock");
+
+        if (writen(scriptFd, pendBuf, pendLen) != pendLen)
+            errExit("write typescript");
+
+        s = pthread_mutex_lock(&tsMutex);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_lock");
+        pendLen = 0;
+        s = pthread_cond_signal(&tsIdleCond);
+        if (s != 0)
+            errExitEN(s, "pthread_cond_signal");
+    }
+
+    s = pthread_mutex_unlock(&tsMutex);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_unlock");
+    return NULL;
+}
+
+/* Pass the contents of 'fillBuf' to the writer thread. If the writer is
+   busy, then either wait for it (if 'wait' is TRUE) or do nothing. */
+
+static void
+tsHandoff(Boolean wait)
+{
+    char *tmp;
+    int s;
+
+    s = pthread_mutex_lock(&tsMutex);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_lock");
+
+    while (wait && pendLen > 0) {
+        s = pthread_cond_wait(&tsIdleCond, &tsMutex);
+        if (s != 0)
+            errExitEN(s, "pthread_cond_wait");
+    }
+
+    if (pendLen == 0 && fillLen > 0) {
+        tmp = pendBuf;
+        pendBuf = fillBuf;
+        pendLen = fillLen;
+        fillBuf = tmp;
+        fillLen = 0;
+        s = pthread_cond_signal(&tsDataCond);
+        if (s != 0)
+            errExitEN(s, "pthread_cond_signal");
+    }
+
+    s = pthread_mutex_unlock(&tsMutex);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_unlock");
+}
+
+static void
+tsAppend(const char *data, size_t len)
+{
+    size_t n;
+
+    while (len > 0) {
+        if (fillLen == TS_BUF_SIZE)
+            tsHandoff(TRUE);
+        n = (len < TS_BUF_SIZE - fillLen) ? len : TS_BUF_SIZE - fillLen;
+        memcpy(fillBuf + fillLen, data, n);
+        fillLen += n;
+        data += n;
+        len -= n;
+    }
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-b buf-KiB] [-c command] [typescript-file]\n",
+            progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char slaveName[MAX_SNAME];
+    char *shell, *command, *buf;
+    int opt, masterFd, epfd, ready, j, s, status;
+    size_t bufSize;
+    struct winsize ws;
+    struct epoll_event ev, evlist[2];
+    ssize_t numRead;
+    pid_t childPid;
+    pthread_t writer;
+    Boolean isTty, done;
+
+    bufSize = 64 * 1024;
+    command = NULL;
+    while ((opt = getopt(argc, argv, "b:c:")) != -1) {
+        switch (opt) {
+        case 'b':   bufSize = getInt(optarg, GN_GT_0, "buf-KiB") * 1024; break;
+        case 'c':   command = optarg;                                   break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (argc > optind + 1)
+        usageError(argv[0]);
+
+    /* If standard input is a terminal, give the pty slave the same
+       attributes and window size */
+
+    isTty = isatty(STDIN_FILENO);
+    if (isTty) {
+        if (tcgetattr(STDIN_FILENO, &ttyOrig) == -1)
+            errExit("tcgetattr");
+        if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) < 0)
+            errExit("ioctl-TIOCGWINSZ");
+    }
+
+    childPid = ptyFork(&masterFd, slaveName, MAX_SNAME,
+                       isTty ? &ttyOrig : NULL, isTty ? &ws : NULL);
+    if (childPid == -1)
+        errExit("ptyFork");
+
+    if (childPid == 0) {        /* Child: execute a shell on pty slave */
+        if (command != NULL) {
+            execl("/bin/sh", "sh", "-c", command, (char *) NULL);
+            errExit("execl");
+        }
+
+        shell = getenv("SHELL");
+        if (shell == NULL || *shell == '\0')
+            shell = "/bin/sh";
+
+        execlp(shell, shell, (char *) NULL);
+        errExit("execlp");      /* If we get here, something went wrong */
+    }
+
+    /* Parent: relay data between standard input/output and pty master */
+
+    scriptFd = open((argc > optind) ? argv[optind] : "typescript",
+                        O_WRONLY | O_CREAT | O_TRUNC,
+                        S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP |
+                                S_IROTH | S_IWOTH);
+    if (scriptFd == -1)
+        errExit("open typescript");
+
+    buf = malloc(bufSize);
+    fillBuf = malloc(TS_BUF_SIZE);
+    pendBuf = malloc(TS_BUF_SIZE);
+    if (buf == NULL || fillBuf == NULL || pendBuf == NULL)
+        errExit("malloc");
+
+    s = pthread_create(&writer, NULL, tsWriter, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_create");
+
+    if (isTty) {
+        ttySetRaw(STDIN_FILENO, &ttyOrig);
+        if (atexit(ttyReset) != 0)
+            errExit("atexit");
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+        errExit("epoll_create1");
+
+    ev.events = EPOLLIN;
+    ev.data.fd = masterFd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, masterFd, &ev) == -1)
+        errExit("epoll_ctl");
+
+    ev.data.fd = STDIN_FILENO;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == -1 &&
+            errno != EPERM)             /* EPERM: file doesn't support epoll */
+        errExit("epoll_ctl");
+
+    /* Relay until the pty master reports end-of-file (or EIO, which is
+       what Linux reports once all descriptors for the slave are closed) */
+
+    for (done = FALSE; !done; ) {
+        ready = epoll_wait(epfd, evlist, 2, -1);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("epoll_wait");
+        }
+
+        for (j = 0; j < ready; j++) {
+            if (evlist[j].data.fd == STDIN_FILENO) {    /* stdin --> pty */
+                numRead = read(STDIN_FILENO, buf, bufSize);
+                if (numRead <= 0) {
+                    if (epoll_ctl(epfd, EPOLL_CTL_DEL, STDIN_FILENO,
+                                  NULL) == -1)
+                        errExit("epoll_ctl");
+                    continue;
+                }
+                if (writen(masterFd, buf, numRead) != numRead)
+                    fatal("partial/failed write (masterFd)");
+
+            } else {                            /* pty --> stdout+file */
+                numRead = read(masterFd, buf, bufSize);
+                if (numRead <= 0) {
+                    done = TRUE;
+                    break;
+                }
+                if (writen(STDOUT_FILENO, buf, numRead) != numRead)
+                    fatal("partial/failed write (STDOUT_FILENO)");
+                tsAppend(buf, numRead);
+            }
+        }
+
+        tsHandoff(FALSE);               /* If writer is idle */
+    }
+
+    /* Write any remaining data, then wait for the writer to finish */
+
+    tsHandoff(TRUE);
+    s = pthread_mutex_lock(&tsMutex);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_lock");
+    finished = TRUE;
+    s = pthread_cond_signal(&tsDataCond);
+    if (s != 0)
+        errExitEN(s, "pthread_cond_signal");
+    s = pthread_mutex_unlock(&tsMutex);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_unlock");
+
+    s = pthread_join(writer, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_join");
+    if (close(scriptFd) == -1)
+        errExit("close typescript");
+
+    /* With -c, exit with the command's status */
+
+    if (command != NULL && waitpid(childPid, &status, 0) == childPid)
+        exit(WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,364 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 64 */
+
+/* unbuffer_fast.c
+
+   A version of unbuffer.c for programs that write many small pieces of
+   output, which it relays with low latency and little overhead.
+
+   Usage: unbuffer_fast [-b buf-KiB] [-l latency-us] [-s] [-r]
+                        prog [arg...]
+
+        -b buf-KiB      Size of the buffer in which output is gathered
+                        (default: 64)
+        -l latency-us   Gather output that arrives in bursts, holding it
+                        for at most 'latency-us' microseconds before
+                        writing it (default: 0, meaning that output is
+                        written as soon as it has been read)
+        -s              Move output from the pty master to standard
+                        output with splice(), by way of a pipe (which
+                        serves as the buffer), rather than read() and
+                        write()
+        -r              On termination, report statistics on standard
+                        error
+
+   The differences from unbuffer.c are:
+
+   * The relay loop uses epoll, and reads with a large buffer rather
+     than 256 bytes at a time.
+
+   * With -l, output is not written until the buffer is nearly full, or
+     the oldest byte in it has been held for 'latency-us' (the wait uses
+     epoll_pwait2(), which takes a timeout in nanoseconds, where
+     available; otherwise, the timeout is rounded up to a millisecond).
+     Thus, a program that writes a line at a time produces far fewer
+     writes downstream, while the delay added to output that arrives on
+     its own is bounded; no output is ever held waiting for more to
+     arrive beyond the budget, so there is no equivalent of the
+     delays that Nagle's algorithm can cause.
+
+   * With -s, data is not copied through user space. The pty driver
+     does not itself support splice(); since Linux 6.5, the kernel
+     copies through its own buffer instead, and on earlier kernels,
+     splice() fails with EINVAL, and the program falls back to read()
+     and write().
+
+   * Standard input need not be a terminal. If it isn't, the pty slave
+     gets default attributes, and if standard input can't be monitored
+     with epoll, it is not relayed. End-of-file on standard input stops
+     the relaying of input, rather than terminating the program.
+
+   * The program terminates when the pty master reports end-of-file
+     (once the child, and any descendants holding the pty slave open,
+     have terminated), with the child's termination status.
+
+   The report (-r) shows the number of bytes relayed and the rate, the
+   number of reads (or splices) from the pty master and of writes to
+   standard output, and the median, 99th percentile, and maximum time
+   for which output was held before being written (measured from the
+   read that brought the oldest byte into the buffer).
+
+   Try: unbuffer_fast -r seq 200000 | cat > /dev/null
+        unbuffer_fast -r -l 1000 seq 200000 | cat > /dev/null
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include "pty_fork.h"           /* Declaration of ptyFork() */
+#include "tty_functions.h"      /* Declaration of ttySetRaw() */
+#include "rdwrn.h"              /* Declaration of writen() */
+#include "lat_hist.h"
+#include "tlpi_hdr.h"
+
+#define MAX_SNAME 1000
+#define SLACK 4096              /* Write when less space than this is
+                                   left in the buffer */
+
+static struct termios ttyOrig;
+static Boolean isTty;
+
+static void             /* Reset terminal mode on program exit */
+ttyReset(void)
+{
+    if (isTty && tcsetattr(STDIN_FILENO, TCSANOW, &ttyOrig) == -1)
+        errExit("tcsetattr");
+}
+
+/* Output gathered from the pty master, either in 'buf', or (with -s)
+   in the pipe 'pfd' */
+
+static char *buf;
+static size_t bufSize;
+static size_t pending;                  /* Bytes held */
+static long long heldSince;             /* When oldest held byte was read */
+static int pfd[2] = { -1, -1 };
+static Boolean useSplice;
+
+static long long bytes, reads, writes;
+static struct latHist holdHist;
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Read what is available from the pty master into the buffer. Returns
+   the number of bytes read, or 0 on end-of-file (or EIO, which is what
+   Linux reports once all descriptors for the slave are closed). */
+
+static ssize_t
+fillFromMaster(int masterFd)
+{
+    ssize_t n;
+
+    for (;;) {
+        if (useSplice)
+            n = splice(masterFd, NULL, pfd[1], NULL, bufSize - pending,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        else
+            n = read(masterFd, buf + pending, bufSize - pending);
+        if (n >= 0)
+            break;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN)            /* Pipe full (can't happen, since
+                                           we hold at most 'bufSize') */
+            return -1;
+        if (errno == EIO)
+            return 0;
+        if (useSplice && errno == EINVAL && pending == 0 && reads == 0) {
+            useSplice = FALSE;          /* Not supported by this kernel */
+            continue;
+        }
+        errExit(useSplice ? "splice-master" : "read-master");
+    }
+
+    if (n > 0) {
+        if (pending == 0)
+            heldSince = nowNs();
+        pending += n;
+        reads++;
+    }
+    return n;
+}
+
+/* Write all of the held output to standard output */
+
+static void
+flushOutput(void)
+{
+    ssize_t n;
+
+    if (pending == 0)
+        return;
+    latHistRecord(&holdHist, nowNs() - heldSince);
+
+    if (!useSplice) {
+        if (writen(STDOUT_FILENO, buf, pending) != pending)
+            errExit("write-stdout");
+        bytes += pending;
+        pending = 0;
+        writes++;
+        return;
+    }
+
+    while (pending > 0) {
+        n = splice(pfd[0], NULL, STDOUT_FILENO, NULL, pending, SPLICE_F_MOVE);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            errExit("splice-stdout");
+        pending -= n;
+        bytes += n;
+        writes++;
+    }
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-b buf-KiB] [-l latency-us] [-s] [-r] "
+                    "prog [arg...]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char slaveName[MAX_SNAME];
+    struct epoll_event ev, evlist[2];
+    struct winsize ws;
+    struct timespec ts;
+    long long latencyNs, start, elapsed, rem;
+    ssize_t numRead;
+    int opt, masterFd, epfd, ready, j, status;
+    char *inBuf;
+    pid_t childPid;
+    Boolean report, done;
+
+    bufSize = 64 * 1024;
+    latencyNs = 0;
+    report = FALSE;
+    while ((opt = getopt(argc, argv, "+b:l:sr")) != -1) {
+        switch (opt) {
+        case 'b': bufSize = getInt(optarg, GN_GT_0, "buf-KiB") * 1024;   break;
+        case 'l': latencyNs = getLong(optarg, GN_NONNEG, "latency-us") * 1000;
+                  break;
+        case 's': useSplice = TRUE;                                     break;
+        case 'r': report = TRUE;                                        break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usageError(argv[0]);
+    if (bufSize < 2 * SLACK)
+        bufSize = 2 * SLACK;
+
+    /* If standard input is a terminal, give the pty slave the same
+       attributes and window size */
+
+    isTty = isatty(STDIN_FILENO);
+    if (isTty) {
+        if (tcgetattr(STDIN_FILENO, &ttyOrig) == -1)
+            errExit("tcgetattr");
+        if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) < 0)
+            errExit("ioctl-TIOCGWINSZ");
+    }
+
+    childPid = ptyFork(&masterFd, slaveName, MAX_SNAME,
+                       isTty ? &ttyOrig : NULL, isTty ? &ws : NULL);
+    if (childPid == -1)
+        errExit("ptyFork");
+
+    if (childPid == 0) {        /* Child executes the program */
+        execvp(argv[optind], &argv[optind]);
+        errExit("execvp");
+    }
+
+    /* Parent: relay data between standard input/output and pty master */
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    if (useSplice) {
+        if (pipe2(pfd, O_CLOEXEC) == -1)
+            errExit("pipe2");
+        if (fcntl(pfd[1], F_SETPIPE_SZ, bufSize) == -1)
+            errExit("fcntl-F_SETPIPE_SZ");
+        bufSize = fcntl(pfd[1], F_GETPIPE_SZ);      /* Rounded up */
+    }
+
+    buf = malloc(bufSize);              /* Also used if splice() fails */
+    inBuf = malloc(bufSize);
+    if (buf == NULL || inBuf == NULL)
+        errExit("malloc");
+
+    if (isTty) {
+        ttySetRaw(STDIN_FILENO, &ttyOrig);
+        if (atexit(ttyReset) != 0)
+            errExit("atexit");
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+        errExit("epoll_create1");
+
+    ev.events = EPOLLIN;
+    ev.data.fd = masterFd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, masterFd, &ev) == -1)
+        errExit("epoll_ctl");
+
+    ev.data.fd = STDIN_FILENO;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == -1 &&
+            errno != EPERM)             /* EPERM: file doesn't support epoll */
+        errExit("epoll_ctl");
+
+    latHistInit(&holdHist);
+    start = nowNs();
+
+    for (done = FALSE; !done; ) {
+
+        /* While output is held, wait no longer than the rest of its
+           latency budget */
+
+        if (pending == 0) {
+            ready = epoll_wait(epfd, evlist, 2, -1);
+        } else {
+            rem = heldSince + latencyNs - nowNs();
+            if (rem < 0)
+                rem = 0;
+            ts.tv_sec = rem / 1000000000;
+            ts.tv_nsec = rem % 1000000000;
+            ready = epoll_pwait2(epfd, evlist, 2, &ts, NULL);
+            if (ready == -1 && errno == ENOSYS)
+                ready = epoll_wait(epfd, evlist, 2, (rem + 999999) / 1000000);
+        }
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("epoll_wait");
+        }
+
+        for (j = 0; j < ready; j++) {
+            if (evlist[j].data.fd == STDIN_FILENO) {    /* stdin --> pty */
+                numRead = read(STDIN_FILENO, inBuf, bufSize);
+                if (numRead <= 0) {
+                    if (epoll_ctl(epfd, EPOLL_CTL_DEL, STDIN_FILENO,
+                                  NULL) == -1)
+                        errExit("epoll_ctl");
+                    continue;
+                }
+                if (writen(masterFd, inBuf, numRead) != numRead)
+                    fatal("partial/failed write (masterFd)");
+
+            } else {                            /* pty --> stdout */
+                if (fillFromMaster(masterFd) == 0)
+                    done = TRUE;
+            }
+        }
+
+        if (done || latencyNs == 0 || bufSize - pending < SLACK ||
+                nowNs() - heldSince >= latencyNs)
+            flushOutput();
+    }
+
+    elapsed = nowNs() - start;
+
+    if (waitpid(childPid, &status, 0) == -1)
+        errExit("waitpid");
+
+    if (report) {
+        ttyReset();
+        fprintf(stderr, "%lld bytes in %.3f s (%.1f MB/s), %s\n", bytes,
+                elapsed / 1e9, bytes / (elapsed / 1e3),
+                useSplice ? "splice" : "read/write");
+        fprintf(stderr, "%lld reads, %lld writes (%.0f bytes per write)\n",
+                reads, writes, writes > 0 ? (double) bytes / writes : 0.0);
+        fprintf(stderr, "held for: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+                latHistPercentile(&holdHist, 0.50) / 1e3,
+                latHistPercentile(&holdHist, 0.99) / 1e3,
+                holdHist.max / 1e3);
+    }
+
+    exit(WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+}
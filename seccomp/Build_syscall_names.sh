@@ -0,0 +1,22 @@
+#!/bin/sh
+#
+# Create a new version of the file syscall_names.c.inc, which maps the
+# names of the system calls defined in <sys/syscall.h> (for the native
+# architecture) to their numbers
+#
+echo '#include <sys/syscall.h>' | cpp -dM |
+sed -n -e 's/^#define  *__NR_\([a-z0-9_]*\)  *\([0-9][0-9]*\)$/\1 \2/p' |
+sort -k2n |
+awk '
+BEGIN {
+        print "static const struct { const char *name; int nr; } " \
+              "syscallNames[] = {";
+}
+
+{
+        printf "    { \"%s\", %s },\n", $1, $2;
+}
+
+END {
+        print "};";
+}'
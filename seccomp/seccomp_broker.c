@@ -0,0 +1,482 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* seccomp_broker.c
+
+   A seccomp user-notification supervisor that serves many target
+   processes from a pool of threads, in the manner of a system call
+   broker for a sandbox. Compare seccomp_user_notification.c, which
+   handles the notifications of a single target, one at a time.
+
+   Usage: seccomp_broker [-n ntargets] [-t nthreads] [-d secs]
+                         [-w continue|open|mixed] [-p prefix] [path]
+
+        -n ntargets  Number of target processes (default: 4)
+        -t nthreads  Number of supervisor threads (default: 2)
+        -d secs      Duration of the run (default: 5)
+        -w workload  What the targets do in a loop (default: mixed):
+                     "continue" calls getppid(), "open" opens (and
+                     closes) 'path' (default: /etc/passwd), and "mixed"
+                     does both
+        -p prefix    Paths that begin with 'prefix' (default: "/etc/")
+                     may be opened (read-only); others fail with EACCES
+
+   Each target installs a filter that returns SECCOMP_RET_USER_NOTIF for
+   getppid() and openat(), and passes the resulting notification file
+   descriptor to the supervisor over a UNIX domain socket. The supervisor
+   adds all of the notification file descriptors to a single epoll
+   instance (with EPOLLONESHOT, so that only one thread at a time
+   receives from each descriptor), and its threads wait in epoll_wait().
+
+   A getppid() notification takes the fast path: the supervisor simply
+   responds with SECCOMP_USER_NOTIF_FLAG_CONTINUE, so that the kernel
+   executes the system call normally. For openat(), the supervisor
+   fetches the pathname from the target with process_vm_readv() (rather
+   than by reading /proc/PID/mem), checks that the notification is still
+   valid (so that the pathname can't have been read from a process that
+   has since terminated and been replaced by another with the same PID),
+   applies its policy, and then opens the file itself and installs the
+   file descriptor in the target with SECCOMP_IOCTL_NOTIF_ADDFD, using
+   SECCOMP_ADDFD_FLAG_SEND so that the installation and the response to
+   the notification happen atomically (Linux 5.14 and later).
+
+   Once per second, and at the end of the run, the program displays the
+   number of notifications handled per second.
+
+   This program is Linux-specific, and supports only x86-64.
+*/
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include "scm_functions.h"
+#include "tlpi_hdr.h"
+
+#define MAX_THREADS 64
+
+struct target {
+    pid_t pid;
+    int notifyFd;
+};
+
+struct threadStats {            /* Padded to avoid false sharing */
+    unsigned long continued;    /* getppid() fast path */
+    unsigned long opened;       /* openat() brokered with ADDFD */
+    unsigned long denied;       /* openat() refused by policy */
+    unsigned long gone;         /* Target terminated before response */
+    char pad[64 - 4 * sizeof(unsigned long)];
+};
+
+static int epfd;
+static struct seccomp_notif_sizes sizes;
+static const char *prefix = "/etc/";
+static struct threadStats stats[MAX_THREADS];
+static int liveTargets;
+
+static int
+seccomp(unsigned int operation, unsigned int flags, void *args)
+{
+    return syscall(__NR_seccomp, operation, flags, args);
+}
+
+/* Target side */
+
+static void
+installFilter(int sockFd)
+{
+    struct sock_filter filter[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                 offsetof(struct seccomp_data, arch)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_KILL_PROCESS),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                 offsetof(struct seccomp_data, nr)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_getppid, 1, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_openat, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+    };
+    struct sock_fprog prog = {
+        .len = sizeof(filter) / sizeof(filter[0]),
+        .filter = filter,
+    };
+    int notifyFd;
+
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1)
+        errExit("prctl");
+
+    notifyFd = seccomp(SECCOMP_SET_MODE_FILTER,
+                       SECCOMP_FILTER_FLAG_NEW_LISTENER, &prog);
+    if (notifyFd == -1)
+        errExit("seccomp-SECCOMP_FILTER_FLAG_NEW_LISTENER");
+
+    if (sendfd(sockFd, notifyFd) == -1)
+        errExit("sendfd");
+    close(notifyFd);
+}
+
+static void
+targetLoop(const char *workload, const char *path)
+{
+    Boolean doCont, doOpen, reported;
+    int fd;
+
+    doCont = strcmp(workload, "open") != 0;
+    doOpen = strcmp(workload, "continue") != 0;
+    reported = FALSE;
+
+    for (;;) {
+        if (doCont)
+            getppid();
+        if (doOpen) {
+            fd = openat(AT_FDCWD, path, O_RDONLY | O_CLOEXEC);
+            if (fd >= 0)
+                close(fd);
+            else if (!reported) {
+                fprintf(stderr, "Target %ld: openat(\"%s\"): %s\n",
+                        (long) getpid(), path, strerror(errno));
+                reported = TRUE;
+            }
+        }
+    }
+}
+
+/* Supervisor side */
+
+/* Read a NUL-terminated string of at most 'size' bytes (including the
+   terminator) at 'addr' in process 'pid'. Since process_vm_readv()
+   stops at the first inaccessible page, read a page at a time, so that
+   a string that ends just before an unmapped page can be read. Returns
+   0 on success, or -1 on error. */
+
+static int
+readTargetString(pid_t pid, unsigned long addr, char *buf, size_t size)
+{
+    struct iovec local, remote;
+    size_t done, chunk;
+    ssize_t n;
+    long pageSize = sysconf(_SC_PAGESIZE);
+
+    for (done = 0; done < size; done += n) {
+        chunk = pageSize - ((addr + done) % pageSize);
+        if (chunk > size - done)
+            chunk = size - done;
+
+        local.iov_base = buf + done;
+        local.iov_len = chunk;
+        remote.iov_base = (void *) (addr + done);
+        remote.iov_len = chunk;
+        n = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+        if (n <= 0)
+            return -1;
+        if (memchr(buf + done, '\0', n) != NULL)
+            return 0;
+    }
+
+    errno = ENAMETOOLONG;
+    return -1;
+}
+
+/* Handle an openat() notification; returns 0 if the response was sent,
+   or -1 if the target has gone */
+
+static int
+brokerOpen(int notifyFd, struct seccomp_notif *req,
+           struct seccomp_notif_resp *resp, struct threadStats *st)
+{
+    struct seccomp_notif_addfd addfd;
+    char path[PATH_MAX];
+    int flags, fd, err;
+
+    flags = req->data.args[2];
+    err = 0;
+    fd = -1;
+
+    if (readTargetString(req->pid, req->data.args[1], path,
+                         sizeof(path)) == -1) {
+        err = (errno == ENAMETOOLONG) ? ENAMETOOLONG : EFAULT;
+
+    /* Having read the target's memory, check that the notification is
+       still valid: if it isn't, the PID may have been reused */
+
+    } else if (ioctl(notifyFd, SECCOMP_IOCTL_NOTIF_ID_VALID,
+                     &req->id) == -1) {
+        return -1;
+
+    } else if ((int) req->data.args[0] != AT_FDCWD || path[0] != '/' ||
+               strncmp(path, prefix, strlen(prefix)) != 0 ||
+               strstr(path, "/../") != NULL ||
+               (flags & (O_ACCMODE | O_CREAT | O_TRUNC)) != O_RDONLY) {
+        err = EACCES;
+
+    } else {
+        fd = open(path, (flags & ~O_CLOEXEC) | O_CLOEXEC);
+        if (fd == -1)
+            err = errno;
+    }
+
+    if (fd >= 0) {
+        memset(&addfd, 0, sizeof(addfd));
+        addfd.id = req->id;
+        addfd.flags = SECCOMP_ADDFD_FLAG_SEND;
+        addfd.srcfd = fd;
+        addfd.newfd_flags = flags & O_CLOEXEC;
+        if (ioctl(notifyFd, SECCOMP_IOCTL_NOTIF_ADDFD, &addfd) == -1) {
+            close(fd);
+            if (errno == ENOENT)
+                return -1;
+            errExit("ioctl-SECCOMP_IOCTL_NOTIF_ADDFD");
+        }
+        close(fd);
+        st->opened++;
+        return 0;
+    }
+
+    memset(resp, 0, sizes.seccomp_notif_resp);
+    resp->id = req->id;
+    resp->error = -err;
+    if (ioctl(notifyFd, SECCOMP_IOCTL_NOTIF_SEND, resp) == -1) {
+        if (errno == ENOENT)
+            return -1;
+        errExit("ioctl-SECCOMP_IOCTL_NOTIF_SEND");
+    }
+    st->denied++;
+    return 0;
+}
+
+static void *
+supervisorThread(void *arg)
+{
+    struct threadStats *st = arg;
+    struct seccomp_notif *req;
+    struct seccomp_notif_resp *resp;
+    struct epoll_event ev;
+    struct target *t;
+    int n;
+
+    req = malloc(sizes.seccomp_notif);
+    resp = malloc(sizes.seccomp_notif_resp);
+    if (req == NULL || resp == NULL)
+        errExit("malloc");
+
+    for (;;) {
+        n = epoll_wait(epfd, &ev, 1, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("epoll_wait");
+        }
+        t = ev.data.ptr;
+
+        if (!(ev.events & EPOLLIN)) {   /* EPOLLHUP: target has gone */
+            epoll_ctl(epfd, EPOLL_CTL_DEL, t->notifyFd, NULL);
+            __atomic_fetch_sub(&liveTargets, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        memset(req, 0, sizes.seccomp_notif);
+        if (ioctl(t->notifyFd, SECCOMP_IOCTL_NOTIF_RECV, req) == -1) {
+            if (errno != ENOENT && errno != EINTR)
+                errExit("ioctl-SECCOMP_IOCTL_NOTIF_RECV");
+            req->data.nr = -1;          /* Target went away */
+        }
+
+        /* Rearm the descriptor before handling the notification, so
+           that another thread can receive the next notification from
+           this descriptor (e.g., from another thread in the target) */
+
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, t->notifyFd, &ev) == -1)
+            errExit("epoll_ctl-EPOLL_CTL_MOD");
+
+        if (req->data.nr == __NR_getppid) {
+            memset(resp, 0, sizes.seccomp_notif_resp);
+            resp->id = req->id;
+            resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+            if (ioctl(t->notifyFd, SECCOMP_IOCTL_NOTIF_SEND, resp) == 0)
+                st->continued++;
+            else if (errno == ENOENT)
+                st->gone++;
+            else
+                errExit("ioctl-SECCOMP_IOCTL_NOTIF_SEND");
+        } else if (req->data.nr == __NR_openat) {
+            if (brokerOpen(t->notifyFd, req, resp, st) == -1)
+                st->gone++;
+        } else if (req->data.nr != -1) {
+            fatal("Unexpected notification for system call %d",
+                  req->data.nr);
+        }
+    }
+
+    return NULL;
+}
+
+static void
+sumStats(int nthreads, struct threadStats *sum)
+{
+    int j;
+
+    memset(sum, 0, sizeof(*sum));
+    for (j = 0; j < nthreads; j++) {
+        sum->continued += __atomic_load_n(&stats[j].continued,
+                                          __ATOMIC_RELAXED);
+        sum->opened += __atomic_load_n(&stats[j].opened, __ATOMIC_RELAXED);
+        sum->denied += __atomic_load_n(&stats[j].denied, __ATOMIC_RELAXED);
+        sum->gone += __atomic_load_n(&stats[j].gone, __ATOMIC_RELAXED);
+    }
+}
+
+static unsigned long
+total(const struct threadStats *s)
+{
+    return s->continued + s->opened + s->denied + s->gone;
+}
+
+static void
+usageError(const char *pname)
+{
+    fprintf(stderr, "Usage: %s [-n ntargets] [-t nthreads] [-d secs]\n"
+            "\t\t[-w continue|open|mixed] [-p prefix] [path]\n", pname);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int ntargets, nthreads, secs, opt, sv[2], s, j;
+    const char *workload, *path;
+    struct target *targets;
+    struct epoll_event ev;
+    struct threadStats prev, now;
+    struct timespec start, ts;
+    pthread_t tid;
+    double elapsed;
+
+    ntargets = 4;
+    nthreads = 2;
+    secs = 5;
+    workload = "mixed";
+    while ((opt = getopt(argc, argv, "n:t:d:w:p:")) != -1) {
+        switch (opt) {
+        case 'n': ntargets = getInt(optarg, GN_GT_0, "-n");     break;
+        case 't': nthreads = getInt(optarg, GN_GT_0, "-t");     break;
+        case 'd': secs = getInt(optarg, GN_GT_0, "-d");         break;
+        case 'w': workload = optarg;                            break;
+        case 'p': prefix = optarg;                              break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (nthreads > MAX_THREADS)
+        cmdLineErr("At most %d threads\n", MAX_THREADS);
+    if (strcmp(workload, "continue") != 0 && strcmp(workload, "open") != 0 &&
+            strcmp(workload, "mixed") != 0)
+        usageError(argv[0]);
+    path = (optind < argc) ? argv[optind] : "/etc/passwd";
+
+    if (seccomp(SECCOMP_GET_NOTIF_SIZES, 0, &sizes) == -1)
+        errExit("seccomp-SECCOMP_GET_NOTIF_SIZES");
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+        errExit("epoll_create1");
+
+    targets = calloc(ntargets, sizeof(struct target));
+    if (targets == NULL)
+        errExit("calloc");
+
+    /* Create the targets (before creating any threads), and collect
+       their notification file descriptors */
+
+    for (j = 0; j < ntargets; j++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+            errExit("socketpair");
+
+        targets[j].pid = fork();
+        if (targets[j].pid == -1)
+            errExit("fork");
+
+        if (targets[j].pid == 0) {
+            close(sv[0]);
+            close(epfd);
+            installFilter(sv[1]);
+            close(sv[1]);
+            targetLoop(workload, path);
+        }
+
+        close(sv[1]);
+        targets[j].notifyFd = recvfd(sv[0]);
+        if (targets[j].notifyFd == -1)
+            errExit("recvfd");
+        close(sv[0]);
+
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = &targets[j];
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, targets[j].notifyFd, &ev) == -1)
+            errExit("epoll_ctl-EPOLL_CTL_ADD");
+    }
+    liveTargets = ntargets;
+
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_create(&tid, NULL, supervisorThread, &stats[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    printf("%d targets, %d supervisor threads, workload \"%s\"\n",
+           ntargets, nthreads, workload);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(&prev, 0, sizeof(prev));
+    for (j = 1; j <= secs; j++) {
+        sleep(1);
+        sumStats(nthreads, &now);
+        printf("%3d: %9lu notifications/sec (continue %lu, open %lu, "
+               "denied %lu)\n", j, total(&now) - total(&prev),
+               now.continued - prev.continued, now.opened - prev.opened,
+               now.denied - prev.denied);
+        prev = now;
+        if (__atomic_load_n(&liveTargets, __ATOMIC_RELAXED) == 0)
+            break;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    elapsed = ts.tv_sec - start.tv_sec + (ts.tv_nsec - start.tv_nsec) / 1e9;
+    sumStats(nthreads, &now);
+
+    for (j = 0; j < ntargets; j++) {
+        kill(targets[j].pid, SIGKILL);
+        if (waitpid(targets[j].pid, NULL, 0) == -1)
+            errExit("waitpid");
+    }
+
+    printf("Total: %lu notifications in %.2f secs: %.0f/sec\n",
+           total(&now), elapsed, total(&now) / elapsed);
+    printf("Per thread:");
+    for (j = 0; j < nthreads; j++)
+        printf(" %lu", total(&stats[j]));
+    printf("\n");
+
+    exit(EXIT_SUCCESS);
+}
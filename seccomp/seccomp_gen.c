@@ -0,0 +1,540 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* seccomp_gen.c
+
+   Generate a seccomp BPF filter from a system call allowlist, laid out so
+   that the most frequently made system calls are matched with the fewest
+   BPF instructions.
+
+   Usage: seccomp_gen [-p profile] [-l layout] [-H nhot] [-a action]
+                      [-o blob-file] [-C] allowlist-file
+
+   The allowlist file contains system call names (or numbers), separated
+   by white space; text from '#' to the end of a line is ignored. The
+   optional profile gives the number of times that each system call is
+   made, in the format produced by "uniq -c"; that is, each line contains
+   a count followed by a system call name (or number). For example, a
+   profile can be built from the audit records produced by a filter that
+   returns SECCOMP_RET_LOG (see seccomp_logging.c):
+
+        # ausearch -m SECCOMP -c myprog --raw | grep -o 'syscall=[0-9]*' |
+                sed 's/syscall=//' | sort | uniq -c > myprog.profile
+
+   The layouts ('-l') are:
+
+        linear  A JEQ for each allowed system call, in order of
+                decreasing frequency, so that the cost of matching a
+                system call is proportional to its position in the list
+        tree    A binary search over the (ranges of consecutive) allowed
+                system call numbers, so that the cost of every system
+                call is logarithmic in the size of the allowlist
+        hybrid  (default) JEQs for the 'nhot' most frequent system calls,
+                followed by a binary search for all of the others. By
+                default, 'nhot' is the smallest number of system calls
+                that account for 90% of the calls in the profile (but
+                at most 16), or 0 if there is no profile.
+
+   System calls that are not allowed cause the action specified by '-a':
+   "errno" (fail with EPERM; the default), "kill" (kill the process),
+   "trap" (deliver SIGSYS), or "log" (allow, but log the call). System
+   calls made with the wrong architecture or using the x32 ABI kill the
+   process.
+
+   Before writing the filter, the program verifies it by running it, in a
+   small BPF interpreter, against every system call number up to beyond
+   the largest allowed number (and against some other special cases),
+   comparing the result with that implied by the allowlist. It then
+   reports, for each layout, the number of BPF instructions, and the
+   average number executed per system call, weighted by the profile (or,
+   if there is no profile, unweighted over the allowlist).
+
+   The filter is written to 'blob-file' in the format loaded by
+   "seccomp_launch -f", and/or, with '-C', to standard output as a C
+   array initializer.
+
+   This program is Linux-specific, and generates filters only for x86-64.
+*/
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include "tlpi_hdr.h"
+
+#include "syscall_names.c.inc"  /* Built by Build_syscall_names.sh */
+
+#define X32_SYSCALL_BIT         0x40000000
+
+#ifndef SECCOMP_RET_KILL_PROCESS
+#define SECCOMP_RET_KILL_PROCESS SECCOMP_RET_KILL
+#endif
+#ifndef SECCOMP_RET_LOG
+#define SECCOMP_RET_LOG         0x7ffc0000U
+#endif
+
+#define MAX_NR 4096             /* System call numbers must be less */
+
+enum layout { L_LINEAR, L_TREE, L_HYBRID, L_NUM };
+static const char *layoutName[] = { "linear", "tree", "hybrid" };
+
+static Boolean allowed[MAX_NR];
+static unsigned long freq[MAX_NR];      /* From the profile */
+static int allowList[MAX_NR];           /* Allowed numbers, by frequency */
+static int nAllowed;
+static uint32_t denyAction;
+
+struct prog {                           /* A generated filter */
+    struct sock_filter insn[BPF_MAXINSNS];
+    int len;
+};
+
+/* Convert a system call name or number to a number, or -1 if invalid */
+
+static int
+syscallNumber(const char *str)
+{
+    char *end;
+    long nr;
+    int j;
+
+    if (isdigit((unsigned char) str[0])) {
+        nr = strtol(str, &end, 10);
+        return (*end == '\0' && nr < MAX_NR) ? nr : -1;
+    }
+    for (j = 0; j < sizeof(syscallNames) / sizeof(syscallNames[0]); j++)
+        if (strcmp(str, syscallNames[j].name) == 0)
+            return (syscallNames[j].nr < MAX_NR) ? syscallNames[j].nr : -1;
+    return -1;
+}
+
+static const char *
+syscallName(int nr)
+{
+    static char buf[16];
+    int j;
+
+    for (j = 0; j < sizeof(syscallNames) / sizeof(syscallNames[0]); j++)
+        if (syscallNames[j].nr == nr)
+            return syscallNames[j].name;
+    snprintf(buf, sizeof(buf), "%d", nr);
+    return buf;
+}
+
+static void
+readAllowlist(const char *path)
+{
+    char line[4096], *tok, *p;
+    FILE *fp;
+    int nr;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        errExit("fopen: %s", path);
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        p = strchr(line, '#');
+        if (p != NULL)
+            *p = '\0';
+        for (tok = strtok(line, " \t\n,"); tok != NULL;
+                tok = strtok(NULL, " \t\n,")) {
+            nr = syscallNumber(tok);
+            if (nr == -1)
+                fatal("%s: unknown system call: %s", path, tok);
+            if (!allowed[nr]) {
+                allowed[nr] = TRUE;
+                allowList[nAllowed++] = nr;
+            }
+        }
+    }
+    fclose(fp);
+
+    if (nAllowed == 0)
+        fatal("%s: empty allowlist", path);
+}
+
+/* Read a profile; returns the total count for allowed system calls */
+
+static unsigned long
+readProfile(const char *path)
+{
+    char line[1024], name[256];
+    unsigned long count, total;
+    FILE *fp;
+    int nr;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        errExit("fopen: %s", path);
+
+    total = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%lu %255s", &count, name) != 2)
+            continue;
+        nr = syscallNumber(name);
+        if (nr == -1) {
+            fprintf(stderr, "%s: ignoring unknown system call: %s\n",
+                    path, name);
+            continue;
+        }
+        freq[nr] += count;
+        if (allowed[nr])
+            total += count;
+    }
+    fclose(fp);
+    return total;
+}
+
+static int
+cmpFreq(const void *a, const void *b)
+{
+    int x = *(const int *) a, y = *(const int *) b;
+
+    if (freq[x] != freq[y])
+        return (freq[x] < freq[y]) ? 1 : -1;
+    return x - y;
+}
+
+/* Filter generation */
+
+static void
+emit(struct prog *p, uint16_t code, uint8_t jt, uint8_t jf, uint32_t k)
+{
+    if (p->len >= BPF_MAXINSNS)
+        fatal("Filter exceeds %d instructions", BPF_MAXINSNS);
+    p->insn[p->len].code = code;
+    p->insn[p->len].jt = jt;
+    p->insn[p->len].jf = jf;
+    p->insn[p->len].k = k;
+    p->len++;
+}
+
+/* Binary search over the ranges of consecutive allowed system call
+   numbers in 'rlo[lo..hi]'..'rhi[lo..hi]'. Each interior node tests
+   "nr >= pivot", reaching the right subtree via a JA, since the left
+   subtree may be more than 255 instructions long (the limit for the
+   8-bit offsets in conditional jumps). */
+
+static void
+genTree(struct prog *p, const int *rlo, const int *rhi, int lo, int hi)
+{
+    int mid, ja;
+
+    if (lo == hi) {
+        if (rlo[lo] == rhi[lo]) {
+            emit(p, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, rlo[lo]);
+        } else {
+            emit(p, BPF_JMP | BPF_JGE | BPF_K, 0, 2, rlo[lo]);
+            emit(p, BPF_JMP | BPF_JGT | BPF_K, 1, 0, rhi[lo]);
+        }
+        emit(p, BPF_RET | BPF_K, 0, 0, SECCOMP_RET_ALLOW);
+        emit(p, BPF_RET | BPF_K, 0, 0, denyAction);
+        return;
+    }
+
+    mid = (lo + hi + 1) / 2;
+    emit(p, BPF_JMP | BPF_JGE | BPF_K, 0, 1, rlo[mid]);
+    ja = p->len;
+    emit(p, BPF_JMP | BPF_JA, 0, 0, 0);
+    genTree(p, rlo, rhi, lo, mid - 1);
+    p->insn[ja].k = p->len - (ja + 1);
+    genTree(p, rlo, rhi, mid, hi);
+}
+
+static void
+genFilter(struct prog *p, enum layout layout, int nhot)
+{
+    static int rlo[MAX_NR], rhi[MAX_NR];
+    int nranges, nr, j;
+
+    p->len = 0;
+
+    emit(p, BPF_LD | BPF_W | BPF_ABS, 0, 0,
+         offsetof(struct seccomp_data, arch));
+    emit(p, BPF_JMP | BPF_JEQ | BPF_K, 1, 0, AUDIT_ARCH_X86_64);
+    emit(p, BPF_RET | BPF_K, 0, 0, SECCOMP_RET_KILL_PROCESS);
+    emit(p, BPF_LD | BPF_W | BPF_ABS, 0, 0,
+         offsetof(struct seccomp_data, nr));
+    emit(p, BPF_JMP | BPF_JGE | BPF_K, 0, 1, X32_SYSCALL_BIT);
+    emit(p, BPF_RET | BPF_K, 0, 0, SECCOMP_RET_KILL_PROCESS);
+
+    if (layout == L_LINEAR)
+        nhot = nAllowed;
+    else if (layout == L_TREE)
+        nhot = 0;
+
+    for (j = 0; j < nhot; j++) {
+        emit(p, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, allowList[j]);
+        emit(p, BPF_RET | BPF_K, 0, 0, SECCOMP_RET_ALLOW);
+    }
+
+    if (layout == L_LINEAR) {
+        emit(p, BPF_RET | BPF_K, 0, 0, denyAction);
+        return;
+    }
+
+    /* The tree covers all allowed system calls (including the hot ones,
+       which allows longer ranges of consecutive numbers) */
+
+    nranges = 0;
+    for (nr = 0; nr < MAX_NR; nr++) {
+        if (!allowed[nr])
+            continue;
+        if (nranges > 0 && rhi[nranges - 1] == nr - 1) {
+            rhi[nranges - 1] = nr;
+        } else {
+            rlo[nranges] = rhi[nranges] = nr;
+            nranges++;
+        }
+    }
+    genTree(p, rlo, rhi, 0, nranges - 1);
+}
+
+/* A BPF interpreter for the subset of instructions that we generate.
+   Returns the filter's return value, and places the number of
+   instructions executed in '*executed'. */
+
+static uint32_t
+runFilter(const struct prog *p, const struct seccomp_data *sd, int *executed)
+{
+    const struct sock_filter *f;
+    uint32_t a;
+    int pc;
+
+    a = 0;
+    *executed = 0;
+    for (pc = 0; pc < p->len; pc++) {
+        f = &p->insn[pc];
+        (*executed)++;
+        switch (f->code) {
+        case BPF_LD | BPF_W | BPF_ABS:
+            if (f->k + 4 > sizeof(*sd))
+                fatal("Verification: load out of range at %d", pc);
+            memcpy(&a, (const char *) sd + f->k, 4);
+            break;
+        case BPF_JMP | BPF_JA:
+            pc += f->k;
+            break;
+        case BPF_JMP | BPF_JEQ | BPF_K:
+            pc += (a == f->k) ? f->jt : f->jf;
+            break;
+        case BPF_JMP | BPF_JGE | BPF_K:
+            pc += (a >= f->k) ? f->jt : f->jf;
+            break;
+        case BPF_JMP | BPF_JGT | BPF_K:
+            pc += (a > f->k) ? f->jt : f->jf;
+            break;
+        case BPF_RET | BPF_K:
+            return f->k;
+        default:
+            fatal("Verification: unexpected opcode %#x at %d", f->code, pc);
+        }
+    }
+    fatal("Verification: fell off the end of the filter");
+}
+
+/* Check the filter against the allowlist for every system call number
+   up to somewhat beyond the largest allowed number, and some special
+   cases. Returns the number of cases checked. */
+
+static int
+verifyFilter(const struct prog *p)
+{
+    static const uint32_t special[] = {
+        MAX_NR, MAX_NR * 16, X32_SYSCALL_BIT - 1, X32_SYSCALL_BIT,
+        X32_SYSCALL_BIT | 1, 0x7fffffff, 0xffffffff
+    };
+    struct seccomp_data sd;
+    uint32_t nr, maxNr, expected, got;
+    int ncases, executed, j;
+
+    memset(&sd, 0, sizeof(sd));
+    ncases = 0;
+
+    /* A foreign architecture is always killed */
+
+    sd.arch = AUDIT_ARCH_I386;
+    sd.nr = allowList[0];
+    if (runFilter(p, &sd, &executed) != SECCOMP_RET_KILL_PROCESS)
+        fatal("Verification failed for a foreign architecture");
+    ncases++;
+
+    sd.arch = AUDIT_ARCH_X86_64;
+    for (maxNr = 0, j = 0; j < nAllowed; j++)
+        if (allowList[j] > maxNr)
+            maxNr = allowList[j];
+
+    for (nr = 0; nr < maxNr + 256 + sizeof(special) / sizeof(special[0]);
+            nr++) {
+        sd.nr = (nr < maxNr + 256) ? nr : special[nr - maxNr - 256];
+        if ((uint32_t) sd.nr >= X32_SYSCALL_BIT)
+            expected = SECCOMP_RET_KILL_PROCESS;
+        else if ((uint32_t) sd.nr < MAX_NR && allowed[sd.nr])
+            expected = SECCOMP_RET_ALLOW;
+        else
+            expected = denyAction;
+        got = runFilter(p, &sd, &executed);
+        if (got != expected)
+            fatal("Verification failed for system call %u: "
+                  "got %#x, expected %#x", sd.nr, got, expected);
+        ncases++;
+    }
+    return ncases;
+}
+
+/* Return the average number of instructions executed per (allowed)
+   system call, weighted by the profile if there is one */
+
+static double
+avgExecuted(const struct prog *p, Boolean weighted)
+{
+    struct seccomp_data sd;
+    double sum, weight;
+    int executed, j;
+
+    memset(&sd, 0, sizeof(sd));
+    sd.arch = AUDIT_ARCH_X86_64;
+    sum = weight = 0;
+    for (j = 0; j < nAllowed; j++) {
+        sd.nr = allowList[j];
+        runFilter(p, &sd, &executed);
+        sum += executed * (weighted ? freq[sd.nr] : 1);
+        weight += weighted ? freq[sd.nr] : 1;
+    }
+    return (weight > 0) ? sum / weight : 0;
+}
+
+static void
+usageError(const char *pname)
+{
+    fprintf(stderr, "Usage: %s [-p profile] [-l linear|tree|hybrid] "
+            "[-H nhot]\n\t\t[-a errno|kill|trap|log] [-o blob-file] [-C] "
+            "allowlist-file\n", pname);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static struct prog progs[L_NUM];
+    const char *profile, *blobFile, *action;
+    enum layout layout, l;
+    unsigned long total, cum;
+    Boolean cOutput;
+    int opt, nhot, ncases, fd, j;
+    struct prog *p;
+
+    profile = NULL;
+    blobFile = NULL;
+    action = "errno";
+    layout = L_HYBRID;
+    nhot = -1;
+    cOutput = FALSE;
+    while ((opt = getopt(argc, argv, "p:l:H:a:o:C")) != -1) {
+        switch (opt) {
+        case 'p': profile = optarg;                             break;
+        case 'H': nhot = getInt(optarg, 0, "-H");               break;
+        case 'a': action = optarg;                              break;
+        case 'o': blobFile = optarg;                            break;
+        case 'C': cOutput = TRUE;                               break;
+        case 'l':
+            for (l = 0; l < L_NUM; l++)
+                if (strcmp(optarg, layoutName[l]) == 0)
+                    break;
+            if (l == L_NUM)
+                usageError(argv[0]);
+            layout = l;
+            break;
+        default:
+            usageError(argv[0]);
+        }
+    }
+    if (optind + 1 != argc)
+        usageError(argv[0]);
+
+    if (strcmp(action, "errno") == 0)
+        denyAction = SECCOMP_RET_ERRNO | EPERM;
+    else if (strcmp(action, "kill") == 0)
+        denyAction = SECCOMP_RET_KILL_PROCESS;
+    else if (strcmp(action, "trap") == 0)
+        denyAction = SECCOMP_RET_TRAP;
+    else if (strcmp(action, "log") == 0)
+        denyAction = SECCOMP_RET_LOG;
+    else
+        usageError(argv[0]);
+
+    readAllowlist(argv[optind]);
+    total = (profile != NULL) ? readProfile(profile) : 0;
+
+    /* Order the allowlist by decreasing frequency (then by number), and
+       choose the number of hot system calls for the hybrid layout */
+
+    qsort(allowList, nAllowed, sizeof(int), cmpFreq);
+
+    if (nhot == -1) {
+        nhot = 0;
+        for (cum = 0; total > 0 && cum < total * 0.9 && nhot < 16; nhot++)
+            cum += freq[allowList[nhot]];
+    }
+    if (nhot > nAllowed)
+        nhot = nAllowed;
+
+    /* Generate and verify all layouts, so that they can be compared */
+
+    fprintf(stderr, "%d system calls allowed; %d hot; %s profile\n",
+            nAllowed, nhot, (total > 0) ? "weighted by" : "no");
+    fprintf(stderr, "  %-8s %8s %14s\n", "layout", "insns", "avg-executed");
+    for (l = 0; l < L_NUM; l++) {
+        genFilter(&progs[l], l, nhot);
+        ncases = verifyFilter(&progs[l]);
+        fprintf(stderr, "%c %-8s %8d %14.1f\n", (l == layout) ? '*' : ' ',
+                layoutName[l], progs[l].len,
+                avgExecuted(&progs[l], total > 0));
+    }
+    fprintf(stderr, "All layouts verified against %d cases\n", ncases);
+
+    if (total > 0) {
+        fprintf(stderr, "Hot system calls:");
+        for (j = 0; j < nhot; j++)
+            fprintf(stderr, " %s (%.1f%%)", syscallName(allowList[j]),
+                    100.0 * freq[allowList[j]] / total);
+        fprintf(stderr, "\n");
+    }
+
+    p = &progs[layout];
+
+    if (blobFile != NULL) {
+        fd = open(blobFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1)
+            errExit("open: %s", blobFile);
+        if (write(fd, p->insn, p->len * sizeof(struct sock_filter)) !=
+                p->len * sizeof(struct sock_filter))
+            errExit("write");
+        if (close(fd) == -1)
+            errExit("close");
+    }
+
+    if (cOutput) {
+        printf("/* %s layout: %d instructions */\n", layoutName[layout],
+               p->len);
+        printf("struct sock_filter filter[] = {\n");
+        for (j = 0; j < p->len; j++)
+            printf("    { 0x%02x, %3d, %3d, 0x%08x },\n", p->insn[j].code,
+                   p->insn[j].jt, p->insn[j].jf, p->insn[j].k);
+        printf("};\n");
+    }
+
+    exit(EXIT_SUCCESS);
+}
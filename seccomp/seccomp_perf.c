@@ -18,6 +18,48 @@
    To test with the in-kernel JIT compiler enabled:
 
         $ sudo sh -c "echo 1 > /proc/sys/net/core/bpf_jit_enable"
+
+   Supplementary feature: "seccomp_perf -B [num-loops]" measures the cost
+   of getppid() both without and with the filter, using the bench.c
+   harness (so that time(1) is not needed). This is the form used by
+   "make bench".
+
+   Supplementary feature: "seccomp_perf -S [options] [num-loops]"
+   measures how the cost of getppid() scales with the size and number of
+   the installed filters, by generating filters that deny a list of
+   'nrules' (nonexistent) system call numbers, each of which is compared
+   in turn with the number of the system call being made. For each
+   combination of the following options, a child process installs
+   'depth' copies of the generated filter and measures getppid() (which
+   is allowed by the filter, so that it must pass every rule) using the
+   bench.c harness:
+
+        -n list    Comma-separated rule counts (default: 1,16,128,512);
+                   since a filter is limited to BPF_MAXINSNS (4096)
+                   instructions, the maximum is about 2000 for the
+                   linear layout, and about 800 for the tree layout
+        -d list    Comma-separated stacking depths (default: 1,4)
+        -l layout  "linear" (a JEQ per rule, so that the cost grows with
+                   the number of rules), "tree" (a balanced binary search
+                   using JGE, so that the cost grows logarithmically),
+                   or "both" (default)
+        -s spec    "off", "on" (install the filters with
+                   SECCOMP_FILTER_FLAG_SPEC_ALLOW, which disables the
+                   speculative store bypass mitigation that seccomp
+                   otherwise enables), or "both" (default)
+        -c         Generate filters that the kernel can cache
+
+   Since Linux 5.11, the kernel caches the result of filters that (as
+   here) depend only on the architecture and system call number, and
+   for such system calls does not run the filters at all. So that the
+   cost of actually executing the filters is measured, the generated
+   filters by default also load the first system call argument, which
+   defeats that cache (as would a real profile that checks arguments);
+   '-c' omits that load, showing the effect of the cache.
+
+   After the per-configuration results, a summary shows the overhead of
+   each configuration relative to getppid() with no filter, and that
+   overhead divided by the number of filters.
 */
 #define _GNU_SOURCE
 #include <stddef.h>
@@ -28,12 +70,9 @@
 #include <linux/seccomp.h>
 #include <sys/prctl.h>
 #include <sys/types.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <unistd.h>
-
-#define errExit(msg)    do { perror(msg); exit(EXIT_FAILURE); \
-                        } while (0)
+#include <sys/wait.h>
+#include "bench.h"
+#include "tlpi_hdr.h"
 
 /* For the x32 ABI, all system call numbers have bit 30 set */
 
@@ -48,6 +87,10 @@
 #define SECCOMP_RET_KILL_PROCESS SECCOMP_RET_KILL
 #endif
 
+#ifndef SECCOMP_FILTER_FLAG_SPEC_ALLOW          /* Since Linux 4.17 */
+#define SECCOMP_FILTER_FLAG_SPEC_ALLOW (1UL << 2)
+#endif
+
 static int
 seccomp(unsigned int operation, unsigned int flags, void *arg)
 {
@@ -97,24 +140,309 @@ install_filter(void)
         errExit("seccomp");
 }
 
+static void
+benchGetppid(long ops, void *arg)
+{
+    for (long j = 0; j < ops; j++)
+        getppid();
+}
+
+static void
+applyFilter(void)
+{
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0))
+        errExit("prctl");
+
+    install_filter();
+}
+
+/* Filter generation for "-S". Each rule i denies system call number
+   DENY_BASE + i, which is greater than any real system call number. */
+
+#define DENY_BASE 1000
+
+static struct sock_filter genProg[BPF_MAXINSNS];
+static int genLen;
+
+static void
+emit(struct sock_filter insn)
+{
+    if (genLen >= BPF_MAXINSNS)
+        fatal("Generated filter exceeds %d instructions", BPF_MAXINSNS);
+    genProg[genLen++] = insn;
+}
+
+static void
+emitDenyRule(int rule)
+{
+    emit((struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                       DENY_BASE + rule, 0, 1));
+    emit((struct sock_filter) BPF_STMT(BPF_RET | BPF_K,
+                                       SECCOMP_RET_ERRNO | EPERM));
+}
+
+/* Generate a balanced binary search over rules 'lo'..'hi'. Each interior
+   node tests "nr >= pivot", and reaches the right subtree via a JA,
+   since the left subtree may be more than 255 instructions long (the
+   limit for the 8-bit offsets in conditional jumps). */
+
+static void
+genTree(int lo, int hi)
+{
+    int mid, ja;
+
+    if (lo == hi) {
+        emitDenyRule(lo);
+        emit((struct sock_filter) BPF_STMT(BPF_RET | BPF_K,
+                                           SECCOMP_RET_ALLOW));
+        return;
+    }
+
+    mid = (lo + hi + 1) / 2;
+    emit((struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K,
+                                       DENY_BASE + mid, 0, 1));
+    ja = genLen;
+    emit((struct sock_filter) BPF_STMT(BPF_JMP | BPF_JA, 0));
+    genTree(lo, mid - 1);
+    genProg[ja].k = genLen - (ja + 1);
+    genTree(mid, hi);
+}
+
+static void
+genFilter(Boolean tree, int nrules, Boolean cacheable)
+{
+    genLen = 0;
+
+    emit((struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                (offsetof(struct seccomp_data, arch))));
+    emit((struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                AUDIT_ARCH_X86_64, 1, 0));
+    emit((struct sock_filter) BPF_STMT(BPF_RET | BPF_K,
+                SECCOMP_RET_KILL_PROCESS));
+
+    if (!cacheable)             /* Defeat the kernel's action cache */
+        emit((struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                    (offsetof(struct seccomp_data, args[0]))));
+
+    emit((struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                (offsetof(struct seccomp_data, nr))));
+
+    if (tree) {
+        genTree(0, nrules - 1);
+    } else {
+        for (int j = 0; j < nrules; j++)
+            emitDenyRule(j);
+        emit((struct sock_filter) BPF_STMT(BPF_RET | BPF_K,
+                                           SECCOMP_RET_ALLOW));
+    }
+}
+
+struct scaleConfig {
+    Boolean tree;
+    int nrules;                 /* 0 means no filter */
+    int depth;
+    Boolean spec;
+    int insns;                  /* Instructions per filter */
+    struct benchResult res;
+};
+
+/* In a child process, install the filters described by 'cfg' and
+   measure getppid(); the results are returned in 'cfg' */
+
+static void
+runScaleConfig(struct scaleConfig *cfg, Boolean cacheable, long nloops)
+{
+    struct sock_fprog fprog;
+    char name[64];
+    int pfd[2], status;
+    ssize_t n;
+
+    if (cfg->nrules > 0)
+        genFilter(cfg->tree, cfg->nrules, cacheable);
+    cfg->insns = (cfg->nrules > 0) ? genLen : 0;
+
+    if (cfg->nrules == 0)
+        snprintf(name, sizeof(name), "seccomp_perf: no filter");
+    else
+        snprintf(name, sizeof(name), "seccomp_perf: %s n=%d d=%d%s",
+                 cfg->tree ? "tree" : "linear", cfg->nrules, cfg->depth,
+                 cfg->spec ? " spec" : "");
+
+    if (pipe(pfd) == -1)
+        errExit("pipe");
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0:
+        close(pfd[0]);
+        if (cfg->nrules > 0) {
+            if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0))
+                errExit("prctl");
+            fprog.len = genLen;
+            fprog.filter = genProg;
+            for (int j = 0; j < cfg->depth; j++)
+                if (seccomp(SECCOMP_SET_MODE_FILTER, cfg->spec ?
+                            SECCOMP_FILTER_FLAG_SPEC_ALLOW : 0, &fprog) == -1)
+                    errExit("seccomp");
+        }
+        if (benchRun(name, benchGetppid, NULL, nloops, NULL,
+                     &cfg->res) == -1)
+            errExit("benchRun");
+        if (write(pfd[1], &cfg->res, sizeof(cfg->res)) != sizeof(cfg->res))
+            errExit("write");
+        _exit(EXIT_SUCCESS);
+
+    default:
+        close(pfd[1]);
+        n = read(pfd[0], &cfg->res, sizeof(cfg->res));
+        close(pfd[0]);
+        if (wait(&status) == -1)
+            errExit("wait");
+        if (n != sizeof(cfg->res))
+            fatal("Child failed for \"%s\"", name);
+    }
+}
+
+#define MAX_LIST 16
+
+static void
+scaleUsageError(const char *pname)
+{
+    fprintf(stderr, "Usage: %s -S [-n rule-counts] [-d depths] "
+            "[-l linear|tree|both]\n\t\t[-s off|on|both] [-c] "
+            "[num-loops]\n", pname);
+    exit(EXIT_FAILURE);
+}
+
+static void
+scaleMain(int argc, char *argv[])
+{
+    static char defRules[] = "1,16,128,512", defDepths[] = "1,4";
+    int rules[MAX_LIST], depths[MAX_LIST], nRules, nDepths;
+    int opt, r, d, l, sp, ncfg, j;
+    const char *layout, *spec;
+    char *rulesStr, *depthsStr;
+    Boolean cacheable;
+    long nloops;
+    struct scaleConfig *cfg;
+    double baseNs, ovh;
+
+    rulesStr = defRules;
+    depthsStr = defDepths;
+    layout = "both";
+    spec = "both";
+    cacheable = FALSE;
+    optind = 2;                 /* Skip "-S" */
+    while ((opt = getopt(argc, argv, "n:d:l:s:c")) != -1) {
+        switch (opt) {
+        case 'n': rulesStr = optarg;            break;
+        case 'd': depthsStr = optarg;           break;
+        case 'l': layout = optarg;              break;
+        case 's': spec = optarg;                break;
+        case 'c': cacheable = TRUE;             break;
+        default:  scaleUsageError(argv[0]);
+        }
+    }
+    if ((strcmp(layout, "linear") != 0 && strcmp(layout, "tree") != 0 &&
+                strcmp(layout, "both") != 0) ||
+            (strcmp(spec, "off") != 0 && strcmp(spec, "on") != 0 &&
+                strcmp(spec, "both") != 0))
+        scaleUsageError(argv[0]);
+
+    nloops = (optind < argc) ? getLong(argv[optind], GN_GT_0, "num-loops") :
+                               100000;
+    nRules = benchParseList(rulesStr, rules, MAX_LIST, GN_GT_0, "-n");
+    nDepths = benchParseList(depthsStr, depths, MAX_LIST, GN_GT_0, "-d");
+
+    cfg = calloc(1 + nRules * nDepths * 4, sizeof(struct scaleConfig));
+    if (cfg == NULL)
+        errExit("calloc");
+
+    /* Configuration 0 is the baseline: no filter */
+
+    ncfg = 1;
+    for (l = 0; l < 2; l++) {
+        if (strcmp(layout, "both") != 0 &&
+                strcmp(layout, l ? "tree" : "linear") != 0)
+            continue;
+        for (sp = 0; sp < 2; sp++) {
+            if (strcmp(spec, "both") != 0 &&
+                    strcmp(spec, sp ? "on" : "off") != 0)
+                continue;
+            for (r = 0; r < nRules; r++)
+                for (d = 0; d < nDepths; d++) {
+                    cfg[ncfg].tree = l;
+                    cfg[ncfg].spec = sp;
+                    cfg[ncfg].nrules = rules[r];
+                    cfg[ncfg].depth = depths[d];
+                    ncfg++;
+                }
+        }
+    }
+
+    setbuf(stdout, NULL);
+    for (j = 0; j < ncfg; j++) {
+        runScaleConfig(&cfg[j], cacheable, nloops);
+        benchReport(&cfg[j].res);
+    }
+
+    baseNs = cfg[0].res.medianNs;
+    printf("\nOverhead relative to getppid() with no filter (%.1f ns)%s:\n",
+           baseNs, cacheable ? ", cacheable filters" : "");
+    printf("%-6s %6s %6s %5s %4s %10s %12s %12s\n", "layout", "rules",
+           "insns", "depth", "spec", "median-ns", "overhead-ns",
+           "per-filter");
+    for (j = 1; j < ncfg; j++) {
+        ovh = cfg[j].res.medianNs - baseNs;
+        printf("%-6s %6d %6d %5d %4s %10.1f %12.1f %12.1f\n",
+               cfg[j].tree ? "tree" : "linear", cfg[j].nrules, cfg[j].insns,
+               cfg[j].depth, cfg[j].spec ? "on" : "off",
+               cfg[j].res.medianNs, ovh, ovh / cfg[j].depth);
+    }
+
+    free(cfg);
+}
+
 int
 main(int argc, char *argv[])
 {
     int nloops;
+    struct benchResult res;
+
+    if (argc > 1 && strcmp(argv[1], "-S") == 0) {
+        scaleMain(argc, argv);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "-B") == 0) {
+        nloops = (argc > 2) ? getInt(argv[2], GN_GT_0, "num-loops") : 1000000;
+
+        if (benchRun("seccomp_perf: getppid() unfiltered", benchGetppid,
+                     NULL, nloops, NULL, &res) == -1)
+            errExit("benchRun");
+        benchReport(&res);
+
+        applyFilter();
+        if (benchRun("seccomp_perf: getppid() filtered", benchGetppid,
+                     NULL, nloops, NULL, &res) == -1)
+            errExit("benchRun");
+        benchReport(&res);
+        exit(EXIT_SUCCESS);
+    }
 
     if (argc < 2) {
         fprintf(stderr, "Usage: %s <num-loops> [x]\n", argv[0]);
         fprintf(stderr, "       (use 'x' to run with BPF filter applied)\n");
+        fprintf(stderr, "   or: %s -B [num-loops]\n", argv[0]);
+        fprintf(stderr, "   or: %s -S [options] [num-loops]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
     if (argc > 2) {
         printf("Applying BPF filter\n");
-
-        if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0))
-            errExit("prctl");
-
-        install_filter();
+        applyFilter();
     }
 
     nloops = atoi(argv[1]);
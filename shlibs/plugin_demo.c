@@ -0,0 +1,32 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 42 */
+
+/* plugin_demo.c
+
+   A plugin for t_plugin_loader.c, exporting 256 functions,
+   plugin_fn000() to plugin_fn255(), each of which returns its argument
+   plus its own number.
+*/
+
+#define FN(n) \
+    int plugin_fn##n(int x); \
+    int plugin_fn##n(int x) { return x + (1##n - 1000); }
+
+#define FN10(n) FN(n##0) FN(n##1) FN(n##2) FN(n##3) FN(n##4) \
+                FN(n##5) FN(n##6) FN(n##7) FN(n##8) FN(n##9)
+#define FN100(n) FN10(n##0) FN10(n##1) FN10(n##2) FN10(n##3) FN10(n##4) \
+                 FN10(n##5) FN10(n##6) FN10(n##7) FN10(n##8) FN10(n##9)
+
+FN100(0)
+FN100(1)
+FN10(20) FN10(21) FN10(22) FN10(23) FN10(24)
+FN(250) FN(251) FN(252) FN(253) FN(254) FN(255)
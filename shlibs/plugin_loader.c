@@ -0,0 +1,371 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 42 */
+
+/* plugin_loader.c
+
+   A loader for plugins (shared libraries loaded with dlopen()) that
+   avoids repeating work when plugins are loaded again and again, and
+   when many symbols are looked up (see plugin_loader.h for the
+   operations).
+
+   - plOpen() resolves, at load time, all of the symbols that the caller
+     names, into a table of function pointers (p->funcs), so that calls
+     through the table cost nothing more than an indirect call, where
+     each dlsym() would walk the library's symbol hash table and compare
+     strings. Further symbols can be looked up with plSym(), which
+     remembers the results in a small hash table.
+
+   - Plugins are cached: plClose() leaves the plugin loaded, and a later
+     plOpen() with the same path, flags, and symbol list returns the
+     cached plugin (after a stat() of the file), without calling dlopen()
+     or dlsym(). If the file has been replaced (its device, inode, or
+     modification time has changed), the cached plugin is marked stale,
+     and unloaded once it is no longer in use, and the new file is
+     loaded.
+
+   - The flags select RTLD_LOCAL (the default) or RTLD_GLOBAL, lazy (the
+     default) or immediate binding, RTLD_DEEPBIND (the plugin's own
+     symbols, and those of its dependencies, take precedence over those
+     of the global scope), and loading with dlmopen() into a new
+     link-map namespace, so that the plugin gets its own copies of its
+     dependencies (glibc supports only 16 namespaces).
+
+   The time taken by dlopen()/dlmopen() and by the resolution of the
+   symbol list is recorded in the plugin (p->loadNs and p->resolveNs),
+   and the cache counts hits, misses, and reloads of replaced files.
+
+   The array of names given to plOpen() must remain valid while the
+   plugin is in the cache. The functions are thread-safe, except that
+   plSym() must not be called concurrently for the same plugin.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <dlfcn.h>
+#include "plugin_loader.h"
+
+struct plMemo {                 /* plSym() cache entry */
+    char *name;
+    void *addr;
+};
+
+static __thread char errBuf[256];
+
+static double
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Return a description of the last error in plOpen() or plSym() */
+
+const char *
+plError(void)
+{
+    return errBuf;
+}
+
+void
+plCacheInit(struct pluginCache *pc)
+{
+    pthread_mutex_init(&pc->mtx, NULL);
+    pc->list = NULL;
+    pc->hits = pc->misses = pc->reloads = 0;
+}
+
+static void
+unload(struct plugin *p)
+{
+    int j;
+
+    dlclose(p->handle);
+    for (j = 0; j < p->maxMemo; j++)
+        free(p->memo[j].name);
+    free(p->memo);
+    free(p->funcs);
+    free(p->path);
+    free(p);
+}
+
+/* Remove 'p' from the cache list, and unload it */
+
+static void
+removePlugin(struct pluginCache *pc, struct plugin *p)
+{
+    struct plugin **pp;
+
+    for (pp = &pc->list; *pp != NULL; pp = &(*pp)->next)
+        if (*pp == p) {
+            *pp = p->next;
+            break;
+        }
+    unload(p);
+}
+
+static Boolean
+sameNames(const struct plugin *p, const char *const *names, int nsyms)
+{
+    int j;
+
+    if (p->nsyms != nsyms)
+        return FALSE;
+    if (p->names == names)
+        return TRUE;
+    for (j = 0; j < nsyms; j++)
+        if (strcmp(p->names[j], names[j]) != 0)
+            return FALSE;
+    return TRUE;
+}
+
+static struct plugin *
+load(const char *path, const char *const *names, int nsyms, int flags,
+     const struct stat *sb)
+{
+    struct plugin *p;
+    const char *err;
+    Lmid_t lmid;
+    double t0;
+    void *addr;
+    int mode, j;
+
+    p = calloc(1, sizeof(struct plugin));
+    if (p == NULL)
+        goto nomem;
+    p->path = strdup(path);
+    p->funcs = calloc(nsyms > 0 ? nsyms : 1, sizeof(plFunc));
+    if (p->path == NULL || p->funcs == NULL)
+        goto nomem;
+    p->flags = flags;
+    p->names = names;
+    p->nsyms = nsyms;
+    if (sb != NULL) {
+        p->dev = sb->st_dev;
+        p->ino = sb->st_ino;
+        p->mtime = sb->st_mtim;
+    }
+
+    mode = (flags & PL_NOW) ? RTLD_NOW : RTLD_LAZY;
+    mode |= (flags & PL_GLOBAL) ? RTLD_GLOBAL : RTLD_LOCAL;
+    if (flags & PL_DEEPBIND)
+        mode |= RTLD_DEEPBIND;
+
+    t0 = nowNs();
+    if (flags & PL_NEWNS)
+        p->handle = dlmopen(LM_ID_NEWLM, path, mode);
+    else
+        p->handle = dlopen(path, mode);
+    p->loadNs = nowNs() - t0;
+    if (p->handle == NULL) {
+        snprintf(errBuf, sizeof(errBuf), "%s", dlerror());
+        free(p->funcs);
+        free(p->path);
+        free(p);
+        return NULL;
+    }
+    p->lmid = (dlinfo(p->handle, RTLD_DI_LMID, &lmid) == 0) ? lmid : -1;
+
+    t0 = nowNs();
+    for (j = 0; j < nsyms; j++) {
+        (void) dlerror();
+        addr = dlsym(p->handle, names[j]);
+        err = dlerror();
+        if (err != NULL) {
+            snprintf(errBuf, sizeof(errBuf), "%s", err);
+            unload(p);
+            return NULL;
+        }
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+        p->funcs[j] = (plFunc) addr;            /* See dynload.c */
+#pragma GCC diagnostic pop
+    }
+    p->resolveNs = nowNs() - t0;
+    return p;
+
+nomem:
+    snprintf(errBuf, sizeof(errBuf), "out of memory");
+    if (p != NULL) {
+        free(p->path);
+        free(p->funcs);
+        free(p);
+    }
+    return NULL;
+}
+
+/* Return the plugin at 'path', loaded with 'flags' (PL_*), with the
+   'nsyms' symbols in 'names' resolved into its 'funcs' table, from the
+   cache if possible. Returns NULL on error; plError() then describes
+   the error. */
+
+struct plugin *
+plOpen(struct pluginCache *pc, const char *path, const char *const *names,
+       int nsyms, int flags)
+{
+    struct plugin *p, *next;
+    struct stat sb;
+    Boolean haveStat;
+
+    /* A path without a slash is searched for by dlopen(), so we can't
+       tell whether the file has changed */
+
+    haveStat = strchr(path, '/') != NULL && stat(path, &sb) == 0;
+
+    pthread_mutex_lock(&pc->mtx);
+
+    for (p = pc->list; p != NULL; p = next) {
+        next = p->next;
+        if (p->stale || p->flags != flags || strcmp(p->path, path) != 0 ||
+                !sameNames(p, names, nsyms))
+            continue;
+
+        if (haveStat && (p->dev != sb.st_dev || p->ino != sb.st_ino ||
+                         p->mtime.tv_sec != sb.st_mtim.tv_sec ||
+                         p->mtime.tv_nsec != sb.st_mtim.tv_nsec)) {
+            p->stale = TRUE;
+            pc->reloads++;
+            if (p->refCount == 0)
+                removePlugin(pc, p);
+            continue;
+        }
+
+        p->refCount++;
+        pc->hits++;
+        pthread_mutex_unlock(&pc->mtx);
+        return p;
+    }
+
+    p = load(path, names, nsyms, flags, haveStat ? &sb : NULL);
+    if (p != NULL) {
+        p->refCount = 1;
+        p->next = pc->list;
+        pc->list = p;
+        pc->misses++;
+    }
+
+    pthread_mutex_unlock(&pc->mtx);
+    return p;
+}
+
+static unsigned int
+hashName(const char *s)
+{
+    unsigned int h;
+
+    for (h = 5381; *s != '\0'; s++)
+        h = h * 33 + (unsigned char) *s;
+
+    /* Names such as "fn001", "fn002", ... differ only in their last
+       characters, so mix the high bits into the low bits that select a
+       slot in the (power-of-two-sized) table */
+
+    h ^= h >> 15;
+    h *= 0x2c1b3c6dU;
+    h ^= h >> 12;
+    return h;
+}
+
+/* Look up 'name' in 'p', remembering the result. Returns NULL (with
+   plError() describing the error) if the symbol is not found. */
+
+void *
+plSym(struct plugin *p, const char *name)
+{
+    struct plMemo *m, *old;
+    const char *err;
+    void *addr;
+    int j, oldMax;
+
+    if (p->maxMemo > 0) {
+        for (j = hashName(name) % p->maxMemo; p->memo[j].name != NULL;
+                j = (j + 1) % p->maxMemo)
+            if (strcmp(p->memo[j].name, name) == 0)
+                return p->memo[j].addr;
+    }
+
+    (void) dlerror();
+    addr = dlsym(p->handle, name);
+    err = dlerror();
+    if (err != NULL) {
+        snprintf(errBuf, sizeof(errBuf), "%s", err);
+        return NULL;
+    }
+
+    /* Keep the table at most half full */
+
+    if (2 * (p->nmemo + 1) > p->maxMemo) {
+        old = p->memo;
+        oldMax = p->maxMemo;
+        p->maxMemo = (oldMax == 0) ? 64 : oldMax * 2;
+        p->memo = calloc(p->maxMemo, sizeof(struct plMemo));
+        if (p->memo == NULL) {          /* Can't remember, but can answer */
+            p->memo = old;
+            p->maxMemo = oldMax;
+            return addr;
+        }
+        for (j = 0; j < oldMax; j++) {
+            if (old[j].name == NULL)
+                continue;
+            for (m = &p->memo[hashName(old[j].name) % p->maxMemo];
+                    m->name != NULL; )
+                m = (m == &p->memo[p->maxMemo - 1]) ? p->memo : m + 1;
+            *m = old[j];
+        }
+        free(old);
+    }
+
+    for (j = hashName(name) % p->maxMemo; p->memo[j].name != NULL; )
+        j = (j + 1) % p->maxMemo;
+    p->memo[j].name = strdup(name);
+    if (p->memo[j].name == NULL)
+        return addr;
+    p->memo[j].addr = addr;
+    p->nmemo++;
+    return addr;
+}
+
+/* Release a plugin returned by plOpen(). It remains in the cache, unless
+   its file has been replaced. */
+
+void
+plClose(struct pluginCache *pc, struct plugin *p)
+{
+    pthread_mutex_lock(&pc->mtx);
+    if (--p->refCount == 0 && p->stale)
+        removePlugin(pc, p);
+    pthread_mutex_unlock(&pc->mtx);
+}
+
+/* Unload all cached plugins that are not in use. Returns the number
+   of plugins unloaded. */
+
+int
+plFlush(struct pluginCache *pc)
+{
+    struct plugin *p, *next;
+    int n;
+
+    pthread_mutex_lock(&pc->mtx);
+    n = 0;
+    for (p = pc->list; p != NULL; p = next) {
+        next = p->next;
+        if (p->refCount == 0) {
+            removePlugin(pc, p);
+            n++;
+        }
+    }
+    pthread_mutex_unlock(&pc->mtx);
+    return n;
+}
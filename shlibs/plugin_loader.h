@@ -0,0 +1,87 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 42 */
+
+/* plugin_loader.h
+
+   Header file for plugin_loader.c.
+
+   A plugin host keeps a cache of loaded plugins:
+
+        initialize the cache:           plCacheInit(&pc)
+        load a plugin (or find it in    p = plOpen(&pc, path, names, n,
+            the cache), resolving all               flags)
+            of 'names' into p->funcs[]
+        look up another symbol:         addr = plSym(p, name)
+        release the plugin:             plClose(&pc, p)
+        unload unused plugins:          plFlush(&pc)
+
+   A plugin stays loaded after its last plClose(), so that the next
+   plOpen() of it is cheap; it is unloaded by plFlush(), or by plOpen() if
+   the file has been replaced.
+*/
+#ifndef PLUGIN_LOADER_H
+#define PLUGIN_LOADER_H         /* Prevent accidental double inclusion */
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#define PL_GLOBAL    0x1        /* RTLD_GLOBAL rather than RTLD_LOCAL */
+#define PL_DEEPBIND  0x2        /* RTLD_DEEPBIND */
+#define PL_NOW       0x4        /* RTLD_NOW rather than RTLD_LAZY */
+#define PL_NEWNS     0x8        /* Load into a new dlmopen() namespace */
+
+typedef void (*plFunc)(void);   /* Cast to the real type before calling */
+
+struct plMemo;
+
+struct plugin {
+    char *path;                 /* As given to plOpen() */
+    int flags;                  /* PL_* */
+    void *handle;
+    long lmid;                  /* Link-map namespace (Lmid_t) */
+    const char *const *names;   /* Symbols resolved at load time */
+    int nsyms;
+    plFunc *funcs;              /* funcs[j] is the address of names[j] */
+    int refCount;
+    Boolean stale;              /* File has changed since it was loaded */
+    dev_t dev;                  /* Identity of the file when loaded */
+    ino_t ino;
+    struct timespec mtime;
+    double loadNs;              /* Time taken by dlopen()/dlmopen() */
+    double resolveNs;           /* Time taken to resolve 'names' */
+    struct plMemo *memo;        /* Cache for plSym() */
+    int nmemo, maxMemo;
+    struct plugin *next;
+};
+
+struct pluginCache {
+    pthread_mutex_t mtx;
+    struct plugin *list;
+    long hits, misses, reloads;
+};
+
+void plCacheInit(struct pluginCache *pc);
+
+struct plugin *plOpen(struct pluginCache *pc, const char *path,
+                      const char *const *names, int nsyms, int flags);
+
+void *plSym(struct plugin *p, const char *name);
+
+void plClose(struct pluginCache *pc, struct plugin *p);
+
+int plFlush(struct pluginCache *pc);
+
+const char *plError(void);
+
+#endif
@@ -0,0 +1,322 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 41 */
+
+/* startup_bench.c
+
+   Measure the startup cost of programs, in particular, of the variants of
+   startup_prog.c (prog.c plus mod1.c, mod2.c, and mod3.c) that are built
+   by "make bench" in this directory:
+
+        startup_static     Linked statically (-static)
+        startup_archive    Modules from a static library; libc shared
+        startup_lazy       Shared library, lazy binding (-z lazy)
+        startup_now        Shared library, immediate binding (-z now)
+        startup_symbolic   Shared library linked with -Bsymbolic
+        startup_hidden     Shared library compiled with -fvisibility=hidden
+                           (only x1(), x2(), and x3() are exported)
+        startup_packed     The nearest modern equivalent of a prelinked
+                           layout (prelink(8) is no longer supported by
+                           glibc): a non-PIE executable, immediate binding,
+                           and packed relative relocations
+                           (-z pack-relative-relocs, that is, DT_RELR)
+
+   Usage: startup_bench [-n nexecs] [-B] prog...
+
+        -n nexecs    Number of times each program is executed in each
+                     repetition of the benchmark (default: 100); the
+                     number of repetitions is set by TLPI_BENCH_REPS (see
+                     lib/bench.c)
+        -B           Report the exec-to-exit time in the common benchmark
+                     format of lib/bench.c (as used by "make bench"),
+                     rather than as a table
+
+   Each program is run with posix_spawn(), with standard output directed
+   to /dev/null, and waited for. The exec-to-exit time runs from just
+   before posix_spawn() until waitpid() returns. If the program writes a
+   CLOCK_MONOTONIC timestamp to the file descriptor named by the
+   environment variable STARTUP_BENCH_FD (as startup_prog.c does) on
+   entry to main(), the exec-to-main time is shown too.
+
+   In addition, each program is run once with LD_DEBUG=statistics, and
+   the dynamic linker's statistics are shown: the time that it spent
+   (in cycles), the number of symbol relocations processed at startup
+   (and how many of those were satisfied from its lookup cache), the
+   number of relative relocations, and the total number of symbol
+   relocations at exit (which, with lazy binding, includes the PLT
+   entries that were bound on first call). A statically linked program
+   has no dynamic linker, and so no statistics.
+
+   Try: make bench
+        ./startup_bench startup_static startup_lazy startup_now /bin/true
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <time.h>
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+extern char **environ;
+
+struct spawnArg {
+    const char *prog;
+    char **envp;                /* Includes STARTUP_BENCH_FD */
+    int pfd[2];                 /* Pipe that carries main() timestamps */
+    int64_t *mainNs;            /* Exec-to-main samples */
+    long nMain, maxMain;
+    posix_spawn_file_actions_t fa;
+};
+
+struct ldStats {
+    long startupCycles;         /* -1 if no statistics were reported */
+    long relocs, cached, relative, finalRelocs;
+};
+
+static int64_t
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int
+cmpI64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Return 'envp' with the additional entry 'extra' */
+
+static char **
+addEnv(char **envp, const char *extra)
+{
+    char **nenv;
+    int n;
+
+    for (n = 0; envp[n] != NULL; n++)
+        continue;
+    nenv = calloc(n + 2, sizeof(char *));
+    if (nenv == NULL)
+        errExit("calloc");
+    memcpy(nenv, envp, n * sizeof(char *));
+    nenv[n] = (char *) extra;
+    return nenv;
+}
+
+/* The function measured by benchRun(): run the program 'ops' times */
+
+static void
+spawnBatch(long ops, void *arg)
+{
+    struct spawnArg *sa = arg;
+    char *argv[2];
+    struct timespec ts;
+    int64_t t0;
+    pid_t pid;
+    long j;
+    int s, status;
+
+    argv[0] = (char *) sa->prog;
+    argv[1] = NULL;
+
+    for (j = 0; j < ops; j++) {
+        t0 = nowNs();
+        s = posix_spawn(&pid, sa->prog, &sa->fa, NULL, argv, sa->envp);
+        if (s != 0)
+            errExitEN(s, "posix_spawn %s", sa->prog);
+        if (waitpid(pid, &status, 0) == -1)
+            errExit("waitpid");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fatal("%s failed", sa->prog);
+
+        /* The timestamp (if any) is already in the pipe */
+
+        if (read(sa->pfd[0], &ts, sizeof(ts)) == sizeof(ts) &&
+                sa->nMain < sa->maxMain)
+            sa->mainNs[sa->nMain++] =
+                    ts.tv_sec * 1000000000LL + ts.tv_nsec - t0;
+    }
+}
+
+/* Run 'prog' once with LD_DEBUG=statistics, and collect the statistics
+   that the dynamic linker writes to standard error */
+
+static void
+getLdStats(const char *prog, struct ldStats *st)
+{
+    posix_spawn_file_actions_t fa;
+    char *argv[2], **envp, line[256], *p;
+    int pfd[2], s, status;
+    long val;
+    pid_t pid;
+    FILE *fp;
+
+    st->startupCycles = st->relocs = st->cached = st->relative =
+            st->finalRelocs = -1;
+
+    if (pipe(pfd) == -1)
+        errExit("pipe");
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null",
+                                     O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&fa, pfd[1], STDERR_FILENO);
+    posix_spawn_file_actions_addclose(&fa, pfd[0]);
+    posix_spawn_file_actions_addclose(&fa, pfd[1]);
+
+    argv[0] = (char *) prog;
+    argv[1] = NULL;
+    envp = addEnv(environ, "LD_DEBUG=statistics");
+    s = posix_spawn(&pid, prog, &fa, NULL, argv, envp);
+    if (s != 0)
+        errExitEN(s, "posix_spawn %s", prog);
+    close(pfd[1]);
+
+    fp = fdopen(pfd[0], "r");
+    if (fp == NULL)
+        errExit("fdopen");
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        p = strchr(line, ':');          /* Skip "PID:" prefix */
+        if (p == NULL || (p = strchr(p + 1, ':')) == NULL)
+            continue;
+        if (sscanf(p + 1, "%ld", &val) != 1)
+            continue;
+
+        if (strstr(line, "total startup time") != NULL)
+            st->startupCycles = val;
+        else if (strstr(line, "final number of relocations:") != NULL)
+            st->finalRelocs = val;
+        else if (strstr(line, "final number") != NULL)
+            continue;
+        else if (strstr(line, "relocations from cache") != NULL)
+            st->cached = val;
+        else if (strstr(line, "relative relocations") != NULL)
+            st->relative = val;
+        else if (strstr(line, "number of relocations:") != NULL)
+            st->relocs = val;
+    }
+    fclose(fp);
+
+    if (waitpid(pid, &status, 0) == -1)
+        errExit("waitpid");
+    posix_spawn_file_actions_destroy(&fa);
+    free(envp);
+}
+
+static void
+printStat(long val)
+{
+    if (val < 0)
+        printf(" %8s", "-");
+    else
+        printf(" %8ld", val);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct benchOpts opts;
+    struct benchResult res;
+    struct spawnArg sa;
+    struct ldStats st;
+    char envFd[32], name[64];
+    Boolean benchFormat;
+    int opt, j;
+    long nexecs;
+
+    nexecs = 100;
+    benchFormat = FALSE;
+    while ((opt = getopt(argc, argv, "n:B")) != -1) {
+        switch (opt) {
+        case 'n': nexecs = getLong(optarg, GN_GT_0, "-n");     break;
+        case 'B': benchFormat = TRUE;                           break;
+        default:  optind = argc;                                break;
+        }
+    }
+    if (optind >= argc)
+        usageErr("%s [-n nexecs] [-B] prog...\n", argv[0]);
+
+    benchOptsInit(&opts);
+
+    /* The write end of the timestamp pipe is inherited by each child;
+       the read end is nonblocking, so that a program that doesn't write
+       a timestamp does no harm */
+
+    if (pipe(sa.pfd) == -1)
+        errExit("pipe");
+    if (fcntl(sa.pfd[0], F_SETFD, FD_CLOEXEC) == -1 ||
+            fcntl(sa.pfd[0], F_SETFL, O_NONBLOCK) == -1)
+        errExit("fcntl");
+    snprintf(envFd, sizeof(envFd), "STARTUP_BENCH_FD=%d", sa.pfd[1]);
+    sa.envp = addEnv(environ, envFd);
+
+    posix_spawn_file_actions_init(&sa.fa);
+    posix_spawn_file_actions_addopen(&sa.fa, STDOUT_FILENO, "/dev/null",
+                                     O_WRONLY, 0);
+
+    sa.maxMain = nexecs * (opts.reps + opts.warmup);
+    sa.mainNs = calloc(sa.maxMain, sizeof(int64_t));
+    if (sa.mainNs == NULL)
+        errExit("calloc");
+
+    if (!benchFormat)
+        printf("%-20s %9s %9s %9s %9s %8s %8s %8s %8s %8s\n", "program",
+               "exit-med", "exit-p99", "main-med", "main-p99", "ld-kcyc",
+               "relocs", "cached", "relative", "final");
+
+    for (j = optind; j < argc; j++) {
+        sa.prog = argv[j];
+        sa.nMain = 0;
+        snprintf(name, sizeof(name), "startup_bench: %s", argv[j]);
+        if (benchRun(name, spawnBatch, &sa, nexecs, &opts, &res) == -1)
+            errExit("benchRun");
+
+        if (benchFormat) {
+            benchReport(&res);
+            continue;
+        }
+
+        printf("%-20s %8.1fu %8.1fu", argv[j], res.medianNs / 1e3,
+               res.p99Ns / 1e3);
+        if (sa.nMain > 0) {
+            qsort(sa.mainNs, sa.nMain, sizeof(int64_t), cmpI64);
+            printf(" %8.1fu %8.1fu", sa.mainNs[sa.nMain / 2] / 1e3,
+                   sa.mainNs[sa.nMain * 99 / 100] / 1e3);
+        } else {
+            printf(" %9s %9s", "-", "-");
+        }
+
+        getLdStats(argv[j], &st);
+        printStat(st.startupCycles < 0 ? -1 : st.startupCycles / 1000);
+        printStat(st.relocs);
+        printStat(st.cached);
+        printStat(st.relative);
+        printStat(st.finalRelocs);
+        printf("\n");
+    }
+
+    if (!benchFormat)
+        printf("\nexit-/main-: median and 99th percentile exec-to-exit and "
+               "exec-to-main times\n(exit-p99 is over repetitions of %ld "
+               "execs); ld-kcyc: dynamic linker startup\ntime (thousands "
+               "of cycles); relocs/cached/relative/final: see source\n",
+               nexecs);
+
+    exit(EXIT_SUCCESS);
+}
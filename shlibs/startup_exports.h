@@ -0,0 +1,31 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 41 */
+
+/* startup_exports.h
+
+   The interface of mod1.c, mod2.c, and mod3.c, force-included (gcc
+   -include) when they are compiled for startup_bench.c. Besides
+   supplying prototypes, this keeps the interface visible when the
+   modules are compiled with -fvisibility=hidden, while everything else
+   (here, the test1..test3 arrays) is hidden: a definition inherits the
+   visibility of an earlier declaration.
+*/
+#ifndef STARTUP_EXPORTS_H
+#define STARTUP_EXPORTS_H
+
+#define EXPORT __attribute__ ((visibility ("default")))
+
+EXPORT void x1(void);
+EXPORT void x2(void);
+EXPORT void x3(void);
+
+#endif
@@ -0,0 +1,44 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 41 */
+
+/* startup_prog.c
+
+   prog.c, instrumented for startup_bench.c: if the environment variable
+   STARTUP_BENCH_FD is set, then on entry to main(), the program writes
+   the current CLOCK_MONOTONIC time (a 'struct timespec') to the file
+   descriptor that it names.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+void x1(void);
+void x2(void);
+
+int
+main(int argc, char *argv[])
+{
+    struct timespec ts;
+    char *fd;
+
+    fd = getenv("STARTUP_BENCH_FD");
+    if (fd != NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        if (write(atoi(fd), &ts, sizeof(ts)) != sizeof(ts))
+            exit(EXIT_FAILURE);
+    }
+
+    x1();
+    x2();
+    exit(EXIT_SUCCESS);
+}
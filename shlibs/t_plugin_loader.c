@@ -0,0 +1,234 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 42 */
+
+/* t_plugin_loader.c
+
+   Compare loading a plugin and looking up its symbols as dynload.c does
+   (dlopen(), then dlsym() for each symbol, then dlclose(), each time the
+   plugin is needed) with the cached loader of plugin_loader.c.
+
+   Usage: t_plugin_loader [-n nsyms] [-r reloads] [-c calls]
+                          [-f flag[,flag...]] [-t] plugin-path
+
+        -n nsyms     Number of symbols, plugin_fn000..., to resolve
+                     (default: 256, all those in plugin_demo.so)
+        -r reloads   Number of times the plugin is loaded (default: 1000)
+        -c calls     Number of calls for the per-call lookup comparison
+                     (default: 1000000)
+        -f flags     Loader flags: 'global', 'deepbind', 'now', 'newns'
+        -t           Finally, update the plugin's modification time, to
+                     show that plOpen() then reloads it
+
+   The program reports:
+
+   - The average time to load the plugin and resolve 'nsyms' symbols,
+     uncached (dlopen() + dlsym() + dlclose()) and with plOpen() +
+     plClose(); for plOpen(), the time of the first (uncached) load and
+     symbol resolution is shown separately.
+
+   - The cost per call of calling a function that is looked up with
+     dlsym() at each call, looked up with plSym(), or called through the
+     table built by plOpen().
+
+   Try: make plugin_demo.so t_plugin_loader
+        ./t_plugin_loader ./plugin_demo.so
+        ./t_plugin_loader -f newns,now -t ./plugin_demo.so
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <time.h>
+#include "plugin_loader.h"
+#include "tlpi_hdr.h"
+
+#define MAX_SYMS 256
+
+typedef int (*demoFn)(int);
+
+static double
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+parseFlags(char *s)
+{
+    char *tok;
+    int flags;
+
+    flags = 0;
+    for (tok = strtok(s, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (strcmp(tok, "global") == 0)
+            flags |= PL_GLOBAL;
+        else if (strcmp(tok, "deepbind") == 0)
+            flags |= PL_DEEPBIND;
+        else if (strcmp(tok, "now") == 0)
+            flags |= PL_NOW;
+        else if (strcmp(tok, "newns") == 0)
+            flags |= PL_NEWNS;
+        else
+            cmdLineErr("Unknown flag: %s\n", tok);
+    }
+    return flags;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static char nameBuf[MAX_SYMS][32];
+    const char *names[MAX_SYMS];
+    struct pluginCache pc;
+    struct plugin *p;
+    int opt, nsyms, reloads, calls, flags, mode, j, k;
+    Boolean touch;
+    double t, firstLoad, firstResolve;
+    const char *path;
+    void *handle, *addr;
+    long sum;
+    demoFn fn;
+
+    nsyms = MAX_SYMS;
+    reloads = 1000;
+    calls = 1000000;
+    flags = 0;
+    touch = FALSE;
+    while ((opt = getopt(argc, argv, "n:r:c:f:t")) != -1) {
+        switch (opt) {
+        case 'n': nsyms = getInt(optarg, GN_GT_0, "-n");        break;
+        case 'r': reloads = getInt(optarg, GN_GT_0, "-r");      break;
+        case 'c': calls = getInt(optarg, GN_GT_0, "-c");        break;
+        case 'f': flags = parseFlags(optarg);                   break;
+        case 't': touch = TRUE;                                 break;
+        default:  optind = argc;                                break;
+        }
+    }
+    if (optind != argc - 1)
+        usageErr("%s [-n nsyms] [-r reloads] [-c calls] [-f flags] [-t] "
+                 "plugin-path\n", argv[0]);
+    if (nsyms > MAX_SYMS)
+        cmdLineErr("At most %d symbols\n", MAX_SYMS);
+    path = argv[optind];
+
+    for (j = 0; j < nsyms; j++) {
+        snprintf(nameBuf[j], sizeof(nameBuf[j]), "plugin_fn%03d", j);
+        names[j] = nameBuf[j];
+    }
+
+    /* Uncached: as dynload.c does it, but for 'nsyms' symbols */
+
+    mode = ((flags & PL_NOW) ? RTLD_NOW : RTLD_LAZY) |
+           ((flags & PL_GLOBAL) ? RTLD_GLOBAL : RTLD_LOCAL) |
+           ((flags & PL_DEEPBIND) ? RTLD_DEEPBIND : 0);
+    t = nowNs();
+    for (k = 0; k < reloads; k++) {
+        handle = (flags & PL_NEWNS) ? dlmopen(LM_ID_NEWLM, path, mode)
+                                    : dlopen(path, mode);
+        if (handle == NULL)
+            fatal("dlopen: %s", dlerror());
+        for (j = 0; j < nsyms; j++)
+            if (dlsym(handle, names[j]) == NULL)
+                fatal("dlsym: %s", dlerror());
+        dlclose(handle);
+    }
+    t = nowNs() - t;
+    printf("%d symbols, %d loads\n\n", nsyms, reloads);
+    printf("dlopen + dlsym + dlclose:  %10.2f us per load\n",
+           t / reloads / 1e3);
+
+    /* Cached */
+
+    plCacheInit(&pc);
+    t = nowNs();
+    for (k = 0; k < reloads; k++) {
+        p = plOpen(&pc, path, names, nsyms, flags);
+        if (p == NULL)
+            fatal("plOpen: %s", plError());
+        if (k == 0) {
+            firstLoad = p->loadNs;
+            firstResolve = p->resolveNs;
+        }
+        plClose(&pc, p);
+    }
+    t = nowNs() - t;
+    printf("plOpen + plClose:          %10.2f us per load "
+           "(first: load %.1f us, resolve %.1f us)\n",
+           t / reloads / 1e3, firstLoad / 1e3, firstResolve / 1e3);
+    printf("Cache: %ld hits, %ld misses\n\n", pc.hits, pc.misses);
+
+    /* Per-call lookup */
+
+    p = plOpen(&pc, path, names, nsyms, flags);
+    if (p == NULL)
+        fatal("plOpen: %s", plError());
+    printf("Namespace (Lmid_t) of plugin: %ld\n", p->lmid);
+
+    for (j = 0; j < nsyms; j++)                 /* Check the table */
+        if (((demoFn) p->funcs[j])(1) != 1 + j)
+            fatal("%s returned wrong value", names[j]);
+
+    sum = 0;
+    t = nowNs();
+    for (k = 0; k < calls; k++) {
+        addr = dlsym(p->handle, names[k % nsyms]);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+        fn = (demoFn) addr;                     /* See dynload.c */
+#pragma GCC diagnostic pop
+        sum += fn(k);
+    }
+    printf("dlsym() per call:          %10.2f ns per call\n",
+           (nowNs() - t) / calls);
+
+    t = nowNs();
+    for (k = 0; k < calls; k++) {
+        addr = plSym(p, names[k % nsyms]);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+        fn = (demoFn) addr;
+#pragma GCC diagnostic pop
+        sum += fn(k);
+    }
+    printf("plSym() per call:          %10.2f ns per call\n",
+           (nowNs() - t) / calls);
+
+    t = nowNs();
+    for (k = 0; k < calls; k++)
+        sum += ((demoFn) p->funcs[k % nsyms])(k);
+    printf("funcs[] table:             %10.2f ns per call\n",
+           (nowNs() - t) / calls);
+    plClose(&pc, p);
+
+    /* Show that a changed file is reloaded */
+
+    if (touch) {
+        if (utimensat(AT_FDCWD, path, NULL, 0) == -1)
+            errExit("utimensat");
+        p = plOpen(&pc, path, names, nsyms, flags);
+        if (p == NULL)
+            fatal("plOpen: %s", plError());
+        printf("\nAfter touching %s: %ld reload(s), %ld misses; "
+               "load %.1f us\n", path, pc.reloads, pc.misses,
+               p->loadNs / 1e3);
+        plClose(&pc, p);
+    }
+
+    printf("\n%d plugin(s) unloaded by plFlush() (checksum %ld)\n",
+           plFlush(&pc), sum);
+    exit(EXIT_SUCCESS);
+}
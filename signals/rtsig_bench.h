@@ -0,0 +1,47 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 22 */
+
+/* rtsig_bench.h
+
+   Header file used by rtsig_bench_recv.c and rtsig_bench_send.c.
+
+   The sender sends a run of instances of a realtime "test" signal
+   (by default, SIGRTMIN), followed by one instance of the "end" signal
+   (the test signal + 1). Since realtime signals are delivered lowest
+   numbered first, the end signal is accepted only after all queued
+   instances of the test signal, and marks the end of the run.
+
+   When the signal is sent with sigqueue() or pidfd_send_signal(), the
+   accompanying data contains the CLOCK_MONOTONIC time (in nanoseconds)
+   at which the signal was sent, so that the receiver can calculate the
+   delivery latency. On platforms where a pointer is 32 bits, this value
+   wraps every 4.29 seconds; the (unsigned) difference between the send
+   and receive times is nevertheless correct for latencies shorter
+   than that.
+*/
+#include <stdint.h>
+#include <time.h>
+
+#define DEFAULT_TEST_SIG (SIGRTMIN)
+#define END_SIG(testSig) ((testSig) + 1)
+
+/* Return the current CLOCK_MONOTONIC time, in nanoseconds. The value
+   placed in 'sival_ptr' is this value cast to 'uintptr_t'. */
+
+static uint64_t
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);        /* Async-signal-safe */
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,314 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 22 */
+
+/* rtsig_bench_recv.c
+
+   Receive runs of realtime signals sent by rtsig_bench_send.c, and report
+   the number received, the delivery rate, and (for signals sent with
+   sigqueue() or pidfd_send_signal()) percentiles of the delivery latency.
+
+   Usage: rtsig_bench_recv [-m method] [-s sig-offset] [-b block-secs]
+                           [-n max-samples] [-t timeout-ms]
+
+        -m method       How signals are accepted:
+                          handler       an SA_SIGINFO handler, waiting with
+                                        sigsuspend() (the default)
+                          sigwaitinfo   sigwaitinfo()
+                          sigtimedwait  sigtimedwait(), with a timeout
+                                        (see -t)
+                          signalfd      blocking read()s from a signalfd,
+                                        each retrieving up to 64 signals
+        -s sig-offset   Use SIGRTMIN+sig-offset as the test signal
+                        (default: 0); the end signal is the next signal
+        -b block-secs   At startup, block the signals and sleep for
+                        'block-secs' seconds, so that signals accumulate in
+                        the queue (compare catch_rtsigs.c)
+        -n max-samples  Record at most this many latencies per run
+                        (default: 1000000)
+        -t timeout-ms   Timeout for sigtimedwait() (default: 1000); if a
+                        run has started and the timeout expires before
+                        the end signal arrives, the run is reported anyway
+
+   After each run (i.e., on receipt of the end signal) statistics are
+   printed; the program then waits for the next run. It can be terminated
+   with SIGINT or SIGTERM.
+
+   The number of realtime signals that can be queued to a process is
+   limited by the real user ID's RLIMIT_SIGPENDING resource limit. Once
+   the limit is reached, sigqueue() fails with EAGAIN, while kill() still
+   succeeds, but the signal is then no longer queued: further instances
+   are merged, as for a standard signal. Comparing the number of signals
+   sent with the number received shows when this happens.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include "rtsig_bench.h"
+#include "tlpi_hdr.h"
+
+#define BATCH_SIZE 64           /* Max. signals retrieved per read() */
+
+enum { M_HANDLER, M_SIGWAITINFO, M_SIGTIMEDWAIT, M_SIGNALFD };
+
+static const char *methodNames[] = {
+    "handler", "sigwaitinfo", "sigtimedwait", "signalfd"
+};
+
+#define NMETHODS (sizeof(methodNames) / sizeof(methodNames[0]))
+
+static int testSig, endSig;
+
+/* Statistics for the current run. These are updated (only) by record(),
+   which may be called from a signal handler. */
+
+static uint64_t *samples;       /* Latencies (nanoseconds) */
+static long maxSamples;
+static volatile long numSamples;
+static volatile long numRecv;   /* Instances of test signal received */
+static volatile long numUser;   /* ... of which were sent with kill() */
+static uint64_t firstNs, lastNs;
+static long numReads;           /* read()s from signalfd */
+
+static volatile sig_atomic_t runDone, quit;
+
+/* Record receipt of one signal */
+
+static void
+record(int sig, int code, void *sentPtr)
+{
+    uint64_t now;
+
+    if (sig != testSig) {
+        if (sig == endSig)
+            runDone = 1;
+        else                            /* SIGINT or SIGTERM */
+            quit = 1;
+        return;
+    }
+
+    now = nowNs();
+    if (numRecv == 0)
+        firstNs = now;
+    lastNs = now;
+    numRecv++;
+
+    if (code == SI_USER)
+        numUser++;
+    else if (numSamples < maxSamples)
+        samples[numSamples++] = (uintptr_t) now - (uintptr_t) sentPtr;
+}
+
+static int
+cmpSample(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+reportRun(int runNum)
+{
+    double secs;
+
+    printf("run %d: received %ld signal(s)", runNum, numRecv);
+    if (numUser > 0)
+        printf(" (%ld via kill())", numUser);
+    if (numRecv > 1) {
+        secs = (lastNs - firstNs) / 1e9;
+        printf(" in %.3f secs (%.0f sigs/sec)", secs,
+                (secs > 0) ? (numRecv - 1) / secs : 0.0);
+    }
+    if (numReads > 0)
+        printf("; %.2f sigs/read", (double) numRecv / numReads);
+    printf("\n");
+
+    if (numSamples > 0) {
+        qsort(samples, numSamples, sizeof(uint64_t), cmpSample);
+        printf("    latency (usec): p50=%.1f p90=%.1f p99=%.1f max=%.1f\n",
+                samples[numSamples / 2] / 1e3,
+                samples[numSamples * 9 / 10] / 1e3,
+                samples[numSamples * 99 / 100] / 1e3,
+                samples[numSamples - 1] / 1e3);
+    }
+
+    numRecv = numUser = numSamples = numReads = 0;
+}
+
+static void
+handler(int sig, siginfo_t *si, void *ucontext)
+{
+    record(sig, si->si_code, si->si_value.sival_ptr);
+}
+
+static void
+usageError(const char *progName)
+{
+    int m;
+
+    fprintf(stderr, "Usage: %s [-m method] [-s sig-offset] [-b block-secs]\n"
+            "\t\t[-n max-samples] [-t timeout-ms]\n", progName);
+    fprintf(stderr, "Methods are:");
+    for (m = 0; m < NMETHODS; m++)
+        fprintf(stderr, " %s", methodNames[m]);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int method, opt, blockSecs, timeoutMs, runNum, sig, sfd, j;
+    struct signalfd_siginfo fdsi[BATCH_SIZE];
+    struct sigaction sa;
+    struct timespec timeout;
+    struct rlimit rlim;
+    sigset_t waitMask, emptyMask;
+    siginfo_t si;
+    ssize_t s;
+
+    method = M_HANDLER;
+    testSig = DEFAULT_TEST_SIG;
+    blockSecs = 0;
+    maxSamples = 1000000;
+    timeoutMs = 1000;
+    while ((opt = getopt(argc, argv, "m:s:b:n:t:")) != -1) {
+        switch (opt) {
+        case 'm':
+            for (method = 0; method < NMETHODS; method++)
+                if (strcmp(optarg, methodNames[method]) == 0)
+                    break;
+            if (method == NMETHODS)
+                usageError(argv[0]);
+            break;
+        case 's':
+            testSig = SIGRTMIN + getInt(optarg, GN_NONNEG, "sig-offset");
+            break;
+        case 'b':   blockSecs = getInt(optarg, GN_GT_0, "block-secs");  break;
+        case 'n':   maxSamples = getLong(optarg, 0, "max-samples");     break;
+        case 't':   timeoutMs = getInt(optarg, GN_GT_0, "timeout-ms");  break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc)
+        usageError(argv[0]);
+
+    endSig = END_SIG(testSig);
+    if (endSig > SIGRTMAX)
+        cmdLineErr("sig-offset too large\n");
+
+    samples = malloc((maxSamples + 1) * sizeof(uint64_t));
+    if (samples == NULL)
+        errExit("malloc");
+
+    if (getrlimit(RLIMIT_SIGPENDING, &rlim) == -1)
+        errExit("getrlimit");
+
+    setbuf(stdout, NULL);
+    printf("%s: PID = %ld; method = %s; test signal = %d; "
+            "RLIMIT_SIGPENDING = %lld\n", argv[0], (long) getpid(),
+            methodNames[method], testSig, (long long) rlim.rlim_cur);
+
+    /* All methods block the signals of interest: the handler method
+       waits for them using sigsuspend(); the other methods accept them
+       synchronously */
+
+    sigemptyset(&waitMask);
+    sigaddset(&waitMask, testSig);
+    sigaddset(&waitMask, endSig);
+    sigaddset(&waitMask, SIGINT);
+    sigaddset(&waitMask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &waitMask, NULL) == -1)
+        errExit("sigprocmask");
+
+    if (blockSecs > 0) {
+        printf("signals blocked - sleeping %d seconds\n", blockSecs);
+        sleep(blockSecs);
+        printf("sleep complete\n");
+    }
+
+    sfd = -1;
+    if (method == M_HANDLER) {
+        sa.sa_mask = waitMask;          /* Else the end signal could be
+                                           delivered during the handler
+                                           for an earlier test signal */
+        sa.sa_flags = SA_SIGINFO;
+        sa.sa_sigaction = handler;
+        if (sigaction(testSig, &sa, NULL) == -1 ||
+                sigaction(endSig, &sa, NULL) == -1 ||
+                sigaction(SIGINT, &sa, NULL) == -1 ||
+                sigaction(SIGTERM, &sa, NULL) == -1)
+            errExit("sigaction");
+    } else if (method == M_SIGNALFD) {
+        sfd = signalfd(-1, &waitMask, SFD_CLOEXEC);
+        if (sfd == -1)
+            errExit("signalfd");
+    }
+
+    sigemptyset(&emptyMask);
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (timeoutMs % 1000) * 1000000;
+
+    for (runNum = 1; !quit; runNum++) {
+        runDone = 0;
+
+        while (!runDone && !quit) {
+            switch (method) {
+            case M_HANDLER:
+                sigsuspend(&emptyMask);
+                break;
+
+            case M_SIGWAITINFO:
+                sig = sigwaitinfo(&waitMask, &si);
+                if (sig == -1)
+                    errExit("sigwaitinfo");
+                record(sig, si.si_code, si.si_value.sival_ptr);
+                break;
+
+            case M_SIGTIMEDWAIT:
+                sig = sigtimedwait(&waitMask, &si, &timeout);
+                if (sig == -1) {
+                    if (errno != EAGAIN)
+                        errExit("sigtimedwait");
+                    if (numRecv > 0)    /* End signal not seen */
+                        printf("timed out, no end signal\n");
+                    runDone = numRecv > 0;
+                    break;
+                }
+                record(sig, si.si_code, si.si_value.sival_ptr);
+                break;
+
+            case M_SIGNALFD:
+                s = read(sfd, fdsi, sizeof(fdsi));
+                if (s == -1)
+                    errExit("read");
+                numReads++;
+                for (j = 0; j < s / (ssize_t) sizeof(fdsi[0]); j++)
+                    record(fdsi[j].ssi_signo, fdsi[j].ssi_code,
+                           (void *) (uintptr_t) fdsi[j].ssi_ptr);
+                break;
+            }
+        }
+
+        if (runDone)
+            reportRun(runNum);
+    }
+
+    if (numRecv > 0)                    /* Partial run */
+        reportRun(runNum);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,202 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 22 */
+
+/* rtsig_bench_send.c
+
+   Send a run of realtime signals to rtsig_bench_recv.c as fast as
+   possible (or at a fixed rate), and report the achieved sending rate.
+
+   Usage: rtsig_bench_send [-m method] [-s sig-offset] [-r rate] [-d]
+                           pid num-sigs
+
+        -m method       How signals are sent:
+                          kill      kill(); no data accompanies the signal,
+                                    so the receiver can't measure latency
+                          sigqueue  sigqueue() (the default)
+                          pidfd     pidfd_send_signal(), with a siginfo_t
+                                    that has si_code set to SI_QUEUE
+        -s sig-offset   Must match the receiver's -s option
+        -r rate         Send at most 'rate' signals per second
+        -d              If sending fails with EAGAIN (because the
+                        receiver's queue is full), drop the signal rather
+                        than retrying
+
+   After the run, an end signal is sent (retrying on EAGAIN) so that the
+   receiver reports its statistics.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <sched.h>
+#include "rtsig_bench.h"
+#include "tlpi_hdr.h"
+
+enum { M_KILL, M_SIGQUEUE, M_PIDFD };
+
+static const char *methodNames[] = { "kill", "sigqueue", "pidfd" };
+
+#define NMETHODS (sizeof(methodNames) / sizeof(methodNames[0]))
+
+static int method;
+static pid_t pid;
+static int pidfd;
+
+/* Send 'sig' using the selected method; return 0 on success, or -1 with
+   errno set on error */
+
+static int
+sendSig(int sig)
+{
+    union sigval sv;
+    siginfo_t si;
+
+    sv.sival_ptr = (void *) (uintptr_t) nowNs();
+
+    switch (method) {
+    case M_KILL:
+        return kill(pid, sig);
+
+    case M_SIGQUEUE:
+        return sigqueue(pid, sig, sv);
+
+    default:    /* M_PIDFD */
+#ifdef SYS_pidfd_send_signal
+        memset(&si, 0, sizeof(si));
+        si.si_signo = sig;
+        si.si_code = SI_QUEUE;
+        si.si_pid = getpid();
+        si.si_uid = getuid();
+        si.si_value = sv;
+        return syscall(SYS_pidfd_send_signal, pidfd, sig, &si, 0);
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+}
+
+static void
+usageError(const char *progName)
+{
+    int m;
+
+    fprintf(stderr, "Usage: %s [-m method] [-s sig-offset] [-r rate] [-d] "
+            "pid num-sigs\n", progName);
+    fprintf(stderr, "Methods are:");
+    for (m = 0; m < NMETHODS; m++)
+        fprintf(stderr, " %s", methodNames[m]);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int opt, testSig;
+    long numSigs, rate, j, numRetries, numDropped;
+    Boolean drop;
+    uint64_t start, next, now;
+    struct timespec ts;
+    struct rlimit rlim;
+    double secs;
+
+    method = M_SIGQUEUE;
+    testSig = DEFAULT_TEST_SIG;
+    rate = 0;
+    drop = FALSE;
+    while ((opt = getopt(argc, argv, "m:s:r:d")) != -1) {
+        switch (opt) {
+        case 'm':
+            for (method = 0; method < NMETHODS; method++)
+                if (strcmp(optarg, methodNames[method]) == 0)
+                    break;
+            if (method == NMETHODS)
+                usageError(argv[0]);
+            break;
+        case 's':
+            testSig = SIGRTMIN + getInt(optarg, GN_NONNEG, "sig-offset");
+            break;
+        case 'r':   rate = getLong(optarg, GN_GT_0, "rate");            break;
+        case 'd':   drop = TRUE;                                        break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind + 2 != argc)
+        usageError(argv[0]);
+    if (END_SIG(testSig) > SIGRTMAX)
+        cmdLineErr("sig-offset too large\n");
+
+    pid = getLong(argv[optind], GN_GT_0, "pid");
+    numSigs = getLong(argv[optind + 1], GN_GT_0, "num-sigs");
+
+    if (method == M_PIDFD) {
+#ifdef SYS_pidfd_open
+        pidfd = syscall(SYS_pidfd_open, pid, 0);
+        if (pidfd == -1)
+            errExit("pidfd_open");
+#else
+        fatal("pidfd_open() is not supported on this system");
+#endif
+    }
+
+    if (getrlimit(RLIMIT_SIGPENDING, &rlim) == -1)
+        errExit("getrlimit");
+    printf("%s: sending %ld signal(s) using %s; "
+            "RLIMIT_SIGPENDING = %lld\n", argv[0], numSigs,
+            methodNames[method], (long long) rlim.rlim_cur);
+
+    numRetries = numDropped = 0;
+    start = next = nowNs();
+    for (j = 0; j < numSigs; j++) {
+
+        /* If a rate was specified, sleep until this signal is due */
+
+        if (rate > 0) {
+            next = start + (uint64_t) (j * (1e9 / rate));
+            now = nowNs();
+            if (now < next) {
+                ts.tv_sec = next / 1000000000;
+                ts.tv_nsec = next % 1000000000;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            }
+        }
+
+        while (sendSig(testSig) == -1) {
+            if (errno != EAGAIN)
+                errExit("send");
+            if (drop) {
+                numDropped++;
+                break;
+            }
+            numRetries++;
+            sched_yield();              /* Give the receiver a chance */
+        }
+    }
+    secs = (nowNs() - start) / 1e9;
+
+    while (sendSig(END_SIG(testSig)) == -1) {
+        if (errno != EAGAIN)
+            errExit("send");
+        sched_yield();
+    }
+
+    printf("sent %ld signal(s) in %.3f secs (%.0f sigs/sec)\n",
+            numSigs - numDropped, secs, (numSigs - numDropped) / secs);
+    printf("EAGAIN (queue full): %ld retries, %ld dropped\n",
+            numRetries, numDropped);
+
+    exit(EXIT_SUCCESS);
+}
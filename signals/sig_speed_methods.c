@@ -0,0 +1,348 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 22 */
+
+/* sig_speed_methods.c
+
+   This program compares how fast signals can be received using three
+   techniques for synchronously waiting for signals:
+
+        pipe         a handler that writes a byte to a nonblocking pipe
+                     (the "self-pipe trick"; see altio/self_pipe.c), with
+                     the main loop waiting in select() on the read end
+        sigwaitinfo  the signal is blocked and accepted using sigwaitinfo()
+        signalfd     the signal is blocked and read from a signalfd, with
+                     the main loop waiting in select() on the signalfd
+
+   Usage: sig_speed_methods [-b burst] num-bursts [method...]
+
+   As in sig_speed_sigsuspend.c, the program forks to create a parent and
+   a child. The child sends 'burst' (default: 1) realtime signals to the
+   parent using sigqueue(), and then waits for an acknowledgement signal
+   from the parent, repeating this 'num-bursts' times. The parent receives
+   the signals using the method under test, and sends the acknowledgement
+   after each complete burst. Realtime signals are used so that every
+   signal is queued and none are merged; 'burst' can thus be no greater
+   than the RLIMIT_SIGPENDING limit.
+
+   With a burst size of 1, the test measures round-trip latency; with
+   larger bursts, the pipe and signalfd methods can retrieve many
+   notifications with a single read(), as a process that reaps many
+   children on SIGCHLD would do.
+
+   If no methods are specified, all are tested.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/signalfd.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include "tlpi_hdr.h"
+
+#define TESTSIG (SIGRTMIN)      /* Sent by child; queued */
+#define ACKSIG SIGUSR1          /* Sent by parent after each burst */
+#define BATCH_SIZE 64           /* Max. notifications retrieved per read() */
+
+static int pfd[2];              /* Self-pipe */
+
+static long numReads;           /* read() calls made by parent */
+
+static void
+handler(int sig)
+{
+    int savedErrno;
+
+    savedErrno = errno;
+    if (write(pfd[1], "x", 1) == -1 && errno != EAGAIN)
+        errExit("write");
+    errno = savedErrno;
+}
+
+static void
+waitReadable(int fd)
+{
+    fd_set readfds;
+
+    FD_ZERO(&readfds);
+    FD_SET(fd, &readfds);
+    while (select(fd + 1, &readfds, NULL, NULL, NULL) == -1) {
+        if (errno != EINTR)
+            errExit("select");
+        FD_SET(fd, &readfds);
+    }
+}
+
+/* Each of the following functions receives 'burst' instances of TESTSIG */
+
+static void
+recvPipe(int burst)
+{
+    char buf[BATCH_SIZE];
+    ssize_t s;
+
+    while (burst > 0) {
+        waitReadable(pfd[0]);
+        for (;;) {
+            s = read(pfd[0], buf, sizeof(buf));
+            if (s == -1) {
+                if (errno == EAGAIN || errno == EINTR)
+                    break;
+                errExit("read");
+            }
+            numReads++;
+            burst -= s;
+        }
+    }
+}
+
+static void
+recvSigwaitinfo(int burst)
+{
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, TESTSIG);
+
+    for (; burst > 0; burst--)
+        if (sigwaitinfo(&mask, NULL) == -1)
+            errExit("sigwaitinfo");
+}
+
+static int sfd;                 /* signalfd used by recvSignalfd() */
+
+static void
+recvSignalfd(int burst)
+{
+    struct signalfd_siginfo fdsi[BATCH_SIZE];
+    ssize_t s;
+
+    while (burst > 0) {
+        waitReadable(sfd);
+        for (;;) {
+            s = read(sfd, fdsi, sizeof(fdsi));
+            if (s == -1) {
+                if (errno == EAGAIN)
+                    break;
+                errExit("read");
+            }
+            numReads++;
+            burst -= s / sizeof(struct signalfd_siginfo);
+        }
+    }
+}
+
+/* Prepare the parent to receive TESTSIG using each method */
+
+static void
+setupPipe(void)
+{
+    struct sigaction sa;
+    sigset_t mask;
+
+    if (pipe2(pfd, O_NONBLOCK | O_CLOEXEC) == -1)
+        errExit("pipe2");
+
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sa.sa_handler = handler;
+    if (sigaction(TESTSIG, &sa, NULL) == -1)
+        errExit("sigaction");
+
+    /* The handler can't be invoked until the signal is unblocked, which
+       happens only after fork() (see test()) */
+
+    sigemptyset(&mask);
+    sigaddset(&mask, TESTSIG);
+    if (sigprocmask(SIG_UNBLOCK, &mask, NULL) == -1)
+        errExit("sigprocmask");
+}
+
+static void
+setupSigwaitinfo(void)
+{
+}
+
+static void
+setupSignalfd(void)
+{
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, TESTSIG);
+    sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sfd == -1)
+        errExit("signalfd");
+}
+
+static struct {
+    const char *name;
+    void (*setup)(void);
+    void (*recv)(int burst);
+} methods[] = {
+    { "pipe",           setupPipe,              recvPipe },
+    { "sigwaitinfo",    setupSigwaitinfo,       recvSigwaitinfo },
+    { "signalfd",       setupSignalfd,          recvSignalfd },
+};
+
+#define NMETHODS (sizeof(methods) / sizeof(methods[0]))
+
+static double
+timeDiff(const struct timeval *start, const struct timeval *end)
+{
+    return (end->tv_sec - start->tv_sec) +
+           (end->tv_usec - start->tv_usec) / 1e6;
+}
+
+/* Run one test in a separate process, so that each method starts with
+   default signal dispositions and no leftover file descriptors */
+
+static void
+test(int m, int numBursts, int burst)
+{
+    pid_t parentPid, childPid;
+    sigset_t blockMask, ackMask;
+    union sigval sv;
+    struct timeval start, end;
+    double secs;
+    int b, j, status;
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+    case 0:
+        break;
+    default:
+        if (wait(&status) == -1)
+            errExit("wait");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fatal("test of method '%s' failed", methods[m].name);
+        return;
+    }
+
+    /* Block both signals before fork(), so that the child can't send
+       them before the parent is ready (see sig_speed_sigsuspend.c) */
+
+    sigemptyset(&blockMask);
+    sigaddset(&blockMask, TESTSIG);
+    sigaddset(&blockMask, ACKSIG);
+    if (sigprocmask(SIG_BLOCK, &blockMask, NULL) == -1)
+        errExit("sigprocmask");
+
+    sigemptyset(&ackMask);
+    sigaddset(&ackMask, ACKSIG);
+
+    parentPid = getpid();
+    numReads = 0;
+
+    switch (childPid = fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0:     /* child */
+        sv.sival_int = 0;
+        for (b = 0; b < numBursts; b++) {
+            for (j = 0; j < burst; j++)
+                if (sigqueue(parentPid, TESTSIG, sv) == -1)
+                    errExit("sigqueue");
+            if (sigwaitinfo(&ackMask, NULL) == -1)
+                errExit("sigwaitinfo");
+        }
+        _exit(EXIT_SUCCESS);
+
+    default:    /* parent */
+        methods[m].setup();
+
+        gettimeofday(&start, NULL);
+        for (b = 0; b < numBursts; b++) {
+            methods[m].recv(burst);
+            if (kill(childPid, ACKSIG) == -1)
+                errExit("kill");
+        }
+        gettimeofday(&end, NULL);
+
+        if (waitpid(childPid, NULL, 0) == -1)
+            errExit("waitpid");
+
+        secs = timeDiff(&start, &end);
+        printf("%-12s %10.3f %12.0f %10.3f", methods[m].name, secs,
+                numBursts * (double) burst / secs,
+                secs * 1e6 / ((double) numBursts * burst));
+        if (numReads > 0)
+            printf(" %10.2f", (double) numBursts * burst / numReads);
+        else
+            printf(" %10s", "-");
+        printf("\n");
+        exit(EXIT_SUCCESS);
+    }
+}
+
+static void
+usageError(const char *progName)
+{
+    int m;
+
+    fprintf(stderr, "Usage: %s [-b burst] num-bursts [method...]\n",
+            progName);
+    fprintf(stderr, "Methods are:");
+    for (m = 0; m < NMETHODS; m++)
+        fprintf(stderr, " %s", methods[m].name);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int opt, burst, numBursts, m, j;
+
+    burst = 1;
+    while ((opt = getopt(argc, argv, "b:")) != -1) {
+        switch (opt) {
+        case 'b':   burst = getInt(optarg, GN_GT_0, "burst");   break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind >= argc)
+        usageError(argv[0]);
+    numBursts = getInt(argv[optind], GN_GT_0, "num-bursts");
+
+    for (j = optind + 1; j < argc; j++) {
+        for (m = 0; m < NMETHODS; m++)
+            if (strcmp(argv[j], methods[m].name) == 0)
+                break;
+        if (m == NMETHODS)
+            usageError(argv[0]);
+    }
+
+    setbuf(stdout, NULL);
+    printf("%d bursts of %d signal(s)\n", numBursts, burst);
+    printf("%-12s %10s %12s %10s %10s\n", "method", "secs", "sigs/sec",
+            "usec/sig", "sigs/read");
+
+    if (optind + 1 == argc) {
+        for (m = 0; m < NMETHODS; m++)
+            test(m, numBursts, burst);
+    } else {
+        for (j = optind + 1; j < argc; j++) {
+            for (m = 0; m < NMETHODS; m++)
+                if (strcmp(argv[j], methods[m].name) == 0)
+                    break;
+            test(m, numBursts, burst);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
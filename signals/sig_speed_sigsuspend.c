@@ -19,7 +19,7 @@
    the signal with a handler, and waits for signals to arrive using
    sigsuspend().
 
-   Usage: $ time ./sig_speed_sigsuspend num-sigs
+   Usage: $ time ./sig_speed_sigsuspend [-l] [-t transport] num-sigs
 
    The 'num-sigs' argument specifies how many times the parent and
    child send signals to each other.
@@ -30,8 +30,47 @@
        send signal to parent                  wait for signal from child
        wait for a signal from parent          send a signal to child
    }                                      }
+
+   For comparison, the '-t' option selects a different mechanism
+   ("transport") with which the two processes wake each other:
+
+        signal      kill() and sigsuspend(), as described above (the
+                    default)
+        futex       a futex word in shared anonymous memory for each
+                    direction, set and woken with FUTEX_WAKE, and waited
+                    on with FUTEX_WAIT (Linux only)
+        eventfd     an eventfd for each direction (Linux only)
+        pipe        a pipe for each direction
+        socketpair  a UNIX domain stream socket pair
+        sem         a POSIX unnamed semaphore for each direction, in shared
+                    anonymous memory
+        all         each of the above in turn (implies -l)
+
+   The '-l' option causes the parent to time each round trip (from
+   waking the child until it is woken in turn) and to print the mean and
+   percentiles of the round-trip latency.
+
+   The '-B' option instead measures the cost per round trip of each
+   selected transport using the bench.c harness, which repeats the whole
+   test (including the creation of the two processes) several times and
+   reports the median and percentiles of the repetitions in the same
+   format as the other benchmark programs. This is the form used by
+   "make bench".
 */
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+#endif
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <semaphore.h>
 #include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include "bench.h"
 #include "tlpi_hdr.h"
 
 static void
@@ -41,18 +80,41 @@ handler(int sig)
 
 #define TESTSIG SIGUSR1
 
-int
-main(int argc, char *argv[])
+/* Wakeup channels: each transport provides one channel in each direction */
+
+#define TO_PARENT 0
+#define TO_CHILD  1
+
+static pid_t peerPid[2];                /* Process to signal on each channel */
+static sigset_t emptyMask;
+
+static int readFd[2], writeFd[2];       /* For fd-based transports */
+static size_t msgSize;                  /* Bytes read/written per wakeup */
+
+static uint32_t *futexWord;             /* Shared futex words */
+static sem_t *sems;                     /* Shared semaphores */
+
+/* Allocate a shared anonymous mapping (inherited by the child) */
+
+static void *
+sharedAlloc(size_t size)
 {
-    int numSigs, scnt;
-    pid_t childPid;
-    sigset_t blockedMask, emptyMask;
-    struct sigaction sa;
+    void *addr;
 
-    if (argc != 2 || strcmp(argv[1], "--help") == 0)
-        usageErr("%s num-sigs\n", argv[0]);
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+        errExit("mmap");
+    return addr;
+}
+
+/* "signal" transport */
 
-    numSigs = getInt(argv[1], GN_GT_0, "num-sigs");
+static void
+signalSetup(void)
+{
+    struct sigaction sa;
+    sigset_t blockedMask;
 
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = 0;
@@ -69,26 +131,349 @@ main(int argc, char *argv[])
         errExit("sigprocmask");
 
     sigemptyset(&emptyMask);
+}
+
+static void
+signalPost(int ch)
+{
+    if (kill(peerPid[ch], TESTSIG) == -1)
+        errExit("kill");
+}
+
+static void
+signalWait(int ch)
+{
+    if (sigsuspend(&emptyMask) == -1 && errno != EINTR)
+        errExit("sigsuspend");
+}
+
+#if defined(__linux__)
+
+/* "futex" transport. The waker sets the word to 1 and wakes any waiter;
+   the waiter atomically resets the word to 0, and sleeps only if it was
+   already 0. The futex words are shared between processes, so the
+   (non-private) FUTEX_WAIT and FUTEX_WAKE operations must be used. */
+
+static void
+futexSetup(void)
+{
+    futexWord = sharedAlloc(2 * sizeof(uint32_t));
+}
+
+static void
+futexPost(int ch)
+{
+    __atomic_store_n(&futexWord[ch], 1, __ATOMIC_RELEASE);
+    if (syscall(SYS_futex, &futexWord[ch], FUTEX_WAKE, 1,
+                NULL, NULL, 0) == -1)
+        errExit("futex-FUTEX_WAKE");
+}
+
+static void
+futexWait(int ch)
+{
+    while (__atomic_exchange_n(&futexWord[ch], 0, __ATOMIC_ACQUIRE) == 0)
+        if (syscall(SYS_futex, &futexWord[ch], FUTEX_WAIT, 0,
+                    NULL, NULL, 0) == -1 && errno != EAGAIN && errno != EINTR)
+            errExit("futex-FUTEX_WAIT");
+}
+
+/* "eventfd" transport */
+
+static void
+eventfdSetup(void)
+{
+    int ch;
+
+    for (ch = 0; ch < 2; ch++) {
+        readFd[ch] = writeFd[ch] = eventfd(0, 0);
+        if (readFd[ch] == -1)
+            errExit("eventfd");
+    }
+    msgSize = sizeof(uint64_t);
+}
+
+#endif
+
+/* "pipe" transport */
+
+static void
+pipeSetup(void)
+{
+    int pfd[2], ch;
+
+    for (ch = 0; ch < 2; ch++) {
+        if (pipe(pfd) == -1)
+            errExit("pipe");
+        readFd[ch] = pfd[0];
+        writeFd[ch] = pfd[1];
+    }
+    msgSize = 1;
+}
+
+/* "socketpair" transport: the parent uses sv[0] and the child sv[1] */
+
+static void
+socketpairSetup(void)
+{
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+        errExit("socketpair");
+    writeFd[TO_CHILD] = readFd[TO_PARENT] = sv[0];
+    writeFd[TO_PARENT] = readFd[TO_CHILD] = sv[1];
+    msgSize = 1;
+}
+
+/* Post and wait operations for all of the fd-based transports */
+
+static void
+fdPost(int ch)
+{
+    uint64_t val = 1;                   /* An eventfd needs 8 bytes */
+
+    if (write(writeFd[ch], &val, msgSize) != msgSize)
+        errExit("write");
+}
+
+static void
+fdWait(int ch)
+{
+    uint64_t val;
+
+    if (read(readFd[ch], &val, msgSize) != msgSize)
+        errExit("read");
+}
+
+/* "sem" transport */
+
+static void
+semSetup(void)
+{
+    int ch;
+
+    sems = sharedAlloc(2 * sizeof(sem_t));
+    for (ch = 0; ch < 2; ch++)
+        if (sem_init(&sems[ch], 1, 0) == -1)
+            errExit("sem_init");
+}
+
+static void
+semPost(int ch)
+{
+    if (sem_post(&sems[ch]) == -1)
+        errExit("sem_post");
+}
+
+static void
+semWait(int ch)
+{
+    while (sem_wait(&sems[ch]) == -1)
+        if (errno != EINTR)
+            errExit("sem_wait");
+}
+
+static struct {
+    const char *name;
+    void (*setup)(void);                /* Called before fork() */
+    void (*post)(int ch);               /* Wake the peer on channel 'ch' */
+    void (*wait)(int ch);               /* Wait for wakeup on channel 'ch' */
+} transports[] = {
+    { "signal",         signalSetup,            signalPost,     signalWait },
+#if defined(__linux__)
+    { "futex",          futexSetup,             futexPost,      futexWait },
+    { "eventfd",        eventfdSetup,           fdPost,         fdWait },
+#endif
+    { "pipe",           pipeSetup,              fdPost,         fdWait },
+    { "socketpair",     socketpairSetup,        fdPost,         fdWait },
+    { "sem",            semSetup,               semPost,        semWait },
+};
+
+#define NTRANSPORTS (sizeof(transports) / sizeof(transports[0]))
+
+static uint64_t
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+cmpSample(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Perform 'numSigs' round trips using transport 't' in a new pair of
+   processes. If 'showLatency' is true, the parent times each round trip
+   and prints statistics. */
+
+static void
+runTest(int t, int numSigs, Boolean showLatency)
+{
+    int scnt, status;
+    pid_t childPid;
+    uint64_t *samples, start, lastPost, now;
+    long n;
+
+    switch (fork()) {           /* Isolate each test in its own process */
+    case -1:
+        errExit("fork");
+    case 0:
+        break;
+    default:
+        if (wait(&status) == -1)
+            errExit("wait");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fatal("%s test failed", transports[t].name);
+        return;
+    }
+
+    samples = NULL;
+    if (showLatency) {
+        samples = malloc(numSigs * sizeof(uint64_t));
+        if (samples == NULL)
+            errExit("malloc");
+    }
+
+    transports[t].setup();
+    peerPid[TO_PARENT] = getpid();
 
     switch (childPid = fork()) {
     case -1: errExit("fork");
 
     case 0:     /* child */
         for (scnt = 0; scnt < numSigs; scnt++) {
-            if (kill(getppid(), TESTSIG) == -1)
-                errExit("kill");
-            if (sigsuspend(&emptyMask) == -1 && errno != EINTR)
-                    errExit("sigsuspend");
+            transports[t].post(TO_PARENT);
+            transports[t].wait(TO_CHILD);
         }
-        exit(EXIT_SUCCESS);
+        _exit(EXIT_SUCCESS);
 
     default: /* parent */
+        peerPid[TO_CHILD] = childPid;
+
+        /* Each sample is the time from waking the child until the child
+           wakes us in turn; the first wakeup (from the child) starts the
+           clock, so there are numSigs - 1 samples */
+
+        n = 0;
+        start = lastPost = 0;
         for (scnt = 0; scnt < numSigs; scnt++) {
-            if (sigsuspend(&emptyMask) == -1 && errno != EINTR)
-                    errExit("sigsuspend");
-            if (kill(childPid, TESTSIG) == -1)
-                errExit("kill");
+            transports[t].wait(TO_PARENT);
+            if (showLatency) {
+                now = nowNs();
+                if (scnt == 0)
+                    start = now;
+                else
+                    samples[n++] = now - lastPost;
+                lastPost = nowNs();
+            }
+            transports[t].post(TO_CHILD);
+        }
+
+        if (waitpid(childPid, NULL, 0) == -1)
+            errExit("waitpid");
+
+        if (showLatency) {
+            now = nowNs();
+            printf("%-12s %10.3f", transports[t].name, (now - start) / 1e9);
+            if (n > 0) {
+                qsort(samples, n, sizeof(uint64_t), cmpSample);
+                printf(" %8.2f %8.2f %8.2f %8.2f %8.2f",
+                        (double) (now - start) / numSigs / 1e3,
+                        samples[n / 2] / 1e3, samples[n * 9 / 10] / 1e3,
+                        samples[n * 99 / 100] / 1e3, samples[n - 1] / 1e3);
+            }
+            printf("\n");
         }
         exit(EXIT_SUCCESS);
     }
 }
+
+static void
+benchTransport(long ops, void *arg)
+{
+    runTest(*(int *) arg, ops, FALSE);
+}
+
+static void
+usageError(const char *progName)
+{
+    int t;
+
+    fprintf(stderr, "Usage: %s [-B] [-l] [-t transport] num-sigs\n",
+            progName);
+    fprintf(stderr, "Transports are:");
+    for (t = 0; t < NTRANSPORTS; t++)
+        fprintf(stderr, " %s", transports[t].name);
+    fprintf(stderr, " all\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int numSigs, opt, t;
+    const char *transport;
+    Boolean showLatency, bench;
+    struct benchResult res;
+    char name[64];
+
+    transport = "signal";
+    showLatency = FALSE;
+    bench = FALSE;
+    while ((opt = getopt(argc, argv, "Blt:")) != -1) {
+        switch (opt) {
+        case 'B':   bench = TRUE;               break;
+        case 'l':   showLatency = TRUE;         break;
+        case 't':   transport = optarg;         break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc || strcmp(argv[optind], "--help") == 0)
+        usageError(argv[0]);
+
+    numSigs = getInt(argv[optind], GN_GT_0, "num-sigs");
+
+    if (strcmp(transport, "all") == 0) {
+        showLatency = TRUE;
+    } else {
+        for (t = 0; t < NTRANSPORTS; t++)
+            if (strcmp(transport, transports[t].name) == 0)
+                break;
+        if (t == NTRANSPORTS)
+            usageError(argv[0]);
+    }
+
+    if (bench) {
+        for (t = 0; t < NTRANSPORTS; t++) {
+            if (strcmp(transport, "all") != 0 &&
+                    strcmp(transport, transports[t].name) != 0)
+                continue;
+            snprintf(name, sizeof(name), "sig_speed_sigsuspend: %s",
+                     transports[t].name);
+            if (benchRun(name, benchTransport, &t, numSigs, NULL, &res) == -1)
+                errExit("benchRun");
+            benchReport(&res);
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    setbuf(stdout, NULL);
+    if (showLatency)
+        printf("%-12s %10s %8s %8s %8s %8s %8s\n", "transport", "secs",
+                "mean-us", "p50-us", "p90-us", "p99-us", "max-us");
+
+    for (t = 0; t < NTRANSPORTS; t++)
+        if (strcmp(transport, "all") == 0 ||
+                strcmp(transport, transports[t].name) == 0)
+            runTest(t, numSigs, showLatency);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,212 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* file_xfer.c
+
+   Implementation of fileXfer(), which transfers data from one file
+   descriptor to another using the cheapest mechanism available.
+
+   The sendfile() system call transfers data from a file to a socket (or,
+   since Linux 2.6.33, to any file) entirely within the kernel, but it
+   requires that the input file support mmap()-like operations (in
+   practice, a regular file). If the input is some other kind of file (for
+   example, a pipe, a socket, or a character device), we instead use
+   splice() to move the data via a pipe, which also avoids copying the data
+   through user space. Only if neither of these works do we fall back to
+   read() and write() through a buffer (which is what the implementation of
+   sendfile() in sendfile.c does).
+*/
+#define _GNU_SOURCE
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include "file_xfer.h"
+
+#define CHUNK_SIZE (1024 * 1024)        /* Max. bytes per system call */
+#define BUF_SIZE 65536                  /* Buffer size for FX_RDWR */
+
+static int
+isFallbackErrno(int err)        /* Does 'err' mean "method not supported"? */
+{
+    return err == EINVAL || err == ENOSYS || err == EOPNOTSUPP;
+}
+
+static size_t
+chunk(size_t count, size_t max)
+{
+    return (count < max) ? count : max;
+}
+
+/* Each of the following functions transfers up to 'count' bytes from
+   'inFd' to 'outFd', stopping early only at end of input, and stores the
+   number of bytes transferred in '*tot'. On error, -1 is returned. */
+
+static int
+xferSendfile(int outFd, int inFd, size_t count, size_t *tot)
+{
+    ssize_t s;
+
+    while (*tot < count) {
+        s = sendfile(outFd, inFd, NULL, chunk(count - *tot, CHUNK_SIZE));
+        if (s == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (s == 0)                     /* EOF */
+            break;
+        *tot += s;
+    }
+    return 0;
+}
+
+static int
+xferSplice(int outFd, int inFd, size_t count, size_t *tot)
+{
+    int pfd[2], savedErrno;
+    ssize_t inPipe, s;
+
+    if (pipe(pfd) == -1)
+        return -1;
+
+    /* Since Linux 2.6.35, it is possible to enlarge the pipe
+       buffer, so that each pair of splice() calls moves more data */
+
+#ifdef F_SETPIPE_SZ
+    fcntl(pfd[1], F_SETPIPE_SZ, CHUNK_SIZE);    /* Failure is harmless */
+#endif
+
+    while (*tot < count) {
+
+        /* Move data from the input into the pipe */
+
+        inPipe = splice(inFd, NULL, pfd[1], NULL,
+                        chunk(count - *tot, CHUNK_SIZE),
+                        SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (inPipe == -1) {
+            if (errno == EINTR)
+                continue;
+            goto fail;
+        }
+        if (inPipe == 0)                /* EOF */
+            break;
+
+        /* Drain the pipe into the output */
+
+        while (inPipe > 0) {
+            s = splice(pfd[0], NULL, outFd, NULL, inPipe,
+                       SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (s == -1) {
+                if (errno == EINTR)
+                    continue;
+                goto fail;
+            }
+            inPipe -= s;
+            *tot += s;
+        }
+    }
+
+    close(pfd[0]);
+    close(pfd[1]);
+    return 0;
+
+fail:
+    savedErrno = errno;
+    close(pfd[0]);
+    close(pfd[1]);
+    errno = savedErrno;
+    return -1;
+}
+
+static int
+xferRdwr(int outFd, int inFd, size_t count, size_t *tot)
+{
+    char buf[BUF_SIZE];
+    ssize_t numRead, numWritten, off;
+
+    while (*tot < count) {
+        numRead = read(inFd, buf, chunk(count - *tot, BUF_SIZE));
+        if (numRead == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (numRead == 0)               /* EOF */
+            break;
+
+        for (off = 0; off < numRead; off += numWritten) {
+            numWritten = write(outFd, buf + off, numRead - off);
+            if (numWritten == -1) {
+                if (errno == EINTR) {
+                    numWritten = 0;
+                    continue;
+                }
+                return -1;
+            }
+            *tot += numWritten;
+        }
+    }
+    return 0;
+}
+
+/* Transfer up to 'count' bytes from 'inFd' (starting at its current file
+   offset) to 'outFd', stopping early only at end of input. 'method' is
+   one of the FX_* constants. If it is FX_AUTO, then the methods are tried
+   in the order sendfile(), splice(), read()/write(), with a later method
+   being used only if an earlier method fails with an error indicating
+   that it doesn't support the given file descriptors (and has not yet
+   transferred any data). If 'usedMethod' is not NULL, the method that
+   was actually used is returned there.
+
+   Returns the number of bytes transferred, or -1 on error. */
+
+ssize_t
+fileXfer(int outFd, int inFd, size_t count, int method, int *usedMethod)
+{
+    size_t tot;
+    int m, s;
+
+    tot = 0;
+    s = -1;
+    for (m = (method == FX_AUTO) ? FX_SENDFILE : method; ; m++) {
+        switch (m) {
+        case FX_SENDFILE:   s = xferSendfile(outFd, inFd, count, &tot); break;
+        case FX_SPLICE:     s = xferSplice(outFd, inFd, count, &tot);   break;
+        case FX_RDWR:       s = xferRdwr(outFd, inFd, count, &tot);     break;
+        default:            errno = EINVAL;                             return -1;
+        }
+
+        if (s == 0 || method != FX_AUTO || m == FX_RDWR || tot > 0 ||
+                !isFallbackErrno(errno))
+            break;
+    }
+
+    if (usedMethod != NULL)
+        *usedMethod = m;
+
+    return (s == -1) ? -1 : (ssize_t) tot;
+}
+
+/* Return a printable name for one of the FX_* constants */
+
+const char *
+fileXferMethodName(int method)
+{
+    switch (method) {
+    case FX_AUTO:       return "auto";
+    case FX_SENDFILE:   return "sendfile";
+    case FX_SPLICE:     return "splice";
+    case FX_RDWR:       return "read/write";
+    default:            return "?";
+    }
+}
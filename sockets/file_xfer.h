@@ -0,0 +1,36 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* file_xfer.h
+
+   Header file for file_xfer.c.
+*/
+#ifndef FILE_XFER_H
+#define FILE_XFER_H             /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+
+/* Values for the 'method' argument of fileXfer() */
+
+#define FX_AUTO     0           /* Try FX_SENDFILE, then FX_SPLICE, then
+                                   FX_RDWR */
+#define FX_SENDFILE 1           /* Kernel sendfile() */
+#define FX_SPLICE   2           /* splice() via an intermediate pipe */
+#define FX_RDWR     3           /* read() + write() through a user-space
+                                   buffer */
+
+ssize_t fileXfer(int outFd, int inFd, size_t count, int method,
+                 int *usedMethod);
+
+const char *fileXferMethodName(int method);
+
+#endif
@@ -0,0 +1,176 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 60 */
+
+/* id_echo_mmsg_cl.c
+
+   A load generator for the UDP "echo" service (see id_echo_sv.c and
+   id_echo_mmsg_sv.c). The program repeatedly sends a batch of datagrams
+   to the server using a single sendmmsg() call, and then collects the
+   replies using recvmmsg().
+
+   Usage: id_echo_mmsg_cl [-b batch] [-l len] [-t secs] [-s service] host
+
+        -b batch     Number of datagrams sent per sendmmsg() call
+                     (default: 64; maximum: 1024)
+        -l len       Size of each datagram (default: 64 bytes)
+        -t secs      Duration of test (default: 10 seconds)
+        -s service   Use 'service' instead of SERVICE from id_echo.h
+
+   Replies that have not arrived within 100 milliseconds of sending a
+   batch are counted as lost. Once per second, the program displays the
+   number of datagrams sent and received per second; at the end of the
+   test, it displays totals.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <time.h>
+#include "id_echo.h"
+
+#define MAX_BATCH 1024
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-b batch] [-l len] [-t secs] [-s service] "
+                    "host\n", progName);
+    fprintf(stderr, "    -b batch     Datagrams per system call "
+                    "(default: 64)\n");
+    fprintf(stderr, "    -l len       Datagram size (default: 64)\n");
+    fprintf(stderr, "    -t secs      Duration of test (default: 10)\n");
+    fprintf(stderr, "    -s service   Service to connect to "
+                    "(default: \"%s\")\n", SERVICE);
+    exit(EXIT_FAILURE);
+}
+
+static double           /* Return difference in seconds: 'b' - 'a' */
+tsDiff(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct mmsghdr *smsgs, *rmsgs;
+    struct iovec siov, *riovs;
+    struct timeval tv;
+    struct timespec start, last, now;
+    const char *service;
+    char *sbuf, *rbufs;
+    int sfd, opt, batch, len, duration, j, n, got;
+    unsigned long sent, rcvd, totSent, totRcvd;
+    double secs;
+
+    batch = 64;
+    len = 64;
+    duration = 10;
+    service = SERVICE;
+    while ((opt = getopt(argc, argv, "b:l:t:s:")) != -1) {
+        switch (opt) {
+        case 'b':   batch = getInt(optarg, GN_GT_0, "batch");       break;
+        case 'l':   len = getInt(optarg, GN_GT_0, "len");           break;
+        case 't':   duration = getInt(optarg, GN_GT_0, "secs");     break;
+        case 's':   service = optarg;                               break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind >= argc || batch > MAX_BATCH || len > BUF_SIZE)
+        usageError(argv[0]);
+
+    sfd = inetConnect(argv[optind], service, SOCK_DGRAM);
+    if (sfd == -1)
+        fatal("Could not connect to server socket");
+
+    tv.tv_sec = 0;
+    tv.tv_usec = 100000;
+    if (setsockopt(sfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1)
+        errExit("setsockopt-SO_RCVTIMEO");
+
+    /* Since the socket is connected, the messages need no addresses.
+       All outgoing messages share a single data buffer. */
+
+    sbuf = malloc(len);
+    smsgs = calloc(batch, sizeof(struct mmsghdr));
+    rmsgs = calloc(batch, sizeof(struct mmsghdr));
+    riovs = calloc(batch, sizeof(struct iovec));
+    rbufs = malloc(batch * BUF_SIZE);
+    if (sbuf == NULL || smsgs == NULL || rmsgs == NULL || riovs == NULL ||
+            rbufs == NULL)
+        errExit("malloc");
+
+    memset(sbuf, 'x', len);
+    siov.iov_base = sbuf;
+    siov.iov_len = len;
+    for (j = 0; j < batch; j++) {
+        smsgs[j].msg_hdr.msg_iov = &siov;
+        smsgs[j].msg_hdr.msg_iovlen = 1;
+        riovs[j].iov_base = rbufs + j * BUF_SIZE;
+        riovs[j].iov_len = BUF_SIZE;
+        rmsgs[j].msg_hdr.msg_iov = &riovs[j];
+        rmsgs[j].msg_hdr.msg_iovlen = 1;
+    }
+
+    sent = rcvd = totSent = totRcvd = 0;
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+    last = start;
+
+    for (;;) {
+        n = sendmmsg(sfd, smsgs, batch, 0);
+        if (n == -1) {
+            if (errno != EINTR && errno != ECONNREFUSED)
+                errExit("sendmmsg");
+            n = 0;
+        }
+        sent += n;
+
+        /* Collect replies until we have one for each datagram that was
+           sent, or we time out */
+
+        for (got = 0; got < n; ) {
+            j = recvmmsg(sfd, rmsgs, n - got, MSG_WAITFORONE, NULL);
+            if (j == -1) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == ECONNREFUSED)
+                    break;              /* Timed out, or no server */
+                errExit("recvmmsg");
+            }
+            got += j;
+        }
+        rcvd += got;
+
+        if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+            errExit("clock_gettime");
+        secs = tsDiff(&last, &now);
+        if (secs >= 1.0) {
+            printf("sent %.0f/s; received %.0f/s\n", sent / secs, rcvd / secs);
+            totSent += sent;
+            totRcvd += rcvd;
+            sent = rcvd = 0;
+            last = now;
+            if (tsDiff(&start, &now) >= duration)
+                break;
+        }
+    }
+
+    secs = tsDiff(&start, &now);
+    printf("Total: sent %lu, received %lu (%.2f%% lost) in %.2f s; "
+            "%.0f round trips/s\n", totSent, totRcvd,
+            totSent ? 100.0 * (totSent - totRcvd) / totSent : 0.0,
+            secs, totRcvd / secs);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,248 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 60 */
+
+/* id_echo_mmsg_sv.c
+
+   A version of the UDP "echo" server (id_echo_sv.c) that receives and
+   replies to batches of datagrams, using recvmmsg() and sendmmsg(), so
+   that many datagrams are processed by each system call.
+
+   Usage: id_echo_mmsg_sv [-b batch] [-g] [-s service]
+
+        -b batch     Maximum number of datagrams per recvmmsg() and
+                     sendmmsg() call (default: 64; maximum: 1024)
+        -g           Enable UDP generic receive offload (UDP_GRO, Linux
+                     5.0 and later). The kernel may then coalesce several
+                     datagrams from the same sender into one large buffer;
+                     a coalesced buffer is echoed using UDP segmentation
+                     offload (UDP_SEGMENT), so that the sender still sees
+                     one reply per datagram.
+        -s service   Use 'service' instead of SERVICE from id_echo.h
+
+   Unlike id_echo_sv.c, this program does not become a daemon. Instead, it
+   remains in the foreground and, once per second (while there is
+   traffic), displays the number of datagrams echoed per second and the
+   average number of datagrams handled per recvmmsg() call.
+
+   All of the message headers, I/O vectors, address buffers, and data
+   buffers are allocated once, at program start-up.
+
+   See id_echo_mmsg_cl.c for a corresponding load generator.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <time.h>
+#include <stdint.h>
+#include "id_echo.h"
+
+#ifndef UDP_SEGMENT                     /* Defined in glibc 2.29 and later */
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+#define MAX_BATCH 1024
+#define GRO_BUF_SIZE 65536              /* Largest coalesced GRO buffer */
+
+union ctlBuf {                  /* Ancillary data for one message */
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;       /* Ensure suitable alignment */
+};
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-b batch] [-g] [-s service]\n", progName);
+    fprintf(stderr, "    -b batch     Datagrams per system call "
+                    "(default: 64)\n");
+    fprintf(stderr, "    -g           Use UDP GRO/GSO\n");
+    fprintf(stderr, "    -s service   Service to bind to (default: \"%s\")\n",
+                    SERVICE);
+    exit(EXIT_FAILURE);
+}
+
+/* If 'msg' contains a UDP_GRO control message, return the segment size
+   that it describes; otherwise return 0 */
+
+static int
+groSegSize(struct msghdr *msg)
+{
+    struct cmsghdr *cmsg;
+    int segSize;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+            cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            memcpy(&segSize, CMSG_DATA(cmsg), sizeof(int));
+            return segSize;
+        }
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    struct sockaddr_storage *addrs;
+    union ctlBuf *ctls;
+    struct timeval tv;
+    struct timespec last, now;
+    struct cmsghdr *cmsg;
+    size_t bufSize;
+    char *bufs;
+    const char *service;
+    int sfd, opt, batch, useGro, j, n, sent, segSize, optval;
+    uint16_t gsoSize;
+    unsigned long dgrams, calls;
+    double secs;
+
+    batch = 64;
+    useGro = 0;
+    service = SERVICE;
+    while ((opt = getopt(argc, argv, "b:gs:")) != -1) {
+        switch (opt) {
+        case 'b':   batch = getInt(optarg, GN_GT_0, "batch");   break;
+        case 'g':   useGro = 1;                                 break;
+        case 's':   service = optarg;                           break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (batch > MAX_BATCH)
+        usageError(argv[0]);
+
+    sfd = inetBind(service, SOCK_DGRAM, NULL);
+    if (sfd == -1)
+        errExit("inetBind");
+
+    if (useGro) {
+        optval = 1;
+        if (setsockopt(sfd, IPPROTO_UDP, UDP_GRO, &optval,
+                    sizeof(optval)) == -1)
+            errExit("setsockopt-UDP_GRO");
+    }
+
+    /* Time out recvmmsg() once per second, so that we can display
+       statistics even when traffic stops */
+
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    if (setsockopt(sfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1)
+        errExit("setsockopt-SO_RCVTIMEO");
+
+    /* Preallocate all per-message structures */
+
+    bufSize = useGro ? GRO_BUF_SIZE : BUF_SIZE;
+    msgs = calloc(batch, sizeof(struct mmsghdr));
+    iovs = calloc(batch, sizeof(struct iovec));
+    addrs = calloc(batch, sizeof(struct sockaddr_storage));
+    ctls = calloc(batch, sizeof(union ctlBuf));
+    bufs = malloc(batch * bufSize);
+    if (msgs == NULL || iovs == NULL || addrs == NULL || ctls == NULL ||
+            bufs == NULL)
+        errExit("malloc");
+
+    for (j = 0; j < batch; j++) {
+        iovs[j].iov_base = bufs + j * bufSize;
+        msgs[j].msg_hdr.msg_iov = &iovs[j];
+        msgs[j].msg_hdr.msg_iovlen = 1;
+        msgs[j].msg_hdr.msg_name = &addrs[j];
+    }
+
+    dgrams = calls = 0;
+    if (clock_gettime(CLOCK_MONOTONIC, &last) == -1)
+        errExit("clock_gettime");
+
+    /* Receive batches of datagrams and return copies to senders */
+
+    for (;;) {
+        for (j = 0; j < batch; j++) {
+            iovs[j].iov_len = bufSize;
+            msgs[j].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+            msgs[j].msg_hdr.msg_control = useGro ? ctls[j].buf : NULL;
+            msgs[j].msg_hdr.msg_controllen = useGro ? sizeof(ctls[j]) : 0;
+            msgs[j].msg_hdr.msg_flags = 0;
+        }
+
+        /* MSG_WAITFORONE: block until at least one datagram is
+           available, then return as many as are queued (up to 'batch') */
+
+        n = recvmmsg(sfd, msgs, batch, MSG_WAITFORONE, NULL);
+        if (n == -1 && errno != EAGAIN && errno != EINTR)
+            errExit("recvmmsg");
+
+        if (n > 0) {
+            calls++;
+
+            /* Each reply is the received data, sent back to the address
+               that it came from. If GRO coalesced several datagrams into
+               one buffer, ask the kernel to split the reply into the same
+               sized segments. */
+
+            for (j = 0; j < n; j++) {
+                iovs[j].iov_len = msgs[j].msg_len;
+
+                segSize = useGro ? groSegSize(&msgs[j].msg_hdr) : 0;
+                if (segSize > 0 && msgs[j].msg_len > segSize) {
+                    gsoSize = segSize;
+                    msgs[j].msg_hdr.msg_controllen =
+                                CMSG_SPACE(sizeof(uint16_t));
+                    cmsg = CMSG_FIRSTHDR(&msgs[j].msg_hdr);
+                    cmsg->cmsg_level = SOL_UDP;
+                    cmsg->cmsg_type = UDP_SEGMENT;
+                    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                    memcpy(CMSG_DATA(cmsg), &gsoSize, sizeof(uint16_t));
+                    dgrams += (msgs[j].msg_len + segSize - 1) / segSize;
+                } else {
+                    msgs[j].msg_hdr.msg_control = NULL;
+                    msgs[j].msg_hdr.msg_controllen = 0;
+                    dgrams++;
+                }
+            }
+
+            /* sendmmsg() may send fewer than 'n' messages; if it fails
+               on a message, report the error and skip that message */
+
+            for (sent = 0; sent < n; ) {
+                j = sendmmsg(sfd, msgs + sent, n - sent, 0);
+                if (j == -1) {
+                    if (errno == EINTR)
+                        continue;
+                    errMsg("sendmmsg");
+                    sent++;
+                } else {
+                    sent += j;
+                }
+            }
+        }
+
+        if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+            errExit("clock_gettime");
+        secs = (now.tv_sec - last.tv_sec) +
+               (now.tv_nsec - last.tv_nsec) / 1e9;
+        if (secs >= 1.0) {
+            if (calls > 0)
+                printf("%.0f datagrams/s; %.1f datagrams/recvmmsg()\n",
+                        dgrams / secs, (double) dgrams / calls);
+            fflush(stdout);
+            dgrams = calls = 0;
+            last = now;
+        }
+    }
+}
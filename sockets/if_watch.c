@@ -0,0 +1,759 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* if_watch.c
+
+   Maintain a table of the host's network interfaces (links) and their
+   addresses, using rtnetlink (see rtnetlink(7)), rather than calling
+   getifaddrs() repeatedly. Each call of getifaddrs() dumps every link
+   and every address; on a host with thousands of interfaces (e.g.,
+   the veth devices of containers), polling it is expensive, and still
+   misses changes between polls.
+
+   ifwOpen() loads the table with one RTM_GETLINK and one RTM_GETADDR
+   dump, received with a large buffer, so that each recv() returns many
+   messages. If 'flags' includes IFW_WATCH, it first subscribes (on a
+   second socket, whose receive buffer is set to 'rcvBufSize' bytes, or
+   4 MiB if 'rcvBufSize' is 0) to the link and address notifications
+   that the kernel multicasts; ifwProcess() then reads the notifications
+   that are waiting (without blocking; use poll() or epoll on ifwFd() to
+   wait for them), and applies them to the table. Because the
+   subscription precedes the dump, no change is missed; notifications
+   of changes that the dump already saw are harmless, since the table
+   ends up in the same state. If notifications were lost because the
+   receive buffer overflowed (recv() fails with ENOBUFS), or if the
+   kernel reports that a dump was interrupted by a change
+   (NLM_F_DUMP_INTR), the table is reloaded with another dump, and the
+   differences from the old table are reported as changes; ifwResync()
+   does this on request.
+
+   Each change to the table (not each notification: a notification that
+   changes nothing isn't reported) is reported by a call to the callback
+   'cb' given to ifwProcess() or ifwResync() (if it is not NULL).
+   Deleting a link deletes its addresses too, reporting each.
+
+   ifwGetLinks() and ifwGetAddrs() return a copy of the table (an array
+   allocated with malloc(), which the caller should free) and the number
+   of entries, or -1 on error. ifwLinkByIndex() returns the link with
+   the given index, or NULL; the entry may change during the next
+   ifwProcess() or ifwResync().
+
+   ifwOpen() returns a handle, or NULL on error. ifwProcess() and
+   ifwResync() return the number of changes reported, or -1 on error.
+
+   This module is Linux-specific.
+*/
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "if_watch.h"           /* Declares functions defined here */
+
+#define RECV_BUF_SIZE 65536     /* Dumps are sent in chunks of up to
+                                   32 kB */
+#define DEFAULT_RCVBUF (4 * 1024 * 1024)
+#define MAX_DUMP_TRIES 5
+
+struct linkEnt {
+    struct linkEnt *next;       /* Next in hash chain */
+    unsigned int gen;           /* Dump in which last seen */
+    int naddrs;                 /* Addresses on this link */
+    struct ifwLink l;
+};
+
+struct addrEnt {
+    struct addrEnt *next;
+    unsigned int gen;
+    struct ifwAddr a;
+};
+
+struct ifWatch {
+    int dumpFd;                 /* For dump requests */
+    int monFd;                  /* Subscribed to notifications, or -1 */
+    unsigned int seq;           /* Sequence number of last request */
+    unsigned int gen;           /* Number of current dump */
+    int dumping;                /* In a dump (marking entries with 'gen') */
+    char *buf;                  /* RECV_BUF_SIZE bytes */
+    struct linkEnt **links;     /* Hash table, keyed by index */
+    int nlinks, linkBuckets;
+    struct addrEnt **addrs;     /* Hash table, keyed by all of the address
+                                   except 'scope' and 'flags' */
+    int naddrs, addrBuckets;
+    struct ifwStats stats;
+    ifwCallback cb;             /* Callback for the current operation */
+    void *cbArg;
+};
+
+static unsigned int
+linkHash(int index)
+{
+    return index * 2654435761U;
+}
+
+/* Hash the key of an address: its index, family, prefix length and
+   address (FNV-1a) */
+
+static unsigned int
+addrHash(const struct ifwAddr *a)
+{
+    unsigned int h;
+    int j;
+
+    h = 2166136261U;
+    h = (h ^ a->index) * 16777619U;
+    h = (h ^ a->family) * 16777619U;
+    h = (h ^ a->prefixLen) * 16777619U;
+    for (j = 0; j < 16; j++)
+        h = (h ^ a->addr[j]) * 16777619U;
+    return h;
+}
+
+static int
+addrKeyEqual(const struct ifwAddr *a, const struct ifwAddr *b)
+{
+    return a->index == b->index && a->family == b->family &&
+           a->prefixLen == b->prefixLen &&
+           memcmp(a->addr, b->addr, sizeof(a->addr)) == 0;
+}
+
+static void
+report(struct ifWatch *w, int event, const struct ifwLink *l,
+       const struct ifwAddr *a)
+{
+    w->stats.changes++;
+    if (w->cb != NULL)
+        w->cb(w->cbArg, event, l, a);
+}
+
+/* Double the number of buckets in a hash table when it has more entries
+   than buckets. The chains of both tables are linked through their
+   first member ('next'). */
+
+static int
+maybeGrow(void ***table, int *nbuckets, int count,
+          unsigned int (*hash)(const void *))
+{
+    void **newTable, *e, *next;
+    int newSize, j;
+    unsigned int b;
+
+    if (count <= *nbuckets)
+        return 0;
+
+    newSize = *nbuckets * 2;
+    newTable = calloc(newSize, sizeof(void *));
+    if (newTable == NULL)
+        return -1;
+    for (j = 0; j < *nbuckets; j++) {
+        for (e = (*table)[j]; e != NULL; e = next) {
+            next = *(void **) e;
+            b = hash(e) & (newSize - 1);
+            *(void **) e = newTable[b];
+            newTable[b] = e;
+        }
+    }
+    free(*table);
+    *table = newTable;
+    *nbuckets = newSize;
+    return 0;
+}
+
+static unsigned int
+linkEntHash(const void *e)
+{
+    return linkHash(((const struct linkEnt *) e)->l.index);
+}
+
+static unsigned int
+addrEntHash(const void *e)
+{
+    return addrHash(&((const struct addrEnt *) e)->a);
+}
+
+static struct linkEnt **
+findLink(struct ifWatch *w, int index)
+{
+    struct linkEnt **lp;
+
+    lp = &w->links[linkHash(index) & (w->linkBuckets - 1)];
+    while (*lp != NULL && (*lp)->l.index != index)
+        lp = &(*lp)->next;
+    return lp;
+}
+
+static struct addrEnt **
+findAddr(struct ifWatch *w, const struct ifwAddr *a)
+{
+    struct addrEnt **ap;
+
+    ap = &w->addrs[addrHash(a) & (w->addrBuckets - 1)];
+    while (*ap != NULL && !addrKeyEqual(&(*ap)->a, a))
+        ap = &(*ap)->next;
+    return ap;
+}
+
+/* Add or update an entry. Returns 0 on success, or -1 on error. */
+
+static int
+putLink(struct ifWatch *w, const struct ifwLink *l)
+{
+    struct linkEnt **lp, *le;
+
+    lp = findLink(w, l->index);
+    le = *lp;
+    if (le == NULL) {
+        le = calloc(1, sizeof(struct linkEnt));
+        if (le == NULL)
+            return -1;
+        le->l = *l;
+        *lp = le;
+        w->nlinks++;
+        report(w, IFW_LINK_NEW, &le->l, NULL);
+        if (maybeGrow((void ***) &w->links, &w->linkBuckets, w->nlinks,
+                      linkEntHash) == -1)
+            return -1;
+    } else if (memcmp(&le->l, l, sizeof(*l)) != 0) {
+        le->l = *l;
+        report(w, IFW_LINK_NEW, &le->l, NULL);
+    }
+    if (w->dumping)
+        le->gen = w->gen;
+    return 0;
+}
+
+static int
+putAddr(struct ifWatch *w, const struct ifwAddr *a)
+{
+    struct addrEnt **ap, *ae;
+    struct linkEnt *le;
+
+    ap = findAddr(w, a);
+    ae = *ap;
+    if (ae == NULL) {
+        ae = calloc(1, sizeof(struct addrEnt));
+        if (ae == NULL)
+            return -1;
+        ae->a = *a;
+        *ap = ae;
+        w->naddrs++;
+        le = *findLink(w, a->index);
+        if (le != NULL)
+            le->naddrs++;
+        report(w, IFW_ADDR_NEW, NULL, &ae->a);
+        if (maybeGrow((void ***) &w->addrs, &w->addrBuckets, w->naddrs,
+                      addrEntHash) == -1)
+            return -1;
+    } else if (memcmp(&ae->a, a, sizeof(*a)) != 0) {
+        ae->a = *a;
+        report(w, IFW_ADDR_NEW, NULL, &ae->a);
+    }
+    if (w->dumping)
+        ae->gen = w->gen;
+    return 0;
+}
+
+static void
+unlinkAddr(struct ifWatch *w, struct addrEnt **ap)
+{
+    struct addrEnt *ae;
+    struct linkEnt *le;
+
+    ae = *ap;
+    *ap = ae->next;
+    w->naddrs--;
+    le = *findLink(w, ae->a.index);
+    if (le != NULL)
+        le->naddrs--;
+    report(w, IFW_ADDR_DEL, NULL, &ae->a);
+    free(ae);
+}
+
+static void
+delAddr(struct ifWatch *w, const struct ifwAddr *a)
+{
+    struct addrEnt **ap;
+
+    ap = findAddr(w, a);
+    if (*ap != NULL)
+        unlinkAddr(w, ap);
+}
+
+/* Delete the addresses of the link 'index' */
+
+static void
+delLinkAddrs(struct ifWatch *w, int index)
+{
+    struct addrEnt **ap;
+    int j;
+
+    for (j = 0; j < w->addrBuckets; j++) {
+        for (ap = &w->addrs[j]; *ap != NULL; ) {
+            if ((*ap)->a.index == index)
+                unlinkAddr(w, ap);
+            else
+                ap = &(*ap)->next;
+        }
+    }
+}
+
+/* Delete a link, after deleting its addresses */
+
+static void
+delLink(struct ifWatch *w, int index)
+{
+    struct linkEnt **lp, *le;
+
+    lp = findLink(w, index);
+    le = *lp;
+    if (le == NULL)
+        return;
+    if (le->naddrs > 0)
+        delLinkAddrs(w, index);
+    *lp = le->next;
+    w->nlinks--;
+    report(w, IFW_LINK_DEL, &le->l, NULL);
+    free(le);
+}
+
+/* Apply one RTM_NEWLINK, RTM_DELLINK, RTM_NEWADDR, or RTM_DELADDR
+   message (from a dump or a notification) to the table. Returns 0 on
+   success, or -1 on error. */
+
+static int
+applyMsg(struct ifWatch *w, struct nlmsghdr *nlh)
+{
+    struct ifinfomsg *ifi;
+    struct ifaddrmsg *ifa;
+    struct rtattr *rta;
+    struct ifwLink l;
+    struct ifwAddr a;
+    void *addr, *local;
+    int len, alen;
+
+    switch (nlh->nlmsg_type) {
+    case RTM_NEWLINK:
+    case RTM_DELLINK:
+        if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+            return 0;
+        ifi = NLMSG_DATA(nlh);
+        if (nlh->nlmsg_type == RTM_DELLINK) {
+            delLink(w, ifi->ifi_index);
+            return 0;
+        }
+
+        memset(&l, 0, sizeof(l));
+        l.index = ifi->ifi_index;
+        l.flags = ifi->ifi_flags;
+        l.type = ifi->ifi_type;
+        len = IFLA_PAYLOAD(nlh);
+        for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type == IFLA_IFNAME)
+                strncpy(l.name, RTA_DATA(rta), IF_NAMESIZE - 1);
+            else if (rta->rta_type == IFLA_MTU &&
+                    RTA_PAYLOAD(rta) >= sizeof(unsigned int))
+                memcpy(&l.mtu, RTA_DATA(rta), sizeof(unsigned int));
+        }
+        return putLink(w, &l);
+
+    case RTM_NEWADDR:
+    case RTM_DELADDR:
+        if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa)))
+            return 0;
+        ifa = NLMSG_DATA(nlh);
+        if (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)
+            return 0;
+
+        memset(&a, 0, sizeof(a));
+        a.index = ifa->ifa_index;
+        a.family = ifa->ifa_family;
+        a.prefixLen = ifa->ifa_prefixlen;
+        a.scope = ifa->ifa_scope;
+        a.flags = ifa->ifa_flags;
+        alen = (a.family == AF_INET) ? 4 : 16;
+
+        /* For IPv4, IFA_LOCAL is the local address, and IFA_ADDRESS
+           the peer's address (on a point-to-point link); IPv6 has just
+           IFA_ADDRESS */
+
+        addr = local = NULL;
+        len = IFA_PAYLOAD(nlh);
+        for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+            if (rta->rta_type == IFA_ADDRESS && RTA_PAYLOAD(rta) >= alen)
+                addr = RTA_DATA(rta);
+            else if (rta->rta_type == IFA_LOCAL && RTA_PAYLOAD(rta) >= alen)
+                local = RTA_DATA(rta);
+            else if (rta->rta_type == IFA_FLAGS &&
+                    RTA_PAYLOAD(rta) >= sizeof(unsigned int))
+                memcpy(&a.flags, RTA_DATA(rta), sizeof(unsigned int));
+        }
+        if (local != NULL)
+            addr = local;
+        if (addr == NULL)
+            return 0;
+        memcpy(a.addr, addr, alen);
+
+        if (nlh->nlmsg_type == RTM_DELADDR) {
+            delAddr(w, &a);
+            return 0;
+        }
+        return putAddr(w, &a);
+
+    default:
+        return 0;
+    }
+}
+
+/* Perform one dump ('type' is RTM_GETLINK or RTM_GETADDR), applying the
+   results to the table. Returns 1 if the dump was interrupted by a
+   change (and should be repeated), 0 if not, or -1 on error. */
+
+static int
+dump(struct ifWatch *w, int type)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct rtgenmsg g;
+    } req;
+    struct sockaddr_nl sa;
+    struct nlmsghdr *nlh;
+    struct nlmsgerr *err;
+    socklen_t salen;
+    ssize_t nr;
+    int len, intr;
+
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.g));
+    req.nlh.nlmsg_type = type;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nlh.nlmsg_seq = ++w->seq;
+    req.g.rtgen_family = AF_UNSPEC;
+    if (send(w->dumpFd, &req, req.nlh.nlmsg_len, 0) == -1)
+        return -1;
+
+    intr = 0;
+    for (;;) {
+        salen = sizeof(sa);
+        nr = recvfrom(w->dumpFd, w->buf, RECV_BUF_SIZE, 0,
+                      (struct sockaddr *) &sa, &salen);
+        if (nr == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (sa.nl_pid != 0)             /* Not from the kernel */
+            continue;
+
+        len = nr;
+        for (nlh = (struct nlmsghdr *) w->buf; NLMSG_OK(nlh, len);
+                nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_seq != w->seq)
+                continue;               /* Reply to an earlier request */
+            if (nlh->nlmsg_flags & NLM_F_DUMP_INTR)
+                intr = 1;
+            if (nlh->nlmsg_type == NLMSG_DONE)
+                return intr;
+            if (nlh->nlmsg_type == NLMSG_ERROR) {
+                err = NLMSG_DATA(nlh);
+                errno = (err->error < 0) ? -err->error : EPROTO;
+                return -1;
+            }
+            if (applyMsg(w, nlh) == -1)
+                return -1;
+        }
+    }
+}
+
+/* Reload the table from dumps, and remove entries that the dumps didn't
+   report. Returns the number of changes, or -1 on error. */
+
+static int
+reload(struct ifWatch *w)
+{
+    struct linkEnt **lp;
+    struct addrEnt **ap;
+    long changes;
+    int tries, s, j;
+
+    changes = w->stats.changes;
+    for (tries = 0; ; tries++) {
+        w->gen++;
+        w->dumping = 1;
+        w->stats.dumps++;
+        s = dump(w, RTM_GETLINK);
+        if (s == 0)
+            s = dump(w, RTM_GETADDR);
+        w->dumping = 0;
+        if (s == -1)
+            return -1;
+        if (s == 0 || tries + 1 >= MAX_DUMP_TRIES)
+            break;
+    }
+
+    /* Anything not seen in this dump no longer exists. Remove the
+       addresses first, so that delLink() finds none left to delete. */
+
+    for (j = 0; j < w->addrBuckets; j++) {
+        for (ap = &w->addrs[j]; *ap != NULL; ) {
+            if ((*ap)->gen != w->gen)
+                unlinkAddr(w, ap);
+            else
+                ap = &(*ap)->next;
+        }
+    }
+    for (j = 0; j < w->linkBuckets; j++) {
+        for (lp = &w->links[j]; *lp != NULL; ) {
+            if ((*lp)->gen != w->gen)
+                delLink(w, (*lp)->l.index);
+            else
+                lp = &(*lp)->next;
+        }
+    }
+
+    return w->stats.changes - changes;
+}
+
+static int
+netlinkSocket(void)
+{
+    return socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+}
+
+struct ifWatch *
+ifwOpen(int flags, int rcvBufSize)
+{
+    struct ifWatch *w;
+    struct sockaddr_nl sa;
+    int savedErrno;
+
+    w = calloc(1, sizeof(struct ifWatch));
+    if (w == NULL)
+        return NULL;
+    w->dumpFd = w->monFd = -1;
+    w->linkBuckets = w->addrBuckets = 64;
+    w->buf = malloc(RECV_BUF_SIZE);
+    w->links = calloc(w->linkBuckets, sizeof(struct linkEnt *));
+    w->addrs = calloc(w->addrBuckets, sizeof(struct addrEnt *));
+    if (w->buf == NULL || w->links == NULL || w->addrs == NULL)
+        goto fail;
+
+    w->dumpFd = netlinkSocket();
+    if (w->dumpFd == -1)
+        goto fail;
+
+    if (flags & IFW_WATCH) {
+        w->monFd = netlinkSocket();
+        if (w->monFd == -1)
+            goto fail;
+
+        /* Notifications for many interfaces can arrive in bursts; a
+           privileged process can exceed the 'rmem_max' limit */
+
+        if (rcvBufSize <= 0)
+            rcvBufSize = DEFAULT_RCVBUF;
+        if (setsockopt(w->monFd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvBufSize,
+                       sizeof(rcvBufSize)) == -1 &&
+                setsockopt(w->monFd, SOL_SOCKET, SO_RCVBUF, &rcvBufSize,
+                           sizeof(rcvBufSize)) == -1)
+            goto fail;
+
+        memset(&sa, 0, sizeof(sa));
+        sa.nl_family = AF_NETLINK;
+        sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+        if (bind(w->monFd, (struct sockaddr *) &sa, sizeof(sa)) == -1)
+            goto fail;
+    }
+
+    if (reload(w) == -1)
+        goto fail;
+    return w;
+
+fail:
+    savedErrno = errno;
+    ifwClose(w);
+    errno = savedErrno;
+    return NULL;
+}
+
+int
+ifwFd(const struct ifWatch *w)
+{
+    return w->monFd;
+}
+
+int
+ifwResync(struct ifWatch *w, ifwCallback cb, void *arg)
+{
+    int n;
+
+    w->cb = cb;
+    w->cbArg = arg;
+    n = reload(w);
+    w->cb = NULL;
+    return n;
+}
+
+int
+ifwProcess(struct ifWatch *w, ifwCallback cb, void *arg)
+{
+    struct sockaddr_nl sa;
+    struct nlmsghdr *nlh;
+    socklen_t salen;
+    long changes;
+    ssize_t nr;
+    int len;
+
+    if (w->monFd == -1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    w->cb = cb;
+    w->cbArg = arg;
+    changes = w->stats.changes;
+    for (;;) {
+        salen = sizeof(sa);
+        nr = recvfrom(w->monFd, w->buf, RECV_BUF_SIZE, MSG_DONTWAIT,
+                      (struct sockaddr *) &sa, &salen);
+        if (nr == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            if (errno == ENOBUFS) {     /* Lost notifications */
+                w->stats.resyncs++;
+                if (reload(w) == -1)
+                    goto fail;
+                continue;
+            }
+            goto fail;
+        }
+        if (sa.nl_pid != 0)             /* Not from the kernel */
+            continue;
+
+        len = nr;
+        for (nlh = (struct nlmsghdr *) w->buf; NLMSG_OK(nlh, len);
+                nlh = NLMSG_NEXT(nlh, len)) {
+            w->stats.notifications++;
+            if (applyMsg(w, nlh) == -1)
+                goto fail;
+        }
+    }
+
+    w->cb = NULL;
+    return w->stats.changes - changes;
+
+fail:
+    w->cb = NULL;
+    return -1;
+}
+
+static int
+cmpLink(const void *a, const void *b)
+{
+    return ((const struct ifwLink *) a)->index -
+           ((const struct ifwLink *) b)->index;
+}
+
+static int
+cmpAddr(const void *a, const void *b)
+{
+    const struct ifwAddr *x = a, *y = b;
+
+    if (x->index != y->index)
+        return x->index - y->index;
+    if (x->family != y->family)
+        return x->family - y->family;
+    return memcmp(x->addr, y->addr, sizeof(x->addr));
+}
+
+/* Return copies of the links, sorted by index */
+
+int
+ifwGetLinks(struct ifWatch *w, struct ifwLink **links)
+{
+    struct linkEnt *le;
+    int n, j;
+
+    *links = malloc((w->nlinks + 1) * sizeof(struct ifwLink));
+    if (*links == NULL)
+        return -1;
+    n = 0;
+    for (j = 0; j < w->linkBuckets; j++)
+        for (le = w->links[j]; le != NULL; le = le->next)
+            (*links)[n++] = le->l;
+    qsort(*links, n, sizeof(struct ifwLink), cmpLink);
+    return n;
+}
+
+/* Return copies of the addresses, sorted by interface index */
+
+int
+ifwGetAddrs(struct ifWatch *w, struct ifwAddr **addrs)
+{
+    struct addrEnt *ae;
+    int n, j;
+
+    *addrs = malloc((w->naddrs + 1) * sizeof(struct ifwAddr));
+    if (*addrs == NULL)
+        return -1;
+    n = 0;
+    for (j = 0; j < w->addrBuckets; j++)
+        for (ae = w->addrs[j]; ae != NULL; ae = ae->next)
+            (*addrs)[n++] = ae->a;
+    qsort(*addrs, n, sizeof(struct ifwAddr), cmpAddr);
+    return n;
+}
+
+const struct ifwLink *
+ifwLinkByIndex(struct ifWatch *w, int index)
+{
+    struct linkEnt *le;
+
+    le = *findLink(w, index);
+    return (le == NULL) ? NULL : &le->l;
+}
+
+void
+ifwGetStats(const struct ifWatch *w, struct ifwStats *stats)
+{
+    *stats = w->stats;
+}
+
+void
+ifwClose(struct ifWatch *w)
+{
+    struct linkEnt *le, *lnext;
+    struct addrEnt *ae, *anext;
+    int j;
+
+    if (w->dumpFd != -1)
+        close(w->dumpFd);
+    if (w->monFd != -1)
+        close(w->monFd);
+    for (j = 0; w->links != NULL && j < w->linkBuckets; j++)
+        for (le = w->links[j]; le != NULL; le = lnext) {
+            lnext = le->next;
+            free(le);
+        }
+    for (j = 0; w->addrs != NULL && j < w->addrBuckets; j++)
+        for (ae = w->addrs[j]; ae != NULL; ae = anext) {
+            anext = ae->next;
+            free(ae);
+        }
+    free(w->links);
+    free(w->addrs);
+    free(w->buf);
+    free(w);
+}
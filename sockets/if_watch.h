@@ -0,0 +1,76 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* if_watch.h
+
+   Header file for if_watch.c.
+*/
+#ifndef IF_WATCH_H
+#define IF_WATCH_H              /* Prevent accidental double inclusion */
+
+#include <net/if.h>
+
+struct ifwLink {
+    int index;
+    unsigned int flags;         /* IFF_* */
+    unsigned int mtu;
+    unsigned int type;          /* ARPHRD_* */
+    char name[IF_NAMESIZE];
+};
+
+struct ifwAddr {
+    int index;                  /* Interface */
+    int family;                 /* AF_INET or AF_INET6 */
+    int prefixLen;
+    int scope;                  /* RT_SCOPE_* */
+    unsigned int flags;         /* IFA_F_* */
+    unsigned char addr[16];     /* 4 bytes for AF_INET */
+};
+
+/* Events reported to an ifwCallback; IFW_LINK_NEW and IFW_ADDR_NEW are
+   also reported when an existing link or address changes */
+
+enum { IFW_LINK_NEW, IFW_LINK_DEL, IFW_ADDR_NEW, IFW_ADDR_DEL };
+
+typedef void (*ifwCallback)(void *arg, int event, const struct ifwLink *link,
+                            const struct ifwAddr *addr);
+
+#define IFW_WATCH 1             /* Flag for ifwOpen() */
+
+struct ifwStats {
+    long dumps;                 /* Full dumps (including the first) */
+    long resyncs;               /* ... of which after lost notifications */
+    long notifications;         /* Notifications received */
+    long changes;               /* Changes reported to callbacks */
+};
+
+struct ifWatch;                 /* Opaque; defined in if_watch.c */
+
+struct ifWatch *ifwOpen(int flags, int rcvBufSize);
+
+int ifwFd(const struct ifWatch *w);
+
+int ifwProcess(struct ifWatch *w, ifwCallback cb, void *arg);
+
+int ifwResync(struct ifWatch *w, ifwCallback cb, void *arg);
+
+int ifwGetLinks(struct ifWatch *w, struct ifwLink **links);
+
+int ifwGetAddrs(struct ifWatch *w, struct ifwAddr **addrs);
+
+const struct ifwLink *ifwLinkByIndex(struct ifWatch *w, int index);
+
+void ifwGetStats(const struct ifWatch *w, struct ifwStats *stats);
+
+void ifwClose(struct ifWatch *w);
+
+#endif
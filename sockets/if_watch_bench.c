@@ -0,0 +1,237 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* if_watch_bench.c
+
+   Compare the cost of keeping track of the host's addresses by polling
+   getifaddrs() with that of if_watch.c.
+
+   Usage: if_watch_bench [-a naddrs] [-n reps]
+
+        -a naddrs   Before measuring, add 'naddrs' IPv4 addresses
+                    (127.77.x.y/32) to the loopback interface, removing
+                    them at the end (default: 1000; requires
+                    CAP_NET_ADMIN; 0 means add none)
+        -n reps     Number of repetitions of each measurement (default:
+                    100)
+
+   The program reports the mean time taken by:
+
+        getifaddrs      A call to getifaddrs(), i.e., one poll
+        ifwOpen         Loading the table with rtnetlink dumps
+        ifwProcess      A call to ifwProcess() that finds no changes
+        change          A call to ifwProcess() that applies and reports
+                        one change (the addition or deletion of an
+                        address; the time taken by the kernel to make the
+                        change is excluded)
+
+   Try also adding many interfaces (e.g., veth pairs, with
+   "ip link add vethN type veth peer name vethNp").
+
+   This program is Linux-specific.
+*/
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <time.h>
+#include "if_watch.h"
+#include "tlpi_hdr.h"
+
+static int nlFd;                /* For adding and deleting addresses */
+static unsigned int nlSeq;
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+addAttr(struct nlmsghdr *nlh, int type, const void *data, int len)
+{
+    struct rtattr *rta;
+
+    rta = (struct rtattr *) ((char *) nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+/* Add ('type' is RTM_NEWADDR) or delete (RTM_DELADDR) the address
+   127.77.0.0 + 'n' on the loopback interface (index 1). Returns 0 on
+   success, or -1 (with errno set) on error. */
+
+static int
+changeAddr(int type, int n)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct ifaddrmsg ifa;
+        char attrs[64];
+    } req;
+    char reply[1024];
+    struct nlmsghdr *nlh;
+    struct nlmsgerr *err;
+    struct in_addr a;
+    ssize_t nr;
+
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifa));
+    req.nlh.nlmsg_type = type;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK |
+                          ((type == RTM_NEWADDR) ? NLM_F_CREATE : 0);
+    req.nlh.nlmsg_seq = ++nlSeq;
+    req.ifa.ifa_family = AF_INET;
+    req.ifa.ifa_prefixlen = 32;
+    req.ifa.ifa_scope = RT_SCOPE_HOST;
+    req.ifa.ifa_index = 1;
+    a.s_addr = htonl(0x7f4d0000 + n);
+    addAttr(&req.nlh, IFA_LOCAL, &a, sizeof(a));
+    addAttr(&req.nlh, IFA_ADDRESS, &a, sizeof(a));
+
+    if (send(nlFd, &req, req.nlh.nlmsg_len, 0) == -1)
+        errExit("send");
+    nr = recv(nlFd, reply, sizeof(reply), 0);
+    if (nr == -1)
+        errExit("recv");
+
+    nlh = (struct nlmsghdr *) reply;
+    if (!NLMSG_OK(nlh, nr) || nlh->nlmsg_type != NLMSG_ERROR)
+        fatal("Unexpected reply to netlink request");
+    err = NLMSG_DATA(nlh);
+    if (err->error != 0) {
+        errno = -err->error;
+        return -1;
+    }
+    return 0;
+}
+
+static void
+countChange(void *arg, int event, const struct ifwLink *link,
+            const struct ifwAddr *addr)
+{
+    (*(int *) arg)++;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-a naddrs] [-n reps]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct ifaddrs *ifa, *p;
+    struct ifWatch *w;
+    struct ifwStats st;
+    double start, procSecs;
+    int opt, naddrs, added, reps, count, nchanges, j;
+
+    naddrs = 1000;
+    reps = 100;
+    while ((opt = getopt(argc, argv, "a:n:")) != -1) {
+        switch (opt) {
+        case 'a':   naddrs = getInt(optarg, GN_NONNEG, "-a");   break;
+        case 'n':   reps = getInt(optarg, GN_GT_0, "-n");       break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (naddrs > 65534)
+        cmdLineErr("-a must be at most 65534\n");
+
+    nlFd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nlFd == -1)
+        errExit("socket");
+
+    for (added = 0; added < naddrs; added++) {
+        if (changeAddr(RTM_NEWADDR, added + 1) == -1) {
+            if (added == 0 && errno == EPERM) {
+                printf("(no permission to add addresses)\n");
+                break;
+            }
+            errExit("Adding address");
+        }
+    }
+
+    if (getifaddrs(&ifa) == -1)
+        errExit("getifaddrs");
+    for (count = 0, p = ifa; p != NULL; p = p->ifa_next)
+        count++;
+    freeifaddrs(ifa);
+    printf("%d entries from getifaddrs()\n", count);
+
+    printf("%-12s %12s\n", "operation", "us/op");
+
+    start = nowSecs();
+    for (j = 0; j < reps; j++) {
+        if (getifaddrs(&ifa) == -1)
+            errExit("getifaddrs");
+        freeifaddrs(ifa);
+    }
+    printf("%-12s %12.1f\n", "getifaddrs", (nowSecs() - start) * 1e6 / reps);
+
+    start = nowSecs();
+    for (j = 0; j < reps; j++) {
+        w = ifwOpen(0, 0);
+        if (w == NULL)
+            errExit("ifwOpen");
+        ifwClose(w);
+    }
+    printf("%-12s %12.1f\n", "ifwOpen", (nowSecs() - start) * 1e6 / reps);
+
+    w = ifwOpen(IFW_WATCH, 0);
+    if (w == NULL)
+        errExit("ifwOpen");
+
+    start = nowSecs();
+    for (j = 0; j < reps; j++)
+        if (ifwProcess(w, NULL, NULL) == -1)
+            errExit("ifwProcess");
+    printf("%-12s %12.1f\n", "ifwProcess", (nowSecs() - start) * 1e6 / reps);
+
+    if (added > 0) {
+        nchanges = 0;
+        procSecs = 0;
+        for (j = 0; j < 2 * reps; j++) {
+            if (changeAddr((j % 2 == 0) ? RTM_NEWADDR : RTM_DELADDR,
+                           65535) == -1)
+                errExit("Changing address");
+            start = nowSecs();
+            if (ifwProcess(w, countChange, &nchanges) == -1)
+                errExit("ifwProcess");
+            procSecs += nowSecs() - start;
+        }
+        printf("%-12s %12.1f\n", "change", procSecs * 1e6 / (2 * reps));
+        if (nchanges != 2 * reps)
+            printf("(saw %d changes; expected %d)\n", nchanges, 2 * reps);
+    }
+
+    ifwGetStats(w, &st);
+    printf("%ld dump(s), %ld resync(s), %ld notification(s)\n",
+           st.dumps, st.resyncs, st.notifications);
+    ifwClose(w);
+
+    for (j = 0; j < added; j++)
+        if (changeAddr(RTM_DELADDR, j + 1) == -1)
+            errExit("Deleting address");
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,530 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 59 */
+
+/* inet_resolve.c
+
+   Resolver caches for Internet domain socket addresses.
+
+   inetAddressStr() (inet_sockets.c) calls getnameinfo() each time it is
+   called, and inetConnect() calls getaddrinfo() each time; either may
+   block for a long time waiting for a DNS server. This package keeps the
+   results of such lookups for 'ttlSecs' seconds in two caches:
+
+   *  a reverse cache (address => host name), used by irAddressStr(); and
+   *  a forward cache ((host, service, type) => list of addresses), used
+      by irConnect().
+
+   Each cache is direct mapped: an entry lives in the slot given by a
+   hash of its key, and a new entry simply replaces whatever was in its
+   slot. Lookups and insertions are thus O(1), and the memory used is
+   fixed. (Note that the TTL is ours alone: getaddrinfo() and
+   getnameinfo() don't report the TTLs of the DNS records.)
+
+   For callers that must never block, such as a server's accept loop,
+   irAddressStr(..., IR_NOWAIT) returns the numeric address if the name
+   isn't cached, and queues the lookup to a worker thread, which adds the
+   result to the cache; later calls for the same address then return the
+   name. irPrefetch() similarly queues a forward lookup, so that a later
+   irConnect() finds the addresses cached. An entry marked "pending"
+   prevents the same lookup from being queued repeatedly. (glibc's
+   getaddrinfo_a() provides asynchronous forward lookups, but there is no
+   asynchronous equivalent of getnameinfo(), so we use our own thread
+   for both.)
+
+   A single mutex protects the caches and the request queue; it is never
+   held while a lookup is in progress.
+*/
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include "inet_sockets.h"
+#include "inet_resolve.h"
+#include "fast_once.h"
+#include "tlpi_hdr.h"
+
+#define IR_MAX_ADDRS 8          /* Max. addresses cached per host */
+#define IR_QUEUE_LEN 256        /* Max. queued asynchronous requests */
+
+enum { E_EMPTY, E_PENDING, E_VALID };
+
+struct revEntry {               /* Reverse cache entry */
+    int state;
+    time_t expires;
+    int family;
+    unsigned char addr[16];     /* IPv4 or IPv6 address */
+    char host[NI_MAXHOST];
+};
+
+struct fwdEntry {               /* Forward cache entry */
+    int state;
+    time_t expires;
+    int type;
+    char host[NI_MAXHOST];
+    char service[NI_MAXSERV];
+    int naddrs;
+    struct {
+        int family;
+        int protocol;
+        socklen_t addrlen;
+        struct sockaddr_storage addr;
+    } addrs[IR_MAX_ADDRS];
+};
+
+struct request {                /* Asynchronous request */
+    int reverse;                /* Reverse lookup? Else forward */
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    char host[NI_MAXHOST];
+    char service[NI_MAXSERV];
+    int type;
+};
+
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static struct fastOnce initOnce = FAST_ONCE_INITIALIZER;
+
+static int cacheSize = 1024;            /* Slots in each cache */
+static int ttl = 300;                   /* Seconds */
+
+static struct revEntry *revCache;
+static struct fwdEntry *fwdCache;
+static struct irStats stats;
+
+static struct request queue[IR_QUEUE_LEN];
+static int qHead, qLen;                 /* Protected by 'mtx' */
+static int workerStarted;
+
+static time_t
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static uint32_t
+hashBytes(const void *buf, size_t len, uint32_t h)
+{
+    const unsigned char *p = buf;
+
+    while (len-- > 0)
+        h = (h ^ *p++) * 16777619;      /* FNV-1a */
+    return h;
+}
+
+/* Called once, via fastOnce(); if allocation fails, a later call
+   tries again */
+
+static int
+allocCaches(void *arg)
+{
+    revCache = calloc(cacheSize, sizeof(struct revEntry));
+    fwdCache = calloc(cacheSize, sizeof(struct fwdEntry));
+    if (revCache == NULL || fwdCache == NULL) {
+        free(revCache);
+        free(fwdCache);
+        revCache = NULL;
+        fwdCache = NULL;
+        return ENOMEM;
+    }
+    return 0;
+}
+
+static int
+ensureInit(void)
+{
+    int err;
+
+    err = fastOnce(&initOnce, allocCaches, NULL);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/* Set the number of slots in each cache (rounded up to a power of 2) and
+   the time for which entries remain valid. If called, this function must
+   be called before any other function in this package; otherwise, the
+   defaults are 1024 slots and 300 seconds. Returns 0 on success, or -1
+   on error. */
+
+int
+irInit(int size, int ttlSecs)
+{
+    if (size <= 0 || ttlSecs < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (cacheSize = 1; cacheSize < size; cacheSize <<= 1)
+        continue;
+    ttl = ttlSecs;
+    return ensureInit();
+}
+
+/* Extract the address (without the port) from 'addr' as a cache key.
+   Returns -1 if 'addr' is not an IPv4 or IPv6 address. */
+
+static int
+revKey(const struct sockaddr *addr, socklen_t addrlen,
+       unsigned char key[16], uint32_t *slot)
+{
+    memset(key, 0, 16);
+    if (addr->sa_family == AF_INET &&
+            addrlen >= sizeof(struct sockaddr_in))
+        memcpy(key, &((const struct sockaddr_in *) addr)->sin_addr, 4);
+    else if (addr->sa_family == AF_INET6 &&
+            addrlen >= sizeof(struct sockaddr_in6))
+        memcpy(key, &((const struct sockaddr_in6 *) addr)->sin6_addr, 16);
+    else
+        return -1;
+
+    *slot = hashBytes(key, 16, 2166136261U ^ addr->sa_family) &
+            (cacheSize - 1);
+    return 0;
+}
+
+static uint32_t
+fwdSlot(const char *host, const char *service, int type)
+{
+    uint32_t h;
+
+    h = hashBytes(host, strlen(host) + 1, 2166136261U ^ type);
+    h = hashBytes(service, strlen(service) + 1, h);
+    return h & (cacheSize - 1);
+}
+
+static int
+fwdMatch(const struct fwdEntry *e, const char *host, const char *service,
+         int type)
+{
+    return e->state != E_EMPTY && e->type == type &&
+           strcmp(e->host, host) == 0 && strcmp(e->service, service) == 0;
+}
+
+/* Perform a reverse lookup, and record the result (or, if there is no
+   name, the numeric address) in the cache. If 'hostOut' is not NULL,
+   also return the name there. Returns 0 on success, or -1 on error. */
+
+static int
+resolveReverse(const struct sockaddr *addr, socklen_t addrlen,
+               char hostOut[NI_MAXHOST])
+{
+    char host[NI_MAXHOST];
+    unsigned char key[16];
+    struct revEntry *e;
+    uint32_t slot;
+
+    if (revKey(addr, addrlen, key, &slot) == -1)
+        return -1;
+
+    if (getnameinfo(addr, addrlen, host, NI_MAXHOST, NULL, 0, 0) != 0 &&
+            getnameinfo(addr, addrlen, host, NI_MAXHOST, NULL, 0,
+                        NI_NUMERICHOST) != 0)
+        return -1;
+
+    pthread_mutex_lock(&mtx);
+    e = &revCache[slot];
+    e->state = E_VALID;
+    e->expires = nowSecs() + ttl;
+    e->family = addr->sa_family;
+    memcpy(e->addr, key, 16);
+    memcpy(e->host, host, NI_MAXHOST);
+    pthread_mutex_unlock(&mtx);
+
+    if (hostOut != NULL)
+        memcpy(hostOut, host, NI_MAXHOST);
+    return 0;
+}
+
+/* Perform a forward lookup, and record the result in the cache. 'host'
+   is "" for the loopback address. If 'ent' is not NULL, also return a
+   copy of the entry there. Returns 0 on success, or -1 (with errno set
+   to ENOSYS, as in inetConnect()) if the lookup failed. */
+
+static int
+resolveForward(const char *host, const char *service, int type,
+               struct fwdEntry *ent)
+{
+    struct addrinfo hints, *result, *rp;
+    struct fwdEntry *e, tmp;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = type;
+
+    if (getaddrinfo((*host == '\0') ? NULL : host, service, &hints,
+                    &result) != 0) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.state = E_VALID;
+    tmp.type = type;
+    snprintf(tmp.host, sizeof(tmp.host), "%s", host);
+    snprintf(tmp.service, sizeof(tmp.service), "%s", service);
+    for (rp = result; rp != NULL && tmp.naddrs < IR_MAX_ADDRS;
+            rp = rp->ai_next) {
+        if (rp->ai_addrlen > sizeof(struct sockaddr_storage))
+            continue;
+        tmp.addrs[tmp.naddrs].family = rp->ai_family;
+        tmp.addrs[tmp.naddrs].protocol = rp->ai_protocol;
+        tmp.addrs[tmp.naddrs].addrlen = rp->ai_addrlen;
+        memcpy(&tmp.addrs[tmp.naddrs].addr, rp->ai_addr, rp->ai_addrlen);
+        tmp.naddrs++;
+    }
+    freeaddrinfo(result);
+
+    pthread_mutex_lock(&mtx);
+    tmp.expires = nowSecs() + ttl;
+    e = &fwdCache[fwdSlot(host, service, type)];
+    *e = tmp;
+    pthread_mutex_unlock(&mtx);
+
+    if (ent != NULL)
+        *ent = tmp;
+    return 0;
+}
+
+/* Worker thread: perform queued lookups */
+
+static void *
+worker(void *arg)
+{
+    struct request req;
+
+    for (;;) {
+        pthread_mutex_lock(&mtx);
+        while (qLen == 0)
+            pthread_cond_wait(&cond, &mtx);
+        req = queue[qHead];
+        qHead = (qHead + 1) % IR_QUEUE_LEN;
+        qLen--;
+        pthread_mutex_unlock(&mtx);
+
+        if (req.reverse)
+            resolveReverse((struct sockaddr *) &req.addr, req.addrlen, NULL);
+        else
+            resolveForward(req.host, req.service, req.type, NULL);
+    }
+
+    return NULL;
+}
+
+/* Append 'req' to the queue; called with 'mtx' held. Returns 0 on
+   success, or -1 if the request was dropped. */
+
+static int
+enqueue(const struct request *req)
+{
+    pthread_t t;
+    pthread_attr_t attr;
+
+    if (!workerStarted) {
+        if (pthread_attr_init(&attr) != 0)
+            return -1;
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&t, &attr, worker, NULL) != 0) {
+            pthread_attr_destroy(&attr);
+            return -1;
+        }
+        pthread_attr_destroy(&attr);
+        workerStarted = 1;
+    }
+
+    if (qLen == IR_QUEUE_LEN) {
+        stats.dropped++;
+        return -1;
+    }
+
+    queue[(qHead + qLen) % IR_QUEUE_LEN] = *req;
+    qLen++;
+    stats.async++;
+    pthread_cond_signal(&cond);
+    return 0;
+}
+
+/* As inetAddressStr(), but look up the host name in the reverse cache.
+   If the name isn't cached, then, if 'flags' includes IR_NOWAIT, queue
+   an asynchronous lookup and return the numeric address (as
+   inetAddressStrNumeric() does); otherwise, look up the name now, and
+   cache it. */
+
+char *
+irAddressStr(const struct sockaddr *addr, socklen_t addrlen,
+             char *addrStr, int addrStrLen, int flags)
+{
+    unsigned char key[16];
+    uint32_t slot;
+    struct revEntry *e;
+    struct request req;
+    char host[NI_MAXHOST];
+    in_port_t port;
+    int match;
+
+    if (ensureInit() == -1 || revKey(addr, addrlen, key, &slot) == -1 ||
+            addrlen > sizeof(struct sockaddr_storage))
+        return inetAddressStr(addr, addrlen, addrStr, addrStrLen);
+
+    port = (addr->sa_family == AF_INET) ?
+                ((const struct sockaddr_in *) addr)->sin_port :
+                ((const struct sockaddr_in6 *) addr)->sin6_port;
+
+    pthread_mutex_lock(&mtx);
+    e = &revCache[slot];
+    match = e->state != E_EMPTY && e->family == addr->sa_family &&
+            memcmp(e->addr, key, 16) == 0 && e->expires > nowSecs();
+
+    if (match && e->state == E_VALID) {
+        stats.hits++;
+        memcpy(host, e->host, NI_MAXHOST);
+        pthread_mutex_unlock(&mtx);
+        snprintf(addrStr, addrStrLen, "(%s, %u)", host, ntohs(port));
+        return addrStr;
+    }
+
+    if (flags & IR_NOWAIT) {
+
+        /* Queue a lookup, unless one is already pending, and return the
+           numeric form. (A pending entry expires, so that a failed
+           asynchronous lookup is eventually retried.) */
+
+        if (!match) {
+            stats.misses++;
+            memset(&req, 0, sizeof(req));
+            req.reverse = 1;
+            memcpy(&req.addr, addr, addrlen);
+            req.addrlen = addrlen;
+            if (enqueue(&req) == 0) {
+                e->state = E_PENDING;
+                e->expires = nowSecs() + ttl;
+                e->family = addr->sa_family;
+                memcpy(e->addr, key, 16);
+            }
+        }
+        pthread_mutex_unlock(&mtx);
+        return inetAddressStrNumeric(addr, addrlen, addrStr, addrStrLen);
+    }
+
+    stats.misses++;
+    pthread_mutex_unlock(&mtx);
+
+    if (resolveReverse(addr, addrlen, host) == -1)
+        snprintf(addrStr, addrStrLen, "(?UNKNOWN?)");
+    else
+        snprintf(addrStr, addrStrLen, "(%s, %u)", host, ntohs(port));
+    return addrStr;
+}
+
+/* As inetConnect(), but use the forward cache to obtain the addresses
+   of 'host' + 'service'/'type' */
+
+int
+irConnect(const char *host, const char *service, int type)
+{
+    struct fwdEntry ent, *e;
+    int j, sfd, hit;
+
+    if (ensureInit() == -1)
+        return -1;
+
+    if (host == NULL)
+        host = "";
+
+    pthread_mutex_lock(&mtx);
+    e = &fwdCache[fwdSlot(host, service, type)];
+    hit = fwdMatch(e, host, service, type) && e->state == E_VALID &&
+          e->expires > nowSecs();
+    if (hit) {
+        stats.hits++;
+        ent = *e;
+    } else {
+        stats.misses++;
+    }
+    pthread_mutex_unlock(&mtx);
+
+    if (!hit && resolveForward(host, service, type, &ent) == -1)
+        return -1;
+
+    /* Walk through the addresses, as inetConnect() walks the list
+       returned by getaddrinfo() */
+
+    for (j = 0; j < ent.naddrs; j++) {
+        sfd = socket(ent.addrs[j].family, type, ent.addrs[j].protocol);
+        if (sfd == -1)
+            continue;
+
+        if (connect(sfd, (struct sockaddr *) &ent.addrs[j].addr,
+                    ent.addrs[j].addrlen) != -1)
+            return sfd;                 /* Success */
+
+        close(sfd);                     /* Connect failed: try next */
+    }
+
+    return -1;
+}
+
+/* Queue an asynchronous forward lookup of 'host' + 'service'/'type', so
+   that a later irConnect() finds the result in the cache. Returns 0 on
+   success (including if the result is already cached or pending), or -1
+   on error (e.g., the queue is full). */
+
+int
+irPrefetch(const char *host, const char *service, int type)
+{
+    struct request req;
+    struct fwdEntry *e;
+    int s;
+
+    if (ensureInit() == -1)
+        return -1;
+
+    if (host == NULL)
+        host = "";
+
+    pthread_mutex_lock(&mtx);
+    e = &fwdCache[fwdSlot(host, service, type)];
+    if (fwdMatch(e, host, service, type) && e->expires > nowSecs()) {
+        pthread_mutex_unlock(&mtx);
+        return 0;
+    }
+
+    memset(&req, 0, sizeof(req));
+    snprintf(req.host, sizeof(req.host), "%s", host);
+    snprintf(req.service, sizeof(req.service), "%s", service);
+    req.type = type;
+    s = enqueue(&req);
+    if (s == 0) {
+        e->state = E_PENDING;
+        e->expires = nowSecs() + ttl;
+        e->type = type;
+        snprintf(e->host, sizeof(e->host), "%s", host);
+        snprintf(e->service, sizeof(e->service), "%s", service);
+    } else {
+        errno = EAGAIN;
+    }
+    pthread_mutex_unlock(&mtx);
+    return s;
+}
+
+void
+irGetStats(struct irStats *st)
+{
+    pthread_mutex_lock(&mtx);
+    *st = stats;
+    pthread_mutex_unlock(&mtx);
+}
@@ -0,0 +1,53 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 59 */
+
+/* inet_resolve.h
+
+   Header file for inet_resolve.c.
+
+   Cached (and optionally asynchronous) versions of the name resolution
+   performed by inetAddressStr() and inetConnect() in inet_sockets.c.
+   All of the functions may be called from multiple threads. Programs
+   using these functions must be linked with the threads library.
+*/
+#ifndef INET_RESOLVE_H
+#define INET_RESOLVE_H          /* Prevent accidental double inclusion */
+
+#include <sys/socket.h>
+#include <netdb.h>
+
+/* Flags for irAddressStr() */
+
+#define IR_NOWAIT   1           /* Don't block: if the name isn't cached,
+                                   start an asynchronous lookup, and
+                                   return the numeric address */
+
+struct irStats {
+    long hits;                  /* Lookups satisfied from the caches */
+    long misses;                /* Lookups that required a resolution */
+    long async;                 /* Resolutions queued to worker thread */
+    long dropped;               /* Asynchronous requests dropped because
+                                   the queue was full */
+};
+
+int irInit(int cacheSize, int ttlSecs);
+
+char *irAddressStr(const struct sockaddr *addr, socklen_t addrlen,
+                   char *addrStr, int addrStrLen, int flags);
+
+int irConnect(const char *host, const char *service, int type);
+
+int irPrefetch(const char *host, const char *service, int type);
+
+void irGetStats(struct irStats *stats);
+
+#endif
@@ -0,0 +1,199 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 59 */
+
+/* inet_resolve_bench.c
+
+   Compare the cost of converting socket addresses to strings using
+   inetAddressStr() (a getnameinfo() call each time), inetAddressStrNumeric(),
+   and the cached irAddressStr() (inet_resolve.c), and the cost of making
+   connections with inetConnect() (a getaddrinfo() call each time) and
+   the cached irConnect().
+
+   Usage: inet_resolve_bench [-n iterations] [-c host] [address...]
+
+        -n iterations   Number of calls in each test (default: 10000)
+        -c host         Host name used in the connection tests (default:
+                        "localhost"); it must resolve to a local address
+
+   Each 'address' is a numeric IPv4 or IPv6 address (default: 127.0.0.1
+   and ::1). For each address, the program reports the mean time per
+   call, and the string returned by each function. The first call of
+   irAddressStr(IR_NOWAIT) returns the numeric address; once the worker
+   thread has resolved the name, later calls return the name.
+
+   The connection tests connect to a listening socket created by this
+   program on an ephemeral port, accepting and closing each connection.
+*/
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <time.h>
+#include "inet_sockets.h"
+#include "inet_resolve.h"
+#include "tlpi_hdr.h"
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Convert the numeric address 'str' to a socket address */
+
+static socklen_t
+parseAddr(const char *str, struct sockaddr_storage *ss)
+{
+    struct sockaddr_in *sin = (struct sockaddr_in *) ss;
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) ss;
+
+    memset(ss, 0, sizeof(*ss));
+    if (inet_pton(AF_INET, str, &sin->sin_addr) == 1) {
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(50000);
+        return sizeof(struct sockaddr_in);
+    }
+    if (inet_pton(AF_INET6, str, &sin6->sin6_addr) == 1) {
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(50000);
+        return sizeof(struct sockaddr_in6);
+    }
+    fatal("Bad address: %s", str);
+    return 0;                           /* Not reached */
+}
+
+enum { T_GETNAMEINFO, T_NUMERIC, T_CACHED, T_NOWAIT };
+
+static const char *testNames[] = {
+    "inetAddressStr", "inetAddressStrNumeric", "irAddressStr",
+    "irAddressStr(IR_NOWAIT)"
+};
+
+static void
+addrTests(const char *str, int numIters)
+{
+    struct sockaddr_storage ss;
+    struct sockaddr *sa = (struct sockaddr *) &ss;
+    socklen_t len;
+    char addrStr[IS_ADDR_STR_LEN];
+    double start;
+    int t, j;
+
+    len = parseAddr(str, &ss);
+    printf("%s:\n", str);
+
+    for (t = T_GETNAMEINFO; t <= T_NOWAIT; t++) {
+        start = nowSecs();
+        for (j = 0; j < numIters; j++) {
+            switch (t) {
+            case T_GETNAMEINFO:
+                inetAddressStr(sa, len, addrStr, IS_ADDR_STR_LEN);
+                break;
+            case T_NUMERIC:
+                inetAddressStrNumeric(sa, len, addrStr, IS_ADDR_STR_LEN);
+                break;
+            case T_CACHED:
+                irAddressStr(sa, len, addrStr, IS_ADDR_STR_LEN, 0);
+                break;
+            case T_NOWAIT:
+                irAddressStr(sa, len, addrStr, IS_ADDR_STR_LEN, IR_NOWAIT);
+                break;
+            }
+        }
+        printf("    %-24s %10.3f us   %s\n", testNames[t],
+                (nowSecs() - start) * 1e6 / numIters, addrStr);
+    }
+}
+
+static void
+connectTest(const char *host, const char *service, int lfd, int numIters,
+            Boolean cached)
+{
+    int j, cfd, afd;
+    double start;
+
+    start = nowSecs();
+    for (j = 0; j < numIters; j++) {
+        cfd = cached ? irConnect(host, service, SOCK_STREAM) :
+                       inetConnect(host, service, SOCK_STREAM);
+        if (cfd == -1)
+            errExit("connect to %s", host);
+        afd = accept(lfd, NULL, NULL);
+        if (afd == -1)
+            errExit("accept");
+        close(cfd);
+        close(afd);
+    }
+    printf("    %-24s %10.3f us\n", cached ? "irConnect" : "inetConnect",
+            (nowSecs() - start) * 1e6 / numIters);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int opt, numIters, lfd, j;
+    struct sockaddr_storage ss;
+    socklen_t len;
+    struct irStats st;
+    const char *connHost;
+    char service[NI_MAXSERV];
+    char *defAddrs[] = { "127.0.0.1", "::1" };
+    char **addrs;
+    int numAddrs;
+
+    numIters = 10000;
+    connHost = "localhost";
+    while ((opt = getopt(argc, argv, "n:c:")) != -1) {
+        switch (opt) {
+        case 'n':   numIters = getInt(optarg, GN_GT_0, "iterations");   break;
+        case 'c':   connHost = optarg;                                  break;
+        default:
+            usageErr("%s [-n iterations] [-c host] [address...]\n", argv[0]);
+        }
+    }
+
+    if (optind < argc) {
+        addrs = &argv[optind];
+        numAddrs = argc - optind;
+    } else {
+        addrs = defAddrs;
+        numAddrs = 2;
+    }
+
+    for (j = 0; j < numAddrs; j++)
+        addrTests(addrs[j], numIters);
+
+    /* Connection tests */
+
+    lfd = inetListen("0", SOMAXCONN, NULL);
+    if (lfd == -1)
+        errExit("inetListen");
+    len = sizeof(ss);
+    if (getsockname(lfd, (struct sockaddr *) &ss, &len) == -1)
+        errExit("getsockname");
+    if (getnameinfo((struct sockaddr *) &ss, len, NULL, 0,
+                    service, sizeof(service), NI_NUMERICSERV) != 0)
+        fatal("getnameinfo");
+
+    printf("connect to (%s, %s):\n", connHost, service);
+    connectTest(connHost, service, lfd, numIters, FALSE);
+    connectTest(connHost, service, lfd, numIters, TRUE);
+
+    irGetStats(&st);
+    printf("cache: %ld hits, %ld misses, %ld async, %ld dropped\n",
+            st.hits, st.misses, st.async, st.dropped);
+
+    exit(EXIT_SUCCESS);
+}
@@ -20,6 +20,13 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
 #include "inet_sockets.h"       /* Declares functions defined here */
 #include "tlpi_hdr.h"
 
@@ -32,12 +39,167 @@
         'type':         either SOCK_STREAM or SOCK_DGRAM
 */
 
-/* Create socket and connect it to the address specified by
-  'host' + 'service'/'type'. Return socket descriptor on success,
-  or -1 on error */
+/* Socket option settings for each of the profiles accepted by
+   inetSetProfile(). Options marked 'optional' are set on a best-effort
+   basis: e.g., raising SO_BUSY_POLL above the value of
+   /proc/sys/net/core/busy_read requires CAP_NET_ADMIN. */
+
+#define ON_ANY      0           /* Listening and connecting sockets */
+#define ON_LISTEN   1           /* Listening sockets only */
+#define ON_CONNECT  2           /* Connecting sockets only */
+
+struct profileOpt {
+    int profile;
+    int level;
+    int name;
+    int value;
+    int where;                  /* ON_* */
+    Boolean optional;
+};
+
+static const struct profileOpt profileOpts[] = {
+
+    /* Low latency: send small writes at once, rather than waiting to
+       coalesce them (Nagle's algorithm), and acknowledge at once rather
+       than delaying ACKs. Queue little unsent data in the kernel, so
+       that a newly written message need not wait behind a backlog (but
+       see below). Busy poll the device queue briefly when reading.
+       (TCP_QUICKACK is not permanent: the kernel may reenable delayed
+       ACKs later in the life of a connection.) */
+
+    { ISP_LOW_LATENCY, IPPROTO_TCP, TCP_NODELAY,       1,     ON_ANY, FALSE },
+#ifdef TCP_QUICKACK
+    { ISP_LOW_LATENCY, IPPROTO_TCP, TCP_QUICKACK,      1, ON_CONNECT, TRUE },
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+    { ISP_LOW_LATENCY, IPPROTO_TCP, TCP_NOTSENT_LOWAT, 16384, ON_ANY, TRUE },
+#endif
+#ifdef SO_BUSY_POLL
+    { ISP_LOW_LATENCY, SOL_SOCKET,  SO_BUSY_POLL,      50,    ON_ANY, TRUE },
+#endif
+
+    /* Bulk transfer: large socket buffers, so that the TCP window can
+       cover a large bandwidth-delay product. These must be set before
+       listen() or connect(), since the window scale is fixed when the
+       connection is established. (The kernel doubles these values, and
+       caps them at /proc/sys/net/core/{r,w}mem_max.) */
+
+    { ISP_BULK,        SOL_SOCKET,  SO_SNDBUF,         4 << 20, ON_ANY, FALSE },
+    { ISP_BULK,        SOL_SOCKET,  SO_RCVBUF,         4 << 20, ON_ANY, FALSE },
+
+    /* Many idle connections: don't wake the server to accept() a
+       connection until the client has sent data (or 5 seconds have
+       passed); keep per-connection memory small; and use keepalive
+       probes to detect and discard connections to peers that have gone
+       away. */
+
+#ifdef TCP_DEFER_ACCEPT
+    { ISP_MANY_IDLE,   IPPROTO_TCP, TCP_DEFER_ACCEPT,  5,  ON_LISTEN, TRUE },
+#endif
+    { ISP_MANY_IDLE,   SOL_SOCKET,  SO_SNDBUF,         16384, ON_ANY, FALSE },
+    { ISP_MANY_IDLE,   SOL_SOCKET,  SO_RCVBUF,         16384, ON_ANY, FALSE },
+#ifdef TCP_NOTSENT_LOWAT
+    { ISP_MANY_IDLE,   IPPROTO_TCP, TCP_NOTSENT_LOWAT, 4096,  ON_ANY, TRUE },
+#endif
+    { ISP_MANY_IDLE,   SOL_SOCKET,  SO_KEEPALIVE,      1,     ON_ANY, FALSE },
+#ifdef TCP_KEEPIDLE
+    { ISP_MANY_IDLE,   IPPROTO_TCP, TCP_KEEPIDLE,      60,    ON_ANY, TRUE },
+    { ISP_MANY_IDLE,   IPPROTO_TCP, TCP_KEEPINTVL,     10,    ON_ANY, TRUE },
+    { ISP_MANY_IDLE,   IPPROTO_TCP, TCP_KEEPCNT,       5,     ON_ANY, TRUE },
+#endif
+};
+
+#define NPROFILE_OPTS (sizeof(profileOpts) / sizeof(profileOpts[0]))
+
+static const char *profileNames[] = {
+    "default", "low-latency", "bulk", "many-idle"
+};
+
+#define NPROFILES (sizeof(profileNames) / sizeof(profileNames[0]))
+
+/* Apply the socket options for 'profile' (one of the ISP_* constants)
+   to the socket 'sfd', of type 'type'. 'listening' says whether the
+   socket will be a listening socket (sockets returned by accept()
+   inherit the options of the listening socket) or a connecting socket.
+   The options should be applied before listen() or connect(). Options
+   at the IPPROTO_TCP level are applied only to SOCK_STREAM sockets.
+   Return 0 on success, or -1 on error. */
 
 int
-inetConnect(const char *host, const char *service, int type)
+inetSetProfile(int sfd, int type, int profile, int listening)
+{
+    const struct profileOpt *po;
+    int j;
+
+    if (profile < 0 || profile >= NPROFILES) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (j = 0; j < NPROFILE_OPTS; j++) {
+        po = &profileOpts[j];
+        if (po->profile != profile)
+            continue;
+        if (po->level == IPPROTO_TCP && type != SOCK_STREAM)
+            continue;
+        if ((po->where == ON_LISTEN && !listening) ||
+                (po->where == ON_CONNECT && listening))
+            continue;
+
+        if (setsockopt(sfd, po->level, po->name, &po->value,
+                       sizeof(po->value)) == -1 && !po->optional)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Return the ISP_* constant for the profile named 'name' (e.g.,
+   "low-latency"), or -1 (with errno set to EINVAL) if there is none */
+
+int
+inetProfileFromStr(const char *name)
+{
+    int j;
+
+    for (j = 0; j < NPROFILES; j++)
+        if (strcmp(name, profileNames[j]) == 0)
+            return j;
+
+    errno = EINVAL;
+    return -1;
+}
+
+const char *
+inetProfileName(int profile)
+{
+    return (profile >= 0 && profile < NPROFILES) ?
+            profileNames[profile] : "unknown";
+}
+
+/* Set (if 'on' is nonzero) or clear the TCP_CORK option on the TCP
+   socket 'sfd'. While the option is set, partial segments are held back
+   (for up to 200 ms), so that a response that is built by several
+   write() calls (e.g., a header followed by a body sent with sendfile())
+   goes out in as few segments as possible; clearing the option sends any
+   pending data at once. Return 0 on success, or -1 on error. */
+
+int
+inetCork(int sfd, int on)
+{
+#ifdef TCP_CORK
+    on = (on != 0);
+    return setsockopt(sfd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+#else
+    errno = ENOPROTOOPT;
+    return -1;
+#endif
+}
+
+static int              /* Public interfaces: inetConnect() and
+                           inetConnectProfile() */
+inetActiveSocket(const char *host, const char *service, int type,
+                 int profile)
 {
     struct addrinfo hints;
     struct addrinfo *result, *rp;
@@ -64,6 +226,13 @@ inetConnect(const char *host, const char *service, int type)
         if (sfd == -1)
             continue;                   /* On error, try next address */
 
+        if (profile != ISP_DEFAULT &&
+                inetSetProfile(sfd, type, profile, FALSE) == -1) {
+            close(sfd);
+            freeaddrinfo(result);
+            return -1;
+        }
+
         if (connect(sfd, rp->ai_addr, rp->ai_addrlen) != -1)
             break;                      /* Success */
 
@@ -77,17 +246,284 @@ inetConnect(const char *host, const char *service, int type)
     return (rp == NULL) ? -1 : sfd;
 }
 
+/* Create socket and connect it to the address specified by
+  'host' + 'service'/'type'. Return socket descriptor on success,
+  or -1 on error */
+
+int
+inetConnect(const char *host, const char *service, int type)
+{
+    return inetActiveSocket(host, service, type, ISP_DEFAULT);
+}
+
+/* As inetConnect(), but first apply the socket options for 'profile'
+   (see inetSetProfile()) to the socket */
+
+int
+inetConnectProfile(const char *host, const char *service, int type,
+                   int profile)
+{
+    return inetActiveSocket(host, service, type, profile);
+}
+
+#define IC_MAX_ATTEMPTS 64        /* Max. addresses tried by
+                                   inetConnectRace() */
+
+static long
+monoMs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/* Like inetConnect(), but for stream sockets, race connection attempts
+   to the addresses of 'host' in the manner of RFC 8305 ("Happy
+   Eyeballs"), so that an unreachable address (typically, an IPv6 address
+   on a network without working IPv6) doesn't stall the caller for the
+   full TCP connection timeout:
+
+   *  The addresses returned by getaddrinfo() are reordered so that the
+      address families alternate, starting with the family of the first
+      address (which getaddrinfo() has sorted to be the preferred one).
+
+   *  A nonblocking connection to the first address is started. If it
+      hasn't completed after 'attemptDelayMs' milliseconds (0 means
+      50 ms), or as soon as it fails, a connection to the next address
+      is started in parallel, and so on. The first connection to
+      complete wins; the others are closed. (The RFC recommends 250 ms,
+      but allows as little as 10 ms; the shorter default favors the
+      caller's latency over the few extra SYNs sent when the first
+      address is merely slow.)
+
+   *  An attempt that hasn't completed within 'timeoutMs' milliseconds
+      (-1 means no limit other than the kernel's) is abandoned.
+
+   If 'flags' includes IC_FASTOPEN, TCP Fast Open is requested
+   (TCP_FASTOPEN_CONNECT, Linux 4.11 and later): if the kernel has a Fast
+   Open cookie for the server, connect() succeeds at once and the SYN is
+   sent, carrying data, by the first write(); errors are then reported by
+   that write().
+
+   The returned socket is in blocking mode. Return the socket descriptor
+   on success, or -1 on error (with errno set to ETIMEDOUT if all of the
+   attempts timed out, or to EHOSTUNREACH if 'host' or 'service' could
+   not be resolved, unless getaddrinfo() failed with EAI_SYSTEM, in which
+   case errno is as it set it). For other socket types, this function
+   is equivalent to inetConnect(). */
+
+int
+inetConnectRace(const char *host, const char *service, int type,
+                int attemptDelayMs, int timeoutMs, int flags)
+{
+    struct addrinfo hints;
+    struct addrinfo *result, *rp, *addrs[IC_MAX_ATTEMPTS];
+    struct pollfd pfds[IC_MAX_ATTEMPTS];
+    long started[IC_MAX_ATTEMPTS], now, nextStart, wait;
+    int naddrs, nfirst, nextAddr, nactive, sfd, s, j, k, err, lastErr;
+    socklen_t len;
+
+    if (type != SOCK_STREAM)
+        return inetConnect(host, service, type);
+
+    if (attemptDelayMs <= 0)
+        attemptDelayMs = 50;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = type;
+
+    s = getaddrinfo(host, service, &hints, &result);
+    if (s != 0) {
+        if (s != EAI_SYSTEM)            /* Else, errno is already set */
+            errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    /* Interleave the address families: first, the addresses of the
+       preferred family go in the even slots, and the others fill in
+       the remaining slots in order */
+
+    naddrs = 0;
+    for (rp = result; rp != NULL && naddrs < IC_MAX_ATTEMPTS;
+            rp = rp->ai_next)
+        naddrs++;
+
+    nfirst = 0;
+    k = 0;
+    for (rp = result, j = 0; j < naddrs; rp = rp->ai_next, j++)
+        if (rp->ai_family == result->ai_family)
+            nfirst++;
+    for (rp = result, j = 0; j < naddrs; rp = rp->ai_next, j++) {
+        if (rp->ai_family == result->ai_family) {
+            addrs[(k < naddrs - nfirst) ? 2 * k : (naddrs - nfirst) + k] = rp;
+            k++;
+        }
+    }
+    k = 0;
+    for (rp = result, j = 0; j < naddrs; rp = rp->ai_next, j++) {
+        if (rp->ai_family != result->ai_family) {
+            addrs[(k < nfirst) ? 2 * k + 1 : nfirst + k] = rp;
+            k++;
+        }
+    }
+
+    nextAddr = 0;
+    nactive = 0;
+    nextStart = monoMs();
+    lastErr = ECONNREFUSED;
+    sfd = -1;
+
+    while (sfd == -1) {
+        now = monoMs();
+
+        /* Start the next attempt, if it's time (or nothing is in
+           progress) */
+
+        if (nextAddr < naddrs && (nactive == 0 || now >= nextStart)) {
+            rp = addrs[nextAddr++];
+
+            s = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+            if (s == -1) {
+                lastErr = errno;
+                continue;
+            }
+
+            if (fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK) == -1) {
+                lastErr = errno;
+                close(s);
+                continue;
+            }
+
+#ifdef TCP_FASTOPEN_CONNECT
+            if (flags & IC_FASTOPEN) {
+                int optval = 1;
+
+                setsockopt(s, IPPROTO_TCP, TCP_FASTOPEN_CONNECT,
+                           &optval, sizeof(optval));
+            }
+#endif
+
+            if (connect(s, rp->ai_addr, rp->ai_addrlen) == 0) {
+                sfd = s;                /* Connected at once */
+                break;
+            }
+            if (errno != EINPROGRESS) {
+                lastErr = errno;        /* Failed: try next at once */
+                close(s);
+                continue;
+            }
+
+            pfds[nactive].fd = s;
+            pfds[nactive].events = POLLOUT;
+            started[nactive] = now;
+            nactive++;
+            nextStart = now + attemptDelayMs;
+            continue;
+        }
+
+        if (nactive == 0)               /* All addresses have failed */
+            break;
+
+        /* Wait until an attempt completes, the next attempt is due, or
+           the oldest attempt times out */
+
+        wait = -1;
+        if (nextAddr < naddrs)
+            wait = nextStart - now;
+        if (timeoutMs >= 0) {
+            long remaining = started[0] + timeoutMs - now;
+
+            if (wait == -1 || remaining < wait)
+                wait = remaining;
+        }
+        if (wait < 0 && wait != -1)
+            wait = 0;
+
+        if (poll(pfds, nactive, wait) == -1 && errno != EINTR) {
+            lastErr = errno;
+            break;
+        }
+
+        now = monoMs();
+        for (j = 0; j < nactive; ) {
+            err = 0;
+            if (pfds[j].revents != 0) {
+                len = sizeof(err);
+                if (getsockopt(pfds[j].fd, SOL_SOCKET, SO_ERROR,
+                               &err, &len) == -1)
+                    err = errno;
+                if (err == 0) {
+                    sfd = pfds[j].fd;   /* This attempt won */
+                    pfds[j] = pfds[--nactive];
+                    started[j] = started[nactive];
+                    break;
+                }
+            } else if (timeoutMs >= 0 && now - started[j] >= timeoutMs) {
+                err = ETIMEDOUT;
+            }
+
+            if (err != 0) {             /* Remove failed attempt */
+                lastErr = err;
+                close(pfds[j].fd);
+                pfds[j] = pfds[--nactive];
+                started[j] = started[nactive];
+                nextStart = now;        /* Start next attempt at once */
+            } else {
+                j++;
+            }
+        }
+
+        /* Keep 'started[0]' as the oldest attempt (for the timeout) */
+
+        for (j = 1; j < nactive; j++) {
+            if (started[j] < started[0]) {
+                struct pollfd tp = pfds[0];
+                long ts = started[0];
+
+                pfds[0] = pfds[j];
+                started[0] = started[j];
+                pfds[j] = tp;
+                started[j] = ts;
+            }
+        }
+    }
+
+    for (j = 0; j < nactive; j++)       /* Close losing attempts */
+        close(pfds[j].fd);
+    freeaddrinfo(result);
+
+    if (sfd == -1) {
+        errno = lastErr;
+        return -1;
+    }
+
+    if (fcntl(sfd, F_SETFL, fcntl(sfd, F_GETFL) & ~O_NONBLOCK) == -1) {
+        lastErr = errno;
+        close(sfd);
+        errno = lastErr;
+        return -1;
+    }
+    return sfd;
+}
+
 /* Create an Internet domain socket and bind it to the address
    { wildcard-IP-address + 'service'/'type' }.
    If 'doListen' is TRUE, then make this a listening socket (by
    calling listen() with 'backlog'), with the SO_REUSEADDR option set.
+   If 'reusePort' is also TRUE, then the SO_REUSEPORT option is set as
+   well, so that several sockets can be bound to the same address.
+   The socket options for 'profile' (see inetSetProfile()) are applied
+   before the socket is bound.
    If 'addrLen' is not NULL, then use it to return the size of the
    address structure for the address family for this socket.
    Return the socket descriptor on success, or -1 on error. */
 
 static int              /* Public interfaces: inetBind() and inetListen() */
 inetPassiveSocket(const char *service, int type, socklen_t *addrlen,
-                  Boolean doListen, int backlog)
+                  Boolean doListen, int backlog, Boolean reusePort,
+                  int profile)
 {
     struct addrinfo hints;
     struct addrinfo *result, *rp;
@@ -123,6 +559,24 @@ inetPassiveSocket(const char *service, int type, socklen_t *addrlen,
             }
         }
 
+#ifdef SO_REUSEPORT
+        if (doListen && reusePort) {
+            if (setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &optval,
+                    sizeof(optval)) == -1) {
+                close(sfd);
+                freeaddrinfo(result);
+                return -1;
+            }
+        }
+#endif
+
+        if (profile != ISP_DEFAULT &&
+                inetSetProfile(sfd, type, profile, doListen) == -1) {
+            close(sfd);
+            freeaddrinfo(result);
+            return -1;
+        }
+
         if (bind(sfd, rp->ai_addr, rp->ai_addrlen) == 0)
             break;                      /* Success */
 
@@ -153,7 +607,131 @@ inetPassiveSocket(const char *service, int type, socklen_t *addrlen,
 int
 inetListen(const char *service, int backlog, socklen_t *addrlen)
 {
-    return inetPassiveSocket(service, SOCK_STREAM, addrlen, TRUE, backlog);
+    return inetPassiveSocket(service, SOCK_STREAM, addrlen, TRUE, backlog,
+                             FALSE, ISP_DEFAULT);
+}
+
+/* As inetListen(), but first apply the socket options for 'profile' (see
+   inetSetProfile()) to the listening socket. Connected sockets returned
+   by accept() inherit these options. */
+
+int
+inetListenProfile(const char *service, int backlog, socklen_t *addrlen,
+                  int profile)
+{
+    return inetPassiveSocket(service, SOCK_STREAM, addrlen, TRUE, backlog,
+                             FALSE, profile);
+}
+
+/* Create 'nsocks' stream sockets, each bound (using SO_REUSEPORT) to the
+   wildcard IP address + port given in 'service', and each a listening
+   socket with the specified 'backlog'. The kernel distributes incoming
+   connections across the sockets, so that each can be served by a
+   separate worker with its own accept queue. The socket descriptors are
+   returned in the array 'sfds'.
+
+   If 'flags' includes IL_CPU_STEER, then inetSteerByCpu(sfds[0], NULL,
+   nsocks) is called, so that each connection is placed on the queue of
+   socket number (N % nsocks), where N is the number of the CPU on which
+   the kernel processed the incoming connection request. (A worker that
+   handles socket 'j' should therefore run on CPU 'j'; otherwise, call
+   inetSteerByCpu() with the list of CPUs on which the workers run.)
+
+   Return 0 on success, or -1 on error (in which case no sockets remain
+   open). */
+
+int
+inetListenMulti(const char *service, int backlog, socklen_t *addrlen,
+                int sfds[], int nsocks, int flags)
+{
+    int j, savedErrno;
+
+    if (nsocks <= 0 || sfds == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#ifndef SO_REUSEPORT
+    errno = ENOPROTOOPT;
+    return -1;
+#else
+    for (j = 0; j < nsocks; j++) {
+        sfds[j] = inetPassiveSocket(service, SOCK_STREAM, addrlen, TRUE,
+                                    backlog, TRUE, ISP_DEFAULT);
+        if (sfds[j] == -1)
+            goto fail;
+    }
+
+    if (flags & IL_CPU_STEER)
+        if (inetSteerByCpu(sfds[0], NULL, nsocks) == -1)
+            goto fail;
+
+    return 0;
+
+fail:
+    savedErrno = errno;
+    while (--j >= 0)
+        close(sfds[j]);
+    errno = savedErrno;
+    return -1;
+#endif
+}
+
+/* Attach a BPF program to the SO_REUSEPORT group of 'sfd' (one of the
+   sockets created by inetListenMulti()), so that a connection request
+   processed by the kernel on CPU 'cpus[j]' is placed on the queue of
+   socket number 'j' (0 <= j < nsocks). A CPU that appears more than once
+   in 'cpus' steers to the first socket that lists it; a CPU that is not
+   in the list steers to socket (N % nsocks), where N is its number. If
+   'cpus' is NULL, every CPU steers to socket (N % nsocks), so that CPU
+   'j' steers to socket 'j'. Return 0 on success, or -1 on error. */
+
+int
+inetSteerByCpu(int sfd, const int cpus[], int nsocks)
+{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    struct sock_filter *code, *p;
+    struct sock_fprog prog;
+    int j, ncpus, s, savedErrno;
+
+    ncpus = (cpus == NULL) ? 0 : nsocks;
+    if (nsocks <= 0 || 3 + 2 * ncpus > BPF_MAXINSNS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    code = calloc(3 + 2 * ncpus, sizeof(struct sock_filter));
+    if (code == NULL)
+        return -1;
+
+    /* A = CPU number; for each listed CPU, if A == cpus[j], return j;
+       otherwise, return (A % nsocks) */
+
+    p = code;
+    *p++ = (struct sock_filter)
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+    for (j = 0; j < ncpus; j++) {
+        *p++ = (struct sock_filter)
+                BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cpus[j], 0, 1);
+        *p++ = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, j);
+    }
+    *p++ = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, nsocks);
+    *p++ = (struct sock_filter) BPF_STMT(BPF_RET | BPF_A, 0);
+
+    /* It is sufficient to attach the program to one socket in the group */
+
+    prog.len = p - code;
+    prog.filter = code;
+    s = setsockopt(sfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                   &prog, sizeof(prog));
+    savedErrno = errno;
+    free(code);
+    errno = savedErrno;
+    return s;
+#else
+    errno = ENOPROTOOPT;
+    return -1;
+#endif
 }
 
 /* Create socket bound to wildcard IP address + port given in
@@ -162,7 +740,8 @@ inetListen(const char *service, int backlog, socklen_t *addrlen)
 int
 inetBind(const char *service, int type, socklen_t *addrlen)
 {
-    return inetPassiveSocket(service, type, addrlen, FALSE, 0);
+    return inetPassiveSocket(service, type, addrlen, FALSE, 0, FALSE,
+                             ISP_DEFAULT);
 }
 
 /* Given a socket address in 'addr', whose length is specified in
@@ -170,14 +749,23 @@ inetBind(const char *service, int type, socklen_t *addrlen)
    service names in the form "(hostname, port#)". The string is
    returned in the buffer pointed to by 'addrStr', and this value is
    also returned as the function result. The caller must specify the
-   size of the 'addrStr' buffer in 'addrStrLen'. */
+   size of the 'addrStr' buffer in 'addrStrLen'. If 'addrStr' is NULL,
+   the string is instead returned in a buffer (of IS_ADDR_STR_LEN bytes)
+   private to the calling thread, which is overwritten by the thread's
+   next such call. */
 
 char *
 inetAddressStr(const struct sockaddr *addr, socklen_t addrlen,
                char *addrStr, int addrStrLen)
 {
+    static __thread char tbuf[IS_ADDR_STR_LEN];
     char host[NI_MAXHOST], service[NI_MAXSERV];
 
+    if (addrStr == NULL) {
+        addrStr = tbuf;
+        addrStrLen = IS_ADDR_STR_LEN;
+    }
+
     if (getnameinfo(addr, addrlen, host, NI_MAXHOST,
                     service, NI_MAXSERV, NI_NUMERICSERV) == 0)
         snprintf(addrStr, addrStrLen, "(%s, %s)", host, service);
@@ -186,3 +774,44 @@ inetAddressStr(const struct sockaddr *addr, socklen_t addrlen,
 
     return addrStr;
 }
+
+/* As inetAddressStr(), but always return the numeric host address and
+   port number. This formats the address directly, rather than calling
+   getnameinfo(), so it is fast, and never blocks on a reverse DNS
+   lookup. Suitable, for example, for logging each accepted connection
+   in a busy server. As with inetAddressStr(), 'addrStr' may be NULL. */
+
+char *
+inetAddressStrNumeric(const struct sockaddr *addr, socklen_t addrlen,
+                      char *addrStr, int addrStrLen)
+{
+    static __thread char tbuf[IS_ADDR_STR_LEN];
+    char host[INET6_ADDRSTRLEN];
+    const void *ap;
+    in_port_t port;
+
+    if (addrStr == NULL) {
+        addrStr = tbuf;
+        addrStrLen = IS_ADDR_STR_LEN;
+    }
+
+    if (addr->sa_family == AF_INET &&
+            addrlen >= sizeof(struct sockaddr_in)) {
+        ap = &((const struct sockaddr_in *) addr)->sin_addr;
+        port = ((const struct sockaddr_in *) addr)->sin_port;
+    } else if (addr->sa_family == AF_INET6 &&
+            addrlen >= sizeof(struct sockaddr_in6)) {
+        ap = &((const struct sockaddr_in6 *) addr)->sin6_addr;
+        port = ((const struct sockaddr_in6 *) addr)->sin6_port;
+    } else {
+        snprintf(addrStr, addrStrLen, "(?UNKNOWN?)");
+        return addrStr;
+    }
+
+    if (inet_ntop(addr->sa_family, ap, host, sizeof(host)) == NULL)
+        snprintf(addrStr, addrStrLen, "(?UNKNOWN?)");
+    else
+        snprintf(addrStr, addrStrLen, "(%s, %u)", host, ntohs(port));
+
+    return addrStr;
+}
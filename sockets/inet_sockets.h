@@ -20,17 +20,56 @@
 #include <sys/socket.h>
 #include <netdb.h>
 
+/* Socket option profiles for inetSetProfile(), inetConnectProfile(),
+   and inetListenProfile() */
+
+#define ISP_DEFAULT     0       /* Kernel defaults */
+#define ISP_LOW_LATENCY 1       /* Small request/response exchanges */
+#define ISP_BULK        2       /* High-throughput transfers */
+#define ISP_MANY_IDLE   3       /* Many mostly idle connections */
+
+int inetSetProfile(int sfd, int type, int profile, int listening);
+
+int inetProfileFromStr(const char *name);
+
+const char *inetProfileName(int profile);
+
+int inetCork(int sfd, int on);
+
 int inetConnect(const char *host, const char *service, int type);
 
+int inetConnectProfile(const char *host, const char *service, int type,
+                int profile);
+
+#define IC_FASTOPEN 1      /* inetConnectRace(): use TCP Fast Open */
+
+int inetConnectRace(const char *host, const char *service, int type,
+                int attemptDelayMs, int timeoutMs, int flags);
+
 int inetListen(const char *service, int backlog, socklen_t *addrlen);
 
+int inetListenProfile(const char *service, int backlog, socklen_t *addrlen,
+                int profile);
+
+#define IL_CPU_STEER 1     /* inetListenMulti(): steer connections by CPU */
+
+int inetListenMulti(const char *service, int backlog, socklen_t *addrlen,
+                int sfds[], int nsocks, int flags);
+
+int inetSteerByCpu(int sfd, const int cpus[], int nsocks);
+
 int inetBind(const char *service, int type, socklen_t *addrlen);
 
 char *inetAddressStr(const struct sockaddr *addr, socklen_t addrlen,
                 char *addrStr, int addrStrLen);
 
+char *inetAddressStrNumeric(const struct sockaddr *addr, socklen_t addrlen,
+                char *addrStr, int addrStrLen);
+
 #define IS_ADDR_STR_LEN 4096
                         /* Suggested length for string buffer that caller
                            should pass to inetAddressStr(). Must be greater
-                           than (NI_MAXHOST + NI_MAXSERV + 4) */
+                           than (NI_MAXHOST + NI_MAXSERV + 4). Also the
+                           size of the per-thread buffer used when the
+                           caller passes NULL. */
 #endif
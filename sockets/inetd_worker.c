@@ -0,0 +1,101 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 60 */
+
+/* inetd_worker.c
+
+   The worker side of the pre-forking superserver in prefork_inetd.c.
+
+   A program invoked by inetd (such as is_echo_inetd_sv.c) handles one
+   connection, on its standard input and output, and exits; the cost of
+   creating and execing a process is paid for every connection. A
+   program that instead calls inetdWorkerNext() in a loop:
+
+        while (inetdWorkerNext() == 0) {
+            Handle the connection on STDIN_FILENO and STDOUT_FILENO
+            (flushing any stdio output before the next call)
+        }
+        exit(EXIT_SUCCESS);
+
+   can serve many connections in one process, when run as a "pool"
+   service by prefork_inetd.c, which passes it each connection over a
+   UNIX domain socket whose descriptor number is given by the
+   environment variable INETD_WORKER_FD. The same program still works
+   under an ordinary inetd: if INETD_WORKER_FD is not set, the first
+   call returns 0 (the connection is already on standard input and
+   output), and the second returns -1.
+
+   Each call after the first closes the previous connection (by making
+   standard input and output refer to /dev/null), tells the superserver
+   that we are idle, and waits for the next connection. It returns 0
+   once the new connection is on standard input and output, or -1 when
+   the program should exit: when the superserver has retired this
+   worker (or itself terminated), or on error.
+*/
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "scm_functions.h"
+#include "inetd_worker.h"       /* Declares function defined here */
+
+static int chan = -2;           /* Connection to superserver; -1 if none;
+                                   -2 if not yet known */
+static long served;             /* Connections handled so far */
+
+/* Make standard input and output refer to 'fd' */
+
+static int
+attachStdio(int fd)
+{
+    if (dup2(fd, STDIN_FILENO) == -1 || dup2(fd, STDOUT_FILENO) == -1)
+        return -1;
+    return 0;
+}
+
+int
+inetdWorkerNext(void)
+{
+    const char *s;
+    int fd, ok;
+
+    if (chan == -2) {
+        s = getenv(INETD_WORKER_ENV);
+        chan = (s != NULL) ? atoi(s) : -1;
+    }
+
+    if (chan == -1)                     /* Invoked by an ordinary inetd */
+        return (served++ == 0) ? 0 : -1;
+
+    if (served > 0) {
+
+        /* Close the previous connection, so that the client sees EOF, and
+           report that we are ready for another */
+
+        fd = open("/dev/null", O_RDWR);
+        if (fd == -1)
+            return -1;
+        ok = attachStdio(fd) == 0;
+        close(fd);
+        if (!ok || write(chan, "D", 1) != 1)
+            return -1;
+    }
+
+    fd = recvfd(chan);                  /* Fails at EOF (we are retired) */
+    if (fd == -1)
+        return -1;
+    ok = attachStdio(fd) == 0;
+    close(fd);
+    if (!ok)
+        return -1;
+
+    served++;
+    return 0;
+}
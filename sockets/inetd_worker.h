@@ -0,0 +1,27 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 60 */
+
+/* inetd_worker.h
+
+   Header file for inetd_worker.c.
+*/
+#ifndef INETD_WORKER_H
+#define INETD_WORKER_H          /* Prevent accidental double inclusion */
+
+/* Environment variable through which prefork_inetd.c tells a worker the
+   number of the descriptor on which connections arrive */
+
+#define INETD_WORKER_ENV "INETD_WORKER_FD"
+
+int inetdWorkerNext(void);
+
+#endif
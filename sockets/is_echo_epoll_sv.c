@@ -0,0 +1,372 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 60 */
+
+/* is_echo_epoll_sv.c
+
+   An implementation of the TCP "echo" service that, instead of creating
+   a child process for each client (as is done by is_echo_sv.c and
+   is_echo_v2_sv.c), handles all clients in a single process, using
+   edge-triggered epoll notification and nonblocking sockets.
+
+   Usage: is_echo_epoll_sv [-i] [-t nthreads] [-s service]
+
+        -i           Invoked from inetd(8): handle the single connection
+                     on STDIN_FILENO, and then terminate
+        -t nthreads  Create 'nthreads' worker threads (default: 1). Each
+                     thread has its own epoll instance, and accepts and
+                     handles its own connections.
+        -s service   Listen on 'service' instead of "echo"
+
+   If run from inetd(8), place a line similar to the following in
+   /etc/inetd.conf (you will need to modify <some-path> as required):
+
+        echo stream tcp nowait root /some-path/is_echo_epoll_sv is_echo_epoll_sv -i
+
+   Each connection has a fixed-size ring buffer (RING_SIZE bytes). Input
+   is read from the socket into the free space in the ring, and the data
+   in the ring is written back to the socket. If the client is slow to
+   read, so that the ring fills, we simply stop reading from that client
+   until its socket becomes writable again; input then remains queued in
+   the kernel, which in turn applies TCP flow control to the client.
+
+   Because the listening socket is shared by all worker threads, it is
+   added to each epoll instance with the EPOLLEXCLUSIVE flag (Linux 4.5
+   and later), so that each new connection wakes just one thread.
+
+   This program is Linux-specific.
+
+   See also is_echo_sv.c and is_echo_v2_sv.c.
+*/
+#define _GNU_SOURCE
+#include <syslog.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "become_daemon.h"
+#include "inet_sockets.h"       /* Declares our socket functions */
+#include "tlpi_hdr.h"
+
+#define SERVICE "echo"          /* Name of TCP service */
+
+#define RING_SIZE 4096          /* Per-connection buffer; must be a power
+                                   of two */
+#define MAX_EVENTS 64           /* Maximum events fetched by epoll_wait() */
+#define MAX_THREADS 1024
+
+#ifndef EPOLLEXCLUSIVE          /* Defined in glibc 2.24 and later */
+#define EPOLLEXCLUSIVE (1u << 28)
+#endif
+
+struct conn {                   /* State for one client connection */
+    int fd;
+    Boolean eof;                /* Has client shut down its output? */
+    size_t head;                /* Total bytes placed in 'ring' */
+    size_t tail;                /* Total bytes sent from 'ring' */
+    char ring[RING_SIZE];
+};
+
+static int lfd = -1;            /* Listening socket (-1 in inetd mode) */
+
+/* Set the O_NONBLOCK flag on 'fd' */
+
+static int
+setNonblocking(int fd)
+{
+    int flags;
+
+    flags = fcntl(fd, F_GETFL);
+    if (flags == -1)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Create a 'struct conn' for 'fd' and add 'fd' to the epoll interest list.
+   We ask for both input and output notifications once only: because we
+   use edge-triggered notification, there is no need to later modify the
+   event mask as the ring buffer fills and empties. */
+
+static int
+addConn(int epfd, int fd)
+{
+    struct epoll_event ev;
+    struct conn *c;
+
+    if (setNonblocking(fd) == -1)
+        return -1;
+
+    c = malloc(sizeof(struct conn));
+    if (c == NULL)
+        return -1;
+    c->fd = fd;
+    c->eof = FALSE;
+    c->head = c->tail = 0;
+
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        free(c);
+        return -1;
+    }
+    return 0;
+}
+
+/* Build an iovec describing the part of the ring that starts at offset
+   'from' and contains 'len' bytes (which may wrap around the end of the
+   ring). Returns the number of iovec elements used (0, 1, or 2). */
+
+static int
+ringIov(struct conn *c, size_t from, size_t len, struct iovec iov[2])
+{
+    size_t off, first;
+
+    if (len == 0)
+        return 0;
+
+    off = from & (RING_SIZE - 1);
+    first = min(len, RING_SIZE - off);
+    iov[0].iov_base = c->ring + off;
+    iov[0].iov_len = first;
+    if (first == len)
+        return 1;
+
+    iov[1].iov_base = c->ring;
+    iov[1].iov_len = len - first;
+    return 2;
+}
+
+/* Move as much data as possible from the socket into the ring, and from
+   the ring back to the socket. Because notification is edge-triggered, we
+   must continue until neither direction makes progress (i.e., the socket
+   has no more input or the ring is full, and the socket can't accept more
+   output or the ring is empty). Returns TRUE if the connection should be
+   closed. */
+
+static Boolean
+serviceConn(struct conn *c)
+{
+    struct iovec iov[2];
+    ssize_t numRead, numWritten;
+    Boolean progress;
+    int cnt;
+
+    do {
+        progress = FALSE;
+
+        cnt = ringIov(c, c->head, RING_SIZE - (c->head - c->tail), iov);
+        if (!c->eof && cnt > 0) {
+            numRead = readv(c->fd, iov, cnt);
+            if (numRead > 0) {
+                c->head += numRead;
+                progress = TRUE;
+            } else if (numRead == 0) {
+                c->eof = TRUE;
+            } else if (errno != EAGAIN && errno != EINTR) {
+                syslog(LOG_ERR, "Error from read(): %s", strerror(errno));
+                return TRUE;
+            }
+        }
+
+        cnt = ringIov(c, c->tail, c->head - c->tail, iov);
+        if (cnt > 0) {
+            numWritten = writev(c->fd, iov, cnt);
+            if (numWritten > 0) {
+                c->tail += numWritten;
+                progress = TRUE;
+            } else if (numWritten == -1 && errno != EAGAIN && errno != EINTR) {
+                if (errno != EPIPE && errno != ECONNRESET)
+                    syslog(LOG_ERR, "write() failed: %s", strerror(errno));
+                return TRUE;
+            }
+        }
+    } while (progress);
+
+    /* Once the client has shut down its output and we've sent back
+       everything that it sent us, we're done */
+
+    return c->eof && c->head == c->tail;
+}
+
+/* Accept all pending connections on the (nonblocking) listening socket */
+
+static void
+acceptConns(int epfd)
+{
+    int cfd;
+
+    for (;;) {
+        cfd = accept(lfd, NULL, NULL);
+        if (cfd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+                    errno != ECONNABORTED)
+                syslog(LOG_ERR, "Failure in accept(): %s", strerror(errno));
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            return;
+        }
+
+        if (addConn(epfd, cfd) == -1) {
+            syslog(LOG_ERR, "Can't add connection (%s)", strerror(errno));
+            close(cfd);         /* Give up on this client */
+        }
+    }
+}
+
+/* Worker thread (or, in inetd mode, the main thread): run an event loop
+   on a private epoll instance. If 'cfd' is not -1, it is a connection
+   that is handled as the sole client, and the loop terminates when that
+   connection is closed. Otherwise, we accept connections on 'lfd'. */
+
+static void *
+eventLoop(void *arg)
+{
+    struct epoll_event ev, evlist[MAX_EVENTS];
+    struct conn *c;
+    int epfd, ready, j, cfd, numConns;
+
+    cfd = (int) (long) arg;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        syslog(LOG_ERR, "Error from epoll_create1(): %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (cfd != -1) {
+        if (addConn(epfd, cfd) == -1) {
+            syslog(LOG_ERR, "Can't add connection (%s)", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = NULL;             /* NULL identifies listening socket */
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev) == -1) {
+            syslog(LOG_ERR, "Error from epoll_ctl(): %s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    numConns = (cfd != -1) ? 1 : 0;
+
+    for (;;) {
+        ready = epoll_wait(epfd, evlist, MAX_EVENTS, -1);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;               /* Restart if interrupted by signal */
+            syslog(LOG_ERR, "Error from epoll_wait(): %s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        for (j = 0; j < ready; j++) {
+            c = evlist[j].data.ptr;
+            if (c == NULL) {
+                acceptConns(epfd);
+                continue;
+            }
+
+            /* Closing the socket also removes it from the interest list */
+
+            if (serviceConn(c) || (evlist[j].events & (EPOLLERR | EPOLLHUP))) {
+                close(c->fd);
+                free(c);
+                if (cfd != -1 && --numConns == 0)
+                    exit(EXIT_SUCCESS);         /* inetd mode: all done */
+            }
+        }
+    }
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-i] [-t nthreads] [-s service]\n", progName);
+    fprintf(stderr, "    -i           Invoked from inetd; handle "
+                    "connection on stdin\n");
+    fprintf(stderr, "    -t nthreads  Number of worker threads "
+                    "(default: 1)\n");
+    fprintf(stderr, "    -s service   Service to listen on "
+                    "(default: \"%s\")\n", SERVICE);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    Boolean inetdMode;
+    const char *service;
+    pthread_t *tids;
+    int opt, numThreads, j, s;
+
+    inetdMode = FALSE;
+    numThreads = 1;
+    service = SERVICE;
+    while ((opt = getopt(argc, argv, "it:s:")) != -1) {
+        switch (opt) {
+        case 'i':   inetdMode = TRUE;                                   break;
+        case 't':   numThreads = getInt(optarg, GN_GT_0, "nthreads");   break;
+        case 's':   service = optarg;                                   break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (numThreads > MAX_THREADS)
+        usageError(argv[0]);
+
+    /* Ignore the SIGPIPE signal, so that we find out about broken
+       connection errors via a failure from write() */
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    /* The "-i" option means we were invoked from inetd(8), so that
+       all we need to do is handle the connection on STDIN_FILENO */
+
+    if (inetdMode) {
+        eventLoop((void *) (long) STDIN_FILENO);
+        exit(EXIT_SUCCESS);             /* Not reached */
+    }
+
+    if (becomeDaemon(0) == -1)
+        errExit("becomeDaemon");
+
+    lfd = inetListen(service, SOMAXCONN, NULL);
+    if (lfd == -1) {
+        syslog(LOG_ERR, "Could not create server socket (%s)", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (setNonblocking(lfd) == -1) {
+        syslog(LOG_ERR, "Error from fcntl(): %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    /* The main thread serves as one of the workers */
+
+    tids = calloc(numThreads, sizeof(pthread_t));
+    if (tids == NULL) {
+        syslog(LOG_ERR, "Error from calloc(): %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (j = 1; j < numThreads; j++) {
+        s = pthread_create(&tids[j], NULL, eventLoop, (void *) -1L);
+        if (s != 0) {
+            syslog(LOG_ERR, "Error from pthread_create(): %s", strerror(s));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    eventLoop((void *) -1L);
+    exit(EXIT_SUCCESS);                 /* Not reached */
+}
@@ -0,0 +1,210 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 63 */
+
+/* is_echo_evloop_sv.c
+
+   An implementation of the TCP "echo" service, written in terms of the
+   completion-based operations of the event loop library in event_loop.c
+   (evAccept(), evRead(), and evWrite()), so that it can run with either
+   an epoll or an io_uring backend.
+
+   Usage: is_echo_evloop_sv [-b backend] [-r secs] [service]
+
+        -b backend   "epoll" or "uring" (default: io_uring if available,
+                     else epoll; see evLoopCreate())
+        -r secs      Every 'secs' seconds, report the number of connections
+                     and bytes echoed (uses evAddTimer())
+        service      Listen on 'service' instead of "echo"
+
+   The server terminates cleanly (via evAddSignal()) on receipt of SIGINT
+   or SIGTERM.
+
+   This program is Linux-specific.
+
+   See also is_echo_epoll_sv.c, which uses epoll directly.
+*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include "event_loop.h"
+#include "inet_sockets.h"       /* Declares our socket functions */
+#include "tlpi_hdr.h"
+
+#define SERVICE "echo"          /* Name of TCP service */
+#define BUF_SIZE 4096
+
+struct conn {                   /* State for one client connection */
+    int fd;
+    size_t len;                 /* Bytes in 'buf' */
+    size_t sent;                /* Bytes from 'buf' already written */
+    char buf[BUF_SIZE];
+};
+
+static long activeConns, totalConns;
+static long long totalBytes;
+
+static void readDone(struct evLoop *loop, int fd, ssize_t res, void *arg);
+
+static void
+closeConn(struct evLoop *loop, struct conn *c)
+{
+    evDelFd(loop, c->fd);
+    close(c->fd);
+    free(c);
+    activeConns--;
+}
+
+static void
+writeDone(struct evLoop *loop, int fd, ssize_t res, void *arg)
+{
+    struct conn *c = arg;
+
+    if (res < 0) {
+        closeConn(loop, c);
+        return;
+    }
+
+    c->sent += res;
+    totalBytes += res;
+    if (c->sent < c->len) {             /* Partial write: write the rest */
+        if (evWrite(loop, fd, c->buf + c->sent, c->len - c->sent,
+                    writeDone, c) == -1)
+            errExit("evWrite");
+    } else {
+        if (evRead(loop, fd, c->buf, BUF_SIZE, readDone, c) == -1)
+            errExit("evRead");
+    }
+}
+
+static void
+readDone(struct evLoop *loop, int fd, ssize_t res, void *arg)
+{
+    struct conn *c = arg;
+
+    if (res <= 0) {                     /* EOF or error */
+        closeConn(loop, c);
+        return;
+    }
+
+    c->len = res;
+    c->sent = 0;
+    if (evWrite(loop, fd, c->buf, c->len, writeDone, c) == -1)
+        errExit("evWrite");
+}
+
+static void
+acceptDone(struct evLoop *loop, int lfd, ssize_t res, void *arg)
+{
+    struct conn *c;
+
+    if (res < 0) {
+        errno = -res;
+        errMsg("accept");
+    } else {
+        c = malloc(sizeof(struct conn));
+        if (c == NULL)
+            errExit("malloc");
+        c->fd = res;
+        if (fcntl(c->fd, F_SETFL, O_NONBLOCK) == -1)
+            errExit("fcntl");
+        activeConns++;
+        totalConns++;
+        if (evRead(loop, c->fd, c->buf, BUF_SIZE, readDone, c) == -1)
+            errExit("evRead");
+    }
+
+    if (evAccept(loop, lfd, acceptDone, NULL) == -1)    /* Next one */
+        errExit("evAccept");
+}
+
+static void
+reportTimer(struct evLoop *loop, int timerId, unsigned long long exp,
+            void *arg)
+{
+    printf("connections: active=%ld total=%ld; bytes echoed: %lld\n",
+            activeConns, totalConns, totalBytes);
+}
+
+static void
+termSignal(struct evLoop *loop, int sig, void *arg)
+{
+    printf("Caught signal %d; terminating\n", sig);
+    evStop(loop);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-b epoll|uring] [-r secs] [service]\n",
+            progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct evLoop *loop;
+    int opt, backend, reportSecs, lfd;
+
+    backend = EV_BACKEND_DEFAULT;
+    reportSecs = 0;
+    while ((opt = getopt(argc, argv, "b:r:")) != -1) {
+        switch (opt) {
+        case 'b':
+            if (strcmp(optarg, "epoll") == 0)
+                backend = EV_BACKEND_EPOLL;
+            else if (strcmp(optarg, "uring") == 0)
+                backend = EV_BACKEND_URING;
+            else
+                usageError(argv[0]);
+            break;
+        case 'r':   reportSecs = getInt(optarg, GN_GT_0, "secs");       break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind + 1 < argc)
+        usageError(argv[0]);
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    lfd = inetListen((optind < argc) ? argv[optind] : SERVICE, SOMAXCONN,
+                     NULL);
+    if (lfd == -1)
+        errExit("inetListen");
+    if (fcntl(lfd, F_SETFL, O_NONBLOCK) == -1)
+        errExit("fcntl");
+
+    loop = evLoopCreate(backend);
+    if (loop == NULL)
+        errExit("evLoopCreate");
+    printf("Using %s backend\n", evLoopBackend(loop));
+    setbuf(stdout, NULL);
+
+    if (evAccept(loop, lfd, acceptDone, NULL) == -1)
+        errExit("evAccept");
+    if (evAddSignal(loop, SIGINT, termSignal, NULL) == -1 ||
+            evAddSignal(loop, SIGTERM, termSignal, NULL) == -1)
+        errExit("evAddSignal");
+    if (reportSecs > 0 && evAddTimer(loop, reportSecs * 1000L,
+                                     reportSecs * 1000L, reportTimer,
+                                     NULL) == -1)
+        errExit("evAddTimer");
+
+    if (evRun(loop) == -1)
+        errExit("evRun");
+
+    reportTimer(loop, -1, 0, NULL);
+    evLoopDestroy(loop);
+    exit(EXIT_SUCCESS);
+}
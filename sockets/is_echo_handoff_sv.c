@@ -0,0 +1,539 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* is_echo_handoff_sv.c
+
+   A single-process, epoll-based TCP "echo" server (like
+   is_echo_epoll_sv.c) that can be restarted without clients noticing:
+   a new instance takes over the listening socket, and the idle client
+   connections, from the running instance, using the handoff mechanism
+   in sock_handoff.c.
+
+   Usage: is_echo_handoff_sv [-f] [-I] [-s service] [-H path]
+
+        -f           Stay in the foreground, instead of becoming a daemon,
+                     and also log to standard error
+        -I           When replaced, hand off only the listening socket,
+                     and finish serving the existing connections
+        -s service   Listen on 'service' instead of "echo"
+        -H path      Handoff socket (default: /tmp/is_echo_handoff)
+
+   To restart the server, simply start another instance with the same
+   handoff socket. The new instance receives the listening socket (whose
+   listen queue is thus never lost) and the client connections. To make
+   the connections idle--with no echoed data waiting to be sent--the old
+   instance first stops reading from them, and sends what it has already
+   read (for at most QUIESCE_MS milliseconds); it finishes serving any
+   connections that are still not idle, and then exits. A client that is
+   sending data at the moment of the handoff doesn't notice: its data
+   waits in the socket until the new instance reads it. If no instance is
+   running, the new instance creates its listening socket in the usual
+   way.
+
+   Try (is_echo_load.c measures failed and slow connections):
+
+        ./is_echo_handoff_sv -f -s 51000 &
+        ./is_echo_load -d 10 -k localhost 51000 &
+        sleep 3; ./is_echo_handoff_sv -f -s 51000 &
+        sleep 3; ./is_echo_handoff_sv -f -s 51000 &
+
+   This program is Linux-specific.
+
+   See also is_echo_sv.c, is_echo_v2_sv.c, and is_echo_epoll_sv.c.
+*/
+#define _GNU_SOURCE
+#include <syslog.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "become_daemon.h"
+#include "inet_sockets.h"       /* Declares our socket functions */
+#include "sock_handoff.h"
+#include "tlpi_hdr.h"
+
+#define SERVICE "echo"          /* Name of TCP service */
+#define HANDOFF_PATH "/tmp/is_echo_handoff"
+#define HANDOFF_TIMEOUT_MS 5000 /* How long the old instance waits for the
+                                   new one to acknowledge the handoff */
+
+#define QUIESCE_MS 1000         /* How long we wait for connections to become
+                                   idle before a handoff */
+
+#define RING_SIZE 4096          /* Per-connection buffer; must be a power
+                                   of two */
+#define MAX_EVENTS 64           /* Maximum events fetched by epoll_wait() */
+
+struct conn {                   /* State for one client connection */
+    int fd;
+    Boolean eof;                /* Has client shut down its output? */
+    size_t head;                /* Total bytes placed in 'ring' */
+    size_t tail;                /* Total bytes sent from 'ring' */
+    struct conn *prev, *next;   /* In the list of all connections */
+    char ring[RING_SIZE];
+};
+
+static struct conn conns = { -1, FALSE, 0, 0, &conns, &conns, { 0 } };
+                                /* Head of circular list of connections */
+static int numConns;
+
+static int epfd;
+static int lfd = -1;            /* Listening socket */
+static int hfd = -1;            /* Handoff socket */
+static char lfdTag, hfdTag;     /* Their epoll 'data.ptr' values */
+static Boolean quiescing;       /* Handoff requested: don't read from
+                                   connections, so that they become idle */
+static struct timespec quiesceEnd;
+static Boolean draining;        /* Handed off: finish and exit */
+
+/* Set the O_NONBLOCK flag on 'fd' */
+
+static int
+setNonblocking(int fd)
+{
+    int flags;
+
+    flags = fcntl(fd, F_GETFL);
+    if (flags == -1)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Add 'fd' to the epoll interest list, with 'ptr' as its data */
+
+static int
+watch(int fd, uint32_t events, void *ptr)
+{
+    struct epoll_event ev;
+
+    ev.events = events;
+    ev.data.ptr = ptr;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* Create a 'struct conn' for 'fd' and add 'fd' to the epoll interest
+   list (as in is_echo_epoll_sv.c) */
+
+static int
+addConn(int fd)
+{
+    struct conn *c;
+
+    if (setNonblocking(fd) == -1)
+        return -1;
+
+    c = malloc(sizeof(struct conn));
+    if (c == NULL)
+        return -1;
+    c->fd = fd;
+    c->eof = FALSE;
+    c->head = c->tail = 0;
+
+    if (watch(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, c) == -1) {
+        free(c);
+        return -1;
+    }
+
+    c->next = conns.next;
+    c->prev = &conns;
+    conns.next->prev = c;
+    conns.next = c;
+    numConns++;
+    return 0;
+}
+
+/* Close a connection (which also removes it from the interest list) */
+
+static void
+dropConn(struct conn *c)
+{
+    close(c->fd);
+    c->prev->next = c->next;
+    c->next->prev = c->prev;
+    free(c);
+    numConns--;
+}
+
+/* Build an iovec describing the part of the ring that starts at offset
+   'from' and contains 'len' bytes (which may wrap around the end of the
+   ring). Returns the number of iovec elements used (0, 1, or 2). */
+
+static int
+ringIov(struct conn *c, size_t from, size_t len, struct iovec iov[2])
+{
+    size_t off, first;
+
+    if (len == 0)
+        return 0;
+
+    off = from & (RING_SIZE - 1);
+    first = min(len, RING_SIZE - off);
+    iov[0].iov_base = c->ring + off;
+    iov[0].iov_len = first;
+    if (first == len)
+        return 1;
+
+    iov[1].iov_base = c->ring;
+    iov[1].iov_len = len - first;
+    return 2;
+}
+
+/* Move as much data as possible from the socket into the ring, and from
+   the ring back to the socket (as in is_echo_epoll_sv.c). Returns TRUE
+   if the connection should be closed. */
+
+static Boolean
+serviceConn(struct conn *c)
+{
+    struct iovec iov[2];
+    ssize_t numRead, numWritten;
+    Boolean progress;
+    int cnt;
+
+    do {
+        progress = FALSE;
+
+        cnt = ringIov(c, c->head, RING_SIZE - (c->head - c->tail), iov);
+        if (!c->eof && !quiescing && cnt > 0) {
+            numRead = readv(c->fd, iov, cnt);
+            if (numRead > 0) {
+                c->head += numRead;
+                progress = TRUE;
+            } else if (numRead == 0) {
+                c->eof = TRUE;
+            } else if (errno != EAGAIN && errno != EINTR) {
+                if (errno != ECONNRESET)
+                    syslog(LOG_ERR, "Error from read(): %s", strerror(errno));
+                return TRUE;
+            }
+        }
+
+        cnt = ringIov(c, c->tail, c->head - c->tail, iov);
+        if (cnt > 0) {
+            numWritten = writev(c->fd, iov, cnt);
+            if (numWritten > 0) {
+                c->tail += numWritten;
+                progress = TRUE;
+            } else if (numWritten == -1 && errno != EAGAIN && errno != EINTR) {
+                if (errno != EPIPE && errno != ECONNRESET)
+                    syslog(LOG_ERR, "write() failed: %s", strerror(errno));
+                return TRUE;
+            }
+        }
+    } while (progress);
+
+    return c->eof && c->head == c->tail;
+}
+
+/* Accept all pending connections on the (nonblocking) listening socket */
+
+static void
+acceptConns(void)
+{
+    int cfd;
+
+    for (;;) {
+        cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (cfd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                syslog(LOG_ERR, "Failure in accept(): %s", strerror(errno));
+            return;
+        }
+
+        if (addConn(cfd) == -1) {
+            syslog(LOG_ERR, "Can't add connection (%s)", strerror(errno));
+            close(cfd);         /* Give up on this client */
+        }
+    }
+}
+
+/* Return the number of milliseconds until the end of the quiescing
+   period (0 if it is over) */
+
+static int
+quiesceMsLeft(void)
+{
+    struct timespec now;
+    long ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms = (quiesceEnd.tv_sec - now.tv_sec) * 1000 +
+         (quiesceEnd.tv_nsec - now.tv_nsec) / 1000000;
+    return (ms > 0) ? ms : 0;
+}
+
+/* Are all connections idle, with no echoed data waiting to be sent? */
+
+static Boolean
+allIdle(void)
+{
+    struct conn *c;
+
+    for (c = conns.next; c != &conns; c = c->next)
+        if (c->head != c->tail)
+            return FALSE;
+    return TRUE;
+}
+
+/* A new instance has connected to the handoff socket. Stop reading from
+   our connections, so that they become idle as we send the data that we
+   have already read; the handoff is made (by handOff()) once they are
+   all idle, or after QUIESCE_MS milliseconds. Meanwhile, we stop
+   monitoring the handoff socket (which remains readable). */
+
+static void
+startQuiesce(void)
+{
+    if (epoll_ctl(epfd, EPOLL_CTL_DEL, hfd, NULL) == -1) {
+        syslog(LOG_ERR, "Error from epoll_ctl(): %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    quiescing = TRUE;
+    clock_gettime(CLOCK_MONOTONIC, &quiesceEnd);
+    quiesceEnd.tv_sec += QUIESCE_MS / 1000;
+    quiesceEnd.tv_nsec += (QUIESCE_MS % 1000) * 1000000L;
+    if (quiesceEnd.tv_nsec >= 1000000000L) {
+        quiesceEnd.tv_sec++;
+        quiesceEnd.tv_nsec -= 1000000000L;
+    }
+}
+
+/* Give the new instance the listening socket and (unless 'keepConns')
+   the idle connections; we then finish with the others, and exit. Since
+   the echo protocol has no state beyond the data still to be sent, any
+   data that a client sends to an idle connection is simply read by the
+   new instance instead of by us. */
+
+static void
+handOff(Boolean keepConns)
+{
+    struct conn *c, *next, **idle;
+    int *cfds, nidle, j;
+
+    quiescing = FALSE;
+
+    idle = calloc(numConns + 1, sizeof(struct conn *));
+    cfds = calloc(numConns + 1, sizeof(int));
+    if (idle == NULL || cfds == NULL) {
+        syslog(LOG_ERR, "Error from calloc(): %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    nidle = 0;
+    if (!keepConns) {
+        for (c = conns.next; c != &conns; c = c->next) {
+            if (!c->eof && c->head == c->tail) {
+                idle[nidle] = c;
+                cfds[nidle++] = c->fd;
+            }
+        }
+    }
+
+    if (handoffGive(hfd, &lfd, 1, cfds, nidle, HANDOFF_TIMEOUT_MS) == -1) {
+        syslog(LOG_WARNING, "Handoff failed (%s); continuing",
+               strerror(errno));
+        if (watch(hfd, EPOLLIN, &hfdTag) == -1) {
+            syslog(LOG_ERR, "Error from epoll_ctl(): %s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        /* Read the input that accumulated while we were quiescing (for
+           which, since we use edge-triggered notification, no further
+           events may arrive) */
+
+        for (c = conns.next; c != &conns; c = next) {
+            next = c->next;
+            if (serviceConn(c))
+                dropConn(c);
+        }
+    } else {
+        close(lfd);             /* Our copies; the new instance has its own */
+        close(hfd);             /* Don't unlink: the path is now the new
+                                   instance's */
+        lfd = hfd = -1;
+        for (j = 0; j < nidle; j++)
+            dropConn(idle[j]);
+        draining = TRUE;
+        syslog(LOG_INFO, "Handed off %d connections; %d to finish", nidle,
+               numConns);
+    }
+
+    free(idle);
+    free(cfds);
+}
+
+/* Take over from a running instance, if there is one. Returns TRUE if
+   we obtained a listening socket. */
+
+static Boolean
+takeOver(const char *path)
+{
+    int lfds[HANDOFF_MAX_LISTEN], *cfds;
+    int sfd, nlisten, nconn, j;
+    Boolean ok;
+
+    sfd = handoffTake(path, lfds, &nlisten, &cfds, &nconn);
+    if (sfd == -1) {
+        if (errno != ENOENT && errno != ECONNREFUSED)
+            syslog(LOG_WARNING, "Handoff from %s failed: %s", path,
+                   strerror(errno));
+        return FALSE;
+    }
+
+    lfd = lfds[0];
+    for (j = 1; j < nlisten; j++)       /* We use only one */
+        close(lfds[j]);
+    if (watch(lfd, EPOLLIN, &lfdTag) == -1) {
+        syslog(LOG_ERR, "Error from epoll_ctl(): %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    /* Serve the connections only once the old instance has confirmed
+       that it has stopped serving them */
+
+    ok = handoffAck(sfd) == 0;
+    for (j = 0; j < nconn; j++) {
+        if (!ok || addConn(cfds[j]) == -1)
+            close(cfds[j]);
+    }
+    free(cfds);
+
+    syslog(LOG_INFO, "Took over listening socket and %d connections",
+           ok ? nconn : 0);
+    return TRUE;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-f] [-I] [-s service] [-H path]\n",
+            progName);
+    fprintf(stderr, "    -f           Stay in foreground\n");
+    fprintf(stderr, "    -I           Don't hand off connections\n");
+    fprintf(stderr, "    -s service   Service to listen on "
+                    "(default: \"%s\")\n", SERVICE);
+    fprintf(stderr, "    -H path      Handoff socket (default: %s)\n",
+            HANDOFF_PATH);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct epoll_event evlist[MAX_EVENTS];
+    Boolean foreground, keepConns;
+    const char *service, *path;
+    Boolean handoffRequested;
+    struct conn *c;
+    void *ptr;
+    int opt, ready, j;
+
+    foreground = FALSE;
+    keepConns = FALSE;
+    service = SERVICE;
+    path = HANDOFF_PATH;
+    while ((opt = getopt(argc, argv, "fIs:H:")) != -1) {
+        switch (opt) {
+        case 'f':   foreground = TRUE;          break;
+        case 'I':   keepConns = TRUE;            break;
+        case 's':   service = optarg;           break;
+        case 'H':   path = optarg;              break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    /* Ignore the SIGPIPE signal, so that we find out about broken
+       connection errors via a failure from write() */
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    if (!foreground && becomeDaemon(0) == -1)
+        errExit("becomeDaemon");
+    openlog("is_echo_handoff_sv", LOG_PID | (foreground ? LOG_PERROR : 0),
+            LOG_DAEMON);
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        syslog(LOG_ERR, "Error from epoll_create1(): %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (!takeOver(path)) {
+        lfd = inetListen(service, SOMAXCONN, NULL);
+        if (lfd == -1) {
+            syslog(LOG_ERR, "Could not create server socket (%s)",
+                   strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (setNonblocking(lfd) == -1 || watch(lfd, EPOLLIN, &lfdTag) == -1) {
+            syslog(LOG_ERR, "Error setting up listening socket: %s",
+                   strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* Be ready to hand over to our own successor */
+
+    hfd = handoffListen(path);
+    if (hfd == -1 || watch(hfd, EPOLLIN, &hfdTag) == -1) {
+        syslog(LOG_ERR, "Could not create handoff socket %s (%s)", path,
+               strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    while (!draining || numConns > 0) {
+        ready = epoll_wait(epfd, evlist, MAX_EVENTS,
+                           quiescing ? quiesceMsLeft() : -1);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "Error from epoll_wait(): %s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        handoffRequested = FALSE;
+        for (j = 0; j < ready; j++) {
+            ptr = evlist[j].data.ptr;
+            if (ptr == &lfdTag) {
+                if (lfd != -1)
+                    acceptConns();
+            } else if (ptr == &hfdTag) {
+                handoffRequested = TRUE;
+            } else {
+                c = ptr;
+                if (serviceConn(c) ||
+                        (evlist[j].events & (EPOLLERR | EPOLLHUP)))
+                    dropConn(c);
+            }
+        }
+
+        /* Hand off only after this batch of events has been handled,
+           since handOff() frees connections that may appear in it */
+
+        if (handoffRequested) {
+            if (keepConns)
+                handOff(TRUE);
+            else
+                startQuiesce();
+        }
+        if (quiescing && (allIdle() || quiesceMsLeft() == 0))
+            handOff(FALSE);
+    }
+
+    syslog(LOG_INFO, "All connections finished; exiting");
+    exit(EXIT_SUCCESS);
+}
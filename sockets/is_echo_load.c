@@ -0,0 +1,331 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* is_echo_load.c
+
+   A load generator for the TCP echo servers (is_echo_sv.c,
+   is_echo_epoll_sv.c, is_echo_handoff_sv.c, and so on), for observing
+   what clients see while a server is restarted. Each of a number of
+   client threads repeatedly sends a message to the server and checks
+   that the same message is echoed back; by default, each message uses a
+   new connection.
+
+   Usage: is_echo_load [-c conc] [-d secs] [-k] [-l len] host service
+
+        -c conc   Number of client threads (default: 8)
+        -d secs   Duration of the run (default: 10)
+        -k        Keep each connection open, and send messages on it
+                  until it fails (when a new one is made)
+        -l len    Message length (default: 64; at most 4096)
+
+   Each second, the program prints the number of messages echoed
+   successfully, the number of connect() failures (for example, refused
+   because no server is listening, or reset because the listening
+   socket was closed with connections in its queue), the number of other
+   failures (a connection reset, closed, returning the wrong data, or
+   not replying within IO_TIMEOUT_SECS seconds), the number of
+   connections that took a second or more to be established (the
+   signature of a SYN that was dropped, because the listen queue was
+   full or no socket was listening, and retransmitted), and the longest
+   time taken to connect. At the end, it shows the totals, and the
+   increase in the kernel's ListenOverflows and ListenDrops counters
+   (from /proc/net/netstat) during the run.
+
+   Try: restarting is_echo_epoll_sv.c (kill it and start it again), and
+   restarting is_echo_handoff_sv.c (start a new instance), while this
+   program runs; see is_echo_handoff_sv.c.
+
+   This program is Linux-specific (because of /proc/net/netstat).
+*/
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#define MAX_LEN 4096
+#define IO_TIMEOUT_SECS 5       /* A server that takes longer to reply
+                                   has failed */
+#define SLOW_CONNECT_MS 1000    /* A connect() taking this long had its SYN
+                                   retransmitted */
+
+struct counts {                 /* Per-thread counters, read (without
+                                   locking) by the main thread */
+    volatile long ok;
+    volatile long connErrs;
+    volatile long ioErrs;
+    volatile long slowConns;
+    volatile long maxConnMs;    /* Reset by the main thread each second */
+};
+
+struct client {
+    pthread_t tid;
+    struct counts cnt;
+};
+
+static struct sockaddr_storage addr;    /* Server address, resolved once */
+static socklen_t addrlen;
+static int addrFamily;
+static Boolean keepAlive;
+static int msgLen;
+static volatile Boolean stop;
+static const struct timeval ioTimeout = { IO_TIMEOUT_SECS, 0 };
+
+static long
+nowMs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/* Connect to the server, updating the counters in 'cnt'. Returns a
+   socket, or -1 on error. */
+
+static int
+connectServer(struct counts *cnt)
+{
+    long start, ms;
+    int sfd;
+
+    sfd = socket(addrFamily, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sfd == -1)
+        errExit("socket");
+    if (setsockopt(sfd, SOL_SOCKET, SO_RCVTIMEO, &ioTimeout,
+                   sizeof(ioTimeout)) == -1)
+        errExit("setsockopt");
+
+    start = nowMs();
+    if (connect(sfd, (struct sockaddr *) &addr, addrlen) == -1) {
+        close(sfd);
+        cnt->connErrs++;
+        return -1;
+    }
+
+    ms = nowMs() - start;
+    if (ms >= SLOW_CONNECT_MS)
+        cnt->slowConns++;
+    if (ms > cnt->maxConnMs)
+        cnt->maxConnMs = ms;
+    return sfd;
+}
+
+/* Send 'msg' on 'sfd' and check that it is echoed back. Returns 0 on
+   success, or -1 on error. */
+
+static int
+echoMsg(int sfd, const char *msg)
+{
+    char buf[MAX_LEN];
+    ssize_t numRead;
+    int got;
+
+    if (write(sfd, msg, msgLen) != msgLen)
+        return -1;
+    for (got = 0; got < msgLen; got += numRead) {
+        numRead = read(sfd, buf + got, msgLen - got);
+        if (numRead <= 0)
+            return -1;
+    }
+    return (memcmp(buf, msg, msgLen) == 0) ? 0 : -1;
+}
+
+static void *
+clientFunc(void *arg)
+{
+    struct client *cl = arg;
+    char msg[MAX_LEN];
+    long seq;
+    int sfd, j;
+
+    sfd = -1;
+    for (seq = 0; !stop; seq++) {
+        for (j = 0; j < msgLen; j++)    /* Vary the message */
+            msg[j] = 'a' + (seq + j) % 26;
+
+        if (sfd == -1) {
+            sfd = connectServer(&cl->cnt);
+            if (sfd == -1) {
+                usleep(10000);          /* Don't spin while server is down */
+                continue;
+            }
+        }
+
+        if (echoMsg(sfd, msg) == 0) {
+            cl->cnt.ok++;
+        } else {
+            cl->cnt.ioErrs++;
+            close(sfd);
+            sfd = -1;
+            continue;
+        }
+
+        if (!keepAlive) {
+            close(sfd);
+            sfd = -1;
+        }
+    }
+
+    if (sfd != -1)
+        close(sfd);
+    return NULL;
+}
+
+/* Obtain the ListenOverflows and ListenDrops counters from the "TcpExt"
+   lines of /proc/net/netstat (a line of names followed by a line of
+   values). Returns 0 on success, or -1 if they can't be found. */
+
+static int
+listenCounters(long *overflows, long *drops)
+{
+    char names[4096], values[4096];
+    char *np, *vp, *nsave, *vsave, *name, *val;
+    FILE *fp;
+    int found;
+
+    fp = fopen("/proc/net/netstat", "r");
+    if (fp == NULL)
+        return -1;
+
+    found = 0;
+    while (fgets(names, sizeof(names), fp) != NULL &&
+            fgets(values, sizeof(values), fp) != NULL) {
+        if (strncmp(names, "TcpExt:", 7) != 0)
+            continue;
+        for (np = names, vp = values; ; np = vp = NULL) {
+            name = strtok_r(np, " \n", &nsave);
+            val = strtok_r(vp, " \n", &vsave);
+            if (name == NULL || val == NULL)
+                break;
+            if (strcmp(name, "ListenOverflows") == 0) {
+                *overflows = atol(val);
+                found++;
+            } else if (strcmp(name, "ListenDrops") == 0) {
+                *drops = atol(val);
+                found++;
+            }
+        }
+    }
+    fclose(fp);
+    return (found == 2) ? 0 : -1;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-c conc] [-d secs] [-k] [-l len] "
+                    "host service\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct addrinfo hints, *res;
+    struct client *cl;
+    struct counts tot, prev;
+    long ovf0, drop0, ovf1, drop1, maxMs;
+    Boolean haveCounters;
+    int opt, conc, secs, sec, j, s;
+
+    conc = 8;
+    secs = 10;
+    msgLen = 64;
+    while ((opt = getopt(argc, argv, "c:d:kl:")) != -1) {
+        switch (opt) {
+        case 'c':   conc = getInt(optarg, GN_GT_0, "-c");       break;
+        case 'd':   secs = getInt(optarg, GN_GT_0, "-d");       break;
+        case 'k':   keepAlive = TRUE;                           break;
+        case 'l':   msgLen = getInt(optarg, GN_GT_0, "-l");     break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind + 2 != argc)
+        usageError(argv[0]);
+    if (msgLen > MAX_LEN)
+        cmdLineErr("-l must be at most %d\n", MAX_LEN);
+
+    /* Resolve the server address once, so that name lookups don't
+       contribute to the time taken by each connection */
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    s = getaddrinfo(argv[optind], argv[optind + 1], &hints, &res);
+    if (s != 0)
+        fatal("getaddrinfo: %s", gai_strerror(s));
+    memcpy(&addr, res->ai_addr, res->ai_addrlen);
+    addrlen = res->ai_addrlen;
+    addrFamily = res->ai_family;
+    freeaddrinfo(res);
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    haveCounters = listenCounters(&ovf0, &drop0) == 0;
+
+    cl = calloc(conc, sizeof(struct client));
+    if (cl == NULL)
+        errExit("calloc");
+    for (j = 0; j < conc; j++) {
+        s = pthread_create(&cl[j].tid, NULL, clientFunc, &cl[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    printf("%4s %9s %9s %9s %9s %9s\n", "sec", "ok", "conn-err",
+           "io-err", "slow-conn", "max-ms");
+    memset(&prev, 0, sizeof(prev));
+    maxMs = 0;
+    for (sec = 1; sec <= secs; sec++) {
+        sleep(1);
+
+        memset(&tot, 0, sizeof(tot));
+        for (j = 0; j < conc; j++) {
+            tot.ok += cl[j].cnt.ok;
+            tot.connErrs += cl[j].cnt.connErrs;
+            tot.ioErrs += cl[j].cnt.ioErrs;
+            tot.slowConns += cl[j].cnt.slowConns;
+            if (cl[j].cnt.maxConnMs > tot.maxConnMs)
+                tot.maxConnMs = cl[j].cnt.maxConnMs;
+            cl[j].cnt.maxConnMs = 0;
+        }
+        if (tot.maxConnMs > maxMs)
+            maxMs = tot.maxConnMs;
+
+        printf("%4d %9ld %9ld %9ld %9ld %9ld\n", sec, tot.ok - prev.ok,
+               tot.connErrs - prev.connErrs, tot.ioErrs - prev.ioErrs,
+               tot.slowConns - prev.slowConns, tot.maxConnMs);
+        fflush(stdout);
+        prev = tot;
+    }
+
+    stop = TRUE;
+    for (j = 0; j < conc; j++) {
+        s = pthread_join(cl[j].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    printf("%4s %9ld %9ld %9ld %9ld %9ld\n", "all", prev.ok,
+           prev.connErrs, prev.ioErrs, prev.slowConns, maxMs);
+    if (haveCounters && listenCounters(&ovf1, &drop1) == 0)
+        printf("ListenOverflows +%ld, ListenDrops +%ld (system-wide)\n",
+               ovf1 - ovf0, drop1 - drop0);
+
+    free(cl);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,53 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 60 */
+
+/* is_echo_pool_sv.c
+
+   A version of the inetd-invoked TCP "echo" service in is_echo_inetd_sv.c
+   that can also run as a "pool" service under prefork_inetd.c, serving
+   many connections in one process; the only change is the loop around
+   inetdWorkerNext() (see inetd_worker.c). Run by an ordinary inetd, it
+   behaves exactly as is_echo_inetd_sv.c does.
+*/
+#include <syslog.h>
+#include <signal.h>
+#include "inetd_worker.h"
+#include "tlpi_hdr.h"
+
+#define BUF_SIZE 4096
+
+int
+main(int argc, char *argv[])
+{
+    char buf[BUF_SIZE];
+    ssize_t numRead;
+
+    /* A client that goes away mustn't kill a process that is to serve
+       other clients */
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    while (inetdWorkerNext() == 0) {
+        while ((numRead = read(STDIN_FILENO, buf, BUF_SIZE)) > 0) {
+            if (write(STDOUT_FILENO, buf, numRead) != numRead) {
+                syslog(LOG_ERR, "write() failed: %s", strerror(errno));
+                break;          /* Client went away; on to the next one */
+            }
+        }
+
+        if (numRead == -1)
+            syslog(LOG_ERR, "Error from read(): %s", strerror(errno));
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,65 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* is_ktls.h
+
+   Header file for is_ktls_sv.c and is_ktls_cl.c.
+
+   The client sends a request consisting of a line of the form
+
+        <mode> <count>
+
+   where <mode> is one of the TM_* constants below, and <count> is the
+   maximum number of bytes to be sent. For TM_PLAIN, the server responds
+   as is_sendfile_sv.c does, sending (up to) <count> bytes from the start
+   of its file with sendfile(), and closing the connection. For the
+   other modes, the server first sends (in the clear) a randomly chosen
+   salt (TLS_SALT_LEN bytes) and initial IV (TLS_IV_LEN bytes), which,
+   with the key that both sides read from a key file, are used to
+   protect the file data, sent as TLS 1.2 records. (This stands in for
+   a TLS handshake; see ktls.c.) If the server can't use the requested
+   mode, it closes the connection without sending any records.
+*/
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <signal.h>
+#include "inet_sockets.h"       /* Declares our socket functions */
+#include "read_line.h"          /* Declaration of readLine() */
+#include "rdwrn.h"              /* Declarations of readn() and writen() */
+#include "file_xfer.h"          /* Declaration of fileXfer() */
+#include "ktls.h"
+#include "tlpi_hdr.h"
+
+#define PORT_NUM_STR "50002"    /* Port number for server */
+
+#define REQ_LEN 64              /* Maximum length of request line */
+
+#define TM_PLAIN    0           /* sendfile(), no encryption */
+#define TM_KTLS     1           /* sendfile(), encrypted by kernel TLS */
+#define TM_UTLS     2           /* read(), encrypt in user space, write() */
+
+static const char *tmNames[] = { "plain", "ktls", "utls" };
+
+/* Read the key from 'path' into 'k' (a helper for both programs) */
+
+static void
+readKeyFile(const char *path, struct tlsKey *k)
+{
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+        errExit("open %s", path);
+    if (readn(fd, k->key, TLS_KEY_LEN) != TLS_KEY_LEN)
+        fatal("Key file %s must hold at least %d bytes", path, TLS_KEY_LEN);
+    close(fd);
+}
@@ -0,0 +1,189 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* is_ktls_cl.c
+
+   A client for is_ktls_sv.c that measures the throughput of each of the
+   server's modes. For each mode, the client makes 'reps' requests for
+   'count' bytes, decrypts (and so authenticates) the data that the
+   server sends, discards it, and displays the throughput. The server
+   displays the CPU time that it used per GiB.
+
+   Usage: is_ktls_cl [-m mode] [-n count] [-r reps] [-u] keyfile host
+
+        -m mode      Test only 'mode': one of "plain", "ktls", or "utls"
+                     (default: test each in turn)
+        -n count     Number of bytes to request (default: 1 GiB); the
+                     server may send less if its file is smaller
+        -r reps      Number of requests per mode (default: 3)
+        -u           Decrypt in user space, rather than with kernel TLS
+
+   Whichever mode the server uses, the client decrypts with kernel TLS
+   if it can (so that it costs the client as little as possible),
+   falling back to decrypting in user space.
+
+   This program is Linux-specific.
+
+   See also is_ktls_sv.c.
+*/
+#include <sys/time.h>
+#include <fcntl.h>
+#include "is_ktls.h"
+
+#define BUF_SIZE (1024 * 1024)
+
+static char buf[BUF_SIZE];
+
+static int
+modeFromName(const char *name)
+{
+    int m;
+
+    for (m = TM_PLAIN; m <= TM_UTLS; m++)
+        if (strcmp(name, tmNames[m]) == 0)
+            return m;
+    return -1;
+}
+
+/* Receive the server's response to a request made with 'mode' on 'cfd'.
+   Returns the number of bytes of file data received; '*rxName' is set
+   to describe how it was decrypted. */
+
+static long long
+receiveData(int cfd, int mode, struct tlsKey *k, Boolean userRx,
+            const char **rxName)
+{
+    unsigned char params[TLS_SALT_LEN + TLS_IV_LEN];
+    struct tlsRec rec;
+    ssize_t numRead;
+    long long tot;
+
+    *rxName = "";
+    if (mode != TM_PLAIN) {
+        numRead = readn(cfd, params, sizeof(params));
+        if (numRead == -1)
+            errExit("read");
+        if (numRead != sizeof(params))
+            return 0;                   /* Server couldn't use 'mode' */
+        memcpy(k->salt, params, TLS_SALT_LEN);
+        memcpy(k->iv, params + TLS_SALT_LEN, TLS_IV_LEN);
+
+        if (!userRx && ktlsEnable(cfd, 0, k) == 0) {
+            *rxName = "rx: kernel";
+        } else {
+            if (tlsRecInit(&rec, k, 0) == -1)
+                errExit("tlsRecInit");
+            for (tot = 0; (numRead = tlsRecRead(cfd, &rec, buf)) > 0; )
+                tot += numRead;
+            if (numRead == -1)
+                errExit("tlsRecRead");
+            tlsRecFree(&rec);
+            *rxName = "rx: user";
+            return tot;
+        }
+    }
+
+    /* Plain data, or data that the kernel decrypts (and authenticates:
+       read() fails with EBADMSG if a record has been tampered with) */
+
+    for (tot = 0; (numRead = read(cfd, buf, BUF_SIZE)) > 0; )
+        tot += numRead;
+    if (numRead == -1)
+        errExit("read");
+    return tot;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-m mode] [-n count] [-r reps] [-u] "
+                    "keyfile host\n", progName);
+    fprintf(stderr, "    -m mode      plain, ktls, or utls (default: all)\n");
+    fprintf(stderr, "    -n count     Bytes per request (default: 1 GiB)\n");
+    fprintf(stderr, "    -r reps      Requests per mode (default: 3)\n");
+    fprintf(stderr, "    -u           Decrypt in user space\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char req[REQ_LEN];
+    int opt, cfd, mode, first, last, reps, r;
+    long long count, tot;
+    struct tlsKey k;
+    struct timeval tvStart, tvEnd;
+    const char *rxName;
+    Boolean userRx;
+    double secs;
+
+    first = TM_PLAIN;
+    last = TM_UTLS;
+    count = 1024 * 1024 * 1024;
+    reps = 3;
+    userRx = FALSE;
+    while ((opt = getopt(argc, argv, "m:n:r:u")) != -1) {
+        switch (opt) {
+        case 'm':
+            first = last = modeFromName(optarg);
+            if (first == -1)
+                usageError(argv[0]);
+            break;
+        case 'n':   count = getLong(optarg, GN_GT_0 | GN_ANY_BASE, "count");
+                    break;
+        case 'r':   reps = getInt(optarg, GN_GT_0, "reps");     break;
+        case 'u':   userRx = TRUE;                              break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc - 2)
+        usageError(argv[0]);
+
+    readKeyFile(argv[optind], &k);
+
+    for (mode = first; mode <= last; mode++) {
+        for (r = 0; r < reps; r++) {
+            cfd = inetConnectRace(argv[optind + 1], PORT_NUM_STR,
+                                  SOCK_STREAM, 0, -1, 0);
+            if (cfd == -1)
+                fatal("inetConnectRace() failed");
+
+            snprintf(req, REQ_LEN, "%d %lld\n", mode, count);
+
+            gettimeofday(&tvStart, NULL);
+
+            if (write(cfd, req, strlen(req)) != strlen(req))
+                fatal("Partial/failed write (request)");
+
+            tot = receiveData(cfd, mode, &k, userRx, &rxName);
+
+            gettimeofday(&tvEnd, NULL);
+            close(cfd);
+
+            if (tot == 0) {
+                printf("%-10s server couldn't use this mode\n",
+                        tmNames[mode]);
+                break;
+            }
+
+            secs = (tvEnd.tv_sec - tvStart.tv_sec) +
+                   (tvEnd.tv_usec - tvStart.tv_usec) / 1e6;
+            printf("%-10s %lld bytes in %.3f s (%.1f MiB/s) %s\n",
+                    tmNames[mode], tot, secs,
+                    (secs > 0) ? tot / (1024.0 * 1024) / secs : 0.0,
+                    rxName);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,206 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* is_ktls_sv.c
+
+   A version of is_sendfile_sv.c that can protect the file data with
+   TLS, either using kernel TLS (ktls.c), so that the data is still sent
+   with sendfile(), without being copied through user space, or
+   encrypting in user space, as a conventional TLS server does (reading
+   the file into a buffer, encrypting it, and writing the records). The
+   protocol is described in is_ktls.h.
+
+   Usage: is_ktls_sv keyfile file
+
+   Try:    head -c 16 /dev/urandom > /tmp/key
+           ./is_ktls_sv /tmp/key /dev/zero &
+           ./is_ktls_cl /tmp/key localhost
+
+   After each transfer, the server displays the mode, the throughput, and
+   the CPU time consumed by the server (user + system) per GiB
+   transferred. For kernel TLS, it also shows whether the kernel
+   encrypted the data in software ("ktls/sw") or offloaded the
+   encryption to the network device ("ktls/device"), which it does of its
+   own accord if the device supports it (see "ethtool -k" and the
+   "tls-hw-tx-offload" feature); offload never applies on the loopback
+   device.
+
+   Kernel TLS requires the "tls" kernel module (CONFIG_TLS); if it is
+   unavailable, requests for that mode fail.
+
+   This program is Linux-specific.
+
+   See also is_ktls_cl.c.
+*/
+#include <sys/random.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include "is_ktls.h"
+
+#define BUF_SIZE TLS_MAX_PLAIN
+
+static double           /* Return CPU time (user + system) in 'ru' */
+cpuSecs(const struct rusage *ru)
+{
+    return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 +
+           ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+/* Send up to 'count' bytes from 'fd' on 'cfd', encrypting them in user
+   space. Returns the number of bytes sent, or -1 on error. */
+
+static ssize_t
+sendUserTls(int cfd, int fd, size_t count, const struct tlsKey *k)
+{
+    static char buf[BUF_SIZE];
+    struct tlsRec rec;
+    ssize_t numRead;
+    size_t tot;
+
+    if (tlsRecInit(&rec, k, 1) == -1)
+        return -1;
+
+    for (tot = 0; tot < count; tot += numRead) {
+        numRead = read(fd, buf, (count - tot < BUF_SIZE) ? count - tot
+                                                          : BUF_SIZE);
+        if (numRead == -1 || (numRead > 0 &&
+                    tlsRecWrite(cfd, &rec, buf, numRead) == -1)) {
+            tlsRecFree(&rec);
+            return -1;
+        }
+        if (numRead == 0)
+            break;
+    }
+
+    tlsRecFree(&rec);
+    return tot;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char req[REQ_LEN];
+    const char *modeName;
+    char *p;
+    int lfd, cfd, fd, mode, used;
+    long long count, sw0, dev0, sw1, dev1;
+    ssize_t numSent;
+    struct tlsKey k;
+    unsigned char params[TLS_SALT_LEN + TLS_IV_LEN];
+    struct rusage ruStart, ruEnd;
+    struct timeval tvStart, tvEnd;
+    double secs, cpu, gib;
+
+    if (argc != 3 || strcmp(argv[1], "--help") == 0)
+        usageErr("%s keyfile file\n", argv[0]);
+
+    readKeyFile(argv[1], &k);
+
+    /* Ignore the SIGPIPE signal, so that we find out about broken
+       connection errors via a failure from write() */
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    lfd = inetListen(PORT_NUM_STR, 5, NULL);
+    if (lfd == -1)
+        errExit("inetListen");
+
+    for (;;) {                  /* Handle clients iteratively */
+        cfd = accept(lfd, NULL, NULL);
+        if (cfd == -1) {
+            errMsg("accept");
+            continue;
+        }
+
+        /* Read and parse the client's request */
+
+        if (readLine(cfd, req, REQ_LEN) <= 0) {
+            close(cfd);
+            continue;                   /* Failed read; skip request */
+        }
+
+        mode = strtol(req, &p, 10);
+        count = strtoll(p, NULL, 10);
+        if (mode < TM_PLAIN || mode > TM_UTLS || count <= 0) {
+            close(cfd);                 /* Bad request; skip it */
+            continue;
+        }
+
+        /* Choose a fresh salt and IV for each connection, since a nonce
+           must never be reused with the same key */
+
+        if (ktlsStats(&sw0, &dev0) == -1)
+            sw0 = dev0 = 0;
+
+        if (mode != TM_PLAIN) {
+            if (getrandom(params, sizeof(params), 0) != sizeof(params))
+                errExit("getrandom");
+            memcpy(k.salt, params, TLS_SALT_LEN);
+            memcpy(k.iv, params + TLS_SALT_LEN, TLS_IV_LEN);
+            if (writen(cfd, params, sizeof(params)) != sizeof(params)) {
+                close(cfd);
+                continue;
+            }
+        }
+
+        if (mode == TM_KTLS && ktlsEnable(cfd, 1, &k) == -1) {
+            errMsg("ktlsEnable");
+            close(cfd);
+            continue;
+        }
+
+        /* Open the file afresh for each request, so that the transfer
+           starts from the beginning of the file */
+
+        fd = open(argv[2], O_RDONLY);
+        if (fd == -1)
+            errExit("open");
+
+        if (getrusage(RUSAGE_SELF, &ruStart) == -1)
+            errExit("getrusage");
+        gettimeofday(&tvStart, NULL);
+
+        if (mode == TM_UTLS)
+            numSent = sendUserTls(cfd, fd, count, &k);
+        else
+            numSent = fileXfer(cfd, fd, count, FX_SENDFILE, &used);
+
+        gettimeofday(&tvEnd, NULL);
+        if (getrusage(RUSAGE_SELF, &ruEnd) == -1)
+            errExit("getrusage");
+
+        modeName = tmNames[mode];
+        if (mode == TM_KTLS && ktlsStats(&sw1, &dev1) == 0)
+            modeName = (dev1 > dev0) ? "ktls/device" :
+                       (sw1 > sw0) ? "ktls/sw" : "ktls";
+
+        if (numSent == -1) {
+            errMsg("%s", modeName);
+        } else {
+            secs = (tvEnd.tv_sec - tvStart.tv_sec) +
+                   (tvEnd.tv_usec - tvStart.tv_usec) / 1e6;
+            cpu = cpuSecs(&ruEnd) - cpuSecs(&ruStart);
+            gib = numSent / (1024.0 * 1024 * 1024);
+            printf("%-11s %lld bytes in %.3f s (%.1f MiB/s); "
+                    "CPU %.3f s/GiB\n", modeName,
+                    (long long) numSent, secs,
+                    (secs > 0) ? gib * 1024 / secs : 0.0,
+                    (gib > 0) ? cpu / gib : 0.0);
+        }
+
+        close(fd);
+        if (close(cfd) == -1)
+            errMsg("close");
+    }
+}
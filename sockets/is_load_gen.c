@@ -0,0 +1,584 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* is_load_gen.c
+
+   A load generator for the TCP echo servers (is_echo_sv.c,
+   is_echo_v2_sv.c, is_echo_epoll_sv.c, ...) and sequence-number servers
+   (is_seqnum_sv.c, is_seqnum_v2_sv.c, is_seqnum_mp_sv.c), which drives
+   thousands of connections from a single thread using epoll, and
+   reports the throughput and the distribution of latencies.
+
+   Usage: is_load_gen [-p proto] [-c conns] [-r rate] [-d secs] [-l len]
+                      [-n] host [service]
+
+        -p proto    "echo" (the default) or "seqnum" (which is also the
+                    protocol of the "v2" servers)
+        -c conns    Number of connections (default: 100); this is also
+                    the most requests that are outstanding at once
+        -r rate     Requests per second, in all (default: 0, meaning as
+                    many as possible)
+        -d secs     Duration of the run (default: 10)
+        -l len      "echo": length of each message (default: 64);
+                    "seqnum": length of sequence requested (default: 1)
+        -n          "echo": make a new connection for each request
+                    (otherwise, the connections are kept open)
+
+   'service' defaults to "echo" or 50000 (the port of the seqnum
+   servers). An "echo" request sends a message and waits for it to be
+   echoed; a "seqnum" request connects, sends the requested length,
+   reads the reply line, and closes the connection (as is_seqnum_cl.c
+   does).
+
+   With -r, the load is "open-loop": request i is due at time i / rate
+   after the start, whether or not earlier requests have completed, and
+   its latency is measured from the time at which it was due. A request
+   that is due when all connections are busy waits for one to become
+   free, and that wait counts in its latency. (A "closed-loop" generator,
+   which sends each request when the previous one completes and measures
+   from when it actually sends it, slows down when the server does, and
+   so fails to record the requests it would have sent during a stall--
+   "coordinated omission"--which makes stalls look rarer and shorter than
+   clients would find them.) For comparison, the program also reports the
+   service time: the time from when each request was actually started.
+   Requests still waiting at the end of the run are recorded with the
+   time they had waited (a lower bound on their latency). Without -r,
+   every connection sends its next request as soon as the previous one
+   completes, which measures the maximum throughput.
+
+   Latencies are recorded in an HdrHistogram-style histogram (see
+   lat_hist.c), so that the percentiles are accurate to within 1%.
+
+   Try: ./is_echo_epoll_sv -s 51000
+        ./is_load_gen -c 1000 -r 20000 -d 5 localhost 51000
+        ./is_seqnum_mp_sv &
+        ./is_load_gen -p seqnum -c 50 -r 5000 -d 5 localhost
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <netdb.h>
+#include <signal.h>
+#include <time.h>
+#include "lat_hist.h"
+#include "tlpi_hdr.h"
+
+#define MAX_LEN 65536           /* Longest echo message */
+#define REPLY_LEN 32            /* Longest seqnum reply */
+#define MAX_EVENTS 256
+#define DRAIN_NS 2000000000LL   /* Time allowed for outstanding requests
+                                   to complete at the end of the run */
+
+enum proto { P_ECHO, P_SEQNUM };
+
+enum state {
+    S_IDLE,                     /* No request outstanding */
+    S_CONNECTING,
+    S_SENDING,
+    S_RECEIVING
+};
+
+struct conn {
+    int fd;                     /* -1 if not connected */
+    enum state st;
+    long long due;              /* When the current request was due */
+    long long start;            /* ... and when it was started */
+    size_t done;                /* Bytes sent or received so far */
+    char *rbuf;                 /* Reply received so far */
+    struct conn *nextIdle;
+};
+
+static enum proto proto;
+static int msgLen;
+static Boolean newConnEach;
+static char *msg;               /* Echo message, or seqnum request */
+static size_t reqLen;           /* Length of 'msg' */
+
+static struct sockaddr_storage addr;    /* Server address, resolved once */
+static socklen_t addrlen;
+static int addrFamily;
+
+static int epfd;
+static struct conn *idleList;   /* Connections with no request */
+static int nidle;
+
+static struct latHist latency;  /* From when each request was due */
+static struct latHist svcTime;  /* From when each request was started */
+static long completed, connErrs, ioErrs, badReplies;
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+pushIdle(struct conn *c)
+{
+    c->st = S_IDLE;
+    c->nextIdle = idleList;
+    idleList = c;
+    nidle++;
+}
+
+static void
+closeConn(struct conn *c)
+{
+    if (c->fd != -1) {
+        close(c->fd);                   /* Also removes it from 'epfd' */
+        c->fd = -1;
+    }
+}
+
+/* Start a nonblocking connect() on 'c'. Returns 0 on success (the
+   connection may still be in progress), or -1 on error. */
+
+static int
+startConnect(struct conn *c)
+{
+    struct epoll_event ev;
+
+    c->fd = socket(addrFamily, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                   0);
+    if (c->fd == -1)
+        errExit("socket");
+
+    /* Edge-triggered: each handler below tries its operation until it
+       would block, and then waits for the next event */
+
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1)
+        errExit("epoll_ctl");
+
+    c->st = S_CONNECTING;
+    if (connect(c->fd, (struct sockaddr *) &addr, addrlen) == -1 &&
+            errno != EINPROGRESS) {
+        closeConn(c);
+        return -1;
+    }
+    return 0;
+}
+
+/* The request on 'c' failed; count it, and make the connection idle
+   (to be reconnected when it is next used) */
+
+static void
+failRequest(struct conn *c, long *counter)
+{
+    (*counter)++;
+    closeConn(c);
+    pushIdle(c);
+}
+
+/* The request on 'c' has completed */
+
+static void
+finishRequest(struct conn *c)
+{
+    long long now;
+
+    now = nowNs();
+    latHistRecord(&latency, now - c->due);
+    latHistRecord(&svcTime, now - c->start);
+    completed++;
+
+    if (proto == P_SEQNUM || newConnEach)
+        closeConn(c);
+    pushIdle(c);
+}
+
+/* Make as much progress as possible with the request on 'c' */
+
+static void
+advance(struct conn *c)
+{
+    struct sockaddr_storage peer, self;
+    ssize_t n;
+    size_t want;
+    char *nl, ch;
+    int err;
+    socklen_t len, slen;
+
+    if (c->st == S_CONNECTING) {
+        len = sizeof(err);
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+            err = errno;
+        if (err == EINPROGRESS || err == EALREADY)
+            return;
+        if (err != 0) {
+            failRequest(c, &connErrs);
+            return;
+        }
+
+        /* A connection in progress also reports SO_ERROR 0 */
+
+        len = sizeof(peer);
+        if (getpeername(c->fd, (struct sockaddr *) &peer, &len) == -1)
+            return;
+
+        /* If no server is listening, and the server's port is in the
+           range used for ephemeral ports, the socket may have been bound
+           to that same port, and connected to itself */
+
+        slen = sizeof(self);
+        if (getsockname(c->fd, (struct sockaddr *) &self, &slen) == -1 ||
+                (slen == len && memcmp(&self, &peer, len) == 0)) {
+            failRequest(c, &connErrs);
+            return;
+        }
+        c->st = S_SENDING;
+        c->done = 0;
+    }
+
+    if (c->st == S_SENDING) {
+        while (c->done < reqLen) {
+            n = send(c->fd, msg + c->done, reqLen - c->done, MSG_NOSIGNAL);
+            if (n == -1) {
+                if (errno == EAGAIN)
+                    return;
+                failRequest(c, &ioErrs);
+                return;
+            }
+            c->done += n;
+        }
+        c->st = S_RECEIVING;
+        c->done = 0;
+    }
+
+    if (c->st == S_RECEIVING) {
+        want = (proto == P_ECHO) ? reqLen : REPLY_LEN - 1;
+        while (c->done < want) {
+            n = recv(c->fd, c->rbuf + c->done, want - c->done, 0);
+            if (n == -1) {
+                if (errno == EAGAIN)
+                    return;
+                failRequest(c, &ioErrs);
+                return;
+            }
+            if (n == 0) {
+                if (proto == P_SEQNUM)
+                    break;              /* Server closes after reply */
+                failRequest(c, &ioErrs);
+                return;
+            }
+            c->done += n;
+            if (proto == P_SEQNUM &&
+                    memchr(c->rbuf, '\n', c->done) != NULL)
+                break;
+        }
+
+        if (proto == P_ECHO) {
+            if (memcmp(c->rbuf, msg, reqLen) != 0) {
+                failRequest(c, &badReplies);
+                return;
+            }
+        } else {
+            c->rbuf[c->done] = '\0';
+            nl = strchr(c->rbuf, '\n');
+            if (nl == c->rbuf || nl == NULL ||
+                    strspn(c->rbuf, "0123456789") != (size_t) (nl - c->rbuf)) {
+                failRequest(c, &badReplies);
+                return;
+            }
+        }
+        finishRequest(c);
+        return;
+    }
+
+    /* Event on an idle connection: if the server has closed it (or sent
+       unrequested data), discard it */
+
+    if (c->st == S_IDLE && c->fd != -1) {
+        n = recv(c->fd, &ch, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n >= 0 || errno != EAGAIN)
+            closeConn(c);
+    }
+}
+
+/* Start a request, which was due at 'due', on the idle connection 'c' */
+
+static void
+startRequest(struct conn *c, long long due)
+{
+    c->due = due;
+    c->start = nowNs();
+    c->done = 0;
+    if (c->fd == -1) {
+        if (startConnect(c) == -1) {
+            failRequest(c, &connErrs);
+            return;
+        }
+    } else {
+        c->st = S_SENDING;
+    }
+    advance(c);
+}
+
+/* Return the time at which request 'i' is due, at 'rate' requests/sec
+   from 't0' */
+
+static long long
+dueTime(long long t0, long i, double rate)
+{
+    return t0 + (long long) (i * 1e9 / rate);
+}
+
+/* Arm the timer to expire at 'when' (0: disarm) */
+
+static void
+armTimer(int tfd, long long when)
+{
+    struct itimerspec its;
+
+    its.it_interval.tv_sec = its.it_interval.tv_nsec = 0;
+    its.it_value.tv_sec = when / 1000000000LL;
+    its.it_value.tv_nsec = when % 1000000000LL;
+    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+        errExit("timerfd_settime");
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-p proto] [-c conns] [-r rate] [-d secs] "
+                    "[-l len] [-n]\n\t\thost [service]\n", progName);
+    fprintf(stderr, "    -p proto    echo (default) or seqnum\n");
+    fprintf(stderr, "    -c conns    Connections (default: 100)\n");
+    fprintf(stderr, "    -r rate     Requests/sec (default: 0 = as many "
+                    "as possible)\n");
+    fprintf(stderr, "    -d secs     Duration (default: 10)\n");
+    fprintf(stderr, "    -l len      Message length (echo), or sequence "
+                    "length (seqnum)\n");
+    fprintf(stderr, "    -n          New connection for each echo "
+                    "request\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct epoll_event evlist[MAX_EVENTS];
+    struct addrinfo hints, *res;
+    struct rlimit rl;
+    struct conn *conns, *c;
+    long long t0, end, now, due, waited;
+    long issued, unstarted;
+    const char *service;
+    int opt, nconns, secs, j, n, s, ready, tfd, timeoutMs;
+    double rate, elapsed;
+    uint64_t exp;
+
+    proto = P_ECHO;
+    nconns = 100;
+    rate = 0;
+    secs = 10;
+    msgLen = -1;
+    while ((opt = getopt(argc, argv, "p:c:r:d:l:n")) != -1) {
+        switch (opt) {
+        case 'p':
+            if (strcmp(optarg, "echo") == 0)
+                proto = P_ECHO;
+            else if (strcmp(optarg, "seqnum") == 0)
+                proto = P_SEQNUM;
+            else
+                usageError(argv[0]);
+            break;
+        case 'c':   nconns = getInt(optarg, GN_GT_0, "-c");     break;
+        case 'r':   rate = getLong(optarg, GN_NONNEG, "-r");    break;
+        case 'd':   secs = getInt(optarg, GN_GT_0, "-d");       break;
+        case 'l':   msgLen = getInt(optarg, GN_GT_0, "-l");     break;
+        case 'n':   newConnEach = TRUE;                         break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind >= argc || optind + 2 < argc)
+        usageError(argv[0]);
+    service = (optind + 1 < argc) ? argv[optind + 1] :
+               (proto == P_ECHO) ? "echo" : "50000";
+
+    /* Build the request */
+
+    if (proto == P_ECHO) {
+        if (msgLen == -1)
+            msgLen = 64;
+        if (msgLen > MAX_LEN)
+            cmdLineErr("-l must be at most %d\n", MAX_LEN);
+        msg = malloc(msgLen);
+        if (msg == NULL)
+            errExit("malloc");
+        for (j = 0; j < msgLen; j++)
+            msg[j] = 'a' + j % 26;
+        reqLen = msgLen;
+    } else {
+        if (msgLen == -1)
+            msgLen = 1;
+        msg = malloc(REPLY_LEN);
+        if (msg == NULL)
+            errExit("malloc");
+        reqLen = snprintf(msg, REPLY_LEN, "%d\n", msgLen);
+    }
+
+    /* Resolve the server address once */
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    s = getaddrinfo(argv[optind], service, &hints, &res);
+    if (s != 0)
+        fatal("getaddrinfo: %s", gai_strerror(s));
+    memcpy(&addr, res->ai_addr, res->ai_addrlen);
+    addrlen = res->ai_addrlen;
+    addrFamily = res->ai_family;
+    freeaddrinfo(res);
+
+    /* Each connection needs a file descriptor */
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+        errExit("getrlimit");
+    if (rl.rlim_cur < (rlim_t) nconns + 64) {
+        rl.rlim_cur = nconns + 64;
+        if (rl.rlim_max < rl.rlim_cur)
+            rl.rlim_max = rl.rlim_cur;
+        if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+            errExit("setrlimit (need %d descriptors)", nconns + 64);
+    }
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+        errExit("epoll_create1");
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tfd == -1)
+        errExit("timerfd_create");
+    evlist[0].events = EPOLLIN;
+    evlist[0].data.ptr = NULL;          /* NULL identifies the timer */
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &evlist[0]) == -1)
+        errExit("epoll_ctl");
+
+    conns = calloc(nconns, sizeof(struct conn));
+    if (conns == NULL)
+        errExit("calloc");
+    for (j = 0; j < nconns; j++) {
+        conns[j].fd = -1;
+        conns[j].rbuf = malloc((proto == P_ECHO) ? msgLen : REPLY_LEN);
+        if (conns[j].rbuf == NULL)
+            errExit("malloc");
+        pushIdle(&conns[j]);
+    }
+
+    latHistInit(&latency);
+    latHistInit(&svcTime);
+
+    printf("%s: %d connections, %s, %d s\n",
+           (proto == P_ECHO) ? "echo" : "seqnum", nconns,
+           (rate > 0) ? "open loop" : "closed loop (as fast as possible)",
+           secs);
+    if (rate > 0)
+        printf("Target rate: %.0f requests/s\n", rate);
+
+    /* The main loop: start each request when it is due (or, without -r,
+       as soon as a connection is idle), and handle events */
+
+    t0 = nowNs();
+    end = t0 + secs * 1000000000LL;
+    issued = 0;
+
+    for (;;) {
+        now = nowNs();
+        if (now >= end)
+            break;
+
+        /* (A request may fail at once, making its connection idle
+           again; so each pass starts at most one request per connection,
+           before checking for events) */
+
+        for (n = nidle; n > 0; n--) {
+            due = (rate > 0) ? dueTime(t0, issued, rate) : now;
+            if (due > now) {
+                armTimer(tfd, due);     /* Wake us when the next is due */
+                break;
+            }
+            c = idleList;
+            idleList = c->nextIdle;
+            nidle--;
+            issued++;
+            startRequest(c, due);
+        }
+
+        if (nidle > 0 && (rate == 0 || dueTime(t0, issued, rate) <= now))
+            timeoutMs = 0;              /* Requests are still due */
+        else
+            timeoutMs = (end - now) / 1000000 + 1;
+        ready = epoll_wait(epfd, evlist, MAX_EVENTS, timeoutMs);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("epoll_wait");
+        }
+        for (j = 0; j < ready; j++) {
+            c = evlist[j].data.ptr;
+            if (c == NULL) {
+                if (read(tfd, &exp, sizeof(exp)) == -1 && errno != EAGAIN)
+                    errExit("read-timerfd");
+            } else {
+                advance(c);
+            }
+        }
+    }
+    elapsed = (nowNs() - t0) / 1e9;
+
+    /* Requests that were due but never started count with the time they
+       have waited so far */
+
+    unstarted = 0;
+    if (rate > 0) {
+        for (now = nowNs(); dueTime(t0, issued, rate) < end; issued++) {
+            waited = now - dueTime(t0, issued, rate);
+            latHistRecord(&latency, waited);
+            unstarted++;
+        }
+    }
+
+    /* Allow the outstanding requests to complete */
+
+    armTimer(tfd, 0);
+    for (end = nowNs() + DRAIN_NS; nidle < nconns && nowNs() < end; ) {
+        ready = epoll_wait(epfd, evlist, MAX_EVENTS, 100);
+        for (j = 0; j < ready; j++)
+            if (evlist[j].data.ptr != NULL)
+                advance(evlist[j].data.ptr);
+    }
+
+    printf("Completed %ld requests in %.2f s: %.0f requests/s\n", completed,
+           elapsed, completed / elapsed);
+    printf("Errors: connect %ld; I/O %ld; bad replies %ld; unfinished %d; "
+           "never started %ld\n", connErrs, ioErrs, badReplies,
+           nconns - nidle, unstarted);
+    latHistPrint(&latency, stdout,
+                 (rate > 0) ? "Latency from due time" : "Latency", 1e3,
+                 "us");
+    if (rate > 0)
+        latHistPrint(&svcTime, stdout, "Service time", 1e3, "us");
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,321 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* is_profile_bench.c
+
+   Measure the effect of each of the socket option profiles provided by
+   inetListenProfile() and inetConnectProfile() (inet_sockets.c) on the
+   latency and throughput of a TCP echo service.
+
+   Usage: is_profile_bench [-p port] [-c conns] [-n round-trips]
+                           [-m msg-size] [-w] [-s MiB] [profile...]
+
+        -p port         Port used by the echo server (default: 51000)
+        -c conns        Number of connections in the connection test
+                        (default: 200)
+        -n round-trips  Number of round trips in the latency test
+                        (default: 1000)
+        -m msg-size     Size of each message in the latency test
+                        (default: 64)
+        -w              In the latency test, send each message with two
+                        write() calls (a 4-byte "header", followed by the
+                        rest), as do many request/response protocols
+        -s MiB          Amount of data sent in the throughput test
+                        (default: 256)
+
+   The profiles are "default", "low-latency", "bulk", and "many-idle"
+   (default: all of them). For each profile, the program creates a
+   listening socket with that profile, and a child process that serves
+   the socket, one connection at a time, in the same manner as
+   is_echo_sv.c (echoing everything it reads, with a 4096-byte buffer).
+   The parent then connects to the server using the same profile and
+   performs three tests:
+
+        conn    Mean time to connect, exchange one byte, and close
+        rtt     Median and 99th percentile round-trip times for messages
+                of 'msg-size' bytes
+        MiB/s   Rate at which 'MiB' MiB is echoed, with a child process
+                writing and the parent reading the echoed data
+
+   Together with -w, the rtt test shows the interaction between Nagle's
+   algorithm and delayed acknowledgements, which the low-latency profile
+   (TCP_NODELAY) avoids: with the other profiles, the second write of
+   each message (or its echo) may be held until the peer acknowledges the
+   first, and the peer may delay that acknowledgement by up to 40 ms.
+*/
+#include <sys/wait.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include "inet_sockets.h"
+#include "rdwrn.h"
+#include "tlpi_hdr.h"
+
+#define BUF_SIZE 4096           /* As in is_echo_sv.c */
+#define XFR_SIZE 65536          /* Chunk size in the throughput test */
+
+static const char *service;
+
+static uint64_t
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+cmpSample(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Iterative echo server: handle the connections on 'lfd' one at a time */
+
+static void
+echoServer(int lfd)
+{
+    char buf[BUF_SIZE];
+    ssize_t numRead;
+    int cfd;
+
+    for (;;) {
+        cfd = accept(lfd, NULL, NULL);
+        if (cfd == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("accept");
+        }
+
+        while ((numRead = read(cfd, buf, BUF_SIZE)) > 0)
+            if (write(cfd, buf, numRead) != numRead)
+                break;
+
+        close(cfd);
+    }
+}
+
+static int
+connectProfile(int profile)
+{
+    int sfd;
+
+    sfd = inetConnectProfile("localhost", service, SOCK_STREAM, profile);
+    if (sfd == -1)
+        errExit("inetConnectProfile");
+    return sfd;
+}
+
+/* Return the mean time (in microseconds) to connect, exchange a byte,
+   and close */
+
+static double
+connTest(int profile, int numConns)
+{
+    uint64_t start;
+    char ch;
+    int sfd, j;
+
+    start = nowNs();
+    for (j = 0; j < numConns; j++) {
+        sfd = connectProfile(profile);
+        ch = 'x';
+        if (write(sfd, &ch, 1) != 1)
+            fatal("write() failed in connection test");
+        if (readn(sfd, &ch, 1) != 1)
+            fatal("readn() failed in connection test");
+        close(sfd);
+    }
+    return (nowNs() - start) / 1e3 / numConns;
+}
+
+/* Measure the round-trip times of 'numTrips' messages of 'msgSize'
+   bytes; return the median and 99th percentile in microseconds */
+
+static void
+rttTest(int sfd, int numTrips, size_t msgSize, Boolean split,
+        double *p50, double *p99)
+{
+    uint64_t *samples, start;
+    char *msg;
+    size_t first;
+    int j;
+
+    samples = malloc(numTrips * sizeof(uint64_t));
+    msg = malloc(msgSize);
+    if (samples == NULL || msg == NULL)
+        errExit("malloc");
+    memset(msg, 'x', msgSize);
+
+    first = (split && msgSize > 4) ? 4 : msgSize;
+    for (j = 0; j < numTrips; j++) {
+        start = nowNs();
+        if (write(sfd, msg, first) != first)
+            fatal("write() failed in latency test");
+        if (first < msgSize && write(sfd, msg + first, msgSize - first) !=
+                msgSize - first)
+            fatal("write() failed in latency test");
+        if (readn(sfd, msg, msgSize) != msgSize)
+            fatal("readn() failed in latency test");
+        samples[j] = nowNs() - start;
+    }
+
+    qsort(samples, numTrips, sizeof(uint64_t), cmpSample);
+    *p50 = samples[numTrips / 2] / 1e3;
+    *p99 = samples[numTrips * 99 / 100] / 1e3;
+    free(samples);
+    free(msg);
+}
+
+/* Return the rate (MiB/s) at which 'total' bytes are echoed on 'sfd' */
+
+static double
+throughputTest(int sfd, long long total)
+{
+    static char buf[XFR_SIZE];
+    long long done;
+    uint64_t start;
+    ssize_t numRead;
+    pid_t writer;
+
+    start = nowNs();
+    writer = fork();
+    switch (writer) {
+    case -1:
+        errExit("fork");
+
+    case 0:                     /* Child: send the data, then EOF */
+        for (done = 0; done < total; done += XFR_SIZE)
+            if (write(sfd, buf, XFR_SIZE) != XFR_SIZE)
+                fatal("write() failed in throughput test");
+        if (shutdown(sfd, SHUT_WR) == -1)
+            errExit("shutdown");
+        _exit(EXIT_SUCCESS);
+
+    default:                    /* Parent: consume the echoed data */
+        for (done = 0; (numRead = read(sfd, buf, XFR_SIZE)) > 0; )
+            done += numRead;
+        if (numRead == -1)
+            errExit("read");
+        if (waitpid(writer, NULL, 0) == -1)
+            errExit("waitpid");
+        if (done != total)
+            fatal("throughput test: echoed %lld bytes, expected %lld",
+                    done, total);
+        return total / 1048576.0 / ((nowNs() - start) / 1e9);
+    }
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-p port] [-c conns] [-n round-trips] "
+            "[-m msg-size] [-w] [-s MiB] [profile...]\n", progName);
+    fprintf(stderr, "Profiles: default, low-latency, bulk, many-idle\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int opt, numConns, numTrips, msgSize, numProfiles, j, lfd, sfd;
+    int profiles[16], sndbuf, rcvbuf;
+    long long total;
+    Boolean split;
+    socklen_t len;
+    pid_t server;
+    double conn, p50, p99, rate;
+
+    service = "51000";
+    numConns = 200;
+    numTrips = 1000;
+    msgSize = 64;
+    split = FALSE;
+    total = 256LL * 1024 * 1024;
+    while ((opt = getopt(argc, argv, "p:c:n:m:ws:")) != -1) {
+        switch (opt) {
+        case 'p':   service = optarg;                                   break;
+        case 'c':   numConns = getInt(optarg, GN_GT_0, "conns");        break;
+        case 'n':   numTrips = getInt(optarg, GN_GT_0, "round-trips");  break;
+        case 'm':   msgSize = getInt(optarg, GN_GT_0, "msg-size");      break;
+        case 'w':   split = TRUE;                                       break;
+        case 's':
+            total = getLong(optarg, GN_GT_0, "MiB") * 1024LL * 1024;
+            break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    numProfiles = 0;
+    if (optind == argc) {
+        for (j = ISP_DEFAULT; j <= ISP_MANY_IDLE; j++)
+            profiles[numProfiles++] = j;
+    } else {
+        if (argc - optind > 16)
+            usageError(argv[0]);
+        for (j = optind; j < argc; j++) {
+            profiles[numProfiles] = inetProfileFromStr(argv[j]);
+            if (profiles[numProfiles] == -1)
+                usageError(argv[0]);
+            numProfiles++;
+        }
+    }
+
+    /* Don't let a client's write() to a closed connection kill us */
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    printf("%d connections; %d round trips of %d bytes%s; %lld MiB\n",
+            numConns, numTrips, msgSize, split ? " (two writes)" : "",
+            total / 1024 / 1024);
+    printf("%-12s %8s %8s %9s %9s %9s %9s\n", "profile", "sndbuf",
+            "rcvbuf", "conn-us", "rtt-p50", "rtt-p99", "MiB/s");
+
+    for (j = 0; j < numProfiles; j++) {
+        lfd = inetListenProfile(service, 50, NULL, profiles[j]);
+        if (lfd == -1)
+            errExit("inetListenProfile");
+
+        server = fork();
+        if (server == -1)
+            errExit("fork");
+        if (server == 0)
+            echoServer(lfd);
+        close(lfd);
+
+        conn = connTest(profiles[j], numConns);
+
+        sfd = connectProfile(profiles[j]);
+        len = sizeof(int);
+        if (getsockopt(sfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) == -1 ||
+                getsockopt(sfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len) == -1)
+            errExit("getsockopt");
+        rttTest(sfd, numTrips, msgSize, split, &p50, &p99);
+        rate = throughputTest(sfd, total);
+        close(sfd);
+
+        printf("%-12s %8d %8d %9.1f %9.1f %9.1f %9.0f\n",
+                inetProfileName(profiles[j]), sndbuf, rcvbuf, conn, p50, p99,
+                rate);
+
+        kill(server, SIGTERM);
+        if (waitpid(server, NULL, 0) == -1)
+            errExit("waitpid");
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,197 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* is_reuseport_sv.c
+
+   A stream socket server that demonstrates the use of SO_REUSEPORT to
+   scale accept() across multiple CPUs. The program creates one listening
+   socket per worker thread, using inetListenMulti() (inet_sockets.c); all
+   of the sockets are bound to the same port, and the kernel distributes
+   incoming connections across their accept queues. Each worker thread is
+   pinned to its own CPU and runs an accept loop on its own socket.
+
+   Usage: is_reuseport_sv [-c] [-n nworkers] [-w] [service]
+
+        -c           Attach a BPF program that steers each connection to
+                     the worker running on the CPU that processed the
+                     incoming connection request (with more workers than
+                     CPUs, only the first worker on each CPU is used)
+        -n nworkers  Number of workers (default: number of CPUs available
+                     to the process)
+        -w           For each connection, write a short message ("OK\n")
+                     before closing the connection
+        service      Port to listen on (default: 50000)
+
+   Each worker simply accepts each connection and closes it (optionally
+   after writing a message). Once per second, the program prints the total
+   connection acceptance rate and the number of connections accepted by
+   each worker during that second. This allows comparison of accept
+   scaling for different numbers of workers, and with and without -c.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "inet_sockets.h"       /* Declares our socket functions */
+#include "tlpi_hdr.h"
+
+#define SERVICE "50000"
+#define BACKLOG SOMAXCONN
+
+struct worker {                 /* Per-worker state */
+    pthread_t tid;
+    int lfd;                    /* Listening socket */
+    int cpu;                    /* CPU to which worker is pinned */
+    unsigned long accepted;     /* Number of connections accepted */
+    char pad[64];               /* Keep counters in separate cache lines */
+};
+
+static Boolean writeMsg = FALSE;
+
+static void *
+acceptLoop(void *arg)
+{
+    struct worker *w = arg;
+    cpu_set_t set;
+    int cfd, s;
+
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    s = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (s != 0)
+        errExitEN(s, "pthread_setaffinity_np");
+
+    for (;;) {
+        cfd = accept(w->lfd, NULL, NULL);
+        if (cfd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            errExit("accept");
+        }
+
+        if (writeMsg)           /* Ignore errors: client may have gone */
+            write(cfd, "OK\n", 3);
+
+        close(cfd);
+        __atomic_add_fetch(&w->accepted, 1, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-c] [-n nworkers] [-w] [service]\n",
+            progName);
+    fprintf(stderr, "    -c           Steer connections to workers by CPU "
+                    "(BPF)\n");
+    fprintf(stderr, "    -n nworkers  Number of workers (default: # of "
+                    "available CPUs)\n");
+    fprintf(stderr, "    -w           Write \"OK\\n\" to each client\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct worker *workers;
+    unsigned long *prev, *cur, total;
+    cpu_set_t avail;
+    int opt, nworkers, j, cpu, s;
+    Boolean steer;
+    int *lfds, *cpus;
+    const char *service;
+
+    steer = FALSE;
+    nworkers = 0;
+    while ((opt = getopt(argc, argv, "cn:w")) != -1) {
+        switch (opt) {
+        case 'c':   steer = TRUE;                                       break;
+        case 'n':   nworkers = getInt(optarg, GN_GT_0, "nworkers");     break;
+        case 'w':   writeMsg = TRUE;                                    break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    service = (optind < argc) ? argv[optind] : SERVICE;
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    /* Workers are pinned, in turn, to the CPUs on which we are permitted
+       to run */
+
+    if (sched_getaffinity(0, sizeof(avail), &avail) == -1)
+        errExit("sched_getaffinity");
+    if (nworkers == 0)
+        nworkers = CPU_COUNT(&avail);
+
+    workers = calloc(nworkers, sizeof(struct worker));
+    lfds = calloc(nworkers, sizeof(int));
+    prev = calloc(nworkers, sizeof(unsigned long));
+    cur = calloc(nworkers, sizeof(unsigned long));
+    cpus = calloc(nworkers, sizeof(int));
+    if (workers == NULL || lfds == NULL || prev == NULL || cur == NULL ||
+            cpus == NULL)
+        errExit("calloc");
+
+    cpu = -1;
+    for (j = 0; j < nworkers; j++) {
+        do {                    /* Find next CPU in 'avail', wrapping */
+            cpu = (cpu + 1) % CPU_SETSIZE;
+        } while (!CPU_ISSET(cpu, &avail));
+        cpus[j] = cpu;
+    }
+
+    /* With -c, steer connections processed on CPU cpus[j] to the socket
+       of worker 'j', which is pinned to that CPU */
+
+    if (inetListenMulti(service, BACKLOG, NULL, lfds, nworkers, 0) == -1)
+        errExit("inetListenMulti");
+    if (steer && inetSteerByCpu(lfds[0], cpus, nworkers) == -1)
+        errExit("inetSteerByCpu");
+
+    for (j = 0; j < nworkers; j++) {
+        workers[j].lfd = lfds[j];
+        workers[j].cpu = cpus[j];
+        s = pthread_create(&workers[j].tid, NULL, acceptLoop, &workers[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    printf("%d workers listening on port %s%s\n", nworkers, service,
+            steer ? " (CPU steering)" : "");
+
+    /* Once per second, display the accept rate */
+
+    for (;;) {
+        sleep(1);
+
+        total = 0;
+        for (j = 0; j < nworkers; j++) {
+            cur[j] = __atomic_load_n(&workers[j].accepted, __ATOMIC_RELAXED);
+            total += cur[j] - prev[j];
+        }
+        printf("%lu conn/s:", total);
+
+        for (j = 0; j < nworkers; j++) {
+            printf(" %d:%lu", workers[j].cpu, cur[j] - prev[j]);
+            prev[j] = cur[j];
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+}
@@ -0,0 +1,36 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* is_sendfile.h
+
+   Header file for is_sendfile_sv.c and is_sendfile_cl.c.
+
+   The client sends a request consisting of a line of the form
+
+        <method> <count>
+
+   where <method> is one of the FX_* constants from file_xfer.h, and
+   <count> is the maximum number of bytes to be sent. The server responds
+   by sending (up to) <count> bytes from the start of its file, using the
+   requested method, and then closing the connection.
+*/
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <signal.h>
+#include "inet_sockets.h"       /* Declares our socket functions */
+#include "read_line.h"          /* Declaration of readLine() */
+#include "file_xfer.h"          /* Declaration of fileXfer() */
+#include "tlpi_hdr.h"
+
+#define PORT_NUM_STR "50001"    /* Port number for server */
+
+#define REQ_LEN 64              /* Maximum length of request line */
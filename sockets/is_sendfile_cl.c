@@ -0,0 +1,122 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* is_sendfile_cl.c
+
+   A client for is_sendfile_sv.c that measures the throughput of each of
+   the server's transfer methods. For each method, the client makes
+   'reps' requests for 'count' bytes, discards the data that the server
+   sends, and displays the throughput.
+
+   Usage: is_sendfile_cl [-m method] [-n count] [-r reps] host
+
+        -m method    Test only 'method': one of "auto", "sendfile",
+                     "splice", or "rdwr" (default: test "sendfile",
+                     "splice", and "rdwr" in turn)
+        -n count     Number of bytes to request (default: 1 GiB); the
+                     server may send less if its file is smaller
+        -r reps      Number of requests per method (default: 3)
+
+   See also is_sendfile_sv.c.
+*/
+#include <sys/time.h>
+#include "is_sendfile.h"
+
+#define BUF_SIZE (1024 * 1024)
+
+static char buf[BUF_SIZE];
+
+static int
+methodFromName(const char *name)
+{
+    if (strcmp(name, "auto") == 0)      return FX_AUTO;
+    if (strcmp(name, "sendfile") == 0)  return FX_SENDFILE;
+    if (strcmp(name, "splice") == 0)    return FX_SPLICE;
+    if (strcmp(name, "rdwr") == 0)      return FX_RDWR;
+    return -1;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-m method] [-n count] [-r reps] host\n",
+            progName);
+    fprintf(stderr, "    -m method    auto, sendfile, splice, or rdwr "
+                    "(default: all but auto)\n");
+    fprintf(stderr, "    -n count     Bytes per request (default: 1 GiB)\n");
+    fprintf(stderr, "    -r reps      Requests per method (default: 3)\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char req[REQ_LEN];
+    int opt, cfd, method, first, last, reps, r;
+    long long count, tot;
+    ssize_t numRead;
+    struct timeval tvStart, tvEnd;
+    double secs;
+
+    first = FX_SENDFILE;
+    last = FX_RDWR;
+    count = 1024 * 1024 * 1024;
+    reps = 3;
+    while ((opt = getopt(argc, argv, "m:n:r:")) != -1) {
+        switch (opt) {
+        case 'm':
+            first = last = methodFromName(optarg);
+            if (first == -1)
+                usageError(argv[0]);
+            break;
+        case 'n':   count = getLong(optarg, GN_GT_0 | GN_ANY_BASE, "count");
+                    break;
+        case 'r':   reps = getInt(optarg, GN_GT_0, "reps");     break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1)
+        usageError(argv[0]);
+
+    for (method = first; method <= last; method++) {
+        for (r = 0; r < reps; r++) {
+            cfd = inetConnectRace(argv[optind], PORT_NUM_STR, SOCK_STREAM,
+                                  0, -1, 0);
+            if (cfd == -1)
+                fatal("inetConnectRace() failed");
+
+            snprintf(req, REQ_LEN, "%d %lld\n", method, count);
+
+            gettimeofday(&tvStart, NULL);
+
+            if (write(cfd, req, strlen(req)) != strlen(req))
+                fatal("Partial/failed write (request)");
+
+            for (tot = 0; (numRead = read(cfd, buf, BUF_SIZE)) > 0; )
+                tot += numRead;
+            if (numRead == -1)
+                errExit("read");
+
+            gettimeofday(&tvEnd, NULL);
+            close(cfd);
+
+            secs = (tvEnd.tv_sec - tvStart.tv_sec) +
+                   (tvEnd.tv_usec - tvStart.tv_usec) / 1e6;
+            printf("%-10s %lld bytes in %.3f s (%.1f MiB/s)\n",
+                    fileXferMethodName(method), tot, secs,
+                    (secs > 0) ? tot / (1024.0 * 1024) / secs : 0.0);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
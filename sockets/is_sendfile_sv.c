@@ -0,0 +1,129 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* is_sendfile_sv.c
+
+   An iterative TCP server that sends the contents of a file to each
+   client, using fileXfer() (file_xfer.c) with the transfer method
+   requested by the client. The protocol is described in is_sendfile.h.
+
+   Usage: is_sendfile_sv file
+
+   'file' need not be a regular file: for example, specifying /dev/zero
+   makes it possible to measure transfers of arbitrary size. If the file
+   is of a type that can't be used with sendfile() (on older kernels, this
+   is the case for anything other than a regular file), a request for
+   FX_AUTO falls back to splice().
+
+   After each transfer, the server displays the method that was used, the
+   throughput, and the CPU time consumed by the server (user + system)
+   per GiB transferred. Together with is_sendfile_cl.c, this allows the
+   costs of the different transfer methods to be compared.
+
+   This program is Linux-specific.
+
+   See also is_sendfile_cl.c.
+*/
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include "is_sendfile.h"
+
+static double           /* Return CPU time (user + system) in 'ru' */
+cpuSecs(const struct rusage *ru)
+{
+    return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 +
+           ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char req[REQ_LEN];
+    char *p;
+    int lfd, cfd, fd, method, used;
+    long long count;
+    ssize_t numSent;
+    struct rusage ruStart, ruEnd;
+    struct timeval tvStart, tvEnd;
+    double secs, cpu, gib;
+
+    if (argc != 2 || strcmp(argv[1], "--help") == 0)
+        usageErr("%s file\n", argv[0]);
+
+    /* Ignore the SIGPIPE signal, so that we find out about broken
+       connection errors via a failure from write() */
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    lfd = inetListen(PORT_NUM_STR, 5, NULL);
+    if (lfd == -1)
+        errExit("inetListen");
+
+    for (;;) {                  /* Handle clients iteratively */
+        cfd = accept(lfd, NULL, NULL);
+        if (cfd == -1) {
+            errMsg("accept");
+            continue;
+        }
+
+        /* Read and parse the client's request */
+
+        if (readLine(cfd, req, REQ_LEN) <= 0) {
+            close(cfd);
+            continue;                   /* Failed read; skip request */
+        }
+
+        method = strtol(req, &p, 10);
+        count = strtoll(p, NULL, 10);
+        if (method < FX_AUTO || method > FX_RDWR || count <= 0) {
+            close(cfd);                 /* Bad request; skip it */
+            continue;
+        }
+
+        /* Open the file afresh for each request, so that the transfer
+           starts from the beginning of the file */
+
+        fd = open(argv[1], O_RDONLY);
+        if (fd == -1)
+            errExit("open");
+
+        if (getrusage(RUSAGE_SELF, &ruStart) == -1)
+            errExit("getrusage");
+        gettimeofday(&tvStart, NULL);
+
+        numSent = fileXfer(cfd, fd, count, method, &used);
+
+        gettimeofday(&tvEnd, NULL);
+        if (getrusage(RUSAGE_SELF, &ruEnd) == -1)
+            errExit("getrusage");
+
+        if (numSent == -1) {
+            errMsg("fileXfer (%s)", fileXferMethodName(used));
+        } else {
+            secs = (tvEnd.tv_sec - tvStart.tv_sec) +
+                   (tvEnd.tv_usec - tvStart.tv_usec) / 1e6;
+            cpu = cpuSecs(&ruEnd) - cpuSecs(&ruStart);
+            gib = numSent / (1024.0 * 1024 * 1024);
+            printf("%-10s %lld bytes in %.3f s (%.1f MiB/s); "
+                    "CPU %.3f s/GiB\n", fileXferMethodName(used),
+                    (long long) numSent, secs,
+                    (secs > 0) ? gib * 1024 / secs : 0.0,
+                    (gib > 0) ? cpu / gib : 0.0);
+        }
+
+        close(fd);
+        if (close(cfd) == -1)
+            errMsg("close");
+    }
+}
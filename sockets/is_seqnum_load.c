@@ -0,0 +1,287 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 60 */
+
+/* is_seqnum_load.c
+
+   A load generator for the sequence-number servers is_seqnum_sv.c and
+   is_seqnum_mp_sv.c. For each of a series of concurrency levels, the
+   program runs that many client threads for a fixed period; each thread
+   repeatedly connects to the server, requests a sequence of length 1,
+   and reads the response. The program then reports the request rate and
+   the distribution of the request latency (from the start of connect()
+   until the response has been read).
+
+   Usage: is_seqnum_load [-c conc[,conc...]] [-d secs] [-S delay-ms] host
+
+        -c conc      Comma-separated list of concurrency levels (default:
+                     1,2,4,8,16,32)
+        -d secs      Duration of each run (default: 3)
+        -S delay-ms  Also run one "slow" client, which, on each connection,
+                     waits 'delay-ms' milliseconds before sending its
+                     request. With an iterative server, this stalls all
+                     of the other clients.
+
+   The program also checks that no sequence number was granted twice,
+   which would show that the server's counter was not updated
+   atomically.
+
+   See also fifo_seqnum_load.c, which does the same for the FIFO server.
+*/
+#include <pthread.h>
+#include <time.h>
+#include "inet_sockets.h"       /* Declares our socket functions */
+#include "is_seqnum.h"
+
+#define MAX_LEVELS 16
+
+struct client {                 /* Per-thread results */
+    pthread_t tid;
+    double *lat;                /* Latency of each request (us) */
+    uint32_t *seqs;             /* Sequence number granted by each */
+    long n;
+    long max;
+    long errors;
+};
+
+static const char *host;
+static volatile Boolean stop;
+static int slowMs;
+
+static double
+nowUs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Perform one request; return the granted sequence number, or -1 on
+   error */
+
+static long
+doRequest(int delayMs)
+{
+    char seqNumStr[INT_LEN];
+    struct timespec delay;
+    int cfd;
+    long seq;
+
+    cfd = inetConnectRace(host, PORT_NUM, SOCK_STREAM, 0, -1, 0);
+    if (cfd == -1)
+        return -1;
+
+    if (delayMs > 0) {
+        delay.tv_sec = delayMs / 1000;
+        delay.tv_nsec = (delayMs % 1000) * 1000000L;
+        nanosleep(&delay, NULL);
+    }
+
+    seq = -1;
+    if (write(cfd, "1\n", 2) == 2 && readLine(cfd, seqNumStr, INT_LEN) > 0)
+        seq = strtoul(seqNumStr, NULL, 10);
+    close(cfd);
+    return seq;
+}
+
+static void *
+clientFunc(void *arg)
+{
+    struct client *cl = arg;
+    double start;
+    long seq;
+
+    while (!stop) {
+        start = nowUs();
+        seq = doRequest(0);
+        if (seq == -1) {
+            cl->errors++;
+            continue;
+        }
+
+        if (cl->n == cl->max) {
+            cl->max = (cl->max == 0) ? 4096 : cl->max * 2;
+            cl->lat = realloc(cl->lat, cl->max * sizeof(double));
+            cl->seqs = realloc(cl->seqs, cl->max * sizeof(uint32_t));
+            if (cl->lat == NULL || cl->seqs == NULL)
+                errExit("realloc");
+        }
+        cl->lat[cl->n] = nowUs() - start;
+        cl->seqs[cl->n] = seq;
+        cl->n++;
+    }
+    return NULL;
+}
+
+static void *
+slowClientFunc(void *arg)
+{
+    while (!stop)
+        doRequest(slowMs);
+    return NULL;
+}
+
+static int
+cmpDouble(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+static int
+cmpUint32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+runLevel(int nclients, int secs)
+{
+    struct client *cl;
+    struct timespec duration;
+    pthread_t slowTid;
+    double *lat, start, elapsed;
+    uint32_t *seqs;
+    long total, errors, dups, k;
+    int j, s;
+
+    cl = calloc(nclients, sizeof(struct client));
+    if (cl == NULL)
+        errExit("calloc");
+
+    stop = FALSE;
+    start = nowUs();
+    for (j = 0; j < nclients; j++) {
+        s = pthread_create(&cl[j].tid, NULL, clientFunc, &cl[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    if (slowMs > 0) {
+        s = pthread_create(&slowTid, NULL, slowClientFunc, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    duration.tv_sec = secs;
+    duration.tv_nsec = 0;
+    nanosleep(&duration, NULL);
+    stop = TRUE;
+
+    for (j = 0; j < nclients; j++) {
+        s = pthread_join(cl[j].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+    elapsed = (nowUs() - start) / 1e6;
+    if (slowMs > 0) {
+        s = pthread_join(slowTid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    /* Merge the per-thread results */
+
+    total = errors = 0;
+    for (j = 0; j < nclients; j++) {
+        total += cl[j].n;
+        errors += cl[j].errors;
+    }
+    lat = malloc((total + 1) * sizeof(double));
+    seqs = malloc((total + 1) * sizeof(uint32_t));
+    if (lat == NULL || seqs == NULL)
+        errExit("malloc");
+    for (k = 0, j = 0; j < nclients; j++) {
+        memcpy(&lat[k], cl[j].lat, cl[j].n * sizeof(double));
+        memcpy(&seqs[k], cl[j].seqs, cl[j].n * sizeof(uint32_t));
+        k += cl[j].n;
+        free(cl[j].lat);
+        free(cl[j].seqs);
+    }
+
+    qsort(seqs, total, sizeof(uint32_t), cmpUint32);
+    dups = 0;
+    for (k = 1; k < total; k++)
+        if (seqs[k] == seqs[k - 1])
+            dups++;
+
+    if (total == 0) {
+        printf("%6d %10s (no requests completed; %ld errors)\n",
+                nclients, "-", errors);
+    } else {
+        qsort(lat, total, sizeof(double), cmpDouble);
+        printf("%6d %10.0f %9.0f %9.0f %9.0f %9.0f %9.0f %7ld %6ld\n",
+                nclients, total / elapsed, lat[total / 2],
+                lat[total * 90 / 100], lat[total * 99 / 100],
+                lat[(long) (total * 0.999)], lat[total - 1], errors, dups);
+    }
+
+    free(lat);
+    free(seqs);
+    free(cl);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-c conc[,conc...]] [-d secs] [-S delay-ms] "
+                    "host\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int levels[MAX_LEVELS];
+    char *tok;
+    int opt, nlevels, secs, j;
+
+    nlevels = 0;
+    secs = 3;
+    while ((opt = getopt(argc, argv, "c:d:S:")) != -1) {
+        switch (opt) {
+        case 'c':
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                if (nlevels == MAX_LEVELS)
+                    cmdLineErr("Too many levels (max %d)\n", MAX_LEVELS);
+                levels[nlevels++] = getInt(tok, GN_GT_0, "conc");
+            }
+            break;
+        case 'd':   secs = getInt(optarg, GN_GT_0, "secs");             break;
+        case 'S':   slowMs = getInt(optarg, GN_GT_0, "delay-ms");       break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc)
+        usageError(argv[0]);
+    host = argv[optind];
+
+    if (nlevels == 0)
+        for (j = 1; j <= 32; j *= 2)
+            levels[nlevels++] = j;
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    printf("%6s %10s %9s %9s %9s %9s %9s %7s %6s\n", "conc", "req/s",
+            "p50-us", "p90-us", "p99-us", "p999-us", "max-us", "errors",
+            "dups");
+    for (j = 0; j < nlevels; j++)
+        runLevel(levels[j], secs);
+
+    exit(EXIT_SUCCESS);
+}
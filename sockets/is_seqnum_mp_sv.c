@@ -0,0 +1,219 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 60 */
+
+/* is_seqnum_mp_sv.c
+
+   A concurrent version of the sequence-number server in is_seqnum_sv.c.
+   That server handles clients one at a time, so that a single slow
+   client (for example, one that connects but is slow to send its
+   request) stalls all of the others. This server instead creates, at
+   startup, a pool of worker processes (or, with -t, threads), each of
+   which runs an accept() loop on the (shared) listening socket.
+
+   Usage: is_seqnum_mp_sv [-n nworkers] [-t] [-v] [init-seq-num]
+
+        -n nworkers  Number of workers (default: 8)
+        -t           Use threads rather than processes as workers
+        -v           Display the address of each client
+
+   The sequence number lives in a shared anonymous mapping created before
+   the workers are forked, and each request is granted its sequence with
+   an atomic fetch-and-add, so that workers need no further
+   synchronization.
+
+   The protocol is the same as that of is_seqnum_sv.c, so that the server
+   can be used with is_seqnum_cl.c, or loaded with is_seqnum_load.c. It
+   also accepts the binary protocol of seqnum_bin.c (see
+   is_seqnum_v2_sv.c); a binary client occupies a worker until it closes
+   its connection, so that 'nworkers' should be at least the number of
+   such clients (for example, when loading the server with
+   is_seqnum_v2_bench.c).
+*/
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "inet_sockets.h"       /* Declares our socket functions */
+#include "seqnum_bin.h"         /* Binary protocol */
+#include "is_seqnum.h"
+
+#define BACKLOG SOMAXCONN
+
+static uint32_t *seqNum;        /* In shared memory */
+static int lfd;
+static Boolean verbose = FALSE;
+static pid_t *workerPids;       /* Multiprocess case */
+static int nworkers = 8;
+
+/* In the multiprocess case, terminating the parent also terminates the
+   workers */
+
+static void
+termHandler(int sig)
+{
+    int j;
+
+    for (j = 0; j < nworkers; j++)
+        if (workerPids[j] > 0)
+            kill(workerPids[j], SIGTERM);
+    _exit(EXIT_SUCCESS);
+}
+
+/* Handle one client connection */
+
+static void
+handleRequest(int cfd, const struct sockaddr *claddr, socklen_t addrlen)
+{
+    char reqLenStr[INT_LEN];            /* Length of requested sequence */
+    char seqNumStr[INT_LEN];            /* Start of granted sequence */
+    char addrStr[IS_ADDR_STR_LEN];
+    int reqLen;
+    char c;
+
+    if (verbose)
+        printf("Connection from %s\n",
+                inetAddressStr(claddr, addrlen, addrStr, IS_ADDR_STR_LEN));
+
+    if (recv(cfd, &c, 1, MSG_PEEK) == 1 && c == '\0') {
+        if (seqBinServe(cfd, seqNum) == -1)     /* Binary protocol */
+            errMsg("seqBinServe");
+        return;
+    }
+
+    if (readLine(cfd, reqLenStr, INT_LEN) <= 0)
+        return;                         /* Failed read; skip request */
+
+    reqLen = atoi(reqLenStr);
+    if (reqLen <= 0)                    /* Watch for misbehaving clients */
+        return;
+
+    snprintf(seqNumStr, INT_LEN, "%u\n",
+            __atomic_fetch_add(seqNum, reqLen, __ATOMIC_RELAXED));
+    if (write(cfd, seqNumStr, strlen(seqNumStr)) != strlen(seqNumStr))
+        fprintf(stderr, "Error on write\n");
+}
+
+static void *
+workerFunc(void *arg)
+{
+    struct sockaddr_storage claddr;
+    socklen_t addrlen;
+    int cfd;
+
+    for (;;) {
+        addrlen = sizeof(struct sockaddr_storage);
+        cfd = accept(lfd, (struct sockaddr *) &claddr, &addrlen);
+        if (cfd == -1) {
+            errMsg("accept");
+            continue;
+        }
+
+        handleRequest(cfd, (struct sockaddr *) &claddr, addrlen);
+
+        if (close(cfd) == -1)
+            errMsg("close");
+    }
+    return NULL;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n nworkers] [-t] [-v] [init-seq-num]\n",
+            progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sigaction sa;
+    Boolean useThreads;
+    pthread_t tid;
+    int opt, j, s;
+
+    useThreads = FALSE;
+    while ((opt = getopt(argc, argv, "n:tv")) != -1) {
+        switch (opt) {
+        case 'n':   nworkers = getInt(optarg, GN_GT_0, "nworkers");     break;
+        case 't':   useThreads = TRUE;                                  break;
+        case 'v':   verbose = TRUE;                                     break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind + 1 < argc)
+        usageError(argv[0]);
+
+    /* Ignore the SIGPIPE signal, so that we find out about broken connection
+       errors via a failure from write(). */
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)    errExit("signal");
+
+    seqNum = mmap(NULL, sizeof(*seqNum), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (seqNum == MAP_FAILED)
+        errExit("mmap");
+    *seqNum = (optind < argc) ? getInt(argv[optind], 0, "init-seq-num") : 0;
+
+    lfd = inetListen(PORT_NUM, BACKLOG, NULL);
+    if (lfd == -1)
+        errExit("inetListen");
+
+    setbuf(stdout, NULL);               /* Workers share stdout */
+
+    if (!useThreads) {
+        workerPids = calloc(nworkers, sizeof(pid_t));
+        if (workerPids == NULL)
+            errExit("calloc");
+
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = 0;
+        sa.sa_handler = termHandler;
+        if (sigaction(SIGINT, &sa, NULL) == -1 ||
+                sigaction(SIGTERM, &sa, NULL) == -1)
+            errExit("sigaction");
+    }
+
+    for (j = 0; j < nworkers; j++) {
+        if (useThreads) {
+            s = pthread_create(&tid, NULL, workerFunc, NULL);
+            if (s != 0)
+                errExitEN(s, "pthread_create");
+        } else {
+            switch (workerPids[j] = fork()) {
+            case -1:
+                errExit("fork");
+            case 0:
+                signal(SIGINT, SIG_DFL);
+                signal(SIGTERM, SIG_DFL);
+                workerFunc(NULL);
+                _exit(EXIT_SUCCESS);    /* Not reached */
+            default:
+                break;
+            }
+        }
+    }
+
+    printf("%d worker %s started\n", nworkers,
+            useThreads ? "threads" : "processes");
+
+    /* The main thread has nothing further to do; in the multiprocess
+       case, it waits for the workers (which is to say, forever) */
+
+    if (useThreads)
+        pthread_exit(NULL);
+
+    while (wait(NULL) != -1)
+        continue;
+    errExit("wait");
+}
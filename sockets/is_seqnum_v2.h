@@ -12,13 +12,20 @@
 
 /* is_seqnum_v2.h
 
-   Header file for is_seqnum_v2_sv.c and is_seqnum_v2_cl.c.
+   Header file for is_seqnum_v2_sv.c, is_seqnum_v2_cl.c, and
+   is_seqnum_v2_bench.c.
+
+   A client may instead ask for the binary protocol defined in
+   seqnum_bin.h.
 */
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <signal.h>
 #include "inet_sockets.h"       /* Declares our socket functions */
 #include "read_line.h"          /* Declaration of readLine() */
+#include "line_reader.h"        /* Declaration of lineReaderRead() */
+#include "rdwrn.h"              /* Declaration of writevn() */
+#include "seqnum_bin.h"         /* Binary protocol */
 #include "tlpi_hdr.h"
 
 #define PORT_NUM_STR "50000"    /* Port number for server */
@@ -0,0 +1,311 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 59 */
+
+/* is_seqnum_v2_bench.c
+
+   Compare the ASCII and binary (seqnum_bin.c) sequence-number protocols
+   under load. For each of three modes, the program runs a number of
+   client threads for a fixed period, each repeatedly requesting
+   sequences of length 1:
+
+        ascii     One request per connection, as made by is_seqnum_v2_cl.c
+        bin-1     Binary protocol, one connection per thread, one sequence
+                  per frame
+        bin-N     As bin-1, but 'N' sequences per frame
+
+   For each mode, the program reports the number of requests (ASCII
+   requests or binary frames) and sequences granted per second, the
+   distribution of the request latency, and the number of failed
+   requests. It also checks that the sequences granted to each thread
+   follow one another, which would not be so if the server granted
+   overlapping sequences.
+
+   Usage: is_seqnum_v2_bench [-b batch] [-c conc] [-d secs] host
+
+        -b batch  Sequences per frame in the bin-N mode (default: 64)
+        -c conc   Number of client threads (default: 8)
+        -d secs   Duration of each mode (default: 3)
+
+   Try: is_seqnum_mp_sv -n 16 > /dev/null &
+        is_seqnum_v2_bench localhost
+
+   Since each binary client holds its connection open, the server must
+   be able to serve 'conc' clients at once; with the iterative server
+   is_seqnum_v2_sv.c, use -c 1.
+*/
+#include <netdb.h>
+#include <pthread.h>
+#include <time.h>
+#include "lat_hist.h"
+#include "is_seqnum_v2.h"
+
+struct client {                 /* Per-thread results */
+    pthread_t tid;
+    struct latHist lat;         /* Latency of each request (ns) */
+    long reqs;
+    long seqs;
+    long errors;
+    long overlaps;
+};
+
+static struct sockaddr_storage addr;    /* Server address, resolved once */
+static socklen_t addrlen;
+static int addrFamily;
+static uint32_t batch;                  /* 0 means ASCII */
+static volatile Boolean stop;
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int
+connectServer(void)
+{
+    int sfd;
+
+    sfd = socket(addrFamily, SOCK_STREAM, 0);
+    if (sfd == -1)
+        errExit("socket");
+    if (connect(sfd, (struct sockaddr *) &addr, addrlen) == -1) {
+        close(sfd);
+        return -1;
+    }
+    return sfd;
+}
+
+/* Make one ASCII request for a sequence of length 1. Returns 0 on
+   success, placing the start of the sequence in '*start', or -1 on
+   error. */
+
+static int
+asciiRequest(uint32_t *start)
+{
+    char buf[INT_LEN];
+    ssize_t numRead;
+    size_t got;
+    int sfd, s;
+
+    sfd = connectServer();
+    if (sfd == -1)
+        return -1;
+
+    s = -1;
+    if (write(sfd, "1\n", 2) == 2) {
+        for (got = 0; got < sizeof(buf) - 1; got += numRead) {
+            numRead = read(sfd, buf + got, sizeof(buf) - 1 - got);
+            if (numRead <= 0)
+                break;
+            if (buf[got + numRead - 1] == '\n') {
+                buf[got + numRead] = '\0';
+                *start = strtoul(buf, NULL, 10);
+                s = 0;
+                break;
+            }
+        }
+    }
+    close(sfd);
+    return s;
+}
+
+static void *
+clientFunc(void *arg)
+{
+    struct client *cl = arg;
+    uint32_t lens[SEQ_BIN_MAX_BATCH], starts[SEQ_BIN_MAX_BATCH];
+    uint32_t next, j;
+    Boolean first;
+    long long t0;
+    int sfd;
+
+    for (j = 0; j < SEQ_BIN_MAX_BATCH; j++)
+        lens[j] = 1;
+
+    first = TRUE;
+    next = 0;
+    sfd = -1;
+    while (!stop) {
+        if (batch == 0) {
+            t0 = nowNs();
+            if (asciiRequest(&starts[0]) == -1) {
+                cl->errors++;
+                continue;
+            }
+            j = 1;
+        } else {
+            if (sfd == -1) {
+                sfd = connectServer();
+                if (sfd == -1) {
+                    cl->errors++;
+                    usleep(10000);      /* Don't spin if server is down */
+                    continue;
+                }
+                if (seqBinHello(sfd) == -1) {
+                    if (errno == EPROTO)
+                        fatal("Server doesn't support binary protocol");
+                    cl->errors++;
+                    close(sfd);
+                    sfd = -1;
+                    continue;
+                }
+            }
+
+            t0 = nowNs();
+            if (seqBinRequest(sfd, lens, starts, batch) == -1) {
+                cl->errors++;
+                close(sfd);
+                sfd = -1;
+                continue;
+            }
+            j = batch;
+        }
+        latHistRecord(&cl->lat, nowNs() - t0);
+        cl->reqs++;
+        cl->seqs += j;
+
+        /* Each sequence must start at or after the end of the previous
+           one granted to this thread (allowing for wraparound), and the
+           sequences in a frame must be consecutive */
+
+        if (!first && (int32_t) (starts[0] - next) < 0)
+            cl->overlaps++;
+        for (j = 1; j < (batch == 0 ? 1 : batch); j++)
+            if (starts[j] != starts[j - 1] + 1)
+                cl->overlaps++;
+        next = starts[j - 1] + 1;
+        first = FALSE;
+    }
+
+    if (sfd != -1)
+        close(sfd);
+    return NULL;
+}
+
+static void
+runMode(const char *name, uint32_t batchSize, int conc, int secs)
+{
+    struct client *cl;
+    struct latHist lat;
+    long long start;
+    long reqs, seqs, errors, overlaps;
+    double elapsed;
+    int j, s;
+
+    cl = calloc(conc, sizeof(struct client));
+    if (cl == NULL)
+        errExit("calloc");
+    for (j = 0; j < conc; j++)
+        latHistInit(&cl[j].lat);
+
+    batch = batchSize;
+    stop = FALSE;
+    start = nowNs();
+    for (j = 0; j < conc; j++) {
+        s = pthread_create(&cl[j].tid, NULL, clientFunc, &cl[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    sleep(secs);
+    stop = TRUE;
+
+    latHistInit(&lat);
+    reqs = seqs = errors = overlaps = 0;
+    for (j = 0; j < conc; j++) {
+        s = pthread_join(cl[j].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+        latHistMerge(&lat, &cl[j].lat);
+        reqs += cl[j].reqs;
+        seqs += cl[j].seqs;
+        errors += cl[j].errors;
+        overlaps += cl[j].overlaps;
+    }
+    elapsed = (nowNs() - start) / 1e9;
+
+    printf("%-8s %10.0f %11.0f %9.1f %9.1f %9.1f %7ld\n", name,
+           reqs / elapsed, seqs / elapsed,
+           latHistPercentile(&lat, 0.50) / 1e3,
+           latHistPercentile(&lat, 0.99) / 1e3, lat.max / 1e3, errors);
+    if (overlaps > 0)
+        printf("    ERROR: %ld sequences overlapped an earlier one\n",
+               overlaps);
+
+    free(cl);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-b batch] [-c conc] [-d secs] host\n",
+            progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct addrinfo hints, *res;
+    char name[32];
+    int opt, conc, secs, batchSize, s;
+
+    batchSize = 64;
+    conc = 8;
+    secs = 3;
+    while ((opt = getopt(argc, argv, "b:c:d:")) != -1) {
+        switch (opt) {
+        case 'b':   batchSize = getInt(optarg, GN_GT_0, "-b");  break;
+        case 'c':   conc = getInt(optarg, GN_GT_0, "-c");       break;
+        case 'd':   secs = getInt(optarg, GN_GT_0, "-d");       break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind + 1 != argc)
+        usageError(argv[0]);
+    if (batchSize > SEQ_BIN_MAX_BATCH)
+        cmdLineErr("-b must be at most %d\n", SEQ_BIN_MAX_BATCH);
+
+    /* Resolve the server address once, so that name lookups don't
+       contribute to the cost of each ASCII request */
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    s = getaddrinfo(argv[optind], PORT_NUM_STR, &hints, &res);
+    if (s != 0)
+        fatal("getaddrinfo: %s", gai_strerror(s));
+    memcpy(&addr, res->ai_addr, res->ai_addrlen);
+    addrlen = res->ai_addrlen;
+    addrFamily = res->ai_family;
+    freeaddrinfo(res);
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    printf("%d clients, %d seconds per mode\n", conc, secs);
+    printf("%-8s %10s %11s %9s %9s %9s %7s\n", "mode", "reqs/s", "seqs/s",
+           "p50-us", "p99-us", "max-us", "errors");
+
+    runMode("ascii", 0, conc, secs);
+    runMode("bin-1", 1, conc, secs);
+    if (batchSize > 1) {
+        snprintf(name, sizeof(name), "bin-%d", batchSize);
+        runMode(name, batchSize, conc, secs);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -17,32 +17,42 @@
 
    The program is the same as is_seqnum_cl.c, except that it uses the
    functions in our inet_sockets.c library to simplify the creation of a
-   socket that connects to the server's socket.
+   socket that connects to the server's socket. In addition, the request
+   (the sequence length plus a terminating newline) is sent with a single
+   call to writevn().
+
+   With -b, the program asks for the binary protocol of seqnum_bin.c,
+   and requests all of the sequences in a single frame on one
+   connection; if the server doesn't support that protocol, the program
+   falls back to making an ASCII request (on a new connection) for each
+   sequence.
+
+   Usage: is_seqnum_v2_cl [-b] server-host [sequence-len...]
 
    See also is_seqnum_v2_sv.c.
 */
 #include "is_seqnum_v2.h"
 
-int
-main(int argc, char *argv[])
+/* Request a sequence of length 'reqLenStr' using the ASCII protocol */
+
+static void
+asciiRequest(const char *host, char *reqLenStr)
 {
-    char *reqLenStr;                    /* Requested length of sequence */
     char seqNumStr[INT_LEN];            /* Start of granted sequence */
     int cfd;
     ssize_t numRead;
+    struct iovec iov[2];
 
-    if (argc < 2 || strcmp(argv[1], "--help") == 0)
-        usageErr("%s server-host [sequence-len]\n", argv[0]);
-
-    cfd = inetConnect(argv[1], PORT_NUM_STR, SOCK_STREAM);
+    cfd = inetConnectRace(host, PORT_NUM_STR, SOCK_STREAM, 0, -1, 0);
     if (cfd == -1)
-        fatal("inetConnect() failed");
+        fatal("inetConnectRace() failed");
 
-    reqLenStr = (argc > 2) ? argv[2] : "1";
-    if (write(cfd, reqLenStr, strlen(reqLenStr)) !=  strlen(reqLenStr))
-        fatal("Partial/failed write (reqLenStr)");
-    if (write(cfd, "\n", 1) != 1)
-        fatal("Partial/failed write (newline)");
+    iov[0].iov_base = reqLenStr;
+    iov[0].iov_len = strlen(reqLenStr);
+    iov[1].iov_base = "\n";
+    iov[1].iov_len = 1;
+    if (writevn(cfd, iov, 2) != strlen(reqLenStr) + 1)
+        fatal("Partial/failed write (request)");
 
     numRead = readLine(cfd, seqNumStr, INT_LEN);
     if (numRead == -1)
@@ -52,5 +62,80 @@ main(int argc, char *argv[])
 
     printf("Sequence number: %s", seqNumStr);   /* Includes '\n' */
 
-    exit(EXIT_SUCCESS);                         /* Closes 'cfd' */
+    if (close(cfd) == -1)
+        errMsg("close");
+}
+
+/* Request the 'n' sequences whose lengths are in 'lenStr' in a single
+   binary frame. Returns 0 on success, or -1 if the server doesn't
+   support the binary protocol. */
+
+static int
+binaryRequest(const char *host, char *lenStr[], int n)
+{
+    uint32_t vals[SEQ_BIN_MAX_BATCH];
+    int cfd, j;
+
+    if (n > SEQ_BIN_MAX_BATCH)
+        cmdLineErr("At most %d sequences\n", SEQ_BIN_MAX_BATCH);
+
+    for (j = 0; j < n; j++)
+        vals[j] = getInt(lenStr[j], GN_GT_0, "sequence-len");
+
+    cfd = inetConnectRace(host, PORT_NUM_STR, SOCK_STREAM, 0, -1, 0);
+    if (cfd == -1)
+        fatal("inetConnectRace() failed");
+
+    if (seqBinHello(cfd) == -1) {
+        if (errno != EPROTO)
+            errExit("seqBinHello");
+        close(cfd);
+        return -1;
+    }
+
+    if (seqBinRequest(cfd, vals, vals, n) == -1)
+        errExit("seqBinRequest");
+    for (j = 0; j < n; j++)
+        printf("Sequence number: %u\n", (unsigned int) vals[j]);
+
+    if (close(cfd) == -1)
+        errMsg("close");
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char *defaultLen[] = { "1" };
+    char **lenStr;
+    Boolean binary;
+    int opt, n, j;
+
+    binary = FALSE;
+    while ((opt = getopt(argc, argv, "b")) != -1) {
+        switch (opt) {
+        case 'b':   binary = TRUE;                              break;
+        default:    usageErr("%s [-b] server-host [sequence-len...]\n",
+                             argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usageErr("%s [-b] server-host [sequence-len...]\n", argv[0]);
+
+    n = argc - optind - 1;
+    lenStr = (n > 0) ? &argv[optind + 1] : defaultLen;
+    if (n == 0)
+        n = 1;
+
+    if (binary) {
+        if (binaryRequest(argv[optind], lenStr, n) == 0)
+            exit(EXIT_SUCCESS);
+        fprintf(stderr, "Server doesn't support binary protocol; "
+                "using ASCII\n");
+    }
+
+    for (j = 0; j < n; j++)
+        asciiRequest(argv[optind], lenStr[j]);
+
+    exit(EXIT_SUCCESS);
 }
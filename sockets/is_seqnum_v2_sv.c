@@ -17,6 +17,16 @@
 
    This program is the same as is_seqnum_cl.c, except that it uses the functions
    in our inet_sockets.c library to simplify set up of the server's socket.
+   It also uses lineReaderRead() (line_reader.c) rather than readLine(), so
+   that the client's request is read in blocks rather than one byte per
+   read() system call.
+
+   A client whose first byte is a null byte is instead served with the
+   binary protocol of seqnum_bin.c, which carries any number of requests,
+   each of which may ask for many sequences, on one connection. Since this
+   server is iterative, other clients wait until that client closes its
+   connection; see is_seqnum_mp_sv.c for a server that handles clients
+   concurrently.
 
    Usage:  is_seqnum_sv [init-seq-num]  (default = 0)
 
@@ -34,6 +44,9 @@ main(int argc, char *argv[])
     int lfd, cfd, reqLen;
     socklen_t addrlen, alen;
     char addrStr[IS_ADDR_STR_LEN];
+    struct LineReader lr;
+    char lrBuf[LR_DEFAULT_BUF_SIZE];
+    char c;
 
     if (argc > 1 && strcmp(argv[1], "--help") == 0)
         usageErr("%s [init-seq-num]\n", argv[0]);
@@ -69,9 +82,21 @@ main(int argc, char *argv[])
         printf("Connection from %s\n", inetAddressStr(claddr, alen,
                         addrStr, IS_ADDR_STR_LEN));
 
+        /* A client that wants the binary protocol starts with a null
+           byte; serve it until it closes the connection */
+
+        if (recv(cfd, &c, 1, MSG_PEEK) == 1 && c == '\0') {
+            if (seqBinServe(cfd, &seqNum) == -1)
+                errMsg("seqBinServe");
+            if (close(cfd) == -1)
+                errMsg("close");
+            continue;
+        }
+
         /* Read client request, send sequence number back */
 
-        if (readLine(cfd, reqLenStr, INT_LEN) <= 0) {
+        lineReaderInit(&lr, cfd, lrBuf, sizeof(lrBuf));
+        if (lineReaderRead(&lr, reqLenStr, INT_LEN) <= 0) {
             close(cfd);
             continue;                   /* Failed read; skip request */
         }
@@ -0,0 +1,273 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* is_zc_xfer.c
+
+   Measure the throughput, and CPU cost, of a bulk TCP transfer, sent
+   with or without MSG_ZEROCOPY, and received with or without
+   TCP_ZEROCOPY_RECEIVE (see zc_xfer.c).
+
+   Usage: is_zc_xfer [-b size] [-w size] [-z] -l [port]
+          is_zc_xfer [-b size] [-n MiB] [-z] host [port]
+
+        -b size   Size of each send, or of the receiver's copy buffer
+                  (default: 256 KiB)
+        -l        Receive: accept connections, and read each until
+                  end-of-file
+        -n MiB    Amount of data to send (default: 4096)
+        -w size   Size of the receiver's mapped window (default: 2 MiB)
+        -z        Use zero-copy sending or receiving
+
+   The port defaults to 50003. Run a receiver on one host and a sender on
+   another; each reports, for each transfer, the throughput, the CPU time
+   (user + system) that it used per GiB, and how much of the transfer
+   avoided copying: for the sender, the proportion of zero-copy sends
+   that the kernel didn't have to copy; for the receiver, the proportion
+   of bytes that were mapped rather than copied. Comparing the four
+   combinations of -z shows how much CPU each copy costs, which matters
+   most on fast links (25 Gb/s and above), where a copying receiver can
+   run out of CPU before the link is full.
+
+   For zero-copy receiving to map anything, the path MTU must exceed the
+   page size by the size of the headers (e.g., "ip link set dev eth0 mtu
+   9000" on both hosts), and the receiving network device must place
+   payloads in separate pages (header splitting), as many 25 and 100 GbE
+   devices can. On the loopback device, the kernel reports that every
+   zero-copy send was copied, and the receiver can map only data that
+   was sent with MSG_ZEROCOPY (the pages being the sender's own), so that
+   the figures say little about a real network.
+
+   The sender sends from a ring of buffers, and waits, before reusing a
+   buffer, until the kernel has finished with it, as a program that
+   refills its buffers must.
+
+   This program is Linux-specific.
+*/
+#include <sys/resource.h>
+#include <signal.h>
+#include <time.h>
+#include "inet_sockets.h"
+#include "zc_xfer.h"
+#include "tlpi_hdr.h"
+
+#define PORT_NUM_STR "50003"
+#define NBUFS 8                 /* Sender's ring of buffers */
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double           /* Return CPU time (user + system) used so far */
+cpuSecs(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) == -1)
+        errExit("getrusage");
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static void
+report(const char *what, long long bytes, double secs, double cpu,
+       const char *zcInfo)
+{
+    double gib;
+
+    gib = bytes / (1024.0 * 1024 * 1024);
+    printf("%-7s %lld bytes in %.3f s (%.1f MiB/s, %.2f Gb/s); "
+           "CPU %.3f s/GiB%s\n", what, bytes, secs,
+           (secs > 0) ? gib * 1024 / secs : 0.0,
+           (secs > 0) ? bytes * 8 / secs / 1e9 : 0.0,
+           (gib > 0) ? cpu / gib : 0.0, zcInfo);
+}
+
+static void
+receiver(const char *port, size_t bufSize, size_t windowLen,
+         Boolean zerocopy)
+{
+    struct zcReceiver zr;
+    const void *data;
+    char zcInfo[100];
+    char *buf;
+    double t0, cpu0;
+    long long tot;
+    ssize_t n;
+    int lfd, cfd;
+
+    buf = malloc(bufSize);
+    if (buf == NULL)
+        errExit("malloc");
+
+    lfd = inetListen(port, 5, NULL);
+    if (lfd == -1)
+        errExit("inetListen");
+
+    for (;;) {
+        cfd = accept(lfd, NULL, NULL);
+        if (cfd == -1) {
+            errMsg("accept");
+            continue;
+        }
+        if (zcReceiverInit(&zr, cfd, windowLen, zerocopy) == -1)
+            errExit("zcReceiverInit");
+
+        t0 = nowSecs();
+        cpu0 = cpuSecs();
+        for (tot = 0; (n = zcRecv(&zr, &data, buf, bufSize)) > 0; )
+            tot += n;
+        if (n == -1)
+            errMsg("zcRecv");
+
+        if (!zerocopy)
+            zcInfo[0] = '\0';
+        else if (zr.map == NULL)
+            snprintf(zcInfo, sizeof(zcInfo), "; zero copy unavailable");
+        else
+            snprintf(zcInfo, sizeof(zcInfo), "; %.1f%% mapped",
+                     (tot > 0) ? 100.0 * zr.mapped / tot : 0.0);
+        report(zerocopy ? "recv-zc" : "recv", tot, nowSecs() - t0,
+               cpuSecs() - cpu0, zcInfo);
+
+        zcReceiverFree(&zr);
+        close(cfd);
+    }
+}
+
+static void
+sender(const char *host, const char *port, size_t bufSize,
+       long long total, Boolean zerocopy)
+{
+    struct zcSender zs;
+    uint32_t ticket[NBUFS];
+    char *buf[NBUFS];
+    char zcInfo[100];
+    double t0, cpu0;
+    long long tot;
+    size_t n;
+    int sfd, j;
+    char c;
+
+    for (j = 0; j < NBUFS; j++) {
+        buf[j] = malloc(bufSize);
+        if (buf[j] == NULL)
+            errExit("malloc");
+        memset(buf[j], 'a' + j, bufSize);
+    }
+
+    sfd = inetConnect(host, port, SOCK_STREAM);
+    if (sfd == -1)
+        errExit("inetConnect");
+    if (zcSenderInit(&zs, sfd, zerocopy) == -1)
+        errExit("zcSenderInit");
+    memset(ticket, 0, sizeof(ticket));
+
+    t0 = nowSecs();
+    cpu0 = cpuSecs();
+    for (tot = 0, j = 0; tot < total; tot += n, j = (j + 1) % NBUFS) {
+
+        /* Wait until the kernel has finished with this buffer; a real
+           program would then refill it */
+
+        if (zcSendWait(&zs, ticket[j]) == -1)
+            errExit("zcSendWait");
+
+        n = (total - tot < (long long) bufSize) ? total - tot : bufSize;
+        if (zcSend(&zs, buf[j], n, &ticket[j]) == -1)
+            errExit("zcSend");
+    }
+
+    /* Wait for the last completions, and for the receiver to see
+       end-of-file and close its socket, so that the time includes the
+       delivery of all of the data */
+
+    if (zcSendWait(&zs, zs.next) == -1)
+        errExit("zcSendWait");
+    if (shutdown(sfd, SHUT_WR) == -1)
+        errExit("shutdown");
+    if (read(sfd, &c, 1) == -1)
+        errExit("read");
+
+    if (!zerocopy)
+        zcInfo[0] = '\0';
+    else if (!zs.zerocopy)
+        snprintf(zcInfo, sizeof(zcInfo), "; zero copy unavailable");
+    else
+        snprintf(zcInfo, sizeof(zcInfo), "; %lld sends, %.1f%% not copied",
+                 zs.sends, (zs.sends > 0) ?
+                 100.0 * (zs.sends - zs.copied) / zs.sends : 0.0);
+    report(zerocopy ? "send-zc" : "send", tot, nowSecs() - t0,
+           cpuSecs() - cpu0, zcInfo);
+
+    close(sfd);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-b size] [-w size] [-z] -l [port]\n",
+            progName);
+    fprintf(stderr, "       %s [-b size] [-n MiB] [-z] host [port]\n",
+            progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    Boolean listen, zerocopy;
+    long long total;
+    size_t bufSize, windowLen;
+    const char *port;
+    int opt;
+
+    bufSize = 256 * 1024;
+    windowLen = 2 * 1024 * 1024;
+    total = 4096LL * 1024 * 1024;
+    listen = zerocopy = FALSE;
+    while ((opt = getopt(argc, argv, "b:ln:w:z")) != -1) {
+        switch (opt) {
+        case 'b':   bufSize = getLong(optarg, GN_GT_0 | GN_ANY_BASE, "-b");
+                    break;
+        case 'l':   listen = TRUE;                                  break;
+        case 'n':   total = getLong(optarg, GN_GT_0, "-n") * 1024LL * 1024;
+                    break;
+        case 'w':   windowLen = getLong(optarg, GN_GT_0 | GN_ANY_BASE, "-w");
+                    break;
+        case 'z':   zerocopy = TRUE;                                break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    if (listen) {
+        if (optind + 1 < argc)
+            usageError(argv[0]);
+        port = (optind < argc) ? argv[optind] : PORT_NUM_STR;
+        receiver(port, bufSize, windowLen, zerocopy);
+    } else {
+        if (optind >= argc || optind + 2 < argc)
+            usageError(argv[0]);
+        port = (optind + 1 < argc) ? argv[optind + 1] : PORT_NUM_STR;
+        sender(argv[optind], port, bufSize, total, zerocopy);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,275 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* ktls.c
+
+   Functions for sending and receiving TLS 1.2 records (AES-128-GCM),
+   either by handing the keys to the kernel (kernel TLS, "kTLS"), or by
+   encrypting and decrypting in user space with OpenSSL's libcrypto.
+
+   Once ktlsEnable() has installed the keys for a direction of a TCP
+   socket, the kernel frames and encrypts whatever is written to the
+   socket (including data sent by sendfile() and splice(), so that file
+   data still need not be copied through user space), or decrypts
+   whatever is read from it. Where the network device supports TLS
+   offload, the kernel lets the device do the encryption; otherwise, it
+   encrypts in software. ktlsStats() reports which has been happening.
+
+   The keys would normally be agreed by a TLS handshake, done in user
+   space by a library such as OpenSSL (which, if built with kTLS support
+   and asked to with SSL_OP_ENABLE_KTLS, then makes the same
+   setsockopt() calls as ktlsEnable()). The records are those of TLS
+   1.2, so that the two ends interoperate whichever of them uses the
+   kernel and whichever user space.
+
+   The kernel TLS module ("tls") must be loaded (or loadable) for
+   ktlsEnable() to succeed; otherwise it fails with ENOENT.
+
+   This code is Linux-specific.
+*/
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#include <openssl/evp.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include "rdwrn.h"
+#include "ktls.h"               /* Declares functions defined here */
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+#define TLS_REC_APPDATA 23      /* Record type for application data */
+
+/* Install the keys in 'k' on the TCP socket 'sfd', for sending if 'tx'
+   is nonzero, or for receiving otherwise. Returns 0 on success, or -1 on
+   error. */
+
+int
+ktlsEnable(int sfd, int tx, const struct tlsKey *k)
+{
+    struct tls12_crypto_info_aes_gcm_128 ci;
+
+    /* Attach the TLS upper-layer protocol; this fails with EEXIST if it
+       was already attached for the other direction */
+
+    if (setsockopt(sfd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == -1 &&
+            errno != EEXIST)
+        return -1;
+
+    memset(&ci, 0, sizeof(ci));
+    ci.info.version = TLS_1_2_VERSION;
+    ci.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+    memcpy(ci.key, k->key, TLS_KEY_LEN);
+    memcpy(ci.salt, k->salt, TLS_SALT_LEN);
+    memcpy(ci.iv, k->iv, TLS_IV_LEN);
+    /* ci.rec_seq is zero */
+
+    return setsockopt(sfd, SOL_TLS, tx ? TLS_TX : TLS_RX, &ci, sizeof(ci));
+}
+
+/* Obtain the number of connections that have (since boot) had kTLS
+   transmission enabled in software ('*txSw') and offloaded to a
+   network device ('*txDevice'), from /proc/net/tls_stat. Returns 0 on
+   success, or -1 on error (for example, if the tls module isn't
+   loaded). */
+
+int
+ktlsStats(long long *txSw, long long *txDevice)
+{
+    char name[64];
+    long long val;
+    FILE *fp;
+    int found;
+
+    fp = fopen("/proc/net/tls_stat", "r");
+    if (fp == NULL)
+        return -1;
+
+    found = 0;
+    while (fscanf(fp, "%63s %lld", name, &val) == 2) {
+        if (strcmp(name, "TlsTxSw") == 0) {
+            *txSw = val;
+            found++;
+        } else if (strcmp(name, "TlsTxDevice") == 0) {
+            *txDevice = val;
+            found++;
+        }
+    }
+    fclose(fp);
+    return (found == 2) ? 0 : -1;
+}
+
+/* Prepare 'r' for encrypting (if 'encrypt' is nonzero) or decrypting
+   records with the keys in 'k'. Returns 0 on success, or -1 on error. */
+
+int
+tlsRecInit(struct tlsRec *r, const struct tlsKey *k, int encrypt)
+{
+    r->ctx = EVP_CIPHER_CTX_new();
+    if (r->ctx == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    /* Expand the key once; each record then supplies only its nonce */
+
+    if (EVP_CipherInit_ex(r->ctx, EVP_aes_128_gcm(), NULL, k->key, NULL,
+                          encrypt) != 1) {
+        EVP_CIPHER_CTX_free(r->ctx);
+        errno = EINVAL;
+        return -1;
+    }
+    r->k = *k;
+    r->seq = 0;
+    return 0;
+}
+
+void
+tlsRecFree(struct tlsRec *r)
+{
+    EVP_CIPHER_CTX_free(r->ctx);
+}
+
+/* Build the 12-byte nonce from the salt and the record's explicit
+   nonce, and the additional authenticated data (sequence number, type,
+   version, plaintext length) for a record of 'len' bytes */
+
+static void
+recordParams(struct tlsRec *r, const unsigned char *explicitIv,
+             size_t len, unsigned char *nonce, unsigned char *aad)
+{
+    int j;
+
+    memcpy(nonce, r->k.salt, TLS_SALT_LEN);
+    memcpy(nonce + TLS_SALT_LEN, explicitIv, TLS_IV_LEN);
+
+    for (j = 0; j < 8; j++)
+        aad[j] = r->seq >> (56 - 8 * j);
+    aad[8] = TLS_REC_APPDATA;
+    aad[9] = 3;                 /* TLS 1.2 is version 3.3 */
+    aad[10] = 3;
+    aad[11] = len >> 8;
+    aad[12] = len & 0xff;
+}
+
+/* Encrypt the 'len' bytes in 'buf' into records, and write them to
+   'fd'. Returns 'len' on success, or -1 on error. */
+
+ssize_t
+tlsRecWrite(int fd, struct tlsRec *r, const void *buf, size_t len)
+{
+    unsigned char nonce[TLS_SALT_LEN + TLS_IV_LEN], aad[13];
+    unsigned char *hdr, *iv, *out;
+    const unsigned char *in;
+    size_t done, n, recLen;
+    uint64_t ivNum;
+    int outl, j;
+
+    hdr = r->buf;
+    iv = hdr + TLS_HDR_LEN;
+    out = iv + TLS_IV_LEN;
+
+    for (done = 0, in = buf; done < len; done += n, in += n) {
+        n = (len - done > TLS_MAX_PLAIN) ? TLS_MAX_PLAIN : len - done;
+
+        /* As the kernel does, make the explicit nonce of each record the
+           initial IV plus the record's sequence number */
+
+        ivNum = 0;
+        for (j = 0; j < TLS_IV_LEN; j++)
+            ivNum = (ivNum << 8) | r->k.iv[j];
+        ivNum += r->seq;
+        for (j = 0; j < TLS_IV_LEN; j++)
+            iv[j] = ivNum >> (56 - 8 * j);
+
+        recordParams(r, iv, n, nonce, aad);
+        if (EVP_EncryptInit_ex(r->ctx, NULL, NULL, NULL, nonce) != 1 ||
+                EVP_EncryptUpdate(r->ctx, NULL, &outl, aad,
+                                  sizeof(aad)) != 1 ||
+                EVP_EncryptUpdate(r->ctx, out, &outl, in, n) != 1 ||
+                EVP_EncryptFinal_ex(r->ctx, out + n, &outl) != 1 ||
+                EVP_CIPHER_CTX_ctrl(r->ctx, EVP_CTRL_GCM_GET_TAG,
+                                    TLS_TAG_LEN, out + n) != 1) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        recLen = TLS_IV_LEN + n + TLS_TAG_LEN;
+        hdr[0] = TLS_REC_APPDATA;
+        hdr[1] = 3;
+        hdr[2] = 3;
+        hdr[3] = recLen >> 8;
+        hdr[4] = recLen & 0xff;
+        if (writen(fd, r->buf, TLS_HDR_LEN + recLen) !=
+                (ssize_t) (TLS_HDR_LEN + recLen))
+            return -1;
+        r->seq++;
+    }
+    return len;
+}
+
+/* Read one record from 'fd', and decrypt it into 'buf', which must have
+   room for TLS_MAX_PLAIN bytes. Returns the number of bytes placed in
+   'buf', 0 on end-of-file, or -1 on error; the error is EBADMSG if the
+   record is malformed or fails authentication. */
+
+ssize_t
+tlsRecRead(int fd, struct tlsRec *r, void *buf)
+{
+    unsigned char nonce[TLS_SALT_LEN + TLS_IV_LEN], aad[13];
+    unsigned char *hdr, *iv, *in;
+    size_t recLen, n;
+    ssize_t numRead;
+    int outl;
+
+    hdr = r->buf;
+    iv = hdr + TLS_HDR_LEN;
+    in = iv + TLS_IV_LEN;
+
+    errno = 0;
+    numRead = readn(fd, hdr, TLS_HDR_LEN);
+    if (numRead == 0)
+        return 0;
+    if (numRead != TLS_HDR_LEN)
+        goto bad;
+
+    recLen = (hdr[3] << 8) | hdr[4];
+    if (hdr[0] != TLS_REC_APPDATA || hdr[1] != 3 || hdr[2] != 3 ||
+            recLen < TLS_IV_LEN + TLS_TAG_LEN ||
+            recLen > TLS_IV_LEN + TLS_MAX_PLAIN + TLS_TAG_LEN)
+        goto bad;
+    if (readn(fd, iv, recLen) != (ssize_t) recLen)
+        goto bad;
+
+    n = recLen - TLS_IV_LEN - TLS_TAG_LEN;
+    recordParams(r, iv, n, nonce, aad);
+    if (EVP_DecryptInit_ex(r->ctx, NULL, NULL, NULL, nonce) != 1 ||
+            EVP_DecryptUpdate(r->ctx, NULL, &outl, aad, sizeof(aad)) != 1 ||
+            EVP_DecryptUpdate(r->ctx, buf, &outl, in, n) != 1 ||
+            EVP_CIPHER_CTX_ctrl(r->ctx, EVP_CTRL_GCM_SET_TAG, TLS_TAG_LEN,
+                                in + n) != 1 ||
+            EVP_DecryptFinal_ex(r->ctx, (unsigned char *) buf + n,
+                                &outl) != 1)
+        goto bad;
+
+    r->seq++;
+    return n;
+
+bad:
+    if (errno == 0)
+        errno = EBADMSG;
+    return -1;
+}
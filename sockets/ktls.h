@@ -0,0 +1,61 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* ktls.h
+
+   Header file for ktls.c.
+*/
+#ifndef KTLS_H
+#define KTLS_H                  /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/* TLS 1.2 records protected with AES-128-GCM */
+
+#define TLS_KEY_LEN     16
+#define TLS_SALT_LEN    4       /* Implicit part of each record's nonce */
+#define TLS_IV_LEN      8       /* Explicit part, carried in each record */
+#define TLS_TAG_LEN     16
+#define TLS_HDR_LEN     5       /* Type, version, length */
+#define TLS_MAX_PLAIN   16384   /* Most plaintext in one record */
+
+struct tlsKey {                 /* Keys for one direction of a connection */
+    unsigned char key[TLS_KEY_LEN];
+    unsigned char salt[TLS_SALT_LEN];
+    unsigned char iv[TLS_IV_LEN];       /* Explicit nonce of first record */
+};
+
+int ktlsEnable(int sfd, int tx, const struct tlsKey *k);
+
+int ktlsStats(long long *txSw, long long *txDevice);
+
+/* State for protecting or checking records in user space; the record
+   sequence number starts at 0, as it does for ktlsEnable() */
+
+struct tlsRec {
+    void *ctx;                  /* OpenSSL cipher context */
+    struct tlsKey k;
+    uint64_t seq;               /* Sequence number of next record */
+    unsigned char buf[TLS_HDR_LEN + TLS_IV_LEN + TLS_MAX_PLAIN +
+                      TLS_TAG_LEN];
+};
+
+int tlsRecInit(struct tlsRec *r, const struct tlsKey *k, int encrypt);
+
+void tlsRecFree(struct tlsRec *r);
+
+ssize_t tlsRecWrite(int fd, struct tlsRec *r, const void *buf, size_t len);
+
+ssize_t tlsRecRead(int fd, struct tlsRec *r, void *buf);
+
+#endif
@@ -0,0 +1,304 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 59 */
+
+/* lib_bench.c
+
+   Benchmark the hot paths of the functions in libtlpi that programs call
+   in loops: reading lines (readLine(), readLineBuf(), readLineBufView(),
+   and lineReaderRead()), readn() and writen(), and number parsing
+   (getLong() and getInt()), on inputs that never take an error path.
+
+   Usage: lib_bench [-n ops]
+
+        -n ops       Number of operations (lines, transfers, or numbers)
+                     per repetition of each benchmark (default: 100000)
+
+   The results are reported in the common format of lib/bench.c. Each
+   benchmark name is prefixed with the name by which the program was
+   invoked, so that "make opt_bench" in lib/ can report the same
+   benchmarks for this program linked with libtlpi.a and with the
+   optimized libtlpi_opt.a (see TLPI_OPT in Makefile.inc), as
+   "lib_bench_base" and "lib_bench_opt".
+
+   This program is also the training workload for the profile-guided
+   build of libtlpi_opt.a ("make opt" in lib/).
+
+   Before measuring, the program checks that each function returns
+   exactly the expected results (the lines of the input file, the data
+   written, and the values of the numbers), and exits with an error if it
+   does not, so that it also serves as a check that the optimized library
+   behaves the same as the normal library.
+*/
+#include <sys/socket.h>
+#include "read_line.h"
+#include "read_line_buf.h"
+#include "line_reader.h"
+#include "rdwrn.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+#define NUM_LINES 4096          /* Lines in the input file */
+#define MAX_LINE 128            /* Longest line is 99 bytes */
+#define NUM_NUMS 1024           /* Strings for getLong() and getInt() */
+#define XFER_SIZE 512           /* Bytes per writen()/readn() */
+#define RL_BUF_SIZE 65536       /* Buffer for readLineBuf() and
+                                   lineReaderRead() */
+
+static const char *prog;        /* Basename of argv[0] */
+static int lineFd;              /* Input file of NUM_LINES lines */
+static long fileBytes;          /* Size of input file */
+static unsigned long fileSum;   /* Checksum of input file */
+
+static char numStr[NUM_NUMS][16];   /* Numbers for getLong() and getInt() */
+static long numVal[NUM_NUMS];   /* Their values */
+
+static int sv[2];               /* Socket pair for readn()/writen() */
+
+static struct ReadLineBuf rlb;
+static char rlbBuf[RL_BUF_SIZE];
+static struct LineReader lr;
+static char lrBuf[RL_BUF_SIZE];
+
+static volatile unsigned long sink;     /* Defeats dead code elimination */
+
+static unsigned long
+checksum(unsigned long sum, const char *buf, size_t len)
+{
+    size_t j;
+
+    for (j = 0; j < len; j++)
+        sum = sum * 31 + (unsigned char) buf[j];
+    return sum;
+}
+
+/* Create the input file (unlinked), and the strings to be parsed */
+
+static void
+makeInputs(void)
+{
+    char tmpl[] = "/tmp/lib_bench_XXXXXX";
+    char line[MAX_LINE];
+    int j, len;
+    FILE *fp;
+
+    lineFd = mkstemp(tmpl);
+    if (lineFd == -1)
+        errExit("mkstemp");
+    unlink(tmpl);
+    fp = fdopen(dup(lineFd), "w");
+    if (fp == NULL)
+        errExit("fdopen");
+
+    fileBytes = 0;
+    fileSum = 0;
+    srandom(1);
+    for (j = 0; j < NUM_LINES; j++) {
+        len = snprintf(line, sizeof(line), "%06d %.*s\n", j,
+                       (int) (random() % 90),
+                       "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                       "0123456789abcdefghijklmnopqrstuvwxyz0123456789");
+        fputs(line, fp);
+        fileBytes += len;
+        fileSum = checksum(fileSum, line, len);
+    }
+    if (fclose(fp) == EOF)
+        errExit("fclose");
+
+    for (j = 0; j < NUM_NUMS; j++) {
+        numVal[j] = (j % 3 == 0) ? -(random() % 100000) : random() % 1000000;
+        snprintf(numStr[j], sizeof(numStr[j]), "%ld", numVal[j]);
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+        errExit("socketpair");
+}
+
+static void
+rewindLines(void)
+{
+    if (lseek(lineFd, 0, SEEK_SET) == -1)
+        errExit("lseek");
+    if (readLineBufInitSize(lineFd, &rlb, rlbBuf, sizeof(rlbBuf)) == -1)
+        errExit("readLineBufInitSize");
+    lineReaderInit(&lr, lineFd, lrBuf, sizeof(lrBuf));
+}
+
+/* Read one line with the reader selected by 'which'; on end of file,
+   start again from the beginning of the file. Returns the line length,
+   and (via 'line') the line. */
+
+enum reader { R_READLINE, R_READLINEBUF, R_VIEW, R_LINEREADER };
+
+static ssize_t
+getLine(enum reader which, char *buf, const char **line)
+{
+    ssize_t n;
+    int tries;
+
+    for (tries = 0; tries < 2; tries++) {
+        *line = buf;
+        switch (which) {
+        case R_READLINE:    n = readLine(lineFd, buf, MAX_LINE);      break;
+        case R_READLINEBUF: n = readLineBuf(&rlb, buf, MAX_LINE);     break;
+        case R_VIEW:        n = readLineBufView(&rlb, line);          break;
+        default:            n = lineReaderRead(&lr, buf, MAX_LINE);   break;
+        }
+        if (n == -1)
+            errExit("reading line");
+        if (n > 0)
+            return n;
+        rewindLines();
+    }
+    fatal("empty input file");
+    return 0;
+}
+
+static void
+benchLines(long ops, void *arg)
+{
+    enum reader which = *(enum reader *) arg;
+    char buf[MAX_LINE];
+    const char *line;
+    unsigned long sum;
+    long j;
+
+    sum = 0;
+    for (j = 0; j < ops; j++)
+        sum += getLine(which, buf, &line) + line[0];
+    sink = sum;
+}
+
+static void
+benchXfer(long ops, void *arg)
+{
+    char out[XFER_SIZE], in[XFER_SIZE];
+    long j;
+
+    memset(out, 'x', sizeof(out));
+    for (j = 0; j < ops; j++) {
+        if (writen(sv[0], out, sizeof(out)) != sizeof(out))
+            errExit("writen");
+        if (readn(sv[1], in, sizeof(in)) != sizeof(in))
+            errExit("readn");
+    }
+    sink = in[0];
+}
+
+static void
+benchGetLong(long ops, void *arg)
+{
+    unsigned long sum;
+    long j;
+
+    sum = 0;
+    for (j = 0; j < ops; j++)
+        sum += getLong(numStr[j % NUM_NUMS], 0, "num");
+    sink = sum;
+}
+
+static void
+benchGetInt(long ops, void *arg)
+{
+    unsigned long sum;
+    long j;
+
+    sum = 0;
+    for (j = 0; j < ops; j++)
+        sum += getInt(numStr[j % NUM_NUMS], 0, "num");
+    sink = sum;
+}
+
+/* Check that each function produces exactly the expected results */
+
+static void
+checkResults(void)
+{
+    static const char *names[] = { "readLine", "readLineBuf",
+                                   "readLineBufView", "lineReaderRead" };
+    char buf[MAX_LINE], out[XFER_SIZE], in[XFER_SIZE];
+    const char *line;
+    unsigned long sum;
+    long bytes;
+    ssize_t n;
+    int r, j;
+
+    for (r = R_READLINE; r <= R_LINEREADER; r++) {
+        rewindLines();
+        sum = 0;
+        bytes = 0;
+        for (j = 0; j < NUM_LINES; j++) {
+            n = getLine(r, buf, &line);
+            sum = checksum(sum, line, n);
+            bytes += n;
+        }
+        if (sum != fileSum || bytes != fileBytes)
+            fatal("%s: wrong result (%ld bytes, checksum %lx; "
+                  "expected %ld, %lx)", names[r], bytes, sum, fileBytes,
+                  fileSum);
+    }
+    rewindLines();
+
+    for (j = 0; j < XFER_SIZE; j++)
+        out[j] = j;
+    if (writen(sv[0], out, sizeof(out)) != sizeof(out) ||
+            readn(sv[1], in, sizeof(in)) != sizeof(in) ||
+            memcmp(in, out, sizeof(out)) != 0)
+        fatal("writen()/readn(): wrong result");
+
+    for (j = 0; j < NUM_NUMS; j++)
+        if (getLong(numStr[j], 0, "num") != numVal[j] ||
+                getInt(numStr[j], 0, "num") != numVal[j])
+            fatal("getLong()/getInt(): wrong result for %s", numStr[j]);
+}
+
+static void
+run(const char *what, benchFn fn, void *arg, long ops)
+{
+    struct benchResult res;
+    char name[64];
+
+    snprintf(name, sizeof(name), "%s: %s", prog, what);
+    if (benchRun(name, fn, arg, ops, NULL, &res) == -1)
+        errExit("benchRun");
+    benchReport(&res);
+}
+
+int
+main(int argc, char *argv[])
+{
+    enum reader rd[] = { R_READLINE, R_READLINEBUF, R_VIEW, R_LINEREADER };
+    long ops;
+    int opt;
+
+    ops = 100000;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n': ops = getLong(optarg, GN_GT_0, "-n");         break;
+        default:  usageErr("%s [-n ops]\n", argv[0]);
+        }
+    }
+    prog = (strrchr(argv[0], '/') != NULL) ? strrchr(argv[0], '/') + 1
+                                          : argv[0];
+
+    makeInputs();
+    checkResults();
+
+    run("readLine", benchLines, &rd[0], ops);
+    run("readLineBuf", benchLines, &rd[1], ops);
+    run("readLineBufView", benchLines, &rd[2], ops);
+    run("lineReaderRead", benchLines, &rd[3], ops);
+    run("writen+readn 512B", benchXfer, NULL, ops);
+    run("getLong", benchGetLong, NULL, ops);
+    run("getInt", benchGetInt, NULL, ops);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,136 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 59 */
+
+/* line_reader.c
+
+   Implementation of lineReaderRead(), a buffered alternative to readLine().
+
+   readLine() (read_line.c) performs one read() system call for each byte
+   of input. lineReaderRead() instead reads input in blocks the size of a
+   caller-supplied buffer, and then uses memchr() (which, in most C
+   libraries, is heavily optimized and scans many bytes per instruction)
+   to locate the end of each line within the buffered data.
+
+   lineReaderRead() has the same semantics as readLine() with respect to
+   truncation of long lines, the terminating null byte, and the return
+   value, so that a caller can be switched from readLine() to
+   lineReaderRead() simply by replacing the call:
+
+        readLine(fd, buf, n)        ==>     lineReaderRead(&lr, buf, n)
+
+   where 'lr' was earlier initialized by a call to lineReaderInit().
+
+   Note that because input is read in blocks, bytes following the most
+   recently returned line may already have been consumed from 'fd' and
+   held in the LineReader buffer. The caller should therefore not mix
+   calls to lineReaderRead() with other reads from the same file
+   descriptor, and should reinitialize the LineReader (with
+   lineReaderInit()) whenever it begins reading from a different source
+   (e.g., a newly accepted socket that happens to reuse a file descriptor
+   number).
+*/
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include "line_reader.h"
+
+/* Initialize a LineReader structure that will read input from 'fd',
+   using 'buf' (of size 'bufSize') to hold input that has been read but
+   not yet returned */
+
+void
+lineReaderInit(struct LineReader *lr, int fd, void *buf, size_t bufSize)
+{
+    lr->fd = fd;
+    lr->buf = buf;
+    lr->bufSize = bufSize;
+    lr->next = 0;
+    lr->len = 0;
+}
+
+/* Return the next line of input from 'lr', placing the characters in
+   'buffer'. If a newline character is not encountered in the first
+   (n - 1) bytes, then the excess characters are discarded. The
+   returned string placed in 'buffer' is null-terminated and includes
+   the newline character if it was read in the first (n - 1) bytes.
+   The function return value is the number of bytes placed in buffer
+   (which includes the newline character if encountered, but excludes
+   the terminating null byte). */
+
+ssize_t
+lineReaderRead(struct LineReader *lr, void *buffer, size_t n)
+{
+    ssize_t numRead;                    /* # of bytes fetched by last read() */
+    size_t totRead;                     /* Total bytes placed in 'buffer' */
+    size_t avail;                       /* Unread bytes in 'lr->buf' */
+    size_t cnt;                         /* Bytes of this line in 'lr->buf' */
+    size_t room;                        /* Space remaining in 'buffer' */
+    char *buf, *start, *nl;
+
+    if (n <= 0 || buffer == NULL || lr->buf == NULL || lr->bufSize == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    buf = buffer;                       /* No pointer arithmetic on "void *" */
+
+    totRead = 0;
+    for (;;) {
+
+        /* If we have consumed all buffered input, refill the buffer */
+
+        if (lr->next >= lr->len) {
+            numRead = read(lr->fd, lr->buf, lr->bufSize);
+
+            if (numRead == -1) {
+                if (errno == EINTR)     /* Interrupted --> restart read() */
+                    continue;
+                else
+                    return -1;          /* Some other error */
+
+            } else if (numRead == 0) {  /* EOF */
+                if (totRead == 0)       /* No bytes read; return 0 */
+                    return 0;
+                else                    /* Some bytes read; add '\0' */
+                    break;
+            }
+
+            lr->next = 0;
+            lr->len = numRead;
+        }
+
+        /* Search the buffered input for the end of the line, and copy
+           as much of the line as will fit into the caller's buffer. Any
+           bytes that don't fit are discarded. */
+
+        start = lr->buf + lr->next;
+        avail = lr->len - lr->next;
+        nl = memchr(start, '\n', avail);
+        cnt = (nl == NULL) ? avail : (size_t) (nl - start) + 1;
+
+        room = n - 1 - totRead;
+        if (room > 0) {
+            if (room > cnt)
+                room = cnt;
+            memcpy(buf + totRead, start, room);
+            totRead += room;
+        }
+
+        lr->next += cnt;
+
+        if (nl != NULL)
+            break;
+    }
+
+    buf[totRead] = '\0';
+    return totRead;
+}
@@ -0,0 +1,42 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 59 */
+
+/* line_reader.h
+
+   Header file for line_reader.c.
+*/
+#ifndef LINE_READER_H
+#define LINE_READER_H           /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+
+/* Per-file-descriptor state for lineReaderRead(). The caller supplies
+   the buffer ('buf', of 'bufSize' bytes) that holds input that has
+   been read from 'fd' but not yet returned to the caller. */
+
+struct LineReader {
+    int     fd;                 /* File descriptor from which to read */
+    char   *buf;                /* Caller-supplied input buffer */
+    size_t  bufSize;            /* Size of 'buf' */
+    size_t  next;               /* Index of next unread byte in 'buf' */
+    size_t  len;                /* Number of bytes currently in 'buf' */
+};
+
+#define LR_DEFAULT_BUF_SIZE 4096
+                        /* A reasonable size for the 'buf' that the caller
+                           passes to lineReaderInit() */
+
+void lineReaderInit(struct LineReader *lr, int fd, void *buf, size_t bufSize);
+
+ssize_t lineReaderRead(struct LineReader *lr, void *buffer, size_t n);
+
+#endif
@@ -13,6 +13,15 @@
 /* list_host_addresses.c
 
    List host's network interfaces and IP addresses.
+
+   Usage: list_host_addresses [-n] [-f]
+
+        -n      Obtain the addresses via rtnetlink, using if_watch.c,
+                rather than getifaddrs()
+        -f      After listing the addresses, follow changes to them
+                (implies -n): addresses that are added or deleted are
+                shown prefixed by '+' or '-', and new, changed, or
+                deleted interfaces by '*'
 */
 #define _GNU_SOURCE     /* To get definition of NI_MAXHOST */
 #include <arpa/inet.h>
@@ -23,15 +32,115 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <poll.h>
 #include <linux/if_link.h>
+#include "if_watch.h"
+
+/* Display an address from if_watch.c, in the same form as those from
+   getifaddrs() */
+
+static void
+showAddr(struct ifWatch *w, const char *prefix, const struct ifwAddr *a)
+{
+    const struct ifwLink *l;
+    char host[INET6_ADDRSTRLEN];
+
+    l = ifwLinkByIndex(w, a->index);
+    inet_ntop(a->family, a->addr, host, sizeof(host));
+    printf("%s%-16s %s\n", prefix, (l == NULL) ? "?" : l->name, host);
+}
+
+static void
+changed(void *arg, int event, const struct ifwLink *link,
+        const struct ifwAddr *addr)
+{
+    switch (event) {
+    case IFW_LINK_NEW:
+        printf("* %-16s link %d, %s\n", link->name, link->index,
+               (link->flags & IFF_UP) ? "up" : "down");
+        break;
+    case IFW_LINK_DEL:
+        printf("* %-16s link %d, deleted\n", link->name, link->index);
+        break;
+    case IFW_ADDR_NEW:
+        showAddr(arg, "+ ", addr);
+        break;
+    case IFW_ADDR_DEL:
+        showAddr(arg, "- ", addr);
+        break;
+    }
+    fflush(stdout);
+}
+
+/* List (and, if 'follow', keep listing changes to) the addresses of the
+   interfaces other than "lo", using if_watch.c */
+
+static void
+listViaNetlink(int follow)
+{
+    struct ifWatch *w;
+    struct ifwAddr *addrs;
+    const struct ifwLink *l;
+    struct pollfd pfd;
+    int n, j;
+
+    w = ifwOpen(follow ? IFW_WATCH : 0, 0);
+    if (w == NULL) {
+        perror("ifwOpen");
+        exit(EXIT_FAILURE);
+    }
+
+    n = ifwGetAddrs(w, &addrs);
+    if (n == -1) {
+        perror("ifwGetAddrs");
+        exit(EXIT_FAILURE);
+    }
+    for (j = 0; j < n; j++) {
+        l = ifwLinkByIndex(w, addrs[j].index);
+        if (l == NULL || strcmp(l->name, "lo") != 0)
+            showAddr(w, "", &addrs[j]);
+    }
+    free(addrs);
+
+    while (follow) {
+        pfd.fd = ifwFd(w);
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, -1) == -1) {
+            perror("poll");
+            exit(EXIT_FAILURE);
+        }
+        if (ifwProcess(w, changed, w) == -1) {
+            perror("ifwProcess");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    ifwClose(w);
+}
 
 int
 main(int argc, char *argv[])
 {
     struct ifaddrs *ifaddr;
-    int family, s;
+    int family, s, opt, useNetlink, follow;
     char host[NI_MAXHOST];
 
+    useNetlink = follow = 0;
+    while ((opt = getopt(argc, argv, "nf")) != -1) {
+        switch (opt) {
+        case 'n':   useNetlink = 1;             break;
+        case 'f':   useNetlink = follow = 1;    break;
+        default:
+            fprintf(stderr, "Usage: %s [-n] [-f]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (useNetlink) {
+        listViaNetlink(follow);
+        exit(EXIT_SUCCESS);
+    }
+
     if (getifaddrs(&ifaddr) == -1) {
         perror("getifaddrs");
         exit(EXIT_FAILURE);
@@ -0,0 +1,422 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* memfd_ring.c
+
+   Implement a byte stream between two processes as a lock-free single-
+   producer, single-consumer ring buffer in shared memory.
+
+   The producer creates the ring in a file created with memfd_create()
+   and then seals the file against changes in size (F_SEAL_GROW,
+   F_SEAL_SHRINK) and further sealing (F_SEAL_SEAL). It passes the file
+   descriptor to the consumer over a UNIX domain socket using sendfds()
+   (scm_functions.c), in a single message along with two eventfd file
+   descriptors that the peers use to wake one another. The consumer
+   checks the seals before mapping the file: since the file can't shrink,
+   the consumer can't be killed by SIGBUS through a (buggy or malicious)
+   producer truncating the file.
+
+   The ring holds a header, followed by 'capacity' bytes of data, where
+   'capacity' is a power of 2. The header contains two free-running
+   counters: 'head', the number of bytes ever written (updated only by the
+   producer), and 'tail', the number of bytes ever read (updated only by
+   the consumer). The bytes in the ring are thus those from 'tail' to
+   'head', and each counter is published by a single atomic store with
+   release semantics, after the data it covers has been copied. The
+   counters are placed in separate cache lines, so that the peers don't
+   contend for one line.
+
+   A peer that finds the ring empty (consumer) or full (producer) sets a
+   "waiting" flag in the header, rechecks the ring, and then blocks in a
+   read() on its eventfd. After updating its counter, the other peer
+   writes to that eventfd only if the flag is set. Thus, while data flows
+   steadily, no system calls are made at all; in particular, unlike a
+   socket, the data is not copied into and out of the kernel.
+
+   This code is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include "scm_functions.h"
+#include "memfd_ring.h"
+#include "tlpi_hdr.h"
+
+#define MR_MAGIC 0x6d72696eU    /* Identifies an initialized ring */
+
+#define CACHE_LINE 64
+
+struct mrHeader {               /* At start of shared memory */
+    uint32_t magic;
+    uint32_t capacity;          /* Size of data area (a power of 2) */
+    uint32_t eof;               /* Producer has called mrClose() */
+    char pad1[CACHE_LINE - 3 * sizeof(uint32_t)];
+
+    uint64_t head;              /* Bytes written; updated by producer */
+    uint32_t consWaiting;       /* Consumer is (about to be) blocked */
+    char pad2[CACHE_LINE - sizeof(uint64_t) - sizeof(uint32_t)];
+
+    uint64_t tail;              /* Bytes read; updated by consumer */
+    uint32_t prodWaiting;       /* Producer is (about to be) blocked */
+    char pad3[CACHE_LINE - sizeof(uint64_t) - sizeof(uint32_t)];
+};
+
+struct memfdRing {              /* Per-process handle */
+    int memFd;
+    int dataEvFd;               /* Signaled when data is added */
+    int spaceEvFd;              /* Signaled when space is freed */
+    size_t mapSize;
+    struct mrHeader *hdr;
+    char *data;
+};
+
+/* Wait until the eventfd 'efd' is signaled */
+
+static int
+evWait(int efd)
+{
+    uint64_t v;
+
+    while (read(efd, &v, sizeof(v)) == -1)
+        if (errno != EINTR)
+            return -1;
+    return 0;
+}
+
+/* Wake the peer waiting on 'efd', if the flag '*waiting' shows that it
+   is (or is about to be) blocked. The full barrier ensures that the
+   preceding update of 'head' or 'tail' is visible before we inspect the
+   flag; the peer sets the flag and rechecks the counter in the opposite
+   order. */
+
+static int
+evWake(int efd, uint32_t *waiting)
+{
+    uint64_t v = 1;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED) == 0)
+        return 0;
+
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    if (write(efd, &v, sizeof(v)) == -1)
+        return -1;
+    return 0;
+}
+
+static void
+closeFds(struct memfdRing *r)
+{
+    if (r->memFd != -1)
+        close(r->memFd);
+    if (r->dataEvFd != -1)
+        close(r->dataEvFd);
+    if (r->spaceEvFd != -1)
+        close(r->spaceEvFd);
+}
+
+static struct memfdRing *
+allocRing(void)
+{
+    struct memfdRing *r;
+
+    r = malloc(sizeof(struct memfdRing));
+    if (r == NULL)
+        return NULL;
+    r->memFd = r->dataEvFd = r->spaceEvFd = -1;
+    r->hdr = NULL;
+    return r;
+}
+
+/* Map the ring whose (sealed) file is r->memFd */
+
+static int
+mapRing(struct memfdRing *r, int initialize, size_t capacity)
+{
+    void *addr;
+
+    addr = mmap(NULL, r->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                r->memFd, 0);
+    if (addr == MAP_FAILED)
+        return -1;
+
+    r->hdr = addr;
+    r->data = (char *) addr + sizeof(struct mrHeader);
+
+    if (initialize) {           /* memfd_create() file is zero-filled */
+        r->hdr->capacity = capacity;
+        __atomic_store_n(&r->hdr->magic, MR_MAGIC, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+/* Create a ring with a data area of 'capacity' bytes, which must be a
+   power of 2. Returns NULL (with errno set) on error. */
+
+struct memfdRing *
+mrCreate(size_t capacity)
+{
+    struct memfdRing *r;
+    int savedErrno;
+
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+            capacity > UINT32_MAX / 2 + 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    r = allocRing();
+    if (r == NULL)
+        return NULL;
+    r->mapSize = sizeof(struct mrHeader) + capacity;
+
+    r->memFd = memfd_create("memfd_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (r->memFd == -1)
+        goto fail;
+    if (ftruncate(r->memFd, r->mapSize) == -1)
+        goto fail;
+    if (fcntl(r->memFd, F_ADD_SEALS,
+                F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL) == -1)
+        goto fail;
+
+    r->dataEvFd = eventfd(0, EFD_CLOEXEC);
+    r->spaceEvFd = eventfd(0, EFD_CLOEXEC);
+    if (r->dataEvFd == -1 || r->spaceEvFd == -1)
+        goto fail;
+
+    if (mapRing(r, 1, capacity) == -1)
+        goto fail;
+    return r;
+
+fail:
+    savedErrno = errno;
+    closeFds(r);
+    free(r);
+    errno = savedErrno;
+    return NULL;
+}
+
+/* Pass the file descriptors of the ring 'r' to the peer at the other end
+   of the connected UNIX domain socket 'sockfd'. Returns 0 on success, or
+   -1 on error. */
+
+int
+mrSendFds(struct memfdRing *r, int sockfd)
+{
+    int fds[3];
+
+    fds[0] = r->memFd;
+    fds[1] = r->dataEvFd;
+    fds[2] = r->spaceEvFd;
+    if (sendfds(sockfd, fds, 3, NULL, 0, 0) == -1)
+        return -1;
+    return 0;
+}
+
+/* Receive the file descriptors sent by mrSendFds() on 'sockfd', verify
+   that the file has the expected seals and contents, and map it. Returns
+   NULL (with errno set) on error; EBADMSG means that the file is not a
+   properly sealed ring. */
+
+struct memfdRing *
+mrAttach(int sockfd)
+{
+    struct memfdRing *r;
+    struct stat sb;
+    int seals, savedErrno, fds[3], nfds, j;
+    size_t capacity;
+
+    r = allocRing();
+    if (r == NULL)
+        return NULL;
+
+    nfds = 3;
+    if (recvfds(sockfd, fds, &nfds, NULL, 0, NULL) == -1) {
+        if (errno == 0)                 /* EOF */
+            errno = EBADMSG;
+        goto fail;
+    }
+    if (nfds != 3) {
+        for (j = 0; j < nfds; j++)
+            close(fds[j]);
+        errno = EBADMSG;
+        goto fail;
+    }
+    r->memFd = fds[0];
+    r->dataEvFd = fds[1];
+    r->spaceEvFd = fds[2];
+
+    seals = fcntl(r->memFd, F_GET_SEALS);
+    if (seals == -1)
+        goto fail;
+    if ((seals & (F_SEAL_SHRINK | F_SEAL_SEAL)) !=
+            (F_SEAL_SHRINK | F_SEAL_SEAL)) {
+        errno = EBADMSG;
+        goto fail;
+    }
+
+    if (fstat(r->memFd, &sb) == -1)
+        goto fail;
+    if (sb.st_size <= sizeof(struct mrHeader)) {
+        errno = EBADMSG;
+        goto fail;
+    }
+    r->mapSize = sb.st_size;
+    capacity = r->mapSize - sizeof(struct mrHeader);
+
+    if (mapRing(r, 0, 0) == -1)
+        goto fail;
+
+    if (__atomic_load_n(&r->hdr->magic, __ATOMIC_ACQUIRE) != MR_MAGIC ||
+            r->hdr->capacity != capacity) {
+        munmap(r->hdr, r->mapSize);
+        errno = EBADMSG;
+        goto fail;
+    }
+    return r;
+
+fail:
+    savedErrno = errno;
+    closeFds(r);
+    free(r);
+    errno = savedErrno;
+    return NULL;
+}
+
+/* Copy all 'len' bytes of 'buf' into the ring, blocking while the ring
+   is full. Returns 'len' on success, or -1 on error. */
+
+ssize_t
+mrWrite(struct memfdRing *r, const void *buf, size_t len)
+{
+    struct mrHeader *h = r->hdr;
+    uint64_t head, tail;
+    size_t done, n, off, chunk, mask;
+
+    mask = h->capacity - 1;
+    head = h->head;                     /* Only we update 'head' */
+
+    for (done = 0; done < len; ) {
+        tail = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+
+        if (head - tail == h->capacity) {       /* Ring is full */
+            __atomic_store_n(&h->prodWaiting, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&h->tail, __ATOMIC_ACQUIRE) == tail)
+                if (evWait(r->spaceEvFd) == -1)
+                    return -1;
+            __atomic_store_n(&h->prodWaiting, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        n = h->capacity - (head - tail);        /* Free space */
+        if (n > len - done)
+            n = len - done;
+
+        /* Copy in (at most) two pieces, since we may wrap around the
+           end of the data area */
+
+        off = head & mask;
+        chunk = (n < h->capacity - off) ? n : h->capacity - off;
+        memcpy(r->data + off, (const char *) buf + done, chunk);
+        memcpy(r->data, (const char *) buf + done + chunk, n - chunk);
+
+        head += n;
+        done += n;
+        __atomic_store_n(&h->head, head, __ATOMIC_RELEASE);
+
+        if (evWake(r->dataEvFd, &h->consWaiting) == -1)
+            return -1;
+    }
+
+    return len;
+}
+
+/* Read up to 'len' bytes from the ring into 'buf', blocking while the
+   ring is empty. Returns the number of bytes read, 0 at end of data (the
+   producer has called mrClose() and the ring is empty), or -1 on error. */
+
+ssize_t
+mrRead(struct memfdRing *r, void *buf, size_t len)
+{
+    struct mrHeader *h = r->hdr;
+    uint64_t head, tail;
+    size_t n, off, chunk, mask;
+
+    if (len == 0)
+        return 0;
+
+    mask = h->capacity - 1;
+    tail = h->tail;                     /* Only we update 'tail' */
+
+    for (;;) {
+        head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+        if (head != tail)
+            break;
+
+        if (__atomic_load_n(&h->eof, __ATOMIC_ACQUIRE)) {
+            /* 'head' may have been updated just before 'eof' was set */
+
+            if (__atomic_load_n(&h->head, __ATOMIC_ACQUIRE) == tail)
+                return 0;
+            continue;
+        }
+
+        __atomic_store_n(&h->consWaiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&h->head, __ATOMIC_ACQUIRE) == tail &&
+                !__atomic_load_n(&h->eof, __ATOMIC_ACQUIRE))
+            if (evWait(r->dataEvFd) == -1)
+                return -1;
+        __atomic_store_n(&h->consWaiting, 0, __ATOMIC_RELAXED);
+    }
+
+    n = head - tail;
+    if (n > len)
+        n = len;
+
+    off = tail & mask;
+    chunk = (n < h->capacity - off) ? n : h->capacity - off;
+    memcpy(buf, r->data + off, chunk);
+    memcpy((char *) buf + chunk, r->data, n - chunk);
+
+    __atomic_store_n(&h->tail, tail + n, __ATOMIC_RELEASE);
+
+    if (evWake(r->spaceEvFd, &h->prodWaiting) == -1)
+        return -1;
+    return n;
+}
+
+/* Called by the producer to indicate that no more data will be written;
+   the consumer will see end-of-file once it has read the remaining
+   data. Returns 0 on success, or -1 on error. */
+
+int
+mrClose(struct memfdRing *r)
+{
+    __atomic_store_n(&r->hdr->eof, 1, __ATOMIC_RELEASE);
+    return evWake(r->dataEvFd, &r->hdr->consWaiting);
+}
+
+/* Unmap the ring and close its file descriptors */
+
+void
+mrFree(struct memfdRing *r)
+{
+    if (r->hdr != NULL)
+        munmap(r->hdr, r->mapSize);
+    closeFds(r);
+    free(r);
+}
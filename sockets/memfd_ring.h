@@ -0,0 +1,49 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* memfd_ring.h
+
+   Header file for memfd_ring.c.
+
+   A single-producer, single-consumer byte stream between two processes,
+   carried in a ring buffer in shared memory. The operations are:
+
+        producer creates a ring:            r = mrCreate(capacity)
+        producer passes the ring to peer:   mrSendFds(r, sockfd)
+        consumer attaches to the ring:      r = mrAttach(sockfd)
+        producer writes data:               mrWrite(r, buf, len)
+        consumer reads data:                mrRead(r, buf, len)
+        producer signals end of data:       mrClose(r)
+        either side unmaps the ring:        mrFree(r)
+*/
+#ifndef MEMFD_RING_H
+#define MEMFD_RING_H            /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+
+struct memfdRing;               /* Opaque; defined in memfd_ring.c */
+
+struct memfdRing *mrCreate(size_t capacity);
+
+int mrSendFds(struct memfdRing *r, int sockfd);
+
+struct memfdRing *mrAttach(int sockfd);
+
+ssize_t mrWrite(struct memfdRing *r, const void *buf, size_t len);
+
+ssize_t mrRead(struct memfdRing *r, void *buf, size_t len);
+
+int mrClose(struct memfdRing *r);
+
+void mrFree(struct memfdRing *r);
+
+#endif
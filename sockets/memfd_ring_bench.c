@@ -0,0 +1,288 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* memfd_ring_bench.c
+
+   Compare the throughput of a byte stream carried over a UNIX domain
+   stream socket (as in us_xfr_sv.c and us_xfr_cl.c) with the same stream
+   carried in a shared memory ring buffer (memfd_ring.c).
+
+   Usage: memfd_ring_bench [-r ring-KiB] [-b block-size] [-t transport]
+                           total-MiB
+
+        -r ring-KiB     Size of the ring buffer (a power of 2; default:
+                        256)
+        -b block-size   Size of each write and read (default: 4096)
+        -t transport    "socket", "ring", or "all" (the default)
+
+   For each transport, the program creates a socket pair and a child
+   process that acts as the consumer; the parent is the producer. For the
+   ring transport, the parent creates the ring after fork() and passes it
+   to the child over the socket with mrSendFds(), just as it would to an
+   unrelated process. The child reads the stream until end-of-file,
+   computes a checksum, and reports it back over the socket, so that the
+   parent can verify the transfer.
+
+   This program is Linux-specific.
+*/
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <time.h>
+#include "memfd_ring.h"
+#include "tlpi_hdr.h"
+
+static size_t ringSize, blockSize;
+static long long totalBytes;
+
+struct result {                 /* Sent by consumer to producer */
+    long long bytes;
+    uint64_t sum;
+};
+
+static uint64_t
+checksum(const char *buf, size_t len, uint64_t sum)
+{
+    size_t j;
+
+    for (j = 0; j < len; j++)
+        sum = sum * 31 + (unsigned char) buf[j];
+    return sum;
+}
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Producer and consumer functions for each transport. The consumer
+   functions return the number of bytes read. */
+
+static void
+sockProduce(int sfd, const char *buf)
+{
+    long long done;
+    size_t n;
+
+    for (done = 0; done < totalBytes; done += n) {
+        n = (totalBytes - done < blockSize) ? totalBytes - done : blockSize;
+        if (write(sfd, buf, n) != n)
+            fatal("partial/failed write");
+    }
+
+    if (shutdown(sfd, SHUT_WR) == -1)
+        errExit("shutdown");
+}
+
+static long long
+sockConsume(int sfd, char *buf, uint64_t *sum)
+{
+    long long total;
+    ssize_t numRead;
+
+    total = 0;
+    while ((numRead = read(sfd, buf, blockSize)) > 0) {
+        *sum = checksum(buf, numRead, *sum);
+        total += numRead;
+    }
+    if (numRead == -1)
+        errExit("read");
+    return total;
+}
+
+static void
+ringProduce(int sfd, const char *buf)
+{
+    struct memfdRing *r;
+    long long done;
+    size_t n;
+
+    r = mrCreate(ringSize);
+    if (r == NULL)
+        errExit("mrCreate");
+    if (mrSendFds(r, sfd) == -1)
+        errExit("mrSendFds");
+
+    for (done = 0; done < totalBytes; done += n) {
+        n = (totalBytes - done < blockSize) ? totalBytes - done : blockSize;
+        if (mrWrite(r, buf, n) == -1)
+            errExit("mrWrite");
+    }
+
+    if (mrClose(r) == -1)
+        errExit("mrClose");
+    mrFree(r);
+}
+
+static long long
+ringConsume(int sfd, char *buf, uint64_t *sum)
+{
+    struct memfdRing *r;
+    long long total;
+    ssize_t numRead;
+
+    r = mrAttach(sfd);
+    if (r == NULL)
+        errExit("mrAttach");
+
+    total = 0;
+    while ((numRead = mrRead(r, buf, blockSize)) > 0) {
+        *sum = checksum(buf, numRead, *sum);
+        total += numRead;
+    }
+    if (numRead == -1)
+        errExit("mrRead");
+
+    mrFree(r);
+    return total;
+}
+
+static struct {
+    const char *name;
+    void (*produce)(int sfd, const char *buf);
+    long long (*consume)(int sfd, char *buf, uint64_t *sum);
+} transports[] = {
+    { "socket",     sockProduce,    sockConsume },
+    { "ring",       ringProduce,    ringConsume },
+};
+
+#define NTRANSPORTS (sizeof(transports) / sizeof(transports[0]))
+
+/* Run one test; returns FALSE if the transfer could not be verified */
+
+static Boolean
+runTest(int t, char *buf)
+{
+    int sv[2];
+    struct result res;
+    uint64_t expected;
+    long long done;
+    size_t n;
+    double start, secs;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+        errExit("socketpair");
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0:                     /* Child: consumer */
+        if (close(sv[0]) == -1)
+            errExit("close");
+        res.sum = 0;
+        res.bytes = transports[t].consume(sv[1], buf, &res.sum);
+        if (write(sv[1], &res, sizeof(res)) != sizeof(res))
+            fatal("write result");
+        _exit(EXIT_SUCCESS);
+
+    default:                    /* Parent: producer */
+        if (close(sv[1]) == -1)
+            errExit("close");
+        break;
+    }
+
+    start = nowSecs();
+    transports[t].produce(sv[0], buf);
+    if (read(sv[0], &res, sizeof(res)) != sizeof(res))
+        fatal("read result");
+    secs = nowSecs() - start;
+
+    if (wait(NULL) == -1)
+        errExit("wait");
+    if (close(sv[0]) == -1)
+        errExit("close");
+
+    expected = 0;
+    for (done = 0; done < totalBytes; done += n) {
+        n = (totalBytes - done < blockSize) ? totalBytes - done : blockSize;
+        expected = checksum(buf, n, expected);
+    }
+
+    printf("%-8s %12lld %10.3f %10.1f %s\n", transports[t].name, res.bytes,
+            secs, totalBytes / secs / (1024 * 1024),
+            (res.bytes == totalBytes && res.sum == expected) ?
+                    "ok" : "MISMATCH");
+    return res.bytes == totalBytes && res.sum == expected;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-r ring-KiB] [-b block-size] "
+            "[-t transport] total-MiB\n", progName);
+    fprintf(stderr, "    'transport' is one of: all");
+    for (int t = 0; t < NTRANSPORTS; t++)
+        fprintf(stderr, " %s", transports[t].name);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int opt, t;
+    const char *transport;
+    char *buf;
+    size_t j;
+    Boolean ok;
+
+    ringSize = 256 * 1024;
+    blockSize = 4096;
+    transport = "all";
+    while ((opt = getopt(argc, argv, "r:b:t:")) != -1) {
+        switch (opt) {
+        case 'r':   ringSize = getLong(optarg, GN_GT_0, "ring-KiB") * 1024;
+                    break;
+        case 'b':   blockSize = getLong(optarg, GN_GT_0, "block-size");
+                    break;
+        case 't':   transport = optarg;                                 break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc)
+        usageError(argv[0]);
+    totalBytes = getLong(argv[optind], GN_GT_0, "total-MiB") * 1024LL * 1024;
+
+    if (strcmp(transport, "all") != 0) {
+        for (t = 0; t < NTRANSPORTS; t++)
+            if (strcmp(transport, transports[t].name) == 0)
+                break;
+        if (t == NTRANSPORTS)
+            usageError(argv[0]);
+    }
+
+    buf = malloc(blockSize);
+    if (buf == NULL)
+        errExit("malloc");
+    for (j = 0; j < blockSize; j++)
+        buf[j] = j % 251;
+
+    printf("%lld MiB in %ld-byte blocks; ring size %ld KiB\n",
+            totalBytes >> 20, (long) blockSize, (long) (ringSize >> 10));
+    printf("%-8s %12s %10s %10s\n", "method", "bytes", "secs", "MiB/s");
+
+    ok = TRUE;
+    for (t = 0; t < NTRANSPORTS; t++)
+        if (strcmp(transport, "all") == 0 ||
+                strcmp(transport, transports[t].name) == 0)
+            if (!runTest(t, buf))
+                ok = FALSE;
+
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,606 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 60 */
+
+/* prefork_inetd.c
+
+   A superserver, like inetd, for TCP services: it listens on each
+   service's port, and hands each connection to a worker process, which
+   serves it on its standard input and output. Unlike inetd, which
+   creates and execs a new process for each connection, it keeps a pool
+   of ready worker processes for each service, and passes each accepted
+   connection to an idle worker over a UNIX domain socket (using
+   SCM_RIGHTS; see scm_functions.c).
+
+   Usage: prefork_inetd [-f] config-file
+
+        -f    Stay in the foreground, instead of becoming a daemon, and
+              also log to standard error
+
+   Each line of the configuration file (other than blank lines and
+   comments starting with '#') describes one service:
+
+        service  type  spare  max  path  arg0 [arg...]
+
+   'service' is a service name or port number; 'path' is the program to
+   run, with the arguments 'arg0' (conventionally, the program name) and
+   so on. (A relative 'path' is taken relative to the directory in which
+   prefork_inetd is started.) 'type' is one of:
+
+        exec  The program is an ordinary inetd service, such as
+              is_echo_inetd_sv.c, that serves one connection and exits.
+              Each worker is created in advance by fork(), and waits for
+              a connection; it then execs the program. This saves the
+              cost of fork() (but not of exec()) on each connection.
+
+        pool  The program calls inetdWorkerNext() in a loop (see
+              inetd_worker.c), as is_echo_pool_sv.c does, so that each
+              worker execs the program in advance and then serves any
+              number of connections, one at a time. This saves the cost
+              of creating and execing a process on each connection.
+
+   The pool for each service starts with 'spare' idle workers. When a
+   connection arrives, it is given to the most recently idle worker (whose
+   memory is most likely to be in the CPU caches); if no worker is idle,
+   a new one is created, up to a total of 'max' workers--which is also
+   the most connections that the service serves at once. When that limit
+   is reached, the superserver stops accepting connections for the
+   service (so that they wait in the listen queue) until a worker becomes
+   free. After each connection is handed out, further workers are created
+   to restore 'spare' idle workers; idle "pool" workers beyond 'spare'
+   that have been idle for IDLE_SECS seconds are retired (their socket to
+   the superserver is closed, so that inetdWorkerNext() returns -1). A
+   service whose workers fail MAX_FAILS times in a row without serving a
+   connection (for example, because the program can't be executed) is
+   disabled: its listening socket is closed.
+
+   The workers are managed with PID file descriptors (child_mgr.c), so
+   that all events--connections, idle workers, and terminated
+   workers--are handled by a single epoll loop. Each worker receives a
+   connection on descriptor 3, and has no other descriptors open apart
+   from 0, 1, and 2. If the superserver terminates, idle workers exit,
+   and busy workers exit once they have finished with their connection.
+
+   Try (see prefork_inetd.conf):
+
+        ./prefork_inetd -f prefork_inetd.conf &
+        ./is_echo_load -c 4 -d 5 localhost 51010     # "exec" service
+        ./is_echo_load -c 4 -d 5 localhost 51011     # "pool" service
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <syslog.h>
+#include <signal.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include "become_daemon.h"
+#include "inet_sockets.h"       /* Declares our socket functions */
+#include "scm_functions.h"
+#include "child_mgr.h"
+#include "close_fds.h"
+#include "inetd_worker.h"
+#include "tlpi_hdr.h"
+
+#define WORKER_FD 3             /* Worker's descriptor for its channel */
+#define WORKER_FD_STR "3"
+#define IDLE_SECS 10            /* Idle time before a surplus "pool"
+                                   worker is retired */
+#define MAX_FAILS 5             /* Failed workers before a service is
+                                   disabled */
+#define MAX_ARGS 32             /* Most arguments for a service program */
+#define LINE_MAX_LEN 1024       /* Longest line in configuration file */
+#define MAX_EVENTS 64           /* Maximum events fetched by epoll_wait() */
+
+/* Each epoll 'data.ptr' points to a structure that starts with one of
+   these */
+
+enum srcType { SRC_LISTEN, SRC_WORKER, SRC_REAP };
+
+struct service;
+
+struct worker {
+    enum srcType type;          /* SRC_WORKER */
+    struct service *svc;
+    struct cmChild *child;
+    int chan;                   /* Our end of the worker's channel, or -1
+                                   once closed */
+    Boolean busy;               /* Serving a connection */
+    Boolean retired;            /* Told to exit */
+    long served;                /* Connections handed to this worker */
+    time_t idleSince;
+    struct worker *prev, *next; /* In the service's list of idle workers */
+};
+
+struct service {
+    enum srcType type;          /* SRC_LISTEN */
+    char *name;                 /* Service name or port number */
+    Boolean pool;               /* "pool" service? (Else "exec") */
+    int spare;                  /* Idle workers to keep ready */
+    int max;                    /* Most workers */
+    char *path;                 /* Program, and its arguments */
+    char *argv[MAX_ARGS + 1];
+    int lfd;                    /* Listening socket */
+    Boolean accepting;          /* Is 'lfd' in the interest list? */
+    Boolean disabled;
+    int nworkers;               /* All workers that haven't been reaped */
+    int nidle;                  /* Workers in 'idle' list */
+    struct worker idle;         /* Head of circular list of idle workers,
+                                   most recently idle first */
+    int fails;                  /* Consecutive failed workers */
+    struct service *next;
+};
+
+static struct service *services;
+static struct childMgr *cm;
+static int epfd;
+static enum srcType reapTag = SRC_REAP;
+
+/* Add or remove 'fd' in the epoll interest list, with 'ptr' as its
+   data */
+
+static void
+watch(int op, int fd, void *ptr)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = ptr;
+    if (epoll_ctl(epfd, op, fd, &ev) == -1) {
+        syslog(LOG_ERR, "Error from epoll_ctl(): %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void
+setAccepting(struct service *svc, Boolean on)
+{
+    if (on && !svc->accepting && !svc->disabled)
+        watch(EPOLL_CTL_ADD, svc->lfd, svc);
+    else if (!on && svc->accepting)
+        watch(EPOLL_CTL_DEL, svc->lfd, NULL);
+    else
+        return;
+    svc->accepting = on;
+}
+
+/* Add 'w' at the head of its service's idle list */
+
+static void
+pushIdle(struct worker *w)
+{
+    struct service *svc = w->svc;
+
+    w->next = svc->idle.next;
+    w->prev = &svc->idle;
+    svc->idle.next->prev = w;
+    svc->idle.next = w;
+    svc->nidle++;
+    w->idleSince = time(NULL);
+}
+
+static void
+removeIdle(struct worker *w)
+{
+    w->prev->next = w->next;
+    w->next->prev = w->prev;
+    w->prev = w->next = NULL;
+    w->svc->nidle--;
+}
+
+/* The body of a new worker, which receives connections on the socket
+   'chan' */
+
+static void
+workerMain(struct service *svc, int chan)
+{
+    int cfd;
+
+    /* Leave the worker with nothing but its channel (as WORKER_FD) and
+       descriptors 0 to 2, and with default SIGPIPE disposition */
+
+    if (chan != WORKER_FD && dup2(chan, WORKER_FD) == -1)
+        _exit(127);
+    closeFdsFrom(WORKER_FD + 1, 0);
+    signal(SIGPIPE, SIG_DFL);
+
+    if (svc->pool) {
+        if (setenv(INETD_WORKER_ENV, WORKER_FD_STR, 1) == -1)
+            _exit(127);
+    } else {
+
+        /* Wait for a connection, then set it up as inetd would */
+
+        cfd = recvfd(WORKER_FD);
+        if (cfd == -1)                  /* We were retired */
+            _exit(EXIT_SUCCESS);
+        if (dup2(cfd, STDIN_FILENO) == -1 ||
+                dup2(cfd, STDOUT_FILENO) == -1 ||
+                dup2(cfd, STDERR_FILENO) == -1)
+            _exit(127);
+        close(cfd);
+        close(WORKER_FD);
+    }
+
+    execv(svc->path, svc->argv);
+    _exit(127);
+}
+
+/* Create a new (idle) worker for 'svc'. Returns 0 on success, or -1 on
+   error. */
+
+static int
+spawnWorker(struct service *svc)
+{
+    struct worker *w;
+    int sv[2];
+    pid_t pid;
+
+    w = calloc(1, sizeof(struct worker));
+    if (w == NULL)
+        return -1;
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) == -1) {
+        free(w);
+        return -1;
+    }
+
+    pid = cmFork(cm, w, &w->child);
+    if (pid == -1) {
+        close(sv[0]);
+        close(sv[1]);
+        free(w);
+        return -1;
+    }
+    if (pid == 0)
+        workerMain(svc, sv[1]);         /* Doesn't return */
+
+    close(sv[1]);
+    if (fcntl(sv[0], F_SETFD, FD_CLOEXEC) == -1)
+        syslog(LOG_WARNING, "F_SETFD: %s", strerror(errno));
+
+    w->type = SRC_WORKER;
+    w->svc = svc;
+    w->chan = sv[0];
+    if (svc->pool)                      /* Will tell us when it is idle */
+        watch(EPOLL_CTL_ADD, w->chan, w);
+    svc->nworkers++;
+    pushIdle(w);
+    return 0;
+}
+
+/* Create workers until 'svc' has 'spare' idle workers (or 'max' in
+   all) */
+
+static void
+topUp(struct service *svc)
+{
+    while (!svc->disabled && svc->nidle < svc->spare &&
+            svc->nworkers < svc->max) {
+        if (spawnWorker(svc) == -1) {
+            syslog(LOG_ERR, "%s: can't create worker: %s", svc->name,
+                   strerror(errno));
+            return;
+        }
+    }
+}
+
+/* Close a worker's channel; if it is idle, this tells it to exit */
+
+static void
+closeChan(struct worker *w)
+{
+    if (w->chan != -1) {
+        close(w->chan);                 /* Also removes it from 'epfd' */
+        w->chan = -1;
+    }
+}
+
+/* Accept connections for 'svc' while it has (or can create) idle
+   workers, and hand each connection to an idle worker */
+
+static void
+acceptConns(struct service *svc)
+{
+    struct worker *w;
+    int cfd;
+
+    for (;;) {
+        if (svc->nidle == 0) {
+            if (svc->nworkers >= svc->max) {
+                setAccepting(svc, FALSE);       /* Until a worker is free */
+                return;
+            }
+            if (spawnWorker(svc) == -1) {
+                syslog(LOG_ERR, "%s: can't create worker: %s", svc->name,
+                       strerror(errno));
+                return;
+            }
+        }
+
+        cfd = accept4(svc->lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (cfd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                syslog(LOG_ERR, "%s: failure in accept(): %s", svc->name,
+                       strerror(errno));
+            break;
+        }
+
+        w = svc->idle.next;
+        removeIdle(w);
+        if (sendfd(w->chan, cfd) == -1) {       /* Worker has died */
+            syslog(LOG_ERR, "%s: can't pass connection to worker %ld: %s",
+                   svc->name, (long) w->child->pid, strerror(errno));
+            w->retired = TRUE;
+            closeChan(w);
+            close(cfd);
+            continue;
+        }
+        close(cfd);                     /* The worker has its own copy */
+
+        w->busy = TRUE;
+        w->served++;
+        if (!svc->pool)                 /* An "exec" worker is done with its
+                                           channel once it has a connection */
+            closeChan(w);
+    }
+
+    topUp(svc);
+}
+
+/* A "pool" worker has reported that it is idle, or has closed its
+   channel */
+
+static void
+workerReady(struct worker *w)
+{
+    char buf[16];
+    ssize_t numRead;
+
+    numRead = read(w->chan, buf, sizeof(buf));
+    if (numRead > 0 && w->busy) {
+        w->busy = FALSE;
+        w->svc->fails = 0;
+        pushIdle(w);
+        setAccepting(w->svc, TRUE);
+    } else if (numRead <= 0 && (numRead == 0 || errno != EINTR)) {
+        if (w->prev != NULL)            /* On the idle list */
+            removeIdle(w);
+        closeChan(w);                   /* Wait for it to terminate */
+    }
+}
+
+/* Reap terminated workers */
+
+static void
+reapWorkers(void)
+{
+    struct cmChild *done[MAX_EVENTS];
+    struct service *svc;
+    struct worker *w;
+    int n, j;
+
+    n = cmReap(cm, done, MAX_EVENTS, 0);
+    if (n == -1) {
+        if (errno != ECHILD && errno != EINTR)
+            syslog(LOG_ERR, "Error from cmReap(): %s", strerror(errno));
+        return;
+    }
+
+    for (j = 0; j < n; j++) {
+        w = done[j]->data;
+        svc = w->svc;
+
+        if (w->prev != NULL)
+            removeIdle(w);
+        closeChan(w);
+        svc->nworkers--;
+
+        if (w->served == 0 && !w->retired) {
+            svc->fails++;
+            syslog(LOG_ERR, "%s: worker %ld terminated (status 0x%x) without "
+                   "serving a connection", svc->name, (long) done[j]->pid,
+                   done[j]->status);
+            if (svc->fails >= MAX_FAILS && !svc->disabled) {
+                syslog(LOG_ERR, "%s: too many failures; service disabled",
+                       svc->name);
+                setAccepting(svc, FALSE);
+                svc->disabled = TRUE;
+                close(svc->lfd);        /* Refuse further connections */
+            }
+        } else if (w->served > 0) {
+            svc->fails = 0;
+        }
+
+        cmRelease(cm, done[j]);
+        free(w);
+
+        topUp(svc);
+        if (svc->nworkers < svc->max)
+            setAccepting(svc, TRUE);
+    }
+}
+
+/* Retire "pool" workers beyond 'spare' that have been idle for IDLE_SECS
+   seconds. The oldest idle workers are at the tail of the list. */
+
+static void
+retireIdle(void)
+{
+    struct service *svc;
+    struct worker *w;
+    time_t now;
+
+    now = time(NULL);
+    for (svc = services; svc != NULL; svc = svc->next) {
+        while (svc->pool && svc->nidle > svc->spare) {
+            w = svc->idle.prev;
+            if (now - w->idleSince < IDLE_SECS)
+                break;
+            removeIdle(w);
+            w->retired = TRUE;
+            closeChan(w);
+        }
+    }
+}
+
+/* Read the configuration file 'cfPath', creating the list of services */
+
+static void
+readConfig(const char *cfPath)
+{
+    char line[LINE_MAX_LEN], resolved[PATH_MAX];
+    char *tok[MAX_ARGS + 6], *p;
+    struct service *svc, **tailp;
+    int lineNum, ntok, j;
+    FILE *fp;
+
+    fp = fopen(cfPath, "r");
+    if (fp == NULL)
+        errExit("fopen %s", cfPath);
+
+    tailp = &services;
+    for (lineNum = 1; fgets(line, sizeof(line), fp) != NULL; lineNum++) {
+        p = strchr(line, '#');
+        if (p != NULL)
+            *p = '\0';
+
+        ntok = 0;
+        for (p = strtok(line, " \t\n"); p != NULL; p = strtok(NULL, " \t\n")) {
+            if (ntok == MAX_ARGS + 5)
+                fatal("%s:%d: too many arguments", cfPath, lineNum);
+            tok[ntok++] = p;
+        }
+        if (ntok == 0)
+            continue;
+        if (ntok < 6)
+            fatal("%s:%d: expected: service type spare max path arg0 ...",
+                  cfPath, lineNum);
+
+        svc = calloc(1, sizeof(struct service));
+        if (svc == NULL)
+            errExit("calloc");
+        svc->type = SRC_LISTEN;
+        svc->name = strdup(tok[0]);
+        if (strcmp(tok[1], "pool") == 0)
+            svc->pool = TRUE;
+        else if (strcmp(tok[1], "exec") != 0)
+            fatal("%s:%d: type must be \"exec\" or \"pool\"", cfPath,
+                  lineNum);
+        svc->spare = getInt(tok[2], GN_NONNEG, "spare");
+        svc->max = getInt(tok[3], GN_GT_0, "max");
+        if (svc->spare > svc->max)
+            fatal("%s:%d: 'spare' exceeds 'max'", cfPath, lineNum);
+
+        if (realpath(tok[4], resolved) == NULL)
+            errExit("%s:%d: %s", cfPath, lineNum, tok[4]);
+        svc->path = strdup(resolved);
+        for (j = 5; j < ntok; j++)
+            svc->argv[j - 5] = strdup(tok[j]);
+        svc->argv[ntok - 5] = NULL;
+
+        svc->lfd = -1;
+        svc->idle.next = svc->idle.prev = &svc->idle;
+        *tailp = svc;
+        tailp = &svc->next;
+    }
+
+    fclose(fp);
+    if (services == NULL)
+        fatal("%s: no services", cfPath);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct epoll_event evlist[MAX_EVENTS];
+    struct service *svc;
+    Boolean foreground;
+    enum srcType *src;
+    int opt, ready, j;
+
+    foreground = FALSE;
+    while ((opt = getopt(argc, argv, "f")) != -1) {
+        switch (opt) {
+        case 'f':   foreground = TRUE;          break;
+        default:    usageErr("%s [-f] config-file\n", argv[0]);
+        }
+    }
+    if (optind + 1 != argc)
+        usageErr("%s [-f] config-file\n", argv[0]);
+
+    readConfig(argv[optind]);
+
+    /* Ignore SIGPIPE, so that a worker that has died yields an error from
+       sendfd(), rather than killing us */
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    if (!foreground && becomeDaemon(0) == -1)
+        errExit("becomeDaemon");
+    openlog("prefork_inetd", LOG_PID | (foreground ? LOG_PERROR : 0),
+            LOG_DAEMON);
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    cm = cmCreate();
+    if (epfd == -1 || cm == NULL) {
+        syslog(LOG_ERR, "Can't create epoll instance: %s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    watch(EPOLL_CTL_ADD, cmFd(cm), &reapTag);
+
+    for (svc = services; svc != NULL; svc = svc->next) {
+        svc->lfd = inetListen(svc->name, SOMAXCONN, NULL);
+        if (svc->lfd == -1 ||
+                fcntl(svc->lfd, F_SETFL, O_NONBLOCK) == -1 ||
+                fcntl(svc->lfd, F_SETFD, FD_CLOEXEC) == -1) {
+            syslog(LOG_ERR, "%s: can't create listening socket: %s",
+                   svc->name, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        setAccepting(svc, TRUE);
+        topUp(svc);
+    }
+
+    for (;;) {
+        ready = epoll_wait(epfd, evlist, MAX_EVENTS, 1000);
+        if (ready == -1) {
+            if (errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "Error from epoll_wait(): %s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        /* Handle readiness of workers before terminations, so that a
+           worker's final message is seen before it is freed */
+
+        for (j = 0; j < ready; j++) {
+            src = evlist[j].data.ptr;
+            if (*src == SRC_LISTEN)
+                acceptConns((struct service *) src);
+            else if (*src == SRC_WORKER)
+                workerReady((struct worker *) src);
+        }
+        for (j = 0; j < ready; j++) {
+            src = evlist[j].data.ptr;
+            if (*src == SRC_REAP)
+                reapWorkers();
+        }
+
+        retireIdle();
+    }
+}
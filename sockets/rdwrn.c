@@ -13,11 +13,20 @@
 /* rdwrn.c
 
    Implementations of readn() and writen().
+
+   This file also provides readvn() and writevn(), which are the analogous
+   functions for scatter-gather I/O with readv() and writev().
 */
+#include <sys/uio.h>
+#include <limits.h>
 #include <unistd.h>
 #include <errno.h>
 #include "rdwrn.h"                      /* Declares readn() and writen() */
 
+#ifndef IOV_MAX                         /* Not defined on some systems */
+#define IOV_MAX 1024
+#endif
+
 /* Read 'n' bytes from 'fd' into 'buf', restarting after partial
    reads or interruptions by a signal handlers */
 
@@ -74,3 +83,96 @@ writen(int fd, const void *buffer, size_t n)
     }
     return totWritten;                  /* Must be 'n' bytes if we get here */
 }
+
+/* Advance the vector described by '*iovp' and '*iovcntp' past the
+   first 'n' bytes, updating the 'iov_base' and 'iov_len' fields of
+   any partially transferred element */
+
+static void
+advanceIov(struct iovec **iovp, int *iovcntp, size_t n)
+{
+    struct iovec *iov;
+
+    for (iov = *iovp; n > 0 && *iovcntp > 0; iov++, (*iovcntp)--) {
+        if (n < iov->iov_len) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+            break;
+        }
+        n -= iov->iov_len;
+        iov->iov_base = (char *) iov->iov_base + iov->iov_len;
+        iov->iov_len = 0;
+    }
+
+    /* Step over elements that are now (or always were) empty */
+
+    while (*iovcntp > 0 && iov->iov_len == 0) {
+        iov++;
+        (*iovcntp)--;
+    }
+
+    *iovp = iov;
+}
+
+/* Read into the 'iovcnt' buffers described by 'iov' until they are all
+   full, restarting after partial reads or interruptions by a signal
+   handler. At most IOV_MAX elements are passed to each readv() call.
+   Note that the elements of 'iov' are modified by this function: on
+   return, each element describes the remaining unfilled part of its
+   buffer. */
+
+ssize_t
+readvn(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t numRead;                    /* # of bytes fetched by last readv() */
+    size_t totRead;                     /* Total # of bytes read so far */
+
+    advanceIov(&iov, &iovcnt, 0);       /* Skip leading empty buffers */
+
+    for (totRead = 0; iovcnt > 0; ) {
+        numRead = readv(fd, iov, (iovcnt > IOV_MAX) ? IOV_MAX : iovcnt);
+
+        if (numRead == 0)               /* EOF */
+            return totRead;             /* May be 0 if this is first readv() */
+        if (numRead == -1) {
+            if (errno == EINTR)
+                continue;               /* Interrupted --> restart readv() */
+            else
+                return -1;              /* Some other error */
+        }
+        totRead += numRead;
+        advanceIov(&iov, &iovcnt, numRead);
+    }
+    return totRead;                     /* Sum of all 'iov_len' values */
+}
+
+/* Write the 'iovcnt' buffers described by 'iov' to 'fd', restarting
+   after partial writes or interruptions by a signal handler. At most
+   IOV_MAX elements are passed to each writev() call. As with readvn(),
+   the elements of 'iov' are modified by this function. */
+
+ssize_t
+writevn(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t numWritten;                 /* # of bytes written by last writev() */
+    size_t totWritten;                  /* Total # of bytes written so far */
+
+    advanceIov(&iov, &iovcnt, 0);       /* Skip leading empty buffers */
+
+    for (totWritten = 0; iovcnt > 0; ) {
+        numWritten = writev(fd, iov, (iovcnt > IOV_MAX) ? IOV_MAX : iovcnt);
+
+        /* The "writev() returns 0" case should never happen, but the
+           following ensures that we don't loop forever if it does */
+
+        if (numWritten <= 0) {
+            if (numWritten == -1 && errno == EINTR)
+                continue;               /* Interrupted --> restart writev() */
+            else
+                return -1;              /* Some other error */
+        }
+        totWritten += numWritten;
+        advanceIov(&iov, &iovcnt, numWritten);
+    }
+    return totWritten;                  /* Sum of all 'iov_len' values */
+}
@@ -18,9 +18,14 @@
 #define RDWRN_H
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 ssize_t readn(int fd, void *buf, size_t len);
 
 ssize_t writen(int fd, const void *buf, size_t len);
 
+ssize_t readvn(int fd, struct iovec *iov, int iovcnt);
+
+ssize_t writevn(int fd, struct iovec *iov, int iovcnt);
+
 #endif
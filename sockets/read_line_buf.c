@@ -14,7 +14,20 @@
 
    Implementation of readLineBuf(), a version of readLine() that is more
    efficient because it reads blocks of characters at a time.
+
+   In addition to the solution of the exercise, this file provides two
+   extensions:
+
+   * readLineBufInitSize() initializes a ReadLineBuf to use a buffer of
+     any size, either supplied by the caller or allocated on the heap.
+
+   * readLineBufView() returns each line as a pointer into the ReadLineBuf
+     buffer (plus a length), rather than copying the line into a buffer
+     supplied by the caller. Data within the buffer is moved only when a
+     line crosses the end of the buffer.
 */
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include "read_line_buf.h"
@@ -23,8 +36,49 @@ void                    /* Initialize a ReadLineBuf structure */
 readLineBufInit(int fd, struct ReadLineBuf *rlbuf)
 {
     rlbuf->fd = fd;
+    rlbuf->buf = rlbuf->dfltBuf;
+    rlbuf->size = RL_MAX_BUF;
     rlbuf->len = 0;
     rlbuf->next = 0;
+    rlbuf->discard = 0;
+    rlbuf->allocated = 0;
+}
+
+/* Initialize a ReadLineBuf structure that uses a buffer of 'size' bytes.
+   If 'buf' is NULL, the buffer is allocated with malloc(), and should
+   later be freed by calling readLineBufFree(); otherwise, 'buf' points to
+   a caller-supplied buffer of at least 'size' bytes. Returns 0 on success,
+   or -1 on error. */
+
+int
+readLineBufInitSize(int fd, struct ReadLineBuf *rlbuf, void *buf, size_t size)
+{
+    if (size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    readLineBufInit(fd, rlbuf);
+
+    if (buf == NULL) {
+        buf = malloc(size);
+        if (buf == NULL)
+            return -1;
+        rlbuf->allocated = 1;
+    }
+
+    rlbuf->buf = buf;
+    rlbuf->size = size;
+    return 0;
+}
+
+void                    /* Free buffer allocated by readLineBufInitSize() */
+readLineBufFree(struct ReadLineBuf *rlbuf)
+{
+    if (rlbuf->allocated)
+        free(rlbuf->buf);
+    rlbuf->buf = NULL;
+    rlbuf->allocated = 0;
 }
 
 /* Return a line of input from the buffer 'rlbuf', placing the characters in
@@ -34,6 +88,7 @@ readLineBufInit(int fd, struct ReadLineBuf *rlbuf)
 ssize_t
 readLineBuf(struct ReadLineBuf *rlbuf, char *buffer, size_t n)
 {
+    ssize_t numRead;
     size_t cnt;
     char c;
 
@@ -52,14 +107,15 @@ readLineBuf(struct ReadLineBuf *rlbuf, char *buffer, size_t n)
            further input from the associated file descriptor. */
 
         if (rlbuf->next >= rlbuf->len) {
-            rlbuf->len = read(rlbuf->fd, rlbuf->buf, RL_MAX_BUF);
-            if (rlbuf->len == -1)
+            numRead = read(rlbuf->fd, rlbuf->buf, rlbuf->size);
+            if (numRead == -1)
                 return -1;
 
-            if (rlbuf->len == 0)        /* End of file */
-                break;
-
+            rlbuf->len = numRead;
             rlbuf->next = 0;
+
+            if (numRead == 0)           /* End of file */
+                break;
         }
 
         c = rlbuf->buf[rlbuf->next];
@@ -74,3 +130,112 @@ readLineBuf(struct ReadLineBuf *rlbuf, char *buffer, size_t n)
 
     return cnt;
 }
+
+/* Return the next line of input from 'rlbuf' without copying it. On
+   success, '*line' is set to point to the start of the line within the
+   'rlbuf' buffer, and the function returns the length of the line
+   (including the terminating newline, if there is one). Note that the
+   line is not null-terminated, and that the returned pointer remains
+   valid only until the next call to readLineBufView() or readLineBuf().
+
+   The final line of input may lack a newline. If a line is longer than
+   the 'rlbuf' buffer, then the first 'rlbuf->size' bytes of the line are
+   returned (without a newline), and the remainder of the line is
+   discarded.
+
+   The function returns 0 on end of file, or -1 on error. */
+
+ssize_t
+readLineBufView(struct ReadLineBuf *rlbuf, const char **line)
+{
+    ssize_t numRead;
+    size_t scanned;             /* Bytes at 'next' known to lack a newline */
+    char *start, *nl;
+
+    if (line == NULL || rlbuf->buf == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Buffered input has been consumed (and the caller has finished with
+       the previously returned line), so we can refill from the start of
+       the buffer */
+
+    if (rlbuf->next >= rlbuf->len)
+        rlbuf->next = rlbuf->len = 0;
+
+    /* Skip the remainder of an over-long line returned by the previous
+       call */
+
+    while (rlbuf->discard) {
+        if (rlbuf->len == 0) {
+            numRead = read(rlbuf->fd, rlbuf->buf, rlbuf->size);
+            if (numRead == -1) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            if (numRead == 0)           /* End of file */
+                return 0;
+            rlbuf->len = numRead;
+        }
+
+        nl = memchr(rlbuf->buf + rlbuf->next, '\n', rlbuf->len - rlbuf->next);
+        if (nl == NULL) {
+            rlbuf->next = rlbuf->len = 0;
+        } else {
+            rlbuf->next = nl - rlbuf->buf + 1;
+            rlbuf->discard = 0;
+        }
+    }
+
+    scanned = 0;
+    for (;;) {
+        start = rlbuf->buf + rlbuf->next;
+
+        nl = memchr(start + scanned, '\n', rlbuf->len - rlbuf->next - scanned);
+        if (nl != NULL) {                       /* Found a complete line */
+            *line = start;
+            rlbuf->next += nl - start + 1;
+            return nl - start + 1;
+        }
+        scanned = rlbuf->len - rlbuf->next;
+
+        /* The partial line extends to the end of the buffered data. If
+           there is no space after the data, then either move the partial
+           line to the start of the buffer, or, if it already occupies the
+           whole buffer, return it as a truncated line. */
+
+        if (rlbuf->len == rlbuf->size) {
+            if (rlbuf->next > 0) {
+                memmove(rlbuf->buf, start, scanned);
+                rlbuf->next = 0;
+                rlbuf->len = scanned;
+                start = rlbuf->buf;
+            } else {
+                *line = rlbuf->buf;
+                rlbuf->next = rlbuf->len;
+                rlbuf->discard = 1;
+                return rlbuf->len;
+            }
+        }
+
+        numRead = read(rlbuf->fd, rlbuf->buf + rlbuf->len,
+                       rlbuf->size - rlbuf->len);
+        if (numRead == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        if (numRead == 0) {                     /* End of file */
+            if (scanned == 0)
+                return 0;
+            *line = start;                      /* Final unterminated line */
+            rlbuf->next = rlbuf->len;
+            return scanned;
+        }
+
+        rlbuf->len += numRead;
+    }
+}
@@ -21,17 +21,30 @@
 #include <pthread.h>
 #include <errno.h>
 
-#define RL_MAX_BUF 10
+#define RL_MAX_BUF 10           /* Size of buffer used by readLineBufInit() */
 
 struct ReadLineBuf {
     int     fd;                 /* File descriptor from which to read */
-    char    buf[RL_MAX_BUF];    /* Current buffer from file */
-    int     next;               /* Index of next unread character in 'buf' */
-    ssize_t len;                /* Number of characters in 'buf' */
+    char   *buf;                /* Current buffer from file */
+    size_t  size;               /* Size of 'buf' */
+    size_t  next;               /* Index of next unread character in 'buf' */
+    size_t  len;                /* Number of characters in 'buf' */
+    int     discard;            /* Discarding remainder of an over-long line
+                                   returned by readLineBufView()? */
+    int     allocated;          /* Was 'buf' allocated by
+                                   readLineBufInitSize()? */
+    char    dfltBuf[RL_MAX_BUF];    /* 'buf' used by readLineBufInit() */
 };
 
 void readLineBufInit(int fd, struct ReadLineBuf *rlbuf);
 
+int readLineBufInitSize(int fd, struct ReadLineBuf *rlbuf, void *buf,
+                        size_t size);
+
+void readLineBufFree(struct ReadLineBuf *rlbuf);
+
 ssize_t readLineBuf(struct ReadLineBuf *rlbuf, char *buffer, size_t n);
 
+ssize_t readLineBufView(struct ReadLineBuf *rlbuf, const char **line);
+
 #endif
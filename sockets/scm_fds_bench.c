@@ -0,0 +1,187 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* scm_fds_bench.c
+
+   Measure the rate at which file descriptors can be passed between
+   processes over a UNIX domain socket, one per message with sendfd() and
+   recvfd(), and in batches with sendfds() and recvfds().
+
+   Usage: scm_fds_bench [-b batch-size] [-c] num-fds
+
+        -b batch-size   Number of descriptors per sendfds() message
+                        (default, and maximum: SCM_MAX_FD)
+        -c              Also send credentials with each batch (the
+                        receiver verifies them)
+
+   The parent repeatedly passes (duplicates of) a descriptor for
+   /dev/null to a child, which closes each descriptor that it receives.
+   In the batched test, the real data of each message is the number of
+   descriptors in the batch, which the child checks.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <time.h>
+#include "scm_functions.h"
+#include "tlpi_hdr.h"
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Child: receive 'numFds' descriptors, closing each one */
+
+static void
+receiver(int sfd, long numFds, int batchSize, Boolean checkCreds)
+{
+    int fds[SCM_MAX_FD], nfds, cnt, optval, j;
+    struct ucred cred;
+    long received;
+
+    if (batchSize == 0) {                       /* One per message */
+        for (received = 0; received < numFds; received++) {
+            nfds = recvfd(sfd);
+            if (nfds == -1)
+                errExit("recvfd");
+            close(nfds);
+        }
+        return;
+    }
+
+    if (checkCreds) {
+        optval = 1;
+        if (setsockopt(sfd, SOL_SOCKET, SO_PASSCRED, &optval,
+                       sizeof(optval)) == -1)
+            errExit("setsockopt");
+    }
+
+    for (received = 0; received < numFds; received += nfds) {
+        nfds = SCM_MAX_FD;
+        if (recvfds(sfd, fds, &nfds, &cnt, sizeof(cnt),
+                    checkCreds ? &cred : NULL) != sizeof(cnt))
+            errExit("recvfds");
+        if (cnt != nfds)
+            fatal("Expected %d descriptors, got %d", cnt, nfds);
+        if (checkCreds && cred.pid != getppid())
+            fatal("Bad credentials: pid=%ld", (long) cred.pid);
+        for (j = 0; j < nfds; j++)
+            close(fds[j]);
+    }
+}
+
+/* Pass 'numFds' descriptors to a child, 'batchSize' per message (0 means
+   one per message using sendfd()), and return the elapsed time */
+
+static double
+runTest(int fd, long numFds, int batchSize, Boolean sendCreds)
+{
+    int sv[2], fds[SCM_MAX_FD], cnt, j;
+    long sent;
+    double start;
+    char ch;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+        errExit("socketpair");
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0:
+        close(sv[0]);
+        receiver(sv[1], numFds, batchSize, sendCreds);
+        if (write(sv[1], "x", 1) != 1)          /* Tell parent we're done */
+            errExit("write");
+        _exit(EXIT_SUCCESS);
+
+    default:
+        close(sv[1]);
+        break;
+    }
+
+    for (j = 0; j < SCM_MAX_FD; j++)
+        fds[j] = fd;
+
+    start = nowSecs();
+    for (sent = 0; sent < numFds; sent += cnt) {
+        if (batchSize == 0) {
+            cnt = 1;
+            if (sendfd(sv[0], fd) == -1)
+                errExit("sendfd");
+        } else {
+            cnt = (numFds - sent < batchSize) ? numFds - sent : batchSize;
+            if (sendfds(sv[0], fds, cnt, &cnt, sizeof(cnt),
+                        sendCreds ? SCM_SEND_CREDS : 0) != sizeof(cnt))
+                errExit("sendfds");
+        }
+    }
+
+    /* The descriptors are "in flight" until the child has received them */
+
+    if (read(sv[0], &ch, 1) != 1)
+        fatal("Child failed");
+    start = nowSecs() - start;
+
+    if (wait(NULL) == -1)
+        errExit("wait");
+    close(sv[0]);
+    return start;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int opt, fd, batchSize;
+    long numFds;
+    Boolean sendCreds;
+    double secs;
+
+    batchSize = SCM_MAX_FD;
+    sendCreds = FALSE;
+    while ((opt = getopt(argc, argv, "b:c")) != -1) {
+        switch (opt) {
+        case 'b':   batchSize = getInt(optarg, GN_GT_0, "batch-size");  break;
+        case 'c':   sendCreds = TRUE;                                   break;
+        default:    usageErr("%s [-b batch-size] [-c] num-fds\n", argv[0]);
+        }
+    }
+
+    if (optind + 1 != argc || batchSize > SCM_MAX_FD)
+        usageErr("%s [-b batch-size (<= %d)] [-c] num-fds\n", argv[0],
+                SCM_MAX_FD);
+    numFds = getLong(argv[optind], GN_GT_0, "num-fds");
+
+    fd = open("/dev/null", O_RDONLY);
+    if (fd == -1)
+        errExit("open");
+
+    printf("%-22s %10s %12s\n", "method", "secs", "fds/sec");
+
+    secs = runTest(fd, numFds, 0, FALSE);
+    printf("%-22s %10.3f %12.0f\n", "sendfd/recvfd", secs, numFds / secs);
+
+    secs = runTest(fd, numFds, batchSize, sendCreds);
+    printf("sendfds/recvfds (%3d)%s %10.3f %12.0f\n", batchSize,
+            sendCreds ? "+c" : "  ", secs, numFds / secs);
+
+    exit(EXIT_SUCCESS);
+}
@@ -19,7 +19,16 @@
    applications, the application makes use of both the "real" data
    channel and the ancillary data, with some kind of protocol that
    determines how the "real" and ancillary data are used together.
+
+   sendfds() and recvfds() are more general: they transfer a batch of up
+   to SCM_MAX_FD file descriptors, optionally accompanied by the sender's
+   credentials, together with a caller-supplied payload, in a single
+   sendmsg()/recvmsg() call. Passing many descriptors one per call (as
+   sendfd() and recvfd() do) costs a pair of system calls per descriptor.
 */
+#define _GNU_SOURCE             /* For 'struct ucred' and MSG_CMSG_CLOEXEC */
+#include <string.h>
+#include <unistd.h>
 #include "scm_functions.h"
 
 /* Send the file descriptor 'fd' over the connected UNIX domain socket
@@ -144,3 +153,194 @@ recvfd(int sockfd)
 
     return *((int *) CMSG_DATA(cmsgp));
 }
+
+/* Send the 'nfds' file descriptors in 'fds' (0 <= nfds <= SCM_MAX_FD),
+   along with the 'len' bytes in 'buf', in a single message on the
+   connected UNIX domain socket 'sockfd'. If 'flags' includes
+   SCM_SEND_CREDS, the message also carries our credentials. If 'len' is
+   0, a single (ignored) byte is sent, since at least one byte of real
+   data must accompany the ancillary data; the receiver should then also
+   specify 'len' as 0. Returns the number of bytes of 'buf' sent, or -1 on
+   error. */
+
+ssize_t
+sendfds(int sockfd, const int *fds, int nfds,
+        const void *buf, size_t len, int flags)
+{
+    struct msghdr msgh;
+    struct iovec iov;
+    struct cmsghdr *cmsgp;
+    struct ucred *ucredp;
+    char dummy;
+    ssize_t ns;
+
+    /* Buffer large enough for the largest possible ancillary data; the
+       union ensures suitable alignment (see sendfd()) */
+
+    union {
+        char   buf[CMSG_SPACE(sizeof(int) * SCM_MAX_FD) +
+                   CMSG_SPACE(sizeof(struct ucred))];
+        struct cmsghdr align;
+    } controlMsg;
+
+    if (nfds < 0 || nfds > SCM_MAX_FD) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    msgh.msg_name = NULL;
+    msgh.msg_namelen = 0;
+    msgh.msg_flags = 0;
+
+    msgh.msg_iov = &iov;
+    msgh.msg_iovlen = 1;
+    if (len == 0) {
+        dummy = 0;
+        iov.iov_base = &dummy;
+        iov.iov_len = 1;
+    } else {
+        iov.iov_base = (void *) buf;
+        iov.iov_len = len;
+    }
+
+    /* Build the control message: an SCM_RIGHTS header (if there are any
+       descriptors to send), followed by an SCM_CREDENTIALS header (if
+       requested) */
+
+    memset(&controlMsg, 0, sizeof(controlMsg));
+    msgh.msg_control = controlMsg.buf;
+    msgh.msg_controllen = ((nfds > 0) ? CMSG_SPACE(sizeof(int) * nfds) : 0) +
+            ((flags & SCM_SEND_CREDS) ? CMSG_SPACE(sizeof(struct ucred)) : 0);
+    if (msgh.msg_controllen == 0)
+        msgh.msg_control = NULL;
+
+    cmsgp = CMSG_FIRSTHDR(&msgh);
+
+    if (nfds > 0) {
+        cmsgp->cmsg_level = SOL_SOCKET;
+        cmsgp->cmsg_type = SCM_RIGHTS;
+        cmsgp->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsgp), fds, sizeof(int) * nfds);
+        cmsgp = CMSG_NXTHDR(&msgh, cmsgp);
+    }
+
+    if (flags & SCM_SEND_CREDS) {
+        cmsgp->cmsg_level = SOL_SOCKET;
+        cmsgp->cmsg_type = SCM_CREDENTIALS;
+        cmsgp->cmsg_len = CMSG_LEN(sizeof(struct ucred));
+        ucredp = (struct ucred *) CMSG_DATA(cmsgp);
+        ucredp->pid = getpid();
+        ucredp->uid = getuid();
+        ucredp->gid = getgid();
+    }
+
+    ns = sendmsg(sockfd, &msgh, 0);
+    if (ns == -1)
+        return -1;
+    return (len == 0) ? 0 : ns;
+}
+
+/* Receive a message sent by sendfds() on the connected UNIX domain
+   socket 'sockfd'. On entry, '*nfds' is the number of elements in 'fds'
+   (at most SCM_MAX_FD); on return, it is the number of descriptors
+   received. The descriptors are received with the close-on-exec flag set
+   (MSG_CMSG_CLOEXEC). Up to 'len' bytes of real data are placed in 'buf'
+   (if 'len' is 0, the single dummy byte sent by sendfds() is discarded).
+
+   If 'creds' is not NULL, it is filled with the credentials carried by
+   the message; if the message carried none, 'creds->pid' is set to 0.
+   (The receiving socket must have the SO_PASSCRED option set in order to
+   receive credentials.)
+
+   Returns the number of bytes placed in 'buf', or -1 on error. If the
+   sender passed more descriptors than will fit in 'fds', the error is
+   EMSGSIZE, and none of the descriptors is left open. At end-of-file,
+   0 is returned if 'len' is greater than 0; if 'len' is 0 (so that 0 is
+   also the result for a message), -1 is returned with errno set to 0. */
+
+ssize_t
+recvfds(int sockfd, int *fds, int *nfds,
+        void *buf, size_t len, struct ucred *creds)
+{
+    struct msghdr msgh;
+    struct iovec iov;
+    struct cmsghdr *cmsgp;
+    int maxFds, cnt, j;
+    char dummy;
+    ssize_t nr;
+
+    union {
+        char   buf[CMSG_SPACE(sizeof(int) * SCM_MAX_FD) +
+                   CMSG_SPACE(sizeof(struct ucred))];
+        struct cmsghdr align;
+    } controlMsg;
+
+    maxFds = *nfds;
+    *nfds = 0;
+    if (maxFds < 0 || maxFds > SCM_MAX_FD) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (creds != NULL)
+        creds->pid = 0;
+
+    msgh.msg_name = NULL;
+    msgh.msg_namelen = 0;
+
+    msgh.msg_iov = &iov;
+    msgh.msg_iovlen = 1;
+    if (len == 0) {
+        iov.iov_base = &dummy;
+        iov.iov_len = 1;
+    } else {
+        iov.iov_base = buf;
+        iov.iov_len = len;
+    }
+
+    /* Offer the kernel the full-sized buffer, so that, if the sender
+       passed too many descriptors, we receive (and can close) all of
+       them rather than having the excess silently discarded */
+
+    msgh.msg_control = controlMsg.buf;
+    msgh.msg_controllen = sizeof(controlMsg.buf);
+
+    nr = recvmsg(sockfd, &msgh, MSG_CMSG_CLOEXEC);
+    if (nr == -1)
+        return -1;
+    if (nr == 0 && len == 0) {          /* EOF (sendfds() sent a byte) */
+        errno = 0;
+        return -1;
+    }
+
+    for (cmsgp = CMSG_FIRSTHDR(&msgh); cmsgp != NULL;
+            cmsgp = CMSG_NXTHDR(&msgh, cmsgp)) {
+        if (cmsgp->cmsg_level != SOL_SOCKET)
+            continue;
+
+        if (cmsgp->cmsg_type == SCM_RIGHTS) {
+            cnt = (cmsgp->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            if (*nfds + cnt > maxFds) {
+                for (j = 0; j < cnt; j++)       /* Discard this batch */
+                    close(((int *) CMSG_DATA(cmsgp))[j]);
+                msgh.msg_flags |= MSG_CTRUNC;
+                continue;
+            }
+            memcpy(fds + *nfds, CMSG_DATA(cmsgp), sizeof(int) * cnt);
+            *nfds += cnt;
+
+        } else if (cmsgp->cmsg_type == SCM_CREDENTIALS && creds != NULL &&
+                cmsgp->cmsg_len == CMSG_LEN(sizeof(struct ucred))) {
+            memcpy(creds, CMSG_DATA(cmsgp), sizeof(struct ucred));
+        }
+    }
+
+    if (msgh.msg_flags & MSG_CTRUNC) {
+        for (j = 0; j < *nfds; j++)
+            close(fds[j]);
+        *nfds = 0;
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    return (len == 0) ? 0 : nr;
+}
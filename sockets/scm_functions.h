@@ -26,4 +26,22 @@ int sendfd(int sockfd, int fd);
 
 int recvfd(int sockfd);
 
+/* Maximum number of file descriptors in one SCM_RIGHTS message (the
+   kernel's SCM_MAX_FD, which is not exported to user space) */
+
+#define SCM_MAX_FD 253
+
+/* Flags for sendfds() */
+
+#define SCM_SEND_CREDS  1       /* Also send our credentials */
+
+struct ucred;                   /* Defined in <sys/socket.h> with
+                                   _GNU_SOURCE */
+
+ssize_t sendfds(int sockfd, const int *fds, int nfds,
+                const void *buf, size_t len, int flags);
+
+ssize_t recvfds(int sockfd, int *fds, int *nfds,
+                void *buf, size_t len, struct ucred *creds);
+
 #endif
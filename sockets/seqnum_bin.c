@@ -0,0 +1,242 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 59 */
+
+/* seqnum_bin.c
+
+   A binary framing of the sequence-number protocol of is_seqnum_v2.h.
+
+   In the ASCII protocol, each connection carries one request: the
+   client sends the length of the sequence it wants as a line of text,
+   and the server replies with the start of the sequence, likewise as
+   text. The server must scan for the newline, and both sides convert
+   between text and binary. In the binary protocol (see seqnum_bin.h),
+   a connection carries any number of requests, each a frame with a
+   fixed-size header giving the number of sequences wanted, followed by
+   their lengths; the server replies with a frame holding the start of
+   each sequence. The server thus reads the header and the payload each
+   with a single readn(), and updates the sequence number once per
+   frame, however many sequences the frame asks for; each frame is sent
+   with a single writev().
+
+   Since the values are little-endian on the wire, the byte-order
+   conversions compile to nothing on little-endian hosts.
+
+   This module is Linux-specific (because of le32toh() and htole32(),
+   which are in glibc and the BSDs, but not in SUSv3).
+*/
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <endian.h>
+#include <string.h>
+#include <errno.h>
+#include "rdwrn.h"
+#include "seqnum_bin.h"         /* Declares functions defined here */
+
+/* Send a frame of type 'type' carrying the 'count' values in 'vals',
+   which have already been converted to little-endian. */
+
+static int
+sendFrame(int fd, uint32_t type, uint32_t *vals, uint32_t count)
+{
+    struct seqBinHdr hdr;
+    struct iovec iov[2];
+    size_t len;
+
+    hdr.type = htole32(type);
+    hdr.count = htole32(count);
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = vals;
+    iov[1].iov_len = count * sizeof(uint32_t);
+    len = iov[0].iov_len + iov[1].iov_len;
+
+    return (writevn(fd, iov, 2) == (ssize_t) len) ? 0 : -1;
+}
+
+/* Read a frame header from 'fd', converting it to host byte order.
+   Returns 1 on success, 0 on end-of-file before the header, or -1 on
+   error (EPROTO if the connection was closed partway through). */
+
+static int
+recvHdr(int fd, struct seqBinHdr *hdr)
+{
+    ssize_t numRead;
+
+    numRead = readn(fd, hdr, sizeof(*hdr));
+    if (numRead == -1)
+        return -1;
+    if (numRead == 0)
+        return 0;
+    if (numRead != sizeof(*hdr)) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    hdr->type = le32toh(hdr->type);
+    hdr->count = le32toh(hdr->count);
+    return 1;
+}
+
+/* Read 'count' values from 'fd' into 'vals', converting them to host
+   byte order. Returns 0 on success, or -1 on error. */
+
+static int
+recvVals(int fd, uint32_t *vals, uint32_t count)
+{
+    uint32_t j;
+
+    errno = 0;
+    if (readn(fd, vals, count * sizeof(uint32_t)) !=
+            (ssize_t) (count * sizeof(uint32_t))) {
+        if (errno == 0)
+            errno = EPROTO;
+        return -1;
+    }
+
+    for (j = 0; j < count; j++)
+        vals[j] = le32toh(vals[j]);
+    return 0;
+}
+
+/* Client: ask the server on the newly connected socket 'fd' to use the
+   binary protocol. Returns 0 on success, or -1 on error; the error is
+   EPROTO if the server doesn't speak the binary protocol, in which case
+   the caller should close 'fd' and make a new connection for each ASCII
+   request. */
+
+int
+seqBinHello(int fd)
+{
+    char buf[SEQ_BIN_HELLO_LEN];
+    ssize_t numRead;
+
+    if (writen(fd, SEQ_BIN_HELLO, SEQ_BIN_HELLO_LEN) != SEQ_BIN_HELLO_LEN)
+        return -1;
+
+    errno = 0;
+    numRead = readn(fd, buf, SEQ_BIN_HELLO_LEN);
+    if (numRead == -1 && errno != ECONNRESET)
+        return -1;
+    if (numRead != SEQ_BIN_HELLO_LEN ||
+            memcmp(buf, SEQ_BIN_HELLO, SEQ_BIN_HELLO_LEN) != 0) {
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+/* Client: request 'n' sequences, whose lengths are in 'lens', placing
+   the start of each sequence in the corresponding element of 'starts'.
+   ('starts' may be the same array as 'lens'.) Returns 0 on success, or
+   -1 on error; the error is EPROTO if the server rejected the request
+   or sent a malformed reply. */
+
+int
+seqBinRequest(int fd, const uint32_t *lens, uint32_t *starts, uint32_t n)
+{
+    struct seqBinHdr hdr;
+    uint32_t j;
+
+    if (n == 0 || n > SEQ_BIN_MAX_BATCH) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Build the payload in 'starts', which will receive the reply */
+
+    for (j = 0; j < n; j++)
+        starts[j] = htole32(lens[j]);
+    if (sendFrame(fd, SEQ_BIN_REQ, starts, n) == -1)
+        return -1;
+
+    errno = 0;
+    switch (recvHdr(fd, &hdr)) {
+    case -1:
+        return -1;
+    case 0:
+        errno = EPROTO;
+        return -1;
+    default:
+        break;
+    }
+    if (hdr.type != SEQ_BIN_RESP || hdr.count != n) {
+        errno = EPROTO;
+        return -1;
+    }
+    return recvVals(fd, starts, n);
+}
+
+/* Server: serve the binary protocol on 'fd', after the caller has seen
+   (for example, with recv(MSG_PEEK)) that the client's first byte is
+   the null byte that starts SEQ_BIN_HELLO. The sequence number '*seqNum'
+   is updated atomically, once per frame, so that it may be shared by
+   several threads or processes (via shared memory). Returns 0 when the
+   client closes the connection, or -1 on error; the error is EPROTO if
+   the client sent an invalid request (which it is told of with a
+   SEQ_BIN_ERR frame). */
+
+int
+seqBinServe(int fd, uint32_t *seqNum)
+{
+    uint32_t vals[SEQ_BIN_MAX_BATCH];
+    char hello[SEQ_BIN_HELLO_LEN];
+    struct seqBinHdr hdr;
+    uint32_t start, total, j;
+    int s;
+
+    errno = 0;
+    if (readn(fd, hello, SEQ_BIN_HELLO_LEN) != SEQ_BIN_HELLO_LEN ||
+            memcmp(hello, SEQ_BIN_HELLO, SEQ_BIN_HELLO_LEN) != 0) {
+        if (errno == 0)
+            errno = EPROTO;
+        return -1;
+    }
+    if (writen(fd, SEQ_BIN_HELLO, SEQ_BIN_HELLO_LEN) != SEQ_BIN_HELLO_LEN)
+        return -1;
+
+    for (;;) {
+        errno = 0;
+        s = recvHdr(fd, &hdr);
+        if (s <= 0)
+            return s;
+
+        if (hdr.type != SEQ_BIN_REQ || hdr.count == 0 ||
+                hdr.count > SEQ_BIN_MAX_BATCH)
+            goto reject;
+        if (recvVals(fd, vals, hdr.count) == -1)
+            return -1;
+
+        /* Check the whole request before granting any of it */
+
+        total = 0;
+        for (j = 0; j < hdr.count; j++) {
+            if (vals[j] == 0 || vals[j] > UINT32_MAX - total)
+                goto reject;
+            total += vals[j];
+        }
+
+        start = __atomic_fetch_add(seqNum, total, __ATOMIC_RELAXED);
+        for (j = 0; j < hdr.count; j++) {
+            total = vals[j];
+            vals[j] = htole32(start);
+            start += total;
+        }
+
+        if (sendFrame(fd, SEQ_BIN_RESP, vals, hdr.count) == -1)
+            return -1;
+    }
+
+reject:
+    sendFrame(fd, SEQ_BIN_ERR, NULL, 0);
+    errno = EPROTO;
+    return -1;
+}
@@ -0,0 +1,55 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 59 */
+
+/* seqnum_bin.h
+
+   Header file for seqnum_bin.c.
+*/
+#ifndef SEQNUM_BIN_H
+#define SEQNUM_BIN_H            /* Prevent accidental double inclusion */
+
+#include <stdint.h>
+
+/* A client asks for binary mode by sending SEQ_BIN_HELLO as the first
+   SEQ_BIN_HELLO_LEN bytes of the connection; a server that understands
+   it echoes the same bytes back. The initial null byte can't begin an
+   ASCII request, and the final newline means that a server that knows
+   only the ASCII protocol sees an invalid request and closes the
+   connection, rather than waiting for the rest of a line. */
+
+#define SEQ_BIN_HELLO "\0SEQBN1\n"
+#define SEQ_BIN_HELLO_LEN 8
+
+/* Thereafter, each message is a frame: a fixed-size header, followed by
+   'count' 32-bit values. All integers are little-endian. */
+
+struct seqBinHdr {
+    uint32_t type;              /* One of the SEQ_BIN_* types below */
+    uint32_t count;             /* Number of values that follow */
+};
+
+#define SEQ_BIN_REQ     1       /* Client: lengths of sequences wanted */
+#define SEQ_BIN_RESP    2       /* Server: start of each sequence granted,
+                                   in the same order */
+#define SEQ_BIN_ERR     3       /* Server: request rejected (no values);
+                                   the server then closes the connection */
+
+#define SEQ_BIN_MAX_BATCH 4096  /* Most values allowed in one frame */
+
+int seqBinHello(int fd);
+
+int seqBinRequest(int fd, const uint32_t *lens, uint32_t *starts,
+                  uint32_t n);
+
+int seqBinServe(int fd, uint32_t *seqNum);
+
+#endif
@@ -0,0 +1,319 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* sock_handoff.c
+
+   Hand a server's listening sockets (and, optionally, some of its
+   connected sockets) to a new instance of the server, so that the
+   server can be restarted (for example, to run a new version of the
+   program) without clients noticing.
+
+   A server that is stopped and started again closes its listening
+   socket, so that connections waiting in the listen queue are reset;
+   until the new instance has bound its socket again, new connection
+   requests are refused; and the new instance may not be able to bind
+   the address at once (EADDRINUSE) if connections from the old instance
+   are still in the TIME_WAIT state. If instead the old instance passes
+   its listening socket to the new one, via SCM_RIGHTS (see
+   scm_functions.c), then the socket--and its listen queue--is never
+   closed: both instances refer to the same open file description, and
+   connections keep arriving in the same queue, to be accepted by
+   whichever instance calls accept().
+
+   The old instance calls handoffListen() at startup, to create a UNIX
+   domain socket at 'path', and includes that socket in its event loop.
+   A new instance calls handoffTake(), which connects to the old
+   instance; when the old instance finds that the handoff socket is
+   readable, it calls handoffGive(), which passes the listening sockets
+   and the connected sockets that it chooses (typically, the idle ones:
+   those with no partially handled request). The new instance adds the
+   listening sockets to its own event loop, and then calls handoffAck().
+   When handoffGive() sees the acknowledgement, it confirms it and
+   returns 0; the old instance then closes its copies of the sockets that
+   it handed off (which doesn't affect the new instance's copies),
+   finishes with the connections that it kept, and exits. Once
+   handoffAck() has seen the confirmation, it returns 0, and the new
+   instance starts serving the connected sockets; this two-step exchange
+   ensures that a connection is never served by both instances. If
+   either instance fails (or handoffGive() times out) before the
+   exchange completes, handoffGive() returns -1, and the old instance
+   simply carries on, while handoffAck() returns -1, and the new instance
+   must close the connected sockets (both instances may go on accepting
+   connections from the listening sockets). Finally, the new instance
+   calls handoffListen(), so that it can itself be replaced.
+
+   If handoffTake() finds no old instance (the error is ENOENT or
+   ECONNREFUSED), the new instance creates its listening sockets in the
+   usual way.
+
+   The handoff socket is a SOCK_SEQPACKET socket, so that message
+   boundaries are preserved; it is created with permissions that allow
+   access only by its owner, and handoffGive() also checks (via
+   SO_PEERCRED) that the new instance has the same effective user ID as
+   the old one (or is privileged), since anyone who obtains the
+   listening sockets can accept the server's clients.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include "scm_functions.h"
+#include "unix_sockets.h"
+#include "sock_handoff.h"       /* Declares functions defined here */
+
+#define HANDOFF_MAGIC 0x544c484fU       /* "TLHO" */
+
+struct handoffHdr {             /* Carried by the first message */
+    uint32_t magic;
+    uint32_t nlisten;
+    uint32_t nconn;
+};
+
+/* Create the UNIX domain socket at 'path' through which a new instance
+   can ask for our sockets; any existing socket file at 'path' (perhaps
+   left by an earlier instance) is removed first. Returns a listening
+   socket, or -1 on error. */
+
+int
+handoffListen(const char *path)
+{
+    mode_t oldUmask;
+    int hfd, savedErrno;
+
+    if (unlink(path) == -1 && errno != ENOENT)
+        return -1;
+
+    oldUmask = umask(S_IRWXG | S_IRWXO);
+    hfd = unixBind(path, SOCK_SEQPACKET);
+    umask(oldUmask);
+    if (hfd == -1)
+        return -1;
+
+    if (listen(hfd, 5) == -1 || fcntl(hfd, F_SETFD, FD_CLOEXEC) == -1) {
+        savedErrno = errno;
+        close(hfd);
+        errno = savedErrno;
+        return -1;
+    }
+    return hfd;
+}
+
+/* Accept a new instance's connection on the handoff socket 'hfd', pass
+   it the 'nlisten' listening sockets in 'lfds' and the 'nconn' connected
+   sockets in 'cfds', and wait up to 'timeoutMs' milliseconds (-1: for
+   ever) for it to acknowledge. Returns 0 if the new instance has taken
+   over the sockets, or -1 if not (in which case the caller continues to
+   serve them). The caller must not touch the connected sockets while
+   this function executes. */
+
+int
+handoffGive(int hfd, const int *lfds, int nlisten,
+            const int *cfds, int nconn, int timeoutMs)
+{
+    int batch[SCM_MAX_FD];
+    struct handoffHdr hdr;
+    struct pollfd pfd;
+    struct ucred cred;
+    socklen_t len;
+    int sfd, total, sent, n, s, savedErrno;
+    char ack;
+
+    if (nlisten < 1 || nlisten > HANDOFF_MAX_LISTEN || nconn < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sfd = accept4(hfd, NULL, NULL, SOCK_CLOEXEC);
+    if (sfd == -1)
+        return -1;
+
+    len = sizeof(cred);
+    if (getsockopt(sfd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+        goto fail;
+    if (cred.uid != geteuid() && cred.uid != 0) {
+        errno = EPERM;
+        goto fail;
+    }
+
+    /* Send the descriptors, listening sockets first, in as many messages
+       as needed; the first also carries the header */
+
+    hdr.magic = HANDOFF_MAGIC;
+    hdr.nlisten = nlisten;
+    hdr.nconn = nconn;
+    total = nlisten + nconn;
+    for (sent = 0; sent < total; sent += n) {
+        for (n = 0; n < SCM_MAX_FD && sent + n < total; n++)
+            batch[n] = (sent + n < nlisten) ? lfds[sent + n]
+                                            : cfds[sent + n - nlisten];
+        if (sent == 0)
+            s = sendfds(sfd, batch, n, &hdr, sizeof(hdr), 0);
+        else
+            s = sendfds(sfd, batch, n, NULL, 0, 0);
+        if (s == -1)
+            goto fail;
+    }
+
+    /* Wait for the new instance to say that it is using the sockets */
+
+    pfd.fd = sfd;
+    pfd.events = POLLIN;
+    s = poll(&pfd, 1, timeoutMs);
+    if (s == -1)
+        goto fail;
+    if (s == 0) {
+        errno = ETIMEDOUT;
+        goto fail;
+    }
+    if (read(sfd, &ack, 1) != 1 || ack != 'A') {
+        errno = EPROTO;
+        goto fail;
+    }
+    if (send(sfd, "C", 1, MSG_NOSIGNAL) != 1)   /* Confirm: they're yours */
+        goto fail;
+
+    close(sfd);
+    return 0;
+
+fail:
+    savedErrno = errno;
+    close(sfd);
+    errno = savedErrno;
+    return -1;
+}
+
+/* Connect to the old instance's handoff socket at 'path', and receive
+   its sockets: the listening sockets are placed in 'lfds' (which must
+   have room for HANDOFF_MAX_LISTEN elements), and their number in
+   '*nlisten'; the connected sockets are placed in an array allocated
+   with malloc(), which is returned in '*cfds' (to be freed by the
+   caller), and their number in '*nconn'. Returns a socket to be passed
+   to handoffAck() once the caller is serving the sockets, or -1 on
+   error. If there is no old instance, the error is ENOENT or
+   ECONNREFUSED. */
+
+int
+handoffTake(const char *path, int *lfds, int *nlisten,
+            int **cfds, int *nconn)
+{
+    int batch[SCM_MAX_FD];
+    struct handoffHdr hdr;
+    int sfd, total, got, n, j, savedErrno;
+    ssize_t nr;
+
+    *nlisten = *nconn = 0;
+    *cfds = NULL;
+    got = 0;
+
+    sfd = unixConnect(path, SOCK_SEQPACKET);
+    if (sfd == -1)
+        return -1;
+    if (fcntl(sfd, F_SETFD, FD_CLOEXEC) == -1)
+        goto fail;
+
+    n = SCM_MAX_FD;
+    nr = recvfds(sfd, batch, &n, &hdr, sizeof(hdr), NULL);
+    if (nr == -1)
+        goto fail;
+    if (nr != sizeof(hdr) || hdr.magic != HANDOFF_MAGIC ||
+            hdr.nlisten < 1 || hdr.nlisten > HANDOFF_MAX_LISTEN ||
+            hdr.nconn > INT_MAX - HANDOFF_MAX_LISTEN) {
+        for (j = 0; j < n; j++)
+            close(batch[j]);
+        errno = EPROTO;
+        goto fail;
+    }
+
+    *cfds = malloc((hdr.nconn > 0 ? hdr.nconn : 1) * sizeof(int));
+    if (*cfds == NULL) {
+        for (j = 0; j < n; j++)
+            close(batch[j]);
+        goto fail;
+    }
+
+    total = hdr.nlisten + hdr.nconn;
+    for (;;) {
+        if (got + n > total) {
+            for (j = 0; j < n; j++)
+                close(batch[j]);
+            errno = EPROTO;
+            goto fail;
+        }
+        for (j = 0; j < n; j++, got++) {
+            if (got < (int) hdr.nlisten)
+                lfds[(*nlisten)++] = batch[j];
+            else
+                (*cfds)[(*nconn)++] = batch[j];
+        }
+        if (got == total)
+            break;
+
+        n = SCM_MAX_FD;
+        if (recvfds(sfd, batch, &n, NULL, 0, NULL) == -1) {
+            if (errno == 0)             /* Old instance went away */
+                errno = EPROTO;
+            goto fail;
+        }
+        if (n == 0) {
+            errno = EPROTO;
+            goto fail;
+        }
+    }
+
+    return sfd;
+
+fail:
+    savedErrno = errno;
+    for (j = 0; j < *nlisten; j++)
+        close(lfds[j]);
+    for (j = 0; j < *nconn; j++)
+        close((*cfds)[j]);
+    free(*cfds);
+    *cfds = NULL;
+    *nlisten = *nconn = 0;
+    close(sfd);
+    errno = savedErrno;
+    return -1;
+}
+
+/* Tell the old instance that we are now serving the listening sockets
+   received from handoffTake(), wait for it to confirm that it has
+   stopped serving the connected sockets, and close 'sfd'. Returns 0 on
+   success, or -1 on error; in the latter case, the old instance carries
+   on serving the connected sockets, and the caller must close them. */
+
+int
+handoffAck(int sfd)
+{
+    int s, savedErrno;
+    char conf;
+
+    s = -1;
+    if (send(sfd, "A", 1, MSG_NOSIGNAL) == 1) {
+        if (read(sfd, &conf, 1) == 1 && conf == 'C')
+            s = 0;
+        else
+            errno = EPROTO;
+    }
+    savedErrno = errno;
+    close(sfd);
+    errno = savedErrno;
+    return s;
+}
@@ -0,0 +1,32 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* sock_handoff.h
+
+   Header file for sock_handoff.c.
+*/
+#ifndef SOCK_HANDOFF_H
+#define SOCK_HANDOFF_H          /* Prevent accidental double inclusion */
+
+#define HANDOFF_MAX_LISTEN 64   /* Most listening sockets handed off */
+
+int handoffListen(const char *path);
+
+int handoffGive(int hfd, const int *lfds, int nlisten,
+                const int *cfds, int nconn, int timeoutMs);
+
+int handoffTake(const char *path, int *lfds, int *nlisten,
+                int **cfds, int *nconn);
+
+int handoffAck(int sfd);
+
+#endif
@@ -0,0 +1,250 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 59 */
+
+/* ucase_mt_sv.c
+
+   A multithreaded version of the uppercase datagram servers
+   ud_ucase_sv.c (UNIX domain) and i6d_ucase_sv.c (IPv6).
+
+   Usage: ucase_mt_sv [-u] [-t nthreads] [-b batch] [-l max-len]
+
+        -u            Use a UNIX domain socket bound to SV_SOCK_PATH (from
+                      ud_ucase.h); by default, an IPv6 socket bound to
+                      PORT_NUM (from i6d_ucase.h) is used
+        -t nthreads   Number of worker threads (default: 4)
+        -b batch      Maximum number of datagrams per recvmmsg() and
+                      sendmmsg() call (default: 64; maximum: 1024)
+        -l max-len    Maximum datagram size (default: BUF_SIZE, as used by
+                      the clients)
+
+   In IPv6 mode, each thread has its own socket, bound to the same port
+   using SO_REUSEPORT, so that the kernel distributes incoming datagrams
+   across the threads' sockets. A UNIX domain socket can't be shared in
+   that way, so in UNIX domain mode, all of the threads receive from the
+   one socket.
+
+   Each thread receives and replies to batches of datagrams using
+   recvmmsg() and sendmmsg() (as in id_echo_mmsg_sv.c), and converts each
+   datagram to uppercase with caseToUpper() (case_conv.c), which uses
+   vector instructions where the CPU has them. Like toupper() in the "C"
+   locale (which these servers use), caseToUpper() changes only the ASCII
+   letters.
+
+   Instead of displaying each datagram, the program displays, once per
+   second while there is traffic, the number of datagrams handled per
+   second and the mean number per recvmmsg() call.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include "ud_ucase.h"           /* SV_SOCK_PATH, BUF_SIZE */
+#include "i6d_ucase.h"          /* PORT_NUM */
+#include "case_conv.h"
+
+#define MAX_BATCH 1024
+
+static int batch, maxLen;
+static Boolean unixDomain;
+
+static unsigned long totDgrams, totCalls;       /* Updated atomically */
+
+static int
+ipv6Socket(void)
+{
+    struct sockaddr_in6 svaddr;
+    int sfd, optval;
+
+    sfd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (sfd == -1)
+        errExit("socket");
+
+    optval = 1;
+    if (setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &optval,
+                   sizeof(optval)) == -1)
+        errExit("setsockopt-SO_REUSEPORT");
+
+    memset(&svaddr, 0, sizeof(struct sockaddr_in6));
+    svaddr.sin6_family = AF_INET6;
+    svaddr.sin6_addr = in6addr_any;                     /* Wildcard address */
+    svaddr.sin6_port = htons(PORT_NUM);
+
+    if (bind(sfd, (struct sockaddr *) &svaddr,
+                sizeof(struct sockaddr_in6)) == -1)
+        errExit("bind");
+
+    return sfd;
+}
+
+static int
+unixSocket(void)
+{
+    struct sockaddr_un svaddr;
+    int sfd;
+
+    sfd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (sfd == -1)
+        errExit("socket");
+
+    if (remove(SV_SOCK_PATH) == -1 && errno != ENOENT)
+        errExit("remove-%s", SV_SOCK_PATH);
+
+    memset(&svaddr, 0, sizeof(struct sockaddr_un));
+    svaddr.sun_family = AF_UNIX;
+    strncpy(svaddr.sun_path, SV_SOCK_PATH, sizeof(svaddr.sun_path) - 1);
+
+    if (bind(sfd, (struct sockaddr *) &svaddr,
+                sizeof(struct sockaddr_un)) == -1)
+        errExit("bind");
+
+    return sfd;
+}
+
+/* Worker thread: receive, convert, and return batches of datagrams on
+   the socket whose descriptor is '*arg' */
+
+static void *
+worker(void *arg)
+{
+    int sfd = *(int *) arg;
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    struct sockaddr_storage *addrs;
+    char *bufs;
+    int j, n, sent;
+
+    msgs = calloc(batch, sizeof(struct mmsghdr));
+    iovs = calloc(batch, sizeof(struct iovec));
+    addrs = calloc(batch, sizeof(struct sockaddr_storage));
+    bufs = malloc((size_t) batch * maxLen);
+    if (msgs == NULL || iovs == NULL || addrs == NULL || bufs == NULL)
+        errExit("malloc");
+
+    for (j = 0; j < batch; j++) {
+        iovs[j].iov_base = bufs + (size_t) j * maxLen;
+        msgs[j].msg_hdr.msg_iov = &iovs[j];
+        msgs[j].msg_hdr.msg_iovlen = 1;
+        msgs[j].msg_hdr.msg_name = &addrs[j];
+    }
+
+    for (;;) {
+        for (j = 0; j < batch; j++) {
+            iovs[j].iov_len = maxLen;
+            msgs[j].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        }
+
+        n = recvmmsg(sfd, msgs, batch, MSG_WAITFORONE, NULL);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("recvmmsg");
+        }
+
+        /* Convert each datagram, and send it back to where it came from
+           (recvmmsg() has set 'msg_namelen'). A datagram from an unbound
+           UNIX domain socket has no address, so it can't be answered. */
+
+        for (j = 0; j < n; j++) {
+            caseToUpper(iovs[j].iov_base, msgs[j].msg_len);
+            iovs[j].iov_len = msgs[j].msg_len;
+        }
+
+        for (sent = 0; sent < n; ) {
+            j = sendmmsg(sfd, msgs + sent, n - sent, 0);
+            if (j == -1) {
+                if (errno == EINTR)
+                    continue;
+                errMsg("sendmmsg");
+                sent++;                 /* Skip the failed message */
+            } else {
+                sent += j;
+            }
+        }
+
+        __atomic_fetch_add(&totDgrams, n, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&totCalls, 1, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-u] [-t nthreads] [-b batch] [-l max-len]\n",
+            progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int opt, numThreads, j, s;
+    int *sfds;
+    pthread_t thr;
+    unsigned long dgrams, calls, lastDgrams, lastCalls;
+
+    unixDomain = FALSE;
+    numThreads = 4;
+    batch = 64;
+    maxLen = BUF_SIZE;
+    while ((opt = getopt(argc, argv, "ut:b:l:")) != -1) {
+        switch (opt) {
+        case 'u':   unixDomain = TRUE;                                  break;
+        case 't':   numThreads = getInt(optarg, GN_GT_0, "nthreads");   break;
+        case 'b':   batch = getInt(optarg, GN_GT_0, "batch");           break;
+        case 'l':   maxLen = getInt(optarg, GN_GT_0, "max-len");        break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc || batch > MAX_BATCH)
+        usageError(argv[0]);
+
+    sfds = calloc(numThreads, sizeof(int));
+    if (sfds == NULL)
+        errExit("calloc");
+
+    if (unixDomain)
+        sfds[0] = unixSocket();
+    for (j = 0; j < numThreads; j++) {
+        if (unixDomain)
+            sfds[j] = sfds[0];          /* All threads share one socket */
+        else
+            sfds[j] = ipv6Socket();
+
+        s = pthread_create(&thr, NULL, worker, &sfds[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    printf("%d threads, %s\n", numThreads, unixDomain ?
+            "sharing UNIX domain socket " SV_SOCK_PATH :
+            "each with own SO_REUSEPORT IPv6 socket");
+
+    lastDgrams = lastCalls = 0;
+    for (;;) {
+        sleep(1);
+        dgrams = __atomic_load_n(&totDgrams, __ATOMIC_RELAXED);
+        calls = __atomic_load_n(&totCalls, __ATOMIC_RELAXED);
+        if (calls > lastCalls)
+            printf("%lu datagrams/s; %.1f datagrams/recvmmsg()\n",
+                    dgrams - lastDgrams,
+                    (double) (dgrams - lastDgrams) / (calls - lastCalls));
+        fflush(stdout);
+        lastDgrams = dgrams;
+        lastCalls = calls;
+    }
+}
@@ -0,0 +1,225 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* unix_auth.c
+
+   Authenticated connections on UNIX domain sockets.
+
+   scm_cred_send.c and scm_cred_recv.c pass credentials with each
+   message (SCM_CREDENTIALS), which the receiver must enable
+   (SO_PASSCRED) and then find among the ancillary data of every
+   recvmsg(). For a connected socket, that work is unnecessary: the
+   peer's credentials were recorded by the kernel when the connection
+   was made (connect() or socketpair()), and can be retrieved once with
+   SO_PEERCRED. (A peer can't send credentials other than its own
+   without privilege, but if the peer is privileged, or passes the
+   socket to another process, per-message credentials can differ from
+   the connection's; a server that must know who sent each message
+   should use per-message credentials.)
+
+   uaInit() (or uaAccept(), which accepts a connection on 'lfd' and
+   calls uaInit() for it) records the identity of the peer of the
+   connected socket 'fd' in 'c->peer', including its user name (looked
+   up via ugid_cache.c), and, since Linux 6.5, obtains a pidfd for the
+   peer (SO_PEERPIDFD), which refers to the peer process even if its
+   PID is later reused; uaPeerAlive() uses it to check whether the peer
+   still exists. uaRecv() is then recv(), and returns a pointer to the
+   recorded identity.
+
+   A datagram socket has no peer, so uaInit() instead enables
+   SO_PASSCRED, and uaRecv() obtains the credentials of each datagram's
+   sender; the kernel supplies them even if the sender doesn't send any.
+   The user name of the previous sender is reused if the UID is
+   unchanged.
+
+   uaInit() and uaAccept() return 0 and the new socket respectively, or
+   -1 on error. uaRecv() returns as recv() does.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE             /* For 'struct ucred' and SO_PEERCRED */
+#include <sys/socket.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "ugid_cache.h"
+#include "unix_auth.h"          /* Declares functions defined here */
+
+#ifndef SO_PEERPIDFD            /* Linux 6.5 */
+#define SO_PEERPIDFD 77
+#endif
+
+static void
+setPeer(struct uaPeer *peer, const struct ucred *ucred)
+{
+    char *name;
+
+    peer->pid = ucred->pid;
+    peer->gid = ucred->gid;
+    peer->uid = ucred->uid;
+    name = userNameFromIdCached(ucred->uid);
+    if (name != NULL)
+        snprintf(peer->user, UA_NAME_LEN, "%s", name);
+    else
+        snprintf(peer->user, UA_NAME_LEN, "%ld", (long) ucred->uid);
+}
+
+int
+uaInit(struct uaConn *c, int fd)
+{
+    struct ucred ucred;
+    socklen_t len;
+    int optval;
+
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+    c->pidfd = -1;
+    c->peer.uid = -1;
+    c->peer.gid = -1;
+
+    len = sizeof(c->type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &c->type, &len) == -1)
+        return -1;
+
+    if (c->type == SOCK_DGRAM) {
+        optval = 1;
+        return setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &optval,
+                          sizeof(optval));
+    }
+
+    len = sizeof(ucred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &ucred, &len) == -1)
+        return -1;
+    setPeer(&c->peer, &ucred);
+
+    /* The pidfd is created with O_CLOEXEC; failure (e.g., ENOPROTOOPT
+       before Linux 6.5) just means that we don't have one */
+
+    len = sizeof(c->pidfd);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERPIDFD, &c->pidfd, &len) == -1)
+        c->pidfd = -1;
+
+    return 0;
+}
+
+int
+uaAccept(int lfd, struct uaConn *c)
+{
+    int fd, savedErrno;
+
+    fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    if (uaInit(c, fd) == -1) {
+        savedErrno = errno;
+        close(fd);
+        errno = savedErrno;
+        return -1;
+    }
+    return fd;
+}
+
+/* Receive up to 'len' bytes into 'buf', as recv() with 'flags'. If
+   'peer' is not NULL, '*peer' returns a pointer to the identity of the
+   sender, which, for a datagram socket, is valid until the next
+   call. */
+
+ssize_t
+uaRecv(struct uaConn *c, void *buf, size_t len, int flags,
+       const struct uaPeer **peer)
+{
+    struct msghdr msgh;
+    struct iovec iov;
+    struct cmsghdr *cmsgp;
+    struct ucred ucred;
+    ssize_t nr;
+    union {
+        char   buf[CMSG_SPACE(sizeof(struct ucred))];
+        struct cmsghdr align;
+    } controlMsg;
+
+    if (c->type != SOCK_DGRAM) {
+        nr = recv(c->fd, buf, len, flags);
+        if (peer != NULL)
+            *peer = &c->peer;
+        return nr;
+    }
+
+    memset(&msgh, 0, sizeof(msgh));
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    msgh.msg_iov = &iov;
+    msgh.msg_iovlen = 1;
+    msgh.msg_control = controlMsg.buf;
+    msgh.msg_controllen = sizeof(controlMsg.buf);
+
+    nr = recvmsg(c->fd, &msgh, flags);
+    if (nr == -1)
+        return -1;
+
+    for (cmsgp = CMSG_FIRSTHDR(&msgh); cmsgp != NULL;
+            cmsgp = CMSG_NXTHDR(&msgh, cmsgp))
+        if (cmsgp->cmsg_level == SOL_SOCKET &&
+                cmsgp->cmsg_type == SCM_CREDENTIALS &&
+                cmsgp->cmsg_len == CMSG_LEN(sizeof(struct ucred)))
+            break;
+    if (cmsgp == NULL) {        /* Shouldn't happen, given SO_PASSCRED */
+        errno = EPROTO;
+        return -1;
+    }
+    memcpy(&ucred, CMSG_DATA(cmsgp), sizeof(struct ucred));
+
+    if (ucred.uid == c->peer.uid) {     /* Same user as last time */
+        c->peer.pid = ucred.pid;
+        c->peer.gid = ucred.gid;
+    } else {
+        setPeer(&c->peer, &ucred);
+        c->lookups++;
+    }
+
+    if (peer != NULL)
+        *peer = &c->peer;
+    return nr;
+}
+
+/* Return 1 if the peer process still exists, 0 if it has terminated,
+   or -1 if this can't be determined (no pidfd, as for a datagram
+   socket) */
+
+int
+uaPeerAlive(const struct uaConn *c)
+{
+    struct pollfd pfd;
+
+    if (c->pidfd == -1)
+        return -1;
+
+    pfd.fd = c->pidfd;          /* A pidfd is readable once the */
+    pfd.events = POLLIN;        /* process has terminated */
+    if (poll(&pfd, 1, 0) == -1)
+        return -1;
+    return (pfd.revents & POLLIN) ? 0 : 1;
+}
+
+/* Close the socket and the pidfd */
+
+void
+uaClose(struct uaConn *c)
+{
+    if (c->pidfd != -1)
+        close(c->pidfd);
+    close(c->fd);
+    c->pidfd = -1;
+    c->fd = -1;
+}
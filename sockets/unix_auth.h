@@ -0,0 +1,53 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* unix_auth.h
+
+   Header file for unix_auth.c.
+*/
+#ifndef UNIX_AUTH_H
+#define UNIX_AUTH_H             /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+
+#define UA_NAME_LEN 33
+
+struct uaPeer {
+    pid_t pid;
+    uid_t uid;
+    gid_t gid;
+    char user[UA_NAME_LEN];     /* User name, or the UID as a string if
+                                   the UID has no name */
+};
+
+struct uaConn {
+    int fd;
+    int type;                   /* SOCK_STREAM, SOCK_SEQPACKET, or
+                                   SOCK_DGRAM */
+    int pidfd;                  /* pidfd for the peer, or -1 */
+    struct uaPeer peer;         /* Connected socket: the peer; datagram
+                                   socket: sender of the last message */
+    long lookups;               /* User names looked up (datagrams) */
+};
+
+int uaInit(struct uaConn *c, int fd);
+
+int uaAccept(int lfd, struct uaConn *c);
+
+ssize_t uaRecv(struct uaConn *c, void *buf, size_t len, int flags,
+               const struct uaPeer **peer);
+
+int uaPeerAlive(const struct uaConn *c);
+
+void uaClose(struct uaConn *c);
+
+#endif
@@ -0,0 +1,317 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* unix_auth_bench.c
+
+   Compare the rate at which a server can receive messages together with
+   the identity of their sender, with per-message credentials
+   (SCM_CREDENTIALS) and with the connection-level credentials of
+   unix_auth.c.
+
+   Usage: unix_auth_bench [-n msgs] [-l len] [method...]
+
+        -n msgs     Number of messages (default: 200000)
+        -l len      Length of each message (default: 64; at most 4096)
+
+   A child process connects to the parent and sends the messages; the
+   parent receives them, and, for each, determines the sender's user
+   name and checks it. The methods (by default, all are measured) are:
+
+        scm_cred_pw     Stream socket; the child sends credentials with
+                        each message (as scm_cred_send.c does); the parent
+                        finds them in the ancillary data of each recvmsg()
+                        (with SO_PASSCRED), and looks up the user name
+                        with getpwuid_r()
+        scm_cred        As scm_cred_pw, but the name is looked up in the
+                        cache of ugid_cache.c
+        conn            Stream socket; the identity is obtained once, by
+                        uaAccept(), and each message is received with
+                        uaRecv()
+        dgram           Datagram socket; uaRecv() obtains the sender's
+                        credentials with each datagram, and reuses the
+                        previous user name if the UID is unchanged
+
+   For each method, the program shows the messages received per second
+   and the mean time per message.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <pwd.h>
+#include <time.h>
+#include "unix_sockets.h"
+#include "unix_auth.h"
+#include "ugid_cache.h"
+#include "tlpi_hdr.h"
+
+#define MAX_LEN 4096
+
+enum { M_SCM_CRED_PW, M_SCM_CRED, M_CONN, M_DGRAM, NMETHODS };
+
+static const char *methodNames[NMETHODS] = {
+    "scm_cred_pw", "scm_cred", "conn", "dgram"
+};
+
+static long numMsgs;
+static int msgLen;
+static char sockName[64];       /* Abstract socket name */
+static char expectUser[UA_NAME_LEN];
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Child: send 'numMsgs' messages, with credentials if 'sendCreds' */
+
+static void
+sender(int type, Boolean sendCreds)
+{
+    struct msghdr msgh;
+    struct iovec iov;
+    struct cmsghdr *cmsgp;
+    struct ucred ucred;
+    char buf[MAX_LEN];
+    long j;
+    int sfd;
+    union {
+        char   buf[CMSG_SPACE(sizeof(struct ucred))];
+        struct cmsghdr align;
+    } controlMsg;
+
+    sfd = unixAbstractConnect(sockName, type);
+    if (sfd == -1)
+        errExit("unixAbstractConnect");
+
+    memset(buf, 'x', msgLen);
+    memset(&msgh, 0, sizeof(msgh));
+    iov.iov_base = buf;
+    iov.iov_len = msgLen;
+    msgh.msg_iov = &iov;
+    msgh.msg_iovlen = 1;
+    if (sendCreds) {
+        msgh.msg_control = controlMsg.buf;
+        msgh.msg_controllen = sizeof(controlMsg.buf);
+        cmsgp = CMSG_FIRSTHDR(&msgh);
+        cmsgp->cmsg_level = SOL_SOCKET;
+        cmsgp->cmsg_type = SCM_CREDENTIALS;
+        cmsgp->cmsg_len = CMSG_LEN(sizeof(struct ucred));
+        ucred.pid = getpid();
+        ucred.uid = getuid();
+        ucred.gid = getgid();
+        memcpy(CMSG_DATA(cmsgp), &ucred, sizeof(struct ucred));
+    }
+
+    for (j = 0; j < numMsgs; j++)
+        if (sendmsg(sfd, &msgh, 0) != msgLen)
+            errExit("sendmsg");
+
+    close(sfd);
+}
+
+/* Receive messages on the stream socket 'fd' with per-message
+   credentials, until 'numMsgs' messages' worth of bytes have arrived */
+
+static void
+recvScmCred(int fd, Boolean cached)
+{
+    struct msghdr msgh;
+    struct iovec iov;
+    struct cmsghdr *cmsgp;
+    struct ucred ucred;
+    struct passwd pwd, *pwdp;
+    char buf[MAX_LEN], pwBuf[4096];
+    const char *name;
+    long long tot;
+    ssize_t nr;
+    union {
+        char   buf[CMSG_SPACE(sizeof(struct ucred))];
+        struct cmsghdr align;
+    } controlMsg;
+
+    for (tot = 0; tot < (long long) numMsgs * msgLen; tot += nr) {
+        memset(&msgh, 0, sizeof(msgh));
+        iov.iov_base = buf;
+        iov.iov_len = msgLen;
+        msgh.msg_iov = &iov;
+        msgh.msg_iovlen = 1;
+        msgh.msg_control = controlMsg.buf;
+        msgh.msg_controllen = sizeof(controlMsg.buf);
+
+        nr = recvmsg(fd, &msgh, 0);
+        if (nr == -1)
+            errExit("recvmsg");
+        if (nr == 0)
+            fatal("Unexpected EOF");
+
+        cmsgp = CMSG_FIRSTHDR(&msgh);
+        if (cmsgp == NULL || cmsgp->cmsg_level != SOL_SOCKET ||
+                cmsgp->cmsg_type != SCM_CREDENTIALS)
+            fatal("No credentials");
+        memcpy(&ucred, CMSG_DATA(cmsgp), sizeof(struct ucred));
+
+        if (cached) {
+            name = userNameFromIdCached(ucred.uid);
+        } else {
+            getpwuid_r(ucred.uid, &pwd, pwBuf, sizeof(pwBuf), &pwdp);
+            name = (pwdp == NULL) ? NULL : pwdp->pw_name;
+        }
+        if (name == NULL || strcmp(name, expectUser) != 0)
+            fatal("Wrong user");
+    }
+}
+
+/* Receive with uaRecv() */
+
+static void
+recvUa(struct uaConn *c)
+{
+    const struct uaPeer *peer;
+    char buf[MAX_LEN];
+    long long tot;
+    ssize_t nr;
+
+    for (tot = 0; tot < (long long) numMsgs * msgLen; tot += nr) {
+        nr = uaRecv(c, buf, msgLen, 0, &peer);
+        if (nr == -1)
+            errExit("uaRecv");
+        if (nr == 0)
+            fatal("Unexpected EOF");
+        if (strcmp(peer->user, expectUser) != 0)
+            fatal("Wrong user");
+    }
+}
+
+static double
+runMethod(int method)
+{
+    struct uaConn c;
+    double start, secs;
+    int type, lfd, fd, optval;
+    pid_t pid;
+
+    type = (method == M_DGRAM) ? SOCK_DGRAM : SOCK_STREAM;
+    lfd = unixAbstractBind(sockName, type);
+    if (lfd == -1)
+        errExit("unixAbstractBind");
+    if (type == SOCK_STREAM && listen(lfd, 5) == -1)
+        errExit("listen");
+
+    start = nowSecs();
+
+    pid = fork();
+    if (pid == -1)
+        errExit("fork");
+    if (pid == 0) {
+        close(lfd);
+        sender(type, method == M_SCM_CRED_PW || method == M_SCM_CRED);
+        _exit(EXIT_SUCCESS);
+    }
+
+    switch (method) {
+    case M_SCM_CRED_PW:
+    case M_SCM_CRED:
+        fd = accept(lfd, NULL, NULL);
+        if (fd == -1)
+            errExit("accept");
+        optval = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &optval,
+                       sizeof(optval)) == -1)
+            errExit("setsockopt");
+        recvScmCred(fd, method == M_SCM_CRED);
+        close(fd);
+        break;
+
+    case M_CONN:
+        if (uaAccept(lfd, &c) == -1)
+            errExit("uaAccept");
+        recvUa(&c);
+        uaClose(&c);
+        break;
+
+    case M_DGRAM:
+        if (uaInit(&c, lfd) == -1)
+            errExit("uaInit");
+        recvUa(&c);
+        break;
+    }
+
+    secs = nowSecs() - start;
+    if (waitpid(pid, NULL, 0) == -1)
+        errExit("waitpid");
+    close(lfd);
+    return secs;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n msgs] [-l len] [method...]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    Boolean run[NMETHODS];
+    char *name;
+    double secs;
+    int opt, m, j;
+
+    numMsgs = 200000;
+    msgLen = 64;
+    while ((opt = getopt(argc, argv, "n:l:")) != -1) {
+        switch (opt) {
+        case 'n':   numMsgs = getLong(optarg, GN_GT_0, "-n");   break;
+        case 'l':   msgLen = getInt(optarg, GN_GT_0, "-l");     break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (msgLen > MAX_LEN)
+        cmdLineErr("-l must be at most %d\n", MAX_LEN);
+
+    for (m = 0; m < NMETHODS; m++)
+        run[m] = optind == argc;
+    for (j = optind; j < argc; j++) {
+        for (m = 0; m < NMETHODS; m++)
+            if (strcmp(argv[j], methodNames[m]) == 0)
+                break;
+        if (m == NMETHODS)
+            cmdLineErr("Unknown method: %s\n", argv[j]);
+        run[m] = TRUE;
+    }
+
+    name = userNameFromIdCached(getuid());
+    if (name == NULL)
+        fatal("No user name for UID %ld", (long) getuid());
+    snprintf(expectUser, sizeof(expectUser), "%s", name);
+    snprintf(sockName, sizeof(sockName), "unix_auth_bench.%ld",
+             (long) getpid());
+
+    printf("%-12s %12s %10s\n", "method", "msgs/sec", "ns/msg");
+    for (m = 0; m < NMETHODS; m++) {
+        if (!run[m])
+            continue;
+        secs = runMethod(m);
+        printf("%-12s %12.0f %10.1f\n", methodNames[m], numMsgs / secs,
+               secs * 1e9 / numMsgs);
+    }
+
+    exit(EXIT_SUCCESS);
+}
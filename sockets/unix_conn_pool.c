@@ -0,0 +1,215 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 57 */
+
+/* unix_conn_pool.c
+
+   Implement a pool of idle connected UNIX domain sockets on top of
+   unix_sockets.c, so that a client making many short requests to a
+   server can reuse connections rather than paying for a pathname lookup,
+   socket(), connect(), and (on the server side) accept() for each one.
+
+   The endpoints are kept in a hash table; each endpoint has a stack of
+   up to 'maxIdle' idle connections. Getting and returning a connection
+   are thus O(1) operations (on average, in the case of the hash lookup).
+   Connections are reused most-recently-returned first, which keeps a
+   small working set of connections busy and lets the others (which the
+   server may close) be detected as stale.
+
+   Before handing out an idle connection, ucpGet() checks its health
+   with a nonblocking recv(MSG_PEEK): a healthy idle connection has no
+   input pending, so the call fails with EAGAIN. If instead the call
+   returns 0 (end-of-file: the server closed the connection), returns
+   data (unsolicited, so the stream is out of step), or fails with some
+   other error, the connection is closed and the next one is tried.
+   The check can't detect a server that closes the connection just after
+   the check, so callers should still be prepared for a request to fail.
+
+   This code is Linux-specific (the abstract namespace).
+*/
+#include <sys/socket.h>
+#include "unix_sockets.h"
+#include "unix_conn_pool.h"
+#include "tlpi_hdr.h"
+
+#define NBUCKETS 64             /* Size of hash table (a power of 2) */
+
+struct endpoint {
+    struct endpoint *next;      /* Next in hash chain */
+    char *name;
+    int nidle;                  /* Number of fds in 'idle' */
+    int idle[];                 /* Stack of 'maxIdle' idle connections */
+};
+
+struct ucPool {
+    int type;                   /* Socket type */
+    int maxIdle;                /* Per-endpoint limit on idle sockets */
+    struct ucpStats stats;
+    struct endpoint *buckets[NBUCKETS];
+};
+
+static unsigned int
+hashName(const char *s)
+{
+    unsigned int h = 5381;
+
+    while (*s != '\0')
+        h = h * 33 + (unsigned char) *s++;
+    return h & (NBUCKETS - 1);
+}
+
+/* Find the record for 'name', creating it if 'create' is true. Returns
+   NULL if there is no such record (or it could not be created). */
+
+static struct endpoint *
+findEndpoint(struct ucPool *p, const char *name, int create)
+{
+    struct endpoint *ep;
+    unsigned int h;
+
+    h = hashName(name);
+    for (ep = p->buckets[h]; ep != NULL; ep = ep->next)
+        if (strcmp(ep->name, name) == 0)
+            return ep;
+
+    if (!create)
+        return NULL;
+
+    ep = malloc(sizeof(struct endpoint) + p->maxIdle * sizeof(int));
+    if (ep == NULL)
+        return NULL;
+    ep->name = strdup(name);
+    if (ep->name == NULL) {
+        free(ep);
+        return NULL;
+    }
+    ep->nidle = 0;
+    ep->next = p->buckets[h];
+    p->buckets[h] = ep;
+    return ep;
+}
+
+/* Return true if the idle connection 'fd' appears usable */
+
+static int
+isHealthy(int fd)
+{
+    char ch;
+
+    return recv(fd, &ch, 1, MSG_PEEK | MSG_DONTWAIT) == -1 &&
+           (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/* Create a pool of connections of type 'type' (SOCK_STREAM or
+   SOCK_SEQPACKET), keeping at most 'maxIdle' idle connections per
+   endpoint. Returns NULL (with errno set) on error. */
+
+struct ucPool *
+ucpCreate(int type, int maxIdle)
+{
+    struct ucPool *p;
+
+    if (maxIdle <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    p = calloc(1, sizeof(struct ucPool));
+    if (p == NULL)
+        return NULL;
+    p->type = type;
+    p->maxIdle = maxIdle;
+    return p;
+}
+
+/* Return a connected socket for 'endpoint', either an idle connection
+   from the pool or a new connection. Returns -1 on error. */
+
+int
+ucpGet(struct ucPool *p, const char *endpoint)
+{
+    struct endpoint *ep;
+    int fd, savedErrno;
+
+    ep = findEndpoint(p, endpoint, 0);
+    if (ep != NULL) {
+        savedErrno = errno;
+        while (ep->nidle > 0) {
+            fd = ep->idle[--ep->nidle];
+            if (isHealthy(fd)) {
+                errno = savedErrno;
+                p->stats.hits++;
+                return fd;
+            }
+            p->stats.stale++;
+            close(fd);
+        }
+        errno = savedErrno;
+    }
+
+    p->stats.misses++;
+    if (endpoint[0] == '@')
+        return unixAbstractConnect(endpoint + 1, p->type);
+    else
+        return unixConnect(endpoint, p->type);
+}
+
+/* Return the connection 'fd' (obtained from ucpGet()) to the pool. If
+   the endpoint already has 'maxIdle' idle connections, 'fd' is closed
+   instead. Returns 0 on success, or -1 on error (in which case 'fd' has
+   been closed). */
+
+int
+ucpPut(struct ucPool *p, const char *endpoint, int fd)
+{
+    struct endpoint *ep;
+
+    ep = findEndpoint(p, endpoint, 1);
+    if (ep == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    if (ep->nidle == p->maxIdle) {
+        p->stats.overflows++;
+        close(fd);
+        return 0;
+    }
+
+    ep->idle[ep->nidle++] = fd;
+    return 0;
+}
+
+void
+ucpGetStats(const struct ucPool *p, struct ucpStats *stats)
+{
+    *stats = p->stats;
+}
+
+/* Close all idle connections and free the pool */
+
+void
+ucpFree(struct ucPool *p)
+{
+    struct endpoint *ep, *next;
+    int j;
+
+    for (j = 0; j < NBUCKETS; j++) {
+        for (ep = p->buckets[j]; ep != NULL; ep = next) {
+            next = ep->next;
+            while (ep->nidle > 0)
+                close(ep->idle[--ep->nidle]);
+            free(ep->name);
+            free(ep);
+        }
+    }
+    free(p);
+}
@@ -0,0 +1,52 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 57 */
+
+/* unix_conn_pool.h
+
+   Header file for unix_conn_pool.c.
+
+   A pool of idle connected UNIX domain sockets, kept per endpoint. An
+   endpoint is a pathname, or, if it begins with '@', a name (the
+   remainder of the string) in the Linux-specific abstract namespace.
+   The operations are:
+
+        create a pool:                      p = ucpCreate(type, maxIdle)
+        get a connection to 'endpoint':     fd = ucpGet(p, endpoint)
+        return a healthy connection:        ucpPut(p, endpoint, fd)
+        close all idle connections:         ucpFree(p)
+
+   A connection that is in an unknown state (e.g., after an error, or
+   with a reply only partly read) should be closed, not returned.
+*/
+#ifndef UNIX_CONN_POOL_H
+#define UNIX_CONN_POOL_H        /* Prevent accidental double inclusion */
+
+struct ucPool;                  /* Opaque; defined in unix_conn_pool.c */
+
+struct ucpStats {
+    long hits;                  /* ucpGet() returned an idle connection */
+    long misses;                /* ucpGet() made a new connection */
+    long stale;                 /* Idle connections found to be dead */
+    long overflows;             /* ucpPut() closed fd: pool was full */
+};
+
+struct ucPool *ucpCreate(int type, int maxIdle);
+
+int ucpGet(struct ucPool *p, const char *endpoint);
+
+int ucpPut(struct ucPool *p, const char *endpoint, int fd);
+
+void ucpGetStats(const struct ucPool *p, struct ucpStats *stats);
+
+void ucpFree(struct ucPool *p);
+
+#endif
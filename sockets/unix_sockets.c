@@ -13,7 +13,11 @@
 /* unix_sockets.c
 
    A package of useful routines for UNIX domain sockets.
+
+   The unixAbstract*() functions use the Linux-specific abstract
+   namespace.
 */
+#include <stddef.h>
 #include "unix_sockets.h"       /* Declares functions defined here */
 #include "tlpi_hdr.h"
 
@@ -92,3 +96,92 @@ unixBind(const char *path, int type)
 
     return sd;
 }
+
+/* Build a UNIX domain socket address structure for the name 'name' in
+   the Linux-specific abstract namespace (see us_abstract_bind.c),
+   returning it in 'addr', and its length in 'addrlen'. 'name' doesn't
+   include the initial null byte of the address. Returns 0 on success,
+   or -1 on error. */
+
+int
+unixBuildAbstractAddress(const char *name, struct sockaddr_un *addr,
+                         socklen_t *addrlen)
+{
+    size_t len;
+
+    if (addr == NULL || name == NULL || addrlen == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    len = strlen(name);
+    if (len > sizeof(addr->sun_path) - 1) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    memcpy(&addr->sun_path[1], name, len);     /* sun_path[0] is 0 */
+
+    /* The address length must not include any trailing null bytes,
+       which would otherwise be significant */
+
+    *addrlen = offsetof(struct sockaddr_un, sun_path) + 1 + len;
+    return 0;
+}
+
+/* Create a UNIX domain socket of type 'type' and connect it to the
+   abstract name 'name'. Return the socket descriptor on success, or -1
+   on error */
+
+int
+unixAbstractConnect(const char *name, int type)
+{
+    int sd, savedErrno;
+    struct sockaddr_un addr;
+    socklen_t addrlen;
+
+    if (unixBuildAbstractAddress(name, &addr, &addrlen) == -1)
+        return -1;
+
+    sd = socket(AF_UNIX, type, 0);
+    if (sd == -1)
+        return -1;
+
+    if (connect(sd, (struct sockaddr *) &addr, addrlen) == -1) {
+        savedErrno = errno;
+        close(sd);                      /* Might change 'errno' */
+        errno = savedErrno;
+        return -1;
+    }
+
+    return sd;
+}
+
+/* Create a UNIX domain socket and bind it to the abstract name 'name'.
+   Return the socket descriptor on success, or -1 on error. */
+
+int
+unixAbstractBind(const char *name, int type)
+{
+    int sd, savedErrno;
+    struct sockaddr_un addr;
+    socklen_t addrlen;
+
+    if (unixBuildAbstractAddress(name, &addr, &addrlen) == -1)
+        return -1;
+
+    sd = socket(AF_UNIX, type, 0);
+    if (sd == -1)
+        return -1;
+
+    if (bind(sd, (struct sockaddr *) &addr, addrlen) == -1) {
+        savedErrno = errno;
+        close(sd);                      /* Might change 'errno' */
+        errno = savedErrno;
+        return -1;
+    }
+
+    return sd;
+}
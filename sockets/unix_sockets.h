@@ -26,4 +26,11 @@ int unixConnect(const char *path, int type);
 
 int unixBind(const char *path, int type);
 
+int unixBuildAbstractAddress(const char *name, struct sockaddr_un *addr,
+                             socklen_t *addrlen);
+
+int unixAbstractConnect(const char *name, int type);
+
+int unixAbstractBind(const char *name, int type);
+
 #endif
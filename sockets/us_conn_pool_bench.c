@@ -0,0 +1,243 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 57 */
+
+/* us_conn_pool_bench.c
+
+   Compare the cost of short request/response exchanges with a UNIX
+   domain stream socket server when the client makes a new connection
+   for each request (unixConnect() or unixAbstractConnect()) with the
+   cost when the client reuses connections from a pool (unix_conn_pool.c),
+   for both a pathname and an abstract socket address.
+
+   Usage: us_conn_pool_bench [-n requests] [-k max-per-conn]
+
+        -n requests       Number of requests in each test (default: 100000)
+        -k max-per-conn   The server closes each connection after this
+                          many requests (default: 0, meaning never). This
+                          exercises the pool's detection of stale
+                          connections.
+
+   For each test, a child process acts as the server: it uses poll() to
+   service its listening socket and connections, echoing back each
+   4-byte request. The pathname server uses a socket in /tmp (see the
+   comments in us_xfr.h).
+
+   This program is Linux-specific.
+*/
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include "unix_sockets.h"
+#include "unix_conn_pool.h"
+#include "tlpi_hdr.h"
+
+#define SV_SOCK_PATH "/tmp/us_conn_pool_bench"
+#define SV_ABSTRACT_NAME "us_conn_pool_bench"
+#define MAX_CONN 1024
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Server (in a child process): echo requests on all connections. Each
+   connection is closed after 'maxPerConn' requests (if not 0). */
+
+static void
+server(int lfd, int maxPerConn)
+{
+    struct pollfd pfds[MAX_CONN + 1];
+    int count[MAX_CONN + 1];
+    int nfds, j, cfd, req;
+    ssize_t numRead;
+
+    pfds[0].fd = lfd;
+    pfds[0].events = POLLIN;
+    nfds = 1;
+
+    for (;;) {
+        if (poll(pfds, nfds, -1) == -1)
+            errExit("poll");
+
+        for (j = nfds - 1; j >= 1; j--) {
+            if (pfds[j].revents == 0)
+                continue;
+
+            numRead = read(pfds[j].fd, &req, sizeof(req));
+            if (numRead == sizeof(req)) {
+                if (write(pfds[j].fd, &req, sizeof(req)) != sizeof(req))
+                    numRead = 0;        /* Client has gone; close */
+                count[j]++;
+            }
+
+            if (numRead != sizeof(req) ||
+                    (maxPerConn > 0 && count[j] >= maxPerConn)) {
+                close(pfds[j].fd);
+                pfds[j] = pfds[nfds - 1];       /* Fill the hole */
+                count[j] = count[nfds - 1];
+                nfds--;
+            }
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            cfd = accept(lfd, NULL, NULL);
+            if (cfd == -1)
+                errExit("accept");
+            if (nfds > MAX_CONN) {
+                close(cfd);
+            } else {
+                pfds[nfds].fd = cfd;
+                pfds[nfds].events = POLLIN;
+                count[nfds] = 0;
+                nfds++;
+            }
+        }
+    }
+}
+
+/* Perform one request on 'fd'; returns -1 if the connection failed */
+
+static int
+doRequest(int fd, int req)
+{
+    int reply;
+
+    if (write(fd, &req, sizeof(req)) != sizeof(req))
+        return -1;
+    if (read(fd, &reply, sizeof(reply)) != sizeof(reply))
+        return -1;
+    if (reply != req)
+        fatal("Bad reply: %d (expected %d)", reply, req);
+    return 0;
+}
+
+static void
+runTest(const char *endpoint, Boolean usePool, int numReqs, int maxPerConn)
+{
+    struct ucPool *pool;
+    struct ucpStats stats;
+    int lfd, fd, req, retries;
+    pid_t childPid;
+    double start, secs;
+
+    if (endpoint[0] == '@') {
+        lfd = unixAbstractBind(endpoint + 1, SOCK_STREAM);
+    } else {
+        if (remove(endpoint) == -1 && errno != ENOENT)
+            errExit("remove-%s", endpoint);
+        lfd = unixBind(endpoint, SOCK_STREAM);
+    }
+    if (lfd == -1)
+        errExit("bind %s", endpoint);
+    if (listen(lfd, SOMAXCONN) == -1)
+        errExit("listen");
+
+    childPid = fork();
+    if (childPid == -1)
+        errExit("fork");
+    if (childPid == 0)
+        server(lfd, maxPerConn);
+    close(lfd);
+
+    pool = NULL;
+    if (usePool) {
+        pool = ucpCreate(SOCK_STREAM, 4);
+        if (pool == NULL)
+            errExit("ucpCreate");
+    }
+
+    retries = 0;
+    start = nowSecs();
+    for (req = 0; req < numReqs; req++) {
+        for (;;) {
+            if (usePool)
+                fd = ucpGet(pool, endpoint);
+            else if (endpoint[0] == '@')
+                fd = unixAbstractConnect(endpoint + 1, SOCK_STREAM);
+            else
+                fd = unixConnect(endpoint, SOCK_STREAM);
+            if (fd == -1)
+                errExit("connect %s", endpoint);
+
+            if (doRequest(fd, req) == 0)
+                break;
+
+            /* The server closed the connection after the pool's health
+               check; close it and retry */
+
+            close(fd);
+            retries++;
+        }
+
+        if (usePool) {
+            if (ucpPut(pool, endpoint, fd) == -1)
+                errExit("ucpPut");
+        } else {
+            close(fd);
+        }
+    }
+    secs = nowSecs() - start;
+
+    printf("%-26s %-6s %10.2f %10.0f", endpoint, usePool ? "pool" : "fresh",
+            secs * 1e6 / numReqs, numReqs / secs);
+    if (usePool) {
+        ucpGetStats(pool, &stats);
+        printf(" %8ld %8ld %8ld", stats.misses, stats.stale, (long) retries);
+        ucpFree(pool);
+    }
+    printf("\n");
+
+    kill(childPid, SIGTERM);
+    if (waitpid(childPid, NULL, 0) == -1)
+        errExit("waitpid");
+    if (endpoint[0] != '@')
+        remove(endpoint);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int opt, numReqs, maxPerConn;
+
+    numReqs = 100000;
+    maxPerConn = 0;
+    while ((opt = getopt(argc, argv, "n:k:")) != -1) {
+        switch (opt) {
+        case 'n':   numReqs = getInt(optarg, GN_GT_0, "requests");      break;
+        case 'k':   maxPerConn = getInt(optarg, GN_NONNEG, "max-per-conn");
+                    break;
+        default:
+            usageErr("%s [-n requests] [-k max-per-conn]\n", argv[0]);
+        }
+    }
+
+    /* The client may write to a connection that the server has closed */
+
+    if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+        errExit("signal");
+
+    printf("%-26s %-6s %10s %10s %8s %8s %8s\n", "endpoint", "mode",
+            "us/req", "req/sec", "connects", "stale", "retries");
+    runTest(SV_SOCK_PATH, FALSE, numReqs, maxPerConn);
+    runTest(SV_SOCK_PATH, TRUE, numReqs, maxPerConn);
+    runTest("@" SV_ABSTRACT_NAME, FALSE, numReqs, maxPerConn);
+    runTest("@" SV_ABSTRACT_NAME, TRUE, numReqs, maxPerConn);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,390 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 57 */
+
+/* us_xfr_bench.c
+
+   Measure the throughput of the kind of transfer performed by
+   us_xfr_cl.c and us_xfr_sv.c (a sender writes fixed-size buffers to a
+   UNIX domain socket, and a receiver reads them), over a range of buffer
+   sizes, socket buffer sizes, and socket types.
+
+   Usage: us_xfr_bench [-n MiB] [-b size[,size...]] [-s size[,size...]]
+                       [-t type[,type...]] [-z]
+
+        -n MiB      Amount of data transferred in each test (default: 256)
+        -b size     Comma-separated list of buffer sizes, in bytes, used
+                    for each write and read (default: 100,4096,65536)
+        -s size     Comma-separated list of values for SO_SNDBUF and
+                    SO_RCVBUF, in bytes; 0 means the system default
+                    (default: 0)
+        -t type     Comma-separated list of socket types: "stream",
+                    "seqpacket", and/or "dgram" (default: all three)
+        -z          Also try each test with MSG_ZEROCOPY; this requires
+                    SO_ZEROCOPY support for the socket type, which (as at
+                    Linux 6.x) the UNIX domain doesn't provide; for
+                    unsupported types, the program says so and skips
+                    the MSG_ZEROCOPY tests
+
+   (The buffer size of 100 bytes is the BUF_SIZE used by us_xfr_cl.c.)
+
+   Each test creates a connected socket pair and a child process that
+   reads from one socket until end-of-file, while the parent writes to
+   the other socket. For each test, the program reports the throughput, the
+   number of write() and read() calls made per MiB transferred, and the
+   mean number of bytes returned by each read(). For the datagram types,
+   the buffer size is also the message size; a message must fit in the
+   sender's socket buffer, so some combinations fail with EMSGSIZE.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <linux/errqueue.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#define MAX_SIZES 16
+
+static struct {
+    const char *name;
+    int type;
+} sockTypes[] = {
+    { "stream",     SOCK_STREAM },
+    { "seqpacket",  SOCK_SEQPACKET },
+    { "dgram",      SOCK_DGRAM },
+};
+
+#define NTYPES (sizeof(sockTypes) / sizeof(sockTypes[0]))
+
+struct rxResult {               /* Reported by receiver to the parent */
+    long long bytes;
+    long long calls;
+};
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Parse a comma-separated list of sizes into 'sizes'; return the count */
+
+static int
+parseSizes(char *arg, long *sizes, const char *name, long minVal)
+{
+    char *tok;
+    int n;
+
+    n = 0;
+    for (tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (n == MAX_SIZES)
+            cmdLineErr("Too many values for %s (max %d)\n", name, MAX_SIZES);
+        sizes[n] = getLong(tok, GN_NONNEG, name);
+        if (sizes[n] < minVal)
+            cmdLineErr("%s must be at least %ld\n", name, minVal);
+        n++;
+    }
+    return n;
+}
+
+/* Read (and discard) zero-copy completion notifications from the
+   socket's error queue; returns the number of sends completed */
+
+static long
+reapZerocopy(int sfd)
+{
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct sock_extended_err *serr;
+    char control[100];
+    long completed;
+
+    completed = 0;
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+            break;
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+                cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+            if (serr->ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+                completed += serr->ee_data - serr->ee_info + 1;
+        }
+    }
+    return completed;
+}
+
+/* Return TRUE if sockets of type 'type' support SO_ZEROCOPY */
+
+static Boolean
+zerocopySupported(int type)
+{
+    int sv[2], optval, s;
+
+    if (socketpair(AF_UNIX, type, 0, sv) == -1)
+        errExit("socketpair");
+    optval = 1;
+    s = setsockopt(sv[0], SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof(optval));
+    close(sv[0]);
+    close(sv[1]);
+    return s == 0;
+}
+
+/* Child: read from 'sfd' until end-of-file (for datagrams, a zero-length
+   message) and report the totals on 'resFd' */
+
+static void
+receiver(int sfd, int resFd, size_t bufSize)
+{
+    struct rxResult res;
+    ssize_t numRead;
+    char *buf;
+
+    buf = malloc(bufSize);
+    if (buf == NULL)
+        errExit("malloc");
+
+    res.bytes = res.calls = 0;
+    for (;;) {
+        numRead = read(sfd, buf, bufSize);
+        if (numRead == -1)
+            errExit("read");
+        res.calls++;
+        if (numRead == 0)
+            break;
+        res.bytes += numRead;
+    }
+
+    if (write(resFd, &res, sizeof(res)) != sizeof(res))
+        fatal("write result");
+}
+
+/* Run one test; returns FALSE if the test couldn't be performed */
+
+static Boolean
+runTest(int t, size_t bufSize, long sockBuf, Boolean zerocopy,
+        long long total)
+{
+    int sv[2], pfd[2], optval, sendFlags;
+    long long sent, txCalls;
+    struct rxResult res;
+    ssize_t numWritten;
+    double start, secs;
+    char *buf;
+    char label[64];
+
+    snprintf(label, sizeof(label), "%-9s %8ld %8ld %3s", sockTypes[t].name,
+            (long) bufSize, sockBuf, zerocopy ? "zc" : "");
+
+    if (socketpair(AF_UNIX, sockTypes[t].type, 0, sv) == -1)
+        errExit("socketpair");
+
+    if (sockBuf > 0) {
+        optval = sockBuf;
+        if (setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &optval,
+                       sizeof(optval)) == -1 ||
+                setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &optval,
+                       sizeof(optval)) == -1)
+            errExit("setsockopt");
+    }
+
+    sendFlags = 0;
+    if (zerocopy) {
+        optval = 1;
+        if (setsockopt(sv[0], SOL_SOCKET, SO_ZEROCOPY, &optval,
+                       sizeof(optval)) == -1)
+            errExit("setsockopt-SO_ZEROCOPY");
+        sendFlags = MSG_ZEROCOPY;
+    }
+
+    if (pipe(pfd) == -1)
+        errExit("pipe");
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0:
+        close(sv[0]);
+        close(pfd[0]);
+        receiver(sv[1], pfd[1], bufSize);
+        _exit(EXIT_SUCCESS);
+
+    default:
+        close(sv[1]);
+        close(pfd[1]);
+        break;
+    }
+
+    buf = malloc(bufSize);
+    if (buf == NULL)
+        errExit("malloc");
+    memset(buf, 'x', bufSize);
+
+    start = nowSecs();
+    txCalls = 0;
+    for (sent = 0; sent < total; sent += numWritten) {
+        numWritten = send(sv[0], buf, bufSize, sendFlags);
+        txCalls++;
+        if (numWritten == -1) {
+            if (errno == ENOBUFS && zerocopy) {     /* Too many pending */
+                reapZerocopy(sv[0]);
+                numWritten = 0;
+                continue;
+            }
+            printf("%s  send() failed: %s\n", label, strerror(errno));
+            break;
+        }
+        if (zerocopy)
+            reapZerocopy(sv[0]);
+    }
+
+    /* Signal end-of-file */
+
+    if (sockTypes[t].type == SOCK_DGRAM) {
+        if (send(sv[0], buf, 0, 0) == -1)
+            errExit("send");
+    } else {
+        if (shutdown(sv[0], SHUT_WR) == -1)
+            errExit("shutdown");
+    }
+    txCalls++;
+
+    if (read(pfd[0], &res, sizeof(res)) != sizeof(res))
+        fatal("read result");
+    secs = nowSecs() - start;
+
+    if (wait(NULL) == -1)
+        errExit("wait");
+    close(sv[0]);
+    close(pfd[0]);
+    free(buf);
+
+    if (sent < total)
+        return FALSE;
+
+    printf("%s %9.3f %10.1f %10.1f %10.1f\n", label,
+            res.bytes / secs / 1e9,
+            txCalls / (res.bytes / 1048576.0),
+            res.calls / (res.bytes / 1048576.0),
+            (double) res.bytes / (res.calls - 1));
+    return TRUE;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n MiB] [-b size[,size...]] "
+            "[-s size[,size...]]\n"
+            "               [-t type[,type...]] [-z]\n", progName);
+    fprintf(stderr, "    'type' is one of:");
+    for (int t = 0; t < NTYPES; t++)
+        fprintf(stderr, " %s", sockTypes[t].name);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long bufSizes[MAX_SIZES], sockBufs[MAX_SIZES];
+    int numBufSizes, numSockBufs, opt, t, b, s, z;
+    Boolean useType[NTYPES], anyType, zerocopy, tryZc, ok;
+    long long total;
+    char *tok;
+
+    total = 256LL * 1024 * 1024;
+    numBufSizes = numSockBufs = 0;
+    anyType = FALSE;
+    zerocopy = FALSE;
+    for (t = 0; t < NTYPES; t++)
+        useType[t] = FALSE;
+
+    while ((opt = getopt(argc, argv, "n:b:s:t:z")) != -1) {
+        switch (opt) {
+        case 'n':
+            total = getLong(optarg, GN_GT_0, "MiB") * 1024LL * 1024;
+            break;
+        case 'b':
+            numBufSizes = parseSizes(optarg, bufSizes, "buffer size", 1);
+            break;
+        case 's':
+            numSockBufs = parseSizes(optarg, sockBufs, "socket buffer", 0);
+            break;
+        case 't':
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                for (t = 0; t < NTYPES; t++)
+                    if (strcmp(tok, sockTypes[t].name) == 0)
+                        break;
+                if (t == NTYPES)
+                    usageError(argv[0]);
+                useType[t] = TRUE;
+                anyType = TRUE;
+            }
+            break;
+        case 'z':   zerocopy = TRUE;                    break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc)
+        usageError(argv[0]);
+
+    if (numBufSizes == 0) {
+        bufSizes[numBufSizes++] = 100;
+        bufSizes[numBufSizes++] = 4096;
+        bufSizes[numBufSizes++] = 65536;
+    }
+    if (numSockBufs == 0)
+        sockBufs[numSockBufs++] = 0;
+    if (!anyType)
+        for (t = 0; t < NTYPES; t++)
+            useType[t] = TRUE;
+
+    printf("%lld MiB per test\n", total >> 20);
+    printf("%-9s %8s %8s %3s %9s %10s %10s %10s\n", "type", "bufsize",
+            "sockbuf", "", "GB/s", "writes/MiB", "reads/MiB", "bytes/read");
+
+    ok = TRUE;
+    for (t = 0; t < NTYPES; t++) {
+        if (!useType[t])
+            continue;
+
+        tryZc = zerocopy && zerocopySupported(sockTypes[t].type);
+        if (zerocopy && !tryZc)
+            printf("%-9s MSG_ZEROCOPY not supported (%s); skipping\n",
+                    sockTypes[t].name, strerror(errno));
+
+        for (s = 0; s < numSockBufs; s++)
+            for (b = 0; b < numBufSizes; b++)
+                for (z = 0; z <= tryZc; z++)
+                    if (!runTest(t, bufSizes[b], sockBufs[s], z, total))
+                        ok = FALSE;
+    }
+
+    exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,298 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* zc_xfer.c
+
+   Bulk transfer over TCP sockets without copying data between user
+   space and the kernel.
+
+   Sending: zcSend() sends with MSG_ZEROCOPY (after zcSenderInit() has
+   enabled SO_ZEROCOPY), so that the kernel transmits from the caller's
+   pages rather than a copy of them. The caller must therefore not modify
+   a buffer until the kernel has finished with it: each call to zcSend()
+   returns a ticket, and the buffer may be reused once zcSendWait() with
+   that ticket has returned. The kernel reports completions (which, for
+   TCP, arrive in order, and may cover a range of sends) on the socket's
+   error queue; zcSendReap() reads them without blocking, and should be
+   called from time to time even by a caller that never waits, since
+   unread notifications are charged to the socket's option memory (when
+   that is exhausted, send() fails with ENOBUFS, which zcSend() handles
+   by waiting for completions). Zero-copy sending pays off only for large
+   sends (tens of kilobytes or more); where the kernel can't avoid a copy
+   (for example, on the loopback device), it copies when the data is
+   sent, and says so in the completion, which is counted in 'copied'.
+
+   Receiving: zcRecv() uses TCP_ZEROCOPY_RECEIVE to map whole pages of
+   received data into a window of the caller's address space, mmap()ed
+   from the socket by zcReceiverInit(). Only page-aligned, page-sized
+   runs of data can be mapped (so that, in practice, the sender's MTU
+   must be more than a page, and the network device must split headers
+   from payloads); the kernel reports how many bytes must be read in the
+   usual way before it can map again, and zcRecv() copies those bytes
+   into the caller's buffer. Either way, zcRecv() returns a pointer to
+   the data, which remains valid until the next call.
+
+   If zero copy was not requested or isn't available, the functions fall
+   back to send() and recv().
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include "zc_xfer.h"            /* Declares functions defined here */
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+/* Prepare 'zs' for sending on the TCP socket 'fd', with MSG_ZEROCOPY if
+   'zerocopy' is nonzero and the kernel supports it (check zs->zerocopy
+   afterward). Returns 0 on success, or -1 on error. */
+
+int
+zcSenderInit(struct zcSender *zs, int fd, int zerocopy)
+{
+    int optval;
+
+    memset(zs, 0, sizeof(*zs));
+    zs->fd = fd;
+
+    if (zerocopy) {
+        optval = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &optval,
+                       sizeof(optval)) == 0)
+            zs->zerocopy = 1;
+        else if (errno != ENOPROTOOPT && errno != EOPNOTSUPP)
+            return -1;
+    }
+    return 0;
+}
+
+/* Send all 'len' bytes of 'buf'. On return, '*ticket' identifies the
+   sends that used 'buf', for use with zcSendWait(). Returns 'len' on
+   success, or -1 on error. */
+
+ssize_t
+zcSend(struct zcSender *zs, const void *buf, size_t len, uint32_t *ticket)
+{
+    const char *p;
+    ssize_t numSent;
+    size_t tot;
+
+    for (tot = 0, p = buf; tot < len; tot += numSent, p += numSent) {
+        numSent = send(zs->fd, p, len - tot,
+                       MSG_NOSIGNAL | (zs->zerocopy ? MSG_ZEROCOPY : 0));
+        if (numSent == -1) {
+            if (errno == EINTR) {
+                numSent = 0;
+            } else if (errno == ENOBUFS && zs->zerocopy &&
+                       zs->done != zs->next) {
+
+                /* Too many notifications are outstanding; wait for the
+                   earliest to arrive (which frees option memory) */
+
+                if (zcSendWait(zs, zs->done + 1) == -1)
+                    return -1;
+                numSent = 0;
+            } else {
+                return -1;
+            }
+        } else if (zs->zerocopy) {
+            zs->next++;
+            zs->sends++;
+        }
+    }
+
+    *ticket = zs->next;
+    return len;
+}
+
+/* Read all of the completion notifications that are waiting on the
+   socket's error queue. Returns the number of sends still outstanding,
+   or -1 on error. */
+
+int
+zcSendReap(struct zcSender *zs)
+{
+    struct sock_extended_err *serr;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    char control[CMSG_SPACE(sizeof(*serr) + sizeof(struct sockaddr_in6))];
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(zs->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+                cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!((cmsg->cmsg_level == SOL_IP &&
+                            cmsg->cmsg_type == IP_RECVERR) ||
+                    (cmsg->cmsg_level == SOL_IPV6 &&
+                            cmsg->cmsg_type == IPV6_RECVERR)))
+                continue;
+            serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+            if (serr->ee_errno != 0 ||
+                    serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            /* Sends ee_info to ee_data (inclusive) have completed */
+
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                zs->copied += serr->ee_data - serr->ee_info + 1;
+            if ((int32_t) (serr->ee_data + 1 - zs->done) > 0)
+                zs->done = serr->ee_data + 1;
+        }
+    }
+
+    return zs->next - zs->done;
+}
+
+/* Wait until the kernel has finished with the buffers of the sends
+   covered by 'ticket' (from zcSend()). Returns 0 on success, or -1 on
+   error. */
+
+int
+zcSendWait(struct zcSender *zs, uint32_t ticket)
+{
+    struct pollfd pfd;
+
+    for (;;) {
+        if (zcSendReap(zs) == -1)
+            return -1;
+        if ((int32_t) (zs->done - ticket) >= 0)
+            return 0;
+
+        /* A notification on the error queue is reported as POLLERR,
+           which poll() returns even if not requested */
+
+        pfd.fd = zs->fd;
+        pfd.events = 0;
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+            return -1;
+    }
+}
+
+/* Prepare 'zr' for receiving from the TCP socket 'fd', mapping data into
+   a window of 'windowLen' bytes (rounded up to a multiple of the page
+   size) if 'zerocopy' is nonzero and the kernel supports it (check
+   whether zr->map is NULL afterward). Returns 0 on success, or -1 on
+   error. */
+
+int
+zcReceiverInit(struct zcReceiver *zr, int fd, size_t windowLen,
+               int zerocopy)
+{
+    long pageSize;
+
+    memset(zr, 0, sizeof(*zr));
+    zr->fd = fd;
+    if (!zerocopy)
+        return 0;
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    zr->mapLen = (windowLen + pageSize - 1) / pageSize * pageSize;
+    zr->map = mmap(NULL, zr->mapLen, PROT_READ, MAP_SHARED, fd, 0);
+    if (zr->map == MAP_FAILED) {
+        zr->map = NULL;
+        if (errno != ENODEV && errno != EINVAL && errno != EOPNOTSUPP)
+            return -1;
+    }
+    return 0;
+}
+
+/* Receive the next run of data. On success, '*data' points to the data,
+   either mapped from the socket or copied into 'buf' (of 'bufLen'
+   bytes), and the number of bytes is returned; 0 is returned on
+   end-of-file. Returns -1 on error. */
+
+ssize_t
+zcRecv(struct zcReceiver *zr, const void **data, void *buf, size_t bufLen)
+{
+    struct tcp_zerocopy_receive zc;
+    struct pollfd pfd;
+    socklen_t optlen;
+    ssize_t numRead;
+    size_t n;
+    int waited;
+
+    /* Try to map data, waiting (once) for data to arrive if none has */
+
+    for (waited = 0; zr->map != NULL && zr->skip == 0; waited = 1) {
+        memset(&zc, 0, sizeof(zc));
+        zc.address = (uintptr_t) zr->map;
+        zc.length = zr->mapLen;
+        optlen = sizeof(zc);
+        if (getsockopt(zr->fd, IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE, &zc,
+                       &optlen) == -1) {
+            if (errno == EIO)   /* No data, and peer has shut down: */
+                break;          /* let recv() report end-of-file */
+            return -1;
+        }
+
+        if (zc.length > 0) {
+            *data = zr->map;
+            zr->mapped += zc.length;
+            return zc.length;
+        }
+
+        zr->skip = zc.recv_skip_hint;   /* Unaligned data must be copied */
+        if (zr->skip > 0 || waited)
+            break;      /* If still nothing: less than a page, or EOF */
+
+        pfd.fd = zr->fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR)
+            return -1;
+    }
+
+    /* Copy the bytes that can't be mapped (or everything, if we're not
+       mapping) */
+
+    n = (zr->skip > 0 && zr->skip < bufLen) ? zr->skip : bufLen;
+    do {
+        numRead = recv(zr->fd, buf, n, 0);
+    } while (numRead == -1 && errno == EINTR);
+    if (numRead <= 0)
+        return numRead;
+
+    zr->skip -= (zr->skip < (size_t) numRead) ? zr->skip : (size_t) numRead;
+    zr->copied += numRead;
+    *data = buf;
+    return numRead;
+}
+
+void
+zcReceiverFree(struct zcReceiver *zr)
+{
+    if (zr->map != NULL)
+        munmap(zr->map, zr->mapLen);
+    zr->map = NULL;
+}
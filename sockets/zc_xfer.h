@@ -0,0 +1,59 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 61 */
+
+/* zc_xfer.h
+
+   Header file for zc_xfer.c.
+*/
+#ifndef ZC_XFER_H
+#define ZC_XFER_H               /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <stdint.h>
+
+struct zcSender {
+    int fd;
+    int zerocopy;               /* Nonzero if sending with MSG_ZEROCOPY */
+    uint32_t next;              /* ID of the next zero-copy send() */
+    uint32_t done;              /* All sends with lower IDs have completed */
+    long long sends;            /* Number of zero-copy send() calls */
+    long long copied;           /* ... of which the kernel copied anyway */
+};
+
+int zcSenderInit(struct zcSender *zs, int fd, int zerocopy);
+
+ssize_t zcSend(struct zcSender *zs, const void *buf, size_t len,
+               uint32_t *ticket);
+
+int zcSendReap(struct zcSender *zs);
+
+int zcSendWait(struct zcSender *zs, uint32_t ticket);
+
+struct zcReceiver {
+    int fd;
+    void *map;                  /* Receive window mapped from socket, or
+                                   NULL if copying */
+    size_t mapLen;
+    size_t skip;                /* Bytes to copy before next mapping */
+    long long mapped;           /* Bytes received by mapping */
+    long long copied;           /* Bytes received by copying */
+};
+
+int zcReceiverInit(struct zcReceiver *zr, int fd, size_t windowLen,
+                   int zerocopy);
+
+ssize_t zcRecv(struct zcReceiver *zr, const void **data, void *buf,
+               size_t bufLen);
+
+void zcReceiverFree(struct zcReceiver *zr);
+
+#endif
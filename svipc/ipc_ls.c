@@ -0,0 +1,195 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 45 */
+
+/* ipc_ls.c
+
+   List System V IPC objects of one type, using ipcScan() (ipc_scan.c),
+   which reads /proc/sysvipc rather than probing each index (as
+   svmsg_ls.c does) when that is cheaper.
+
+   Usage: ipc_ls [-q | -s | -m] [-u user] [-k key] [-z size]
+                 [-S sort] [-r] [-p | -P] [-c] [-t]
+
+        -q        List message queues (the default)
+        -s        List semaphore sets
+        -m        List shared memory segments
+        -u user   Only objects owned by 'user' (a name or a UID)
+        -k key    Only objects with the key 'key' (decimal, or hex
+                  with a leading "0x")
+        -z size   Only objects of at least 'size' (bytes queued,
+                  semaphores, or segment size)
+        -S sort   Sort by 'sort': id, key, size, count, otime, ctime,
+                  or uid (default: the order listed by the kernel)
+        -r        Reverse the order of sorting
+        -p        Probe each index with *_STAT (by default, the method
+                  is chosen according to how full the table is)
+        -P        Read /proc/sysvipc
+        -c        Print only the number of objects
+        -t        Report, on stderr, how the objects were obtained, the
+                  number of system calls made, and the time taken
+
+   For each object, the program shows its key, ID, permissions, owner,
+   and the 'size' and 'count' fields of its 'ipcRec' record (bytes and
+   messages queued; semaphores; or segment size and attachments).
+
+   Try: ipc_ls -t -p and ipc_ls -t -P, when there are many objects (for
+        example, after creating thousands of queues with svmsg_create),
+        and again after removing most of them.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <time.h>
+#include "ipc_scan.h"
+#include "ugid_functions.h"
+#include "tlpi_hdr.h"
+
+static const char *sortNames[] = {
+    "", "id", "key", "size", "count", "otime", "ctime", "uid"
+};
+
+static const char *sizeHeads[] = { "bytes", "nsems", "size" };
+static const char *countHeads[] = { "messages", "", "nattch" };
+
+/* Return the name of the user 'uid', or NULL if there isn't one;
+   objects tend to have few different owners, so remember the last */
+
+static const char *
+ownerName(uid_t uid)
+{
+    static uid_t lastUid = (uid_t) -1;
+    static char *lastName;
+
+    if (uid != lastUid) {
+        lastUid = uid;
+        lastName = userNameFromId(uid);
+    }
+    return lastName;
+}
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-q | -s | -m] [-u user] [-k key] "
+            "[-z size]\n        [-S sort] [-r] [-p | -P] [-c] [-t]\n",
+            progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct ipcFilter filt;
+    struct ipcScanStats st;
+    struct ipcRec *recs, *r;
+    enum ipcType type;
+    enum ipcSortKey sortBy;
+    const char *name;
+    char *end;
+    long long t0;
+    Boolean reverse, countOnly, timing;
+    ssize_t n, j;
+    int opt, flags, k;
+
+    type = IPC_TYPE_MSG;
+    filt.uid = (uid_t) -1;
+    filt.keySet = 0;
+    filt.minSize = 0;
+    sortBy = IPC_SORT_NONE;
+    reverse = countOnly = timing = FALSE;
+    flags = 0;
+    while ((opt = getopt(argc, argv, "qsmu:k:z:S:rpPct")) != -1) {
+        switch (opt) {
+        case 'q':   type = IPC_TYPE_MSG;        break;
+        case 's':   type = IPC_TYPE_SEM;        break;
+        case 'm':   type = IPC_TYPE_SHM;        break;
+        case 'u':
+            filt.uid = strtoul(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0')
+                filt.uid = userIdFromName(optarg);
+            if (filt.uid == (uid_t) -1)
+                cmdLineErr("No such user: %s\n", optarg);
+            break;
+        case 'k':
+            filt.key = strtol(optarg, &end, 0);
+            if (*optarg == '\0' || *end != '\0')
+                cmdLineErr("Bad key: %s\n", optarg);
+            filt.keySet = 1;
+            break;
+        case 'z':   filt.minSize = getLong(optarg, GN_NONNEG, "-z"); break;
+        case 'S':
+            for (k = IPC_SORT_ID; k <= IPC_SORT_UID; k++)
+                if (strcmp(optarg, sortNames[k]) == 0)
+                    break;
+            if (k > IPC_SORT_UID)
+                cmdLineErr("Bad sort key: %s\n", optarg);
+            sortBy = k;
+            break;
+        case 'r':   reverse = TRUE;             break;
+        case 'p':   flags = IPS_PROBE;          break;
+        case 'P':   flags = IPS_PROC;           break;
+        case 'c':   countOnly = TRUE;           break;
+        case 't':   timing = TRUE;              break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+
+    t0 = nowNs();
+    n = ipcScan(type, &filt, flags, &recs, &st);
+    if (n == -1)
+        errExit("ipcScan");
+    ipcSort(recs, n, sortBy, reverse);
+    if (timing)
+        fprintf(stderr, "%s: %lu objects (%ld listed) in %.3f ms, "
+                "%lu system calls\n",
+                st.fromProc ? "/proc/sysvipc" : "probing", st.seen,
+                (long) n, (nowNs() - t0) / 1e6, st.calls);
+
+    if (countOnly) {
+        printf("%ld\n", (long) n);
+        free(recs);
+        exit(EXIT_SUCCESS);
+    }
+
+    printf("%-10s %10s %5s %-10s %12s %8s\n", "key", "id", "perms",
+           "owner", sizeHeads[type], countHeads[type]);
+    for (j = 0; j < n; j++) {
+        r = &recs[j];
+        printf("0x%08lx %10d %5o ", (unsigned long) r->key, r->id,
+               r->mode & 0777);
+        name = ownerName(r->uid);
+        if (name != NULL)
+            printf("%-10s ", name);
+        else
+            printf("%-10ld ", (long) r->uid);
+        printf("%12lu ", r->size);
+        if (type == IPC_TYPE_SEM)
+            printf("\n");
+        else
+            printf("%8lu\n", r->count);
+    }
+
+    free(recs);
+    exit(EXIT_SUCCESS);
+}
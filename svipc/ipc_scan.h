@@ -0,0 +1,72 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 45 */
+
+/* ipc_scan.h
+
+   Header file for ipc_scan.c.
+*/
+#ifndef IPC_SCAN_H
+#define IPC_SCAN_H              /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <time.h>
+
+enum ipcType { IPC_TYPE_MSG, IPC_TYPE_SEM, IPC_TYPE_SHM };
+
+struct ipcRec {                 /* One IPC object */
+    key_t key;
+    int id;
+    unsigned int mode;          /* Permissions (for shared memory, with
+                                   SHM_DEST and SHM_LOCKED) */
+    uid_t uid, gid;             /* Owner */
+    uid_t cuid, cgid;           /* Creator */
+    unsigned long size;         /* Message queue: bytes queued;
+                                   semaphore set: semaphores;
+                                   shared memory: segment size */
+    unsigned long count;        /* Message queue: messages queued;
+                                   shared memory: attachments */
+    pid_t pid1, pid2;           /* Message queue: last msgsnd() and
+                                   msgrcv(); shared memory: creator and
+                                   last shmat()/shmdt() */
+    time_t otime;               /* Last msgsnd(), semop(), or shmat() */
+    time_t ctime;               /* Last change */
+};
+
+struct ipcFilter {              /* Objects to include */
+    uid_t uid;                  /* Owner, or (uid_t) -1 for any */
+    key_t key;                  /* Key, if 'keySet' is nonzero */
+    int keySet;
+    unsigned long minSize;      /* Smallest 'size' */
+};
+
+#define IPS_PROBE       0x1     /* Probe each index with *_STAT */
+#define IPS_PROC        0x2     /* Read /proc/sysvipc (fail if it
+                                   can't be read) */
+
+enum ipcSortKey { IPC_SORT_NONE, IPC_SORT_ID, IPC_SORT_KEY,
+                  IPC_SORT_SIZE, IPC_SORT_COUNT, IPC_SORT_OTIME,
+                  IPC_SORT_CTIME, IPC_SORT_UID };
+
+struct ipcScanStats {
+    int fromProc;               /* Nonzero if /proc/sysvipc was read */
+    unsigned long calls;        /* *ctl() calls made when probing */
+    unsigned long seen;         /* Objects found, before filtering */
+};
+
+ssize_t ipcScan(enum ipcType type, const struct ipcFilter *f, int flags,
+                struct ipcRec **recs, struct ipcScanStats *st);
+
+void ipcSort(struct ipcRec *recs, size_t n, enum ipcSortKey by,
+             int reverse);
+
+#endif
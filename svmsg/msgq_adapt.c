@@ -0,0 +1,458 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 46 */
+
+/* msgq_adapt.c
+
+   Adaptive sizing of, and backpressure for, a System V message queue.
+
+   The monitor: mqaMonitorStart() creates a thread that samples the
+   queue with IPC_STAT every 'intervalMs' milliseconds. When the queue is
+   fuller than 'highPct' percent of its 'msg_qbytes' limit, the thread
+   doubles the limit (up to 'maxBytes'), using IPC_SET as in
+   svmsg_chqbytes.c; when it has been emptier than 'lowPct' percent for
+   'shrinkMs' milliseconds, the thread halves the limit (down to
+   'minBytes'). The kernel allocates memory only for messages that are
+   actually queued, so a small limit doesn't save memory while the
+   consumer keeps up; what it bounds is how much kernel memory a stalled
+   consumer can pin, and how stale the oldest queued message can become.
+   Raising 'msg_qbytes' above the 'msgmnb' limit requires privilege
+   (CAP_SYS_RESOURCE); if IPC_SET fails with EPERM, the monitor uses
+   'msgmnb' as its ceiling from then on. IPC_SET itself requires that
+   the caller own the queue (or be privileged).
+
+   The producer: mqaSend() sends with IPC_NOWAIT, so that it never blocks.
+   If the queue is full, the message is copied into a spill buffer of
+   'spillBytes' bytes, from which mqaFlush() later sends it; mqaSend()
+   flushes first, and spills a message if any earlier message is still
+   waiting, so that messages arrive in the order sent. When the spill
+   buffer is full too, mqaSend() fails with EAGAIN, and the caller
+   must decide whether to drop the message, wait (mqaFlush() with
+   'block' nonzero), or slow down. A producer object must be used by
+   only one thread at a time.
+
+   This module is Linux-specific.
+*/
+#include <sys/types.h>
+#include <sys/msg.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "msgq_adapt.h"         /* Declares functions defined here */
+
+struct mqaMonitor {
+    int msqid;
+    struct mqaParams p;
+    pthread_t tid;
+    pthread_mutex_t mtx;        /* Protects 'stop' and 'st' */
+    pthread_cond_t cond;        /* Signaled by mqaMonitorStop() */
+    int stop;
+    int err;                    /* errno of a failure that ended the
+                                   thread, or 0 */
+    struct mqaMonitorStats st;
+};
+
+/* Each message in the spill buffer is preceded by its 'msgsz'; records
+   are padded to a multiple of sizeof(long), so that the 'mtype' field
+   of each message is suitably aligned for msgsnd() */
+
+struct spillHdr {
+    size_t msgsz;
+    long pad;                   /* Keeps the header a multiple of
+                                   sizeof(long) in size */
+};
+
+struct mqaProducer {
+    int msqid;
+    char *buf;                  /* Spill buffer */
+    size_t cap;
+    size_t head;                /* Offset of oldest record */
+    size_t tail;                /* Offset just past newest record */
+    struct mqaProducerStats st;
+};
+
+void
+mqaDefaultParams(struct mqaParams *p)
+{
+    p->minBytes = 4096;
+    p->maxBytes = 0;
+    p->highPct = 75;
+    p->lowPct = 10;
+    p->intervalMs = 5;
+    p->shrinkMs = 1000;
+}
+
+/* Return the 'msgmnb' limit (the default 'msg_qbytes' of a new queue, and
+   the most that an unprivileged process may set), or 16384 (the kernel's
+   default) if it can't be read */
+
+static size_t
+readMsgmnb(void)
+{
+    FILE *fp;
+    long v;
+
+    fp = fopen("/proc/sys/kernel/msgmnb", "r");
+    if (fp == NULL)
+        return 16384;
+    if (fscanf(fp, "%ld", &v) != 1 || v <= 0)
+        v = 16384;
+    fclose(fp);
+    return v;
+}
+
+/* Set the queue's 'msg_qbytes' to 'qbytes', starting from the attributes
+   in 'ds' (as returned by IPC_STAT, since IPC_SET also sets the owner and
+   permissions). Returns 0 on success, or -1 on error. */
+
+static int
+setQbytes(struct mqaMonitor *m, struct msqid_ds *ds, size_t qbytes)
+{
+    ds->msg_qbytes = qbytes;
+    return msgctl(m->msqid, IPC_SET, ds);
+}
+
+static void *
+monitorFunc(void *arg)
+{
+    struct mqaMonitor *m = arg;
+    struct msqid_ds ds;
+    struct timespec deadline;
+    size_t qbytes, newQbytes, cbytes, msgmnb, ceiling;
+    long lowMs;                 /* How long the queue has been below
+                                   the low-water mark */
+    int s, err;
+
+    msgmnb = readMsgmnb();
+    ceiling = m->st.ceiling;
+    lowMs = 0;
+    err = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    pthread_mutex_lock(&m->mtx);
+    while (!m->stop) {
+        deadline.tv_nsec += m->p.intervalMs * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        s = pthread_cond_timedwait(&m->cond, &m->mtx, &deadline);
+        if (m->stop)
+            break;
+        if (s != 0 && s != ETIMEDOUT) {
+            err = s;
+            break;
+        }
+        pthread_mutex_unlock(&m->mtx);
+
+        if (msgctl(m->msqid, IPC_STAT, &ds) == -1) {
+            err = errno;        /* E.g., EINVAL: queue removed */
+            pthread_mutex_lock(&m->mtx);
+            break;
+        }
+        qbytes = ds.msg_qbytes;
+        cbytes = ds.__msg_cbytes;
+        newQbytes = qbytes;
+
+        if (cbytes * 100 >= qbytes * m->p.highPct) {
+            lowMs = 0;
+            if (qbytes < ceiling) {
+                newQbytes = qbytes * 2;
+                if (newQbytes > ceiling)
+                    newQbytes = ceiling;
+            }
+        } else if (cbytes * 100 <= qbytes * m->p.lowPct) {
+            lowMs += m->p.intervalMs;
+            if (lowMs >= m->p.shrinkMs && qbytes > m->p.minBytes) {
+                newQbytes = qbytes / 2;
+                if (newQbytes < m->p.minBytes)
+                    newQbytes = m->p.minBytes;
+                lowMs = 0;
+            }
+        } else {
+            lowMs = 0;
+        }
+
+        if (newQbytes != qbytes && setQbytes(m, &ds, newQbytes) == -1) {
+            if (errno == EPERM && newQbytes > msgmnb) {
+
+                /* Not privileged to exceed 'msgmnb': go no further than
+                   that, now or later */
+
+                ceiling = (msgmnb > qbytes) ? msgmnb : qbytes;
+                newQbytes = ceiling;
+                if (newQbytes != qbytes && setQbytes(m, &ds, newQbytes) == -1)
+                    err = errno;
+            } else {
+                err = errno;
+            }
+        }
+
+        pthread_mutex_lock(&m->mtx);
+        if (err != 0)
+            break;
+        m->st.samples++;
+        if (newQbytes > qbytes)
+            m->st.grows++;
+        else if (newQbytes < qbytes)
+            m->st.shrinks++;
+        m->st.qbytes = newQbytes;
+        m->st.ceiling = ceiling;
+        if (newQbytes > m->st.peakQbytes)
+            m->st.peakQbytes = newQbytes;
+        if (cbytes > m->st.peakCbytes)
+            m->st.peakCbytes = cbytes;
+    }
+    m->err = err;
+    pthread_mutex_unlock(&m->mtx);
+    return NULL;
+}
+
+/* Start a thread that adjusts the 'msg_qbytes' limit of the queue
+   'msqid' according to the parameters in 'p' (which may be NULL, to
+   use the defaults). Returns a handle for the other mqaMonitor*()
+   functions, or NULL on error. */
+
+struct mqaMonitor *
+mqaMonitorStart(int msqid, const struct mqaParams *p)
+{
+    struct mqaMonitor *m;
+    struct msqid_ds ds;
+    pthread_condattr_t cattr;
+    sigset_t all, prev;
+    int s;
+
+    if (msgctl(msqid, IPC_STAT, &ds) == -1)
+        return NULL;
+
+    m = calloc(1, sizeof(*m));
+    if (m == NULL)
+        return NULL;
+    m->msqid = msqid;
+    if (p != NULL)
+        m->p = *p;
+    else
+        mqaDefaultParams(&m->p);
+    if (m->p.intervalMs <= 0 || m->p.minBytes == 0 ||
+            m->p.lowPct >= m->p.highPct) {
+        free(m);
+        errno = EINVAL;
+        return NULL;
+    }
+    m->st.ceiling = (m->p.maxBytes != 0) ? m->p.maxBytes : readMsgmnb();
+    m->st.qbytes = m->st.peakQbytes = ds.msg_qbytes;
+
+    pthread_mutex_init(&m->mtx, NULL);
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&m->cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    /* The thread inherits our signal mask: block everything, so that
+       signals meant for the application aren't delivered to it */
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &prev);
+    s = pthread_create(&m->tid, NULL, monitorFunc, m);
+    pthread_sigmask(SIG_SETMASK, &prev, NULL);
+    if (s != 0) {
+        pthread_cond_destroy(&m->cond);
+        pthread_mutex_destroy(&m->mtx);
+        free(m);
+        errno = s;
+        return NULL;
+    }
+    return m;
+}
+
+void
+mqaMonitorGetStats(struct mqaMonitor *m, struct mqaMonitorStats *st)
+{
+    pthread_mutex_lock(&m->mtx);
+    *st = m->st;
+    pthread_mutex_unlock(&m->mtx);
+}
+
+/* Stop the monitor thread and free 'm'. Returns 0 if the thread ran
+   until stopped, or -1 (with 'errno' set) if it ended early because of
+   an error (for example, EINVAL if the queue was removed, or EPERM if
+   we don't own it). */
+
+int
+mqaMonitorStop(struct mqaMonitor *m)
+{
+    int err;
+
+    pthread_mutex_lock(&m->mtx);
+    m->stop = 1;
+    pthread_cond_signal(&m->cond);
+    pthread_mutex_unlock(&m->mtx);
+    pthread_join(m->tid, NULL);
+
+    err = m->err;
+    pthread_cond_destroy(&m->cond);
+    pthread_mutex_destroy(&m->mtx);
+    free(m);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/* Create a producer for the queue 'msqid', with a spill buffer of
+   'spillBytes' bytes (which may be 0, for no spilling). Returns a
+   handle for the other mqa*() producer functions, or NULL on error. */
+
+struct mqaProducer *
+mqaProducerOpen(int msqid, size_t spillBytes)
+{
+    struct mqaProducer *pr;
+
+    pr = calloc(1, sizeof(*pr));
+    if (pr == NULL)
+        return NULL;
+    pr->msqid = msqid;
+    pr->cap = spillBytes;
+    if (spillBytes > 0) {
+        pr->buf = malloc(spillBytes);
+        if (pr->buf == NULL) {
+            free(pr);
+            return NULL;
+        }
+    }
+    return pr;
+}
+
+/* Size of the spill record for a message with 'msgsz' bytes of text */
+
+static size_t
+recordSize(size_t msgsz)
+{
+    size_t len;
+
+    len = sizeof(struct spillHdr) + sizeof(long) + msgsz;
+    return (len + sizeof(long) - 1) / sizeof(long) * sizeof(long);
+}
+
+/* Copy a message into the spill buffer. Returns 0 on success, or -1 if
+   there is no room. */
+
+static int
+spill(struct mqaProducer *pr, const void *msgp, size_t msgsz)
+{
+    struct spillHdr *h;
+    size_t len;
+
+    len = recordSize(msgsz);
+    if (pr->tail + len > pr->cap && pr->head > 0) {
+
+        /* Move the pending records to the start of the buffer. This is
+           cheap in the common case, in which few records remain. */
+
+        memmove(pr->buf, pr->buf + pr->head, pr->tail - pr->head);
+        pr->tail -= pr->head;
+        pr->head = 0;
+    }
+    if (pr->tail + len > pr->cap)
+        return -1;
+
+    h = (struct spillHdr *) (pr->buf + pr->tail);
+    h->msgsz = msgsz;
+    memcpy(h + 1, msgp, sizeof(long) + msgsz);
+    pr->tail += len;
+
+    pr->st.spilled++;
+    pr->st.pending++;
+    if (pr->tail - pr->head > pr->st.peakSpillBytes)
+        pr->st.peakSpillBytes = pr->tail - pr->head;
+    return 0;
+}
+
+/* Send a message ('msgp' points to a structure whose first field is the
+   'long' message type, followed by 'msgsz' bytes of text), without
+   blocking. Returns 0 if the message was sent, 1 if it was saved in the
+   spill buffer (to be sent by a later call to mqaSend() or mqaFlush()),
+   or -1 on error. If the queue and the spill buffer are both full, the
+   message is discarded, and the call fails with EAGAIN. */
+
+int
+mqaSend(struct mqaProducer *pr, const void *msgp, size_t msgsz)
+{
+    if (pr->head != pr->tail && mqaFlush(pr, 0) == -1)
+        return -1;
+
+    if (pr->head == pr->tail) {         /* Nothing waiting: send directly */
+        for (;;) {
+            if (msgsnd(pr->msqid, msgp, msgsz, IPC_NOWAIT) == 0) {
+                pr->st.direct++;
+                return 0;
+            }
+            if (errno != EINTR)
+                break;
+        }
+        if (errno != EAGAIN)
+            return -1;
+    }
+
+    if (spill(pr, msgp, msgsz) == -1) {
+        pr->st.rejected++;
+        errno = EAGAIN;
+        return -1;
+    }
+    return 1;
+}
+
+/* Send the messages in the spill buffer, oldest first. If 'block' is
+   zero, stop when the queue is full; otherwise, wait for room. Returns
+   the number of messages still waiting, or -1 on error. */
+
+int
+mqaFlush(struct mqaProducer *pr, int block)
+{
+    struct spillHdr *h;
+
+    while (pr->head != pr->tail) {
+        h = (struct spillHdr *) (pr->buf + pr->head);
+        if (msgsnd(pr->msqid, h + 1, h->msgsz, block ? 0 : IPC_NOWAIT)
+                == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+            return -1;
+        }
+        pr->head += recordSize(h->msgsz);
+        pr->st.pending--;
+    }
+
+    if (pr->head == pr->tail)
+        pr->head = pr->tail = 0;
+    return pr->st.pending;
+}
+
+void
+mqaProducerGetStats(struct mqaProducer *pr, struct mqaProducerStats *st)
+{
+    *st = pr->st;
+}
+
+/* Free 'pr'. Any messages still in the spill buffer are discarded; call
+   mqaFlush() with 'block' nonzero first to avoid that. */
+
+void
+mqaProducerClose(struct mqaProducer *pr)
+{
+    free(pr->buf);
+    free(pr);
+}
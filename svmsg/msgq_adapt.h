@@ -0,0 +1,75 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 46 */
+
+/* msgq_adapt.h
+
+   Header file for msgq_adapt.c.
+*/
+#ifndef MSGQ_ADAPT_H
+#define MSGQ_ADAPT_H            /* Prevent accidental double inclusion */
+
+#include <stddef.h>
+
+struct mqaParams {
+    size_t minBytes;            /* Lowest 'msg_qbytes' (default: 4096) */
+    size_t maxBytes;            /* Highest 'msg_qbytes' (default: 0,
+                                   meaning /proc/sys/kernel/msgmnb) */
+    int highPct;                /* Double 'msg_qbytes' when the queue is
+                                   fuller than this (default: 75%) */
+    int lowPct;                 /* Halve it when the queue has been
+                                   emptier than this for 'shrinkMs'
+                                   (default: 10%) */
+    int intervalMs;             /* Sampling interval (default: 5) */
+    int shrinkMs;               /* Default: 1000 */
+};
+
+struct mqaMonitorStats {
+    unsigned long samples;      /* IPC_STAT calls */
+    unsigned long grows;        /* Increases of 'msg_qbytes' */
+    unsigned long shrinks;      /* Decreases */
+    size_t qbytes;              /* Current 'msg_qbytes' */
+    size_t peakQbytes;
+    size_t peakCbytes;          /* Largest 'msg_cbytes' seen */
+    size_t ceiling;             /* Effective 'maxBytes' */
+};
+
+struct mqaProducerStats {
+    unsigned long direct;       /* Messages sent at once */
+    unsigned long spilled;      /* Messages held in the spill buffer */
+    unsigned long rejected;     /* Messages refused (spill buffer full) */
+    unsigned long pending;      /* Messages now in the spill buffer */
+    size_t peakSpillBytes;
+};
+
+struct mqaMonitor;              /* Opaque; defined in msgq_adapt.c */
+struct mqaProducer;
+
+void mqaDefaultParams(struct mqaParams *p);
+
+struct mqaMonitor *mqaMonitorStart(int msqid, const struct mqaParams *p);
+
+void mqaMonitorGetStats(struct mqaMonitor *m, struct mqaMonitorStats *st);
+
+int mqaMonitorStop(struct mqaMonitor *m);
+
+struct mqaProducer *mqaProducerOpen(int msqid, size_t spillBytes);
+
+int mqaSend(struct mqaProducer *pr, const void *msgp, size_t msgsz);
+
+int mqaFlush(struct mqaProducer *pr, int block);
+
+void mqaProducerGetStats(struct mqaProducer *pr,
+                         struct mqaProducerStats *st);
+
+void mqaProducerClose(struct mqaProducer *pr);
+
+#endif
@@ -0,0 +1,328 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 46 */
+
+/* msgq_adapt_bench.c
+
+   Compare a System V message queue of fixed size, written with blocking
+   msgsnd() calls, with one whose size is adjusted by msgq_adapt.c's
+   monitor, written with mqaSend(), under bursts of messages.
+
+   Usage: msgq_adapt_bench [-b burst] [-p ms] [-r rounds] [-s size]
+                           [-c usecs] [-q qbytes] [-m maxbytes] [-S spill]
+
+        -b burst    Messages in each burst (default: 100)
+        -p ms       Interval between the starts of bursts (default: 100)
+        -r rounds   Number of bursts (default: 30)
+        -s size     Message text size (default: 256)
+        -c usecs    Time the consumer spends on each message (default: 20)
+        -q qbytes   'msg_qbytes' of the fixed queue, and the starting
+                    value for the adaptive one (default: 4096)
+        -m maxbytes Largest 'msg_qbytes' for the adaptive queue (default:
+                    /proc/sys/kernel/msgmnb; more requires privilege)
+        -S spill    Producer's spill buffer size (default: 1048576)
+
+   For each of three configurations ("fixed", a queue of 'qbytes' bytes;
+   "fixed-max", a queue of 'maxbytes' bytes; and "adaptive", a queue that
+   starts at 'qbytes' bytes, monitored by mqaMonitorStart()), a consumer
+   thread receives messages and spends 'usecs' microseconds on each,
+   while the main thread sends them in bursts. The program reports the
+   median, 99th percentile, and maximum latency of messages (from when
+   the producer tried to send a message until it was received), the
+   longest time the producer was held up by a single send and the total
+   time it was held up, the number of messages that were spilled and
+   that had to wait for room in the spill buffer, and the largest
+   'msg_qbytes' and 'msg_cbytes' that were used.
+
+   Try: msgq_adapt_bench
+        msgq_adapt_bench -b 400 -c 50 -S 32768
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/msg.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <time.h>
+#include "msgq_adapt.h"
+#include "lat_hist.h"
+#include "tlpi_hdr.h"
+
+#define MAX_SIZE 8192           /* Default 'msgmax' */
+
+#define MTYPE_DATA 1
+#define MTYPE_END 2             /* Tells the consumer to stop */
+
+struct benchMsg {
+    long mtype;
+    long long sentNs;           /* When the producer tried to send */
+    char pad[MAX_SIZE];
+};
+
+enum { MODE_FIXED, MODE_FIXED_MAX, MODE_ADAPTIVE, NUM_MODES };
+static const char *modeNames[] = { "fixed", "fixed-max", "adaptive" };
+
+static int msgSize, workUs;
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct consumer {
+    int msqid;
+    struct latHist hist;        /* Message latencies */
+    size_t peakCbytes;
+};
+
+/* Consumer thread: receive messages, recording their latencies, and
+   spend 'workUs' microseconds on each */
+
+static void *
+consumerFunc(void *arg)
+{
+    struct consumer *c = arg;
+    struct benchMsg msg;
+    struct msqid_ds ds;
+    long long t, until;
+
+    for (;;) {
+        if (msgrcv(c->msqid, &msg, MAX_SIZE, 0, 0) == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("msgrcv");
+        }
+        t = nowNs();
+        if (msg.mtype == MTYPE_END)
+            break;
+        latHistRecord(&c->hist, t - msg.sentNs);
+
+        if (msgctl(c->msqid, IPC_STAT, &ds) == -1)
+            errExit("msgctl-IPC_STAT");
+        if (ds.__msg_cbytes + msgSize > c->peakCbytes)
+            c->peakCbytes = ds.__msg_cbytes + msgSize;
+
+        for (until = t + workUs * 1000LL; nowNs() < until; )
+            continue;                   /* Busy wait: the "work" */
+    }
+    return NULL;
+}
+
+/* Set the 'msg_qbytes' limit of 'msqid'. Returns 0 on success, or -1
+   if we aren't privileged to set a value that large. */
+
+static int
+setQbytes(int msqid, size_t qbytes)
+{
+    struct msqid_ds ds;
+
+    if (msgctl(msqid, IPC_STAT, &ds) == -1)
+        errExit("msgctl-IPC_STAT");
+    ds.msg_qbytes = qbytes;
+    if (msgctl(msqid, IPC_SET, &ds) == -1) {
+        if (errno == EPERM)
+            return -1;
+        errExit("msgctl-IPC_SET");
+    }
+    return 0;
+}
+
+static void
+sleepUntil(long long ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+        continue;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-b burst] [-p ms] [-r rounds] [-s size]\n"
+            "        [-c usecs] [-q qbytes] [-m maxbytes] [-S spill]\n",
+            progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct mqaParams params;
+    struct mqaMonitor *mon;
+    struct mqaMonitorStats mst;
+    struct mqaProducer *pr;
+    struct mqaProducerStats pst;
+    struct consumer cons;
+    struct benchMsg msg;
+    struct msqid_ds ds;
+    pthread_t tid;
+    long long start, next, t0, t, stallNs, maxSendNs;
+    size_t qbytes, maxBytes, spillBytes, peakQbytes;
+    int opt, burst, periodMs, rounds, mode, round, j, s;
+
+    burst = 100;
+    periodMs = 100;
+    rounds = 30;
+    msgSize = 256;
+    workUs = 20;
+    qbytes = 4096;
+    maxBytes = 0;
+    spillBytes = 1024 * 1024;
+    while ((opt = getopt(argc, argv, "b:p:r:s:c:q:m:S:")) != -1) {
+        switch (opt) {
+        case 'b':   burst = getInt(optarg, GN_GT_0, "-b");          break;
+        case 'p':   periodMs = getInt(optarg, GN_GT_0, "-p");       break;
+        case 'r':   rounds = getInt(optarg, GN_GT_0, "-r");         break;
+        case 's':   msgSize = getInt(optarg, GN_GT_0, "-s");        break;
+        case 'c':   workUs = getInt(optarg, GN_NONNEG, "-c");       break;
+        case 'q':   qbytes = getLong(optarg, GN_GT_0, "-q");        break;
+        case 'm':   maxBytes = getLong(optarg, GN_GT_0, "-m");      break;
+        case 'S':   spillBytes = getLong(optarg, GN_NONNEG, "-S");  break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+    if (msgSize < (int) sizeof(long long) || msgSize > MAX_SIZE)
+        cmdLineErr("-s must be between %d and %d\n",
+                   (int) sizeof(long long), MAX_SIZE);
+
+    mqaDefaultParams(&params);
+    params.maxBytes = maxBytes;
+    if (params.minBytes > qbytes)
+        params.minBytes = qbytes;
+
+    memset(&msg, 0, sizeof(msg));
+    printf("%d bursts of %d x %d-byte messages every %d ms; "
+           "consumer %d us/message\n", rounds, burst, msgSize, periodMs,
+           workUs);
+    printf("%-9s %8s %8s %9s %9s %9s %9s %9s %7s %7s\n", "mode",
+           "qbytes", "cbytes", "lat-p50", "lat-p99", "lat-max",
+           "send-max", "stall-ms", "spills", "waits");
+
+    for (mode = 0; mode < NUM_MODES; mode++) {
+        cons.msqid = msgget(IPC_PRIVATE, IPC_CREAT | S_IRUSR | S_IWUSR);
+        if (cons.msqid == -1)
+            errExit("msgget");
+        latHistInit(&cons.hist);
+        cons.peakCbytes = 0;
+
+        mon = NULL;
+        pr = NULL;
+        if (mode == MODE_FIXED_MAX) {
+            if (maxBytes != 0 && setQbytes(cons.msqid, maxBytes) == -1)
+                printf("(-m %zu not permitted; using msgmnb)\n", maxBytes);
+        } else if (setQbytes(cons.msqid, qbytes) == -1) {
+            msgctl(cons.msqid, IPC_RMID, NULL);
+            cmdLineErr("-q %zu exceeds msgmnb\n", qbytes);
+        }
+        if (mode == MODE_ADAPTIVE) {
+            mon = mqaMonitorStart(cons.msqid, &params);
+            if (mon == NULL)
+                errExit("mqaMonitorStart");
+            pr = mqaProducerOpen(cons.msqid, spillBytes);
+            if (pr == NULL)
+                errExit("mqaProducerOpen");
+        }
+        if (msgctl(cons.msqid, IPC_STAT, &ds) == -1)
+            errExit("msgctl-IPC_STAT");
+        peakQbytes = ds.msg_qbytes;
+
+        s = pthread_create(&tid, NULL, consumerFunc, &cons);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+
+        stallNs = maxSendNs = 0;
+        start = nowNs();
+        for (round = 0; round < rounds; round++) {
+            next = start + (round + 1) * periodMs * 1000000LL;
+
+            for (j = 0; j < burst; j++) {
+                msg.mtype = MTYPE_DATA;
+                t0 = msg.sentNs = nowNs();
+                if (pr == NULL) {
+                    while (msgsnd(cons.msqid, &msg, msgSize, 0) == -1)
+                        if (errno != EINTR)
+                            errExit("msgsnd");
+                } else {
+
+                    /* If the spill buffer is full, wait for room */
+
+                    while (mqaSend(pr, &msg, msgSize) == -1) {
+                        if (errno != EAGAIN)
+                            errExit("mqaSend");
+                        if (mqaFlush(pr, 1) == -1)
+                            errExit("mqaFlush");
+                    }
+                }
+                t = nowNs() - t0;
+                stallNs += t;
+                if (t > maxSendNs)
+                    maxSendNs = t;
+            }
+
+            /* Between bursts, move spilled messages to the queue as
+               room appears */
+
+            if (pr != NULL) {
+                while (mqaFlush(pr, 0) > 0 && nowNs() < next)
+                    usleep(200);
+            }
+            sleepUntil(next);
+        }
+
+        if (pr != NULL) {
+            if (mqaFlush(pr, 1) == -1)
+                errExit("mqaFlush");
+            mqaProducerGetStats(pr, &pst);
+            mqaProducerClose(pr);
+        } else {
+            memset(&pst, 0, sizeof(pst));
+        }
+        msg.mtype = MTYPE_END;
+        while (msgsnd(cons.msqid, &msg, msgSize, 0) == -1)
+            if (errno != EINTR)
+                errExit("msgsnd");
+        s = pthread_join(tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+
+        if (mon != NULL) {
+            mqaMonitorGetStats(mon, &mst);
+            if (mqaMonitorStop(mon) == -1)
+                errExit("mqaMonitorStop");
+            peakQbytes = mst.peakQbytes;
+        }
+        if (msgctl(cons.msqid, IPC_RMID, NULL) == -1)
+            errExit("msgctl-IPC_RMID");
+
+        printf("%-9s %8zu %8zu %9.1f %9.1f %9.1f %9.1f %9.1f %7lu %7lu\n",
+               modeNames[mode], peakQbytes, cons.peakCbytes,
+               latHistPercentile(&cons.hist, 0.50) / 1000.0,
+               latHistPercentile(&cons.hist, 0.99) / 1000.0,
+               cons.hist.max / 1000.0, maxSendNs / 1000.0, stallNs / 1e6,
+               pst.spilled, pst.rejected);
+        if (mon != NULL)
+            printf("%-9s %lu grows, %lu shrinks, ceiling %zu\n", "",
+                   mst.grows, mst.shrinks, mst.ceiling);
+        fflush(stdout);
+    }
+
+    exit(EXIT_SUCCESS);
+}
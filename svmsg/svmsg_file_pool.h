@@ -0,0 +1,64 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 46 */
+
+/* svmsg_file_pool.h
+
+   Header file for svmsg_file_pool_server.c and svmsg_file_pool_client.c.
+
+   The protocol is an extension of the one used by svmsg_file_server.c
+   (see svmsg_file.h): a request additionally specifies the maximum size
+   of the response messages that the client is prepared to receive, and
+   whether the client will accept a file via a POSIX shared memory object
+   instead of a series of data messages.
+*/
+#ifndef SVMSG_FILE_POOL_H
+#define SVMSG_FILE_POOL_H
+
+#include "svmsg_file.h"
+
+#define POOL_SERVER_KEY 0x1aaaaaa2      /* Key for server's message queue */
+
+#define REQ_FL_SHM 1                    /* Client accepts RESP_MT_SHM */
+
+struct poolRequestMsg {                 /* Requests (client to server) */
+    long mtype;                         /* Unused */
+    int  clientId;                      /* ID of client's message queue */
+    int  msgSize;                       /* Max. size of response 'data' */
+    int  flags;                         /* REQ_FL_* */
+    char pathname[PATH_MAX];            /* File to be returned */
+};
+
+#define MIN_MSG_SIZE 512                /* Smallest permitted 'msgSize' */
+
+#define POOL_REQ_MSG_SIZE (offsetof(struct poolRequestMsg, pathname) - \
+                           offsetof(struct poolRequestMsg, clientId) + \
+                           PATH_MAX)
+
+/* Responses have the same form as 'struct responseMsg', but the size of
+   the 'data' field is determined at run time (and is at most the
+   'msgSize' specified in the request); such messages are allocated with
+   RESP_ALLOC_SIZE(msgSize) bytes. The types are the RESP_MT_* values
+   from svmsg_file.h, plus: */
+
+#define RESP_MT_SHM     4               /* File is in a shared memory object;
+                                           message contains a shmRef */
+
+#define RESP_ALLOC_SIZE(msgSize) (offsetof(struct responseMsg, data) + \
+                                  (msgSize))
+
+struct shmRef {                         /* 'data' for RESP_MT_SHM */
+    off_t size;                         /* Size of file */
+    char name[NAME_MAX];                /* Name for shm_open(); the client
+                                           must shm_unlink() the object */
+};
+
+#endif
@@ -0,0 +1,192 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 46 */
+
+/* svmsg_file_pool_client.c
+
+   A client for svmsg_file_pool_server.c. Like svmsg_file_client.c, it
+   requests the contents of the file named on its command line, but it
+   can repeat the request a number of times and reports the throughput.
+
+   Usage: svmsg_file_pool_client [-s msg-size] [-S] [-n count] pathname
+
+        -s msg-size   Size of the response messages to request (default:
+                      RESP_MSG_SIZE, 8192). The server may use a smaller
+                      size.
+        -S            Accept the file via a POSIX shared memory object, if
+                      the server is willing to send it that way
+        -n count      Request the file 'count' times (default: 1)
+
+   On completion, the program displays the number of bytes and messages
+   received, the number of requests, messages, and bytes per second, and
+   the number of files that were received via shared memory.
+*/
+#include <sys/mman.h>
+#include <time.h>
+#include "svmsg_file_pool.h"
+
+static int clientId;
+
+static void
+removeQueue(void)
+{
+    if (msgctl(clientId, IPC_RMID, NULL) == -1)
+        errExit("msgctl");
+}
+
+/* Map, read, and unlink the shared memory object described by 'ref',
+   returning the number of bytes that it contains */
+
+static off_t
+receiveShm(const struct shmRef *ref)
+{
+    volatile char sum;
+    char *addr;
+    int fd;
+
+    fd = shm_open(ref->name, O_RDONLY, 0);
+    if (fd == -1)
+        errExit("shm_open: %s", ref->name);
+    if (shm_unlink(ref->name) == -1)
+        errExit("shm_unlink");
+
+    if (ref->size > 0) {
+        addr = mmap(NULL, ref->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED)
+            errExit("mmap");
+
+        /* Touch each page, to be comparable with receiving the data
+           via msgrcv() */
+
+        sum = 0;
+        for (off_t off = 0; off < ref->size; off += 4096)
+            sum += addr[off];
+
+        if (munmap(addr, ref->size) == -1)
+            errExit("munmap");
+    }
+
+    close(fd);
+    return ref->size;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-s msg-size] [-S] [-n count] pathname\n",
+            progName);
+    fprintf(stderr, "    -s msg-size   Response message size (default: %d)\n",
+            RESP_MSG_SIZE);
+    fprintf(stderr, "    -S            Accept file via shared memory\n");
+    fprintf(stderr, "    -n count      Number of requests (default: 1)\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct poolRequestMsg req;
+    struct responseMsg *resp;
+    struct timespec start, end;
+    int serverId, opt, msgSize, flags, count, j;
+    long numMsgs, numShm;
+    ssize_t msgLen;
+    off_t totBytes;
+    double secs;
+
+    msgSize = RESP_MSG_SIZE;
+    flags = 0;
+    count = 1;
+    while ((opt = getopt(argc, argv, "s:Sn:")) != -1) {
+        switch (opt) {
+        case 's':   msgSize = getInt(optarg, GN_GT_0 | GN_ANY_BASE,
+                                     "msg-size");                   break;
+        case 'S':   flags |= REQ_FL_SHM;                            break;
+        case 'n':   count = getInt(optarg, GN_GT_0, "count");       break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1 || msgSize < MIN_MSG_SIZE)
+        usageError(argv[0]);
+
+    if (strlen(argv[optind]) > sizeof(req.pathname) - 1)
+        cmdLineErr("pathname too long (max: %ld bytes)\n",
+                (long) sizeof(req.pathname) - 1);
+
+    resp = malloc(RESP_ALLOC_SIZE(msgSize));
+    if (resp == NULL)
+        errExit("malloc");
+
+    /* Get server's queue identifier; create queue for response */
+
+    serverId = msgget(POOL_SERVER_KEY, S_IWUSR);
+    if (serverId == -1)
+        errExit("msgget - server message queue");
+
+    clientId = msgget(IPC_PRIVATE, S_IRUSR | S_IWUSR | S_IWGRP);
+    if (clientId == -1)
+        errExit("msgget - client message queue");
+
+    if (atexit(removeQueue) != 0)
+        errExit("atexit");
+
+    req.mtype = 1;                      /* Any type will do */
+    req.clientId = clientId;
+    req.msgSize = msgSize;
+    req.flags = flags;
+    strncpy(req.pathname, argv[optind], sizeof(req.pathname) - 1);
+    req.pathname[sizeof(req.pathname) - 1] = '\0';
+
+    totBytes = 0;
+    numMsgs = numShm = 0;
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+
+    for (j = 0; j < count; j++) {
+        if (msgsnd(serverId, &req, POOL_REQ_MSG_SIZE, 0) == -1)
+            errExit("msgsnd");
+
+        /* Receive messages until end of file (or failure) */
+
+        do {
+            msgLen = msgrcv(clientId, resp, msgSize, 0, 0);
+            if (msgLen == -1)
+                errExit("msgrcv");
+            numMsgs++;
+
+            if (resp->mtype == RESP_MT_FAILURE) {
+                printf("%s\n", resp->data);
+                exit(EXIT_FAILURE);
+            }
+
+            if (resp->mtype == RESP_MT_SHM) {
+                totBytes += receiveShm((struct shmRef *) resp->data);
+                numShm++;
+            } else {
+                totBytes += msgLen;
+            }
+        } while (resp->mtype == RESP_MT_DATA);
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("Received %lld bytes (%ld messages) in %d request(s)\n",
+            (long long) totBytes, numMsgs, count);
+    if (numShm > 0)
+        printf("%ld file(s) received via shared memory\n", numShm);
+    printf("%.3f s: %.0f requests/s; %.0f messages/s; %.2f MB/s\n",
+            secs, count / secs, numMsgs / secs, totBytes / 1e6 / secs);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,315 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 46 */
+
+/* svmsg_file_pool_server.c
+
+   A version of the file server in svmsg_file_server.c that, rather than
+   forking a new child for each request, serves requests using a fixed
+   pool of workers that are created at start-up. Each worker repeatedly
+   calls msgrcv() on the server's queue and serves the request that it
+   receives; the kernel ensures that each request is delivered to just one
+   worker, so no dispatcher is needed. The cost of a fork() per request,
+   which dominates when clients request many small files, is eliminated.
+
+   Usage: svmsg_file_pool_server [-w nworkers] [-p] [-s max-msg-size]
+                                 [-S shm-threshold]
+
+        -w nworkers      Number of workers (default: 4)
+        -p               Use pre-forked worker processes rather than
+                         threads
+        -s max-msg-size  Largest response message that will be sent
+                         (default and maximum: the system's 'msgmax'
+                         limit, from /proc/sys/kernel/msgmax). Each client
+                         specifies the size of the messages that it wants;
+                         this option caps that size.
+        -S threshold     If a client permits it, send files of at least
+                         'threshold' bytes via a POSIX shared memory object,
+                         rather than copying them through the message queue
+                         (default: never)
+
+   When a file is sent via shared memory, the server creates a shared
+   memory object, copies the file into it, and sends the client a single
+   RESP_MT_SHM message containing the object's name and size; the client
+   maps the object and is responsible for unlinking it. (Note that an
+   individual message can't be larger than the queue's 'msg_qbytes'
+   limit, which by default is 'msgmnb'; see svmsg_chqbytes.c.)
+
+   The server terminates, removing its queue, on receipt of SIGINT or
+   SIGTERM.
+
+   See svmsg_file_pool_client.c for a corresponding client.
+*/
+#include <sys/mman.h>
+#include <pthread.h>
+#include "svmsg_file_pool.h"
+
+#define MAX_WORKERS 1024
+
+static int serverId;
+static int maxMsgSize;
+static off_t shmThreshold = -1;         /* -1 == don't use shared memory */
+
+/* Return the system's limit on the size of a message, or RESP_MSG_SIZE
+   if it can't be determined */
+
+static int
+getMsgMax(void)
+{
+    FILE *fp;
+    int msgmax;
+
+    fp = fopen("/proc/sys/kernel/msgmax", "r");
+    if (fp == NULL)
+        return RESP_MSG_SIZE;
+    if (fscanf(fp, "%d", &msgmax) != 1 || msgmax <= 0)
+        msgmax = RESP_MSG_SIZE;
+    fclose(fp);
+    return msgmax;
+}
+
+/* Copy the file open on 'fd', of size 'size', into a new shared memory
+   object, and send its name to the client. Returns 0 on success, or -1
+   if the shared memory object couldn't be created (in which case the
+   caller falls back to sending the data in messages). */
+
+static int
+sendViaShm(int fd, off_t size, int clientId, struct responseMsg *resp)
+{
+    static unsigned long seq;           /* Makes names unique */
+    struct shmRef *ref = (struct shmRef *) resp->data;
+    unsigned long mySeq;
+    ssize_t numRead;
+    char *addr;
+    off_t off;
+    int shmFd;
+
+    mySeq = __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED);
+    snprintf(ref->name, sizeof(ref->name), "/svmsg_file.%ld.%lu",
+             (long) getpid(), mySeq);
+
+    shmFd = shm_open(ref->name, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    if (shmFd == -1)
+        return -1;
+
+    if (ftruncate(shmFd, size) == -1)
+        goto fail;
+
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shmFd, 0);
+    if (addr == MAP_FAILED)
+        goto fail;
+    close(shmFd);
+
+    /* read() directly into the mapping: a single copy of the data, as
+       opposed to the two made by msgsnd() and msgrcv() */
+
+    for (off = 0; off < size; off += numRead) {
+        numRead = pread(fd, addr + off, size - off, off);
+        if (numRead <= 0)
+            break;
+    }
+    munmap(addr, size);
+
+    ref->size = off;                    /* File may have shrunk */
+    resp->mtype = RESP_MT_SHM;
+    if (msgsnd(clientId, resp, sizeof(struct shmRef), 0) == -1)
+        shm_unlink(ref->name);          /* The client can't do so */
+    return 0;
+
+fail:
+    close(shmFd);
+    shm_unlink(ref->name);
+    return -1;
+}
+
+/* Serve a single client request, using the response buffer 'resp',
+   which has space for 'maxMsgSize' bytes of data */
+
+static void
+serveRequest(const struct poolRequestMsg *req, struct responseMsg *resp)
+{
+    struct stat sb;
+    ssize_t numRead;
+    int fd, msgSize;
+
+    msgSize = req->msgSize;
+    if (msgSize < MIN_MSG_SIZE || msgSize > maxMsgSize)
+        msgSize = maxMsgSize;
+
+    fd = open(req->pathname, O_RDONLY);
+    if (fd == -1) {                     /* Open failed: send error text */
+        resp->mtype = RESP_MT_FAILURE;
+        snprintf(resp->data, msgSize, "%s", "Couldn't open");
+        msgsnd(req->clientId, resp, strlen(resp->data) + 1, 0);
+        return;
+    }
+
+    if (shmThreshold >= 0 && (req->flags & REQ_FL_SHM) &&
+            msgSize >= (int) sizeof(struct shmRef) &&
+            fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0 &&
+            sb.st_size >= shmThreshold &&
+            sendViaShm(fd, sb.st_size, req->clientId, resp) == 0) {
+        close(fd);
+        return;
+    }
+
+    /* Transmit file contents in messages with type RESP_MT_DATA. We don't
+       diagnose read() and msgsnd() errors since we can't notify client. */
+
+    resp->mtype = RESP_MT_DATA;
+    while ((numRead = read(fd, resp->data, msgSize)) > 0)
+        if (msgsnd(req->clientId, resp, numRead, 0) == -1)
+            break;
+    close(fd);
+
+    /* Send a message of type RESP_MT_END to signify end-of-file */
+
+    resp->mtype = RESP_MT_END;
+    msgsnd(req->clientId, resp, 0, 0);          /* Zero-length mtext */
+}
+
+/* Each worker (thread or process) loops, receiving and serving requests,
+   until the server queue is removed */
+
+static void *
+worker(void *arg)
+{
+    struct poolRequestMsg req;
+    struct responseMsg *resp;
+    ssize_t msgLen;
+
+    resp = malloc(RESP_ALLOC_SIZE(maxMsgSize));
+    if (resp == NULL)
+        errExit("malloc");
+
+    for (;;) {
+        msgLen = msgrcv(serverId, &req, POOL_REQ_MSG_SIZE, 0, 0);
+        if (msgLen == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EIDRM)         /* EIDRM: server is terminating */
+                errMsg("msgrcv");
+            break;
+        }
+
+        req.pathname[sizeof(req.pathname) - 1] = '\0';
+        serveRequest(&req, resp);
+    }
+
+    free(resp);
+    return NULL;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-w nworkers] [-p] [-s max-msg-size] "
+                    "[-S shm-threshold]\n", progName);
+    fprintf(stderr, "    -w nworkers   Number of workers (default: 4)\n");
+    fprintf(stderr, "    -p            Use processes rather than threads\n");
+    fprintf(stderr, "    -s size       Maximum message size (default: "
+                    "msgmax)\n");
+    fprintf(stderr, "    -S threshold  Send files of at least 'threshold' "
+                    "bytes via shared memory\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    pthread_t tid[MAX_WORKERS];
+    pid_t pid[MAX_WORKERS];
+    int opt, nworkers, msgmax, sig, j, s;
+    Boolean useProcs;
+    sigset_t termSigs;
+
+    nworkers = 4;
+    useProcs = FALSE;
+    msgmax = getMsgMax();
+    maxMsgSize = msgmax;
+    while ((opt = getopt(argc, argv, "w:ps:S:")) != -1) {
+        switch (opt) {
+        case 'w':   nworkers = getInt(optarg, GN_GT_0, "nworkers");     break;
+        case 'p':   useProcs = TRUE;                                    break;
+        case 's':   maxMsgSize = getInt(optarg, GN_GT_0 | GN_ANY_BASE,
+                                        "max-msg-size");                break;
+        case 'S':   shmThreshold = getLong(optarg, GN_NONNEG | GN_ANY_BASE,
+                                           "shm-threshold");            break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc || nworkers > MAX_WORKERS)
+        usageError(argv[0]);
+    if (maxMsgSize > msgmax || maxMsgSize < MIN_MSG_SIZE)
+        cmdLineErr("max-msg-size must be in the range %d..%d\n",
+                MIN_MSG_SIZE, msgmax);
+
+    /* Create server message queue */
+
+    serverId = msgget(POOL_SERVER_KEY, IPC_CREAT | IPC_EXCL |
+                            S_IRUSR | S_IWUSR | S_IWGRP);
+    if (serverId == -1)
+        errExit("msgget");
+
+    /* Block the termination signals, so that they are delivered only via
+       sigwait() in the main thread (threads and children inherit the
+       signal mask) */
+
+    sigemptyset(&termSigs);
+    sigaddset(&termSigs, SIGINT);
+    sigaddset(&termSigs, SIGTERM);
+    s = pthread_sigmask(SIG_BLOCK, &termSigs, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_sigmask");
+
+    for (j = 0; j < nworkers; j++) {
+        if (useProcs) {
+            pid[j] = fork();
+            if (pid[j] == -1)
+                errExit("fork");
+            if (pid[j] == 0) {
+                worker(NULL);
+                _exit(EXIT_SUCCESS);
+            }
+        } else {
+            s = pthread_create(&tid[j], NULL, worker, NULL);
+            if (s != 0)
+                errExitEN(s, "pthread_create");
+        }
+    }
+
+    printf("%d %s serving requests (max. message size: %d)\n", nworkers,
+            useProcs ? "processes" : "threads", maxMsgSize);
+
+    s = sigwait(&termSigs, &sig);
+    if (s != 0)
+        errExitEN(s, "sigwait");
+
+    /* Removing the queue causes the workers' msgrcv() calls to fail
+       with EIDRM, so that they terminate */
+
+    if (msgctl(serverId, IPC_RMID, NULL) == -1)
+        errExit("msgctl");
+
+    for (j = 0; j < nworkers; j++) {
+        if (useProcs) {
+            if (waitpid(pid[j], NULL, 0) == -1)
+                errExit("waitpid");
+        } else {
+            s = pthread_join(tid[j], NULL);
+            if (s != 0)
+                errExitEN(s, "pthread_join");
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,208 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 47 */
+
+/* futex_binary_sems.c
+
+   Implement the binary semaphore protocol of binary_sems.c using a futex
+   word in shared memory. Reserving an available semaphore and releasing
+   a semaphore for which no process is waiting are each a single atomic
+   instruction; a system call (futex()) is made only under contention.
+
+   In the default (nonrobust) case, the futex word has three states:
+
+        0 (FS_AVAILABLE)    the semaphore is available
+        1 (FS_IN_USE)       the semaphore is in use, and no process is
+                            waiting for it
+        2 (FS_CONTENDED)    the semaphore is in use, and processes may be
+                            waiting for it (so that releaseFsem() must
+                            issue FUTEX_WAKE)
+
+   (This is the algorithm described in Ulrich Drepper's paper "Futexes Are
+   Tricky".)
+
+   If 'fsRobust' is true when a semaphore is initialized, the futex word
+   instead holds 0 when the semaphore is available, or else the PID of the
+   process that last reserved it (or that initialized it as in use), ORed
+   with FS_WAITERS if processes may be waiting. A waiter sleeps in FUTEX_WAIT
+   for at most ROBUST_POLL_MS milliseconds at a time, after which it checks
+   whether the recorded owner still exists. If it does not, the waiter takes
+   over the semaphore, and reserveFsem() returns -1 with 'errno' set to
+   EOWNERDEAD; as with pthread_mutex_lock() on a robust mutex, the caller
+   then holds the semaphore, and must decide whether the data protected by
+   it is consistent. (The kernel's robust futex list can't be used here,
+   since glibc already uses the per-thread list for its own robust
+   mutexes.) Owner-died detection is based on the PID, and so can be
+   defeated by PID reuse.
+
+   Because the futex words are shared between processes, the non-private
+   futex operations are used.
+
+   This code is Linux-specific.
+*/
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <time.h>
+#include "futex_binary_sems.h"
+
+#define FS_AVAILABLE  0
+#define FS_IN_USE     1
+#define FS_CONTENDED  2
+
+#define FS_WAITERS   0x80000000U        /* For robust semaphores */
+
+#define ROBUST_POLL_MS 100
+
+Boolean fsRobust = FALSE;
+Boolean fsRetryOnEintr = TRUE;
+
+static int
+futexWait(uint32_t *word, uint32_t val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, word, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static int
+futexWake(uint32_t *word, int n)
+{
+    return syscall(SYS_futex, word, FUTEX_WAKE, n, NULL, NULL, 0);
+}
+
+int                     /* Initialize semaphore to "available" */
+initFsemAvailable(struct fsem *sems, int semNum)
+{
+    sems[semNum].robust = fsRobust;
+    __atomic_store_n(&sems[semNum].word, FS_AVAILABLE, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int                     /* Initialize semaphore to "in use" */
+initFsemInUse(struct fsem *sems, int semNum)
+{
+    sems[semNum].robust = fsRobust;
+    __atomic_store_n(&sems[semNum].word,
+                     fsRobust ? (uint32_t) getpid() : FS_IN_USE,
+                     __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* Reserve a robust semaphore; see the comments at the top of this file */
+
+static int
+reserveRobust(uint32_t *word)
+{
+    uint32_t self, c;
+    pid_t owner;
+    struct timespec ts;
+
+    self = getpid();
+    c = FS_AVAILABLE;
+    if (__atomic_compare_exchange_n(word, &c, self, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return 0;                       /* Uncontended */
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = ROBUST_POLL_MS * 1000000L;
+
+    for (;;) {
+        if (c == FS_AVAILABLE) {
+
+            /* Another process may be waiting, so be conservative and
+               set FS_WAITERS, so that our release wakes it */
+
+            if (__atomic_compare_exchange_n(word, &c, self | FS_WAITERS, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return 0;
+            continue;                   /* 'c' was updated */
+        }
+
+        if (!(c & FS_WAITERS)) {
+            if (!__atomic_compare_exchange_n(word, &c, c | FS_WAITERS, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                continue;               /* 'c' was updated */
+            c |= FS_WAITERS;
+        }
+
+        if (futexWait(word, c, &ts) == -1) {
+            if (errno == EINTR && !fsRetryOnEintr)
+                return -1;
+
+            if (errno == ETIMEDOUT) {   /* Is the owner still alive? */
+                owner = c & ~FS_WAITERS;
+                if (kill(owner, 0) == -1 && errno == ESRCH &&
+                        __atomic_compare_exchange_n(word, &c,
+                                        self | FS_WAITERS, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                    errno = EOWNERDEAD;
+                    return -1;          /* But we now hold the semaphore */
+                }
+            } else if (errno != EAGAIN && errno != EINTR) {
+                return -1;
+            }
+        }
+
+        c = __atomic_load_n(word, __ATOMIC_RELAXED);
+    }
+}
+
+/* Reserve semaphore (blocking), return 0 on success, or -1 with 'errno'
+   set to EINTR if operation was interrupted by a signal handler, or to
+   EOWNERDEAD (robust semaphores only) if the semaphore was acquired
+   after its previous owner terminated */
+
+int                     /* Reserve semaphore */
+reserveFsem(struct fsem *sems, int semNum)
+{
+    uint32_t *word = &sems[semNum].word;
+    uint32_t c;
+
+    if (sems[semNum].robust)
+        return reserveRobust(word);
+
+    c = FS_AVAILABLE;
+    if (__atomic_compare_exchange_n(word, &c, FS_IN_USE, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return 0;                       /* Uncontended: no system call */
+
+    /* Mark the semaphore as contended; if the exchange shows that it
+       had meanwhile become available, then we have acquired it */
+
+    if (c != FS_CONTENDED)
+        c = __atomic_exchange_n(word, FS_CONTENDED, __ATOMIC_ACQUIRE);
+
+    while (c != FS_AVAILABLE) {
+        if (futexWait(word, FS_CONTENDED, NULL) == -1) {
+            if (errno == EINTR && !fsRetryOnEintr)
+                return -1;
+            if (errno != EAGAIN && errno != EINTR)
+                return -1;
+        }
+        c = __atomic_exchange_n(word, FS_CONTENDED, __ATOMIC_ACQUIRE);
+    }
+
+    return 0;
+}
+
+int                     /* Release semaphore */
+releaseFsem(struct fsem *sems, int semNum)
+{
+    uint32_t *word = &sems[semNum].word;
+    uint32_t old;
+
+    old = __atomic_exchange_n(word, FS_AVAILABLE, __ATOMIC_RELEASE);
+
+    if (sems[semNum].robust ? (old & FS_WAITERS) : (old == FS_CONTENDED))
+        if (futexWake(word, 1) == -1)
+            return -1;
+
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 47 */
+
+/* futex_binary_sems.h
+
+   Header file for futex_binary_sems.c.
+
+   The functions correspond to those in binary_sems.h, but operate on an
+   array of 'struct fsem' (which must be placed in memory shared by the
+   cooperating processes) instead of a System V semaphore set:
+
+        binary_sems.c                   futex_binary_sems.c
+        initSemAvailable(semId, n)      initFsemAvailable(sems, n)
+        initSemInUse(semId, n)          initFsemInUse(sems, n)
+        reserveSem(semId, n)            reserveFsem(sems, n)
+        releaseSem(semId, n)            releaseFsem(sems, n)
+*/
+#ifndef FUTEX_BINARY_SEMS_H     /* Prevent accidental double inclusion */
+#define FUTEX_BINARY_SEMS_H
+
+#include <stdint.h>
+#include "tlpi_hdr.h"
+
+struct fsem {
+    uint32_t word;              /* Futex word; see futex_binary_sems.c */
+    uint32_t robust;            /* Nonzero if 'word' records owner's PID */
+};
+
+/* Variables controlling operation of functions below */
+
+extern Boolean fsRobust;                /* Initialize semaphores as robust? */
+extern Boolean fsRetryOnEintr;          /* Retry if futex wait interrupted
+                                           by signal handler? */
+
+int initFsemAvailable(struct fsem *sems, int semNum);
+
+int initFsemInUse(struct fsem *sems, int semNum);
+
+int reserveFsem(struct fsem *sems, int semNum);
+
+int releaseFsem(struct fsem *sems, int semNum);
+
+#endif
@@ -0,0 +1,224 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 47 */
+
+/* futex_event_flags.c
+
+   Implement groups of 64 event flags in shared memory using atomic
+   operations and futexes.
+
+   See futex_event_flags.h for a summary of the interface.
+
+   Setting and clearing flags are single atomic operations on the 64-bit
+   'flags' field. Futex words are 32 bits, so a waiter sleeps on whichever
+   32-bit halves of 'flags' contain bits of its mask:
+
+   *  If the mask lies within one half, the waiter uses FUTEX_WAIT_BITSET
+      with its mask (for that half) as the bitset. efgSet() wakes with
+      FUTEX_WAKE_BITSET, using the newly set bits as the bitset, so that
+      only waiters interested in one of those bits are woken.
+
+   *  Otherwise, the waiter uses futex_waitv() (Linux 5.16 and later) to
+      wait on both halves at once. Such waiters are woken by any newly set
+      flag, and then recheck their condition.
+
+   A wait-all waiter may thus be woken when only some of its flags have
+   been set; it then sleeps again. efgSet() makes a futex() call only if
+   it sets a flag that was clear and some process is waiting.
+
+   Because the groups are shared between processes, the non-private futex
+   operations are used. Timeouts are measured against CLOCK_MONOTONIC.
+
+   This code is Linux-specific.
+*/
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <time.h>
+#include "futex_event_flags.h"
+#include "tlpi_hdr.h"
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define LO_HALF 0               /* Index of 32-bit half holding flags 0-31 */
+#else
+#define LO_HALF 1
+#endif
+#define HI_HALF (1 - LO_HALF)
+
+/* Return the futex word holding flags 0-31 (half == LO_HALF) or
+   32-63 (half == HI_HALF) */
+
+static uint32_t *
+halfWord(struct efGroup *grp, int half)
+{
+    return (uint32_t *) &grp->flags + half;
+}
+
+static uint32_t
+halfBits(uint64_t mask, int half)
+{
+    return (half == LO_HALF) ? (uint32_t) mask : (uint32_t) (mask >> 32);
+}
+
+int
+efgInit(struct efGroup *grp, uint64_t initial)
+{
+    __atomic_store_n(&grp->waiters, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&grp->flags, initial, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+/* Set the flags in 'mask', waking waiters interested in any flag that
+   was not already set */
+
+int
+efgSet(struct efGroup *grp, uint64_t mask)
+{
+    uint64_t old, newBits;
+    uint32_t bits;
+    int half;
+
+    old = __atomic_fetch_or(&grp->flags, mask, __ATOMIC_SEQ_CST);
+    newBits = mask & ~old;
+
+    if (newBits == 0 || __atomic_load_n(&grp->waiters, __ATOMIC_SEQ_CST) == 0)
+        return 0;                       /* No system call needed */
+
+    for (half = 0; half < 2; half++) {
+        bits = halfBits(newBits, half);
+        if (bits != 0 && syscall(SYS_futex, halfWord(grp, half),
+                    FUTEX_WAKE_BITSET, INT_MAX, NULL, NULL, bits) == -1)
+            return -1;
+    }
+
+    return 0;
+}
+
+int
+efgClear(struct efGroup *grp, uint64_t mask)
+{
+    __atomic_fetch_and(&grp->flags, ~mask, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+uint64_t
+efgGet(struct efGroup *grp)
+{
+    return __atomic_load_n(&grp->flags, __ATOMIC_SEQ_CST);
+}
+
+/* Sleep until the flags differ from 'cur' in a half that is of interest
+   to 'mask', 'deadline' (if not NULL) passes, or a signal arrives.
+   Returns 0 or -1 (with errno set); EAGAIN means that the flags had
+   already changed. */
+
+static int
+sleepOnFlags(struct efGroup *grp, uint64_t mask, uint64_t cur,
+             const struct timespec *deadline)
+{
+    int half;
+#ifdef FUTEX_32
+    struct futex_waitv wv[2];
+#endif
+
+    if (halfBits(mask, HI_HALF) == 0 || halfBits(mask, LO_HALF) == 0) {
+        half = (halfBits(mask, LO_HALF) != 0) ? LO_HALF : HI_HALF;
+
+        /* FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout */
+
+        return syscall(SYS_futex, halfWord(grp, half), FUTEX_WAIT_BITSET,
+                       halfBits(cur, half), deadline, NULL,
+                       halfBits(mask, half));
+    }
+
+#if defined(FUTEX_32) && defined(SYS_futex_waitv)
+    for (half = 0; half < 2; half++) {
+        wv[half].val = halfBits(cur, half);
+        wv[half].uaddr = (uintptr_t) halfWord(grp, half);
+        wv[half].flags = FUTEX_32;
+        wv[half].__reserved = 0;
+    }
+    return syscall(SYS_futex_waitv, wv, 2, 0, deadline, CLOCK_MONOTONIC);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/* Wait until any (or, if 'flags' includes EFG_ALL, all) of the flags in
+   'mask' are set. If 'timeoutMs' is nonnegative, wait at most that many
+   milliseconds. If 'flags' includes EFG_CONSUME, the flags in 'mask' that
+   are set when the wait is satisfied are atomically cleared. If 'state'
+   is not NULL, the value of the flags at the time that the wait was
+   satisfied is returned there.
+
+   Return 0 on success, or -1 with 'errno' set to ETIMEDOUT if the timeout
+   expired, EINTR if the wait was interrupted by a signal handler, or
+   EINVAL if 'mask' is 0. */
+
+int
+efgWait(struct efGroup *grp, uint64_t mask, int flags, long timeoutMs,
+        uint64_t *state)
+{
+    struct timespec deadline;
+    uint64_t cur;
+    int s, savedErrno;
+
+    if (mask == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (timeoutMs >= 0) {
+        if (clock_gettime(CLOCK_MONOTONIC, &deadline) == -1)
+            return -1;
+        deadline.tv_sec += timeoutMs / 1000;
+        deadline.tv_nsec += (timeoutMs % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    cur = __atomic_load_n(&grp->flags, __ATOMIC_SEQ_CST);
+    for (;;) {
+        if ((flags & EFG_ALL) ? (cur & mask) == mask : (cur & mask) != 0) {
+            if ((flags & EFG_CONSUME) &&
+                    !__atomic_compare_exchange_n(&grp->flags, &cur,
+                                cur & ~mask, 0, __ATOMIC_SEQ_CST,
+                                __ATOMIC_SEQ_CST))
+                continue;               /* 'cur' was updated; recheck */
+            if (state != NULL)
+                *state = cur;
+            return 0;
+        }
+
+        /* Announce ourselves before the final check of the flags, so
+           that a concurrent efgSet() either sees us as a waiter, or sets
+           the flags before we read them */
+
+        __atomic_fetch_add(&grp->waiters, 1, __ATOMIC_SEQ_CST);
+        cur = __atomic_load_n(&grp->flags, __ATOMIC_SEQ_CST);
+        if ((flags & EFG_ALL) ? (cur & mask) == mask : (cur & mask) != 0)
+            s = 0;
+        else
+            s = sleepOnFlags(grp, mask, cur,
+                             (timeoutMs >= 0) ? &deadline : NULL);
+        savedErrno = errno;
+        __atomic_fetch_sub(&grp->waiters, 1, __ATOMIC_SEQ_CST);
+        errno = savedErrno;
+
+        if (s == -1 && errno != EAGAIN)
+            return -1;                  /* ETIMEDOUT, EINTR, ENOSYS, ... */
+
+        cur = __atomic_load_n(&grp->flags, __ATOMIC_SEQ_CST);
+    }
+}
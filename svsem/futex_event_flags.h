@@ -0,0 +1,60 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 47 */
+
+/* futex_event_flags.h
+
+   Header file for futex_event_flags.c.
+
+   A futex-based alternative to event_flags.c, in which a group of 64
+   event flags is held in a 'struct efGroup' placed in memory shared by
+   the cooperating processes. The operations are:
+
+        initialize a group:             efgInit(grp, initial)
+        set flags in 'mask':            efgSet(grp, mask)
+        clear flags in 'mask':          efgClear(grp, mask)
+        read the flags:                 efgGet(grp)
+        wait for any/all of 'mask':     efgWait(grp, mask, flags,
+                                                timeoutMs, &state)
+
+   Unlike event_flags.c, a flag is "set" when its bit is 1.
+*/
+#ifndef FUTEX_EVENT_FLAGS_H
+#define FUTEX_EVENT_FLAGS_H     /* Prevent accidental double inclusion */
+
+#include <stdint.h>
+
+struct efGroup {
+    uint64_t flags;             /* The flags; the 32-bit halves of this
+                                   field are used as futex words */
+    uint32_t waiters;           /* Number of processes in efgWait() */
+    uint32_t pad;
+};
+
+/* Flags for efgWait() */
+
+#define EFG_ALL     1           /* Wait for all flags in 'mask' (default:
+                                   wait for any flag in 'mask') */
+#define EFG_CONSUME 2           /* Atomically clear the flags that
+                                   satisfied the wait */
+
+int efgInit(struct efGroup *grp, uint64_t initial);
+
+int efgSet(struct efGroup *grp, uint64_t mask);
+
+int efgClear(struct efGroup *grp, uint64_t mask);
+
+uint64_t efgGet(struct efGroup *grp);
+
+int efgWait(struct efGroup *grp, uint64_t mask, int flags, long timeoutMs,
+            uint64_t *state);
+
+#endif
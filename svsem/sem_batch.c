@@ -0,0 +1,153 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 47 */
+
+/* sem_batch.c
+
+   Accumulate operations on the semaphores of a System V semaphore set,
+   and then perform them all with a single semop() (or, if a timeout is
+   given, semtimedop()) call. As with semop(), the operations in a batch
+   are performed atomically: either all of them are performed, or none.
+
+   Where binary_sems.c makes one semop() call per operation (and
+   optionally forces SEM_UNDO on every operation, which causes the kernel
+   to allocate and maintain an undo structure for the process), a batch
+   lets a caller release or reserve several semaphores for the cost of
+   one system call, and choose SEM_UNDO per operation.
+
+   A typical sequence is:
+
+        b = semBatchCreate(semId, 16);
+        semBatchAdd(b, 0, -1, 0);
+        semBatchAdd(b, 3, +1, IPC_NOWAIT);
+        semBatchSubmit(b, NULL);
+
+   See also svsem_batch_bench.c.
+*/
+#if defined(__linux__)
+#define _GNU_SOURCE             /* For semtimedop() */
+#endif
+#include <limits.h>
+#include "sem_batch.h"
+#include "tlpi_hdr.h"
+
+struct semBatch {
+    int semId;
+    int nsops;                  /* Operations currently in 'sops' */
+    int maxOps;                 /* Capacity of 'sops' */
+    struct sembuf sops[];
+};
+
+/* Create a batch that can hold up to 'maxOps' operations on the
+   semaphore set 'semId'. Returns NULL (with errno set) on error. */
+
+struct semBatch *
+semBatchCreate(int semId, int maxOps)
+{
+    struct semBatch *b;
+
+    if (maxOps <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    b = malloc(sizeof(struct semBatch) + maxOps * sizeof(struct sembuf));
+    if (b == NULL)
+        return NULL;
+
+    b->semId = semId;
+    b->nsops = 0;
+    b->maxOps = maxOps;
+    return b;
+}
+
+void
+semBatchFree(struct semBatch *b)
+{
+    free(b);
+}
+
+/* Append the operation 'op' (with 'flags', i.e., IPC_NOWAIT and/or
+   SEM_UNDO) on semaphore 'semNum' to the batch. If the preceding
+   operation in the batch is an increment of the same semaphore with the
+   same flags, and 'op' is also an increment, the two are merged (this
+   does not change the effect of the batch, since increments never
+   block). Returns 0 on success, or -1 with errno set to E2BIG if the
+   batch is full. */
+
+int
+semBatchAdd(struct semBatch *b, int semNum, int op, int flags)
+{
+    struct sembuf *last;
+
+    if (b->nsops > 0) {
+        last = &b->sops[b->nsops - 1];
+        if (last->sem_num == semNum && last->sem_flg == flags &&
+                last->sem_op > 0 && op > 0 && last->sem_op + op <= SHRT_MAX) {
+            last->sem_op += op;
+            return 0;
+        }
+    }
+
+    if (b->nsops >= b->maxOps) {
+        errno = E2BIG;
+        return -1;
+    }
+
+    b->sops[b->nsops].sem_num = semNum;
+    b->sops[b->nsops].sem_op = op;
+    b->sops[b->nsops].sem_flg = flags;
+    b->nsops++;
+    return 0;
+}
+
+int
+semBatchCount(const struct semBatch *b)
+{
+    return b->nsops;
+}
+
+void
+semBatchReset(struct semBatch *b)
+{
+    b->nsops = 0;
+}
+
+/* Perform all of the operations in the batch with a single system call.
+   If 'timeout' is not NULL, semtimedop() is used (Linux only), and the
+   call fails with EAGAIN if the operations could not be performed within
+   the interval. On success, the batch is emptied and 0 is returned. On
+   failure (e.g., EINTR), -1 is returned and the batch is left unchanged,
+   so that the caller may resubmit it. An empty batch succeeds trivially. */
+
+int
+semBatchSubmit(struct semBatch *b, const struct timespec *timeout)
+{
+    int s;
+
+    if (b->nsops == 0)
+        return 0;
+
+    if (timeout == NULL) {
+        s = semop(b->semId, b->sops, b->nsops);
+    } else {
+#if defined(__linux__)
+        s = semtimedop(b->semId, b->sops, b->nsops, timeout);
+#else
+        errno = ENOSYS;
+        s = -1;
+#endif
+    }
+
+    if (s == 0)
+        b->nsops = 0;
+    return s;
+}
@@ -0,0 +1,38 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 47 */
+
+/* sem_batch.h
+
+   Header file for sem_batch.c.
+*/
+#ifndef SEM_BATCH_H
+#define SEM_BATCH_H             /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <sys/sem.h>
+#include <time.h>
+
+struct semBatch;                /* Opaque */
+
+struct semBatch *semBatchCreate(int semId, int maxOps);
+
+void semBatchFree(struct semBatch *b);
+
+int semBatchAdd(struct semBatch *b, int semNum, int op, int flags);
+
+int semBatchCount(const struct semBatch *b);
+
+void semBatchReset(struct semBatch *b);
+
+int semBatchSubmit(struct semBatch *b, const struct timespec *timeout);
+
+#endif
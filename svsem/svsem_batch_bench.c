@@ -0,0 +1,199 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 47 */
+
+/* svsem_batch_bench.c
+
+   Compare the cost of System V semaphore operations performed one per
+   semop() call (as binary_sems.c does) with the same operations performed
+   as a single batch using sem_batch.c, each with and without SEM_UNDO.
+
+   Usage: svsem_batch_bench [-n nsems] [-i iterations] [-t]
+
+        -n nsems        Number of semaphores in the set (default: 8)
+        -i iterations   Number of iterations (default: 100000)
+        -t              Submit batches using semtimedop() (with a
+                        timeout of 1 second) instead of semop()
+
+   Each iteration increments, and then decrements, each semaphore in a
+   private semaphore set. In the "single" modes, this takes 2 * nsems
+   semop() calls; in the "batch" modes, it takes two calls. For each mode,
+   the program prints the number of calls per iteration, the mean cost
+   per operation, and percentiles of the time taken by an iteration.
+*/
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <time.h>
+#include "semun.h"              /* Definition of semun union */
+#include "sem_batch.h"
+#include "tlpi_hdr.h"
+
+static int semId, numSems;
+static struct semBatch *batch;
+static struct timespec *submitTimeout;
+
+/* Perform one iteration, one semop() per operation */
+
+static void
+iterSingle(int flags)
+{
+    struct sembuf sop;
+    int j;
+
+    sop.sem_flg = flags;
+    for (sop.sem_op = 1; sop.sem_op >= -1; sop.sem_op -= 2) {
+        for (j = 0; j < numSems; j++) {
+            sop.sem_num = j;
+            if (semop(semId, &sop, 1) == -1)
+                errExit("semop");
+        }
+    }
+}
+
+/* Perform one iteration as two batches */
+
+static void
+iterBatch(int flags)
+{
+    int op, j;
+
+    for (op = 1; op >= -1; op -= 2) {
+        for (j = 0; j < numSems; j++)
+            if (semBatchAdd(batch, j, op, flags) == -1)
+                errExit("semBatchAdd");
+        if (semBatchSubmit(batch, submitTimeout) == -1)
+            errExit("semBatchSubmit");
+    }
+}
+
+static struct {
+    const char *name;
+    void (*iter)(int flags);
+    int flags;
+    Boolean batched;
+} modes[] = {
+    { "single",         iterSingle,     0,              FALSE },
+    { "single-undo",    iterSingle,     SEM_UNDO,       FALSE },
+    { "batch",          iterBatch,      0,              TRUE },
+    { "batch-undo",     iterBatch,      SEM_UNDO,       TRUE },
+};
+
+#define NMODES (sizeof(modes) / sizeof(modes[0]))
+
+static uint64_t
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+cmpSample(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n nsems] [-i iterations] [-t]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int opt, numIters, m, j;
+    uint64_t *samples, start, total, t;
+    struct timespec ts;
+    union semun arg;
+
+    numSems = 8;
+    numIters = 100000;
+    submitTimeout = NULL;
+    while ((opt = getopt(argc, argv, "n:i:t")) != -1) {
+        switch (opt) {
+        case 'n':   numSems = getInt(optarg, GN_GT_0, "nsems");         break;
+        case 'i':   numIters = getInt(optarg, GN_GT_0, "iterations");   break;
+        case 't':
+            ts.tv_sec = 1;
+            ts.tv_nsec = 0;
+            submitTimeout = &ts;
+            break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc)
+        usageError(argv[0]);
+
+    samples = malloc(numIters * sizeof(uint64_t));
+    if (samples == NULL)
+        errExit("malloc");
+
+    /* Initialize all semaphores to 0; each iteration returns them to
+       that value */
+
+    semId = semget(IPC_PRIVATE, numSems, IPC_CREAT | S_IRUSR | S_IWUSR);
+    if (semId == -1)
+        errExit("semget");
+
+    arg.array = calloc(numSems, sizeof(unsigned short));
+    if (arg.array == NULL)
+        errExit("calloc");
+    if (semctl(semId, 0, SETALL, arg) == -1)
+        errExit("semctl-SETALL");
+
+    batch = semBatchCreate(semId, numSems);
+    if (batch == NULL)
+        errExit("semBatchCreate");
+
+    printf("%d semaphores, %d iterations%s\n", numSems, numIters,
+            (submitTimeout != NULL) ? ", batches use semtimedop()" : "");
+    printf("%-12s %10s %10s %10s %10s %10s\n", "mode", "calls/iter",
+            "ns/op", "p50-us", "p99-us", "max-us");
+
+    for (m = 0; m < NMODES; m++) {
+        for (j = 0; j < numIters / 10 + 1; j++)         /* Warm up */
+            modes[m].iter(modes[m].flags);
+
+        total = 0;
+        for (j = 0; j < numIters; j++) {
+            start = nowNs();
+            modes[m].iter(modes[m].flags);
+            t = nowNs() - start;
+            samples[j] = t;
+            total += t;
+        }
+
+        qsort(samples, numIters, sizeof(uint64_t), cmpSample);
+        printf("%-12s %10d %10.1f %10.2f %10.2f %10.2f\n", modes[m].name,
+                modes[m].batched ? 2 : 2 * numSems,
+                (double) total / numIters / (2 * numSems),
+                samples[numIters / 2] / 1e3,
+                samples[numIters * 99 / 100] / 1e3,
+                samples[numIters - 1] / 1e3);
+    }
+
+    semBatchFree(batch);
+    if (semctl(semId, 0, IPC_RMID) == -1)
+        errExit("semctl-IPC_RMID");
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,350 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 47 */
+
+/* svsem_watch.c
+
+   Periodically sample the values and wait-queue lengths (semncnt and
+   semzcnt) of the semaphores in one or more System V semaphore sets, and
+   report where processes are waiting.
+
+   Usage: svsem_watch [-i interval-ms] [-n count] [-v] {-a | semid...}
+
+        -i interval-ms  Sampling interval (default: 1000)
+        -n count        Stop after 'count' samples (default: run until
+                        interrupted with SIGINT)
+        -v              At each sample, display every semaphore, rather
+                        than only those with waiters
+        -a              Monitor all semaphore sets on the system (that we
+                        have permission to read); the sets are enumerated
+                        afresh at each sample using SEM_INFO and SEM_STAT,
+                        as in svsem_info.c and svmsg_ls.c
+
+   At each sample, the program prints a line for each semaphore with
+   waiting processes, followed by a one-line summary. On termination, it
+   prints, for each semaphore that had waiters in at least one sample,
+   the percentage of samples in which there were waiters and the mean and
+   maximum semncnt and semzcnt values; the semaphores are listed in
+   decreasing order of mean wait-queue depth.
+
+   As with svsem_mon.c, the values for a set are not retrieved atomically.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/sem.h>
+#include <signal.h>
+#include <time.h>
+#include "semun.h"                      /* Definition of semun union */
+#include "curr_time.h"                  /* Declaration of currTime() */
+#include "tlpi_hdr.h"
+
+struct semStat {                /* Accumulated statistics for a semaphore */
+    int semid;
+    key_t key;
+    int semnum;
+    long waitSamples;           /* Samples in which there were waiters */
+    long long ncntSum, zcntSum;
+    int ncntMax, zcntMax;
+};
+
+struct setInfo {                /* A monitored set */
+    int semid;
+    key_t key;
+    int nsems;
+    struct semStat *sems;       /* Array of 'nsems' elements */
+};
+
+static struct setInfo *sets;
+static int numSets, maxSets;
+
+static long numSamples;
+static Boolean verbose;
+
+static volatile sig_atomic_t gotSigint = 0;
+
+static void
+sigintHandler(int sig)
+{
+    gotSigint = 1;
+}
+
+/* Return the record for the set 'semid', creating it if necessary. If
+   the set has changed size (i.e., the ID was reused), its statistics are
+   discarded. */
+
+static struct setInfo *
+findSet(int semid, key_t key, int nsems)
+{
+    struct setInfo *s;
+    int j;
+
+    for (j = 0; j < numSets; j++)
+        if (sets[j].semid == semid)
+            break;
+
+    if (j == numSets) {
+        if (numSets == maxSets) {
+            maxSets = (maxSets == 0) ? 16 : 2 * maxSets;
+            sets = realloc(sets, maxSets * sizeof(struct setInfo));
+            if (sets == NULL)
+                errExit("realloc");
+        }
+        numSets++;
+        sets[j].semid = semid;
+        sets[j].nsems = 0;
+        sets[j].sems = NULL;
+    }
+
+    s = &sets[j];
+    if (s->nsems != nsems) {
+        free(s->sems);
+        s->sems = calloc(nsems, sizeof(struct semStat));
+        if (s->sems == NULL)
+            errExit("calloc");
+        s->nsems = nsems;
+        for (j = 0; j < nsems; j++) {
+            s->sems[j].semid = semid;
+            s->sems[j].key = key;
+            s->sems[j].semnum = j;
+        }
+    }
+    s->key = key;
+    return s;
+}
+
+/* Sample the set 'semid', updating its statistics and printing
+   semaphores with waiters (or all semaphores, if 'verbose'). Returns
+   FALSE if the set could not be sampled (e.g., it was removed). */
+
+static Boolean
+sampleSet(int semid, const struct semid_ds *ds, long *totNcnt,
+          long *totZcnt, int *numContended)
+{
+    struct setInfo *s;
+    struct semStat *st;
+    union semun arg, dummy;
+    unsigned short *vals;
+    int j, ncnt, zcnt;
+
+    vals = calloc(ds->sem_nsems, sizeof(unsigned short));
+    if (vals == NULL)
+        errExit("calloc");
+    arg.array = vals;
+    if (semctl(semid, 0, GETALL, arg) == -1) {
+        free(vals);
+        return FALSE;
+    }
+
+    s = findSet(semid, ds->sem_perm.__key, ds->sem_nsems);
+
+    for (j = 0; j < ds->sem_nsems; j++) {
+        ncnt = semctl(semid, j, GETNCNT, dummy);
+        zcnt = semctl(semid, j, GETZCNT, dummy);
+        if (ncnt == -1 || zcnt == -1)
+            break;                      /* Set was probably removed */
+
+        st = &s->sems[j];
+        st->ncntSum += ncnt;
+        st->zcntSum += zcnt;
+        if (ncnt > st->ncntMax)
+            st->ncntMax = ncnt;
+        if (zcnt > st->zcntMax)
+            st->zcntMax = zcnt;
+        if (ncnt > 0 || zcnt > 0) {
+            st->waitSamples++;
+            (*numContended)++;
+        }
+        *totNcnt += ncnt;
+        *totZcnt += zcnt;
+
+        if (verbose || ncnt > 0 || zcnt > 0)
+            printf("    %8d  0x%08lx %5d %6d %7d %7d\n", semid,
+                    (unsigned long) ds->sem_perm.__key, j, vals[j],
+                    ncnt, zcnt);
+    }
+
+    free(vals);
+    return TRUE;
+}
+
+/* Take one sample of all sets in 'semids' (or, if 'semids' is NULL, of
+   all sets on the system) */
+
+static void
+sample(int *semids, int nids)
+{
+    struct seminfo info;
+    struct semid_ds ds;
+    union semun arg;
+    int maxind, ind, semid, nsets, nsems, numContended;
+    long totNcnt, totZcnt;
+    Boolean all;
+
+    all = (semids == NULL);
+    if (all) {
+        arg.__buf = &info;
+        maxind = semctl(0, 0, SEM_INFO, arg);
+        if (maxind == -1)
+            errExit("semctl-SEM_INFO");
+    } else {
+        maxind = nids - 1;
+    }
+
+    nsets = nsems = numContended = 0;
+    totNcnt = totZcnt = 0;
+    arg.buf = &ds;
+    for (ind = 0; ind <= maxind; ind++) {
+        if (all) {
+            semid = semctl(ind, 0, SEM_STAT, arg);
+            if (semid == -1) {
+                if (errno != EINVAL && errno != EACCES)
+                    errMsg("semctl-SEM_STAT");  /* Unexpected error */
+                continue;                       /* Ignore this item */
+            }
+        } else {
+            semid = semids[ind];
+            if (semctl(semid, 0, IPC_STAT, arg) == -1) {
+                errMsg("semctl-IPC_STAT %d", semid);
+                continue;
+            }
+        }
+
+        if (sampleSet(semid, &ds, &totNcnt, &totZcnt, &numContended)) {
+            nsets++;
+            nsems += ds.sem_nsems;
+        }
+    }
+    numSamples++;
+
+    printf("%s sets=%d sems=%d contended=%d ncnt=%ld zcnt=%ld\n",
+            currTime("%T"), nsets, nsems, numContended, totNcnt, totZcnt);
+}
+
+static int
+cmpDepth(const void *a, const void *b)
+{
+    const struct semStat *x = *(const struct semStat **) a;
+    const struct semStat *y = *(const struct semStat **) b;
+    long long dx = x->ncntSum + x->zcntSum, dy = y->ncntSum + y->zcntSum;
+
+    return (dx < dy) - (dx > dy);       /* Descending */
+}
+
+/* Print statistics for semaphores that had waiters in any sample */
+
+static void
+printSummary(void)
+{
+    struct semStat **list;
+    int n, j, k;
+
+    n = 0;
+    for (j = 0; j < numSets; j++)
+        n += sets[j].nsems;
+    list = malloc((n + 1) * sizeof(struct semStat *));
+    if (list == NULL)
+        errExit("malloc");
+
+    n = 0;
+    for (j = 0; j < numSets; j++)
+        for (k = 0; k < sets[j].nsems; k++)
+            if (sets[j].sems[k].waitSamples > 0)
+                list[n++] = &sets[j].sems[k];
+
+    qsort(list, n, sizeof(struct semStat *), cmpDepth);
+
+    printf("\n%ld samples; %d semaphore(s) with waiters\n", numSamples, n);
+    if (n == 0)
+        return;
+
+    printf("    %8s  %10s %5s %6s %9s %7s %9s %7s\n", "semid", "key",
+            "sem#", "%wait", "mean-ncnt", "max", "mean-zcnt", "max");
+    for (j = 0; j < n; j++)
+        printf("    %8d  0x%08lx %5d %6.1f %9.2f %7d %9.2f %7d\n",
+                list[j]->semid, (unsigned long) list[j]->key,
+                list[j]->semnum,
+                100.0 * list[j]->waitSamples / numSamples,
+                (double) list[j]->ncntSum / numSamples, list[j]->ncntMax,
+                (double) list[j]->zcntSum / numSamples, list[j]->zcntMax);
+    free(list);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-i interval-ms] [-n count] [-v] "
+            "{-a | semid...}\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int opt, intervalMs, count, nids, j;
+    int *semids;
+    Boolean all;
+    struct sigaction sa;
+    struct timespec ts;
+
+    intervalMs = 1000;
+    count = 0;
+    all = FALSE;
+    verbose = FALSE;
+    while ((opt = getopt(argc, argv, "i:n:va")) != -1) {
+        switch (opt) {
+        case 'i':   intervalMs = getInt(optarg, GN_GT_0, "interval-ms"); break;
+        case 'n':   count = getInt(optarg, GN_GT_0, "count");           break;
+        case 'v':   verbose = TRUE;                                     break;
+        case 'a':   all = TRUE;                                         break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    nids = argc - optind;
+    if (all == (nids > 0))              /* Need exactly one of -a, semid */
+        usageError(argv[0]);
+
+    semids = NULL;
+    if (!all) {
+        semids = calloc(nids, sizeof(int));
+        if (semids == NULL)
+            errExit("calloc");
+        for (j = 0; j < nids; j++)
+            semids[j] = getInt(argv[optind + j], 0, "semid");
+    }
+
+    /* SIGINT terminates the sampling loop, so that the summary is shown */
+
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    sa.sa_handler = sigintHandler;
+    if (sigaction(SIGINT, &sa, NULL) == -1)
+        errExit("sigaction");
+
+    setbuf(stdout, NULL);
+    printf("    %8s  %10s %5s %6s %7s %7s\n", "semid", "key", "sem#",
+                "value", "semncnt", "semzcnt");
+
+    while (!gotSigint) {
+        sample(semids, nids);
+        if (count > 0 && numSamples >= count)
+            break;
+
+        ts.tv_sec = intervalMs / 1000;
+        ts.tv_nsec = (intervalMs % 1000) * 1000000;
+        nanosleep(&ts, NULL);           /* Interrupted by SIGINT */
+    }
+
+    printSummary();
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,135 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 48 */
+
+/*  svshm_ring.h
+
+   Header file used by the svshm_ring_reader.c and svshm_ring_writer.c
+   programs.
+
+   Unlike svshm_xfr_writer.c and svshm_xfr_reader.c, which pass a single
+   buffer back and forth using a pair of semaphores, these programs use a
+   ring of 'nslots' buffers in the shared memory segment, so that the
+   writer can fill some slots while the reader empties others.
+
+   The ring is controlled by two free-running counters: 'head' (the
+   number of slots filled by the writer) and 'tail' (the number of slots
+   emptied by the reader). Slot (n % nslots) is the n-th slot to be used.
+   The ring is empty when head == tail, and full when head - tail ==
+   nslots. Each counter is written by only one process, so no locking is
+   required. The counters are also used as futex words: a process makes a
+   system call only when it must wait because the ring is empty (reader)
+   or full (writer), or when it must wake a process that is waiting.
+
+   These programs are Linux-specific.
+*/
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/shm.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include "tlpi_hdr.h"
+
+#define RING_SHM_KEY 0x1235     /* Key for shared memory segment */
+
+#define OBJ_PERMS (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP)
+                                /* Permissions for our IPC objects */
+
+#define DEF_NSLOTS 64           /* Default number of slots */
+#define DEF_SLOT_SIZE 65536     /* Default size of each slot's buffer */
+
+#define CACHE_LINE 64
+
+struct ringHdr {                /* Header at start of shared memory segment */
+
+    /* Each counter (and the corresponding "waiting" flag) is in a cache
+       line of its own, so that the writer's updates of 'head' don't evict
+       the cache line containing 'tail' from the reader's CPU, and vice
+       versa */
+
+    uint32_t head __attribute__ ((aligned(CACHE_LINE)));
+    uint32_t readerWaiting;     /* Reader is (about to be) in FUTEX_WAIT */
+
+    uint32_t tail __attribute__ ((aligned(CACHE_LINE)));
+    uint32_t writerWaiting;     /* Writer is (about to be) in FUTEX_WAIT */
+
+    uint32_t ready __attribute__ ((aligned(CACHE_LINE)));
+                                /* Set by writer when header initialized */
+    uint32_t nslots;
+    uint32_t slotSize;          /* Size of 'buf' in each slot */
+};
+
+struct ringSlot {
+    int cnt;                    /* Number of bytes used in 'buf'; 0 == EOF */
+    char buf[];                 /* Data being transferred */
+};
+
+/* Distance between the start of successive slots; each slot starts on a
+   cache-line boundary */
+
+#define SLOT_STRIDE(slotSize) \
+        ((sizeof(struct ringSlot) + (slotSize) + CACHE_LINE - 1) / \
+         CACHE_LINE * CACHE_LINE)
+
+#define SEG_SIZE(nslots, slotSize) \
+        (sizeof(struct ringHdr) + (size_t) (nslots) * SLOT_STRIDE(slotSize))
+
+static inline struct ringSlot *
+ringSlot(struct ringHdr *hdr, uint32_t n)
+{
+    return (struct ringSlot *) ((char *) hdr + sizeof(struct ringHdr) +
+                (size_t) (n % hdr->nslots) * SLOT_STRIDE(hdr->slotSize));
+}
+
+/* Wait until the counter '*word' no longer has the value 'val'. Before
+   sleeping, we set '*waiting', so that the other process knows that it
+   must call ringAdvance() to wake us. Returns the number of
+   FUTEX_WAIT calls that were made. */
+
+static inline long
+ringWait(uint32_t *word, uint32_t val, uint32_t *waiting)
+{
+    long waits = 0;
+
+    while (__atomic_load_n(word, __ATOMIC_ACQUIRE) == val) {
+
+        /* The sequentially consistent store and load here, together with
+           those in ringAdvance(), ensure that either we see the new value
+           of the counter, or the other process sees that we are waiting */
+
+        __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(word, __ATOMIC_SEQ_CST) != val)
+            break;
+
+        /* FUTEX_WAIT fails with EAGAIN if '*word' is no longer 'val' */
+
+        if (syscall(SYS_futex, word, FUTEX_WAIT, val, NULL, NULL, 0) == -1 &&
+                errno != EAGAIN && errno != EINTR)
+            errExit("futex-FUTEX_WAIT");
+        waits++;
+    }
+
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    return waits;
+}
+
+/* Set the counter '*word' to 'val', waking the other process if it is
+   waiting for the counter to change */
+
+static inline void
+ringAdvance(uint32_t *word, uint32_t val, uint32_t *waiting)
+{
+    __atomic_store_n(word, val, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST))
+        if (syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0) == -1)
+            errExit("futex-FUTEX_WAKE");
+}
@@ -0,0 +1,85 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 48 */
+
+/* svshm_ring_reader.c
+
+   Read data from the ring of slots in a System V shared memory segment
+   created by svshm_ring_writer.c, and write it to standard output.
+
+   This program is Linux-specific.
+*/
+#include "svshm_ring.h"
+
+int
+main(int argc, char *argv[])
+{
+    int shmid;
+    long long bytes;
+    long xfrs, waits;
+    struct ringHdr *hdr;
+    struct ringSlot *slot;
+    uint32_t tail;
+
+    /* Get ID for shared memory created by writer */
+
+    shmid = shmget(RING_SHM_KEY, 0, 0);
+    if (shmid == -1)
+        errExit("shmget");
+
+    /* Unlike svshm_xfr_reader.c, we need write access to the segment, in
+       order to update 'tail' */
+
+    hdr = shmat(shmid, NULL, 0);
+    if (hdr == (void *) -1)
+        errExit("shmat");
+
+    /* Wait until the writer has initialized the header */
+
+    while (__atomic_load_n(&hdr->ready, __ATOMIC_ACQUIRE) == 0)
+        if (syscall(SYS_futex, &hdr->ready, FUTEX_WAIT, 0, NULL, NULL, 0) == -1
+                && errno != EAGAIN && errno != EINTR)
+            errExit("futex-FUTEX_WAIT");
+
+    /* Transfer blocks of data from shared memory to stdout */
+
+    waits = 0;
+    for (xfrs = 0, bytes = 0, tail = 0; ; xfrs++) {
+
+        /* Wait while the ring is empty */
+
+        waits += ringWait(&hdr->head, tail, &hdr->readerWaiting);
+
+        slot = ringSlot(hdr, tail);
+        if (slot->cnt == 0) {                   /* Writer encountered EOF */
+
+            /* Release the EOF slot, so that the writer knows that
+               we have finished */
+
+            ringAdvance(&hdr->tail, tail + 1, &hdr->writerWaiting);
+            break;
+        }
+
+        if (write(STDOUT_FILENO, slot->buf, slot->cnt) != slot->cnt)
+            fatal("partial/failed write");
+        bytes += slot->cnt;
+
+        tail++;
+        ringAdvance(&hdr->tail, tail, &hdr->writerWaiting);
+    }
+
+    if (shmdt(hdr) == -1)
+        errExit("shmdt");
+
+    fprintf(stderr, "Received %lld bytes (%ld xfrs; %ld waits)\n",
+            bytes, xfrs, waits);
+    exit(EXIT_SUCCESS);
+}
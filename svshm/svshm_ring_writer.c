@@ -0,0 +1,137 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 48 */
+
+/*  svshm_ring_writer.c
+
+   Read buffers of data from standard input into a ring of slots in a
+   System V shared memory segment, from which they are copied by
+   svshm_ring_reader.c. This is a version of svshm_xfr_writer.c in which
+   the writer and reader work in parallel, rather than in lock step; see
+   svshm_ring.h for a description of the protocol.
+
+   Usage: svshm_ring_writer [-n nslots] [-s slot-size] < infile
+
+        -n nslots     Number of slots in the ring; must be a power of 2
+                      (default: 64)
+        -s slot-size  Size of each slot (default: 65536 bytes)
+
+   This program needs to be started before the reader process, as it
+   creates the shared memory segment:
+
+        $ svshm_ring_writer < infile &
+        $ svshm_ring_reader > out_file
+
+   This program is Linux-specific.
+*/
+#include "svshm_ring.h"
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n nslots] [-s slot-size]\n", progName);
+    fprintf(stderr, "    -n nslots     Number of slots (power of 2; "
+                    "default: %d)\n", DEF_NSLOTS);
+    fprintf(stderr, "    -s slot-size  Size of each slot (default: %d)\n",
+                    DEF_SLOT_SIZE);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int shmid, opt, nslots, slotSize;
+    long long bytes;
+    long xfrs, waits;
+    struct ringHdr *hdr;
+    struct ringSlot *slot;
+    uint32_t head, tail;
+
+    nslots = DEF_NSLOTS;
+    slotSize = DEF_SLOT_SIZE;
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n':   nslots = getInt(optarg, GN_GT_0, "nslots");     break;
+        case 's':   slotSize = getInt(optarg, GN_GT_0 | GN_ANY_BASE,
+                                      "slot-size");                 break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    /* A power of 2 ensures that (n % nslots) continues to cycle through
+       the slots in order when the counters wrap around */
+
+    if (optind != argc || (nslots & (nslots - 1)) != 0)
+        usageError(argv[0]);
+
+    /* Create shared memory; attach at address chosen by system */
+
+    shmid = shmget(RING_SHM_KEY, SEG_SIZE(nslots, slotSize),
+                   IPC_CREAT | OBJ_PERMS);
+    if (shmid == -1)
+        errExit("shmget");
+
+    hdr = shmat(shmid, NULL, 0);
+    if (hdr == (void *) -1)
+        errExit("shmat");
+
+    /* Initialize the header, and then tell the reader (which may already
+       be waiting) that the ring is ready */
+
+    memset(hdr, 0, sizeof(struct ringHdr));
+    hdr->nslots = nslots;
+    hdr->slotSize = slotSize;
+    __atomic_store_n(&hdr->ready, 1, __ATOMIC_RELEASE);
+    if (syscall(SYS_futex, &hdr->ready, FUTEX_WAKE, 1, NULL, NULL, 0) == -1)
+        errExit("futex-FUTEX_WAKE");
+
+    /* Transfer blocks of data from stdin to shared memory. The data is
+       read directly into the next free slot. */
+
+    waits = 0;
+    for (xfrs = 0, bytes = 0, head = 0; ; xfrs++) {
+
+        /* Wait while the ring is full */
+
+        waits += ringWait(&hdr->tail, head - nslots, &hdr->writerWaiting);
+
+        slot = ringSlot(hdr, head);
+        slot->cnt = read(STDIN_FILENO, slot->buf, slotSize);
+        if (slot->cnt == -1)
+            errExit("read");
+        bytes += slot->cnt;
+
+        /* Make the slot available to the reader. At EOF, the slot
+           (with 'cnt' == 0) tells the reader to terminate. */
+
+        head++;
+        ringAdvance(&hdr->head, head, &hdr->readerWaiting);
+
+        if (slot->cnt == 0)
+            break;
+    }
+
+    /* Wait until the reader has emptied every slot (including the EOF
+       slot); we then know that the reader has finished, and so we can
+       delete the shared memory segment */
+
+    while ((tail = __atomic_load_n(&hdr->tail, __ATOMIC_ACQUIRE)) != head)
+        waits += ringWait(&hdr->tail, tail, &hdr->writerWaiting);
+
+    if (shmdt(hdr) == -1)
+        errExit("shmdt");
+    if (shmctl(shmid, IPC_RMID, 0) == -1)
+        errExit("shmctl");
+
+    fprintf(stderr, "Sent %lld bytes (%ld xfrs; %ld waits)\n",
+            bytes, xfrs, waits);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,50 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 48 */
+
+/* svshm_xfr_futex.h
+
+   Header file used by the svshm_xfr_futex_reader.c and
+   svshm_xfr_futex_writer.c programs, which are versions of
+   svshm_xfr_reader.c and svshm_xfr_writer.c (Listings 48-2 and 48-3)
+   that use the futex-based binary semaphores of futex_binary_sems.c.
+   The semaphores live in the shared memory segment itself, so no
+   semaphore set is needed.
+*/
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/shm.h>
+#include "futex_binary_sems.h"  /* Declares our futex semaphore functions */
+#include "tlpi_hdr.h"
+
+/* Hard-coded key for the shared memory segment (differs from the key
+   in svshm_xfr.h, since the segment's layout differs) */
+
+#define SHM_KEY 0x1235
+
+#define OBJ_PERMS (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP)
+                                /* Permissions for our IPC objects */
+
+/* Two semaphores are used to ensure exclusive, alternating access
+   to the shared memory segment */
+
+#define WRITE_SEM 0             /* Writer has access to shared memory */
+#define READ_SEM 1              /* Reader has access to shared memory */
+
+#ifndef BUF_SIZE                /* Allow "cc -D" to override definition */
+#define BUF_SIZE 1024           /* Size of transfer buffer */
+#endif
+
+struct shmseg {                 /* Defines structure of shared memory segment */
+    struct fsem sems[2];        /* Semaphores, indexed by WRITE_SEM/READ_SEM */
+    int cnt;                    /* Number of bytes used in 'buf' */
+    char buf[BUF_SIZE];         /* Data being transferred */
+};
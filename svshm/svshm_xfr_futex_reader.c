@@ -0,0 +1,70 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 48 */
+
+/* svshm_xfr_futex_reader.c
+
+   A version of svshm_xfr_reader.c (Listing 48-3) that uses the
+   futex-based binary semaphores in the shared memory segment; see
+   svshm_xfr_futex_writer.c.
+
+   This program is Linux-specific.
+*/
+#include "svshm_xfr_futex.h"
+
+int
+main(int argc, char *argv[])
+{
+    int shmid, xfrs, bytes;
+    struct shmseg *shmp;
+
+    /* Get ID for shared memory created by writer */
+
+    shmid  = shmget(SHM_KEY, 0, 0);
+    if (shmid == -1)
+        errExit("shmget");
+
+    /* Attach shared memory read-write: although we only read the data,
+       we must modify the semaphores */
+
+    shmp = shmat(shmid, NULL, 0);
+    if (shmp == (void *) -1)
+        errExit("shmat");
+
+    /* Transfer blocks of data from shared memory to stdout */
+
+    for (xfrs = 0, bytes = 0; ; xfrs++) {
+        if (reserveFsem(shmp->sems, READ_SEM) == -1)    /* Wait for our turn */
+            errExit("reserveFsem");
+
+        if (shmp->cnt == 0)                     /* Writer encountered EOF */
+            break;
+        bytes += shmp->cnt;
+
+        if (write(STDOUT_FILENO, shmp->buf, shmp->cnt) != shmp->cnt)
+            fatal("partial/failed write");
+
+        if (releaseFsem(shmp->sems, WRITE_SEM) == -1)   /* Give writer a turn */
+            errExit("releaseFsem");
+    }
+
+    /* Give writer one more turn, so it can clean up. We detach only
+       afterward, since the semaphore is in the segment. */
+
+    if (releaseFsem(shmp->sems, WRITE_SEM) == -1)
+        errExit("releaseFsem");
+
+    if (shmdt(shmp) == -1)
+        errExit("shmdt");
+
+    fprintf(stderr, "Received %d bytes (%d xfrs)\n", bytes, xfrs);
+    exit(EXIT_SUCCESS);
+}
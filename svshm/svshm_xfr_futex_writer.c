@@ -0,0 +1,88 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 48 */
+
+/* svshm_xfr_futex_writer.c
+
+   A version of svshm_xfr_writer.c (Listing 48-2) that uses the
+   futex-based binary semaphores of futex_binary_sems.c, placed in the
+   shared memory segment, instead of a System V semaphore set. While
+   the semaphores are uncontended, reserving or releasing one needs no
+   system call.
+
+   Use it with svshm_xfr_futex_reader.c, in the same way as
+   svshm_xfr_writer.c:
+
+        $ svshm_xfr_futex_writer < infile &
+        $ svshm_xfr_futex_reader > out_file
+
+   This program is Linux-specific.
+*/
+#include "svshm_xfr_futex.h"
+
+int
+main(int argc, char *argv[])
+{
+    int shmid, bytes, xfrs;
+    struct shmseg *shmp;
+
+    /* Create shared memory; attach at address chosen by system */
+
+    shmid = shmget(SHM_KEY, sizeof(struct shmseg), IPC_CREAT | OBJ_PERMS);
+    if (shmid == -1)
+        errExit("shmget");
+
+    shmp = shmat(shmid, NULL, 0);
+    if (shmp == (void *) -1)
+        errExit("shmat");
+
+    /* Initialize the semaphores in the segment so that writer has
+       first access to shared memory */
+
+    if (initFsemAvailable(shmp->sems, WRITE_SEM) == -1)
+        errExit("initFsemAvailable");
+    if (initFsemInUse(shmp->sems, READ_SEM) == -1)
+        errExit("initFsemInUse");
+
+    /* Transfer blocks of data from stdin to shared memory */
+
+    for (xfrs = 0, bytes = 0; ; xfrs++, bytes += shmp->cnt) {
+        if (reserveFsem(shmp->sems, WRITE_SEM) == -1)   /* Wait for our turn */
+            errExit("reserveFsem");
+
+        shmp->cnt = read(STDIN_FILENO, shmp->buf, BUF_SIZE);
+        if (shmp->cnt == -1)
+            errExit("read");
+
+        if (releaseFsem(shmp->sems, READ_SEM) == -1)    /* Give reader a turn */
+            errExit("releaseFsem");
+
+        /* Have we reached EOF? We test this after giving the reader
+           a turn so that it can see the 0 value in shmp->cnt. */
+
+        if (shmp->cnt == 0)
+            break;
+    }
+
+    /* Wait until reader has let us have one more turn. We then know
+       reader has finished, and so we can delete the segment. */
+
+    if (reserveFsem(shmp->sems, WRITE_SEM) == -1)
+        errExit("reserveFsem");
+
+    if (shmdt(shmp) == -1)
+        errExit("shmdt");
+    if (shmctl(shmid, IPC_RMID, 0) == -1)
+        errExit("shmctl");
+
+    fprintf(stderr, "Sent %d bytes (%d xfrs)\n", bytes, xfrs);
+    exit(EXIT_SUCCESS);
+}
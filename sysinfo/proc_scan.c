@@ -0,0 +1,557 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 12 */
+
+/* proc_scan.c
+
+   Functions for repeatedly scanning the /proc/PID directories of all
+   processes on the system, with low overhead.
+
+   psCreate() returns a scanner that will read the /proc/PID files
+   specified by 'flags' (PS_STATUS and/or PS_STAT), using 'nthreads'
+   threads (including the caller). Each call to psScan() then calls
+   'fn' once for each process, with a structure containing information
+   parsed from the files. If 'nthreads' is greater than 1, 'fn' is called
+   concurrently by several threads ('pi->thread' identifies the thread).
+   If 'fn' returns nonzero, the scan stops (after the calls in progress
+   in other threads have returned), and psScan() returns that value;
+   otherwise psScan() returns 0 at the end of the scan, or -1 on error.
+
+   Compared with the approach of procfs_user_exe.c (readdir() on /proc,
+   and fopen() plus fgets() on each /proc/PID/status file), the cost
+   per process is reduced as follows:
+
+     * The /proc directory is opened once, in psCreate(), and each scan
+       lists it with a few large getdents64() calls (see dir_batch.c).
+
+     * Each file is opened with openat() relative to the /proc directory
+       (or, if both files are to be read, relative to a descriptor for
+       the /proc/PID directory, so that both files certainly refer to the
+       same process), and read with a single pread() into a per-thread
+       buffer that is allocated once.
+
+     * The files are parsed in place, without stdio or memory
+       allocation.
+
+     * The threads are created once, in psCreate(), and wait between
+       scans; the PIDs are handed out to them in small chunks.
+
+   Processes that terminate during a scan are silently omitted.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include "dir_batch.h"
+#include "proc_scan.h"
+#include "tlpi_hdr.h"
+
+#define BUF_SIZE 16384          /* Bigger than any status or stat file */
+#define CHUNK 32                /* PIDs taken by a thread at a time */
+
+struct psThread {
+    struct procScanner *ps;
+    int index;
+    pthread_t tid;
+    char *buf;
+};
+
+struct procScanner {
+    int procFd;
+    int flags;
+    int nthreads;
+    int started;                /* Threads created, plus the caller */
+    long pageKb;                /* Page size, in kB */
+    struct dirBatch db;         /* For reading /proc */
+    pid_t *pids;                /* PIDs found by the current scan */
+    size_t numPids;
+    size_t maxPids;
+    struct psThread *threads;
+
+    /* The following are used to hand out work to the threads */
+
+    pthread_mutex_t mtx;
+    pthread_cond_t startCond;   /* Signaled at start of scan, or to quit */
+    pthread_cond_t doneCond;    /* Signaled when last worker finishes */
+    unsigned long gen;          /* Incremented for each scan */
+    int active;                 /* Workers still scanning */
+    Boolean quit;
+    psFunc fn;
+    void *arg;
+    size_t next;                /* Next index in 'pids' (atomic) */
+    int stopVal;                /* First nonzero value returned by 'fn' */
+};
+
+/* Parse a decimal number at '*pp' (after any spaces or tabs), and
+   advance '*pp' past it */
+
+static unsigned long long
+parseNum(const char **pp)
+{
+    const char *p = *pp;
+    unsigned long long n;
+    Boolean neg;
+
+    while (*p == ' ' || *p == '\t')
+        p++;
+    neg = (*p == '-');
+    if (neg)
+        p++;
+    for (n = 0; *p >= '0' && *p <= '9'; p++)
+        n = n * 10 + (*p - '0');
+    *pp = p;
+    return neg ? -n : n;
+}
+
+/* Advance '*pp' past 'n' space-delimited fields */
+
+static void
+skipFields(const char **pp, int n)
+{
+    const char *p = *pp;
+
+    for (; n > 0; n--) {
+        while (*p == ' ')
+            p++;
+        while (*p != ' ' && *p != '\0')
+            p++;
+    }
+    *pp = p;
+}
+
+/* Copy the text at 'p', up to a newline or null byte (or at most
+   'size' - 1 characters) into 'buf' */
+
+static void
+copyLine(char *buf, size_t size, const char *p)
+{
+    size_t n;
+
+    while (*p == ' ' || *p == '\t')
+        p++;
+    for (n = 0; n < size - 1 && p[n] != '\n' && p[n] != '\0'; n++)
+        buf[n] = p[n];
+    buf[n] = '\0';
+}
+
+static void
+parseStatus(const char *buf, struct procInfo *pi)
+{
+    const char *p, *eol;
+
+    for (p = buf; *p != '\0'; p = eol + 1) {
+
+        /* Check the first character before calling strncmp() */
+
+        switch (*p) {
+        case 'N':
+            if (strncmp(p, "Name:", 5) == 0)
+                copyLine(pi->name, sizeof(pi->name), p + 5);
+            break;
+        case 'S':
+            if (strncmp(p, "State:", 6) == 0) {
+                for (p += 6; *p == ' ' || *p == '\t'; p++)
+                    continue;
+                pi->state = *p;
+            }
+            break;
+        case 'P':
+            if (strncmp(p, "PPid:", 5) == 0) {
+                p += 5;
+                pi->ppid = parseNum(&p);
+            }
+            break;
+        case 'U':
+            if (strncmp(p, "Uid:", 4) == 0) {
+                p += 4;
+                pi->ruid = parseNum(&p);
+                pi->euid = parseNum(&p);
+            }
+            break;
+        case 'G':
+            if (strncmp(p, "Gid:", 4) == 0) {
+                p += 4;
+                pi->rgid = parseNum(&p);
+                pi->egid = parseNum(&p);
+            }
+            break;
+        case 'V':
+            if (strncmp(p, "VmRSS:", 6) == 0) {
+                p += 6;
+                pi->rssKb = parseNum(&p);
+            }
+            break;
+        case 'T':
+            if (strncmp(p, "Threads:", 8) == 0) {
+                p += 8;
+                pi->threads = parseNum(&p);
+                return;                 /* Nothing further is needed */
+            }
+            break;
+        }
+
+        eol = strchr(p, '\n');
+        if (eol == NULL)
+            break;
+    }
+}
+
+static void
+parseStat(const char *buf, struct procInfo *pi, Boolean haveStatus,
+          long pageKb)
+{
+    const char *p, *q;
+    size_t len;
+
+    /* The command name is enclosed in parentheses, and may itself
+       contain parentheses or spaces; the last ')' ends it */
+
+    p = strchr(buf, '(');
+    q = strrchr(buf, ')');
+    if (p == NULL || q == NULL || q < p)
+        return;
+
+    if (!haveStatus) {
+        len = q - p - 1;
+        if (len >= sizeof(pi->name))
+            len = sizeof(pi->name) - 1;
+        memcpy(pi->name, p + 1, len);
+        pi->name[len] = '\0';
+    }
+
+    /* Fields are numbered as in proc(5); 'p' is after field 2 */
+
+    p = q + 1;
+    while (*p == ' ')
+        p++;
+    pi->state = *p++;                           /* 3 */
+    pi->ppid = parseNum(&p);                    /* 4 */
+    skipFields(&p, 9);                          /* 5 to 13 */
+    pi->utime = parseNum(&p);                   /* 14 */
+    pi->stime = parseNum(&p);                   /* 15 */
+    skipFields(&p, 4);                          /* 16 to 19 */
+    pi->threads = parseNum(&p);                 /* 20 */
+    skipFields(&p, 1);                          /* 21 */
+    pi->startTime = parseNum(&p);               /* 22 */
+    skipFields(&p, 1);                          /* 23 */
+    if (!haveStatus)
+        pi->rssKb = parseNum(&p) * pageKb;      /* 24 */
+}
+
+/* Read the file 'name' (relative to 'dirFd') into 'buf' with a single
+   pread(), and null-terminate it. Return the number of bytes read, or
+   -1 on error. */
+
+static ssize_t
+readFile(int dirFd, const char *name, char *buf)
+{
+    ssize_t numRead;
+    int fd;
+
+    fd = openat(dirFd, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    numRead = pread(fd, buf, BUF_SIZE - 1, 0);
+    close(fd);
+    if (numRead == -1)
+        return -1;
+    buf[numRead] = '\0';
+    return numRead;
+}
+
+/* Gather information about the process 'pid' into 'pi'. Return 0 on
+   success, or -1 if the process has gone (or some other error occurs). */
+
+static int
+readProcess(struct procScanner *ps, struct psThread *pt, pid_t pid,
+            struct procInfo *pi)
+{
+    char path[32];
+    int dirFd;
+
+    memset(pi, 0, sizeof(*pi));
+    pi->pid = pid;
+    pi->thread = pt->index;
+
+    if (ps->flags == (PS_STATUS | PS_STAT)) {
+        snprintf(path, sizeof(path), "%ld", (long) pid);
+        dirFd = openat(ps->procFd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd == -1)
+            return -1;
+
+        if (readFile(dirFd, "status", pt->buf) == -1) {
+            close(dirFd);
+            return -1;
+        }
+        parseStatus(pt->buf, pi);
+        pi->have = PS_STATUS;
+
+        if (readFile(dirFd, "stat", pt->buf) != -1) {
+            parseStat(pt->buf, pi, TRUE, ps->pageKb);
+            pi->have |= PS_STAT;
+        }
+        close(dirFd);
+
+    } else if (ps->flags == PS_STATUS) {
+        snprintf(path, sizeof(path), "%ld/status", (long) pid);
+        if (readFile(ps->procFd, path, pt->buf) == -1)
+            return -1;
+        parseStatus(pt->buf, pi);
+        pi->have = PS_STATUS;
+
+    } else {
+        snprintf(path, sizeof(path), "%ld/stat", (long) pid);
+        if (readFile(ps->procFd, path, pt->buf) == -1)
+            return -1;
+        parseStat(pt->buf, pi, FALSE, ps->pageKb);
+        pi->have = PS_STAT;
+    }
+
+    return 0;
+}
+
+/* Process chunks of 'ps->pids' until there are none left, or the scan
+   has been stopped */
+
+static void
+scanPids(struct procScanner *ps, struct psThread *pt)
+{
+    struct procInfo pi;
+    size_t j, start, end;
+    int s, zero;
+
+    for (;;) {
+        start = __atomic_fetch_add(&ps->next, CHUNK, __ATOMIC_RELAXED);
+        if (start >= ps->numPids)
+            return;
+        end = (start + CHUNK < ps->numPids) ? start + CHUNK : ps->numPids;
+
+        for (j = start; j < end; j++) {
+            if (__atomic_load_n(&ps->stopVal, __ATOMIC_RELAXED) != 0)
+                return;
+            if (readProcess(ps, pt, ps->pids[j], &pi) == -1)
+                continue;
+
+            s = ps->fn(&pi, ps->arg);
+            if (s != 0) {
+                zero = 0;
+                __atomic_compare_exchange_n(&ps->stopVal, &zero, s, FALSE,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+                return;
+            }
+        }
+    }
+}
+
+static void *
+workerFunc(void *arg)
+{
+    struct psThread *pt = arg;
+    struct procScanner *ps = pt->ps;
+    unsigned long gen;
+
+    /* Threads are created before the first scan, when 'ps->gen' is 0; we
+       can't read it here, since psScan() may already have incremented it */
+
+    gen = 0;
+    pthread_mutex_lock(&ps->mtx);
+    for (;;) {
+        while (ps->gen == gen && !ps->quit)
+            pthread_cond_wait(&ps->startCond, &ps->mtx);
+        if (ps->quit)
+            break;
+        gen = ps->gen;
+        pthread_mutex_unlock(&ps->mtx);
+
+        scanPids(ps, pt);
+
+        pthread_mutex_lock(&ps->mtx);
+        if (--ps->active == 0)
+            pthread_cond_signal(&ps->doneCond);
+    }
+    pthread_mutex_unlock(&ps->mtx);
+    return NULL;
+}
+
+/* Create a scanner that reads the files specified by 'flags' using
+   'nthreads' threads (if 'nthreads' is 0 or less, one per online CPU).
+   Return NULL on error. */
+
+struct procScanner *
+psCreate(int flags, int nthreads)
+{
+    struct procScanner *ps;
+    int j, s;
+
+    if ((flags & ~(PS_STATUS | PS_STAT)) != 0 || flags == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0)
+        nthreads = 1;
+
+    ps = calloc(1, sizeof(struct procScanner));
+    if (ps == NULL)
+        return NULL;
+    ps->flags = flags;
+    ps->nthreads = nthreads;
+    ps->pageKb = sysconf(_SC_PAGESIZE) / 1024;
+
+    ps->procFd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (ps->procFd == -1)
+        goto fail;
+    if (dirBatchInit(&ps->db, ps->procFd, 0) == -1)
+        goto fail;
+
+    ps->threads = calloc(nthreads, sizeof(struct psThread));
+    if (ps->threads == NULL)
+        goto fail;
+    for (j = 0; j < nthreads; j++) {
+        ps->threads[j].ps = ps;
+        ps->threads[j].index = j;
+        ps->threads[j].buf = malloc(BUF_SIZE);
+        if (ps->threads[j].buf == NULL)
+            goto fail;
+    }
+
+    pthread_mutex_init(&ps->mtx, NULL);
+    pthread_cond_init(&ps->startCond, NULL);
+    pthread_cond_init(&ps->doneCond, NULL);
+
+    /* Thread 0 is the caller of psScan() */
+
+    for (ps->started = 1; ps->started < nthreads; ps->started++) {
+        s = pthread_create(&ps->threads[ps->started].tid, NULL, workerFunc,
+                           &ps->threads[ps->started]);
+        if (s != 0) {
+            psDestroy(ps);
+            errno = s;
+            return NULL;
+        }
+    }
+
+    return ps;
+
+fail:
+    if (ps->threads != NULL)
+        for (j = 0; j < nthreads; j++)
+            free(ps->threads[j].buf);
+    free(ps->threads);
+    if (ps->db.buf != NULL)
+        dirBatchFree(&ps->db);
+    if (ps->procFd >= 0)
+        close(ps->procFd);
+    free(ps);
+    return NULL;
+}
+
+/* Refill 'ps->pids' from the /proc directory. Return 0 on success, or
+   -1 on error. */
+
+static int
+listPids(struct procScanner *ps)
+{
+    struct dirBatchEnt *ents;
+    ssize_t n, j;
+    const char *p;
+    pid_t pid, *newPids;
+
+    if (lseek(ps->procFd, 0, SEEK_SET) == -1)
+        return -1;
+
+    ps->numPids = 0;
+    while ((n = dirBatchRead(&ps->db, &ents)) > 0) {
+        for (j = 0; j < n; j++) {
+            if (ents[j].type != DT_DIR || ents[j].name[0] < '1' ||
+                    ents[j].name[0] > '9')
+                continue;
+
+            for (pid = 0, p = ents[j].name; *p >= '0' && *p <= '9'; p++)
+                pid = pid * 10 + (*p - '0');
+
+            if (ps->numPids == ps->maxPids) {
+                ps->maxPids = (ps->maxPids == 0) ? 1024 : ps->maxPids * 2;
+                newPids = realloc(ps->pids, ps->maxPids * sizeof(pid_t));
+                if (newPids == NULL)
+                    return -1;
+                ps->pids = newPids;
+            }
+            ps->pids[ps->numPids++] = pid;
+        }
+    }
+
+    return (n == -1) ? -1 : 0;
+}
+
+/* Scan all processes, calling 'fn' for each one, with 'arg' as its
+   second argument */
+
+int
+psScan(struct procScanner *ps, psFunc fn, void *arg)
+{
+    if (listPids(ps) == -1)
+        return -1;
+
+    ps->fn = fn;
+    ps->arg = arg;
+    ps->next = 0;
+    ps->stopVal = 0;
+
+    if (ps->nthreads > 1) {
+        pthread_mutex_lock(&ps->mtx);
+        ps->active = ps->nthreads - 1;
+        ps->gen++;
+        pthread_cond_broadcast(&ps->startCond);
+        pthread_mutex_unlock(&ps->mtx);
+    }
+
+    scanPids(ps, &ps->threads[0]);
+
+    if (ps->nthreads > 1) {
+        pthread_mutex_lock(&ps->mtx);
+        while (ps->active > 0)
+            pthread_cond_wait(&ps->doneCond, &ps->mtx);
+        pthread_mutex_unlock(&ps->mtx);
+    }
+
+    return ps->stopVal;
+}
+
+/* Terminate the scanner's threads and free its resources */
+
+void
+psDestroy(struct procScanner *ps)
+{
+    int j;
+
+    pthread_mutex_lock(&ps->mtx);
+    ps->quit = TRUE;
+    pthread_cond_broadcast(&ps->startCond);
+    pthread_mutex_unlock(&ps->mtx);
+
+    for (j = 1; j < ps->started; j++)
+        pthread_join(ps->threads[j].tid, NULL);
+
+    for (j = 0; j < ps->nthreads; j++)
+        free(ps->threads[j].buf);
+    free(ps->threads);
+    free(ps->pids);
+    dirBatchFree(&ps->db);
+    close(ps->procFd);
+    pthread_mutex_destroy(&ps->mtx);
+    pthread_cond_destroy(&ps->startCond);
+    pthread_cond_destroy(&ps->doneCond);
+    free(ps);
+}
@@ -0,0 +1,55 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 12 */
+
+/* proc_scan.h
+
+   Header file for proc_scan.c.
+*/
+#ifndef PROC_SCAN_H
+#define PROC_SCAN_H             /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+
+/* Flags for psCreate(), specifying which files are read; also used in
+   the 'have' field of struct procInfo */
+
+#define PS_STATUS 1             /* /proc/PID/status */
+#define PS_STAT   2             /* /proc/PID/stat */
+
+struct procInfo {               /* Information about one process */
+    pid_t pid;
+    int thread;                 /* Index (0..nthreads-1) of scanning thread */
+    int have;                   /* Which of PS_STATUS and PS_STAT were read */
+    char name[64];              /* Command name (both) */
+    char state;                 /* Process state, e.g., 'R' (both) */
+    pid_t ppid;                 /* Parent process ID (both) */
+    long threads;               /* Number of threads (both) */
+    long rssKb;                 /* Resident set size (both) */
+    uid_t ruid, euid;           /* Real and effective UID (PS_STATUS) */
+    gid_t rgid, egid;           /* Real and effective GID (PS_STATUS) */
+    unsigned long long utime;   /* User CPU time, in ticks (PS_STAT) */
+    unsigned long long stime;   /* System CPU time, in ticks (PS_STAT) */
+    unsigned long long startTime;       /* Start time, in ticks since
+                                           boot (PS_STAT) */
+};
+
+typedef int (*psFunc)(const struct procInfo *pi, void *arg);
+
+struct procScanner;             /* Opaque; defined in proc_scan.c */
+
+struct procScanner *psCreate(int flags, int nthreads);
+
+int psScan(struct procScanner *ps, psFunc fn, void *arg);
+
+void psDestroy(struct procScanner *ps);
+
+#endif
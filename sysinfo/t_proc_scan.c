@@ -0,0 +1,188 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 12 */
+
+/* t_proc_scan.c
+
+   Demonstrate the proc_scan.c functions: list the processes whose real
+   user ID is that of the user named on the command line (as does
+   procfs_user_exe.c), or, if no user is named, all processes.
+
+   Usage: t_proc_scan [-t nthreads] [-f files] [-r reps] [username]
+
+        -t nthreads  Number of threads used by the scanner (default: 1)
+        -f files     Files read for each process: "status" (default),
+                     "stat", or "both"
+        -r reps      Instead of listing the processes, scan 'reps' times,
+                     and report the average time taken per scan, both
+                     for psScan() and for the readdir()/fopen()/fgets()
+                     approach of procfs_user_exe.c
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <limits.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <time.h>
+#include "proc_scan.h"
+#include "ugid_functions.h"
+#include "tlpi_hdr.h"
+
+#define MAX_THREADS 1024
+
+static uid_t checkedUid = -1;           /* -1 means all processes */
+static Boolean quiet;                   /* Don't list processes */
+static long matched[MAX_THREADS];       /* Per-thread match counts */
+
+static int
+showProcess(const struct procInfo *pi, void *arg)
+{
+    if (checkedUid != -1 && (!(pi->have & PS_STATUS) ||
+                pi->ruid != checkedUid))
+        return 0;
+
+    matched[pi->thread]++;
+    if (!quiet)
+        printf("%5ld %c %5ld %8ld kB %s\n", (long) pi->pid, pi->state,
+               (long) pi->ppid, pi->rssKb, pi->name);
+    return 0;
+}
+
+/* The approach used in procfs_user_exe.c, for comparison; returns the
+   number of matching processes */
+
+static long
+scanStdio(void)
+{
+    DIR *dirp;
+    struct dirent *dp;
+    char path[PATH_MAX], line[1000];
+    FILE *fp;
+    uid_t uid;
+    long n;
+
+    dirp = opendir("/proc");
+    if (dirp == NULL)
+        errExit("opendir");
+
+    n = 0;
+    while ((dp = readdir(dirp)) != NULL) {
+        if (dp->d_type != DT_DIR || !isdigit((unsigned char) dp->d_name[0]))
+            continue;
+
+        snprintf(path, sizeof(path), "/proc/%s/status", dp->d_name);
+        fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+
+        uid = -1;
+        while (fgets(line, sizeof(line), fp) != NULL)
+            if (strncmp(line, "Uid:", 4) == 0) {
+                uid = strtol(line + 4, NULL, 10);
+                break;
+            }
+        fclose(fp);
+
+        if (checkedUid == -1 || uid == checkedUid)
+            n++;
+    }
+
+    closedir(dirp);
+    return n;
+}
+
+static double
+secsSince(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct procScanner *ps;
+    struct timespec start;
+    int opt, nthreads, flags, reps, j;
+    long total, n;
+    double secs;
+
+    nthreads = 1;
+    flags = PS_STATUS;
+    reps = 0;
+    while ((opt = getopt(argc, argv, "t:f:r:")) != -1) {
+        switch (opt) {
+        case 't':
+            nthreads = getInt(optarg, GN_GT_0, "-t");
+            if (nthreads > MAX_THREADS)
+                cmdLineErr("At most %d threads\n", MAX_THREADS);
+            break;
+        case 'f':
+            if (strcmp(optarg, "status") == 0)
+                flags = PS_STATUS;
+            else if (strcmp(optarg, "stat") == 0)
+                flags = PS_STAT;
+            else if (strcmp(optarg, "both") == 0)
+                flags = PS_STATUS | PS_STAT;
+            else
+                cmdLineErr("Bad -f argument: %s\n", optarg);
+            break;
+        case 'r':
+            reps = getInt(optarg, GN_GT_0, "-r");
+            break;
+        default:
+            usageErr("%s [-t nthreads] [-f status|stat|both] [-r reps] "
+                     "[username]\n", argv[0]);
+        }
+    }
+
+    if (optind < argc) {
+        checkedUid = userIdFromName(argv[optind]);
+        if (checkedUid == -1)
+            cmdLineErr("Bad username: %s\n", argv[optind]);
+        if (!(flags & PS_STATUS))
+            cmdLineErr("Matching a user requires -f status or -f both\n");
+    }
+
+    ps = psCreate(flags, nthreads);
+    if (ps == NULL)
+        errExit("psCreate");
+
+    if (reps == 0) {
+        if (psScan(ps, showProcess, NULL) == -1)
+            errExit("psScan");
+        exit(EXIT_SUCCESS);
+    }
+
+    quiet = TRUE;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (j = 0; j < reps; j++)
+        if (psScan(ps, showProcess, NULL) == -1)
+            errExit("psScan");
+    secs = secsSince(&start);
+    for (total = 0, j = 0; j < nthreads; j++)
+        total += matched[j];
+    printf("psScan():       %ld processes per scan, %.1f usec per scan\n",
+           total / reps, secs * 1e6 / reps);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (n = 0, j = 0; j < reps; j++)
+        n += scanStdio();
+    secs = secsSince(&start);
+    printf("stdio (status): %ld processes per scan, %.1f usec per scan\n",
+           n / reps, secs * 1e6 / reps);
+
+    psDestroy(ps);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,180 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 31 */
+
+/* err_storm.c
+
+   Measure the cost of reporting errors from many threads at once (as a
+   server might, during a storm of EAGAIN errors) with errMsg() and with
+   errMsgFast() (fast_err.c), with and without rate limiting.
+
+   Usage: err_storm [-t nthreads] [-n msgs] [-m mode[,mode...]]
+                    [-b burst] [-i interval-ms] [-o file]
+
+        -t nthreads  Number of threads reporting errors (default: 4)
+        -n msgs      Total number of messages reported in each
+                     repetition of each benchmark (default: 100000)
+        -m modes     Any of 'errMsg', 'fast', and 'limited' (errMsgFast()
+                     with rate limiting) (default: all three)
+        -b burst     Rate limit: messages allowed per interval
+                     (default: 10)
+        -i interval  Rate limit: interval, in milliseconds (default: 1000)
+        -o file      Write the messages to 'file' (default: /dev/null)
+
+   Each thread reports errors about a few different file descriptors,
+   so that rate limiting applies to each of several distinct messages.
+   The results are reported in the common format of lib/bench.c (the
+   time per message, over all threads), followed, for the rate-limited
+   mode, by the number of messages that were suppressed.
+
+   Try: ./err_storm -t 8
+        ./err_storm -t 2 -n 1000 -m limited -b 2 -i 10 -o /tmp/err.log
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include "fast_err.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+#define NUM_FDS 4               /* Distinct messages per thread */
+
+enum mode { M_ERRMSG, M_FAST, M_LIMITED };
+
+struct stormArg {
+    enum mode mode;
+    int nthreads;
+    long perThread;
+};
+
+static void *
+reporter(void *arg)
+{
+    struct stormArg *sa = arg;
+    long j;
+
+    for (j = 0; j < sa->perThread; j++) {
+        errno = EAGAIN;
+        if (sa->mode == M_ERRMSG)
+            errMsg("read() on fd %ld", 10 + j % NUM_FDS);
+        else
+            errMsgFast("read() on fd %ld", 10 + j % NUM_FDS);
+    }
+    return NULL;
+}
+
+/* The function measured by benchRun(): 'ops' messages, in total, from
+   'nthreads' threads */
+
+static void
+storm(long ops, void *arg)
+{
+    struct stormArg *sa = arg;
+    pthread_t *thr;
+    int j, s;
+
+    sa->perThread = ops / sa->nthreads;
+    thr = calloc(sa->nthreads, sizeof(pthread_t));
+    if (thr == NULL)
+        errExit("calloc");
+    for (j = 0; j < sa->nthreads; j++) {
+        s = pthread_create(&thr[j], NULL, reporter, sa);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    for (j = 0; j < sa->nthreads; j++) {
+        s = pthread_join(thr[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+    free(thr);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char *modeName[] = { "errMsg", "fast", "limited" };
+    struct benchResult res;
+    struct stormArg sa;
+    Boolean want[3];
+    char name[64], *tok;
+    const char *file;
+    int opt, burst, interval, outFd, savedFd, m;
+    long msgs;
+
+    sa.nthreads = 4;
+    msgs = 100000;
+    burst = 10;
+    interval = 1000;
+    file = "/dev/null";
+    want[M_ERRMSG] = want[M_FAST] = want[M_LIMITED] = TRUE;
+    while ((opt = getopt(argc, argv, "t:n:m:b:i:o:")) != -1) {
+        switch (opt) {
+        case 't': sa.nthreads = getInt(optarg, GN_GT_0, "-t");  break;
+        case 'n': msgs = getLong(optarg, GN_GT_0, "-n");        break;
+        case 'b': burst = getInt(optarg, GN_GT_0, "-b");        break;
+        case 'i': interval = getInt(optarg, GN_GT_0, "-i");     break;
+        case 'o': file = optarg;                                break;
+        case 'm':
+            want[M_ERRMSG] = want[M_FAST] = want[M_LIMITED] = FALSE;
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                for (m = M_ERRMSG; m <= M_LIMITED; m++)
+                    if (strcmp(tok, modeName[m]) == 0)
+                        break;
+                if (m > M_LIMITED)
+                    cmdLineErr("Unknown mode: %s\n", tok);
+                want[m] = TRUE;
+            }
+            break;
+        default:
+            usageErr("%s [-t nthreads] [-n msgs] [-m mode[,mode...]] "
+                     "[-b burst] [-i interval-ms] [-o file]\n", argv[0]);
+        }
+    }
+    if (msgs < sa.nthreads)
+        cmdLineErr("Fewer messages than threads\n");
+
+    /* Direct the messages to 'file', keeping a copy of the original
+       standard error for our own diagnostics */
+
+    outFd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (outFd == -1)
+        errExit("open %s", file);
+    savedFd = dup(STDERR_FILENO);
+    if (savedFd == -1)
+        errExit("dup");
+
+    for (m = M_ERRMSG; m <= M_LIMITED; m++) {
+        if (!want[m])
+            continue;
+        sa.mode = m;
+        errFastRateLimit((m == M_LIMITED) ? burst : 0, interval);
+
+        if (dup2(outFd, STDERR_FILENO) == -1)
+            errExit("dup2");
+        snprintf(name, sizeof(name), "err_storm: %s, %d threads",
+                 modeName[m], sa.nthreads);
+        if (benchRun(name, storm, &sa, msgs, NULL, &res) == -1)
+            errExit("benchRun");
+        if (dup2(savedFd, STDERR_FILENO) == -1)
+            errExit("dup2");
+
+        benchReport(&res);
+    }
+
+    if (want[M_LIMITED])
+        printf("Suppressed by rate limiting: %ld messages\n",
+               errFastSuppressed());
+    exit(EXIT_SUCCESS);
+}
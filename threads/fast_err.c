@@ -0,0 +1,215 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 31 */
+
+/* fast_err.c
+
+   errMsgFast() and errMsgFastEN(): versions of errMsg() (and an errMsg()
+   that takes the error number as an argument, like errExitEN()) for
+   multithreaded programs that may report errors at a high rate, for
+   example, a server that hits a storm of EAGAIN errors.
+
+   errMsg() (error_functions.c) formats the message in buffers on the
+   stack, and then calls fflush(stdout), fputs(), and fflush(stderr),
+   each of which takes the lock on the stdio stream, so that threads
+   that report errors at the same time are serialized on those locks.
+   These functions instead format the message (in the same form as
+   errMsg()) in a buffer that belongs to the calling thread, and write
+   it to standard error with a single write(), which the kernel performs
+   atomically with respect to other writes to the same file (on a pipe,
+   for messages of up to PIPE_BUF bytes), so that messages from
+   different threads are not interleaved. Nothing is allocated, and no
+   lock is taken: vsnprintf() on a string takes no lock, and
+   strerror_r() is used in place of strerror(). Unlike errMsg(), these
+   functions don't flush stdout; messages that a thread writes to
+   stderr with stdio may appear out of order with respect to them.
+
+   Optionally (errFastRateLimit()), repeats of a message can be limited:
+   only 'burst' identical messages (the same text, after formatting) are
+   written in each interval of 'intervalMs' milliseconds, and the rest
+   are counted and dropped. The first message written in a new interval
+   is followed by a count of the repeats that were suppressed during the
+   previous interval. Messages are tracked in a small table, indexed by a
+   hash of the message, whose entries are updated with atomic operations
+   rather than under a lock; so, when two different messages that hash
+   to the same entry are reported at the same time, or when a new
+   interval begins, a few extra repeats may be written or suppressed.
+   errFastSuppressed() returns the total number of suppressed messages.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "fast_err.h"
+#include "tlpi_hdr.h"
+#include "ename.c.inc"          /* Defines ename and MAX_ENAME */
+
+#define MSG_SIZE 1024           /* Longest message (truncated beyond) */
+#define NUM_SLOTS 256           /* Rate-limiting table; a power of 2 */
+
+struct rlSlot {                 /* Rate-limiting state for a message */
+    uint64_t hash;              /* Hash of the message text */
+    int64_t windowStart;        /* Start of current interval (ns) */
+    long count;                 /* Messages in current interval */
+    long suppressed;            /* Suppressed in current interval */
+};
+
+static __thread char msgBuf[MSG_SIZE];
+
+static int rlBurst;             /* 0: no rate limiting */
+static int64_t rlIntervalNs;
+static struct rlSlot slots[NUM_SLOTS];
+static long totalSuppressed;
+
+/* Limit identical messages to 'burst' in each 'intervalMs' milliseconds;
+   a 'burst' of 0 (the default) disables rate limiting */
+
+void
+errFastRateLimit(int burst, int intervalMs)
+{
+    __atomic_store_n(&rlIntervalNs, (int64_t) intervalMs * 1000000,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&rlBurst, burst, __ATOMIC_RELAXED);
+}
+
+/* Return the number of messages that have been suppressed */
+
+long
+errFastSuppressed(void)
+{
+    return __atomic_load_n(&totalSuppressed, __ATOMIC_RELAXED);
+}
+
+static uint64_t
+hashMsg(const char *s, size_t len)
+{
+    uint64_t h;
+    size_t j;
+
+    h = 14695981039346656037ULL;                /* FNV-1a */
+    for (j = 0; j < len; j++)
+        h = (h ^ (unsigned char) s[j]) * 1099511628211ULL;
+    return h;
+}
+
+/* Decide whether to write the message with hash 'h'. Returns -1 if the
+   message should be suppressed; otherwise, returns the number of
+   repeats that were suppressed in the previous interval. */
+
+static long
+rateCheck(uint64_t h, int burst)
+{
+    struct rlSlot *s = &slots[h & (NUM_SLOTS - 1)];
+    struct timespec ts;
+    int64_t now, start;
+    long prev;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    now = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    start = __atomic_load_n(&s->windowStart, __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&s->hash, __ATOMIC_RELAXED) != h ||
+            now - start >= __atomic_load_n(&rlIntervalNs, __ATOMIC_RELAXED)) {
+
+        /* A different message, or a new interval. Only the thread whose
+           compare-and-swap succeeds resets the slot; the others count
+           their message in the new interval. */
+
+        if (__atomic_compare_exchange_n(&s->windowStart, &start, now, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            prev = __atomic_exchange_n(&s->suppressed, 0, __ATOMIC_RELAXED);
+            if (__atomic_exchange_n(&s->hash, h, __ATOMIC_RELAXED) != h)
+                prev = 0;       /* Repeats were of another message */
+            __atomic_store_n(&s->count, 1, __ATOMIC_RELAXED);
+            return prev;
+        }
+    }
+
+    if (__atomic_add_fetch(&s->count, 1, __ATOMIC_RELAXED) <= burst)
+        return 0;
+
+    __atomic_add_fetch(&s->suppressed, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&totalSuppressed, 1, __ATOMIC_RELAXED);
+    return -1;
+}
+
+static void
+outputErrorFast(int err, const char *format, va_list ap)
+{
+    char errText[256];
+    const char *desc;
+    size_t len;
+    long prev;
+    int burst, n;
+
+    desc = strerror_r(err, errText, sizeof(errText));
+    n = snprintf(msgBuf, MSG_SIZE, "ERROR [%s %s] ",
+                 (err > 0 && err <= MAX_ENAME) ? ename[err] : "?UNKNOWN?",
+                 desc);
+    len = (n < MSG_SIZE) ? n : MSG_SIZE - 1;
+    n = vsnprintf(msgBuf + len, MSG_SIZE - len, format, ap);
+    len = (n < 0) ? len : (len + n < MSG_SIZE) ? len + n : MSG_SIZE - 1;
+
+    burst = __atomic_load_n(&rlBurst, __ATOMIC_RELAXED);
+    if (burst > 0) {
+        prev = rateCheck(hashMsg(msgBuf, len), burst);
+        if (prev == -1)
+            return;
+        if (prev > 0 && len < MSG_SIZE - 1) {
+            n = snprintf(msgBuf + len, MSG_SIZE - len,
+                         " [%ld repeats suppressed]", prev);
+            len = (len + n < MSG_SIZE) ? len + n : MSG_SIZE - 1;
+        }
+    }
+
+    msgBuf[len++] = '\n';       /* Replaces terminating null byte */
+    if (write(STDERR_FILENO, msgBuf, len) == -1)
+        return;                 /* Nothing useful can be done */
+}
+
+/* Like errMsg(): display an error message including an 'errno'
+   diagnostic, and return to the caller */
+
+void
+errMsgFast(const char *format, ...)
+{
+    va_list argList;
+    int savedErrno;
+
+    savedErrno = errno;
+
+    va_start(argList, format);
+    outputErrorFast(savedErrno, format, argList);
+    va_end(argList);
+
+    errno = savedErrno;
+}
+
+/* Like errMsgFast(), but with the error number in 'errnum' */
+
+void
+errMsgFastEN(int errnum, const char *format, ...)
+{
+    va_list argList;
+    int savedErrno;
+
+    savedErrno = errno;
+
+    va_start(argList, format);
+    outputErrorFast(errnum, format, argList);
+    va_end(argList);
+
+    errno = savedErrno;
+}
@@ -0,0 +1,36 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 31 */
+
+/* fast_err.h
+
+   Header file for fast_err.c.
+*/
+#ifndef FAST_ERR_H
+#define FAST_ERR_H              /* Prevent accidental double inclusion */
+
+void errMsgFast(const char *format, ...)
+#ifdef __GNUC__
+    __attribute__ ((format (printf, 1, 2)))
+#endif
+    ;
+
+void errMsgFastEN(int errnum, const char *format, ...)
+#ifdef __GNUC__
+    __attribute__ ((format (printf, 2, 3)))
+#endif
+    ;
+
+void errFastRateLimit(int burst, int intervalMs);
+
+long errFastSuppressed(void);
+
+#endif
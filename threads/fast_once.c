@@ -0,0 +1,114 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 31 */
+
+/* fast_once.c
+
+   One-time initialization, like pthread_once() (and one_time_init.c),
+   but:
+
+   *  Once initialization is complete, fastOnce() takes no lock: it is
+      an acquire load of the state word, which pairs with the release
+      store made when initialization completed, so that everything
+      written by the initialization function is visible to the caller.
+      (one_time_init.c locks and unlocks a mutex on every call; with
+      many threads calling it, the cache line holding the mutex bounces
+      between CPUs.)
+
+   *  The initialization function, init(arg), returns 0 on success, or
+      an error number. If it fails, fastOnce() returns that error
+      number, and initialization is not considered done: the next call
+      (or a thread that was waiting for it) calls init() again. (With
+      pthread_once(), a failed initialization can't be retried.)
+
+   Threads that call fastOnce() while another thread is running init()
+   wait on a futex in the state word, and the thread that ran init()
+   makes a FUTEX_WAKE call only if there are waiters.
+
+   Usage:
+
+        static struct fastOnce once = FAST_ONCE_INITIALIZER;
+        ...
+        err = fastOnce(&once, init, arg);
+
+   fastOnce() returns 0 once initialization has been done, or the
+   error number returned by a failed init().
+
+   As with pthread_once(), init() must not call fastOnce() for the same
+   'struct fastOnce'. Unlike pthread_once(), if the thread running init()
+   is canceled, other callers wait forever; init() should not contain
+   cancellation points (or should disable cancellation).
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <unistd.h>
+#include <errno.h>
+#include "fast_once.h"          /* Declares functions defined here */
+
+/* States of the state word */
+
+#define FO_INIT 0               /* Not done; no thread is running init() */
+#define FO_RUNNING 1            /* A thread is running init() */
+#define FO_WAITERS 2            /* ... and other threads may be waiting */
+/* FO_DONE (3; in fast_once.h) */
+
+int
+fastOnceSlow(struct fastOnce *fo, int (*init)(void *), void *arg)
+{
+    uint32_t s, old;
+    int err, savedErrno;
+
+    for (;;) {
+        s = __atomic_load_n(&fo->state, __ATOMIC_ACQUIRE);
+        if (s == FO_DONE)
+            return 0;
+
+        if (s == FO_INIT) {
+            if (!__atomic_compare_exchange_n(&fo->state, &s, FO_RUNNING, 0,
+                                             __ATOMIC_ACQUIRE,
+                                             __ATOMIC_ACQUIRE))
+                continue;
+
+            /* We run init(); on failure, return the state to FO_INIT,
+               so that the next caller (perhaps one of the waiters) tries
+               again */
+
+            err = init(arg);
+            old = __atomic_exchange_n(&fo->state,
+                                      (err == 0) ? FO_DONE : FO_INIT,
+                                      __ATOMIC_RELEASE);
+            if (old == FO_WAITERS) {
+                savedErrno = errno;
+                syscall(SYS_futex, &fo->state, FUTEX_WAKE_PRIVATE, INT32_MAX,
+                        NULL, NULL, 0);
+                errno = savedErrno;
+            }
+            return err;
+        }
+
+        /* Another thread is running init(): note that we're waiting, and
+           sleep until the state changes. (FUTEX_WAIT fails with EAGAIN
+           if the state is no longer FO_WAITERS.) */
+
+        if (s == FO_RUNNING &&
+                !__atomic_compare_exchange_n(&fo->state, &s, FO_WAITERS, 0,
+                                             __ATOMIC_RELAXED,
+                                             __ATOMIC_RELAXED))
+            continue;
+        savedErrno = errno;
+        syscall(SYS_futex, &fo->state, FUTEX_WAIT_PRIVATE, FO_WAITERS,
+                NULL, NULL, 0);
+        errno = savedErrno;
+    }
+}
@@ -0,0 +1,43 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 31 */
+
+/* fast_once.h
+
+   Header file for fast_once.c.
+
+   fastOnce() is inline, so that once initialization has been done, a
+   call costs just a load and a comparison.
+*/
+#ifndef FAST_ONCE_H
+#define FAST_ONCE_H             /* Prevent accidental double inclusion */
+
+#include <stdint.h>
+
+struct fastOnce {
+    uint32_t state;             /* FO_* in fast_once.c */
+};
+
+#define FAST_ONCE_INITIALIZER { 0 }
+
+#define FO_DONE 3
+
+int fastOnceSlow(struct fastOnce *fo, int (*init)(void *), void *arg);
+
+static inline int
+fastOnce(struct fastOnce *fo, int (*init)(void *), void *arg)
+{
+    if (__atomic_load_n(&fo->state, __ATOMIC_ACQUIRE) == FO_DONE)
+        return 0;
+    return fastOnceSlow(fo, init, arg);
+}
+
+#endif
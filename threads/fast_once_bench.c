@@ -0,0 +1,264 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 31 */
+
+/* fast_once_bench.c
+
+   Compare the cost of calling a one-time initialization function after
+   initialization is done, for the mutex-based one_time_init.c,
+   pthread_once(), and fastOnce() (fast_once.c), and check that each runs
+   the initialization exactly once when many threads make their first
+   call simultaneously.
+
+   Usage: fast_once_bench [-t nthreads] [-n calls] [-s init-usecs]
+                          [-f failures]
+
+        -t nthreads     Comma-separated list of thread counts (default:
+                        1,4,16,64)
+        -n calls        Calls per thread (default: 10000000)
+        -s init-usecs   Time taken by the initialization function
+                        (default: 1000)
+        -f failures     The first 'failures' calls of the
+                        initialization function for fastOnce() fail, and
+                        must be retried (default: 0)
+
+   For each method and thread count, the program first starts all of the
+   threads together, so that they race to make the first call, and checks
+   that the initialization function ran once (for fastOnce(), once plus
+   the number of failures), and that no thread returned before it had
+   completed. Then each thread makes 'calls' calls, and the program
+   shows the mean CPU time per call, and the calls per second made by all
+   of the threads.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <time.h>
+#include "fast_once.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+#define MAX_LIST 64             /* Maximum items in a comma-separated list */
+
+enum { M_MUTEX, M_PTHREAD, M_FAST, NMETHODS };
+
+static const char *methodNames[NMETHODS] = {
+    "mutex", "pthread_once", "fastOnce"
+};
+
+struct onceMutex {              /* As in one_time_init.c */
+    pthread_mutex_t mtx;
+    int called;
+};
+
+static struct onceMutex onceMtx;
+static pthread_once_t oncePthread;
+static struct fastOnce onceFast;
+
+static int method;
+static long numCalls;
+static int initUsecs, failures;
+static pthread_barrier_t barrier;
+static volatile int initCalls;          /* Calls of the init function */
+static volatile int initDone;           /* Set by a successful init */
+static volatile int earlyReturns;       /* Returned before 'initDone' */
+
+struct thread {
+    pthread_t tid;
+    long long cpuNs;
+};
+
+static long long
+clockNs(clockid_t clk)
+{
+    struct timespec ts;
+
+    if (clock_gettime(clk, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+slowInit(void)
+{
+    __atomic_fetch_add(&initCalls, 1, __ATOMIC_RELAXED);
+    usleep(initUsecs);
+    initDone = 1;
+}
+
+static int
+fallibleInit(void *arg)
+{
+    int n;
+
+    n = __atomic_fetch_add(&initCalls, 1, __ATOMIC_RELAXED);
+    usleep(initUsecs);
+    if (n < failures)
+        return EAGAIN;
+    initDone = 1;
+    return 0;
+}
+
+/* Call 'method's one-time initialization; for fastOnce(), retry failed
+   initializations. */
+
+static inline void
+callOnce(void)
+{
+    int s;
+
+    switch (method) {
+    case M_MUTEX:
+        s = pthread_mutex_lock(&onceMtx.mtx);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_lock");
+        if (!onceMtx.called) {
+            slowInit();
+            onceMtx.called = 1;
+        }
+        s = pthread_mutex_unlock(&onceMtx.mtx);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_unlock");
+        break;
+
+    case M_PTHREAD:
+        s = pthread_once(&oncePthread, slowInit);
+        if (s != 0)
+            errExitEN(s, "pthread_once");
+        break;
+
+    case M_FAST:
+        while (fastOnce(&onceFast, fallibleInit, NULL) != 0)
+            continue;
+        break;
+    }
+}
+
+static void *
+threadFunc(void *arg)
+{
+    struct thread *t = arg;
+    long long start;
+    long j;
+
+    pthread_barrier_wait(&barrier);     /* Race to make the first call */
+    callOnce();
+    if (!initDone)
+        __atomic_fetch_add(&earlyReturns, 1, __ATOMIC_RELAXED);
+
+    pthread_barrier_wait(&barrier);
+    start = clockNs(CLOCK_THREAD_CPUTIME_ID);
+    for (j = 0; j < numCalls; j++)
+        callOnce();
+    t->cpuNs = clockNs(CLOCK_THREAD_CPUTIME_ID) - start;
+    return NULL;
+}
+
+static void
+runTest(int nthreads)
+{
+    static const pthread_once_t onceInit = PTHREAD_ONCE_INIT;
+    static const struct fastOnce fastInit = FAST_ONCE_INITIALIZER;
+    struct thread *thr;
+    long long start, wallNs, cpuNs;
+    int expected, s, j;
+
+    onceMtx.called = 0;
+    oncePthread = onceInit;
+    onceFast = fastInit;
+    initCalls = initDone = earlyReturns = 0;
+
+    thr = calloc(nthreads, sizeof(struct thread));
+    if (thr == NULL)
+        errExit("calloc");
+    s = pthread_barrier_init(&barrier, NULL, nthreads);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_init");
+
+    start = clockNs(CLOCK_MONOTONIC);
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_create(&thr[j].tid, NULL, threadFunc, &thr[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    cpuNs = 0;
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_join(thr[j].tid, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+        cpuNs += thr[j].cpuNs;
+    }
+    wallNs = clockNs(CLOCK_MONOTONIC) - start;
+
+    expected = (method == M_FAST) ? failures + 1 : 1;
+    printf("%-13s %8d %10.2f %14.0f%s%s\n", methodNames[method], nthreads,
+           (double) cpuNs / nthreads / numCalls,
+           (double) nthreads * numCalls / (wallNs / 1e9),
+           (initCalls != expected) ? "  INIT CALLS WRONG" : "",
+           (earlyReturns != 0) ? "  EARLY RETURN" : "");
+    if (initCalls != expected || earlyReturns != 0)
+        fprintf(stderr, "init calls: %d (expected %d); early returns: %d\n",
+                initCalls, expected, earlyReturns);
+
+    s = pthread_barrier_destroy(&barrier);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_destroy");
+    free(thr);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-t nthreads] [-n calls] [-s init-usecs] "
+                    "[-f failures]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char defThreads[] = "1,4,16,64";
+    int threadList[MAX_LIST];
+    int opt, nt, j, s;
+
+    numCalls = 10000000;
+    initUsecs = 1000;
+    failures = 0;
+    nt = 0;
+    while ((opt = getopt(argc, argv, "t:n:s:f:")) != -1) {
+        switch (opt) {
+        case 't':
+            nt = benchParseList(optarg, threadList, MAX_LIST, GN_GT_0, "-t");
+            break;
+        case 'n': numCalls = getLong(optarg, GN_GT_0, "-n");            break;
+        case 's': initUsecs = getInt(optarg, GN_NONNEG, "-s");          break;
+        case 'f': failures = getInt(optarg, GN_NONNEG, "-f");           break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+    if (nt == 0)
+        nt = benchParseList(defThreads, threadList, MAX_LIST, GN_GT_0, "-t");
+
+    s = pthread_mutex_init(&onceMtx.mtx, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_init");
+
+    printf("%-13s %8s %10s %14s\n", "method", "threads", "ns/call",
+           "calls/sec");
+    for (method = 0; method < NMETHODS; method++)
+        for (j = 0; j < nt; j++)
+            runTest(threadList[j]);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,213 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 30 */
+
+/* lf_queue.c
+
+   Bounded lock-free queues of pointers, for passing items between
+   threads without a mutex:
+
+   spscInit(), spscPush(), spscPop(), spscFree()
+        A queue that may be used by exactly one producer thread and one
+        consumer thread.
+
+   mpmcInit(), mpmcPush(), mpmcPop(), mpmcFree()
+        A queue that may be used by any number of producers and consumers
+        (D. Vyukov's bounded MPMC queue).
+
+   The capacity of each queue is rounded up to a power of 2. The push
+   functions return FALSE if the queue is full, and the pop functions
+   return FALSE if it is empty; they never block. A caller that must wait
+   can retry (perhaps after sched_yield()), or use some other mechanism,
+   such as a condition variable, to sleep.
+
+   The memory ordering is the minimum needed: the release store that
+   publishes an index (or a cell sequence number) makes the item visible
+   to the thread that performs the corresponding acquire load.
+*/
+#include <stdlib.h>
+#include "lf_queue.h"
+
+/* Return the smallest power of 2 that is >= 'n' (at least 2) */
+
+static size_t
+roundPow2(size_t n)
+{
+    size_t p;
+
+    for (p = 2; p < n; p <<= 1)
+        continue;
+    return p;
+}
+
+/* Initialize 'q' to hold at least 'capacity' items. Returns 0 on
+   success, or -1 on error. */
+
+int
+spscInit(struct spscQueue *q, size_t capacity)
+{
+    capacity = roundPow2(capacity);
+
+    q->head = q->tailCache = 0;
+    q->tail = q->headCache = 0;
+    q->mask = capacity - 1;
+    q->slots = malloc(capacity * sizeof(void *));
+    return (q->slots == NULL) ? -1 : 0;
+}
+
+/* Add 'item' to 'q'; may be called only by the producer */
+
+Boolean
+spscPush(struct spscQueue *q, void *item)
+{
+    size_t head = q->head;      /* Only we modify 'head' */
+
+    /* Consult the consumer's cache line only if our copy of 'tail'
+       suggests that the queue is full */
+
+    if (head - q->tailCache > q->mask) {
+        q->tailCache = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        if (head - q->tailCache > q->mask)
+            return FALSE;
+    }
+
+    q->slots[head & q->mask] = item;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+/* Remove the oldest item from 'q', placing it in '*item'; may be
+   called only by the consumer */
+
+Boolean
+spscPop(struct spscQueue *q, void **item)
+{
+    size_t tail = q->tail;      /* Only we modify 'tail' */
+
+    if (tail == q->headCache) {
+        q->headCache = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+        if (tail == q->headCache)
+            return FALSE;
+    }
+
+    *item = q->slots[tail & q->mask];
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+void
+spscFree(struct spscQueue *q)
+{
+    free(q->slots);
+    q->slots = NULL;
+}
+
+/* Initialize 'q' to hold at least 'capacity' items. Returns 0 on
+   success, or -1 on error. */
+
+int
+mpmcInit(struct mpmcQueue *q, size_t capacity)
+{
+    size_t j;
+
+    capacity = roundPow2(capacity);
+
+    q->cells = malloc(capacity * sizeof(struct mpmcCell));
+    if (q->cells == NULL)
+        return -1;
+
+    /* Cell 'j' is initially ready for the producer that obtains
+       enqueue position 'j' */
+
+    for (j = 0; j < capacity; j++)
+        q->cells[j].seq = j;
+
+    q->mask = capacity - 1;
+    q->enqPos = q->deqPos = 0;
+    return 0;
+}
+
+/* Add 'item' to 'q' */
+
+Boolean
+mpmcPush(struct mpmcQueue *q, void *item)
+{
+    struct mpmcCell *cell;
+    size_t pos, seq;
+    long diff;
+
+    pos = __atomic_load_n(&q->enqPos, __ATOMIC_RELAXED);
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        diff = (long) (seq - pos);
+
+        if (diff == 0) {                /* Cell is free: try to claim it */
+            if (__atomic_compare_exchange_n(&q->enqPos, &pos, pos + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+            /* On failure, 'pos' was updated; try again */
+        } else if (diff < 0) {          /* Cell still holds an item from
+                                           the previous lap: queue full */
+            return FALSE;
+        } else {                        /* Another producer claimed 'pos' */
+            pos = __atomic_load_n(&q->enqPos, __ATOMIC_RELAXED);
+        }
+    }
+
+    /* Store the item, then mark the cell as ready for the consumer that
+       obtains dequeue position 'pos' */
+
+    cell->data = item;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+/* Remove the oldest item from 'q', placing it in '*item' */
+
+Boolean
+mpmcPop(struct mpmcQueue *q, void **item)
+{
+    struct mpmcCell *cell;
+    size_t pos, seq;
+    long diff;
+
+    pos = __atomic_load_n(&q->deqPos, __ATOMIC_RELAXED);
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        diff = (long) (seq - (pos + 1));
+
+        if (diff == 0) {                /* Cell is filled: try to claim it */
+            if (__atomic_compare_exchange_n(&q->deqPos, &pos, pos + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {          /* Cell not yet filled: empty */
+            return FALSE;
+        } else {                        /* Another consumer claimed 'pos' */
+            pos = __atomic_load_n(&q->deqPos, __ATOMIC_RELAXED);
+        }
+    }
+
+    /* Take the item, then make the cell available to the producer on the
+       next lap around the ring */
+
+    *item = cell->data;
+    __atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+void
+mpmcFree(struct mpmcQueue *q)
+{
+    free(q->cells);
+    q->cells = NULL;
+}
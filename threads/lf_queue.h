@@ -0,0 +1,77 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 30 */
+
+/* lf_queue.h
+
+   Header file for lf_queue.c.
+*/
+#ifndef LF_QUEUE_H
+#define LF_QUEUE_H              /* Prevent accidental double inclusion */
+
+#include <stddef.h>
+#include "tlpi_hdr.h"
+
+#define LFQ_CACHE_LINE 64
+
+/* Single-producer, single-consumer queue. 'head' is modified only by
+   the producer and 'tail' only by the consumer; each is in a cache line
+   of its own, together with that thread's (possibly stale) copy of the
+   other index. */
+
+struct spscQueue {
+    size_t head __attribute__ ((aligned(LFQ_CACHE_LINE)));
+                                /* Number of items pushed */
+    size_t tailCache;           /* Producer's last view of 'tail' */
+
+    size_t tail __attribute__ ((aligned(LFQ_CACHE_LINE)));
+                                /* Number of items popped */
+    size_t headCache;           /* Consumer's last view of 'head' */
+
+    void **slots __attribute__ ((aligned(LFQ_CACHE_LINE)));
+    size_t mask;                /* Capacity - 1 */
+};
+
+/* Multiple-producer, multiple-consumer queue. Each cell carries a
+   sequence number that tells a producer or consumer whether the cell is
+   ready for it, so that the threads need only compete (via
+   compare-and-swap) for the enqueue and dequeue positions. */
+
+struct mpmcCell {
+    size_t seq;
+    void *data;
+};
+
+struct mpmcQueue {
+    size_t enqPos __attribute__ ((aligned(LFQ_CACHE_LINE)));
+    size_t deqPos __attribute__ ((aligned(LFQ_CACHE_LINE)));
+
+    struct mpmcCell *cells __attribute__ ((aligned(LFQ_CACHE_LINE)));
+    size_t mask;                /* Capacity - 1 */
+};
+
+int spscInit(struct spscQueue *q, size_t capacity);
+
+Boolean spscPush(struct spscQueue *q, void *item);
+
+Boolean spscPop(struct spscQueue *q, void **item);
+
+void spscFree(struct spscQueue *q);
+
+int mpmcInit(struct mpmcQueue *q, size_t capacity);
+
+Boolean mpmcPush(struct mpmcQueue *q, void *item);
+
+Boolean mpmcPop(struct mpmcQueue *q, void **item);
+
+void mpmcFree(struct mpmcQueue *q);
+
+#endif
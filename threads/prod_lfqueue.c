@@ -0,0 +1,349 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 30 */
+
+/* prod_lfqueue.c
+
+   A version of the producer-consumer example in prod_condvar.c that
+   measures how many units per second can be passed from the producer
+   threads to the consumer (the main thread), using each of the
+   following methods:
+
+        condvar  A mutex-protected count of available units, with a
+                 condition variable that is signaled for every unit, as
+                 in prod_condvar.c
+        spsc     One lock-free single-producer, single-consumer queue
+                 (see lf_queue.c) per producer; the consumer polls each
+                 queue in turn
+        mpmc     A single lock-free multiple-producer, multiple-consumer
+                 queue shared by all producers
+
+   Usage: prod_lfqueue [-m mode]... [-n units] [-s capacity] [nthreads...]
+
+        -m mode      Method to measure (may be repeated; default: all)
+        -n units     Total number of units to produce (default: 2000000),
+                     divided evenly among the producers
+        -s capacity  Capacity of each queue (default: 1024)
+        nthreads     Numbers of producer threads with which to run each
+                     method (default: 1 2 4 8 16 32 64)
+
+   When a lock-free queue is full (or empty), the producer (or consumer)
+   calls sched_yield() and tries again. In the lock-free modes, each unit
+   carries a value, and the consumer checks that it received every value.
+*/
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include "lf_queue.h"
+#include "tlpi_hdr.h"
+
+#define MAX_THREADS 1024
+
+enum mode { MODE_CONDVAR, MODE_SPSC, MODE_MPMC, NUM_MODES };
+
+static const char *modeNames[NUM_MODES] = { "condvar", "spsc", "mpmc" };
+
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static long avail = 0;                  /* Used by "condvar" mode */
+
+static struct spscQueue *spscQueues;    /* One per producer */
+static struct mpmcQueue mpmcQueue;
+
+static pthread_barrier_t startBarrier;  /* Start producers together */
+
+struct producer {
+    enum mode mode;
+    int idx;                            /* Producer number */
+    long cnt;                           /* Number of units to produce */
+};
+
+static void *
+threadFunc(void *arg)
+{
+    struct producer *p = arg;
+    long j;
+    void *item;
+    int s;
+
+    s = pthread_barrier_wait(&startBarrier);
+    if (s != 0 && s != PTHREAD_BARRIER_SERIAL_THREAD)
+        errExitEN(s, "pthread_barrier_wait");
+
+    for (j = 1; j <= p->cnt; j++) {
+        item = (void *) (uintptr_t) j;  /* The "unit" */
+
+        switch (p->mode) {
+        case MODE_CONDVAR:
+            s = pthread_mutex_lock(&mtx);
+            if (s != 0)
+                errExitEN(s, "pthread_mutex_lock");
+
+            avail++;    /* Let consumer know another unit is available */
+
+            s = pthread_mutex_unlock(&mtx);
+            if (s != 0)
+                errExitEN(s, "pthread_mutex_unlock");
+
+            s = pthread_cond_signal(&cond);     /* Wake sleeping consumer */
+            if (s != 0)
+                errExitEN(s, "pthread_cond_signal");
+            break;
+
+        case MODE_SPSC:
+            while (!spscPush(&spscQueues[p->idx], item))
+                sched_yield();                  /* Queue full */
+            break;
+
+        case MODE_MPMC:
+            while (!mpmcPush(&mpmcQueue, item))
+                sched_yield();
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/* Consume 'totRequired' units, returning the sum of their values */
+
+static unsigned long long
+consume(enum mode mode, int nthreads, long totRequired)
+{
+    unsigned long long sum;
+    long numConsumed;
+    Boolean got;
+    void *item;
+    int s, j;
+
+    sum = 0;
+    numConsumed = 0;
+
+    switch (mode) {
+    case MODE_CONDVAR:
+        while (numConsumed < totRequired) {
+            s = pthread_mutex_lock(&mtx);
+            if (s != 0)
+                errExitEN(s, "pthread_mutex_lock");
+
+            while (avail == 0) {        /* Wait for something to consume */
+                s = pthread_cond_wait(&cond, &mtx);
+                if (s != 0)
+                    errExitEN(s, "pthread_cond_wait");
+            }
+
+            numConsumed += avail;       /* Consume all available units */
+            avail = 0;
+
+            s = pthread_mutex_unlock(&mtx);
+            if (s != 0)
+                errExitEN(s, "pthread_mutex_unlock");
+        }
+        break;
+
+    case MODE_SPSC:
+        while (numConsumed < totRequired) {
+            got = FALSE;
+            for (j = 0; j < nthreads; j++) {
+                while (spscPop(&spscQueues[j], &item)) {
+                    sum += (uintptr_t) item;
+                    numConsumed++;
+                    got = TRUE;
+                }
+            }
+            if (!got)
+                sched_yield();          /* All queues empty */
+        }
+        break;
+
+    case MODE_MPMC:
+        while (numConsumed < totRequired) {
+            if (mpmcPop(&mpmcQueue, &item)) {
+                sum += (uintptr_t) item;
+                numConsumed++;
+            } else {
+                sched_yield();
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return sum;
+}
+
+/* Run 'mode' with 'nthreads' producers, returning units per second */
+
+static double
+runMode(enum mode mode, int nthreads, long units, size_t capacity)
+{
+    static pthread_t tid[MAX_THREADS];
+    static struct producer prod[MAX_THREADS];
+    struct timespec start, end;
+    unsigned long long sum, expected;
+    long totRequired;
+    int s, j;
+
+    if (mode == MODE_SPSC) {
+        spscQueues = malloc(nthreads * sizeof(struct spscQueue));
+        if (spscQueues == NULL)
+            errExit("malloc");
+        for (j = 0; j < nthreads; j++)
+            if (spscInit(&spscQueues[j], capacity) == -1)
+                errExit("spscInit");
+    } else if (mode == MODE_MPMC) {
+        if (mpmcInit(&mpmcQueue, capacity) == -1)
+            errExit("mpmcInit");
+    }
+
+    s = pthread_barrier_init(&startBarrier, NULL, nthreads + 1);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_init");
+
+    /* Create all threads */
+
+    totRequired = 0;
+    expected = 0;
+    for (j = 0; j < nthreads; j++) {
+        prod[j].mode = mode;
+        prod[j].idx = j;
+        prod[j].cnt = units / nthreads + (j < units % nthreads);
+        totRequired += prod[j].cnt;
+        expected += (unsigned long long) prod[j].cnt * (prod[j].cnt + 1) / 2;
+
+        s = pthread_create(&tid[j], NULL, threadFunc, &prod[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+    s = pthread_barrier_wait(&startBarrier);
+    if (s != 0 && s != PTHREAD_BARRIER_SERIAL_THREAD)
+        errExitEN(s, "pthread_barrier_wait");
+
+    sum = consume(mode, nthreads, totRequired);
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_join(tid[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    s = pthread_barrier_destroy(&startBarrier);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_destroy");
+
+    if (mode == MODE_SPSC) {
+        for (j = 0; j < nthreads; j++)
+            spscFree(&spscQueues[j]);
+        free(spscQueues);
+    } else if (mode == MODE_MPMC) {
+        mpmcFree(&mpmcQueue);
+    }
+
+    if (mode != MODE_CONDVAR && sum != expected)
+        fatal("%s: sum of units was %llu; expected %llu",
+                modeNames[mode], sum, expected);
+
+    return totRequired / ((end.tv_sec - start.tv_sec) +
+                          (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-m mode]... [-n units] [-s capacity] "
+                    "[nthreads...]\n", progName);
+    fprintf(stderr, "    -m mode      condvar, spsc, or mpmc "
+                    "(default: all)\n");
+    fprintf(stderr, "    -n units     Total units to produce "
+                    "(default: 2000000)\n");
+    fprintf(stderr, "    -s capacity  Capacity of each queue "
+                    "(default: 1024)\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const int defThreads[] = { 1, 2, 4, 8, 16, 32, 64 };
+    int nthreads[MAX_THREADS];
+    enum mode modes[NUM_MODES];
+    int opt, nmodes, ncounts, m, j;
+    long units;
+    size_t capacity;
+
+    nmodes = 0;
+    units = 2000000;
+    capacity = 1024;
+    while ((opt = getopt(argc, argv, "m:n:s:")) != -1) {
+        switch (opt) {
+        case 'm':
+            for (m = 0; m < NUM_MODES; m++)
+                if (strcmp(optarg, modeNames[m]) == 0)
+                    break;
+            if (m == NUM_MODES || nmodes == NUM_MODES)
+                usageError(argv[0]);
+            modes[nmodes++] = m;
+            break;
+        case 'n':   units = getLong(optarg, GN_GT_0, "units");          break;
+        case 's':   capacity = getLong(optarg, GN_GT_0, "capacity");    break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (nmodes == 0)
+        for (m = 0; m < NUM_MODES; m++)
+            modes[nmodes++] = m;
+
+    ncounts = 0;
+    if (optind == argc) {
+        for (j = 0; j < (int) (sizeof(defThreads) / sizeof(defThreads[0])); j++)
+            nthreads[ncounts++] = defThreads[j];
+    } else {
+        for (j = optind; j < argc && ncounts < MAX_THREADS; j++) {
+            nthreads[ncounts] = getInt(argv[j], GN_GT_0, "nthreads");
+            if (nthreads[ncounts] > MAX_THREADS)
+                cmdLineErr("nthreads must be at most %d\n", MAX_THREADS);
+            ncounts++;
+        }
+    }
+
+    /* Display a table of units per second */
+
+    printf("%8s", "threads");
+    for (m = 0; m < nmodes; m++)
+        printf(" %12s", modeNames[modes[m]]);
+    printf("   (units/sec)\n");
+
+    for (j = 0; j < ncounts; j++) {
+        printf("%8d", nthreads[j]);
+        fflush(stdout);
+        for (m = 0; m < nmodes; m++) {
+            printf(" %12.0f", runMode(modes[m], nthreads[j], units, capacity));
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    exit(EXIT_SUCCESS);
+}
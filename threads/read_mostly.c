@@ -0,0 +1,405 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 30 */
+
+/* read_mostly.c
+
+   Synchronization for data that is read far more often than it is
+   written, without the readers writing to shared memory. (Even a read
+   lock, such as pthread_rwlock_rdlock(), must update the lock word, so
+   that the cache line holding it moves from CPU to CPU as readers come
+   and go, and readers on many CPUs slow one another down although none
+   of them excludes any other.)
+
+   Sequence lock: for small data that can be copied. A writer makes the
+   sequence number odd, updates the data, and makes it even again;
+   slRead() copies the data, and repeats the copy if the sequence number
+   was odd, or changed during the copy. Readers never wait for one
+   another, but a reader may have to retry while a writer is active (so
+   that writes must be brief, and infrequent), and the copy must not be
+   used before slRead() has returned (it may be inconsistent). Writers
+   are serialized by a mutex.
+
+   Epoch-based reclamation: for linked data, which readers access in
+   place, and writers change by copying and replacing nodes. The problem
+   is to know when a node that has been unlinked can be freed, since
+   readers may still hold pointers to it. A reader brackets each access
+   with epEnter() and epExit(), which record (in a cache line of the
+   reader's own) that the thread is active, and the global epoch that it
+   saw. A writer passes an unlinked node to epRetire(), which places it
+   on a list for the current epoch. The global epoch advances only when
+   every active thread has seen the current epoch, so that once it has
+   advanced twice beyond the epoch in which a node was retired, no
+   reader can still hold a pointer to that node, and it is freed. The
+   cost is that a reader that stays in a critical section (or a thread
+   that stays registered and active) holds up all reclamation; epEnter()
+   calls do not nest.
+
+   These functions use the GCC atomic built-ins.
+*/
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <errno.h>
+#include "read_mostly.h"        /* Declares functions defined here */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpuRelax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpuRelax() __asm__ __volatile__ ("yield")
+#else
+#define cpuRelax() do { } while (0)
+#endif
+
+/* Copy 'len' bytes to or from data that another thread may be
+   modifying, using relaxed atomic accesses (in units of a long, where
+   alignment allows) */
+
+static void
+loadRelaxed(void *dst, const void *src, size_t len)
+{
+    const unsigned char *s = src;
+    unsigned char *d = dst;
+    size_t j;
+
+    if (((uintptr_t) s | (uintptr_t) d) % sizeof(long) == 0) {
+        for (; len >= sizeof(long); len -= sizeof(long),
+                s += sizeof(long), d += sizeof(long))
+            *(long *) d = __atomic_load_n((const long *) s, __ATOMIC_RELAXED);
+    }
+    for (j = 0; j < len; j++)
+        d[j] = __atomic_load_n(&s[j], __ATOMIC_RELAXED);
+}
+
+static void
+storeRelaxed(void *dst, const void *src, size_t len)
+{
+    const unsigned char *s = src;
+    unsigned char *d = dst;
+    size_t j;
+
+    if (((uintptr_t) s | (uintptr_t) d) % sizeof(long) == 0) {
+        for (; len >= sizeof(long); len -= sizeof(long),
+                s += sizeof(long), d += sizeof(long))
+            __atomic_store_n((long *) d, *(const long *) s, __ATOMIC_RELAXED);
+    }
+    for (j = 0; j < len; j++)
+        __atomic_store_n(&d[j], s[j], __ATOMIC_RELAXED);
+}
+
+void
+slInit(struct seqLock *sl)
+{
+    sl->seq = 0;
+    pthread_mutex_init(&sl->wmtx, NULL);
+}
+
+/* Copy a consistent snapshot of the 'len' bytes at 'src' (which are
+   protected by 'sl') to 'dst'. Returns the number of times that the
+   copy had to be retried. */
+
+int
+slRead(struct seqLock *sl, void *dst, const void *src, size_t len)
+{
+    unsigned seq;
+    int retries;
+
+    for (retries = 0; ; retries++) {
+        seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {                  /* Writer active */
+            cpuRelax();
+            continue;
+        }
+
+        loadRelaxed(dst, src, len);
+
+        /* Order the loads of the data before the second load of the
+           sequence number */
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&sl->seq, __ATOMIC_RELAXED) == seq)
+            return retries;
+    }
+}
+
+/* Copy the 'len' bytes at 'src' to 'dst' (which is protected by 'sl') */
+
+void
+slWrite(struct seqLock *sl, void *dst, const void *src, size_t len)
+{
+    unsigned seq;
+
+    pthread_mutex_lock(&sl->wmtx);
+
+    seq = __atomic_load_n(&sl->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&sl->seq, seq + 1, __ATOMIC_RELAXED);
+
+    /* Order the store of the odd sequence number before the stores of
+       the data */
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    storeRelaxed(dst, src, len);
+    __atomic_store_n(&sl->seq, seq + 2, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&sl->wmtx);
+}
+
+void
+slDestroy(struct seqLock *sl)
+{
+    pthread_mutex_destroy(&sl->wmtx);
+}
+
+#define EP_LISTS 3              /* Retired objects may be from the current
+                                   epoch, or either of the two before it */
+#define EP_ADVANCE_EVERY 32     /* Retirements between attempts to advance
+                                   the global epoch */
+
+struct epRetired {              /* An object awaiting reclamation */
+    struct epRetired *next;
+    void *p;
+    void (*freeFunc)(void *);
+};
+
+struct epochThread {
+    uint64_t state;             /* (epoch << 1) | 1 while in a critical
+                                   section, otherwise 0 */
+    struct epochDomain *ed;
+    int inUse;                  /* Slot is registered to a thread */
+    struct epRetired *limbo[EP_LISTS];
+    uint64_t limboEpoch[EP_LISTS];      /* Epoch of each 'limbo' list */
+    int sinceAdvance;           /* Retirements since last advance attempt */
+    unsigned long retired;
+    unsigned long freed;
+} __attribute__ ((aligned(RM_CACHE_LINE)));
+
+struct epochDomain {
+    uint64_t epoch __attribute__ ((aligned(RM_CACHE_LINE)));
+    unsigned long advances;
+    int maxThreads;
+    struct epochThread *threads;
+};
+
+/* Create a domain in which up to 'maxThreads' threads may register.
+   Returns a pointer to the domain, or NULL on error. */
+
+struct epochDomain *
+epCreate(int maxThreads)
+{
+    struct epochDomain *ed;
+    size_t size;
+    int j;
+
+    if (maxThreads <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (posix_memalign((void **) &ed, RM_CACHE_LINE,
+                       sizeof(struct epochDomain)) != 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(ed, 0, sizeof(struct epochDomain));
+    ed->epoch = EP_LISTS;       /* So that 'epoch - 2' can't underflow */
+    ed->maxThreads = maxThreads;
+
+    size = maxThreads * sizeof(struct epochThread);
+    if (posix_memalign((void **) &ed->threads, RM_CACHE_LINE, size) != 0) {
+        free(ed);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(ed->threads, 0, size);
+    for (j = 0; j < maxThreads; j++)
+        ed->threads[j].ed = ed;
+
+    return ed;
+}
+
+/* Register the calling thread in 'ed'. Returns a handle to be passed to
+   the other functions by this thread, or NULL if 'maxThreads' threads
+   are already registered. */
+
+struct epochThread *
+epRegister(struct epochDomain *ed)
+{
+    int j, expected;
+
+    for (j = 0; j < ed->maxThreads; j++) {
+        expected = 0;
+        if (__atomic_compare_exchange_n(&ed->threads[j].inUse, &expected,
+                    1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return &ed->threads[j];
+    }
+    errno = EAGAIN;
+    return NULL;
+}
+
+/* Begin a critical section, within which pointers to objects that are
+   protected by the domain may be obtained and used */
+
+void
+epEnter(struct epochThread *et)
+{
+    uint64_t e;
+
+    e = __atomic_load_n(&et->ed->epoch, __ATOMIC_ACQUIRE);
+
+    /* The store must be visible to other threads before any of our
+       loads of shared pointers; a sequentially consistent store is
+       followed by a full barrier */
+
+    __atomic_store_n(&et->state, (e << 1) | 1, __ATOMIC_SEQ_CST);
+}
+
+void
+epExit(struct epochThread *et)
+{
+    __atomic_store_n(&et->state, 0, __ATOMIC_RELEASE);
+}
+
+/* Advance the global epoch if every thread that is in a critical
+   section has seen the current epoch. Returns the (possibly new)
+   global epoch. */
+
+static uint64_t
+tryAdvance(struct epochDomain *ed)
+{
+    uint64_t e, s;
+    int j;
+
+    e = __atomic_load_n(&ed->epoch, __ATOMIC_SEQ_CST);
+    for (j = 0; j < ed->maxThreads; j++) {
+        s = __atomic_load_n(&ed->threads[j].state, __ATOMIC_SEQ_CST);
+        if ((s & 1) && (s >> 1) != e)
+            return e;
+    }
+
+    if (__atomic_compare_exchange_n(&ed->epoch, &e, e + 1, 0,
+                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&ed->advances, 1, __ATOMIC_RELAXED);
+        return e + 1;
+    }
+    return e;                   /* Another thread advanced it */
+}
+
+/* Free the objects retired by 'et' that no thread can still be using,
+   given that the global epoch is 'e' */
+
+static void
+reclaim(struct epochThread *et, uint64_t e)
+{
+    struct epRetired *r, *next;
+    int j;
+
+    for (j = 0; j < EP_LISTS; j++) {
+        if (et->limbo[j] == NULL || et->limboEpoch[j] + 2 > e)
+            continue;
+        for (r = et->limbo[j]; r != NULL; r = next) {
+            next = r->next;
+            r->freeFunc(r->p);
+            free(r);
+            __atomic_store_n(&et->freed, et->freed + 1, __ATOMIC_RELAXED);
+        }
+        et->limbo[j] = NULL;
+    }
+}
+
+/* Arrange for freeFunc(p) to be called once no thread can still be
+   using 'p', which must already be unreachable from the shared data.
+   Returns 0 on success, or -1 on error. */
+
+int
+epRetire(struct epochThread *et, void *p, void (*freeFunc)(void *))
+{
+    struct epRetired *r;
+    uint64_t e;
+    int j;
+
+    r = malloc(sizeof(struct epRetired));
+    if (r == NULL)
+        return -1;
+    r->p = p;
+    r->freeFunc = freeFunc;
+
+    e = __atomic_load_n(&et->ed->epoch, __ATOMIC_SEQ_CST);
+    reclaim(et, e);             /* Empties any list from epoch 'e - 3' */
+
+    j = e % EP_LISTS;
+    et->limboEpoch[j] = e;
+    r->next = et->limbo[j];
+    et->limbo[j] = r;
+    __atomic_store_n(&et->retired, et->retired + 1, __ATOMIC_RELAXED);
+
+    if (++et->sinceAdvance >= EP_ADVANCE_EVERY) {
+        et->sinceAdvance = 0;
+        reclaim(et, tryAdvance(et->ed));
+    }
+    return 0;
+}
+
+/* Wait until all of the objects retired by 'et' have been freed. The
+   caller must not be in a critical section. */
+
+void
+epBarrier(struct epochThread *et)
+{
+    int j;
+
+    for (;;) {
+        reclaim(et, tryAdvance(et->ed));
+        for (j = 0; j < EP_LISTS; j++)
+            if (et->limbo[j] != NULL)
+                break;
+        if (j == EP_LISTS)
+            return;
+        sched_yield();          /* Wait for readers to leave */
+    }
+}
+
+/* Unregister the thread that owns 'et', first waiting until the objects
+   that it retired have been freed */
+
+void
+epUnregister(struct epochThread *et)
+{
+    epBarrier(et);
+    et->state = 0;
+    et->sinceAdvance = 0;
+    __atomic_store_n(&et->inUse, 0, __ATOMIC_RELEASE);
+}
+
+void
+epGetStats(struct epochDomain *ed, struct epStats *stats)
+{
+    int j;
+
+    stats->advances = __atomic_load_n(&ed->advances, __ATOMIC_RELAXED);
+    stats->retired = stats->freed = 0;
+    for (j = 0; j < ed->maxThreads; j++) {
+        stats->retired += __atomic_load_n(&ed->threads[j].retired,
+                                          __ATOMIC_RELAXED);
+        stats->freed += __atomic_load_n(&ed->threads[j].freed,
+                                        __ATOMIC_RELAXED);
+    }
+}
+
+/* Free the domain; all threads must have unregistered */
+
+void
+epDestroy(struct epochDomain *ed)
+{
+    free(ed->threads);
+    free(ed);
+}
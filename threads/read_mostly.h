@@ -0,0 +1,70 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 30 */
+
+/* read_mostly.h
+
+   Header file for read_mostly.c.
+*/
+#ifndef READ_MOSTLY_H
+#define READ_MOSTLY_H           /* Prevent accidental double inclusion */
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define RM_CACHE_LINE 64
+
+/* Sequence lock */
+
+struct seqLock {
+    unsigned seq __attribute__ ((aligned(RM_CACHE_LINE)));
+                                /* Odd while a write is in progress */
+    pthread_mutex_t wmtx;       /* Serializes writers */
+};
+
+void slInit(struct seqLock *sl);
+
+int slRead(struct seqLock *sl, void *dst, const void *src, size_t len);
+
+void slWrite(struct seqLock *sl, void *dst, const void *src, size_t len);
+
+void slDestroy(struct seqLock *sl);
+
+/* Epoch-based reclamation */
+
+struct epochDomain;             /* Opaque; defined in read_mostly.c */
+struct epochThread;             /* Opaque; one per registered thread */
+
+struct epStats {
+    unsigned long advances;     /* Times the global epoch advanced */
+    unsigned long retired;      /* Objects passed to epRetire() */
+    unsigned long freed;        /* ...of which have been freed */
+};
+
+struct epochDomain *epCreate(int maxThreads);
+
+struct epochThread *epRegister(struct epochDomain *ed);
+
+void epEnter(struct epochThread *et);
+
+void epExit(struct epochThread *et);
+
+int epRetire(struct epochThread *et, void *p, void (*freeFunc)(void *));
+
+void epBarrier(struct epochThread *et);
+
+void epUnregister(struct epochThread *et);
+
+void epGetStats(struct epochDomain *ed, struct epStats *stats);
+
+void epDestroy(struct epochDomain *ed);
+
+#endif
@@ -0,0 +1,140 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 30 */
+
+/* sharded_counter.c
+
+   A counter that can be incremented concurrently by many threads
+   without the cache line that holds it bouncing between CPUs. The
+   counter is divided into 'nslots' slots, each in a cache line of its
+   own; scAdd() adds to one slot, and scRead() returns the sum of all of
+   the slots. Thus, updates are cheap and scale with the number of
+   threads, while reads cost O(nslots). (A value returned by scRead()
+   while other threads are updating the counter is a value that the
+   counter had at some moment during the call.)
+
+   In SC_PER_THREAD mode, each thread is assigned a slot when it first
+   updates any sharded counter (thread 'n' uses slot n % nslots). In
+   SC_PER_CPU mode, a thread adds to the slot of the CPU on which it is
+   running. Where the C library has registered a restartable sequences
+   (rseq) area for the thread (glibc 2.35 and later), the CPU number is
+   read directly from that area, which the kernel keeps up to date;
+   otherwise, sched_getcpu() is called. Per-CPU slots use less memory
+   when there are many more threads than CPUs.
+
+   Because a thread may share a slot with another thread, or be migrated
+   to another CPU between finding its slot and updating it, the update is
+   an atomic add; but since the slot is rarely touched by other CPUs, the
+   add doesn't cause cache-line transfers. (A true rseq critical section
+   would allow a plain add, but requires assembly code for each
+   architecture.)
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef __has_include
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define HAVE_RSEQ
+#endif
+#endif
+#include "sharded_counter.h"
+
+static int nextThreadNum;               /* Used to assign per-thread slots */
+static __thread int threadNum = -1;     /* This thread's number */
+
+/* Return the number of the CPU on which the caller is running */
+
+static inline int
+currentCpu(void)
+{
+    int cpu;
+
+#ifdef HAVE_RSEQ
+    if (__rseq_size > 0) {
+        struct rseq *rs = (struct rseq *)
+                ((char *) __builtin_thread_pointer() + __rseq_offset);
+
+        cpu = (int) __atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED);
+        if (cpu >= 0)
+            return cpu;
+    }
+#endif
+
+    cpu = sched_getcpu();
+    return (cpu == -1) ? 0 : cpu;
+}
+
+/* Initialize 'sc' (with a value of 0), using 'nslots' slots; if
+   'nslots' is 0, use one slot per configured CPU. Returns 0 on success,
+   or -1 on error. */
+
+int
+scInit(struct shardedCounter *sc, enum scMode mode, int nslots)
+{
+    long ncpus;
+
+    if (nslots <= 0) {
+        ncpus = sysconf(_SC_NPROCESSORS_CONF);
+        nslots = (ncpus > 0) ? ncpus : 1;
+    }
+
+    if (posix_memalign((void **) &sc->slots, SC_CACHE_LINE,
+                       nslots * sizeof(struct scSlot)) != 0)
+        return -1;
+    for (int j = 0; j < nslots; j++)
+        sc->slots[j].val = 0;
+
+    sc->nslots = nslots;
+    sc->mode = mode;
+    return 0;
+}
+
+/* Add 'n' to the counter */
+
+void
+scAdd(struct shardedCounter *sc, long n)
+{
+    int idx;
+
+    if (sc->mode == SC_PER_CPU) {
+        idx = currentCpu();
+    } else {
+        if (threadNum == -1)
+            threadNum = __atomic_fetch_add(&nextThreadNum, 1,
+                                           __ATOMIC_RELAXED);
+        idx = threadNum;
+    }
+
+    __atomic_fetch_add(&sc->slots[idx % sc->nslots].val, n, __ATOMIC_RELAXED);
+}
+
+/* Return the value of the counter */
+
+long
+scRead(const struct shardedCounter *sc)
+{
+    long sum = 0;
+
+    for (int j = 0; j < sc->nslots; j++)
+        sum += __atomic_load_n(&sc->slots[j].val, __ATOMIC_RELAXED);
+    return sum;
+}
+
+void
+scFree(struct shardedCounter *sc)
+{
+    free(sc->slots);
+    sc->slots = NULL;
+}
@@ -0,0 +1,46 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 30 */
+
+/* sharded_counter.h
+
+   Header file for sharded_counter.c.
+*/
+#ifndef SHARDED_COUNTER_H
+#define SHARDED_COUNTER_H       /* Prevent accidental double inclusion */
+
+#define SC_CACHE_LINE 64
+
+enum scMode {
+    SC_PER_THREAD,              /* Each thread uses "its own" slot */
+    SC_PER_CPU                  /* Each thread uses the slot for the CPU
+                                   on which it is running */
+};
+
+struct scSlot {                 /* Each slot is in a cache line of its own */
+    long val __attribute__ ((aligned(SC_CACHE_LINE)));
+};
+
+struct shardedCounter {
+    struct scSlot *slots;
+    int nslots;
+    enum scMode mode;
+};
+
+int scInit(struct shardedCounter *sc, enum scMode mode, int nslots);
+
+void scAdd(struct shardedCounter *sc, long n);
+
+long scRead(const struct shardedCounter *sc);
+
+void scFree(struct shardedCounter *sc);
+
+#endif
@@ -0,0 +1,304 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 29 */
+
+/* stack_pool.c
+
+   Create short-lived threads on stacks recycled from a pool.
+
+   By default, each thread gets a stack of the size given by RLIMIT_STACK
+   (typically 8 MiB), which glibc allocates with mmap() and protects
+   with a guard page. glibc keeps a small cache of the stacks of threads
+   that have terminated, but the cache is limited in size (40 MiB, or
+   just five default stacks), so that when threads are created and
+   terminate in bursts, many of them still pay for an mmap(), an
+   mprotect(), page faults as the new stack is touched, and later a
+   munmap().
+
+   A stack pool instead hands out stacks of a size chosen by the caller
+   (one pool per role of thread: a thread that does little needs a stack
+   of tens of kilobytes, not megabytes), and keeps up to 'maxCached' of
+   them for reuse. A stack supplied with pthread_attr_setstack() belongs
+   to the application, and may be reused only once the thread that ran
+   on it has been joined (glibc places the thread's descriptor and
+   thread-local storage at the top of the stack, and uses them until
+   the thread has fully terminated). The pool therefore creates joinable
+   threads and joins them itself: each thread, as it terminates (by
+   returning, calling pthread_exit(), or being canceled), places itself
+   on the pool's list of finished threads, and spSpawn() and spReap()
+   join the threads on that list and return their stacks to the pool.
+   The caller must neither join nor detach a thread created by
+   spSpawn(), and the thread's return value is discarded.
+
+   A stack is mapped with MAP_STACK, and its lowest 'guardSize' bytes
+   are protected with PROT_NONE, since glibc does not create a guard
+   page for a stack supplied by the application.
+
+   This module is Linux-specific (MAP_STACK).
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include "stack_pool.h"         /* Declares functions defined here */
+
+struct spThread {               /* A stack, and the thread running on it */
+    struct spThread *next;      /* Next on 'free' or 'done' list */
+    struct stackPool *sp;
+    void *base;                 /* Start of mapping (the guard area) */
+    void *stack;                /* Lowest usable address of stack */
+    pthread_t tid;
+    void *(*fn)(void *);
+    void *arg;
+};
+
+struct stackPool {
+    size_t stackSize;           /* Usable size of each stack */
+    size_t guardSize;           /* Size of guard area below each stack */
+    int maxCached;              /* Most stacks to keep on 'free' */
+    pthread_mutex_t mtx;        /* Protects the following fields */
+    pthread_cond_t cond;        /* Signaled when a thread finishes */
+    struct spThread *free;      /* Stacks ready for reuse */
+    int nfree;
+    struct spThread *done;      /* Finished threads not yet joined */
+    int live;                   /* Threads created and not yet joined */
+    struct spStats stats;
+};
+
+static size_t
+roundPage(size_t len)
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+
+    return (len + pageSize - 1) / pageSize * pageSize;
+}
+
+/* Create a pool whose threads have stacks of 'stackSize' bytes (rounded
+   up to a multiple of the page size), each with a guard area of
+   'guardSize' bytes below it, and which keeps up to 'maxCached' unused
+   stacks. Returns a pointer to the pool, or NULL on error. */
+
+struct stackPool *
+spCreate(size_t stackSize, size_t guardSize, int maxCached)
+{
+    struct stackPool *sp;
+
+    if (stackSize < PTHREAD_STACK_MIN || maxCached < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    sp = calloc(1, sizeof(struct stackPool));
+    if (sp == NULL)
+        return NULL;
+    sp->stackSize = roundPage(stackSize);
+    sp->guardSize = roundPage(guardSize);
+    sp->maxCached = maxCached;
+    pthread_mutex_init(&sp->mtx, NULL);
+    pthread_cond_init(&sp->cond, NULL);
+    return sp;
+}
+
+static void
+freeStack(struct stackPool *sp, struct spThread *t)
+{
+    munmap(t->base, sp->guardSize + sp->stackSize);
+    free(t);
+    sp->stats.munmaps++;
+}
+
+/* Called (via the cleanup handler) as a thread terminates */
+
+static void
+threadDone(void *arg)
+{
+    struct spThread *t = arg;
+    struct stackPool *sp = t->sp;
+
+    pthread_mutex_lock(&sp->mtx);
+    t->next = sp->done;
+    sp->done = t;
+    pthread_cond_broadcast(&sp->cond);
+    pthread_mutex_unlock(&sp->mtx);
+}
+
+static void *
+threadStart(void *arg)
+{
+    struct spThread *t = arg;
+
+    pthread_cleanup_push(threadDone, t);
+    t->fn(t->arg);
+    pthread_cleanup_pop(1);
+    return NULL;
+}
+
+/* Join the finished threads in 'sp', and keep their stacks for reuse
+   (or free them, beyond 'maxCached'). Returns the number of threads
+   joined. */
+
+int
+spReap(struct stackPool *sp)
+{
+    struct spThread *list, *t, *next;
+    int n;
+
+    pthread_mutex_lock(&sp->mtx);
+    list = sp->done;
+    sp->done = NULL;
+    pthread_mutex_unlock(&sp->mtx);
+
+    /* A thread on the list may not yet have terminated, but it no
+       longer runs application code; once joined, its stack is unused */
+
+    for (t = list, n = 0; t != NULL; t = t->next, n++)
+        pthread_join(t->tid, NULL);
+
+    pthread_mutex_lock(&sp->mtx);
+    for (t = list; t != NULL; t = next) {
+        next = t->next;
+        sp->live--;
+        if (sp->nfree < sp->maxCached) {
+            t->next = sp->free;
+            sp->free = t;
+            sp->nfree++;
+        } else {
+            freeStack(sp, t);
+        }
+    }
+    pthread_mutex_unlock(&sp->mtx);
+
+    return n;
+}
+
+/* Create a thread that calls fn(arg), with its stack taken from 'sp',
+   and return its ID in '*tid'. Returns 0 on success, or -1 on error. */
+
+int
+spSpawn(struct stackPool *sp, pthread_t *tid, void *(*fn)(void *),
+        void *arg)
+{
+    struct spThread *t;
+    pthread_attr_t attr;
+    int s;
+
+    spReap(sp);
+
+    pthread_mutex_lock(&sp->mtx);
+    t = sp->free;
+    if (t != NULL) {
+        sp->free = t->next;
+        sp->nfree--;
+        sp->stats.reused++;
+    }
+    pthread_mutex_unlock(&sp->mtx);
+
+    if (t == NULL) {
+        t = malloc(sizeof(struct spThread));
+        if (t == NULL)
+            return -1;
+        t->base = mmap(NULL, sp->guardSize + sp->stackSize,
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (t->base == MAP_FAILED) {
+            free(t);
+            return -1;
+        }
+        if (sp->guardSize > 0 &&
+                mprotect(t->base, sp->guardSize, PROT_NONE) == -1) {
+            s = errno;
+            munmap(t->base, sp->guardSize + sp->stackSize);
+            free(t);
+            errno = s;
+            return -1;
+        }
+        t->stack = (char *) t->base + sp->guardSize;
+        t->sp = sp;
+
+        pthread_mutex_lock(&sp->mtx);
+        sp->stats.mmaps++;
+        pthread_mutex_unlock(&sp->mtx);
+    }
+    t->fn = fn;
+    t->arg = arg;
+
+    s = pthread_attr_init(&attr);
+    if (s == 0)
+        s = pthread_attr_setstack(&attr, t->stack, sp->stackSize);
+    if (s == 0)
+        s = pthread_create(&t->tid, &attr, threadStart, t);
+    pthread_attr_destroy(&attr);
+
+    pthread_mutex_lock(&sp->mtx);
+    if (s != 0) {                       /* Return the stack to the pool */
+        t->next = sp->free;
+        sp->free = t;
+        sp->nfree++;
+    } else {
+        sp->live++;
+        sp->stats.spawned++;
+    }
+    pthread_mutex_unlock(&sp->mtx);
+
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    *tid = t->tid;
+    return 0;
+}
+
+/* Wait until every thread created from 'sp' has terminated, and join
+   them all */
+
+void
+spWaitAll(struct stackPool *sp)
+{
+    for (;;) {
+        spReap(sp);
+
+        pthread_mutex_lock(&sp->mtx);
+        if (sp->live == 0) {
+            pthread_mutex_unlock(&sp->mtx);
+            return;
+        }
+        while (sp->done == NULL)
+            pthread_cond_wait(&sp->cond, &sp->mtx);
+        pthread_mutex_unlock(&sp->mtx);
+    }
+}
+
+void
+spGetStats(struct stackPool *sp, struct spStats *stats)
+{
+    pthread_mutex_lock(&sp->mtx);
+    *stats = sp->stats;
+    pthread_mutex_unlock(&sp->mtx);
+}
+
+/* Wait for all threads in 'sp' to terminate, and free the pool */
+
+void
+spDestroy(struct stackPool *sp)
+{
+    struct spThread *t;
+
+    spWaitAll(sp);
+    while ((t = sp->free) != NULL) {
+        sp->free = t->next;
+        freeStack(sp, t);
+    }
+    pthread_mutex_destroy(&sp->mtx);
+    pthread_cond_destroy(&sp->cond);
+    free(sp);
+}
@@ -0,0 +1,45 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 29 */
+
+/* stack_pool.h
+
+   Header file for stack_pool.c.
+*/
+#ifndef STACK_POOL_H
+#define STACK_POOL_H            /* Prevent accidental double inclusion */
+
+#include <pthread.h>
+
+struct stackPool;               /* Opaque; defined in stack_pool.c */
+
+struct spStats {
+    unsigned long spawned;      /* Threads created */
+    unsigned long reused;       /* ...of which ran on a cached stack */
+    unsigned long mmaps;        /* Stacks allocated */
+    unsigned long munmaps;      /* Stacks freed */
+};
+
+struct stackPool *spCreate(size_t stackSize, size_t guardSize,
+                           int maxCached);
+
+int spSpawn(struct stackPool *sp, pthread_t *tid,
+            void *(*fn)(void *), void *arg);
+
+int spReap(struct stackPool *sp);
+
+void spWaitAll(struct stackPool *sp);
+
+void spGetStats(struct stackPool *sp, struct spStats *stats);
+
+void spDestroy(struct stackPool *sp);
+
+#endif
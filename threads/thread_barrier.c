@@ -0,0 +1,391 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 30 */
+
+/* thread_barrier.c
+
+   Barriers for the threads of a process, as alternatives to
+   pthread_barrier_wait(), which (in glibc) passes every thread through
+   one lock in each phase, and has the last thread wake all of the others
+   from one futex.
+
+   tbCreate() creates a barrier for 'nthreads' threads. Each thread must
+   pass its own ID, in the range 0 to nthreads - 1, to tbWait(), which
+   returns once all threads have called it, and can then be called
+   again for the next phase. In each phase, tbWait() returns TB_SERIAL in
+   exactly one thread (the one with ID 0 for TB_DISSEM), and 0 in the
+   others. There are three algorithms:
+
+   TB_CENTRAL   A counter of arrivals, and a phase number: the last thread
+                to arrive resets the counter and increments the phase
+                number, on which all of the other threads wait. This is
+                the classic sense-reversing barrier, with the phase
+                number (rather than one bit of it) as the sense, so that
+                waiters need not remember the previous sense.
+
+   TB_TREE      A combining tree, in which each node counts the arrivals
+                of up to TB_FANIN threads or child nodes. The last arrival
+                at a node carries on to the node's parent; the others wait
+                on the node's release word. The thread that completes the
+                root then releases each node that it completed, on its way
+                back down, as does each thread when it is released. So no
+                memory location is written by more than TB_FANIN threads
+                in each phase, or waited on by more than TB_FANIN - 1.
+
+   TB_DISSEM    Dissemination: in round r (of ceil(log2(nthreads))),
+                thread i signals thread (i + 2^r) % nthreads, and then
+                waits for a signal from thread (i - 2^r) % nthreads. There
+                is no counter; each flag has one writer and one waiter,
+                but the barrier makes n log2(n) signals per phase.
+
+   Each wait for a word to reach a value first spins, checking the word
+   up to 'spin' times (which is worthwhile only when each thread has a
+   CPU of its own), and then sleeps with FUTEX_WAIT. The count of
+   sleepers that is kept with each word means that a signal makes a
+   futex() system call only when there is a thread to wake.
+
+   tbWait() can fail only if futex() fails unexpectedly; it then returns
+   -1 with errno set.
+
+   This module is Linux-specific.
+*/
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "thread_barrier.h"     /* Declares functions defined here */
+
+#define TB_CACHE_LINE 64
+#define TB_FANIN 4              /* Arrivals counted at each tree node */
+#define TB_MAX_DEPTH 32
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpuRelax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpuRelax() __asm__ __volatile__ ("yield")
+#else
+#define cpuRelax() do { } while (0)
+#endif
+
+struct tbWord {                 /* A word that threads wait on; it is only
+                                   ever incremented */
+    uint32_t val;               /* The futex word */
+    uint32_t sleepers;          /* Threads in FUTEX_WAIT on 'val' */
+} __attribute__ ((aligned(TB_CACHE_LINE)));
+
+struct tbNode {                 /* TB_TREE */
+    uint32_t count;             /* Arrivals still awaited in this phase */
+    uint32_t fanin;             /* Arrivals expected in each phase */
+    int parent;                 /* Index of parent, or -1 for the root */
+    struct tbWord release;      /* Incremented when the node completes */
+} __attribute__ ((aligned(TB_CACHE_LINE)));
+
+struct tbThread {               /* Per-thread state */
+    uint32_t phase;             /* Phases that this thread has completed */
+} __attribute__ ((aligned(TB_CACHE_LINE)));
+
+struct threadBarrier {
+    enum tbKind kind;
+    int nthreads;
+    int spin;
+    struct tbThread *threads;   /* Indexed by thread ID */
+
+    /* TB_CENTRAL */
+
+    uint32_t count __attribute__ ((aligned(TB_CACHE_LINE)));
+    struct tbWord phase;
+
+    /* TB_TREE: the leaves are nodes 0 .. ceil(nthreads / TB_FANIN) - 1,
+       and thread i arrives at leaf i / TB_FANIN */
+
+    struct tbNode *nodes;
+
+    /* TB_DISSEM: flags[i * rounds + r] is the flag that thread i waits
+       on in round r */
+
+    int rounds;
+    struct tbWord *flags;
+};
+
+/* Has 'val' reached 'target' (allowing for wraparound)? */
+
+static int
+reached(uint32_t val, uint32_t target)
+{
+    return (int32_t) (val - target) >= 0;
+}
+
+static int
+wordSignal(struct tbWord *w)
+{
+    __atomic_fetch_add(&w->val, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&w->sleepers, __ATOMIC_SEQ_CST) > 0 &&
+            syscall(SYS_futex, &w->val, FUTEX_WAKE_PRIVATE, INT_MAX,
+                    NULL, NULL, 0) == -1)
+        return -1;
+    return 0;
+}
+
+/* Wait until 'w' reaches 'target': spin, and then sleep */
+
+static int
+wordWait(struct tbWord *w, uint32_t target, int spin)
+{
+    uint32_t cur;
+    int j, s;
+
+    for (j = 0; j < spin; j++) {
+        if (reached(__atomic_load_n(&w->val, __ATOMIC_ACQUIRE), target))
+            return 0;
+        cpuRelax();
+    }
+
+    /* Announce ourselves as a sleeper before the final check, so that a
+       signaller either sees us, or increments the word before we check
+       it (in which case FUTEX_WAIT fails with EAGAIN) */
+
+    for (;;) {
+        __atomic_fetch_add(&w->sleepers, 1, __ATOMIC_SEQ_CST);
+        cur = __atomic_load_n(&w->val, __ATOMIC_SEQ_CST);
+        s = 0;
+        if (!reached(cur, target))
+            s = syscall(SYS_futex, &w->val, FUTEX_WAIT_PRIVATE, cur,
+                        NULL, NULL, 0);
+        __atomic_fetch_sub(&w->sleepers, 1, __ATOMIC_SEQ_CST);
+        if (s == -1 && errno != EAGAIN && errno != EINTR)
+            return -1;
+        if (reached(__atomic_load_n(&w->val, __ATOMIC_ACQUIRE), target))
+            return 0;
+    }
+}
+
+static int
+centralWait(struct threadBarrier *tb, uint32_t target)
+{
+    if (__atomic_sub_fetch(&tb->count, 1, __ATOMIC_ACQ_REL) == 0) {
+
+        /* Last to arrive. No thread can arrive in the next phase until
+           it sees the new phase number, so resetting 'count' first is
+           safe. */
+
+        __atomic_store_n(&tb->count, tb->nthreads, __ATOMIC_RELAXED);
+        return (wordSignal(&tb->phase) == -1) ? -1 : TB_SERIAL;
+    }
+    return wordWait(&tb->phase, target, tb->spin);
+}
+
+static int
+treeWait(struct threadBarrier *tb, int id, uint32_t target)
+{
+    int path[TB_MAX_DEPTH];     /* Nodes completed by this thread */
+    struct tbNode *node;
+    int depth, n, ret;
+
+    ret = 0;
+    depth = 0;
+    for (n = id / TB_FANIN; ; n = node->parent) {
+        node = &tb->nodes[n];
+        if (__atomic_sub_fetch(&node->count, 1, __ATOMIC_ACQ_REL) != 0) {
+            if (wordWait(&node->release, target, tb->spin) == -1)
+                return -1;
+            break;
+        }
+
+        /* Last to arrive at this node: reset it, and carry on up */
+
+        __atomic_store_n(&node->count, node->fanin, __ATOMIC_RELAXED);
+        path[depth++] = n;
+        if (node->parent == -1) {
+            ret = TB_SERIAL;
+            break;
+        }
+    }
+
+    /* Release the nodes that we completed, from the top down */
+
+    while (depth > 0)
+        if (wordSignal(&tb->nodes[path[--depth]].release) == -1)
+            return -1;
+    return ret;
+}
+
+static int
+dissemWait(struct threadBarrier *tb, int id, uint32_t target)
+{
+    int r, dist;
+
+    for (r = 0, dist = 1; r < tb->rounds; r++, dist *= 2) {
+        if (wordSignal(&tb->flags[((id + dist) % tb->nthreads) *
+                                  tb->rounds + r]) == -1)
+            return -1;
+        if (wordWait(&tb->flags[id * tb->rounds + r], target,
+                     tb->spin) == -1)
+            return -1;
+    }
+    return (id == 0) ? TB_SERIAL : 0;
+}
+
+/* Wait until all threads have arrived at the barrier. 'id' identifies
+   the calling thread. Returns TB_SERIAL in one thread in each phase, 0
+   in the others, or -1 on error. */
+
+int
+tbWait(struct threadBarrier *tb, int id)
+{
+    uint32_t target;
+    int s;
+
+    target = tb->threads[id].phase + 1;
+    switch (tb->kind) {
+    case TB_CENTRAL:    s = centralWait(tb, target);            break;
+    case TB_TREE:       s = treeWait(tb, id, target);           break;
+    default:            s = dissemWait(tb, id, target);         break;
+    }
+    if (s != -1)
+        tb->threads[id].phase = target;
+    return s;
+}
+
+/* Allocate 'size' bytes of zeroed memory, aligned on a cache line, so
+   that each element of an array of the structures above occupies cache
+   lines of its own */
+
+static void *
+allocLines(size_t size)
+{
+    void *p;
+    int s;
+
+    s = posix_memalign(&p, TB_CACHE_LINE, size);
+    if (s != 0) {
+        errno = s;
+        return NULL;
+    }
+    memset(p, 0, size);
+    return p;
+}
+
+/* Build the combining tree: returns 0 on success, or -1 on error */
+
+static int
+buildTree(struct threadBarrier *tb)
+{
+    int total, level, width, prevWidth, first, prevFirst, j, depth;
+
+    /* Count the nodes, level by level */
+
+    total = 0;
+    depth = 0;
+    for (width = (tb->nthreads + TB_FANIN - 1) / TB_FANIN; ;
+            width = (width + TB_FANIN - 1) / TB_FANIN) {
+        total += width;
+        depth++;
+        if (width == 1)
+            break;
+    }
+    if (depth > TB_MAX_DEPTH) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    tb->nodes = allocLines(total * sizeof(struct tbNode));
+    if (tb->nodes == NULL)
+        return -1;
+
+    /* Each level's nodes follow those of the level below. A node of a
+       level counts up to TB_FANIN items (threads or nodes) of the level
+       below. */
+
+    prevFirst = 0;
+    prevWidth = tb->nthreads;
+    first = 0;
+    for (level = 0; ; level++) {
+        width = (prevWidth + TB_FANIN - 1) / TB_FANIN;
+        for (j = 0; j < width; j++) {
+            tb->nodes[first + j].fanin = (j < width - 1) ? TB_FANIN :
+                    prevWidth - (width - 1) * TB_FANIN;
+            tb->nodes[first + j].count = tb->nodes[first + j].fanin;
+            tb->nodes[first + j].parent = -1;
+        }
+        if (level > 0)
+            for (j = 0; j < prevWidth; j++)
+                tb->nodes[prevFirst + j].parent = first + j / TB_FANIN;
+        if (width == 1)
+            break;
+        prevFirst = first;
+        prevWidth = width;
+        first += width;
+    }
+    return 0;
+}
+
+/* Create a barrier of kind 'kind' for 'nthreads' threads; waits spin up
+   to 'spin' times before sleeping. Returns a pointer to the barrier, or
+   NULL on error. */
+
+struct threadBarrier *
+tbCreate(enum tbKind kind, int nthreads, int spin)
+{
+    struct threadBarrier *tb;
+    int savedErrno;
+
+    if (nthreads <= 0 || spin < 0 ||
+            (kind != TB_CENTRAL && kind != TB_TREE && kind != TB_DISSEM)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    tb = allocLines(sizeof(struct threadBarrier));
+    if (tb == NULL)
+        return NULL;
+    tb->kind = kind;
+    tb->nthreads = nthreads;
+    tb->spin = spin;
+    tb->count = nthreads;
+
+    tb->threads = allocLines(nthreads * sizeof(struct tbThread));
+    if (tb->threads == NULL)
+        goto fail;
+
+    if (kind == TB_TREE && buildTree(tb) == -1)
+        goto fail;
+
+    if (kind == TB_DISSEM) {
+        for (tb->rounds = 0; (1 << tb->rounds) < nthreads; tb->rounds++)
+            continue;
+        if (tb->rounds > 0) {
+            tb->flags = allocLines((size_t) nthreads * tb->rounds *
+                                   sizeof(struct tbWord));
+            if (tb->flags == NULL)
+                goto fail;
+        }
+    }
+    return tb;
+
+fail:
+    savedErrno = errno;
+    tbDestroy(tb);
+    errno = savedErrno;
+    return NULL;
+}
+
+void
+tbDestroy(struct threadBarrier *tb)
+{
+    free(tb->threads);
+    free(tb->nodes);
+    free(tb->flags);
+    free(tb);
+}
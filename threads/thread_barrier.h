@@ -0,0 +1,40 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 30 */
+
+/* thread_barrier.h
+
+   Header file for thread_barrier.c.
+*/
+#ifndef THREAD_BARRIER_H
+#define THREAD_BARRIER_H        /* Prevent accidental double inclusion */
+
+enum tbKind {
+    TB_CENTRAL,                 /* One counter, and one release word */
+    TB_TREE,                    /* Combining tree with tree release */
+    TB_DISSEM                   /* Dissemination (log2(n) rounds of
+                                   pairwise signals) */
+};
+
+/* Returned by tbWait() in one thread in each phase (compare
+   PTHREAD_BARRIER_SERIAL_THREAD) */
+
+#define TB_SERIAL 1
+
+struct threadBarrier;           /* Opaque */
+
+struct threadBarrier *tbCreate(enum tbKind kind, int nthreads, int spin);
+
+int tbWait(struct threadBarrier *tb, int id);
+
+void tbDestroy(struct threadBarrier *tb);
+
+#endif
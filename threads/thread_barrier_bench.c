@@ -0,0 +1,328 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 30 */
+
+/* thread_barrier_bench.c
+
+   A benchmarking counterpart to pthread_barrier_demo.c: threads pass
+   through a barrier repeatedly, and the program reports how long each
+   phase takes, for each combination of barrier implementation and
+   number of threads.
+
+   Usage: thread_barrier_bench [-b barriers] [-t nthreads] [-n phases]
+                               [-s spin] [-w work] [-p] [-V] [-C]
+
+        -b barriers   Comma-separated list of barriers to measure
+                      (default: all):
+                        pthread   pthread_barrier_wait()
+                        central   thread_barrier.c, TB_CENTRAL
+                        tree      thread_barrier.c, TB_TREE
+                        dissem    thread_barrier.c, TB_DISSEM
+        -t nthreads   Comma-separated list of thread counts
+                      (default: 1,2,4,8)
+        -n phases     Number of phases in each run (default: 100000)
+        -s spin       Number of times that thread_barrier.c waits spin
+                      before sleeping (default: 2000 if there are at
+                      least as many CPUs as threads, otherwise 0)
+        -w work       In each phase, each thread performs a random number
+                      (from 0 to 'work') of loop iterations before
+                      arriving at the barrier (default: 0)
+        -p            Pin thread 'n' to CPU (n % number-of-CPUs)
+        -V            Verify that no thread leaves a phase before all
+                      threads have arrived in it (this adds a shared
+                      atomic increment to each phase)
+        -C            Produce CSV output
+
+   For each run, the program shows the mean time per phase, and the
+   median, 99th percentile, and maximum of the times between successive
+   returns from the barrier in thread 0. It also checks that the barrier
+   returned the "serial" value exactly once in each phase.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "thread_barrier.h"
+#include "lat_hist.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+#define MAX_LIST 64             /* Maximum items in a comma-separated list */
+
+enum barrierType { B_PTHREAD, B_CENTRAL, B_TREE, B_DISSEM, NUM_BARRIERS };
+
+static const char *barrierNames[NUM_BARRIERS] = {
+    "pthread", "central", "tree", "dissem"
+};
+
+static enum barrierType curBarrier;
+static pthread_barrier_t pbarrier;
+static struct threadBarrier *tbarrier;
+static pthread_barrier_t startBarrier;
+static long phases;
+static int nthreadsCur;
+static int work;
+static Boolean pin, verify;
+static long serialCount;        /* Serial returns (updated atomically) */
+static long arrivals;           /* -V: arrivals (updated atomically) */
+static volatile Boolean verifyFailed;
+static struct latHist hist;     /* Phase times seen by thread 0 */
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int
+barrierWait(int id)
+{
+    int s;
+
+    if (curBarrier == B_PTHREAD) {
+        s = pthread_barrier_wait(&pbarrier);
+        if (s == PTHREAD_BARRIER_SERIAL_THREAD)
+            return 1;
+        if (s != 0)
+            errExitEN(s, "pthread_barrier_wait");
+        return 0;
+    }
+
+    s = tbWait(tbarrier, id);
+    if (s == -1)
+        errExit("tbWait");
+    return s == TB_SERIAL;
+}
+
+static void *
+threadFunc(void *arg)
+{
+    int id = (int) (long) arg;
+    unsigned int seed;
+    long long prev, now;
+    cpu_set_t set;
+    volatile int loc;
+    long k, serial;
+    int s, j, n;
+
+    if (pin) {
+        CPU_ZERO(&set);
+        CPU_SET(id % sysconf(_SC_NPROCESSORS_ONLN), &set);
+        s = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (s != 0)
+            errExitEN(s, "pthread_setaffinity_np");
+    }
+
+    s = pthread_barrier_wait(&startBarrier);
+    if (s != 0 && s != PTHREAD_BARRIER_SERIAL_THREAD)
+        errExitEN(s, "pthread_barrier_wait");
+
+    seed = id + 1;
+    serial = 0;
+    prev = (id == 0) ? nowNs() : 0;
+    for (k = 0; k < phases; k++) {
+        if (work > 0) {
+            n = rand_r(&seed) % (work + 1);
+            for (j = 0, loc = 0; j < n; j++)
+                loc++;
+        }
+
+        if (verify)
+            __atomic_fetch_add(&arrivals, 1, __ATOMIC_SEQ_CST);
+
+        serial += barrierWait(id);
+
+        /* Every thread must have arrived in this phase */
+
+        if (verify && __atomic_load_n(&arrivals, __ATOMIC_SEQ_CST) <
+                (k + 1) * nthreadsCur)
+            verifyFailed = TRUE;
+
+        if (id == 0) {
+            now = nowNs();
+            latHistRecord(&hist, now - prev);
+            prev = now;
+        }
+    }
+
+    __atomic_fetch_add(&serialCount, serial, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+static void
+runOne(int nthreads, int spin, Boolean csv)
+{
+    pthread_t *tid;
+    long long start, elapsed;
+    int s, j;
+
+    nthreadsCur = nthreads;
+    serialCount = arrivals = 0;
+    verifyFailed = FALSE;
+    latHistInit(&hist);
+
+    if (curBarrier == B_PTHREAD) {
+        s = pthread_barrier_init(&pbarrier, NULL, nthreads);
+        if (s != 0)
+            errExitEN(s, "pthread_barrier_init");
+    } else {
+        tbarrier = tbCreate((curBarrier == B_CENTRAL) ? TB_CENTRAL :
+                            (curBarrier == B_TREE) ? TB_TREE : TB_DISSEM,
+                            nthreads, spin);
+        if (tbarrier == NULL)
+            errExit("tbCreate");
+    }
+
+    s = pthread_barrier_init(&startBarrier, NULL, nthreads + 1);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_init");
+
+    tid = calloc(nthreads, sizeof(pthread_t));
+    if (tid == NULL)
+        errExit("calloc");
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_create(&tid[j], NULL, threadFunc, (void *) (long) j);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    s = pthread_barrier_wait(&startBarrier);
+    if (s != 0 && s != PTHREAD_BARRIER_SERIAL_THREAD)
+        errExitEN(s, "pthread_barrier_wait");
+    start = nowNs();
+
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_join(tid[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+    elapsed = nowNs() - start;
+
+    if (serialCount != phases)
+        fatal("%s: %ld serial returns in %ld phases",
+              barrierNames[curBarrier], serialCount, phases);
+    if (verifyFailed)
+        fatal("%s: a thread left a phase early", barrierNames[curBarrier]);
+
+    if (csv)
+        printf("%s,%d,%d,%.1f,%.1f,%.1f,%.1f\n", barrierNames[curBarrier],
+               nthreads, (curBarrier == B_PTHREAD) ? 0 : spin,
+               (double) elapsed / phases,
+               (double) latHistPercentile(&hist, 0.50),
+               (double) latHistPercentile(&hist, 0.99), (double) hist.max);
+    else
+        printf("%-8s %7d %7d %10.0f %10.2f %10.2f %10.1f\n",
+               barrierNames[curBarrier], nthreads,
+               (curBarrier == B_PTHREAD) ? 0 : spin,
+               (double) elapsed / phases,
+               latHistPercentile(&hist, 0.50) / 1000.0,
+               latHistPercentile(&hist, 0.99) / 1000.0, hist.max / 1000.0);
+    fflush(stdout);
+
+    free(tid);
+    pthread_barrier_destroy(&startBarrier);
+    if (curBarrier == B_PTHREAD)
+        pthread_barrier_destroy(&pbarrier);
+    else
+        tbDestroy(tbarrier);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-b barriers] [-t nthreads] [-n phases]\n"
+                    "\t\t[-s spin] [-w work] [-p] [-V] [-C]\n", progName);
+    fprintf(stderr, "    -b barriers  pthread,central,tree,dissem "
+                    "(default: all)\n");
+    fprintf(stderr, "    -t nthreads  Thread counts (default: 1,2,4,8)\n");
+    fprintf(stderr, "    -n phases    Phases per run (default: 100000)\n");
+    fprintf(stderr, "    -s spin      Spins before sleeping\n");
+    fprintf(stderr, "    -w work      Max. work per phase (default: 0)\n");
+    fprintf(stderr, "    -p           Pin threads to CPUs\n");
+    fprintf(stderr, "    -V           Verify the barriers\n");
+    fprintf(stderr, "    -C           CSV output\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int barriers[NUM_BARRIERS], threads[MAX_LIST];
+    int nbarriers, nthreadCounts, spin, opt, b, t;
+    Boolean csv;
+    char *tok;
+    long ncpus;
+
+    nbarriers = 0;
+    threads[0] = 1; threads[1] = 2; threads[2] = 4; threads[3] = 8;
+    nthreadCounts = 4;
+    phases = 100000;
+    spin = -1;
+    csv = FALSE;
+
+    while ((opt = getopt(argc, argv, "b:t:n:s:w:pVC")) != -1) {
+        switch (opt) {
+        case 'b':
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                for (b = 0; b < NUM_BARRIERS; b++)
+                    if (strcmp(tok, barrierNames[b]) == 0)
+                        break;
+                if (b == NUM_BARRIERS || nbarriers == NUM_BARRIERS)
+                    usageError(argv[0]);
+                barriers[nbarriers++] = b;
+            }
+            break;
+        case 't':
+            nthreadCounts = benchParseList(optarg, threads, MAX_LIST,
+                                           GN_GT_0, "nthreads");
+            break;
+        case 'n':   phases = getLong(optarg, GN_GT_0, "phases");    break;
+        case 's':   spin = getInt(optarg, GN_NONNEG, "spin");       break;
+        case 'w':   work = getInt(optarg, GN_NONNEG, "work");       break;
+        case 'p':   pin = TRUE;                                     break;
+        case 'V':   verify = TRUE;                                  break;
+        case 'C':   csv = TRUE;                                     break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc)
+        usageError(argv[0]);
+
+    if (nbarriers == 0)
+        for (b = 0; b < NUM_BARRIERS; b++)
+            barriers[nbarriers++] = b;
+
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (csv)
+        printf("barrier,threads,spin,ns_per_phase,p50_ns,p99_ns,max_ns\n");
+    else
+        printf("%-8s %7s %7s %10s %10s %10s %10s\n", "barrier", "threads",
+               "spin", "ns/phase", "p50-us", "p99-us", "max-us");
+
+    for (t = 0; t < nthreadCounts; t++) {
+        for (b = 0; b < nbarriers; b++) {
+            curBarrier = barriers[b];
+            runOne(threads[t], (spin >= 0) ? spin :
+                               (threads[t] <= ncpus) ? 2000 : 0, csv);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,47 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 31 */
+
+/* thread_buf.c
+
+   Per-thread scratch buffers, for functions that, like strerror() and
+   the strerror_tls.c and strerror_tsd.c versions of it, return a
+   pointer to a string that they have built. Using such a buffer, rather
+   than a static one, makes the function thread-safe without locking
+   (as in strerror_tls.c), although each thread's next call still
+   overwrites the previous result.
+
+   threadBuf(id, size) returns the calling thread's buffer number 'id'
+   (0 <= id < THREAD_BUF_MAX), which is THREAD_BUF_SIZE bytes long. The
+   buffer and its contents persist from call to call, and are initially
+   zero. Returns NULL (with errno set to EINVAL) if 'id' is out of range,
+   or 'size' is greater than THREAD_BUF_SIZE.
+
+   The buffers are a __thread array, so that a call costs a thread-local
+   address computation and two comparisons, and there is nothing to
+   allocate, or to free when the thread terminates; no use is made of
+   the Pthreads API (compare strerror_tsd.c).
+*/
+#include <errno.h>
+#include "thread_buf.h"         /* Declares function defined here */
+
+static __thread char bufs[THREAD_BUF_MAX][THREAD_BUF_SIZE];
+
+void *
+threadBuf(int id, size_t size)
+{
+    if (id < 0 || id >= THREAD_BUF_MAX || size > THREAD_BUF_SIZE) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return bufs[id];
+}
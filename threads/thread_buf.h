@@ -0,0 +1,27 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 31 */
+
+/* thread_buf.h
+
+   Header file for thread_buf.c.
+*/
+#ifndef THREAD_BUF_H
+#define THREAD_BUF_H            /* Prevent accidental double inclusion */
+
+#include <stddef.h>
+
+#define THREAD_BUF_MAX          16      /* Number of buffers per thread */
+#define THREAD_BUF_SIZE         256     /* Size of each buffer */
+
+void *threadBuf(int id, size_t size);
+
+#endif
@@ -15,7 +15,9 @@
    This program employs two POSIX threads that increment the same global
    variable, synchronizing their access using a read/write lock. As a
    consequence, updates are not lost. Compare with thread_incr.c,
-   thread_incr_mutex.c, and thread_incr_spinlock.c.
+   thread_incr_mutex.c, and thread_incr_spinlock.c. See
+   thread_read_bench.c for a comparison of read/write locks with other
+   techniques when (as is more usual) most accesses are reads.
 */
 #include <pthread.h>
 #include "tlpi_hdr.h"
@@ -0,0 +1,116 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 30 */
+
+/* thread_incr_sharded.c
+
+   A version of thread_incr_mutex.c in which the threads increment a
+   sharded counter (see sharded_counter.c), rather than a single global
+   variable protected by a mutex. Updates are not lost, but the threads
+   don't contend for a lock or for the cache line containing the counter.
+
+   Usage: thread_incr_sharded [-c] [-t nthreads] [num-loops]
+
+        -c            Use per-CPU slots (default: per-thread slots)
+        -t nthreads   Number of threads (default: 2)
+
+   The program displays the final value of the counter and the elapsed
+   time. Compare the times with those of thread_incr_mutex.c and
+   thread_incr_spinlock.c as the number of threads grows; "thread_lock_bench
+   -l mutex,spin,atomic,sharded,percpu" makes the same comparison.
+
+   This program is Linux-specific.
+*/
+#include <time.h>
+#include <pthread.h>
+#include "sharded_counter.h"
+#include "tlpi_hdr.h"
+
+static struct shardedCounter glob;
+
+static void *                   /* Loop 'arg' times incrementing 'glob' */
+threadFunc(void *arg)
+{
+    int loops = *((int *) arg);
+    int j;
+
+    for (j = 0; j < loops; j++)
+        scAdd(&glob, 1);
+
+    return NULL;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-c] [-t nthreads] [num-loops]\n", progName);
+    fprintf(stderr, "    -c            Use per-CPU slots\n");
+    fprintf(stderr, "    -t nthreads   Number of threads (default: 2)\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    pthread_t *tid;
+    struct timespec start, end;
+    enum scMode mode;
+    int loops, nthreads, opt, s, j;
+
+    mode = SC_PER_THREAD;
+    nthreads = 2;
+    while ((opt = getopt(argc, argv, "ct:")) != -1) {
+        switch (opt) {
+        case 'c':   mode = SC_PER_CPU;                                  break;
+        case 't':   nthreads = getInt(optarg, GN_GT_0, "nthreads");     break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    loops = (optind < argc) ? getInt(argv[optind], GN_GT_0, "num-loops") :
+                              10000000;
+
+    /* Per-thread slots: one for each thread. Per-CPU slots: one for
+       each CPU. */
+
+    if (scInit(&glob, mode, (mode == SC_PER_THREAD) ? nthreads : 0) == -1)
+        errExit("scInit");
+
+    tid = calloc(nthreads, sizeof(pthread_t));
+    if (tid == NULL)
+        errExit("calloc");
+
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_create(&tid[j], NULL, threadFunc, &loops);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_join(tid[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+
+    printf("glob = %ld\n", scRead(&glob));
+    printf("%d threads, %s slots: %.3f secs\n", nthreads,
+            (mode == SC_PER_CPU) ? "per-CPU" : "per-thread",
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    scFree(&glob);
+    exit(EXIT_SUCCESS);
+}
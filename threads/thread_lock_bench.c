@@ -0,0 +1,701 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 33 */
+
+/* thread_lock_bench.c
+
+   A more thorough version of thread_lock_speed.c. Threads repeatedly
+   acquire a lock, increment a shared variable a number of times (the
+   "critical section"), release the lock, and then (optionally) perform
+   some work outside the lock. The program runs every combination of the
+   specified locks, thread counts, critical-section lengths, and amounts
+   of outside work for a fixed time, and reports the rate at which the
+   lock was acquired.
+
+   Usage: thread_lock_bench [-l locks] [-t nthreads] [-c cs-lengths]
+                            [-o outside-lengths] [-d secs] [-p] [-F] [-C]
+
+        -l locks      Comma-separated list of locks to measure (default:
+                      all); see below
+        -t nthreads   Comma-separated list of thread counts
+                      (default: 1,2,4,8)
+        -c lengths    Comma-separated list of critical-section lengths, as
+                      numbers of increments (default: 1,10,100)
+        -o lengths    Comma-separated list of numbers of loop iterations
+                      executed outside the lock after each release; larger
+                      values reduce contention (default: 0)
+        -d secs       Duration of each run (default: 1)
+        -p            Pin thread 'n' to CPU (n % number-of-CPUs)
+        -F            "False sharing" layout: place the lock, the shared
+                      variable, and the per-thread operation counters in
+                      adjacent memory, rather than each in a cache line
+                      of its own
+        -C            Produce CSV output
+
+   The locks are:
+
+        mutex      pthread mutex (PTHREAD_MUTEX_NORMAL)
+        adaptive   pthread mutex (PTHREAD_MUTEX_ADAPTIVE_NP), which spins
+                   briefly before sleeping
+        spin       pthread spin lock
+        rwlock     pthread read-write lock, write-locked (as in
+                   thread_incr_rwlock.c)
+        sem        POSIX unnamed semaphore (as in thread_incr_psem.c)
+        futex      a mutex built directly on futex(2), using the three-state
+                   algorithm from Ulrich Drepper's "Futexes Are Tricky"
+        ticket     a ticket lock (FIFO spin lock)
+        mcs        an MCS queue lock, in which each waiter spins on a flag
+                   in its own cache line
+        tas        a test-and-test-and-set spin lock
+        atomic     no lock: the increments are C11 atomic_fetch_add()
+                   operations
+        sharded    no lock: the increments are made to a sharded counter
+                   (see sharded_counter.c) with one slot per thread
+        percpu     as "sharded", but with one slot per CPU
+
+   The futex, ticket, mcs, tas, and atomic variants are implemented using
+   C11 atomics. The spinning locks call sched_yield() after SPIN_LIMIT
+   unsuccessful attempts, so that they make progress (slowly) even when
+   there are more threads than CPUs.
+
+   After each run, the program checks that the shared variable was
+   incremented the expected number of times. The "fair" column shows
+   the ratio of the smallest to the largest number of operations performed
+   by any thread.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include "sharded_counter.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+#define CACHE_LINE 64
+#define SPIN_LIMIT 1000
+#define MAX_LIST 64             /* Maximum items in a comma-separated list */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpuRelax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpuRelax() __asm__ __volatile__ ("yield")
+#else
+#define cpuRelax() do { } while (0)
+#endif
+
+enum lockType { L_MUTEX, L_ADAPTIVE, L_SPIN, L_RWLOCK, L_SEM, L_FUTEX,
+                L_TICKET, L_MCS, L_TAS, L_ATOMIC, L_SHARDED, L_PERCPU,
+                NUM_LOCKS };
+
+static const char *lockNames[NUM_LOCKS] = {
+    "mutex", "adaptive", "spin", "rwlock", "sem", "futex",
+    "ticket", "mcs", "tas", "atomic", "sharded", "percpu"
+};
+
+struct mcsNode {                /* One per thread, in its own cache line */
+    _Atomic(struct mcsNode *) next;
+    atomic_int locked;
+} __attribute__ ((aligned(CACHE_LINE)));
+
+union anyLock {
+    pthread_mutex_t mtx;
+    pthread_spinlock_t spin;
+    pthread_rwlock_t rwlock;
+    sem_t sem;
+    atomic_int futex;           /* 0: unlocked; 1: locked; 2: contended */
+    struct {
+        atomic_uint next;       /* Next ticket to issue */
+        atomic_uint serving;    /* Ticket now being served */
+    } ticket;
+    _Atomic(struct mcsNode *) mcsTail;
+    atomic_bool tas;
+};
+
+/* The two layouts of the shared data. In the padded layout, the lock
+   and the variable that it protects are in separate cache lines, so
+   that waiters spinning on the lock don't disturb the holder's accesses
+   to the variable. */
+
+static struct {
+    union anyLock lock __attribute__ ((aligned(CACHE_LINE)));
+    volatile long glob __attribute__ ((aligned(CACHE_LINE)));
+} padded;
+
+static struct {
+    union anyLock lock;
+    volatile long glob;
+} __attribute__ ((aligned(CACHE_LINE))) packed;
+
+static union anyLock *lockp;
+static volatile long *globp;
+static atomic_long *atomicGlob; /* 'glob', for "atomic" */
+static struct shardedCounter shardedGlob;   /* For "sharded", "percpu" */
+
+/* Per-thread operation counters: adjacent longs in the false-sharing
+   layout, or one per cache line in the padded layout */
+
+static long *opsArray;
+static int opsStride;
+
+#define OPS(j) (opsArray[(j) * opsStride])
+
+static atomic_int stop;         /* Set by main() to end a run */
+static pthread_barrier_t startBarrier;
+
+static enum lockType curLock;
+static int csLen;
+static int outsideLen;
+static Boolean pin;
+
+/* Three-state futex mutex */
+
+static void
+futexLock(atomic_int *f)
+{
+    int c = 0;
+
+    if (atomic_compare_exchange_strong(f, &c, 1))
+        return;                         /* Uncontended */
+
+    /* Mark the lock contended (2), so that the unlocker knows that it
+       must call FUTEX_WAKE, and sleep until we obtain it */
+
+    if (c != 2)
+        c = atomic_exchange(f, 2);
+    while (c != 0) {
+        syscall(SYS_futex, f, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+        c = atomic_exchange(f, 2);
+    }
+}
+
+static void
+futexUnlock(atomic_int *f)
+{
+    if (atomic_fetch_sub(f, 1) != 1) {  /* Was contended */
+        atomic_store(f, 0);
+        syscall(SYS_futex, f, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+static inline void
+spinPause(int *spins)
+{
+    if (++*spins >= SPIN_LIMIT) {
+        sched_yield();
+        *spins = 0;
+    } else {
+        cpuRelax();
+    }
+}
+
+static void
+acquire(struct mcsNode *me)
+{
+    struct mcsNode *pred;
+    unsigned int ticket;
+    int s, spins = 0;
+    bool expected;
+
+    switch (curLock) {
+    case L_MUTEX:
+    case L_ADAPTIVE:
+        s = pthread_mutex_lock(&lockp->mtx);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_lock");
+        break;
+
+    case L_SPIN:
+        s = pthread_spin_lock(&lockp->spin);
+        if (s != 0)
+            errExitEN(s, "pthread_spin_lock");
+        break;
+
+    case L_RWLOCK:
+        s = pthread_rwlock_wrlock(&lockp->rwlock);
+        if (s != 0)
+            errExitEN(s, "pthread_rwlock_wrlock");
+        break;
+
+    case L_SEM:
+        while (sem_wait(&lockp->sem) == -1)
+            if (errno != EINTR)
+                errExit("sem_wait");
+        break;
+
+    case L_FUTEX:
+        futexLock(&lockp->futex);
+        break;
+
+    case L_TICKET:
+        ticket = atomic_fetch_add_explicit(&lockp->ticket.next, 1,
+                                           memory_order_relaxed);
+        while (atomic_load_explicit(&lockp->ticket.serving,
+                                    memory_order_acquire) != ticket)
+            spinPause(&spins);
+        break;
+
+    case L_MCS:
+
+        /* Append our node to the queue; if there was a predecessor, link
+           it to us and spin on our own 'locked' flag until it hands the
+           lock over */
+
+        atomic_store_explicit(&me->next, NULL, memory_order_relaxed);
+        atomic_store_explicit(&me->locked, 1, memory_order_relaxed);
+        pred = atomic_exchange_explicit(&lockp->mcsTail, me,
+                                        memory_order_acq_rel);
+        if (pred != NULL) {
+            atomic_store_explicit(&pred->next, me, memory_order_release);
+            while (atomic_load_explicit(&me->locked, memory_order_acquire))
+                spinPause(&spins);
+        }
+        break;
+
+    case L_TAS:
+        for (;;) {
+            expected = false;
+            if (atomic_compare_exchange_weak_explicit(&lockp->tas,
+                        &expected, true, memory_order_acquire,
+                        memory_order_relaxed))
+                break;
+            while (atomic_load_explicit(&lockp->tas, memory_order_relaxed))
+                spinPause(&spins);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void
+release(struct mcsNode *me)
+{
+    struct mcsNode *succ, *expected;
+    int s, spins = 0;
+
+    switch (curLock) {
+    case L_MUTEX:
+    case L_ADAPTIVE:
+        s = pthread_mutex_unlock(&lockp->mtx);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_unlock");
+        break;
+
+    case L_SPIN:
+        s = pthread_spin_unlock(&lockp->spin);
+        if (s != 0)
+            errExitEN(s, "pthread_spin_unlock");
+        break;
+
+    case L_RWLOCK:
+        s = pthread_rwlock_unlock(&lockp->rwlock);
+        if (s != 0)
+            errExitEN(s, "pthread_rwlock_unlock");
+        break;
+
+    case L_SEM:
+        if (sem_post(&lockp->sem) == -1)
+            errExit("sem_post");
+        break;
+
+    case L_FUTEX:
+        futexUnlock(&lockp->futex);
+        break;
+
+    case L_TICKET:
+        atomic_store_explicit(&lockp->ticket.serving,
+                atomic_load_explicit(&lockp->ticket.serving,
+                                     memory_order_relaxed) + 1,
+                memory_order_release);
+        break;
+
+    case L_MCS:
+        succ = atomic_load_explicit(&me->next, memory_order_acquire);
+        if (succ == NULL) {
+
+            /* No known successor: if we are still the tail, the queue
+               is now empty. Otherwise, a successor is in the middle of
+               linking itself to us; wait for it to do so. */
+
+            expected = me;
+            if (atomic_compare_exchange_strong_explicit(&lockp->mcsTail,
+                        &expected, NULL, memory_order_acq_rel,
+                        memory_order_relaxed))
+                break;
+            while ((succ = atomic_load_explicit(&me->next,
+                                memory_order_acquire)) == NULL)
+                spinPause(&spins);
+        }
+        atomic_store_explicit(&succ->locked, 0, memory_order_release);
+        break;
+
+    case L_TAS:
+        atomic_store_explicit(&lockp->tas, false, memory_order_release);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void *
+threadFunc(void *arg)
+{
+    int idx = (int) (long) arg;
+    struct mcsNode node;
+    cpu_set_t set;
+    volatile int loc;
+    int s, k;
+
+    if (pin) {
+        CPU_ZERO(&set);
+        CPU_SET(idx % sysconf(_SC_NPROCESSORS_ONLN), &set);
+        s = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (s != 0)
+            errExitEN(s, "pthread_setaffinity_np");
+    }
+
+    s = pthread_barrier_wait(&startBarrier);
+    if (s != 0 && s != PTHREAD_BARRIER_SERIAL_THREAD)
+        errExitEN(s, "pthread_barrier_wait");
+
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        if (curLock == L_ATOMIC) {
+            for (k = 0; k < csLen; k++)
+                atomic_fetch_add_explicit(atomicGlob, 1,
+                                          memory_order_relaxed);
+        } else if (curLock == L_SHARDED || curLock == L_PERCPU) {
+            for (k = 0; k < csLen; k++)
+                scAdd(&shardedGlob, 1);
+        } else {
+            acquire(&node);
+            for (k = 0; k < csLen; k++)
+                (*globp)++;
+            release(&node);
+        }
+
+        OPS(idx)++;
+
+        for (loc = 0; loc < outsideLen; loc++)
+            continue;
+    }
+
+    return NULL;
+}
+
+static void
+initLock(enum lockType type)
+{
+    pthread_mutexattr_t mattr;
+    int s;
+
+    memset(lockp, 0, sizeof(*lockp));
+
+    switch (type) {
+    case L_MUTEX:
+    case L_ADAPTIVE:
+        s = pthread_mutexattr_init(&mattr);
+        if (s != 0)
+            errExitEN(s, "pthread_mutexattr_init");
+        s = pthread_mutexattr_settype(&mattr, (type == L_MUTEX) ?
+                PTHREAD_MUTEX_NORMAL : PTHREAD_MUTEX_ADAPTIVE_NP);
+        if (s != 0)
+            errExitEN(s, "pthread_mutexattr_settype");
+        s = pthread_mutex_init(&lockp->mtx, &mattr);
+        if (s != 0)
+            errExitEN(s, "pthread_mutex_init");
+        pthread_mutexattr_destroy(&mattr);
+        break;
+
+    case L_SPIN:
+        s = pthread_spin_init(&lockp->spin, PTHREAD_PROCESS_PRIVATE);
+        if (s != 0)
+            errExitEN(s, "pthread_spin_init");
+        break;
+
+    case L_RWLOCK:
+        s = pthread_rwlock_init(&lockp->rwlock, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_rwlock_init");
+        break;
+
+    case L_SEM:
+        if (sem_init(&lockp->sem, 0, 1) == -1)
+            errExit("sem_init");
+        break;
+
+    default:                    /* Zero is "unlocked" for the others */
+        break;
+    }
+}
+
+static void
+destroyLock(enum lockType type)
+{
+    switch (type) {
+    case L_MUTEX:
+    case L_ADAPTIVE:    pthread_mutex_destroy(&lockp->mtx);     break;
+    case L_SPIN:        pthread_spin_destroy(&lockp->spin);     break;
+    case L_RWLOCK:      pthread_rwlock_destroy(&lockp->rwlock); break;
+    case L_SEM:         sem_destroy(&lockp->sem);               break;
+    default:                                                    break;
+    }
+}
+
+static double
+cpuSecs(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) == -1)
+        errExit("getrusage");
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/* Perform one run, and print a line of results */
+
+static void
+runOne(int nthreads, double duration, Boolean csv, Boolean falseSharing)
+{
+    pthread_t *tid;
+    struct timespec start, end, ts;
+    long totOps, minOps, maxOps, expected, actual;
+    double secs, cpu;
+    int s, j;
+
+    tid = calloc(nthreads, sizeof(pthread_t));
+    if (tid == NULL)
+        errExit("calloc");
+    memset(opsArray, 0, nthreads * opsStride * sizeof(long));
+
+    initLock(curLock);
+    *globp = 0;
+    if (curLock == L_SHARDED || curLock == L_PERCPU)
+        if (scInit(&shardedGlob, (curLock == L_SHARDED) ? SC_PER_THREAD :
+                    SC_PER_CPU, (curLock == L_SHARDED) ? nthreads : 0) == -1)
+            errExit("scInit");
+    atomic_store(&stop, 0);
+
+    s = pthread_barrier_init(&startBarrier, NULL, nthreads + 1);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_init");
+
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_create(&tid[j], NULL, threadFunc, (void *) (long) j);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    cpu = cpuSecs();
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+    s = pthread_barrier_wait(&startBarrier);
+    if (s != 0 && s != PTHREAD_BARRIER_SERIAL_THREAD)
+        errExitEN(s, "pthread_barrier_wait");
+
+    ts.tv_sec = (time_t) duration;
+    ts.tv_nsec = (duration - ts.tv_sec) * 1e9;
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+        continue;
+    atomic_store(&stop, 1);
+
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_join(tid[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    if (clock_gettime(CLOCK_MONOTONIC, &end) == -1)
+        errExit("clock_gettime");
+    cpu = cpuSecs() - cpu;
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    s = pthread_barrier_destroy(&startBarrier);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_destroy");
+    destroyLock(curLock);
+    free(tid);
+
+    totOps = 0;
+    minOps = maxOps = OPS(0);
+    for (j = 0; j < nthreads; j++) {
+        totOps += OPS(j);
+        minOps = min(minOps, OPS(j));
+        maxOps = max(maxOps, OPS(j));
+    }
+
+    /* Verify mutual exclusion: no increments were lost */
+
+    expected = totOps * csLen;
+    if (curLock == L_SHARDED || curLock == L_PERCPU) {
+        actual = scRead(&shardedGlob);
+        scFree(&shardedGlob);
+    } else {
+        actual = (curLock == L_ATOMIC) ? atomic_load(atomicGlob) : *globp;
+    }
+    if (actual != expected)
+        fatal("%s: glob = %ld; expected %ld", lockNames[curLock],
+                actual, expected);
+
+    if (csv)
+        printf("%s,%d,%d,%d,%s,%d,%ld,%.3f,%.0f,%.1f,%.3f,%.3f\n",
+                lockNames[curLock], nthreads, csLen, outsideLen,
+                falseSharing ? "packed" : "padded", pin, totOps, secs,
+                totOps / secs, secs * 1e9 / totOps,
+                (maxOps > 0) ? (double) minOps / maxOps : 0.0, cpu);
+    else
+        printf("%-9s %7d %6d %8d %14.0f %10.1f %6.3f %8.2f\n",
+                lockNames[curLock], nthreads, csLen, outsideLen,
+                totOps / secs, secs * 1e9 / totOps,
+                (maxOps > 0) ? (double) minOps / maxOps : 0.0, cpu);
+    fflush(stdout);
+}
+
+static void
+usageError(const char *progName)
+{
+    int j;
+
+    fprintf(stderr, "Usage: %s [-l locks] [-t nthreads] [-c cs-lengths]\n"
+                    "\t\t[-o outside-lengths] [-d secs] [-p] [-F] [-C]\n",
+                    progName);
+    fprintf(stderr, "    -l locks     Locks to measure (default: all):\n\t");
+    for (j = 0; j < NUM_LOCKS; j++)
+        fprintf(stderr, " %s", lockNames[j]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "    -t nthreads  Thread counts (default: 1,2,4,8)\n");
+    fprintf(stderr, "    -c lengths   Critical-section lengths "
+                    "(default: 1,10,100)\n");
+    fprintf(stderr, "    -o lengths   Work outside lock (default: 0)\n");
+    fprintf(stderr, "    -d secs      Duration of each run (default: 1)\n");
+    fprintf(stderr, "    -p           Pin threads to CPUs\n");
+    fprintf(stderr, "    -F           False-sharing (packed) layout\n");
+    fprintf(stderr, "    -C           CSV output\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int locks[NUM_LOCKS], threads[MAX_LIST], csLens[MAX_LIST];
+    int outsideLens[MAX_LIST];
+    int nlocks, nthreadCounts, ncs, noutside, maxThreads;
+    int opt, l, t, c, o, j;
+    Boolean csv, falseSharing;
+    double duration;
+    char *tok, *endp;
+
+    nlocks = 0;
+    threads[0] = 1; threads[1] = 2; threads[2] = 4; threads[3] = 8;
+    nthreadCounts = 4;
+    csLens[0] = 1; csLens[1] = 10; csLens[2] = 100;
+    ncs = 3;
+    outsideLens[0] = 0;
+    noutside = 1;
+    duration = 1;
+    pin = csv = falseSharing = FALSE;
+
+    while ((opt = getopt(argc, argv, "l:t:c:o:d:pFC")) != -1) {
+        switch (opt) {
+        case 'l':
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                for (l = 0; l < NUM_LOCKS; l++)
+                    if (strcmp(tok, lockNames[l]) == 0)
+                        break;
+                if (l == NUM_LOCKS || nlocks == NUM_LOCKS)
+                    usageError(argv[0]);
+                locks[nlocks++] = l;
+            }
+            break;
+        case 't':
+            nthreadCounts = benchParseList(optarg, threads, MAX_LIST,
+                                           GN_GT_0, "nthreads");
+            break;
+        case 'c':
+            ncs = benchParseList(optarg, csLens, MAX_LIST, GN_NONNEG,
+                                 "cs-length");
+            break;
+        case 'o':
+            noutside = benchParseList(optarg, outsideLens, MAX_LIST,
+                                       GN_NONNEG, "outside-length");
+            break;
+        case 'd':
+            duration = strtod(optarg, &endp);
+            if (*endp != '\0' || duration <= 0)
+                cmdLineErr("Bad duration: %s\n", optarg);
+            break;
+        case 'p':   pin = TRUE;                 break;
+        case 'F':   falseSharing = TRUE;        break;
+        case 'C':   csv = TRUE;                 break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc)
+        usageError(argv[0]);
+
+    if (nlocks == 0)
+        for (l = 0; l < NUM_LOCKS; l++)
+            locks[nlocks++] = l;
+
+    /* Prevent runaway/forgotten process from burning up CPU time forever */
+
+    alarm(nlocks * nthreadCounts * ncs * noutside * (duration + 5) + 60);
+
+    /* Set up the chosen memory layout */
+
+    if (falseSharing) {
+        lockp = &packed.lock;
+        globp = &packed.glob;
+        opsStride = 1;
+    } else {
+        lockp = &padded.lock;
+        globp = &padded.glob;
+        opsStride = CACHE_LINE / sizeof(long);
+    }
+    atomicGlob = (atomic_long *) globp;
+
+    maxThreads = 0;
+    for (j = 0; j < nthreadCounts; j++)
+        maxThreads = max(maxThreads, threads[j]);
+    if (posix_memalign((void **) &opsArray, CACHE_LINE,
+                       maxThreads * opsStride * sizeof(long)) != 0)
+        fatal("posix_memalign");
+
+    if (csv)
+        printf("lock,threads,cs_len,outside_len,layout,pinned,ops,secs,"
+               "ops_per_sec,ns_per_op,fairness,cpu_secs\n");
+    else
+        printf("%-9s %7s %6s %8s %14s %10s %6s %8s\n", "lock", "threads",
+                "cs", "outside", "ops/sec", "ns/op", "fair", "cpu-secs");
+
+    for (l = 0; l < nlocks; l++)
+        for (t = 0; t < nthreadCounts; t++)
+            for (c = 0; c < ncs; c++)
+                for (o = 0; o < noutside; o++) {
+                    curLock = locks[l];
+                    csLen = csLens[c];
+                    outsideLen = outsideLens[o];
+                    runOne(threads[t], duration, csv, falseSharing);
+                }
+
+    exit(EXIT_SUCCESS);
+}
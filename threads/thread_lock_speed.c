@@ -31,8 +31,17 @@
    program. In some scenarios (e.g., many threads, large "inner loop"
    values), mutexes will perform better, while in others (few threads,
    small "inner loop" value), spin locks are likely to be better.
+
+   See thread_lock_bench.c for a program that compares many more kinds
+   of lock, and measures the results itself.
+
+   Supplementary feature: the "-B" option causes the program to measure
+   itself using the bench.c harness instead (so that time(1) is not
+   needed), reporting the cost per lock/unlock pair. This is the form used
+   by "make bench".
 */
 #include <pthread.h>
+#include "bench.h"
 #include "tlpi_hdr.h"
 
 static volatile int glob = 0;
@@ -75,12 +84,44 @@ threadFunc(void *arg)
     return NULL;
 }
 
+/* Create 'numThreads' threads that perform the increments, and wait
+   for them to terminate */
+
+static void
+runThreads(pthread_t *thread, int numThreads)
+{
+    int s;
+
+    for (int j = 0; j < numThreads; j++) {
+        s = pthread_create(&thread[j], NULL, threadFunc, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    for (int j = 0; j < numThreads; j++) {
+        s = pthread_join(thread[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+}
+
+static pthread_t *benchThread;
+static int benchNumThreads;
+
+static void
+benchThreads(long ops, void *arg)
+{
+    runThreads(benchThread, benchNumThreads);
+}
+
 static void
 usageError(char *pname)
 {
     fprintf(stderr,
-            "Usage: %s [-s] num-threads "
+            "Usage: %s [-Bqs] num-threads "
             "[num-inner-loops [num-outer-loops]]\n", pname);
+    fprintf(stderr,
+            "    -B   Measure using the bench.c harness\n");
     fprintf(stderr,
             "    -q   Don't print verbose messages\n");
     fprintf(stderr,
@@ -94,7 +135,9 @@ main(int argc, char *argv[])
     int opt, s;
     int numThreads;
     pthread_t *thread;
-    int verbose;
+    int verbose, bench;
+    struct benchResult res;
+    char name[64];
 
     /* Prevent runaway/forgotten process from burning up CPU time forever */
 
@@ -102,8 +145,13 @@ main(int argc, char *argv[])
 
     useMutex = 1;
     verbose = 1;
-    while ((opt = getopt(argc, argv, "qs")) != -1) {
+    bench = 0;
+    while ((opt = getopt(argc, argv, "Bqs")) != -1) {
         switch (opt) {
+        case 'B':
+            bench = 1;
+            verbose = 0;
+            break;
         case 'q':
             verbose = 0;
             break;
@@ -142,17 +190,19 @@ main(int argc, char *argv[])
             errExitEN(s, "pthread_spin_init");
     }
 
-    for (int j = 0; j < numThreads; j++) {
-        s = pthread_create(&thread[j], NULL, threadFunc, NULL);
-        if (s != 0)
-            errExitEN(s, "pthread_create");
+    if (bench) {
+        benchThread = thread;
+        benchNumThreads = numThreads;
+        snprintf(name, sizeof(name), "thread_lock_speed: %s %dthr in=%d",
+                 useMutex ? "mutex" : "spin", numThreads, numInnerLoops);
+        if (benchRun(name, benchThreads, NULL,
+                     (long) numThreads * numOuterLoops, NULL, &res) == -1)
+            errExit("benchRun");
+        benchReport(&res);
+        exit(EXIT_SUCCESS);
     }
 
-    for (int j = 0; j < numThreads; j++) {
-        s = pthread_join(thread[j], NULL);
-        if (s != 0)
-            errExitEN(s, "pthread_join");
-    }
+    runThreads(thread, numThreads);
 
     if (verbose)
         printf("glob = %d\n", glob);
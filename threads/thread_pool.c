@@ -0,0 +1,563 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 29 */
+
+/* thread_pool.c
+
+   A pool of worker threads that execute tasks (a function plus an
+   argument) submitted with tpSubmit(), so that a program that performs
+   many short tasks needn't create (and join) a thread for each of them.
+
+   tpCreate() creates the pool. tpSubmit() queues a task; it may be
+   called by any thread, including by a task that is running in the
+   pool. tpWait() waits until every task that has been submitted
+   (including tasks submitted by other tasks) has completed. tpDestroy()
+   waits for the tasks to complete, and then terminates the workers and
+   frees the pool. tpWait() and tpDestroy() must not be called from
+   within a task.
+
+   Each worker has its own double-ended queue of tasks (a Chase-Lev
+   deque). When a task running in the pool submits another task, the new
+   task is added to the bottom of the worker's deque, and the worker
+   takes its next task from the bottom of the deque; these operations
+   require no locking. Tasks submitted by threads outside the pool are
+   added to a mutex-protected injection queue. A worker whose deque is
+   empty takes tasks from the injection queue, or else steals a task from
+   the top of another worker's deque (the oldest task, which, in a
+   divide-and-conquer program, is likely to represent the most work).
+
+   A worker that finds no work sleeps in FUTEX_WAIT on a "work available"
+   sequence counter; tpSubmit() increments the counter and calls
+   FUTEX_WAKE only if some worker is asleep. Thus, when all workers are
+   busy, submitting a task requires no system call.
+
+   If the TP_PIN flag is specified to tpCreate(), worker 'n' is bound to
+   CPU (n % number-of-CPUs) using sched_setaffinity().
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include "thread_pool.h"
+#include "tlpi_hdr.h"
+
+#define CACHE_LINE 64
+#define DEQUE_INIT_SIZE 256     /* Initial capacity of each deque (power
+                                   of 2); deques grow as needed */
+#define SPIN_ROUNDS 64          /* Searches for work before sleeping */
+
+struct tpTask {
+    tpFunc fn;
+    void *arg;
+    struct tpTask *next;        /* Link in injection queue */
+};
+
+struct tpArray {                /* Circular array of deque elements */
+    long size;                  /* Power of 2 */
+    struct tpArray *retired;    /* Older (smaller) array, still possibly
+                                   being read by a thief */
+    struct tpTask *buf[];
+};
+
+struct tpWorker {
+
+    /* 'top' is modified by thieves; 'bottom' only by the owner. They are
+       in separate cache lines, so that the owner's pushes and takes
+       don't disturb thieves, and vice versa. */
+
+    long top __attribute__ ((aligned(CACHE_LINE)));
+    long bottom __attribute__ ((aligned(CACHE_LINE)));
+    struct tpArray *array;
+
+    struct threadPool *pool;
+    pthread_t tid;
+    int idx;
+    unsigned int seed;          /* For choosing steal victims */
+    unsigned long tasks;        /* Statistics */
+    unsigned long steals;
+    unsigned long sleeps;
+} __attribute__ ((aligned(CACHE_LINE)));
+
+struct threadPool {
+    int nworkers;
+    int nstarted;               /* Number of worker threads created */
+    int flags;
+    struct tpWorker *workers;
+
+    pthread_mutex_t injMtx;     /* Protects injection queue */
+    struct tpTask *injHead;
+    struct tpTask *injTail;
+    long injCount;
+
+    uint32_t workSeq;           /* Futex word: incremented when work is
+                                   added while a worker is asleep */
+    int sleepers;               /* Number of workers asleep (or about to
+                                   sleep) on 'workSeq' */
+    long pending;               /* Tasks submitted but not yet completed */
+    uint32_t idleSeq;           /* Futex word: incremented each time that
+                                   'pending' falls to 0 */
+    int waiters;                /* Threads waiting in tpWait() */
+    int shutdown;
+};
+
+/* The worker structure of the calling thread, if it is a pool worker */
+
+static __thread struct tpWorker *curWorker;
+
+#define STAT_INC(w, field) \
+        __atomic_store_n(&(w)->field, (w)->field + 1, __ATOMIC_RELAXED)
+
+static void
+futexWait(uint32_t *word, uint32_t val)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void
+futexWake(uint32_t *word, int n)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+static struct tpArray *
+newArray(long size)
+{
+    struct tpArray *a;
+
+    a = malloc(sizeof(struct tpArray) + size * sizeof(struct tpTask *));
+    if (a == NULL)
+        return NULL;
+    a->size = size;
+    a->retired = NULL;
+    return a;
+}
+
+/* Deque operations, following Le, Pop, Cohen, and Zappa Nardelli,
+   "Correct and Efficient Work-Stealing for Weak Memory Models" (2013) */
+
+/* Add 'task' at the bottom of the deque of 'w' (owner only). Returns 0
+   on success, or -1 if the deque needed to grow but memory couldn't be
+   allocated. */
+
+static int
+dequePush(struct tpWorker *w, struct tpTask *task)
+{
+    struct tpArray *a, *na;
+    long b, t, j;
+
+    b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+    t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    a = __atomic_load_n(&w->array, __ATOMIC_RELAXED);
+
+    if (b - t > a->size - 1) {          /* Full: double the array */
+        na = newArray(a->size * 2);
+        if (na == NULL)
+            return -1;
+        for (j = t; j < b; j++)
+            na->buf[j & (na->size - 1)] =
+                __atomic_load_n(&a->buf[j & (a->size - 1)], __ATOMIC_RELAXED);
+
+        /* Thieves may still be reading the old array, so it is freed
+           only when the pool is destroyed */
+
+        na->retired = a;
+        __atomic_store_n(&w->array, na, __ATOMIC_RELEASE);
+        a = na;
+    }
+
+    __atomic_store_n(&a->buf[b & (a->size - 1)], task, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Remove a task from the bottom of the deque of 'w' (owner only).
+   Returns NULL if the deque is empty. */
+
+static struct tpTask *
+dequeTake(struct tpWorker *w)
+{
+    struct tpArray *a;
+    struct tpTask *task;
+    long b, t;
+
+    b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED) - 1;
+    a = __atomic_load_n(&w->array, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+
+    if (t > b) {                        /* Empty */
+        __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    task = __atomic_load_n(&a->buf[b & (a->size - 1)], __ATOMIC_RELAXED);
+    if (t == b) {
+
+        /* Last task: race against thieves for it */
+
+        if (!__atomic_compare_exchange_n(&w->top, &t, t + 1, 0,
+                    __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            task = NULL;                /* A thief won */
+        __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+enum stealResult { STEAL_OK, STEAL_EMPTY, STEAL_RETRY };
+
+/* Try to remove a task from the top of the deque of 'w' (any thread) */
+
+static enum stealResult
+dequeSteal(struct tpWorker *w, struct tpTask **task)
+{
+    struct tpArray *a;
+    long b, t;
+
+    t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b)
+        return STEAL_EMPTY;
+
+    a = __atomic_load_n(&w->array, __ATOMIC_ACQUIRE);
+    *task = __atomic_load_n(&a->buf[t & (a->size - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&w->top, &t, t + 1, 0,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return STEAL_RETRY;             /* Lost a race with another thread */
+    return STEAL_OK;
+}
+
+/* Add 'task' to the injection queue */
+
+static void
+injectTask(struct threadPool *tp, struct tpTask *task)
+{
+    task->next = NULL;
+    pthread_mutex_lock(&tp->injMtx);
+    if (tp->injTail == NULL)
+        tp->injHead = task;
+    else
+        tp->injTail->next = task;
+    tp->injTail = task;
+    __atomic_store_n(&tp->injCount, tp->injCount + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&tp->injMtx);
+}
+
+/* Remove the oldest task from the injection queue, or return NULL */
+
+static struct tpTask *
+takeInjected(struct threadPool *tp)
+{
+    struct tpTask *task;
+
+    if (__atomic_load_n(&tp->injCount, __ATOMIC_RELAXED) == 0)
+        return NULL;                    /* Avoid locking if empty */
+
+    pthread_mutex_lock(&tp->injMtx);
+    task = tp->injHead;
+    if (task != NULL) {
+        tp->injHead = task->next;
+        if (tp->injHead == NULL)
+            tp->injTail = NULL;
+        __atomic_store_n(&tp->injCount, tp->injCount - 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&tp->injMtx);
+    return task;
+}
+
+/* Find a task for worker 'w': from its own deque, from the injection
+   queue, or from another worker's deque */
+
+static struct tpTask *
+findWork(struct tpWorker *w)
+{
+    struct threadPool *tp = w->pool;
+    struct tpTask *task;
+    enum stealResult res;
+    Boolean retry;
+    int j, victim;
+
+    task = dequeTake(w);
+    if (task != NULL)
+        return task;
+
+    task = takeInjected(tp);
+    if (task != NULL)
+        return task;
+
+    /* Try each other worker, starting at a random one */
+
+    do {
+        retry = FALSE;
+        w->seed = w->seed * 1103515245 + 12345;
+        victim = (w->seed >> 16) % tp->nworkers;
+        for (j = 0; j < tp->nworkers;
+                j++, victim = (victim + 1) % tp->nworkers) {
+            if (victim == w->idx)
+                continue;
+            res = dequeSteal(&tp->workers[victim], &task);
+            if (res == STEAL_OK) {
+                STAT_INC(w, steals);
+                return task;
+            }
+            if (res == STEAL_RETRY)
+                retry = TRUE;
+        }
+    } while (retry);
+
+    return NULL;
+}
+
+/* Wake one sleeping worker, if there is one, after work was added */
+
+static void
+notifyWork(struct threadPool *tp)
+{
+    /* This fence pairs with the increment of 'sleepers' in
+       workerFunc(): either we see that a worker is going to sleep, or
+       that worker sees the work that we added */
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&tp->sleepers, __ATOMIC_RELAXED) > 0) {
+        __atomic_fetch_add(&tp->workSeq, 1, __ATOMIC_SEQ_CST);
+        futexWake(&tp->workSeq, 1);
+    }
+}
+
+static void
+runTask(struct tpWorker *w, struct tpTask *task)
+{
+    struct threadPool *tp = w->pool;
+
+    task->fn(task->arg);
+    free(task);
+    STAT_INC(w, tasks);
+
+    if (__atomic_sub_fetch(&tp->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+        __atomic_fetch_add(&tp->idleSeq, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&tp->waiters, __ATOMIC_SEQ_CST) > 0)
+            futexWake(&tp->idleSeq, INT_MAX);
+    }
+}
+
+static void *
+workerFunc(void *arg)
+{
+    struct tpWorker *w = arg;
+    struct threadPool *tp = w->pool;
+    struct tpTask *task;
+    cpu_set_t set;
+    uint32_t seq;
+    long ncpus;
+    int spins;
+
+    curWorker = w;
+
+    if (tp->flags & TP_PIN) {
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        CPU_ZERO(&set);
+        CPU_SET(w->idx % ((ncpus > 0) ? ncpus : 1), &set);
+        sched_setaffinity(0, sizeof(set), &set);    /* Best effort */
+    }
+
+    for (;;) {
+        for (spins = 0; spins < SPIN_ROUNDS; spins++) {
+            task = findWork(w);
+            if (task != NULL)
+                break;
+            sched_yield();
+        }
+
+        if (task == NULL) {
+
+            /* Announce that we are going to sleep, then look for work
+               once more, since a task may have been submitted before
+               tpSubmit() could see that we are asleep */
+
+            seq = __atomic_load_n(&tp->workSeq, __ATOMIC_ACQUIRE);
+            __atomic_fetch_add(&tp->sleepers, 1, __ATOMIC_SEQ_CST);
+            task = findWork(w);
+            if (task == NULL) {
+                if (__atomic_load_n(&tp->shutdown, __ATOMIC_SEQ_CST)) {
+                    __atomic_fetch_sub(&tp->sleepers, 1, __ATOMIC_SEQ_CST);
+                    break;
+                }
+                STAT_INC(w, sleeps);
+                futexWait(&tp->workSeq, seq);
+            }
+            __atomic_fetch_sub(&tp->sleepers, 1, __ATOMIC_SEQ_CST);
+        }
+
+        if (task != NULL)
+            runTask(w, task);
+    }
+
+    return NULL;
+}
+
+/* Create a pool of 'nworkers' threads (or one per online CPU, if
+   'nworkers' is 0). Returns a pointer to the pool, or NULL on error. */
+
+struct threadPool *
+tpCreate(int nworkers, int flags)
+{
+    struct threadPool *tp;
+    struct tpWorker *w;
+    int j, s;
+
+    if (nworkers <= 0) {
+        nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+        if (nworkers <= 0)
+            nworkers = 1;
+    }
+
+    tp = calloc(1, sizeof(struct threadPool));
+    if (tp == NULL)
+        return NULL;
+    tp->nworkers = nworkers;
+    tp->flags = flags;
+    pthread_mutex_init(&tp->injMtx, NULL);
+
+    if (posix_memalign((void **) &tp->workers, CACHE_LINE,
+                       nworkers * sizeof(struct tpWorker)) != 0) {
+        free(tp);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(tp->workers, 0, nworkers * sizeof(struct tpWorker));
+
+    for (j = 0; j < nworkers; j++) {
+        w = &tp->workers[j];
+        w->pool = tp;
+        w->idx = j;
+        w->seed = j + 1;
+        w->array = newArray(DEQUE_INIT_SIZE);
+        if (w->array == NULL) {
+            tpDestroy(tp);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    for (j = 0; j < nworkers; j++) {
+        s = pthread_create(&tp->workers[j].tid, NULL, workerFunc,
+                           &tp->workers[j]);
+        if (s != 0) {
+            tpDestroy(tp);              /* Terminate the workers created
+                                           so far */
+            errno = s;
+            return NULL;
+        }
+        tp->nstarted++;
+    }
+
+    return tp;
+}
+
+/* Submit a task that calls fn(arg). Returns 0 on success, or -1 on
+   error. */
+
+int
+tpSubmit(struct threadPool *tp, tpFunc fn, void *arg)
+{
+    struct tpTask *task;
+
+    task = malloc(sizeof(struct tpTask));
+    if (task == NULL)
+        return -1;
+    task->fn = fn;
+    task->arg = arg;
+
+    __atomic_fetch_add(&tp->pending, 1, __ATOMIC_SEQ_CST);
+
+    /* A task submitted from a worker goes onto that worker's deque; any
+       other task goes onto the injection queue */
+
+    if (curWorker == NULL || curWorker->pool != tp ||
+            dequePush(curWorker, task) == -1)
+        injectTask(tp, task);
+
+    notifyWork(tp);
+    return 0;
+}
+
+/* Wait until all submitted tasks have completed */
+
+void
+tpWait(struct threadPool *tp)
+{
+    uint32_t seq;
+
+    for (;;) {
+        seq = __atomic_load_n(&tp->idleSeq, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&tp->pending, __ATOMIC_SEQ_CST) == 0)
+            return;
+
+        __atomic_fetch_add(&tp->waiters, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&tp->pending, __ATOMIC_SEQ_CST) != 0)
+            futexWait(&tp->idleSeq, seq);
+        __atomic_fetch_sub(&tp->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/* Return the sum of the workers' statistics in 'stats' */
+
+void
+tpGetStats(struct threadPool *tp, struct tpStats *stats)
+{
+    struct tpWorker *w;
+    int j;
+
+    memset(stats, 0, sizeof(*stats));
+    for (j = 0; j < tp->nworkers; j++) {
+        w = &tp->workers[j];
+        stats->tasks += __atomic_load_n(&w->tasks, __ATOMIC_RELAXED);
+        stats->steals += __atomic_load_n(&w->steals, __ATOMIC_RELAXED);
+        stats->sleeps += __atomic_load_n(&w->sleeps, __ATOMIC_RELAXED);
+    }
+}
+
+/* Wait for all tasks to complete, then terminate the workers and free
+   the pool */
+
+void
+tpDestroy(struct threadPool *tp)
+{
+    struct tpArray *a, *next;
+    int j;
+
+    tpWait(tp);
+
+    __atomic_store_n(&tp->shutdown, 1, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&tp->workSeq, 1, __ATOMIC_SEQ_CST);
+    futexWake(&tp->workSeq, INT_MAX);
+
+    for (j = 0; j < tp->nstarted; j++)
+        pthread_join(tp->workers[j].tid, NULL);
+
+    for (j = 0; j < tp->nworkers; j++) {
+        for (a = tp->workers[j].array; a != NULL; a = next) {
+            next = a->retired;
+            free(a);
+        }
+    }
+
+    pthread_mutex_destroy(&tp->injMtx);
+    free(tp->workers);
+    free(tp);
+}
@@ -0,0 +1,42 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 29 */
+
+/* thread_pool.h
+
+   Header file for thread_pool.c.
+*/
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H           /* Prevent accidental double inclusion */
+
+typedef void (*tpFunc)(void *arg);
+
+struct threadPool;              /* Opaque; defined in thread_pool.c */
+
+#define TP_PIN 1                /* Pin worker 'n' to CPU (n % num-CPUs) */
+
+struct tpStats {
+    unsigned long tasks;        /* Tasks executed */
+    unsigned long steals;       /* Tasks taken from another worker */
+    unsigned long sleeps;       /* Times that a worker went to sleep */
+};
+
+struct threadPool *tpCreate(int nworkers, int flags);
+
+int tpSubmit(struct threadPool *tp, tpFunc fn, void *arg);
+
+void tpWait(struct threadPool *tp);
+
+void tpGetStats(struct threadPool *tp, struct tpStats *stats);
+
+void tpDestroy(struct threadPool *tp);
+
+#endif
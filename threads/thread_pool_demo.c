@@ -0,0 +1,197 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 29 */
+
+/* thread_pool_demo.c
+
+   Compare the cost of running many short tasks by creating a thread for
+   each task with the cost of running them in a thread pool (see
+   thread_pool.c).
+
+   Usage: thread_pool_demo [-w nworkers] [-n ntasks] [-l loops]
+                           [-d depth] [-p]
+
+        -w nworkers  Number of threads running at once, and the size of
+                     the pool (default: number of online CPUs)
+        -n ntasks    Number of tasks (default: 100000)
+        -l loops     Number of loop iterations performed by each task
+                     (default: 1000)
+        -d depth     Depth of the task tree in the "tree" test (default:
+                     16, giving 65536 leaf tasks)
+        -p           Pin the pool's workers to CPUs
+
+   The program performs three tests:
+
+        create  For each task, a thread is created (with at most
+                'nworkers' in existence at once) and joined.
+        pool    The main thread submits all of the tasks to the pool and
+                then waits for them to complete.
+        tree    A single task is submitted; each task at depth less than
+                'depth' submits two child tasks, and each leaf task
+                performs 'loops' iterations. This shows the pool's work
+                stealing: the tasks are created on (at first) one worker's
+                deque, and are stolen by the other workers.
+
+   This program is Linux-specific.
+*/
+#include <time.h>
+#include <pthread.h>
+#include "thread_pool.h"
+#include "tlpi_hdr.h"
+
+static int loops = 1000;
+static struct threadPool *pool;
+static volatile long sink;
+
+static void
+task(void *arg)
+{
+    long j, sum;
+
+    sum = 0;
+    for (j = 0; j < loops; j++)
+        sum += j;
+    sink = sum;
+}
+
+static void *
+threadFunc(void *arg)
+{
+    task(arg);
+    return NULL;
+}
+
+static void
+treeTask(void *arg)
+{
+    long depth = (long) arg;
+
+    if (depth == 0) {
+        task(NULL);
+        return;
+    }
+
+    if (tpSubmit(pool, treeTask, (void *) (depth - 1)) == -1 ||
+            tpSubmit(pool, treeTask, (void *) (depth - 1)) == -1)
+        errExit("tpSubmit");
+}
+
+static double
+elapsed(const struct timespec *start)
+{
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+        errExit("clock_gettime");
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-w nworkers] [-n ntasks] [-l loops] "
+                    "[-d depth] [-p]\n", progName);
+    fprintf(stderr, "    -w nworkers  Threads at once/pool size "
+                    "(default: #CPUs)\n");
+    fprintf(stderr, "    -n ntasks    Number of tasks (default: 100000)\n");
+    fprintf(stderr, "    -l loops     Loops per task (default: 1000)\n");
+    fprintf(stderr, "    -d depth     Depth of task tree (default: 16)\n");
+    fprintf(stderr, "    -p           Pin pool workers to CPUs\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct timespec start;
+    struct tpStats stats;
+    pthread_t *tid;
+    int opt, nworkers, ntasks, depth, flags, s, j, k, batch;
+    double secs;
+
+    nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    ntasks = 100000;
+    depth = 16;
+    flags = 0;
+    while ((opt = getopt(argc, argv, "w:n:l:d:p")) != -1) {
+        switch (opt) {
+        case 'w':   nworkers = getInt(optarg, GN_GT_0, "nworkers");     break;
+        case 'n':   ntasks = getInt(optarg, GN_GT_0, "ntasks");         break;
+        case 'l':   loops = getInt(optarg, GN_NONNEG, "loops");         break;
+        case 'd':   depth = getInt(optarg, GN_NONNEG, "depth");         break;
+        case 'p':   flags |= TP_PIN;                                    break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc || depth > 30)
+        usageError(argv[0]);
+
+    /* Thread per task */
+
+    tid = calloc(nworkers, sizeof(pthread_t));
+    if (tid == NULL)
+        errExit("calloc");
+
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+    for (j = 0; j < ntasks; j += batch) {
+        batch = min(nworkers, ntasks - j);
+        for (k = 0; k < batch; k++) {
+            s = pthread_create(&tid[k], NULL, threadFunc, NULL);
+            if (s != 0)
+                errExitEN(s, "pthread_create");
+        }
+        for (k = 0; k < batch; k++) {
+            s = pthread_join(tid[k], NULL);
+            if (s != 0)
+                errExitEN(s, "pthread_join");
+        }
+    }
+    secs = elapsed(&start);
+    printf("create: %d tasks in %.3f s (%.0f tasks/s)\n", ntasks, secs,
+            ntasks / secs);
+
+    /* Pool, with tasks submitted from outside */
+
+    pool = tpCreate(nworkers, flags);
+    if (pool == NULL)
+        errExit("tpCreate");
+
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+    for (j = 0; j < ntasks; j++)
+        if (tpSubmit(pool, task, NULL) == -1)
+            errExit("tpSubmit");
+    tpWait(pool);
+    secs = elapsed(&start);
+    tpGetStats(pool, &stats);
+    printf("pool:   %d tasks in %.3f s (%.0f tasks/s); %lu steals, "
+            "%lu sleeps\n", ntasks, secs, ntasks / secs, stats.steals,
+            stats.sleeps);
+
+    /* Pool, with tasks submitted by tasks */
+
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+    if (tpSubmit(pool, treeTask, (void *) (long) depth) == -1)
+        errExit("tpSubmit");
+    tpWait(pool);
+    secs = elapsed(&start);
+    tpGetStats(pool, &stats);
+    printf("tree:   %ld tasks (%ld leaves) in %.3f s (%.0f tasks/s); "
+            "%lu steals, %lu sleeps (cumulative)\n",
+            (2L << depth) - 1, 1L << depth, secs,
+            ((2L << depth) - 1) / secs, stats.steals, stats.sleeps);
+
+    tpDestroy(pool);
+    exit(EXIT_SUCCESS);
+}
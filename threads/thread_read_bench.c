@@ -0,0 +1,464 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 30 */
+
+/* thread_read_bench.c
+
+   A read-mostly counterpart to thread_incr_rwlock.c: many reader threads
+   repeatedly take a consistent snapshot of a small shared record, while
+   a few writer threads occasionally replace it, and the program reports
+   the read throughput for each combination of synchronization method
+   and number of readers.
+
+   Usage: thread_read_bench [-m methods] [-r nreaders] [-w nwriters]
+                            [-i interval-us] [-d msecs] [-p] [-C]
+
+        -m methods    Comma-separated list of methods (default: all):
+                        mutex     pthread_mutex_lock()
+                        rwlock    pthread_rwlock_rdlock() and
+                                  pthread_rwlock_wrlock()
+                        seqlock   slRead() and slWrite() (read_mostly.c)
+                        epoch     Readers use the record in place, within
+                                  epEnter()/epExit(); writers replace it
+                                  with a new copy, and retire the old one
+                                  with epRetire() (read_mostly.c)
+        -r nreaders   Comma-separated list of reader counts
+                      (default: 1,2,4,8,16,32,64,128)
+        -w nwriters   Number of writer threads (default: 2)
+        -i interval   Microseconds that each writer sleeps between writes
+                      (default: 100; 0 means that writers don't sleep)
+        -d msecs      Duration of each run (default: 1000)
+        -p            Pin thread 'n' to CPU (n % number-of-CPUs)
+        -C            Produce CSV output
+
+   For each run, the program shows the total number of reads per second,
+   the reads per second per reader, the writes per second, and the
+   number of reads that had to be retried (seqlock) or of times that the
+   global epoch advanced (epoch). Each reader checks that every snapshot
+   is consistent.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "read_mostly.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+#define MAX_LIST 64             /* Maximum items in a comma-separated list */
+#define REC_WORDS 8
+
+enum method { M_MUTEX, M_RWLOCK, M_SEQLOCK, M_EPOCH, NUM_METHODS };
+
+static const char *methodNames[NUM_METHODS] = {
+    "mutex", "rwlock", "seqlock", "epoch"
+};
+
+struct record {                 /* The shared data; consistent if
+                                   w[j] == w[0] + j for all 'j' */
+    long w[REC_WORDS];
+};
+
+struct counter {                /* A count in a cache line of its own */
+    long val __attribute__ ((aligned(RM_CACHE_LINE)));
+};
+
+static enum method curMethod;
+static struct record shared;    /* mutex, rwlock, seqlock */
+static struct record *sharedPtr;        /* epoch */
+static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static struct seqLock sl;
+static struct epochDomain *ed;
+static struct counter *reads, *writes, *retries;
+static pthread_barrier_t startBarrier;
+static int nreadersCur, intervalUs;
+static Boolean pin;
+static volatile Boolean stop;
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+pinSelf(int id)
+{
+    cpu_set_t set;
+    int s;
+
+    CPU_ZERO(&set);
+    CPU_SET(id % sysconf(_SC_NPROCESSORS_ONLN), &set);
+    s = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (s != 0)
+        errExitEN(s, "pthread_setaffinity_np");
+}
+
+static void
+startWait(void)
+{
+    int s;
+
+    s = pthread_barrier_wait(&startBarrier);
+    if (s != 0 && s != PTHREAD_BARRIER_SERIAL_THREAD)
+        errExitEN(s, "pthread_barrier_wait");
+}
+
+static void
+checkRecord(const struct record *r)
+{
+    int j;
+
+    for (j = 1; j < REC_WORDS; j++)
+        if (r->w[j] != r->w[0] + j)
+            fatal("%s: inconsistent snapshot", methodNames[curMethod]);
+}
+
+static void *
+readerFunc(void *arg)
+{
+    int id = (int) (long) arg;
+    struct epochThread *et;
+    struct record copy;
+    const struct record *p;
+    long n, nretries;
+    int s;
+
+    if (pin)
+        pinSelf(id);
+    et = NULL;
+    if (curMethod == M_EPOCH) {
+        et = epRegister(ed);
+        if (et == NULL)
+            errExit("epRegister");
+    }
+    startWait();
+
+    for (n = 0, nretries = 0; !stop; n++) {
+        switch (curMethod) {
+        case M_MUTEX:
+            s = pthread_mutex_lock(&mtx);
+            if (s != 0)
+                errExitEN(s, "pthread_mutex_lock");
+            copy = shared;
+            s = pthread_mutex_unlock(&mtx);
+            if (s != 0)
+                errExitEN(s, "pthread_mutex_unlock");
+            checkRecord(&copy);
+            break;
+
+        case M_RWLOCK:
+            s = pthread_rwlock_rdlock(&rwlock);
+            if (s != 0)
+                errExitEN(s, "pthread_rwlock_rdlock");
+            copy = shared;
+            s = pthread_rwlock_unlock(&rwlock);
+            if (s != 0)
+                errExitEN(s, "pthread_rwlock_unlock");
+            checkRecord(&copy);
+            break;
+
+        case M_SEQLOCK:
+            nretries += slRead(&sl, &copy, &shared, sizeof(copy));
+            checkRecord(&copy);
+            break;
+
+        case M_EPOCH:           /* Use the record in place */
+            epEnter(et);
+            p = __atomic_load_n(&sharedPtr, __ATOMIC_ACQUIRE);
+            checkRecord(p);
+            epExit(et);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    reads[id].val = n;
+    retries[id].val = nretries;
+    if (et != NULL)
+        epUnregister(et);
+    return NULL;
+}
+
+static void *
+writerFunc(void *arg)
+{
+    int id = (int) (long) arg;
+    struct epochThread *et;
+    struct record rec, *old, *new;
+    struct timespec ts;
+    long n;
+    int s, j;
+
+    if (pin)
+        pinSelf(nreadersCur + id);
+    et = NULL;
+    if (curMethod == M_EPOCH) {
+        et = epRegister(ed);
+        if (et == NULL)
+            errExit("epRegister");
+    }
+    startWait();
+
+    ts.tv_sec = intervalUs / 1000000;
+    ts.tv_nsec = intervalUs % 1000000 * 1000;
+    for (n = 0; !stop; n++) {
+        for (j = 0; j < REC_WORDS; j++)
+            rec.w[j] = id * 1000000000L + n + j;
+
+        switch (curMethod) {
+        case M_MUTEX:
+            s = pthread_mutex_lock(&mtx);
+            if (s != 0)
+                errExitEN(s, "pthread_mutex_lock");
+            shared = rec;
+            s = pthread_mutex_unlock(&mtx);
+            if (s != 0)
+                errExitEN(s, "pthread_mutex_unlock");
+            break;
+
+        case M_RWLOCK:
+            s = pthread_rwlock_wrlock(&rwlock);
+            if (s != 0)
+                errExitEN(s, "pthread_rwlock_wrlock");
+            shared = rec;
+            s = pthread_rwlock_unlock(&rwlock);
+            if (s != 0)
+                errExitEN(s, "pthread_rwlock_unlock");
+            break;
+
+        case M_SEQLOCK:
+            slWrite(&sl, &shared, &rec, sizeof(rec));
+            break;
+
+        case M_EPOCH:           /* Publish a new copy; retire the old */
+            new = malloc(sizeof(struct record));
+            if (new == NULL)
+                errExit("malloc");
+            *new = rec;
+            old = __atomic_exchange_n(&sharedPtr, new, __ATOMIC_ACQ_REL);
+            if (epRetire(et, old, free) == -1)
+                errExit("epRetire");
+            break;
+
+        default:
+            break;
+        }
+
+        if (intervalUs > 0)
+            nanosleep(&ts, NULL);
+    }
+
+    writes[id].val = n;
+    if (et != NULL)
+        epUnregister(et);
+    return NULL;
+}
+
+static void
+runOne(int nreaders, int nwriters, int msecs, Boolean csv)
+{
+    pthread_t *tid;
+    struct timespec ts;
+    struct epStats st;
+    long long start, elapsed;
+    long totReads, totWrites, totRetries, extra;
+    int s, j;
+
+    nreadersCur = nreaders;
+    stop = FALSE;
+    memset(&shared, 0, sizeof(shared));
+    for (j = 0; j < REC_WORDS; j++)
+        shared.w[j] = j;
+    if (curMethod == M_SEQLOCK)
+        slInit(&sl);
+    if (curMethod == M_EPOCH) {
+        ed = epCreate(nreaders + nwriters);
+        if (ed == NULL)
+            errExit("epCreate");
+        sharedPtr = malloc(sizeof(struct record));
+        if (sharedPtr == NULL)
+            errExit("malloc");
+        *sharedPtr = shared;
+    }
+
+    if (posix_memalign((void **) &reads, RM_CACHE_LINE,
+                       nreaders * sizeof(struct counter)) != 0 ||
+            posix_memalign((void **) &retries, RM_CACHE_LINE,
+                           nreaders * sizeof(struct counter)) != 0 ||
+            posix_memalign((void **) &writes, RM_CACHE_LINE,
+                           nwriters * sizeof(struct counter)) != 0)
+        fatal("posix_memalign failed");
+
+    s = pthread_barrier_init(&startBarrier, NULL, nreaders + nwriters + 1);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_init");
+
+    tid = calloc(nreaders + nwriters, sizeof(pthread_t));
+    if (tid == NULL)
+        errExit("calloc");
+    for (j = 0; j < nreaders + nwriters; j++) {
+        s = pthread_create(&tid[j], NULL,
+                           (j < nreaders) ? readerFunc : writerFunc,
+                           (void *) (long) ((j < nreaders) ? j :
+                                            j - nreaders));
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    startWait();
+    start = nowNs();
+    ts.tv_sec = msecs / 1000;
+    ts.tv_nsec = msecs % 1000 * 1000000L;
+    nanosleep(&ts, NULL);
+    stop = TRUE;
+
+    for (j = 0; j < nreaders + nwriters; j++) {
+        s = pthread_join(tid[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+    elapsed = nowNs() - start;
+
+    totReads = totRetries = totWrites = 0;
+    for (j = 0; j < nreaders; j++) {
+        totReads += reads[j].val;
+        totRetries += retries[j].val;
+    }
+    for (j = 0; j < nwriters; j++)
+        totWrites += writes[j].val;
+
+    extra = 0;
+    if (curMethod == M_SEQLOCK) {
+        extra = totRetries;
+        slDestroy(&sl);
+    } else if (curMethod == M_EPOCH) {
+        epGetStats(ed, &st);
+        extra = st.advances;
+        epDestroy(ed);
+        free(sharedPtr);
+    }
+
+    if (csv)
+        printf("%s,%d,%d,%.0f,%.0f,%.0f,%ld\n", methodNames[curMethod],
+               nreaders, nwriters, totReads / (elapsed / 1e9),
+               totReads / (elapsed / 1e9) / nreaders,
+               totWrites / (elapsed / 1e9), extra);
+    else
+        printf("%-8s %7d %7d %12.0f %12.0f %10.0f %10ld\n",
+               methodNames[curMethod], nreaders, nwriters,
+               totReads / (elapsed / 1e9),
+               totReads / (elapsed / 1e9) / nreaders,
+               totWrites / (elapsed / 1e9), extra);
+    fflush(stdout);
+
+    free(tid);
+    free(reads);
+    free(retries);
+    free(writes);
+    pthread_barrier_destroy(&startBarrier);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-m methods] [-r nreaders] [-w nwriters]\n"
+                    "\t\t[-i interval-us] [-d msecs] [-p] [-C]\n",
+                    progName);
+    fprintf(stderr, "    -m methods   mutex,rwlock,seqlock,epoch "
+                    "(default: all)\n");
+    fprintf(stderr, "    -r nreaders  Reader counts "
+                    "(default: 1,2,4,8,16,32,64,128)\n");
+    fprintf(stderr, "    -w nwriters  Writer threads (default: 2)\n");
+    fprintf(stderr, "    -i interval  Microseconds between writes "
+                    "(default: 100)\n");
+    fprintf(stderr, "    -d msecs     Duration of each run "
+                    "(default: 1000)\n");
+    fprintf(stderr, "    -p           Pin threads to CPUs\n");
+    fprintf(stderr, "    -C           CSV output\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int methods[NUM_METHODS], readers[MAX_LIST];
+    int nmethods, nreaderCounts, nwriters, msecs, opt, m, r;
+    Boolean csv;
+    char *tok;
+
+    nmethods = 0;
+    nreaderCounts = 0;
+    for (r = 1; r <= 128; r *= 2)
+        readers[nreaderCounts++] = r;
+    nwriters = 2;
+    intervalUs = 100;
+    msecs = 1000;
+    csv = FALSE;
+
+    while ((opt = getopt(argc, argv, "m:r:w:i:d:pC")) != -1) {
+        switch (opt) {
+        case 'm':
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                for (m = 0; m < NUM_METHODS; m++)
+                    if (strcmp(tok, methodNames[m]) == 0)
+                        break;
+                if (m == NUM_METHODS || nmethods == NUM_METHODS)
+                    usageError(argv[0]);
+                methods[nmethods++] = m;
+            }
+            break;
+        case 'r':
+            nreaderCounts = benchParseList(optarg, readers, MAX_LIST, GN_GT_0,
+                                           "nreaders");
+            break;
+        case 'w':   nwriters = getInt(optarg, GN_GT_0, "nwriters");  break;
+        case 'i':   intervalUs = getInt(optarg, GN_NONNEG, "interval"); break;
+        case 'd':   msecs = getInt(optarg, GN_GT_0, "msecs");        break;
+        case 'p':   pin = TRUE;                                      break;
+        case 'C':   csv = TRUE;                                      break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc)
+        usageError(argv[0]);
+
+    if (nmethods == 0)
+        for (m = 0; m < NUM_METHODS; m++)
+            methods[nmethods++] = m;
+
+    if (csv)
+        printf("method,readers,writers,reads_per_sec,reads_per_sec_reader,"
+               "writes_per_sec,retries_or_advances\n");
+    else
+        printf("%-8s %7s %7s %12s %12s %10s %10s\n", "method",
+               "readers", "writers", "reads/s", "reads/s/rdr", "writes/s",
+               "retry/adv");
+
+    for (m = 0; m < nmethods; m++) {
+        curMethod = methods[m];
+        for (r = 0; r < nreaderCounts; r++)
+            runOne(readers[r], nwriters, msecs, csv);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,319 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 29 */
+
+/* thread_spawn_bench.c
+
+   Measure the cost of creating short-lived threads in bursts, as a
+   server that starts a thread per request might, with default stacks
+   (as in detached_attrib.c), with stacks of a size chosen for the job,
+   and with stacks recycled by stack_pool.c.
+
+   Usage: thread_spawn_bench [-m modes] [-b burst] [-r rounds]
+                             [-s stack-KiB] [-u use-KiB] [-w work]
+                             [-c cached]
+
+        -m modes      Comma-separated list of ways of creating threads
+                      (default: all):
+                        default   Detached threads, default attributes
+                        sized     Detached threads, with a stack size
+                                  set by pthread_attr_setstacksize()
+                        pool      Threads from spSpawn(), on stacks from
+                                  a stack pool
+        -b burst      Number of threads created in each burst
+                      (default: 64)
+        -r rounds     Number of bursts (default: 200); the program waits
+                      for each burst to complete before starting the next
+        -s stack-KiB  Stack size for "sized" and "pool" (default: 64)
+        -u use-KiB    Amount of stack that each thread touches
+                      (default: 16)
+        -w work       Loop iterations performed by each thread
+                      (default: 0)
+        -c cached     Number of stacks kept by the pool (default: the
+                      burst size)
+
+   For each mode, the program shows the rate at which threads were
+   created and completed, the median and 99th percentile of the time
+   from each call to the thread-creation function until the thread
+   began to run, the minor page faults per thread, and the number of
+   distinct stacks used (found from the threads' IDs, which glibc places
+   at the top of each stack). For "default" and "sized", that number is
+   a lower bound on the number of mmap() calls that glibc made for
+   stacks (glibc caches the stacks of terminated threads, but only up to
+   40 MiB); for "pool", the pool's counts of mmap() and munmap() calls
+   are also shown.
+
+   Try: thread_spawn_bench -b 256
+        thread_spawn_bench -b 16 -u 4 -w 100000
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/resource.h>
+#include <pthread.h>
+#include <time.h>
+#include "stack_pool.h"
+#include "lat_hist.h"
+#include "tlpi_hdr.h"
+
+#define MAX_LIST 8              /* Maximum items in a comma-separated list */
+
+enum mode { M_DEFAULT, M_SIZED, M_POOL };
+
+static const char *modeNames[] = { "default", "sized", "pool" };
+
+struct job {
+    long long created;          /* When pthread_create()/spSpawn() called */
+    long long latency;          /* Time until thread started running */
+    pthread_t self;             /* Thread's ID, as seen by the thread */
+};
+
+static size_t useBytes;         /* Stack touched by each thread */
+static long work;               /* Loop iterations by each thread */
+
+static pthread_mutex_t doneMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;
+static int numDone;             /* Threads finished in this burst */
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+touchStack(size_t len)
+{
+    volatile char buf[1024];
+    size_t j;
+
+    for (j = 0; j < sizeof(buf); j += 64)
+        buf[j] = 1;
+    if (len > sizeof(buf))
+        touchStack(len - sizeof(buf));
+}
+
+static void *
+threadFunc(void *arg)
+{
+    struct job *jb = arg;
+    volatile long j;
+
+    jb->latency = nowNs() - jb->created;
+    jb->self = pthread_self();
+
+    touchStack(useBytes);
+    for (j = 0; j < work; j++)
+        continue;
+
+    pthread_mutex_lock(&doneMtx);
+    numDone++;
+    pthread_cond_signal(&doneCond);
+    pthread_mutex_unlock(&doneMtx);
+    return NULL;
+}
+
+static int
+cmpTid(const void *a, const void *b)
+{
+    pthread_t x = *(const pthread_t *) a, y = *(const pthread_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Return the number of distinct values in 'tids' (sorting it) */
+
+static long
+countDistinct(pthread_t *tids, long n)
+{
+    long j, cnt;
+
+    qsort(tids, n, sizeof(pthread_t), cmpTid);
+    for (j = 0, cnt = 0; j < n; j++)
+        if (j == 0 || tids[j] != tids[j - 1])
+            cnt++;
+    return cnt;
+}
+
+static void
+runMode(enum mode m, int burst, int rounds, size_t stackSize, int cached)
+{
+    struct job *jobs;
+    pthread_t *tids, tid;
+    pthread_attr_t attr;
+    struct stackPool *sp;
+    struct spStats st;
+    struct latHist hist;
+    struct rusage ru0, ru1;
+    long long start, elapsed;
+    long nthreads;
+    int r, j, s;
+
+    jobs = calloc(burst, sizeof(struct job));
+    nthreads = (long) burst * rounds;
+    tids = calloc(nthreads, sizeof(pthread_t));
+    if (jobs == NULL || tids == NULL)
+        errExit("calloc");
+    latHistInit(&hist);
+
+    s = pthread_attr_init(&attr);
+    if (s != 0)
+        errExitEN(s, "pthread_attr_init");
+    s = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (s != 0)
+        errExitEN(s, "pthread_attr_setdetachstate");
+    if (m == M_SIZED) {
+        s = pthread_attr_setstacksize(&attr, stackSize);
+        if (s != 0)
+            errExitEN(s, "pthread_attr_setstacksize");
+    }
+
+    sp = NULL;
+    if (m == M_POOL) {
+        sp = spCreate(stackSize, sysconf(_SC_PAGESIZE), cached);
+        if (sp == NULL)
+            errExit("spCreate");
+    }
+
+    if (getrusage(RUSAGE_SELF, &ru0) == -1)
+        errExit("getrusage");
+    start = nowNs();
+
+    for (r = 0; r < rounds; r++) {
+        numDone = 0;
+        for (j = 0; j < burst; j++) {
+            jobs[j].created = nowNs();
+            if (m == M_POOL) {
+                if (spSpawn(sp, &tid, threadFunc, &jobs[j]) == -1)
+                    errExit("spSpawn");
+            } else {
+                s = pthread_create(&tid, &attr, threadFunc, &jobs[j]);
+                if (s != 0)
+                    errExitEN(s, "pthread_create");
+            }
+        }
+
+        pthread_mutex_lock(&doneMtx);
+        while (numDone < burst)
+            pthread_cond_wait(&doneCond, &doneMtx);
+        pthread_mutex_unlock(&doneMtx);
+
+        for (j = 0; j < burst; j++) {
+            latHistRecord(&hist, jobs[j].latency);
+            tids[(long) r * burst + j] = jobs[j].self;
+        }
+    }
+
+    if (sp != NULL)
+        spWaitAll(sp);
+    elapsed = nowNs() - start;
+    if (getrusage(RUSAGE_SELF, &ru1) == -1)
+        errExit("getrusage");
+
+    printf("%-8s %10.0f %9.1f %9.1f %8.1f %8ld", modeNames[m],
+           nthreads / (elapsed / 1e9),
+           latHistPercentile(&hist, 0.50) / 1000.0,
+           latHistPercentile(&hist, 0.99) / 1000.0,
+           (double) (ru1.ru_minflt - ru0.ru_minflt) / nthreads,
+           countDistinct(tids, nthreads));
+    if (sp != NULL) {
+        spGetStats(sp, &st);
+        spDestroy(sp);
+        printf(" %7lu %7lu", st.mmaps, st.munmaps);
+    }
+    printf("\n");
+
+    pthread_attr_destroy(&attr);
+    free(jobs);
+    free(tids);
+}
+
+/* Parse the comma-separated list of mode names in 'str' into 'modes';
+   return the number of items */
+
+static int
+parseModes(char *str, enum mode *modes)
+{
+    char *tok, *save;
+    int n, m;
+
+    n = 0;
+    for (tok = strtok_r(str, ",", &save); tok != NULL;
+            tok = strtok_r(NULL, ",", &save)) {
+        if (n >= MAX_LIST)
+            cmdLineErr("Too many items in list\n");
+        for (m = M_DEFAULT; m <= M_POOL; m++)
+            if (strcmp(tok, modeNames[m]) == 0)
+                break;
+        if (m > M_POOL)
+            cmdLineErr("Unknown mode: %s\n", tok);
+        modes[n++] = m;
+    }
+    return n;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-m modes] [-b burst] [-r rounds] "
+            "[-s stack-KiB] [-u use-KiB]\n"
+            "            [-w work] [-c cached]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    enum mode modes[MAX_LIST];
+    int nmodes, burst, rounds, cached, opt, j;
+    size_t stackSize;
+
+    nmodes = 0;
+    burst = 64;
+    rounds = 200;
+    stackSize = 64 * 1024;
+    useBytes = 16 * 1024;
+    cached = -1;
+    while ((opt = getopt(argc, argv, "m:b:r:s:u:w:c:")) != -1) {
+        switch (opt) {
+        case 'm': nmodes = parseModes(optarg, modes);                break;
+        case 'b': burst = getInt(optarg, GN_GT_0, "-b");             break;
+        case 'r': rounds = getInt(optarg, GN_GT_0, "-r");            break;
+        case 's': stackSize = getLong(optarg, GN_GT_0, "-s") * 1024; break;
+        case 'u': useBytes = getLong(optarg, GN_NONNEG, "-u") * 1024; break;
+        case 'w': work = getLong(optarg, GN_NONNEG, "-w");           break;
+        case 'c': cached = getInt(optarg, GN_NONNEG, "-c");          break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+    if (nmodes == 0)
+        for (nmodes = 0; nmodes <= M_POOL; nmodes++)
+            modes[nmodes] = nmodes;
+    if (cached == -1)
+        cached = burst;
+    if (useBytes + 16 * 1024 > stackSize)
+        cmdLineErr("-u must leave at least 16 KiB of the stack unused\n");
+
+    printf("burst %d, rounds %d, stack %zu KiB, use %zu KiB, work %ld\n",
+           burst, rounds, stackSize / 1024, useBytes / 1024, work);
+    printf("%-8s %10s %9s %9s %8s %8s %7s %7s\n", "mode", "threads/s",
+           "p50-us", "p99-us", "faults", "stacks", "mmaps", "munmaps");
+    for (j = 0; j < nmodes; j++)
+        runMode(modes[j], burst, rounds, stackSize, cached);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,211 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 31 */
+
+/* tls_model_bench.c
+
+   Measure the cost of reaching per-thread data from library code, for
+   the thread-local storage (TLS) models and for thread-specific data
+   (TSD), which are the techniques of strerror_tls.c and strerror_tsd.c.
+
+   Usage: tls_model_bench [-n ops] [-t nthreads]
+
+        -n ops       Calls in each repetition (default: 10000000)
+        -t nthreads  Make the calls in each of 'nthreads' threads at once
+                     (default: 1, which makes them in the main thread).
+                     The time per call is then the elapsed time divided
+                     by the calls made by each thread, so that it
+                     includes the cost of contention for any shared
+                     data (and, if there are fewer CPUs than threads, of
+                     time slicing)
+
+   Each benchmark calls a function that increments a per-thread counter:
+
+        plain        (baseline) a global variable, not per-thread, in the
+                     shared library libtls_model.so (tls_model_lib.c)
+        global-dyn   a __thread variable in libtls_model.so, using the
+                     global-dynamic model: the address is obtained by
+                     calling __tls_get_addr(); this is the default for an
+                     exported variable in code compiled with -fPIC
+        local-dyn    as global-dyn, for a static variable (the
+                     local-dynamic model); the call to __tls_get_addr()
+                     finds the library's TLS block, which could be shared
+                     by several variables in one function
+        initial-exec a __thread variable in libtls_model.so, using the
+                     initial-exec model: a load of the variable's offset
+                     from the thread pointer (from the GOT). A library
+                     built like this can't be loaded with dlopen() (unless
+                     the C library has spare static TLS space)
+        local-exec   a __thread variable in the program itself: the offset
+                     from the thread pointer is a constant
+        tsd          pthread_getspecific() (in libtls_model.so)
+        threadBuf    threadBuf() (thread_buf.c in libtlpi, linked
+                     statically, so that its __thread array uses the
+                     initial-exec or local-exec model)
+
+   The shared library is compiled with -O2, as libraries usually are; so
+   is this program (see the Makefile). "objdump -d libtls_model.so" shows
+   the generated code. Where the C library and compiler support TLS
+   descriptors (-mtls-dialect=gnu2 on x86-64), the dynamic models are
+   cheaper than shown here.
+
+   This program is Linux-specific.
+*/
+#include <pthread.h>
+#include "tls_model_lib.h"
+#include "thread_buf.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+static __thread long leCounter;         /* local-exec (in a program) */
+
+static volatile long sink;              /* Defeats dead code elimination */
+
+__attribute__ ((noinline)) static long
+incrLocalExec(void)
+{
+    return ++leCounter;
+}
+
+__attribute__ ((noinline)) static long
+incrThreadBuf(void)
+{
+    long *p;
+
+    p = threadBuf(0, sizeof(long));
+    if (p == NULL)
+        errExit("threadBuf");
+    return ++*p;
+}
+
+struct method {
+    const char *name;
+    long (*fn)(void);
+};
+
+static const struct method methods[] = {
+    { "plain",          incrPlain },
+    { "global-dyn",     incrGlobalDynamic },
+    { "local-dyn",      incrLocalDynamic },
+    { "initial-exec",   incrInitialExec },
+    { "local-exec",     incrLocalExec },
+    { "tsd",            incrTsd },
+    { "threadBuf",      incrThreadBuf },
+};
+
+#define NUM_METHODS (sizeof(methods) / sizeof(methods[0]))
+
+static void
+callMany(long ops, void *arg)
+{
+    const struct method *m = arg;
+    long j, v;
+
+    v = 0;
+    for (j = 0; j < ops; j++)
+        v = m->fn();
+    sink = v;
+}
+
+static int nthreads;
+static pthread_barrier_t startBarrier;
+
+struct threadArg {
+    const struct method *m;
+    long ops;
+    long last;                  /* Counter value after the last call */
+};
+
+static void *
+threadFunc(void *arg)
+{
+    struct threadArg *ta = arg;
+    long j, v;
+    int s;
+
+    s = pthread_barrier_wait(&startBarrier);
+    if (s != 0 && s != PTHREAD_BARRIER_SERIAL_THREAD)
+        errExitEN(s, "pthread_barrier_wait");
+
+    v = 0;
+    for (j = 0; j < ta->ops; j++)
+        v = ta->m->fn();
+    ta->last = v;
+    return NULL;
+}
+
+/* Make 'ops' calls in each of 'nthreads' threads; each thread checks
+   that its counter was private */
+
+static void
+callManyThreaded(long ops, void *arg)
+{
+    struct threadArg *ta;
+    pthread_t *tid;
+    int j, s;
+
+    ta = calloc(nthreads, sizeof(struct threadArg));
+    tid = calloc(nthreads, sizeof(pthread_t));
+    if (ta == NULL || tid == NULL)
+        errExit("calloc");
+    s = pthread_barrier_init(&startBarrier, NULL, nthreads);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_init");
+
+    for (j = 0; j < nthreads; j++) {
+        ta[j].m = arg;
+        ta[j].ops = ops;
+        s = pthread_create(&tid[j], NULL, threadFunc, &ta[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_join(tid[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+        if (ta[j].m->fn != incrPlain && ta[j].last != ops)
+            fatal("Thread %d: counter is %ld after %ld calls", j,
+                  ta[j].last, ops);
+    }
+
+    pthread_barrier_destroy(&startBarrier);
+    free(ta);
+    free(tid);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct benchResult res;
+    long ops;
+    size_t m;
+    int opt;
+
+    ops = 10000000;
+    nthreads = 1;
+    while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+        switch (opt) {
+        case 'n':   ops = getLong(optarg, GN_GT_0, "ops");          break;
+        case 't':   nthreads = getInt(optarg, GN_GT_0, "nthreads"); break;
+        default:    usageErr("%s [-n ops] [-t nthreads]\n", argv[0]);
+        }
+    }
+
+    for (m = 0; m < NUM_METHODS; m++) {
+        if (benchRun(methods[m].name,
+                     (nthreads > 1) ? callManyThreaded : callMany,
+                     (void *) &methods[m], ops, NULL, &res) == -1)
+            errExit("benchRun");
+        benchReport(&res);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,85 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 31 */
+
+/* tls_model_lib.c
+
+   The shared library used by tls_model_bench.c. Each function increments
+   a counter, held in a different kind of per-thread storage, and returns
+   the new value; the kind of storage determines the code that the
+   compiler generates to find the counter (see tls_model_bench.c).
+*/
+#include <pthread.h>
+#include <stdlib.h>
+#include "tls_model_lib.h"
+
+long plainCounter;              /* Not per-thread: the baseline */
+
+/* An exported thread-local variable in a shared library normally uses
+   the global-dynamic model; we make the choice explicit */
+
+__thread long gdCounter __attribute__ ((tls_model("global-dynamic")));
+
+static __thread long ldCounter __attribute__ ((tls_model("local-dynamic")));
+
+__thread long ieCounter __attribute__ ((tls_model("initial-exec")));
+
+static pthread_key_t counterKey;
+static pthread_once_t keyOnce = PTHREAD_ONCE_INIT;
+
+static void
+createKey(void)
+{
+    if (pthread_key_create(&counterKey, free) != 0)
+        abort();
+}
+
+long
+incrPlain(void)
+{
+    return ++plainCounter;
+}
+
+long
+incrGlobalDynamic(void)
+{
+    return ++gdCounter;
+}
+
+long
+incrLocalDynamic(void)
+{
+    return ++ldCounter;
+}
+
+long
+incrInitialExec(void)
+{
+    return ++ieCounter;
+}
+
+/* The thread-specific data version, as in strerror_tsd.c */
+
+long
+incrTsd(void)
+{
+    long *p;
+
+    if (pthread_once(&keyOnce, createKey) != 0)
+        abort();
+    p = pthread_getspecific(counterKey);
+    if (p == NULL) {
+        p = calloc(1, sizeof(long));
+        if (p == NULL || pthread_setspecific(counterKey, p) != 0)
+            abort();
+    }
+    return ++*p;
+}
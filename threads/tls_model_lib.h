@@ -0,0 +1,30 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 31 */
+
+/* tls_model_lib.h
+
+   Header file for tls_model_lib.c.
+*/
+#ifndef TLS_MODEL_LIB_H
+#define TLS_MODEL_LIB_H         /* Prevent accidental double inclusion */
+
+long incrPlain(void);
+
+long incrGlobalDynamic(void);
+
+long incrLocalDynamic(void);
+
+long incrInitialExec(void);
+
+long incrTsd(void);
+
+#endif
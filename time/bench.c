@@ -0,0 +1,365 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 10 */
+
+/* bench.c
+
+   A small harness for microbenchmarks, so that the various *_speed and
+   *_perf programs can measure themselves (rather than relying on time(1))
+   and report their results in a uniform format.
+
+   benchRun() calls a caller-supplied function, which performs a given
+   number of operations, 'warmup' times untimed and then 'reps' times
+   timed (using CLOCK_MONOTONIC). It reports the per-operation cost as the
+   median and percentiles of the repetitions, which (unlike the mean) are
+   robust against the occasional repetition that is disturbed by an
+   interrupt or a context switch; repetitions that lie more than five
+   median absolute deviations from the median are counted as outliers.
+   Optionally, the caller can be pinned to a CPU, and the cost can also be
+   expressed in CPU cycle counter (TSC) ticks and, where perf_event_open()
+   is permitted, in hardware cycles, instructions, and cache misses.
+
+   benchOptsInit() sets default options, which can be overridden by the
+   following environment variables, so that all programs that use this
+   module can be controlled in the same way (e.g., by "make bench"):
+
+        TLPI_BENCH_REPS     Number of timed repetitions
+        TLPI_BENCH_WARMUP   Number of untimed repetitions
+        TLPI_BENCH_CPU      CPU to pin to
+        TLPI_BENCH_PERF     "0" to disable the perf counters
+
+   benchReport() writes one line per result, preceded (the first time it
+   is called) by a header line that begins with the word "benchmark". If
+   TLPI_BENCH_FORMAT is "csv", the output is instead in CSV format.
+
+   benchParseList() parses a command-line argument such as "1,2,4,8",
+   for the programs that repeat a measurement for each of a list of
+   values (thread counts, and so on).
+
+   The perf counters are Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <time.h>
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "bench.h"
+
+static int
+envInt(const char *name, int def)
+{
+    char *s, *end;
+    long val;
+
+    s = getenv(name);
+    if (s == NULL || *s == '\0')
+        return def;
+    val = strtol(s, &end, 10);
+    return (*end == '\0') ? val : def;
+}
+
+void
+benchOptsInit(struct benchOpts *opts)
+{
+    opts->warmup = envInt("TLPI_BENCH_WARMUP", 1);
+    opts->reps = envInt("TLPI_BENCH_REPS", 11);
+    opts->cpu = envInt("TLPI_BENCH_CPU", -1);
+    opts->perf = envInt("TLPI_BENCH_PERF", 1) != 0;
+
+    if (opts->reps < 1)
+        opts->reps = 1;
+    if (opts->warmup < 0)
+        opts->warmup = 0;
+}
+
+/* Pin the calling thread to 'cpu'. Returns 0 on success, or -1 on error */
+
+int
+benchPin(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+/* Return the value of the CPU cycle counter, or 0 if there is none */
+
+uint64_t
+benchCycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t val;
+
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (val));
+    return val;
+#else
+    return 0;
+#endif
+}
+
+/* perf_event_open() counters. Each counter is opened separately (rather
+   than as a group), since 'inherit' (which allows the counts to include
+   threads and child processes) can't be used with group reads. */
+
+enum { PC_CYCLES, PC_INSTR, PC_CACHE_MISS, PC_NUM };
+
+static void
+perfOpen(int fd[PC_NUM])
+{
+#if defined(__linux__)
+    static const unsigned long long config[PC_NUM] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES
+    };
+    struct perf_event_attr pe;
+    int j;
+
+    for (j = 0; j < PC_NUM; j++) {
+        memset(&pe, 0, sizeof(pe));
+        pe.type = PERF_TYPE_HARDWARE;
+        pe.size = sizeof(pe);
+        pe.config = config[j];
+        pe.disabled = 1;
+        pe.inherit = 1;
+        pe.exclude_hv = 1;
+        fd[j] = syscall(SYS_perf_event_open, &pe, 0, -1, -1,
+                        PERF_FLAG_FD_CLOEXEC);
+    }
+#else
+    fd[PC_CYCLES] = fd[PC_INSTR] = fd[PC_CACHE_MISS] = -1;
+#endif
+}
+
+static void
+perfEnable(int fd[PC_NUM], Boolean enable)
+{
+#if defined(__linux__)
+    int j;
+
+    for (j = 0; j < PC_NUM; j++)
+        if (fd[j] >= 0)
+            ioctl(fd[j], enable ? PERF_EVENT_IOC_ENABLE :
+                                  PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+/* Return the count for the counter on 'fd' as a per-op value, or -1 if
+   the counter isn't available, and close 'fd' */
+
+static double
+perfPerOp(int fd, long totalOps)
+{
+    uint64_t count;
+    double val;
+
+    if (fd < 0)
+        return -1;
+    val = (read(fd, &count, sizeof(count)) == sizeof(count)) ?
+          (double) count / totalOps : -1;
+    close(fd);
+    return val;
+}
+
+static int
+cmpDouble(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Return the 'pct' percentile of the 'n' sorted values in 'v' */
+
+static double
+percentile(const double *v, int n, int pct)
+{
+    return v[(int) ((n - 1) * pct / 100.0 + 0.5)];
+}
+
+static double
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Measure 'fn', which performs 'ops' operations per call, according to
+   'opts' (or the defaults, if 'opts' is NULL), and place the results in
+   'res'. Returns 0 on success, or -1 on error. */
+
+int
+benchRun(const char *name, benchFn fn, void *arg, long ops,
+         const struct benchOpts *opts, struct benchResult *res)
+{
+    struct benchOpts defOpts;
+    double *ns, *dev, t0, med;
+    uint64_t c0, cycles;
+    int fd[PC_NUM], j;
+
+    if (opts == NULL) {
+        benchOptsInit(&defOpts);
+        opts = &defOpts;
+    }
+    if (ops < 1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ns = malloc(2 * opts->reps * sizeof(double));
+    if (ns == NULL)
+        return -1;
+    dev = ns + opts->reps;
+
+    if (opts->cpu >= 0 && benchPin(opts->cpu) == -1) {
+        free(ns);
+        return -1;
+    }
+
+    for (j = 0; j < opts->warmup; j++)
+        fn(ops, arg);
+
+    fd[PC_CYCLES] = fd[PC_INSTR] = fd[PC_CACHE_MISS] = -1;
+    if (opts->perf)
+        perfOpen(fd);
+    perfEnable(fd, TRUE);
+
+    cycles = 0;
+    for (j = 0; j < opts->reps; j++) {
+        c0 = benchCycles();
+        t0 = nowNs();
+        fn(ops, arg);
+        ns[j] = (nowNs() - t0) / ops;
+        cycles += benchCycles() - c0;
+    }
+
+    perfEnable(fd, FALSE);
+
+    snprintf(res->name, sizeof(res->name), "%s", name);
+    res->ops = ops;
+    res->reps = opts->reps;
+
+    qsort(ns, opts->reps, sizeof(double), cmpDouble);
+    med = percentile(ns, opts->reps, 50);
+    res->minNs = ns[0];
+    res->medianNs = med;
+    res->p90Ns = percentile(ns, opts->reps, 90);
+    res->p99Ns = percentile(ns, opts->reps, 99);
+    res->maxNs = ns[opts->reps - 1];
+
+    for (j = 0; j < opts->reps; j++)
+        dev[j] = (ns[j] > med) ? ns[j] - med : med - ns[j];
+    qsort(dev, opts->reps, sizeof(double), cmpDouble);
+    res->madNs = percentile(dev, opts->reps, 50);
+    res->outliers = 0;
+    for (j = 0; j < opts->reps; j++)
+        if (dev[j] > 5 * res->madNs && res->madNs > 0)
+            res->outliers++;
+
+    res->cyclesPerOp = (cycles > 0) ?
+                       (double) cycles / ((double) ops * opts->reps) : -1;
+    res->hwCyclesPerOp = perfPerOp(fd[PC_CYCLES], ops * opts->reps);
+    res->instrPerOp = perfPerOp(fd[PC_INSTR], ops * opts->reps);
+    res->cacheMissPerOp = perfPerOp(fd[PC_CACHE_MISS], ops * opts->reps);
+
+    free(ns);
+    return 0;
+}
+
+/* Print a per-op counter value, or "-" if it is unavailable */
+
+static void
+printCount(double val, Boolean csv)
+{
+    if (csv && val < 0)
+        printf(",");
+    else if (csv)
+        printf(",%.2f", val);
+    else if (val < 0)
+        printf(" %9s", "-");
+    else
+        printf(" %9.2f", val);
+}
+
+void
+benchReport(const struct benchResult *res)
+{
+    static Boolean headerDone = FALSE;
+    const char *fmt;
+    Boolean csv;
+
+    fmt = getenv("TLPI_BENCH_FORMAT");
+    csv = fmt != NULL && strcmp(fmt, "csv") == 0;
+
+    if (!headerDone) {
+        if (csv)
+            printf("benchmark,ops,reps,min_ns,median_ns,p90_ns,p99_ns,"
+                   "max_ns,mad_ns,outliers,tsc_per_op,cycles_per_op,"
+                   "instr_per_op,cache_miss_per_op\n");
+        else
+            printf("%-36s %9s %4s %9s %9s %9s %9s %9s %3s %9s %9s %9s %9s\n",
+                   "benchmark", "ops", "reps", "min-ns", "median-ns",
+                   "p90-ns", "p99-ns", "mad-ns", "out", "tsc/op",
+                   "cycles/op", "instr/op", "miss/op");
+        headerDone = TRUE;
+    }
+
+    if (csv)
+        printf("%s,%ld,%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%d", res->name,
+               res->ops, res->reps, res->minNs, res->medianNs, res->p90Ns,
+               res->p99Ns, res->maxNs, res->madNs, res->outliers);
+    else
+        printf("%-36s %9ld %4d %9.2f %9.2f %9.2f %9.2f %9.2f %3d",
+               res->name, res->ops, res->reps, res->minNs, res->medianNs,
+               res->p90Ns, res->p99Ns, res->madNs, res->outliers);
+    printCount(res->cyclesPerOp, csv);
+    printCount(res->hwCyclesPerOp, csv);
+    printCount(res->instrPerOp, csv);
+    printCount(res->cacheMissPerOp, csv);
+    printf("\n");
+    fflush(stdout);
+}
+
+/* Parse a comma-separated list of integers in 'str' (which is modified)
+   into 'list', which has room for 'max' items. Each item is converted
+   with getInt(), using 'flags' (e.g., GN_GT_0 for positive integers) and
+   'name' (which also names the list in error messages). An empty list,
+   or one with more than 'max' items, is a command-line error. Returns
+   the number of items. */
+
+int
+benchParseList(char *str, int *list, int max, int flags, const char *name)
+{
+    char *tok, *save;
+    int n;
+
+    n = 0;
+    for (tok = strtok_r(str, ",", &save); tok != NULL;
+            tok = strtok_r(NULL, ",", &save)) {
+        if (n >= max)
+            cmdLineErr("Too many items in %s list\n", name);
+        list[n++] = getInt(tok, flags, name);
+    }
+    if (n == 0)
+        cmdLineErr("Empty %s list\n", name);
+    return n;
+}
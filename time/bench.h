@@ -0,0 +1,69 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 10 */
+
+/* bench.h
+
+   Header file for bench.c.
+*/
+#ifndef BENCH_H
+#define BENCH_H                 /* Prevent accidental double inclusion */
+
+#include <stdint.h>
+#include "tlpi_hdr.h"
+
+/* The function being measured performs 'ops' operations */
+
+typedef void (*benchFn)(long ops, void *arg);
+
+struct benchOpts {
+    int warmup;                 /* Untimed repetitions (default: 1) */
+    int reps;                   /* Timed repetitions (default: 11) */
+    int cpu;                    /* CPU to pin to, or -1 (default) */
+    Boolean perf;               /* Use perf_event_open() counters? */
+};
+
+struct benchResult {
+    char name[64];
+    long ops;                   /* Operations per repetition */
+    int reps;
+
+    /* Statistics of the per-repetition cost, in nanoseconds per op */
+
+    double minNs, medianNs, p90Ns, p99Ns, maxNs;
+    double madNs;               /* Median absolute deviation */
+    int outliers;               /* Reps more than 5 MADs from median */
+
+    double cyclesPerOp;         /* From the CPU cycle counter (TSC);
+                                   -1 if there is none */
+
+    /* The following are -1 if perf counters were not requested or are
+       not available; they include any child processes and threads
+       created by the measured function */
+
+    double hwCyclesPerOp, instrPerOp, cacheMissPerOp;
+};
+
+void benchOptsInit(struct benchOpts *opts);
+
+int benchPin(int cpu);
+
+uint64_t benchCycles(void);
+
+int benchRun(const char *name, benchFn fn, void *arg, long ops,
+             const struct benchOpts *opts, struct benchResult *res);
+
+void benchReport(const struct benchResult *res);
+
+int benchParseList(char *str, int *list, int max, int flags,
+                   const char *name);
+
+#endif
@@ -23,22 +23,22 @@
    the specification in 'format' (see strftime(3) for specifiers).
    If 'format' is NULL, we use "%c" as a specifier (which gives the'
    date and time as for ctime(3), but without the trailing newline).
-   Returns NULL on error. */
+   The string is in a buffer private to the calling thread, which is
+   overwritten by the thread's next call. Returns NULL on error. */
 
 char *
 currTime(const char *format)
 {
-    static char buf[BUF_SIZE];  /* Nonreentrant */
+    static __thread char buf[BUF_SIZE];
     time_t t;
     size_t s;
-    struct tm *tm;
+    struct tm tm;
 
     t = time(NULL);
-    tm = localtime(&t);
-    if (tm == NULL)
+    if (localtime_r(&t, &tm) == NULL)
         return NULL;
 
-    s = strftime(buf, BUF_SIZE, (format != NULL) ? format : "%c", tm);
+    s = strftime(buf, BUF_SIZE, (format != NULL) ? format : "%c", &tm);
 
     return (s == 0) ? NULL : buf;
 }
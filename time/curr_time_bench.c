@@ -0,0 +1,146 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 10 */
+
+/* curr_time_bench.c
+
+   Compare the cost of currTime() (curr_time.c) with that of
+   currTimeFast() (fast_time.c).
+
+   Usage: curr_time_bench [-n calls] [-t nthreads] [-d digits] [format]
+
+        -n calls     Number of calls made by each thread (default: 1000000)
+        -t nthreads  Number of threads calling currTimeFast() at the same
+                     time (default: 1)
+        -d digits    Subsecond digits requested from currTimeFast()
+                     (default: 0)
+
+   'format' is a strftime(3) format (default: "%Y-%m-%d %H:%M:%S").
+
+   currTime() returns a static buffer, so it is measured only in the
+   main thread; currTimeFast() is measured in 'nthreads' concurrent
+   threads, each of which checks that every string it gets back is well
+   formed.
+*/
+#include <pthread.h>
+#include "curr_time.h"
+#include "fast_time.h"
+#include "tlpi_hdr.h"
+
+static long ncalls = 1000000;
+static int digits = 0;
+static const char *format = "%Y-%m-%d %H:%M:%S";
+static size_t prefixLen;                /* Length of formatted prefix */
+
+static double
+elapsedNs(const struct timespec *start)
+{
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1)
+        errExit("clock_gettime");
+    return (now.tv_sec - start->tv_sec) * 1e9 +
+           (now.tv_nsec - start->tv_nsec);
+}
+
+static void *
+threadFunc(void *arg)
+{
+    struct timespec start;
+    double *nsPerCall = arg;
+    char *s;
+    long j;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+    for (j = 0; j < ncalls; j++) {
+        s = currTimeFast(format, digits);
+        if (s == NULL)
+            fatal("currTimeFast() failed");
+        if (strlen(s) != prefixLen + (digits > 0 ? digits + 1 : 0))
+            fatal("currTimeFast() returned malformed string: \"%s\"", s);
+    }
+    *nsPerCall = elapsedNs(&start) / ncalls;
+    return NULL;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n calls] [-t nthreads] [-d digits] "
+                    "[format]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct timespec start;
+    pthread_t *tid;
+    double *nsPerCall, ns;
+    int opt, nthreads, s, j;
+
+    nthreads = 1;
+    while ((opt = getopt(argc, argv, "n:t:d:")) != -1) {
+        switch (opt) {
+        case 'n':   ncalls = getLong(optarg, GN_GT_0, "calls");         break;
+        case 't':   nthreads = getInt(optarg, GN_GT_0, "nthreads");     break;
+        case 'd':   digits = getInt(optarg, GN_NONNEG, "digits");       break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind < argc)
+        format = argv[optind++];
+    if (optind != argc || digits > 9)
+        usageError(argv[0]);
+
+    if (currTime(format) == NULL)
+        fatal("currTime() failed");
+    prefixLen = strlen(currTime(format));
+
+    printf("currTime:     \"%s\"\n", currTime(format));
+    printf("currTimeFast: \"%s\"\n", currTimeFast(format, digits));
+
+    /* currTime(), in the main thread only */
+
+    if (clock_gettime(CLOCK_MONOTONIC, &start) == -1)
+        errExit("clock_gettime");
+    for (j = 0; j < ncalls; j++)
+        if (currTime(format) == NULL)
+            fatal("currTime() failed");
+    printf("currTime:     %8.1f ns/call\n", elapsedNs(&start) / ncalls);
+
+    /* currTimeFast(), in 'nthreads' threads */
+
+    tid = calloc(nthreads, sizeof(pthread_t));
+    nsPerCall = calloc(nthreads, sizeof(double));
+    if (tid == NULL || nsPerCall == NULL)
+        errExit("calloc");
+
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_create(&tid[j], NULL, threadFunc, &nsPerCall[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    ns = 0;
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_join(tid[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+        ns += nsPerCall[j];
+    }
+    printf("currTimeFast: %8.1f ns/call (average over %d thread%s)\n",
+            ns / nthreads, nthreads, (nthreads == 1) ? "" : "s");
+
+    exit(EXIT_SUCCESS);
+}
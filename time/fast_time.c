@@ -0,0 +1,130 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 10 */
+
+/* fast_time.c
+
+   Implement currTimeFast(), a faster, thread-safe alternative to our
+   currTime() function (curr_time.c).
+
+   currTime() calls time(), localtime(), and strftime() on every call, and
+   returns its result in a static buffer. Converting to broken-down local
+   time and formatting are by far the most expensive steps, yet their
+   result changes only once per second. currTimeFast() therefore keeps,
+   in thread-local storage, the most recently formatted string along with
+   the second (and format) that it was built from, and calls
+   localtime_r() and strftime() only when the second changes. The current
+   time is obtained with clock_gettime(), which on most architectures is
+   implemented in the vDSO (see vdso/gettimeofday.c), so that the common
+   case involves no system calls at all.
+
+   When no subsecond digits are requested (or the requested precision is
+   no finer than the clock's resolution), the cheaper CLOCK_REALTIME_COARSE
+   clock is used. This clock is updated only once per kernel tick, so the
+   second boundary may be observed up to one tick late. (This clock is
+   Linux-specific; elsewhere, CLOCK_REALTIME is always used.)
+*/
+#include <time.h>
+#include <string.h>
+#include "fast_time.h"          /* Declares function defined here */
+
+#define BUF_SIZE 1000
+#define FMT_SIZE 128            /* Longer formats aren't cached */
+
+#ifndef CLOCK_REALTIME_COARSE
+#define CLOCK_REALTIME_COARSE CLOCK_REALTIME
+#endif
+
+static __thread char buf[BUF_SIZE];     /* Returned to caller */
+static __thread size_t prefixLen;       /* Length of cached prefix */
+static __thread time_t cachedSec = -1;  /* Second of cached prefix */
+static __thread char cachedFmt[FMT_SIZE];
+static __thread long coarseRes;         /* Resolution of coarse clock */
+
+/* Return a string containing the current time formatted according to
+   the specification in 'format' (see strftime(3) for specifiers),
+   followed by a decimal point and 'digits' (0 to 9) digits giving the
+   fraction of the second. If 'format' is NULL, we use "%c". The string
+   is in a thread-local buffer that is overwritten by the calling
+   thread's next call. Returns NULL on error.
+
+   If the TZ environment variable is changed after the first call, the
+   change may not be noticed (as for localtime_r()). */
+
+char *
+currTimeFast(const char *format, int digits)
+{
+    struct timespec ts, res;
+    struct tm tm;
+    clockid_t clk;
+    long frac;
+    size_t len;
+    int j;
+
+    if (format == NULL)
+        format = "%c";
+    if (digits < 0 || digits > 9)
+        return NULL;
+
+    if (coarseRes == 0) {
+        if (clock_getres(CLOCK_REALTIME_COARSE, &res) == -1 ||
+                res.tv_sec != 0)
+            coarseRes = 1000000000;
+        else
+            coarseRes = res.tv_nsec;
+    }
+
+    /* Units of the last requested digit, in nanoseconds */
+
+    frac = 1000000000;
+    for (j = 0; j < digits; j++)
+        frac /= 10;
+
+    clk = (coarseRes <= frac) ? CLOCK_REALTIME_COARSE : CLOCK_REALTIME;
+    if (clock_gettime(clk, &ts) == -1)
+        return NULL;
+
+    /* Reformat the prefix only if the second or the format changed */
+
+    if (ts.tv_sec != cachedSec || strcmp(format, cachedFmt) != 0) {
+        cachedSec = -1;                 /* In case of error */
+        if (localtime_r(&ts.tv_sec, &tm) == NULL)
+            return NULL;
+
+        prefixLen = strftime(buf, BUF_SIZE - 11, format, &tm);
+        if (prefixLen == 0)
+            return NULL;
+
+        len = strlen(format);
+        if (len < FMT_SIZE) {
+            memcpy(cachedFmt, format, len + 1);
+            cachedSec = ts.tv_sec;
+        }
+    }
+
+    /* Append the fraction, most significant digit first */
+
+    len = prefixLen;
+    if (digits > 0) {
+        buf[len++] = '.';
+        frac = ts.tv_nsec;
+        for (j = 9; j > digits; j--)
+            frac /= 10;
+        for (j = digits - 1; j >= 0; j--) {
+            buf[len + j] = '0' + frac % 10;
+            frac /= 10;
+        }
+        len += digits;
+    }
+    buf[len] = '\0';
+
+    return buf;
+}
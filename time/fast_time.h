@@ -0,0 +1,22 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 10 */
+
+/* fast_time.h
+
+   Header file for fast_time.c.
+*/
+#ifndef FAST_TIME_H
+#define FAST_TIME_H             /* Prevent accidental double inclusion */
+
+char *currTimeFast(const char *format, int digits);
+
+#endif
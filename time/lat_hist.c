@@ -0,0 +1,161 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 10 */
+
+/* lat_hist.c
+
+   A histogram for latencies (or other nonnegative integer values), in
+   the style of HdrHistogram: values are counted in log-linear buckets,
+   so that recording a value costs a few instructions and no memory
+   allocation, the histogram has a fixed size (about 58 kB) whatever the
+   range of values, and any percentile can be read back with a relative
+   error of less than 1/LH_SUB_BUCKETS. Values below LH_SUB_BUCKETS are
+   recorded exactly.
+
+   The histogram structure is public, so that it can be declared
+   statically or as part of another structure; histograms recorded
+   separately (for example, by different threads) can be combined with
+   latHistMerge(). latHistPrint() writes a one-line summary: the count,
+   mean, and the usual percentiles up to 99.99, each divided by 'scale'
+   (for example, 1000 to show nanoseconds as microseconds).
+*/
+#include <string.h>
+#include "lat_hist.h"           /* Declares functions defined here */
+
+/* Return the index of the bucket that holds 'v' */
+
+static int
+bucketIndex(long long v)
+{
+    int e;
+
+    if (v < LH_SUB_BUCKETS)
+        return (v < 0) ? 0 : v;
+    e = 63 - __builtin_clzll(v);        /* Position of leading 1 bit */
+    return (e - LH_SUB_BITS + 1) * LH_SUB_BUCKETS +
+           ((v >> (e - LH_SUB_BITS)) & (LH_SUB_BUCKETS - 1));
+}
+
+/* Return the lowest value that falls in bucket 'idx' */
+
+static long long
+bucketLow(int idx)
+{
+    int e;
+
+    if (idx < LH_SUB_BUCKETS)
+        return idx;
+    e = idx / LH_SUB_BUCKETS + LH_SUB_BITS - 1;
+    return (1LL << e) +
+           ((long long) (idx % LH_SUB_BUCKETS) << (e - LH_SUB_BITS));
+}
+
+void
+latHistInit(struct latHist *h)
+{
+    memset(h, 0, sizeof(struct latHist));
+}
+
+/* Record 'n' occurrences of 'value' */
+
+void
+latHistRecordN(struct latHist *h, long long value, long long n)
+{
+    if (value < 0)
+        value = 0;
+    if (h->count == 0 || value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+    h->count += n;
+    h->sum += (double) value * n;
+    h->bucket[bucketIndex(value)] += n;
+}
+
+void
+latHistRecord(struct latHist *h, long long value)
+{
+    latHistRecordN(h, value, 1);
+}
+
+/* Add the counts in 'src' to 'dst' */
+
+void
+latHistMerge(struct latHist *dst, const struct latHist *src)
+{
+    int j;
+
+    if (src->count == 0)
+        return;
+    if (dst->count == 0 || src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+    dst->count += src->count;
+    dst->sum += src->sum;
+    for (j = 0; j < LH_BUCKETS; j++)
+        dst->bucket[j] += src->bucket[j];
+}
+
+/* Return the value below which the fraction 'p' (0 to 1) of the
+   recorded values lie: the highest value in the bucket that holds that
+   fraction (but no more than the largest value recorded). Returns 0 if
+   the histogram is empty. */
+
+long long
+latHistPercentile(const struct latHist *h, double p)
+{
+    long long target, seen, hi;
+    int j;
+
+    if (h->count == 0)
+        return 0;
+    target = p * h->count;
+    if (target >= h->count)
+        target = h->count - 1;
+
+    seen = 0;
+    for (j = 0; j < LH_BUCKETS; j++) {
+        seen += h->bucket[j];
+        if (seen > target) {
+            hi = (j + 1 < LH_BUCKETS) ? bucketLow(j + 1) - 1 : h->max;
+            return (hi < h->max) ? hi : h->max;
+        }
+    }
+    return h->max;
+}
+
+double
+latHistMean(const struct latHist *h)
+{
+    return (h->count == 0) ? 0 : h->sum / h->count;
+}
+
+void
+latHistPrint(const struct latHist *h, FILE *fp, const char *label,
+             double scale, const char *unit)
+{
+    static const double pct[] = { 0.5, 0.9, 0.99, 0.999, 0.9999 };
+    static const char *pctName[] = { "p50", "p90", "p99", "p99.9",
+                                     "p99.99" };
+    size_t j;
+
+    fprintf(fp, "%s (%s): n %lld", label, unit, h->count);
+    if (h->count > 0) {
+        fprintf(fp, "; min %.1f; mean %.1f", h->min / scale,
+                latHistMean(h) / scale);
+        for (j = 0; j < sizeof(pct) / sizeof(pct[0]); j++)
+            fprintf(fp, "; %s %.1f", pctName[j],
+                    latHistPercentile(h, pct[j]) / scale);
+        fprintf(fp, "; max %.1f", h->max / scale);
+    }
+    fprintf(fp, "\n");
+}
@@ -0,0 +1,52 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 10 */
+
+/* lat_hist.h
+
+   Header file for lat_hist.c.
+*/
+#ifndef LAT_HIST_H
+#define LAT_HIST_H              /* Prevent accidental double inclusion */
+
+#include <stdio.h>
+
+/* Each power-of-2 range of values is divided into LH_SUB_BUCKETS
+   buckets, so that a recorded value is known to within 1/LH_SUB_BUCKETS
+   (under 1%) */
+
+#define LH_SUB_BITS 7
+#define LH_SUB_BUCKETS (1 << LH_SUB_BITS)
+#define LH_BUCKETS ((64 - LH_SUB_BITS) * LH_SUB_BUCKETS)
+
+struct latHist {
+    long long count;
+    long long min, max;
+    double sum;
+    long long bucket[LH_BUCKETS];
+};
+
+void latHistInit(struct latHist *h);
+
+void latHistRecord(struct latHist *h, long long value);
+
+void latHistRecordN(struct latHist *h, long long value, long long n);
+
+void latHistMerge(struct latHist *dst, const struct latHist *src);
+
+long long latHistPercentile(const struct latHist *h, double p);
+
+double latHistMean(const struct latHist *h);
+
+void latHistPrint(const struct latHist *h, FILE *fp, const char *label,
+                  double scale, const char *unit);
+
+#endif
@@ -0,0 +1,356 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 10 */
+
+/* perf_counters.c
+
+   Instrument regions of code with hardware performance counters.
+
+   pcInit() selects the events to be counted (CPU cycles, instructions,
+   last-level cache misses, branch misses, and context switches). Each
+   thread that executes an instrumented region opens its own group of
+   perf_event_open() counters (the first time it uses a region, or when
+   it calls pcThreadInit()); counting is per-thread, and not inherited by
+   children. Events that can't be opened (e.g., hardware events inside
+   a virtual machine, or when /proc/sys/kernel/perf_event_paranoid
+   forbids them) are omitted, and are shown as "-" in the summary.
+
+   The PC_START() and PC_STOP() macros (see perf_counters.h) bracket a
+   region; PC_STOP() adds the differences in the counter values (and the
+   elapsed time, and a count of calls) to the region's totals, which are
+   shared by all threads. Where possible (on x86, when all of the opened
+   counters are hardware counters whose mmap()ed control page permits
+   it), the counters are read in user space with the RDPMC instruction,
+   costing a few tens of cycles; otherwise, all of the counters in the
+   group are fetched with a single read(2).
+
+   Unless PC_NO_REPORT is specified, a summary of each region, showing
+   the average per call of the time and of each counter, is written to
+   stderr when the program exits.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDPMC
+#endif
+#include "perf_counters.h"
+#include "tlpi_hdr.h"
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} events[PC_NEVENTS] = {
+    { "cycles",         PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instrs",         PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "llc-miss",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "br-miss",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "ctx-sw",         PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+};
+
+static int pcFlags = PC_DEFAULT;
+static int opened;                      /* Events opened by any thread */
+static struct pcRegion *regions;        /* List of registered regions, */
+static struct pcRegion **regTail = &regions;    /* in order of first use */
+static pthread_mutex_t regMtx = PTHREAD_MUTEX_INITIALIZER;
+
+struct pcThread {                       /* Per-thread counter state */
+    int init;                           /* 0 = not yet, 1 = done */
+    int nfds;                           /* Number of counters opened */
+    int leader;                         /* Group leader fd, or -1 */
+    int ev[PC_NEVENTS];                 /* Event of each counter, in
+                                           group order */
+    int fd[PC_NEVENTS];
+    struct perf_event_mmap_page *pg[PC_NEVENTS];
+    int rdpmc;                          /* Read with RDPMC? */
+};
+
+static __thread struct pcThread th;
+
+static void
+reportAtExit(void)
+{
+    fflush(stdout);
+    pcReport(stderr);
+}
+
+/* Set the events and options used by threads that subsequently open
+   their counters, and open the counters for the calling thread. Returns
+   0 on success, or -1 if no counters could be opened. */
+
+int
+pcInit(int flags)
+{
+    static int reportSet = 0;
+
+    pcFlags = flags;
+    if (!(flags & PC_NO_REPORT) && !reportSet) {
+        if (atexit(reportAtExit) != 0)
+            return -1;
+        reportSet = 1;
+    }
+    return pcThreadInit();
+}
+
+/* Open (a group of) counters for the calling thread. Returns 0 on
+   success, or -1 if no counters could be opened. */
+
+int
+pcThreadInit(void)
+{
+    struct perf_event_attr pe;
+    long pageSize;
+    int e, fd, j;
+
+    if (th.init)
+        return (th.nfds > 0) ? 0 : -1;
+
+    th.init = 1;
+    th.nfds = 0;
+    th.leader = -1;
+    th.rdpmc = 0;
+
+    for (e = 0; e < PC_NEVENTS; e++) {
+        if (!(pcFlags & PC_EV(e)))
+            continue;
+
+        memset(&pe, 0, sizeof(pe));
+        pe.type = events[e].type;
+        pe.size = sizeof(pe);
+        pe.config = events[e].config;
+        pe.read_format = PERF_FORMAT_GROUP;
+        pe.exclude_kernel = !(pcFlags & PC_KERNEL);
+        pe.exclude_hv = 1;
+
+        fd = syscall(SYS_perf_event_open, &pe, 0, -1, th.leader,
+                     PERF_FLAG_FD_CLOEXEC);
+        if (fd == -1)
+            continue;                   /* Event not available */
+
+        if (th.leader == -1)
+            th.leader = fd;
+        th.ev[th.nfds] = e;
+        th.fd[th.nfds] = fd;
+        th.pg[th.nfds] = NULL;
+        th.nfds++;
+        __atomic_fetch_or(&opened, PC_EV(e), __ATOMIC_RELAXED);
+    }
+
+    if (th.nfds == 0)
+        return -1;
+
+    /* Use RDPMC only if all counters are hardware counters whose
+       control page says that RDPMC is permitted */
+
+#ifdef HAVE_RDPMC
+    if (!(pcFlags & PC_NO_RDPMC)) {
+        pageSize = sysconf(_SC_PAGESIZE);
+        th.rdpmc = 1;
+        for (j = 0; j < th.nfds; j++) {
+            if (events[th.ev[j]].type != PERF_TYPE_HARDWARE) {
+                th.rdpmc = 0;
+                break;
+            }
+            th.pg[j] = mmap(NULL, pageSize, PROT_READ, MAP_SHARED,
+                            th.fd[j], 0);
+            if (th.pg[j] == MAP_FAILED) {
+                th.pg[j] = NULL;
+                th.rdpmc = 0;
+                break;
+            }
+            if (!th.pg[j]->cap_user_rdpmc || th.pg[j]->index == 0) {
+                th.rdpmc = 0;
+                break;
+            }
+        }
+
+        if (!th.rdpmc)
+            for (j = 0; j < th.nfds; j++)
+                if (th.pg[j] != NULL) {
+                    munmap(th.pg[j], pageSize);
+                    th.pg[j] = NULL;
+                }
+    }
+#else
+    (void) pageSize;
+    (void) j;
+#endif
+
+    return 0;
+}
+
+/* Return a mask (of PC_EV() values) of the events that have been
+   opened by at least one thread */
+
+int
+pcEvents(void)
+{
+    return __atomic_load_n(&opened, __ATOMIC_RELAXED);
+}
+
+/* Return 1 if the calling thread reads its counters with RDPMC */
+
+int
+pcUsingRdpmc(void)
+{
+    return th.rdpmc;
+}
+
+#ifdef HAVE_RDPMC
+
+/* Read a counter via its control page, using the protocol described in
+   <linux/perf_event.h>. Returns 0 on success, or -1 if the counter is
+   not currently readable with RDPMC. */
+
+static int
+rdpmcRead(volatile struct perf_event_mmap_page *pg, uint64_t *val)
+{
+    uint32_t seq, idx;
+    uint64_t count;
+    int64_t pmc;
+    int width;
+
+    do {
+        seq = pg->lock;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        idx = pg->index;
+        count = pg->offset;
+        if (!pg->cap_user_rdpmc || idx == 0)
+            return -1;
+        width = pg->pmc_width;
+        pmc = __rdpmc(idx - 1);
+        pmc <<= 64 - width;             /* Sign-extend to 64 bits */
+        pmc >>= 64 - width;
+        count += pmc;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    } while (pg->lock != seq);
+
+    *val = count;
+    return 0;
+}
+
+#endif
+
+void
+pcRead(struct pcSnap *snap)
+{
+    uint64_t buf[1 + PC_NEVENTS];
+    struct timespec ts;
+    int j;
+
+    if (!th.init)
+        pcThreadInit();
+
+#ifdef HAVE_RDPMC
+    if (th.rdpmc) {
+        for (j = 0; j < th.nfds; j++)
+            if (rdpmcRead(th.pg[j], &snap->val[th.ev[j]]) == -1)
+                break;
+        if (j == th.nfds)
+            goto done;
+    }
+#endif
+
+    /* Fall back to reading the whole group at once: the buffer holds
+       the number of counters, followed by their values in group order */
+
+    if (th.nfds > 0 && read(th.leader, buf, sizeof(buf)) > 0)
+        for (j = 0; j < th.nfds && j < buf[0]; j++)
+            snap->val[th.ev[j]] = buf[1 + j];
+    else
+        memset(snap->val, 0, sizeof(snap->val));
+
+#ifdef HAVE_RDPMC
+done:
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    snap->ns = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Add the differences between the current counter values and those in
+   'start' to the totals for region 'r' */
+
+void
+pcAccumulate(struct pcRegion *r, const struct pcSnap *start)
+{
+    struct pcSnap now;
+    int j;
+
+    pcRead(&now);
+
+    if (!__atomic_load_n(&r->registered, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&regMtx);
+        if (!r->registered) {
+            r->next = NULL;
+            *regTail = r;
+            regTail = &r->next;
+            __atomic_store_n(&r->registered, 1, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&regMtx);
+    }
+
+    __atomic_fetch_add(&r->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&r->ns, now.ns - start->ns, __ATOMIC_RELAXED);
+    for (j = 0; j < th.nfds; j++)
+        __atomic_fetch_add(&r->sum[th.ev[j]],
+                now.val[th.ev[j]] - start->val[th.ev[j]], __ATOMIC_RELAXED);
+}
+
+/* Print the per-call averages for each region that has been used */
+
+void
+pcReport(FILE *fp)
+{
+    struct pcRegion *r;
+    int e, ev;
+
+    ev = pcEvents();
+
+    pthread_mutex_lock(&regMtx);
+    if (regions == NULL) {
+        pthread_mutex_unlock(&regMtx);
+        return;
+    }
+
+    fprintf(fp, "%-20s %10s %10s", "region", "calls", "ns/call");
+    for (e = 0; e < PC_NEVENTS; e++)
+        if (pcFlags & PC_EV(e))
+            fprintf(fp, " %10s", events[e].name);
+    if ((ev & PC_EV(PC_CYCLES)) && (ev & PC_EV(PC_INSTRUCTIONS)))
+        fprintf(fp, " %6s", "IPC");
+    fprintf(fp, "\n");
+
+    for (r = regions; r != NULL; r = r->next) {
+        fprintf(fp, "%-20s %10llu %10.1f", r->name,
+                (unsigned long long) r->calls, (double) r->ns / r->calls);
+        for (e = 0; e < PC_NEVENTS; e++) {
+            if (!(pcFlags & PC_EV(e)))
+                continue;
+            if (ev & PC_EV(e))
+                fprintf(fp, " %10.1f", (double) r->sum[e] / r->calls);
+            else
+                fprintf(fp, " %10s", "-");
+        }
+        if ((ev & PC_EV(PC_CYCLES)) && (ev & PC_EV(PC_INSTRUCTIONS)))
+            fprintf(fp, " %6.2f", (r->sum[PC_CYCLES] == 0) ? 0.0 :
+                    (double) r->sum[PC_INSTRUCTIONS] / r->sum[PC_CYCLES]);
+        fprintf(fp, "\n");
+    }
+    pthread_mutex_unlock(&regMtx);
+}
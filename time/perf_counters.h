@@ -0,0 +1,92 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 10 */
+
+/* perf_counters.h
+
+   Header file for perf_counters.c.
+
+   A region of code is instrumented as follows:
+
+        PC_REGION(parse);               // At file scope
+
+        ...
+        PC_START(parse);
+        ... code being measured ...
+        PC_STOP(parse);
+
+   Compiling with -DNO_PERF_COUNTERS causes these macros to expand to
+   nothing.
+*/
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H         /* Prevent accidental double inclusion */
+
+#include <stdio.h>
+#include <stdint.h>
+
+enum {                          /* Events that can be counted */
+    PC_CYCLES,
+    PC_INSTRUCTIONS,
+    PC_LLC_MISSES,
+    PC_BRANCH_MISSES,
+    PC_CTX_SWITCHES,
+    PC_NEVENTS
+};
+
+#define PC_EV(e)        (1 << (e))
+
+/* Flags for pcInit(): a mask of PC_EV() values, plus the following */
+
+#define PC_DEFAULT      (PC_EV(PC_CYCLES) | PC_EV(PC_INSTRUCTIONS) | \
+                         PC_EV(PC_LLC_MISSES) | PC_EV(PC_BRANCH_MISSES))
+#define PC_ALL          (PC_DEFAULT | PC_EV(PC_CTX_SWITCHES))
+#define PC_KERNEL       0x100   /* Count in kernel mode as well as user
+                                   mode (may need privilege) */
+#define PC_NO_REPORT    0x200   /* Don't print a summary at exit */
+#define PC_NO_RDPMC     0x400   /* Always read counters with read(2) */
+
+struct pcSnap {                 /* Counter values at a point in time */
+    uint64_t val[PC_NEVENTS];
+    uint64_t ns;                /* CLOCK_MONOTONIC time */
+};
+
+struct pcRegion {               /* Accumulated values for a code region */
+    const char *name;
+    struct pcRegion *next;      /* In list of registered regions */
+    int registered;
+    uint64_t calls;
+    uint64_t ns;
+    uint64_t sum[PC_NEVENTS];
+};
+
+int pcInit(int flags);
+int pcThreadInit(void);
+int pcEvents(void);
+int pcUsingRdpmc(void);
+void pcRead(struct pcSnap *snap);
+void pcAccumulate(struct pcRegion *r, const struct pcSnap *start);
+void pcReport(FILE *fp);
+
+#ifndef NO_PERF_COUNTERS
+
+#define PC_REGION(var)  static struct pcRegion var = { .name = #var }
+#define PC_START(var)   struct pcSnap var##_pcStart; pcRead(&var##_pcStart)
+#define PC_STOP(var)    pcAccumulate(&var, &var##_pcStart)
+
+#else
+
+#define PC_REGION(var)  struct pcRegion
+#define PC_START(var)   do { } while (0)
+#define PC_STOP(var)    do { } while (0)
+
+#endif
+
+#endif
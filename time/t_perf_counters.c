@@ -0,0 +1,149 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 10 */
+
+/* t_perf_counters.c
+
+   Demonstrate the perf_counters.c functions, by instrumenting a few
+   regions of code whose behavior differs in ways that the counters
+   should reveal.
+
+   Usage: t_perf_counters [-a] [-k] [-r] [-n loops] [-s array-kB]
+
+        -a          Also count context switches
+        -k          Also count events in kernel mode
+        -r          Don't use RDPMC (always read(2) the counters)
+        -n loops    Number of times each region is executed (default: 10)
+        -s kB       Size of the array used by the memory regions
+                    (default: 65536, i.e., 64 MB)
+
+   The regions are:
+
+        seq_sum     Sum the array sequentially (cache-friendly)
+        rand_sum    Sum the same number of array elements, at random
+                    indexes (many last-level cache misses)
+        sorted_br   A branch on each element of a sorted array
+                    (predictable)
+        random_br   The same branch on random data (many branch misses)
+        yield       1000 calls to sched_yield()
+        empty       An empty region, showing the cost of the
+                    instrumentation itself
+
+   The per-region summary is printed to stderr on exit.
+
+   This program is Linux-specific.
+*/
+#include <sched.h>
+#include <stdint.h>
+#include "perf_counters.h"
+#include "tlpi_hdr.h"
+
+PC_REGION(seq_sum);
+PC_REGION(rand_sum);
+PC_REGION(sorted_br);
+PC_REGION(random_br);
+PC_REGION(yield);
+PC_REGION(empty);
+
+static volatile uint64_t sink;          /* Defeat the optimizer */
+
+static int
+cmpU32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint32_t *arr, *sorted, *idx;
+    uint64_t sum;
+    size_t n, j;
+    int opt, flags, loops, k;
+
+    flags = PC_DEFAULT;
+    loops = 10;
+    n = 65536 * 1024 / sizeof(uint32_t);
+    while ((opt = getopt(argc, argv, "akrn:s:")) != -1) {
+        switch (opt) {
+        case 'a': flags |= PC_ALL;                                      break;
+        case 'k': flags |= PC_KERNEL;                                   break;
+        case 'r': flags |= PC_NO_RDPMC;                                 break;
+        case 'n': loops = getInt(optarg, GN_GT_0, "-n");                break;
+        case 's': n = getLong(optarg, GN_GT_0, "-s") * 1024 /
+                      sizeof(uint32_t);                                 break;
+        default:
+            usageErr("%s [-a] [-k] [-r] [-n loops] [-s array-kB]\n",
+                     argv[0]);
+        }
+    }
+
+    if (pcInit(flags) == -1)
+        fprintf(stderr, "No counters could be opened; "
+                "only times will be reported\n");
+    printf("Counters read with %s\n", pcUsingRdpmc() ? "RDPMC" : "read()");
+
+    arr = malloc(n * sizeof(uint32_t));
+    sorted = malloc(n * sizeof(uint32_t));
+    idx = malloc(n * sizeof(uint32_t));
+    if (arr == NULL || sorted == NULL || idx == NULL)
+        errExit("malloc");
+
+    srandom(1);
+    for (j = 0; j < n; j++) {
+        arr[j] = random();
+        sorted[j] = arr[j];
+        idx[j] = ((uint64_t) random() << 16 ^ random()) % n;
+    }
+    qsort(sorted, n, sizeof(uint32_t), cmpU32);
+
+    for (k = 0; k < loops; k++) {
+        PC_START(seq_sum);
+        for (sum = 0, j = 0; j < n; j++)
+            sum += arr[j];
+        PC_STOP(seq_sum);
+        sink = sum;
+
+        PC_START(rand_sum);
+        for (sum = 0, j = 0; j < n; j++)
+            sum += arr[idx[j]];
+        PC_STOP(rand_sum);
+        sink = sum;
+
+        PC_START(sorted_br);
+        for (sum = 0, j = 0; j < n; j++)
+            if (sorted[j] < RAND_MAX / 2)
+                sum += sorted[j];
+        PC_STOP(sorted_br);
+        sink = sum;
+
+        PC_START(random_br);
+        for (sum = 0, j = 0; j < n; j++)
+            if (arr[j] < RAND_MAX / 2)
+                sum += arr[j];
+        PC_STOP(random_br);
+        sink = sum;
+
+        PC_START(yield);
+        for (j = 0; j < 1000; j++)
+            sched_yield();
+        PC_STOP(yield);
+    }
+
+    for (k = 0; k < 100000; k++) {
+        PC_START(empty);
+        PC_STOP(empty);
+    }
+
+    exit(EXIT_SUCCESS);         /* Summary is printed by an exit handler */
+}
@@ -0,0 +1,928 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 10 */
+
+/* time_conv.c
+
+   Fast conversions between time_t values and strings, for programs (such
+   as log processors) that convert many timestamps with the same format.
+
+   strftime() and strptime() interpret the format string on every call,
+   and localtime_r() and mktime() must find the UTC offset in force at the
+   given time in the timezone rules, each time. This module instead:
+
+   - compiles a format once (tcCompile()) into a list of operations, which
+     tcFormat() and tcParse() then execute. The month and day names, and
+     the expansions of %c, %x, %X, and %r, are those of the locale when
+     the format was compiled.
+
+   - converts between days since the Epoch and the civil (Gregorian)
+     date with the arithmetic algorithms described by Howard Hinnant
+     ("chrono-Compatible Low-Level Date Algorithms"), with no loops or
+     tables (tcGmtime() and tcTimegm()).
+
+   - caches, for each thread, the UTC offset of the local timezone. The
+     cache holds the offset for each of the most recently used days,
+     obtained by calling localtime_r() for the first and last seconds of
+     the day; so, timestamps that are close together (as they are in a
+     log) are converted to local time (tcLocaltime()), and from local
+     time (tcTimelocal()), by adding or subtracting a cached offset. For
+     a day during which the offset changes, a second cache holds the
+     offset for each 15-minute interval, obtained in the same way; times
+     in the interval during which the offset changes are converted by
+     localtime_r() or mktime(). (The offsets are obtained from the C
+     library, rather than by parsing the timezone files ourselves, so
+     that they are right for every form of TZ, including times after the
+     last transition listed in the file, which are described by a rule.)
+
+   tcLocaltime() and tcTimelocal() assume that the offset doesn't change
+   more than once in a day. For a local time that occurs twice (when
+   clocks go back), tcTimelocal() may choose the other of the two times
+   than mktime() does; for a local time that doesn't exist (when clocks go
+   forward), it calls mktime(). If TZ is changed, tcTzReset() must be
+   called (in each thread that converts times) to discard the cache.
+
+   The following conversions are supported, with the same meaning as for
+   strftime() and strptime():
+
+        %a %A %b %B %c %C %d %D %e %F %h %H %I %j %m %M %n %p %r %R %s
+        %S %t %T %u %w %x %X %y %Y %z %Z %%
+
+   (the E and O modifiers are accepted, and ignored), and, in addition,
+   %f, which is the fraction of the second as 6 digits (microseconds), or
+   %<n>f, for 'n' (1 to 9) digits. When parsing, %f accepts 1 to 9
+   digits, a white-space character in the format matches zero or more
+   white-space characters, %Z skips a timezone abbreviation (but doesn't
+   use it), %z accepts "Z" or an offset of the form +hh, +hhmm, or +hh:mm,
+   and numeric fields may have fewer digits than their usual width.
+   Times are interpreted as local time unless the format includes %s or
+   %z, or was compiled with TC_UTC.
+*/
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <langinfo.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include "time_conv.h"          /* Declares functions defined here */
+
+#define MAX_DEPTH 3             /* Nesting of %c, %F, etc. */
+#define MAX_NUM 24              /* Longest formatted number */
+
+#define SLOT_SECS 900           /* Interval covered by an entry in the
+                                   cache for days with a change */
+#define NUM_SLOTS 256           /* Entries in each offset cache */
+
+#define SECS_PER_DAY 86400
+
+enum opType {
+    OP_LIT, OP_YEAR, OP_CENT, OP_YEAR2, OP_MON, OP_MDAY, OP_MDAY_SP,
+    OP_HOUR, OP_HOUR12, OP_MIN, OP_SEC, OP_YDAY, OP_WDAY, OP_WDAY1,
+    OP_MON_NAME, OP_MON_FULL, OP_DAY_NAME, OP_DAY_FULL, OP_AMPM,
+    OP_TZOFF, OP_TZNAME, OP_EPOCH, OP_FRAC
+};
+
+struct tcOp {
+    enum opType type;
+    int width;                  /* Digits, for OP_FRAC */
+    size_t off, len;            /* Text in 'lit', for OP_LIT */
+};
+
+struct tzSlot {                 /* Cached UTC offset for an interval */
+    int valid;
+    int uniform;                /* Offset is the same for whole interval */
+    time_t slot;                /* Start time / length of interval */
+    long gmtoff;
+    int isdst;
+    const char *zone;
+};
+
+static __thread struct tzSlot dayCache[NUM_SLOTS];
+static __thread struct tzSlot slotCache[NUM_SLOTS];
+
+static const long powTen[] = { 1, 10, 100, 1000, 10000, 100000, 1000000,
+                               10000000, 100000000, 1000000000 };
+
+/* Days since 1970-01-01 of the Gregorian date 'y'-'m'-'d' (m is 1 to 12) */
+
+static long
+daysFromCivil(long y, int m, int d)
+{
+    long era, yoe, doy, doe;
+
+    y -= (m <= 2);
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = y - era * 400;                                /* [0, 399] */
+    doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;  /* [0, 365] */
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;        /* [0, 146096] */
+    return era * 146097 + doe - 719468;
+}
+
+/* The inverse of daysFromCivil() */
+
+static void
+civilFromDays(long z, long *y, int *m, int *d)
+{
+    long era, doe, yoe, doy, mp;
+
+    z += 719468;
+    era = (z >= 0 ? z : z - 146096) / 146097;
+    doe = z - era * 146097;                             /* [0, 146096] */
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);      /* [0, 365] */
+    mp = (5 * doy + 2) / 153;                           /* [0, 11] */
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = yoe + era * 400 + (*m <= 2);
+}
+
+/* Fill in the date and time fields of 'tm' from 't', which is taken to
+   be UTC; the other fields are left to the caller */
+
+static int
+fillTm(time_t t, struct tm *tm)
+{
+    long days, secs, y;
+    int m, d;
+
+    days = t / SECS_PER_DAY;
+    secs = t % SECS_PER_DAY;
+    if (secs < 0) {
+        secs += SECS_PER_DAY;
+        days--;
+    }
+    civilFromDays(days, &y, &m, &d);
+    if (y - 1900 > INT_MAX || y - 1900 < INT_MIN) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    tm->tm_year = y - 1900;
+    tm->tm_mon = m - 1;
+    tm->tm_mday = d;
+    tm->tm_hour = secs / 3600;
+    tm->tm_min = secs / 60 % 60;
+    tm->tm_sec = secs % 60;
+    tm->tm_wday = (days % 7 + 11) % 7;          /* 1970-01-01 was Thursday */
+    tm->tm_yday = days - daysFromCivil(y, 1, 1);
+    return 0;
+}
+
+/* Like gmtime_r() */
+
+struct tm *
+tcGmtime(time_t t, struct tm *tm)
+{
+    if (fillTm(t, tm) == -1)
+        return NULL;
+    tm->tm_isdst = 0;
+    tm->tm_gmtoff = 0;
+    tm->tm_zone = "GMT";
+    return tm;
+}
+
+/* Like timegm(): the fields of 'tm' may be outside their usual ranges,
+   but 'tm' is not modified */
+
+time_t
+tcTimegm(const struct tm *tm)
+{
+    long y, m;
+
+    y = tm->tm_year + 1900L + tm->tm_mon / 12;
+    m = tm->tm_mon % 12;
+    if (m < 0) {
+        m += 12;
+        y--;
+    }
+    return (time_t) (daysFromCivil(y, m + 1, 1) + tm->tm_mday - 1) *
+           SECS_PER_DAY + tm->tm_hour * 3600L + tm->tm_min * 60L +
+           tm->tm_sec;
+}
+
+/* Discard the calling thread's cache of UTC offsets, and reread TZ */
+
+void
+tcTzReset(void)
+{
+    tzset();
+    memset(dayCache, 0, sizeof(dayCache));
+    memset(slotCache, 0, sizeof(slotCache));
+}
+
+/* Return the entry in 'cache' for the interval of 'secs' seconds that
+   contains 't', filling it in if necessary */
+
+static const struct tzSlot *
+cacheLookup(struct tzSlot *cache, time_t t, long secs)
+{
+    struct tzSlot *e;
+    struct tm a, b;
+    time_t s, t0, t1;
+
+    s = t / secs - (t % secs < 0);
+    e = &cache[(unsigned long) s % NUM_SLOTS];
+    if (e->valid && e->slot == s)
+        return e;
+
+    t0 = s * secs;
+    t1 = t0 + secs - 1;
+    if (localtime_r(&t0, &a) == NULL || localtime_r(&t1, &b) == NULL)
+        return NULL;
+
+    e->valid = 1;
+    e->slot = s;
+    e->gmtoff = a.tm_gmtoff;
+    e->isdst = a.tm_isdst;
+    e->zone = a.tm_zone;
+    e->uniform = a.tm_gmtoff == b.tm_gmtoff && a.tm_isdst == b.tm_isdst &&
+                 strcmp(a.tm_zone, b.tm_zone) == 0;
+    return e;
+}
+
+/* Return the cache entry for the day, or, if the offset changes during
+   the day, the 15-minute interval, that contains 't' */
+
+static const struct tzSlot *
+tzLookup(time_t t)
+{
+    const struct tzSlot *e;
+
+    e = cacheLookup(dayCache, t, SECS_PER_DAY);
+    if (e == NULL || e->uniform)
+        return e;
+    return cacheLookup(slotCache, t, SLOT_SECS);
+}
+
+/* Like localtime_r() */
+
+struct tm *
+tcLocaltime(time_t t, struct tm *tm)
+{
+    const struct tzSlot *e;
+
+    e = tzLookup(t);
+    if (e == NULL)
+        return NULL;
+    if (!e->uniform)
+        return localtime_r(&t, tm);
+
+    if (fillTm(t + e->gmtoff, tm) == -1)
+        return NULL;
+    tm->tm_isdst = e->isdst;
+    tm->tm_gmtoff = e->gmtoff;
+    tm->tm_zone = e->zone;
+    return tm;
+}
+
+/* Return (via 'off') the UTC offset at time 't' */
+
+static int
+offsetAt(time_t t, long *off)
+{
+    const struct tzSlot *e;
+    struct tm tm;
+
+    e = tzLookup(t);
+    if (e == NULL)
+        return -1;
+    if (e->uniform) {
+        *off = e->gmtoff;
+    } else {
+        if (localtime_r(&t, &tm) == NULL)
+            return -1;
+        *off = tm.tm_gmtoff;
+    }
+    return 0;
+}
+
+/* Convert 'local' (a local time, expressed as seconds since the Epoch as
+   if the local time were UTC) to a time_t, returned via 't' */
+
+static int
+fromLocal(time_t local, time_t *t)
+{
+    struct tm tm;
+    long off1, off2, off3;
+
+    /* Guess the offset, and check that the guess is consistent; if not,
+       try the offset in force at the first guess */
+
+    if (offsetAt(local, &off1) == -1)
+        return -1;
+    *t = local - off1;
+    if (offsetAt(*t, &off2) == -1)
+        return -1;
+    if (off2 == off1)
+        return 0;
+    *t = local - off2;
+    if (offsetAt(*t, &off3) == -1)
+        return -1;
+    if (off3 == off2)
+        return 0;
+
+    /* 'local' doesn't exist (the clocks went forward); let mktime()
+       decide what it means */
+
+    if (tcGmtime(local, &tm) == NULL)
+        return -1;
+    tm.tm_isdst = -1;
+    errno = 0;
+    *t = mktime(&tm);
+    return (*t == -1 && errno != 0) ? -1 : 0;
+}
+
+/* Like mktime(), but with 'tm->tm_isdst' taken as -1, and without
+   modifying 'tm' */
+
+time_t
+tcTimelocal(const struct tm *tm)
+{
+    time_t t;
+
+    return (fromLocal(tcTimegm(tm), &t) == -1) ? (time_t) -1 : t;
+}
+
+/* Append an operation to 'tf' (merging adjacent literal text) */
+
+static int
+addOp(struct timeFmt *tf, enum opType type, int width, const char *lit,
+      size_t len)
+{
+    struct tcOp *op;
+    void *p;
+
+    if (type == OP_LIT) {
+        if (tf->litLen + len > tf->maxLit) {
+            p = realloc(tf->lit, 2 * (tf->litLen + len));
+            if (p == NULL)
+                return -1;
+            tf->lit = p;
+            tf->maxLit = 2 * (tf->litLen + len);
+        }
+        memcpy(tf->lit + tf->litLen, lit, len);
+
+        if (tf->nops > 0) {
+            op = &tf->ops[tf->nops - 1];
+            if (op->type == OP_LIT && op->off + op->len == tf->litLen) {
+                op->len += len;
+                tf->litLen += len;
+                return 0;
+            }
+        }
+    }
+
+    if (tf->nops == tf->maxOps) {
+        p = realloc(tf->ops, 2 * (tf->maxOps + 4) * sizeof(struct tcOp));
+        if (p == NULL)
+            return -1;
+        tf->ops = p;
+        tf->maxOps = 2 * (tf->maxOps + 4);
+    }
+
+    op = &tf->ops[tf->nops++];
+    op->type = type;
+    op->width = width;
+    op->off = tf->litLen;
+    op->len = (type == OP_LIT) ? len : 0;
+    if (type == OP_LIT)
+        tf->litLen += len;
+    return 0;
+}
+
+static int
+compile(struct timeFmt *tf, const char *format, int depth)
+{
+    const char *p, *q, *sub;
+    enum opType type;
+    int width;
+
+    if (depth > MAX_DEPTH) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (p = format; *p != '\0'; p++) {
+        if (*p != '%') {
+            for (q = p; q[1] != '\0' && q[1] != '%'; q++)
+                continue;
+            if (addOp(tf, OP_LIT, 0, p, q - p + 1) == -1)
+                return -1;
+            p = q;
+            continue;
+        }
+
+        p++;
+        width = 6;
+        if (*p >= '1' && *p <= '9' && p[1] == 'f')
+            width = *p++ - '0';
+        if (*p == 'E' || *p == 'O')
+            p++;
+
+        sub = NULL;
+        type = OP_LIT;
+        switch (*p) {
+        case 'Y': type = OP_YEAR;               break;
+        case 'C': type = OP_CENT;               break;
+        case 'y': type = OP_YEAR2;              break;
+        case 'm': type = OP_MON;                break;
+        case 'd': type = OP_MDAY;               break;
+        case 'e': type = OP_MDAY_SP;            break;
+        case 'H': type = OP_HOUR;               break;
+        case 'I': type = OP_HOUR12;             break;
+        case 'M': type = OP_MIN;                break;
+        case 'S': type = OP_SEC;                break;
+        case 'j': type = OP_YDAY;               break;
+        case 'w': type = OP_WDAY;               break;
+        case 'u': type = OP_WDAY1;              break;
+        case 'b':
+        case 'h': type = OP_MON_NAME;           break;
+        case 'B': type = OP_MON_FULL;           break;
+        case 'a': type = OP_DAY_NAME;           break;
+        case 'A': type = OP_DAY_FULL;           break;
+        case 'p': type = OP_AMPM;               break;
+        case 'z': type = OP_TZOFF;              break;
+        case 'Z': type = OP_TZNAME;             break;
+        case 's': type = OP_EPOCH;              break;
+        case 'f': type = OP_FRAC;               break;
+        case 'F': sub = "%Y-%m-%d";             break;
+        case 'T': sub = "%H:%M:%S";             break;
+        case 'D': sub = "%m/%d/%y";             break;
+        case 'R': sub = "%H:%M";                break;
+        case 'c': sub = nl_langinfo(D_T_FMT);   break;
+        case 'x': sub = nl_langinfo(D_FMT);     break;
+        case 'X': sub = nl_langinfo(T_FMT);     break;
+        case 'r': sub = nl_langinfo(T_FMT_AMPM);        break;
+        case 'n': sub = "\n";                   break;
+        case 't': sub = "\t";                   break;
+        case '%':
+            if (addOp(tf, OP_LIT, 0, "%", 1) == -1)
+                return -1;
+            continue;
+        default:                        /* Includes '\0' */
+            errno = EINVAL;
+            return -1;
+        }
+
+        if (sub != NULL) {
+            if (compile(tf, sub, depth + 1) == -1)
+                return -1;
+        } else {
+            if (addOp(tf, type, width, NULL, 0) == -1)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+static void
+copyName(char *dst, nl_item item)
+{
+    snprintf(dst, TC_NAME_LEN, "%s", nl_langinfo(item));
+}
+
+/* Compile 'format'; 'flags' is zero or TC_UTC. Returns NULL on error
+   (with errno set to EINVAL if the format contains an unsupported
+   conversion). */
+
+struct timeFmt *
+tcCompile(const char *format, int flags)
+{
+    static const nl_item monItems[] = { ABMON_1, ABMON_2, ABMON_3,
+        ABMON_4, ABMON_5, ABMON_6, ABMON_7, ABMON_8, ABMON_9, ABMON_10,
+        ABMON_11, ABMON_12 };
+    static const nl_item monFullItems[] = { MON_1, MON_2, MON_3, MON_4,
+        MON_5, MON_6, MON_7, MON_8, MON_9, MON_10, MON_11, MON_12 };
+    static const nl_item dayItems[] = { ABDAY_1, ABDAY_2, ABDAY_3,
+        ABDAY_4, ABDAY_5, ABDAY_6, ABDAY_7 };
+    static const nl_item dayFullItems[] = { DAY_1, DAY_2, DAY_3, DAY_4,
+        DAY_5, DAY_6, DAY_7 };
+    struct timeFmt *tf;
+    int j;
+
+    tf = calloc(1, sizeof(struct timeFmt));
+    if (tf == NULL)
+        return NULL;
+    tf->flags = flags;
+
+    if (compile(tf, format, 0) == -1) {
+        tcFree(tf);
+        return NULL;
+    }
+
+    for (j = 0; j < 12; j++) {
+        copyName(tf->mon[j], monItems[j]);
+        copyName(tf->monFull[j], monFullItems[j]);
+    }
+    for (j = 0; j < 7; j++) {
+        copyName(tf->day[j], dayItems[j]);
+        copyName(tf->dayFull[j], dayFullItems[j]);
+    }
+    copyName(tf->ampm[0], AM_STR);
+    copyName(tf->ampm[1], PM_STR);
+
+    return tf;
+}
+
+void
+tcFree(struct timeFmt *tf)
+{
+    if (tf == NULL)
+        return;
+    free(tf->ops);
+    free(tf->lit);
+    free(tf);
+}
+
+/* Write 'v' (>= 0) as exactly 'width' digits */
+
+static char *
+putDigits(char *p, unsigned long v, int width)
+{
+    int j;
+
+    for (j = width - 1; j >= 0; j--) {
+        p[j] = '0' + v % 10;
+        v /= 10;
+    }
+    return p + width;
+}
+
+static char *
+putLong(char *p, long v)
+{
+    char tmp[MAX_NUM];
+    unsigned long u;
+    int n;
+
+    u = (v < 0) ? -(unsigned long) v : (unsigned long) v;
+    n = 0;
+    do {
+        tmp[n++] = '0' + u % 10;
+        u /= 10;
+    } while (u != 0);
+    if (v < 0)
+        *p++ = '-';
+    while (n > 0)
+        *p++ = tmp[--n];
+    return p;
+}
+
+static char *
+putStr(char *p, const char *s)
+{
+    size_t len;
+
+    len = strlen(s);
+    memcpy(p, s, len);
+    return p + len;
+}
+
+/* Format the time 'ts' according to 'tf' into 'buf' (of 'size' bytes),
+   with a terminating null byte. Returns the length of the string, or -1
+   on error (with errno set to ERANGE if the string doesn't fit). */
+
+ssize_t
+tcFormat(const struct timeFmt *tf, const struct timespec *ts, char *buf,
+         size_t size)
+{
+    const struct tcOp *op, *end;
+    struct tm tm, *tmp;
+    size_t need;
+    long y, off;
+    char *p;
+
+    tmp = (tf->flags & TC_UTC) ? tcGmtime(ts->tv_sec, &tm) :
+                                 tcLocaltime(ts->tv_sec, &tm);
+    if (tmp == NULL)
+        return -1;
+    y = tm.tm_year + 1900L;
+
+    p = buf;
+    end = tf->ops + tf->nops;
+    for (op = tf->ops; op < end; op++) {
+        need = (op->type == OP_LIT) ? op->len :
+               (op->type == OP_TZNAME) ? strlen(tm.tm_zone) :
+               (op->type >= OP_MON_NAME && op->type <= OP_AMPM) ?
+                        TC_NAME_LEN : MAX_NUM;
+        if (need >= size - (p - buf)) {
+            errno = ERANGE;
+            return -1;
+        }
+
+        switch (op->type) {
+        case OP_LIT:
+            memcpy(p, tf->lit + op->off, op->len);
+            p += op->len;
+            break;
+        case OP_YEAR:
+            p = (y >= 0 && y <= 9999) ? putDigits(p, y, 4) : putLong(p, y);
+            break;
+        case OP_CENT:
+            p = putDigits(p, (y >= 0) ? y / 100 : 0, 2);
+            break;
+        case OP_YEAR2:
+            p = putDigits(p, (y % 100 + 100) % 100, 2);
+            break;
+        case OP_MON:    p = putDigits(p, tm.tm_mon + 1, 2);     break;
+        case OP_MDAY:   p = putDigits(p, tm.tm_mday, 2);        break;
+        case OP_MDAY_SP:
+            if (tm.tm_mday < 10)
+                *p++ = ' ';
+            p = putLong(p, tm.tm_mday);
+            break;
+        case OP_HOUR:   p = putDigits(p, tm.tm_hour, 2);        break;
+        case OP_HOUR12:
+            p = putDigits(p, (tm.tm_hour % 12 == 0) ? 12 : tm.tm_hour % 12,
+                          2);
+            break;
+        case OP_MIN:    p = putDigits(p, tm.tm_min, 2);         break;
+        case OP_SEC:    p = putDigits(p, tm.tm_sec, 2);         break;
+        case OP_YDAY:   p = putDigits(p, tm.tm_yday + 1, 3);    break;
+        case OP_WDAY:   p = putDigits(p, tm.tm_wday, 1);        break;
+        case OP_WDAY1:
+            p = putDigits(p, (tm.tm_wday == 0) ? 7 : tm.tm_wday, 1);
+            break;
+        case OP_MON_NAME:  p = putStr(p, tf->mon[tm.tm_mon]);           break;
+        case OP_MON_FULL:  p = putStr(p, tf->monFull[tm.tm_mon]);       break;
+        case OP_DAY_NAME:  p = putStr(p, tf->day[tm.tm_wday]);          break;
+        case OP_DAY_FULL:  p = putStr(p, tf->dayFull[tm.tm_wday]);      break;
+        case OP_AMPM:      p = putStr(p, tf->ampm[tm.tm_hour >= 12]);   break;
+        case OP_TZOFF:
+            off = tm.tm_gmtoff;
+            *p++ = (off < 0) ? '-' : '+';
+            off = (off < 0) ? -off : off;
+            p = putDigits(p, off / 3600 * 100 + off / 60 % 60, 4);
+            break;
+        case OP_TZNAME: p = putStr(p, tm.tm_zone);              break;
+        case OP_EPOCH:  p = putLong(p, ts->tv_sec);             break;
+        case OP_FRAC:
+            p = putDigits(p, ts->tv_nsec / powTen[9 - op->width], op->width);
+            break;
+        }
+    }
+
+    *p = '\0';
+    return p - buf;
+}
+
+/* Read from 1 to 'maxDigits' digits at '*pp', advancing '*pp' */
+
+static int
+getDigits(const char **pp, const char *end, int maxDigits, long *v)
+{
+    const char *p;
+
+    *v = 0;
+    for (p = *pp; p < end && p - *pp < maxDigits && isdigit((unsigned char) *p);
+            p++)
+        *v = *v * 10 + (*p - '0');
+    if (p == *pp)
+        return -1;
+    *pp = p;
+    return 0;
+}
+
+/* Match one of the 'n' names in 'names' (case-insensitively) at '*pp',
+   advancing '*pp'. Returns the index of the longest name matched. */
+
+static int
+getName(const char **pp, const char *end, const char (*names)[TC_NAME_LEN],
+        int n, int best, size_t *bestLen)
+{
+    size_t len;
+    int j, c;
+
+    if (*pp == end)
+        return best;
+    c = tolower((unsigned char) **pp);
+    for (j = 0; j < n; j++) {
+        if (tolower((unsigned char) names[j][0]) != c)
+            continue;           /* Quick check of first character */
+        len = strlen(names[j]);
+        if (len > *bestLen && len <= (size_t) (end - *pp) &&
+                strncasecmp(*pp, names[j], len) == 0) {
+            best = j;
+            *bestLen = len;
+        }
+    }
+    return best;
+}
+
+static int
+matchName(const char **pp, const char *end,
+          const char (*abbr)[TC_NAME_LEN], const char (*full)[TC_NAME_LEN],
+          int n, long *v)
+{
+    size_t len;
+    int best;
+
+    len = 0;
+    best = getName(pp, end, full, n, -1, &len);
+    best = getName(pp, end, abbr, n, best, &len);
+    if (best == -1)
+        return -1;
+    *pp += len;
+    *v = best;
+    return 0;
+}
+
+/* Parse the time at the start of the 'len' bytes at 's' (which need not
+   be null-terminated) according to 'tf', returning it via 'ts'. If
+   'used' is NULL, all 'len' bytes must match the format; otherwise,
+   trailing bytes are allowed, and the number of bytes that matched is
+   returned in '*used'. Fields that are not in the format default to the
+   start of the day, month, or year, or 1970. Returns 0 on success, or
+   -1 (with errno set to EINVAL) if the string doesn't match the format. */
+
+int
+tcParse(const struct timeFmt *tf, const char *s, size_t len,
+        struct timespec *ts, size_t *used)
+{
+    const struct tcOp *op, *opEnd;
+    const char *p, *end, *l;
+    long year, cent, year2, mon, mday, hour, min, sec, yday, nsec, off;
+    long v, sign, pm, days;
+    int haveCent, haveYear2, haveDate, haveYday, have12, haveOff,
+        haveEpoch, ok;
+    time_t local, epoch;
+    size_t j;
+
+    year = 1970;
+    mon = mday = 1;
+    hour = min = sec = yday = nsec = off = cent = year2 = 0;
+    pm = -1;
+    epoch = 0;
+    haveCent = haveYear2 = haveDate = haveYday = have12 = haveOff = 0;
+    haveEpoch = 0;
+
+    p = s;
+    end = s + len;
+    opEnd = tf->ops + tf->nops;
+    for (op = tf->ops; op < opEnd; op++) {
+        ok = 0;
+        switch (op->type) {
+        case OP_LIT:
+            l = tf->lit + op->off;
+            for (j = 0; j < op->len; j++) {
+                if (isspace((unsigned char) l[j])) {
+                    while (p < end && isspace((unsigned char) *p))
+                        p++;
+                } else {
+                    if (p == end || *p != l[j])
+                        goto fail;
+                    p++;
+                }
+            }
+            break;
+        case OP_YEAR:   ok = getDigits(&p, end, 4, &year);      break;
+        case OP_CENT:
+            ok = getDigits(&p, end, 2, &cent);
+            haveCent = 1;
+            break;
+        case OP_YEAR2:
+            ok = getDigits(&p, end, 2, &year2);
+            haveYear2 = 1;
+            break;
+        case OP_MON:
+            ok = getDigits(&p, end, 2, &mon);
+            haveDate = 1;
+            break;
+        case OP_MDAY_SP:
+            if (p < end && *p == ' ')
+                p++;
+            /* FALLTHROUGH */
+        case OP_MDAY:
+            ok = getDigits(&p, end, 2, &mday);
+            haveDate = 1;
+            break;
+        case OP_HOUR:   ok = getDigits(&p, end, 2, &hour);      break;
+        case OP_HOUR12:
+            ok = getDigits(&p, end, 2, &hour);
+            ok = (ok == 0 && hour >= 1 && hour <= 12) ? 0 : -1;
+            have12 = 1;
+            break;
+        case OP_MIN:    ok = getDigits(&p, end, 2, &min);       break;
+        case OP_SEC:    ok = getDigits(&p, end, 2, &sec);       break;
+        case OP_YDAY:
+            ok = getDigits(&p, end, 3, &yday);
+            haveYday = 1;
+            break;
+        case OP_WDAY:
+        case OP_WDAY1:
+            ok = getDigits(&p, end, 1, &v);     /* Ignored */
+            break;
+        case OP_MON_NAME:
+        case OP_MON_FULL:
+            ok = matchName(&p, end, tf->mon, tf->monFull, 12, &mon);
+            mon++;
+            haveDate = 1;
+            break;
+        case OP_DAY_NAME:
+        case OP_DAY_FULL:
+            ok = matchName(&p, end, tf->day, tf->dayFull, 7, &v);
+            break;
+        case OP_AMPM:
+            ok = matchName(&p, end, tf->ampm, tf->ampm, 2, &pm);
+            break;
+        case OP_TZOFF:
+            haveOff = 1;
+            if (p < end && *p == 'Z') {
+                p++;
+                off = 0;
+                break;
+            }
+            if (p == end || (*p != '+' && *p != '-'))
+                goto fail;
+            sign = (*p++ == '-') ? -1 : 1;
+            if (end - p < 2 || getDigits(&p, p + 2, 2, &v) == -1 ||
+                    v > 24)
+                goto fail;
+            off = v * 3600;
+            if (p < end && *p == ':')
+                p++;
+            if (end - p >= 2 && isdigit((unsigned char) *p)) {
+                if (getDigits(&p, p + 2, 2, &v) == -1 || v > 59)
+                    goto fail;
+                off += v * 60;
+            }
+            off *= sign;
+            break;
+        case OP_TZNAME:
+            while (p < end && !isspace((unsigned char) *p))
+                p++;
+            break;
+        case OP_EPOCH:
+            sign = (p < end && *p == '-') ? -1 : 1;
+            if (sign == -1)
+                p++;
+            if (p == end || !isdigit((unsigned char) *p))
+                goto fail;
+            for (epoch = 0; p < end && isdigit((unsigned char) *p); p++) {
+                if (epoch > (LONG_MAX - 9) / 10)
+                    goto fail;
+                epoch = epoch * 10 + (*p - '0');
+            }
+            epoch *= sign;
+            haveEpoch = 1;
+            break;
+        case OP_FRAC:
+            l = p;
+            ok = getDigits(&p, end, 9, &nsec);
+            if (ok == 0)
+                nsec *= powTen[9 - (p - l)];
+            break;
+        }
+        if (ok == -1)
+            goto fail;
+    }
+
+    if (used != NULL)
+        *used = p - s;
+    else if (p != end)
+        goto fail;
+
+    if (mon < 1 || mon > 12 || mday < 1 || mday > 31 || hour > 24 ||
+            min > 59 || sec > 60 || (haveYday && (yday < 1 || yday > 366)))
+        goto fail;
+
+    if (haveYear2)              /* As for strptime() */
+        year = haveCent ? cent * 100 + year2 :
+               (year2 < 69) ? 2000 + year2 : 1900 + year2;
+    else if (haveCent)
+        year = cent * 100 + year % 100;
+    if (have12)
+        hour = hour % 12 + (pm == 1 ? 12 : 0);
+
+    if (haveYday && !haveDate)
+        days = daysFromCivil(year, 1, 1) + yday - 1;
+    else
+        days = daysFromCivil(year, mon, mday);
+    local = (time_t) days * SECS_PER_DAY + hour * 3600 + min * 60 + sec;
+
+    if (haveEpoch)
+        ts->tv_sec = epoch;
+    else if (haveOff)
+        ts->tv_sec = local - off;
+    else if (tf->flags & TC_UTC)
+        ts->tv_sec = local;
+    else if (fromLocal(local, &ts->tv_sec) == -1)
+        return -1;
+    ts->tv_nsec = nsec;
+    return 0;
+
+fail:
+    errno = EINVAL;
+    return -1;
+}
@@ -0,0 +1,74 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 10 */
+
+/* time_conv.h
+
+   Header file for time_conv.c.
+
+   Time conversions for programs that convert many timestamps:
+
+        compile a format once:          tf = tcCompile(format, flags)
+        format a time:                  n = tcFormat(tf, &ts, buf, size)
+        parse a time:                   s = tcParse(tf, str, len, &ts,
+                                                    &used)
+        release the format:             tcFree(tf)
+
+   and replacements for gmtime_r(), localtime_r(), timegm(), and mktime():
+   tcGmtime(), tcLocaltime(), tcTimegm(), and tcTimelocal().
+*/
+#ifndef TIME_CONV_H
+#define TIME_CONV_H             /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+#include <time.h>
+
+#define TC_UTC          01      /* Format and parse times as UTC, rather
+                                   than as local time */
+
+#define TC_NAME_LEN     32      /* Longest month or day name, plus 1 */
+
+struct tcOp;
+
+struct timeFmt {
+    int flags;                  /* TC_* */
+    struct tcOp *ops;           /* The compiled format */
+    int nops, maxOps;
+    char *lit;                  /* Literal text of the format */
+    size_t litLen, maxLit;
+    char mon[12][TC_NAME_LEN];  /* Names in the locale when compiled */
+    char monFull[12][TC_NAME_LEN];
+    char day[7][TC_NAME_LEN];
+    char dayFull[7][TC_NAME_LEN];
+    char ampm[2][TC_NAME_LEN];
+};
+
+struct timeFmt *tcCompile(const char *format, int flags);
+
+void tcFree(struct timeFmt *tf);
+
+ssize_t tcFormat(const struct timeFmt *tf, const struct timespec *ts,
+                 char *buf, size_t size);
+
+int tcParse(const struct timeFmt *tf, const char *s, size_t len,
+            struct timespec *ts, size_t *used);
+
+struct tm *tcGmtime(time_t t, struct tm *tm);
+
+struct tm *tcLocaltime(time_t t, struct tm *tm);
+
+time_t tcTimegm(const struct tm *tm);
+
+time_t tcTimelocal(const struct tm *tm);
+
+void tcTzReset(void);
+
+#endif
@@ -0,0 +1,248 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 10 */
+
+/* time_conv_bench.c
+
+   Compare the cost of formatting and parsing timestamps with the C
+   library (localtime_r() and strftime(); strptime() and mktime()) and
+   with the functions in time_conv.c.
+
+   Usage: time_conv_bench [-n nstamps] [-s span-days] [-f format] [-u]
+
+        -n nstamps   Number of timestamps (default: 100000)
+        -s days      The timestamps are spread evenly over this many days,
+                     starting at 2023-01-01 00:00 UTC (default: 365, so
+                     that daylight saving time changes are included)
+        -f format    Format of the timestamps (default: "%F %T")
+        -u           Use UTC (gmtime_r() and timegm(), and TC_UTC),
+                     rather than local time
+
+   The program first checks that tcFormat() produces the same string as
+   strftime() for every timestamp (unless the format contains %f, which
+   strftime() doesn't support), and that tcParse() converts each string
+   back to the original timestamp (or to the time that strptime() and
+   mktime() produce for it, which can differ for a local time that occurs
+   twice). It then reports the cost of converting a timestamp with each
+   method, in the common format of lib/bench.c.
+
+   Try: ./time_conv_bench
+        TZ=America/New_York ./time_conv_bench -f '%a %b %e %r %Z %Y'
+        ./time_conv_bench -u -f '%Y-%m-%dT%H:%M:%S.%3fZ'
+*/
+#define _GNU_SOURCE
+#include <time.h>
+#include "time_conv.h"
+#include "bench.h"
+#include "tlpi_hdr.h"
+
+#define STR_SIZE 128
+
+static long nstamps;
+static struct timespec *stamps;
+static char (*strs)[STR_SIZE];  /* Formatted timestamps */
+static const char *format;
+static struct timeFmt *tf;
+static Boolean utc;
+
+static volatile unsigned long sink;     /* Defeats dead code elimination */
+
+static void
+benchStrftime(long ops, void *arg)
+{
+    char buf[STR_SIZE];
+    unsigned long sum;
+    struct tm tm;
+    long j;
+
+    sum = 0;
+    for (j = 0; j < ops; j++) {
+        if (utc)
+            gmtime_r(&stamps[j % nstamps].tv_sec, &tm);
+        else
+            localtime_r(&stamps[j % nstamps].tv_sec, &tm);
+        sum += strftime(buf, STR_SIZE, format, &tm);
+    }
+    sink = sum;
+}
+
+static void
+benchTcFormat(long ops, void *arg)
+{
+    char buf[STR_SIZE];
+    unsigned long sum;
+    long j;
+
+    sum = 0;
+    for (j = 0; j < ops; j++)
+        sum += tcFormat(tf, &stamps[j % nstamps], buf, STR_SIZE);
+    sink = sum;
+}
+
+static void
+benchStrptime(long ops, void *arg)
+{
+    unsigned long sum;
+    struct tm tm;
+    long j;
+
+    sum = 0;
+    for (j = 0; j < ops; j++) {
+        memset(&tm, 0, sizeof(tm));
+        if (strptime(strs[j % nstamps], format, &tm) == NULL)
+            fatal("strptime() failed: %s", strs[j % nstamps]);
+        tm.tm_isdst = -1;
+        sum += utc ? timegm(&tm) : mktime(&tm);
+    }
+    sink = sum;
+}
+
+static void
+benchTcParse(long ops, void *arg)
+{
+    struct timespec ts;
+    unsigned long sum;
+    long j;
+
+    sum = 0;
+    for (j = 0; j < ops; j++) {
+        if (tcParse(tf, strs[j % nstamps], strlen(strs[j % nstamps]), &ts,
+                    NULL) == -1)
+            fatal("tcParse() failed: %s", strs[j % nstamps]);
+        sum += ts.tv_sec;
+    }
+    sink = sum;
+}
+
+/* Does 'fmt' contain %f or %<n>f? */
+
+static Boolean
+hasFrac(const char *fmt)
+{
+    for (; *fmt != '\0'; fmt++) {
+        if (*fmt != '%')
+            continue;
+        fmt++;
+        if (*fmt >= '1' && *fmt <= '9')
+            fmt++;
+        if (*fmt == 'f')
+            return TRUE;
+        if (*fmt == '\0')
+            break;
+    }
+    return FALSE;
+}
+
+/* Create the timestamps and their strings, checking that tcFormat() and
+   tcParse() agree with the C library */
+
+static void
+makeStamps(long spanDays)
+{
+    char buf[STR_SIZE];
+    struct timespec ts;
+    Boolean cmpLibc;
+    struct tm tm;
+    time_t libc;
+    long j;
+
+    stamps = calloc(nstamps, sizeof(struct timespec));
+    strs = calloc(nstamps, STR_SIZE);
+    if (stamps == NULL || strs == NULL)
+        errExit("calloc");
+
+    cmpLibc = !hasFrac(format);
+    for (j = 0; j < nstamps; j++) {
+        stamps[j].tv_sec = 1672531200 + spanDays * 86400 / nstamps * j;
+        stamps[j].tv_nsec = j * 7919 % 1000000000;
+
+        if (tcFormat(tf, &stamps[j], strs[j], STR_SIZE) == -1)
+            errExit("tcFormat");
+        if (cmpLibc) {
+            if (utc)
+                gmtime_r(&stamps[j].tv_sec, &tm);
+            else
+                localtime_r(&stamps[j].tv_sec, &tm);
+            if (strftime(buf, STR_SIZE, format, &tm) == 0)
+                fatal("strftime() failed");
+            if (strcmp(buf, strs[j]) != 0)
+                fatal("tcFormat() gave \"%s\"; strftime() gave \"%s\"",
+                      strs[j], buf);
+        }
+
+        if (tcParse(tf, strs[j], strlen(strs[j]), &ts, NULL) == -1)
+            errExit("tcParse %s", strs[j]);
+        if (ts.tv_sec == stamps[j].tv_sec)
+            continue;
+
+        memset(&tm, 0, sizeof(tm));
+        if (strptime(strs[j], format, &tm) == NULL)
+            fatal("strptime() failed: %s", strs[j]);
+        tm.tm_isdst = -1;
+        libc = utc ? timegm(&tm) : mktime(&tm);
+        if (ts.tv_sec != libc)
+            fatal("tcParse(\"%s\") gave %ld; expected %ld (or %ld)",
+                  strs[j], (long) ts.tv_sec, (long) stamps[j].tv_sec,
+                  (long) libc);
+    }
+}
+
+static void
+run(const char *name, benchFn fn)
+{
+    struct benchResult res;
+
+    if (benchRun(name, fn, NULL, nstamps, NULL, &res) == -1)
+        errExit("benchRun");
+    benchReport(&res);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long spanDays;
+    int opt;
+
+    nstamps = 100000;
+    spanDays = 365;
+    format = "%F %T";
+    utc = FALSE;
+    while ((opt = getopt(argc, argv, "n:s:f:u")) != -1) {
+        switch (opt) {
+        case 'n': nstamps = getLong(optarg, GN_GT_0, "-n");     break;
+        case 's': spanDays = getLong(optarg, GN_GT_0, "-s");    break;
+        case 'f': format = optarg;                              break;
+        case 'u': utc = TRUE;                                   break;
+        default:
+            usageErr("%s [-n nstamps] [-s span-days] [-f format] [-u]\n",
+                     argv[0]);
+        }
+    }
+
+    tzset();
+    tf = tcCompile(format, utc ? TC_UTC : 0);
+    if (tf == NULL)
+        errExit("tcCompile");
+
+    makeStamps(spanDays);
+    printf("%ld timestamps over %ld days, from \"%s\" to \"%s\"\n",
+           nstamps, spanDays, strs[0], strs[nstamps - 1]);
+
+    run(utc ? "gmtime_r+strftime" : "localtime_r+strftime",
+        benchStrftime);
+    run("tcFormat", benchTcFormat);
+    if (!hasFrac(format))
+        run(utc ? "strptime+timegm" : "strptime+mktime", benchStrptime);
+    run("tcParse", benchTcParse);
+
+    tcFree(tf);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,409 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* cpu_load_gen.c
+
+   A CPU load generator: each thread consumes a target percentage of a
+   CPU, and the program periodically reports the CPU time that each
+   thread actually got, and how long it spent waiting to run.
+
+   Usage: cpu_load_gen [-d secs] [-r secs] [-p msecs] [-c cpu,...]
+                       [-g cgroup-dir] util...
+
+        util        For each argument, create a thread that aims to
+                    consume 'util' percent (0 to 100) of a CPU
+        -d secs     Run for 'secs' seconds (default: 10)
+        -r secs     Report every 'secs' seconds (default: 1)
+        -p msecs    Duty-cycle period (default: 100): in each period, a
+                    thread burns CPU until it has consumed its share of
+                    the period, and then sleeps until the next period
+        -c cpu,...  Pin thread N to the Nth CPU in the list (cyclically)
+        -g dir      Move the process into the cgroup v2 directory 'dir'
+                    and also report the throttling statistics from its
+                    cpu.stat (e.g., to test a limit set in cpu.max)
+
+   Unlike cpu_multithread_burner.c, whose threads call clock_gettime()
+   after every few thousand instructions, the threads burn CPU in chunks
+   that are calibrated at startup to take about 50 microseconds, and
+   check their CPU time (CLOCK_THREAD_CPUTIME_ID) only between chunks.
+   If a thread has not received its share by the end of a period
+   (because it was preempted or throttled), it counts the period as
+   missed, and starts the next period without trying to catch up.
+
+   For each thread, the report shows:
+
+        cpu%     CPU time consumed in the interval, as a percentage of
+                 the interval (read by the main thread with a clock ID
+                 obtained from pthread_getcpuclockid())
+        wait%    Time spent runnable, but waiting for a CPU (the second
+                 field of /proc/self/task/TID/schedstat)
+        slices/s Number of times the thread was scheduled onto a CPU
+        missed   Number of periods in which the target was not reached
+
+   At the end, the program prints each thread's overall share relative to
+   its target, and Jain's fairness index of those ratios (1.0 if every
+   thread got the same fraction of its target; 1/n if one thread got
+   everything).
+
+   For example, to see how four threads that each want 60% of a CPU
+   share two CPUs, and then a cgroup limited to one CPU:
+
+        $ ./cpu_load_gen -c 0,1 60 60 60 60
+        # mkdir /sys/fs/cgroup/lg; echo 100000 100000 > /sys/fs/cgroup/lg/cpu.max
+        # ./cpu_load_gen -g /sys/fs/cgroup/lg 60 60 60 60
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sched.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "cgroup_stats.h"
+#include "tlpi_hdr.h"
+
+#define NANO 1000000000LL
+#define CHUNK_NS 50000                  /* Target duration of a burn chunk */
+
+struct burner {
+    pthread_t thr;
+    pid_t tid;                          /* Kernel thread ID */
+    double util;                        /* Target percentage */
+    int cpu;                            /* CPU to pin to, or -1 */
+    clockid_t clock;                    /* Thread's CPU-time clock */
+    long missed;                        /* Periods that missed target */
+    long long cpuNs, waitNs, slices;    /* Values at last report */
+    long lastMissed;
+    long long startCpuNs;               /* CPU time at start */
+};
+
+static long long periodNs = 100 * 1000000LL;
+static long chunkIters;
+static int stop;
+
+static long long
+clockNs(clockid_t clock)
+{
+    struct timespec ts;
+
+    if (clock_gettime(clock, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * NANO + ts.tv_nsec;
+}
+
+static void
+burnChunk(void)
+{
+    volatile long j;
+
+    for (j = 0; j < chunkIters; j++)
+        continue;
+}
+
+/* Set 'chunkIters' so that burnChunk() takes about CHUNK_NS of CPU time */
+
+static void
+calibrate(void)
+{
+    long long start, elapsed;
+
+    chunkIters = 1000;
+    for (;;) {
+        start = clockNs(CLOCK_THREAD_CPUTIME_ID);
+        burnChunk();
+        elapsed = clockNs(CLOCK_THREAD_CPUTIME_ID) - start;
+        if (elapsed > 10 * CHUNK_NS)
+            break;
+        chunkIters *= 2;
+    }
+    chunkIters = chunkIters * CHUNK_NS / elapsed;
+    if (chunkIters < 1)
+        chunkIters = 1;
+}
+
+static void *
+threadFunc(void *arg)
+{
+    struct burner *b = arg;
+    long long budget, periodStart, periodEnd, now;
+    struct timespec next;
+    cpu_set_t set;
+    int s;
+
+    if (b->cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(b->cpu, &set);
+        s = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (s != 0)
+            errExitEN(s, "pthread_setaffinity_np");
+    }
+    __atomic_store_n(&b->tid, syscall(SYS_gettid), __ATOMIC_RELEASE);
+
+    budget = b->util * periodNs / 100;
+    if (clock_gettime(CLOCK_MONOTONIC, &next) == -1)
+        errExit("clock_gettime");
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        if (budget >= periodNs) {       /* 100%: just burn */
+            burnChunk();
+            continue;
+        }
+
+        /* Burn until this period's budget is used, or the period ends */
+
+        periodStart = clockNs(CLOCK_THREAD_CPUTIME_ID);
+        next.tv_nsec += periodNs % NANO;
+        next.tv_sec += periodNs / NANO + next.tv_nsec / NANO;
+        next.tv_nsec %= NANO;
+        periodEnd = next.tv_sec * NANO + next.tv_nsec;
+        while (clockNs(CLOCK_THREAD_CPUTIME_ID) - periodStart < budget) {
+            burnChunk();
+            if (clockNs(CLOCK_MONOTONIC) >= periodEnd) {
+                __atomic_add_fetch(&b->missed, 1, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+
+        /* Sleep until the end of the period; if we are already past it,
+           start the next period now, rather than trying to catch up */
+
+        now = clockNs(CLOCK_MONOTONIC);
+        if (now >= periodEnd) {
+            next.tv_sec = now / NANO;
+            next.tv_nsec = now % NANO;
+        } else {
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+/* Read run time, wait time, and number of time slices of thread 'tid'
+   from its schedstat file. Returns 0 on success, or -1 on error. */
+
+static int
+readSchedstat(pid_t tid, long long *run, long long *wait, long long *slices)
+{
+    char path[64], buf[128];
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "/proc/self/task/%ld/schedstat", (long) tid);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return -1;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return -1;
+    buf[n] = '\0';
+    return (sscanf(buf, "%lld %lld %lld", run, wait, slices) == 3) ? 0 : -1;
+}
+
+/* Parse a comma-separated list of CPU numbers. Returns the number of
+   CPUs in the list. */
+
+static int
+parseCpus(char *str, int **cpus)
+{
+    char *tok;
+    int n;
+
+    *cpus = NULL;
+    n = 0;
+    for (tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        *cpus = realloc(*cpus, (n + 1) * sizeof(int));
+        if (*cpus == NULL)
+            errExit("realloc");
+        (*cpus)[n++] = getInt(tok, GN_NONNEG, "-c");
+    }
+    return n;
+}
+
+static void
+moveToCgroup(const char *dir)
+{
+    char path[PATH_MAX];
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/cgroup.procs", dir);
+    fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+        errExit("open %s", path);
+    if (write(fd, "0", 1) != 1)         /* "0" means the caller */
+        errExit("write %s", path);
+    close(fd);
+}
+
+static void
+usageError(char *pname)
+{
+    fprintf(stderr, "Usage: %s [-d secs] [-r secs] [-p msecs] [-c cpu,...] "
+            "[-g cgroup-dir] util...\n", pname);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct burner *b;
+    struct cgStats cg;
+    struct timespec next;
+    uint64_t prevPeriods, prevThrottled, prevThrottledUsec;
+    long long start, prevNs, now, cpuNs, run, wait, slices, interval;
+    double secs, reportSecs, share, sum, sumSq;
+    int nthreads, ncpus, *cpus, opt, j, s, n;
+    char *cgroupDir;
+    long missed;
+
+    secs = 10;
+    reportSecs = 1;
+    ncpus = 0;
+    cpus = NULL;
+    cgroupDir = NULL;
+    while ((opt = getopt(argc, argv, "d:r:p:c:g:")) != -1) {
+        switch (opt) {
+        case 'd': secs = atof(optarg);                                  break;
+        case 'r': reportSecs = atof(optarg);                            break;
+        case 'p': periodNs = getInt(optarg, GN_GT_0, "-p") * 1000000LL; break;
+        case 'c': ncpus = parseCpus(optarg, &cpus);                     break;
+        case 'g': cgroupDir = optarg;                                   break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (optind >= argc || secs <= 0 || reportSecs <= 0)
+        usageError(argv[0]);
+
+    nthreads = argc - optind;
+    b = calloc(nthreads, sizeof(struct burner));
+    if (b == NULL)
+        errExit("calloc");
+
+    if (cgroupDir != NULL) {
+        moveToCgroup(cgroupDir);
+        if (cgOpen(&cg, AT_FDCWD, cgroupDir, CG_FILE(CG_CPU_STAT)) == -1)
+            errExit("cgOpen");
+        if (!(cg.avail & CG_FILE(CG_CPU_STAT)))
+            fatal("%s has no cpu.stat", cgroupDir);
+        cgRead(&cg, CG_FILE(CG_CPU_STAT));
+    }
+
+    calibrate();
+
+    for (j = 0; j < nthreads; j++) {
+        b[j].util = atof(argv[optind + j]);
+        if (b[j].util < 0 || b[j].util > 100)
+            cmdLineErr("Bad utilization: %s\n", argv[optind + j]);
+        b[j].cpu = (ncpus > 0) ? cpus[j % ncpus] : -1;
+        s = pthread_create(&b[j].thr, NULL, threadFunc, &b[j]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+        s = pthread_getcpuclockid(b[j].thr, &b[j].clock);
+        if (s != 0)
+            errExitEN(s, "pthread_getcpuclockid");
+    }
+
+    /* Wait until each thread has published its thread ID, and take the
+       initial readings */
+
+    for (j = 0; j < nthreads; j++) {
+        while (__atomic_load_n(&b[j].tid, __ATOMIC_ACQUIRE) == 0)
+            sched_yield();
+        b[j].cpuNs = b[j].startCpuNs = clockNs(b[j].clock);
+        readSchedstat(b[j].tid, &run, &b[j].waitNs, &b[j].slices);
+    }
+
+    printf("%d threads, period %lld ms, burn chunk %ld iterations\n",
+           nthreads, periodNs / 1000000, chunkIters);
+    printf("%7s %4s %4s %7s %7s %7s %9s %7s\n", "time", "thr", "cpu",
+           "target", "cpu%", "wait%", "slices/s", "missed");
+
+    start = prevNs = clockNs(CLOCK_MONOTONIC);
+    for (n = 1; n * reportSecs <= secs; n++) {
+        next.tv_sec = (start + (long long) (n * reportSecs * NANO)) / NANO;
+        next.tv_nsec = (start + (long long) (n * reportSecs * NANO)) % NANO;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        now = clockNs(CLOCK_MONOTONIC);
+        interval = now - prevNs;
+        prevNs = now;
+
+        for (j = 0; j < nthreads; j++) {
+            cpuNs = clockNs(b[j].clock);
+            if (readSchedstat(b[j].tid, &run, &wait, &slices) == -1)
+                wait = slices = 0;
+            missed = __atomic_load_n(&b[j].missed, __ATOMIC_RELAXED);
+
+            printf("%7.1f %4d %4d %6.1f%% %6.1f%% %6.1f%% %9.0f %7ld\n",
+                   (now - start) / 1e9, j, b[j].cpu, b[j].util,
+                   (cpuNs - b[j].cpuNs) * 100.0 / interval,
+                   (wait - b[j].waitNs) * 100.0 / interval,
+                   (slices - b[j].slices) * 1e9 / interval,
+                   missed - b[j].lastMissed);
+
+            b[j].cpuNs = cpuNs;
+            b[j].waitNs = wait;
+            b[j].slices = slices;
+            b[j].lastMissed = missed;
+        }
+
+        if (cgroupDir != NULL) {
+            prevPeriods = cg.v.nrPeriods;
+            prevThrottled = cg.v.nrThrottled;
+            prevThrottledUsec = cg.v.throttledUsec;
+            if (cgRead(&cg, CG_FILE(CG_CPU_STAT)) == -1)
+                errExit("cgRead");
+            printf("%7.1f cgroup: %llu periods, %llu throttled, "
+                   "%.1f ms throttled\n", (now - start) / 1e9,
+                   (unsigned long long) (cg.v.nrPeriods - prevPeriods),
+                   (unsigned long long) (cg.v.nrThrottled - prevThrottled),
+                   (cg.v.throttledUsec - prevThrottledUsec) / 1000.0);
+        }
+        fflush(stdout);
+    }
+
+    /* Summary: each thread's share of its target over the whole run,
+       and the fairness of those shares */
+
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    now = clockNs(CLOCK_MONOTONIC);
+
+    printf("\nOverall (%.1f secs):\n", (now - start) / 1e9);
+    sum = sumSq = 0;
+    n = 0;
+    for (j = 0; j < nthreads; j++) {
+        cpuNs = clockNs(b[j].clock) - b[j].startCpuNs;
+        printf("  thread %d: target %.1f%%, got %.1f%%", j, b[j].util,
+               cpuNs * 100.0 / (now - start));
+        if (b[j].util > 0) {
+            share = cpuNs * 100.0 / (now - start) / b[j].util;
+            printf(" (%.2f of target)", share);
+            sum += share;
+            sumSq += share * share;
+            n++;
+        }
+        printf("\n");
+    }
+    if (n > 0 && sumSq > 0)
+        printf("Jain's fairness index: %.3f\n", sum * sum / (n * sumSq));
+
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_join(b[j].thr, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    exit(EXIT_SUCCESS);
+}
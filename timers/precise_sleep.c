@@ -0,0 +1,160 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* precise_sleep.c
+
+   Sleep until a deadline with better precision than a plain sleep.
+
+   A thread that sleeps, by any means, wakes late: the kernel adds the
+   thread's timer slack (by default, 50 microseconds for a thread with a
+   normal scheduling policy) to the expiry time, so that it can merge
+   wake-ups, and then the thread must be scheduled. For a 100-microsecond
+   sleep, the slack alone is half the interval (see sleep_bench.c).
+
+   psSetSlack() reduces the calling thread's slack with
+   prctl(PR_SET_TIMERSLACK), which removes most of the systematic
+   lateness, at some cost in power (wake-ups are less often batched).
+   psSleepUntil() goes further: it sleeps (with clock_nanosleep() and
+   TIMER_ABSTIME, so that the deadline doesn't drift) until a margin
+   before the deadline, and busy-waits for the remainder. The margin is
+   the smoothed lateness of its earlier sleeps, plus twice their smoothed
+   deviation (as with TCP's retransmission timeout estimate), but no more
+   than 'spinLimitNs', so that the busy-waiting, which costs CPU time,
+   is limited to what is needed to hide the lateness that the thread
+   actually sees. With 'spinLimitNs' of 0, the functions just sleep.
+
+   A 'struct preciseSleep' is used by one thread at a time (the slack
+   is a per-thread attribute, and the estimates are of the lateness seen
+   by that thread).
+
+   This module is Linux-specific (PR_SET_TIMERSLACK).
+*/
+#define _GNU_SOURCE
+#include <sys/prctl.h>
+#include <errno.h>
+#include "precise_sleep.h"      /* Declares functions defined here */
+
+#define NS_PER_SEC 1000000000L
+
+static long long
+tsToNs(const struct timespec *ts)
+{
+    return ts->tv_sec * (long long) NS_PER_SEC + ts->tv_nsec;
+}
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return tsToNs(&ts);
+}
+
+/* Initialize 'ps'; psSleepUntil() will busy-wait for at most
+   'spinLimitNs' nanoseconds before each deadline */
+
+void
+psInit(struct preciseSleep *ps, long spinLimitNs)
+{
+    ps->spinLimitNs = (spinLimitNs > 0) ? spinLimitNs : 0;
+    ps->lateNs = 0;
+    ps->lateDevNs = 0;
+    ps->sleeps = 0;
+    ps->spinNs = 0;
+}
+
+/* Set the calling thread's timer slack to 'slackNs' nanoseconds (at
+   least 1; 0 restores the default). Returns 0 on success, or -1 on
+   error. */
+
+int
+psSetSlack(long slackNs)
+{
+    return prctl(PR_SET_TIMERSLACK, (unsigned long) slackNs, 0, 0, 0);
+}
+
+/* Return the calling thread's timer slack, or -1 on error */
+
+long
+psGetSlack(void)
+{
+    return prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+}
+
+/* Return when CLOCK_MONOTONIC reaches 'deadline'. Returns 0 on success,
+   or -1 on error. */
+
+int
+psSleepUntil(struct preciseSleep *ps, const struct timespec *deadline)
+{
+    long long target, wake, now;
+    long margin, late;
+    struct timespec ts;
+    int s;
+
+    target = tsToNs(deadline);
+
+    /* Sleep until the margin before the deadline, if that is still
+       in the future */
+
+    margin = ps->lateNs + 2 * ps->lateDevNs;
+    if (margin > ps->spinLimitNs)
+        margin = ps->spinLimitNs;
+
+    now = nowNs();
+    wake = target - margin;
+    if (wake > now) {
+        ts.tv_sec = wake / NS_PER_SEC;
+        ts.tv_nsec = wake % NS_PER_SEC;
+        do {
+            s = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        } while (s == EINTR);
+        if (s != 0) {
+            errno = s;
+            return -1;
+        }
+
+        /* Update the estimates (gains of 1/8 and 1/4) */
+
+        now = nowNs();
+        late = now - wake;
+        ps->lateNs += (late - ps->lateNs) / 8;
+        ps->lateDevNs += ((late > ps->lateNs ? late - ps->lateNs :
+                           ps->lateNs - late) - ps->lateDevNs) / 4;
+        ps->sleeps++;
+    }
+
+    /* Busy-wait for the remainder */
+
+    if (now < target) {
+        wake = now;
+        while (now < target)
+            now = nowNs();
+        ps->spinNs += now - wake;
+    }
+    return 0;
+}
+
+/* Sleep for 'ns' nanoseconds. Returns 0 on success, or -1 on error. */
+
+int
+psSleep(struct preciseSleep *ps, long ns)
+{
+    struct timespec ts;
+    long long deadline;
+
+    deadline = nowNs() + ns;
+    ts.tv_sec = deadline / NS_PER_SEC;
+    ts.tv_nsec = deadline % NS_PER_SEC;
+    return psSleepUntil(ps, &ts);
+}
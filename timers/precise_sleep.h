@@ -0,0 +1,40 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* precise_sleep.h
+
+   Header file for precise_sleep.c.
+*/
+#ifndef PRECISE_SLEEP_H
+#define PRECISE_SLEEP_H         /* Prevent accidental double inclusion */
+
+#include <time.h>
+
+struct preciseSleep {           /* Per-thread state; see psInit() */
+    long spinLimitNs;           /* Longest busy-wait before a deadline */
+    long lateNs;                /* Smoothed lateness of wake-ups */
+    long lateDevNs;             /* Smoothed mean deviation of lateness */
+    unsigned long sleeps;       /* Calls that slept */
+    unsigned long spinNs;       /* Total time spent busy-waiting */
+};
+
+void psInit(struct preciseSleep *ps, long spinLimitNs);
+
+int psSetSlack(long slackNs);
+
+long psGetSlack(void);
+
+int psSleepUntil(struct preciseSleep *ps, const struct timespec *deadline);
+
+int psSleep(struct preciseSleep *ps, long ns);
+
+#endif
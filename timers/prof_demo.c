@@ -0,0 +1,157 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* prof_demo.c
+
+   Demonstrate the sampling profiler in sample_prof.c. The program
+   creates a number of threads, each of which spends about two thirds of
+   its CPU time in one function and a third in another (reached through
+   an intermediate function), and profiles them all.
+
+   Usage: prof_demo [-t nthreads] [-s cpu-secs] [-f hz] [-o file]
+
+        -t nthreads   Number of threads (default: 2)
+        -s cpu-secs   CPU seconds consumed by each thread (default: 2)
+        -f hz         Samples per CPU second (default: PROF_DEFAULT_HZ)
+        -o file       Output file (default: prof.<pid>.folded)
+
+   Try: ./prof_demo -o prof.folded && cat prof.folded
+        flamegraph.pl prof.folded > prof.svg
+
+   The profiler can also be loaded into a program that doesn't call it,
+   using the shared library built by the Makefile in this directory:
+
+        LD_PRELOAD=./libtlpi_prof.so TLPI_PROF=incr.folded \
+                ../threads/thread_incr_mutex 10000000
+
+   This program is Linux-specific.
+*/
+#include <pthread.h>
+#include <time.h>
+#include "sample_prof.h"
+#include "tlpi_hdr.h"
+
+static double cpuSecs;
+
+static double
+threadCpu(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+spin(long n)
+{
+    volatile long j;
+
+    for (j = 0; j < n; j++)
+        continue;
+}
+
+static void
+heavyFunc(void)
+{
+    spin(2000000);
+}
+
+static void
+lightFunc(void)
+{
+    spin(1000000);
+}
+
+static void
+middleFunc(void)
+{
+    lightFunc();
+}
+
+static void *
+threadFunc(void *arg)
+{
+    double start;
+
+    if (profThreadStart() == -1)
+        errExit("profThreadStart");
+
+    start = threadCpu();
+    while (threadCpu() - start < cpuSecs) {
+        heavyFunc();
+        middleFunc();
+    }
+
+    profThreadStop();
+    return NULL;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-t nthreads] [-s cpu-secs] [-f hz] "
+            "[-o file]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct profStats st;
+    pthread_t *tid;
+    char *path;
+    int opt, nthreads, hz, j, s;
+
+    nthreads = 2;
+    cpuSecs = 2;
+    hz = 0;
+    path = NULL;
+    while ((opt = getopt(argc, argv, "t:s:f:o:")) != -1) {
+        switch (opt) {
+        case 't':   nthreads = getInt(optarg, GN_GT_0, "-t");   break;
+        case 's':   cpuSecs = getInt(optarg, GN_GT_0, "-s");    break;
+        case 'f':   hz = getInt(optarg, GN_GT_0, "-f");         break;
+        case 'o':   path = optarg;                              break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+
+    if (profStart(path, hz) == -1)
+        errExit("profStart");
+
+    tid = calloc(nthreads, sizeof(pthread_t));
+    if (tid == NULL)
+        errExit("calloc");
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_create(&tid[j], NULL, threadFunc, NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_join(tid[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    profGetStats(&st);
+    printf("%lu samples (%lu dropped), %lu distinct stacks\n",
+           st.samples, st.dropped, st.stacks);
+    if (profStop() == -1)
+        errExit("profStop");
+
+    free(tid);
+    exit(EXIT_SUCCESS);
+}
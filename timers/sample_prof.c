@@ -0,0 +1,730 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* sample_prof.c
+
+   An in-process sampling profiler, whose output can be turned into a
+   flame graph (for example, with Brendan Gregg's flamegraph.pl), and
+   which, unlike perf(1), needs no privileges.
+
+   profStart() creates, for the calling thread, a POSIX timer that
+   measures the thread's CPU time (CLOCK_THREAD_CPUTIME_ID), and that
+   sends SIGPROF to that thread (SIGEV_THREAD_ID) each time it has
+   consumed 1/hz seconds of CPU. (Compare the process-wide ITIMER_PROF
+   timer, whose signals go to whichever thread happens to be running,
+   and real_timer.c, which uses ITIMER_REAL.) Each other thread to be
+   profiled calls profThreadStart(); its timer is deleted when it calls
+   profThreadStop(), or terminates.
+
+   The SIGPROF handler records the interrupted thread's stack (obtained
+   with backtrace(), whose first call, which may load libgcc_s and so is
+   not async-signal-safe, is made by profStart()) in a ring buffer of
+   fixed-size slots. The handler claims a slot with an atomic
+   compare-and-swap, fills it, and then publishes it by storing its
+   sequence number; it neither allocates memory nor takes locks. A
+   thread created by profStart() drains the ring every DRAIN_MS
+   milliseconds, adding each stack to a hash table of distinct stacks
+   and counts. If the ring fills between drains, samples are dropped
+   (and counted).
+
+   profStop(), which is also called at exit() if the program didn't call
+   it, writes the table to the file named in profStart() in "folded"
+   form: one line per distinct stack, with the names of the functions
+   from the outermost inward, separated by semicolons, followed by the
+   number of samples. Names are taken from the program's own symbol
+   table (read from /proc/self/exe, so that static functions are named
+   too) and, for shared libraries, from dladdr(); other addresses are
+   shown as "module+offset".
+
+   Built with PROF_PRELOAD defined, as a shared library, the module
+   profiles an unmodified program when loaded with LD_PRELOAD: if the
+   TLPI_PROF environment variable is set, it names the output file
+   (TLPI_PROF_HZ sets the rate), and pthread_create() is wrapped so that
+   every thread is profiled.
+
+   Stacks are only as good as the unwinding information in the program;
+   frames of functions that were inlined, or of code built without
+   unwind tables, are missing.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <errno.h>
+#include "sample_prof.h"        /* Declares functions defined here */
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#define RING_SLOTS 4096         /* Must be a power of two */
+#define HASH_BUCKETS 4096
+#define DRAIN_MS 50
+
+struct profSlot {               /* A sample, as written by the handler */
+    uint64_t seq;               /* Ticket + 1, once the slot is filled */
+    int depth;
+    void *pc[PROF_MAX_DEPTH];   /* Innermost frame first */
+};
+
+struct profStack {              /* A distinct stack, and its count */
+    struct profStack *next;     /* Next in hash chain */
+    unsigned long count;
+    int depth;
+    void *pc[];
+};
+
+struct exeSym {                 /* A function in the program */
+    uintptr_t addr;
+    size_t size;
+    const char *name;
+};
+
+static struct profSlot *ring;   /* NULL unless profiling */
+static uint64_t head;           /* Next ticket to be claimed */
+static uint64_t tail;           /* Next ticket to be drained */
+static int active;              /* Handler records samples */
+static unsigned long dropped;
+static long intervalNs;
+static char *outPath;
+
+static pthread_mutex_t aggMtx = PTHREAD_MUTEX_INITIALIZER;
+static struct profStack *table[HASH_BUCKETS];   /* Protected by aggMtx */
+static unsigned long samples, nstacks;          /* Protected by aggMtx */
+
+static pthread_t drainer;
+static int drainStop;
+
+static pthread_once_t keyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t timerKey;  /* Destructor deletes thread's timer */
+static __thread timer_t threadTimer;
+static __thread int haveTimer;
+
+static struct exeSym *syms;     /* Sorted by address */
+static size_t nsyms;
+static char *symStrings;        /* Program's string table */
+
+/* Return the program counter of the context interrupted by a signal */
+
+static void *
+contextPc(void *ucv)
+{
+    ucontext_t *uc = ucv;
+
+#if defined(__x86_64__)
+    return (void *) uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+    return (void *) uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+    return (void *) uc->uc_mcontext.pc;
+#else
+    (void) uc;
+    return NULL;
+#endif
+}
+
+static void
+sigprofHandler(int sig, siginfo_t *si, void *ucv)
+{
+    void *frames[PROF_MAX_DEPTH + 8];
+    struct profSlot *slot;
+    uint64_t h;
+    void *pc;
+    int savedErrno, n, j, k;
+
+    if (!__atomic_load_n(&active, __ATOMIC_RELAXED))
+        return;
+    savedErrno = errno;
+
+    /* Claim a slot, unless the ring is full */
+
+    h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    do {
+        if (h - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= RING_SLOTS) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            errno = savedErrno;
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&head, &h, h + 1, 1,
+                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    slot = &ring[h & (RING_SLOTS - 1)];
+
+    /* backtrace() returns the frames of this handler and the signal
+       trampoline, then the interrupted frame (whose address is the
+       interrupted PC), then its callers. Skip to the interrupted frame;
+       if it can't be found, record just the interrupted PC. */
+
+    pc = contextPc(ucv);
+    n = backtrace(frames, PROF_MAX_DEPTH + 8);
+    for (j = 0; j < n && frames[j] != pc; j++)
+        continue;
+    if (j == n) {
+        slot->pc[0] = pc;
+        slot->depth = 1;
+    } else {
+        for (k = 0; j < n && k < PROF_MAX_DEPTH; j++, k++)
+            slot->pc[k] = frames[j];
+        slot->depth = k;
+    }
+
+    __atomic_store_n(&slot->seq, h + 1, __ATOMIC_RELEASE);
+    errno = savedErrno;
+}
+
+static unsigned long
+hashStack(void *const *pc, int depth)
+{
+    unsigned long h;
+    int j;
+
+    h = 14695981039346656037UL;         /* FNV-1a */
+    for (j = 0; j < depth; j++)
+        h = (h ^ (uintptr_t) pc[j]) * 1099511628211UL;
+    return h;
+}
+
+/* Move the samples in the ring into the table. Called with aggMtx
+   locked. */
+
+static void
+drainRing(void)
+{
+    struct profStack *ps;
+    struct profSlot *slot;
+    uint64_t t, h;
+    unsigned long b;
+
+    h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    for (t = tail; t != h; t++) {
+        slot = &ring[t & (RING_SLOTS - 1)];
+
+        /* The slot has been claimed, but the handler may not yet have
+           finished filling it */
+
+        while (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != t + 1)
+            sched_yield();
+
+        b = hashStack(slot->pc, slot->depth) % HASH_BUCKETS;
+        for (ps = table[b]; ps != NULL; ps = ps->next)
+            if (ps->depth == slot->depth &&
+                    memcmp(ps->pc, slot->pc,
+                           slot->depth * sizeof(void *)) == 0)
+                break;
+        if (ps == NULL) {
+            ps = malloc(sizeof(struct profStack) +
+                        slot->depth * sizeof(void *));
+            if (ps != NULL) {
+                ps->count = 0;
+                ps->depth = slot->depth;
+                memcpy(ps->pc, slot->pc, slot->depth * sizeof(void *));
+                ps->next = table[b];
+                table[b] = ps;
+                nstacks++;
+            }
+        }
+        if (ps != NULL)
+            ps->count++;
+        samples++;
+
+        /* Release the slot to the handler */
+
+        __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void *
+drainFunc(void *arg)
+{
+    struct timespec ts = { 0, DRAIN_MS * 1000000L };
+
+    while (!__atomic_load_n(&drainStop, __ATOMIC_ACQUIRE)) {
+        nanosleep(&ts, NULL);
+        pthread_mutex_lock(&aggMtx);
+        drainRing();
+        pthread_mutex_unlock(&aggMtx);
+    }
+    return NULL;
+}
+
+static void
+destructor(void *arg)
+{
+    profThreadStop();
+}
+
+static void
+createKey(void)
+{
+    pthread_key_create(&timerKey, destructor);
+}
+
+/* Start sampling the calling thread. Returns 0 on success, or -1 on
+   error. */
+
+int
+profThreadStart(void)
+{
+    struct itimerspec its;
+    struct sigevent sev;
+
+    if (ring == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (haveTimer)
+        return 0;
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &threadTimer) == -1)
+        return -1;
+
+    its.it_value.tv_sec = its.it_interval.tv_sec = intervalNs / 1000000000;
+    its.it_value.tv_nsec = its.it_interval.tv_nsec = intervalNs % 1000000000;
+    if (timer_settime(threadTimer, 0, &its, NULL) == -1) {
+        timer_delete(threadTimer);
+        return -1;
+    }
+
+    haveTimer = 1;
+    pthread_setspecific(timerKey, &haveTimer);  /* Any non-NULL value */
+    return 0;
+}
+
+/* Stop sampling the calling thread */
+
+void
+profThreadStop(void)
+{
+    if (haveTimer) {
+        timer_delete(threadTimer);
+        haveTimer = 0;
+    }
+}
+
+static void
+atExitStop(void)
+{
+    if (ring != NULL && profStop() == -1)
+        fprintf(stderr, "sample_prof: can't write %s\n", outPath);
+}
+
+/* Begin profiling, sampling each profiled thread 'hz' times per second
+   of CPU time that it consumes (PROF_DEFAULT_HZ if 'hz' is 0), and
+   start sampling the calling thread. The profile will be written to
+   'path' (or, if it is NULL, to "prof.<pid>.folded"). Returns 0 on
+   success, or -1 on error. */
+
+int
+profStart(const char *path, int hz)
+{
+    static int atExitSet;
+    struct sigaction sa;
+    void *dummy[1];
+    char buf[64];
+    int s;
+
+    if (ring != NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (hz <= 0)
+        hz = PROF_DEFAULT_HZ;
+    intervalNs = 1000000000L / hz;
+
+    if (path == NULL) {
+        snprintf(buf, sizeof(buf), "prof.%ld.folded", (long) getpid());
+        path = buf;
+    }
+    outPath = strdup(path);
+    if (outPath == NULL)
+        return -1;
+
+    s = pthread_once(&keyOnce, createKey);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+
+    backtrace(dummy, 1);        /* Load the unwinder now, not in the
+                                   signal handler */
+
+    ring = mmap(NULL, RING_SLOTS * sizeof(struct profSlot),
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        ring = NULL;
+        return -1;
+    }
+    head = tail = 0;
+    dropped = 0;
+
+    sa.sa_sigaction = sigprofHandler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, NULL) == -1)
+        goto fail;
+
+    drainStop = 0;
+    s = pthread_create(&drainer, NULL, drainFunc, NULL);
+    if (s != 0) {
+        errno = s;
+        goto fail;
+    }
+
+    if (!atExitSet) {
+        atexit(atExitStop);
+        atExitSet = 1;
+    }
+
+    __atomic_store_n(&active, 1, __ATOMIC_RELEASE);
+    if (profThreadStart() == -1)
+        return -1;
+    return 0;
+
+fail:
+    s = errno;
+    munmap(ring, RING_SLOTS * sizeof(struct profSlot));
+    ring = NULL;
+    errno = s;
+    return -1;
+}
+
+void
+profGetStats(struct profStats *stats)
+{
+    pthread_mutex_lock(&aggMtx);
+    if (ring != NULL)
+        drainRing();
+    stats->samples = samples;
+    stats->stacks = nstacks;
+    stats->dropped = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&aggMtx);
+}
+
+static int
+cmpSym(const void *a, const void *b)
+{
+    const struct exeSym *x = a, *y = b;
+
+    return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+/* dl_iterate_phdr() callback: the first object is the program; return
+   its load bias */
+
+static int
+exeBias(struct dl_phdr_info *info, size_t size, void *data)
+{
+    *(uintptr_t *) data = info->dlpi_addr;
+    return 1;
+}
+
+/* Load the function symbols from the program's symbol table. Returns 0
+   on success, or -1 on error (in which case dladdr() alone is used). */
+
+static int
+loadExeSyms(void)
+{
+    ElfW(Ehdr) eh;
+    ElfW(Shdr) *sh;
+    ElfW(Sym) *sym;
+    uintptr_t bias;
+    size_t nsym, j;
+    int fd, k;
+
+    fd = open("/proc/self/exe", O_RDONLY);
+    if (fd == -1)
+        return -1;
+    sh = NULL;
+    sym = NULL;
+    if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh) ||
+            memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0 ||
+            eh.e_shentsize != sizeof(ElfW(Shdr)))
+        goto fail;
+
+    sh = malloc(eh.e_shnum * sizeof(ElfW(Shdr)));
+    if (sh == NULL || pread(fd, sh, eh.e_shnum * sizeof(ElfW(Shdr)),
+                            eh.e_shoff) != eh.e_shnum * sizeof(ElfW(Shdr)))
+        goto fail;
+
+    for (k = 0; k < eh.e_shnum; k++)
+        if (sh[k].sh_type == SHT_SYMTAB && sh[k].sh_link < eh.e_shnum)
+            break;
+    if (k == eh.e_shnum)                /* Stripped */
+        goto fail;
+
+    nsym = sh[k].sh_size / sizeof(ElfW(Sym));
+    sym = malloc(sh[k].sh_size);
+    symStrings = malloc(sh[sh[k].sh_link].sh_size);
+    syms = malloc(nsym * sizeof(struct exeSym));
+    if (sym == NULL || symStrings == NULL || syms == NULL ||
+            pread(fd, sym, sh[k].sh_size, sh[k].sh_offset) !=
+                    (ssize_t) sh[k].sh_size ||
+            pread(fd, symStrings, sh[sh[k].sh_link].sh_size,
+                  sh[sh[k].sh_link].sh_offset) !=
+                    (ssize_t) sh[sh[k].sh_link].sh_size)
+        goto fail;
+
+    bias = 0;
+    dl_iterate_phdr(exeBias, &bias);
+
+    for (j = 0, nsyms = 0; j < nsym; j++) {
+        if (ELF64_ST_TYPE(sym[j].st_info) != STT_FUNC ||
+                sym[j].st_value == 0 ||
+                sym[j].st_name >= sh[sh[k].sh_link].sh_size)
+            continue;
+        syms[nsyms].addr = bias + sym[j].st_value;
+        syms[nsyms].size = sym[j].st_size;
+        syms[nsyms].name = symStrings + sym[j].st_name;
+        nsyms++;
+    }
+    qsort(syms, nsyms, sizeof(struct exeSym), cmpSym);
+
+    free(sym);
+    free(sh);
+    close(fd);
+    return 0;
+
+fail:
+    free(sym);
+    free(sh);
+    free(syms);
+    free(symStrings);
+    syms = NULL;
+    symStrings = NULL;
+    nsyms = 0;
+    close(fd);
+    return -1;
+}
+
+/* Return the name of the function containing 'pc' (in 'buf', of 'len'
+   bytes, if it must be built) */
+
+static const char *
+symName(void *pc, char *buf, size_t len)
+{
+    const char *base;
+    uintptr_t a = (uintptr_t) pc;
+    size_t lo, hi, mid;
+    Dl_info di;
+
+    /* Binary search for the last symbol at or below 'pc' */
+
+    lo = 0;
+    hi = nsyms;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (syms[mid].addr <= a)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0 && a < syms[lo - 1].addr + syms[lo - 1].size)
+        return syms[lo - 1].name;
+
+    if (dladdr(pc, &di) == 0 || di.dli_fname == NULL)
+        return "[unknown]";
+    if (di.dli_sname != NULL)
+        return di.dli_sname;
+
+    base = strrchr(di.dli_fname, '/');
+    snprintf(buf, len, "%s+0x%lx", (base == NULL) ? di.dli_fname : base + 1,
+             (unsigned long) (a - (uintptr_t) di.dli_fbase));
+    return buf;
+}
+
+struct foldedLine {
+    char *stack;
+    unsigned long count;
+};
+
+static int
+cmpLine(const void *a, const void *b)
+{
+    return strcmp(((const struct foldedLine *) a)->stack,
+                  ((const struct foldedLine *) b)->stack);
+}
+
+/* Write the table to 'outPath' in folded form. Stacks that differ only
+   in addresses within the same functions are merged. Returns 0 on
+   success, or -1 on error. */
+
+static int
+writeFolded(void)
+{
+    struct foldedLine *lines;
+    struct profStack *ps;
+    char buf[256];
+    size_t nlines, len, j;
+    FILE *fp, *sfp;
+    int b, k;
+
+    if (syms == NULL)
+        loadExeSyms();
+
+    lines = calloc(nstacks + 1, sizeof(struct foldedLine));
+    if (lines == NULL)
+        return -1;
+
+    nlines = 0;
+    for (b = 0; b < HASH_BUCKETS; b++) {
+        for (ps = table[b]; ps != NULL; ps = ps->next) {
+            sfp = open_memstream(&lines[nlines].stack, &len);
+            if (sfp == NULL)
+                continue;
+
+            /* Each frame but the innermost holds a return address,
+               which may be the first byte of the next function */
+
+            for (k = ps->depth - 1; k >= 0; k--)
+                fprintf(sfp, "%s%s", symName((char *) ps->pc[k] -
+                                             (k > 0 ? 1 : 0),
+                                             buf, sizeof(buf)),
+                        (k > 0) ? ";" : "");
+            if (fclose(sfp) != 0)
+                continue;
+            lines[nlines++].count = ps->count;
+        }
+    }
+    qsort(lines, nlines, sizeof(struct foldedLine), cmpLine);
+
+    fp = fopen(outPath, "w");
+    for (j = 0; j < nlines; j++) {
+        if (fp != NULL && (j + 1 == nlines ||
+                    strcmp(lines[j].stack, lines[j + 1].stack) != 0))
+            fprintf(fp, "%s %lu\n", lines[j].stack, lines[j].count);
+        else if (j + 1 < nlines)
+            lines[j + 1].count += lines[j].count;
+        free(lines[j].stack);
+    }
+    free(lines);
+
+    return (fp == NULL) ? -1 : fclose(fp);
+}
+
+/* Stop profiling, and write the profile. Returns 0 on success, or -1 on
+   error. */
+
+int
+profStop(void)
+{
+    struct profStack *ps, *next;
+    struct sigaction sa;
+    int b, ret, savedErrno;
+
+    if (ring == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Other threads' timers may still fire; their signals are ignored */
+
+    profThreadStop();
+    __atomic_store_n(&active, 0, __ATOMIC_RELEASE);
+    sa.sa_handler = SIG_IGN;
+    sa.sa_flags = 0;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+
+    __atomic_store_n(&drainStop, 1, __ATOMIC_RELEASE);
+    pthread_join(drainer, NULL);
+
+    pthread_mutex_lock(&aggMtx);
+    drainRing();
+    ret = writeFolded();
+    savedErrno = errno;
+    for (b = 0; b < HASH_BUCKETS; b++) {
+        for (ps = table[b]; ps != NULL; ps = next) {
+            next = ps->next;
+            free(ps);
+        }
+        table[b] = NULL;
+    }
+    samples = nstacks = 0;
+    pthread_mutex_unlock(&aggMtx);
+
+    munmap(ring, RING_SLOTS * sizeof(struct profSlot));
+    ring = NULL;
+    free(outPath);
+    outPath = NULL;
+    errno = savedErrno;
+    return ret;
+}
+
+#ifdef PROF_PRELOAD
+
+struct startArgs {
+    void *(*fn)(void *);
+    void *arg;
+};
+
+static void *
+profiledStart(void *arg)
+{
+    struct startArgs sa = *(struct startArgs *) arg;
+
+    free(arg);
+    profThreadStart();
+    return sa.fn(sa.arg);
+}
+
+int
+pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+               void *(*fn)(void *), void *arg)
+{
+    static int (*realCreate)(pthread_t *, const pthread_attr_t *,
+                             void *(*)(void *), void *);
+    struct startArgs *sa;
+
+    if (realCreate == NULL)
+        *(void **) &realCreate = dlsym(RTLD_NEXT, "pthread_create");
+    if (ring == NULL || fn == drainFunc)
+        return realCreate(thread, attr, fn, arg);
+
+    sa = malloc(sizeof(struct startArgs));
+    if (sa == NULL)
+        return EAGAIN;
+    sa->fn = fn;
+    sa->arg = arg;
+    return realCreate(thread, attr, profiledStart, sa);
+}
+
+__attribute__ ((constructor)) static void
+preloadInit(void)
+{
+    const char *path, *hz;
+
+    path = getenv("TLPI_PROF");
+    hz = getenv("TLPI_PROF_HZ");
+    if (path != NULL && profStart(path, (hz != NULL) ? atoi(hz) : 0) == -1)
+        fprintf(stderr, "sample_prof: profStart: %s\n", strerror(errno));
+}
+
+#endif
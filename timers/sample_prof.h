@@ -0,0 +1,39 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* sample_prof.h
+
+   Header file for sample_prof.c.
+*/
+#ifndef SAMPLE_PROF_H
+#define SAMPLE_PROF_H           /* Prevent accidental double inclusion */
+
+#define PROF_MAX_DEPTH 64       /* Frames recorded per sample */
+#define PROF_DEFAULT_HZ 99      /* Samples per CPU-second per thread */
+
+struct profStats {
+    unsigned long samples;      /* Samples recorded */
+    unsigned long dropped;      /* Samples lost because the ring was full */
+    unsigned long stacks;       /* Distinct stacks */
+};
+
+int profStart(const char *path, int hz);
+
+int profThreadStart(void);
+
+void profThreadStop(void);
+
+void profGetStats(struct profStats *stats);
+
+int profStop(void);
+
+#endif
@@ -0,0 +1,327 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* sleep_bench.c
+
+   Measure how late a thread wakes when it sleeps for a short interval,
+   by various means, and with various settings of its timer slack
+   (prctl(PR_SET_TIMERSLACK)). Compare t_nanosleep.c and
+   t_clock_nanosleep.c, which show how a sleep is restarted after a
+   signal handler has interrupted it.
+
+   Usage: sleep_bench [-m methods] [-i interval-us] [-n count]
+                      [-s slacks] [-S spin-us] [-C]
+
+        -m methods      Comma-separated list of methods (default: all):
+                          nanosleep   nanosleep() for the time remaining
+                          clock_abs   clock_nanosleep(TIMER_ABSTIME)
+                          timerfd     timerfd_settime(TFD_TIMER_ABSTIME),
+                                      then read()
+                          epoll       epoll_wait() with a timeout (which
+                                      is in milliseconds, and so rounded
+                                      up)
+                          epoll2      epoll_pwait2() with a timeout in
+                                      nanoseconds (Linux 5.11)
+                          spin        Busy-wait on clock_gettime()
+                          hybrid      psSleepUntil() (precise_sleep.c):
+                                      sleep, then busy-wait for at most
+                                      'spin-us'
+        -i interval-us  Requested sleep (default: 100)
+        -n count        Number of sleeps per run (default: 2000)
+        -s slacks       Comma-separated list of timer slack values, in
+                        nanoseconds (default: 0,1000,1; 0 means the
+                        default slack, normally 50000)
+        -S spin-us      Busy-wait limit for "hybrid" (default: 50)
+        -C              Produce CSV output
+
+   Each sleep is to a deadline 'interval' after the previous wake-up,
+   and the program reports how late the wake-ups were (the mean, median,
+   99th percentile, and maximum, in microseconds), and the CPU time
+   consumed, as a percentage of the elapsed time (a proxy for the power
+   cost).
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include "precise_sleep.h"
+#include "lat_hist.h"
+#include "tlpi_hdr.h"
+
+#define MAX_LIST 16             /* Maximum items in a comma-separated list */
+#define NS_PER_SEC 1000000000L
+
+enum method { M_NANOSLEEP, M_CLOCK_ABS, M_TIMERFD, M_EPOLL, M_EPOLL2,
+              M_SPIN, M_HYBRID, NUM_METHODS };
+
+static const char *methodNames[NUM_METHODS] = {
+    "nanosleep", "clock_abs", "timerfd", "epoll", "epoll2", "spin", "hybrid"
+};
+
+static long long
+clockNs(clockid_t clk)
+{
+    struct timespec ts;
+
+    if (clock_gettime(clk, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * (long long) NS_PER_SEC + ts.tv_nsec;
+}
+
+static void
+nsToTs(long long ns, struct timespec *ts)
+{
+    ts->tv_sec = ns / NS_PER_SEC;
+    ts->tv_nsec = ns % NS_PER_SEC;
+}
+
+/* Sleep until CLOCK_MONOTONIC reaches 'deadline' using method 'm'. The
+   relative methods may return early if interrupted; the caller
+   measures the actual wake-up time. Returns 0 on success, or -1 if the
+   method is unsupported. */
+
+static int
+sleepUntil(enum method m, long long deadline, int tfd, int epfd,
+           struct preciseSleep *ps)
+{
+    struct epoll_event ev;
+    struct itimerspec its;
+    struct timespec ts;
+    long long rem;
+    uint64_t exp;
+    int s;
+
+    rem = deadline - clockNs(CLOCK_MONOTONIC);
+
+    switch (m) {
+    case M_NANOSLEEP:
+        if (rem > 0) {
+            nsToTs(rem, &ts);
+            if (nanosleep(&ts, NULL) == -1 && errno != EINTR)
+                errExit("nanosleep");
+        }
+        break;
+
+    case M_CLOCK_ABS:
+        nsToTs(deadline, &ts);
+        s = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        if (s != 0 && s != EINTR)
+            errExitEN(s, "clock_nanosleep");
+        break;
+
+    case M_TIMERFD:
+        nsToTs(deadline, &its.it_value);
+        its.it_interval.tv_sec = its.it_interval.tv_nsec = 0;
+        if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) == -1)
+            errExit("timerfd_settime");
+        if (read(tfd, &exp, sizeof(exp)) == -1 && errno != EINTR)
+            errExit("read-timerfd");
+        break;
+
+    case M_EPOLL:
+        if (rem > 0 && epoll_wait(epfd, &ev, 1,
+                    (rem + 999999) / 1000000) == -1 && errno != EINTR)
+            errExit("epoll_wait");
+        break;
+
+    case M_EPOLL2:
+        if (rem > 0) {
+            nsToTs(rem, &ts);
+            if (epoll_pwait2(epfd, &ev, 1, &ts, NULL) == -1) {
+                if (errno == ENOSYS)
+                    return -1;
+                if (errno != EINTR)
+                    errExit("epoll_pwait2");
+            }
+        }
+        break;
+
+    case M_SPIN:
+        while (clockNs(CLOCK_MONOTONIC) < deadline)
+            continue;
+        break;
+
+    case M_HYBRID:
+        nsToTs(deadline, &ts);
+        if (psSleepUntil(ps, &ts) == -1)
+            errExit("psSleepUntil");
+        break;
+
+    default:
+        break;
+    }
+    return 0;
+}
+
+static void
+runOne(enum method m, long slack, long intervalNs, long count,
+       long spinLimitNs, Boolean csv)
+{
+    struct preciseSleep ps;
+    struct latHist hist;
+    long long start, cpu0, deadline, now, late, sumLate;
+    double cpuPct;
+    long j;
+    int tfd, epfd;
+
+    if (psSetSlack(slack) == -1)
+        errExit("prctl-PR_SET_TIMERSLACK");
+
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (tfd == -1)
+        errExit("timerfd_create");
+    epfd = epoll_create1(EPOLL_CLOEXEC);        /* Never has events */
+    if (epfd == -1)
+        errExit("epoll_create1");
+    psInit(&ps, spinLimitNs);
+    latHistInit(&hist);
+
+    sumLate = 0;
+    cpu0 = clockNs(CLOCK_THREAD_CPUTIME_ID);
+    start = now = clockNs(CLOCK_MONOTONIC);
+    for (j = 0; j < count; j++) {
+        deadline = now + intervalNs;
+        if (sleepUntil(m, deadline, tfd, epfd, &ps) == -1) {
+            printf("%-10s %8ld  (not supported)\n", methodNames[m], slack);
+            goto done;
+        }
+        now = clockNs(CLOCK_MONOTONIC);
+        late = (now > deadline) ? now - deadline : 0;
+        latHistRecord(&hist, late);
+        sumLate += late;
+    }
+    cpuPct = 100.0 * (clockNs(CLOCK_THREAD_CPUTIME_ID) - cpu0) /
+             (now - start);
+
+    if (csv)
+        printf("%s,%ld,%ld,%.2f,%.2f,%.2f,%.2f,%.1f\n", methodNames[m],
+               psGetSlack(), intervalNs / 1000, sumLate / 1000.0 / count,
+               latHistPercentile(&hist, 0.50) / 1000.0,
+               latHistPercentile(&hist, 0.99) / 1000.0, hist.max / 1000.0,
+               cpuPct);
+    else
+        printf("%-10s %8ld %9.1f %9.1f %9.1f %9.1f %7.1f\n", methodNames[m],
+               psGetSlack(), sumLate / 1000.0 / count,
+               latHistPercentile(&hist, 0.50) / 1000.0,
+               latHistPercentile(&hist, 0.99) / 1000.0, hist.max / 1000.0,
+               cpuPct);
+    fflush(stdout);
+
+done:
+    close(tfd);
+    close(epfd);
+}
+
+/* Parse a comma-separated list of nonnegative integers into 'list';
+   returns the number of items */
+
+static int
+parseList(char *str, long *list, const char *name)
+{
+    char *tok;
+    int n;
+
+    n = 0;
+    for (tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (n == MAX_LIST)
+            cmdLineErr("Too many items in %s list\n", name);
+        list[n++] = getLong(tok, GN_NONNEG, name);
+    }
+    if (n == 0)
+        cmdLineErr("Empty %s list\n", name);
+    return n;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-m methods] [-i interval-us] [-n count]\n"
+                    "\t\t[-s slacks] [-S spin-us] [-C]\n", progName);
+    fprintf(stderr, "    -m methods   nanosleep,clock_abs,timerfd,epoll,"
+                    "epoll2,spin,hybrid\n");
+    fprintf(stderr, "    -i interval  Requested sleep, in microseconds "
+                    "(default: 100)\n");
+    fprintf(stderr, "    -n count     Sleeps per run (default: 2000)\n");
+    fprintf(stderr, "    -s slacks    Timer slacks, in nanoseconds "
+                    "(default: 0,1000,1)\n");
+    fprintf(stderr, "    -S spin-us   Busy-wait limit for hybrid "
+                    "(default: 50)\n");
+    fprintf(stderr, "    -C           CSV output\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int methods[NUM_METHODS];
+    long slacks[MAX_LIST], intervalNs, count, spinLimitNs;
+    int nmethods, nslacks, opt, m, k;
+    Boolean csv;
+    char *tok;
+
+    nmethods = 0;
+    slacks[0] = 0; slacks[1] = 1000; slacks[2] = 1;
+    nslacks = 3;
+    intervalNs = 100000;
+    count = 2000;
+    spinLimitNs = 50000;
+    csv = FALSE;
+
+    while ((opt = getopt(argc, argv, "m:i:n:s:S:C")) != -1) {
+        switch (opt) {
+        case 'm':
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                for (m = 0; m < NUM_METHODS; m++)
+                    if (strcmp(tok, methodNames[m]) == 0)
+                        break;
+                if (m == NUM_METHODS || nmethods == NUM_METHODS)
+                    usageError(argv[0]);
+                methods[nmethods++] = m;
+            }
+            break;
+        case 'i':
+            intervalNs = getLong(optarg, GN_GT_0, "interval") * 1000;
+            break;
+        case 'n':   count = getLong(optarg, GN_GT_0, "count");      break;
+        case 's':   nslacks = parseList(optarg, slacks, "slacks");  break;
+        case 'S':
+            spinLimitNs = getLong(optarg, GN_NONNEG, "spin-us") * 1000;
+            break;
+        case 'C':   csv = TRUE;                                     break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+
+    if (nmethods == 0)
+        for (m = 0; m < NUM_METHODS; m++)
+            methods[nmethods++] = m;
+
+    if (csv)
+        printf("method,slack_ns,interval_us,mean_late_us,p50_late_us,"
+               "p99_late_us,max_late_us,cpu_pct\n");
+    else
+        printf("interval %ld us, %ld sleeps; lateness in microseconds\n"
+               "%-10s %8s %9s %9s %9s %9s %7s\n", intervalNs / 1000, count,
+               "method", "slack-ns", "mean", "p50", "p99", "max", "cpu-%");
+
+    for (m = 0; m < nmethods; m++)
+        for (k = 0; k < nslacks; k++)
+            runOne(methods[m], slacks[k], intervalNs, count, spinLimitNs,
+                   csv);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,201 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* timed_read_ev.c
+
+   A version of timed_read.c that places a timeout on each of several
+   reads at once, using the deadlines of ev_deadline.c, rather than
+   alarm() and a SIGALRM handler.
+
+   Usage: timed_read_ev [-t timeout-ms] [source...]
+
+   Each source is a pathname (for example, a FIFO or a terminal), "-"
+   for standard input (the default), or host:port, to connect to a TCP
+   server (with a deadline for the connection) and read from it. The
+   program starts a read (or a connect()) on each source, each with its
+   own deadline (default: 5000 milliseconds), and reports the outcome
+   of each.
+
+   Try: mkfifo f1 f2
+        (sleep 1; echo hello > f1) & (sleep 9; echo late > f2) &
+        ./timed_read_ev -t 3000 f1 f2
+        ./timed_read_ev -t 2000 10.255.255.1:80     # Unroutable
+
+   This program is Linux-specific.
+*/
+#include <sys/socket.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <time.h>
+#include "ev_deadline.h"
+#include "tlpi_hdr.h"
+
+#define BUF_SIZE 200
+
+struct source {
+    const char *name;
+    int fd;
+    long long startMs;
+    char buf[BUF_SIZE];
+};
+
+static long timeoutMs;
+
+static long long
+nowMs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void
+readDone(struct evDeadlines *dl, int fd, ssize_t res, void *arg)
+{
+    struct source *src = arg;
+
+    printf("%-20s after %5lld ms: ", src->name, nowMs() - src->startMs);
+    if (res == -ETIMEDOUT)
+        printf("read timed out\n");
+    else if (res < 0)
+        printf("read: %s\n", strerror(-res));
+    else
+        printf("successful read (%ld bytes): %.*s%s", (long) res,
+               (int) res, src->buf,
+               (res > 0 && src->buf[res - 1] == '\n') ? "" : "\n");
+    evDlCancel(dl, fd);
+    if (fd != STDIN_FILENO)
+        close(fd);
+}
+
+static void
+connectDone(struct evDeadlines *dl, int fd, ssize_t res, void *arg)
+{
+    struct source *src = arg;
+
+    if (res < 0) {
+        printf("%-20s after %5lld ms: connect %s\n", src->name,
+               nowMs() - src->startMs,
+               (res == -ETIMEDOUT) ? "timed out" : strerror(-res));
+        evDlCancel(dl, fd);
+        close(fd);
+        return;
+    }
+
+    /* Connected: the read gets a fresh deadline */
+
+    src->startMs = nowMs();
+    if (evDlRead(dl, fd, src->buf, BUF_SIZE, timeoutMs, readDone, src) == -1)
+        errExit("evDlRead");
+}
+
+/* Start a connection to "host:port" */
+
+static void
+startConnect(struct evDeadlines *dl, struct source *src, char *colon)
+{
+    struct addrinfo hints, *res;
+    char host[256];
+    int s;
+
+    snprintf(host, sizeof(host), "%.*s", (int) (colon - src->name),
+             src->name);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    s = getaddrinfo(host, colon + 1, &hints, &res);
+    if (s != 0)
+        fatal("getaddrinfo %s: %s", src->name, gai_strerror(s));
+
+    src->fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (src->fd == -1)
+        errExit("socket");
+    if (evDlConnect(dl, src->fd, res->ai_addr, res->ai_addrlen, timeoutMs,
+                    connectDone, src) == -1)
+        errExit("evDlConnect %s", src->name);
+    freeaddrinfo(res);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct evDeadlines *dl;
+    struct evDlStats st;
+    struct evLoop *loop;
+    struct source *srcs;
+    static char *stdinOnly[] = { "-" };
+    char **names, *colon;
+    int opt, nsrcs, stdinFlags, j;
+
+    timeoutMs = 5000;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        switch (opt) {
+        case 't':   timeoutMs = getLong(optarg, GN_NONNEG, "timeout"); break;
+        default:    usageErr("%s [-t timeout-ms] [source...]\n", argv[0]);
+        }
+    }
+    names = (optind < argc) ? &argv[optind] : stdinOnly;
+    nsrcs = (optind < argc) ? argc - optind : 1;
+
+    loop = evLoopCreate(EV_BACKEND_DEFAULT);
+    if (loop == NULL)
+        errExit("evLoopCreate");
+    dl = evDlCreate(loop, 1);
+    if (dl == NULL)
+        errExit("evDlCreate");
+
+    srcs = calloc(nsrcs, sizeof(struct source));
+    if (srcs == NULL)
+        errExit("calloc");
+
+    stdinFlags = -1;
+    for (j = 0; j < nsrcs; j++) {
+        srcs[j].name = names[j];
+        srcs[j].startMs = nowMs();
+        colon = strrchr(names[j], ':');
+
+        if (strcmp(names[j], "-") == 0) {
+            srcs[j].fd = STDIN_FILENO;
+            stdinFlags = fcntl(STDIN_FILENO, F_GETFL);
+            if (stdinFlags == -1 ||
+                    fcntl(STDIN_FILENO, F_SETFL, stdinFlags | O_NONBLOCK)
+                    == -1)
+                errExit("fcntl");
+        } else if (colon != NULL && access(names[j], F_OK) == -1) {
+            startConnect(dl, &srcs[j], colon);
+            continue;
+        } else {
+            srcs[j].fd = open(names[j], O_RDONLY | O_NONBLOCK);
+            if (srcs[j].fd == -1)
+                errExit("open %s", names[j]);
+        }
+
+        if (evDlRead(dl, srcs[j].fd, srcs[j].buf, BUF_SIZE, timeoutMs,
+                     readDone, &srcs[j]) == -1)
+            errExit("evDlRead");
+    }
+
+    if (evRun(loop) == -1)
+        errExit("evRun");
+
+    evDlGetStats(dl, &st);
+    printf("%lu completed, %lu timed out, %lu timerfd expirations\n",
+           st.completed, st.timedOut, st.wakeups);
+
+    if (stdinFlags != -1)
+        fcntl(STDIN_FILENO, F_SETFL, stdinFlags);
+    evDlDestroy(dl);
+    evLoopDestroy(loop);
+    free(srcs);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,390 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* timer_wheel.c
+
+   A hierarchical timing wheel: a large number of timers, all driven by
+   a single timerfd, rather than one POSIX timer per timer.
+
+   Time is divided into ticks of 'tickNs' nanoseconds. A timer that will
+   expire within 256 ticks is placed in the level 0 slot for its expiry
+   tick; a timer that will expire later is placed in a coarser slot on
+   one of the higher levels, each of which has 64 slots that are each 64
+   times wider than those of the level below. Each time that the level 0
+   wheel completes a revolution, the timers in the next slot of level 1
+   are redistributed ("cascaded") into level 0 (and likewise, when
+   level 1 completes a revolution, for level 2, and so on). Thus, adding
+   and canceling a timer are O(1) operations (each slot is a doubly
+   linked list), and each timer is moved at most TW_LEVELS - 1 times
+   before it expires.
+
+   The caller allocates the twTimer structures (typically embedding them
+   in some other structure, such as a per-connection structure), and
+   monitors the timerfd, 'tw->fd' (e.g., using epoll), calling
+   twProcess() whenever it becomes readable. twProcess() advances the
+   wheel to the current time, moving all of the expired timers to a
+   single list, and then calls their callback functions. The timerfd is
+   armed only for the next tick on which there is something to do
+   (located using a bitmap of nonempty level 0 slots), so that there are
+   no wakeups during idle periods, and many timers that expire on the
+   same tick cost just one wakeup.
+
+   A timer never expires early, but may expire up to one tick late (plus
+   scheduling latency). The maximum timeout is 2^32 ticks; longer
+   timeouts are truncated.
+
+   This module is Linux-specific.
+*/
+#include <sys/timerfd.h>
+#include <time.h>
+#include "timer_wheel.h"
+#include "tlpi_hdr.h"
+
+/* Maximum timeout, in ticks */
+
+#define TW_RANGE \
+    ((uint64_t) 1 << (TW_LVL0_BITS + (TW_LEVELS - 1) * TW_LVL_BITS))
+
+static void
+listInit(struct twList *head)
+{
+    head->next = head->prev = head;
+}
+
+static Boolean
+listEmpty(const struct twList *head)
+{
+    return head->next == head;
+}
+
+static void
+listAddTail(struct twList *head, struct twList *node)
+{
+    node->next = head;
+    node->prev = head->prev;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static void
+listDel(struct twList *node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+}
+
+/* Move all nodes of 'from' to the end of 'to', leaving 'from' empty */
+
+static void
+listSplice(struct twList *from, struct twList *to)
+{
+    if (listEmpty(from))
+        return;
+    from->next->prev = to->prev;
+    to->prev->next = from->next;
+    from->prev->next = to;
+    to->prev = from->prev;
+    listInit(from);
+}
+
+static int64_t
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (int64_t) 1000000000 + ts.tv_nsec;
+}
+
+/* Place 'timer', whose 'expires' field is set, in the appropriate slot */
+
+static void
+placeTimer(struct timerWheel *tw, struct twTimer *timer)
+{
+    uint64_t delta;
+    int level, shift, slot;
+
+    if (timer->expires < tw->curTick)   /* Already due */
+        timer->expires = tw->curTick;
+    delta = timer->expires - tw->curTick;
+
+    if (delta < TW_LVL0_SIZE) {
+        slot = timer->expires & (TW_LVL0_SIZE - 1);
+        timer->level = 0;
+        timer->slot = slot;
+        listAddTail(&tw->lvl0[slot], &timer->link);
+        tw->lvl0Map[slot / 64] |= (uint64_t) 1 << (slot % 64);
+        return;
+    }
+
+    for (level = 1; level < TW_LEVELS; level++) {
+        shift = TW_LVL0_BITS + level * TW_LVL_BITS;
+        if (level == TW_LEVELS - 1 || delta < ((uint64_t) 1 << shift))
+            break;
+    }
+
+    if (delta >= TW_RANGE)                      /* Truncate */
+        timer->expires = tw->curTick + TW_RANGE - 1;
+
+    shift = TW_LVL0_BITS + (level - 1) * TW_LVL_BITS;
+    slot = (timer->expires >> shift) & (TW_LVL_SIZE - 1);
+    timer->level = level;
+    timer->slot = slot;
+    listAddTail(&tw->lvl[level - 1][slot], &timer->link);
+}
+
+/* Redistribute the timers in the current slot of 'level' into lower
+   levels. Returns the slot index. */
+
+static int
+cascade(struct timerWheel *tw, int level)
+{
+    struct twList list, *node;
+    int slot;
+
+    slot = (tw->curTick >> (TW_LVL0_BITS + (level - 1) * TW_LVL_BITS)) &
+           (TW_LVL_SIZE - 1);
+
+    listInit(&list);
+    listSplice(&tw->lvl[level - 1][slot], &list);
+    while (!listEmpty(&list)) {
+        node = list.next;
+        listDel(node);
+        placeTimer(tw, (struct twTimer *) node);
+    }
+    return slot;
+}
+
+/* Arm the timerfd for the next tick on which there may be something to
+   do: the next nonempty level 0 slot in the current revolution, or the
+   end of the revolution (when higher levels must be cascaded) */
+
+static int
+rearm(struct timerWheel *tw)
+{
+    struct itimerspec its;
+    uint64_t next, bits;
+    int64_t ns;
+    int idx, w;
+
+    memset(&its, 0, sizeof(its));
+
+    if (tw->count == 0) {
+        if (tw->armedTick == UINT64_MAX)
+            return 0;
+        tw->armedTick = UINT64_MAX;     /* Disarm */
+        return timerfd_settime(tw->fd, 0, &its, NULL);
+    }
+
+    /* If the next tick to be processed starts a revolution, there is a
+       cascade to be done at that tick */
+
+    idx = tw->curTick & (TW_LVL0_SIZE - 1);
+    next = (idx == 0) ? tw->curTick : (tw->curTick | (TW_LVL0_SIZE - 1)) + 1;
+    for (w = idx / 64; idx != 0 && w < TW_LVL0_SIZE / 64; w++) {
+        bits = tw->lvl0Map[w];
+        if (w == idx / 64)
+            bits &= ~(uint64_t) 0 << (idx % 64);
+        if (bits != 0) {
+            next = (tw->curTick & ~(uint64_t) (TW_LVL0_SIZE - 1)) +
+                   w * 64 + __builtin_ctzll(bits);
+            break;
+        }
+    }
+
+    if (next == tw->armedTick)
+        return 0;
+
+    tw->armedTick = next;
+    ns = tw->baseNs + (int64_t) next * tw->tickNs;
+    its.it_value.tv_sec = ns / 1000000000;
+    its.it_value.tv_nsec = ns % 1000000000;
+    return timerfd_settime(tw->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* Initialize 'tw', with ticks of 'tickNs' nanoseconds. Returns 0 on
+   success, or -1 on error. */
+
+int
+twInit(struct timerWheel *tw, long tickNs)
+{
+    int j, k;
+
+    if (tickNs <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(tw, 0, sizeof(*tw));
+    tw->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tw->fd == -1)
+        return -1;
+
+    tw->tickNs = tickNs;
+    tw->baseNs = nowNs();
+    tw->curTick = 0;
+    tw->armedTick = UINT64_MAX;
+
+    for (j = 0; j < TW_LVL0_SIZE; j++)
+        listInit(&tw->lvl0[j]);
+    for (j = 0; j < TW_LEVELS - 1; j++)
+        for (k = 0; k < TW_LVL_SIZE; k++)
+            listInit(&tw->lvl[j][k]);
+    return 0;
+}
+
+/* Initialize 'timer', which will call fn(timer, arg) when it expires */
+
+void
+twTimerInit(struct twTimer *timer, twFunc fn, void *arg)
+{
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->level = -1;
+}
+
+/* Start (or restart) 'timer', to expire after 'delayNs' nanoseconds.
+   Returns 0 on success, or -1 if the timerfd couldn't be armed. */
+
+int
+twAdd(struct timerWheel *tw, struct twTimer *timer, int64_t delayNs)
+{
+    int64_t when;
+
+    if (timer->level != -1)
+        twCancel(tw, timer);
+
+    /* Round up, so that the timer doesn't expire early */
+
+    when = nowNs() + ((delayNs > 0) ? delayNs : 0) - tw->baseNs;
+    timer->expires = (when + tw->tickNs - 1) / tw->tickNs;
+
+    placeTimer(tw, timer);
+    tw->count++;
+
+    if (tw->armedTick == UINT64_MAX || timer->expires < tw->armedTick)
+        return rearm(tw);
+    return 0;
+}
+
+/* Stop 'timer'. Returns 1 if the timer was pending, or 0 if it was not
+   (because it had expired or had never been started). */
+
+int
+twCancel(struct timerWheel *tw, struct twTimer *timer)
+{
+    if (timer->level == -1)
+        return 0;
+
+    listDel(&timer->link);
+    if (timer->level == 0 && listEmpty(&tw->lvl0[timer->slot]))
+        tw->lvl0Map[timer->slot / 64] &=
+            ~((uint64_t) 1 << (timer->slot % 64));
+    timer->level = -1;
+    tw->count--;
+
+    /* We don't rearm the timerfd here: at worst, twProcess() will later
+       be called and find nothing to do */
+
+    return 1;
+}
+
+/* Advance the wheel to the current time and call the callback functions
+   of all expired timers. A callback may add or cancel any timer
+   (including itself). Returns the number of timers that expired, or -1
+   on error. */
+
+int
+twProcess(struct timerWheel *tw)
+{
+    struct twList expired;
+    struct twTimer *timer;
+    uint64_t now, bits, buf, next;
+    int idx, level, w, n;
+
+    /* If the timerfd has expired, it is no longer armed */
+
+    if (read(tw->fd, &buf, sizeof(buf)) == sizeof(buf)) {
+        tw->wakeups++;
+        tw->armedTick = UINT64_MAX;
+    } else if (errno != EAGAIN) {
+        return -1;
+    }
+
+    now = (nowNs() - tw->baseNs) / tw->tickNs;
+    listInit(&expired);
+
+    while (tw->curTick <= now) {
+        idx = tw->curTick & (TW_LVL0_SIZE - 1);
+
+        /* At the start of each level 0 revolution, cascade level 1; at
+           the start of each level 1 revolution, also cascade level 2;
+           and so on */
+
+        if (idx == 0)
+            for (level = 1; level < TW_LEVELS; level++)
+                if (cascade(tw, level) != 0)
+                    break;
+
+        if (!listEmpty(&tw->lvl0[idx])) {
+            listSplice(&tw->lvl0[idx], &expired);
+            tw->lvl0Map[idx / 64] &= ~((uint64_t) 1 << (idx % 64));
+        }
+        tw->curTick++;
+
+        /* Skip ticks whose slots are empty (but stop at the end of the
+           revolution, since something may need to be cascaded) */
+
+        idx = tw->curTick & (TW_LVL0_SIZE - 1);
+        if (idx != 0) {
+            next = (tw->curTick | (TW_LVL0_SIZE - 1)) + 1;
+            for (w = idx / 64; w < TW_LVL0_SIZE / 64; w++) {
+                bits = tw->lvl0Map[w];
+                if (w == idx / 64)
+                    bits &= ~(uint64_t) 0 << (idx % 64);
+                if (bits != 0) {
+                    next = (tw->curTick & ~(uint64_t) (TW_LVL0_SIZE - 1)) +
+                           w * 64 + __builtin_ctzll(bits);
+                    break;
+                }
+            }
+            tw->curTick = min(next, now + 1);
+        }
+    }
+
+    /* Call the callbacks of the expired timers. Each timer is detached
+       before its callback is called, so that the callback may restart
+       it, or cancel other timers in the batch. */
+
+    n = 0;
+    while (!listEmpty(&expired)) {
+        timer = (struct twTimer *) expired.next;
+        listDel(&timer->link);
+        timer->level = -1;
+        tw->count--;
+        timer->fn(timer, timer->arg);
+        n++;
+    }
+
+    if (rearm(tw) == -1)
+        return -1;
+    return n;
+}
+
+/* Close the timerfd. Pending timers are simply abandoned. */
+
+void
+twDestroy(struct timerWheel *tw)
+{
+    close(tw->fd);
+    tw->fd = -1;
+}
@@ -0,0 +1,74 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* timer_wheel.h
+
+   Header file for timer_wheel.c.
+*/
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H           /* Prevent accidental double inclusion */
+
+#include <stdint.h>
+
+#define TW_LVL0_BITS 8          /* Level 0 has 256 slots of one tick */
+#define TW_LVL_BITS 6           /* Higher levels have 64 slots each */
+#define TW_LEVELS 5             /* Range: 2^(8 + 4 * 6) = 2^32 ticks */
+
+#define TW_LVL0_SIZE (1 << TW_LVL0_BITS)
+#define TW_LVL_SIZE (1 << TW_LVL_BITS)
+
+struct twList {                 /* Doubly linked list node/head */
+    struct twList *next;
+    struct twList *prev;
+};
+
+struct twTimer;
+
+typedef void (*twFunc)(struct twTimer *timer, void *arg);
+
+struct twTimer {                /* A timer; allocated by the caller */
+    struct twList link;         /* Must be first */
+    uint64_t expires;           /* Expiry time, in ticks */
+    twFunc fn;                  /* Called on expiry */
+    void *arg;
+    int16_t level;              /* Location in wheel; -1 if not pending */
+    int16_t slot;
+};
+
+struct timerWheel {
+    int fd;                     /* timerfd that drives the wheel */
+    long tickNs;                /* Length of one tick */
+    int64_t baseNs;             /* CLOCK_MONOTONIC time of tick 0 */
+    uint64_t curTick;           /* Next tick to be processed */
+    uint64_t armedTick;         /* timerfd set for this tick, or
+                                   UINT64_MAX if unarmed */
+    long count;                 /* Number of pending timers */
+    unsigned long wakeups;      /* Calls to twProcess() that found the
+                                   timerfd had expired */
+    uint64_t lvl0Map[TW_LVL0_SIZE / 64];    /* Nonempty level 0 slots */
+    struct twList lvl0[TW_LVL0_SIZE];
+    struct twList lvl[TW_LEVELS - 1][TW_LVL_SIZE];
+};
+
+int twInit(struct timerWheel *tw, long tickNs);
+
+void twTimerInit(struct twTimer *timer, twFunc fn, void *arg);
+
+int twAdd(struct timerWheel *tw, struct twTimer *timer, int64_t delayNs);
+
+int twCancel(struct timerWheel *tw, struct twTimer *timer);
+
+int twProcess(struct timerWheel *tw);
+
+void twDestroy(struct timerWheel *tw);
+
+#endif
@@ -0,0 +1,409 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 23 */
+
+/* timer_wheel_bench.c
+
+   Compare the cost of managing a large number of one-shot timers using
+   the timer wheel in timer_wheel.c (one timerfd for all of the timers)
+   with the cost of creating one POSIX timer per timer.
+
+   Usage: timer_wheel_bench [-m wheel|posix]... [-n count[,count...]]
+                            [-d min-ms] [-D max-ms] [-c cancel-pct]
+                            [-t tick-us]
+
+        -m mode      Test only the specified mode (may be repeated;
+                     default: both)
+        -n counts    Comma-separated list of numbers of timers (default:
+                     10000,100000,1000000)
+        -d min-ms    Minimum timeout, in milliseconds (default: 200)
+        -D max-ms    Maximum timeout, in milliseconds (default: 1000)
+        -c pct       Percentage of the timers that are canceled before
+                     they expire (default: 50)
+        -t tick-us   Timer wheel tick, in microseconds (default: 1000)
+
+   For each mode and count, the program starts 'count' timers with
+   random timeouts in the range [min-ms, max-ms], cancels 'pct' percent
+   of them, and then waits for the remainder to expire. It reports the
+   cost of starting and canceling a timer, how late the timers expired
+   (relative to their scheduled expiry time), the number of times that
+   the program was woken, and the CPU time consumed.
+
+   In "posix" mode, each timer is created with timer_create() and
+   notifies expiry via a realtime signal, which is accepted using
+   sigwaitinfo(). Each POSIX timer consumes a kernel sigqueue entry that
+   counts against the RLIMIT_SIGPENDING resource limit, so the program
+   tries to raise that limit.
+
+   This program is Linux-specific.
+*/
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include "timer_wheel.h"
+#include "tlpi_hdr.h"
+
+#define MAX_COUNTS 16
+
+static int64_t *due;                    /* Scheduled expiry times */
+static int64_t *late;                   /* Lateness of each expiry */
+static long nlate;
+
+static int64_t
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * (int64_t) 1000000000 + ts.tv_nsec;
+}
+
+static double
+cpuMs(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) == -1)
+        errExit("getrusage");
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000.0 +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000.0;
+}
+
+static void
+recordExpiry(long idx)
+{
+    late[nlate++] = nowNs() - due[idx];
+}
+
+static int
+cmpInt64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Display one line of results */
+
+static void
+report(const char *mode, long n, double insNs, double cancNs,
+       unsigned long wakeups, double cpu)
+{
+    double avg;
+    long j;
+
+    qsort(late, nlate, sizeof(int64_t), cmpInt64);
+    avg = 0;
+    for (j = 0; j < nlate; j++)
+        avg += late[j];
+    avg = (nlate > 0) ? avg / nlate : 0;
+
+    printf("%-6s %8ld %8.0f %8.0f %8ld %8.0f %8.0f %8.0f %9lu %9.0f\n",
+            mode, n, insNs, cancNs, nlate, avg / 1000,
+            (nlate > 0) ? late[nlate * 99 / 100] / 1000.0 : 0.0,
+            (nlate > 0) ? late[nlate - 1] / 1000.0 : 0.0, wakeups, cpu);
+}
+
+static Boolean
+isCanceled(long j, int cancelPct)
+{
+    return j % 100 < cancelPct;
+}
+
+static void
+wheelExpire(struct twTimer *timer, void *arg)
+{
+    recordExpiry((long) arg);
+}
+
+static void
+benchWheel(long n, int cancelPct, long tickNs)
+{
+    struct timerWheel tw;
+    struct twTimer *timers;
+    struct pollfd pfd;
+    int64_t t0, t1;
+    double cpu0, insNs, cancNs;
+    long j, ncanc;
+
+    timers = calloc(n, sizeof(struct twTimer));
+    if (timers == NULL)
+        errExit("calloc");
+
+    if (twInit(&tw, tickNs) == -1)
+        errExit("twInit");
+    for (j = 0; j < n; j++)
+        twTimerInit(&timers[j], wheelExpire, (void *) j);
+
+    cpu0 = cpuMs();
+    t0 = nowNs();
+    for (j = 0; j < n; j++) {
+        if (twAdd(&tw, &timers[j], due[j]) == -1)
+            errExit("twAdd");
+        due[j] += nowNs();
+    }
+    t1 = nowNs();
+    insNs = (double) (t1 - t0) / n;
+
+    ncanc = 0;
+    for (j = 0; j < n; j++) {
+        if (isCanceled(j, cancelPct)) {
+            twCancel(&tw, &timers[j]);
+            ncanc++;
+        }
+    }
+    cancNs = (ncanc > 0) ? (double) (nowNs() - t1) / ncanc : 0;
+
+    pfd.fd = tw.fd;
+    pfd.events = POLLIN;
+    while (tw.count > 0) {
+        if (poll(&pfd, 1, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            errExit("poll");
+        }
+        if (twProcess(&tw) == -1)
+            errExit("twProcess");
+    }
+
+    report("wheel", n, insNs, cancNs, tw.wakeups, cpuMs() - cpu0);
+
+    twDestroy(&tw);
+    free(timers);
+}
+
+/* Raise the RLIMIT_SIGPENDING soft (and if necessary, hard) limit so
+   that 'n' POSIX timers can be created. Failure is not fatal; we'll
+   find out when timer_create() fails. */
+
+static void
+raiseSigpending(long n)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_SIGPENDING, &rl) == -1)
+        errExit("getrlimit");
+    if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (rlim_t) n + 1024) {
+        rl.rlim_cur = n + 1024;
+        if (rl.rlim_max != RLIM_INFINITY && rl.rlim_max < rl.rlim_cur)
+            rl.rlim_max = rl.rlim_cur;          /* Needs privilege */
+        if (setrlimit(RLIMIT_SIGPENDING, &rl) == -1)
+            fprintf(stderr, "Warning: couldn't raise RLIMIT_SIGPENDING "
+                    "to %ld: %s\n", n + 1024, strerror(errno));
+    }
+}
+
+/* Discard any queued signals left by expired timers */
+
+static void
+drainSignals(const sigset_t *set)
+{
+    struct timespec zero = { 0, 0 };
+
+    while (sigtimedwait(set, NULL, &zero) > 0)
+        continue;
+}
+
+static void
+benchPosix(long n, int cancelPct)
+{
+    struct sigevent sev;
+    struct itimerspec its;
+    siginfo_t si;
+    sigset_t set;
+    timer_t *tids;
+    int64_t t0, t1;
+    double cpu0, insNs, cancNs;
+    long j, k, ncanc, nexp, nsig;
+
+    tids = calloc(n, sizeof(timer_t));
+    if (tids == NULL)
+        errExit("calloc");
+
+    raiseSigpending(n);
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGRTMIN);
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGRTMIN;
+    memset(&its, 0, sizeof(its));
+
+    /* Creating and arming a POSIX timer are separate steps; we count
+       both as the cost of starting the timer */
+
+    cpu0 = cpuMs();
+    t0 = nowNs();
+    for (j = 0; j < n; j++) {
+        sev.sigev_value.sival_int = j;
+        if (timer_create(CLOCK_MONOTONIC, &sev, &tids[j]) == -1) {
+            fprintf(stderr, "posix: timer_create() failed after %ld "
+                    "timers: %s\n", j, strerror(errno));
+            for (k = 0; k < j; k++)
+                if (timer_delete(tids[k]) == -1)
+                    errExit("timer_delete");
+
+            drainSignals(&set);
+            free(tids);
+            return;
+        }
+        due[j] += nowNs();
+        its.it_value.tv_sec = due[j] / 1000000000;
+        its.it_value.tv_nsec = due[j] % 1000000000;
+        if (timer_settime(tids[j], TIMER_ABSTIME, &its, NULL) == -1)
+            errExit("timer_settime");
+    }
+    t1 = nowNs();
+    insNs = (double) (t1 - t0) / n;
+
+    ncanc = 0;
+    for (j = 0; j < n; j++) {
+        if (isCanceled(j, cancelPct)) {
+            if (timer_delete(tids[j]) == -1)
+                errExit("timer_delete");
+            ncanc++;
+        }
+    }
+    cancNs = (ncanc > 0) ? (double) (nowNs() - t1) / ncanc : 0;
+
+    /* A timer that expired before it was deleted may have left a signal
+       queued; such signals are ignored */
+
+    nsig = 0;
+    for (nexp = 0; nexp < n - ncanc; ) {
+        if (sigwaitinfo(&set, &si) == -1)
+            errExit("sigwaitinfo");
+        nsig++;
+        if (!isCanceled(si.si_value.sival_int, cancelPct)) {
+            recordExpiry(si.si_value.sival_int);
+            nexp++;
+        }
+    }
+
+    report("posix", n, insNs, cancNs, nsig, cpuMs() - cpu0);
+
+    for (j = 0; j < n; j++)
+        if (!isCanceled(j, cancelPct))
+            if (timer_delete(tids[j]) == -1)
+                errExit("timer_delete");
+    drainSignals(&set);
+    free(tids);
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-m wheel|posix]... [-n count[,count...]] "
+                    "[-d min-ms] [-D max-ms]\n"
+                    "          [-c cancel-pct] [-t tick-us]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long counts[MAX_COUNTS];
+    char *tok;
+    Boolean doWheel, doPosix;
+    sigset_t set;
+    int opt, ncounts, minMs, maxMs, cancelPct, tickUs, c, m;
+    long n, j;
+
+    doWheel = doPosix = FALSE;
+    ncounts = 0;
+    minMs = 200;
+    maxMs = 1000;
+    cancelPct = 50;
+    tickUs = 1000;
+    while ((opt = getopt(argc, argv, "m:n:d:D:c:t:")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "wheel") == 0)
+                doWheel = TRUE;
+            else if (strcmp(optarg, "posix") == 0)
+                doPosix = TRUE;
+            else
+                usageError(argv[0]);
+            break;
+        case 'n':
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                if (ncounts == MAX_COUNTS)
+                    cmdLineErr("Too many counts (max %d)\n", MAX_COUNTS);
+                counts[ncounts++] = getLong(tok, GN_GT_0, "count");
+            }
+            break;
+        case 'd':   minMs = getInt(optarg, GN_NONNEG, "min-ms");        break;
+        case 'D':   maxMs = getInt(optarg, GN_NONNEG, "max-ms");        break;
+        case 'c':   cancelPct = getInt(optarg, GN_NONNEG, "cancel-pct"); break;
+        case 't':   tickUs = getInt(optarg, GN_GT_0, "tick-us");        break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc || maxMs < minMs || cancelPct > 100)
+        usageError(argv[0]);
+
+    if (!doWheel && !doPosix)
+        doWheel = doPosix = TRUE;
+    if (ncounts == 0) {
+        counts[ncounts++] = 10000;
+        counts[ncounts++] = 100000;
+        counts[ncounts++] = 1000000;
+    }
+
+    /* SIGRTMIN is accepted with sigwaitinfo() in "posix" mode */
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGRTMIN);
+    if (sigprocmask(SIG_BLOCK, &set, NULL) == -1)
+        errExit("sigprocmask");
+
+    printf("%-6s %8s %8s %8s %8s %8s %8s %8s %9s %9s\n", "mode", "timers",
+            "start-ns", "canc-ns", "expired", "late-us", "p99-us", "max-us",
+            "wakeups", "cpu-ms");
+
+    for (c = 0; c < ncounts; c++) {
+        n = counts[c];
+        due = malloc(n * sizeof(int64_t));
+        late = malloc(n * sizeof(int64_t));
+        if (due == NULL || late == NULL)
+            errExit("malloc");
+
+        for (m = 0; m < 2; m++) {
+            if ((m == 0 && !doWheel) || (m == 1 && !doPosix))
+                continue;
+
+            /* Both modes use the same timeouts; each timeout is relative
+               to the time at which its timer was started */
+
+            srandom(n);
+            for (j = 0; j < n; j++)
+                due[j] = (minMs + random() % (maxMs - minMs + 1)) *
+                         (int64_t) 1000000 + random() % 1000000;
+            nlate = 0;
+
+            if (m == 0)
+                benchWheel(n, cancelPct, tickUs * 1000L);
+            else
+                benchPosix(n, cancelPct);
+        }
+
+        free(due);
+        free(late);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,117 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 62 */
+
+/* tty_batch.c
+
+   Terminal settings for programs that read bulk data (for example, from
+   a fast serial line) rather than keystrokes.
+
+   ttySetRaw() (tty_functions.c) sets MIN to 1 and TIME to 0, so that
+   read() returns as soon as a single byte is available: right for
+   interactive input, but, for a stream arriving at hundreds of kilobytes
+   per second, it means a read() for every few bytes. ttySetRawBatch()
+   makes the same changes as ttySetRaw(), but lets the caller choose MIN
+   (0 to 255 bytes) and TIME (0 to 255 tenths of a second); with, say,
+   MIN 64 and TIME 1, read() returns when 64 bytes have accumulated, or
+   when the line has been quiet for a tenth of a second after at least
+   one byte has arrived (so that the tail of a burst isn't held
+   indefinitely).
+
+   The gain is smaller than might be expected (see tty_batch_bench.c).
+   Since Linux 5.12, the terminal layer passes data from the line
+   discipline to read() through a 64-byte buffer, so that a MIN larger
+   than 64 has the same effect as 64; and the line discipline wakes a
+   blocked reader whenever data arrives, leaving it to check MIN and go
+   back to sleep, so a larger MIN saves system calls but not wakeups. A
+   reader that can tolerate a few milliseconds' delay does far better by
+   setting MIN and TIME to 0 (so that read() doesn't block), and, each
+   time read() returns 0, sleeping for a fixed interval; at 400 KB/s,
+   sleeping for 5 ms cut the reader's CPU time by a factor of 15. The
+   interval must be short enough that the input queue, which holds 4096
+   bytes, doesn't fill in the meantime: when it fills, the sender is
+   throttled if flow control is enabled, and data is lost if not. For
+   the same reason, a read() buffer larger than 4096 bytes gains nothing.
+
+   ttySetLowLatency() sets or clears the ASYNC_LOW_LATENCY flag of a
+   serial port (see setserial(8)), which asks the driver to pass received
+   data to the line discipline immediately rather than from a work
+   queue; recent kernels ignore the flag for most drivers, and
+   pseudoterminals don't support it at all (the call fails with ENOTTY
+   or EINVAL), so callers should treat failure as harmless.
+
+   This module is Linux-specific.
+*/
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#include <termios.h>
+#include <unistd.h>
+#include <errno.h>
+#include "tty_batch.h"          /* Declares functions defined here */
+
+/* Place the terminal referred to by 'fd' in raw mode (as ttySetRaw()
+   does), with MIN set to 'vmin' and TIME to 'vtime' (tenths of a
+   second). Return 0 on success, or -1 on error. If 'prevTermios' is
+   non-NULL, then use the buffer to which it points to return the
+   previous terminal settings. */
+
+int
+ttySetRawBatch(int fd, struct termios *prevTermios, int vmin, int vtime)
+{
+    struct termios t;
+
+    if (vmin < 0 || vmin > 255 || vtime < 0 || vtime > 255) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (tcgetattr(fd, &t) == -1)
+        return -1;
+
+    if (prevTermios != NULL)
+        *prevTermios = t;
+
+    t.c_lflag &= ~(ICANON | ISIG | IEXTEN | ECHO);
+    t.c_iflag &= ~(BRKINT | ICRNL | IGNBRK | IGNCR | INLCR |
+                      INPCK | ISTRIP | IXON | PARMRK);
+    t.c_oflag &= ~OPOST;
+
+    t.c_cc[VMIN] = vmin;
+    t.c_cc[VTIME] = vtime;
+
+    if (tcsetattr(fd, TCSAFLUSH, &t) == -1)
+        return -1;
+
+    return 0;
+}
+
+/* Set ('on' nonzero) or clear the ASYNC_LOW_LATENCY flag of the serial
+   port referred to by 'fd'. If 'prevOn' is non-NULL, return the previous
+   setting in '*prevOn'. Return 0 on success, or -1 on error. */
+
+int
+ttySetLowLatency(int fd, int on, int *prevOn)
+{
+    struct serial_struct ss;
+
+    if (ioctl(fd, TIOCGSERIAL, &ss) == -1)
+        return -1;
+
+    if (prevOn != NULL)
+        *prevOn = (ss.flags & ASYNC_LOW_LATENCY) != 0;
+
+    if (on)
+        ss.flags |= ASYNC_LOW_LATENCY;
+    else
+        ss.flags &= ~ASYNC_LOW_LATENCY;
+
+    return ioctl(fd, TIOCSSERIAL, &ss);
+}
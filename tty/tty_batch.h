@@ -0,0 +1,27 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 62 */
+
+/* tty_batch.h
+
+   Header file for tty_batch.c.
+*/
+#ifndef TTY_BATCH_H
+#define TTY_BATCH_H             /* Prevent accidental double inclusion */
+
+#include <termios.h>
+
+int ttySetRawBatch(int fd, struct termios *prevTermios, int vmin,
+                   int vtime);
+
+int ttySetLowLatency(int fd, int on, int *prevOn);
+
+#endif
@@ -0,0 +1,254 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 62 */
+
+/* tty_batch_bench.c
+
+   Measure the cost of reading a steady stream of data from a terminal
+   with various MIN and TIME settings (see tty_batch.c).
+
+   Usage: tty_batch_bench [-r rate] [-c chunk] [-d secs] [-b bufsize] [-l]
+                          [min/time...]
+
+        -r rate     Rate at which data is sent, in KB/s (default: 400,
+                    roughly a 4 Mbaud serial line)
+        -c chunk    Bytes written at a time (default: 16, as a UART with
+                    a 16-byte FIFO might deliver them)
+        -d secs     Duration of each measurement (default: 3)
+        -b bufsize  Size of the reader's buffer (default: 4096)
+        -l          Try to set ASYNC_LOW_LATENCY (fails on a pseudoterminal)
+
+   Each 'min/time' argument is a setting to measure (default: 1/0 32/1
+   64/1 255/1 @5); 1/0 is what ttySetRaw() uses. A setting of the form
+   '@ms' means MIN 0 and TIME 0 (so that read() never blocks), with the
+   reader sleeping for 'ms' milliseconds each time it has emptied the
+   terminal's input queue. For each setting, the program
+   opens a pseudoterminal, places the slave in raw mode with that
+   setting, and creates a child process that writes to the master at the
+   given rate, while the parent reads from the slave. It reports the rate
+   at which data was read, the number of read() calls and the average
+   bytes returned by each, the reads and voluntary context switches (that
+   is, wakeups) per KB, and the reader's CPU time, per KB and as a
+   percentage of the elapsed time.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include "pty_master_open.h"
+#include "tty_batch.h"
+#include "tlpi_hdr.h"
+
+#define MAX_SLAVE_NAME 1000
+#define MAX_CHUNK 4096
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static volatile sig_atomic_t stop;
+
+static void
+alarmHandler(int sig)
+{
+    stop = 1;                   /* And interrupt read() */
+}
+
+/* Child: write to 'fd' at 'rate' KB/s, 'chunk' bytes per write(), until
+   killed */
+
+static void
+writer(int fd, int rate, int chunk)
+{
+    char buf[MAX_CHUNK];
+    struct timespec ts;
+    long long start, written, due, next;
+
+    memset(buf, 'x', sizeof(buf));
+    start = nowNs();
+    for (written = 0; ; ) {
+        due = (nowNs() - start) * rate / 1000000 - written;
+        while (due >= chunk) {
+            if (write(fd, buf, chunk) != chunk)
+                errExit("write");
+            written += chunk;
+            due -= chunk;
+        }
+
+        /* Sleep until the next chunk is due */
+
+        next = start + (written + chunk) * 1000000 / rate;
+        ts.tv_sec = next / 1000000000;
+        ts.tv_nsec = next % 1000000000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+}
+
+static double
+cpuSecs(const struct rusage *ru)
+{
+    return ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6 +
+           ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-r rate] [-c chunk] [-d secs] "
+            "[-b bufsize] [-l]\n        [min/time...]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static char *defSettings[] = { "1/0", "32/1", "64/1", "255/1", "@5",
+                                   NULL };
+    char slaveName[MAX_SLAVE_NAME];
+    char **settings, *buf;
+    struct sigaction sa;
+    struct rusage ru0, ru1;
+    struct itimerval itv;
+    long long t0, bytes, reads;
+    double secs, kb, cpu;
+    ssize_t numRead;
+    Boolean lowLatency;
+    int opt, rate, chunk, dur, bufSize, vmin, vtime, pollMs, mfd, sfd, j;
+    pid_t child;
+
+    rate = 400;
+    chunk = 16;
+    dur = 3;
+    bufSize = 4096;
+    lowLatency = FALSE;
+    while ((opt = getopt(argc, argv, "r:c:d:b:l")) != -1) {
+        switch (opt) {
+        case 'r':   rate = getInt(optarg, GN_GT_0, "-r");       break;
+        case 'c':   chunk = getInt(optarg, GN_GT_0, "-c");      break;
+        case 'd':   dur = getInt(optarg, GN_GT_0, "-d");        break;
+        case 'b':   bufSize = getInt(optarg, GN_GT_0, "-b");    break;
+        case 'l':   lowLatency = TRUE;                          break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (chunk > MAX_CHUNK)
+        cmdLineErr("-c must be at most %d\n", MAX_CHUNK);
+    settings = (optind < argc) ? &argv[optind] : defSettings;
+
+    buf = malloc(bufSize);
+    if (buf == NULL)
+        errExit("malloc");
+
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;                    /* No SA_RESTART */
+    sa.sa_handler = alarmHandler;
+    if (sigaction(SIGALRM, &sa, NULL) == -1)
+        errExit("sigaction");
+
+    printf("%d KB/s in %d-byte writes, %d-byte reads\n", rate, chunk,
+           bufSize);
+    printf("%-8s %8s %9s %8s %8s %8s %9s %6s\n", "min/time", "KB/s",
+           "reads", "B/read", "reads/KB", "csw/KB", "cpu-us/KB", "cpu%");
+
+    for (j = 0; settings[j] != NULL; j++) {
+        pollMs = 0;
+        if (sscanf(settings[j], "@%d", &pollMs) == 1 && pollMs > 0)
+            vmin = vtime = 0;
+        else if (sscanf(settings[j], "%d/%d", &vmin, &vtime) != 2)
+            cmdLineErr("Bad setting: %s\n", settings[j]);
+
+        mfd = ptyMasterOpen(slaveName, sizeof(slaveName));
+        if (mfd == -1)
+            errExit("ptyMasterOpen");
+        sfd = open(slaveName, O_RDWR | O_NOCTTY);
+        if (sfd == -1)
+            errExit("open %s", slaveName);
+        if (ttySetRawBatch(sfd, NULL, vmin, vtime) == -1)
+            errExit("ttySetRawBatch %s", settings[j]);
+        if (lowLatency && ttySetLowLatency(sfd, 1, NULL) == -1)
+            errMsg("ttySetLowLatency");
+
+        switch (child = fork()) {
+        case -1:
+            errExit("fork");
+        case 0:
+            close(sfd);
+            writer(mfd, rate, chunk);
+            _exit(EXIT_SUCCESS);
+        default:
+            break;
+        }
+
+        if (getrusage(RUSAGE_SELF, &ru0) == -1)
+            errExit("getrusage");
+        bytes = reads = 0;
+        stop = 0;
+        t0 = nowNs();
+
+        /* After the first signal, repeat it until we notice: a signal
+           that arrives between reads doesn't interrupt the next one */
+
+        itv.it_value.tv_sec = dur;
+        itv.it_value.tv_usec = 0;
+        itv.it_interval.tv_sec = 0;
+        itv.it_interval.tv_usec = 10000;
+        if (setitimer(ITIMER_REAL, &itv, NULL) == -1)
+            errExit("setitimer");
+        while (!stop) {
+            numRead = read(sfd, buf, bufSize);
+            if (numRead == -1) {
+                if (errno == EINTR)
+                    continue;
+                errExit("read");
+            }
+            bytes += numRead;
+            reads++;
+            if (numRead == 0 && pollMs > 0)     /* Drained: sleep */
+                usleep(pollMs * 1000);
+        }
+        secs = (nowNs() - t0) / 1e9;
+        memset(&itv, 0, sizeof(itv));
+        if (setitimer(ITIMER_REAL, &itv, NULL) == -1)
+            errExit("setitimer");
+        if (getrusage(RUSAGE_SELF, &ru1) == -1)
+            errExit("getrusage");
+
+        kill(child, SIGKILL);
+        if (waitpid(child, NULL, 0) == -1)
+            errExit("waitpid");
+        close(sfd);
+        close(mfd);
+
+        kb = bytes / 1000.0;
+        cpu = cpuSecs(&ru1) - cpuSecs(&ru0);
+        printf("%-8s %8.1f %9lld %8.1f %8.2f %8.2f %9.2f %6.1f\n",
+               settings[j], kb / secs, reads,
+               (reads > 0) ? (double) bytes / reads : 0.0,
+               (kb > 0) ? reads / kb : 0.0,
+               (kb > 0) ? (ru1.ru_nvcsw - ru0.ru_nvcsw) / kb : 0.0,
+               (kb > 0) ? cpu * 1e6 / kb : 0.0, cpu * 100 / secs);
+        fflush(stdout);
+    }
+
+    free(buf);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,651 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 8 */
+
+/* pw_verify.c
+
+   A password verification service: a pool of worker threads that check
+   passwords against the shadow password database, for a server (such as
+   an authentication gateway) that must check many passwords, each of
+   which, with a modern hashing method (yescrypt, or SHA-512 with many
+   rounds), costs milliseconds of CPU time.
+
+   Unlike check_password.c, which uses crypt() and getspnam(), which
+   return results in static buffers, the workers use crypt_r(), each
+   with its own 'struct crypt_data' (which is large, and so is allocated
+   rather than placed on the stack), and getspnam_r().
+
+   pwvSubmit() queues a request, and 'func' is called (in a worker
+   thread) with the result: PWV_OK, PWV_BAD, or -1 if the user's entry
+   couldn't be read (for example, because the caller lacks permission to
+   read the shadow file). At most 'queueMax' requests can wait for a
+   worker; when the queue is full, pwvSubmit() either waits or (if 'wait'
+   is zero) fails with EAGAIN, so that a server can shed load rather than
+   let the time requests spend queued grow without limit. pwvVerify()
+   submits a request, waits for the result, and returns it.
+
+   Care is taken with the password hashes and cleartext passwords:
+
+   * The copy of each password that is queued is erased (with
+     explicit_bzero()) once it has been checked, as are cached hashes
+     when they are discarded.
+
+   * Cached hashes expire after 'cacheTtl' seconds, and the whole cache
+     is discarded if the shadow file (/etc/shadow, or 'shadowFile')
+     changes, so that a changed password or a locked account takes
+     effect at once. The check for changes is made at most once per
+     second.
+
+   * A password for an unknown user, or for an account whose hash is
+     locked ("!" or "*") or empty, is hashed anyway (using a hash made
+     with the default method when the service starts), so that the time
+     taken does not reveal which user names exist. Such requests always
+     fail.
+
+   * Hashes are compared without an early exit.
+*/
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <crypt.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <shadow.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "pw_verify.h"          /* Declares functions defined here */
+
+#define USER_MAX 256            /* Longest user name, plus 1 */
+#define CACHE_BUCKETS 4096
+#define CACHE_MAX 65536         /* Flush the cache if it grows this big
+                                   (e.g., with guessed user names) */
+#define DEFAULT_SHADOW "/etc/shadow"
+
+#ifndef CRYPT_OUTPUT_SIZE               /* Defined by libxcrypt */
+#define CRYPT_OUTPUT_SIZE 384
+#endif
+
+struct request {
+    char user[USER_MAX];
+    char *password;             /* Copy, erased once checked */
+    pwvCallback func;
+    void *arg;
+    long long submitNs;
+};
+
+struct cacheEntry {
+    char user[USER_MAX];
+    char *hash;                 /* NULL if the user has no entry */
+    time_t expires;
+    struct cacheEntry *next;
+};
+
+struct pwVerifier {
+    struct pwvParams p;
+    const char *watchFile;      /* File checked for changes */
+    pthread_t *tids;
+    int nthreads;               /* Threads started */
+
+    pthread_mutex_t mtx;        /* Protects the queue and 'stats' */
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    struct request *queue;      /* 'queueMax' slots */
+    int head;
+    int count;
+    int stop;
+    struct pwvStats stats;
+
+    pthread_mutex_t cacheMtx;   /* Protects the cache */
+    struct cacheEntry *buckets[CACHE_BUCKETS];
+    int cached;
+    time_t lastCheck;
+    struct stat watchSt;        /* Shadow file's state when last checked */
+    int haveWatchSt;
+
+    char dummyHash[CRYPT_OUTPUT_SIZE];
+};
+
+void
+pwvDefaultParams(struct pwvParams *params)
+{
+    long ncpus;
+
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    params->threads = (ncpus > 0) ? ncpus : 1;
+    params->queueMax = 1024;
+    params->cacheTtl = 60;
+    params->shadowFile = NULL;
+}
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static unsigned int
+hashName(const char *s)
+{
+    unsigned int h;
+
+    for (h = 2166136261u; *s != '\0'; s++)      /* FNV-1a */
+        h = (h ^ (unsigned char) *s) * 16777619u;
+    return h % CACHE_BUCKETS;
+}
+
+static void
+freeEntry(struct cacheEntry *e)
+{
+    if (e->hash != NULL) {
+        explicit_bzero(e->hash, strlen(e->hash));
+        free(e->hash);
+    }
+    free(e);
+}
+
+/* Discard the whole cache (caller holds 'cacheMtx') */
+
+static void
+flushCache(struct pwVerifier *pv)
+{
+    struct cacheEntry *e, *next;
+    int j;
+
+    for (j = 0; j < CACHE_BUCKETS; j++) {
+        for (e = pv->buckets[j]; e != NULL; e = next) {
+            next = e->next;
+            freeEntry(e);
+        }
+        pv->buckets[j] = NULL;
+    }
+    pv->cached = 0;
+}
+
+/* Flush the cache if the shadow file has changed since the last check
+   (caller holds 'cacheMtx') */
+
+static void
+checkShadowFile(struct pwVerifier *pv, time_t now)
+{
+    struct stat sb;
+
+    if (now == pv->lastCheck)
+        return;
+    pv->lastCheck = now;
+
+    if (stat(pv->watchFile, &sb) == -1)
+        return;
+    if (pv->haveWatchSt && (sb.st_ino != pv->watchSt.st_ino ||
+            sb.st_dev != pv->watchSt.st_dev ||
+            sb.st_size != pv->watchSt.st_size ||
+            sb.st_mtim.tv_sec != pv->watchSt.st_mtim.tv_sec ||
+            sb.st_mtim.tv_nsec != pv->watchSt.st_mtim.tv_nsec ||
+            sb.st_ctim.tv_sec != pv->watchSt.st_ctim.tv_sec ||
+            sb.st_ctim.tv_nsec != pv->watchSt.st_ctim.tv_nsec)) {
+        flushCache(pv);
+        pthread_mutex_lock(&pv->mtx);
+        pv->stats.flushes++;
+        pthread_mutex_unlock(&pv->mtx);
+    }
+    pv->watchSt = sb;
+    pv->haveWatchSt = 1;
+}
+
+/* Look up the hash for 'user' in the shadow file or database, placing
+   it in 'hash' (of 'len' bytes), or setting it to the empty string if
+   the user has no entry. Returns 0 on success, or -1 on error. */
+
+static int
+lookupHash(struct pwVerifier *pv, const char *user, char *hash, size_t len)
+{
+    struct spwd sp, *spp;
+    struct passwd pw, *pwp;
+    char buf[4096];
+    const char *found;
+    FILE *fp;
+    int s;
+
+    found = NULL;
+    if (pv->p.shadowFile != NULL) {
+        fp = fopen(pv->p.shadowFile, "re");
+        if (fp == NULL)
+            return -1;
+        while (fgetspent_r(fp, &sp, buf, sizeof(buf), &spp) == 0)
+            if (strcmp(sp.sp_namp, user) == 0) {
+                found = sp.sp_pwdp;
+                break;
+            }
+        fclose(fp);
+
+    } else {
+        s = getspnam_r(user, &sp, buf, sizeof(buf), &spp);
+        if (spp != NULL) {
+            found = sp.sp_pwdp;
+        } else if (s != 0 && s != ENOENT) {
+            errno = s;
+            return -1;
+
+        } else {                /* No shadow entry: try the passwd entry */
+            s = getpwnam_r(user, &pw, buf, sizeof(buf), &pwp);
+            if (pwp != NULL)
+                found = pw.pw_passwd;
+            else if (s != 0 && s != ENOENT) {
+                errno = s;
+                return -1;
+            }
+        }
+    }
+
+    if (found == NULL || strlen(found) >= len)
+        found = "";
+    strcpy(hash, found);
+    explicit_bzero(buf, sizeof(buf));
+    return 0;
+}
+
+/* Obtain the hash for 'user', from the cache if possible. Returns 0 on
+   success, or -1 on error. */
+
+static int
+getHash(struct pwVerifier *pv, const char *user, char *hash, size_t len)
+{
+    struct cacheEntry *e, **pp;
+    time_t now;
+    unsigned int b;
+    int hit;
+
+    if (pv->p.cacheTtl <= 0)
+        return lookupHash(pv, user, hash, len);
+
+    now = time(NULL);
+    b = hashName(user);
+
+    pthread_mutex_lock(&pv->cacheMtx);
+    checkShadowFile(pv, now);
+    for (pp = &pv->buckets[b]; (e = *pp) != NULL; pp = &e->next)
+        if (strcmp(e->user, user) == 0)
+            break;
+    if (e != NULL && e->expires <= now) {       /* Expired: discard */
+        *pp = e->next;
+        freeEntry(e);
+        pv->cached--;
+        e = NULL;
+    }
+    hit = (e != NULL);
+    if (hit)
+        strcpy(hash, (e->hash != NULL) ? e->hash : "");
+    pthread_mutex_unlock(&pv->cacheMtx);
+
+    pthread_mutex_lock(&pv->mtx);
+    if (hit)
+        pv->stats.cacheHits++;
+    else
+        pv->stats.cacheMisses++;
+    pthread_mutex_unlock(&pv->mtx);
+    if (hit)
+        return 0;
+
+    /* Look the user up without holding the lock (another thread may do
+       the same for the same user, in which case we cache it twice, and
+       the first entry found is used) */
+
+    if (lookupHash(pv, user, hash, len) == -1)
+        return -1;
+
+    e = malloc(sizeof(struct cacheEntry));
+    if (e == NULL)
+        return 0;               /* Just don't cache it */
+    strcpy(e->user, user);
+    e->hash = (*hash != '\0') ? strdup(hash) : NULL;
+    if (*hash != '\0' && e->hash == NULL) {
+        free(e);
+        return 0;
+    }
+    e->expires = now + pv->p.cacheTtl;
+
+    pthread_mutex_lock(&pv->cacheMtx);
+    if (pv->cached >= CACHE_MAX)
+        flushCache(pv);
+    e->next = pv->buckets[b];
+    pv->buckets[b] = e;
+    pv->cached++;
+    pthread_mutex_unlock(&pv->cacheMtx);
+    return 0;
+}
+
+/* Compare two strings in time that depends only on their lengths */
+
+static int
+sameString(const char *a, const char *b)
+{
+    size_t len, j;
+    unsigned char diff;
+
+    len = strlen(a);
+    if (strlen(b) != len)
+        return 0;
+    for (diff = 0, j = 0; j < len; j++)
+        diff |= a[j] ^ b[j];
+    return diff == 0;
+}
+
+static int
+verifyOne(struct pwVerifier *pv, struct crypt_data *cd,
+          const struct request *req)
+{
+    char hash[CRYPT_OUTPUT_SIZE];
+    const char *setting, *out;
+    int usable;
+
+    if (getHash(pv, req->user, hash, sizeof(hash)) == -1)
+        return -1;
+
+    usable = hash[0] != '\0' && hash[0] != '!' && hash[0] != '*';
+    setting = usable ? hash : pv->dummyHash;
+
+    out = crypt_r(req->password, setting, cd);
+    usable = usable && out != NULL && out[0] != '*' && sameString(out, hash);
+
+    explicit_bzero(hash, sizeof(hash));
+    return usable ? PWV_OK : PWV_BAD;
+}
+
+static void *
+workerFunc(void *arg)
+{
+    struct pwVerifier *pv = arg;
+    struct crypt_data *cd;
+    struct request req;
+    long long queueNs;
+    int result, savedErrno;
+
+    cd = calloc(1, sizeof(struct crypt_data));      /* Zeroed, as
+                                                       crypt_r() requires */
+
+    pthread_mutex_lock(&pv->mtx);
+    for (;;) {
+        while (pv->count == 0 && !pv->stop)
+            pthread_cond_wait(&pv->notEmpty, &pv->mtx);
+        if (pv->count == 0)             /* Stopping, and queue drained */
+            break;
+
+        req = pv->queue[pv->head];
+        pv->head = (pv->head + 1) % pv->p.queueMax;
+        pv->count--;
+        pthread_cond_signal(&pv->notFull);
+        pthread_mutex_unlock(&pv->mtx);
+
+        queueNs = nowNs() - req.submitNs;
+        if (cd == NULL) {
+            errno = ENOMEM;
+            result = -1;
+        } else {
+            result = verifyOne(pv, cd, &req);
+        }
+        savedErrno = errno;
+        explicit_bzero(req.password, strlen(req.password));
+        free(req.password);
+
+        pthread_mutex_lock(&pv->mtx);
+        pv->stats.verified++;
+        if (result == PWV_OK)
+            pv->stats.ok++;
+        if (result == -1) {
+            pv->stats.errors++;
+            pv->stats.lastErrno = savedErrno;
+        }
+        pv->stats.queueNs += queueNs;
+        if (queueNs > pv->stats.maxQueueNs)
+            pv->stats.maxQueueNs = queueNs;
+        pthread_mutex_unlock(&pv->mtx);
+
+        req.func(req.arg, result, queueNs);
+
+        pthread_mutex_lock(&pv->mtx);
+    }
+    pthread_mutex_unlock(&pv->mtx);
+
+    if (cd != NULL) {
+        explicit_bzero(cd, sizeof(struct crypt_data));
+        free(cd);
+    }
+    return NULL;
+}
+
+/* Start a verification service. If 'params' is NULL, pwvDefaultParams()
+   is used. Returns a handle, or NULL on error. */
+
+struct pwVerifier *
+pwvOpen(const struct pwvParams *params)
+{
+    struct pwVerifier *pv;
+#ifdef CRYPT_GENSALT_IMPLEMENTS_DEFAULT_PREFIX
+    char setting[CRYPT_GENSALT_OUTPUT_SIZE];
+#endif
+    struct crypt_data *cd;
+    sigset_t all, prev;
+    const char *out;
+    int j, s;
+
+    pv = calloc(1, sizeof(struct pwVerifier));
+    if (pv == NULL)
+        return NULL;
+    if (params != NULL)
+        pv->p = *params;
+    else
+        pwvDefaultParams(&pv->p);
+    if (pv->p.threads < 1 || pv->p.queueMax < 1) {
+        free(pv);
+        errno = EINVAL;
+        return NULL;
+    }
+    pv->watchFile = (pv->p.shadowFile != NULL) ? pv->p.shadowFile :
+                                                 DEFAULT_SHADOW;
+
+    /* Make the hash used for users that have none, with the default
+       method (and cost) if libxcrypt tells us what that is, or else
+       SHA-512 */
+
+    cd = calloc(1, sizeof(struct crypt_data));
+    if (cd == NULL) {
+        free(pv);
+        return NULL;
+    }
+    out = NULL;
+#ifdef CRYPT_GENSALT_IMPLEMENTS_DEFAULT_PREFIX
+    if (crypt_gensalt_rn(NULL, 0, NULL, 0, setting, sizeof(setting)) != NULL)
+        out = crypt_r("not a password", setting, cd);
+#endif
+    if (out == NULL || out[0] == '*' || strlen(out) >= CRYPT_OUTPUT_SIZE)
+        out = crypt_r("not a password", "$6$pwvDummySalt", cd);
+    if (out == NULL || out[0] == '*') {
+        free(cd);
+        free(pv);
+        errno = EINVAL;
+        return NULL;
+    }
+    strcpy(pv->dummyHash, out);
+    free(cd);
+
+    pv->queue = calloc(pv->p.queueMax, sizeof(struct request));
+    pv->tids = calloc(pv->p.threads, sizeof(pthread_t));
+    if (pv->queue == NULL || pv->tids == NULL) {
+        free(pv->queue);
+        free(pv->tids);
+        free(pv);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pv->mtx, NULL);
+    pthread_cond_init(&pv->notEmpty, NULL);
+    pthread_cond_init(&pv->notFull, NULL);
+    pthread_mutex_init(&pv->cacheMtx, NULL);
+
+    /* The workers block all signals, so that they aren't chosen to
+       handle signals directed at the process */
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &prev);
+    for (j = 0; j < pv->p.threads; j++) {
+        s = pthread_create(&pv->tids[j], NULL, workerFunc, pv);
+        if (s != 0)
+            break;
+        pv->nthreads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &prev, NULL);
+
+    if (pv->nthreads < pv->p.threads) {
+        pwvClose(pv);
+        errno = s;
+        return NULL;
+    }
+    return pv;
+}
+
+/* Queue a request to verify 'password' for 'user'; 'func' will be called
+   with 'arg' and the result. If the queue is full, wait if 'wait' is
+   nonzero, or else fail with EAGAIN. Returns 0 on success, or -1 on
+   error. */
+
+int
+pwvSubmit(struct pwVerifier *pv, const char *user, const char *password,
+          int wait, pwvCallback func, void *arg)
+{
+    struct request *req;
+    char *copy;
+
+    if (strlen(user) >= USER_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    copy = strdup(password);
+    if (copy == NULL)
+        return -1;
+
+    pthread_mutex_lock(&pv->mtx);
+    while (pv->count == pv->p.queueMax && !pv->stop) {
+        if (!wait) {
+            pv->stats.rejected++;
+            pthread_mutex_unlock(&pv->mtx);
+            explicit_bzero(copy, strlen(copy));
+            free(copy);
+            errno = EAGAIN;
+            return -1;
+        }
+        pthread_cond_wait(&pv->notFull, &pv->mtx);
+    }
+    if (pv->stop) {
+        pthread_mutex_unlock(&pv->mtx);
+        explicit_bzero(copy, strlen(copy));
+        free(copy);
+        errno = EINVAL;
+        return -1;
+    }
+
+    req = &pv->queue[(pv->head + pv->count) % pv->p.queueMax];
+    strcpy(req->user, user);
+    req->password = copy;
+    req->func = func;
+    req->arg = arg;
+    req->submitNs = nowNs();
+    pv->count++;
+    pthread_cond_signal(&pv->notEmpty);
+    pthread_mutex_unlock(&pv->mtx);
+    return 0;
+}
+
+/* Synchronous verification, for pwvVerify() */
+
+struct syncResult {
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    int done;
+    int result;
+};
+
+static void
+syncDone(void *arg, int result, long long queueNs)
+{
+    struct syncResult *sr = arg;
+
+    pthread_mutex_lock(&sr->mtx);
+    sr->result = result;
+    sr->done = 1;
+    pthread_cond_signal(&sr->cond);
+    pthread_mutex_unlock(&sr->mtx);
+}
+
+/* Verify 'password' for 'user', waiting for the result. Returns PWV_OK,
+   PWV_BAD, or -1 on error. */
+
+int
+pwvVerify(struct pwVerifier *pv, const char *user, const char *password)
+{
+    struct syncResult sr;
+
+    pthread_mutex_init(&sr.mtx, NULL);
+    pthread_cond_init(&sr.cond, NULL);
+    sr.done = 0;
+
+    if (pwvSubmit(pv, user, password, 1, syncDone, &sr) == -1)
+        sr.result = -1;
+    else {
+        pthread_mutex_lock(&sr.mtx);
+        while (!sr.done)
+            pthread_cond_wait(&sr.cond, &sr.mtx);
+        pthread_mutex_unlock(&sr.mtx);
+    }
+
+    pthread_cond_destroy(&sr.cond);
+    pthread_mutex_destroy(&sr.mtx);
+    return sr.result;
+}
+
+void
+pwvGetStats(struct pwVerifier *pv, struct pwvStats *stats)
+{
+    pthread_mutex_lock(&pv->mtx);
+    *stats = pv->stats;
+    stats->queued = pv->count;
+    pthread_mutex_unlock(&pv->mtx);
+}
+
+/* Complete the requests already queued, stop the workers, and free the
+   service (erasing the cached hashes) */
+
+void
+pwvClose(struct pwVerifier *pv)
+{
+    int j;
+
+    pthread_mutex_lock(&pv->mtx);
+    pv->stop = 1;
+    pthread_cond_broadcast(&pv->notEmpty);
+    pthread_cond_broadcast(&pv->notFull);
+    pthread_mutex_unlock(&pv->mtx);
+    for (j = 0; j < pv->nthreads; j++)
+        pthread_join(pv->tids[j], NULL);
+
+    flushCache(pv);
+    pthread_mutex_destroy(&pv->cacheMtx);
+    pthread_cond_destroy(&pv->notFull);
+    pthread_cond_destroy(&pv->notEmpty);
+    pthread_mutex_destroy(&pv->mtx);
+    free(pv->queue);
+    free(pv->tids);
+    free(pv);
+}
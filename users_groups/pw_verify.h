@@ -0,0 +1,68 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 8 */
+
+/* pw_verify.h
+
+   Header file for pw_verify.c.
+*/
+#ifndef PW_VERIFY_H
+#define PW_VERIFY_H             /* Prevent accidental double inclusion */
+
+#include <sys/types.h>
+
+#define PWV_OK 1                /* Results of a verification */
+#define PWV_BAD 0               /* Wrong password, unknown user, or
+                                   locked account */
+
+struct pwvParams {              /* See pwvDefaultParams() for defaults */
+    int threads;                /* Number of worker threads */
+    int queueMax;               /* Maximum requests waiting for a worker */
+    int cacheTtl;               /* Seconds for which a user's hash is
+                                   cached (0: don't cache) */
+    const char *shadowFile;     /* If not NULL, look users up in this file
+                                   (in the format of /etc/shadow) rather
+                                   than with getspnam_r() */
+};
+
+struct pwvStats {
+    unsigned long long verified;    /* Requests completed */
+    unsigned long long ok;          /* ... with PWV_OK */
+    unsigned long long unknown;     /* ... for users with no hash */
+    unsigned long long rejected;    /* pwvSubmit() calls that found the
+                                       queue full */
+    unsigned long long cacheHits;
+    unsigned long long cacheMisses;
+    unsigned long long flushes;     /* Cache flushed because the shadow
+                                       file changed */
+    unsigned long long errors;      /* Requests completed with -1 */
+    int lastErrno;                  /* errno from the most recent error */
+    unsigned long long queueNs;     /* Total, and maximum, time that */
+    unsigned long long maxQueueNs;  /* requests waited for a worker */
+    int queued;                     /* Requests now waiting */
+};
+
+typedef void (*pwvCallback)(void *arg, int result, long long queueNs);
+
+void pwvDefaultParams(struct pwvParams *params);
+
+struct pwVerifier *pwvOpen(const struct pwvParams *params);
+
+int pwvSubmit(struct pwVerifier *pv, const char *user, const char *password,
+              int wait, pwvCallback func, void *arg);
+
+int pwvVerify(struct pwVerifier *pv, const char *user, const char *password);
+
+void pwvGetStats(struct pwVerifier *pv, struct pwvStats *stats);
+
+void pwvClose(struct pwVerifier *pv);
+
+#endif
@@ -0,0 +1,308 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 8 */
+
+/* pw_verify_bench.c
+
+   Measure the rate at which the verification service in pw_verify.c
+   checks passwords, and the time that requests wait in its queue.
+
+   Usage: pw_verify_bench [-t threads] [-q queue-max] [-n requests]
+                          [-r rate] [-u users] [-m method] [-b bad-pct]
+                          [-c cache-ttl] [-1]
+
+        -t threads     Worker threads (default: number of CPUs)
+        -q queue-max   Requests that may wait for a worker (default: 1024)
+        -n requests    Number of requests (default: 2000)
+        -r rate        Submit this many requests per second, without
+                       waiting if the queue is full (such requests are
+                       rejected, and counted); by default, requests are
+                       submitted as fast as the queue accepts them
+        -u users       Number of users (default: 100)
+        -m method      Hashing method: yescrypt (the default), sha512,
+                       sha256, or bcrypt
+        -b bad-pct     Percentage of requests with a wrong password
+                       (default: 10)
+        -c cache-ttl   Cache lifetime for hashes, in seconds (default: 60;
+                       0 disables the cache)
+        -1             Also measure a single thread calling crypt_r()
+                       directly, for comparison
+
+   The users, with passwords "pwN" for user "userN", are placed in a
+   temporary file in the format of /etc/shadow, which the service reads
+   instead of the shadow password database. Each request names a user
+   at random, and the program checks that each result is the expected
+   one. It reports the number of verifications per second, the median,
+   99th percentile, and maximum times that requests waited in the queue
+   and that they took in all, and the number of requests rejected.
+
+   Try: pw_verify_bench -m sha512 -1
+        pw_verify_bench -r 100 -q 16
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <crypt.h>
+#include <pthread.h>
+#include <time.h>
+#include "pw_verify.h"
+#include "lat_hist.h"
+#include "tlpi_hdr.h"
+
+struct reqInfo {                /* One per request */
+    long long submitNs;
+    int expected;               /* PWV_OK or PWV_BAD */
+};
+
+static pthread_mutex_t resMtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resCond = PTHREAD_COND_INITIALIZER;
+static struct latHist queueHist, totalHist;
+static long completed, wrong, errors;
+static long long lastDoneNs;
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void
+verified(void *arg, int result, long long queueNs)
+{
+    struct reqInfo *ri = arg;
+    long long now;
+
+    now = nowNs();
+    pthread_mutex_lock(&resMtx);
+    latHistRecord(&queueHist, queueNs);
+    latHistRecord(&totalHist, now - ri->submitNs);
+    if (result == -1)
+        errors++;
+    else if (result != ri->expected)
+        wrong++;
+    completed++;
+    lastDoneNs = now;
+    pthread_cond_signal(&resCond);
+    pthread_mutex_unlock(&resMtx);
+}
+
+/* Create a shadow-format file with 'nusers' users, hashed with 'prefix'.
+   Returns the hashes (for the -1 comparison). */
+
+static char **
+makeShadowFile(char *path, int nusers, const char *prefix)
+{
+    char setting[CRYPT_GENSALT_OUTPUT_SIZE], pw[32];
+    struct crypt_data *cd;
+    const char *hash;
+    char **hashes;
+    FILE *fp;
+    int fd, j;
+
+    fd = mkstemp(path);
+    if (fd == -1)
+        errExit("mkstemp");
+    fp = fdopen(fd, "w");
+    if (fp == NULL)
+        errExit("fdopen");
+
+    cd = calloc(1, sizeof(struct crypt_data));
+    hashes = calloc(nusers, sizeof(char *));
+    if (cd == NULL || hashes == NULL)
+        errExit("calloc");
+
+    for (j = 0; j < nusers; j++) {
+        if (crypt_gensalt_rn(prefix, 0, NULL, 0, setting,
+                             sizeof(setting)) == NULL)
+            errExit("crypt_gensalt_rn");
+        snprintf(pw, sizeof(pw), "pw%d", j);
+        hash = crypt_r(pw, setting, cd);
+        if (hash == NULL || hash[0] == '*')
+            fatal("crypt_r failed for method %s", prefix);
+        hashes[j] = strdup(hash);
+        if (hashes[j] == NULL)
+            errExit("strdup");
+        fprintf(fp, "user%d:%s:19000:0:99999:7:::\n", j, hash);
+    }
+
+    if (fclose(fp) == EOF)
+        errExit("fclose");
+    free(cd);
+    return hashes;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-t threads] [-q queue-max] [-n requests] "
+            "[-r rate]\n        [-u users] [-m method] [-b bad-pct] "
+            "[-c cache-ttl] [-1]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const struct { const char *name, *prefix; } methods[] = {
+        { "yescrypt", "$y$" }, { "sha512", "$6$" },
+        { "sha256", "$5$" }, { "bcrypt", "$2b$" }, { NULL, NULL }
+    };
+    char path[] = "/tmp/pw_verify_bench.XXXXXX";
+    char user[32], pw[32];
+    struct pwvParams params;
+    struct pwVerifier *pv;
+    struct pwvStats stats;
+    struct reqInfo *ri;
+    struct crypt_data *cd;
+    struct timespec next;
+    long long start, elapsed;
+    const char *prefix, *out;
+    char **hashes;
+    int opt, nreqs, rate, nusers, badPct, u, j, m;
+    long rejected;
+    Boolean single;
+
+    pwvDefaultParams(&params);
+    nreqs = 2000;
+    rate = 0;
+    nusers = 100;
+    badPct = 10;
+    prefix = "$y$";
+    single = FALSE;
+    while ((opt = getopt(argc, argv, "t:q:n:r:u:m:b:c:1")) != -1) {
+        switch (opt) {
+        case 't': params.threads = getInt(optarg, GN_GT_0, "-t");       break;
+        case 'q': params.queueMax = getInt(optarg, GN_GT_0, "-q");      break;
+        case 'n': nreqs = getInt(optarg, GN_GT_0, "-n");                break;
+        case 'r': rate = getInt(optarg, GN_GT_0, "-r");                 break;
+        case 'u': nusers = getInt(optarg, GN_GT_0, "-u");               break;
+        case 'b': badPct = getInt(optarg, GN_NONNEG, "-b");             break;
+        case 'c': params.cacheTtl = getInt(optarg, GN_NONNEG, "-c");    break;
+        case '1': single = TRUE;                                        break;
+        case 'm':
+            for (m = 0; methods[m].name != NULL; m++)
+                if (strcmp(optarg, methods[m].name) == 0)
+                    break;
+            if (methods[m].name == NULL)
+                usageError(argv[0]);
+            prefix = methods[m].prefix;
+            break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+
+    hashes = makeShadowFile(path, nusers, prefix);
+    params.shadowFile = path;
+    srandom(1);
+
+    setbuf(stdout, NULL);
+    printf("%d users, method %s, %d threads, queue %d, cache %d s\n",
+           nusers, prefix, params.threads, params.queueMax, params.cacheTtl);
+
+    /* For comparison, a single thread hashing directly */
+
+    if (single) {
+        cd = calloc(1, sizeof(struct crypt_data));
+        if (cd == NULL)
+            errExit("calloc");
+        start = nowNs();
+        for (j = 0; j < nreqs; j++) {
+            u = random() % nusers;
+            snprintf(pw, sizeof(pw), "pw%d", u);
+            out = crypt_r(pw, hashes[u], cd);
+            if (out == NULL || strcmp(out, hashes[u]) != 0)
+                fatal("crypt_r gave the wrong result");
+        }
+        elapsed = nowNs() - start;
+        printf("single thread, crypt_r():  %8.1f verifications/s\n",
+               nreqs / (elapsed / 1e9));
+        free(cd);
+    }
+
+    pv = pwvOpen(&params);
+    if (pv == NULL)
+        errExit("pwvOpen");
+
+    ri = calloc(nreqs, sizeof(struct reqInfo));
+    if (ri == NULL)
+        errExit("calloc");
+    latHistInit(&queueHist);
+    latHistInit(&totalHist);
+
+    rejected = 0;
+    if (clock_gettime(CLOCK_MONOTONIC, &next) == -1)
+        errExit("clock_gettime");
+    start = nowNs();
+    for (j = 0; j < nreqs; j++) {
+        if (rate > 0) {         /* Wait until this request is due */
+            next.tv_nsec += 1000000000L / rate;
+            if (next.tv_nsec >= 1000000000L) {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000L;
+            }
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+                                   NULL) == EINTR)
+                continue;
+        }
+
+        u = random() % nusers;
+        snprintf(user, sizeof(user), "user%d", u);
+        if (random() % 100 < badPct) {
+            snprintf(pw, sizeof(pw), "pw%d", u + 1);
+            ri[j].expected = PWV_BAD;
+        } else {
+            snprintf(pw, sizeof(pw), "pw%d", u);
+            ri[j].expected = PWV_OK;
+        }
+        ri[j].submitNs = nowNs();
+
+        if (pwvSubmit(pv, user, pw, rate == 0, verified, &ri[j]) == -1) {
+            if (errno != EAGAIN)
+                errExit("pwvSubmit");
+            rejected++;
+        }
+    }
+
+    /* Wait for the accepted requests to complete */
+
+    pthread_mutex_lock(&resMtx);
+    while (completed < nreqs - rejected)
+        pthread_cond_wait(&resCond, &resMtx);
+    pthread_mutex_unlock(&resMtx);
+    elapsed = lastDoneNs - start;
+
+    pwvGetStats(pv, &stats);
+    pwvClose(pv);
+
+    printf("pool (%2d threads):         %8.1f verifications/s\n",
+           params.threads, completed / (elapsed / 1e9));
+    printf("%ld completed, %ld rejected, %ld wrong results, %ld errors\n",
+           completed, rejected, wrong, errors);
+    printf("cache: %llu hits, %llu misses\n", stats.cacheHits,
+           stats.cacheMisses);
+    printf("%-10s %10s %10s %10s\n", "ms", "p50", "p99", "max");
+    printf("%-10s %10.2f %10.2f %10.2f\n", "queued",
+           latHistPercentile(&queueHist, 0.50) / 1e6,
+           latHistPercentile(&queueHist, 0.99) / 1e6, queueHist.max / 1e6);
+    printf("%-10s %10.2f %10.2f %10.2f\n", "total",
+           latHistPercentile(&totalHist, 0.50) / 1e6,
+           latHistPercentile(&totalHist, 0.99) / 1e6, totalHist.max / 1e6);
+
+    if (unlink(path) == -1)
+        errExit("unlink");
+    exit((wrong == 0 && errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,131 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 8 */
+
+/* t_ugid_snapshot.c
+
+   Demonstrate the snapshots of the password and group databases
+   provided by ugid_snapshot.c.
+
+   Usage: t_ugid_snapshot [-c] [-m] [-b count] [file] [user|uid...]
+
+        -c        Create (or refresh) the snapshot in 'file'
+        -m        Instead of using 'file', create a snapshot in a memfd
+        -b count  Time 'count' conversions of the user IDs 0..99, using
+                  the snapshot and using getpwuid()
+
+   Each remaining argument is converted from a user ID to a name, or
+   from a name to a user ID, using the snapshot.
+
+   This program is Linux-specific.
+*/
+#include <pwd.h>
+#include <time.h>
+#include "ugid_snapshot.h"
+#include "tlpi_hdr.h"
+
+static double
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-c] [-m] [-b count] [file] "
+            "[user|uid...]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct ugsSnapshot *snap;
+    Boolean create, memfd;
+    const char *name;
+    long count, j, nusers, ngroups, found;
+    double t0;
+    uid_t uid;
+    char *endptr;
+    int opt, fd;
+
+    create = memfd = FALSE;
+    count = 0;
+    while ((opt = getopt(argc, argv, "cmb:")) != -1) {
+        switch (opt) {
+        case 'c': create = TRUE;                                        break;
+        case 'm': memfd = TRUE;                                         break;
+        case 'b': count = getLong(optarg, GN_GT_0, "count");            break;
+        default:  usageError(argv[0]);
+        }
+    }
+
+    if (memfd) {
+        fd = ugsCreateMemfd();
+        if (fd == -1)
+            errExit("ugsCreateMemfd");
+        snap = ugsOpenFd(fd);
+        if (snap == NULL)
+            errExit("ugsOpenFd");
+        close(fd);
+    } else {
+        if (optind >= argc)
+            usageError(argv[0]);
+        if (create && ugsCreate(argv[optind]) == -1)
+            errExit("ugsCreate");
+        snap = ugsOpen(argv[optind]);
+        if (snap == NULL)
+            errExit("ugsOpen %s", argv[optind]);
+        optind++;
+    }
+
+    ugsCounts(snap, &nusers, &ngroups);
+    printf("Snapshot: %ld users, %ld groups\n", nusers, ngroups);
+
+    for (j = optind; j < argc; j++) {
+        uid = strtol(argv[j], &endptr, 10);
+        if (*endptr == '\0') {
+            name = ugsUserName(snap, uid);
+            printf("%s -> %s\n", argv[j], (name == NULL) ? "???" : name);
+        } else {
+            uid = ugsUserId(snap, argv[j]);
+            if (uid == -1)
+                printf("%s -> ???\n", argv[j]);
+            else
+                printf("%s -> %ld\n", argv[j], (long) uid);
+        }
+    }
+
+    if (count > 0) {
+        found = 0;
+        t0 = nowNs();
+        for (j = 0; j < count; j++)
+            if (ugsUserName(snap, j % 100) != NULL)
+                found++;
+        printf("snapshot:   %8.1f ns per lookup (%ld found)\n",
+               (nowNs() - t0) / count, found);
+
+        found = 0;
+        t0 = nowNs();
+        for (j = 0; j < count; j++)
+            if (getpwuid(j % 100) != NULL)
+                found++;
+        printf("getpwuid(): %8.1f ns per lookup (%ld found)\n",
+               (nowNs() - t0) / count, found);
+    }
+
+    ugsClose(snap);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,483 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 8 */
+
+/* ugid_cache.c
+
+   Caching versions of the functions in ugid_functions.c, for programs
+   that convert the same user and group IDs and names many times (e.g.,
+   once per record of a large file). When the password and group
+   databases are provided by a network service such as LDAP, each call
+   to getpwuid() and friends can take milliseconds.
+
+   userNameFromIdCached(), userIdFromNameCached(), groupNameFromIdCached(),
+   and groupIdFromNameCached() return the same results as the
+   corresponding functions in ugid_functions.c. A name is returned in a
+   buffer private to the calling thread (one for user names, another for
+   group names), which is overwritten by the next call of the same
+   function in that thread; all of the functions are thread-safe. The
+   lookups themselves use the reentrant getpwuid_r() etc.
+
+   Each result is cached in both directions (a lookup of UID 1000 that
+   finds "mtk" also answers a later lookup of "mtk"), and unsuccessful
+   lookups are cached too, so that repeatedly asking about an unknown ID
+   doesn't reach the network service each time.
+
+   ugidCacheInit() (optional; call it before the other functions) sets
+   the time in seconds for which successful ('ttl'; default 300) and
+   unsuccessful ('negTtl'; default 60) results are kept. A TTL of 0
+   means "forever", and a 'negTtl' of -1 disables the caching of
+   unsuccessful lookups. 'flags' may include UC_PRELOAD_USERS and
+   UC_PRELOAD_GROUPS, which load the whole password or group database
+   (using getpwent_r() or getgrent_r()) into the cache, which is cheaper
+   than many individual lookups when most users will be needed. It
+   returns 0 on success, or -1 on error.
+
+   ugidCacheGetStats() returns counts of cache hits and misses, and
+   ugidCacheFlush() discards all cached results.
+
+   This module is Linux-specific (it uses getpwent_r() and getgrent_r()).
+*/
+#define _GNU_SOURCE
+#include <pwd.h>
+#include <grp.h>
+#include <pthread.h>
+#include <time.h>
+#include "ugid_cache.h"         /* Declares functions defined here */
+
+struct ucEntry {
+    struct ucEntry *next;       /* Next in hash chain */
+    long id;                    /* -1 in negative entry keyed by name */
+    char *name;                 /* NULL in negative entry keyed by ID */
+    time_t expires;             /* 0 means never */
+};
+
+struct ucMap {                  /* Hash table keyed by ID or by name */
+    Boolean byName;
+    struct ucEntry **buckets;
+    size_t nbuckets;
+    size_t count;
+};
+
+static struct ucMap userById, userByName = { .byName = TRUE };
+static struct ucMap groupById, groupByName = { .byName = TRUE };
+
+static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static int posTtl = 300;
+static int negTtl = 60;
+static struct ugidCacheStats stats;
+
+static __thread char *userBuf, *groupBuf;       /* Returned names */
+static __thread size_t userBufLen, groupBufLen;
+
+static size_t
+hashKey(const struct ucMap *map, long id, const char *name)
+{
+    size_t h;
+
+    if (!map->byName)
+        return (size_t) id * 2654435761U;
+
+    for (h = 2166136261U; *name != '\0'; name++)
+        h = (h ^ (unsigned char) *name) * 16777619U;
+    return h;
+}
+
+static struct ucEntry *
+mapFind(const struct ucMap *map, long id, const char *name)
+{
+    struct ucEntry *e;
+
+    if (map->nbuckets == 0)
+        return NULL;
+    for (e = map->buckets[hashKey(map, id, name) & (map->nbuckets - 1)];
+            e != NULL; e = e->next)
+        if (map->byName ? strcmp(e->name, name) == 0 : e->id == id)
+            return e;
+    return NULL;
+}
+
+/* Add or replace the entry for (id, name) in 'map'. Since the cache is
+   only an optimization, failure to allocate memory is ignored. */
+
+static void
+mapStore(struct ucMap *map, long id, const char *name, int ttl)
+{
+    struct ucEntry *e, *next, **nb;
+    char *copy;
+    size_t j, n, h;
+
+    copy = NULL;
+    if (name != NULL && (copy = strdup(name)) == NULL)
+        return;
+
+    e = mapFind(map, id, map->byName ? name : NULL);
+    if (e == NULL) {
+        if (map->count >= map->nbuckets) {      /* Grow the table */
+            n = (map->nbuckets == 0) ? 64 : 2 * map->nbuckets;
+            nb = calloc(n, sizeof(struct ucEntry *));
+            if (nb == NULL) {
+                free(copy);
+                return;
+            }
+            for (j = 0; j < map->nbuckets; j++) {
+                for (e = map->buckets[j]; e != NULL; e = next) {
+                    next = e->next;
+                    h = hashKey(map, e->id, e->name) & (n - 1);
+                    e->next = nb[h];
+                    nb[h] = e;
+                }
+            }
+            free(map->buckets);
+            map->buckets = nb;
+            map->nbuckets = n;
+        }
+
+        e = malloc(sizeof(struct ucEntry));
+        if (e == NULL) {
+            free(copy);
+            return;
+        }
+        h = hashKey(map, id, copy) & (map->nbuckets - 1);
+        e->next = map->buckets[h];
+        map->buckets[h] = e;
+        map->count++;
+    } else {
+        free(e->name);
+    }
+
+    e->id = id;
+    e->name = copy;
+    e->expires = (ttl == 0) ? 0 : time(NULL) + ttl;
+}
+
+static void
+mapClear(struct ucMap *map)
+{
+    struct ucEntry *e, *next;
+    size_t j;
+
+    for (j = 0; j < map->nbuckets; j++) {
+        for (e = map->buckets[j]; e != NULL; e = next) {
+            next = e->next;
+            free(e->name);
+            free(e);
+        }
+    }
+    free(map->buckets);
+    map->buckets = NULL;
+    map->nbuckets = map->count = 0;
+}
+
+/* Record a successful lookup in both directions */
+
+static void
+storeBoth(struct ucMap *byId, struct ucMap *byName, long id,
+          const char *name)
+{
+    mapStore(byId, id, name, posTtl);
+    mapStore(byName, id, name, posTtl);
+}
+
+/* Copy 'name' into the thread's buffer '*buf', returning the buffer, or
+   NULL if 'name' is NULL or memory can't be allocated */
+
+static char *
+copyOut(char **buf, size_t *len, const char *name)
+{
+    size_t n;
+    char *p;
+
+    if (name == NULL)
+        return NULL;
+    n = strlen(name) + 1;
+    if (n > *len) {
+        p = realloc(*buf, n);
+        if (p == NULL)
+            return NULL;
+        *buf = p;
+        *len = n;
+    }
+    memcpy(*buf, name, n);
+    return *buf;
+}
+
+/* Look up a user or group in the system databases, using the reentrant
+   functions. By ID, '*name' is set to a copy of the name; by name, '*id'
+   is set. Return 1 if found, 0 if not, or -1 on error. */
+
+static int
+nssLookup(Boolean group, long *id, const char *name, char **nameOut)
+{
+    struct passwd pwd, *pwdp;
+    struct group grp, *grpp;
+    size_t bufSize;
+    char *buf, *p;
+    long sz;
+    int s;
+
+    sz = sysconf(group ? _SC_GETGR_R_SIZE_MAX : _SC_GETPW_R_SIZE_MAX);
+    bufSize = (sz > 0) ? sz : 1024;
+    buf = NULL;
+
+    for (;;) {
+        p = realloc(buf, bufSize);
+        if (p == NULL) {
+            free(buf);
+            return -1;
+        }
+        buf = p;
+
+        if (group) {
+            s = (name == NULL) ?
+                    getgrgid_r(*id, &grp, buf, bufSize, &grpp) :
+                    getgrnam_r(name, &grp, buf, bufSize, &grpp);
+            pwdp = NULL;
+        } else {
+            s = (name == NULL) ?
+                    getpwuid_r(*id, &pwd, buf, bufSize, &pwdp) :
+                    getpwnam_r(name, &pwd, buf, bufSize, &pwdp);
+            grpp = NULL;
+        }
+        if (s != ERANGE || bufSize >= 1024 * 1024)
+            break;
+        bufSize *= 2;                   /* E.g., a group with many members */
+    }
+
+    if (s != 0) {
+        free(buf);
+        return -1;
+    }
+    if (pwdp == NULL && grpp == NULL) {
+        free(buf);
+        return 0;
+    }
+
+    if (name == NULL) {
+        *nameOut = strdup(group ? grpp->gr_name : pwdp->pw_name);
+        s = (*nameOut == NULL) ? -1 : 1;
+    } else {
+        *id = group ? (long) grpp->gr_gid : (long) pwdp->pw_uid;
+        s = 1;
+    }
+    free(buf);
+    return s;
+}
+
+static Boolean
+fresh(const struct ucEntry *e)
+{
+    return e->expires == 0 || time(NULL) < e->expires;
+}
+
+/* Return the name for 'id', copied into '*buf' */
+
+static char *
+nameFromId(Boolean group, long id, char **buf, size_t *len)
+{
+    struct ucMap *byId = group ? &groupById : &userById;
+    struct ucMap *byName = group ? &groupByName : &userByName;
+    struct ucEntry *e;
+    char *name, *result;
+    int s;
+
+    pthread_rwlock_rdlock(&rwlock);
+    e = mapFind(byId, id, "");
+    if (e != NULL && fresh(e)) {
+        result = copyOut(buf, len, e->name);
+        pthread_rwlock_unlock(&rwlock);
+        __atomic_add_fetch(&stats.hits, 1, __ATOMIC_RELAXED);
+        if (result == NULL)
+            __atomic_add_fetch(&stats.negHits, 1, __ATOMIC_RELAXED);
+        return result;
+    }
+    pthread_rwlock_unlock(&rwlock);
+
+    __atomic_add_fetch(&stats.misses, 1, __ATOMIC_RELAXED);
+    name = NULL;
+    s = nssLookup(group, &id, NULL, &name);
+
+    pthread_rwlock_wrlock(&rwlock);
+    if (s == 1)
+        storeBoth(byId, byName, id, name);
+    else if (s == 0 && negTtl >= 0)
+        mapStore(byId, id, NULL, negTtl);
+    pthread_rwlock_unlock(&rwlock);
+
+    result = copyOut(buf, len, name);
+    free(name);
+    return result;
+}
+
+/* Return the ID for 'name', or -1 */
+
+static long
+idFromName(Boolean group, const char *name)
+{
+    struct ucMap *byId = group ? &groupById : &userById;
+    struct ucMap *byName = group ? &groupByName : &userByName;
+    struct ucEntry *e;
+    char *endptr;
+    long id;
+    int s;
+
+    if (name == NULL || *name == '\0')  /* On NULL or empty string */
+        return -1;                      /* return an error */
+
+    id = strtol(name, &endptr, 10);     /* As a convenience to caller */
+    if (*endptr == '\0')                /* allow a numeric string */
+        return id;
+
+    pthread_rwlock_rdlock(&rwlock);
+    e = mapFind(byName, 0, name);
+    if (e != NULL && fresh(e)) {
+        id = e->id;
+        pthread_rwlock_unlock(&rwlock);
+        __atomic_add_fetch(&stats.hits, 1, __ATOMIC_RELAXED);
+        if (id == -1)
+            __atomic_add_fetch(&stats.negHits, 1, __ATOMIC_RELAXED);
+        return id;
+    }
+    pthread_rwlock_unlock(&rwlock);
+
+    __atomic_add_fetch(&stats.misses, 1, __ATOMIC_RELAXED);
+    s = nssLookup(group, &id, name, NULL);
+
+    pthread_rwlock_wrlock(&rwlock);
+    if (s == 1)
+        storeBoth(byId, byName, id, name);
+    else if (s == 0 && negTtl >= 0)
+        mapStore(byName, -1, name, negTtl);
+    pthread_rwlock_unlock(&rwlock);
+
+    return (s == 1) ? id : -1;
+}
+
+char *          /* Return name corresponding to 'uid', or NULL on error */
+userNameFromIdCached(uid_t uid)
+{
+    return nameFromId(FALSE, uid, &userBuf, &userBufLen);
+}
+
+uid_t           /* Return UID corresponding to 'name', or -1 on error */
+userIdFromNameCached(const char *name)
+{
+    return idFromName(FALSE, name);
+}
+
+char *          /* Return name corresponding to 'gid', or NULL on error */
+groupNameFromIdCached(gid_t gid)
+{
+    return nameFromId(TRUE, gid, &groupBuf, &groupBufLen);
+}
+
+gid_t           /* Return GID corresponding to 'name', or -1 on error */
+groupIdFromNameCached(const char *name)
+{
+    return idFromName(TRUE, name);
+}
+
+/* Load the whole password or group database into the cache */
+
+static int
+preload(Boolean group)
+{
+    struct passwd pwd, *pwdp;
+    struct group grp, *grpp;
+    size_t bufSize;
+    char *buf, *p;
+    int s;
+
+    bufSize = 16384;
+    buf = malloc(bufSize);
+    if (buf == NULL)
+        return -1;
+
+    if (group)
+        setgrent();
+    else
+        setpwent();
+
+    for (;;) {
+        if (group)
+            s = getgrent_r(&grp, buf, bufSize, &grpp);
+        else
+            s = getpwent_r(&pwd, buf, bufSize, &pwdp);
+
+        if (s == ERANGE && bufSize < 1024 * 1024) {
+            bufSize *= 2;               /* Retry the same entry */
+            p = realloc(buf, bufSize);
+            if (p == NULL)
+                break;
+            buf = p;
+            continue;
+        }
+        if (s != 0)                     /* ENOENT at end of database */
+            break;
+
+        if (group)
+            storeBoth(&groupById, &groupByName, grp.gr_gid, grp.gr_name);
+        else
+            storeBoth(&userById, &userByName, pwd.pw_uid, pwd.pw_name);
+        stats.preloaded++;
+    }
+
+    if (group)
+        endgrent();
+    else
+        endpwent();
+    free(buf);
+    return (s == ENOENT) ? 0 : -1;
+}
+
+int
+ugidCacheInit(int ttl, int nttl, int flags)
+{
+    int s;
+
+    if (ttl < 0 || nttl < -1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    s = 0;
+    pthread_rwlock_wrlock(&rwlock);
+    posTtl = ttl;
+    negTtl = nttl;
+    if ((flags & UC_PRELOAD_USERS) && preload(FALSE) == -1)
+        s = -1;
+    if ((flags & UC_PRELOAD_GROUPS) && preload(TRUE) == -1)
+        s = -1;
+    pthread_rwlock_unlock(&rwlock);
+    return s;
+}
+
+void
+ugidCacheGetStats(struct ugidCacheStats *st)
+{
+    st->hits = __atomic_load_n(&stats.hits, __ATOMIC_RELAXED);
+    st->negHits = __atomic_load_n(&stats.negHits, __ATOMIC_RELAXED);
+    st->misses = __atomic_load_n(&stats.misses, __ATOMIC_RELAXED);
+    pthread_rwlock_rdlock(&rwlock);
+    st->preloaded = stats.preloaded;
+    pthread_rwlock_unlock(&rwlock);
+}
+
+void
+ugidCacheFlush(void)
+{
+    pthread_rwlock_wrlock(&rwlock);
+    mapClear(&userById);
+    mapClear(&userByName);
+    mapClear(&groupById);
+    mapClear(&groupByName);
+    pthread_rwlock_unlock(&rwlock);
+}
@@ -0,0 +1,46 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 8 */
+
+/* ugid_cache.h
+
+   Header file for ugid_cache.c.
+*/
+#ifndef UGID_CACHE_H
+#define UGID_CACHE_H
+
+#include "tlpi_hdr.h"
+
+#define UC_PRELOAD_USERS  1     /* Flags for ugidCacheInit() */
+#define UC_PRELOAD_GROUPS 2
+
+struct ugidCacheStats {
+    unsigned long hits;         /* Answered from the cache */
+    unsigned long negHits;      /*  ... of which "no such user/group" */
+    unsigned long misses;       /* Not cached (or expired): looked up */
+    unsigned long preloaded;    /* Entries loaded by UC_PRELOAD_* */
+};
+
+int ugidCacheInit(int ttl, int negTtl, int flags);
+
+char *userNameFromIdCached(uid_t uid);
+
+uid_t userIdFromNameCached(const char *name);
+
+char *groupNameFromIdCached(gid_t gid);
+
+gid_t groupIdFromNameCached(const char *name);
+
+void ugidCacheGetStats(struct ugidCacheStats *stats);
+
+void ugidCacheFlush(void);
+
+#endif
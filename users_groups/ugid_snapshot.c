@@ -0,0 +1,655 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 8 */
+
+/* ugid_snapshot.c
+
+   Load the whole password and group databases into a compact, read-only
+   "snapshot" that can be shared by many processes, and in which user and
+   group IDs and names are converted by hash table lookups in memory.
+
+   ugsCreate() reads the databases (using getpwent_r() and getgrent_r(),
+   so that entries from network services such as LDAP are included) and
+   writes the snapshot to the file 'path'. The snapshot is written to a
+   temporary file that is then renamed, so that a snapshot can be
+   refreshed while other processes are using it: they continue to see
+   the old snapshot until they reopen it. ugsCreateMemfd() instead
+   writes the snapshot to a sealed memfd (see memfd_create(2)), and
+   returns its file descriptor, which can be passed to child processes
+   or sent to other processes over a UNIX domain socket. Both return -1
+   on error.
+
+   ugsOpen() and ugsOpenFd() map a snapshot read-only, returning a handle,
+   or NULL on error. ugsRefresh() replaces '*sp' (which must have been
+   opened with ugsOpen()) by the current snapshot at the same pathname
+   if that has been replaced since '*sp' was opened; it returns 1 if the
+   snapshot was replaced, 0 if not, or -1 on error. The caller must
+   ensure that no other thread is using the old handle.
+
+   ugsUserName(), ugsUserId(), ugsGroupName(), and ugsGroupId() convert
+   as the functions in ugid_functions.c do, returning NULL or -1 if
+   there is no such entry. Returned names point into the snapshot, and
+   remain valid until it is closed. Lookups make no system calls and
+   take no locks, so any number of threads can use a snapshot at once.
+
+   The snapshot consists of a header, arrays of user and group entries
+   (ID, offset of name), four open-addressing hash tables (by user ID,
+   user name, group ID, and group name) that hold indexes into those
+   arrays, and the names. All references are offsets, so the snapshot
+   can be mapped at any address.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <pwd.h>
+#include <stdint.h>
+#include "ugid_snapshot.h"      /* Declares functions defined here */
+
+#define UGS_MAGIC "TLPIUGS1"
+
+struct ugsHeader {
+    char magic[8];
+    uint32_t size;              /* Size of snapshot */
+    uint32_t nusers;
+    uint32_t ngroups;
+    uint32_t usersOff;          /* struct ugsEntry [nusers] */
+    uint32_t groupsOff;         /* struct ugsEntry [ngroups] */
+    uint32_t userTabSize;       /* Slots in each user hash table */
+    uint32_t groupTabSize;      /* Slots in each group hash table */
+    uint32_t uidTabOff;         /* Hash tables: uint32_t [tabSize]; */
+    uint32_t unameTabOff;       /*  each slot is 0 (empty), or an */
+    uint32_t gidTabOff;         /*  entry index + 1 */
+    uint32_t gnameTabOff;
+    uint32_t strOff;            /* Null-terminated names */
+    uint32_t strSize;
+};
+
+struct ugsEntry {
+    uint32_t id;
+    uint32_t nameOff;           /* Relative to 'strOff' */
+};
+
+struct ugsSnapshot {
+    const char *base;
+    size_t size;
+    const struct ugsHeader *hdr;
+    char *path;                 /* NULL if opened by ugsOpenFd() */
+    dev_t dev;                  /* Identify the file, for ugsRefresh() */
+    ino_t ino;
+};
+
+/* Hashing of IDs and names */
+
+static uint32_t
+hashId(uint32_t id)
+{
+    return id * 2654435761U;
+}
+
+static uint32_t
+hashName(const char *name)
+{
+    uint32_t h;
+
+    for (h = 2166136261U; *name != '\0'; name++)
+        h = (h ^ (unsigned char) *name) * 16777619U;
+    return h;
+}
+
+/* Building a snapshot */
+
+struct buildEntry {
+    uint32_t id;
+    char *name;
+};
+
+struct buildList {
+    struct buildEntry *ent;
+    size_t n;
+    size_t cap;
+};
+
+static int
+listAdd(struct buildList *l, uint32_t id, const char *name)
+{
+    struct buildEntry *p;
+
+    if (l->n == l->cap) {
+        l->cap = (l->cap == 0) ? 256 : 2 * l->cap;
+        p = realloc(l->ent, l->cap * sizeof(struct buildEntry));
+        if (p == NULL)
+            return -1;
+        l->ent = p;
+    }
+    l->ent[l->n].id = id;
+    l->ent[l->n].name = strdup(name);
+    if (l->ent[l->n].name == NULL)
+        return -1;
+    l->n++;
+    return 0;
+}
+
+static void
+listFree(struct buildList *l)
+{
+    size_t j;
+
+    for (j = 0; j < l->n; j++)
+        free(l->ent[j].name);
+    free(l->ent);
+}
+
+/* Read the password (group == FALSE) or group database into 'l' */
+
+static int
+readDatabase(Boolean group, struct buildList *l)
+{
+    struct passwd pwd, *pwdp;
+    struct group grp, *grpp;
+    size_t bufSize;
+    char *buf, *p;
+    int s;
+
+    bufSize = 16384;
+    buf = malloc(bufSize);
+    if (buf == NULL)
+        return -1;
+
+    if (group)
+        setgrent();
+    else
+        setpwent();
+
+    for (;;) {
+        s = group ? getgrent_r(&grp, buf, bufSize, &grpp) :
+                    getpwent_r(&pwd, buf, bufSize, &pwdp);
+        if (s == ERANGE && bufSize < 1024 * 1024) {
+            bufSize *= 2;               /* Retry the same entry */
+            p = realloc(buf, bufSize);
+            if (p == NULL)
+                break;
+            buf = p;
+            continue;
+        }
+        if (s != 0)                     /* ENOENT at end of database */
+            break;
+
+        if (listAdd(l, group ? grp.gr_gid : pwd.pw_uid,
+                    group ? grp.gr_name : pwd.pw_name) == -1) {
+            s = ENOMEM;
+            break;
+        }
+    }
+
+    if (group)
+        endgrent();
+    else
+        endpwent();
+    free(buf);
+
+    if (s != ENOENT) {
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t
+tableSize(size_t n)                     /* Power of 2, load <= 1/2 */
+{
+    uint32_t size;
+
+    for (size = 16; size < 2 * n; size *= 2)
+        continue;
+    return size;
+}
+
+/* Fill the hash tables for one set of entries. Where several entries
+   have the same ID, the first is found, as with getpwuid(). */
+
+static void
+fillTables(const struct buildList *l, const struct ugsEntry *ent,
+           uint32_t *idTab, uint32_t *nameTab, uint32_t tabSize)
+{
+    uint32_t j, h, k;
+
+    for (j = 0; j < l->n; j++) {
+        for (h = hashId(ent[j].id) & (tabSize - 1); idTab[h] != 0;
+                h = (h + 1) & (tabSize - 1)) {
+            k = idTab[h] - 1;
+            if (ent[k].id == ent[j].id)
+                break;                  /* Keep the first */
+        }
+        if (idTab[h] == 0)
+            idTab[h] = j + 1;
+
+        for (h = hashName(l->ent[j].name) & (tabSize - 1); nameTab[h] != 0;
+                h = (h + 1) & (tabSize - 1)) {
+            k = nameTab[h] - 1;
+            if (strcmp(l->ent[k].name, l->ent[j].name) == 0)
+                break;
+        }
+        if (nameTab[h] == 0)
+            nameTab[h] = j + 1;
+    }
+}
+
+/* Build a snapshot in memory, returning its address and size */
+
+static char *
+buildSnapshot(size_t *sizep)
+{
+    struct buildList users = { 0 }, groups = { 0 };
+    struct ugsHeader *hdr;
+    struct ugsEntry *uent, *gent;
+    size_t size, strSize, j;
+    uint32_t off;
+    char *base, *str;
+
+    base = NULL;
+    if (readDatabase(FALSE, &users) == -1 ||
+            readDatabase(TRUE, &groups) == -1)
+        goto done;
+
+    strSize = 1;                        /* Never empty */
+    for (j = 0; j < users.n; j++)
+        strSize += strlen(users.ent[j].name) + 1;
+    for (j = 0; j < groups.n; j++)
+        strSize += strlen(groups.ent[j].name) + 1;
+
+    /* Lay out the snapshot */
+
+    size = sizeof(struct ugsHeader);
+    size += (users.n + groups.n) * sizeof(struct ugsEntry);
+    size += 2 * (tableSize(users.n) + tableSize(groups.n)) *
+            sizeof(uint32_t);
+    size += strSize;
+    if (size > UINT32_MAX) {
+        errno = EOVERFLOW;
+        goto done;
+    }
+
+    base = calloc(1, size);
+    if (base == NULL)
+        goto done;
+    hdr = (struct ugsHeader *) base;
+    memcpy(hdr->magic, UGS_MAGIC, sizeof(hdr->magic));
+    hdr->size = size;
+    hdr->nusers = users.n;
+    hdr->ngroups = groups.n;
+    hdr->userTabSize = tableSize(users.n);
+    hdr->groupTabSize = tableSize(groups.n);
+
+    off = sizeof(struct ugsHeader);
+    hdr->usersOff = off;
+    off += users.n * sizeof(struct ugsEntry);
+    hdr->groupsOff = off;
+    off += groups.n * sizeof(struct ugsEntry);
+    hdr->uidTabOff = off;
+    off += hdr->userTabSize * sizeof(uint32_t);
+    hdr->unameTabOff = off;
+    off += hdr->userTabSize * sizeof(uint32_t);
+    hdr->gidTabOff = off;
+    off += hdr->groupTabSize * sizeof(uint32_t);
+    hdr->gnameTabOff = off;
+    off += hdr->groupTabSize * sizeof(uint32_t);
+    hdr->strOff = off;
+    hdr->strSize = strSize;
+
+    /* Copy in the entries and names, and build the hash tables */
+
+    uent = (struct ugsEntry *) (base + hdr->usersOff);
+    gent = (struct ugsEntry *) (base + hdr->groupsOff);
+    str = base + hdr->strOff;
+    off = 1;
+    for (j = 0; j < users.n; j++) {
+        uent[j].id = users.ent[j].id;
+        uent[j].nameOff = off;
+        strcpy(str + off, users.ent[j].name);
+        off += strlen(users.ent[j].name) + 1;
+    }
+    for (j = 0; j < groups.n; j++) {
+        gent[j].id = groups.ent[j].id;
+        gent[j].nameOff = off;
+        strcpy(str + off, groups.ent[j].name);
+        off += strlen(groups.ent[j].name) + 1;
+    }
+
+    fillTables(&users, uent, (uint32_t *) (base + hdr->uidTabOff),
+               (uint32_t *) (base + hdr->unameTabOff), hdr->userTabSize);
+    fillTables(&groups, gent, (uint32_t *) (base + hdr->gidTabOff),
+               (uint32_t *) (base + hdr->gnameTabOff), hdr->groupTabSize);
+    *sizep = size;
+
+done:
+    listFree(&users);
+    listFree(&groups);
+    return base;
+}
+
+static int
+writeAll(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int
+ugsCreate(const char *path)
+{
+    char *base, *tmpPath;
+    size_t size;
+    int fd, savedErrno;
+
+    base = buildSnapshot(&size);
+    if (base == NULL)
+        return -1;
+
+    if (asprintf(&tmpPath, "%s.XXXXXX", path) == -1) {
+        free(base);
+        return -1;
+    }
+    fd = mkstemp(tmpPath);
+    if (fd == -1)
+        goto fail;
+    if (fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == -1 ||
+            writeAll(fd, base, size) == -1 || fsync(fd) == -1 ||
+            close(fd) == -1) {
+        savedErrno = errno;
+        unlink(tmpPath);
+        errno = savedErrno;
+        goto fail;
+    }
+    if (rename(tmpPath, path) == -1) {  /* Atomically replace old one */
+        savedErrno = errno;
+        unlink(tmpPath);
+        errno = savedErrno;
+        goto fail;
+    }
+
+    free(tmpPath);
+    free(base);
+    return 0;
+
+fail:
+    savedErrno = errno;
+    free(tmpPath);
+    free(base);
+    errno = savedErrno;
+    return -1;
+}
+
+int
+ugsCreateMemfd(void)
+{
+    char *base;
+    size_t size;
+    int fd, savedErrno;
+
+    base = buildSnapshot(&size);
+    if (base == NULL)
+        return -1;
+
+    fd = memfd_create("ugid_snapshot", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1)
+        goto fail;
+    if (writeAll(fd, base, size) == -1 ||
+            fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+                                   F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+        savedErrno = errno;
+        close(fd);
+        errno = savedErrno;
+        goto fail;
+    }
+
+    free(base);
+    return fd;
+
+fail:
+    savedErrno = errno;
+    free(base);
+    errno = savedErrno;
+    return -1;
+}
+
+/* Using a snapshot */
+
+static Boolean
+inBounds(const struct ugsHeader *hdr, uint32_t off, size_t len)
+{
+    return off <= hdr->size && len <= hdr->size - off;
+}
+
+struct ugsSnapshot *
+ugsOpenFd(int fd)
+{
+    const struct ugsHeader *hdr;
+    struct ugsSnapshot *s;
+    struct stat sb;
+    void *addr;
+
+    if (fstat(fd, &sb) == -1)
+        return NULL;
+    if (sb.st_size < sizeof(struct ugsHeader)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    addr = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    /* Check that the snapshot is sound, so that lookups need check only
+       the values that they take from the hash tables and entries */
+
+    hdr = addr;
+    if (memcmp(hdr->magic, UGS_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->size != sb.st_size ||
+            (hdr->userTabSize & (hdr->userTabSize - 1)) != 0 ||
+            (hdr->groupTabSize & (hdr->groupTabSize - 1)) != 0 ||
+            hdr->userTabSize < hdr->nusers ||
+            hdr->groupTabSize < hdr->ngroups ||
+            !inBounds(hdr, hdr->usersOff,
+                      (size_t) hdr->nusers * sizeof(struct ugsEntry)) ||
+            !inBounds(hdr, hdr->groupsOff,
+                      (size_t) hdr->ngroups * sizeof(struct ugsEntry)) ||
+            !inBounds(hdr, hdr->uidTabOff,
+                      (size_t) hdr->userTabSize * sizeof(uint32_t)) ||
+            !inBounds(hdr, hdr->unameTabOff,
+                      (size_t) hdr->userTabSize * sizeof(uint32_t)) ||
+            !inBounds(hdr, hdr->gidTabOff,
+                      (size_t) hdr->groupTabSize * sizeof(uint32_t)) ||
+            !inBounds(hdr, hdr->gnameTabOff,
+                      (size_t) hdr->groupTabSize * sizeof(uint32_t)) ||
+            !inBounds(hdr, hdr->strOff, hdr->strSize) ||
+            hdr->strSize == 0 ||
+            ((const char *) addr)[hdr->strOff + hdr->strSize - 1] != '\0') {
+        munmap(addr, sb.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    s = calloc(1, sizeof(struct ugsSnapshot));
+    if (s == NULL) {
+        munmap(addr, sb.st_size);
+        return NULL;
+    }
+    s->base = addr;
+    s->size = sb.st_size;
+    s->hdr = hdr;
+    s->dev = sb.st_dev;
+    s->ino = sb.st_ino;
+    return s;
+}
+
+struct ugsSnapshot *
+ugsOpen(const char *path)
+{
+    struct ugsSnapshot *s;
+    int fd, savedErrno;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    s = ugsOpenFd(fd);
+    savedErrno = errno;
+    close(fd);                          /* The mapping remains */
+    if (s == NULL) {
+        errno = savedErrno;
+        return NULL;
+    }
+
+    s->path = strdup(path);
+    if (s->path == NULL) {
+        ugsClose(s);
+        return NULL;
+    }
+    return s;
+}
+
+int
+ugsRefresh(struct ugsSnapshot **sp)
+{
+    struct ugsSnapshot *s;
+    struct stat sb;
+
+    if ((*sp)->path == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (stat((*sp)->path, &sb) == -1)
+        return -1;
+    if (sb.st_dev == (*sp)->dev && sb.st_ino == (*sp)->ino)
+        return 0;                       /* Not replaced */
+
+    s = ugsOpen((*sp)->path);
+    if (s == NULL)
+        return -1;
+    ugsClose(*sp);
+    *sp = s;
+    return 1;
+}
+
+void
+ugsClose(struct ugsSnapshot *s)
+{
+    munmap((void *) s->base, s->size);
+    free(s->path);
+    free(s);
+}
+
+/* Look up an ID or a name in one of the hash tables, returning the
+   entry, or NULL */
+
+static const struct ugsEntry *
+lookup(const struct ugsSnapshot *s, Boolean group, Boolean byName,
+       uint32_t id, const char *name)
+{
+    const struct ugsHeader *hdr = s->hdr;
+    const struct ugsEntry *ent;
+    const uint32_t *tab;
+    uint32_t h, mask, n, k, j;
+    const char *strs;
+
+    n = group ? hdr->ngroups : hdr->nusers;
+    mask = (group ? hdr->groupTabSize : hdr->userTabSize) - 1;
+    ent = (const struct ugsEntry *)
+            (s->base + (group ? hdr->groupsOff : hdr->usersOff));
+    tab = (const uint32_t *) (s->base + (group ?
+            (byName ? hdr->gnameTabOff : hdr->gidTabOff) :
+            (byName ? hdr->unameTabOff : hdr->uidTabOff)));
+    strs = s->base + hdr->strOff;
+
+    h = (byName ? hashName(name) : hashId(id)) & mask;
+    for (j = 0; j <= mask; j++, h = (h + 1) & mask) {
+        if (tab[h] == 0 || tab[h] > n)
+            return NULL;
+        k = tab[h] - 1;
+        if (ent[k].nameOff >= hdr->strSize)
+            return NULL;                /* Corrupt snapshot */
+        if (byName ? strcmp(strs + ent[k].nameOff, name) == 0 :
+                     ent[k].id == id)
+            return &ent[k];
+    }
+    return NULL;
+}
+
+const char *    /* Return name corresponding to 'uid', or NULL */
+ugsUserName(const struct ugsSnapshot *s, uid_t uid)
+{
+    const struct ugsEntry *e = lookup(s, FALSE, FALSE, uid, NULL);
+
+    return (e == NULL) ? NULL : s->base + s->hdr->strOff + e->nameOff;
+}
+
+uid_t           /* Return UID corresponding to 'name', or -1 */
+ugsUserId(const struct ugsSnapshot *s, const char *name)
+{
+    const struct ugsEntry *e;
+    char *endptr;
+    uid_t u;
+
+    if (name == NULL || *name == '\0')
+        return -1;
+    u = strtol(name, &endptr, 10);      /* Allow a numeric string */
+    if (*endptr == '\0')
+        return u;
+
+    e = lookup(s, FALSE, TRUE, 0, name);
+    return (e == NULL) ? -1 : e->id;
+}
+
+const char *    /* Return name corresponding to 'gid', or NULL */
+ugsGroupName(const struct ugsSnapshot *s, gid_t gid)
+{
+    const struct ugsEntry *e = lookup(s, TRUE, FALSE, gid, NULL);
+
+    return (e == NULL) ? NULL : s->base + s->hdr->strOff + e->nameOff;
+}
+
+gid_t           /* Return GID corresponding to 'name', or -1 */
+ugsGroupId(const struct ugsSnapshot *s, const char *name)
+{
+    const struct ugsEntry *e;
+    char *endptr;
+    gid_t g;
+
+    if (name == NULL || *name == '\0')
+        return -1;
+    g = strtol(name, &endptr, 10);      /* Allow a numeric string */
+    if (*endptr == '\0')
+        return g;
+
+    e = lookup(s, TRUE, TRUE, 0, name);
+    return (e == NULL) ? -1 : e->id;
+}
+
+void
+ugsCounts(const struct ugsSnapshot *s, long *nusers, long *ngroups)
+{
+    *nusers = s->hdr->nusers;
+    *ngroups = s->hdr->ngroups;
+}
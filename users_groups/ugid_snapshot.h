@@ -0,0 +1,46 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 8 */
+
+/* ugid_snapshot.h
+
+   Header file for ugid_snapshot.c.
+*/
+#ifndef UGID_SNAPSHOT_H
+#define UGID_SNAPSHOT_H
+
+#include "tlpi_hdr.h"
+
+struct ugsSnapshot;             /* Opaque; defined in ugid_snapshot.c */
+
+int ugsCreate(const char *path);
+
+int ugsCreateMemfd(void);
+
+struct ugsSnapshot *ugsOpen(const char *path);
+
+struct ugsSnapshot *ugsOpenFd(int fd);
+
+int ugsRefresh(struct ugsSnapshot **sp);
+
+void ugsClose(struct ugsSnapshot *s);
+
+const char *ugsUserName(const struct ugsSnapshot *s, uid_t uid);
+
+uid_t ugsUserId(const struct ugsSnapshot *s, const char *name);
+
+const char *ugsGroupName(const struct ugsSnapshot *s, gid_t gid);
+
+gid_t ugsGroupId(const struct ugsSnapshot *s, const char *name);
+
+void ugsCounts(const struct ugsSnapshot *s, long *nusers, long *ngroups);
+
+#endif
@@ -0,0 +1,331 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter Z */
+
+/* clock_bench.c
+
+   Measure the cost of reading each of the system clocks, both via
+   clock_gettime() (which the C library implements using the VDSO where
+   possible; see gettimeofday.c) and by directly invoking the system call
+   with syscall(2). On x86, the cost of reading the timestamp counter
+   directly with the RDTSC and RDTSCP instructions is also measured.
+
+   Usage: clock_bench [-n loops] [-t nthreads]
+
+        -n loops     Number of reads performed by each thread in each test
+                     (default: 1000000)
+        -t nthreads  Number of threads performing each test at the same
+                     time (default: 1)
+
+   For each method the program shows the average and worst (over all
+   threads) cost per call, the resolution reported by clock_getres(),
+   and the smallest nonzero step observed between successive readings.
+   Running with several threads shows the effect of the threads
+   contending on the VDSO data page (which readers access under a
+   seqlock that the kernel holds while updating the time).
+
+   The kernel implements a clock in the VDSO only if the current
+   clocksource can be read from user space (for example "tsc" on x86,
+   but not "hpet" or "acpi_pm"); otherwise the VDSO code itself falls
+   back to the system call. In addition, the CPU-time clocks are never
+   implemented in the VDSO. The program flags any clock whose
+   clock_gettime() cost is close to that of the system call as
+   probably not being handled in user space.
+
+   For example, compare the results when using different clocksources:
+
+        $ cd /sys/devices/system/clocksource/clocksource0
+        $ cat available_clocksource
+        tsc hpet acpi_pm
+        $ sudo sh -c 'echo hpet > current_clocksource'
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+#include "tlpi_hdr.h"
+
+#define CLOCKSOURCE_FILE \
+    "/sys/devices/system/clocksource/clocksource0/current_clocksource"
+
+#define FALLBACK_RATIO 0.75     /* VDSO/syscall cost ratio above which we
+                                   guess that the VDSO isn't used */
+
+enum method { M_VDSO, M_SYSCALL, M_RDTSC, M_RDTSCP };
+
+struct test {
+    const char *name;
+    clockid_t clock;
+    enum method method;
+};
+
+static const struct {
+    const char *name;
+    clockid_t clock;
+} clocks[] = {
+    { "REALTIME",               CLOCK_REALTIME },
+    { "REALTIME_COARSE",        CLOCK_REALTIME_COARSE },
+    { "MONOTONIC",              CLOCK_MONOTONIC },
+    { "MONOTONIC_COARSE",       CLOCK_MONOTONIC_COARSE },
+    { "MONOTONIC_RAW",          CLOCK_MONOTONIC_RAW },
+    { "BOOTTIME",               CLOCK_BOOTTIME },
+    { "PROCESS_CPUTIME_ID",     CLOCK_PROCESS_CPUTIME_ID },
+    { "THREAD_CPUTIME_ID",      CLOCK_THREAD_CPUTIME_ID },
+};
+
+#define NCLOCKS (sizeof(clocks) / sizeof(clocks[0]))
+#define MAX_TESTS (2 * NCLOCKS + 2)
+
+static struct test tests[MAX_TESTS];
+static int ntests;
+static long loops = 1000000;
+static int nthreads = 1;
+static double *nsPerCall;               /* [test * nthreads + thread] */
+static int64_t minStep[MAX_TESTS];      /* In ns, or TSC ticks */
+static pthread_barrier_t barrier;
+static volatile uint64_t sink;
+
+static int64_t
+tsToNs(const struct timespec *ts)
+{
+    return ts->tv_sec * (int64_t) 1000000000 + ts->tv_nsec;
+}
+
+/* Read the clock (or counter) for 'test'. The value is in nanoseconds,
+   or for the TSC, in ticks. */
+
+static inline int64_t
+readClock(const struct test *test)
+{
+    struct timespec ts;
+#ifdef HAVE_TSC
+    unsigned int aux;
+#endif
+
+    switch (test->method) {
+    case M_VDSO:
+        if (clock_gettime(test->clock, &ts) == -1)
+            errExit("clock_gettime");
+        return tsToNs(&ts);
+    case M_SYSCALL:
+        if (syscall(SYS_clock_gettime, test->clock, &ts) == -1)
+            errExit("syscall(clock_gettime)");
+        return tsToNs(&ts);
+#ifdef HAVE_TSC
+    case M_RDTSC:
+        return __rdtsc();
+    case M_RDTSCP:
+        return __rdtscp(&aux);
+#endif
+    default:
+        fatal("Bad method");
+    }
+}
+
+static int64_t
+monoNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return tsToNs(&ts);
+}
+
+static void *
+threadFunc(void *arg)
+{
+    int tnum = (long) arg;
+    const struct test *test;
+    int64_t start, prev, cur, step;
+    uint64_t sum;
+    long j;
+    int t, s;
+
+    for (t = 0; t < ntests; t++) {
+        test = &tests[t];
+
+        s = pthread_barrier_wait(&barrier);     /* Start together */
+        if (s != 0 && s != PTHREAD_BARRIER_SERIAL_THREAD)
+            errExitEN(s, "pthread_barrier_wait");
+
+        sum = 0;
+        start = monoNs();
+        for (j = 0; j < loops; j++)
+            sum += readClock(test);
+        nsPerCall[t * nthreads + tnum] = (double) (monoNs() - start) / loops;
+        sink = sum;
+
+        /* Thread 0 also looks for the smallest step between readings
+           (reading for longer if no step has yet been seen, as is
+           likely for the coarse clocks) */
+
+        if (tnum == 0) {
+            minStep[t] = INT64_MAX;
+            prev = readClock(test);
+            for (j = 0; j < 100000 ||
+                    (minStep[t] == INT64_MAX && j < 100000000); j++) {
+                cur = readClock(test);
+                step = cur - prev;
+                if (step > 0 && step < minStep[t])
+                    minStep[t] = step;
+                prev = cur;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Estimate the TSC frequency, in ticks per nanosecond */
+
+#ifdef HAVE_TSC
+static double
+tscPerNs(void)
+{
+    struct timespec delay = { 0, 100000000 };
+    int64_t ns, tsc;
+
+    ns = monoNs();
+    tsc = __rdtsc();
+    nanosleep(&delay, NULL);
+    return (double) (__rdtsc() - tsc) / (monoNs() - ns);
+}
+#endif
+
+static void
+addTest(const char *name, clockid_t clock, enum method method)
+{
+    tests[ntests].name = name;
+    tests[ntests].clock = clock;
+    tests[ntests].method = method;
+    ntests++;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n loops] [-t nthreads]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const char *methodName[] = { "vdso", "syscall", "rdtsc", "rdtscp" };
+    struct timespec res;
+    pthread_t *tid;
+    char clocksource[64];
+    double avg, worst, vdsoNs, tscRate;
+    FILE *fp;
+    int opt, s, t, j;
+
+    while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+        switch (opt) {
+        case 'n':   loops = getLong(optarg, GN_GT_0, "loops");          break;
+        case 't':   nthreads = getInt(optarg, GN_GT_0, "nthreads");     break;
+        default:    usageError(argv[0]);
+        }
+    }
+
+    if (optind != argc)
+        usageError(argv[0]);
+
+    for (j = 0; j < NCLOCKS; j++) {
+        addTest(clocks[j].name, clocks[j].clock, M_VDSO);
+        addTest(clocks[j].name, clocks[j].clock, M_SYSCALL);
+    }
+#ifdef HAVE_TSC
+    addTest("TSC", 0, M_RDTSC);
+    addTest("TSC", 0, M_RDTSCP);
+    tscRate = tscPerNs();
+#else
+    tscRate = 0;
+#endif
+
+    fp = fopen(CLOCKSOURCE_FILE, "r");
+    if (fp == NULL || fgets(clocksource, sizeof(clocksource), fp) == NULL)
+        snprintf(clocksource, sizeof(clocksource), "unknown\n");
+    if (fp != NULL)
+        fclose(fp);
+    printf("Clocksource: %s", clocksource);
+    if (tscRate > 0)
+        printf("TSC rate:    %.3f GHz\n", tscRate);
+    printf("Threads:     %d\n\n", nthreads);
+
+    nsPerCall = calloc(ntests * nthreads, sizeof(double));
+    tid = calloc(nthreads, sizeof(pthread_t));
+    if (nsPerCall == NULL || tid == NULL)
+        errExit("calloc");
+
+    s = pthread_barrier_init(&barrier, NULL, nthreads);
+    if (s != 0)
+        errExitEN(s, "pthread_barrier_init");
+
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_create(&tid[j], NULL, threadFunc, (void *) (long) j);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    for (j = 0; j < nthreads; j++) {
+        s = pthread_join(tid[j], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    printf("%-20s %-8s %9s %9s %11s %11s\n", "clock", "method",
+            "avg-ns", "worst-ns", "res-ns", "min-step-ns");
+
+    vdsoNs = 0;
+    for (t = 0; t < ntests; t++) {
+        avg = worst = 0;
+        for (j = 0; j < nthreads; j++) {
+            avg += nsPerCall[t * nthreads + j];
+            worst = max(worst, nsPerCall[t * nthreads + j]);
+        }
+        avg /= nthreads;
+
+        printf("%-20s %-8s %9.1f %9.1f ", tests[t].name,
+                methodName[tests[t].method], avg, worst);
+
+        if (tests[t].method == M_VDSO || tests[t].method == M_SYSCALL) {
+            if (clock_getres(tests[t].clock, &res) == -1)
+                printf("%11s ", "?");
+            else
+                printf("%11lld ", (long long) tsToNs(&res));
+            if (minStep[t] == INT64_MAX)
+                printf("%11s", "-");
+            else
+                printf("%11lld", (long long) minStep[t]);
+        } else {
+            printf("%11.2f %11.2f", (tscRate > 0) ? 1 / tscRate : 0.0,
+                    (tscRate > 0) ? minStep[t] / tscRate : 0.0);
+        }
+
+        /* Each clock's "vdso" test immediately precedes its "syscall"
+           test */
+
+        if (tests[t].method == M_VDSO)
+            vdsoNs = avg;
+        else if (tests[t].method == M_SYSCALL &&
+                 vdsoNs >= FALLBACK_RATIO * avg)
+            printf("  <- not in VDSO?");
+        printf("\n");
+    }
+
+    exit(EXIT_SUCCESS);
+}
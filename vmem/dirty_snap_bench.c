@@ -0,0 +1,267 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 50 */
+
+/* dirty_snap_bench.c
+
+   Measure the cost of incremental snapshots of memory taken with
+   dirty_track.c, for each way of tracking writes, against taking a full
+   copy each time.
+
+   Usage: dirty_snap_bench [-s MiB] [-w pages,...] [-n intervals]
+                           [-m method,...] [-V] [-C]
+
+        -s MiB      Size of the region (default: 64)
+        -w pages    Pages written (at random, possibly repeating) in each
+                    interval between checkpoints (default: 16,256,4096)
+        -n intervals  Intervals for each measurement (default: 50)
+        -m          Methods (default: all): full (no tracking: copy the
+                    whole region at each checkpoint), uffd, soft-dirty,
+                    mprotect (see dirty_track.c)
+        -V          After each checkpoint, verify that the snapshot
+                    matches the region
+        -C          CSV output
+
+   For each method and number of pages written, the program reports the
+   average time taken by the writes in an interval (which, with tracking,
+   includes the write faults) per page written, the median and maximum
+   time taken by a checkpoint, the pages copied per checkpoint, and the
+   write faults taken per interval. Methods that are unavailable (for
+   example, soft-dirty on a kernel without CONFIG_MEM_SOFT_DIRTY) are
+   reported and skipped.
+
+   Try: dirty_snap_bench -V
+
+   This program is Linux-specific.
+*/
+#include <sys/mman.h>
+#include <time.h>
+#include "dirty_track.h"
+#include "lat_hist.h"
+#include "tlpi_hdr.h"
+
+#define MAX_LIST 16
+#define M_FULL (-1)             /* Pseudo-method: full copy */
+
+static const struct {
+    const char *name;
+    int method;
+} methods[] = {
+    { "full", M_FULL },
+    { "uffd", DT_UFFD },
+    { "soft-dirty", DT_SOFT_DIRTY },
+    { "mprotect", DT_MPROTECT },
+};
+#define NUM_METHODS (sizeof(methods) / sizeof(methods[0]))
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+        errExit("clock_gettime");
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int
+parseList(char *str, int *list, const char *name)
+{
+    char *tok;
+    int n;
+
+    n = 0;
+    for (tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (n == MAX_LIST)
+            cmdLineErr("Too many items in %s list\n", name);
+        list[n++] = getInt(tok, GN_GT_0, name);
+    }
+    if (n == 0)
+        cmdLineErr("Empty %s list\n", name);
+    return n;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-s MiB] [-w pages,...] [-n intervals]\n"
+                    "\t\t[-m method,...] [-V] [-C]\n", progName);
+    fprintf(stderr, "    -s MiB        Region size (default: 64)\n");
+    fprintf(stderr, "    -w pages      Pages written per interval "
+                    "(default: 16,256,4096)\n");
+    fprintf(stderr, "    -n intervals  Intervals (default: 50)\n");
+    fprintf(stderr, "    -m methods    full,uffd,soft-dirty,mprotect "
+                    "(default: all)\n");
+    fprintf(stderr, "    -V            Verify the snapshots\n");
+    fprintf(stderr, "    -C            CSV output\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int meth[MAX_LIST], writes[MAX_LIST];
+    int nmeth, nwrites, intervals, m, w, j, k;
+    struct dirtyTracker *dt;
+    struct dtStats st;
+    struct latHist ckpt;
+    long long writeNs, t0, t1;
+    unsigned long faults0;
+    unsigned int seed;
+    double pagesCopied;
+    Boolean verify, csv;
+    size_t len, npages;
+    long pageSize;
+    char *region, *full, *tok;
+    const char *snap;
+    long n;
+    int opt;
+
+    len = 64;
+    intervals = 50;
+    nmeth = 0;
+    nwrites = 0;
+    verify = FALSE;
+    csv = FALSE;
+    while ((opt = getopt(argc, argv, "s:w:n:m:VC")) != -1) {
+        switch (opt) {
+        case 's':   len = getInt(optarg, GN_GT_0, "MiB");           break;
+        case 'w':   nwrites = parseList(optarg, writes, "pages");   break;
+        case 'n':   intervals = getInt(optarg, GN_GT_0, "intervals"); break;
+        case 'm':
+            for (tok = strtok(optarg, ","); tok != NULL;
+                    tok = strtok(NULL, ",")) {
+                for (m = 0; m < (int) NUM_METHODS; m++)
+                    if (strcmp(tok, methods[m].name) == 0)
+                        break;
+                if (m == NUM_METHODS || nmeth == MAX_LIST)
+                    usageError(argv[0]);
+                meth[nmeth++] = m;
+            }
+            break;
+        case 'V':   verify = TRUE;                                  break;
+        case 'C':   csv = TRUE;                                     break;
+        default:    usageError(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usageError(argv[0]);
+
+    if (nmeth == 0)
+        for (m = 0; m < (int) NUM_METHODS; m++)
+            meth[nmeth++] = m;
+    if (nwrites == 0) {
+        writes[nwrites++] = 16;
+        writes[nwrites++] = 256;
+        writes[nwrites++] = 4096;
+    }
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    len *= 1024 * 1024;
+    npages = len / pageSize;
+
+    /* The "full" method's snapshot */
+
+    full = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (full == MAP_FAILED)
+        errExit("mmap");
+    memset(full, 0, len);
+
+    if (csv)
+        printf("method,pages,write_ns_per_page,ckpt_p50_us,ckpt_max_us,"
+               "copied_per_ckpt,faults_per_interval\n");
+    else
+        printf("%-10s %6s %10s %10s %10s %10s %10s\n", "method", "pages",
+               "ns/write", "ckpt-p50", "ckpt-max", "copied", "faults");
+
+    for (j = 0; j < nmeth; j++) {
+        for (w = 0; w < nwrites; w++) {
+            region = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (region == MAP_FAILED)
+                errExit("mmap");
+            memset(region, 1, len);
+
+            dt = NULL;
+            if (methods[meth[j]].method != M_FULL) {
+                dt = dtCreate(region, len, methods[meth[j]].method);
+                if (dt == NULL) {
+                    printf("%-10s unavailable: %s\n", methods[meth[j]].name,
+                           strerror(errno));
+                    if (munmap(region, len) == -1)
+                        errExit("munmap");
+                    break;
+                }
+                if (dtCheckpoint(dt, NULL, NULL) == -1)     /* Full copy */
+                    errExit("dtCheckpoint");
+            }
+
+            latHistInit(&ckpt);
+            writeNs = 0;
+            pagesCopied = 0;
+            faults0 = 0;
+            if (dt != NULL) {
+                dtGetStats(dt, &st);
+                faults0 = st.faults;
+            }
+            seed = 1;
+
+            for (k = 0; k < intervals; k++) {
+
+                /* Write to random pages, as an application would */
+
+                t0 = nowNs();
+                for (n = 0; n < writes[w]; n++)
+                    region[(rand_r(&seed) % npages) * pageSize +
+                           n % pageSize] += 1;
+                t1 = nowNs();
+                writeNs += t1 - t0;
+
+                if (dt == NULL) {
+                    memcpy(full, region, len);
+                    n = npages;
+                    snap = full;
+                } else {
+                    n = dtCheckpoint(dt, NULL, NULL);
+                    if (n == -1)
+                        errExit("dtCheckpoint");
+                    snap = dtSnapshot(dt);
+                }
+                latHistRecord(&ckpt, nowNs() - t1);
+                pagesCopied += n;
+
+                if (verify && memcmp(snap, region, len) != 0)
+                    fatal("%s: snapshot %d differs from region",
+                          methods[meth[j]].name, k);
+            }
+
+            st.faults = faults0;
+            if (dt != NULL) {
+                dtGetStats(dt, &st);
+                dtDestroy(dt);
+            }
+            if (munmap(region, len) == -1)
+                errExit("munmap");
+
+            printf(csv ? "%s,%d,%.1f,%.1f,%.1f,%.1f,%.1f\n" :
+                         "%-10s %6d %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                   methods[meth[j]].name, writes[w],
+                   (double) writeNs / intervals / writes[w],
+                   latHistPercentile(&ckpt, 0.50) / 1000.0,
+                   ckpt.max / 1000.0, pagesCopied / intervals,
+                   (double) (st.faults - faults0) / intervals);
+            fflush(stdout);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,608 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 50 */
+
+/* dirty_track.c
+
+   Incremental snapshots of a region of memory: each checkpoint copies
+   only the pages that have been written since the previous one.
+
+   dtCreate() begins tracking writes to a region of private anonymous
+   memory (whose pages it faults in, since only present pages can be
+   tracked), and allocates a snapshot region of the same size.
+   dtCheckpoint() finds the pages written since the last checkpoint,
+   rearms the tracking, copies those pages to the snapshot, and reports
+   each run of them to an optional callback (which might, say, append
+   them to a checkpoint file). The first checkpoint copies every page.
+
+   There are three ways to find the pages that have been written:
+
+   DT_UFFD: the region is registered with a userfaultfd in
+        write-protect mode (Linux 5.7), and write-protected with
+        UFFDIO_WRITEPROTECT. The first write to each page blocks the
+        writer, and delivers a message on the userfaultfd to a thread
+        created by dtCreate(), which marks the page dirty and removes
+        the protection from the page (which wakes the writer). Rearming
+        is one ioctl() for the whole region. (An unprivileged process
+        may use a userfaultfd only if /proc/sys/vm/unprivileged_userfaultfd
+        is 1, or with UFFD_USER_MODE_ONLY, which is tried first.)
+
+   DT_SOFT_DIRTY: the kernel sets a page's soft-dirty bit, visible in
+        /proc/self/pagemap, when it is written after the bits were
+        cleared by writing "4" to /proc/self/clear_refs. There is no
+        cost to the writer (beyond one minor fault per page after each
+        clear), but each checkpoint reads the page map entries of the
+        whole region, and the bits are cleared for the whole process
+        (so that only one tracker should use this method). Requires a
+        kernel built with CONFIG_MEM_SOFT_DIRTY; dtCreate() checks that
+        the bits work.
+
+   DT_MPROTECT: the region is made read-only with mprotect(); the first
+        write to each page raises SIGSEGV, whose handler marks the page
+        dirty and makes it writable again. This works everywhere, but
+        costs a signal delivery per page, splits the mapping into many
+        VMAs, and takes over SIGSEGV (faults outside tracked regions are
+        passed to the previous disposition).
+
+   For DT_UFFD and DT_MPROTECT, a page can be written without a fault
+   only after it has been marked dirty, and tracking is rearmed before
+   the pages are copied, so that writes made during a checkpoint are
+   picked up by the next one. Nevertheless, a snapshot is consistent
+   (that is, shows the region as it was at some instant) only if the
+   region isn't written during dtCheckpoint(). The region must not be
+   remapped or discarded (e.g., with MADV_DONTNEED) while it is tracked.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/userfaultfd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include "dirty_track.h"        /* Declares functions defined here */
+
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+
+#define PM_SOFT_DIRTY ((uint64_t) 1 << 55)      /* In a pagemap entry */
+#define PM_CHUNK 512            /* Page map entries read at a time */
+#define MAX_MPROTECT 16         /* Max. DT_MPROTECT trackers at once */
+
+struct dirtyTracker {
+    enum dtMethod method;
+    char *addr;                 /* Tracked region */
+    size_t len;
+    size_t npages;
+    long pageSize;
+    char *snap;                 /* Snapshot of the region */
+    unsigned char *dirty;       /* Per page; set by fault handlers */
+    unsigned char *work;        /* Pages to copy in this checkpoint */
+    int first;                  /* No checkpoint yet */
+    int uffd;                   /* DT_UFFD */
+    int stopFd;                 /* eventfd to stop the fault thread */
+    pthread_t faultThread;
+    int pagemapFd;              /* DT_SOFT_DIRTY */
+    int clearRefsFd;
+    unsigned long faults;       /* Updated atomically */
+    struct dtStats stats;
+};
+
+static const char *methodNames[] = { "auto", "uffd", "soft-dirty",
+                                     "mprotect" };
+
+/* DT_MPROTECT trackers, searched by the SIGSEGV handler */
+
+static pthread_mutex_t mpMtx = PTHREAD_MUTEX_INITIALIZER;
+static struct dirtyTracker *mpTrackers[MAX_MPROTECT];
+static struct sigaction oldSegv;
+static int segvInstalled;
+
+static long long
+nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+const char *
+dtMethodName(enum dtMethod method)
+{
+    return (method >= DT_AUTO && method <= DT_MPROTECT) ?
+           methodNames[method] : "unknown";
+}
+
+/* Thread that handles write-protect faults on the userfaultfd */
+
+static void *
+uffdThreadFunc(void *arg)
+{
+    struct dirtyTracker *dt = arg;
+    struct uffdio_writeprotect wp;
+    struct uffd_msg msgs[16];
+    struct pollfd pfd[2];
+    uintptr_t page;
+    ssize_t n;
+    int j;
+
+    pfd[0].fd = dt->uffd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = dt->stopFd;
+    pfd[1].events = POLLIN;
+
+    for (;;) {
+        if (poll(pfd, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (pfd[1].revents != 0)
+            break;
+
+        n = read(dt->uffd, msgs, sizeof(msgs));
+        if (n == -1)
+            continue;           /* EAGAIN: another reader, or spurious */
+
+        for (j = 0; j < n / (ssize_t) sizeof(struct uffd_msg); j++) {
+            if (msgs[j].event != UFFD_EVENT_PAGEFAULT ||
+                    !(msgs[j].arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP))
+                continue;
+
+            page = msgs[j].arg.pagefault.address & ~(dt->pageSize - 1);
+            __atomic_load_n(&dt->dirty, __ATOMIC_ACQUIRE)
+                    [(page - (uintptr_t) dt->addr) / dt->pageSize] = 1;
+            __atomic_fetch_add(&dt->faults, 1, __ATOMIC_RELAXED);
+
+            /* Unprotecting the page also wakes the writer */
+
+            wp.range.start = page;
+            wp.range.len = dt->pageSize;
+            wp.mode = 0;
+            ioctl(dt->uffd, UFFDIO_WRITEPROTECT, &wp);
+        }
+    }
+    return NULL;
+}
+
+static int
+uffdProtect(struct dirtyTracker *dt, int protect)
+{
+    struct uffdio_writeprotect wp;
+
+    wp.range.start = (uintptr_t) dt->addr;
+    wp.range.len = dt->len;
+    wp.mode = protect ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+    return ioctl(dt->uffd, UFFDIO_WRITEPROTECT, &wp);
+}
+
+static int
+uffdSetup(struct dirtyTracker *dt)
+{
+    struct uffdio_register reg;
+    struct uffdio_api api;
+    int s, savedErrno;
+
+    dt->uffd = syscall(SYS_userfaultfd,
+                       O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+    if (dt->uffd == -1 && errno == EINVAL)      /* Before Linux 5.11 */
+        dt->uffd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    if (dt->uffd == -1)
+        return -1;
+
+    api.api = UFFD_API;
+    api.features = 0;
+    if (ioctl(dt->uffd, UFFDIO_API, &api) == -1)
+        goto fail;
+    if (!(api.features & UFFD_FEATURE_PAGEFAULT_FLAG_WP)) {
+        errno = ENOTSUP;
+        goto fail;
+    }
+
+    reg.range.start = (uintptr_t) dt->addr;
+    reg.range.len = dt->len;
+    reg.mode = UFFDIO_REGISTER_MODE_WP;
+    if (ioctl(dt->uffd, UFFDIO_REGISTER, &reg) == -1 ||
+            uffdProtect(dt, 1) == -1)
+        goto fail;
+
+    dt->stopFd = eventfd(0, EFD_CLOEXEC);
+    if (dt->stopFd == -1)
+        goto fail;
+    s = pthread_create(&dt->faultThread, NULL, uffdThreadFunc, dt);
+    if (s != 0) {
+        close(dt->stopFd);
+        errno = s;
+        goto fail;
+    }
+    return 0;
+
+fail:
+    savedErrno = errno;
+    close(dt->uffd);            /* Also unregisters the region */
+    dt->uffd = -1;
+    errno = savedErrno;
+    return -1;
+}
+
+static void
+uffdTeardown(struct dirtyTracker *dt)
+{
+    struct uffdio_range range;
+    uint64_t one = 1;
+
+    if (write(dt->stopFd, &one, sizeof(one)) == sizeof(one))
+        pthread_join(dt->faultThread, NULL);
+    close(dt->stopFd);
+
+    uffdProtect(dt, 0);
+    range.start = (uintptr_t) dt->addr;
+    range.len = dt->len;
+    ioctl(dt->uffd, UFFDIO_UNREGISTER, &range);
+    close(dt->uffd);
+}
+
+static int
+clearSoftDirty(struct dirtyTracker *dt)
+{
+    return (pwrite(dt->clearRefsFd, "4", 1, 0) == 1) ? 0 : -1;
+}
+
+static int
+softDirtySetup(struct dirtyTracker *dt)
+{
+    volatile char *p = dt->addr;
+    uint64_t ent;
+    int savedErrno;
+
+    dt->pagemapFd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    dt->clearRefsFd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (dt->pagemapFd == -1 || dt->clearRefsFd == -1)
+        goto fail;
+
+    /* Check that a write sets the bit */
+
+    if (clearSoftDirty(dt) == -1)
+        goto fail;
+    p[0] = p[0];
+    if (pread(dt->pagemapFd, &ent, sizeof(ent),
+              (uintptr_t) dt->addr / dt->pageSize * sizeof(ent)) !=
+            sizeof(ent))
+        goto fail;
+    if (!(ent & PM_SOFT_DIRTY)) {
+        errno = ENOTSUP;
+        goto fail;
+    }
+    return 0;
+
+fail:
+    savedErrno = errno;
+    if (dt->pagemapFd != -1)
+        close(dt->pagemapFd);
+    if (dt->clearRefsFd != -1)
+        close(dt->clearRefsFd);
+    dt->pagemapFd = dt->clearRefsFd = -1;
+    errno = savedErrno;
+    return -1;
+}
+
+/* Set dt->work[] from the soft-dirty bits */
+
+static int
+readSoftDirty(struct dirtyTracker *dt)
+{
+    uint64_t ents[PM_CHUNK];
+    size_t j, k, n;
+    off_t off;
+
+    off = (uintptr_t) dt->addr / dt->pageSize * sizeof(uint64_t);
+    for (j = 0; j < dt->npages; j += n) {
+        n = (dt->npages - j < PM_CHUNK) ? dt->npages - j : PM_CHUNK;
+        if (pread(dt->pagemapFd, ents, n * sizeof(uint64_t),
+                  off + j * sizeof(uint64_t)) != n * sizeof(uint64_t))
+            return -1;
+        for (k = 0; k < n; k++)
+            dt->work[j + k] = (ents[k] & PM_SOFT_DIRTY) != 0;
+    }
+    return 0;
+}
+
+static void
+segvHandler(int sig, siginfo_t *si, void *uc)
+{
+    struct dirtyTracker *dt;
+    uintptr_t a = (uintptr_t) si->si_addr;
+    int savedErrno, j;
+
+    for (j = 0; j < MAX_MPROTECT; j++) {
+        dt = __atomic_load_n(&mpTrackers[j], __ATOMIC_ACQUIRE);
+        if (dt == NULL || a < (uintptr_t) dt->addr ||
+                a >= (uintptr_t) dt->addr + dt->len)
+            continue;
+
+        savedErrno = errno;
+        a &= ~(dt->pageSize - 1);
+        if (mprotect((void *) a, dt->pageSize,
+                     PROT_READ | PROT_WRITE) == 0) {
+            __atomic_load_n(&dt->dirty, __ATOMIC_ACQUIRE)
+                    [(a - (uintptr_t) dt->addr) / dt->pageSize] = 1;
+            __atomic_fetch_add(&dt->faults, 1, __ATOMIC_RELAXED);
+        }
+        errno = savedErrno;
+        return;
+    }
+
+    /* Not ours: pass the fault on to the previous disposition (if it is
+       SIG_DFL or SIG_IGN, restore the default, and let the faulting
+       instruction fault again) */
+
+    if ((oldSegv.sa_flags & SA_SIGINFO) &&
+            oldSegv.sa_sigaction != NULL) {
+        oldSegv.sa_sigaction(sig, si, uc);
+    } else if (oldSegv.sa_handler != SIG_DFL &&
+               oldSegv.sa_handler != SIG_IGN) {
+        oldSegv.sa_handler(sig);
+    } else {
+        signal(SIGSEGV, SIG_DFL);
+    }
+}
+
+static int
+mprotectSetup(struct dirtyTracker *dt)
+{
+    struct sigaction sa;
+    int j;
+
+    pthread_mutex_lock(&mpMtx);
+    for (j = 0; j < MAX_MPROTECT; j++)
+        if (mpTrackers[j] == NULL)
+            break;
+    if (j == MAX_MPROTECT) {
+        pthread_mutex_unlock(&mpMtx);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if (!segvInstalled) {
+        sa.sa_sigaction = segvHandler;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART | SA_NODEFER;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGSEGV, &sa, &oldSegv) == -1) {
+            pthread_mutex_unlock(&mpMtx);
+            return -1;
+        }
+        segvInstalled = 1;
+    }
+    __atomic_store_n(&mpTrackers[j], dt, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&mpMtx);
+
+    if (mprotect(dt->addr, dt->len, PROT_READ) == -1)
+        return -1;
+    return 0;
+}
+
+static void
+mprotectTeardown(struct dirtyTracker *dt)
+{
+    int j;
+
+    mprotect(dt->addr, dt->len, PROT_READ | PROT_WRITE);
+    pthread_mutex_lock(&mpMtx);
+    for (j = 0; j < MAX_MPROTECT; j++)
+        if (mpTrackers[j] == dt)
+            __atomic_store_n(&mpTrackers[j], NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&mpMtx);
+}
+
+static int
+setupMethod(struct dirtyTracker *dt, enum dtMethod method)
+{
+    dt->method = method;
+    switch (method) {
+    case DT_UFFD:       return uffdSetup(dt);
+    case DT_SOFT_DIRTY: return softDirtySetup(dt);
+    case DT_MPROTECT:   return mprotectSetup(dt);
+    default:            errno = EINVAL; return -1;
+    }
+}
+
+/* Begin tracking writes to the 'len' bytes at 'addr' (both page-aligned;
+   the region must be private anonymous memory, or, for DT_SOFT_DIRTY
+   and DT_MPROTECT, any writable private mapping), using 'method'.
+   Returns a pointer to the tracker, or NULL on error. */
+
+struct dirtyTracker *
+dtCreate(void *addr, size_t len, enum dtMethod method)
+{
+    struct dirtyTracker *dt;
+    volatile char *p;
+    size_t j;
+    int savedErrno;
+
+    dt = calloc(1, sizeof(struct dirtyTracker));
+    if (dt == NULL)
+        return NULL;
+    dt->pageSize = sysconf(_SC_PAGESIZE);
+    if (len == 0 || (uintptr_t) addr % dt->pageSize != 0 ||
+            len % dt->pageSize != 0) {
+        free(dt);
+        errno = EINVAL;
+        return NULL;
+    }
+    dt->addr = addr;
+    dt->len = len;
+    dt->npages = len / dt->pageSize;
+    dt->first = 1;
+    dt->uffd = dt->stopFd = dt->pagemapFd = dt->clearRefsFd = -1;
+
+    dt->snap = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    dt->dirty = calloc(dt->npages, 1);
+    dt->work = calloc(dt->npages, 1);
+    if (dt->snap == MAP_FAILED || dt->dirty == NULL || dt->work == NULL)
+        goto fail;
+
+    /* Fault in (and dirty) every page, so that every page can be
+       tracked */
+
+    for (j = 0, p = addr; j < len; j += dt->pageSize)
+        p[j] = p[j];
+
+    if (method == DT_AUTO) {
+        if (setupMethod(dt, DT_UFFD) == -1 &&
+                setupMethod(dt, DT_SOFT_DIRTY) == -1 &&
+                setupMethod(dt, DT_MPROTECT) == -1)
+            goto fail;
+    } else if (setupMethod(dt, method) == -1) {
+        goto fail;
+    }
+    return dt;
+
+fail:
+    savedErrno = errno;
+    if (dt->method == DT_MPROTECT)
+        mprotectTeardown(dt);
+    if (dt->snap != MAP_FAILED && dt->snap != NULL)
+        munmap(dt->snap, len);
+    free(dt->dirty);
+    free(dt->work);
+    free(dt);
+    errno = savedErrno;
+    return NULL;
+}
+
+enum dtMethod
+dtGetMethod(const struct dirtyTracker *dt)
+{
+    return dt->method;
+}
+
+/* Copy the pages of the region written since the last checkpoint (or,
+   the first time, all pages) to the snapshot, calling fn(offset, data,
+   len, arg) (if 'fn' is not NULL) for each run of them. Returns the
+   number of pages copied, or -1 on error. */
+
+long
+dtCheckpoint(struct dirtyTracker *dt, dtPageFunc fn, void *arg)
+{
+    long long t0, t1, t2;
+    size_t j, k, copied;
+    unsigned char *tmp;
+
+    t0 = nowNs();
+
+    /* Find the dirty pages, and rearm tracking */
+
+    if (dt->method == DT_SOFT_DIRTY) {
+        if (readSoftDirty(dt) == -1 || clearSoftDirty(dt) == -1)
+            return -1;
+    } else {
+
+        /* Swap the arrays; a page can only be written without a fault
+           (before the region is protected again) if it is already
+           marked in what is now 'work' */
+
+        memset(dt->work, 0, dt->npages);
+        tmp = dt->work;
+        dt->work = __atomic_exchange_n(&dt->dirty, tmp, __ATOMIC_ACQ_REL);
+
+        if (dt->method == DT_UFFD) {
+            if (uffdProtect(dt, 1) == -1)
+                return -1;
+        } else {
+            if (mprotect(dt->addr, dt->len, PROT_READ) == -1)
+                return -1;
+        }
+    }
+    if (dt->first)
+        memset(dt->work, 1, dt->npages);
+    dt->first = 0;
+
+    t1 = nowNs();
+
+    /* Copy runs of dirty pages */
+
+    copied = 0;
+    for (j = 0; j < dt->npages; j = k) {
+        if (!dt->work[j]) {
+            k = j + 1;
+            continue;
+        }
+        for (k = j + 1; k < dt->npages && dt->work[k]; k++)
+            continue;
+        memcpy(dt->snap + j * dt->pageSize, dt->addr + j * dt->pageSize,
+               (k - j) * dt->pageSize);
+        if (fn != NULL)
+            fn(j * dt->pageSize, dt->snap + j * dt->pageSize,
+               (k - j) * dt->pageSize, arg);
+        copied += k - j;
+    }
+
+    t2 = nowNs();
+    dt->stats.checkpoints++;
+    dt->stats.pagesCopied += copied;
+    dt->stats.lastCopied = copied;
+    dt->stats.trackNs += t1 - t0;
+    dt->stats.copyNs += t2 - t1;
+    return copied;
+}
+
+/* Return the snapshot, as of the last checkpoint */
+
+const void *
+dtSnapshot(const struct dirtyTracker *dt)
+{
+    return dt->snap;
+}
+
+void
+dtGetStats(const struct dirtyTracker *dt, struct dtStats *stats)
+{
+    *stats = dt->stats;
+    stats->faults = __atomic_load_n(&dt->faults, __ATOMIC_RELAXED);
+}
+
+/* Stop tracking, and free the tracker and its snapshot */
+
+void
+dtDestroy(struct dirtyTracker *dt)
+{
+    switch (dt->method) {
+    case DT_UFFD:
+        uffdTeardown(dt);
+        break;
+    case DT_SOFT_DIRTY:
+        close(dt->pagemapFd);
+        close(dt->clearRefsFd);
+        break;
+    case DT_MPROTECT:
+        mprotectTeardown(dt);
+        break;
+    default:
+        break;
+    }
+    munmap(dt->snap, dt->len);
+    free(dt->dirty);
+    free(dt->work);
+    free(dt);
+}
@@ -0,0 +1,62 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 50 */
+
+/* dirty_track.h
+
+   Header file for dirty_track.c.
+*/
+#ifndef DIRTY_TRACK_H
+#define DIRTY_TRACK_H           /* Prevent accidental double inclusion */
+
+#include <stddef.h>
+
+enum dtMethod {
+    DT_AUTO,                    /* First of the following that works */
+    DT_UFFD,                    /* userfaultfd write-protect faults */
+    DT_SOFT_DIRTY,              /* Soft-dirty bits in /proc/self/pagemap */
+    DT_MPROTECT                 /* mprotect() and SIGSEGV */
+};
+
+struct dirtyTracker;            /* Opaque; defined in dirty_track.c */
+
+/* Called by dtCheckpoint() for each run of consecutive dirty pages,
+   after they have been copied to the snapshot */
+
+typedef void (*dtPageFunc)(size_t offset, const void *data, size_t len,
+                           void *arg);
+
+struct dtStats {
+    unsigned long checkpoints;
+    unsigned long pagesCopied;  /* Total, over all checkpoints */
+    unsigned long lastCopied;   /* Pages copied by last checkpoint */
+    unsigned long faults;       /* Write faults handled (DT_UFFD and
+                                   DT_MPROTECT) */
+    long long trackNs;          /* Time spent finding dirty pages and
+                                   rearming tracking in dtCheckpoint() */
+    long long copyNs;           /* Time spent copying pages */
+};
+
+struct dirtyTracker *dtCreate(void *addr, size_t len, enum dtMethod method);
+
+enum dtMethod dtGetMethod(const struct dirtyTracker *dt);
+
+const char *dtMethodName(enum dtMethod method);
+
+long dtCheckpoint(struct dirtyTracker *dt, dtPageFunc fn, void *arg);
+
+const void *dtSnapshot(const struct dirtyTracker *dt);
+
+void dtGetStats(const struct dirtyTracker *dt, struct dtStats *stats);
+
+void dtDestroy(struct dirtyTracker *dt);
+
+#endif
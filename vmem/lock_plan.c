@@ -0,0 +1,350 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 50 */
+
+/* lock_plan.c
+
+   Lock (or just prefault) only the memory that a latency-sensitive
+   process actually needs resident, instead of everything, as
+   mlockall(MCL_CURRENT | MCL_FUTURE) does.
+
+   A plan is a list of address ranges, each with a mode:
+
+        LP_LOCK       mlock(): all pages are faulted in and locked now;
+                      for a writable private mapping, the kernel faults
+                      the pages in for writing, so that no copy-on-write
+                      fault occurs later
+        LP_ONFAULT    mlock2(MLOCK_ONFAULT) (Linux 4.4 and later): pages
+                      are locked as they are faulted in, and pages that
+                      are never touched cost nothing; suitable for large,
+                      sparsely used regions
+        LP_POPULATE   madvise(MADV_POPULATE_WRITE or MADV_POPULATE_READ)
+                      (Linux 5.14 and later, else the pages are read):
+                      fault in the pages without locking them, so that
+                      they don't count against RLIMIT_MEMLOCK, but can
+                      still be reclaimed
+
+   Ranges are added either explicitly (lpAdd()) or by selecting mappings
+   of the calling process whose pathname (as shown in /proc/self/smaps,
+   e.g., "[heap]", "[stack]", or "*libc.so*") matches a pattern
+   (lpAddSmaps()).
+
+   lpCheck() compares the bytes to be locked, plus the memory that is
+   already locked (VmLck in /proc/self/status), with the RLIMIT_MEMLOCK
+   soft limit, and warns when the total passes a given fraction of the
+   limit. (An LP_ONFAULT range is counted in full, since all of its pages
+   may eventually be touched. A process with CAP_IPC_LOCK is not subject
+   to the limit.) lpApply() then carries out the plan, and lpResident()
+   reports (via mincore()) how much of a range is resident.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdint.h>
+#include "lock_plan.h"
+#include "tlpi_hdr.h"
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22           /* Since Linux 5.14 */
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+#define CAP_IPC_LOCK_BIT 14
+
+static long pageSize;
+
+int
+lpInit(struct lockPlan *lp)
+{
+    struct rlimit rl;
+
+    if (pageSize == 0)
+        pageSize = sysconf(_SC_PAGESIZE);
+
+    memset(lp, 0, sizeof(*lp));
+    lp->failed = -1;
+    if (getrlimit(RLIMIT_MEMLOCK, &rl) == -1)
+        return -1;
+    lp->limit = (rl.rlim_cur == RLIM_INFINITY) ? SIZE_MAX : rl.rlim_cur;
+    return 0;
+}
+
+/* Add the range 'addr'..'addr + len' (extended to page boundaries) to
+   the plan. Returns 0 on success, or -1 on error. */
+
+int
+lpAdd(struct lockPlan *lp, void *addr, size_t len, int mode,
+      const char *name)
+{
+    struct lockRange *r;
+    uintptr_t start, end;
+
+    if (mode != LP_LOCK && mode != LP_ONFAULT && mode != LP_POPULATE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (lp->n == lp->max) {
+        lp->max = (lp->max == 0) ? 16 : lp->max * 2;
+        r = realloc(lp->ranges, lp->max * sizeof(struct lockRange));
+        if (r == NULL)
+            return -1;
+        lp->ranges = r;
+    }
+
+    start = (uintptr_t) addr & ~(pageSize - 1);
+    end = ((uintptr_t) addr + len + pageSize - 1) & ~(pageSize - 1);
+
+    r = &lp->ranges[lp->n++];
+    memset(r, 0, sizeof(*r));
+    r->addr = (char *) start;
+    r->len = end - start;
+    r->mode = mode;
+    snprintf(r->name, sizeof(r->name), "%s", (name != NULL) ? name : "");
+    if (mode != LP_POPULATE)
+        lp->lockBytes += r->len;
+    return 0;
+}
+
+/* Add each mapping of the calling process whose pathname is equal to,
+   or matches the fnmatch(3) 'pattern'. Inaccessible mappings (e.g.,
+   guard pages) and the kernel's special mappings ([vdso], [vvar],
+   [vsyscall]) are skipped. Returns the number of mappings added, or -1
+   on error. */
+
+int
+lpAddSmaps(struct lockPlan *lp, const char *pattern, int mode)
+{
+    char line[PATH_MAX + 128], perms[8], path[PATH_MAX], *name;
+    unsigned long start, end, rssKb;
+    struct lockRange *last;
+    Boolean match;
+    FILE *fp;
+    int n, nf;
+
+    fp = fopen("/proc/self/smaps", "r");
+    if (fp == NULL)
+        return -1;
+
+    n = 0;
+    last = NULL;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        path[0] = '\0';
+        nf = sscanf(line, "%lx-%lx %7s %*s %*s %*s %4095[^\n]",
+                    &start, &end, perms, path);
+        if (nf < 3) {
+            if (last != NULL && sscanf(line, "Rss: %lu", &rssKb) == 1) {
+                last->rssAtPlan = rssKb * 1024;
+                last = NULL;
+            }
+            continue;
+        }
+
+        last = NULL;
+        match = (strcmp(pattern, path) == 0 ||      /* E.g., "[heap]" */
+                 fnmatch(pattern, path, 0) == 0) &&
+                strncmp(perms, "---", 3) != 0 &&
+                strncmp(path, "[v", 2) != 0;
+        if (!match)
+            continue;
+
+        name = strrchr(path, '/');
+        if (name != NULL)
+            name++;
+        else
+            name = (path[0] != '\0') ? path : "[anon]";
+        if (lpAdd(lp, (void *) start, end - start, mode, name) == -1) {
+            fclose(fp);
+            return -1;
+        }
+        last = &lp->ranges[lp->n - 1];
+        n++;
+    }
+
+    fclose(fp);
+    return n;
+}
+
+/* Return the number of bytes currently locked by the process (VmLck) */
+
+size_t
+lpLockedBytes(void)
+{
+    char line[256];
+    unsigned long kb;
+    FILE *fp;
+
+    kb = 0;
+    fp = fopen("/proc/self/status", "r");
+    if (fp == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), fp) != NULL)
+        if (sscanf(line, "VmLck: %lu", &kb) == 1)
+            break;
+    fclose(fp);
+    return kb * 1024;
+}
+
+static Boolean
+haveIpcLock(void)
+{
+    char line[256];
+    unsigned long long caps;
+    Boolean have;
+    FILE *fp;
+
+    have = FALSE;
+    fp = fopen("/proc/self/status", "r");
+    if (fp == NULL)
+        return FALSE;
+    while (fgets(line, sizeof(line), fp) != NULL)
+        if (sscanf(line, "CapEff: %llx", &caps) == 1) {
+            have = (caps >> CAP_IPC_LOCK_BIT) & 1;
+            break;
+        }
+    fclose(fp);
+    return have;
+}
+
+/* Check the plan against RLIMIT_MEMLOCK, printing a warning on stderr
+   if memory that is already locked plus the memory that the plan will
+   lock exceeds the fraction 'warnFrac' of the limit. Returns 0 if the
+   plan fits, or -1 (with 'errno' set to ENOMEM) if it would exceed the
+   limit (and the process lacks CAP_IPC_LOCK). */
+
+int
+lpCheck(struct lockPlan *lp, double warnFrac)
+{
+    size_t total;
+
+    lp->lockedBefore = lpLockedBytes();
+    if (lp->limit == SIZE_MAX)
+        return 0;
+
+    total = lp->lockedBefore + lp->lockBytes;
+    if (total > lp->limit) {
+        if (haveIpcLock()) {
+            fprintf(stderr, "lock plan: %zu KiB exceeds RLIMIT_MEMLOCK "
+                    "(%zu KiB), but the process has CAP_IPC_LOCK\n",
+                    total / 1024, lp->limit / 1024);
+            return 0;
+        }
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if (total > warnFrac * lp->limit)
+        fprintf(stderr, "lock plan: %zu KiB is %.0f%% of RLIMIT_MEMLOCK "
+                "(%zu KiB)\n", total / 1024, 100.0 * total / lp->limit,
+                lp->limit / 1024);
+    return 0;
+}
+
+/* Fault in the pages of 'r' without locking them */
+
+static int
+populate(struct lockRange *r)
+{
+    volatile char sink;
+    size_t off;
+
+    if (madvise(r->addr, r->len, MADV_POPULATE_WRITE) == 0)
+        return 0;
+    if (errno != EINVAL && errno != EFAULT && errno != EPERM)
+        return -1;
+    if (madvise(r->addr, r->len, MADV_POPULATE_READ) == 0)
+        return 0;
+    if (errno != EINVAL)
+        return -1;
+
+    for (off = 0; off < r->len; off += pageSize)    /* Old kernel */
+        sink = r->addr[off];
+    (void) sink;
+    return 0;
+}
+
+/* Carry out the plan. Returns 0 on success, or -1 on error, in which case
+   'lp->failed' is the index of the range that failed (the preceding
+   ranges have been handled). */
+
+int
+lpApply(struct lockPlan *lp)
+{
+    struct lockRange *r;
+    int j, s;
+
+    lp->failed = -1;
+    for (j = 0; j < lp->n; j++) {
+        r = &lp->ranges[j];
+        switch (r->mode) {
+        case LP_LOCK:
+            s = mlock(r->addr, r->len);
+            break;
+        case LP_ONFAULT:
+            s = mlock2(r->addr, r->len, MLOCK_ONFAULT);
+            if (s == -1 && errno == ENOSYS)     /* Before Linux 4.4 */
+                s = mlock(r->addr, r->len);
+            break;
+        default:
+            s = populate(r);
+            break;
+        }
+        if (s == -1) {
+            lp->failed = j;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Return the number of resident pages in 'r', or -1 on error */
+
+long
+lpResident(const struct lockRange *r)
+{
+    unsigned char *vec;
+    long npages, n, j;
+
+    npages = r->len / pageSize;
+    vec = malloc(npages);
+    if (vec == NULL)
+        return -1;
+    if (mincore(r->addr, r->len, vec) == -1) {
+        free(vec);
+        return -1;
+    }
+    for (j = n = 0; j < npages; j++)
+        n += vec[j] & 1;
+    free(vec);
+    return n;
+}
+
+/* Unlock the locked ranges, and free the plan */
+
+void
+lpRelease(struct lockPlan *lp)
+{
+    int j;
+
+    for (j = 0; j < lp->n; j++)
+        if (lp->ranges[j].mode != LP_POPULATE)
+            munlock(lp->ranges[j].addr, lp->ranges[j].len);
+    free(lp->ranges);
+    lp->ranges = NULL;
+    lp->n = lp->max = 0;
+    lp->lockBytes = 0;
+}
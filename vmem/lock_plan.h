@@ -0,0 +1,63 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 50 */
+
+/* lock_plan.h
+
+   Header file for lock_plan.c.
+*/
+#ifndef LOCK_PLAN_H
+#define LOCK_PLAN_H             /* Prevent accidental double inclusion */
+
+#include <stddef.h>
+
+enum {                          /* How a range is to be treated */
+    LP_LOCK,                    /* Fault in all pages and lock them */
+    LP_ONFAULT,                 /* Lock pages as they are faulted in */
+    LP_POPULATE                 /* Fault in all pages, but don't lock */
+};
+
+struct lockRange {
+    char *addr;                 /* Page-aligned */
+    size_t len;                 /* Multiple of the page size */
+    int mode;                   /* LP_* */
+    char name[64];              /* For reports */
+    size_t rssAtPlan;           /* Resident bytes when added from smaps */
+};
+
+struct lockPlan {
+    struct lockRange *ranges;
+    int n, max;
+    size_t lockBytes;           /* Bytes in LP_LOCK and LP_ONFAULT ranges */
+    size_t limit;               /* RLIMIT_MEMLOCK soft limit, or SIZE_MAX */
+    size_t lockedBefore;        /* VmLck when the plan was checked */
+    int failed;                 /* Index of range that lpApply() could
+                                   not handle, or -1 */
+};
+
+int lpInit(struct lockPlan *lp);
+
+int lpAdd(struct lockPlan *lp, void *addr, size_t len, int mode,
+          const char *name);
+
+int lpAddSmaps(struct lockPlan *lp, const char *pattern, int mode);
+
+int lpCheck(struct lockPlan *lp, double warnFrac);
+
+int lpApply(struct lockPlan *lp);
+
+long lpResident(const struct lockRange *r);
+
+size_t lpLockedBytes(void);
+
+void lpRelease(struct lockPlan *lp);
+
+#endif
@@ -0,0 +1,391 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 50 */
+
+/* madvise_bench.c
+
+   Compare the ways of giving memory back to the kernel with madvise().
+
+   Usage: madvise_bench [-s MiB] [-r reps] [-f file] [-m mapping,...]
+                        [-a advice,...]
+
+        -s MiB      Size of each mapping (default: 64)
+        -r reps     Repetitions of each measurement (default: 3)
+        -f file     File for the file-backed mappings (default:
+                    madvise_bench.tmp in the current directory; the file
+                    is removed at the end)
+        -m          Mappings (default: all):
+                      anon        private anonymous memory, written
+                      file        MAP_SHARED file mapping, read (so its
+                                  pages are clean page-cache pages)
+                      file-dirty  MAP_SHARED file mapping, written
+        -a          Advice (default: all): dontneed, free, cold, pageout,
+                    p-cold, p-pageout (the last two are MADV_COLD and
+                    MADV_PAGEOUT applied with process_madvise(2), via a
+                    PID file descriptor, as another process, such as a
+                    memory manager, would do)
+
+   For each mapping and advice, the program populates the mapping, then
+   measures:
+
+        call      The time taken by the madvise() (or process_madvise())
+                  call
+        RSS       The resident memory of the mapping after the call (from
+                  the mapping's entry in /proc/self/smaps), and also the
+                  part of it that is LazyFree (see below) and the amount
+                  swapped out
+        cache     For file mappings, the part of the file that remains in
+                  the page cache (mincore())
+        retouch   The time to access every page again, and the minor and
+                  major page faults that this incurred
+        kept      The percentage of pages whose contents survived
+
+   Briefly: MADV_DONTNEED unmaps the pages at once (anonymous memory is
+   freed, and reads as zeros afterward; file pages stay in the page
+   cache), so retouching costs a page fault per page. MADV_FREE (private
+   anonymous memory only) just marks the pages as freeable: they stay
+   resident, and are counted as LazyFree, until the kernel needs memory,
+   and if they are written again before that happens, they are kept,
+   without a page fault. MADV_COLD moves the pages to the inactive LRU
+   list, so that they are reclaimed first, but does not reclaim them.
+   MADV_PAGEOUT reclaims them immediately: anonymous pages are written to
+   swap (so they stay resident if there is no swap), and clean file pages
+   are dropped from the page cache (if no other process maps them).
+
+   Effects that occur only under memory pressure (the reclaim of LazyFree
+   and cold pages) can be observed by running the program in a memory
+   cgroup with a limit, along with alloc_mem_pressure.c.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#ifndef MADV_COLD
+#define MADV_COLD 20                    /* Since Linux 5.4 */
+#endif
+#ifndef MADV_PAGEOUT
+#define MADV_PAGEOUT 21                 /* Since Linux 5.4 */
+#endif
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_process_madvise
+#define SYS_process_madvise 440
+#endif
+
+enum { M_ANON, M_FILE, M_FILE_DIRTY, NMAPPINGS };
+
+static const char *mappingNames[] = { "anon", "file", "file-dirty" };
+
+static const struct {
+    const char *name;
+    int advice;
+    Boolean viaPidfd;           /* Use process_madvise() */
+} advices[] = {
+    { "dontneed",  MADV_DONTNEED, FALSE },
+    { "free",      MADV_FREE,     FALSE },
+    { "cold",      MADV_COLD,     FALSE },
+    { "pageout",   MADV_PAGEOUT,  FALSE },
+    { "p-cold",    MADV_COLD,     TRUE },
+    { "p-pageout", MADV_PAGEOUT,  TRUE },
+};
+
+#define NADVICES (sizeof(advices) / sizeof(advices[0]))
+
+static long pageSize;
+static int pidfd = -1;
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Get the Rss, LazyFree, and Swap (KiB) of the mapping at 'addr' from
+   /proc/self/smaps */
+
+static void
+vmaStats(void *addr, long *rss, long *lazy, long *swap)
+{
+    char line[512];
+    unsigned long start, end;
+    Boolean inVma;
+    FILE *fp;
+    long val;
+
+    *rss = *lazy = *swap = 0;
+    fp = fopen("/proc/self/smaps", "r");
+    if (fp == NULL)
+        errExit("fopen-smaps");
+
+    inVma = FALSE;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {   /* New VMA */
+            if (inVma)
+                break;                  /* Passed the end of our entry */
+            inVma = (start == (unsigned long) addr);
+        } else if (inVma) {
+            if (sscanf(line, "Rss: %ld", &val) == 1)
+                *rss = val;
+            else if (sscanf(line, "LazyFree: %ld", &val) == 1)
+                *lazy = val;
+            else if (sscanf(line, "Swap: %ld", &val) == 1)
+                *swap = val;
+        }
+    }
+    fclose(fp);
+}
+
+/* Return the number of pages of the range that are in memory (for a file
+   mapping, in the page cache) */
+
+static long
+residentPages(void *addr, size_t len)
+{
+    unsigned char *vec;
+    long npages, j, n;
+
+    npages = len / pageSize;
+    vec = malloc(npages);
+    if (vec == NULL)
+        errExit("malloc");
+    if (mincore(addr, len, vec) == -1)
+        errExit("mincore");
+    for (j = n = 0; j < npages; j++)
+        n += vec[j] & 1;
+    free(vec);
+    return n;
+}
+
+/* Access each page of the mapping: write a per-round value into each
+   page of a writable mapping, or read each page of a read-only one */
+
+static void
+populate(char *addr, size_t len, int mapping, char val)
+{
+    volatile char sink;
+    size_t off;
+
+    for (off = 0; off < len; off += pageSize) {
+        if (mapping == M_FILE)
+            sink = addr[off];
+        else
+            addr[off] = val;
+    }
+    (void) sink;
+}
+
+static int
+doAdvice(void *addr, size_t len, int a)
+{
+    struct iovec iov;
+
+    if (!advices[a].viaPidfd)
+        return madvise(addr, len, advices[a].advice);
+
+    iov.iov_base = addr;
+    iov.iov_len = len;
+    return (syscall(SYS_process_madvise, pidfd, &iov, 1,
+                    advices[a].advice, 0) == -1) ? -1 : 0;
+}
+
+static void
+bench(int mapping, int a, const char *file, size_t len, int reps)
+{
+    long rss, lazy, swap, cached, kept, minflt, majflt;
+    double callSecs, touchSecs, t;
+    struct rusage r0, r1;
+    volatile char sink;
+    size_t off;
+    char *addr;
+    int fd, rep, err;
+
+    printf("%-10s %-9s ", mappingNames[mapping], advices[a].name);
+    fflush(stdout);
+
+    fd = -1;
+    if (mapping == M_ANON) {
+        addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    } else {
+        fd = open(file, O_RDWR);
+        if (fd == -1)
+            errExit("open %s", file);
+        addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (addr == MAP_FAILED)
+        errExit("mmap");
+
+    callSecs = touchSecs = 0;
+    minflt = majflt = kept = cached = 0;
+    rss = lazy = swap = 0;
+    err = 0;
+    for (rep = 0; rep < reps; rep++) {
+        populate(addr, len, mapping, (char) (rep + 1));
+
+        t = nowSecs();
+        if (doAdvice(addr, len, a) == -1) {
+            err = errno;
+            break;
+        }
+        callSecs += nowSecs() - t;
+
+        vmaStats(addr, &rss, &lazy, &swap);
+        if (mapping != M_ANON)
+            cached = residentPages(addr, len);
+
+        /* Retouch, counting the pages whose contents survived: an anonymous
+           page that was discarded reads as 0; a file page (whose content
+           is the file's content) always survives */
+
+        getrusage(RUSAGE_SELF, &r0);
+        t = nowSecs();
+        kept = 0;
+        for (off = 0; off < len; off += pageSize) {
+            sink = addr[off];
+            if (mapping == M_FILE || sink == (char) (rep + 1))
+                kept++;
+            if (mapping != M_FILE)
+                addr[off] = (char) (rep + 1);
+        }
+        touchSecs += nowSecs() - t;
+        getrusage(RUSAGE_SELF, &r1);
+        minflt += r1.ru_minflt - r0.ru_minflt;
+        majflt += r1.ru_majflt - r0.ru_majflt;
+    }
+
+    if (err != 0) {
+        printf("%s\n", strerror(err));
+    } else {
+        printf("%9.1f %7.1f %7.1f %7.1f", callSecs / reps * 1e6,
+               rss / 1024.0, lazy / 1024.0, swap / 1024.0);
+        if (mapping != M_ANON)
+            printf(" %7.1f", cached * pageSize / 1048576.0);
+        else
+            printf(" %7s", "-");
+        printf(" %9.2f %8ld %6ld %5.0f%%\n", touchSecs / reps * 1e3,
+               minflt / reps, majflt / reps,
+               100.0 * kept / (len / pageSize));
+    }
+
+    munmap(addr, len);
+    if (fd != -1)
+        close(fd);
+}
+
+/* Convert a comma-separated list of names into a bit mask */
+
+static int
+parseNames(char *str, int n, const char *(*name)(int))
+{
+    char *tok;
+    int mask, j;
+
+    mask = 0;
+    for (tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        for (j = 0; j < n; j++)
+            if (strcmp(tok, name(j)) == 0)
+                break;
+        if (j == n)
+            cmdLineErr("Unknown name: %s\n", tok);
+        mask |= 1 << j;
+    }
+    return mask;
+}
+
+static const char *
+mappingName(int j)
+{
+    return mappingNames[j];
+}
+
+static const char *
+adviceName(int j)
+{
+    return advices[j].name;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int mappings, advMask, reps, opt, m, a, fd;
+    const char *file;
+    size_t len, off;
+    char *buf;
+
+    len = 64;
+    reps = 3;
+    file = "madvise_bench.tmp";
+    mappings = (1 << NMAPPINGS) - 1;
+    advMask = (1 << NADVICES) - 1;
+    while ((opt = getopt(argc, argv, "s:r:f:m:a:")) != -1) {
+        switch (opt) {
+        case 's': len = getInt(optarg, GN_GT_0, "-s");                  break;
+        case 'r': reps = getInt(optarg, GN_GT_0, "-r");                 break;
+        case 'f': file = optarg;                                        break;
+        case 'm': mappings = parseNames(optarg, NMAPPINGS, mappingName); break;
+        case 'a': advMask = parseNames(optarg, NADVICES, adviceName);   break;
+        default:
+            usageErr("%s [-s MiB] [-r reps] [-f file] [-m mapping,...] "
+                     "[-a advice,...]\n", argv[0]);
+        }
+    }
+    len <<= 20;
+    pageSize = sysconf(_SC_PAGESIZE);
+
+    pidfd = syscall(SYS_pidfd_open, getpid(), 0);  /* For process_madvise() */
+
+    /* Create the file for the file mappings */
+
+    if (mappings & ~(1 << M_ANON)) {
+        fd = open(file, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd == -1)
+            errExit("open %s", file);
+        buf = malloc(1024 * 1024);
+        if (buf == NULL)
+            errExit("malloc");
+        memset(buf, 'x', 1024 * 1024);
+        for (off = 0; off < len; off += 1024 * 1024)
+            if (write(fd, buf, 1024 * 1024) != 1024 * 1024)
+                errExit("write");
+        if (fsync(fd) == -1)
+            errExit("fsync");
+        free(buf);
+        close(fd);
+    }
+
+    printf("%ld MiB mappings, %d repetitions\n\n", (long) (len >> 20), reps);
+    printf("%-10s %-9s %9s %7s %7s %7s %7s %9s %8s %6s %6s\n", "mapping",
+           "advice", "call(us)", "RSS", "LazyFr", "Swap", "cache",
+           "touch(ms)", "minflt", "majflt", "kept");
+    printf("%-10s %-9s %9s %7s %7s %7s %7s\n", "", "", "",
+           "(MiB)", "(MiB)", "(MiB)", "(MiB)");
+
+    for (m = 0; m < NMAPPINGS; m++)
+        for (a = 0; a < NADVICES; a++)
+            if ((mappings & (1 << m)) && (advMask & (1 << a)))
+                bench(m, a, file, len, reps);
+
+    if (mappings & ~(1 << M_ANON))
+        unlink(file);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,253 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 50 */
+
+/* t_lock_plan.c
+
+   Demonstrate lock_plan.c: build a plan that locks a "hot" region,
+   locks a sparsely used region on fault, and leaves a "cold" region
+   alone, plus any of the process's own mappings selected by pattern;
+   then check the plan against RLIMIT_MEMLOCK, apply it, and report the
+   residency of each range.
+
+   Usage: t_lock_plan [-H hot-MiB] [-O onfault-MiB] [-C cold-MiB]
+                      [-s pattern[:mode]]... [-w warn-pct] [-l limit-KiB]
+                      [-A]
+
+        -H MiB       Size of the hot region, locked with mlock()
+                     (default: 4)
+        -O MiB       Size of the sparse region, locked with
+                     mlock2(MLOCK_ONFAULT); one page in 16 is touched
+                     after the plan is applied (default: 16)
+        -C MiB       Size of the cold region, which is not in the plan
+                     (default: 32)
+        -s pattern[:mode]
+                     Add the mappings whose pathname in /proc/self/smaps
+                     matches 'pattern' (e.g., "[stack]", "*libc.so*");
+                     'mode' is 'lock' (the default), 'onfault', or
+                     'populate'
+        -w pct       Warn if the plan takes more than 'pct' percent of
+                     RLIMIT_MEMLOCK (default: 80)
+        -l KiB       First set the RLIMIT_MEMLOCK soft limit to 'KiB'
+        -A           Afterward, for comparison, release the plan and call
+                     mlockall(MCL_CURRENT), and show the time taken and
+                     the amount of memory locked
+
+   Try: t_lock_plan -s '*libc.so*' -s '[stack]:onfault'
+        t_lock_plan -l 8192 -H 6 -O 4          # Warns (or fails without
+                                               # CAP_IPC_LOCK)
+        t_lock_plan -A
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <stdint.h>
+#include <time.h>
+#include "lock_plan.h"
+#include "tlpi_hdr.h"
+
+#define MAX_PATTERNS 16
+
+static const char *modeNames[] = { "lock", "onfault", "populate" };
+
+static double
+nowSecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+parseMode(const char *s)
+{
+    int m;
+
+    for (m = LP_LOCK; m <= LP_POPULATE; m++)
+        if (strcmp(s, modeNames[m]) == 0)
+            return m;
+    cmdLineErr("Bad mode: %s\n", s);
+    return -1;                          /* Not reached */
+}
+
+static char *
+mapRegion(size_t len)
+{
+    char *p;
+
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        errExit("mmap");
+    return p;
+}
+
+static void
+printPlan(const struct lockPlan *lp, const long *before)
+{
+    long pageSize, res;
+    int j;
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    printf("%-32s %-8s %10s %10s %10s\n", "range", "mode", "size(KiB)",
+           "res-before", "res-after");
+    for (j = 0; j < lp->n; j++) {
+        res = lpResident(&lp->ranges[j]);
+        printf("%-32.32s %-8s %10zu %10ld %10ld\n", lp->ranges[j].name,
+               modeNames[lp->ranges[j].mode], lp->ranges[j].len / 1024,
+               before[j] * pageSize / 1024, res * pageSize / 1024);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    char *patterns[MAX_PATTERNS];
+    int npat, opt, j, mode, n;
+    size_t hotLen, sparseLen, coldLen;
+    char *hot, *sparse, *cold, *colon;
+    double warnPct, t;
+    long pageSize, *before, res;
+    struct lockPlan lp;
+    struct lockRange coldRange;
+    struct rlimit rl;
+    Boolean compareAll;
+    size_t off;
+
+    hotLen = 4;
+    sparseLen = 16;
+    coldLen = 32;
+    warnPct = 80;
+    npat = 0;
+    compareAll = FALSE;
+    rl.rlim_cur = RLIM_INFINITY;
+
+    while ((opt = getopt(argc, argv, "H:O:C:s:w:l:A")) != -1) {
+        switch (opt) {
+        case 'H': hotLen = getInt(optarg, GN_NONNEG, "-H");             break;
+        case 'O': sparseLen = getInt(optarg, GN_NONNEG, "-O");          break;
+        case 'C': coldLen = getInt(optarg, GN_NONNEG, "-C");            break;
+        case 'w': warnPct = getInt(optarg, GN_GT_0, "-w");              break;
+        case 'l': rl.rlim_cur = getLong(optarg, GN_NONNEG, "-l") * 1024; break;
+        case 'A': compareAll = TRUE;                                    break;
+        case 's':
+            if (npat == MAX_PATTERNS)
+                cmdLineErr("Too many -s options\n");
+            patterns[npat++] = optarg;
+            break;
+        default:
+            usageErr("%s [-H MiB] [-O MiB] [-C MiB] [-s pattern[:mode]]... "
+                     "[-w pct]\n        [-l KiB] [-A]\n", argv[0]);
+        }
+    }
+
+    if (rl.rlim_cur != RLIM_INFINITY) {
+        struct rlimit cur;
+
+        if (getrlimit(RLIMIT_MEMLOCK, &cur) == -1)
+            errExit("getrlimit");
+        rl.rlim_max = cur.rlim_max;
+        if (setrlimit(RLIMIT_MEMLOCK, &rl) == -1)
+            errExit("setrlimit");
+    }
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    hotLen *= 1024 * 1024;
+    sparseLen *= 1024 * 1024;
+    coldLen *= 1024 * 1024;
+    hot = (hotLen > 0) ? mapRegion(hotLen) : NULL;
+    sparse = (sparseLen > 0) ? mapRegion(sparseLen) : NULL;
+    cold = (coldLen > 0) ? mapRegion(coldLen) : NULL;
+
+    if (lpInit(&lp) == -1)
+        errExit("lpInit");
+    if (hot != NULL && lpAdd(&lp, hot, hotLen, LP_LOCK, "hot") == -1)
+        errExit("lpAdd");
+    if (sparse != NULL &&
+            lpAdd(&lp, sparse, sparseLen, LP_ONFAULT, "sparse") == -1)
+        errExit("lpAdd");
+
+    for (j = 0; j < npat; j++) {
+        colon = strrchr(patterns[j], ':');
+        mode = LP_LOCK;
+        if (colon != NULL) {
+            *colon = '\0';
+            mode = parseMode(colon + 1);
+        }
+        n = lpAddSmaps(&lp, patterns[j], mode);
+        if (n == -1)
+            errExit("lpAddSmaps");
+        if (n == 0)
+            printf("No mapping matches '%s'\n", patterns[j]);
+    }
+
+    printf("RLIMIT_MEMLOCK: ");
+    if (lp.limit == SIZE_MAX)
+        printf("unlimited\n");
+    else
+        printf("%zu KiB\n", lp.limit / 1024);
+    printf("Plan locks:     %zu KiB in %d range(s)\n",
+           lp.lockBytes / 1024, lp.n);
+
+    if (lpCheck(&lp, warnPct / 100) == -1)
+        errExit("lpCheck");
+    printf("Locked before:  %zu KiB\n\n", lp.lockedBefore / 1024);
+
+    before = calloc(lp.n > 0 ? lp.n : 1, sizeof(long));
+    if (before == NULL)
+        errExit("calloc");
+    for (j = 0; j < lp.n; j++)
+        before[j] = lpResident(&lp.ranges[j]);
+
+    t = nowSecs();
+    if (lpApply(&lp) == -1)
+        errExit("lpApply: range '%s'", lp.ranges[lp.failed].name);
+    t = nowSecs() - t;
+
+    /* Touch part of the sparse region; only those pages become resident
+       (and locked) */
+
+    if (sparse != NULL)
+        for (off = 0; off < sparseLen; off += 16 * pageSize)
+            sparse[off] = 1;
+
+    printPlan(&lp, before);
+
+    if (cold != NULL) {
+        coldRange.addr = cold;
+        coldRange.len = coldLen;
+        res = lpResident(&coldRange);
+        printf("%-32s %-8s %10zu %10s %10ld\n", "cold", "-",
+               coldLen / 1024, "", res * pageSize / 1024);
+    }
+
+    printf("\nApply time:     %.3f ms\n", t * 1000);
+    printf("Locked after:   %zu KiB\n", lpLockedBytes() / 1024);
+
+    if (compareAll) {
+        lpRelease(&lp);
+        t = nowSecs();
+        if (mlockall(MCL_CURRENT) == -1)
+            errExit("mlockall");
+        t = nowSecs() - t;
+        printf("\nmlockall(MCL_CURRENT): %.3f ms, %zu KiB locked\n",
+               t * 1000, lpLockedBytes() / 1024);
+        munlockall();
+    } else {
+        lpRelease(&lp);
+    }
+
+    free(before);
+    exit(EXIT_SUCCESS);
+}
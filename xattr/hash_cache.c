@@ -0,0 +1,572 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 16 */
+
+/* hash_cache.c
+
+   A cache of the SHA-256 hashes of file contents, kept in an extended
+   attribute of each file, so that a file whose contents haven't changed
+   needn't be read and hashed again.
+
+   hcFileHash() returns the hash of the file open on a descriptor. The
+   hash is cached in the attribute HC_XATTR_NAME, together with a
+   validity key: the file's i-node number, size, last modification time,
+   and last status change time, as they were when the hash was computed.
+   The cached hash is used only if the key matches the file's current
+   attributes. Content changes normally change the modification time; the
+   status change time catches changes that were followed by resetting the
+   modification time (e.g., with utimensat()), since the status change
+   time can't be set explicitly.
+
+   However, setting the attribute itself changes the status change time.
+   So, just before setting the attribute, we record (in the attribute
+   value) the time from CLOCK_REALTIME_COARSE, which can't be later than
+   the status change time that the kernel then gives the file; a status
+   change time no more than HC_CTIME_SLACK_NS later than the recorded
+   time is taken to be the one that resulted from setting the attribute.
+   The interval allows for the coarse clock lagging by up to a clock tick;
+   if the kernel was slower than that to set the attribute, we merely
+   hash the file again next time. (Conversely, a change of the status
+   change time within that interval after the hash was stored goes
+   unnoticed; this is no worse than the timestamp granularity of many
+   filesystems.)
+
+   Where the attribute can't be set (e.g., the filesystem doesn't support
+   user extended attributes, is mounted read-only, or we don't have write
+   permission for the file), and a database pathname was given to
+   hcOpen(), the hash is instead stored in that "sidecar" database, keyed
+   by device and i-node number. The database is a file of fixed-size
+   records, to which new records are appended (with O_APPEND, so that
+   several processes can share the database); it is read into a hash
+   table by hcOpen(), with later records replacing earlier ones for the
+   same file. If the file has accumulated many superseded records,
+   hcClose() rewrites it. (Records for files that have been deleted are
+   never removed, since the database doesn't record pathnames.)
+
+   A file that changes while it is being hashed (as seen by comparing its
+   attributes before and after) yields a hash that is returned to the
+   caller, but not cached.
+
+   The functions may be called by several threads at once.
+
+   This module is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <sys/file.h>
+#include <pthread.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include "hash_cache.h"         /* Declares functions defined here */
+
+#define HC_MAGIC 0x31304348     /* "HC01" (in little-endian order) */
+#define HC_CTIME_SLACK_NS 20000000     /* 20 ms */
+#define READ_BUF_SIZE (64 * 1024)
+#define COMPACT_MIN 1024        /* Don't rewrite smaller databases */
+
+struct hcRecord {               /* Attribute value, or database record */
+    uint32_t magic;             /* HC_MAGIC (0 in an empty table slot) */
+    uint32_t pad;
+    uint64_t dev;               /* Device (database only) */
+    uint64_t ino;               /* Validity key */
+    uint64_t size;
+    int64_t mtimeSec;
+    int64_t ctimeSec;
+    int64_t storedSec;          /* Time at which attribute was set */
+    uint32_t mtimeNsec;
+    uint32_t ctimeNsec;
+    uint32_t storedNsec;
+    uint32_t pad2;
+    unsigned char digest[SHA256_DIGEST_LEN];
+};
+
+struct hashCache {
+    int flags;                  /* HC_* flags given to hcOpen() */
+    char *dbPath;               /* NULL if no database */
+    int dbFd;
+    pthread_mutex_t mtx;        /* Protects the database fields */
+    struct hcRecord *tab;       /* Open-addressing hash table */
+    size_t tabSize;             /* Number of slots (a power of 2) */
+    size_t numRecs;             /* Slots in use */
+    size_t fileRecs;            /* Records in database file */
+    struct hcStats st;          /* Updated atomically */
+};
+
+#define COUNT(hc, field, n) \
+    __atomic_fetch_add(&(hc)->st.field, (n), __ATOMIC_RELAXED)
+
+/* Return the table slot for the file identified by 'dev' and 'ino':
+   either the slot that holds its record, or the empty slot where the
+   record belongs */
+
+static struct hcRecord *
+tabSlot(struct hashCache *hc, uint64_t dev, uint64_t ino)
+{
+    uint64_t h;
+    size_t j;
+
+    h = (ino ^ (dev << 32 | dev >> 32)) * 0x9e3779b97f4a7c15ULL;
+    for (j = h >> 20; ; j++) {
+        j &= hc->tabSize - 1;
+        if (hc->tab[j].magic == 0 ||
+                (hc->tab[j].dev == dev && hc->tab[j].ino == ino))
+            return &hc->tab[j];
+    }
+}
+
+/* Add 'r' to the table, replacing any record for the same file. Returns
+   0 on success, or -1 on error. */
+
+static int
+tabInsert(struct hashCache *hc, const struct hcRecord *r)
+{
+    struct hcRecord *old, *slot;
+    size_t oldSize;
+
+    if (2 * (hc->numRecs + 1) > hc->tabSize) {        /* Grow table */
+        old = hc->tab;
+        oldSize = hc->tabSize;
+        hc->tabSize = (oldSize == 0) ? 1024 : 2 * oldSize;
+        hc->tab = calloc(hc->tabSize, sizeof(struct hcRecord));
+        if (hc->tab == NULL) {
+            hc->tab = old;
+            hc->tabSize = oldSize;
+            return -1;
+        }
+        for (size_t j = 0; j < oldSize; j++)
+            if (old[j].magic == HC_MAGIC)
+                *tabSlot(hc, old[j].dev, old[j].ino) = old[j];
+        free(old);
+    }
+
+    slot = tabSlot(hc, r->dev, r->ino);
+    if (slot->magic == 0)
+        hc->numRecs++;
+    *slot = *r;
+    return 0;
+}
+
+/* Read the whole of the database into the (empty) table. A partial
+   record at the end of the file (left by a crash) is ignored. Returns 0
+   on success, or -1 on error. */
+
+static int
+dbLoad(struct hashCache *hc)
+{
+    struct hcRecord recs[256];
+    ssize_t numRead;
+    off_t off;
+
+    hc->fileRecs = 0;
+    for (off = 0; ; off += numRead) {
+        numRead = pread(hc->dbFd, recs, sizeof(recs), off);
+        if (numRead == -1)
+            return -1;
+        if (numRead < (ssize_t) sizeof(struct hcRecord))
+            break;
+        numRead -= numRead % sizeof(struct hcRecord);
+
+        for (size_t j = 0; j < numRead / sizeof(struct hcRecord); j++) {
+            if (recs[j].magic != HC_MAGIC)
+                continue;
+            if (tabInsert(hc, &recs[j]) == -1)
+                return -1;
+            hc->fileRecs++;
+        }
+    }
+    return 0;
+}
+
+static int
+dbOpen(struct hashCache *hc)
+{
+    hc->dbFd = open(hc->dbPath, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+                    S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    return (hc->dbFd == -1) ? -1 : 0;
+}
+
+/* Add 'r' to the table and append it to the database. The caller holds
+   'hc->mtx'. Returns 0 on success, or -1 on error. */
+
+static int
+dbStore(struct hashCache *hc, const struct hcRecord *r)
+{
+    struct stat sb;
+    ssize_t numWritten;
+    int savedErrno;
+
+    if (tabInsert(hc, r) == -1)
+        return -1;
+
+    /* Holding a shared lock keeps hcClose() (in another process) from
+       replacing the file while we append to it. If the file has been
+       replaced since we opened it (it has no links), open the new one. */
+
+    for (;;) {
+        if (flock(hc->dbFd, LOCK_SH) == -1 || fstat(hc->dbFd, &sb) == -1)
+            return -1;
+        if (sb.st_nlink > 0)
+            break;
+        close(hc->dbFd);
+        if (dbOpen(hc) == -1)
+            return -1;
+    }
+
+    numWritten = write(hc->dbFd, r, sizeof(*r));
+    savedErrno = errno;
+    flock(hc->dbFd, LOCK_UN);
+    if (numWritten != sizeof(*r)) {
+        errno = (numWritten == -1) ? savedErrno : ENOSPC;
+        return -1;
+    }
+    hc->fileRecs++;
+    return 0;
+}
+
+/* If the database holds many superseded records, rewrite it. We reread
+   it first, under an exclusive lock, to pick up records appended by
+   other processes. */
+
+static int
+dbCompact(struct hashCache *hc)
+{
+    char tmpPath[PATH_MAX];
+    struct stat sb;
+    FILE *fp;
+    int ok, savedErrno;
+
+    if (hc->fileRecs < COMPACT_MIN || hc->fileRecs < 2 * hc->numRecs)
+        return 0;
+
+    if (flock(hc->dbFd, LOCK_EX | LOCK_NB) == -1)
+        return (errno == EWOULDBLOCK) ? 0 : -1;         /* Try next time */
+
+    if (fstat(hc->dbFd, &sb) == -1)
+        return -1;
+    if (sb.st_nlink == 0)               /* Someone else compacted it */
+        return 0;
+
+    free(hc->tab);
+    hc->tab = NULL;
+    hc->tabSize = hc->numRecs = 0;
+    if (dbLoad(hc) == -1)
+        return -1;
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", hc->dbPath);
+    fp = fopen(tmpPath, "w");
+    if (fp == NULL)
+        return -1;
+
+    for (size_t j = 0; j < hc->tabSize; j++)
+        if (hc->tab[j].magic == HC_MAGIC)
+            fwrite(&hc->tab[j], sizeof(struct hcRecord), 1, fp);
+
+    ok = !ferror(fp) && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    savedErrno = errno;
+    if (fclose(fp) != 0 && ok) {
+        ok = 0;
+        savedErrno = errno;
+    }
+    if (ok && rename(tmpPath, hc->dbPath) == -1) {
+        ok = 0;
+        savedErrno = errno;
+    }
+    if (!ok) {
+        unlink(tmpPath);
+        errno = savedErrno;
+        return -1;
+    }
+
+    hc->fileRecs = hc->numRecs;
+    return 0;                   /* Lock is released when 'dbFd' is closed */
+}
+
+/* Open a hash cache. 'dbPath' is the pathname of the sidecar database,
+   which is created if necessary; if it is NULL, hashes that can't be
+   stored in extended attributes are not cached. 'flags' is zero or more
+   of the HC_* flags. Returns a pointer to the cache, or NULL on error. */
+
+struct hashCache *
+hcOpen(const char *dbPath, int flags)
+{
+    struct hashCache *hc;
+    int savedErrno;
+
+    hc = calloc(1, sizeof(struct hashCache));
+    if (hc == NULL)
+        return NULL;
+    hc->flags = flags;
+    hc->dbFd = -1;
+    pthread_mutex_init(&hc->mtx, NULL);
+
+    if (dbPath != NULL) {
+        hc->dbPath = strdup(dbPath);
+        if (hc->dbPath == NULL || dbOpen(hc) == -1 || dbLoad(hc) == -1) {
+            savedErrno = errno;
+            hcClose(hc);
+            errno = savedErrno;
+            return NULL;
+        }
+    }
+
+    return hc;
+}
+
+/* Does the validity key in 'r' match the file attributes in 'sb'?
+   'fromXattr' says whether 'r' was obtained from the file's extended
+   attribute (see the comments at the start of this file). */
+
+static int
+keyMatches(const struct hcRecord *r, const struct stat *sb, int fromXattr)
+{
+    long long ns;
+
+    if (r->ino != sb->st_ino || r->size != sb->st_size ||
+            r->mtimeSec != sb->st_mtim.tv_sec ||
+            r->mtimeNsec != sb->st_mtim.tv_nsec)
+        return 0;
+
+    if (r->ctimeSec == sb->st_ctim.tv_sec &&
+            r->ctimeNsec == sb->st_ctim.tv_nsec)
+        return 1;
+
+    if (!fromXattr)
+        return 0;
+
+    ns = (sb->st_ctim.tv_sec - r->storedSec) * 1000000000LL +
+         sb->st_ctim.tv_nsec - (long long) r->storedNsec;
+    return ns >= 0 && ns <= HC_CTIME_SLACK_NS;
+}
+
+/* Look for a valid cached hash of the file open on 'fd', whose attributes
+   are in 'sb'. Returns HC_HIT_XATTR or HC_HIT_DB if one was found (and
+   placed in 'digest'), or 0 if not. */
+
+static int
+lookup(struct hashCache *hc, int fd, const struct stat *sb,
+       unsigned char *digest)
+{
+    struct hcRecord rec, *r;
+    int how;
+
+    if (!(hc->flags & HC_NO_XATTR) &&
+            fgetxattr(fd, HC_XATTR_NAME, &rec, sizeof(rec)) == sizeof(rec) &&
+            rec.magic == HC_MAGIC) {
+        if (keyMatches(&rec, sb, 1)) {
+            memcpy(digest, rec.digest, SHA256_DIGEST_LEN);
+            COUNT(hc, xattrHits, 1);
+            return HC_HIT_XATTR;
+        }
+        COUNT(hc, stale, 1);
+    }
+
+    if (hc->dbFd == -1)
+        return 0;
+
+    how = 0;
+    pthread_mutex_lock(&hc->mtx);
+    if (hc->tabSize > 0) {
+        r = tabSlot(hc, sb->st_dev, sb->st_ino);
+        if (r->magic == HC_MAGIC) {
+            if (keyMatches(r, sb, 0)) {
+                memcpy(digest, r->digest, SHA256_DIGEST_LEN);
+                how = HC_HIT_DB;
+            } else {
+                COUNT(hc, stale, 1);
+            }
+        }
+    }
+    pthread_mutex_unlock(&hc->mtx);
+
+    if (how == HC_HIT_DB)
+        COUNT(hc, dbHits, 1);
+    return how;
+}
+
+/* Compute the hash of the contents of the file open on 'fd'. Returns the
+   number of bytes hashed, or -1 on error. */
+
+static off_t
+hashFile(int fd, unsigned char *digest)
+{
+    struct sha256Ctx c;
+    ssize_t numRead;
+    off_t off;
+    char *buf;
+
+    buf = malloc(READ_BUF_SIZE);
+    if (buf == NULL)
+        return -1;
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    sha256Init(&c);
+    for (off = 0; ; off += numRead) {
+        numRead = pread(fd, buf, READ_BUF_SIZE, off);
+        if (numRead == -1) {
+            if (errno == EINTR) {
+                numRead = 0;
+                continue;
+            }
+            free(buf);
+            return -1;
+        }
+        if (numRead == 0)
+            break;
+        sha256Update(&c, buf, numRead);
+    }
+    sha256Final(&c, digest);
+
+    free(buf);
+    return off;
+}
+
+/* Store 'digest' as the hash of the file open on 'fd', whose attributes
+   (when it was hashed) are in 'sb'. Returns HC_HASHED if the hash was
+   stored, or HC_UNCACHED if not. */
+
+static int
+store(struct hashCache *hc, int fd, const struct stat *sb,
+      const unsigned char *digest)
+{
+    struct hcRecord rec;
+    struct timespec now;
+    int s;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.magic = HC_MAGIC;
+    rec.ino = sb->st_ino;
+    rec.size = sb->st_size;
+    rec.mtimeSec = sb->st_mtim.tv_sec;
+    rec.mtimeNsec = sb->st_mtim.tv_nsec;
+    rec.ctimeSec = sb->st_ctim.tv_sec;
+    rec.ctimeNsec = sb->st_ctim.tv_nsec;
+    memcpy(rec.digest, digest, SHA256_DIGEST_LEN);
+
+    if (!(hc->flags & HC_NO_XATTR)) {
+        clock_gettime(CLOCK_REALTIME_COARSE, &now);
+        rec.storedSec = now.tv_sec;
+        rec.storedNsec = now.tv_nsec;
+        if (fsetxattr(fd, HC_XATTR_NAME, &rec, sizeof(rec), 0) == 0) {
+            COUNT(hc, xattrStores, 1);
+            return HC_HASHED;
+        }
+        rec.storedSec = rec.storedNsec = 0;
+    }
+
+    if (hc->dbFd == -1)
+        return HC_UNCACHED;
+
+    rec.dev = sb->st_dev;
+    pthread_mutex_lock(&hc->mtx);
+    s = dbStore(hc, &rec);
+    pthread_mutex_unlock(&hc->mtx);
+    if (s == -1)
+        return HC_UNCACHED;
+
+    COUNT(hc, dbStores, 1);
+    return HC_HASHED;
+}
+
+/* Place the SHA-256 hash of the contents of the regular file open on
+   'fd' (which must be open for reading) in 'digest' (SHA256_DIGEST_LEN
+   bytes), using the cached hash if there is a valid one, and otherwise
+   computing the hash and caching it. If 'how' is not NULL, it is set to
+   one of the HC_HIT_* or HC_HASHED/HC_UNCACHED values, to say which was
+   done. Returns 0 on success, or -1 on error. */
+
+int
+hcFileHash(struct hashCache *hc, int fd, unsigned char *digest, int *how)
+{
+    struct stat sb, sb2;
+    off_t len;
+    int h;
+
+    if (fstat(fd, &sb) == -1)
+        return -1;
+    if (!S_ISREG(sb.st_mode)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    h = (hc->flags & HC_REHASH) ? 0 : lookup(hc, fd, &sb, digest);
+
+    if (h == 0) {
+        len = hashFile(fd, digest);
+        if (len == -1 || fstat(fd, &sb2) == -1)
+            return -1;
+        COUNT(hc, hashed, 1);
+        COUNT(hc, bytesHashed, len);
+
+        if ((hc->flags & HC_NO_STORE) ||
+                sb2.st_size != sb.st_size ||
+                sb2.st_mtim.tv_sec != sb.st_mtim.tv_sec ||
+                sb2.st_mtim.tv_nsec != sb.st_mtim.tv_nsec ||
+                sb2.st_ctim.tv_sec != sb.st_ctim.tv_sec ||
+                sb2.st_ctim.tv_nsec != sb.st_ctim.tv_nsec)
+            h = HC_UNCACHED;
+        else
+            h = store(hc, fd, &sb, digest);
+
+        if (h == HC_UNCACHED)
+            COUNT(hc, uncached, 1);
+    }
+
+    if (how != NULL)
+        *how = h;
+    return 0;
+}
+
+/* Return the cache's statistics in 'st' */
+
+void
+hcGetStats(struct hashCache *hc, struct hcStats *st)
+{
+    pthread_mutex_lock(&hc->mtx);       /* For the memory barrier */
+    *st = hc->st;
+    pthread_mutex_unlock(&hc->mtx);
+}
+
+/* Close the cache (first rewriting the database, if needed) and free its
+   resources. Returns 0 on success, or -1 if rewriting or closing the
+   database failed. */
+
+int
+hcClose(struct hashCache *hc)
+{
+    int ret, savedErrno;
+
+    ret = 0;
+    if (hc->dbFd >= 0) {
+        ret = dbCompact(hc);
+        savedErrno = errno;
+        if (close(hc->dbFd) == -1 && ret == 0) {
+            ret = -1;
+            savedErrno = errno;
+        }
+        errno = savedErrno;
+    }
+
+    pthread_mutex_destroy(&hc->mtx);
+    free(hc->dbPath);
+    free(hc->tab);
+    free(hc);
+    return ret;
+}
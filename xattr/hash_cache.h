@@ -0,0 +1,62 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 16 */
+
+/* hash_cache.h
+
+   Header file for hash_cache.c.
+*/
+#ifndef HASH_CACHE_H
+#define HASH_CACHE_H            /* Prevent accidental double inclusion */
+
+#include "sha256.h"
+
+#define HC_XATTR_NAME "user.tlpi.sha256"
+
+/* Bit values for hcOpen() 'flags' argument */
+
+#define HC_NO_XATTR     01      /* Don't use extended attributes; use only
+                                   the sidecar database */
+#define HC_NO_STORE     02      /* Don't store newly computed hashes */
+#define HC_REHASH       04      /* Ignore cached hashes (but store the
+                                   newly computed ones) */
+
+/* Values returned via hcFileHash() 'how' argument */
+
+#define HC_HIT_XATTR    1       /* Cached hash, from the xattr */
+#define HC_HIT_DB       2       /* Cached hash, from the database */
+#define HC_HASHED       3       /* Computed, and stored */
+#define HC_UNCACHED     4       /* Computed, but could not be stored (or
+                                   the file changed while being hashed) */
+
+struct hcStats {
+    unsigned long xattrHits;
+    unsigned long dbHits;
+    unsigned long stale;        /* Cached hash found, but key didn't match */
+    unsigned long hashed;       /* Files hashed */
+    unsigned long long bytesHashed;
+    unsigned long xattrStores;
+    unsigned long dbStores;
+    unsigned long uncached;     /* Hashes that could not be stored */
+};
+
+struct hashCache;               /* Opaque; defined in hash_cache.c */
+
+struct hashCache *hcOpen(const char *dbPath, int flags);
+
+int hcFileHash(struct hashCache *hc, int fd, unsigned char *digest,
+               int *how);
+
+void hcGetStats(struct hashCache *hc, struct hcStats *st);
+
+int hcClose(struct hashCache *hc);
+
+#endif
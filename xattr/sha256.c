@@ -0,0 +1,337 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 16 */
+
+/* sha256.c
+
+   The SHA-256 hash function (FIPS 180-4), for hashing file contents (see
+   hash_cache.c). The usual incremental interface is provided:
+
+        sha256Init(&c);
+        sha256Update(&c, data, len);        (any number of times)
+        sha256Final(&c, digest);            (32 bytes)
+
+   or sha256() hashes a single buffer.
+
+   There are two implementations of the compression function, which
+   consumes 64-byte blocks:
+
+        scalar  portable C
+        shani   the x86 SHA extensions (SHA-NI), which perform two rounds
+                (sha256rnds2) and the message schedule (sha256msg1,
+                sha256msg2) in SSE registers; several times faster than
+                the scalar code, where the CPU supports them
+
+   The implementation is chosen at the first call, according to what the
+   CPU supports; sha256SetImpl() can be used to select a particular one
+   (e.g., for benchmarking).
+*/
+#include <string.h>
+#include <errno.h>
+#include "sha256.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_SHANI                      /* Can compile SHA-NI code */
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n)   (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* Each of the following functions updates 'state' with the 'nblocks'
+   64-byte blocks at 'data' */
+
+static void
+blocksScalar(uint32_t *state, const unsigned char *data, size_t nblocks)
+{
+    uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int j;
+
+    for (; nblocks > 0; nblocks--, data += SHA256_BLOCK_LEN) {
+        for (j = 0; j < 16; j++)
+            w[j] = (uint32_t) data[4 * j] << 24 |
+                   (uint32_t) data[4 * j + 1] << 16 |
+                   (uint32_t) data[4 * j + 2] << 8 | data[4 * j + 3];
+        for (j = 16; j < 64; j++)
+            w[j] = w[j - 16] + w[j - 7] +
+                   (ROR(w[j - 15], 7) ^ ROR(w[j - 15], 18) ^
+                    (w[j - 15] >> 3)) +
+                   (ROR(w[j - 2], 17) ^ ROR(w[j - 2], 19) ^ (w[j - 2] >> 10));
+
+        a = state[0]; b = state[1]; c = state[2]; d = state[3];
+        e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+        for (j = 0; j < 64; j++) {
+            t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) +
+                 ((e & f) ^ (~e & g)) + K[j] + w[j];
+            t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) +
+                 ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+#ifdef HAVE_SHANI
+
+/* The SHA-NI instructions keep the working variables in two registers,
+   as (A, B, E, F) and (C, D, G, H). Each group of four rounds adds the
+   round constants to four message words and performs two sha256rnds2
+   instructions; meanwhile, sha256msg1 and sha256msg2 compute the message
+   words for later groups, in four registers used in rotation. */
+
+__attribute__((target("sha,sse4.1")))
+static void
+blocksShani(uint32_t *state, const unsigned char *data, size_t nblocks)
+{
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                         0x0405060700010203ULL);
+    __m128i abef, cdgh, abefSave, cdghSave, msg, tmp, m[4];
+    int j;
+
+    tmp = _mm_loadu_si128((const __m128i *) &state[0]);     /* DCBA */
+    cdgh = _mm_loadu_si128((const __m128i *) &state[4]);    /* HGFE */
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);                     /* CDAB */
+    cdgh = _mm_shuffle_epi32(cdgh, 0x1b);                   /* EFGH */
+    abef = _mm_alignr_epi8(tmp, cdgh, 8);                   /* ABEF */
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xf0);                /* CDGH */
+
+    for (; nblocks > 0; nblocks--, data += SHA256_BLOCK_LEN) {
+        abefSave = abef;
+        cdghSave = cdgh;
+
+        for (j = 0; j < 16; j++) {
+            if (j < 4)
+                m[j] = _mm_shuffle_epi8(_mm_loadu_si128(
+                            (const __m128i *) (data + 16 * j)), bswap);
+
+            msg = _mm_add_epi32(m[j % 4],
+                                _mm_loadu_si128((const __m128i *) &K[4 * j]));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+
+            if (j >= 3 && j < 15) {     /* Words for group j + 1 */
+                tmp = _mm_alignr_epi8(m[j % 4], m[(j + 3) % 4], 4);
+                m[(j + 1) % 4] = _mm_add_epi32(m[(j + 1) % 4], tmp);
+                m[(j + 1) % 4] = _mm_sha256msg2_epu32(m[(j + 1) % 4],
+                                                      m[j % 4]);
+            }
+
+            msg = _mm_shuffle_epi32(msg, 0x0e);
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+
+            if (j >= 1 && j < 13)       /* Start words for group j + 3 */
+                m[(j + 3) % 4] = _mm_sha256msg1_epu32(m[(j + 3) % 4],
+                                                      m[j % 4]);
+        }
+
+        abef = _mm_add_epi32(abef, abefSave);
+        cdgh = _mm_add_epi32(cdgh, cdghSave);
+    }
+
+    tmp = _mm_shuffle_epi32(abef, 0x1b);                    /* FEBA */
+    cdgh = _mm_shuffle_epi32(cdgh, 0xb1);                   /* DCHG */
+    abef = _mm_blend_epi16(tmp, cdgh, 0xf0);                /* DCBA */
+    cdgh = _mm_alignr_epi8(cdgh, tmp, 8);                   /* HGFE */
+    _mm_storeu_si128((__m128i *) &state[0], abef);
+    _mm_storeu_si128((__m128i *) &state[4], cdgh);
+}
+
+static int
+haveShani(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) ||
+            !(ebx & bit_SHA))
+        return 0;
+    return __builtin_cpu_supports("sse4.1");
+}
+#endif
+
+static const struct {
+    const char *name;
+    void (*blocks)(uint32_t *state, const unsigned char *data,
+                   size_t nblocks);
+    int (*supported)(void);             /* NULL means always supported */
+} impls[] = {                           /* In decreasing order of speed */
+#ifdef HAVE_SHANI
+    { "shani",  blocksShani,  haveShani },
+#endif
+    { "scalar", blocksScalar, NULL },
+};
+
+#define NIMPLS (sizeof(impls) / sizeof(impls[0]))
+
+static int currImpl = -1;               /* Index in 'impls', or -1 */
+
+/* Select the fastest implementation supported by the CPU. (If several
+   threads call this at once, they all store the same value.) */
+
+static int
+selectImpl(void)
+{
+    int j;
+
+    for (j = 0; j < NIMPLS - 1; j++)
+        if (impls[j].supported == NULL || impls[j].supported())
+            break;
+    currImpl = j;
+    return j;
+}
+
+void
+sha256Init(struct sha256Ctx *c)
+{
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(c->state, init, sizeof(init));
+    c->len = 0;
+    c->bufLen = 0;
+}
+
+void
+sha256Update(struct sha256Ctx *c, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    size_t n;
+    int impl;
+
+    impl = (currImpl >= 0) ? currImpl : selectImpl();
+    c->len += len;
+
+    /* Complete a partial block left by an earlier call */
+
+    if (c->bufLen > 0) {
+        n = SHA256_BLOCK_LEN - c->bufLen;
+        if (n > len)
+            n = len;
+        memcpy(c->buf + c->bufLen, p, n);
+        c->bufLen += n;
+        p += n;
+        len -= n;
+        if (c->bufLen < SHA256_BLOCK_LEN)
+            return;
+        impls[impl].blocks(c->state, c->buf, 1);
+        c->bufLen = 0;
+    }
+
+    /* Hash whole blocks directly from the caller's buffer */
+
+    n = len / SHA256_BLOCK_LEN;
+    if (n > 0) {
+        impls[impl].blocks(c->state, p, n);
+        p += n * SHA256_BLOCK_LEN;
+        len -= n * SHA256_BLOCK_LEN;
+    }
+
+    memcpy(c->buf, p, len);
+    c->bufLen = len;
+}
+
+/* Pad the message (with a 1 bit, zeros, and the length in bits), and
+   place the digest in 'digest' (SHA256_DIGEST_LEN bytes) */
+
+void
+sha256Final(struct sha256Ctx *c, unsigned char *digest)
+{
+    unsigned char pad[2 * SHA256_BLOCK_LEN];
+    uint64_t bits;
+    size_t n;
+    int j;
+
+    bits = c->len * 8;
+    n = (c->bufLen < 56) ? 56 - c->bufLen : 120 - c->bufLen;
+    memset(pad, 0, n);
+    pad[0] = 0x80;
+    for (j = 0; j < 8; j++)
+        pad[n + j] = bits >> (56 - 8 * j);
+    sha256Update(c, pad, n + 8);
+
+    for (j = 0; j < 8; j++) {
+        digest[4 * j] = c->state[j] >> 24;
+        digest[4 * j + 1] = c->state[j] >> 16;
+        digest[4 * j + 2] = c->state[j] >> 8;
+        digest[4 * j + 3] = c->state[j];
+    }
+}
+
+void
+sha256(const void *data, size_t len, unsigned char *digest)
+{
+    struct sha256Ctx c;
+
+    sha256Init(&c);
+    sha256Update(&c, data, len);
+    sha256Final(&c, digest);
+}
+
+/* Return the name of the implementation in use */
+
+const char *
+sha256Impl(void)
+{
+    return impls[currImpl >= 0 ? currImpl : selectImpl()].name;
+}
+
+/* Use the implementation 'name', or, if 'name' is NULL, the fastest one
+   supported by the CPU. Returns 0 on success, or -1 with errno set to
+   EINVAL if there is no such implementation in this build, or ENOTSUP
+   if the CPU does not support it. */
+
+int
+sha256SetImpl(const char *name)
+{
+    int j;
+
+    if (name == NULL) {
+        selectImpl();
+        return 0;
+    }
+
+    for (j = 0; j < NIMPLS; j++) {
+        if (strcmp(name, impls[j].name) == 0) {
+            if (impls[j].supported != NULL && !impls[j].supported()) {
+                errno = ENOTSUP;
+                return -1;
+            }
+            currImpl = j;
+            return 0;
+        }
+    }
+
+    errno = EINVAL;
+    return -1;
+}
@@ -0,0 +1,45 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU Lesser General Public License as published   *
+* by the Free Software Foundation, either version 3 or (at your option)   *
+* any later version. This program is distributed without any warranty.    *
+* See the files COPYING.lgpl-v3 and COPYING.gpl-v3 for details.           *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 16 */
+
+/* sha256.h
+
+   Header file for sha256.c.
+*/
+#ifndef SHA256_H
+#define SHA256_H                /* Prevent accidental double inclusion */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_LEN 32
+#define SHA256_BLOCK_LEN 64
+
+struct sha256Ctx {
+    uint32_t state[8];
+    uint64_t len;                       /* Total bytes hashed so far */
+    unsigned char buf[SHA256_BLOCK_LEN];    /* Partial block */
+    size_t bufLen;
+};
+
+void sha256Init(struct sha256Ctx *c);
+
+void sha256Update(struct sha256Ctx *c, const void *data, size_t len);
+
+void sha256Final(struct sha256Ctx *c, unsigned char *digest);
+
+void sha256(const void *data, size_t len, unsigned char *digest);
+
+const char *sha256Impl(void);
+
+int sha256SetImpl(const char *name);
+
+#endif
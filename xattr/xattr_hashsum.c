@@ -0,0 +1,220 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 16 */
+
+/* xattr_hashsum.c
+
+   Print the SHA-256 hashes of files, like sha256sum(1), but cache each
+   hash in an extended attribute of the file (see hash_cache.c), so that
+   files that haven't changed since the previous run aren't read again.
+
+   Usage: xattr_hashsum [-t nthreads] [-d db-file] [-x] [-n] [-f]
+                        [-i impl] [-s] path...
+
+        -t nthreads  Number of threads (default: one per CPU)
+        -d db-file   Sidecar database, for files whose hashes can't be
+                     stored in extended attributes
+        -x           Don't use extended attributes (use only -d)
+        -n           Don't store new hashes
+        -f           Ignore cached hashes (and store new ones)
+        -i impl      SHA-256 implementation: "shani" or "scalar"
+                     (default: the fastest that the CPU supports)
+        -s           Write statistics to stderr
+
+   Each 'path' may be a regular file or a directory; directories are
+   traversed by treeWalk() (dirs_links/tree_walk.c), which calls us from
+   several threads, so files needing to be hashed are hashed in
+   parallel. Symbolic links and other non-regular files are skipped.
+
+   The output is in the format of sha256sum, so it can be checked with
+   "sha256sum -c". Each thread accumulates output in its own buffer,
+   so lines from different threads are never interleaved.
+
+   Try (the second run should read no file contents):
+
+        xattr_hashsum -s /usr/lib > /dev/null
+        xattr_hashsum -s /usr/lib > /dev/null
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <time.h>
+#include "hash_cache.h"
+#include "tree_walk.h"
+#include "tlpi_hdr.h"
+
+#define MAX_THREADS 1024
+#define OUT_BUF_SIZE (64 * 1024)
+
+struct hashThread {             /* Per-thread state */
+    char *out;                  /* Output buffer */
+    size_t outLen;
+    long files;
+    long errors;
+    char pad[64];
+};
+
+static struct hashThread *threads;
+static struct hashCache *hc;
+
+static void
+flushOut(struct hashThread *ht)
+{
+    if (ht->outLen > 0 && write(STDOUT_FILENO, ht->out, ht->outLen) !=
+            ht->outLen)
+        errExit("write");
+    ht->outLen = 0;
+}
+
+static int
+hashEntry(const struct twEntry *ent, int flag, void *arg)
+{
+    struct hashThread *ht = &threads[ent->thread];
+    unsigned char digest[SHA256_DIGEST_LEN];
+    size_t len;
+    char *p;
+    int fd, s, j;
+
+    if (flag != TW_F || ent->type != S_IFREG)
+        return 0;
+
+    fd = (ent->dirFd == -1) ?
+            open(ent->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC) :
+            openat(ent->dirFd, ent->name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "%s: %s\n", ent->path, strerror(errno));
+        ht->errors++;
+        return 0;
+    }
+
+    s = hcFileHash(hc, fd, digest, NULL);
+    close(fd);
+    if (s == -1) {
+        fprintf(stderr, "%s: %s\n", ent->path, strerror(errno));
+        ht->errors++;
+        return 0;
+    }
+    ht->files++;
+
+    /* Output "<digest>  <path>\n" */
+
+    len = strlen(ent->path);
+    if (ht->outLen + 2 * SHA256_DIGEST_LEN + len + 3 > OUT_BUF_SIZE)
+        flushOut(ht);
+    if (2 * SHA256_DIGEST_LEN + len + 3 > OUT_BUF_SIZE)
+        fatal("Pathname too long");
+
+    p = ht->out + ht->outLen;
+    for (j = 0; j < SHA256_DIGEST_LEN; j++) {
+        *p++ = "0123456789abcdef"[digest[j] >> 4];
+        *p++ = "0123456789abcdef"[digest[j] & 0xf];
+    }
+    *p++ = ' ';
+    *p++ = ' ';
+    memcpy(p, ent->path, len);
+    p[len] = '\n';
+    ht->outLen = p + len + 1 - ht->out;
+    return 0;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-t nthreads] [-d db-file] [-x] [-n] [-f] "
+            "[-i impl] [-s] path...\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct timespec start, end;
+    struct hcStats st;
+    const char *dbPath, *impl;
+    long files, errors;
+    int opt, nthreads, flags, j;
+    Boolean stats;
+    double secs;
+
+    nthreads = 0;
+    dbPath = NULL;
+    impl = NULL;
+    flags = 0;
+    stats = FALSE;
+    while ((opt = getopt(argc, argv, "t:d:xnfi:s")) != -1) {
+        switch (opt) {
+        case 't': nthreads = getInt(optarg, GN_GT_0, "nthreads");       break;
+        case 'd': dbPath = optarg;                                      break;
+        case 'x': flags |= HC_NO_XATTR;                                 break;
+        case 'n': flags |= HC_NO_STORE;                                 break;
+        case 'f': flags |= HC_REHASH;                                   break;
+        case 'i': impl = optarg;                                        break;
+        case 's': stats = TRUE;                                         break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usageError(argv[0]);
+
+    if (impl != NULL && sha256SetImpl(impl) == -1)
+        errExit("sha256SetImpl");
+
+    if (nthreads == 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0 || nthreads > MAX_THREADS)
+        nthreads = 1;
+
+    threads = calloc(nthreads, sizeof(struct hashThread));
+    if (threads == NULL)
+        errExit("calloc");
+    for (j = 0; j < nthreads; j++) {
+        threads[j].out = malloc(OUT_BUF_SIZE);
+        if (threads[j].out == NULL)
+            errExit("malloc");
+    }
+
+    hc = hcOpen(dbPath, flags);
+    if (hc == NULL)
+        errExit("hcOpen");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (j = optind; j < argc; j++)
+        if (treeWalk(argv[j], nthreads, 0, 0, hashEntry, NULL) == -1)
+            errMsg("treeWalk: %s", argv[j]);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    files = errors = 0;
+    for (j = 0; j < nthreads; j++) {
+        flushOut(&threads[j]);
+        files += threads[j].files;
+        errors += threads[j].errors;
+    }
+
+    hcGetStats(hc, &st);
+    if (hcClose(hc) == -1)
+        errMsg("hcClose");
+
+    if (stats) {
+        secs = (end.tv_sec - start.tv_sec) +
+               (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "%ld files (%ld errors); cached: %lu from xattrs, "
+                "%lu from database, %lu stale\n", files, errors,
+                st.xattrHits, st.dbHits, st.stale);
+        fprintf(stderr, "hashed: %lu files, %.1f MiB (%s); stored: %lu in "
+                "xattrs, %lu in database, %lu not stored\n", st.hashed,
+                st.bytesHashed / 1048576.0, sha256Impl(), st.xattrStores,
+                st.dbStores, st.uncached);
+        fprintf(stderr, "%d thread(s); %.3f s\n", nthreads, secs);
+    }
+
+    exit((errors > 0) ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,410 @@
+/*************************************************************************\
+*                  Copyright (C) Michael Kerrisk, 2019.                   *
+*                                                                         *
+* This program is free software. You may use, modify, and redistribute it *
+* under the terms of the GNU General Public License as published by the   *
+* Free Software Foundation, either version 3 or (at your option) any      *
+* later version. This program is distributed without any warranty.  See   *
+* the file COPYING.gpl-v3 for details.                                    *
+\*************************************************************************/
+
+/* Supplementary program for Chapter 16 */
+
+/* xattr_scan.c
+
+   Report the extended attributes (or just the file capabilities) of every
+   file in a directory tree, using several threads.
+
+   Usage: xattr_scan [-t nthreads] [-c | -n name...] [-b] dir-path
+
+        -t nthreads  Number of threads (default: one per CPU)
+        -c           Report only file capabilities (security.capability)
+        -n name      Report only the attribute 'name' (may be repeated)
+        -b           Write a binary stream instead of CSV (see below)
+
+   The tree is traversed by treeWalk() (dirs_links/tree_walk.c).
+   Symbolic links are not followed, and the attributes of the links
+   themselves are reported.
+
+   xattr_view.c calls listxattr() and then, for each name, getxattr()
+   twice: once to learn the size of the value, and once to fetch it.
+   This program avoids most of those calls:
+
+     * Each thread has buffers large enough for any attribute value
+       (XATTR_SIZE_MAX bytes) and, initially, for a large list of names,
+       so that each value is fetched by a single call.
+
+     * With -c or -n, the names are known, so listxattr() is not called:
+       each file costs one getxattr() call per name, which fails with
+       ENODATA for the (usual) file that doesn't have the attribute.
+
+   The output is in CSV format, one line per attribute:
+
+        "path","name","value"
+
+   where the value is shown as text if it is printable, and otherwise in
+   hexadecimal, prefixed by "0x". With -c, lines are instead:
+
+        "path",permitted,inheritable,effective,rootid
+
+   where 'permitted' and 'inheritable' are 64-bit hexadecimal masks,
+   'effective' is 0 or 1, and 'rootid' is the root user ID for a
+   namespaced (version 3) capability, or -1.
+
+   With -b, each attribute is instead written as a record consisting of
+   three 32-bit lengths in host byte order (path, name, value), followed
+   by the path, name, and value, without terminating null bytes.
+
+   Each thread accumulates output in its own buffer, which it writes
+   (with a single write()) when it is nearly full, so records from
+   different threads are never interleaved.
+
+   Summary counts are written to stderr at the end.
+
+   This program is Linux-specific.
+*/
+#define _GNU_SOURCE
+#include <sys/xattr.h>
+#include <linux/capability.h>
+#include <linux/limits.h>
+#include <endian.h>
+#include <stdint.h>
+#include <time.h>
+#include "tree_walk.h"
+#include "tlpi_hdr.h"
+
+#define MAX_THREADS 1024
+#define MAX_NAMES 16
+#define OUT_BUF_SIZE (256 * 1024)
+#define CAP_XATTR "security.capability"
+
+struct scanThread {             /* Per-thread state */
+    char *value;                /* XATTR_SIZE_MAX bytes */
+    char *list;                 /* Result of listxattr() */
+    size_t listSize;
+    char *out;                  /* Output buffer */
+    size_t outLen;
+    long files;                 /* Statistics */
+    long filesWithAttrs;
+    long attrs;
+    long calls;                 /* listxattr() + getxattr() calls */
+    char pad[64];
+};
+
+static struct scanThread *threads;
+static Boolean capsOnly;
+static Boolean binary;
+static const char *names[MAX_NAMES];
+static int numNames;
+
+static void
+flushOut(struct scanThread *st)
+{
+    if (st->outLen > 0 && write(STDOUT_FILENO, st->out, st->outLen) !=
+            st->outLen)
+        errExit("write");
+    st->outLen = 0;
+}
+
+/* Make room for 'len' more bytes of output, returning a pointer to them */
+
+static char *
+outSpace(struct scanThread *st, size_t len)
+{
+    if (st->outLen + len > OUT_BUF_SIZE)
+        flushOut(st);
+    if (len > OUT_BUF_SIZE)
+        fatal("Record too large");
+    return st->out + st->outLen;
+}
+
+static void
+outBytes(struct scanThread *st, const void *buf, size_t len)
+{
+    memcpy(outSpace(st, len), buf, len);
+    st->outLen += len;
+}
+
+/* Append a CSV field: 'len' bytes of 'buf', quoted if 'quote' is TRUE,
+   with any double quotes doubled */
+
+static void
+outField(struct scanThread *st, const char *buf, size_t len, Boolean quote)
+{
+    char *p;
+    size_t j;
+
+    p = outSpace(st, 2 * len + 3);
+    if (quote)
+        *p++ = '"';
+    for (j = 0; j < len; j++) {
+        if (buf[j] == '"')
+            *p++ = '"';
+        *p++ = buf[j];
+    }
+    if (quote)
+        *p++ = '"';
+    st->outLen = p - st->out;
+}
+
+static void
+outAttr(struct scanThread *st, const char *path, const char *name,
+        const char *value, size_t len)
+{
+    char hex[3];
+    uint32_t hdr[3];
+    Boolean printable;
+    size_t j;
+
+    st->attrs++;
+
+    if (binary) {
+        hdr[0] = strlen(path);
+        hdr[1] = strlen(name);
+        hdr[2] = len;
+        outSpace(st, sizeof(hdr) + hdr[0] + hdr[1] + hdr[2]);
+        outBytes(st, hdr, sizeof(hdr));
+        outBytes(st, path, hdr[0]);
+        outBytes(st, name, hdr[1]);
+        outBytes(st, value, hdr[2]);
+        return;
+    }
+
+    /* Treat a value with a single trailing null byte as a string */
+
+    printable = TRUE;
+    for (j = 0; j < len && printable; j++)
+        if ((value[j] < 0x20 || value[j] > 0x7e) &&
+                !(value[j] == '\0' && j == len - 1))
+            printable = FALSE;
+
+    outField(st, path, strlen(path), TRUE);
+    outBytes(st, ",", 1);
+    outField(st, name, strlen(name), TRUE);
+    outBytes(st, ",", 1);
+    if (printable) {
+        outField(st, value, (len > 0 && value[len - 1] == '\0') ?
+                                len - 1 : len, TRUE);
+    } else {
+        outBytes(st, "0x", 2);
+        for (j = 0; j < len; j++) {
+            snprintf(hex, sizeof(hex), "%02x", (unsigned char) value[j]);
+            outBytes(st, hex, 2);
+        }
+    }
+    outBytes(st, "\n", 1);
+}
+
+/* Decode a security.capability value, in the format of struct
+   vfs_ns_cap_data */
+
+static void
+outCaps(struct scanThread *st, const char *path, const char *value,
+        size_t len)
+{
+    struct vfs_ns_cap_data cd;
+    uint64_t perm, inh;
+    uint32_t magic;
+    long long rootid;
+    char buf[128];
+    int n;
+
+    memset(&cd, 0, sizeof(cd));
+    memcpy(&cd, value, (len < sizeof(cd)) ? len : sizeof(cd));
+    magic = le32toh(cd.magic_etc);
+
+    switch (magic & VFS_CAP_REVISION_MASK) {
+    case VFS_CAP_REVISION_1:
+        if (len != XATTR_CAPS_SZ_1)
+            goto bad;
+        perm = le32toh(cd.data[0].permitted);
+        inh = le32toh(cd.data[0].inheritable);
+        rootid = -1;
+        break;
+    case VFS_CAP_REVISION_2:
+    case VFS_CAP_REVISION_3:
+        if (len != XATTR_CAPS_SZ_2 && len != XATTR_CAPS_SZ_3)
+            goto bad;
+        perm = le32toh(cd.data[0].permitted) |
+               (uint64_t) le32toh(cd.data[1].permitted) << 32;
+        inh = le32toh(cd.data[0].inheritable) |
+              (uint64_t) le32toh(cd.data[1].inheritable) << 32;
+        rootid = (len == XATTR_CAPS_SZ_3) ?
+                        (long long) le32toh(cd.rootid) : -1;
+        break;
+    default:
+        goto bad;
+    }
+
+    st->attrs++;
+    outField(st, path, strlen(path), TRUE);
+    n = snprintf(buf, sizeof(buf), ",%016llx,%016llx,%d,%lld\n",
+                 (unsigned long long) perm, (unsigned long long) inh,
+                 (magic & VFS_CAP_FLAGS_EFFECTIVE) != 0, rootid);
+    outBytes(st, buf, n);
+    return;
+
+bad:
+    fprintf(stderr, "%s: malformed %s (%zu bytes)\n", path, CAP_XATTR, len);
+}
+
+/* Fetch the attribute 'name' of 'path', and output it. Return 1 if the
+   file has the attribute, otherwise 0. */
+
+static int
+getAttr(struct scanThread *st, const char *path, const char *name)
+{
+    ssize_t len;
+
+    st->calls++;
+    len = lgetxattr(path, name, st->value, XATTR_SIZE_MAX);
+    if (len == -1) {
+        if (errno != ENODATA && errno != ENOTSUP && errno != ENOENT)
+            fprintf(stderr, "%s: lgetxattr %s: %s\n", path, name,
+                    strerror(errno));
+        return 0;
+    }
+
+    if (capsOnly && !binary)
+        outCaps(st, path, st->value, len);
+    else
+        outAttr(st, path, name, st->value, len);
+    return 1;
+}
+
+/* List the attribute names of 'path' into 'st->list', returning their
+   total length, or -1 on error */
+
+static ssize_t
+listAttrs(struct scanThread *st, const char *path)
+{
+    ssize_t len;
+    char *p;
+
+    for (;;) {
+        st->calls++;
+        len = llistxattr(path, st->list, st->listSize);
+        if (len != -1 || errno != ERANGE)
+            break;
+
+        /* Rare: the list didn't fit; ask for its size, and retry */
+
+        st->calls++;
+        len = llistxattr(path, NULL, 0);
+        if (len == -1)
+            break;
+        p = realloc(st->list, len);
+        if (p == NULL)
+            errExit("realloc");
+        st->list = p;
+        st->listSize = len;
+    }
+
+    if (len == -1 && errno != ENOTSUP && errno != ENOENT)
+        fprintf(stderr, "%s: llistxattr: %s\n", path, strerror(errno));
+    return len;
+}
+
+static int
+scanFile(const struct twEntry *ent, int flag, void *arg)
+{
+    struct scanThread *st = &threads[ent->thread];
+    ssize_t len;
+    char *name;
+    int j, found;
+
+    /* A TW_DNR directory has already been reported as TW_D */
+
+    if (flag == TW_NS || flag == TW_DNR)
+        return 0;
+    st->files++;
+
+    found = 0;
+    if (capsOnly) {
+        if (ent->type == S_IFREG)       /* Only regular files have them */
+            found = getAttr(st, ent->path, CAP_XATTR);
+    } else if (numNames > 0) {
+        for (j = 0; j < numNames; j++)
+            found |= getAttr(st, ent->path, names[j]);
+    } else {
+        len = listAttrs(st, ent->path);
+        for (name = st->list; len > 0 && name < st->list + len;
+                name += strlen(name) + 1)
+            found |= getAttr(st, ent->path, name);
+    }
+
+    if (found)
+        st->filesWithAttrs++;
+    return 0;
+}
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-t nthreads] [-c | -n name...] [-b] "
+            "dir-path\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct timespec start, end;
+    long files, withAttrs, attrs, calls;
+    int opt, nthreads, j;
+
+    nthreads = 0;
+    while ((opt = getopt(argc, argv, "t:cn:b")) != -1) {
+        switch (opt) {
+        case 't': nthreads = getInt(optarg, GN_GT_0, "nthreads");       break;
+        case 'c': capsOnly = TRUE;                                      break;
+        case 'b': binary = TRUE;                                        break;
+        case 'n':
+            if (numNames == MAX_NAMES)
+                cmdLineErr("At most %d names\n", MAX_NAMES);
+            names[numNames++] = optarg;
+            break;
+        default:  usageError(argv[0]);
+        }
+    }
+    if (optind + 1 != argc || (capsOnly && numNames > 0))
+        usageError(argv[0]);
+
+    if (nthreads == 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0 || nthreads > MAX_THREADS)
+        nthreads = 1;
+
+    threads = calloc(nthreads, sizeof(struct scanThread));
+    if (threads == NULL)
+        errExit("calloc");
+    for (j = 0; j < nthreads; j++) {
+        threads[j].value = malloc(XATTR_SIZE_MAX);
+        threads[j].listSize = 4096;
+        threads[j].list = malloc(threads[j].listSize);
+        threads[j].out = malloc(OUT_BUF_SIZE);
+        if (threads[j].value == NULL || threads[j].list == NULL ||
+                threads[j].out == NULL)
+            errExit("malloc");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (treeWalk(argv[optind], nthreads, 0, 0, scanFile, NULL) == -1)
+        errExit("treeWalk");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    files = withAttrs = attrs = calls = 0;
+    for (j = 0; j < nthreads; j++) {
+        flushOut(&threads[j]);
+        files += threads[j].files;
+        withAttrs += threads[j].filesWithAttrs;
+        attrs += threads[j].attrs;
+        calls += threads[j].calls;
+    }
+
+    fprintf(stderr, "%ld files, %ld with attributes, %ld attributes; "
+            "%ld xattr calls; %d thread(s); %.3f s\n", files, withAttrs,
+            attrs, calls, nthreads, (end.tv_sec - start.tv_sec) +
+            (end.tv_nsec - start.tv_nsec) / 1e9);
+    exit(EXIT_SUCCESS);
+}